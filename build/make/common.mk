@@ -1,8 +1,17 @@
 default: all
 
+COMMA := ,
+
 export MAKEFILES_PATH ?= $(TREMO_SDK_PATH)/build/make
 export SCRIPTS_PATH ?= $(TREMO_SDK_PATH)/build/scripts
-export OUT_DIR ?= out
+# Build profiles, make PROFILE=<profile>, each one built in its own directory:
+#   release       the flags of the project, in out
+#   release_lto   link time optimisation across the SDK and the application
+#   release_fast  the files of FAST_SOURCES at FAST_CFLAGS, the others as release
+export PROFILE ?= release
+PROFILES := release release_lto release_fast
+PROFILE_OUT_DIR = $(if $(filter release,$(1)),out,out/$(1))
+export OUT_DIR ?= $(call PROFILE_OUT_DIR,$(PROFILE))
 export VIEW
 export PYTHON = python
 export HOST_ARCH := Cortex-M4F
@@ -30,6 +39,20 @@ include $(MAKEFILES_PATH)/gen_3rd_project.mk
 
 SIZE:="$(TOOLCHAIN_PATH)$(TOOLCHAIN_PREFIX)size$(EXECUTABLE_SUFFIX)"
 
+# Radio interrupt, SPI, frame crypto and timer paths
+FAST_SOURCES ?= radio.c sx126x.c sx1262-board.c LoRaMacCrypto.c cmac.c timer.c
+FAST_CFLAGS ?= $(COMPILER_SPECIFIC_FAST_CFLAGS)
+
+ifeq ($(PROFILE),release_lto)
+PROFILE_CFLAGS := $(COMPILER_SPECIFIC_RELEASE_LTO_CFLAGS)
+# The code is generated at link time, with the optimisation and FPU of the project
+PROFILE_LDFLAGS := $(COMPILER_SPECIFIC_RELEASE_LTO_LDFLAGS) $(filter -O% -mfpu=% -mfloat-abi=%,$($(PROJECT)_CFLAGS))
+else ifeq ($(PROFILE),release_fast)
+PROFILE_FAST_SOURCES := $(FAST_SOURCES)
+else ifneq ($(PROFILE),release)
+$(error Unknown PROFILE $(PROFILE), one of $(PROFILES))
+endif
+
 ##################################################################################################
 $(PROJECT)_INCLUDES := $(addprefix -I ,$($(PROJECT)_INC_PATH))
 
@@ -39,15 +62,45 @@ C_SOURCES := $(filter %.c,$($(PROJECT)_SOURCE))
 CXX_SOURCES := $(filter %.cpp,$($(PROJECT)_SOURCE))
 S_SOURCES := $(filter %.s %.S,$($(PROJECT)_SOURCE))
 
+# The SDK sources are built once per configuration into archives shared by
+# the builds with the same flags and SDK sources, in a directory named after
+# their hash. SDK_CACHE=0 builds them in OUT_DIR with the application.
+SDK_CACHE ?= 1
+SDK_CACHE_DIR ?= $(TREMO_SDK_PATH)/out/sdk
+ifeq ($(SDK_CACHE),1)
+SDK_C_SOURCES := $(filter $(TREMO_SDK_PATH)/%,$(C_SOURCES))
+else
+SDK_C_SOURCES :=
+endif
+C_SOURCES := $(filter-out $(SDK_C_SOURCES),$(C_SOURCES))
+
+SDK_CACHE_KEY := $(CC) $(COMMON_CFLAGS) $(abspath $($(PROJECT)_INC_PATH)) $($(PROJECT)_DEFINES) $($(PROJECT)_CFLAGS) \
+                 $(PROFILE_CFLAGS) $(PROFILE_FAST_SOURCES) $(FAST_CFLAGS) $(sort $(SDK_C_SOURCES))
+SDK_LIB_DIR := $(SDK_CACHE_DIR)/$(if $(SDK_C_SOURCES),$(shell echo '$(SDK_CACHE_KEY)' | md5sum | cut -c1-12))
+
+# lora/mac/region/Region.c is in the lora_mac_region component
+SDK_COMPONENT = $(subst /,_,$(patsubst $(TREMO_SDK_PATH)/%/,%,$(dir $(1))))
+SDK_COMPONENTS := $(sort $(foreach src,$(SDK_C_SOURCES),$(call SDK_COMPONENT,$(src))))
+SDK_LIBS := $(foreach component,$(SDK_COMPONENTS),$(SDK_LIB_DIR)/lib$(component).a)
+
 $(PROJECT)_C_OBJ := $(patsubst %.c,%.o,$(C_SOURCES))
 $(PROJECT)_CXX_OBJ := $(patsubst %.cpp,%.o,$(CXX_SOURCES))
 $(PROJECT)_S_OBJ := $(patsubst %.S,%.o,$(S_SOURCES:.s=.o))
 $(PROJECT)_PACK_OBJ := $($(PROJECT)_C_OBJ) $($(PROJECT)_CXX_OBJ) $($(PROJECT)_S_OBJ)
 
 define BUILD_C_PROCESS
-$(OUT_DIR)/$(notdir $(2:.c=.o)): $(2)
+$(3)/$(notdir $(2:.c=.o)): $(2)
 	$(VIEW)echo Compiling $(notdir $(2))...
-	$(VIEW)$(CC) $$(COMMON_CFLAGS) $$($(1)_INCLUDES) $$($(1)_DEFINES) $$($(1)_CFLAGS) $$< -o $$@
+	$(VIEW)mkdir -p $$(@D)
+	$(VIEW)$(CC) $$(COMMON_CFLAGS) $$($(1)_INCLUDES) $$($(1)_DEFINES) $$($(1)_CFLAGS) $$(PROFILE_CFLAGS) $$(if $$(filter $(notdir $(2)),$$(PROFILE_FAST_SOURCES)),$$(FAST_CFLAGS)) $(COMPILER_SPECIFIC_DEPS_FLAG) $$< -o $$@
+endef
+
+# gcc-ar keeps the symbols of the LTO objects
+define BUILD_SDK_LIB_PROCESS
+$(SDK_LIB_DIR)/lib$(1).a: $(foreach src,$(2),$(SDK_LIB_DIR)/$(1)/$(notdir $(src:.c=.o)))
+	$(VIEW)echo Archiving lib$(1).a...
+	$(VIEW)rm -f $$@
+	$(VIEW)$(GCC_AR) $(COMPILER_SPECIFIC_ARFLAGS_ADD) $$@ $$^
 endef
 
 define BUILD_CXX_PROCESS
@@ -62,13 +115,21 @@ $(OUT_DIR)/$(notdir $(patsubst %.S,%.o,$(1:.s=.o))): $(1)
 endef
 
 $(foreach src,$(S_SOURCES),$(eval $(call BUILD_ASM_PROCESS,$(src))))
-$(foreach src,$(C_SOURCES),$(eval $(call BUILD_C_PROCESS,$(PROJECT),$(src))))
+$(foreach src,$(C_SOURCES),$(eval $(call BUILD_C_PROCESS,$(PROJECT),$(src),$(OUT_DIR))))
+$(foreach src,$(SDK_C_SOURCES),$(eval $(call BUILD_C_PROCESS,$(PROJECT),$(src),$(SDK_LIB_DIR)/$(call SDK_COMPONENT,$(src)))))
+$(foreach component,$(SDK_COMPONENTS),$(eval $(call BUILD_SDK_LIB_PROCESS,$(component),$(foreach src,$(SDK_C_SOURCES),$(if $(filter $(component),$(call SDK_COMPONENT,$(src))),$(src))))))
+
+# Headers of the objects built, from the -MD dependency files
+-include $(wildcard $(OUT_DIR)/*.d $(SDK_LIB_DIR)/*/*.d)
 $(foreach src,$(CXX_SOURCES),$(eval $(call BUILD_CXX_PROCESS,$(PROJECT),$(src))))
 
 # flash settings
 TREMO_LOADER := $(SCRIPTS_PATH)/tremo_loader.py
+MEMREPORT := $(SCRIPTS_PATH)/memreport.py
 SERIAL_PORT        ?= /dev/ttyUSB0
 SERIAL_BAUDRATE    ?= 921600
+# eg. --skip-unchanged
+SERIAL_FLASH_FLAGS ?=
 $(PROJECT)_ADDRESS ?= 0x08000000
 
 ##################################################################################################
@@ -80,7 +141,7 @@ all: $(OUT_DIR)/$(PROJECT)$(BIN_OUTPUT_SUFFIX)
 	$(VIEW)echo Build completed.
 	$(SIZE) $(OUT_DIR)/$(PROJECT)$(LINK_OUTPUT_SUFFIX)
 	$(VIEW)echo "Please run 'make flash' or the following command to download the app"
-	@echo $(PYTHON) $(TREMO_LOADER) -p $(SERIAL_PORT) -b $(SERIAL_BAUDRATE) flash $($(PROJECT)_ADDRESS) $(OUT_DIR)/$(PROJECT)$(BIN_OUTPUT_SUFFIX)
+	@echo $(PYTHON) $(TREMO_LOADER) -p $(SERIAL_PORT) -b $(SERIAL_BAUDRATE) flash $(SERIAL_FLASH_FLAGS) $($(PROJECT)_ADDRESS) $(OUT_DIR)/$(PROJECT)$(BIN_OUTPUT_SUFFIX)
 endif    
 
 $(OUT_DIR)/$(PROJECT)$(BIN_OUTPUT_SUFFIX): $(OUT_DIR)/$(PROJECT)$(LINK_OUTPUT_SUFFIX)
@@ -88,16 +149,47 @@ $(OUT_DIR)/$(PROJECT)$(BIN_OUTPUT_SUFFIX): $(OUT_DIR)/$(PROJECT)$(LINK_OUTPUT_SU
 	$(VIEW)$(OBJCOPY) $(OBJCOPY_BIN_FLAGS) $< $@
 	$(VIEW)$(OBJCOPY) $(OBJCOPY_HEX_FLAGS) $< $(OUT_DIR)/$(PROJECT)$(HEX_OUTPUT_SUFFIX)
 
-$(OUT_DIR)/$(PROJECT)$(LINK_OUTPUT_SUFFIX): $(addprefix $(OUT_DIR)/,$(notdir $($(PROJECT)_PACK_OBJ)))
+# Every member of the SDK archives is linked as an object would be, the weak
+# handlers of the startup code are then overridden as before
+$(OUT_DIR)/$(PROJECT)$(LINK_OUTPUT_SUFFIX): $(addprefix $(OUT_DIR)/,$(notdir $($(PROJECT)_PACK_OBJ))) $(SDK_LIBS)
 	$(VIEW)echo $@
-	$(VIEW)$(LINKER) $($(PROJECT)_LDFLAGS) $(COMPILER_SPECIFIC_LINK_MAP)$(OUT_DIR)/$(PROJECT)$(MAP_OUTPUT_SUFFIX) -T$($(PROJECT)_LINK_LD) -o $@ $(addprefix $(OUT_DIR)/,$(notdir $($(PROJECT)_PACK_OBJ))) $($(PROJECT)_LIBS)
+	$(VIEW)$(LINKER) $($(PROJECT)_LDFLAGS) $(PROFILE_LDFLAGS) $(COMPILER_SPECIFIC_LINK_MAP)$(OUT_DIR)/$(PROJECT)$(MAP_OUTPUT_SUFFIX) -T$($(PROJECT)_LINK_LD) -o $@ $(addprefix $(OUT_DIR)/,$(notdir $($(PROJECT)_PACK_OBJ))) \
+		$(if $(SDK_LIBS),-Wl$(COMMA)--whole-archive $(SDK_LIBS) -Wl$(COMMA)--no-whole-archive) $($(PROJECT)_LIBS)
+
+# RAM owned by each module and the largest RAM symbols, add -fstack-usage to
+# $(PROJECT)_CFLAGS for the deepest stack frame of each module
+memreport: $(OUT_DIR)/$(PROJECT)$(LINK_OUTPUT_SUFFIX) $(MEMREPORT)
+	$(VIEW)$(PYTHON) $(MEMREPORT) --map $(OUT_DIR)/$(PROJECT)$(MAP_OUTPUT_SUFFIX) --elf $< --nm $(NM) --sdk $(TREMO_SDK_PATH) $(if $(SDK_LIBS),--obj-dir $(SDK_LIB_DIR)) $($(PROJECT)_SOURCE)
+
+# Builds every profile and prints their flash footprint against release, the
+# cycles come from the stack_benchmark logs of each profile
+profiles:
+	$(VIEW)$(foreach p,$(PROFILES),$(MAKE) $(SILENT) --no-print-directory PROFILE=$(p) OUT_DIR=$(call PROFILE_OUT_DIR,$(p)) $(call PROFILE_OUT_DIR,$(p))/$(PROJECT)$(BIN_OUTPUT_SUFFIX) > /dev/null &&) true
+	$(VIEW)$(SIZE) $(foreach p,$(PROFILES),$(call PROFILE_OUT_DIR,$(p))/$(PROJECT)$(LINK_OUTPUT_SUFFIX)) | \
+		awk 'NR == 1 { print; next } NR == 2 { base = $$1 + $$2 } { printf "%s  flash %+d\n", $$0, $$1 + $$2 - base }'
 
 flash: $(OUT_DIR)/$(PROJECT)$(BIN_OUTPUT_SUFFIX) $(TREMO_LOADER)
 	$(VIEW)echo Start flashing...
-	$(VIEW)$(PYTHON) $(TREMO_LOADER) -p $(SERIAL_PORT) -b $(SERIAL_BAUDRATE) flash $($(PROJECT)_ADDRESS) $(OUT_DIR)/$(PROJECT)$(BIN_OUTPUT_SUFFIX)
-	
+	$(VIEW)$(PYTHON) $(TREMO_LOADER) -p $(SERIAL_PORT) -b $(SERIAL_BAUDRATE) flash $(SERIAL_FLASH_FLAGS) $($(PROJECT)_ADDRESS) $(OUT_DIR)/$(PROJECT)$(BIN_OUTPUT_SUFFIX)
+
+# OTA update container of the image, chunked at the flash lines with a CRC
+# each, see build/scripts/tremo_image.py. OTA_COMPRESS=1 for a compressed
+# payload, OTA_BASE=<installed image .bin> for a delta, OTA_KEY=<private key>
+# to sign it
+OTA_IMAGE := $(SCRIPTS_PATH)/tremo_image.py
+OTA_ADDRESS ?= 0x0800D000
+OTA_VERSION ?= 1
+OTA_CHUNK_SIZE ?= 0x200
+ota_image: $(OUT_DIR)/$(PROJECT)$(BIN_OUTPUT_SUFFIX) $(OTA_IMAGE)
+	$(VIEW)$(PYTHON) $(OTA_IMAGE) pack $< $(OUT_DIR)/$(PROJECT).ota -a $(OTA_ADDRESS) -v $(OTA_VERSION) -c $(OTA_CHUNK_SIZE) \
+		$(if $(filter 1,$(OTA_COMPRESS)),-z) $(if $(OTA_BASE),-d $(OTA_BASE)) $(if $(OTA_KEY),-k $(OTA_KEY))
+
 clean:
 	$(VIEW)echo Cleaning...
 	$(VIEW)rm -rf $(OUT_DIR)
 	$(VIEW)echo Done
 
+# The archives of every configuration built from this SDK
+sdkclean:
+	$(VIEW)rm -rf $(SDK_CACHE_DIR)
+
@@ -26,6 +26,7 @@ CC      := "$(TOOLCHAIN_PATH)$(TOOLCHAIN_PREFIX)gcc$(EXECUTABLE_SUFFIX)"
 CXX     := "$(TOOLCHAIN_PATH)$(TOOLCHAIN_PREFIX)g++$(EXECUTABLE_SUFFIX)"
 AS      := $(CC)
 AR      := "$(TOOLCHAIN_PATH)$(TOOLCHAIN_PREFIX)ar$(EXECUTABLE_SUFFIX)"
+GCC_AR  := "$(TOOLCHAIN_PATH)$(TOOLCHAIN_PREFIX)gcc-ar$(EXECUTABLE_SUFFIX)"
 LD      := "$(TOOLCHAIN_PATH)$(TOOLCHAIN_PREFIX)ld$(EXECUTABLE_SUFFIX)"
 CPP     := "$(TOOLCHAIN_PATH)$(TOOLCHAIN_PREFIX)cpp$(EXECUTABLE_SUFFIX)"
 OBJDUMP := "$(TOOLCHAIN_PATH)$(TOOLCHAIN_PREFIX)objdump$(EXECUTABLE_SUFFIX)"
@@ -62,6 +63,13 @@ COMPILER_SPECIFIC_RELEASE_CXXFLAGS := -DNDEBUG -ggdb $(COMPILER_SPECIFIC_OPTIMIZ
 COMPILER_SPECIFIC_RELEASE_ASFLAGS  := -ggdb
 COMPILER_SPECIFIC_RELEASE_LDFLAGS  := -Wl,--gc-sections -Wl,$(COMPILER_SPECIFIC_OPTIMIZED_CFLAGS) -Wl,--cref
 
+#release_lto: optimize across the files at link time
+COMPILER_SPECIFIC_RELEASE_LTO_CFLAGS  := -flto
+COMPILER_SPECIFIC_RELEASE_LTO_LDFLAGS := -flto -Wl,--gc-sections
+
+#release_fast: the hot files optimized for speed, the others for size
+COMPILER_SPECIFIC_FAST_CFLAGS         := -O2
+
 COMPILER_SPECIFIC_DEPS_FLAG        := -MD
 COMPILER_SPECIFIC_COMP_ONLY_FLAG   := -c
 COMPILER_SPECIFIC_COMP_C99_FLGA    := -std=gnu99
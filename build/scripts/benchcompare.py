@@ -0,0 +1,56 @@
+import argparse
+import json
+import sys
+
+# Compares the cycle counts of two stack_benchmark logs, e.g. the release
+# build against release_lto or release_fast. The logs are the UART output,
+# one JSON record per line.
+
+
+def load(path):
+    profile = None
+    results = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith('{'):
+                continue
+            try:
+                record = json.loads(line)
+            except ValueError:
+                continue
+            if 'profile' in record:
+                profile = record['profile']
+            elif 'bench' in record:
+                results[(record['bench'], record['arg'])] = record
+    return profile or path, results
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Cycle deltas between two stack_benchmark logs')
+    parser.add_argument('base', help='log of the reference build')
+    parser.add_argument('other', help='log of the compared build')
+    parser.add_argument('--field', default='avg', choices=['min', 'avg', 'max'], help='cycle count compared')
+    args = parser.parse_args()
+
+    base_name, base = load(args.base)
+    other_name, other = load(args.other)
+    if not base or not other:
+        sys.exit('no benchmark record found')
+
+    print('%-24s %6s %10s %10s %8s' % ('bench', 'arg', base_name[:10], other_name[:10], 'delta'))
+    total_base = total_other = 0
+    for key in sorted(base):
+        if key not in other:
+            continue
+        a, b = base[key][args.field], other[key][args.field]
+        total_base += a
+        total_other += b
+        print('%-24s %6u %10u %10u %+7.1f%%' % (key[0], key[1], a, b, 100.0 * (b - a) / a if a else 0.0))
+    if total_base:
+        print('%-24s %6s %10u %10u %+7.1f%%' % ('total', '', total_base, total_other,
+                                                 100.0 * (total_other - total_base) / total_base))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,146 @@
+import argparse
+import re
+import struct
+import sys
+
+# Decodes the LOG_PRINTF records of a CONFIG_LOG_DEFERRED build, passing the
+# other output of the print channel through. The formats are read from the
+# ELF image (.elf or .axf) the device runs.
+
+RECORD_SYNC = 0x1E
+
+CONVERSION = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|z|j|t)?([diouxXcsfFeEgGp%])')
+
+
+class ElfImage(object):
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+        if self.data[:4] != b'\x7fELF' or self.data[4] != 1 or self.data[5] != 1:
+            raise ValueError('%s is not a little endian ELF32 image' % path)
+        shoff, = struct.unpack_from('<I', self.data, 0x20)
+        shentsize, shnum = struct.unpack_from('<HH', self.data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            _, sh_type, _, addr, offset, size = struct.unpack_from('<IIIIII', self.data, shoff + i * shentsize)
+            # PROGBITS sections placed in memory
+            if sh_type == 1 and addr != 0:
+                self.sections.append((addr, offset, size))
+
+    def string(self, address):
+        for addr, offset, size in self.sections:
+            if addr <= address < addr + size:
+                start = offset + address - addr
+                end = self.data.index(b'\0', start, offset + size)
+                return self.data[start:end].decode('latin-1')
+        return None
+
+
+def format_record(elf, payload):
+    address, = struct.unpack_from('<I', payload, 0)
+    args = payload[4:]
+    if address == 0:
+        return '<%u log records lost>\r\n' % struct.unpack_from('<I', args, 0)
+    fmt = elf.string(address)
+    if fmt is None:
+        return '<unknown format 0x%08X>\r\n' % address
+    pos = [0]
+
+    def take(size, signed=False):
+        if pos[0] + size > len(args):
+            raise IndexError
+        code = {4: 'i', 8: 'q'}[size]
+        value, = struct.unpack_from('<' + (code if signed else code.upper()), args, pos[0])
+        pos[0] += size
+        return value
+
+    def convert(m):
+        flags, width, precision, length, conv = m.groups()
+        if conv == '%':
+            return '%'
+        if width == '*':
+            width = str(take(4, True))
+        if precision == '*':
+            precision = str(take(4, True))
+        spec = '%' + flags + (width or '') + ('.' + precision if precision is not None else '')
+        wide = length in ('ll', 'j')
+        if conv in 'fFeEgG':
+            return (spec + conv) % struct.unpack('<d', struct.pack('<Q', take(8)))[0]
+        if conv == 's':
+            n = args[pos[0]]
+            s = args[pos[0] + 1:pos[0] + 1 + n].decode('latin-1')
+            pos[0] += 1 + n
+            return (spec + 's') % s
+        if conv == 'c':
+            return (spec + 'c') % chr(take(4) & 0xFF)
+        if conv == 'p':
+            return '0x%08x' % take(4)
+        value = take(8 if wide else 4, conv in 'di')
+        if conv == 'u':
+            conv = 'd'
+        return (spec + conv) % value
+
+    try:
+        return CONVERSION.sub(convert, fmt)
+    except IndexError:
+        return CONVERSION.sub(lambda m: m.group(0), fmt) + ' <truncated>\r\n'
+
+
+def decode(elf, stream, out):
+    pending = bytearray()
+    while True:
+        chunk = stream.read(1)
+        if not chunk:
+            break
+        pending += chunk
+        while pending:
+            if pending[0] != RECORD_SYNC:
+                out.write(chr(pending[0]))
+                del pending[0]
+                continue
+            if len(pending) < 2 or len(pending) < pending[1] + 3:
+                break
+            length = pending[1]
+            record = pending[1:length + 2]
+            if (~sum(record) & 0xFF) != pending[length + 2]:
+                # Not a record, the sync byte was part of the text
+                out.write(chr(pending[0]))
+                del pending[0]
+                continue
+            out.write(format_record(elf, bytes(record[1:])))
+            del pending[:length + 3]
+        out.flush()
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument('elf', help='ELF image of the firmware')
+
+    parser.add_argument(
+        '--port', '-p',
+        help='serial port to read, instead of the input file')
+
+    parser.add_argument(
+        '--baud', '-b',
+        help='baud rate',
+        type=int,
+        default=115200)
+
+    parser.add_argument(
+        '--input', '-i',
+        help='captured output, stdin by default')
+
+    args = parser.parse_args()
+    elf = ElfImage(args.elf)
+    if args.port:
+        import serial
+        stream = serial.Serial(args.port, args.baud)
+    elif args.input:
+        stream = open(args.input, 'rb')
+    else:
+        stream = sys.stdin.buffer if hasattr(sys.stdin, 'buffer') else sys.stdin
+    try:
+        decode(elf, stream, sys.stdout)
+    except KeyboardInterrupt:
+        pass
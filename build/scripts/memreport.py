@@ -0,0 +1,219 @@
+import argparse
+import glob
+import os
+import re
+import subprocess
+import sys
+
+# Reports who owns the RAM of an image: the .data, .bss and RAM code of each
+# module from the link map, the largest RAM symbols from the ELF image, and
+# the deepest stack frame of each module when the objects were compiled with
+# -fstack-usage.
+
+# Source directories of the SDK modules, the first match wins
+MODULES = [
+    ('region', 'lora/mac/region/'),
+    ('mac', 'lora/mac/'),
+    ('radio', 'lora/radio/'),
+    ('radio', 'lora/driver/'),
+    ('linkwan', 'lora/linkwan/'),
+    ('system', 'lora/system/'),
+    ('drivers', 'drivers/'),
+    ('platform', 'platform/'),
+]
+
+RAM_SECTIONS = {'.ramfunc': 'ramfunc', '.data': 'data', '.bss': 'bss'}
+
+SECTION = re.compile(r'^(\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)')
+INPUT = re.compile(r'^ (\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$')
+INPUT_NAME = re.compile(r'^ (\S+)$')
+INPUT_CONT = re.compile(r'^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$')
+MEMORY = re.compile(r'^(\w+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)')
+STACK_USAGE = re.compile(r'^(\S+?):\d+:\d+:(\S+)\s+(\d+)\s+(\S+)')
+
+
+class Modules(object):
+    def __init__(self, sdk, sources):
+        self.sdk = os.path.abspath(sdk).replace('\\', '/') + '/'
+        # Objects are built flat in the output directory, map them back
+        self.objects = {}
+        for source in sources:
+            name = os.path.splitext(os.path.basename(source))[0]
+            self.objects[name] = source
+
+    def of_path(self, path):
+        path = os.path.abspath(path).replace('\\', '/')
+        if path.startswith(self.sdk):
+            relative = path[len(self.sdk):]
+            for module, prefix in MODULES:
+                if relative.startswith(prefix):
+                    return module
+            return 'app' if relative.startswith('projects/') else 'other'
+        return 'app'
+
+    def of_object(self, obj):
+        # Archive members, libcrypto.a(aes.o), the SDK archives hold objects
+        # of the project sources
+        archive = obj.split('(')[0]
+        if archive.endswith('.a'):
+            member = os.path.splitext(obj[len(archive):].strip('()'))[0]
+            if member in self.objects:
+                return self.of_path(self.objects[member])
+            if os.path.isabs(archive) or os.path.exists(archive):
+                module = self.of_path(archive)
+                return 'libc' if module == 'app' else module
+            return 'libc'
+        name = os.path.splitext(os.path.basename(obj))[0]
+        if name in self.objects:
+            return self.of_path(self.objects[name])
+        return 'libc'
+
+
+def parse_map(path):
+    memory = {}
+    sections = {}
+    inputs = []
+    with open(path) as f:
+        lines = f.read().splitlines()
+    i = 0
+    in_memory = False
+    while i < len(lines):
+        line = lines[i]
+        if line.startswith('Memory Configuration'):
+            in_memory = True
+        elif line.startswith('Linker script and memory map'):
+            break
+        elif in_memory:
+            m = MEMORY.match(line)
+            if m and m.group(1) != 'Name':
+                memory[m.group(1)] = (int(m.group(2), 16), int(m.group(3), 16))
+        i += 1
+
+    output = None
+    while i < len(lines):
+        line = lines[i]
+        i += 1
+        m = SECTION.match(line)
+        if m:
+            output = m.group(1)
+            sections[output] = (int(m.group(2), 16), int(m.group(3), 16))
+            continue
+        if line and not line[0].isspace():
+            # Output section with its address on the next line
+            output = line.split()[0]
+            if i < len(lines):
+                m = re.match(r'^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)', lines[i])
+                if m:
+                    sections[output] = (int(m.group(1), 16), int(m.group(2), 16))
+                    i += 1
+            continue
+        if output not in RAM_SECTIONS:
+            continue
+        m = INPUT.match(line)
+        if m:
+            name, addr, size, obj = m.groups()
+        else:
+            m = INPUT_NAME.match(line)
+            if not m or m.group(1).startswith('*') or i >= len(lines):
+                continue
+            c = INPUT_CONT.match(lines[i])
+            if not c:
+                continue
+            i += 1
+            name = m.group(1)
+            addr, size, obj = c.groups()
+        if name.startswith('*') or int(size, 16) == 0:
+            continue
+        inputs.append((int(addr, 16), int(size, 16), RAM_SECTIONS[output], obj.strip()))
+    return memory, sections, inputs
+
+
+def ram_symbols(nm, elf, start, end):
+    out = subprocess.check_output([nm, '-S', '--size-sort', elf]).decode('latin-1')
+    symbols = []
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) != 4:
+            continue
+        addr, size = int(fields[0], 16), int(fields[1], 16)
+        if start <= addr < end:
+            symbols.append((size, addr, fields[2], fields[3]))
+    symbols.sort(reverse=True)
+    return symbols
+
+
+def stack_usage(out_dirs, modules):
+    frames = {}
+    paths = []
+    for out_dir in out_dirs:
+        paths += glob.glob(os.path.join(out_dir, '*.su')) + glob.glob(os.path.join(out_dir, '*', '*.su'))
+    for path in paths:
+        name = os.path.splitext(os.path.basename(path))[0]
+        module = modules.of_object(name + '.o')
+        with open(path) as f:
+            for line in f:
+                m = STACK_USAGE.match(line)
+                if not m:
+                    continue
+                size = int(m.group(3))
+                if size > frames.get(module, (0, None, None))[0]:
+                    frames[module] = (size, m.group(2), m.group(4))
+    return frames
+
+
+def main():
+    parser = argparse.ArgumentParser(description='RAM budget of an image, per module and per symbol')
+    parser.add_argument('--map', required=True, help='link map of the image')
+    parser.add_argument('--elf', required=True, help='ELF image')
+    parser.add_argument('--nm', default='arm-none-eabi-nm', help='nm of the toolchain')
+    parser.add_argument('--sdk', default=os.path.join(os.path.dirname(__file__), '..', '..'), help='SDK root')
+    parser.add_argument('--top', type=int, default=20, help='number of symbols listed')
+    parser.add_argument('--obj-dir', action='append', default=[], help='more directories of objects, the SDK archives')
+    parser.add_argument('sources', nargs='*', help='sources of the project')
+    args = parser.parse_args()
+
+    modules = Modules(args.sdk, args.sources)
+    memory, sections, inputs = parse_map(args.map)
+    if 'RAM' not in memory:
+        sys.exit('%s has no RAM memory region' % args.map)
+    ram_start, ram_length = memory['RAM']
+    ram_end = ram_start + ram_length
+
+    used = {}
+    owner = []
+    for addr, size, kind, obj in inputs:
+        module = modules.of_object(obj)
+        totals = used.setdefault(module, {'ramfunc': 0, 'data': 0, 'bss': 0})
+        totals[kind] += size
+        owner.append((addr, addr + size, module))
+
+    def section_size(name):
+        return sections.get(name, (0, 0))[1]
+
+    ramfunc, data, bss = section_size('.ramfunc'), section_size('.data'), section_size('.bss')
+    heap, stack = section_size('.heap'), section_size('.stack')
+    free = ram_length - ramfunc - data - bss - heap - stack
+    print('RAM %u bytes: ramfunc %u, data %u, bss %u, heap %u, stack %u, free %d' %
+          (ram_length, ramfunc, data, bss, heap, stack, free))
+    print('')
+
+    frames = stack_usage([os.path.dirname(args.map)] + args.obj_dir, modules)
+    print('%-10s %8s %8s %8s %8s  %s' % ('module', 'ramfunc', 'data', 'bss', 'total', 'deepest frame'))
+    for module in sorted(used, key=lambda m: -sum(used[m].values())):
+        totals = used[module]
+        frame = frames.get(module)
+        print('%-10s %8u %8u %8u %8u  %s' % (module, totals['ramfunc'], totals['data'], totals['bss'],
+                                              sum(totals.values()),
+                                              '%u %s (%s)' % frame if frame else '-'))
+    if not frames:
+        print('(add -fstack-usage to the CFLAGS for the stack frames)')
+    print('')
+
+    print('%-8s %-10s %-10s %s' % ('size', 'address', 'module', 'symbol'))
+    for size, addr, kind, name in ram_symbols(args.nm, args.elf, ram_start, ram_end)[:args.top]:
+        module = next((m for start, end, m in owner if start <= addr < end), '-')
+        print('%-8u 0x%08X %-10s %s' % (size, addr, module, name))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,185 @@
+import argparse
+import hashlib
+import os
+import struct
+import sys
+import zlib
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from tremo_pack import Packer, unpack
+from tremo_sign import G, comb_verify, le, point_mul, read_key, sign
+
+
+# OTA update container, the image to send to the bootloader and what the
+# host needs to send it by chunks:
+#   header       magic(4) format(1) payload(1) flags(1) reserved(1)
+#                version(4) addr(4) image_size(4) image_crc(4)
+#                base_size(4) base_crc(4) payload_size(4) payload_crc(4)
+#                chunk_size(2) chunk_num(2) header_crc(4)
+#   chunk table  crc32(4) of each chunk of the payload
+#   payload      the image, or its STREAM data, compressed or a delta
+#                against the installed image of base_crc
+#   signature    r(32) s(32) of the SHA-256 of the image, flag SIGNED
+# all little endian. A raw payload is cut at the flash lines of the image,
+# a host resends the chunks whose CRC the device does not match and resumes
+# a transfer from the first one missing.
+MAGIC = b'TOTA'
+FORMAT = 1
+HEADER = struct.Struct('<4sBBBxIIIIIIIIHH')
+FLASH_LINE_SIZE = 0x200
+
+PAYLOAD_RAW = 0
+PAYLOAD_STREAM = 1
+PAYLOAD_DELTA = 2
+PAYLOAD_NAMES = {PAYLOAD_RAW: 'raw', PAYLOAD_STREAM: 'stream', PAYLOAD_DELTA: 'delta'}
+
+FLAG_SIGNED = 0x01
+
+
+def crc32(data):
+    return zlib.crc32(data) & 0xFFFFFFFF
+
+
+def chunks(payload, chunk_size):
+    return [payload[i:i+chunk_size] for i in range(0, len(payload), chunk_size)]
+
+
+def build(image, addr, version, chunk_size, base=None, compress=False, key=None):
+    if addr % FLASH_LINE_SIZE or chunk_size % FLASH_LINE_SIZE:
+        raise Exception('the address and the chunk size must be multiples of 0x%X' % FLASH_LINE_SIZE)
+
+    if base is not None:
+        kind, payload = PAYLOAD_DELTA, Packer(image, base).pack()
+    elif compress:
+        kind, payload = PAYLOAD_STREAM, Packer(image).pack()
+    else:
+        kind, payload = PAYLOAD_RAW, image
+    if kind != PAYLOAD_RAW and unpack(payload, base or b'') != image:
+        raise Exception('the stream does not decode to the image')
+
+    parts = chunks(payload, chunk_size)
+    if len(parts) > 0xFFFF:
+        raise Exception('%d chunks, use a larger chunk size' % len(parts))
+    table = b''.join(struct.pack('<I', crc32(c)) for c in parts)
+
+    signature = b''
+    flags = 0
+    if key is not None:
+        d = read_key(key)
+        digest = hashlib.sha256(image).digest()
+        r, s = sign(d, digest)
+        if not comb_verify(point_mul(d, G), digest, r, s):
+            raise Exception('the signature does not verify')
+        signature = le(r) + le(s)
+        flags |= FLAG_SIGNED
+
+    header = HEADER.pack(MAGIC, FORMAT, kind, flags, version, addr, len(image), crc32(image),
+                         len(base) if base is not None else 0, crc32(base) if base is not None else 0,
+                         len(payload), crc32(payload), chunk_size, len(parts))
+    header += struct.pack('<I', crc32(header))
+    return header + table + payload + signature
+
+
+def parse(data):
+    if len(data) < HEADER.size + 4:
+        raise Exception('truncated header')
+    fields = HEADER.unpack_from(data)
+    (magic, fmt, kind, flags, version, addr, image_size, image_crc,
+     base_size, base_crc, payload_size, payload_crc, chunk_size, chunk_num) = fields
+    if magic != MAGIC or fmt != FORMAT:
+        raise Exception('not an OTA image container')
+    if struct.unpack_from('<I', data, HEADER.size)[0] != crc32(data[:HEADER.size]):
+        raise Exception('bad header crc')
+
+    pos = HEADER.size + 4
+    table = struct.unpack_from('<%dI' % chunk_num, data, pos)
+    pos += 4 * chunk_num
+    payload = data[pos:pos+payload_size]
+    pos += payload_size
+    signature = data[pos:pos+64] if flags & FLAG_SIGNED else b''
+    if len(payload) != payload_size or len(signature) != (64 if flags & FLAG_SIGNED else 0):
+        raise Exception('truncated container')
+
+    bad = [i for i, c in enumerate(chunks(payload, chunk_size)) if crc32(c) != table[i]]
+    return {
+        'payload_type': kind, 'flags': flags, 'version': version, 'addr': addr,
+        'image_size': image_size, 'image_crc': image_crc, 'base_size': base_size,
+        'base_crc': base_crc, 'payload': payload, 'payload_crc': payload_crc,
+        'chunk_size': chunk_size, 'chunks': table, 'bad_chunks': bad, 'signature': signature,
+    }
+
+
+def tremo_image_pack(args):
+    with open(args.image, 'rb') as f:
+        image = f.read()
+    base = None
+    if args.base:
+        with open(args.base, 'rb') as f:
+            base = f.read()
+
+    data = build(image, args.addr, args.version, args.chunk_size, base, args.compress, args.key)
+    with open(args.output, 'wb') as f:
+        f.write(data)
+
+    info = parse(data)
+    print('image: %d bytes, crc32 0x%08X, version %d at 0x%08X'
+          % (len(image), info['image_crc'], args.version, args.addr))
+    print('payload: %s, %d bytes (%.1f%%), %d chunks of %d bytes%s'
+          % (PAYLOAD_NAMES[info['payload_type']], len(info['payload']),
+             100.0 * len(info['payload']) / max(len(image), 1), len(info['chunks']),
+             args.chunk_size, ', signed' if info['signature'] else ''))
+    print('container: %s, %d bytes' % (args.output, len(data)))
+
+
+def tremo_image_info(args):
+    with open(args.container, 'rb') as f:
+        info = parse(f.read())
+
+    print('version %d at 0x%08X, image %d bytes, crc32 0x%08X'
+          % (info['version'], info['addr'], info['image_size'], info['image_crc']))
+    if info['payload_type'] == PAYLOAD_DELTA:
+        print('delta against %d bytes, crc32 0x%08X' % (info['base_size'], info['base_crc']))
+    print('payload: %s, %d bytes, %d chunks of %d bytes%s'
+          % (PAYLOAD_NAMES.get(info['payload_type'], '?'), len(info['payload']), len(info['chunks']),
+             info['chunk_size'], ', signed' if info['signature'] else ''))
+    if info['bad_chunks'] or crc32(info['payload']) != info['payload_crc']:
+        raise Exception('bad chunks: %s' % ' '.join(str(i) for i in info['bad_chunks']))
+    print('all chunks ok')
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description='package images in OTA update containers, sent by chunks to the OTA bootloader')
+    subparsers = parser.add_subparsers()
+
+    parser_pack = subparsers.add_parser('pack', help='make the container of an image')
+    parser_pack.set_defaults(func=tremo_image_pack)
+    parser_pack.add_argument('image', help='new image, eg. app.bin')
+    parser_pack.add_argument('output', help='container file, eg. app.ota')
+    parser_pack.add_argument('--addr', '-a', type=lambda x: int(x, 0), default=0x0800D000,
+                             help='flash address of the image, APP_START_ADDR of the bootloader by default')
+    parser_pack.add_argument('--version', '-v', type=lambda x: int(x, 0), default=1,
+                             help='image version')
+    parser_pack.add_argument('--chunk-size', '-c', type=lambda x: int(x, 0), default=FLASH_LINE_SIZE,
+                             help='chunk size, a multiple of the flash line')
+    parser_pack.add_argument('--compress', '-z', action='store_true',
+                             help='compressed payload, for the STREAM commands')
+    parser_pack.add_argument('--base', '-d',
+                             help='installed image, the payload is then a delta patch against it')
+    parser_pack.add_argument('--key', '-k',
+                             help='private key of build/scripts/tremo_sign.py, the image is then signed')
+
+    parser_info = subparsers.add_parser('info', help='print a container and check its chunks')
+    parser_info.set_defaults(func=tremo_image_info)
+    parser_info.add_argument('container', help='container file')
+
+    args = parser.parse_args()
+    if not hasattr(args, 'func'):
+        parser.print_help()
+        sys.exit(1)
+
+    try:
+        args.func(args)
+    except Exception as e:
+        print(str(e))
+        sys.exit(1)
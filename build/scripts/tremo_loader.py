@@ -6,6 +6,7 @@ import time
 import struct
 import zlib
 import binascii
+import threading
 
 
 class TremoLoader(object):
@@ -60,12 +61,13 @@ class TremoLoader(object):
 
         return status, pkt[4:4+rsp_data_len]
 
-    def requeset(self, cmd, data=b""):
+    def requeset(self, cmd, data=b"", flush=True):
         pkt = struct.pack(b'<BBH', 0xFE, cmd, len(data)) + data
         checksum = zlib.crc32(pkt) & 0xFFFFFFFF
         pkt += struct.pack(b'<IB', checksum, 0xEF)
         #print('send Packed Value :', binascii.hexlify(pkt))
-        self.ser.flushInput()
+        if flush:
+            self.ser.flushInput()
         self.ser.write(pkt)
 
     def sync(self):
@@ -121,6 +123,29 @@ class TremoLoader(object):
         if ret != 0:
             raise CmdException("Flash error")
 
+    def flash_window(self, addr, chunks, window):
+        # up to window requests in flight, the responses are read in order
+        # while the next requests are queued in the serial driver
+        pending = 0
+        for data in chunks:
+            if pending == window:
+                ret, _ = self.wait_response()
+                pending -= 1
+                if ret != 0:
+                    raise CmdException("Flash error")
+            self.requeset(self.CMD_FLASH, struct.pack('<II', addr, len(data)) + data, flush=(pending == 0))
+            addr += len(data)
+            pending += 1
+        for _ in range(pending):
+            ret, _ = self.wait_response()
+            if ret != 0:
+                raise CmdException("Flash error")
+
+    def check(self, addr, size, checksum):
+        self.requeset(self.CMD_VERIFY, struct.pack('<III', addr, size, checksum))
+        ret, _ = self.wait_response()
+        return ret == 0
+
     def verify(self, addr, size, checksum):
         self.requeset(self.CMD_VERIFY, struct.pack('<III', addr, size, checksum))
         ret, _ = self.wait_response()
@@ -195,6 +220,9 @@ class CmdException(Exception):
     pass
 
 
+PAGE_SIZE = 0x1000
+
+
 def arg_int(x):
     return int(x, 0)
 
@@ -211,44 +239,140 @@ def tremo_erase(args):
     tremo.erase(args.address, args.size)
 
 
-def tremo_flash(args):
-    # check args
-    download_files = []
-    for i in range(0, len(args.addr_file), 2):
+def load_images(addr_file):
+    # check args, the images are read once and shared by all the ports
+    images = []
+    for i in range(0, len(addr_file), 2):
         try:
-            address = int(args.addr_file[i], 0)
+            address = int(addr_file[i], 0)
         except Exception:
-            raise Exception('Address "%s" must be a number' % args.addr_file[i])
+            raise Exception('Address "%s" must be a number' % addr_file[i])
+
+        if i + 1 >= len(addr_file) or os.access(addr_file[i+1], os.R_OK) is False:
+            raise Exception('failed to read the file: %s' % addr_file[i+1:i+2])
+        with open(addr_file[i+1], 'rb') as f:
+            images.append((address, f.read()))
+    return images
+
+
+def flash_images(tremo, images, args, log=print):
+    for address, image_data in images:
+        image_size = len(image_data)
+        image_checksum = zlib.crc32(image_data) & 0xFFFFFFFF
+
+        # pages to program, the ones holding the same data already skipped
+        pages = [(address, image_data)]
+        if args.skip_unchanged and (address % PAGE_SIZE) == 0:
+            pages = []
+            for offset in range(0, image_size, PAGE_SIZE):
+                page_data = image_data[offset:offset+PAGE_SIZE]
+                if not tremo.check(address + offset, len(page_data), zlib.crc32(page_data) & 0xFFFFFFFF):
+                    pages.append((address + offset, page_data))
+            log("pages changed: %d of %d" % (len(pages), (image_size + PAGE_SIZE - 1) // PAGE_SIZE))
+
+        l = 0
+        for page_addr, page_data in pages:
+            tremo.erase(page_addr, len(page_data))
+            chunks = [page_data[i:i+512] for i in range(0, len(page_data), 512)]
+            if args.window > 1:
+                tremo.flash_window(page_addr, chunks, args.window)
+                l += len(page_data)
+                log("send: %d" % l)
+                continue
+            flash_addr = page_addr
+            for line_data in chunks:
+                tremo.flash(flash_addr, line_data)
+                flash_addr += len(line_data)
+                l += len(line_data)
+                log("send: %d" % l)
+        tremo.verify(address, image_size, image_checksum)
+
 
-        if os.access(args.addr_file[i+1], os.R_OK) is False:
-            raise Exception('failed to read the file: %s' % args.addr_file[i+1])
-        download_files.append((address, args.addr_file[i+1]))
+def tremo_flash(args):
+    images = load_images(args.addr_file)
 
     # flash
     tremo = TremoLoader(args.port)
     tremo.connect()
     tremo.set_baudrate(args.baud)
-    for address, filename in download_files:
-        image_size = os.path.getsize(filename)
-        image_checksum = get_crc32(filename)
-        tremo.erase(address, image_size)
-
-        flash_addr = address
-        with open(filename, 'rb') as f:
-            l = 0
-            while True:
-                line_data = f.read(512)
-                if line_data == b'':
-                    break
-
-                tremo.flash(flash_addr, line_data)
-                flash_addr += len(line_data)
-                l += len(line_data)
-                print("send: ", l)
-        tremo.verify(address, image_size, image_checksum)
+    flash_images(tremo, images, args)
     tremo.reboot(0)
 
 
+def load_params(filename):
+    # one line per device: <port> <flash|otp> <address> <hex data> ...
+    params = {}
+    with open(filename, 'r') as f:
+        for n, line in enumerate(f, 1):
+            fields = line.split('#')[0].replace(',', ' ').split()
+            if not fields:
+                continue
+            if len(fields) < 4 or (len(fields) - 1) % 3 != 0:
+                raise Exception('%s:%d: expected <port> <flash|otp> <address> <data>' % (filename, n))
+            writes = params.setdefault(fields[0], [])
+            for i in range(1, len(fields), 3):
+                if fields[i] not in ('flash', 'otp'):
+                    raise Exception('%s:%d: unknown area "%s"' % (filename, n, fields[i]))
+                writes.append((fields[i], int(fields[i+1], 0), binascii.unhexlify(fields[i+2])))
+    return params
+
+
+def write_params(tremo, writes, log=print):
+    for area, address, data in writes:
+        if area == 'otp':
+            tremo.write_otp(address, data)
+            if tremo.read_otp(address, len(data)) != data:
+                raise CmdException("Read_otp mismatch")
+        else:
+            # the page is erased first, the data gives its whole contents
+            tremo.erase(address - address % PAGE_SIZE, PAGE_SIZE)
+            for i in range(0, len(data), 512):
+                tremo.flash(address + i, data[i:i+512])
+            tremo.verify(address, len(data), zlib.crc32(data) & 0xFFFFFFFF)
+        log("%s 0x%08X: %d bytes" % (area, address, len(data)))
+
+
+def tremo_flash_multi(args):
+    images = load_images(args.addr_file)
+    params = load_params(args.params) if args.params else {}
+    for port in params:
+        if port not in args.ports:
+            raise Exception('device parameters for an unused port: %s' % port)
+
+    lock = threading.Lock()
+    results = {}
+
+    def run(port):
+        def log(msg):
+            with lock:
+                print('[%s] %s' % (port, msg))
+                sys.stdout.flush()
+        try:
+            tremo = TremoLoader(port)
+            tremo.connect()
+            tremo.set_baudrate(args.baud)
+            flash_images(tremo, images, args, log)
+            write_params(tremo, params.get(port, []), log)
+            tremo.reboot(0)
+            results[port] = None
+            log('done')
+        except Exception as e:
+            results[port] = str(e)
+            log('failed: %s' % e)
+
+    # one thread per port, the serial reads release the interpreter lock
+    threads = [threading.Thread(target=run, args=(port,)) for port in args.ports]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    failed = [port for port in args.ports if results.get(port) is not None]
+    print('%d of %d devices flashed' % (len(args.ports) - len(failed), len(args.ports)))
+    if failed:
+        raise Exception('failed ports: %s' % ' '.join(failed))
+
+
 def tremo_write_otp(args):
     tremo = TremoLoader(args.port)
     tremo.connect()
@@ -300,6 +424,25 @@ if __name__ == '__main__':
         help='erase and write the flash')
     parser_flash.add_argument('addr_file', metavar='<address> <filename>',
                                     help='address and filename, eg. 0x08000000 app.bin', nargs='+')
+    parser_flash.add_argument('--skip-unchanged', '-s', action='store_true',
+                                    help='compare the CRC of each page first and only program the changed ones')
+    parser_flash.add_argument('--window', '-w', type=int, default=1,
+                                    help='flash requests sent ahead of their responses, for a bootloader queuing them')
+
+    # flash_multi
+    parser_flash_multi = subparsers.add_parser(
+        'flash_multi',
+        help='write the flash of several devices at once')
+    parser_flash_multi.add_argument('addr_file', metavar='<address> <filename>',
+                                    help='address and filename, eg. 0x08000000 app.bin', nargs='+')
+    parser_flash_multi.add_argument('--ports', '-P', nargs='+', required=True,
+                                    help='serial ports, one device each')
+    parser_flash_multi.add_argument('--params',
+                                    help='file of per device writes, lines of <port> <flash|otp> <address> <hex data>')
+    parser_flash_multi.add_argument('--skip-unchanged', '-s', action='store_true',
+                                    help='compare the CRC of each page first and only program the changed ones')
+    parser_flash_multi.add_argument('--window', '-w', type=int, default=1,
+                                    help='flash requests sent ahead of their responses, for a bootloader queuing them')
 
     # write_otp
     parser_write_otp = subparsers.add_parser(
@@ -329,6 +472,9 @@ if __name__ == '__main__':
         elif args.command == 'flash':
             tremo_flash(args)
             print('Download files successfully')
+        elif args.command == 'flash_multi':
+            tremo_flash_multi(args)
+            print('Download files successfully')
         elif args.command == 'write_otp':
             tremo_write_otp(args)
             print('Write OTP successfully')
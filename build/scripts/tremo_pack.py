@@ -0,0 +1,171 @@
+import argparse
+import os
+import sys
+import struct
+import zlib
+
+
+# stream tokens decoded by the OTA bootloader, see bootloader.h
+LIT_MAX = 128
+MATCH_MIN = 4
+MATCH_MAX = 66
+MATCH_DIST = 65535
+BASE_MIN = 6
+BASE_MAX = 16384
+HASH_LEN = 4
+CHAIN_MAX = 32
+
+
+class Packer(object):
+    def __init__(self, image, base=b""):
+        self.image = image
+        self.base = base
+        self.out = bytearray()
+        self.lits = bytearray()
+        self.base_index = self.index(base, len(base))
+        self.window = {}
+
+    @staticmethod
+    def index(data, size):
+        table = {}
+        for i in range(0, size - HASH_LEN + 1):
+            table.setdefault(data[i:i+HASH_LEN], []).append(i)
+        return table
+
+    def flush_literals(self):
+        while self.lits:
+            run = self.lits[:LIT_MAX]
+            self.out.append(len(run) - 1)
+            self.out += run
+            self.lits = self.lits[LIT_MAX:]
+
+    def match_len(self, data, pos, i, limit):
+        n = 0
+        while n < limit and data[pos+n] == self.image[i+n]:
+            n += 1
+        return n
+
+    def best_base(self, i, hint):
+        # the image at the offset of the previous copy is tried first, code
+        # moved by an insertion keeps matching there
+        limit = min(BASE_MAX, len(self.image) - i)
+        best = (0, 0)
+        candidates = self.base_index.get(bytes(self.image[i:i+HASH_LEN]), [])[-CHAIN_MAX:]
+        if 0 <= hint < len(self.base):
+            candidates = [hint] + candidates
+        for pos in candidates:
+            n = self.match_len(self.base, pos, i, min(limit, len(self.base) - pos))
+            if n > best[0]:
+                best = (n, pos)
+        return best
+
+    def best_window(self, i):
+        limit = min(MATCH_MAX, len(self.image) - i)
+        best = (0, 0)
+        for pos in reversed(self.window.get(bytes(self.image[i:i+HASH_LEN]), [])[-CHAIN_MAX:]):
+            if i - pos > MATCH_DIST:
+                break
+            n = self.match_len(self.image, pos, i, limit)
+            if n > best[0]:
+                best = (n, i - pos)
+        return best
+
+    def add_window(self, start, end):
+        for j in range(start, min(end, len(self.image) - HASH_LEN + 1)):
+            self.window.setdefault(bytes(self.image[j:j+HASH_LEN]), []).append(j)
+
+    def pack(self):
+        i = 0
+        hint = -1
+        while i < len(self.image):
+            base_len, base_pos = self.best_base(i, hint)
+            win_len, win_dist = self.best_window(i)
+
+            # bytes saved over literals, a token costs its size
+            if base_len >= BASE_MIN and base_len - 5 >= win_len - 3:
+                self.flush_literals()
+                n = base_len - 1
+                self.out += struct.pack('<BB', 0xC0 | (n >> 8), n & 0xFF)
+                self.out += struct.pack('<I', base_pos)[:3]
+                step = base_len
+                hint = base_pos + base_len
+            elif win_len >= MATCH_MIN:
+                self.flush_literals()
+                self.out += struct.pack('<BH', 0x80 | (win_len - 3), win_dist)
+                step = win_len
+                if hint >= 0:
+                    hint += win_len
+            else:
+                self.lits.append(self.image[i])
+                step = 1
+                if hint >= 0:
+                    hint += 1
+
+            self.add_window(i, i + step)
+            i += step
+        self.flush_literals()
+        return bytes(self.out)
+
+
+def unpack(stream, base=b""):
+    out = bytearray()
+    i = 0
+    while i < len(stream):
+        t = stream[i]
+        if t < 0x80:
+            out += stream[i+1:i+2+t]
+            i += 2 + t
+        elif t < 0xC0:
+            n = (t & 0x3F) + 3
+            dist = stream[i+1] | (stream[i+2] << 8)
+            for _ in range(n):
+                out.append(out[-dist])
+            i += 3
+        else:
+            n = (((t & 0x3F) << 8) | stream[i+1]) + 1
+            off = stream[i+2] | (stream[i+3] << 8) | (stream[i+4] << 16)
+            out += base[off:off+n]
+            i += 5
+    return bytes(out)
+
+
+def tremo_pack(args):
+    with open(args.image, 'rb') as f:
+        image = f.read()
+    base = b""
+    if args.base:
+        with open(args.base, 'rb') as f:
+            base = f.read()
+
+    stream = Packer(image, base).pack()
+    if unpack(stream, base) != image:
+        raise Exception('the stream does not decode to the image')
+
+    with open(args.output, 'wb') as f:
+        f.write(stream)
+
+    print('image: %d bytes, crc32 0x%08X' % (len(image), zlib.crc32(image) & 0xFFFFFFFF))
+    if base:
+        print('base:  %d bytes, crc32 0x%08X' % (len(base), zlib.crc32(base) & 0xFFFFFFFF))
+    print('stream: %d bytes (%.1f%%)' % (len(stream), 100.0 * len(stream) / max(len(image), 1)))
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description='pack an image for the STREAM commands of the OTA bootloader')
+
+    parser.add_argument('image', help='new image, eg. app.bin')
+    parser.add_argument('output', help='stream file to send')
+    parser.add_argument(
+        '--base', '-d',
+        help='installed image, the stream is then a delta patch against it')
+
+    args = parser.parse_args()
+
+    try:
+        if os.access(args.image, os.R_OK) is False:
+            raise Exception('failed to read the file: %s' % args.image)
+        tremo_pack(args)
+    except Exception as e:
+        print(str(e))
+        sys.exit(1)
@@ -0,0 +1,181 @@
+import argparse
+import hashlib
+import os
+import secrets
+import struct
+import sys
+import zlib
+
+
+# secp256r1, the curve of lora/system/crypto/ecdsa-job.c
+P = 0xFFFFFFFF00000001000000000000000000000000FFFFFFFFFFFFFFFFFFFFFFFF
+A = P - 3
+N = 0xFFFFFFFF00000000FFFFFFFFFFFFFFFFBCE6FAADA7179E84F3B9CAC2FC632551
+G = (0x6B17D1F2E12C4247F8BCE6E563A440F277037D812DEB33A0F4A13945D898C296,
+     0x4FE342E2FE1A7F9B8EE7EB4A7C0F9E162BCE33576B315ECECBB6406837BF51F5)
+
+# fixed-base comb of the verification, ECDSA_COMB_TEETH and ECDSA_COMB_SPACING
+COMB_TEETH = 4
+COMB_SPACING = 64
+
+
+def point_add(p, q):
+    if p is None:
+        return q
+    if q is None:
+        return p
+    if p[0] == q[0]:
+        if (p[1] + q[1]) % P == 0:
+            return None
+        s = (3 * p[0] * p[0] + A) * pow(2 * p[1], P - 2, P) % P
+    else:
+        s = (q[1] - p[1]) * pow(q[0] - p[0], P - 2, P) % P
+    x = (s * s - p[0] - q[0]) % P
+    return (x, (s * (p[0] - x) - p[1]) % P)
+
+
+def point_mul(k, p):
+    r = None
+    while k:
+        if k & 1:
+            r = point_add(r, p)
+        p = point_add(p, p)
+        k >>= 1
+    return r
+
+
+def comb_table(p):
+    # entry i - 1 is the sum of 2^(COMB_SPACING * t) * p over the bits t of i
+    teeth = [point_mul(1 << (COMB_SPACING * t), p) for t in range(COMB_TEETH)]
+    table = []
+    for i in range(1, 1 << COMB_TEETH):
+        q = None
+        for t in range(COMB_TEETH):
+            if i & (1 << t):
+                q = point_add(q, teeth[t])
+        table.append(q)
+    return table
+
+
+def comb_verify(q, digest, r, s):
+    # the walk of EcdsaJobStep, checked against the plain verification
+    e = int.from_bytes(digest, 'big') % N
+    w = pow(s, N - 2, N)
+    u1 = e * w % N
+    u2 = r * w % N
+    tg = comb_table(G)
+    tq = comb_table(q)
+    acc = None
+    for col in range(COMB_SPACING - 1, -1, -1):
+        acc = point_add(acc, acc)
+        ig = sum(((u1 >> (COMB_SPACING * t + col)) & 1) << t for t in range(COMB_TEETH))
+        iq = sum(((u2 >> (COMB_SPACING * t + col)) & 1) << t for t in range(COMB_TEETH))
+        if ig:
+            acc = point_add(acc, tg[ig - 1])
+        if iq:
+            acc = point_add(acc, tq[iq - 1])
+    return acc is not None and acc[0] % N == r
+
+
+def sign(d, digest):
+    e = int.from_bytes(digest, 'big') % N
+    while True:
+        k = secrets.randbelow(N - 1) + 1
+        r = point_mul(k, G)[0] % N
+        s = pow(k, N - 2, N) * (e + r * d) % N
+        if r and s:
+            return r, s
+
+
+def le(v):
+    return v.to_bytes(32, 'little')
+
+
+def c_table(name, table):
+    lines = ['static const EcdsaPoint_t %s[ECDSA_COMB_POINTS] =' % name, '{']
+    for x, y in table:
+        for label, v in (('x', x), ('y', y)):
+            b = le(v)
+            lines.append('    %s{ %s,' % ('{ ' if label == 'x' else '  ',
+                                         ', '.join('0x%02X' % c for c in b[:16])))
+            lines.append('        %s }%s' % (', '.join('0x%02X' % c for c in b[16:]),
+                                            ',' if label == 'x' else ' },'))
+    lines.append('};')
+    return '\n'.join(lines) + '\n'
+
+
+def read_key(filename):
+    with open(filename, 'r') as f:
+        d = int(f.read().strip(), 16)
+    if not 0 < d < N:
+        raise Exception('bad private key in %s' % filename)
+    return d
+
+
+def tremo_keygen(args):
+    if os.path.exists(args.key):
+        d = read_key(args.key)
+    else:
+        d = secrets.randbelow(N - 1) + 1
+        with open(args.key, 'w') as f:
+            f.write('%064x\n' % d)
+
+    q = point_mul(d, G)
+    with open(args.header, 'w') as f:
+        f.write('// generated by build/scripts/tremo_sign.py from the public key\n')
+        f.write('// %064x\n' % q[0])
+        f.write('// %064x\n' % q[1])
+        f.write('#ifndef __BOOT_KEY_H_\n#define __BOOT_KEY_H_\n\n')
+        f.write('#include "ecdsa-job.h"\n\n')
+        f.write(c_table('boot_key', comb_table(q)))
+        f.write('\n#endif //__BOOT_KEY_H_\n')
+    print('public key table: %s' % args.header)
+
+
+def tremo_sign(args):
+    d = read_key(args.key)
+    with open(args.image, 'rb') as f:
+        image = f.read()
+
+    digest = hashlib.sha256(image).digest()
+    r, s = sign(d, digest)
+    if not comb_verify(point_mul(d, G), digest, r, s):
+        raise Exception('the signature does not verify')
+
+    crc = zlib.crc32(image) & 0xFFFFFFFF
+    commit = struct.pack('<III', args.version, len(image), crc) + le(r) + le(s)
+    with open(args.output, 'wb') as f:
+        f.write(commit)
+
+    print('image: %d bytes, crc32 0x%08X, sha256 %s' % (len(image), crc, digest.hex()))
+    print('SLOT_COMMIT data: %s' % commit.hex())
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description='sign the images checked by the OTA bootloader built with CONFIG_BOOT_SIGNED')
+    subparsers = parser.add_subparsers()
+
+    parser_keygen = subparsers.add_parser('keygen', help='make a key and the public key table of the bootloader')
+    parser_keygen.set_defaults(func=tremo_keygen)
+    parser_keygen.add_argument('key', help='private key file, kept off the devices, reused if it exists')
+    parser_keygen.add_argument('header', help='public key table, eg. inc/boot_key.h')
+
+    parser_sign = subparsers.add_parser('sign', help='sign an image, write the SLOT_COMMIT data')
+    parser_sign.set_defaults(func=tremo_sign)
+    parser_sign.add_argument('key', help='private key file')
+    parser_sign.add_argument('image', help='new image, eg. app.bin')
+    parser_sign.add_argument('output', help='SLOT_COMMIT data: version(4) size(4) crc(4) r(32) s(32)')
+    parser_sign.add_argument('--version', '-v', type=lambda x: int(x, 0), default=1,
+                             help='image version, above the installed one')
+
+    args = parser.parse_args()
+    if not hasattr(args, 'func'):
+        parser.print_help()
+        sys.exit(1)
+
+    try:
+        args.func(args)
+    except Exception as e:
+        print(str(e))
+        sys.exit(1)
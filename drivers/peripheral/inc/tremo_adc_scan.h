@@ -0,0 +1,87 @@
+/**
+ ******************************************************************************
+ * @file    tremo_adc_scan.h
+ * @author  ASR Tremo Team
+ * @version v1.6.2
+ * @date    2022-05-28
+ * @brief   Header file of the ADC channel scan: a sequence converted in one
+ *          go into a DMA buffer, calibrated into cached values.
+ * @addtogroup Tremo_Drivers
+ * @{
+ * @defgroup ADC_SCAN
+ * @{
+ */
+
+#ifndef __TREMO_ADC_SCAN_H_
+#define __TREMO_ADC_SCAN_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tremo_adc.h"
+#include "tremo_dma_job.h"
+
+#ifndef ADC_SCAN_CHAN_MAX
+#define ADC_SCAN_CHAN_MAX (8) /*!< Channels of a scan, 15 at most*/
+#endif
+
+#define ADC_SCAN_UNITY (65536) /*!< scale of a channel giving mV*/
+
+/**
+ * @brief Channel of a scan, its value being mV * scale / ADC_SCAN_UNITY + offset
+ */
+typedef struct {
+    adc_sample_chan_t chan; /*!< ADC channel*/
+    bool vbat31;            /*!< VBAT/3 switched on during the scan*/
+    int32_t scale;          /*!< Q16 scale, e.g. 3 * ADC_SCAN_UNITY for VBAT/3 in mV*/
+    int32_t offset;         /*!< offset, in the unit of the value*/
+} adc_scan_chan_t;
+
+typedef struct adc_scan adc_scan_t;
+
+/**
+ * @brief Scan done callback, called from the DMA interrupt
+ * @param scan the scan, its values updated
+ * @param success false on a DMA error, the values kept
+ */
+typedef void (*adc_scan_callback_t)(adc_scan_t* scan, bool success);
+
+/**
+ * @brief ADC channel scan
+ */
+struct adc_scan {
+    dma_chan_t chan;                         /*!< DMA channel*/
+    const adc_scan_chan_t* chans;            /*!< channels, in the sequence order*/
+    uint8_t count;                           /*!< number of channels*/
+    bool vbat31;                             /*!< private, a channel needs VBAT/3*/
+    volatile bool busy;                      /*!< scan running*/
+    bool valid;                              /*!< values set by a scan*/
+    int64_t gain[ADC_SCAN_CHAN_MAX];         /*!< private, Q16 value per ADC code*/
+    int64_t offset[ADC_SCAN_CHAN_MAX];       /*!< private, Q16 value at code 0*/
+    int32_t value[ADC_SCAN_CHAN_MAX];        /*!< values of the last scan*/
+    uint32_t time;                           /*!< time given to the last scan started*/
+    uint32_t start_time;                     /*!< private, time of the scan running*/
+    uint16_t codes[ADC_SCAN_CHAN_MAX + 1];   /*!< private, DMA buffer, the first code dropped*/
+    adc_scan_callback_t done;                /*!< optional done callback*/
+    void* arg;                               /*!< user argument*/
+    dma_job_t job;                           /*!< DMA job*/
+};
+
+int32_t adc_scan_init(adc_scan_t* scan, const adc_scan_chan_t* chans, uint8_t count, bool diff);
+int32_t adc_scan_deinit(adc_scan_t* scan);
+
+int32_t adc_scan_start(adc_scan_t* scan, uint32_t time);
+bool adc_scan_get(adc_scan_t* scan, uint8_t index, int32_t* value, uint32_t* time);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __TREMO_ADC_SCAN_H_ */
+
+/**
+ * @}
+ * @}
+ */
@@ -0,0 +1,142 @@
+/**
+ ******************************************************************************
+ * @file    tremo_adc_stream.h
+ * @author  ASR Tremo Team
+ * @version v1.6.2
+ * @date    2022-05-28
+ * @brief   Header file of the timer triggered ADC acquisition with DMA and
+ *          reduction stages.
+ * @addtogroup Tremo_Drivers
+ * @{
+ * @defgroup ADC_STREAM
+ * @{
+ */
+
+#ifndef __TREMO_ADC_STREAM_H_
+#define __TREMO_ADC_STREAM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tremo_adc.h"
+#include "tremo_dma_job.h"
+
+#define ADC_STREAM_BLOCK_MAX (4095) /*!< Largest ring half, in samples*/
+#define ADC_STREAM_MV_SHIFT  (4)    /*!< Calibrated samples are in 1/16 mV*/
+#define ADC_STAGE_FIR_BLOCK  (32)   /*!< Samples filtered at a time by a FIR stage*/
+#define ADC_SUMMARY_SIZE     (10)   /*!< Bytes of a packed summary*/
+
+typedef struct adc_stream adc_stream_t;
+typedef struct adc_stage adc_stage_t;
+
+/**
+ * @brief Reduction stage, fed with calibrated samples by adc_stream_process
+ */
+struct adc_stage {
+    void (*process)(adc_stage_t* stage, const int16_t* samples, uint16_t len); /*!< consumes the samples*/
+    adc_stage_t* next; /*!< next stage fed with the same samples*/
+};
+
+/**
+ * @brief Summary of a window of samples, in 1/16 mV
+ */
+typedef struct {
+    uint16_t count; /*!< samples in the window*/
+    int16_t mean;   /*!< mean*/
+    int16_t rms;    /*!< root mean square*/
+    int16_t min;    /*!< smallest sample*/
+    int16_t max;    /*!< largest sample*/
+} adc_summary_t;
+
+typedef struct adc_stage_stats adc_stage_stats_t;
+
+/**
+ * @brief Summary callback, called from adc_stream_process
+ * @param stats the stage
+ * @param summary the summary of the window just completed
+ */
+typedef void (*adc_summary_callback_t)(adc_stage_stats_t* stats, const adc_summary_t* summary);
+
+/**
+ * @brief Mean, RMS, min and max stage, one summary per window
+ */
+struct adc_stage_stats {
+    adc_stage_t stage;           /*!< stage, first member*/
+    uint16_t window;             /*!< samples per summary*/
+    adc_summary_callback_t done; /*!< summary callback*/
+    void* arg;                   /*!< callback argument*/
+    uint16_t count;              /*!< private, samples of the window so far*/
+    int32_t sum;                 /*!< private*/
+    uint64_t sum_sq;             /*!< private*/
+    uint32_t min;                /*!< private, lowest sample of each lane*/
+    uint32_t max;                /*!< private, largest sample of each lane*/
+};
+
+/**
+ * @brief Decimating FIR stage, its output fed to the sink stages
+ */
+typedef struct {
+    adc_stage_t stage;     /*!< stage, first member*/
+    const int16_t* coeffs; /*!< Q15 taps in time reversed order, coeffs[0] applied to the oldest sample*/
+    uint16_t num_taps;     /*!< number of taps*/
+    uint8_t factor;        /*!< decimation factor, one output every factor samples*/
+    uint8_t phase;         /*!< private, input samples before the next output*/
+    int16_t* state;        /*!< num_taps - 1 + ADC_STAGE_FIR_BLOCK samples*/
+    adc_stage_t* sink;     /*!< stages fed with the output*/
+} adc_stage_fir_t;
+
+/**
+ * @brief Half ready callback, called from the DMA interrupt
+ * @param stream the stream, adc_stream_process to be called
+ */
+typedef void (*adc_stream_callback_t)(adc_stream_t* stream);
+
+/**
+ * @brief ADC acquisition stream
+ */
+struct adc_stream {
+    dma_chan_t chan;                  /*!< DMA channel*/
+    int32_t gain;                     /*!< Q16, 1/16 mV per ADC code*/
+    int32_t offset;                   /*!< Q16, 1/16 mV*/
+    uint16_t* buf;                    /*!< DMA ring*/
+    uint16_t size;                    /*!< DMA ring size*/
+    volatile bool running;            /*!< DMA running, false again on a DMA error*/
+    volatile uint8_t ready;           /*!< halves filled, bit 0 and bit 1*/
+    uint8_t half;                     /*!< private, next half the DMA completes*/
+    uint8_t next;                     /*!< private, next half processed*/
+    volatile uint32_t overruns;       /*!< halves overwritten before their processing*/
+    adc_stage_t* stages;              /*!< stages fed with the calibrated samples*/
+    adc_stream_callback_t notify;     /*!< optional half ready callback*/
+    void* arg;                        /*!< user argument*/
+    dma_job_t job;                    /*!< DMA job*/
+    dma_lli_block_config_t blocks[2]; /*!< ring halves*/
+    dma_lli_t lli[2];                 /*!< LLI nodes*/
+};
+
+int32_t adc_stream_init(adc_stream_t* stream, bool diff);
+int32_t adc_stream_deinit(adc_stream_t* stream);
+
+void adc_stream_add_stage(adc_stream_t* stream, adc_stage_t* stage);
+int32_t adc_stream_start(adc_stream_t* stream, uint16_t* buf, uint16_t size, adc_trigger_source_t trigger);
+void adc_stream_stop(adc_stream_t* stream);
+uint8_t adc_stream_process(adc_stream_t* stream);
+int16_t adc_stream_calibrate(adc_stream_t* stream, uint16_t code);
+
+void adc_stage_stats_init(adc_stage_stats_t* stats, uint16_t window, adc_summary_callback_t done);
+int32_t adc_stage_fir_init(adc_stage_fir_t* fir, const int16_t* coeffs, uint16_t num_taps, uint8_t factor, int16_t* state);
+void adc_stage_fir_add_sink(adc_stage_fir_t* fir, adc_stage_t* stage);
+
+uint8_t adc_summary_pack(const adc_summary_t* summary, uint8_t* buf);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __TREMO_ADC_STREAM_H_ */
+
+/**
+ * @}
+ * @}
+ */
@@ -55,12 +55,24 @@ typedef struct {
     bool reverse_out;             /*!< The reverse config of the output data */
 } crc_config_t;
 
+/**
+ * @brief The running state of a CRC calculated by parts
+ */
+typedef struct {
+    crc_config_t config;  /*!< The configuration of the CRC, 32bits polynomial size */
+    uint32_t value;       /*!< The CRC register, before the output reverse */
+} crc_ctx_t;
+
 void crc_deinit(void);
 void crc_init(crc_config_t* config);
 uint32_t crc_calc32(uint32_t* data, uint32_t size);
 uint32_t crc_calc16(uint16_t* data, uint32_t size);
 uint32_t crc_calc8(uint8_t* data, uint32_t size);
 
+void crc_ctx_init(crc_ctx_t* ctx, crc_config_t* config);
+void crc_ctx_update(crc_ctx_t* ctx, const uint8_t* data, uint32_t size);
+uint32_t crc_ctx_value(crc_ctx_t* ctx);
+
 #ifdef __cplusplus
 }
 #endif
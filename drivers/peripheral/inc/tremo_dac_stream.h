@@ -0,0 +1,82 @@
+/**
+ ******************************************************************************
+ * @file    tremo_dac_stream.h
+ * @author  ASR Tremo Team
+ * @version v1.6.2
+ * @date    2022-05-28
+ * @brief   Header file of the timer triggered DAC waveform output with a
+ *          circular DMA and fixed point waveform synthesis.
+ * @addtogroup Tremo_Drivers
+ * @{
+ * @defgroup DAC_STREAM
+ * @{
+ */
+
+#ifndef __TREMO_DAC_STREAM_H_
+#define __TREMO_DAC_STREAM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tremo_dac.h"
+#include "tremo_bstimer.h"
+#include "tremo_dma_job.h"
+
+#define DAC_STREAM_TABLE_MAX (8190) /*!< Longest table, in samples, two DMA blocks*/
+#define DAC_STREAM_CODE_MAX  (4095) /*!< Largest DAC code*/
+
+typedef struct dac_stream dac_stream_t;
+
+/**
+ * @brief Swap callback, called from the DMA interrupt once the table queued
+ *        by dac_stream_swap plays
+ * @param stream the stream
+ */
+typedef void (*dac_stream_callback_t)(dac_stream_t* stream);
+
+/**
+ * @brief DAC waveform stream
+ */
+struct dac_stream {
+    dma_chan_t chan;                  /*!< DMA channel*/
+    bstimer_t* timer;                 /*!< trigger timer, BSTIMER0 or BSTIMER1*/
+    const uint16_t* table;            /*!< table played*/
+    uint16_t len;                     /*!< table length*/
+    volatile bool running;            /*!< DMA running, false again on a DMA error*/
+    volatile uint32_t periods;        /*!< tables played since the start*/
+    const uint16_t* next_table;       /*!< private, table queued by dac_stream_swap*/
+    uint16_t next_len;                /*!< private*/
+    volatile uint8_t swap;            /*!< private, 0 none, 1 queued, 2 first half loaded*/
+    uint8_t half;                     /*!< private, next block the DMA completes*/
+    dac_stream_callback_t notify;     /*!< optional swap callback*/
+    void* arg;                        /*!< user argument*/
+    dma_job_t job;                    /*!< DMA job*/
+    dma_lli_block_config_t blocks[2]; /*!< table halves*/
+    dma_lli_t lli[2];                 /*!< LLI nodes*/
+};
+
+int32_t dac_stream_init(dac_stream_t* stream, bstimer_t* timer);
+int32_t dac_stream_deinit(dac_stream_t* stream);
+
+int32_t dac_stream_start(dac_stream_t* stream, const uint16_t* table, uint16_t len, uint32_t rate);
+void dac_stream_stop(dac_stream_t* stream);
+int32_t dac_stream_swap(dac_stream_t* stream, const uint16_t* table, uint16_t len);
+int32_t dac_stream_set_rate(dac_stream_t* stream, uint32_t rate);
+
+void dac_stream_sine(uint16_t* table, uint16_t len, uint16_t cycles, uint16_t offset, uint16_t amplitude);
+void dac_stream_square(uint16_t* table, uint16_t len, uint16_t cycles, uint8_t duty, uint16_t low, uint16_t high);
+void dac_stream_chirp(uint16_t* table, uint16_t len, uint16_t start_cycles, uint16_t end_cycles, uint16_t offset,
+    uint16_t amplitude);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __TREMO_DAC_STREAM_H_ */
+
+/**
+ * @}
+ * @}
+ */
@@ -170,11 +170,15 @@ extern "C" {
 #define DMA_STATUS_TFR_H_REG(i)   (DMA_BASE + i * 0x1000 + 0x2EC)
 #define DMA_STATUS_BLOCK_L_REG(i) (DMA_BASE + i * 0x1000 + 0x2F0)
 #define DMA_STATUS_BLOCK_H_REG(i) (DMA_BASE + i * 0x1000 + 0x2F4)
+#define DMA_STATUS_ERR_L_REG(i)   (DMA_BASE + i * 0x1000 + 0x308)
+#define DMA_STATUS_ERR_H_REG(i)   (DMA_BASE + i * 0x1000 + 0x30C)
 
 #define DMA_MASK_TFR_L_REG(i)   (DMA_BASE + i * 0x1000 + 0x310)
 #define DMA_MASK_TFR_H_REG(i)   (DMA_BASE + i * 0x1000 + 0x314)
 #define DMA_MASK_BLOCK_L_REG(i) (DMA_BASE + i * 0x1000 + 0x318)
 #define DMA_MASK_BLOCK_H_REG(i) (DMA_BASE + i * 0x1000 + 0x31C)
+#define DMA_MASK_ERR_L_REG(i)   (DMA_BASE + i * 0x1000 + 0x330)
+#define DMA_MASK_ERR_H_REG(i)   (DMA_BASE + i * 0x1000 + 0x334)
 
 #define DMA_CLEAR_TFR_L_REG(i)      (DMA_BASE + i * 0x1000 + 0x338)
 #define DMA_CLEAR_TFR_H_REG(i)      (DMA_BASE + i * 0x1000 + 0x33C)
@@ -205,6 +209,9 @@ extern "C" {
 
 typedef void (*dma_callback_func)(void); /*!< DMA callback function*/
 
+extern dma_callback_func g_dma_callback_handler[TREMO_DMA_NUM][TREMO_DMA_CHAN_NUM]; /*!< DMA block callbacks*/
+extern dma_callback_func g_dma_error_handler[TREMO_DMA_NUM][TREMO_DMA_CHAN_NUM];    /*!< DMA error callbacks, the error interrupt unmasked*/
+
 /**
  * @brief DMA mode
  */
@@ -0,0 +1,89 @@
+/**
+ ******************************************************************************
+ * @file    tremo_dma_job.h
+ * @author  ASR Tremo Team
+ * @version v1.6.2
+ * @date    2022-05-28
+ * @brief   Header file of the DMA channel allocator and transfer jobs.
+ * @addtogroup Tremo_Drivers
+ * @{
+ * @defgroup DMA_JOB
+ * @{
+ */
+
+#ifndef __TREMO_DMA_JOB_H_
+#define __TREMO_DMA_JOB_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tremo_dma.h"
+
+/**
+ * @brief Channels never handed out, bit (dma_num * 4 + ch): by default the
+ *        printf channel (DMA0 channel 0) and the radio SPI ones (DMA1
+ *        channels 2 and 3), which program the controller directly
+ */
+#ifndef CONFIG_DMA_CHAN_RESERVED
+#define CONFIG_DMA_CHAN_RESERVED 0xC1
+#endif
+
+/**
+ * @brief DMA channel
+ */
+typedef struct {
+    uint8_t dma_num; /*!< DMA number*/
+    uint8_t ch;      /*!< DMA channel*/
+} dma_chan_t;
+
+/**
+ * @brief Job flags
+ */
+#define DMA_JOB_CIRCULAR (1 << 0) /*!< blocks looped until dma_job_abort, the callback called per block*/
+
+typedef struct dma_job dma_job_t;
+
+/**
+ * @brief Job completion callback, called from the DMA interrupt
+ * @param job the job done
+ * @param success false on a transfer error
+ */
+typedef void (*dma_job_callback_t)(dma_job_t* job, bool success);
+
+/**
+ * @brief DMA transfer job, owned by the driver from its submission to its
+ *        callback
+ */
+struct dma_job {
+    dma_dev_t dev;                  /*!< transfer configuration, dma_num, ch and priv set on submission*/
+    dma_lli_block_config_t* blocks; /*!< blocks chained by LLI, NULL for the dev.src/dev.dest block*/
+    dma_lli_t* lli;                 /*!< LLI nodes, one per block, word aligned*/
+    uint16_t block_num;             /*!< number of blocks*/
+    uint8_t flags;                  /*!< DMA_JOB_xxx, 0 for a job done after its last block*/
+    void (*start)(dma_job_t* job);  /*!< optional, enables the peripheral request once the channel runs*/
+    dma_job_callback_t done;        /*!< completion callback*/
+    void* arg;                      /*!< callback argument*/
+    dma_job_t* next;                /*!< private, queue of the channel*/
+};
+
+int32_t dma_chan_acquire(dma_chan_t* chan);
+int32_t dma_chan_claim(uint8_t dma_num, uint8_t ch);
+int32_t dma_chan_release(dma_chan_t chan);
+
+int32_t dma_job_submit(dma_chan_t chan, dma_job_t* job);
+int32_t dma_job_abort(dma_chan_t chan);
+bool dma_job_busy(dma_chan_t chan);
+uint32_t dma_chan_get_dest(dma_chan_t chan);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __TREMO_DMA_JOB_H_ */
+
+/**
+ * @}
+ * @}
+ */
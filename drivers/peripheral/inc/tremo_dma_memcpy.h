@@ -0,0 +1,92 @@
+/**
+ ******************************************************************************
+ * @file    tremo_dma_memcpy.h
+ * @author  ASR Tremo Team
+ * @version v1.6.2
+ * @date    2022-05-28
+ * @brief   Header file of the asynchronous memory to memory DMA copies.
+ * @addtogroup Tremo_Drivers
+ * @{
+ * @defgroup DMA_MEMCPY
+ * @{
+ */
+
+#ifndef __TREMO_DMA_MEMCPY_H_
+#define __TREMO_DMA_MEMCPY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tremo_dma_job.h"
+
+/**
+ * @brief Copies shorter than this are done by the CPU, in bytes
+ */
+#ifndef CONFIG_DMA_MEMCPY_THRESHOLD
+#define CONFIG_DMA_MEMCPY_THRESHOLD 64
+#endif
+
+/**
+ * @brief Blocks chained per DMA job, the copy goes on in the next job
+ *        from the completion interrupt
+ */
+#ifndef CONFIG_DMA_MEMCPY_BLOCKS
+#define CONFIG_DMA_MEMCPY_BLOCKS 4
+#endif
+
+#define DMA_MEMCPY_BLOCK_MAX (4095) /*!< Largest DMA block, in transfers*/
+
+/**
+ * @brief Segment of a scatter-gather copy
+ */
+typedef struct {
+    void* dst;       /*!< destination*/
+    const void* src; /*!< source*/
+    uint32_t len;    /*!< length in bytes*/
+} dma_memcpy_seg_t;
+
+typedef struct dma_memcpy dma_memcpy_t;
+
+/**
+ * @brief Copy done callback, called from the DMA interrupt, or before
+ *        dma_memcpy returns for a copy done by the CPU
+ * @param copy the copy
+ * @param success false on a DMA error
+ */
+typedef void (*dma_memcpy_callback_t)(dma_memcpy_t* copy, bool success);
+
+/**
+ * @brief Copy, owned by the driver from its start to its callback
+ */
+struct dma_memcpy {
+    dma_memcpy_callback_t done;                              /*!< completion callback*/
+    void* arg;                                               /*!< callback argument*/
+    volatile bool busy;                                      /*!< true until the callback*/
+    const dma_memcpy_seg_t* segs;                            /*!< private, segments*/
+    uint16_t seg_num;                                        /*!< private*/
+    uint16_t seg;                                            /*!< private, segment copied next*/
+    uint32_t offset;                                         /*!< private, offset in it*/
+    dma_memcpy_seg_t one;                                    /*!< private, segment of dma_memcpy*/
+    dma_job_t job;                                           /*!< private, DMA job*/
+    dma_lli_block_config_t blocks[CONFIG_DMA_MEMCPY_BLOCKS]; /*!< private*/
+    dma_lli_t lli[CONFIG_DMA_MEMCPY_BLOCKS];                 /*!< private, LLI nodes*/
+};
+
+int32_t dma_memcpy_init(void);
+int32_t dma_memcpy_deinit(void);
+
+int32_t dma_memcpy(dma_memcpy_t* copy, void* dst, const void* src, uint32_t len, dma_memcpy_callback_t done);
+int32_t dma_memcpy_sg(dma_memcpy_t* copy, const dma_memcpy_seg_t* segs, uint16_t seg_num, dma_memcpy_callback_t done);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __TREMO_DMA_MEMCPY_H_ */
+
+/**
+ * @}
+ * @}
+ */
@@ -19,6 +19,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "tremo_regs.h"
 
 #define FLASH_LINE_SIZE       (0x200)                  /*!< The size of the flash word line */
@@ -35,6 +36,43 @@ extern "C" {
 #define ERRNO_FLASH_OTP_REFLASH        (-103)
 #define ERRNO_FLASH_SEC_ERROR          (-104)
 
+/**
+ * @brief Streaming flash writer, the data is committed by word lines
+ */
+typedef struct {
+    uint32_t addr;                          /*!< flash address of the next byte to be written*/
+    uint32_t erased;                        /*!< end of the pages erased or being erased, 0 without erase-ahead*/
+    uint32_t erase_end;                     /*!< end of the area the writer erases*/
+    uint16_t len;                           /*!< bytes buffered, ending at addr*/
+    uint32_t line[FLASH_LINE_SIZE / 4];     /*!< line buffer, word aligned*/
+} flash_writer_t;
+
+#ifndef CONFIG_FLASH_QUEUE_CHUNK
+#define CONFIG_FLASH_QUEUE_CHUNK (64) /*!< Bytes programmed by a step of flash_queue_process, a multiple of 8 */
+#endif
+
+typedef struct flash_op flash_op_t;
+
+/**
+ * @brief Completion callback of a queued flash operation
+ * @param op The operation, free again
+ * @param status ERRNO_OK, or the error of the erase or program
+ */
+typedef void (*flash_op_callback_t)(flash_op_t* op, int32_t status);
+
+/**
+ * @brief Queued flash operation, owned by the queue from its submission to its callback
+ */
+struct flash_op {
+    uint32_t addr;            /*!< flash address, aligned by a page for an erase and by 8 bytes for a program*/
+    const uint8_t* data;      /*!< data to be programmed, NULL to erase the pages*/
+    uint32_t size;            /*!< size of the data, or of the area to be erased*/
+    flash_op_callback_t done; /*!< optional completion callback*/
+    void* arg;                /*!< callback argument*/
+    uint32_t pos;             /*!< private, bytes done*/
+    flash_op_t* next;         /*!< private*/
+};
+
 #define FLASH_CR_LOCK()                           \
     do {                                          \
         EFC->PROTECT_SEQ = FLASH_CR_PROTECT_SEQ0; \
@@ -48,13 +86,23 @@ extern "C" {
     } while (0)
 
 int32_t flash_erase_all(void);
-int32_t flash_erase_page(uint32_t addr);
+RAM_FUNC_ATTR int32_t flash_erase_page(uint32_t addr);
+RAM_FUNC_ATTR int32_t flash_erase_page_start(uint32_t addr);
+bool flash_erase_busy(void);
 
-int32_t flash_program_bytes(uint32_t addr, uint8_t* data, uint32_t size);
+RAM_FUNC_ATTR int32_t flash_program_bytes(uint32_t addr, uint8_t* data, uint32_t size);
 RAM_FUNC_ATTR int32_t flash_program_line(uint32_t addr, uint8_t* data);
 
 int32_t flash_otp_program_data(uint32_t addr, uint8_t* data, uint32_t size);
 
+int32_t flash_writer_init(flash_writer_t* writer, uint32_t addr, uint32_t erase_size);
+int32_t flash_writer_write(flash_writer_t* writer, const uint8_t* data, uint32_t size);
+int32_t flash_writer_flush(flash_writer_t* writer);
+
+int32_t flash_queue_submit(flash_op_t* op);
+bool flash_queue_process(void);
+bool flash_queue_busy(void);
+
 #ifdef __cplusplus
 }
 #endif
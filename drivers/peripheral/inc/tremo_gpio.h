@@ -118,6 +118,64 @@ void gpio_config_drive_capability(gpio_t* gpiox, uint8_t gpio_pin, gpio_drive_ca
 
 void gpio_set_iomux(gpio_t* gpiox, uint8_t gpio_pin, uint8_t func_num);
 
+/**
+ * @brief Set the specified GPIO pin high with one store to the bit set register
+ * @note No parameter check, and not for the GPIOD pins 8 to 15 in open drain
+ *       mode, which gpio_write drives through the output enable. Safe from
+ *       interrupts without a critical section
+ * @param gpiox Select the GPIO peripheral number(GPIOA, GPIOB, GPIOC and GPIOD)
+ * @param gpio_pin Select the GPIO pin number, GPIO_PIN_0 to GPIO_PIN_15
+ * @retval None
+ */
+static inline void gpio_set(gpio_t* gpiox, uint8_t gpio_pin)
+{
+    gpiox->BSR = 1 << gpio_pin;
+}
+
+/**
+ * @brief Set the specified GPIO pin low with one store to the bit reset register
+ * @note Same restrictions as gpio_set
+ * @param gpiox Select the GPIO peripheral number(GPIOA, GPIOB, GPIOC and GPIOD)
+ * @param gpio_pin Select the GPIO pin number, GPIO_PIN_0 to GPIO_PIN_15
+ * @retval None
+ */
+static inline void gpio_reset(gpio_t* gpiox, uint8_t gpio_pin)
+{
+    gpiox->BRR = 1 << gpio_pin;
+}
+
+/**
+ * @brief Toggle the specified GPIO pin without writing ODR
+ * @note Unlike gpio_toggle, an interrupt changing another pin of the port
+ *       between the read and the write is not undone. Same restrictions as
+ *       gpio_set
+ * @param gpiox Select the GPIO peripheral number(GPIOA, GPIOB, GPIOC and GPIOD)
+ * @param gpio_pin Select the GPIO pin number, GPIO_PIN_0 to GPIO_PIN_15
+ * @retval None
+ */
+static inline void gpio_flip(gpio_t* gpiox, uint8_t gpio_pin)
+{
+    if (gpiox->ODR & (1 << gpio_pin))
+        gpiox->BRR = 1 << gpio_pin;
+    else
+        gpiox->BSR = 1 << gpio_pin;
+}
+
+/**
+ * @brief Write the pins of a mask of the port, the other pins unchanged
+ * @note The pins set go high before the pins cleared go low. Same
+ *       restrictions as gpio_set
+ * @param gpiox Select the GPIO peripheral number(GPIOA, GPIOB, GPIOC and GPIOD)
+ * @param mask Pins written, bit n for GPIO_PIN_n
+ * @param value Levels of the pins, bit n for GPIO_PIN_n
+ * @retval None
+ */
+static inline void gpio_write_port(gpio_t* gpiox, uint16_t mask, uint16_t value)
+{
+    gpiox->BSR = mask & value;
+    gpiox->BRR = mask & ~value;
+}
+
 #ifdef __cplusplus
 }
 #endif
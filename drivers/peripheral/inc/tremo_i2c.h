@@ -115,6 +115,44 @@ typedef struct {
     } settings;
 } i2c_config_t;
 
+/**
+ * @brief I2C transaction segment flags
+ */
+#define I2C_SEG_WRITE (0)      /*!< Segment writing its bytes */
+#define I2C_SEG_READ  (1 << 0) /*!< Segment reading its bytes */
+
+/**
+ * @brief I2C transaction segment, started by a start or a repeated start
+ */
+typedef struct {
+    uint8_t* data; /*!< bytes written or read */
+    uint16_t len;  /*!< number of bytes, 0 only for a write probing the address */
+    uint8_t flags; /*!< I2C_SEG_WRITE or I2C_SEG_READ */
+} i2c_seg_t;
+
+typedef struct i2c_xfer i2c_xfer_t;
+
+/**
+ * @brief Transaction completion callback, called from the I2C interrupt
+ * @param xfer the transaction done
+ * @param status ERRNO_OK, ERRNO_ERROR on a NAK, a bus error, a lost
+ *        arbitration or an abort
+ */
+typedef void (*i2c_xfer_callback_t)(i2c_xfer_t* xfer, int32_t status);
+
+/**
+ * @brief I2C master transaction, owned by the driver from its submission to
+ *        its callback
+ */
+struct i2c_xfer {
+    uint8_t slave_addr;       /*!< 7 bit slave address */
+    uint8_t seg_num;          /*!< number of segments */
+    i2c_seg_t* segs;          /*!< segments, a stop follows the last one */
+    i2c_xfer_callback_t done; /*!< completion callback */
+    void* arg;                /*!< callback argument */
+    i2c_xfer_t* next;         /*!< private, queue of the bus */
+};
+
 
 void i2c_deinit(i2c_t* i2cx);
 
@@ -138,6 +176,13 @@ void i2c_send_data(i2c_t* i2cx, uint8_t data);
 uint8_t i2c_receive_data(i2c_t* i2cx);
 void i2c_set_receive_mode(i2c_t* i2cx, i2c_ack_t ack);
 
+int32_t i2c_async_init(i2c_t* i2cx);
+int32_t i2c_async_deinit(i2c_t* i2cx);
+int32_t i2c_transfer_async(i2c_t* i2cx, i2c_xfer_t* xfer);
+int32_t i2c_transfer_abort(i2c_t* i2cx);
+bool i2c_transfer_busy(i2c_t* i2cx);
+void i2c_irq_handler(i2c_t* i2cx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,104 @@
+/**
+ ******************************************************************************
+ * @file    tremo_i2s_stream.h
+ * @author  ASR Tremo Team
+ * @version v1.6.2
+ * @date    2022-05-28
+ * @brief   Header file of the double buffered I2S capture and playback with
+ *          16 bit sample packing and an energy detector.
+ * @addtogroup Tremo_Drivers
+ * @{
+ * @defgroup I2S_STREAM
+ * @{
+ */
+
+#ifndef __TREMO_I2S_STREAM_H_
+#define __TREMO_I2S_STREAM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tremo_i2s.h"
+
+#define I2S_STREAM_FIFO_LEVEL (2) /*!< FIFO level of the interrupts, in frames*/
+
+/**
+ * @brief Stream direction
+ */
+typedef enum {
+    I2S_STREAM_CAPTURE,  /*!< receive into the buffer*/
+    I2S_STREAM_PLAYBACK, /*!< transmit from the buffer*/
+} i2s_stream_dir_t;
+
+/**
+ * @brief Sample format of the buffer
+ */
+typedef enum {
+    I2S_STREAM_STEREO, /*!< left and right samples interleaved, 4 bytes a frame*/
+    I2S_STREAM_MONO,   /*!< left samples only, 2 bytes a frame, played on both channels*/
+} i2s_stream_format_t;
+
+typedef struct i2s_stream i2s_stream_t;
+
+/**
+ * @brief Buffer callback, called from the I2S interrupt when a half of the
+ *        buffer is complete
+ * @param stream the stream
+ * @param samples the half just captured, or the half to refill on playback
+ * @param frames frames in the half
+ */
+typedef void (*i2s_stream_callback_t)(i2s_stream_t* stream, int16_t* samples, uint16_t frames);
+
+/**
+ * @brief Detector callback, called from the I2S interrupt when an event starts or ends
+ * @param stream the stream
+ * @param active true at the start of an event
+ * @param energy mean square of the samples of the half
+ */
+typedef void (*i2s_stream_detect_t)(i2s_stream_t* stream, bool active, uint32_t energy);
+
+/**
+ * @brief I2S stream
+ */
+struct i2s_stream {
+    i2s_t* i2s;                    /*!< I2S*/
+    i2s_stream_dir_t dir;          /*!< direction*/
+    i2s_stream_format_t format;    /*!< buffer format*/
+    uint8_t shift;                 /*!< private, bits of the word below the 16 kept*/
+    volatile bool running;         /*!< stream running*/
+    int16_t* buffer;               /*!< ping-pong buffer, two halves*/
+    uint16_t frames;               /*!< frames in a half*/
+    uint16_t index;                /*!< private, next frame of the buffer*/
+    volatile uint32_t blocks;      /*!< halves completed since the start*/
+    volatile uint32_t overruns;    /*!< FIFO overruns*/
+    i2s_stream_callback_t half;    /*!< called when the first half completes*/
+    i2s_stream_callback_t full;    /*!< called when the second half completes*/
+    i2s_stream_detect_t detect;    /*!< optional detector callback, capture only*/
+    uint32_t detect_level;         /*!< mean square starting an event*/
+    uint8_t detect_hold;           /*!< quiet halves ending an event*/
+    uint8_t quiet;                 /*!< private, quiet halves of the event*/
+    volatile bool active;          /*!< event in progress*/
+    volatile uint32_t energy;      /*!< mean square of the last half*/
+    void* arg;                     /*!< user argument*/
+};
+
+int32_t i2s_stream_init(i2s_stream_t* stream, i2s_t* I2Sx, i2s_stream_dir_t dir, i2s_stream_format_t format);
+int32_t i2s_stream_start(i2s_stream_t* stream, int16_t* buffer, uint16_t frames);
+void i2s_stream_stop(i2s_stream_t* stream);
+void i2s_stream_set_detector(i2s_stream_t* stream, uint32_t level, uint8_t hold, i2s_stream_detect_t detect);
+void i2s_stream_irq_handler(i2s_stream_t* stream);
+
+uint32_t i2s_stream_energy(const int16_t* samples, uint32_t count);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __TREMO_I2S_STREAM_H_ */
+
+/**
+ * @}
+ * @}
+ */
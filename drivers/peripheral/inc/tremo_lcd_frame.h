@@ -0,0 +1,85 @@
+/**
+ ******************************************************************************
+ * @file    tremo_lcd_frame.h
+ * @author  ASR Tremo Team
+ * @version v1.6.2
+ * @date    2022-05-28
+ * @brief   Header file of the segment LCD frame buffer: a RAM copy of the
+ *          COM registers, digit rendering and commits of the changed COMs.
+ * @addtogroup Tremo_Drivers
+ * @{
+ * @defgroup LCD_FRAME
+ * @{
+ */
+
+#ifndef __TREMO_LCD_FRAME_H
+#define __TREMO_LCD_FRAME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tremo_lcd.h"
+
+#define LCD_FRAME_COM_NUM  (4)    /*!< COM registers of the frame*/
+#define LCD_FRAME_NO_SEG   (0xFF) /*!< com of a segment missing from a digit*/
+
+/**
+ * @brief Glyphs of a seven segment digit, bit 0 to 7 for the segments a to g
+ *        and the point
+ */
+#define LCD_FRAME_GLYPH_MINUS (0x40) /*!< '-'*/
+#define LCD_FRAME_GLYPH_BLANK (0x00) /*!< ' '*/
+#define LCD_FRAME_GLYPH_POINT (0x80) /*!< decimal point*/
+
+/**
+ * @brief Segment position
+ */
+typedef struct {
+    uint8_t com; /*!< COM number, LCD_FRAME_NO_SEG for none*/
+    uint8_t seg; /*!< segment bit of the COM*/
+} lcd_frame_seg_t;
+
+/**
+ * @brief Wiring of a seven segment digit, a to g then the point
+ */
+typedef struct {
+    lcd_frame_seg_t seg[8]; /*!< segment positions*/
+} lcd_frame_digit_t;
+
+/**
+ * @brief LCD frame buffer
+ */
+typedef struct {
+    uint32_t com[LCD_FRAME_COM_NUM];     /*!< segments drawn, not shown before a commit*/
+    uint32_t staged[LCD_FRAME_COM_NUM];  /*!< private, segments committed*/
+    uint32_t written[LCD_FRAME_COM_NUM]; /*!< private, segments in the COM registers*/
+    uint8_t coms;                        /*!< COMs used*/
+    bool sync;                           /*!< commits written at the frame interrupt*/
+    volatile uint8_t pending;            /*!< private, COMs to write at the interrupt*/
+    uint32_t writes;                     /*!< COM registers written*/
+} lcd_frame_t;
+
+void lcd_frame_init(lcd_frame_t* frame, lcd_com_use_t coms, bool sync);
+void lcd_frame_clear(lcd_frame_t* frame);
+void lcd_frame_set(lcd_frame_t* frame, uint8_t com, uint8_t seg, bool on);
+
+void lcd_frame_glyph(lcd_frame_t* frame, const lcd_frame_digit_t* digit, uint8_t glyph);
+int32_t lcd_frame_char(lcd_frame_t* frame, const lcd_frame_digit_t* digit, char c);
+int32_t lcd_frame_number(lcd_frame_t* frame, const lcd_frame_digit_t* digits, uint8_t count, int32_t value, uint8_t decimals);
+
+uint8_t lcd_frame_commit(lcd_frame_t* frame);
+bool lcd_frame_busy(lcd_frame_t* frame);
+void lcd_frame_irq_handler(lcd_frame_t* frame);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __TREMO_LCD_FRAME_H */
+
+/**
+ * @}
+ * @}
+ */
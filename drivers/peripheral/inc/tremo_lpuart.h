@@ -145,7 +145,7 @@ typedef struct {
 void lpuart_init(lpuart_t* lpuart, lpuart_init_t* uart_init);
 void lpuart_deinit(lpuart_t* lpuart);
 
-uint8_t lpuart_receive_data(lpuart_t* lpuart);
+RAM_FUNC_ATTR uint8_t lpuart_receive_data(lpuart_t* lpuart);
 void lpuart_send_data(lpuart_t* lpuart, uint8_t data);
 
 void lpuart_config_dma(lpuart_t* lpuart, lpuart_dma_t dma, bool new_state);
@@ -156,9 +156,9 @@ void lpuart_config_rx(lpuart_t* lpuart, bool new_state);
 void lpuart_config_cts(lpuart_t* lpuart, bool new_state);
 void lpuart_config_tx(lpuart_t* lpuart, bool new_state);
 
-bool lpuart_get_rx_status(lpuart_t* lpuart, lpuart_rx_status_t rx_status);
-void lpuart_clear_rx_status(lpuart_t* lpuart, lpuart_rx_status_t rx_status);
-bool lpuart_get_rx_not_empty_status(lpuart_t* lpuart);
+RAM_FUNC_ATTR bool lpuart_get_rx_status(lpuart_t* lpuart, lpuart_rx_status_t rx_status);
+RAM_FUNC_ATTR void lpuart_clear_rx_status(lpuart_t* lpuart, lpuart_rx_status_t rx_status);
+RAM_FUNC_ATTR bool lpuart_get_rx_not_empty_status(lpuart_t* lpuart);
 bool lpuart_get_tx_empty_status(lpuart_t* lpuart);
 bool lpuart_get_tx_done_status(lpuart_t* lpuart);
 void lpuart_clear_tx_done_status(lpuart_t* lpuart);
@@ -18,6 +18,7 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include "tremo_regs.h"
 
 #define SSP_ROLE_MASTER (0x0) /*!< SPI master*/
@@ -57,6 +58,16 @@ extern "C" {
 #define SSP_DMA_TX_EN (1 << 1) /*!< TX DMA enable*/
 #define SSP_DMA_RX_EN (1)      /*!< RX DMA enable*/
 
+#define SSP_FIFO_DEPTH  (8)      /*!< Depth of the TX and RX fifo*/
+#define SSP_DUMMY_FRAME (0xFFFF) /*!< Frame sent by the transfers without TX data*/
+
+/**
+ * @brief FIFO polls of the blocking calls before they give up on a frame
+ */
+#ifndef CONFIG_SSP_POLL_TIMEOUT
+#define CONFIG_SSP_POLL_TIMEOUT 100000
+#endif
+
 /**
  * @brief SSP initialization configuration
  */
@@ -71,6 +82,31 @@ typedef struct {
     uint8_t ssp_dma_rx_en; /*!< RX DMA enable*/
 } ssp_init_t;
 
+typedef struct ssp_xfer ssp_xfer_t;
+
+/**
+ * @brief Transfer completion callback, called from the SSP or DMA interrupt
+ * @param xfer the transfer done
+ * @param status ERRNO_OK, ERRNO_ERROR on an overrun, a DMA error or an abort
+ */
+typedef void (*ssp_xfer_callback_t)(ssp_xfer_t* xfer, int32_t status);
+
+/**
+ * @brief SSP asynchronous full duplex transfer, owned by the driver from its
+ *        submission to its callback
+ */
+struct ssp_xfer {
+    const void* tx_data;      /*!< frames sent, NULL sends SSP_DUMMY_FRAME*/
+    void* rx_data;            /*!< frames received, NULL drops them*/
+    uint16_t len;             /*!< number of frames, uint16_t ones above 8 bits*/
+    uint8_t data_size;        /*!< SSP_DATA_SIZE_xBIT, 0 keeps the one of ssp_init*/
+    uint8_t cs_pin;           /*!< chip select pin*/
+    gpio_t* cs_gpio;          /*!< chip select held low during the transfer, NULL for none*/
+    ssp_xfer_callback_t done; /*!< completion callback*/
+    void* arg;                /*!< callback argument*/
+    ssp_xfer_t* next;         /*!< private, queue of the bus*/
+};
+
 /**
  * @brief  Clear interrupt
  * @param  SSPx SSP handler
@@ -143,8 +179,16 @@ void ssp_deinit(ssp_typedef_t* SSPx);
 void ssp_config_interrupt(ssp_typedef_t* SSPx, uint8_t ssp_interrupt, uint8_t new_state);
 void ssp_cmd(ssp_typedef_t* SSPx, uint8_t new_state);
 
-void ssp_send_data(ssp_typedef_t* SSPx, uint8_t* tx_data, uint16_t len);
-void ssp_receive_data(ssp_typedef_t* SSPx, uint8_t* rx_data, uint16_t len);
+int32_t ssp_send_data(ssp_typedef_t* SSPx, uint8_t* tx_data, uint16_t len);
+int32_t ssp_receive_data(ssp_typedef_t* SSPx, uint8_t* rx_data, uint16_t len);
+int32_t ssp_transfer(ssp_typedef_t* SSPx, const uint8_t* tx_data, uint8_t* rx_data, uint16_t len);
+
+int32_t ssp_async_init(ssp_typedef_t* SSPx, bool use_dma);
+int32_t ssp_async_deinit(ssp_typedef_t* SSPx);
+int32_t ssp_transfer_async(ssp_typedef_t* SSPx, ssp_xfer_t* xfer);
+int32_t ssp_transfer_abort(ssp_typedef_t* SSPx);
+bool ssp_transfer_busy(ssp_typedef_t* SSPx);
+void ssp_irq_handler(ssp_typedef_t* SSPx);
 
 #ifdef __cplusplus
 }
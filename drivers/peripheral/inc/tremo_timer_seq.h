@@ -0,0 +1,101 @@
+/**
+ ******************************************************************************
+ * @file    tremo_timer_seq.h
+ * @author  ASR Tremo Team
+ * @version v1.6.2
+ * @date    2022-05-28
+ * @brief   Header file of the DMA driven timer sequencer: input captures
+ *          into a ring with counter wrap extension, PWM duty sequences and
+ *          periodic encoder snapshots.
+ * @addtogroup Tremo_Drivers
+ * @{
+ * @defgroup TIMER_SEQ
+ * @{
+ */
+
+#ifndef __TREMO_TIMER_SEQ_H_
+#define __TREMO_TIMER_SEQ_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tremo_timer.h"
+#include "tremo_bstimer.h"
+#include "tremo_dma_job.h"
+
+#define TIMER_SEQ_RING_MAX   (8190)       /*!< Longest ring or table, two DMA blocks*/
+#define TIMER_SEQ_PERIOD_MAX (0xFFFFFFFF) /*!< Period of a gap of 255 counter wraps or more*/
+
+/**
+ * @brief Sequencer mode
+ */
+typedef enum {
+    TIMER_SEQ_IDLE,    /*!< stopped*/
+    TIMER_SEQ_CAPTURE, /*!< channel captures into a ring*/
+    TIMER_SEQ_PWM,     /*!< channel compare values from a table*/
+    TIMER_SEQ_ENCODER, /*!< counter snapshots into a ring*/
+} timer_seq_mode_t;
+
+typedef struct timer_seq timer_seq_t;
+
+/**
+ * @brief Sequence done callback, called from the DMA interrupt at the end of
+ *        a PWM table played once, or on a DMA error
+ * @param seq the sequencer
+ * @param success false on a DMA error
+ */
+typedef void (*timer_seq_callback_t)(timer_seq_t* seq, bool success);
+
+/**
+ * @brief Timer sequencer
+ */
+struct timer_seq {
+    timer_gp_t* timer;                /*!< timer*/
+    uint8_t channel;                  /*!< capture/compare channel*/
+    volatile timer_seq_mode_t mode;   /*!< mode, TIMER_SEQ_IDLE again on a DMA error*/
+    dma_chan_t chan;                  /*!< DMA channel*/
+    bstimer_t* clock;                 /*!< snapshot timer of the encoder mode*/
+    uint16_t* ring;                   /*!< captures or snapshots*/
+    uint8_t* wraps;                   /*!< counter wraps before each capture*/
+    uint16_t size;                    /*!< ring length*/
+    uint32_t modulus;                 /*!< counter period, ARR + 1*/
+    volatile uint32_t blocks;         /*!< private, ring halves written*/
+    uint32_t read;                    /*!< private, next ring entry read*/
+    uint32_t seen;                    /*!< private, entries written at the last wrap*/
+    uint16_t last;                    /*!< private, entry before read*/
+    bool have_last;                   /*!< private*/
+    volatile uint32_t lost;           /*!< entries overwritten before they were read*/
+    timer_seq_callback_t done;        /*!< optional done callback*/
+    void* arg;                        /*!< user argument*/
+    dma_job_t job;                    /*!< DMA job*/
+    dma_lli_block_config_t halves[2]; /*!< ring halves*/
+    dma_lli_t lli[2];                 /*!< LLI nodes*/
+};
+
+int32_t timer_seq_init(timer_seq_t* seq, timer_gp_t* TIMERx, uint8_t channel);
+int32_t timer_seq_deinit(timer_seq_t* seq);
+
+int32_t timer_seq_capture_start(timer_seq_t* seq, uint16_t* ring, uint8_t* wraps, uint16_t size);
+uint16_t timer_seq_capture_read(timer_seq_t* seq, uint32_t* periods, uint16_t max);
+uint32_t timer_seq_count(timer_seq_t* seq);
+
+int32_t timer_seq_pwm_start(timer_seq_t* seq, const uint16_t* duty, uint16_t len, bool loop);
+
+int32_t timer_seq_encoder_start(timer_seq_t* seq, bstimer_t* BSTIMERx, uint16_t* ring, uint16_t size);
+uint16_t timer_seq_encoder_read(timer_seq_t* seq, int32_t* deltas, uint16_t max);
+
+void timer_seq_stop(timer_seq_t* seq);
+void timer_seq_irq_handler(timer_seq_t* seq);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __TREMO_TIMER_SEQ_H_ */
+
+/**
+ * @}
+ * @}
+ */
@@ -0,0 +1,111 @@
+/**
+ ******************************************************************************
+ * @file    tremo_uart_stream.h
+ * @author  ASR Tremo Team
+ * @version v1.6.2
+ * @date    2022-05-28
+ * @brief   Header file of the UART and LPUART DMA streams.
+ * @addtogroup Tremo_Drivers
+ * @{
+ * @defgroup UART_STREAM
+ * @{
+ */
+
+#ifndef __TREMO_UART_STREAM_H_
+#define __TREMO_UART_STREAM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tremo_uart.h"
+#include "tremo_lpuart.h"
+#include "tremo_dma_job.h"
+
+#define UART_STREAM_BLOCK_MAX (4095) /*!< Largest TX buffer, and RX ring half*/
+
+/**
+ * @brief RX stream events
+ */
+typedef enum {
+    UART_STREAM_RX_HALF, /*!< DMA done with the first half of the ring */
+    UART_STREAM_RX_FULL, /*!< DMA done with the second half of the ring */
+    UART_STREAM_RX_IDLE  /*!< Line idle or poll, the bytes moved so far */
+} uart_stream_rx_event_t;
+
+typedef struct uart_stream uart_stream_t;
+typedef struct uart_stream_tx uart_stream_tx_t;
+
+/**
+ * @brief RX callback, called from the DMA or UART interrupt or from
+ *        uart_stream_rx_poll with the interrupts disabled
+ * @param stream the stream
+ * @param event the event
+ * @param data the bytes received since the previous callback, in the ring, or
+ *        for the bytes left in the UART fifo at an idle line in a temporary
+ *        buffer
+ * @param len number of bytes, the ones after a wrap come in the next callback
+ */
+typedef void (*uart_stream_rx_callback_t)(uart_stream_t* stream, uart_stream_rx_event_t event, const uint8_t* data, uint16_t len);
+
+/**
+ * @brief TX completion callback, called from the DMA interrupt
+ * @param tx the buffer sent, free again
+ * @param success false on a transfer error
+ */
+typedef void (*uart_stream_tx_callback_t)(uart_stream_tx_t* tx, bool success);
+
+/**
+ * @brief TX buffer, owned by the stream from its submission to its callback
+ */
+struct uart_stream_tx {
+    const uint8_t* data;            /*!< bytes to send*/
+    uint16_t len;                   /*!< number of bytes, up to UART_STREAM_BLOCK_MAX*/
+    uart_stream_tx_callback_t done; /*!< completion callback*/
+    void* arg;                      /*!< callback argument*/
+    dma_job_t job;                  /*!< private, DMA job of the buffer*/
+};
+
+/**
+ * @brief UART or LPUART stream
+ */
+struct uart_stream {
+    void* port;                          /*!< UARTx or LPUART*/
+    bool lpuart;                         /*!< port is the LPUART*/
+    dma_chan_t tx_chan;                  /*!< TX DMA channel*/
+    dma_chan_t rx_chan;                  /*!< RX DMA channel*/
+    uint8_t* rx_buf;                     /*!< RX ring*/
+    uint16_t rx_size;                    /*!< RX ring size*/
+    uint16_t rx_pos;                     /*!< first byte not reported*/
+    uint8_t rx_half;                     /*!< half of the ring the DMA writes*/
+    uart_stream_rx_callback_t rx_cb;     /*!< RX callback, NULL while stopped*/
+    dma_job_t rx_job;                    /*!< RX DMA job*/
+    dma_lli_block_config_t rx_blocks[2]; /*!< RX ring halves*/
+    dma_lli_t rx_lli[2];                 /*!< RX LLI nodes*/
+    void* arg;                           /*!< user argument*/
+};
+
+int32_t uart_stream_init(uart_stream_t* stream, uart_t* uartx);
+int32_t lpuart_stream_init(uart_stream_t* stream, lpuart_t* lpuart);
+int32_t uart_stream_deinit(uart_stream_t* stream);
+
+int32_t uart_stream_send(uart_stream_t* stream, uart_stream_tx_t* tx);
+bool uart_stream_tx_busy(uart_stream_t* stream);
+
+int32_t uart_stream_rx_start(uart_stream_t* stream, uint8_t* buf, uint16_t size, uart_stream_rx_callback_t cb);
+void uart_stream_rx_stop(uart_stream_t* stream);
+void uart_stream_rx_poll(uart_stream_t* stream);
+
+void uart_stream_irq_handler(uart_stream_t* stream);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __TREMO_UART_STREAM_H_ */
+
+/**
+ * @}
+ * @}
+ */
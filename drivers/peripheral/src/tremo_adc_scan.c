@@ -0,0 +1,177 @@
+#include <string.h>
+#include "tremo_cm4.h"
+#include "tremo_dma_handshake.h"
+#include "tremo_adc_scan.h"
+
+#define ADC_SCAN_VREF_MV (1200) /*!< internal reference*/
+#define ADC_SCAN_CODES   (4096) /*!< 12 bit conversions*/
+
+static void adc_scan_halt(adc_scan_t* scan)
+{
+    adc_start(false);
+    adc_enable_dma(false);
+    adc_enable(false);
+    if (scan->vbat31) {
+        /* the divider draws from the battery while on */
+        adc_enable_vbat31(false);
+    }
+}
+
+static void adc_scan_done(dma_job_t* job, bool success)
+{
+    adc_scan_t* scan = (adc_scan_t*)job->arg;
+    uint8_t i;
+
+    adc_scan_halt(scan);
+    if (success) {
+        for (i = 0; i < scan->count; i++) {
+            scan->value[i] = (int32_t)(((int64_t)(scan->codes[i + 1] & 0x0fff) * scan->gain[i] + scan->offset[i] + 0x8000) >> 16);
+        }
+        scan->time  = scan->start_time;
+        scan->valid = true;
+    }
+    scan->busy = false;
+    if (scan->done) {
+        scan->done(scan, success);
+    }
+}
+
+/**
+ * @brief  Open an ADC scan
+ * @param  scan the scan
+ * @param  chans the channels, kept by the scan
+ * @param  count the number of channels, up to ADC_SCAN_CHAN_MAX
+ * @param  diff the channels are differential, for the calibration
+ * @return ERRNO_OK, ERRNO_ERROR on too many channels or when no DMA channel
+ *         is free
+ * @note   The ADC and DMA clocks and the ADC clock division are set by the
+ *         application, adc_init being called once. The calibration and the
+ *         scale of each channel are folded into one Q16 gain and offset
+ */
+int32_t adc_scan_init(adc_scan_t* scan, const adc_scan_chan_t* chans, uint8_t count, bool diff)
+{
+    float gain, dco, mv_per_code, mv_offset;
+    uint8_t i;
+
+    memset(scan, 0, sizeof(adc_scan_t));
+    if (count == 0 || count > ADC_SCAN_CHAN_MAX || count > ADC_SAMPLE_SEQ_CHAN_15) {
+        return ERRNO_ERROR;
+    }
+    if (dma_chan_acquire(&scan->chan) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+    scan->chans = chans;
+    scan->count = count;
+
+    /* mV = (code * VREF / CODES - dco) / gain */
+    adc_get_calibration_value(diff, &gain, &dco);
+    mv_per_code = (float)ADC_SCAN_VREF_MV / ADC_SCAN_CODES / gain;
+    mv_offset   = -dco * 1000.0f / gain;
+    for (i = 0; i < count; i++) {
+        scan->gain[i]   = (int64_t)(mv_per_code * chans[i].scale + 0.5f);
+        scan->offset[i] = (int64_t)(mv_offset * chans[i].scale) + ((int64_t)chans[i].offset << 16);
+        if (chans[i].vbat31) {
+            scan->vbat31 = true;
+        }
+    }
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Close a scan, the DMA channel released
+ * @param  scan the scan
+ * @return ERRNO_OK
+ */
+int32_t adc_scan_deinit(adc_scan_t* scan)
+{
+    if (scan->busy) {
+        dma_job_abort(scan->chan);
+        adc_scan_halt(scan);
+        scan->busy = false;
+    }
+    return dma_chan_release(scan->chan);
+}
+
+/**
+ * @brief  Convert the channels once
+ * @param  scan the scan
+ * @param  time the time stamp of the values, e.g. TimerGetCurrentTime()
+ * @return ERRNO_OK, ERRNO_ERROR while a scan runs
+ * @note   The sequence runs on its own, the DMA interrupt at its end being
+ *         the only one. The first conversion after the ADC enable is
+ *         dropped. The ADC is switched off again at the end, it is not to
+ *         be shared with a running adc_stream
+ */
+int32_t adc_scan_start(adc_scan_t* scan, uint32_t time)
+{
+    dma_job_t* job = &scan->job;
+    uint8_t i;
+
+    if (scan->busy) {
+        return ERRNO_ERROR;
+    }
+    scan->busy       = true;
+    scan->start_time = time;
+
+    /* a channel 0 slot ends a sequence shorter than 16 */
+    adc_config_sample_sequence(ADC_SAMPLE_SEQ_CHAN_0, scan->chans[0].chan);
+    for (i = 0; i < scan->count; i++) {
+        adc_config_sample_sequence((adc_sample_seq_chan_t)(i + 1), scan->chans[i].chan);
+    }
+    if (scan->count + 1 < 16) {
+        adc_config_sample_sequence((adc_sample_seq_chan_t)(scan->count + 1), ADC_SAMPLE_CHAN_0);
+    }
+    if (scan->vbat31) {
+        adc_enable_vbat31(true);
+    }
+
+    memset(job, 0, sizeof(dma_job_t));
+    job->dev.mode       = P2M_MODE;
+    job->dev.handshake  = DMA_HANDSHAKE_ADCCTRL;
+    job->dev.src        = (uint32_t) & (ADC->DR);
+    job->dev.dest       = (uint32_t)scan->codes;
+    job->dev.data_width = 1;
+    job->dev.src_msize  = 0;
+    job->dev.dest_msize = 0;
+    job->dev.block_size = scan->count + 1;
+    job->done           = adc_scan_done;
+    job->arg            = scan;
+    if (dma_job_submit(scan->chan, job) != ERRNO_OK) {
+        adc_scan_halt(scan);
+        scan->busy = false;
+        return ERRNO_ERROR;
+    }
+
+    adc_config_trigger_polarity(ADC_TRG_POLARITY_SOFT);
+    adc_config_conv_mode(ADC_CONV_MODE_SINGLE);
+    adc_enable_dma(true);
+    adc_enable(true);
+    adc_start(true);
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Read a value of the last scan
+ * @param  scan the scan
+ * @param  index the channel index
+ * @param  value the value
+ * @param  time the time given to the scan, NULL if not needed
+ * @return false before the first scan done
+ * @note   Costs no conversion, the value and its time are read together
+ */
+bool adc_scan_get(adc_scan_t* scan, uint8_t index, int32_t* value, uint32_t* time)
+{
+    uint32_t primask;
+
+    if (!scan->valid || index >= scan->count) {
+        return false;
+    }
+    primask = __get_PRIMASK();
+    __disable_irq();
+    *value = scan->value[index];
+    if (time != NULL) {
+        *time = scan->time;
+    }
+    __set_PRIMASK(primask);
+    return true;
+}
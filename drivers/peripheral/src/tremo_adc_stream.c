@@ -0,0 +1,443 @@
+#include <string.h>
+#include "tremo_cm4.h"
+#include "tremo_dma_handshake.h"
+#include "tremo_adc_stream.h"
+
+#define ADC_STREAM_VREF_MV (1200) /*!< internal reference*/
+#define ADC_STREAM_CODES   (4096) /*!< 12 bit conversions*/
+
+/* two samples in one word, the lower address in the bottom lane */
+static uint32_t adc_q15x2(const int16_t* p)
+{
+    uint32_t pair;
+
+    memcpy(&pair, p, sizeof(pair));
+    return pair;
+}
+
+static void adc_stage_append(adc_stage_t** list, adc_stage_t* stage)
+{
+    while (*list != NULL) {
+        list = &(*list)->next;
+    }
+    stage->next = NULL;
+    *list       = stage;
+}
+
+static void adc_stage_feed(adc_stage_t* stage, const int16_t* samples, uint16_t len)
+{
+    for (; stage != NULL; stage = stage->next) {
+        stage->process(stage, samples, len);
+    }
+}
+
+static void adc_stream_half_done(dma_job_t* job, bool success)
+{
+    adc_stream_t* stream = (adc_stream_t*)job->arg;
+    uint8_t bit;
+
+    if (!success) {
+        /* the job is dropped, the halves filled are still processed */
+        adc_start(false);
+        adc_enable_dma(false);
+        stream->running = false;
+    } else {
+        bit = 1 << stream->half;
+        if (stream->ready & bit) {
+            stream->overruns++;
+        }
+        stream->ready |= bit;
+        stream->half ^= 1;
+    }
+    if (stream->notify) {
+        stream->notify(stream);
+    }
+}
+
+/**
+ * @brief  Open an ADC stream
+ * @param  stream the stream
+ * @param  diff the sequence channels are differential, for the calibration
+ * @return ERRNO_OK, ERRNO_ERROR when no DMA channel is free
+ * @note   The ADC and DMA clocks, the ADC clock division and the sample
+ *         sequence are set by the application
+ */
+int32_t adc_stream_init(adc_stream_t* stream, bool diff)
+{
+    float gain, dco, offset;
+
+    memset(stream, 0, sizeof(adc_stream_t));
+    if (dma_chan_acquire(&stream->chan) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+
+    /* mV = (code * VREF / CODES - dco) / gain, once in Q16 for the integer path */
+    adc_get_calibration_value(diff, &gain, &dco);
+    stream->gain = (int32_t)((float)((ADC_STREAM_VREF_MV << ADC_STREAM_MV_SHIFT) << 16) / ADC_STREAM_CODES / gain + 0.5f);
+    offset = -dco * (float)((1000 << ADC_STREAM_MV_SHIFT) << 16) / gain;
+    stream->offset = (int32_t)(offset < 0 ? offset - 0.5f : offset + 0.5f);
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Close a stream, stopped first
+ * @param  stream the stream
+ * @return ERRNO_OK
+ */
+int32_t adc_stream_deinit(adc_stream_t* stream)
+{
+    adc_stream_stop(stream);
+    return dma_chan_release(stream->chan);
+}
+
+/**
+ * @brief  Feed a stage with the calibrated samples of a stream
+ * @param  stream the stream
+ * @param  stage the stage, after the ones added before
+ * @return
+ */
+void adc_stream_add_stage(adc_stream_t* stream, adc_stage_t* stage)
+{
+    adc_stage_append(&stream->stages, stage);
+}
+
+/**
+ * @brief  Start the timer triggered conversions into a DMA ring
+ * @param  stream the stream
+ * @param  buf the ring, written by the DMA until adc_stream_stop
+ * @param  size the ring size in samples, even, each half up to ADC_STREAM_BLOCK_MAX
+ * @param  trigger the trigger source, e.g. ADC_TRG_SOURCE_TIM0_TRGO_13
+ * @return ERRNO_OK, ERRNO_ERROR on an invalid ring or a running stream
+ * @note   Each rising edge of the trigger converts the sequence once. The
+ *         timer is set up by the application, e.g. with
+ *         timer_config_master_mode(TIM0, TIMER_TRGO_UPDATE), its period being
+ *         the sample period
+ */
+int32_t adc_stream_start(adc_stream_t* stream, uint16_t* buf, uint16_t size, adc_trigger_source_t trigger)
+{
+    dma_job_t* job = &stream->job;
+    uint16_t half  = size / 2;
+    uint8_t i;
+
+    if (stream->running || buf == NULL || half == 0 || (size & 1) || half > ADC_STREAM_BLOCK_MAX) {
+        return ERRNO_ERROR;
+    }
+    stream->buf   = buf;
+    stream->size  = size;
+    stream->ready = 0;
+    stream->half  = 0;
+    stream->next  = 0;
+
+    for (i = 0; i < 2; i++) {
+        stream->blocks[i].src        = (uint32_t) & (ADC->DR);
+        stream->blocks[i].dest       = (uint32_t)(buf + i * half);
+        stream->blocks[i].data_width = 1;
+        stream->blocks[i].src_msize  = 0;
+        stream->blocks[i].dest_msize = 0;
+        stream->blocks[i].block_size = half;
+    }
+    job->dev.mode      = P2M_MODE;
+    job->dev.handshake = DMA_HANDSHAKE_ADCCTRL;
+    job->blocks        = stream->blocks;
+    job->lli           = stream->lli;
+    job->block_num     = 2;
+    job->flags         = DMA_JOB_CIRCULAR;
+    job->start         = NULL;
+    job->done          = adc_stream_half_done;
+    job->arg           = stream;
+    if (dma_job_submit(stream->chan, job) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+    stream->running = true;
+
+    adc_config_trigger_source(trigger);
+    adc_config_trigger_polarity(ADC_TRG_POLARITY_RISING);
+    adc_config_conv_mode(ADC_CONV_MODE_SINGLE);
+    adc_enable_dma(true);
+    adc_enable(true);
+    adc_start(true);
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Stop the conversions, the halves not processed yet are dropped
+ * @param  stream the stream
+ * @return
+ */
+void adc_stream_stop(adc_stream_t* stream)
+{
+    adc_start(false);
+    adc_enable_dma(false);
+    dma_job_abort(stream->chan);
+    stream->running = false;
+    stream->ready   = 0;
+}
+
+/**
+ * @brief  Calibrate the halves the DMA filled and feed them to the stages
+ * @param  stream the stream
+ * @return the number of halves processed
+ * @note   Called from the main loop, e.g. after the notify callback. The
+ *         samples are calibrated in place, a half has to be processed
+ *         before the DMA comes back to it or overruns counts it
+ */
+uint8_t adc_stream_process(adc_stream_t* stream)
+{
+    uint16_t half = stream->size / 2;
+    uint8_t count = 0;
+    uint32_t primask;
+    int16_t* samples;
+    uint16_t i;
+
+    while (stream->ready & (1 << stream->next)) {
+        samples = (int16_t*)(stream->buf + stream->next * half);
+        for (i = 0; i < half; i++) {
+            samples[i] = adc_stream_calibrate(stream, (uint16_t)samples[i]);
+        }
+        adc_stage_feed(stream->stages, samples, half);
+
+        primask = __get_PRIMASK();
+        __disable_irq();
+        stream->ready &= ~(1 << stream->next);
+        __set_PRIMASK(primask);
+        stream->next ^= 1;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief  Convert an ADC code with the calibration of the stream
+ * @param  stream the stream
+ * @param  code the ADC code
+ * @return the voltage in 1/16 mV
+ */
+int16_t adc_stream_calibrate(adc_stream_t* stream, uint16_t code)
+{
+    int32_t value = (int32_t)(code & 0x0fff) * stream->gain + stream->offset;
+
+    return (int16_t)__SSAT((value + 0x8000) >> 16, 16);
+}
+
+static void adc_stage_stats_reset(adc_stage_stats_t* stats)
+{
+    stats->count  = 0;
+    stats->sum    = 0;
+    stats->sum_sq = 0;
+    stats->min    = 0x7FFF7FFF;
+    stats->max    = 0x80008000;
+}
+
+static uint32_t adc_isqrt(uint32_t value)
+{
+    uint32_t root = 0;
+    uint32_t bit  = 1UL << 30;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+static void adc_stage_stats_emit(adc_stage_stats_t* stats)
+{
+    adc_summary_t summary;
+    int16_t lo, hi;
+    int32_t half_count = stats->count / 2;
+
+    summary.count = stats->count;
+    summary.mean  = (int16_t)((stats->sum + (stats->sum < 0 ? -half_count : half_count)) / stats->count);
+    summary.rms   = (int16_t)adc_isqrt((uint32_t)(stats->sum_sq / stats->count));
+    lo            = (int16_t)(stats->min & 0xFFFF);
+    hi            = (int16_t)(stats->min >> 16);
+    summary.min   = lo < hi ? lo : hi;
+    lo            = (int16_t)(stats->max & 0xFFFF);
+    hi            = (int16_t)(stats->max >> 16);
+    summary.max   = lo > hi ? lo : hi;
+    adc_stage_stats_reset(stats);
+    if (stats->done) {
+        stats->done(stats, &summary);
+    }
+}
+
+/* dual 16 bit lanes: the sum and the squares by SMLAD/SMLALD, min and max
+   by SSUB16 setting the GE flags SEL picks the lanes with */
+static void adc_stage_stats_accumulate(adc_stage_stats_t* stats, const int16_t* samples, uint16_t len)
+{
+    int32_t sum     = stats->sum;
+    uint64_t sum_sq = stats->sum_sq;
+    uint32_t vmin   = stats->min;
+    uint32_t vmax   = stats->max;
+    uint32_t pair;
+    uint16_t i;
+
+    for (i = 0; i + 1 < len; i += 2) {
+        pair   = adc_q15x2(samples + i);
+        sum    = (int32_t)__SMLAD(pair, 0x00010001, (uint32_t)sum);
+        sum_sq = __SMLALD(pair, pair, sum_sq);
+        __SSUB16(pair, vmin);
+        vmin = __SEL(vmin, pair);
+        __SSUB16(pair, vmax);
+        vmax = __SEL(pair, vmax);
+    }
+    if (i < len) {
+        /* the last sample in both lanes */
+        pair = (uint32_t)(uint16_t)samples[i] * 0x00010001;
+        sum += samples[i];
+        sum_sq += (uint32_t)(samples[i] * samples[i]);
+        __SSUB16(pair, vmin);
+        vmin = __SEL(vmin, pair);
+        __SSUB16(pair, vmax);
+        vmax = __SEL(pair, vmax);
+    }
+    stats->sum    = sum;
+    stats->sum_sq = sum_sq;
+    stats->min    = vmin;
+    stats->max    = vmax;
+    stats->count += len;
+}
+
+static void adc_stage_stats_process(adc_stage_t* stage, const int16_t* samples, uint16_t len)
+{
+    adc_stage_stats_t* stats = (adc_stage_stats_t*)stage;
+    uint16_t n;
+
+    while (len > 0) {
+        n = stats->window - stats->count;
+        if (n > len) {
+            n = len;
+        }
+        adc_stage_stats_accumulate(stats, samples, n);
+        samples += n;
+        len -= n;
+        if (stats->count == stats->window) {
+            adc_stage_stats_emit(stats);
+        }
+    }
+}
+
+/**
+ * @brief  Initialize a mean, RMS, min and max stage
+ * @param  stats the stage
+ * @param  window samples per summary, up to 65535
+ * @param  done the summary callback
+ * @return
+ */
+void adc_stage_stats_init(adc_stage_stats_t* stats, uint16_t window, adc_summary_callback_t done)
+{
+    stats->stage.process = adc_stage_stats_process;
+    stats->stage.next    = NULL;
+    stats->window        = window ? window : 1;
+    stats->done          = done;
+    adc_stage_stats_reset(stats);
+}
+
+static int16_t adc_fir_dot(const int16_t* x, const int16_t* coeffs, uint16_t num_taps)
+{
+    uint64_t acc = 1 << 14;
+    uint16_t j;
+
+    for (j = 0; j + 1 < num_taps; j += 2) {
+        acc = __SMLALD(adc_q15x2(x + j), adc_q15x2(coeffs + j), acc);
+    }
+    if (j < num_taps) {
+        acc += (int64_t)(x[j] * coeffs[j]);
+    }
+    return (int16_t)__SSAT((int32_t)((int64_t)acc >> 15), 16);
+}
+
+static void adc_stage_fir_process(adc_stage_t* stage, const int16_t* samples, uint16_t len)
+{
+    adc_stage_fir_t* fir = (adc_stage_fir_t*)stage;
+    uint16_t history     = fir->num_taps - 1;
+    int16_t out[ADC_STAGE_FIR_BLOCK];
+    uint16_t n, i, count;
+
+    while (len > 0) {
+        n = len < ADC_STAGE_FIR_BLOCK ? len : ADC_STAGE_FIR_BLOCK;
+        memcpy(fir->state + history, samples, n * sizeof(int16_t));
+
+        /* output i ends with the input sample i */
+        count = 0;
+        for (i = fir->phase; i < n; i += fir->factor) {
+            out[count++] = adc_fir_dot(fir->state + i, fir->coeffs, fir->num_taps);
+        }
+        fir->phase = i - n;
+        memmove(fir->state, fir->state + n, history * sizeof(int16_t));
+
+        if (count > 0) {
+            adc_stage_feed(fir->sink, out, count);
+        }
+        samples += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief  Initialize a decimating FIR stage
+ * @param  fir the stage
+ * @param  coeffs the Q15 taps in time reversed order, kept until the stage is dropped
+ * @param  num_taps number of taps
+ * @param  factor decimation factor, 1 for a plain filter
+ * @param  state num_taps - 1 + ADC_STAGE_FIR_BLOCK samples
+ * @return ERRNO_OK, ERRNO_ERROR on an invalid filter
+ */
+int32_t adc_stage_fir_init(adc_stage_fir_t* fir, const int16_t* coeffs, uint16_t num_taps, uint8_t factor, int16_t* state)
+{
+    if (coeffs == NULL || state == NULL || num_taps == 0 || factor == 0) {
+        return ERRNO_ERROR;
+    }
+    fir->stage.process = adc_stage_fir_process;
+    fir->stage.next    = NULL;
+    fir->coeffs        = coeffs;
+    fir->num_taps      = num_taps;
+    fir->factor        = factor;
+    fir->phase         = factor - 1;
+    fir->state         = state;
+    fir->sink          = NULL;
+    memset(state, 0, (num_taps - 1) * sizeof(int16_t));
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Feed a stage with the output of a FIR stage
+ * @param  fir the FIR stage
+ * @param  stage the stage, after the ones added before
+ * @return
+ */
+void adc_stage_fir_add_sink(adc_stage_fir_t* fir, adc_stage_t* stage)
+{
+    adc_stage_append(&fir->sink, stage);
+}
+
+/**
+ * @brief  Pack a summary, little endian count, mean, rms, min and max
+ * @param  summary the summary
+ * @param  buf ADC_SUMMARY_SIZE bytes, e.g. a record of lwan_record_add
+ * @return ADC_SUMMARY_SIZE
+ */
+uint8_t adc_summary_pack(const adc_summary_t* summary, uint8_t* buf)
+{
+    uint16_t fields[5];
+    uint8_t i;
+
+    fields[0] = summary->count;
+    fields[1] = (uint16_t)summary->mean;
+    fields[2] = (uint16_t)summary->rms;
+    fields[3] = (uint16_t)summary->min;
+    fields[4] = (uint16_t)summary->max;
+    for (i = 0; i < 5; i++) {
+        buf[2 * i]     = (uint8_t)fields[i];
+        buf[2 * i + 1] = (uint8_t)(fields[i] >> 8);
+    }
+    return ADC_SUMMARY_SIZE;
+}
@@ -1,3 +1,4 @@
+#include "tremo_cm4.h"
 #include "tremo_rcc.h"
 #include "tremo_crc.h"
 
@@ -83,3 +84,72 @@ uint32_t crc_calc8(uint8_t* data, uint32_t size)
 
     return CRC->DR;
 }
+
+/**
+ * @brief Init the running state of a CRC calculated by parts
+ * @note  The CRC unit is free between the parts, the state is kept in the
+ *        context and loaded back by crc_ctx_update
+ * @param ctx The context
+ * @param config The configuration of the CRC, 32bits polynomial size
+ * @retval None
+ */
+void crc_ctx_init(crc_ctx_t* ctx, crc_config_t* config)
+{
+    ctx->config = *config;
+    ctx->value  = config->init_value;
+}
+
+/**
+ * @brief Add data to a CRC calculated by parts
+ * @note  With the input reversed by byte, the words of the data are written
+ *        at once with the input reversed by word, which keeps the byte order
+ *        of the little endian words
+ * @param ctx The context
+ * @param data The pointer to the 8-bit input data
+ * @param size The size of the input data
+ * @retval None
+ */
+void crc_ctx_update(crc_ctx_t* ctx, const uint8_t* data, uint32_t size)
+{
+    uint32_t cr = ctx->config.poly_size | (ctx->config.reverse_out ? CRC_CR_REVERSE_OUT_EN : 0);
+    uint32_t value;
+
+    CRC->INIT = ctx->value;
+    CRC->POLY = ctx->config.poly;
+    CRC->CR   = cr | ctx->config.reverse_in | CRC_CR_CALC_INIT;
+
+    if (ctx->config.reverse_in == CRC_REVERSE_IN_BYTE) {
+        for (; size && ((uint32_t)data & 0x3); size--) {
+            *((uint8_t*)CRC_DR_ADDR) = *data++;
+        }
+        if (size >= 4) {
+            while (CRC->CR & CRC_CR_CALC_FLAG)
+                ;
+            CRC->CR = cr | CRC_REVERSE_IN_WORD;
+            for (; size >= 4; size -= 4, data += 4) {
+                CRC->DR = *(const uint32_t*)data;
+            }
+            while (CRC->CR & CRC_CR_CALC_FLAG)
+                ;
+            CRC->CR = cr | CRC_REVERSE_IN_BYTE;
+        }
+    }
+    for (; size; size--) {
+        *((uint8_t*)CRC_DR_ADDR) = *data++;
+    }
+
+    while (CRC->CR & CRC_CR_CALC_FLAG)
+        ;
+    value      = CRC->DR;
+    ctx->value = ctx->config.reverse_out ? __RBIT(value) : value;
+}
+
+/**
+ * @brief Get the CRC value of the data added so far
+ * @param ctx The context
+ * @retval uint32_t the CRC value
+ */
+uint32_t crc_ctx_value(crc_ctx_t* ctx)
+{
+    return ctx->config.reverse_out ? __RBIT(ctx->value) : ctx->value;
+}
@@ -0,0 +1,332 @@
+#include <string.h>
+#include "tremo_cm4.h"
+#include "tremo_rcc.h"
+#include "tremo_dma_handshake.h"
+#include "tremo_dac_stream.h"
+
+/* Q15 sine of the first quadrant, 64 steps */
+static const int16_t dac_sine_quarter[65] = {
+    0, 804, 1608, 2410, 3212, 4011, 4808, 5602,
+    6393, 7179, 7962, 8739, 9512, 10278, 11039, 11793,
+    12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+    18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+    23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+    27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+    30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971,
+    32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+    32767,
+};
+
+/* Q15 sine of a phase, a full turn being 2^32, interpolated between the steps */
+static int32_t dac_sine(uint32_t phase)
+{
+    uint32_t index = (phase >> 24) & 0x3F;
+    int32_t frac   = (phase >> 8) & 0xFFFF;
+    int32_t a, b;
+
+    if (phase & 0x40000000) {
+        /* second and fourth quadrants mirror the first */
+        a = dac_sine_quarter[64 - index];
+        b = dac_sine_quarter[63 - index];
+    } else {
+        a = dac_sine_quarter[index];
+        b = dac_sine_quarter[index + 1];
+    }
+    a += ((b - a) * frac) >> 16;
+    return (phase & 0x80000000) ? -a : a;
+}
+
+static uint16_t dac_code(int32_t offset, int32_t amplitude, int32_t value)
+{
+    return (uint16_t)__USAT(offset + ((amplitude * value) >> 15), 12);
+}
+
+/* points the LLI node of a half at a table, the node not being in use */
+static void dac_stream_load(dac_stream_t* stream, uint8_t half, const uint16_t* table, uint16_t len)
+{
+    uint16_t first = len / 2;
+    dma_lli_t* lli = &stream->lli[half];
+
+    lli->SAR   = (uint32_t)(half ? table + first : table);
+    lli->CTL_H = (lli->CTL_H & ~(uint32_t)0xFFF) | (half ? len - first : first);
+}
+
+static void dac_stream_block_done(dma_job_t* job, bool success)
+{
+    dac_stream_t* stream = (dac_stream_t*)job->arg;
+
+    if (!success) {
+        bstimer_cmd(stream->timer, false);
+        dac_dma_cmd(false);
+        stream->running = false;
+        return;
+    }
+    if (stream->half == 0) {
+        /* the second half plays, the first one is fetched after it */
+        if (stream->swap == 1) {
+            dac_stream_load(stream, 0, stream->next_table, stream->next_len);
+            stream->swap = 2;
+        }
+    } else {
+        /* the first half of the next period plays */
+        stream->periods++;
+        if (stream->swap == 2) {
+            dac_stream_load(stream, 1, stream->next_table, stream->next_len);
+            stream->table = stream->next_table;
+            stream->len   = stream->next_len;
+            stream->swap  = 0;
+            if (stream->notify) {
+                stream->notify(stream);
+            }
+        }
+    }
+    stream->half ^= 1;
+}
+
+static void dac_stream_job_start(dma_job_t* job)
+{
+    (void)job;
+    dac_dma_cmd(true);
+}
+
+/**
+ * @brief  Open a DAC stream
+ * @param  stream the stream
+ * @param  timer the trigger timer, BSTIMER0 or BSTIMER1
+ * @return ERRNO_OK, ERRNO_ERROR on an invalid timer or when no DMA channel is free
+ * @note   The DAC, DMA and timer clocks and the output pin are set by the
+ *         application
+ */
+int32_t dac_stream_init(dac_stream_t* stream, bstimer_t* timer)
+{
+    memset(stream, 0, sizeof(dac_stream_t));
+    if (timer != BSTIMER0 && timer != BSTIMER1) {
+        return ERRNO_ERROR;
+    }
+    if (dma_chan_acquire(&stream->chan) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+    stream->timer = timer;
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Close a stream, stopped first
+ * @param  stream the stream
+ * @return ERRNO_OK
+ */
+int32_t dac_stream_deinit(dac_stream_t* stream)
+{
+    dac_stream_stop(stream);
+    return dma_chan_release(stream->chan);
+}
+
+/**
+ * @brief  Play a table in a loop, one sample per timer update
+ * @param  stream the stream
+ * @param  table the DAC codes, read by the DMA until the stream stops or swaps it
+ * @param  len the table length, 2 to DAC_STREAM_TABLE_MAX samples
+ * @param  rate the sample rate [Hz], the table repeating rate / len times a second
+ * @return ERRNO_OK, ERRNO_ERROR on an invalid table or rate or a running stream
+ */
+int32_t dac_stream_start(dac_stream_t* stream, const uint16_t* table, uint16_t len, uint32_t rate)
+{
+    dma_job_t* job = &stream->job;
+    bstimer_init_t timer_config;
+    dac_config_t dac_config;
+    uint16_t first = len / 2;
+    uint8_t i;
+
+    if (stream->running || table == NULL || len < 2 || len > DAC_STREAM_TABLE_MAX) {
+        return ERRNO_ERROR;
+    }
+    memset(&timer_config, 0, sizeof(timer_config));
+    timer_config.bstimer_mms        = BSTIMER_MMS_UPDATE;
+    timer_config.autoreload_preload = true;
+    bstimer_cmd(stream->timer, false);
+    bstimer_init(stream->timer, &timer_config);
+    if (dac_stream_set_rate(stream, rate) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+    /* loads the prescaler */
+    bstimer_generate_event(stream->timer, BSTIMER_EGR_UG, true);
+
+    stream->table   = table;
+    stream->len     = len;
+    stream->periods = 0;
+    stream->swap    = 0;
+    stream->half    = 0;
+
+    for (i = 0; i < 2; i++) {
+        stream->blocks[i].src        = (uint32_t)(table + i * first);
+        stream->blocks[i].dest       = (uint32_t) & (DAC->DHR);
+        stream->blocks[i].data_width = 1;
+        stream->blocks[i].src_msize  = 0;
+        stream->blocks[i].dest_msize = 0;
+        stream->blocks[i].block_size = i ? len - first : first;
+    }
+    job->dev.mode      = M2P_MODE;
+    job->dev.handshake = DMA_HANDSHAKE_DACCTRL;
+    job->blocks        = stream->blocks;
+    job->lli           = stream->lli;
+    job->block_num     = 2;
+    job->flags         = DMA_JOB_CIRCULAR;
+    job->start         = dac_stream_job_start;
+    job->done          = dac_stream_block_done;
+    job->arg           = stream;
+
+    memset(&dac_config, 0, sizeof(dac_config));
+    dac_config.trigger_src = (stream->timer == BSTIMER0) ? DAC_TRIGGER_SRC_BSTIMER0_TRGO : DAC_TRIGGER_SRC_BSTIMER1_TRGO;
+    dac_init(&dac_config);
+    dac_cmd(true);
+    dac_write_data(table[0]);
+    dac_clear_interrupt(DAC_INTR_UNDERFLOW);
+
+    if (dma_job_submit(stream->chan, job) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+    stream->running = true;
+    bstimer_cmd(stream->timer, true);
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Stop the output, the DAC keeps its last code
+ * @param  stream the stream
+ * @return
+ */
+void dac_stream_stop(dac_stream_t* stream)
+{
+    if (stream->timer != NULL) {
+        bstimer_cmd(stream->timer, false);
+    }
+    dac_dma_cmd(false);
+    dma_job_abort(stream->chan);
+    stream->running = false;
+    stream->swap    = 0;
+}
+
+/**
+ * @brief  Queue a table played from the end of the current period
+ * @param  stream the stream
+ * @param  table the DAC codes, read by the DMA until the stream stops or swaps it
+ * @param  len the table length, 2 to DAC_STREAM_TABLE_MAX samples
+ * @return ERRNO_OK, ERRNO_ERROR on an invalid table, a stopped stream or
+ *         a swap still pending
+ * @note   The DMA interrupt switches each half of the table while the other
+ *         one plays, so the output goes from the last sample of the current
+ *         table to the first one of the new table. The current table stays
+ *         in use until the notify callback. The sample rate is kept, see
+ *         dac_stream_set_rate
+ */
+int32_t dac_stream_swap(dac_stream_t* stream, const uint16_t* table, uint16_t len)
+{
+    if (!stream->running || stream->swap != 0 || table == NULL || len < 2 || len > DAC_STREAM_TABLE_MAX) {
+        return ERRNO_ERROR;
+    }
+    stream->next_table = table;
+    stream->next_len   = len;
+    stream->swap       = 1;
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Retune the sample rate of the trigger timer
+ * @param  stream the stream
+ * @param  rate the sample rate [Hz]
+ * @return ERRNO_OK, ERRNO_ERROR on a rate above half the timer clock or
+ *         below the clock / 2^32
+ * @note   The auto-reload preload applies the new period at the next
+ *         update, a running waveform changes frequency without a glitch
+ *         and without being regenerated
+ */
+int32_t dac_stream_set_rate(dac_stream_t* stream, uint32_t rate)
+{
+    uint32_t clk = rcc_get_clk_freq((stream->timer == BSTIMER0) ? RCC_PCLK0 : RCC_PCLK1);
+    uint32_t ticks, prescaler;
+
+    if (rate == 0) {
+        return ERRNO_ERROR;
+    }
+    ticks = (clk + rate / 2) / rate;
+    if (ticks < 2) {
+        return ERRNO_ERROR;
+    }
+    prescaler = (ticks - 1) >> 16;
+    stream->timer->PSC = prescaler;
+    stream->timer->ARR = ticks / (prescaler + 1) - 1;
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Synthesize a sine
+ * @param  table the table
+ * @param  len the table length
+ * @param  cycles sine periods in the table, a whole number loops without a glitch
+ * @param  offset mid code
+ * @param  amplitude peak deviation from offset, in codes, saturated to 0 and DAC_STREAM_CODE_MAX
+ * @return
+ */
+void dac_stream_sine(uint16_t* table, uint16_t len, uint16_t cycles, uint16_t offset, uint16_t amplitude)
+{
+    uint32_t position = 0;
+    uint16_t i;
+
+    for (i = 0; i < len; i++) {
+        /* position = cycles * i mod len, the phase exact at every sample */
+        table[i] = dac_code(offset, amplitude, dac_sine((uint32_t)(((uint64_t)position << 32) / len)));
+        position = (position + cycles) % len;
+    }
+}
+
+/**
+ * @brief  Synthesize a square wave
+ * @param  table the table
+ * @param  len the table length
+ * @param  cycles periods in the table
+ * @param  duty high part of a period [%]
+ * @param  low low code
+ * @param  high high code
+ * @return
+ */
+void dac_stream_square(uint16_t* table, uint16_t len, uint16_t cycles, uint8_t duty, uint16_t low, uint16_t high)
+{
+    uint32_t position = 0;
+    uint32_t edge     = (uint32_t)len * duty;
+    uint16_t i;
+
+    for (i = 0; i < len; i++) {
+        table[i] = (position * 100 < edge) ? high : low;
+        position = (position + cycles) % len;
+    }
+}
+
+/**
+ * @brief  Synthesize a linear chirp
+ * @param  table the table
+ * @param  len the table length
+ * @param  start_cycles frequency at the start, in periods per table length
+ * @param  end_cycles frequency at the end, in periods per table length
+ * @param  offset mid code
+ * @param  amplitude peak deviation from offset, in codes
+ * @return
+ * @note   The table holds (start_cycles + end_cycles) / 2 periods, an even
+ *         sum loops without a glitch
+ */
+void dac_stream_chirp(uint16_t* table, uint16_t len, uint16_t start_cycles, uint16_t end_cycles, uint16_t offset,
+    uint16_t amplitude)
+{
+    /* phase(i) = (start * i + (end - start) * i^2 / (2 * len)) / len turns */
+    int64_t den = 2 * (int64_t)len * len;
+    int64_t num;
+    uint16_t i;
+
+    for (i = 0; i < len; i++) {
+        num = 2 * (int64_t)len * start_cycles * i + ((int64_t)end_cycles - start_cycles) * i * i;
+        num %= den;
+        if (num < 0) {
+            num += den;
+        }
+        table[i] = dac_code(offset, amplitude, dac_sine((uint32_t)(((uint64_t)num << 32) / den)));
+    }
+}
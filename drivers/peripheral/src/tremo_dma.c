@@ -4,6 +4,28 @@
 #include "tremo_dma.h"
 
 dma_callback_func g_dma_callback_handler[TREMO_DMA_NUM][TREMO_DMA_CHAN_NUM]; /*!< DMA callback function handler*/
+dma_callback_func g_dma_error_handler[TREMO_DMA_NUM][TREMO_DMA_CHAN_NUM];    /*!< DMA error callback function handler*/
+
+static void dma_error_irq(uint8_t dma_num)
+{
+    uint32_t err = TREMO_REG_RD(DMA_STATUS_ERR_L_REG(dma_num)) & 0x0F;
+    uint8_t ch;
+
+    if (err == 0) {
+        return;
+    }
+    /* the blocks of the failed transfers are not reported */
+    TREMO_REG_WR(DMA_CLEAR_ERR_L_REG(dma_num), err);
+    TREMO_REG_WR(DMA_CLEAR_BLOCK_L_REG(dma_num), err);
+    TREMO_REG_WR(DMA_CLEAR_TFR_L_REG(dma_num), err);
+    do {
+        ch = __CLZ(__RBIT(err));
+        err &= err - 1;
+        if (g_dma_error_handler[dma_num][ch]) {
+            g_dma_error_handler[dma_num][ch]();
+        }
+    } while (err);
+}
 
 static uint32_t write32_bit_variate(uint32_t variate_value, uint8_t start_bit, uint8_t len, uint32_t src_val)
 {
@@ -64,84 +86,35 @@ static uint32_t read32_bit_reg(uint32_t reg, uint8_t start_bit, uint8_t len)
     }
 }
 
-void dma0_IRQHandler(void)
+/* services every channel pending, lowest first, until none is left */
+static void dma_irq(uint8_t dma_num)
 {
-    uint8_t dma_ch = 0;
-
-    if (TREMO_REG_RD(DMA_STATUS_BLOCK_L_REG(0)) & 0x01) {
-        dma_ch = 0;
-    } else if (TREMO_REG_RD(DMA_STATUS_BLOCK_L_REG(0)) & 0x02) {
-        dma_ch = 1;
-    } else if (TREMO_REG_RD(DMA_STATUS_BLOCK_L_REG(0)) & 0x04) {
-        dma_ch = 2;
-    } else {
-        dma_ch = 3;
+    uint32_t status;
+    uint8_t dma_ch;
+
+    dma_error_irq(dma_num);
+    while ((status = TREMO_REG_RD(DMA_STATUS_BLOCK_L_REG(dma_num)) & 0x0F) != 0) {
+        /*clear TFR and block int of the channels serviced in one write*/
+        TREMO_REG_WR(DMA_CLEAR_TFR_L_REG(dma_num), status);
+        TREMO_REG_WR(DMA_CLEAR_BLOCK_L_REG(dma_num), status);
+        do {
+            dma_ch = __CLZ(__RBIT(status));
+            status &= status - 1;
+            if (g_dma_callback_handler[dma_num][dma_ch]) {
+                g_dma_callback_handler[dma_num][dma_ch]();
+            }
+        } while (status);
     }
+}
 
-    if (dma_ch == 0) {
-        /*clear TFR int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_TFR_L_REG(0), 0x1);
-        /*clear block int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_BLOCK_L_REG(0), 0x1);
-    } else if (dma_ch == 1) {
-        /*clear TFR int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_TFR_L_REG(0), 0x2);
-        /*clear block int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_BLOCK_L_REG(0), 0x2);
-    } else if (dma_ch == 2) {
-        /*clear TFR int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_TFR_L_REG(0), 0x4);
-        /*clear block int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_BLOCK_L_REG(0), 0x4);
-    } else {
-        /*clear TFR int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_TFR_L_REG(0), 0x8);
-        /*clear block int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_BLOCK_L_REG(0), 0x8);
-    }
-    if (g_dma_callback_handler[0][dma_ch]) {
-        g_dma_callback_handler[0][dma_ch]();
-    }
+void dma0_IRQHandler(void)
+{
+    dma_irq(0);
 }
 
 void dma1_IRQHandler(void)
 {
-    uint8_t dma_ch = 0;
-
-    if (TREMO_REG_RD(DMA_STATUS_BLOCK_L_REG(1)) & 0x01) {
-        dma_ch = 0;
-    } else if (TREMO_REG_RD(DMA_STATUS_BLOCK_L_REG(1)) & 0x02) {
-        dma_ch = 1;
-    } else if (TREMO_REG_RD(DMA_STATUS_BLOCK_L_REG(1)) & 0x04) {
-        dma_ch = 2;
-    } else {
-        dma_ch = 3;
-    }
-
-    if (dma_ch == 0) {
-        /*clear TFR int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_TFR_L_REG(1), 0x1);
-        /*clear block int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_BLOCK_L_REG(1), 0x1);
-    } else if (dma_ch == 1) {
-        /*clear TFR int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_TFR_L_REG(1), 0x2);
-        /*clear block int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_BLOCK_L_REG(1), 0x2);
-    } else if (dma_ch == 2) {
-        /*clear TFR int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_TFR_L_REG(1), 0x4);
-        /*clear block int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_BLOCK_L_REG(1), 0x4);
-    } else {
-        /*clear TFR int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_TFR_L_REG(1), 0x8);
-        /*clear block int,channelx*/
-        TREMO_REG_WR(DMA_CLEAR_BLOCK_L_REG(1), 0x8);
-    }
-    if (g_dma_callback_handler[1][dma_ch]) {
-        g_dma_callback_handler[1][dma_ch]();
-    }
+    dma_irq(1);
 }
 
 static void set_dma_mode(dma_dev_t* dma, dma_config_reg_t* config_reg)
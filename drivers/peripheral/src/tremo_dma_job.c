@@ -0,0 +1,278 @@
+#include <stdbool.h>
+#include "tremo_cm4.h"
+#include "tremo_dma.h"
+#include "tremo_dma_job.h"
+
+#define DMA_CHAN_INDEX(dma_num, ch) ((dma_num) * TREMO_DMA_CHAN_NUM + (ch))
+
+static uint8_t dma_chan_used = 0;                                       /*!< channels handed out*/
+static dma_job_t* dma_job_head[TREMO_DMA_NUM * TREMO_DMA_CHAN_NUM];     /*!< job running on the channel*/
+static dma_job_t* dma_job_tail[TREMO_DMA_NUM * TREMO_DMA_CHAN_NUM];
+
+static void dma_job_irq(uint8_t dma_num, uint8_t ch, bool success);
+
+#define DMA_JOB_HANDLERS(n, c)                                          \
+    static void dma_job_done_##n##_##c(void) { dma_job_irq(n, c, true); } \
+    static void dma_job_error_##n##_##c(void) { dma_job_irq(n, c, false); }
+
+DMA_JOB_HANDLERS(0, 0)
+DMA_JOB_HANDLERS(0, 1)
+DMA_JOB_HANDLERS(0, 2)
+DMA_JOB_HANDLERS(0, 3)
+DMA_JOB_HANDLERS(1, 0)
+DMA_JOB_HANDLERS(1, 1)
+DMA_JOB_HANDLERS(1, 2)
+DMA_JOB_HANDLERS(1, 3)
+
+static const dma_callback_func dma_job_done_handler[TREMO_DMA_NUM * TREMO_DMA_CHAN_NUM] = {
+    dma_job_done_0_0, dma_job_done_0_1, dma_job_done_0_2, dma_job_done_0_3,
+    dma_job_done_1_0, dma_job_done_1_1, dma_job_done_1_2, dma_job_done_1_3
+};
+
+static const dma_callback_func dma_job_error_handler[TREMO_DMA_NUM * TREMO_DMA_CHAN_NUM] = {
+    dma_job_error_0_0, dma_job_error_0_1, dma_job_error_0_2, dma_job_error_0_3,
+    dma_job_error_1_0, dma_job_error_1_1, dma_job_error_1_2, dma_job_error_1_3
+};
+
+/* called with the interrupts disabled */
+static void dma_job_start(uint8_t dma_num, uint8_t ch)
+{
+    uint8_t index = DMA_CHAN_INDEX(dma_num, ch);
+    dma_job_t* job = dma_job_head[index];
+    uint16_t i;
+
+    job->dev.dma_num = dma_num;
+    job->dev.ch      = ch;
+    job->dev.priv    = dma_job_done_handler[index];
+
+    if (job->blocks != NULL && job->block_num > 1) {
+        dma_lli_mode_t lli_mode;
+
+        lli_mode.block_num       = job->block_num;
+        lli_mode.src_lli_enable  = true;
+        lli_mode.dest_lli_enable = true;
+        job->dev.src             = job->blocks[0].src;
+        job->dev.dest            = job->blocks[0].dest;
+        dma_lli_init(&job->dev, job->lli, job->blocks, &lli_mode);
+        if (job->flags & DMA_JOB_CIRCULAR) {
+            /* every block interrupts, the last one links back to the first */
+            job->lli[job->block_num - 1].LLP = (uint32_t)&job->lli[0];
+            job->lli[job->block_num - 1].CTL_L |= (uint32_t)0x3 << 27;
+        } else {
+            /* one block interrupt, at the end of the last block */
+            for (i = 0; i + 1 < job->block_num; i++) {
+                job->lli[i].CTL_L &= ~(uint32_t)0x1;
+            }
+        }
+    } else {
+        if (job->blocks != NULL) {
+            job->dev.src        = job->blocks[0].src;
+            job->dev.dest       = job->blocks[0].dest;
+            job->dev.block_size = job->blocks[0].block_size;
+        }
+        dma_init(&job->dev);
+    }
+
+    g_dma_error_handler[dma_num][ch] = dma_job_error_handler[index];
+    TREMO_REG_WR(DMA_MASK_ERR_L_REG(dma_num), 0x0101 << ch);
+    dma_ch_enable(dma_num, ch);
+    if (job->start) {
+        job->start(job);
+    }
+}
+
+static void dma_job_irq(uint8_t dma_num, uint8_t ch, bool success)
+{
+    uint8_t index = DMA_CHAN_INDEX(dma_num, ch);
+    dma_job_t* job = dma_job_head[index];
+
+    if (job == NULL) {
+        return;
+    }
+    if (!success) {
+        dma_ch_disable(dma_num, ch);
+    } else if (job->flags & DMA_JOB_CIRCULAR) {
+        /* block done, the job keeps the channel */
+        if (job->done) {
+            job->done(job, true);
+        }
+        return;
+    }
+
+    /* the next job runs while the callback of this one is called */
+    dma_job_head[index] = job->next;
+    if (job->next != NULL) {
+        dma_job_start(dma_num, ch);
+    } else {
+        dma_job_tail[index] = NULL;
+    }
+    job->next = NULL;
+    if (job->done) {
+        job->done(job, success);
+    }
+}
+
+/**
+ * @brief  Acquire a free DMA channel
+ * @param  chan the channel acquired
+ * @return ERRNO_OK, ERRNO_ERROR when all the channels are in use
+ * @note   The reserved channels and the ones programmed directly with a
+ *         callback by dma_init are skipped
+ */
+int32_t dma_chan_acquire(dma_chan_t* chan)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint8_t dma_num, ch;
+
+    __disable_irq();
+    for (dma_num = 0; dma_num < TREMO_DMA_NUM; dma_num++) {
+        for (ch = 0; ch < TREMO_DMA_CHAN_NUM; ch++) {
+            uint8_t bit = 1 << DMA_CHAN_INDEX(dma_num, ch);
+
+            if (((CONFIG_DMA_CHAN_RESERVED | dma_chan_used) & bit) || g_dma_callback_handler[dma_num][ch] != NULL) {
+                continue;
+            }
+            dma_chan_used |= bit;
+            __set_PRIMASK(primask);
+            chan->dma_num = dma_num;
+            chan->ch      = ch;
+            return ERRNO_OK;
+        }
+    }
+    __set_PRIMASK(primask);
+    return ERRNO_ERROR;
+}
+
+/**
+ * @brief  Acquire a given DMA channel, reserved ones included
+ * @param  dma_num the DMA number
+ * @param  ch the DMA channel
+ * @return ERRNO_OK, ERRNO_ERROR when it is in use
+ */
+int32_t dma_chan_claim(uint8_t dma_num, uint8_t ch)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint8_t bit;
+    int32_t ret = ERRNO_ERROR;
+
+    if (dma_num >= TREMO_DMA_NUM || ch >= TREMO_DMA_CHAN_NUM) {
+        return ERRNO_ERROR;
+    }
+    bit = 1 << DMA_CHAN_INDEX(dma_num, ch);
+    __disable_irq();
+    if (!(dma_chan_used & bit)) {
+        dma_chan_used |= bit;
+        ret = ERRNO_OK;
+    }
+    __set_PRIMASK(primask);
+    return ret;
+}
+
+/**
+ * @brief  Release a DMA channel
+ * @param  chan the channel
+ * @return ERRNO_OK, ERRNO_ERROR while jobs are queued on it
+ */
+int32_t dma_chan_release(dma_chan_t chan)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint8_t index = DMA_CHAN_INDEX(chan.dma_num, chan.ch);
+    int32_t ret = ERRNO_ERROR;
+
+    __disable_irq();
+    if (dma_job_head[index] == NULL) {
+        TREMO_REG_WR(DMA_MASK_ERR_L_REG(chan.dma_num), 0x0100 << chan.ch);
+        g_dma_error_handler[chan.dma_num][chan.ch]    = NULL;
+        g_dma_callback_handler[chan.dma_num][chan.ch] = NULL;
+        dma_chan_used &= ~(1 << index);
+        ret = ERRNO_OK;
+    }
+    __set_PRIMASK(primask);
+    return ret;
+}
+
+/**
+ * @brief  Submit a job to a DMA channel
+ * @param  chan the channel, acquired
+ * @param  job the job, started at once on an idle channel, queued otherwise
+ * @return ERRNO_OK, ERRNO_ERROR on an invalid job
+ * @note   The buffers, the blocks and the LLI nodes of the job are used until
+ *         its callback
+ */
+int32_t dma_job_submit(dma_chan_t chan, dma_job_t* job)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint8_t index = DMA_CHAN_INDEX(chan.dma_num, chan.ch);
+
+    if (job == NULL || !(dma_chan_used & (1 << index))
+        || (job->blocks != NULL && (job->block_num == 0 || (job->block_num > 1 && job->lli == NULL)))
+        || ((job->flags & DMA_JOB_CIRCULAR) && (job->blocks == NULL || job->block_num < 2))) {
+        return ERRNO_ERROR;
+    }
+    job->next = NULL;
+
+    __disable_irq();
+    if (dma_job_head[index] == NULL) {
+        dma_job_head[index] = job;
+        dma_job_tail[index] = job;
+        dma_job_start(chan.dma_num, chan.ch);
+    } else {
+        dma_job_tail[index]->next = job;
+        dma_job_tail[index]       = job;
+    }
+    __set_PRIMASK(primask);
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Stop the job running on a DMA channel and drop the queued ones
+ * @param  chan the channel
+ * @return ERRNO_OK
+ * @note   No callback is called, the buffers of the jobs are free on return
+ */
+int32_t dma_job_abort(dma_chan_t chan)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint8_t index = DMA_CHAN_INDEX(chan.dma_num, chan.ch);
+    dma_job_t* job;
+
+    __disable_irq();
+    dma_ch_disable(chan.dma_num, chan.ch);
+    TREMO_REG_WR(DMA_CLEAR_ERR_L_REG(chan.dma_num), 1 << chan.ch);
+    TREMO_REG_WR(DMA_CLEAR_BLOCK_L_REG(chan.dma_num), 1 << chan.ch);
+    TREMO_REG_WR(DMA_CLEAR_TFR_L_REG(chan.dma_num), 1 << chan.ch);
+    while ((job = dma_job_head[index]) != NULL) {
+        dma_job_head[index] = job->next;
+        job->next           = NULL;
+    }
+    dma_job_tail[index] = NULL;
+    __set_PRIMASK(primask);
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Check whether jobs are running or queued on a DMA channel
+ * @param  chan the channel
+ * @return true while the channel has jobs
+ */
+bool dma_job_busy(dma_chan_t chan)
+{
+    return dma_job_head[DMA_CHAN_INDEX(chan.dma_num, chan.ch)] != NULL;
+}
+
+/**
+ * @brief  Get the destination address the channel writes next
+ * @param  chan the channel
+ * @return the destination address
+ */
+uint32_t dma_chan_get_dest(dma_chan_t chan)
+{
+    if (chan.ch == 0) {
+        return DMA_DAR0_L(chan.dma_num);
+    } else if (chan.ch == 1) {
+        return DMA_DAR1_L(chan.dma_num);
+    } else if (chan.ch == 2) {
+        return DMA_DAR2_L(chan.dma_num);
+    }
+    return DMA_DAR3_L(chan.dma_num);
+}
@@ -0,0 +1,199 @@
+#include <string.h>
+#include "tremo_cm4.h"
+#include "tremo_rcc.h"
+#include "tremo_dma_memcpy.h"
+
+#define DMA_MEMCPY_BLOCK_BURST (4092) /*!< Largest block of whole 4 beat bursts*/
+
+static dma_chan_t dma_memcpy_chan;
+static bool dma_memcpy_ready = false;
+
+/* fills the blocks of the next job from the position of the copy, the number of blocks */
+static uint16_t dma_memcpy_fill(dma_memcpy_t* copy)
+{
+    uint16_t num = 0;
+
+    while (num < CONFIG_DMA_MEMCPY_BLOCKS && copy->seg < copy->seg_num) {
+        const dma_memcpy_seg_t* seg = &copy->segs[copy->seg];
+        dma_lli_block_config_t* block = &copy->blocks[num];
+        uint32_t src = (uint32_t)seg->src + copy->offset;
+        uint32_t dst = (uint32_t)seg->dst + copy->offset;
+        uint32_t left = seg->len - copy->offset;
+        uint32_t units;
+        uint8_t width;
+
+        if (left == 0) {
+            copy->seg++;
+            copy->offset = 0;
+            continue;
+        }
+        /* the widest transfers both ends can be aligned to, the bytes up to
+           the boundary and the tail go in narrower blocks */
+        if (((src ^ dst) & 3) == 0 && left >= 4) {
+            width = (src & 3) == 0 ? 2 : 0;
+            units = (src & 3) == 0 ? left >> 2 : 4 - (src & 3);
+        } else if (((src ^ dst) & 1) == 0 && left >= 2) {
+            width = (src & 1) == 0 ? 1 : 0;
+            units = (src & 1) == 0 ? left >> 1 : 1;
+        } else {
+            width = 0;
+            units = left;
+        }
+        if (units > DMA_MEMCPY_BLOCK_MAX) {
+            units = DMA_MEMCPY_BLOCK_BURST;
+        }
+
+        block->src        = src;
+        block->dest       = dst;
+        block->data_width = width;
+        block->src_msize  = (units & 3) == 0 ? 1 : 0;
+        block->dest_msize = block->src_msize;
+        block->block_size = units;
+        copy->offset += units << width;
+        num++;
+    }
+    return num;
+}
+
+static void dma_memcpy_job_done(dma_job_t* job, bool success);
+
+static int32_t dma_memcpy_submit(dma_memcpy_t* copy, uint16_t num)
+{
+    dma_job_t* job = &copy->job;
+
+    memset(job, 0, sizeof(dma_job_t));
+    job->dev.mode       = M2M_MODE;
+    job->dev.data_width = copy->blocks[0].data_width;
+    job->dev.src_msize  = copy->blocks[0].src_msize;
+    job->dev.dest_msize = copy->blocks[0].dest_msize;
+    job->blocks         = copy->blocks;
+    job->lli            = copy->lli;
+    job->block_num      = num;
+    job->done           = dma_memcpy_job_done;
+    job->arg            = copy;
+    return dma_job_submit(dma_memcpy_chan, job);
+}
+
+static void dma_memcpy_job_done(dma_job_t* job, bool success)
+{
+    dma_memcpy_t* copy = (dma_memcpy_t*)job->arg;
+    uint16_t num;
+
+    if (success) {
+        num = dma_memcpy_fill(copy);
+        if (num > 0) {
+            if (dma_memcpy_submit(copy, num) == ERRNO_OK) {
+                return;
+            }
+            success = false;
+        }
+    }
+    copy->busy = false;
+    if (copy->done) {
+        copy->done(copy, success);
+    }
+}
+
+/**
+ * @brief  Acquire the DMA channel of the copies and enable its DMA clock
+ * @return ERRNO_OK, ERRNO_ERROR when no DMA channel is free, the CPU then
+ *         does all the copies
+ */
+int32_t dma_memcpy_init(void)
+{
+    if (dma_memcpy_ready) {
+        return ERRNO_OK;
+    }
+    if (dma_chan_acquire(&dma_memcpy_chan) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+    rcc_enable_peripheral_clk(dma_memcpy_chan.dma_num ? RCC_PERIPHERAL_DMA1 : RCC_PERIPHERAL_DMA0, true);
+    dma_memcpy_ready = true;
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Release the DMA channel of the copies
+ * @return ERRNO_OK, ERRNO_ERROR while copies run
+ */
+int32_t dma_memcpy_deinit(void)
+{
+    if (!dma_memcpy_ready) {
+        return ERRNO_OK;
+    }
+    if (dma_chan_release(dma_memcpy_chan) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+    dma_memcpy_ready = false;
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Start a scatter-gather copy
+ * @param  copy the copy, its arg set by the caller
+ * @param  segs the segments, copied in order, used until the callback
+ * @param  seg_num the number of segments
+ * @param  done the completion callback, NULL to poll copy->busy
+ * @return ERRNO_OK, ERRNO_ERROR when the DMA job can not be submitted
+ * @note   The copy is queued behind the ones started before. Copies of
+ *         less than CONFIG_DMA_MEMCPY_THRESHOLD bytes in all, or before
+ *         dma_memcpy_init, are done by the CPU and their callback called
+ *         before the return. The segments must not overlap.
+ */
+int32_t dma_memcpy_sg(dma_memcpy_t* copy, const dma_memcpy_seg_t* segs, uint16_t seg_num, dma_memcpy_callback_t done)
+{
+    uint32_t total = 0;
+    uint16_t i, num;
+
+    if (copy == NULL || (segs == NULL && seg_num > 0)) {
+        return ERRNO_ERROR;
+    }
+    for (i = 0; i < seg_num; i++) {
+        total += segs[i].len;
+    }
+    copy->done    = done;
+    copy->segs    = segs;
+    copy->seg_num = seg_num;
+    copy->seg     = 0;
+    copy->offset  = 0;
+
+    if (!dma_memcpy_ready || total < CONFIG_DMA_MEMCPY_THRESHOLD) {
+        for (i = 0; i < seg_num; i++) {
+            memcpy(segs[i].dst, segs[i].src, segs[i].len);
+        }
+        copy->busy = false;
+        if (done) {
+            done(copy, true);
+        }
+        return ERRNO_OK;
+    }
+
+    copy->busy = true;
+    num        = dma_memcpy_fill(copy);
+    if (dma_memcpy_submit(copy, num) != ERRNO_OK) {
+        copy->busy = false;
+        return ERRNO_ERROR;
+    }
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Start a copy
+ * @param  copy the copy, its arg set by the caller
+ * @param  dst the destination
+ * @param  src the source, RAM or flash
+ * @param  len the length in bytes
+ * @param  done the completion callback, NULL to poll copy->busy
+ * @return ERRNO_OK, ERRNO_ERROR when the DMA job can not be submitted
+ * @note   See dma_memcpy_sg
+ */
+int32_t dma_memcpy(dma_memcpy_t* copy, void* dst, const void* src, uint32_t len, dma_memcpy_callback_t done)
+{
+    if (copy == NULL) {
+        return ERRNO_ERROR;
+    }
+    copy->one.dst = dst;
+    copy->one.src = src;
+    copy->one.len = len;
+    return dma_memcpy_sg(copy, &copy->one, 1, done);
+}
@@ -1,6 +1,21 @@
 #include <string.h>
 #include "tremo_flash.h"
 
+static volatile bool flash_erase_pending = false;
+static flash_op_t* flash_queue_head       = NULL;
+static flash_op_t* flash_queue_tail       = NULL;
+
+/* the operation of flash_erase_page_start ends before the next one */
+static RAM_FUNC_ATTR void flash_erase_finish(void)
+{
+    if (flash_erase_pending) {
+        while (!(EFC->SR & EFC_SR_OPERATION_DONE))
+            ;
+        EFC->SR             = EFC_SR_OPERATION_DONE;
+        flash_erase_pending = false;
+    }
+}
+
 /**
  * @brief Erase all the flash main area
  * @param None
@@ -9,6 +24,8 @@
  */
 int32_t flash_erase_all(void)
 {
+    flash_erase_finish();
+
     //clear sr
     if(SEC->SR & SEC_SR_FLASH_ACCESS_ERROR_MASK)
         SEC->SR = SEC_SR_FLASH_ACCESS_ERROR_MASK;
@@ -33,12 +50,33 @@ int32_t flash_erase_all(void)
 
 /**
  * @brief Erase one page 
+ * @note  With RUN_IN_RAM the erase waits in RAM with the interrupts enabled,
+ *        the handlers in RAM keep running
  * @param addr The flash address
  * @retval ERRNO_OK Erase successfully 
  * @retval ERRNO_FLASH_SEC_ERROR Erase failed due to the flash security policy 
  */
-int32_t flash_erase_page(uint32_t addr)
+RAM_FUNC_ATTR int32_t flash_erase_page(uint32_t addr)
 {
+    int32_t ret = flash_erase_page_start(addr);
+
+    flash_erase_finish();
+    return ret;
+}
+
+/**
+ * @brief Start the erase of one page, without waiting for its end
+ * @note  The code and data read from flash wait until the erase is done, the
+ *        peripherals and the DMA keep running. The next flash operation waits
+ *        for the end of this one.
+ * @param addr The flash address
+ * @retval ERRNO_OK Erase started
+ * @retval ERRNO_FLASH_SEC_ERROR Erase failed due to the flash security policy
+ */
+RAM_FUNC_ATTR int32_t flash_erase_page_start(uint32_t addr)
+{
+    flash_erase_finish();
+
     //clear sr
     if(SEC->SR & SEC_SR_FLASH_ACCESS_ERROR_MASK)
         SEC->SR = SEC_SR_FLASH_ACCESS_ERROR_MASK;
@@ -53,29 +91,43 @@ int32_t flash_erase_page(uint32_t addr)
         SEC->SR = SEC_SR_FLASH_ACCESS_ERROR_MASK;
         return ERRNO_FLASH_SEC_ERROR;
     }
-
-    while (!(EFC->SR & EFC_SR_OPERATION_DONE))
-        ;
-    EFC->SR = EFC_SR_OPERATION_DONE;
+    flash_erase_pending = true;
 
     return ERRNO_OK;
 }
 
+/**
+ * @brief Check whether the erase started by flash_erase_page_start is running
+ * @retval true The erase is running
+ * @retval false The flash is free
+ */
+bool flash_erase_busy(void)
+{
+    if (flash_erase_pending && (EFC->SR & EFC_SR_OPERATION_DONE)) {
+        EFC->SR             = EFC_SR_OPERATION_DONE;
+        flash_erase_pending = false;
+    }
+    return flash_erase_pending;
+}
+
 /**
  * @brief Program the data into flash 
  * @note  The address must be aligned by 8 bytes. If the size is not an integral multiple of 8 bytes, it will be padded with 0xFF 
+ * @note  With RUN_IN_RAM the program waits in RAM with the interrupts enabled
  * @param addr The flash address
  * @param data The data to be programmed
  * @param size The size of the data
  * @retval ERRNO_OK Program successfully 
  * @retval ERRNO_FLASH_SEC_ERROR Program failed due to the flash security policy 
  */
-int32_t flash_program_bytes(uint32_t addr, uint8_t* data, uint32_t size)
+RAM_FUNC_ATTR int32_t flash_program_bytes(uint32_t addr, uint8_t* data, uint32_t size)
 {
     uint8_t tmp[8];
     uint8_t* p            = tmp;
     uint32_t aligned_size = 0;
 
+    flash_erase_finish();
+
     //clear sr
     if(SEC->SR & SEC_SR_FLASH_ACCESS_ERROR_MASK)
         SEC->SR = SEC_SR_FLASH_ACCESS_ERROR_MASK;
@@ -84,10 +136,10 @@ int32_t flash_program_bytes(uint32_t addr, uint8_t* data, uint32_t size)
     EFC->CR = (EFC->CR & EFC_CR_ECC_DISABLE_MASK) | EFC_CR_PROG_EN_MASK | EFC_CR_PREFETCH_EN_MASK;
     FLASH_CR_LOCK();
 
+    // no library call, it may be in flash
     aligned_size = (size)&0xFFFFFFF8;
-    memset((char*)tmp, 0xFF, sizeof(tmp));
-    for (int i = aligned_size; i < size; i++) {
-        tmp[i - aligned_size] = data[i];
+    for (int i = 0; i < sizeof(tmp); i++) {
+        tmp[i] = (aligned_size + i < size) ? data[aligned_size + i] : 0xFF;
     }
 
     for (int i = 0; i < size; i += 8) {
@@ -126,6 +178,14 @@ int32_t flash_program_bytes(uint32_t addr, uint8_t* data, uint32_t size)
 RAM_FUNC_ATTR int32_t flash_program_line(uint32_t addr, uint8_t* data)
 {
     __disable_irq();
+    // a page erase still running
+    if (flash_erase_pending) {
+        while (!(EFC->SR & EFC_SR_OPERATION_DONE))
+            ;
+        EFC->SR             = EFC_SR_OPERATION_DONE;
+        flash_erase_pending = false;
+    }
+
     //clear sr
     if(SEC->SR & SEC_SR_FLASH_ACCESS_ERROR_MASK)
         SEC->SR = SEC_SR_FLASH_ACCESS_ERROR_MASK;
@@ -193,3 +253,219 @@ int32_t flash_otp_program_data(uint32_t addr, uint8_t* data, uint32_t size)
 
     return flash_program_bytes(addr, data, size);
 }
+
+/**
+ * @brief Init a streaming flash writer
+ * @note  The bytes written are buffered and each full word line goes to
+ *        flash_program_line, the part of a line before an unaligned start is
+ *        programmed by flash_program_bytes. The area must not be programmed
+ *        until the writer is flushed.
+ * @note  With erase_size, the page after the one being filled is erased in
+ *        the background by flash_erase_page_start once a line is committed
+ * @param writer The writer
+ * @param addr The flash address of the first byte, aligned by 8 bytes
+ * @param erase_size Size of the area erased by the writer from addr, 0 for an
+ *        area erased already. The page holding a start not aligned by a page
+ *        is expected erased already.
+ * @retval ERRNO_OK Init successfully
+ * @retval ERRNO_FLASH_INVALID_ADDR The address is not aligned by 8 bytes
+ */
+int32_t flash_writer_init(flash_writer_t* writer, uint32_t addr, uint32_t erase_size)
+{
+    if (addr & 0x7)
+        return ERRNO_FLASH_INVALID_ADDR;
+
+    writer->addr      = addr;
+    writer->len       = 0;
+    writer->erased    = 0;
+    writer->erase_end = 0;
+    if (erase_size) {
+        writer->erased    = (addr + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1);
+        writer->erase_end = addr + erase_size;
+        if (writer->erased < writer->erase_end) {
+            if (flash_erase_page_start(writer->erased) != ERRNO_OK)
+                return ERRNO_FLASH_SEC_ERROR;
+            writer->erased += FLASH_PAGE_SIZE;
+        }
+    }
+
+    return ERRNO_OK;
+}
+
+static int32_t flash_writer_commit(flash_writer_t* writer)
+{
+    uint32_t start = writer->addr - writer->len;
+    int32_t ret;
+
+    if (writer->erased) {
+        while (writer->erased < writer->addr && writer->erased < writer->erase_end) {
+            ret = flash_erase_page(writer->erased);
+            if (ret != ERRNO_OK)
+                return ret;
+            writer->erased += FLASH_PAGE_SIZE;
+        }
+    }
+
+    // waits for an erase still running
+    if (writer->len == FLASH_LINE_SIZE)
+        ret = flash_program_line(start, (uint8_t*)writer->line);
+    else
+        ret = flash_program_bytes(start, (uint8_t*)writer->line, writer->len);
+    writer->len = 0;
+    if (ret != ERRNO_OK)
+        return ret;
+
+    // the next page is erased while the data of this one comes in
+    if (writer->erased && writer->erased < writer->erase_end && writer->erased < writer->addr + FLASH_PAGE_SIZE) {
+        ret = flash_erase_page_start(writer->erased);
+        if (ret == ERRNO_OK)
+            writer->erased += FLASH_PAGE_SIZE;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Write data through a streaming flash writer
+ * @param writer The writer
+ * @param data The data to be programmed
+ * @param size The size of the data
+ * @retval ERRNO_OK Write successfully, the data may still be buffered
+ * @retval ERRNO_FLASH_SEC_ERROR Program or erase failed due to the flash security policy
+ */
+int32_t flash_writer_write(flash_writer_t* writer, const uint8_t* data, uint32_t size)
+{
+    uint8_t* line = (uint8_t*)writer->line;
+    uint32_t offset, n;
+    int32_t ret;
+
+    while (size) {
+        // the line ends at the next word line boundary
+        offset = writer->addr & (FLASH_LINE_SIZE - 1);
+        n      = FLASH_LINE_SIZE - offset;
+        if (n > size)
+            n = size;
+
+        memcpy(line + writer->len, data, n);
+        writer->len += n;
+        writer->addr += n;
+        data += n;
+        size -= n;
+
+        if (!(writer->addr & (FLASH_LINE_SIZE - 1))) {
+            ret = flash_writer_commit(writer);
+            if (ret != ERRNO_OK)
+                return ret;
+        }
+    }
+
+    return ERRNO_OK;
+}
+
+/**
+ * @brief Program the bytes buffered by a streaming flash writer
+ * @note  The tail is padded with 0xFF to 8 bytes, the writer continues at
+ *        the next address aligned by 8 bytes
+ * @param writer The writer
+ * @retval ERRNO_OK Flush successfully
+ * @retval ERRNO_FLASH_SEC_ERROR Program or erase failed due to the flash security policy
+ */
+int32_t flash_writer_flush(flash_writer_t* writer)
+{
+    int32_t ret;
+
+    if (writer->len == 0)
+        return ERRNO_OK;
+
+    ret          = flash_writer_commit(writer);
+    writer->addr = (writer->addr + 7) & ~(uint32_t)0x7;
+
+    return ret;
+}
+
+/**
+ * @brief Queue a flash erase or program
+ * @note  The operations run in order from flash_queue_process, which is
+ *        called when the time critical work allows it, eg. between the radio
+ *        windows. The data must stay valid until the callback.
+ * @param op The operation
+ * @retval ERRNO_OK Queued
+ * @retval ERRNO_FLASH_INVALID_ADDR The address is not aligned
+ * @retval ERRNO_FLASH_INVALID_SIZE The size is 0
+ */
+int32_t flash_queue_submit(flash_op_t* op)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    if (op->size == 0)
+        return ERRNO_FLASH_INVALID_SIZE;
+    if ((op->addr & 0x7) || (op->data == NULL && (op->addr & (FLASH_PAGE_SIZE - 1))))
+        return ERRNO_FLASH_INVALID_ADDR;
+
+    op->pos  = 0;
+    op->next = NULL;
+
+    __disable_irq();
+    if (flash_queue_head == NULL)
+        flash_queue_head = op;
+    else
+        flash_queue_tail->next = op;
+    flash_queue_tail = op;
+    __set_PRIMASK(primask);
+
+    return ERRNO_OK;
+}
+
+/**
+ * @brief Run one step of the queued flash operations
+ * @note  A step is a page erase or CONFIG_FLASH_QUEUE_CHUNK bytes programmed,
+ *        the callback of an operation is called from the step ending it
+ * @retval true Operations are left, the function is to be called again
+ * @retval false The queue is empty
+ */
+bool flash_queue_process(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    flash_op_t* op   = flash_queue_head;
+    uint32_t n;
+    int32_t ret;
+
+    if (op == NULL)
+        return false;
+
+    if (op->data == NULL) {
+        ret = flash_erase_page(op->addr + op->pos);
+        n   = FLASH_PAGE_SIZE;
+    } else {
+        n = op->size - op->pos;
+        if (n > CONFIG_FLASH_QUEUE_CHUNK)
+            n = CONFIG_FLASH_QUEUE_CHUNK;
+        ret = flash_program_bytes(op->addr + op->pos, (uint8_t*)op->data + op->pos, n);
+    }
+    op->pos += n;
+
+    if (ret == ERRNO_OK && op->pos < op->size)
+        return true;
+
+    __disable_irq();
+    flash_queue_head = op->next;
+    if (flash_queue_head == NULL)
+        flash_queue_tail = NULL;
+    __set_PRIMASK(primask);
+
+    op->next = NULL;
+    if (op->done)
+        op->done(op, ret);
+
+    return flash_queue_head != NULL;
+}
+
+/**
+ * @brief Check whether flash operations are queued
+ * @retval true Operations are queued
+ * @retval false The queue is empty
+ */
+bool flash_queue_busy(void)
+{
+    return flash_queue_head != NULL;
+}
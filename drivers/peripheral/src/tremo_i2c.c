@@ -1,6 +1,40 @@
 #include "tremo_rcc.h"
 #include "tremo_i2c.h"
 
+#define I2C_BUS_NUM (3)
+
+/* interrupts and status bits of the asynchronous transactions */
+#define I2C_XFER_INTR_EN_MASK                                                                      \
+    (I2C_CR_IDBR_EMPTY_INTR_EN_MASK | I2C_CR_DBR_FULL_INTR_EN_MASK | I2C_CR_BUS_ERROR_INTR_EN_MASK \
+     | I2C_CR_ARB_LOSS_DET_INTR_EN_MASK | I2C_CR_MASTER_STOP_DET_EN_MASK | I2C_CR_MASTER_STOP_DET_INTR_EN_MASK)
+#define I2C_XFER_SR_MASK                                                                           \
+    (I2C_SR_IDBR_EMPTY_MASK | I2C_SR_DBR_FULL_MASK | I2C_SR_BUS_ERROR_MASK | I2C_SR_ARB_LOSS_DET_MASK \
+     | I2C_SR_MASTER_STOP_DET_MASK)
+
+/**
+ * @brief Step of the running asynchronous transaction
+ */
+typedef enum {
+    I2C_XFER_IDLE = 0, /*!< No transaction */
+    I2C_XFER_ADDR,     /*!< Address of the segment sent */
+    I2C_XFER_DATA,     /*!< Byte of the segment in transfer */
+    I2C_XFER_STOP,     /*!< Stop requested */
+} i2c_xfer_state_t;
+
+/**
+ * @brief Asynchronous transaction state of a bus
+ */
+typedef struct {
+    i2c_xfer_t* head;       /*!< transaction running */
+    i2c_xfer_t* tail;       /*!< last transaction queued */
+    uint16_t idx;           /*!< bytes of the segment done */
+    uint8_t seg;            /*!< segment running */
+    i2c_xfer_state_t state; /*!< step of the transaction */
+    bool ready;             /*!< i2c_async_init done */
+} i2c_bus_t;
+
+static i2c_bus_t i2c_bus[I2C_BUS_NUM];
+
 static int8_t unit_reset(i2c_t* i2cx, uint32_t t_timeout)
 {
     /* check unit busy */
@@ -284,3 +318,251 @@ it_status_t i2c_get_interrupt_status(i2c_t* i2cx, i2c_interrupt_t intr)
     else
         return RESET;
 }
+
+static i2c_bus_t* i2c_get_bus(i2c_t* i2cx)
+{
+    if (i2cx == I2C0) {
+        return &i2c_bus[0];
+    } else if (i2cx == I2C1) {
+        return &i2c_bus[1];
+    } else if (i2cx == I2C2) {
+        return &i2c_bus[2];
+    }
+    return NULL;
+}
+
+static IRQn_Type i2c_get_irqn(i2c_t* i2cx)
+{
+    if (i2cx == I2C0) {
+        return I2C0_IRQn;
+    } else if (i2cx == I2C1) {
+        return I2C1_IRQn;
+    }
+    return I2C2_IRQn;
+}
+
+/* starts the segment bus->seg with a start or a repeated start */
+static void i2c_seg_start(i2c_t* i2cx, i2c_bus_t* bus, i2c_xfer_t* xfer)
+{
+    bus->idx   = 0;
+    bus->state = I2C_XFER_ADDR;
+    i2c_master_send_start(i2cx, xfer->slave_addr, (xfer->segs[bus->seg].flags & I2C_SEG_READ) ? I2C_READ : I2C_WRITE);
+}
+
+/* issues what follows the address or the byte just done */
+static void i2c_xfer_step(i2c_t* i2cx, i2c_bus_t* bus, i2c_xfer_t* xfer)
+{
+    i2c_seg_t* seg = &xfer->segs[bus->seg];
+    bool last_seg  = bus->seg + 1 == xfer->seg_num;
+
+    if (bus->idx < seg->len) {
+        bus->state = I2C_XFER_DATA;
+        if (seg->flags & I2C_SEG_READ) {
+            /* the last byte of a segment is not acknowledged */
+            i2c_set_receive_mode(i2cx, (bus->idx + 1 < seg->len) ? I2C_ACK : I2C_NAK);
+        } else if (last_seg && bus->idx + 1 == seg->len) {
+            bus->state = I2C_XFER_STOP;
+            i2c_master_send_stop_with_data(i2cx, seg->data[bus->idx++]);
+        } else {
+            i2c_send_data(i2cx, seg->data[bus->idx++]);
+        }
+    } else if (!last_seg) {
+        bus->seg++;
+        i2c_seg_start(i2cx, bus, xfer);
+    } else if (bus->state != I2C_XFER_STOP) {
+        bus->state = I2C_XFER_STOP;
+        i2c_master_send_stop(i2cx);
+    }
+}
+
+/* called with the interrupts disabled, starts the transaction at the head of the queue */
+static void i2c_xfer_start(i2c_t* i2cx, i2c_bus_t* bus)
+{
+    i2cx->SR = i2cx->SR;
+    i2cx->CR |= I2C_XFER_INTR_EN_MASK;
+    bus->seg = 0;
+    i2c_seg_start(i2cx, bus, bus->head);
+}
+
+/* called with the interrupts disabled or from the interrupt of the bus */
+static void i2c_xfer_finish(i2c_t* i2cx, i2c_bus_t* bus, int32_t status)
+{
+    i2c_xfer_t* xfer = bus->head;
+
+    i2cx->CR &= ~I2C_XFER_INTR_EN_MASK;
+    if (status != ERRNO_OK) {
+        i2c_master_send_stop(i2cx);
+    }
+    bus->state = I2C_XFER_IDLE;
+
+    /* the next transaction runs while the callback of this one is called */
+    bus->head = xfer->next;
+    if (bus->head != NULL) {
+        i2c_xfer_start(i2cx, bus);
+    } else {
+        bus->tail = NULL;
+    }
+    xfer->next = NULL;
+    if (xfer->done) {
+        xfer->done(xfer, status);
+    }
+}
+
+/**
+ * @brief Prepare an I2C master for the asynchronous transactions
+ * @param i2cx Select the I2C peripheral number(I2C0, I2C1 and I2C2), initialized
+ *        in master mode without the fifo and enabled
+ * @note The I2Cx_IRQHandler of the application calls i2c_irq_handler
+ * @retval ERRNO_OK, ERRNO_ERROR while transactions are queued
+ */
+int32_t i2c_async_init(i2c_t* i2cx)
+{
+    i2c_bus_t* bus = i2c_get_bus(i2cx);
+
+    if (bus == NULL || bus->head != NULL) {
+        return ERRNO_ERROR;
+    }
+    i2cx->CR &= ~I2C_XFER_INTR_EN_MASK;
+    i2cx->SR = i2cx->SR;
+    NVIC_EnableIRQ(i2c_get_irqn(i2cx));
+    bus->ready = true;
+    return ERRNO_OK;
+}
+
+/**
+ * @brief Stop the asynchronous transactions of an I2C master
+ * @param i2cx Select the I2C peripheral number(I2C0, I2C1 and I2C2)
+ * @retval ERRNO_OK, ERRNO_ERROR while transactions are queued
+ */
+int32_t i2c_async_deinit(i2c_t* i2cx)
+{
+    i2c_bus_t* bus = i2c_get_bus(i2cx);
+
+    if (bus == NULL || bus->head != NULL) {
+        return ERRNO_ERROR;
+    }
+    if (bus->ready) {
+        NVIC_DisableIRQ(i2c_get_irqn(i2cx));
+    }
+    bus->ready = false;
+    return ERRNO_OK;
+}
+
+/**
+ * @brief Submit an asynchronous master transaction
+ * @param i2cx Select the I2C peripheral number(I2C0, I2C1 and I2C2), prepared
+ *        by i2c_async_init
+ * @param xfer The transaction, started at once on an idle bus, queued otherwise
+ * @note The segments run on the byte interrupts, so a slave stretching the
+ *       clock costs no CPU time. A timeout is a timer of the caller calling
+ *       i2c_transfer_abort.
+ * @retval ERRNO_OK, ERRNO_ERROR on an invalid transaction
+ */
+int32_t i2c_transfer_async(i2c_t* i2cx, i2c_xfer_t* xfer)
+{
+    i2c_bus_t* bus   = i2c_get_bus(i2cx);
+    uint32_t primask = __get_PRIMASK();
+    uint8_t i;
+
+    if (bus == NULL || !bus->ready || xfer == NULL || xfer->segs == NULL || xfer->seg_num == 0) {
+        return ERRNO_ERROR;
+    }
+    for (i = 0; i < xfer->seg_num; i++) {
+        if ((xfer->segs[i].flags & I2C_SEG_READ) && xfer->segs[i].len == 0) {
+            return ERRNO_ERROR;
+        }
+    }
+    xfer->next = NULL;
+
+    __disable_irq();
+    if (bus->head == NULL) {
+        bus->head = xfer;
+        bus->tail = xfer;
+        i2c_xfer_start(i2cx, bus);
+    } else {
+        bus->tail->next = xfer;
+        bus->tail       = xfer;
+    }
+    __set_PRIMASK(primask);
+    return ERRNO_OK;
+}
+
+/**
+ * @brief Abort the running asynchronous transaction with a stop
+ * @param i2cx Select the I2C peripheral number(I2C0, I2C1 and I2C2)
+ * @note Its callback gets ERRNO_ERROR before the return, and the next queued
+ *       transaction starts
+ * @retval ERRNO_OK, ERRNO_ERROR when no transaction runs
+ */
+int32_t i2c_transfer_abort(i2c_t* i2cx)
+{
+    i2c_bus_t* bus   = i2c_get_bus(i2cx);
+    uint32_t primask = __get_PRIMASK();
+    int32_t ret      = ERRNO_ERROR;
+
+    if (bus == NULL) {
+        return ERRNO_ERROR;
+    }
+    __disable_irq();
+    if (bus->head != NULL) {
+        i2c_xfer_finish(i2cx, bus, ERRNO_ERROR);
+        ret = ERRNO_OK;
+    }
+    __set_PRIMASK(primask);
+    return ret;
+}
+
+/**
+ * @brief Check whether asynchronous transactions are running or queued
+ * @param i2cx Select the I2C peripheral number(I2C0, I2C1 and I2C2)
+ * @retval true while the bus has transactions
+ */
+bool i2c_transfer_busy(i2c_t* i2cx)
+{
+    i2c_bus_t* bus = i2c_get_bus(i2cx);
+
+    return bus != NULL && bus->head != NULL;
+}
+
+/**
+ * @brief I2C interrupt handler of the asynchronous transactions
+ * @param i2cx Select the I2C peripheral number(I2C0, I2C1 and I2C2)
+ * @retval None
+ */
+void i2c_irq_handler(i2c_t* i2cx)
+{
+    i2c_bus_t* bus = i2c_get_bus(i2cx);
+    i2c_xfer_t* xfer;
+    i2c_seg_t* seg;
+    uint32_t sr;
+
+    if (bus == NULL) {
+        return;
+    }
+    sr       = i2cx->SR;
+    i2cx->SR = sr & I2C_XFER_SR_MASK;
+    xfer     = bus->head;
+    if (xfer == NULL || bus->state == I2C_XFER_IDLE) {
+        i2cx->CR &= ~I2C_XFER_INTR_EN_MASK;
+        return;
+    }
+    seg = &xfer->segs[bus->seg];
+
+    if (sr & (I2C_SR_BUS_ERROR_MASK | I2C_SR_ARB_LOSS_DET_MASK)) {
+        i2c_xfer_finish(i2cx, bus, ERRNO_ERROR);
+    } else if (bus->state == I2C_XFER_STOP) {
+        if (sr & I2C_SR_MASTER_STOP_DET_MASK) {
+            i2c_xfer_finish(i2cx, bus, ERRNO_OK);
+        }
+    } else if ((sr & I2C_SR_IDBR_EMPTY_MASK) && (bus->state == I2C_XFER_ADDR || !(seg->flags & I2C_SEG_READ))) {
+        /* address or byte written, the slave did not acknowledge it */
+        if (sr & I2C_SR_ACK_STATUS_MASK) {
+            i2c_xfer_finish(i2cx, bus, ERRNO_ERROR);
+        } else {
+            i2c_xfer_step(i2cx, bus, xfer);
+        }
+    } else if ((sr & I2C_SR_DBR_FULL_MASK) && (seg->flags & I2C_SEG_READ)) {
+        seg->data[bus->idx++] = i2c_receive_data(i2cx);
+        i2c_xfer_step(i2cx, bus, xfer);
+    }
+}
@@ -0,0 +1,265 @@
+#include <string.h>
+#include "tremo_cm4.h"
+#include "tremo_i2s_stream.h"
+
+/* bits of the I2S word above the 16 bits kept, indexed by the word size */
+static const uint8_t i2s_stream_shift[] = { 0xFF, 0xFF, 0, 4, 8, 16 };
+
+static void i2s_stream_detect_block(i2s_stream_t* stream, const int16_t* samples, uint32_t count)
+{
+    uint32_t energy = i2s_stream_energy(samples, count);
+
+    stream->energy = energy;
+    if (!stream->active) {
+        if (energy >= stream->detect_level) {
+            stream->active = true;
+            stream->quiet  = 0;
+            stream->detect(stream, true, energy);
+        }
+    } else if (energy < stream->detect_level / 2) {
+        /* 3 dB of hysteresis, the event ends after detect_hold quiet halves */
+        if (++stream->quiet >= stream->detect_hold) {
+            stream->active = false;
+            stream->detect(stream, false, energy);
+        }
+    } else {
+        stream->quiet = 0;
+    }
+}
+
+static void i2s_stream_block_done(i2s_stream_t* stream)
+{
+    uint32_t count  = (stream->format == I2S_STREAM_STEREO) ? 2 * stream->frames : stream->frames;
+    uint8_t second  = (stream->index == 0);
+    int16_t* samples = stream->buffer + (second ? count : 0);
+    i2s_stream_callback_t callback = second ? stream->full : stream->half;
+
+    stream->blocks++;
+    if (stream->dir == I2S_STREAM_CAPTURE && stream->detect != NULL) {
+        i2s_stream_detect_block(stream, samples, count);
+    }
+    if (callback != NULL) {
+        callback(stream, samples, stream->frames);
+    }
+}
+
+static void i2s_stream_next_frame(i2s_stream_t* stream)
+{
+    if (++stream->index == 2 * stream->frames) {
+        stream->index = 0;
+        i2s_stream_block_done(stream);
+    } else if (stream->index == stream->frames) {
+        i2s_stream_block_done(stream);
+    }
+}
+
+static void i2s_stream_receive(i2s_stream_t* stream)
+{
+    i2s_t* I2Sx   = stream->i2s;
+    uint8_t shift = 16 - stream->shift;
+    uint32_t left, right;
+
+    while (stream->running && (I2Sx->ISR & I2S_INTERRUPT_RXDA)) {
+        /* a left read then a right read pop one frame */
+        left  = I2Sx->LRBR_LTHR << shift;
+        right = I2Sx->RRBR_RTHR << shift;
+        if (stream->format == I2S_STREAM_STEREO) {
+            /* the top half words of both channels in one store */
+            ((uint32_t*)stream->buffer)[stream->index] = __PKHTB(right, left, 16);
+        } else {
+            stream->buffer[stream->index] = (int16_t)(left >> 16);
+        }
+        i2s_stream_next_frame(stream);
+    }
+}
+
+static void i2s_stream_transmit(i2s_stream_t* stream)
+{
+    i2s_t* I2Sx = stream->i2s;
+    uint32_t frame;
+    int32_t left, right;
+    uint8_t n;
+
+    /* the FIFO holds at most I2S_STREAM_FIFO_LEVEL frames on the interrupt */
+    for (n = I2S_FIFO_DEPTH - I2S_STREAM_FIFO_LEVEL; n > 0 && stream->running; n--) {
+        if (stream->format == I2S_STREAM_STEREO) {
+            frame = ((const uint32_t*)stream->buffer)[stream->index];
+            left  = (int16_t)frame;
+            right = (int32_t)frame >> 16;
+        } else {
+            left  = stream->buffer[stream->index];
+            right = left;
+        }
+        I2Sx->LRBR_LTHR = (uint32_t)left << stream->shift;
+        I2Sx->RRBR_RTHR = (uint32_t)right << stream->shift;
+        i2s_stream_next_frame(stream);
+    }
+}
+
+/**
+ * @brief  Open an I2S stream
+ * @param  stream the stream
+ * @param  I2Sx the I2S, configured by i2s_init
+ * @param  dir capture or playback, a stream of each direction may share the I2S
+ * @param  format buffer format
+ * @return ERRNO_OK, ERRNO_ERROR on a word size other than 16, 20, 24 or 32 bits
+ * @note   The I2S clocks, the role and the pins are set by the application,
+ *         the I2S interrupt calls i2s_stream_irq_handler for each stream
+ */
+int32_t i2s_stream_init(i2s_stream_t* stream, i2s_t* I2Sx, i2s_stream_dir_t dir, i2s_stream_format_t format)
+{
+    uint32_t word_size;
+
+    memset(stream, 0, sizeof(i2s_stream_t));
+    word_size = (dir == I2S_STREAM_CAPTURE) ? (I2Sx->RCR & I2S_RX_WORDSIZE_MASK) : (I2Sx->TCR & I2S_TX_WORDSIZE_MASK);
+    if (word_size >= sizeof(i2s_stream_shift) || i2s_stream_shift[word_size] == 0xFF) {
+        return ERRNO_ERROR;
+    }
+    stream->i2s    = I2Sx;
+    stream->dir    = dir;
+    stream->format = format;
+    stream->shift  = i2s_stream_shift[word_size];
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Start the capture or the playback of a ping-pong buffer
+ * @param  stream the stream
+ * @param  buffer two halves of frames samples, word aligned, filled by the
+ *         application before a playback
+ * @param  frames frames in a half, even
+ * @return ERRNO_OK, ERRNO_ERROR on an invalid buffer or a running stream
+ * @note   The buffer loops until the stream stops. The half callback gets
+ *         the first half once it is complete, the full callback the second
+ *         one, while the I2S goes on with the other half. A playback
+ *         callback refills the half it gets
+ */
+int32_t i2s_stream_start(i2s_stream_t* stream, int16_t* buffer, uint16_t frames)
+{
+    i2s_t* I2Sx = stream->i2s;
+
+    if (stream->running || buffer == NULL || frames < 2 || (frames & 1) || ((uint32_t)buffer & 3)) {
+        return ERRNO_ERROR;
+    }
+    stream->buffer   = buffer;
+    stream->frames   = frames;
+    stream->index    = 0;
+    stream->blocks   = 0;
+    stream->overruns = 0;
+    stream->active   = false;
+    stream->quiet    = 0;
+    stream->energy   = 0;
+    stream->running  = true;
+
+    if (stream->dir == I2S_STREAM_CAPTURE) {
+        /* RXDA rises with I2S_STREAM_FIFO_LEVEL frames in the FIFO */
+        I2Sx->RFCR = I2S_STREAM_FIFO_LEVEL - 1;
+        I2Sx->RFF  = 1;
+        i2s_rx_channel_cmd(I2Sx, ENABLE);
+        i2s_rx_block_cmd(I2Sx, ENABLE);
+        i2s_config_interrupt(I2Sx, I2S_INTERRUPT_RXDA | I2S_INTERRUPT_RXFO, ENABLE);
+    } else {
+        /* TXFE rises with I2S_STREAM_FIFO_LEVEL frames or less in the FIFO */
+        I2Sx->TFCR = I2S_STREAM_FIFO_LEVEL;
+        I2Sx->TFF  = 1;
+        i2s_tx_channel_cmd(I2Sx, ENABLE);
+        i2s_tx_block_cmd(I2Sx, ENABLE);
+        i2s_config_interrupt(I2Sx, I2S_INTERRUPT_TXFE | I2S_INTERRUPT_TXFO, ENABLE);
+    }
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Stop a stream, may be called from its callbacks
+ * @param  stream the stream
+ * @return
+ */
+void i2s_stream_stop(i2s_stream_t* stream)
+{
+    i2s_t* I2Sx = stream->i2s;
+
+    if (stream->dir == I2S_STREAM_CAPTURE) {
+        i2s_config_interrupt(I2Sx, I2S_INTERRUPT_RXDA | I2S_INTERRUPT_RXFO, DISABLE);
+        i2s_rx_block_cmd(I2Sx, DISABLE);
+    } else {
+        i2s_config_interrupt(I2Sx, I2S_INTERRUPT_TXFE | I2S_INTERRUPT_TXFO, DISABLE);
+        i2s_tx_block_cmd(I2Sx, DISABLE);
+    }
+    stream->running = false;
+}
+
+/**
+ * @brief  Run an energy detector on each captured half
+ * @param  stream the stream
+ * @param  level mean square of the samples starting an event, in LSB^2
+ * @param  hold halves below level / 2 ending the event
+ * @param  detect the callback, NULL to remove the detector
+ * @return
+ * @note   The detector runs in the I2S interrupt before the half callback,
+ *         the application may sleep until an event and only then read
+ *         or uplink the samples
+ */
+void i2s_stream_set_detector(i2s_stream_t* stream, uint32_t level, uint8_t hold, i2s_stream_detect_t detect)
+{
+    stream->detect       = NULL;
+    stream->detect_level = level;
+    stream->detect_hold  = hold ? hold : 1;
+    stream->active       = false;
+    stream->quiet        = 0;
+    stream->detect       = detect;
+}
+
+/**
+ * @brief  Move the samples between the FIFO and the buffer
+ * @param  stream the stream
+ * @return
+ * @note   Called from I2S_IRQHandler, the callbacks run from here
+ */
+void i2s_stream_irq_handler(i2s_stream_t* stream)
+{
+    i2s_t* I2Sx = stream->i2s;
+
+    if (!stream->running) {
+        return;
+    }
+    if (stream->dir == I2S_STREAM_CAPTURE) {
+        if (I2Sx->ISR & I2S_INTERRUPT_RXFO) {
+            i2s_clear_interrupt(I2Sx, I2S_INTERRUPT_RXFO);
+            stream->overruns++;
+        }
+        i2s_stream_receive(stream);
+    } else {
+        if (I2Sx->ISR & I2S_INTERRUPT_TXFO) {
+            i2s_clear_interrupt(I2Sx, I2S_INTERRUPT_TXFO);
+            stream->overruns++;
+        }
+        if (I2Sx->ISR & I2S_INTERRUPT_TXFE) {
+            i2s_stream_transmit(stream);
+        }
+    }
+}
+
+/**
+ * @brief  Mean square of 16 bit samples
+ * @param  samples the samples, word aligned
+ * @param  count the number of samples
+ * @return the mean square, 0 to 2^30
+ */
+uint32_t i2s_stream_energy(const int16_t* samples, uint32_t count)
+{
+    const uint32_t* pairs = (const uint32_t*)samples;
+    uint64_t sum = 0;
+    uint32_t i;
+
+    if (count == 0) {
+        return 0;
+    }
+    for (i = 0; i < count / 2; i++) {
+        /* two squares a multiply-accumulate */
+        sum = __SMLALD(pairs[i], pairs[i], sum);
+    }
+    if (count & 1) {
+        sum += (int32_t)samples[count - 1] * samples[count - 1];
+    }
+    return (uint32_t)(sum / count);
+}
@@ -0,0 +1,252 @@
+#include <string.h>
+#include "tremo_cm4.h"
+#include "tremo_lcd_frame.h"
+
+/* segments wired to each COM register, the others are reserved */
+static const uint32_t lcd_frame_com_mask[LCD_FRAME_COM_NUM] = {
+    LCD_COM0_SEG_MASK, LCD_COM1_SEG_MASK, LCD_COM2_SEG_MASK, LCD_COM3_SEG_MASK
+};
+
+/* seven segment glyphs of '0' to '9' then 'A' to 'F' */
+static const uint8_t lcd_frame_hex_glyph[16] = {
+    0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07,
+    0x7F, 0x6F, 0x77, 0x7C, 0x39, 0x5E, 0x79, 0x71
+};
+
+static void lcd_frame_write(lcd_frame_t* frame, uint8_t com)
+{
+    /* one store for all the segments of the COM */
+    while (lcd_check_sync_done() != true);
+    (&LCD->DR0)[com]    = frame->staged[com];
+    frame->written[com] = frame->staged[com];
+    frame->writes++;
+}
+
+/**
+ * @brief  Open the frame buffer of the LCD
+ * @param  frame the frame buffer
+ * @param  coms COMs used, as given to lcd_enable_com
+ * @param  sync true to write the commits at the next even frame interrupt,
+ *         the LCD interrupt calls lcd_frame_irq_handler then
+ * @return
+ * @note   The buffer starts from the segments shown, the LCD being set up by
+ *         lcd_init and the lcd_enable_* functions
+ */
+void lcd_frame_init(lcd_frame_t* frame, lcd_com_use_t coms, bool sync)
+{
+    uint8_t com;
+
+    memset(frame, 0, sizeof(lcd_frame_t));
+    frame->coms = (uint8_t)coms;
+    frame->sync = sync;
+    for (com = 0; com < frame->coms; com++) {
+        frame->written[com] = (&LCD->DR0)[com] & lcd_frame_com_mask[com];
+        frame->staged[com]  = frame->written[com];
+        frame->com[com]     = frame->written[com];
+    }
+    if (sync) {
+        lcd_clear_interrupt_status();
+        NVIC_EnableIRQ(LCD_IRQn);
+    }
+}
+
+/**
+ * @brief  Turn all the segments off
+ * @param  frame the frame buffer
+ * @return
+ */
+void lcd_frame_clear(lcd_frame_t* frame)
+{
+    memset(frame->com, 0, sizeof(frame->com));
+}
+
+/**
+ * @brief  Turn a segment on or off
+ * @param  frame the frame buffer
+ * @param  com COM number
+ * @param  seg segment bit of the COM
+ * @param  on the segment state
+ * @return
+ */
+void lcd_frame_set(lcd_frame_t* frame, uint8_t com, uint8_t seg, bool on)
+{
+    uint32_t mask;
+
+    if (com >= frame->coms) {
+        return;
+    }
+    mask = (1UL << seg) & lcd_frame_com_mask[com];
+    if (on) {
+        frame->com[com] |= mask;
+    } else {
+        frame->com[com] &= ~mask;
+    }
+}
+
+/**
+ * @brief  Draw the segments of a digit
+ * @param  frame the frame buffer
+ * @param  digit the digit wiring
+ * @param  glyph segments on, bit 0 to 7 for a to g and the point
+ * @return
+ */
+void lcd_frame_glyph(lcd_frame_t* frame, const lcd_frame_digit_t* digit, uint8_t glyph)
+{
+    uint8_t i;
+
+    for (i = 0; i < 8; i++) {
+        if (digit->seg[i].com != LCD_FRAME_NO_SEG) {
+            lcd_frame_set(frame, digit->seg[i].com, digit->seg[i].seg, (glyph >> i) & 1);
+        }
+    }
+}
+
+/**
+ * @brief  Draw a character on a digit
+ * @param  frame the frame buffer
+ * @param  digit the digit wiring
+ * @param  c a hexadecimal digit, '-' or ' '
+ * @return ERRNO_OK, ERRNO_ERROR on another character, drawn blank
+ */
+int32_t lcd_frame_char(lcd_frame_t* frame, const lcd_frame_digit_t* digit, char c)
+{
+    uint8_t glyph = LCD_FRAME_GLYPH_BLANK;
+    int32_t ret   = ERRNO_OK;
+
+    if (c >= '0' && c <= '9') {
+        glyph = lcd_frame_hex_glyph[c - '0'];
+    } else if (c >= 'A' && c <= 'F') {
+        glyph = lcd_frame_hex_glyph[c - 'A' + 10];
+    } else if (c >= 'a' && c <= 'f') {
+        glyph = lcd_frame_hex_glyph[c - 'a' + 10];
+    } else if (c == '-') {
+        glyph = LCD_FRAME_GLYPH_MINUS;
+    } else if (c != ' ') {
+        ret = ERRNO_ERROR;
+    }
+    lcd_frame_glyph(frame, digit, glyph);
+    return ret;
+}
+
+/**
+ * @brief  Draw a decimal number right aligned on a row of digits
+ * @param  frame the frame buffer
+ * @param  digits the digit wirings, the leftmost first
+ * @param  count the number of digits
+ * @param  value the number, in units of 10^-decimals
+ * @param  decimals digits after the point, 0 for no point
+ * @return ERRNO_OK, ERRNO_ERROR on a number too long, drawn as dashes
+ */
+int32_t lcd_frame_number(lcd_frame_t* frame, const lcd_frame_digit_t* digits, uint8_t count, int32_t value, uint8_t decimals)
+{
+    uint32_t magnitude = (value < 0) ? 0 - (uint32_t)value : (uint32_t)value;
+    uint32_t rest      = magnitude;
+    uint8_t len        = 0;
+    uint8_t glyph;
+    int i;
+
+    /* digits needed, the zeros up to the point included */
+    do {
+        rest /= 10;
+        len++;
+    } while (rest != 0 || len <= decimals);
+    if (value < 0) {
+        len++;
+    }
+    if (count == 0 || len > count) {
+        for (i = 0; i < count; i++) {
+            lcd_frame_glyph(frame, &digits[i], LCD_FRAME_GLYPH_MINUS);
+        }
+        return ERRNO_ERROR;
+    }
+
+    for (i = count - 1; i >= 0; i--) {
+        if (i >= count - len + (value < 0)) {
+            glyph     = lcd_frame_hex_glyph[magnitude % 10];
+            magnitude /= 10;
+        } else if (i == count - len) {
+            glyph = LCD_FRAME_GLYPH_MINUS;
+        } else {
+            glyph = LCD_FRAME_GLYPH_BLANK;
+        }
+        if (decimals != 0 && i == count - 1 - decimals) {
+            glyph |= LCD_FRAME_GLYPH_POINT;
+        }
+        lcd_frame_glyph(frame, &digits[i], glyph);
+    }
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Show the segments drawn
+ * @param  frame the frame buffer
+ * @return the number of COM registers to write, 0 when nothing changed
+ * @note   Only the changed COMs are written, each in a single store. A sync
+ *         frame buffer writes them at the next frame interrupt, so that a
+ *         frame never shows half an update. Drawing may go on at once
+ */
+uint8_t lcd_frame_commit(lcd_frame_t* frame)
+{
+    uint8_t dirty = 0;
+    uint8_t count = 0;
+    uint8_t com;
+
+    if (frame->sync) {
+        NVIC_DisableIRQ(LCD_IRQn);
+    }
+    for (com = 0; com < frame->coms; com++) {
+        frame->staged[com] = frame->com[com];
+        if (frame->staged[com] != frame->written[com]) {
+            dirty |= 1 << com;
+            count++;
+        }
+    }
+    if (frame->sync) {
+        frame->pending = dirty;
+        if (dirty) {
+            lcd_config_interrupt(true);
+        }
+        NVIC_EnableIRQ(LCD_IRQn);
+    } else {
+        for (com = 0; com < frame->coms; com++) {
+            if (dirty & (1 << com)) {
+                lcd_frame_write(frame, com);
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief  Tell if a sync commit waits for the frame interrupt
+ * @param  frame the frame buffer
+ * @return true until the COMs are written
+ */
+bool lcd_frame_busy(lcd_frame_t* frame)
+{
+    return frame->pending != 0;
+}
+
+/**
+ * @brief  Write the committed COMs at the even frame interrupt
+ * @param  frame the frame buffer
+ * @return
+ * @note   Called from LCD_IRQHandler
+ */
+void lcd_frame_irq_handler(lcd_frame_t* frame)
+{
+    uint8_t com;
+
+    if (!lcd_get_interrupt_status()) {
+        return;
+    }
+    lcd_clear_interrupt_status();
+    for (com = 0; com < frame->coms; com++) {
+        if (frame->pending & (1 << com)) {
+            lcd_frame_write(frame, com);
+        }
+    }
+    frame->pending = 0;
+    /* no interrupt on the frames without an update */
+    lcd_config_interrupt(false);
+}
@@ -9,7 +9,7 @@
  * @param  lpuart LPUART handler
  * @return received data
  */
-uint8_t lpuart_receive_data(lpuart_t* lpuart)
+RAM_FUNC_ATTR uint8_t lpuart_receive_data(lpuart_t* lpuart)
 {
     uint8_t data = 0;
 
@@ -120,7 +120,7 @@ void lpuart_config_tx(lpuart_t* lpuart, bool new_state)
  * @retval true set status
  * @retval false reset status
  */
-bool lpuart_get_rx_status(lpuart_t* lpuart, lpuart_rx_status_t rx_status)
+RAM_FUNC_ATTR bool lpuart_get_rx_status(lpuart_t* lpuart, lpuart_rx_status_t rx_status)
 {
     while (((lpuart->SR1) & LPUART_SR1_WRITE_SR0_STATE) != LPUART_SR1_WRITE_SR0_STATE)
         ;
@@ -137,7 +137,7 @@ bool lpuart_get_rx_status(lpuart_t* lpuart, lpuart_rx_status_t rx_status)
  * @param  rx_status rx status
  * @return 
  */
-void lpuart_clear_rx_status(lpuart_t* lpuart, lpuart_rx_status_t rx_status)
+RAM_FUNC_ATTR void lpuart_clear_rx_status(lpuart_t* lpuart, lpuart_rx_status_t rx_status)
 {
     while (((lpuart->SR1) & (LPUART_SR1_WRITE_SR0_STATE | LPUART_SR1_WRITE_CR0_STATE))
         != (LPUART_SR1_WRITE_SR0_STATE | LPUART_SR1_WRITE_CR0_STATE))
@@ -154,7 +154,7 @@ void lpuart_clear_rx_status(lpuart_t* lpuart, lpuart_rx_status_t rx_status)
  * @retval true set status
  * @retval false reset status
  */
-bool lpuart_get_rx_not_empty_status(lpuart_t* lpuart)
+RAM_FUNC_ATTR bool lpuart_get_rx_not_empty_status(lpuart_t* lpuart)
 {
     if (lpuart->SR1 & LPUART_SR1_RX_NOT_EMPTY_STATE) {
         return true;
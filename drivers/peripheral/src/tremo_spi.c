@@ -1,6 +1,31 @@
 #include "tremo_rcc.h"
+#include "tremo_gpio.h"
+#include "tremo_dma_handshake.h"
+#include "tremo_dma_job.h"
 #include "tremo_spi.h"
 
+#define SSP_BUS_NUM       (3)
+#define SSP_DMA_BLOCK_MAX (4095)
+
+/**
+ * @brief Asynchronous transfer state of a bus
+ */
+typedef struct {
+    ssp_xfer_t* head;     /*!< transfer running*/
+    ssp_xfer_t* tail;     /*!< last transfer queued*/
+    uint16_t tx_idx;      /*!< frames written to the fifo*/
+    uint16_t rx_idx;      /*!< frames read from the fifo*/
+    bool ready;           /*!< ssp_async_init done*/
+    bool use_dma;         /*!< DMA channels acquired*/
+    bool dma_running;     /*!< the running transfer is on DMA*/
+    dma_chan_t tx_chan;   /*!< TX DMA channel*/
+    dma_chan_t rx_chan;   /*!< RX DMA channel*/
+    dma_job_t tx_job;     /*!< TX DMA job*/
+    dma_job_t rx_job;     /*!< RX DMA job*/
+} ssp_bus_t;
+
+static ssp_bus_t ssp_bus[SSP_BUS_NUM];
+
 /**
  * @brief  SSP initialize
  * @param  init_struct initialization configuration
@@ -137,31 +162,62 @@ void ssp_deinit(ssp_typedef_t* SSPx)
     }
 }
 
+static bool ssp_frame_wide(ssp_typedef_t* SSPx)
+{
+    return (SSPx->CR0 & 0xF) > SSP_DATA_SIZE_8BIT;
+}
+
+static uint16_t ssp_load_frame(const void* data, uint16_t index, bool wide)
+{
+    if (data == NULL) {
+        return SSP_DUMMY_FRAME;
+    }
+    return wide ? ((const uint16_t*)data)[index] : ((const uint8_t*)data)[index];
+}
+
+static void ssp_store_frame(void* data, uint16_t index, bool wide, uint16_t frame)
+{
+    if (data == NULL) {
+        return;
+    } else if (wide) {
+        ((uint16_t*)data)[index] = frame;
+    } else {
+        ((uint8_t*)data)[index] = (uint8_t)frame;
+    }
+}
+
+/* returns ERRNO_ERROR when the flag is still clear after CONFIG_SSP_POLL_TIMEOUT polls */
+static int32_t ssp_wait_flag(ssp_typedef_t* SSPx, uint8_t ssp_flag)
+{
+    uint32_t timeout = CONFIG_SSP_POLL_TIMEOUT;
+
+    while (!(ssp_get_flag_status(SSPx, ssp_flag))) {
+        if (--timeout == 0) {
+            return ERRNO_ERROR;
+        }
+    }
+    return ERRNO_OK;
+}
+
 /**
  * @brief  SSP send data
  * @param  SSPx SSP handler
  * @param  tx_data data need to send
  * @param  len data data length
- * @return
+ * @return ERRNO_OK, ERRNO_ERROR when the TX fifo stays full
  */
-void ssp_send_data(ssp_typedef_t* SSPx, uint8_t* tx_data, uint16_t len)
+int32_t ssp_send_data(ssp_typedef_t* SSPx, uint8_t* tx_data, uint16_t len)
 {
-    uint8_t data_size;
+    bool wide = ssp_frame_wide(SSPx);
+    uint16_t i;
 
-    data_size = (uint8_t)(SSPx->CR0 & 0xF);
-
-    while (len--) {
-        while (!(ssp_get_flag_status(SSPx, SSP_FLAG_TX_FIFO_NOT_FULL)))
-            ; /* wait till tx fifo is not full, change to timeout mechanism */
-
-        if (data_size > SSP_DATA_SIZE_8BIT) {
-            SSPx->DR = *((uint16_t *) tx_data);
-            tx_data = (uint8_t *)((uint16_t *)tx_data + 1);
-        } else {
-            SSPx->DR = *((uint8_t *) tx_data);
-            tx_data = (uint8_t *)tx_data + 1;
+    for (i = 0; i < len; i++) {
+        if (ssp_wait_flag(SSPx, SSP_FLAG_TX_FIFO_NOT_FULL) != ERRNO_OK) {
+            return ERRNO_ERROR;
         }
+        SSPx->DR = ssp_load_frame(tx_data, i, wide);
     }
+    return ERRNO_OK;
 }
 
 /**
@@ -169,24 +225,385 @@ void ssp_send_data(ssp_typedef_t* SSPx, uint8_t* tx_data, uint16_t len)
  * @param  SSPx SSP handler
  * @param  rx_data received data
  * @param  len data data length
- * @return
+ * @return ERRNO_OK, ERRNO_ERROR when the RX fifo stays empty
  */
-void ssp_receive_data(ssp_typedef_t* SSPx, uint8_t* rx_data, uint16_t len)
+int32_t ssp_receive_data(ssp_typedef_t* SSPx, uint8_t* rx_data, uint16_t len)
 {
-    uint8_t data_size;
+    bool wide = ssp_frame_wide(SSPx);
+    uint16_t i;
 
-    data_size = (uint8_t)(SSPx->CR0 & 0xF);
+    for (i = 0; i < len; i++) {
+        if (ssp_wait_flag(SSPx, SSP_FLAG_RX_FIFO_NOT_EMPTY) != ERRNO_OK) {
+            return ERRNO_ERROR;
+        }
+        ssp_store_frame(rx_data, i, wide, SSPx->DR);
+    }
+    return ERRNO_OK;
+}
 
-    while (len--) {
-        while (!(ssp_get_flag_status(SSPx, SSP_FLAG_RX_FIFO_NOT_EMPTY)))
-            ; /* wait till rx fifo is not empty, change to timeout mechanism */
+/**
+ * @brief  SSP full duplex transfer
+ * @param  SSPx SSP handler
+ * @param  tx_data data to send, NULL sends SSP_DUMMY_FRAME
+ * @param  rx_data data received, NULL drops it
+ * @param  len number of frames
+ * @return ERRNO_OK, ERRNO_ERROR when no frame moves for CONFIG_SSP_POLL_TIMEOUT polls
+ * @note   At most SSP_FIFO_DEPTH frames are in flight, the RX fifo never overruns
+ */
+int32_t ssp_transfer(ssp_typedef_t* SSPx, const uint8_t* tx_data, uint8_t* rx_data, uint16_t len)
+{
+    bool wide = ssp_frame_wide(SSPx);
+    uint16_t tx_idx = 0, rx_idx = 0;
+    uint32_t timeout = CONFIG_SSP_POLL_TIMEOUT;
 
-        if (data_size > SSP_DATA_SIZE_8BIT) {
-            *((uint16_t *) rx_data) = SSPx->DR;
-            rx_data = (uint8_t *)((uint16_t *)rx_data + 1);
-        } else {
-            *((uint8_t *) rx_data) = SSPx->DR;
-            rx_data = (uint8_t *)rx_data + 1;
+    while (rx_idx < len) {
+        if (ssp_get_flag_status(SSPx, SSP_FLAG_RX_FIFO_NOT_EMPTY)) {
+            ssp_store_frame(rx_data, rx_idx++, wide, SSPx->DR);
+            timeout = CONFIG_SSP_POLL_TIMEOUT;
+        } else if (tx_idx < len && tx_idx - rx_idx < SSP_FIFO_DEPTH
+                   && ssp_get_flag_status(SSPx, SSP_FLAG_TX_FIFO_NOT_FULL)) {
+            SSPx->DR = ssp_load_frame(tx_data, tx_idx++, wide);
+            timeout  = CONFIG_SSP_POLL_TIMEOUT;
+        } else if (--timeout == 0) {
+            return ERRNO_ERROR;
         }
     }
+    return ERRNO_OK;
+}
+
+static ssp_bus_t* ssp_get_bus(ssp_typedef_t* SSPx)
+{
+    if (SSPx == SSP0) {
+        return &ssp_bus[0];
+    } else if (SSPx == SSP1) {
+        return &ssp_bus[1];
+    } else if (SSPx == SSP2) {
+        return &ssp_bus[2];
+    }
+    return NULL;
+}
+
+static IRQn_Type ssp_get_irqn(ssp_typedef_t* SSPx)
+{
+    if (SSPx == SSP0) {
+        return SSP0_IRQn;
+    } else if (SSPx == SSP1) {
+        return SSP1_IRQn;
+    }
+    return SSP2_IRQn;
+}
+
+/* waits for the frames still shifted out, then empties the RX fifo */
+static void ssp_flush(ssp_typedef_t* SSPx)
+{
+    uint32_t timeout = CONFIG_SSP_POLL_TIMEOUT;
+
+    while (ssp_get_flag_status(SSPx, SSP_FLAG_BUSY) && --timeout) {
+        ;
+    }
+    while (ssp_get_flag_status(SSPx, SSP_FLAG_RX_FIFO_NOT_EMPTY)) {
+        (void)SSPx->DR;
+    }
+}
+
+/* keeps at most SSP_FIFO_DEPTH frames in flight */
+static void ssp_fifo_fill(ssp_typedef_t* SSPx, ssp_bus_t* bus, ssp_xfer_t* xfer)
+{
+    bool wide = ssp_frame_wide(SSPx);
+
+    while (bus->tx_idx < xfer->len && bus->tx_idx - bus->rx_idx < SSP_FIFO_DEPTH
+           && ssp_get_flag_status(SSPx, SSP_FLAG_TX_FIFO_NOT_FULL)) {
+        SSPx->DR = ssp_load_frame(xfer->tx_data, bus->tx_idx++, wide);
+    }
+}
+
+static void ssp_dma_start(dma_job_t* job)
+{
+    ((ssp_typedef_t*)job->arg)->DMA_CR = SSP_DMA_TX_EN | SSP_DMA_RX_EN;
+}
+
+static void ssp_xfer_finish(ssp_typedef_t* SSPx, ssp_bus_t* bus, int32_t status);
+
+static void ssp_dma_done(dma_job_t* job, bool success)
+{
+    ssp_typedef_t* SSPx = (ssp_typedef_t*)job->arg;
+    ssp_bus_t* bus      = ssp_get_bus(SSPx);
+
+    if (!bus->dma_running) {
+        return;
+    }
+    if (!success) {
+        ssp_xfer_finish(SSPx, bus, ERRNO_ERROR);
+    } else if (job == &bus->rx_job) {
+        ssp_xfer_finish(SSPx, bus, ERRNO_OK);
+    }
+}
+
+static void ssp_dma_job_init(dma_job_t* job, ssp_typedef_t* SSPx, uint8_t data_width, uint16_t len)
+{
+    job->dev.data_width = data_width;
+    job->dev.src_msize  = 0;
+    job->dev.dest_msize = 0;
+    job->dev.block_size = len;
+    job->blocks         = NULL;
+    job->lli            = NULL;
+    job->block_num      = 0;
+    job->flags          = 0;
+    job->done           = ssp_dma_done;
+    job->arg            = SSPx;
+}
+
+/* called with the interrupts disabled, starts the transfer at the head of the queue */
+static void ssp_xfer_start(ssp_typedef_t* SSPx, ssp_bus_t* bus)
+{
+    ssp_xfer_t* xfer = bus->head;
+    uint8_t index    = bus - ssp_bus;
+    bool wide;
+
+    if (xfer->data_size != 0 && (SSPx->CR0 & 0xF) != xfer->data_size) {
+        uint32_t cr1 = SSPx->CR1;
+
+        ssp_cmd(SSPx, DISABLE);
+        SSPx->CR0 = (SSPx->CR0 & ~0xF) | xfer->data_size;
+        SSPx->CR1 = cr1;
+    }
+    wide = ssp_frame_wide(SSPx);
+
+    /* frames left by an aborted transfer */
+    while (ssp_get_flag_status(SSPx, SSP_FLAG_RX_FIFO_NOT_EMPTY)) {
+        (void)SSPx->DR;
+    }
+    ssp_clear_interrupt(SSPx, SSP_INTERRUPT_ALL);
+    if (xfer->cs_gpio != NULL) {
+        gpio_write(xfer->cs_gpio, xfer->cs_pin, GPIO_LEVEL_LOW);
+    }
+    bus->tx_idx = 0;
+    bus->rx_idx = 0;
+
+    /* DMA for the long ones with both buffers, the channels only step through memory */
+    if (bus->use_dma && xfer->tx_data != NULL && xfer->rx_data != NULL && xfer->len >= SSP_FIFO_DEPTH
+        && xfer->len <= SSP_DMA_BLOCK_MAX) {
+        ssp_dma_job_init(&bus->rx_job, SSPx, wide ? 1 : 0, xfer->len);
+        bus->rx_job.dev.mode      = P2M_MODE;
+        bus->rx_job.dev.src       = (uint32_t)&SSPx->DR;
+        bus->rx_job.dev.dest      = (uint32_t)xfer->rx_data;
+        bus->rx_job.dev.handshake = DMA_HANDSHAKE_SSP_0_RX - 2 * index;
+        bus->rx_job.start         = NULL;
+
+        ssp_dma_job_init(&bus->tx_job, SSPx, wide ? 1 : 0, xfer->len);
+        bus->tx_job.dev.mode      = M2P_MODE;
+        bus->tx_job.dev.src       = (uint32_t)xfer->tx_data;
+        bus->tx_job.dev.dest      = (uint32_t)&SSPx->DR;
+        bus->tx_job.dev.handshake = DMA_HANDSHAKE_SSP_0_TX - 2 * index;
+        bus->tx_job.start         = ssp_dma_start;
+
+        bus->dma_running = true;
+        ssp_config_interrupt(SSPx, SSP_INTERRUPT_RX_FIFO_OVERRUN, ENABLE);
+        dma_job_submit(bus->rx_chan, &bus->rx_job);
+        dma_job_submit(bus->tx_chan, &bus->tx_job);
+        return;
+    }
+
+    ssp_fifo_fill(SSPx, bus, xfer);
+    ssp_config_interrupt(
+        SSPx, SSP_INTERRUPT_RX_FIFO_TRIGGER | SSP_INTERRUPT_RX_TIMEOUT | SSP_INTERRUPT_RX_FIFO_OVERRUN, ENABLE);
+}
+
+/* called with the interrupts disabled or from the interrupts of the bus */
+static void ssp_xfer_finish(ssp_typedef_t* SSPx, ssp_bus_t* bus, int32_t status)
+{
+    ssp_xfer_t* xfer = bus->head;
+
+    ssp_config_interrupt(SSPx, SSP_INTERRUPT_ALL, DISABLE);
+    ssp_clear_interrupt(SSPx, SSP_INTERRUPT_ALL);
+    if (bus->dma_running) {
+        SSPx->DMA_CR = 0;
+        dma_job_abort(bus->tx_chan);
+        dma_job_abort(bus->rx_chan);
+        bus->dma_running = false;
+    }
+    if (status != ERRNO_OK) {
+        ssp_flush(SSPx);
+    }
+    if (xfer->cs_gpio != NULL) {
+        gpio_write(xfer->cs_gpio, xfer->cs_pin, GPIO_LEVEL_HIGH);
+    }
+
+    /* the next transfer runs while the callback of this one is called */
+    bus->head = xfer->next;
+    if (bus->head != NULL) {
+        ssp_xfer_start(SSPx, bus);
+    } else {
+        bus->tail = NULL;
+    }
+    xfer->next = NULL;
+    if (xfer->done) {
+        xfer->done(xfer, status);
+    }
+}
+
+/**
+ * @brief  Prepare a bus for the asynchronous transfers
+ * @param  SSPx SSP handler, initialized by ssp_init and enabled
+ * @param  use_dma acquire two DMA channels for the transfers with both buffers
+ * @return ERRNO_OK, ERRNO_ERROR on a busy bus or when no DMA channel is free
+ * @note   The SSPx_IRQHandler of the application calls ssp_irq_handler, and the
+ *         DMA clocks are enabled by the application when use_dma is set
+ */
+int32_t ssp_async_init(ssp_typedef_t* SSPx, bool use_dma)
+{
+    ssp_bus_t* bus = ssp_get_bus(SSPx);
+
+    if (bus == NULL || ssp_async_deinit(SSPx) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+    if (use_dma) {
+        if (dma_chan_acquire(&bus->tx_chan) != ERRNO_OK) {
+            return ERRNO_ERROR;
+        }
+        if (dma_chan_acquire(&bus->rx_chan) != ERRNO_OK) {
+            dma_chan_release(bus->tx_chan);
+            return ERRNO_ERROR;
+        }
+        bus->use_dma = true;
+    }
+
+    ssp_config_interrupt(SSPx, SSP_INTERRUPT_ALL, DISABLE);
+    ssp_clear_interrupt(SSPx, SSP_INTERRUPT_ALL);
+    NVIC_EnableIRQ(ssp_get_irqn(SSPx));
+    bus->ready = true;
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Stop the asynchronous transfers of a bus
+ * @param  SSPx SSP handler
+ * @return ERRNO_OK, ERRNO_ERROR while transfers are queued
+ */
+int32_t ssp_async_deinit(ssp_typedef_t* SSPx)
+{
+    ssp_bus_t* bus = ssp_get_bus(SSPx);
+
+    if (bus == NULL || bus->head != NULL) {
+        return ERRNO_ERROR;
+    }
+    if (bus->ready) {
+        NVIC_DisableIRQ(ssp_get_irqn(SSPx));
+    }
+    if (bus->use_dma) {
+        dma_chan_release(bus->tx_chan);
+        dma_chan_release(bus->rx_chan);
+        bus->use_dma = false;
+    }
+    bus->ready = false;
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Submit an asynchronous full duplex transfer
+ * @param  SSPx SSP handler, prepared by ssp_async_init
+ * @param  xfer the transfer, started at once on an idle bus, queued otherwise
+ * @return ERRNO_OK, ERRNO_ERROR on an invalid transfer
+ * @note   The transfers run over the DMA when the bus has channels and both
+ *         buffers are given, on the fifo interrupts otherwise. A timeout is
+ *         a timer of the caller calling ssp_transfer_abort.
+ */
+int32_t ssp_transfer_async(ssp_typedef_t* SSPx, ssp_xfer_t* xfer)
+{
+    ssp_bus_t* bus   = ssp_get_bus(SSPx);
+    uint32_t primask = __get_PRIMASK();
+
+    if (bus == NULL || !bus->ready || xfer == NULL || xfer->len == 0) {
+        return ERRNO_ERROR;
+    }
+    xfer->next = NULL;
+
+    __disable_irq();
+    if (bus->head == NULL) {
+        bus->head = xfer;
+        bus->tail = xfer;
+        ssp_xfer_start(SSPx, bus);
+    } else {
+        bus->tail->next = xfer;
+        bus->tail       = xfer;
+    }
+    __set_PRIMASK(primask);
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Abort the running asynchronous transfer
+ * @param  SSPx SSP handler
+ * @return ERRNO_OK, ERRNO_ERROR when no transfer runs
+ * @note   Its callback gets ERRNO_ERROR before the return, and the next
+ *         queued transfer starts
+ */
+int32_t ssp_transfer_abort(ssp_typedef_t* SSPx)
+{
+    ssp_bus_t* bus   = ssp_get_bus(SSPx);
+    uint32_t primask = __get_PRIMASK();
+    int32_t ret      = ERRNO_ERROR;
+
+    if (bus == NULL) {
+        return ERRNO_ERROR;
+    }
+    __disable_irq();
+    if (bus->head != NULL) {
+        ssp_xfer_finish(SSPx, bus, ERRNO_ERROR);
+        ret = ERRNO_OK;
+    }
+    __set_PRIMASK(primask);
+    return ret;
+}
+
+/**
+ * @brief  Check whether asynchronous transfers are running or queued
+ * @param  SSPx SSP handler
+ * @return true while the bus has transfers
+ */
+bool ssp_transfer_busy(ssp_typedef_t* SSPx)
+{
+    ssp_bus_t* bus = ssp_get_bus(SSPx);
+
+    return bus != NULL && bus->head != NULL;
+}
+
+/**
+ * @brief  SSP interrupt handler of the asynchronous transfers
+ * @param  SSPx SSP handler
+ * @return
+ */
+void ssp_irq_handler(ssp_typedef_t* SSPx)
+{
+    ssp_bus_t* bus = ssp_get_bus(SSPx);
+    ssp_xfer_t* xfer;
+    bool wide;
+
+    if (bus == NULL) {
+        return;
+    }
+    xfer = bus->head;
+    if (xfer == NULL) {
+        ssp_config_interrupt(SSPx, SSP_INTERRUPT_ALL, DISABLE);
+        ssp_clear_interrupt(SSPx, SSP_INTERRUPT_ALL);
+        return;
+    }
+    if (ssp_get_interrupt_status(SSPx, SSP_INTERRUPT_RX_FIFO_OVERRUN)) {
+        ssp_xfer_finish(SSPx, bus, ERRNO_ERROR);
+        return;
+    }
+    if (bus->dma_running) {
+        return;
+    }
+
+    ssp_clear_interrupt(SSPx, SSP_INTERRUPT_RX_TIMEOUT);
+    wide = ssp_frame_wide(SSPx);
+    while (bus->rx_idx < xfer->len && ssp_get_flag_status(SSPx, SSP_FLAG_RX_FIFO_NOT_EMPTY)) {
+        ssp_store_frame(xfer->rx_data, bus->rx_idx++, wide, SSPx->DR);
+    }
+    if (bus->rx_idx >= xfer->len) {
+        ssp_xfer_finish(SSPx, bus, ERRNO_OK);
+    } else {
+        ssp_fifo_fill(SSPx, bus, xfer);
+    }
 }
@@ -0,0 +1,442 @@
+#include <string.h>
+#include "tremo_cm4.h"
+#include "tremo_dma_handshake.h"
+#include "tremo_timer_seq.h"
+
+/* DMA requests of a timer, they run CHn ... CH0, TRG, UP in the handshake table */
+static dma_hand_shake_t timer_seq_ch0_handshake(timer_gp_t* TIMERx)
+{
+    if (TIMERx == TIMER0) {
+        return DMA_HANDSHAKE_TIMER_0_CH0;
+    } else if (TIMERx == TIMER1) {
+        return DMA_HANDSHAKE_TIMER_1_CH0;
+    } else if (TIMERx == TIMER2) {
+        return DMA_HANDSHAKE_TIMER_2_CH0;
+    }
+    return DMA_HANDSHAKE_TIMER_3_CH0;
+}
+
+static dma_hand_shake_t timer_seq_cc_handshake(timer_seq_t* seq)
+{
+    return (dma_hand_shake_t)(timer_seq_ch0_handshake(seq->timer) - seq->channel);
+}
+
+static dma_hand_shake_t timer_seq_up_handshake(timer_seq_t* seq)
+{
+    return (dma_hand_shake_t)(timer_seq_ch0_handshake(seq->timer) + 2);
+}
+
+static volatile uint32_t* timer_seq_ccr(timer_seq_t* seq)
+{
+    return &seq->timer->CCR0 + seq->channel;
+}
+
+/* stops the requests of the mode, the DMA job being aborted or done */
+static void timer_seq_halt(timer_seq_t* seq)
+{
+    if (seq->mode == TIMER_SEQ_CAPTURE) {
+        timer_config_dma(seq->timer, (timer_dma_t)(TIMER_DIER_CC0DE << seq->channel), DISABLE);
+        timer_config_interrupt(seq->timer, TIMER_DIER_UIE, DISABLE);
+    } else if (seq->mode == TIMER_SEQ_PWM) {
+        timer_config_dma(seq->timer, TIMER_DIER_UDE, DISABLE);
+    } else if (seq->mode == TIMER_SEQ_ENCODER) {
+        bstimer_config_dma(seq->clock, false);
+        bstimer_cmd(seq->clock, false);
+    }
+    seq->mode = TIMER_SEQ_IDLE;
+}
+
+static void timer_seq_block_done(dma_job_t* job, bool success)
+{
+    timer_seq_t* seq = (timer_seq_t*)job->arg;
+
+    if (!success || !(job->flags & DMA_JOB_CIRCULAR)) {
+        /* a DMA error, or the end of a table played once */
+        timer_seq_halt(seq);
+        if (seq->done) {
+            seq->done(seq, success);
+        }
+        return;
+    }
+    seq->blocks++;
+}
+
+/* entries written to the ring since the start, the interrupts disabled */
+static uint32_t timer_seq_written(timer_seq_t* seq)
+{
+    uint16_t half   = seq->size / 2;
+    uint32_t blocks = seq->blocks;
+    uint32_t low    = (blocks & 1) * half;
+    uint32_t pos    = (dma_chan_get_dest(seq->chan) - (uint32_t)seq->ring) / sizeof(uint16_t);
+
+    /* out of the half: it is done, its block interrupt pending */
+    if (pos < low || pos > low + half) {
+        pos = low + half;
+    }
+    return blocks * half + pos - low;
+}
+
+/* entries written and not read yet, the oldest ones dropped on an overrun */
+static uint32_t timer_seq_pending(timer_seq_t* seq)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint32_t written, slot;
+    uint8_t wraps;
+
+    __disable_irq();
+    written = timer_seq_written(seq);
+    /* the DMA writes the entry of the slot of written next */
+    if (written - seq->read > seq->size - 1u) {
+        seq->lost += written - 1 - seq->read;
+        seq->read      = written - 1;
+        seq->have_last = false;
+        if (seq->wraps != NULL) {
+            /* the wraps of the dropped entries, the ones of the next capture kept */
+            slot  = written % seq->size;
+            wraps = seq->wraps[slot];
+            memset(seq->wraps, 0, seq->size);
+            seq->wraps[slot] = wraps;
+        }
+    }
+    __set_PRIMASK(primask);
+    return written;
+}
+
+static int32_t timer_seq_ring_start(timer_seq_t* seq, volatile uint32_t* reg, dma_hand_shake_t handshake)
+{
+    dma_job_t* job = &seq->job;
+    uint16_t half  = seq->size / 2;
+    uint8_t i;
+
+    seq->blocks    = 0;
+    seq->read      = 0;
+    seq->seen      = 0;
+    seq->have_last = false;
+    seq->lost      = 0;
+    seq->modulus   = (seq->timer->ARR & 0xFFFF) + 1;
+
+    for (i = 0; i < 2; i++) {
+        seq->halves[i].src        = (uint32_t)reg;
+        seq->halves[i].dest       = (uint32_t)(seq->ring + i * half);
+        seq->halves[i].data_width = 1;
+        seq->halves[i].src_msize  = 0;
+        seq->halves[i].dest_msize = 0;
+        seq->halves[i].block_size = half;
+    }
+    job->dev.mode      = P2M_MODE;
+    job->dev.handshake = handshake;
+    job->blocks        = seq->halves;
+    job->lli           = seq->lli;
+    job->block_num     = 2;
+    job->flags         = DMA_JOB_CIRCULAR;
+    job->start         = NULL;
+    job->done          = timer_seq_block_done;
+    job->arg           = seq;
+    return dma_job_submit(seq->chan, job);
+}
+
+/**
+ * @brief  Open a sequencer on a timer channel
+ * @param  seq the sequencer
+ * @param  TIMERx TIMER0 to TIMER3
+ * @param  channel TIMER_CHANNEL_0 to TIMER_CHANNEL_3 on TIMER0 and TIMER1,
+ *         TIMER_CHANNEL_0 or TIMER_CHANNEL_1 on TIMER2 and TIMER3, unused in
+ *         the encoder mode
+ * @return ERRNO_OK, ERRNO_ERROR on an invalid channel or when no DMA channel is free
+ * @note   The timer, DMA and BSTIMER clocks and the pins are set by the
+ *         application
+ */
+int32_t timer_seq_init(timer_seq_t* seq, timer_gp_t* TIMERx, uint8_t channel)
+{
+    memset(seq, 0, sizeof(timer_seq_t));
+    if (TIMERx != TIMER0 && TIMERx != TIMER1 && TIMERx != TIMER2 && TIMERx != TIMER3) {
+        return ERRNO_ERROR;
+    }
+    if (channel > ((TIMERx == TIMER0 || TIMERx == TIMER1) ? TIMER_CHANNEL_3 : TIMER_CHANNEL_1)) {
+        return ERRNO_ERROR;
+    }
+    if (dma_chan_acquire(&seq->chan) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+    seq->timer   = TIMERx;
+    seq->channel = channel;
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Close a sequencer, stopped first
+ * @param  seq the sequencer
+ * @return ERRNO_OK
+ */
+int32_t timer_seq_deinit(timer_seq_t* seq)
+{
+    timer_seq_stop(seq);
+    return dma_chan_release(seq->chan);
+}
+
+/**
+ * @brief  Capture the edges of the channel into a ring
+ * @param  seq the sequencer
+ * @param  ring the captured counter values
+ * @param  wraps counter wraps before each capture, size entries
+ * @param  size ring length, even, 2 to TIMER_SEQ_RING_MAX
+ * @return ERRNO_OK, ERRNO_ERROR on an invalid ring or a running sequencer
+ * @note   The timer is set by timer_init and its channel as an input by
+ *         timer_config_channel_ic before, the counter is started here. The
+ *         DMA stores every capture, the CPU only runs at the counter wraps:
+ *         the timer interrupt calls timer_seq_irq_handler, which counts the
+ *         wraps between two captures
+ */
+int32_t timer_seq_capture_start(timer_seq_t* seq, uint16_t* ring, uint8_t* wraps, uint16_t size)
+{
+    if (seq->mode != TIMER_SEQ_IDLE || ring == NULL || wraps == NULL || size < 2 || (size & 1)
+        || size > TIMER_SEQ_RING_MAX) {
+        return ERRNO_ERROR;
+    }
+    memset(wraps, 0, size);
+    seq->ring  = ring;
+    seq->wraps = wraps;
+    seq->size  = size;
+    if (timer_seq_ring_start(seq, timer_seq_ccr(seq), timer_seq_cc_handshake(seq)) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+    seq->mode = TIMER_SEQ_CAPTURE;
+
+    timer_clear_status(seq->timer, TIMER_SR_UIF);
+    timer_config_interrupt(seq->timer, TIMER_DIER_UIE, ENABLE);
+    timer_config_dma(seq->timer, (timer_dma_t)(TIMER_DIER_CC0DE << seq->channel), ENABLE);
+    timer_cmd(seq->timer, true);
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Read the periods between the captures
+ * @param  seq the sequencer
+ * @param  periods the periods, in timer ticks, TIMER_SEQ_PERIOD_MAX for a
+ *         gap of 255 counter wraps or more
+ * @param  max room in periods
+ * @return the number of periods read
+ * @note   The last capture is kept until the next one, a wrap interrupt may
+ *         still count before it. Captures overwritten before they are read
+ *         are counted in lost, the period across them is skipped
+ */
+uint16_t timer_seq_capture_read(timer_seq_t* seq, uint32_t* periods, uint16_t max)
+{
+    uint32_t written, slot;
+    uint16_t count = 0;
+    uint16_t value;
+    uint8_t wraps;
+
+    if (seq->mode != TIMER_SEQ_CAPTURE) {
+        return 0;
+    }
+    written = timer_seq_pending(seq);
+    while (count < max && seq->read + 1 < written) {
+        slot  = seq->read % seq->size;
+        value = seq->ring[slot];
+        wraps = seq->wraps[slot];
+        seq->wraps[slot] = 0;
+        if (seq->have_last) {
+            periods[count++] = (wraps == 0xFF) ? TIMER_SEQ_PERIOD_MAX : wraps * seq->modulus + value - seq->last;
+        }
+        seq->last      = value;
+        seq->have_last = true;
+        seq->read++;
+    }
+    return count;
+}
+
+/**
+ * @brief  Number of captures since the start, the pulse count
+ * @param  seq the sequencer
+ * @return the count
+ */
+uint32_t timer_seq_count(timer_seq_t* seq)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint32_t written;
+
+    if (seq->mode != TIMER_SEQ_CAPTURE) {
+        return 0;
+    }
+    __disable_irq();
+    written = timer_seq_written(seq);
+    __set_PRIMASK(primask);
+    return written;
+}
+
+/**
+ * @brief  Load the compare value of the channel from a table, one entry per
+ *         timer period
+ * @param  seq the sequencer
+ * @param  duty the compare values, read by the DMA until the sequence ends
+ * @param  len the table length, 2 to TIMER_SEQ_RING_MAX
+ * @param  loop true to repeat the table until timer_seq_stop, false to play
+ *         it once and call the done callback
+ * @return ERRNO_OK, ERRNO_ERROR on an invalid table or a running sequencer
+ * @note   The channel is set by timer_config_pwm before, the counter is
+ *         started here. Each update event loads the next entry, the output
+ *         keeps the last one at the end
+ */
+int32_t timer_seq_pwm_start(timer_seq_t* seq, const uint16_t* duty, uint16_t len, bool loop)
+{
+    dma_job_t* job = &seq->job;
+    uint16_t first = len / 2;
+    uint8_t i;
+
+    if (seq->mode != TIMER_SEQ_IDLE || duty == NULL || len < 2 || len > TIMER_SEQ_RING_MAX) {
+        return ERRNO_ERROR;
+    }
+    for (i = 0; i < 2; i++) {
+        seq->halves[i].src        = (uint32_t)(duty + i * first);
+        seq->halves[i].dest       = (uint32_t)timer_seq_ccr(seq);
+        seq->halves[i].data_width = 1;
+        seq->halves[i].src_msize  = 0;
+        seq->halves[i].dest_msize = 0;
+        seq->halves[i].block_size = i ? len - first : first;
+    }
+    job->dev.mode      = M2P_MODE;
+    job->dev.handshake = timer_seq_up_handshake(seq);
+    job->blocks        = seq->halves;
+    job->lli           = seq->lli;
+    job->block_num     = 2;
+    job->flags         = loop ? DMA_JOB_CIRCULAR : 0;
+    job->start         = NULL;
+    job->done          = timer_seq_block_done;
+    job->arg           = seq;
+
+    seq->blocks = 0;
+    seq->mode   = TIMER_SEQ_PWM;
+    if (dma_job_submit(seq->chan, job) != ERRNO_OK) {
+        seq->mode = TIMER_SEQ_IDLE;
+        return ERRNO_ERROR;
+    }
+    timer_config_dma(seq->timer, TIMER_DIER_UDE, ENABLE);
+    timer_cmd(seq->timer, true);
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Snapshot the counter of an encoder at the update rate of a BSTIMER
+ * @param  seq the sequencer
+ * @param  BSTIMERx the snapshot timer, BSTIMER0 or BSTIMER1
+ * @param  ring the counter snapshots
+ * @param  size ring length, even, 2 to TIMER_SEQ_RING_MAX
+ * @return ERRNO_OK, ERRNO_ERROR on an invalid ring or BSTIMER or a running
+ *         sequencer
+ * @note   The timer is set in an encoder slave mode and the BSTIMER period
+ *         by bstimer_init before, both are started here. No interrupt runs
+ *         per snapshot
+ */
+int32_t timer_seq_encoder_start(timer_seq_t* seq, bstimer_t* BSTIMERx, uint16_t* ring, uint16_t size)
+{
+    dma_hand_shake_t handshake = (BSTIMERx == BSTIMER0) ? DMA_HANDSHAKE_BSTIMER_0_UP : DMA_HANDSHAKE_BSTIMER_1_UP;
+
+    if (seq->mode != TIMER_SEQ_IDLE || (BSTIMERx != BSTIMER0 && BSTIMERx != BSTIMER1) || ring == NULL
+        || size < 2 || (size & 1) || size > TIMER_SEQ_RING_MAX) {
+        return ERRNO_ERROR;
+    }
+    seq->clock = BSTIMERx;
+    seq->ring  = ring;
+    seq->wraps = NULL;
+    seq->size  = size;
+    if (timer_seq_ring_start(seq, &seq->timer->CNT, handshake) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+    seq->mode = TIMER_SEQ_ENCODER;
+
+    timer_cmd(seq->timer, true);
+    bstimer_config_dma(BSTIMERx, true);
+    bstimer_cmd(BSTIMERx, true);
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Read the encoder moves between the snapshots
+ * @param  seq the sequencer
+ * @param  deltas the counts between two snapshots, the shortest way around
+ *         the counter period
+ * @param  max room in deltas
+ * @return the number of deltas read
+ */
+uint16_t timer_seq_encoder_read(timer_seq_t* seq, int32_t* deltas, uint16_t max)
+{
+    int32_t half = (int32_t)(seq->modulus / 2);
+    uint32_t written;
+    uint16_t count = 0;
+    uint16_t value;
+    int32_t delta;
+
+    if (seq->mode != TIMER_SEQ_ENCODER) {
+        return 0;
+    }
+    written = timer_seq_pending(seq);
+    while (count < max && seq->read < written) {
+        value = seq->ring[seq->read % seq->size];
+        if (seq->have_last) {
+            delta = (int32_t)value - seq->last;
+            if (delta > half) {
+                delta -= (int32_t)seq->modulus;
+            } else if (delta <= -half) {
+                delta += (int32_t)seq->modulus;
+            }
+            deltas[count++] = delta;
+        }
+        seq->last      = value;
+        seq->have_last = true;
+        seq->read++;
+    }
+    return count;
+}
+
+/**
+ * @brief  Stop the sequence, the counter keeps running
+ * @param  seq the sequencer
+ * @return
+ */
+void timer_seq_stop(timer_seq_t* seq)
+{
+    timer_seq_halt(seq);
+    dma_job_abort(seq->chan);
+}
+
+/**
+ * @brief  Timer interrupt handler of a sequencer, counts the counter wraps
+ *         of the capture mode
+ * @param  seq the sequencer
+ * @return
+ * @note   A capture stored after the wrap but before this interrupt is
+ *         told apart by its value, below the counter read here
+ */
+void timer_seq_irq_handler(timer_seq_t* seq)
+{
+    uint32_t primask;
+    uint32_t written, slot;
+    uint16_t counter;
+    bool state;
+
+    timer_get_status(seq->timer, TIMER_SR_UIF, &state);
+    if (!state) {
+        return;
+    }
+    timer_clear_status(seq->timer, TIMER_SR_UIF);
+    if (seq->mode != TIMER_SEQ_CAPTURE) {
+        return;
+    }
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    written = timer_seq_written(seq);
+    counter = seq->timer->CNT;
+    __set_PRIMASK(primask);
+
+    slot = written;
+    if (written != seq->seen && seq->ring[(written - 1) % seq->size] <= counter) {
+        slot = written - 1;
+    }
+    seq->seen = written;
+    slot %= seq->size;
+    if (seq->wraps[slot] != 0xFF) {
+        seq->wraps[slot]++;
+    }
+}
@@ -0,0 +1,333 @@
+#include <stdbool.h>
+#include "tremo_cm4.h"
+#include "tremo_dma_handshake.h"
+#include "tremo_uart_stream.h"
+
+#define UART_STREAM_DRAIN_SIZE (32) /*!< bytes read from the fifo at a time on an idle line*/
+
+static uint32_t uart_stream_data_reg(uart_stream_t* stream)
+{
+    if (stream->lpuart) {
+        return (uint32_t) & (((lpuart_t*)stream->port)->DATA);
+    }
+    return (uint32_t) & (((uart_t*)stream->port)->DR);
+}
+
+static uint8_t uart_stream_handshake(uart_stream_t* stream, bool rx)
+{
+    uint8_t handshake;
+
+    if (stream->lpuart) {
+        handshake = DMA_HANDSHAKE_LPUART_TX;
+    } else if (stream->port == UART0) {
+        handshake = DMA_HANDSHAKE_UART_0_TX;
+    } else if (stream->port == UART1) {
+        handshake = DMA_HANDSHAKE_UART_1_TX;
+    } else if (stream->port == UART2) {
+        handshake = DMA_HANDSHAKE_UART_2_TX;
+    } else {
+        handshake = DMA_HANDSHAKE_UART_3_TX;
+    }
+    /* the RX handshake follows the TX one */
+    return rx ? handshake + 1 : handshake;
+}
+
+static void uart_stream_rx_dma(uart_stream_t* stream, bool new_state)
+{
+    if (stream->lpuart) {
+        lpuart_config_dma((lpuart_t*)stream->port, LPUART_CR1_RX_DMA, new_state);
+    } else {
+        uart_dma_config((uart_t*)stream->port, UART_DMA_REQ_RX, new_state);
+    }
+}
+
+/* called with the interrupts disabled, reports the ring up to end */
+static void uart_stream_rx_report(uart_stream_t* stream, uart_stream_rx_event_t event, uint16_t end)
+{
+    uint16_t start = stream->rx_pos;
+
+    if (end > start) {
+        stream->rx_pos = end;
+        stream->rx_cb(stream, event, stream->rx_buf + start, end - start);
+    }
+}
+
+static void uart_stream_rx_done(dma_job_t* job, bool success)
+{
+    uart_stream_t* stream = (uart_stream_t*)job->arg;
+    uint16_t half         = stream->rx_size / 2;
+    uint32_t primask      = __get_PRIMASK();
+
+    if (!success || stream->rx_cb == NULL) {
+        return;
+    }
+    /* rx_pos stays in the half the DMA writes, the poll never reports past it */
+    __disable_irq();
+    if (stream->rx_half == 0) {
+        uart_stream_rx_report(stream, UART_STREAM_RX_HALF, half);
+    } else {
+        uart_stream_rx_report(stream, UART_STREAM_RX_FULL, stream->rx_size);
+        stream->rx_pos = 0;
+    }
+    stream->rx_half ^= 1;
+    __set_PRIMASK(primask);
+}
+
+static void uart_stream_tx_done(dma_job_t* job, bool success)
+{
+    uart_stream_tx_t* tx = (uart_stream_tx_t*)job->arg;
+
+    if (tx->done) {
+        tx->done(tx, success);
+    }
+}
+
+static int32_t uart_stream_acquire(uart_stream_t* stream)
+{
+    stream->rx_cb = NULL;
+    if (dma_chan_acquire(&stream->tx_chan) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+    if (dma_chan_acquire(&stream->rx_chan) != ERRNO_OK) {
+        dma_chan_release(stream->tx_chan);
+        return ERRNO_ERROR;
+    }
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Open a DMA stream on a UART
+ * @param  stream the stream
+ * @param  uartx the UART, initialized in fifo mode and enabled
+ * @return ERRNO_OK, ERRNO_ERROR when no DMA channel is free
+ * @note   The DMA clocks are enabled by the application, and its
+ *         UARTx_IRQHandler calls uart_stream_irq_handler for the idle line
+ */
+int32_t uart_stream_init(uart_stream_t* stream, uart_t* uartx)
+{
+    stream->port   = uartx;
+    stream->lpuart = false;
+    if (uart_stream_acquire(stream) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+    uart_dma_config(uartx, UART_DMA_REQ_TX, true);
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Open a DMA stream on the LPUART
+ * @param  stream the stream
+ * @param  lpuart the LPUART, initialized with RX and TX enabled
+ * @return ERRNO_OK, ERRNO_ERROR when no DMA channel is free
+ * @note   The LPUART has no RX timeout, uart_stream_rx_poll reports the
+ *         bytes of a partial half
+ */
+int32_t lpuart_stream_init(uart_stream_t* stream, lpuart_t* lpuart)
+{
+    stream->port   = lpuart;
+    stream->lpuart = true;
+    if (uart_stream_acquire(stream) != ERRNO_OK) {
+        return ERRNO_ERROR;
+    }
+    lpuart_config_dma(lpuart, LPUART_CR1_TX_DMA, true);
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Close a stream, its RX stopped
+ * @param  stream the stream
+ * @return ERRNO_OK, ERRNO_ERROR while TX buffers are queued
+ */
+int32_t uart_stream_deinit(uart_stream_t* stream)
+{
+    if (dma_job_busy(stream->tx_chan)) {
+        return ERRNO_ERROR;
+    }
+    uart_stream_rx_stop(stream);
+    if (stream->lpuart) {
+        lpuart_config_dma((lpuart_t*)stream->port, LPUART_CR1_TX_DMA, false);
+    } else {
+        uart_dma_config((uart_t*)stream->port, UART_DMA_REQ_TX, false);
+    }
+    dma_chan_release(stream->tx_chan);
+    dma_chan_release(stream->rx_chan);
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Queue a buffer for sending
+ * @param  stream the stream
+ * @param  tx the buffer, sent at once on an idle stream, queued otherwise
+ * @return ERRNO_OK, ERRNO_ERROR on an invalid buffer
+ * @note   The buffer is not copied, its callback runs once the DMA has moved
+ *         its last byte to the fifo
+ */
+int32_t uart_stream_send(uart_stream_t* stream, uart_stream_tx_t* tx)
+{
+    dma_job_t* job;
+
+    if (tx == NULL || tx->data == NULL || tx->len == 0 || tx->len > UART_STREAM_BLOCK_MAX) {
+        return ERRNO_ERROR;
+    }
+    job                 = &tx->job;
+    job->dev.mode       = M2P_MODE;
+    job->dev.src        = (uint32_t)tx->data;
+    job->dev.dest       = uart_stream_data_reg(stream);
+    job->dev.data_width = 0;
+    job->dev.src_msize  = 0;
+    job->dev.dest_msize = 0;
+    job->dev.block_size = tx->len;
+    job->dev.handshake  = uart_stream_handshake(stream, false);
+    job->blocks         = NULL;
+    job->lli            = NULL;
+    job->block_num      = 0;
+    job->flags          = 0;
+    job->start          = NULL;
+    job->done           = uart_stream_tx_done;
+    job->arg            = tx;
+    return dma_job_submit(stream->tx_chan, job);
+}
+
+/**
+ * @brief  Check whether TX buffers are sent or queued
+ * @param  stream the stream
+ * @return true while the stream has TX buffers
+ */
+bool uart_stream_tx_busy(uart_stream_t* stream)
+{
+    return dma_job_busy(stream->tx_chan);
+}
+
+/**
+ * @brief  Start the circular RX
+ * @param  stream the stream
+ * @param  buf the ring, written by the DMA until uart_stream_rx_stop
+ * @param  size the ring size, even, each half up to UART_STREAM_BLOCK_MAX
+ * @param  cb the RX callback
+ * @return ERRNO_OK, ERRNO_ERROR on an invalid ring or a running RX
+ * @note   A callback slower than the line loses the bytes overwritten
+ */
+int32_t uart_stream_rx_start(uart_stream_t* stream, uint8_t* buf, uint16_t size, uart_stream_rx_callback_t cb)
+{
+    dma_job_t* job = &stream->rx_job;
+    uint16_t half  = size / 2;
+    uint8_t i;
+
+    if (stream->rx_cb != NULL || buf == NULL || cb == NULL || half == 0 || (size & 1)
+        || half > UART_STREAM_BLOCK_MAX) {
+        return ERRNO_ERROR;
+    }
+    stream->rx_buf  = buf;
+    stream->rx_size = size;
+    stream->rx_pos  = 0;
+    stream->rx_half = 0;
+    stream->rx_cb   = cb;
+
+    for (i = 0; i < 2; i++) {
+        stream->rx_blocks[i].src        = uart_stream_data_reg(stream);
+        stream->rx_blocks[i].dest       = (uint32_t)(buf + i * half);
+        stream->rx_blocks[i].data_width = 0;
+        stream->rx_blocks[i].src_msize  = 0;
+        stream->rx_blocks[i].dest_msize = 0;
+        stream->rx_blocks[i].block_size = half;
+    }
+    job->dev.mode      = P2M_MODE;
+    job->dev.handshake = uart_stream_handshake(stream, true);
+    job->blocks        = stream->rx_blocks;
+    job->lli           = stream->rx_lli;
+    job->block_num     = 2;
+    job->flags         = DMA_JOB_CIRCULAR;
+    job->start         = NULL;
+    job->done          = uart_stream_rx_done;
+    job->arg           = stream;
+    if (dma_job_submit(stream->rx_chan, job) != ERRNO_OK) {
+        stream->rx_cb = NULL;
+        return ERRNO_ERROR;
+    }
+
+    uart_stream_rx_dma(stream, true);
+    if (!stream->lpuart) {
+        uart_clear_interrupt((uart_t*)stream->port, UART_INTERRUPT_RX_TIMEOUT);
+        uart_config_interrupt((uart_t*)stream->port, UART_INTERRUPT_RX_TIMEOUT, true);
+    }
+    return ERRNO_OK;
+}
+
+/**
+ * @brief  Stop the circular RX, the bytes not reported yet are dropped
+ * @param  stream the stream
+ * @return
+ */
+void uart_stream_rx_stop(uart_stream_t* stream)
+{
+    if (stream->rx_cb == NULL) {
+        return;
+    }
+    if (!stream->lpuart) {
+        uart_config_interrupt((uart_t*)stream->port, UART_INTERRUPT_RX_TIMEOUT, false);
+    }
+    uart_stream_rx_dma(stream, false);
+    dma_job_abort(stream->rx_chan);
+    stream->rx_cb = NULL;
+}
+
+/**
+ * @brief  Report the bytes the DMA moved to the ring since the previous callback
+ * @param  stream the stream
+ * @return
+ */
+void uart_stream_rx_poll(uart_stream_t* stream)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint16_t half, low;
+    uint32_t pos;
+
+    __disable_irq();
+    if (stream->rx_cb != NULL) {
+        half = stream->rx_size / 2;
+        low  = stream->rx_half * half;
+        pos  = dma_chan_get_dest(stream->rx_chan) - (uint32_t)stream->rx_buf;
+        /* out of the half: it is done, its block interrupt pending */
+        if (pos < low || pos > low + half) {
+            pos = low + half;
+        }
+        uart_stream_rx_report(stream, UART_STREAM_RX_IDLE, pos);
+    }
+    __set_PRIMASK(primask);
+}
+
+/**
+ * @brief  UART interrupt handler of a stream, reports the bytes received at
+ *         an idle line
+ * @param  stream the stream
+ * @return
+ */
+void uart_stream_irq_handler(uart_stream_t* stream)
+{
+    uart_t* uartx = (uart_t*)stream->port;
+    uint8_t drain[UART_STREAM_DRAIN_SIZE];
+    uint16_t len;
+
+    if (stream->lpuart || uart_get_interrupt_status(uartx, UART_INTERRUPT_RX_TIMEOUT) != SET) {
+        return;
+    }
+    uart_clear_interrupt(uartx, UART_INTERRUPT_RX_TIMEOUT);
+    if (stream->rx_cb == NULL) {
+        return;
+    }
+
+    /* the DMA takes the fifo by bursts, the bytes below one wait in it:
+       they are read after the ones the DMA moved, its request off */
+    uart_stream_rx_dma(stream, false);
+    uart_stream_rx_poll(stream);
+    do {
+        len = 0;
+        while (len < UART_STREAM_DRAIN_SIZE && uart_get_flag_status(uartx, UART_FLAG_RX_FIFO_EMPTY) != SET) {
+            drain[len++] = uart_receive_data(uartx);
+        }
+        if (len > 0) {
+            stream->rx_cb(stream, UART_STREAM_RX_IDLE, drain, len);
+        }
+    } while (len == UART_STREAM_DRAIN_SIZE);
+    uart_stream_rx_dma(stream, true);
+}
@@ -20,14 +20,34 @@
  *
  * \author    Gregory Cristian ( Semtech )
  */
-#include <math.h>
 #include "tremo_rtc.h"
 #include "tremo_rcc.h"
 #include "tremo_pwr.h"
+#ifdef CONFIG_TIMER_PRECISE
+#include "tremo_lptimer.h"
+#endif
 #include "utilities.h"
 #include "timer.h"
 #include "radio.h"
 #include "rtc-board.h"
+#ifdef CONFIG_EVENT_QUEUE
+#include "event-queue.h"
+#endif
+#ifdef CONFIG_SCHEDULER
+#include "scheduler.h"
+#endif
+#ifdef CONFIG_COROUTINE
+#include "coroutine.h"
+#endif
+#ifdef CONFIG_AES_KEY_CACHE
+#include "aes-key.h"
+#endif
+#ifdef CONFIG_WARM_BOOT
+#include "tremo_delay.h"
+#endif
+#ifdef CONFIG_CLOCK_GOVERNOR
+#include "clock-governor.h"
+#endif
 
 /*!
  * Number of seconds in a minute
@@ -82,12 +102,17 @@ typedef struct RtcCalendar_s
     rtc_calendar_t CalendarTime;
 } RtcCalendar_t;
 
+TimerTime_t RtcTimerContext;
+
 /*!
- * Current RTC timer context
+ * Raw RTC date register value RtcDaySeconds has been computed for
  */
-RtcCalendar_t RtcCalendarContext;
+static uint32_t RtcDayRegister = 0xFFFFFFFF;
 
-TimerTime_t RtcTimerContext;
+/*!
+ * Seconds from the time base origin to the start of the current day
+ */
+static uint32_t RtcDaySeconds = 0;
 
 /*!
  * \brief Flag to indicate if the timestamp until the next event is long enough
@@ -106,6 +131,13 @@ static bool LowPowerDisableDuringTask = false;
  */
 static bool RtcInitialized = false;
 
+#ifdef CONFIG_TIMER_PRECISE
+/*!
+ * \brief Indicates if LPTIMER0 is set up for the precise timeouts
+ */
+static bool RtcPreciseInitialized = false;
+#endif
+
 /*!
  * \brief Indicates if the RTC Wake Up Time is calibrated or not
  */
@@ -116,6 +148,36 @@ static bool RtcInitialized = false;
  */
 volatile uint32_t McuWakeUpTime = 0;
 
+#ifdef CONFIG_RTC_WAKEUP_CALIBRATION
+/*!
+ * Longest accepted STOP exit latency sample [RTC ticks], longer samples come
+ * from interrupts masked for a while and are discarded
+ */
+#ifndef RTC_WAKEUP_MAX_SAMPLE
+#define RTC_WAKEUP_MAX_SAMPLE       164
+#endif
+
+/*!
+ * \brief Set while the MCU is in a STOP mode
+ */
+static volatile bool RtcInStopMode = false;
+
+/*!
+ * \brief Time the RTC alarm was programmed for [RTC ticks]
+ */
+static TimerTime_t RtcAlarmTicks = 0;
+
+/*!
+ * \brief Running STOP exit latency estimate [1/16 RTC tick]
+ */
+static uint32_t RtcWakeUpEstimate = 0;
+
+/*!
+ * \brief STOP exit latency estimate [RTC ticks], the alarms are advanced by it
+ */
+static uint32_t RtcWakeUpTicks = 0;
+#endif
+
 /*!
  * \brief RTC wakeup time computation
  */
@@ -150,6 +212,50 @@ static RtcCalendar_t RtcGetCalendar( void );
 
 extern void rtc_check_syn(void);
 
+#ifdef CONFIG_WARM_BOOT
+/*!
+ * Consecutive 1 ms windows the XO32K must count right to be deemed stable
+ */
+#ifndef RTC_XO32K_STABLE_WINDOWS
+#define RTC_XO32K_STABLE_WINDOWS    3
+#endif
+
+bool RtcWaitXo32kStable( uint32_t timeout )
+{
+    uint16_t last;
+    uint16_t now;
+    uint32_t ticks;
+    uint8_t stable = 0;
+
+    // The sub-second counter runs from the XO32K once the calendar is on
+    rcc_enable_peripheral_clk( RCC_PERIPHERAL_RTC, true );
+    rtc_calendar_cmd( ENABLE );
+
+    last = rtc_get_subsecond_cnt( );
+    for( ; timeout > 0; timeout-- )
+    {
+        delay_us( 1000 );
+        now = rtc_get_subsecond_cnt( );
+        ticks = ( now >= last ) ? ( uint32_t )( now - last ) : ( uint32_t )( now + 32768 - last );
+        last = now;
+
+        // 32.768 ticks a millisecond, a starting crystal counts short or not at all
+        if( ( ticks >= 31 ) && ( ticks <= 34 ) )
+        {
+            if( ++stable >= RTC_XO32K_STABLE_WINDOWS )
+            {
+                return true;
+            }
+        }
+        else
+        {
+            stable = 0;
+        }
+    }
+    return false;
+}
+#endif
+
 void RtcInit( void )
 {
     if( RtcInitialized == false )
@@ -161,9 +267,17 @@ void RtcInit( void )
         NVIC_EnableIRQ(RTC_IRQn);
         
         RtcInitialized = true;
+#ifdef CONFIG_LOWPOWER_GOVERNOR
+        RtcResetLowPowerStats( );
+#endif
     }
 }
 
+bool RtcIsInitialized( void )
+{
+    return RtcInitialized;
+}
+
 void RtcSetTimeout( uint32_t timeout )
 {
     RtcStartWakeUpAlarm( timeout );
@@ -220,9 +334,169 @@ TimerTime_t RtcGetAdjustedTimeoutValue( uint32_t timeout )
 
 TimerTime_t RtcGetTimerValue( void )
 {
-    return RtcConvertCalendarTickToTimerTime( NULL );
+    return RtcTick2Ms( RtcGetTimerTicks( ) );
+}
+
+static bool RtcIsClockXo32k( void )
+{
+    return RCC_RTC_CLK_SOURCE_XO32K == rcc_get_rtc_clk_source( );
+}
+
+TimerTime_t RtcGetTimerTicks( void )
+{
+    uint32_t time;
+    uint32_t date;
+    uint32_t subsecond;
+    uint32_t seconds;
+    uint32_t primask;
+
+    // Same consistent read sequence as rtc_get_calendar
+    do {
+        subsecond = RTC->SUB_SECOND_CNT;
+        do {
+            time = RTC->CALENDAR_R;
+        } while( time != RTC->CALENDAR_R );
+        do {
+            date = RTC->CALENDAR_R_H;
+        } while( date != RTC->CALENDAR_R_H );
+    } while( ( subsecond != RTC->SUB_SECOND_CNT ) || ( subsecond < 1 ) );
+
+    primask = __get_PRIMASK( );
+    __disable_irq( );
+    if( date != RtcDayRegister )
+    {
+        // The date only changes once a day, convert it then
+        RtcCalendar_t calendar = { 0 };
+
+        calendar.CalendarTime.day = ( date & 0x0F ) + ( ( date >> 4 ) & 0x03 ) * 10;
+        calendar.CalendarTime.month = ( ( date >> 6 ) & 0x0F ) + ( ( date >> 10 ) & 0x01 ) * 10;
+        calendar.CalendarTime.year = 2000 + ( ( date >> 14 ) & 0x0F ) + ( ( date >> 18 ) & 0x0F ) * 10;
+        RtcDaySeconds = ( uint32_t )( RtcConvertCalendarTickToTimerTime( &calendar ) / 1000 );
+        RtcDayRegister = date;
+    }
+    seconds = RtcDaySeconds;
+    if( primask == 0 )
+    {
+        __enable_irq( );
+    }
+
+    seconds += ( ( time & 0x0F ) + ( ( time >> 4 ) & 0x07 ) * 10 ) +
+               ( ( ( time >> 7 ) & 0x0F ) + ( ( time >> 11 ) & 0x07 ) * 10 ) * SecondsInMinute +
+               ( ( ( time >> 14 ) & 0x0F ) + ( ( time >> 18 ) & 0x03 ) * 10 ) * SecondsInHour;
+
+    return ( TimerTime_t )seconds * ( RtcIsClockXo32k( ) ? 32768 : 32000 ) + subsecond;
+}
+
+TimerTime_t RtcTick2Ms( TimerTime_t ticks )
+{
+    if( RtcIsClockXo32k( ) )
+    {
+        return ( ticks * 125 ) >> 12; // * 1000 / 32768
+    }
+    return ticks >> 5; // * 1000 / 32000
+}
+
+TimerTime_t RtcTick2Us( TimerTime_t ticks )
+{
+    if( RtcIsClockXo32k( ) )
+    {
+        return ( ticks * 15625 ) >> 9; // * 1000000 / 32768
+    }
+    return ( ticks * 125 ) >> 2; // * 1000000 / 32000
+}
+
+TimerTime_t RtcMs2Tick( TimerTime_t time )
+{
+    if( RtcIsClockXo32k( ) )
+    {
+        return ( time * 32768 + 500 ) / 1000;
+    }
+    return time * 32;
+}
+
+TimerTime_t RtcUs2Tick( TimerTime_t time )
+{
+    if( RtcIsClockXo32k( ) )
+    {
+        return ( time * 512 + 7812 ) / 15625; // * 32768 / 1000000
+    }
+    return ( time * 4 + 62 ) / 125; // * 32000 / 1000000
+}
+
+#ifdef CONFIG_TIMER_PRECISE
+/*!
+ * \brief Sets LPTIMER0 up as a one shot timer on the RTC clock
+ */
+static void RtcPreciseInit( void )
+{
+    lptimer_init_t config;
+
+    rcc_enable_peripheral_clk( RCC_PERIPHERAL_LPTIMER0, false );
+    rcc_rst_peripheral( RCC_PERIPHERAL_LPTIMER0, true );
+    rcc_rst_peripheral( RCC_PERIPHERAL_LPTIMER0, false );
+    rcc_set_lptimer0_clk_source( RtcIsClockXo32k( ) ? RCC_LPTIMER0_CLK_SOURCE_XO32K : RCC_LPTIMER0_CLK_SOURCE_RCO32K );
+    rcc_enable_peripheral_clk( RCC_PERIPHERAL_LPTIMER0, true );
+
+    config.sel_external_clock = false;
+    config.count_by_external = false;
+    config.prescaler = LPTIMER_PRESC_1;
+    config.autoreload_preload = false;
+    config.wavpol_inverted = false;
+    lptimer_init( LPTIMER0, &config );
+
+    lptimer_config_interrupt( LPTIMER0, LPTIMER_IT_ARRM, ENABLE );
+    lptimer_config_wakeup( LPTIMER0, LPTIMER_CFGR_ARRM_WKUP, ENABLE );
+
+    NVIC_EnableIRQ( LPTIMER0_IRQn );
+    RtcPreciseInitialized = true;
+}
+
+void RtcSetPreciseTimeout( uint32_t ticks )
+{
+    if( RtcPreciseInitialized == false )
+    {
+        RtcPreciseInit( );
+    }
+#ifdef CONFIG_RTC_WAKEUP_CALIBRATION
+    // Fires earlier by the STOP exit latency, an early expiry is rearmed
+    ticks = ( ticks > RtcWakeUpTicks ) ? ( ticks - RtcWakeUpTicks ) : 0;
+#endif
+    if( ticks == 0 )
+    {
+        ticks = 1;
+    }
+    else if( ticks > 0xFFFF )
+    {
+        ticks = 0xFFFF;
+    }
+
+    lptimer_cmd( LPTIMER0, false );
+    lptimer_cmd( LPTIMER0, true );
+    lptimer_set_arr_register( LPTIMER0, ( uint16_t )ticks );
+    lptimer_config_count_mode( LPTIMER0, LPTIMER_MODE_SNGSTRT, ENABLE );
+}
+
+void RtcStopPreciseTimeout( void )
+{
+    if( RtcPreciseInitialized == true )
+    {
+        lptimer_cmd( LPTIMER0, false );
+    }
 }
 
+void RtcOnPreciseIrq( void )
+{
+    if( lptimer_get_interrupt_status( LPTIMER0, LPTIMER_IT_ARRM ) )
+    {
+        lptimer_clear_interrupt( LPTIMER0, LPTIMER_IT_ARRM );
+        while( lptimer_get_clear_status_flag( LPTIMER0, LPTIMER_CSR_ARRM ) == false );
+        lptimer_cmd( LPTIMER0, false );
+
+        TimerPreciseIrqHandler( );
+    }
+}
+#endif
+
 void BlockLowPowerDuringTask ( bool status )
 {
     if( status == true )
@@ -238,7 +512,16 @@ void RtcEnterLowPowerStopMode( void )
         return;
     
     rtc_check_syn();
+#ifdef CONFIG_AES_KEY_CACHE
+    AesKeyInvalidate( );
+#endif
+#ifdef CONFIG_RTC_WAKEUP_CALIBRATION
+    RtcInStopMode = true;
+    pwr_deepsleep_wfi(PWR_LP_MODE_STOP3);
+    RtcInStopMode = false;
+#else
     pwr_deepsleep_wfi(PWR_LP_MODE_STOP3);
+#endif
 }
 
 void RtcRecoverMcuStatus( void )
@@ -246,6 +529,312 @@ void RtcRecoverMcuStatus( void )
 
 }
 
+/*!
+ * XO32K temperature model: deviation = coefficient * ( T - turnover )^2 [ppm]
+ */
+#ifndef RTC_TEMP_COEFFICIENT
+#define RTC_TEMP_COEFFICIENT        ( -0.035f )
+#endif
+#ifndef RTC_TEMP_DEV_COEFFICIENT
+#define RTC_TEMP_DEV_COEFFICIENT    ( 0.0035f )
+#endif
+#ifndef RTC_TEMP_TURNOVER
+#define RTC_TEMP_TURNOVER           ( 25.0f )
+#endif
+#ifndef RTC_TEMP_DEV_TURNOVER
+#define RTC_TEMP_DEV_TURNOVER       ( 5.0f )
+#endif
+
+TimerTime_t RtcTempCompensation( TimerTime_t period, float temperature )
+{
+    float ppm;
+    float interim;
+
+    // Worst case coefficient, the crystal runs slow on both sides
+    ppm = RTC_TEMP_COEFFICIENT - RTC_TEMP_DEV_COEFFICIENT;
+    interim = temperature - ( RTC_TEMP_TURNOVER - RTC_TEMP_DEV_TURNOVER );
+    ppm *= interim * interim;
+
+    // A slow RTC counts less than the real period
+    interim = ( float )period + ( ( float )period * ppm ) / 1000000.0f;
+    if( interim < 0.0f )
+    {
+        return period;
+    }
+    return ( TimerTime_t )interim;
+}
+
+#ifdef CONFIG_RTC_DISCIPLINE
+/*!
+ * Shortest span between two reference samples used to measure the drift [ms],
+ * at the 1 ms resolution of the samples this bounds the error to about 0.5 ppm
+ */
+#ifndef RTC_DISCIPLINE_SPAN_MIN
+#define RTC_DISCIPLINE_SPAN_MIN     1800000
+#endif
+/*!
+ * Largest trim applied and largest plausible error [ppm], a bigger error is
+ * taken for a time step of the reference
+ */
+#ifndef RTC_DISCIPLINE_PPM_MAX
+#define RTC_DISCIPLINE_PPM_MAX      200
+#endif
+
+/*!
+ * Anchor of the drift measurement: local RTC time and reference time [ms]
+ */
+static bool DisciplineAnchored = false;
+static TimerTime_t DisciplineLocal;
+static TimerTime_t DisciplineRef;
+
+/*!
+ * Trim written to the RTC [0.5 ppm], positive speeds the RTC up
+ */
+static int16_t DisciplineTrim = 0;
+
+void RtcDisciplineUpdate( TimerTime_t localTime, TimerTime_t refTime )
+{
+    int32_t localSpan;
+    int32_t refSpan;
+    int32_t error;
+
+    if( DisciplineAnchored == false )
+    {
+        DisciplineAnchored = true;
+        DisciplineLocal = localTime;
+        DisciplineRef = refTime;
+        return;
+    }
+
+    localSpan = ( int32_t )( localTime - DisciplineLocal );
+    refSpan = ( int32_t )( refTime - DisciplineRef );
+    if( refSpan < RTC_DISCIPLINE_SPAN_MIN )
+    {
+        // Keep the anchor until the span resolves the drift
+        if( refSpan < 0 )
+        {
+            DisciplineLocal = localTime;
+            DisciplineRef = refTime;
+        }
+        return;
+    }
+    DisciplineLocal = localTime;
+    DisciplineRef = refTime;
+
+    // Residual drift of the trimmed RTC [0.5 ppm], positive when it runs fast
+    error = ( int32_t )( ( ( int64_t )( localSpan - refSpan ) * 2000000 ) / refSpan );
+    if( ( error > ( 2 * 2 * RTC_DISCIPLINE_PPM_MAX ) ) || ( error < -( 2 * 2 * RTC_DISCIPLINE_PPM_MAX ) ) )
+    {
+        return;
+    }
+
+    // Integrate half of the error, the sample noise averages out over time
+    error = DisciplineTrim - error / 2;
+    if( error > ( 2 * RTC_DISCIPLINE_PPM_MAX ) )
+    {
+        error = 2 * RTC_DISCIPLINE_PPM_MAX;
+    }
+    else if( error < -( 2 * RTC_DISCIPLINE_PPM_MAX ) )
+    {
+        error = -( 2 * RTC_DISCIPLINE_PPM_MAX );
+    }
+    if( error != DisciplineTrim )
+    {
+        DisciplineTrim = ( int16_t )error;
+        rtc_config_ppm( DisciplineTrim );
+    }
+}
+
+int16_t RtcGetPpmTrim( void )
+{
+    return DisciplineTrim;
+}
+#endif
+
+#ifdef CONFIG_LOWPOWER_GOVERNOR
+/*!
+ * Minimum idle time to enter each mode [ms]: the time after which the mode
+ * saves more than its entry and exit cost. McuWakeUpTime is added for the
+ * STOP modes
+ */
+#ifndef RTC_LP_SLEEP_BREAK_EVEN
+#define RTC_LP_SLEEP_BREAK_EVEN     1
+#endif
+#ifndef RTC_LP_STOP0_BREAK_EVEN
+#define RTC_LP_STOP0_BREAK_EVEN     2
+#endif
+#ifndef RTC_LP_STOP1_BREAK_EVEN
+#define RTC_LP_STOP1_BREAK_EVEN     3
+#endif
+#ifndef RTC_LP_STOP2_BREAK_EVEN
+#define RTC_LP_STOP2_BREAK_EVEN     4
+#endif
+#ifndef RTC_LP_STOP3_BREAK_EVEN
+#define RTC_LP_STOP3_BREAK_EVEN     5
+#endif
+
+static const uint32_t RtcLowPowerBreakEven[RTC_LP_MODE_NUM] =
+{
+    0,
+    RTC_LP_SLEEP_BREAK_EVEN,
+    RTC_LP_STOP0_BREAK_EVEN,
+    RTC_LP_STOP1_BREAK_EVEN,
+    RTC_LP_STOP2_BREAK_EVEN,
+    RTC_LP_STOP3_BREAK_EVEN,
+};
+
+/*!
+ * Deepest mode allowed by the application
+ */
+static RtcLowPowerMode_t RtcLowPowerLimit = RTC_LP_STOP3;
+
+/*!
+ * Low power entries and residency, in RTC ticks
+ */
+static uint32_t RtcLowPowerEntries[RTC_LP_MODE_NUM];
+static TimerTime_t RtcLowPowerTicks[RTC_LP_MODE_NUM];
+
+/*!
+ * RTC ticks at the last statistics reset
+ */
+static TimerTime_t RtcLowPowerStatsOrigin = 0;
+
+void RtcEnterLowPower( void )
+{
+    RtcLowPowerMode_t mode = RtcLowPowerLimit;
+    TimerTime_t idle;
+    TimerTime_t start;
+
+    __disable_irq( );
+    if( Radio.IrqPending( ) == true )
+    {
+        // The main loop has radio events to process
+        __enable_irq( );
+        return;
+    }
+#ifdef CONFIG_EVENT_QUEUE
+    if( EventPending( ) == true )
+    {
+        // Posted after the main loop drained the queue
+        __enable_irq( );
+        return;
+    }
+#endif
+#ifdef CONFIG_SCHEDULER
+    if( SchedPending( ) == true )
+    {
+        // Task woken after the scheduler looked for one
+        __enable_irq( );
+        return;
+    }
+#endif
+#ifdef CONFIG_COROUTINE
+    if( CoroutinePending( ) == true )
+    {
+        // Coroutine signaled after CoroutineRunOnce
+        __enable_irq( );
+        return;
+    }
+#endif
+    if( ( ( Radio.GetStatus( ) != RF_IDLE ) || ( LowPowerDisableDuringTask == true ) ) &&
+        ( mode > RTC_LP_SLEEP ) )
+    {
+        mode = RTC_LP_SLEEP;
+    }
+
+    idle = TimerGetTimeToNextEvent( );
+    while( mode > RTC_LP_AWAKE )
+    {
+        uint32_t breakEven = RtcLowPowerBreakEven[mode];
+
+        if( mode >= RTC_LP_STOP0 )
+        {
+            breakEven += McuWakeUpTime;
+        }
+        if( idle >= breakEven )
+        {
+            break;
+        }
+        mode--;
+    }
+    if( mode == RTC_LP_AWAKE )
+    {
+        __enable_irq( );
+        return;
+    }
+
+    // A pending interrupt wakes the core up even with PRIMASK set, its
+    // handler runs once the interrupts are enabled again
+    start = RtcGetTimerTicks( );
+    if( mode == RTC_LP_SLEEP )
+    {
+#ifdef CONFIG_CLOCK_GOVERNOR
+        // The core idles slower, the handler runs once the clock is back
+        ClockIdleEnter( );
+        pwr_sleep_wfi( false );
+        ClockIdleExit( );
+#else
+        pwr_sleep_wfi( false );
+#endif
+    }
+    else
+    {
+        rtc_check_syn( );
+#ifdef CONFIG_AES_KEY_CACHE
+        // The engine may not keep its key in STOP mode
+        AesKeyInvalidate( );
+#endif
+#ifdef CONFIG_RTC_WAKEUP_CALIBRATION
+        RtcInStopMode = true;
+#endif
+        pwr_deepsleep_wfi( PWR_LP_MODE_STOP0 + ( mode - RTC_LP_STOP0 ) );
+    }
+    RtcLowPowerEntries[mode]++;
+    RtcLowPowerTicks[mode] += RtcGetTimerTicks( ) - start;
+    __enable_irq( );
+#ifdef CONFIG_RTC_WAKEUP_CALIBRATION
+    // The wake up handler has run once the interrupts were enabled
+    RtcInStopMode = false;
+#endif
+}
+
+void RtcSetLowPowerLimit( RtcLowPowerMode_t mode )
+{
+    RtcLowPowerLimit = ( mode < RTC_LP_MODE_NUM ) ? mode : RTC_LP_STOP3;
+}
+
+void RtcGetLowPowerStats( RtcLowPowerStats_t *stats )
+{
+    TimerTime_t asleep = 0;
+    uint8_t i;
+
+    __disable_irq( );
+    for( i = RTC_LP_SLEEP; i < RTC_LP_MODE_NUM; i++ )
+    {
+        stats->Entries[i] = RtcLowPowerEntries[i];
+        stats->Residency[i] = RtcTick2Ms( RtcLowPowerTicks[i] );
+        asleep += RtcLowPowerTicks[i];
+    }
+    stats->Entries[RTC_LP_AWAKE] = 0;
+    stats->Residency[RTC_LP_AWAKE] = RtcTick2Ms( RtcGetTimerTicks( ) - RtcLowPowerStatsOrigin - asleep );
+    __enable_irq( );
+}
+
+void RtcResetLowPowerStats( void )
+{
+    uint8_t i;
+
+    __disable_irq( );
+    for( i = 0; i < RTC_LP_MODE_NUM; i++ )
+    {
+        RtcLowPowerEntries[i] = 0;
+        RtcLowPowerTicks[i] = 0;
+    }
+    RtcLowPowerStatsOrigin = RtcGetTimerTicks( );
+    __enable_irq( );
+}
+#endif
+
 //static void RtcComputeWakeUpTime( void )
 //{
 //    if( WakeUpTimeInitialized == false )
@@ -259,25 +848,57 @@ void RtcRecoverMcuStatus( void )
 
 static void RtcStartWakeUpAlarm( uint32_t timeout )
 {   
-    RtcCalendar_t now;
+    uint32_t ticks;
+
     if( timeout <= 5 )
     {
         timeout = 5;
     }
-
-    // Load the RTC calendar
-    now = RtcGetCalendar( );
-
-    // Save the calendar into RtcCalendarContext to be able to calculate the elapsed time
-    RtcCalendarContext = now;
+    ticks = RtcConvertMsToTick(timeout);
+#ifdef CONFIG_RTC_WAKEUP_CALIBRATION
+    // Fires earlier by the STOP exit latency so the handler runs on time
+    if( ticks >= ( RtcWakeUpTicks + RtcConvertMsToTick( 5 ) ) )
+    {
+        ticks -= RtcWakeUpTicks;
+    }
+#endif
 
     rtc_cyc_cmd(DISABLE);
-    rtc_config_cyc_max(RtcConvertMsToTick(timeout));
+    rtc_config_cyc_max(ticks);
     rtc_config_cyc_wakeup(ENABLE);
+#ifdef CONFIG_RTC_WAKEUP_CALIBRATION
+    RtcAlarmTicks = RtcGetTimerTicks( ) + ticks;
+#endif
     rtc_cyc_cmd(ENABLE);
     rtc_config_interrupt(RTC_CYC_IT, ENABLE);
 }
 
+#ifdef CONFIG_RTC_WAKEUP_CALIBRATION
+/*!
+ * \brief Updates the STOP exit latency estimate with a new sample
+ *
+ * \param [IN] sample Time between the alarm and its handler [RTC ticks]
+ */
+static void RtcUpdateWakeUpEstimate( TimerTime_t sample )
+{
+    if( sample > RTC_WAKEUP_MAX_SAMPLE )
+    {
+        return;
+    }
+
+    // Exponential moving average, 1/8 weight
+    RtcWakeUpEstimate = ( uint32_t )( ( int32_t )RtcWakeUpEstimate +
+                        ( ( int32_t )( sample << 4 ) - ( int32_t )RtcWakeUpEstimate ) / 8 );
+    RtcWakeUpTicks = ( RtcWakeUpEstimate + 8 ) >> 4;
+    McuWakeUpTime = ( uint32_t )( ( RtcTick2Us( RtcWakeUpTicks ) + 999 ) / 1000 );
+}
+
+TimerTime_t RtcGetMcuWakeUpTime( void )
+{
+    return RtcTick2Us( RtcWakeUpTicks );
+}
+#endif
+
 static TimerTime_t RtcConvertCalendarTickToTimerTime( RtcCalendar_t *calendar )
 {
     TimerTime_t timeCounter = 0;
@@ -336,14 +957,7 @@ static TimerTime_t RtcConvertCalendarTickToTimerTime( RtcCalendar_t *calendar )
 
 TimerTime_t RtcConvertMsToTick( TimerTime_t timeoutValue )
 {
-    double retVal = 0;
-    uint32_t rtc_ticks_per_second = 32768;
-	
-    if (RCC_RTC_CLK_SOURCE_RCO32K == rcc_get_rtc_clk_source())
-        rtc_ticks_per_second = 32000;
-	
-    retVal = round( ( ( double )timeoutValue ) * rtc_ticks_per_second / 1000);
-    return( ( TimerTime_t )retVal );
+    return RtcMs2Tick( timeoutValue );
 }
 
 static RtcCalendar_t RtcGetCalendar( void )
@@ -360,9 +974,19 @@ static RtcCalendar_t RtcGetCalendar( void )
 void RtcOnIrq( void )
 {
     uint8_t intr_stat;
+#ifdef CONFIG_RTC_WAKEUP_CALIBRATION
+    TimerTime_t now = RtcGetTimerTicks( );
+#endif
     intr_stat =  rtc_get_status(RTC_CYC_SR);
  
     if( intr_stat == true ) {
+#ifdef CONFIG_RTC_WAKEUP_CALIBRATION
+        if( ( RtcInStopMode == true ) && ( now >= RtcAlarmTicks ) )
+        {
+            // The alarm woke the MCU up
+            RtcUpdateWakeUpEstimate( now - RtcAlarmTicks );
+        }
+#endif
         
         rtc_cyc_cmd(DISABLE);
         rtc_config_interrupt(RTC_CYC_IT, DISABLE); // disable
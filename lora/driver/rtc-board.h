@@ -40,6 +40,27 @@
  */
 void RtcInit( void );
 
+/*!
+ * \brief Tells whether the RTC timer runs, \ref RtcInit called
+ *
+ * \retval initialized True once initialized
+ */
+bool RtcIsInitialized( void );
+
+#ifdef CONFIG_WARM_BOOT
+/*!
+ * \brief Waits for the XO32K to run at its frequency, against the core clock
+ *
+ * \remark Returns within a few milliseconds when the crystal kept running
+ *         across a reset, replaces a fixed start up delay.
+ *
+ * \param [IN] timeout Longest wait [ms]
+ *
+ * \retval stable      false when the timeout elapsed first
+ */
+bool RtcWaitXo32kStable( uint32_t timeout );
+#endif
+
 /*!
  * \brief Start the RTC timer
  *
@@ -73,6 +94,82 @@ TimerTime_t RtcGetAdjustedTimeoutValue( uint32_t timeout );
  */
 TimerTime_t RtcGetTimerValue( void );
 
+/*!
+ * \brief Get the free running RTC tick counter
+ *
+ * \remark Counts at the RTC clock rate, 32768 Hz on the XO32K or 32000 Hz on
+ *         the RCO32K. Only converts the calendar date once a day.
+ *
+ * \retval ticks RTC ticks since the time base origin
+ */
+TimerTime_t RtcGetTimerTicks( void );
+
+/*!
+ * \brief Converts RTC ticks into milliseconds, truncated
+ *
+ * \param[IN] ticks RTC ticks
+ * \retval time Time in ms
+ */
+TimerTime_t RtcTick2Ms( TimerTime_t ticks );
+
+/*!
+ * \brief Converts RTC ticks into microseconds, truncated
+ *
+ * \param[IN] ticks RTC ticks
+ * \retval time Time in us
+ */
+TimerTime_t RtcTick2Us( TimerTime_t ticks );
+
+/*!
+ * \brief Converts milliseconds into RTC ticks, rounded
+ *
+ * \param[IN] time Time in ms
+ * \retval ticks RTC ticks
+ */
+TimerTime_t RtcMs2Tick( TimerTime_t time );
+
+/*!
+ * \brief Converts microseconds into RTC ticks, rounded
+ *
+ * \param[IN] time Time in us
+ * \retval ticks RTC ticks
+ */
+TimerTime_t RtcUs2Tick( TimerTime_t time );
+
+#ifdef CONFIG_RTC_WAKEUP_CALIBRATION
+/*!
+ * \brief Gets the measured STOP exit latency
+ *
+ * \remark Measured on every RTC alarm waking the MCU up from a STOP mode,
+ *         the RTC and LPTIMER0 alarms are advanced by it. McuWakeUpTime
+ *         holds it rounded up in ms.
+ *
+ * \retval time Running STOP exit latency estimate [us]
+ */
+TimerTime_t RtcGetMcuWakeUpTime( void );
+#endif
+
+#ifdef CONFIG_TIMER_PRECISE
+/*!
+ * \brief Starts the one shot LPTIMER0 timeout, clocked like the RTC
+ *
+ * \remark Calls TimerPreciseIrqHandler on expiry, also from STOP mode.
+ *
+ * \param[IN] ticks Timeout in RTC ticks, at most 0xFFFF
+ */
+void RtcSetPreciseTimeout( uint32_t ticks );
+
+/*!
+ * \brief Stops the LPTIMER0 timeout
+ */
+void RtcStopPreciseTimeout( void );
+
+/*!
+ * \brief LPTIMER0 IRQ handler of the precise timeouts
+ */
+void RtcOnPreciseIrq( void );
+#endif
+
 /*!
  * \brief Get the RTC timer elapsed time since the last Alarm was set
  *
@@ -113,6 +210,101 @@ void RtcEnterLowPowerStopMode( void );
  */
 void RtcRecoverMcuStatus( void );
 
+/*!
+ * \brief Computes the temperature compensation for a period of time on a
+ *        specific temperature.
+ *
+ * \remark Uses the parabolic frequency deviation of the 32.768 kHz tuning
+ *         fork crystal, RTC_TEMP_COEFFICIENT ppm/C^2 around its turnover
+ *         temperature RTC_TEMP_TURNOVER. The deviation margins push the
+ *         result to the short side so that the RX windows open early rather
+ *         than late.
+ *
+ * \param [IN] period Time period to compensate [ms]
+ * \param [IN] temperature Current temperature [C]
+ *
+ * \retval Compensated time period [ms]
+ */
+TimerTime_t RtcTempCompensation( TimerTime_t period, float temperature );
+
+#ifdef CONFIG_RTC_DISCIPLINE
+/*!
+ * \brief Disciplines the RTC frequency with a reference time sample
+ *
+ * \remark The first sample anchors the measurement. Once the reference has
+ *         advanced by RTC_DISCIPLINE_SPAN_MIN, the drift of the RTC over the
+ *         span is folded into the hardware PPM trim. Errors above
+ *         RTC_DISCIPLINE_PPM_MAX are taken for a time step and only re-anchor.
+ *
+ * \param [IN] localTime RTC time of the sample, RtcGetTimerValue [ms]
+ * \param [IN] refTime   Network time of the same instant [ms]
+ */
+void RtcDisciplineUpdate( TimerTime_t localTime, TimerTime_t refTime );
+
+/*!
+ * \brief Returns the PPM trim currently applied to the RTC
+ *
+ * \retval Trim [0.5 ppm], positive when the RTC is sped up
+ */
+int16_t RtcGetPpmTrim( void );
+#endif
+
+#ifdef CONFIG_LOWPOWER_GOVERNOR
+/*!
+ * \brief Low power modes picked by the governor, from the lightest
+ */
+typedef enum
+{
+    RTC_LP_AWAKE = 0,   //!< Stays in run mode
+    RTC_LP_SLEEP,       //!< Sleep, core clock gated, wakes on any interrupt
+    RTC_LP_STOP0,       //!< Deep sleep modes, wake up latency increasing
+    RTC_LP_STOP1,
+    RTC_LP_STOP2,
+    RTC_LP_STOP3,
+    RTC_LP_MODE_NUM,
+}RtcLowPowerMode_t;
+
+/*!
+ * \brief Low power residency statistics since the last reset
+ */
+typedef struct RtcLowPowerStats_s
+{
+    uint32_t Entries[RTC_LP_MODE_NUM];      //!< Number of times each mode was entered
+    TimerTime_t Residency[RTC_LP_MODE_NUM]; //!< Time spent in each mode [ms]
+}RtcLowPowerStats_t;
+
+/*!
+ * \brief Enters the deepest low power mode whose break-even time fits before
+ *        the next timer expiry
+ *
+ * \remark Sleeps only while the radio is busy or the low power mode is
+ *         blocked by BlockLowPowerDuringTask, and stays awake when a radio
+ *         interrupt has not been processed yet or a timer is due.
+ */
+void RtcEnterLowPower( void );
+
+/*!
+ * \brief Sets the deepest low power mode the governor may use
+ *
+ * \remark e.g. RTC_LP_SLEEP while a UART is receiving.
+ *
+ * \param [IN] mode Deepest allowed mode, RTC_LP_STOP3 by default
+ */
+void RtcSetLowPowerLimit( RtcLowPowerMode_t mode );
+
+/*!
+ * \brief Gets the low power residency statistics
+ *
+ * \param [OUT] stats Statistics, RTC_LP_AWAKE holds the time spent running
+ */
+void RtcGetLowPowerStats( RtcLowPowerStats_t *stats );
+
+/*!
+ * \brief Resets the low power residency statistics
+ */
+void RtcResetLowPowerStats( void );
+#endif
+
 /*!
  * \brief Processes pending timer events
  */
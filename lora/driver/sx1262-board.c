@@ -1,293 +1,704 @@
-/*!
- * \file      sx1262dvk1cas-board.c
- *
- * \brief     Target board SX1262DVK1CAS shield driver implementation
- *
- * \copyright Revised BSD License, see section \ref LICENSE.
- *
- * \code
- *                ______                              _
- *               / _____)             _              | |
- *              ( (____  _____ ____ _| |_ _____  ____| |__
- *               \____ \| ___ |    (_   _) ___ |/ ___)  _ \
- *               _____) ) ____| | | || |_| ____( (___| | | |
- *              (______/|_____)_|_|_| \__)_____)\____)_| |_|
- *              (C)2013-2017 Semtech
- *
- * \endcode
- *
- * \author    Miguel Luis ( Semtech )
- *
- * \author    Gregory Cristian ( Semtech )
- */
-#include <stdlib.h>
-#include "delay.h"
-#include "tremo_gpio.h"
-#include "tremo_regs.h"
-#include "tremo_delay.h"
-#include "radio.h"
-#include "lora_config.h"
-#include "sx126x-board.h"
-
-#define BOARD_TCXO_WAKEUP_TIME 5
-uint8_t gPaOptSetting = 0;
-
-void BoardDisableIrq( void )
-{
-    __disable_irq();
-}
-
-void BoardEnableIrq( void )
-{
-    __enable_irq();
-}
-
-uint16_t SpiInOut( uint16_t outData )
-{
-    uint8_t read_data = 0;
-    
-    LORAC->SSP_DR = outData;
-	
-	while(1) {
-		uint32_t status = LORAC->SSP_SR;
-		if(((status & 0x01) == 0x01) && ((status & 0x10)==0)) break;
-	}
-	
-	read_data = LORAC->SSP_DR & 0xFF;
-
-    return( read_data );
-}
-
-
-void SX126xLoracInit()
-{
-	LORAC->CR0 = 0x00000200;
-
-    LORAC->SSP_CR0 = 0x07;
-    LORAC->SSP_CPSR = 0x02;
-
-    //wakeup lora 
-    //avoid always waiting busy after main reset or soft reset
-    if(LORAC->CR1 != 0x80)
-    {
-        delay_us(20);
-        LORAC->NSS_CR = 0;
-        delay_us(20);
-        LORAC->NSS_CR = 1;
-    }
-
-    LORAC->SSP_CR1 = 0x02;
-    
-    NVIC_EnableIRQ(LORA_IRQn);
-    //NVIC_SetPriority(LORAC_IRQn, 2);
-    
-    if(CONFIG_LORA_RFSW_CTRL_PIN == GPIO_PIN_10)
-        gpio_set_iomux(GPIOD, CONFIG_LORA_RFSW_CTRL_PIN, 6);
-    else
-        gpio_set_iomux(GPIOD, CONFIG_LORA_RFSW_CTRL_PIN, 3);
-}
-
-
-uint32_t SX126xGetBoardTcxoWakeupTime( void )
-{
-    return BOARD_TCXO_WAKEUP_TIME;
-}
-
-void SX126xReset( void )
-{
-    LORAC->CR1 &= ~(1<<5);  //nreset
-    delay_us(100);
-    LORAC->CR1 |= 1<<5;    //nreset release
-    LORAC->CR1 &= ~(1<<7); //por release
-    LORAC->CR0 |= 1<<5; //irq0
-    LORAC->CR1 |= 0x1;  //tcxo
-    
-    while((LORAC->SR & 0x100));  
-}
-
-void SX126xWaitOnBusy( void )
-{
-    delay_us(10);
-    while( LORAC->SR & 0x100 );
-}
-
-void SX126xWakeup( void )
-{
-    BoardDisableIrq( );
-
-    LORAC->NSS_CR = 0;
-    delay_us(20);
-
-    SpiInOut( RADIO_GET_STATUS );
-    SpiInOut( 0x00 );
-
-    LORAC->NSS_CR = 1;
-
-    // Wait for chip to be ready.
-    SX126xWaitOnBusy( );
-
-    BoardEnableIrq( );
-}
-
-void SX126xWriteCommand( RadioCommands_t command, uint8_t *buffer, uint16_t size )
-{
-    SX126xCheckDeviceReady( );
-
-    LORAC->NSS_CR = 0;
-
-    SpiInOut( ( uint8_t )command );
-
-    for( uint16_t i = 0; i < size; i++ )
-    {
-        SpiInOut( buffer[i] );
-    }
-
-    LORAC->NSS_CR = 1;
-
-    if( command != RADIO_SET_SLEEP )
-    {
-        SX126xWaitOnBusy( );
-    }
-}
-
-void SX126xReadCommand( RadioCommands_t command, uint8_t *buffer, uint16_t size )
-{
-    SX126xCheckDeviceReady( );
-
-    LORAC->NSS_CR = 0;
-
-    SpiInOut( ( uint8_t )command );
-    SpiInOut( 0x00 );
-    for( uint16_t i = 0; i < size; i++ )
-    {
-        buffer[i] = SpiInOut( 0 );
-    }
-
-    LORAC->NSS_CR = 1;
-
-    SX126xWaitOnBusy( );
-}
-
-void SX126xWriteRegisters( uint16_t address, uint8_t *buffer, uint16_t size )
-{
-    SX126xCheckDeviceReady( );
-
-    LORAC->NSS_CR = 0;
-    
-    SpiInOut( RADIO_WRITE_REGISTER );
-    SpiInOut( ( address & 0xFF00 ) >> 8 );
-    SpiInOut( address & 0x00FF );
-    
-    for( uint16_t i = 0; i < size; i++ )
-    {
-        SpiInOut( buffer[i] );
-    }
-
-    LORAC->NSS_CR = 1;
-
-    SX126xWaitOnBusy( );
-}
-
-void SX126xWriteRegister( uint16_t address, uint8_t value )
-{
-    SX126xWriteRegisters( address, &value, 1 );
-}
-
-void SX126xReadRegisters( uint16_t address, uint8_t *buffer, uint16_t size )
-{
-    SX126xCheckDeviceReady( );
-
-    LORAC->NSS_CR = 0;
-
-    SpiInOut( RADIO_READ_REGISTER );
-    SpiInOut( ( address & 0xFF00 ) >> 8 );
-    SpiInOut( address & 0x00FF );
-    SpiInOut( 0 );
-    for( uint16_t i = 0; i < size; i++ )
-    {
-        buffer[i] = SpiInOut( 0 );
-    }
-    LORAC->NSS_CR = 1;
-
-    SX126xWaitOnBusy( );
-}
-
-uint8_t SX126xReadRegister( uint16_t address )
-{
-    uint8_t data;
-    SX126xReadRegisters( address, &data, 1 );
-    return data;
-}
-
-void SX126xWriteBuffer( uint8_t offset, uint8_t *buffer, uint8_t size )
-{
-    SX126xCheckDeviceReady( );
-
-    LORAC->NSS_CR = 0;
-
-    SpiInOut( RADIO_WRITE_BUFFER );
-    SpiInOut( offset );
-    for( uint16_t i = 0; i < size; i++ )
-    {
-        SpiInOut( buffer[i] );
-    }
-    LORAC->NSS_CR = 1;
-
-    SX126xWaitOnBusy( );
-}
-
-void SX126xReadBuffer( uint8_t offset, uint8_t *buffer, uint8_t size )
-{
-    SX126xCheckDeviceReady( );
-
-    LORAC->NSS_CR = 0;
-
-    SpiInOut( RADIO_READ_BUFFER );
-    SpiInOut( offset );
-    SpiInOut( 0 );
-    for( uint16_t i = 0; i < size; i++ )
-    {
-        buffer[i] = SpiInOut( 0 );
-    }
-    LORAC->NSS_CR = 1;
-    
-    SX126xWaitOnBusy( );
-}
-
-void SX126xSetRfTxPower( int8_t power )
-{
-    SX126xSetTxParams( power, RADIO_RAMP_40_US );
-}
-
-uint8_t SX126xGetPaSelect( uint32_t channel )
-{
-    return SX1262;
-}
-
-void SX126xAntSwOn( void )
-{
-    gpio_init(CONFIG_LORA_RFSW_VDD_GPIOX, CONFIG_LORA_RFSW_VDD_PIN, GPIO_MODE_OUTPUT_PP_HIGH);  
-}
-
-void SX126xAntSwOff( void )
-{
-    gpio_init(CONFIG_LORA_RFSW_VDD_GPIOX, CONFIG_LORA_RFSW_VDD_PIN, GPIO_MODE_OUTPUT_PP_LOW);  
-}
-
-bool SX126xCheckRfFrequency( uint32_t frequency )
-{
-    // Implement check. Currently all frequencies are supported
-    return true;
-}
-
-uint8_t SX126xGetPaOpt( )
-{
-    return gPaOptSetting;
-}
-
-void SX126xSetPaOpt( uint8_t opt )
-{
-    if(opt>3) return;
-    
-    gPaOptSetting = opt;
-}
+/*!
+ * \file      sx1262dvk1cas-board.c
+ *
+ * \brief     Target board SX1262DVK1CAS shield driver implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \code
+ *                ______                              _
+ *               / _____)             _              | |
+ *              ( (____  _____ ____ _| |_ _____  ____| |__
+ *               \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ *               _____) ) ____| | | || |_| ____( (___| | | |
+ *              (______/|_____)_|_|_| \__)_____)\____)_| |_|
+ *              (C)2013-2017 Semtech
+ *
+ * \endcode
+ *
+ * \author    Miguel Luis ( Semtech )
+ *
+ * \author    Gregory Cristian ( Semtech )
+ */
+#include <stdlib.h>
+#include "delay.h"
+#include "tremo_gpio.h"
+#include "tremo_regs.h"
+#include "tremo_delay.h"
+#include "radio.h"
+#include "lora_config.h"
+#include "tremo_spi.h"
+#include "sx126x-board.h"
+#include "profile.h"
+#include "watchdog.h"
+#ifdef CONFIG_LORA_SPI_DMA
+#include <string.h>
+#include "tremo_rcc.h"
+#include "tremo_dma.h"
+#include "tremo_dma_handshake.h"
+#endif
+
+#define BOARD_TCXO_WAKEUP_TIME 5
+
+#ifdef CONFIG_LORA_BUSY_SLEEP
+#ifndef CONFIG_LORA_BUSY_TIMEOUT
+#define CONFIG_LORA_BUSY_TIMEOUT 100 // ms
+#endif
+
+/*!
+ * Called when a sleeping BUSY wait runs out of time
+ */
+static SX126xBusyTimeoutCallback_t BusyTimeoutCallback = NULL;
+#endif
+
+/*!
+ * Depth of the LORAC SSP TX and RX FIFOs
+ */
+#define SPI_FIFO_DEPTH         8
+uint8_t gPaOptSetting = 0;
+
+void BoardDisableIrq( void )
+{
+    __disable_irq();
+}
+
+void BoardEnableIrq( void )
+{
+    __enable_irq();
+}
+
+RAM_FUNC_ATTR void SX126xIoIrqDisable( void )
+{
+    NVIC_DisableIRQ( LORA_IRQn );
+}
+
+void SX126xIoIrqEnable( void )
+{
+    NVIC_ClearPendingIRQ( LORA_IRQn );
+    NVIC_EnableIRQ( LORA_IRQn );
+}
+
+HOT_FUNC_ATTR uint16_t SpiInOut( uint16_t outData )
+{
+    uint8_t read_data = 0;
+    
+    LORAC->SSP_DR = outData;
+	
+	while(1) {
+		uint32_t status = LORAC->SSP_SR;
+		if(((status & 0x01) == 0x01) && ((status & 0x10)==0)) break;
+	}
+	
+	read_data = LORAC->SSP_DR & 0xFF;
+
+    return( read_data );
+}
+
+HOT_FUNC_ATTR void SpiTransfer( uint8_t *txBuffer, uint8_t *rxBuffer, uint16_t size )
+{
+    uint16_t txCount = 0;
+    uint16_t rxCount = 0;
+    uint8_t data;
+
+    while( rxCount < size )
+    {
+        // Keep the TX FIFO topped up, but never push more than the RX FIFO
+        // can hold or received bytes would be dropped
+        while( ( txCount < size ) && ( ( uint16_t )( txCount - rxCount ) < SPI_FIFO_DEPTH ) &&
+               ( LORAC->SSP_SR & SSP_FLAG_TX_FIFO_NOT_FULL ) )
+        {
+            LORAC->SSP_DR = ( txBuffer != NULL ) ? txBuffer[txCount] : 0x00;
+            txCount++;
+        }
+
+        while( LORAC->SSP_SR & SSP_FLAG_RX_FIFO_NOT_EMPTY )
+        {
+            data = LORAC->SSP_DR & 0xFF;
+            if( rxBuffer != NULL )
+            {
+                rxBuffer[rxCount] = data;
+            }
+            rxCount++;
+        }
+    }
+}
+
+#ifdef CONFIG_LORA_SPI_DMA
+/*!
+ * DMA controller and channels reserved for the LORAC SSP.
+ * DMA0 channel 0 is used by the debug printf when PRINT_BY_DMA is set.
+ */
+#ifndef CONFIG_LORA_SPI_DMA_NUM
+#define CONFIG_LORA_SPI_DMA_NUM     1
+#endif
+#ifndef CONFIG_LORA_SPI_DMA_TX_CH
+#define CONFIG_LORA_SPI_DMA_TX_CH   2
+#endif
+#ifndef CONFIG_LORA_SPI_DMA_RX_CH
+#define CONFIG_LORA_SPI_DMA_RX_CH   3
+#endif
+
+/*!
+ * Below this size the DMA setup costs more than polling the SSP
+ */
+#define SPI_DMA_MIN_SIZE            16
+
+static dma_dev_t SpiDmaTx;
+static dma_dev_t SpiDmaRx;
+static bool SpiDmaRxUsed = false;
+static volatile bool SpiDmaBusy = false;
+static SX126xSpiDoneCallback_t SpiDmaDoneCallback = NULL;
+
+static void SpiDmaStop( void )
+{
+    SX126xSpiDoneCallback_t callback = SpiDmaDoneCallback;
+
+    LORAC->SSP_DMA_CR = 0;
+    dma_finalize( &SpiDmaTx );
+    if( SpiDmaRxUsed == true )
+    {
+        dma_finalize( &SpiDmaRx );
+    }
+    LORAC->NSS_CR = 1;
+
+    SpiDmaDoneCallback = NULL;
+    SpiDmaBusy = false;
+
+    if( callback != NULL )
+    {
+        callback( );
+    }
+}
+
+static void SpiDmaOnTxDone( void )
+{
+    // The last bytes are still in the SSP FIFO when the TX block completes
+    while( LORAC->SSP_SR & SSP_FLAG_BUSY );
+
+    // Nothing was reading the RX side, throw away what is left and the overrun
+    while( LORAC->SSP_SR & SSP_FLAG_RX_FIFO_NOT_EMPTY )
+    {
+        ( void )LORAC->SSP_DR;
+    }
+    LORAC->SSP_ICR = SSP_INTERRUPT_RX_FIFO_OVERRUN;
+
+    SpiDmaStop( );
+}
+
+static void SpiDmaOnRxDone( void )
+{
+    SpiDmaStop( );
+}
+
+static void SpiDmaStart( uint8_t *txBuffer, uint8_t *rxBuffer, uint16_t size, SX126xSpiDoneCallback_t callback )
+{
+    SpiDmaBusy = true;
+    SpiDmaDoneCallback = callback;
+    SpiDmaRxUsed = ( rxBuffer != NULL );
+
+    if( SpiDmaRxUsed == true )
+    {
+        SpiDmaRx.dma_num    = CONFIG_LORA_SPI_DMA_NUM;
+        SpiDmaRx.ch         = CONFIG_LORA_SPI_DMA_RX_CH;
+        SpiDmaRx.mode       = P2M_MODE;
+        SpiDmaRx.src        = ( uint32_t )&( LORAC->SSP_DR );
+        SpiDmaRx.dest       = ( uint32_t )rxBuffer;
+        SpiDmaRx.priv       = ( dma_callback_func )SpiDmaOnRxDone;
+        SpiDmaRx.data_width = 0;
+        SpiDmaRx.block_size = size;
+        SpiDmaRx.src_msize  = 0;
+        SpiDmaRx.dest_msize = 0;
+        SpiDmaRx.handshake  = DMA_HANDSHAKE_LORAC_RX;
+
+        dma_init( &SpiDmaRx );
+        dma_ch_enable( SpiDmaRx.dma_num, SpiDmaRx.ch );
+    }
+
+    SpiDmaTx.dma_num    = CONFIG_LORA_SPI_DMA_NUM;
+    SpiDmaTx.ch         = CONFIG_LORA_SPI_DMA_TX_CH;
+    SpiDmaTx.mode       = M2P_MODE;
+    SpiDmaTx.src        = ( uint32_t )txBuffer;
+    SpiDmaTx.dest       = ( uint32_t )&( LORAC->SSP_DR );
+    // On a read the RX channel signals the end of the transfer
+    SpiDmaTx.priv       = ( SpiDmaRxUsed == true ) ? NULL : ( dma_callback_func )SpiDmaOnTxDone;
+    SpiDmaTx.data_width = 0;
+    SpiDmaTx.block_size = size;
+    SpiDmaTx.src_msize  = 1;
+    SpiDmaTx.dest_msize = 1;
+    SpiDmaTx.handshake  = DMA_HANDSHAKE_LORAC_TX;
+
+    dma_init( &SpiDmaTx );
+    dma_ch_enable( SpiDmaTx.dma_num, SpiDmaTx.ch );
+
+    LORAC->SSP_DMA_CR = ( SpiDmaRxUsed == true ) ? ( SSP_DMA_TX_EN | SSP_DMA_RX_EN ) : SSP_DMA_TX_EN;
+}
+
+bool SX126xSpiIsBusy( void )
+{
+    return SpiDmaBusy;
+}
+#else
+bool SX126xSpiIsBusy( void )
+{
+    return false;
+}
+#endif
+
+HOT_FUNC_ATTR bool SX126xSpiIsSelected( void )
+{
+    return ( LORAC->NSS_CR == 0 ) || ( SX126xSpiIsBusy( ) == true );
+}
+
+/*!
+ * \brief Streams the data phase of a command and releases NSS when done
+ */
+static HOT_FUNC_ATTR void SpiWritePayload( uint8_t *buffer, uint16_t size, SX126xSpiDoneCallback_t callback )
+{
+#ifdef CONFIG_LORA_SPI_DMA
+    if( size >= SPI_DMA_MIN_SIZE )
+    {
+        SpiDmaStart( buffer, NULL, size, callback );
+        return;
+    }
+#endif
+    SpiTransfer( buffer, NULL, size );
+    LORAC->NSS_CR = 1;
+
+    if( callback != NULL )
+    {
+        callback( );
+    }
+}
+
+/*!
+ * \brief Reads the data phase of a command and releases NSS when done
+ */
+static HOT_FUNC_ATTR void SpiReadPayload( uint8_t *buffer, uint16_t size, SX126xSpiDoneCallback_t callback )
+{
+#ifdef CONFIG_LORA_SPI_DMA
+    if( size >= SPI_DMA_MIN_SIZE )
+    {
+        // The zeroed buffer doubles as the dummy TX source: a byte is always
+        // clocked out before the same position is written back by the RX channel
+        memset( buffer, 0, size );
+        SpiDmaStart( buffer, buffer, size, callback );
+        return;
+    }
+#endif
+    SpiTransfer( NULL, buffer, size );
+    LORAC->NSS_CR = 1;
+
+    if( callback != NULL )
+    {
+        callback( );
+    }
+}
+
+
+void SX126xLoracInit()
+{
+#ifdef CONFIG_LORA_SPI_DMA
+    rcc_enable_peripheral_clk( RCC_PERIPHERAL_SYSCFG, true );
+    rcc_enable_peripheral_clk( ( CONFIG_LORA_SPI_DMA_NUM == 0 ) ? RCC_PERIPHERAL_DMA0 : RCC_PERIPHERAL_DMA1, true );
+#endif
+
+	LORAC->CR0 = 0x00000200;
+
+    LORAC->SSP_CR0 = 0x07;
+    LORAC->SSP_CPSR = 0x02;
+
+    //wakeup lora 
+    //avoid always waiting busy after main reset or soft reset
+    if(LORAC->CR1 != 0x80)
+    {
+        delay_us(20);
+        LORAC->NSS_CR = 0;
+        delay_us(20);
+        LORAC->NSS_CR = 1;
+    }
+
+    LORAC->SSP_CR1 = 0x02;
+    
+    NVIC_EnableIRQ(LORA_IRQn);
+    //NVIC_SetPriority(LORAC_IRQn, 2);
+    
+    if(CONFIG_LORA_RFSW_CTRL_PIN == GPIO_PIN_10)
+        gpio_set_iomux(GPIOD, CONFIG_LORA_RFSW_CTRL_PIN, 6);
+    else
+        gpio_set_iomux(GPIOD, CONFIG_LORA_RFSW_CTRL_PIN, 3);
+}
+
+
+uint32_t SX126xGetBoardTcxoWakeupTime( void )
+{
+    return BOARD_TCXO_WAKEUP_TIME;
+}
+
+#ifdef CONFIG_WARM_BOOT
+bool SX126xIsOutOfReset( void )
+{
+    // A soft or watchdog reset of the MCU leaves the radio powered and running
+    return ( ( LORAC->CR1 & ( 1 << 5 ) ) != 0 ) && ( ( LORAC->CR1 & ( 1 << 7 ) ) == 0 );
+}
+#endif
+
+void SX126xReset( void )
+{
+    LORAC->CR1 &= ~(1<<5);  //nreset
+    delay_us(100);
+    LORAC->CR1 |= 1<<5;    //nreset release
+    LORAC->CR1 &= ~(1<<7); //por release
+    LORAC->CR0 |= 1<<5; //irq0
+    LORAC->CR1 |= 0x1;  //tcxo
+    
+#ifdef CONFIG_LORA_BUSY_SLEEP
+    SX126xWaitOnBusySleep( CONFIG_LORA_BUSY_TIMEOUT );
+#else
+    while((LORAC->SR & 0x100));  
+#endif
+
+#ifdef CONFIG_LORA_SHADOW_REGS
+    SX126xShadowInvalidate( );
+#endif
+}
+
+HOT_FUNC_ATTR void SX126xWaitOnBusy( void )
+{
+#ifdef CONFIG_LORA_SPI_DMA
+    // Let a pending burst transfer finish before the next command
+    while( SpiDmaBusy );
+#endif
+    delay_us(10);
+    WATCHDOG_TASK_BEGIN( WATCHDOG_TASK_RADIO );
+    while( LORAC->SR & 0x100 );
+    WATCHDOG_TASK_END( WATCHDOG_TASK_RADIO );
+}
+
+#ifdef CONFIG_LORA_CMD_BATCH
+/*!
+ * Nesting of SX126xBatchBegin
+ */
+static uint8_t BatchDepth = 0;
+
+/*!
+ * Set when a write command of a batch left its BUSY wait to the next one
+ */
+static volatile bool BatchBusy = false;
+
+void SX126xBatchBegin( void )
+{
+    BatchDepth++;
+}
+
+void SX126xBatchEnd( void )
+{
+    if( ( BatchDepth > 0 ) && ( --BatchDepth == 0 ) && ( BatchBusy == true ) )
+    {
+        BatchBusy = false;
+        SX126xWaitOnBusy( );
+    }
+}
+
+/*!
+ * \brief Waits for the command left busy by the batch, before the next one
+ *
+ * The next command was prepared meanwhile and the BUSY pin rises within
+ * 600 ns of NSS, a 1 us guard replaces the 10 us one of SX126xWaitOnBusy
+ */
+static HOT_FUNC_ATTR void BatchSync( void )
+{
+    if( BatchBusy == false )
+    {
+        return;
+    }
+    BatchBusy = false;
+#ifdef CONFIG_LORA_SPI_DMA
+    while( SpiDmaBusy );
+#endif
+    delay_us(1);
+    while( LORAC->SR & 0x100 );
+}
+
+/*!
+ * \brief Ends a write command, the BUSY wait left to the next command of a
+ *        batch
+ */
+static HOT_FUNC_ATTR void BatchWaitOnBusy( void )
+{
+    if( BatchDepth > 0 )
+    {
+        BatchBusy = true;
+        return;
+    }
+    SX126xWaitOnBusy( );
+}
+#else
+#define BatchSync( )
+#define BatchWaitOnBusy( )      SX126xWaitOnBusy( )
+#endif
+
+#ifdef CONFIG_LORA_BUSY_SLEEP
+void SX126xSetBusyTimeoutCallback( SX126xBusyTimeoutCallback_t callback )
+{
+    BusyTimeoutCallback = callback;
+}
+
+bool SX126xWaitOnBusySleep( uint32_t timeout )
+{
+    uint32_t elapsed = 0;
+    uint32_t scr;
+
+#ifdef CONFIG_LORA_SPI_DMA
+    while( SpiDmaBusy );
+#endif
+    delay_us(10);
+
+    // The LORAC has no BUSY edge interrupt, sleep until the next SysTick
+    // or peripheral interrupt instead. SLEEPDEEP is left set by
+    // pwr_deepsleep_wfi() and would stop SysTick, so drop it meanwhile
+    scr = SCB->SCR;
+    SCB->SCR = scr & ~SCB_SCR_SLEEPDEEP_Msk;
+    ( void )SysTick->CTRL; // clear COUNTFLAG
+
+    while( LORAC->SR & 0x100 )
+    {
+        __WFI( );
+        if( ( SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk ) && ( ++elapsed >= timeout ) )
+        {
+            SCB->SCR = scr;
+            if( BusyTimeoutCallback != NULL )
+            {
+                BusyTimeoutCallback( );
+            }
+            return false;
+        }
+    }
+    SCB->SCR = scr;
+    return true;
+}
+#endif
+
+void SX126xWakeup( void )
+{
+    BoardDisableIrq( );
+
+    LORAC->NSS_CR = 0;
+    delay_us(20);
+
+    SpiInOut( RADIO_GET_STATUS );
+    SpiInOut( 0x00 );
+
+    LORAC->NSS_CR = 1;
+
+    // Wait for chip to be ready.
+    SX126xWaitOnBusy( );
+
+    BoardEnableIrq( );
+}
+
+HOT_FUNC_ATTR void SX126xWriteCommand( RadioCommands_t command, uint8_t *buffer, uint16_t size )
+{
+    SX126xCheckDeviceReady( );
+    BatchSync( );
+
+    LORAC->NSS_CR = 0;
+
+    SpiInOut( ( uint8_t )command );
+    SpiTransfer( buffer, NULL, size );
+
+    LORAC->NSS_CR = 1;
+
+#ifdef CONFIG_LORA_BUSY_SLEEP
+    // Calibrations keep the modem busy for milliseconds
+    if( ( command == RADIO_CALIBRATE ) || ( command == RADIO_CALIBRATEIMAGE ) )
+    {
+        SX126xWaitOnBusySleep( CONFIG_LORA_BUSY_TIMEOUT );
+        return;
+    }
+#endif
+    if( command != RADIO_SET_SLEEP )
+    {
+        BatchWaitOnBusy( );
+    }
+}
+
+HOT_FUNC_ATTR void SX126xReadCommand( RadioCommands_t command, uint8_t *buffer, uint16_t size )
+{
+    SX126xCheckDeviceReady( );
+    BatchSync( );
+
+    LORAC->NSS_CR = 0;
+
+    uint8_t header[2] = { ( uint8_t )command, 0x00 };
+
+    SpiTransfer( header, NULL, 2 );
+    SpiTransfer( NULL, buffer, size );
+
+    LORAC->NSS_CR = 1;
+
+    SX126xWaitOnBusy( );
+}
+
+HOT_FUNC_ATTR void SX126xWriteRegisters( uint16_t address, uint8_t *buffer, uint16_t size )
+{
+#ifdef CONFIG_LORA_SHADOW_REGS
+    if( SX126xShadowMatchRegisters( address, buffer, size ) == true )
+    {
+        return;
+    }
+#endif
+    SX126xCheckDeviceReady( );
+    BatchSync( );
+
+    LORAC->NSS_CR = 0;
+
+    uint8_t header[3] = { RADIO_WRITE_REGISTER, ( address & 0xFF00 ) >> 8, address & 0x00FF };
+
+    SpiTransfer( header, NULL, 3 );
+
+    SpiWritePayload( buffer, size, NULL );
+
+    BatchWaitOnBusy( );
+
+#ifdef CONFIG_LORA_SHADOW_REGS
+    SX126xShadowSetRegisters( address, buffer, size );
+#endif
+}
+
+void SX126xWriteRegister( uint16_t address, uint8_t value )
+{
+    SX126xWriteRegisters( address, &value, 1 );
+}
+
+HOT_FUNC_ATTR void SX126xReadRegisters( uint16_t address, uint8_t *buffer, uint16_t size )
+{
+#ifdef CONFIG_LORA_SHADOW_REGS
+    if( SX126xShadowGetRegisters( address, buffer, size ) == true )
+    {
+        return;
+    }
+#endif
+    SX126xCheckDeviceReady( );
+    BatchSync( );
+
+    LORAC->NSS_CR = 0;
+
+    uint8_t header[4] = { RADIO_READ_REGISTER, ( address & 0xFF00 ) >> 8, address & 0x00FF, 0x00 };
+
+    SpiTransfer( header, NULL, 4 );
+
+    SpiReadPayload( buffer, size, NULL );
+
+    SX126xWaitOnBusy( );
+
+#ifdef CONFIG_LORA_SHADOW_REGS
+    SX126xShadowSetRegisters( address, buffer, size );
+#endif
+}
+
+uint8_t SX126xReadRegister( uint16_t address )
+{
+    uint8_t data;
+    SX126xReadRegisters( address, &data, 1 );
+    return data;
+}
+
+HOT_FUNC_ATTR void SX126xWriteBufferAsync( uint8_t offset, uint8_t *buffer, uint8_t size, SX126xSpiDoneCallback_t callback )
+{
+    SX126xCheckDeviceReady( );
+    BatchSync( );
+
+    LORAC->NSS_CR = 0;
+
+    uint8_t header[2] = { RADIO_WRITE_BUFFER, offset };
+
+    SpiTransfer( header, NULL, 2 );
+
+    SpiWritePayload( buffer, size, callback );
+}
+
+HOT_FUNC_ATTR void SX126xReadBufferAsync( uint8_t offset, uint8_t *buffer, uint8_t size, SX126xSpiDoneCallback_t callback )
+{
+    SX126xCheckDeviceReady( );
+    BatchSync( );
+
+    LORAC->NSS_CR = 0;
+
+    uint8_t header[3] = { RADIO_READ_BUFFER, offset, 0x00 };
+
+    SpiTransfer( header, NULL, 3 );
+
+    SpiReadPayload( buffer, size, callback );
+}
+
+HOT_FUNC_ATTR void SX126xWriteBuffer( uint8_t offset, uint8_t *buffer, uint8_t size )
+{
+    SX126xWriteBufferAsync( offset, buffer, size, NULL );
+
+    BatchWaitOnBusy( );
+}
+
+HOT_FUNC_ATTR void SX126xReadBuffer( uint8_t offset, uint8_t *buffer, uint8_t size )
+{
+    PROFILE_START( PROFILE_RADIO_READ_BUFFER );
+    SX126xReadBufferAsync( offset, buffer, size, NULL );
+
+    SX126xWaitOnBusy( );
+    PROFILE_STOP( PROFILE_RADIO_READ_BUFFER );
+}
+
+void SX126xSetRfTxPower( int8_t power )
+{
+    SX126xSetTxParams( power, RADIO_RAMP_40_US );
+}
+
+uint8_t SX126xGetPaSelect( uint32_t channel )
+{
+    return SX1262;
+}
+
+/*!
+ * Set once the antenna switch supply pin is an output, later switches only
+ * write its level
+ */
+static bool AntSwInit = false;
+
+void SX126xAntSwOn( void )
+{
+    if( AntSwInit == false )
+    {
+        gpio_init(CONFIG_LORA_RFSW_VDD_GPIOX, CONFIG_LORA_RFSW_VDD_PIN, GPIO_MODE_OUTPUT_PP_HIGH);
+        AntSwInit = true;
+        return;
+    }
+    gpio_set(CONFIG_LORA_RFSW_VDD_GPIOX, CONFIG_LORA_RFSW_VDD_PIN);
+}
+
+void SX126xAntSwOff( void )
+{
+    if( AntSwInit == false )
+    {
+        gpio_init(CONFIG_LORA_RFSW_VDD_GPIOX, CONFIG_LORA_RFSW_VDD_PIN, GPIO_MODE_OUTPUT_PP_LOW);
+        AntSwInit = true;
+        return;
+    }
+    gpio_reset(CONFIG_LORA_RFSW_VDD_GPIOX, CONFIG_LORA_RFSW_VDD_PIN);
+}
+
+bool SX126xCheckRfFrequency( uint32_t frequency )
+{
+    // Implement check. Currently all frequencies are supported
+    return true;
+}
+
+uint8_t SX126xGetPaOpt( )
+{
+    return gPaOptSetting;
+}
+
+void SX126xSetPaOpt( uint8_t opt )
+{
+    if(opt>3) return;
+    
+    gPaOptSetting = opt;
+}
@@ -28,8 +28,29 @@
 #include "sx126x/sx126x.h"
 
 
+/*!
+ * \brief Completion callback of an asynchronous radio buffer transfer
+ */
+typedef void ( *SX126xSpiDoneCallback_t )( void );
+
+/*!
+ * \brief Called when the radio BUSY line did not drop in time
+ */
+typedef void ( *SX126xBusyTimeoutCallback_t )( void );
+
 void SX126xLoracInit();
 
+/*!
+ * \brief Full duplex transfer on the LORAC SSP keeping its FIFO filled
+ *
+ * \remark NSS is left untouched, the caller frames the transaction.
+ *
+ * \param [in]  txBuffer      Bytes to send, NULL to clock out zeros
+ * \param [out] rxBuffer      Received bytes, NULL to discard them
+ * \param [in]  size          Number of bytes to transfer
+ */
+void SpiTransfer( uint8_t *txBuffer, uint8_t *rxBuffer, uint16_t size );
+
 /*!
  * \brief Initializes the radio I/Os pins interface
  */
@@ -42,6 +63,16 @@ void SX126xIoInit( void );
  */
 void SX126xIoIrqInit( DioIrqHandler dioIrq );
 
+/*!
+ * \brief Masks the radio DIO interrupt line
+ */
+void SX126xIoIrqDisable( void );
+
+/*!
+ * \brief Unmasks the radio DIO interrupt line, a still asserted line fires again
+ */
+void SX126xIoIrqEnable( void );
+
 /*!
  * \brief De-initializes the radio I/Os pins interface.
  *
@@ -54,11 +85,55 @@ void SX126xIoDeInit( void );
  */
 void SX126xReset( void );
 
+#ifdef CONFIG_WARM_BOOT
+/*!
+ * \brief Tells if the radio was released from reset before this boot
+ *
+ * \retval running     false after a power on, the radio is still held in reset
+ */
+bool SX126xIsOutOfReset( void );
+#endif
+
 /*!
  * \brief Blocking loop to wait while the Busy pin in high
  */
 void SX126xWaitOnBusy( void );
 
+/*!
+ * \brief Opens a batch of commands, the batches nest
+ *
+ * \remark Only available with CONFIG_LORA_CMD_BATCH. Within a batch a write
+ *         command returns once sent, the next command waiting on the Busy
+ *         pin, so that the preparation of a command overlaps the processing
+ *         of the previous one by the radio
+ */
+void SX126xBatchBegin( void );
+
+/*!
+ * \brief Closes a batch, waits on the Busy pin after the outer one
+ */
+void SX126xBatchEnd( void );
+
+/*!
+ * \brief Waits while the Busy pin is high with the core sleeping
+ *
+ * \remark Only available with CONFIG_LORA_BUSY_SLEEP. The core is woken by
+ *         SysTick or any other interrupt, so this pays off for long
+ *         operations only. SX126xWaitOnBusy stays the blocking variant
+ *
+ * \param [in]  timeout       Maximum wait [ms]
+ *
+ * \retval      ready         false when the timeout elapsed
+ */
+bool SX126xWaitOnBusySleep( uint32_t timeout );
+
+/*!
+ * \brief Registers the handler called when SX126xWaitOnBusySleep times out
+ *
+ * \param [in]  callback      Timeout handler, may be NULL
+ */
+void SX126xSetBusyTimeoutCallback( SX126xBusyTimeoutCallback_t callback );
+
 /*!
  * \brief Wakes up the radio
  */
@@ -82,6 +157,50 @@ void SX126xWriteCommand( RadioCommands_t opcode, uint8_t *buffer, uint16_t size
  */
 void SX126xReadCommand( RadioCommands_t opcode, uint8_t *buffer, uint16_t size );
 
+/*!
+ * \brief Starts writing the radio payload buffer and returns without waiting
+ *
+ * \remark With CONFIG_LORA_SPI_DMA the data phase is streamed by DMA and the
+ *         callback runs from the DMA interrupt. Without it, or for short
+ *         transfers, the data is sent by polling and the callback runs before
+ *         returning. The buffer must stay valid until the callback.
+ *
+ * \param [in]  offset        Offset in the radio buffer
+ * \param [in]  buffer        Data to be written
+ * \param [in]  size          Number of bytes to write
+ * \param [in]  callback      Called once NSS is released, may be NULL
+ */
+void SX126xWriteBufferAsync( uint8_t offset, uint8_t *buffer, uint8_t size, SX126xSpiDoneCallback_t callback );
+
+/*!
+ * \brief Starts reading the radio payload buffer and returns without waiting
+ *
+ * \remark Same completion rules as SX126xWriteBufferAsync
+ *
+ * \param [in]  offset        Offset in the radio buffer
+ * \param [out] buffer        Destination of the data read
+ * \param [in]  size          Number of bytes to read
+ * \param [in]  callback      Called once NSS is released, may be NULL
+ */
+void SX126xReadBufferAsync( uint8_t offset, uint8_t *buffer, uint8_t size, SX126xSpiDoneCallback_t callback );
+
+/*!
+ * \brief Tells if an asynchronous buffer transfer is still running
+ *
+ * \retval busy          [true: transfer in progress, false: idle]
+ */
+bool SX126xSpiIsBusy( void );
+
+/*!
+ * \brief Tells if a command is being exchanged with the radio, NSS asserted
+ *
+ * \remark Lets an interrupt check that it does not cut into the SPI
+ *         transaction of the code it preempted
+ *
+ * \retval selected      [true: transaction in progress, false: idle]
+ */
+bool SX126xSpiIsSelected( void );
+
 /*!
  * \brief Write a single byte of data to the radio memory
  *
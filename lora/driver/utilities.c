@@ -23,6 +23,26 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "utilities.h"
+#ifdef CONFIG_RNG_POOL
+#include "rng-pool.h"
+#endif
+
+/*!
+ * Word access to the byte arrays, 4 bytes aligned
+ */
+#if defined( __GNUC__ )
+typedef uint32_t __attribute__( ( __may_alias__ ) ) UtilWord_t;
+#else
+typedef uint32_t UtilWord_t;
+#endif
+
+#if defined( __CC_ARM )
+#define UTIL_REV32( x )                             __rev( x )
+#else
+#define UTIL_REV32( x )                             __builtin_bswap32( x )
+#endif
+
+#define UTIL_ALIGNED( p )                           ( ( ( uintptr_t )( p ) & 3 ) == 0 )
 
 /*!
  * Redefinition of rand() and srand() standard C functions.
@@ -32,6 +52,18 @@
 // Standard random functions redefinition start
 #define RAND_LOCAL_MAX 2147483647L
 
+#ifdef CONFIG_RNG_POOL
+int32_t rand1( void )
+{
+    return RngPoolGet( ) % RAND_LOCAL_MAX;
+}
+
+void srand1( uint32_t seed )
+{
+    // Nothing to seed, the words come from the TRNG
+    ( void )seed;
+}
+#else
 static uint32_t next = 1;
 
 int32_t rand1( void )
@@ -43,6 +75,7 @@ void srand1( uint32_t seed )
 {
     next = seed;
 }
+#endif
 // Standard random functions redefinition end
 
 int32_t randr( int32_t min, int32_t max )
@@ -52,6 +85,44 @@ int32_t randr( int32_t min, int32_t max )
 
 void memcpy1( uint8_t *dst, const uint8_t *src, uint16_t size )
 {
+    // Words once both are aligned, 4 at a time for LDM/STM. A destination
+    // overlapping ahead of the source keeps the byte copy it relies on
+    if( ( ( ( ( uintptr_t )dst ^ ( uintptr_t )src ) & 3 ) == 0 ) &&
+        ( ( dst <= src ) || ( dst >= src + size ) ) )
+    {
+        UtilWord_t *d;
+        const UtilWord_t *s;
+        uint32_t w0, w1, w2, w3;
+
+        while( !UTIL_ALIGNED( dst ) && ( size > 0 ) )
+        {
+            *dst++ = *src++;
+            size--;
+        }
+        d = ( UtilWord_t * )dst;
+        s = ( const UtilWord_t * )src;
+        while( size >= 16 )
+        {
+            w0 = s[0];
+            w1 = s[1];
+            w2 = s[2];
+            w3 = s[3];
+            d[0] = w0;
+            d[1] = w1;
+            d[2] = w2;
+            d[3] = w3;
+            d += 4;
+            s += 4;
+            size -= 16;
+        }
+        while( size >= 4 )
+        {
+            *d++ = *s++;
+            size -= 4;
+        }
+        dst = ( uint8_t * )d;
+        src = ( const uint8_t * )s;
+    }
     while( size-- )
     {
         *dst++ = *src++;
@@ -61,6 +132,24 @@ void memcpy1( uint8_t *dst, const uint8_t *src, uint16_t size )
 void memcpyr( uint8_t *dst, const uint8_t *src, uint16_t size )
 {
     dst = dst + ( size - 1 );
+    // Byte reversed words once the source is aligned, when the destination
+    // then is too, as for the EUIs
+    if( ( ( ( uintptr_t )dst + ( uintptr_t )src + 1 ) & 3 ) == 0 )
+    {
+        while( !UTIL_ALIGNED( src ) && ( size > 0 ) )
+        {
+            *dst-- = *src++;
+            size--;
+        }
+        while( size >= 4 )
+        {
+            dst -= 3;
+            *( UtilWord_t * )dst = UTIL_REV32( *( const UtilWord_t * )src );
+            dst--;
+            src += 4;
+            size -= 4;
+        }
+    }
     while( size-- )
     {
         *dst-- = *src++;
@@ -69,6 +158,30 @@ void memcpyr( uint8_t *dst, const uint8_t *src, uint16_t size )
 
 void memset1( uint8_t *dst, uint8_t value, uint16_t size )
 {
+    uint32_t word = value * 0x01010101UL;
+    UtilWord_t *d;
+
+    while( !UTIL_ALIGNED( dst ) && ( size > 0 ) )
+    {
+        *dst++ = value;
+        size--;
+    }
+    d = ( UtilWord_t * )dst;
+    while( size >= 16 )
+    {
+        d[0] = word;
+        d[1] = word;
+        d[2] = word;
+        d[3] = word;
+        d += 4;
+        size -= 16;
+    }
+    while( size >= 4 )
+    {
+        *d++ = word;
+        size -= 4;
+    }
+    dst = ( uint8_t * )d;
     while( size-- )
     {
         *dst++ = value;
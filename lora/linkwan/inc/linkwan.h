@@ -8,12 +8,15 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include "log.h"
+#include "mem-profile.h"
+#include "radio.h"
 
-#define LORAWAN_APP_DATA_BUFF_SIZE 242
 #define LINKWAN_APP_DATA_SIZE 51
 #define LORAWAN_CONFIRMED_MSG 1
 #define LORAWAN_UNCONFIRMED_MSG 0
 #define JOINREQ_NBTRIALS 3    
+#define LWAN_RECORD_MAX_SIZE 15
+#define LWAN_RECORD_MAX_TYPE 15
 
 typedef enum eTxEventType {
     TX_ON_NONE,
@@ -32,6 +35,10 @@ typedef struct sLoRaMainCallback {
     uint32_t (*BoardGetRandomSeed)(void);
     void (*LoraTxData)(lora_AppData_t *AppData);
     void (*LoraRxData)(lora_AppData_t *AppData);
+    float (*BoardGetTemperatureLevel)(void); // optional, Class B timer drift compensation and radio image calibration
+#ifdef CONFIG_LWAN_TX_PREPARE
+    void (*LoraTxPrepare)(void); // optional, starts the acquisition of the periodic uplink data, see lwan_tx_data_ready
+#endif
 } LoRaMainCallback_t;
 
 typedef enum eDevicState {
@@ -77,13 +84,66 @@ bool lwan_dev_status_set(DeviceStatus_t ds);
 int lwan_join(uint8_t bJoin, uint8_t bAutoJoin, uint16_t joinInterval, uint16_t joinRetryCnt);
 int lwan_mac_req_send(int type, void *param);
 int lwan_data_send(uint8_t confirm, uint8_t Nbtrials, uint8_t *payload, uint8_t size);
+/* sends at once from the caller's payload, which the MAC has framed when this
+   returns; cb is called from the MAC confirm. Fails while a frame is in flight */
+typedef void (*lwan_send_cb_t)(bool success, uint8_t nb_retries);
+int lwan_data_send_async(uint8_t confirm, uint8_t Nbtrials, uint8_t *payload, uint8_t size, lwan_send_cb_t cb);
+/* payload is borrowed from the MAC until lwan_data_release() */
 int lwan_data_recv(uint8_t *port, uint8_t **payload, uint8_t *size);
+void lwan_data_release(void);
+#ifdef CONFIG_LORAMAC_FAST_INDICATION
+/* Class C unconfirmed downlinks of port reach LoraRxData from the radio RX
+   done, the payload valid during the call only, port 0 to stop */
+int lwan_data_fast_port_set(uint8_t port);
+#endif
+#ifdef CONFIG_LWAN_TX_PREPARE
+/* LoraTxPrepare is called lead ms ahead of each periodic uplink, which then
+   waits for lwan_tx_data_ready, from any context, up to
+   CONFIG_LWAN_TX_PREPARE_TIMEOUT before it calls LoraTxData */
+void lwan_tx_data_ready(void);
+int lwan_tx_prepare_lead_set(uint32_t lead);
+#endif
+#ifdef CONFIG_LWAN_AGGREGATE
+/* records are packed into one uplink once they fill it, on the deadline of
+   the oldest one or on lwan_record_flush(), from the main loop only */
+int lwan_record_add(uint8_t type, uint8_t *data, uint8_t len);
+int lwan_record_flush(void);
+#endif
+#ifdef CONFIG_LORAMAC_TX_TIME
+/* earliest uplink of size bytes the duty cycle allows at the current
+   datarate, the delay and the time on air in ms */
+typedef struct {
+    uint32_t delay;
+    uint8_t channel;
+    uint32_t freq;
+    uint8_t datarate;
+    uint32_t time_on_air;
+} lwan_tx_time_t;
+int lwan_tx_time_get(uint8_t size, lwan_tx_time_t *tx_time);
+#endif
 
 int lwan_dev_rssi_get(uint8_t band, int16_t *channel_rssi);
+/* spectrum scan of count channels, samples RSSI reads each, accumulated into
+   channels which the caller zeroes before the first scan */
+int lwan_dev_scan(const uint32_t *freqs, uint8_t count, uint16_t samples, RadioScanChannel_t *channels);
+/* per mille of the samples of a channel at or above rssi_thresh, rounded
+   down to the histogram bins */
+uint16_t lwan_dev_scan_occupancy(const RadioScanChannel_t *channel, int16_t rssi_thresh);
+/* scanned channel with the lowest occupancy, the lowest average RSSI on a
+   tie, -1 when none was sampled */
+int lwan_dev_scan_quietest(const RadioScanChannel_t *channels, uint8_t count, int16_t rssi_thresh);
+#ifdef CONFIG_LORAMAC_CHANNEL_QUALITY
+/* scans the enabled channels of the region while the MAC is idle and lowers
+   the selection weight of those found busy at or above busy_rssi */
+int lwan_channel_quality_scan(uint16_t samples, int16_t busy_rssi);
+#endif
 uint8_t lwan_dev_battery_get();
 
 bool lwan_multicast_add(void *multicastInfo );
 bool lwan_multicast_del(uint32_t dev_addr);
+// All the groups are linked, or none when one of them can not be
+bool lwan_multicast_add_groups(const void *multicastInfos, uint8_t num);
+bool lwan_multicast_del_groups(const uint32_t *dev_addrs, uint8_t num);
 uint8_t lwan_multicast_num_get(void);
 
 void lwan_sys_reboot(int8_t mode);
@@ -23,6 +23,9 @@
 #define LORA_AT_CFREQBANDMASK "+CFREQBANDMASK"  // freqband mask
 #define LORA_AT_CULDLMODE "+CULDLMODE"  // ul and dl
 #define LORA_AT_CKEYSPROTECT "+CKEYSPROTECT"  // keys protect
+#ifdef CONFIG_REGION_MULTI
+#define LORA_AT_CREGION "+CREGION"  // region at the next boot
+#endif
 
 #define LORA_AT_CWORKMODE "+CWORKMODE"  // work mode
 #define LORA_AT_CREPEATERFREQ "+CREPEATERFREQ"  // repeater freq
@@ -45,8 +48,17 @@
 #define LORA_AT_CNBTRIALS "+CNBTRIALS"  // nb trans
 #define LORA_AT_CRM "+CRM"  // report mode
 #define LORA_AT_CTXP "+CTXP"  // tx power
+#ifdef CONFIG_LORAMAC_TX_TIME
+#define LORA_AT_CTXTIME "+CTXTIME"  // earliest uplink time
+#endif
 #define LORA_AT_CLINKCHECK "+CLINKCHECK"  // link check
 #define LORA_AT_CADR "+CADR"  // ADR
+#ifdef CONFIG_LORAMAC_LINK_ADR
+#define LORA_AT_CLINKADR "+CLINKADR"  // device side ADR
+#endif
+#ifdef CONFIG_LORA_RADIO_STATS
+#define LORA_AT_CRADIOSTAT "+CRADIOSTAT"  // radio airtime and energy
+#endif
 #define LORA_AT_CRXP "+CRXP"  // rx win params
 #define LORA_AT_CFREQLIST "+CFREQLIST"  // freq list
 #define LORA_AT_CRX1DELAY "+CRX1DELAY"  // rx1 win delay
@@ -65,14 +77,80 @@
 #define LORA_AT_CGSN "+CGSN"  // product serial number id
 #define LORA_AT_CGBR "+CGBR"  // baud rate on UART interface
 
+#ifdef CONFIG_CRASH_DUMP
+#define LORA_AT_ICRASH "+ICRASH"  // fault and watchdog snapshot
+#endif
+#ifdef CONFIG_LWAN_ENERGY
+#define LORA_AT_IENERGY "+IENERGY"  // energy budget
+#endif
+#ifdef CONFIG_WATCHDOG
+#define LORA_AT_IHEALTH "+IHEALTH"  // task latencies and overruns
+#endif
 #define LORA_AT_ILOGLVL "+ILOGLVL"  // log level
+#ifdef CONFIG_PROFILE
+#define LORA_AT_IPROFILE "+IPROFILE"  // cycle counting probes
+#endif
 #define LORA_AT_IREBOOT "+IREBOOT"
+#define LORA_AT_ISCAN "+ISCAN"  // spectrum scan
+#ifdef CONFIG_STATS
+#define LORA_AT_ISTAT "+ISTAT"  // runtime statistics
+#endif
+#ifdef CONFIG_LWAN_AT_BINARY
+#define LORA_AT_CBINMODE "+CBINMODE"  // binary framed commands
+
+// binary commands, replied with the same seq and cmd | 0x80, then a status
+#define LWAN_AT_BIN_CMD_SEND        0x01  // confirm, nbtrials, payload
+#define LWAN_AT_BIN_CMD_RECV        0x02  // reply: port, payload
+#define LWAN_AT_BIN_CMD_JOIN        0x03  // join, auto join, interval, retries (LE)
+#define LWAN_AT_BIN_CMD_STATUS      0x04  // reply: device status, device state
+#define LWAN_AT_BIN_CMD_MAX_PAYLOAD 0x05  // reply: max payload
+#define LWAN_AT_BIN_CMD_TEXT        0x7F  // back to the AT commands
+
+// events, seq 0
+#define LWAN_AT_BIN_EVENT_SENT      0x40  // status, nbretries
+#define LWAN_AT_BIN_EVENT_RECV      0x41  // status, type, port, payload
+
+#define LWAN_AT_BIN_STATUS_OK       0x00
+#define LWAN_AT_BIN_STATUS_ERROR    0x01
+#define LWAN_AT_BIN_STATUS_UNKNOWN  0x02
+#endif
+
+#ifdef CONFIG_LWAN_AT_URC
+#define LORA_AT_CURC "+CURC"  // unsolicited events mask
+
+// unsolicited events, enabled by their bit in the +CURC mask
+#define LWAN_AT_URC_RECV            0  // type, port, payload
+#define LWAN_AT_URC_JOIN            1  // status
+#define LWAN_AT_URC_SENT            2  // status, nbretries
+#define LWAN_AT_URC_BEACON          3  // status: 1 locked, 0 lost
+#define LWAN_AT_URC_LINKCHECK       4  // status, margin, gateways, rssi, snr
+#define LWAN_AT_URC_NUM             5
+#endif
 
 #define AT_PRINTF(...) printf(__VA_ARGS__)
 
 void linkwan_at_init(void);
 void linkwan_at_process(void);
 void linkwan_serial_input(uint8_t cmd);
+#if defined(CONFIG_EVENT_QUEUE) && !defined(CONFIG_LWAN_AT_LINE_RX)
+/* true once a command is complete */
+bool linkwan_serial_process(uint8_t cmd);
+#else
+/* true while received bytes wait for linkwan_at_process, with
+   CONFIG_LWAN_AT_LINE_RX once a whole line waits */
+bool linkwan_at_pending(void);
+#endif
 int linkwan_serial_output(uint8_t *buffer, int len);
 void linkwan_at_prompt_print();
+#ifdef CONFIG_LWAN_AT_BINARY
+/* false out of the binary mode, the event is printed as text then */
+bool linkwan_at_bin_event(uint8_t event, uint8_t *head, uint8_t head_len, uint8_t *data, uint8_t len);
+#endif
+#ifdef CONFIG_LWAN_AT_URC
+/* queued for linkwan_at_urc_flush, false when masked off or on a full queue */
+bool linkwan_at_urc(uint8_t type, const uint8_t *head, uint8_t head_len, const uint8_t *data, uint8_t len);
+/* prints the queued events, from the main loop */
+void linkwan_at_urc_flush(void);
+bool linkwan_at_urc_pending(void);
+#endif
 #endif
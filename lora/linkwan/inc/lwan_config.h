@@ -26,14 +26,50 @@
 #define LWAN_SETTINGS_DEV            0
 #define LWAN_SETTINGS_MAC            1
 #define LWAN_SETTINGS_SYS            2
+#define LWAN_KV_JOIN_CACHE           3
+#define LWAN_KV_SESSION              4
+#define LWAN_KV_ENERGY               5
 
 #define LWAN_DEV_KEYS_DEFAULT   {LORA_KEYS_MAGIC_NUM, {0}, \
                                  {LORAWAN_DEVICE_EUI, LORAWAN_APPLICATION_EUI, LORAWAN_APPLICATION_KEY}, \
                                  {LORAWAN_DEVICE_ADDRESS, LORAWAN_NWKSKEY, LORAWAN_APPSKEY}, 0}
 
+/* region of the first boot, the first one of the build in this order */
+#if defined(REGION_AS923)
+#define LWAN_REGION_DEFAULT     LORAMAC_REGION_AS923
+#elif defined(REGION_AU915)
+#define LWAN_REGION_DEFAULT     LORAMAC_REGION_AU915
+#elif defined(REGION_CN470)
+#define LWAN_REGION_DEFAULT     LORAMAC_REGION_CN470
+#elif defined(REGION_CN779)
+#define LWAN_REGION_DEFAULT     LORAMAC_REGION_CN779
+#elif defined(REGION_EU433)
+#define LWAN_REGION_DEFAULT     LORAMAC_REGION_EU433
+#elif defined(REGION_IN865)
+#define LWAN_REGION_DEFAULT     LORAMAC_REGION_IN865
+#elif defined(REGION_EU868)
+#define LWAN_REGION_DEFAULT     LORAMAC_REGION_EU868
+#elif defined(REGION_KR920)
+#define LWAN_REGION_DEFAULT     LORAMAC_REGION_KR920
+#elif defined(REGION_US915)
+#define LWAN_REGION_DEFAULT     LORAMAC_REGION_US915
+#elif defined(REGION_US915_HYBRID)
+#define LWAN_REGION_DEFAULT     LORAMAC_REGION_US915_HYBRID
+#elif defined(REGION_CN470A)
+#define LWAN_REGION_DEFAULT     LORAMAC_REGION_CN470A
+#else
+#error "Please define a region in the compiler options."
+#endif
+
+#ifdef CONFIG_REGION_MULTI
+#define LWAN_DEV_CONFIG_DEFAULT {{JOIN_MODE_OTAA, ULDL_MODE_INTRA, WORK_MODE_NORMAL, CLASS_A}, \
+                                 {3, DR_2, DR_3, 0, 0}, {0, 8, 8, JOIN_METHOD_DEF, 1, DR_3}, \
+                                 0x0001, LWAN_REGION_DEFAULT, 0}
+#else
 #define LWAN_DEV_CONFIG_DEFAULT {{JOIN_MODE_OTAA, ULDL_MODE_INTRA, WORK_MODE_NORMAL, CLASS_A}, \
                                  {3, DR_2, DR_3, 0, 0}, {0, 8, 8, JOIN_METHOD_DEF, 1, DR_3}, \
                                  0x0001, 0}
+#endif
 
 #define LWAN_MAC_CONFIG_DEFAULT {{1, 0, 0, 1}, {7, 7}, 10, DR_3, 0, 0, {0, 0, 0}, 0, 0}
 
@@ -81,6 +117,17 @@ typedef struct sJoinSetings {
     uint8_t stored_datarate;
 } JoinSettings_t;
 
+#ifdef CONFIG_LWAN_JOIN_CACHE
+#define LWAN_JOIN_CACHE_NONE        0xFF
+
+/* join history per freqband, kept across reboots in the KV store */
+typedef struct sLWanJoinCache {
+    uint8_t last_freqband;      // freqband of the last join, LWAN_JOIN_CACHE_NONE for none
+    uint8_t success[16];        // joins per freqband, all halved when one saturates
+    int8_t rssi[16];            // smoothed RSSI of the join accepts
+} __attribute__((packed)) LWanJoinCache_t;
+#endif
+
 typedef struct sLoraDevConfig {
     struct sDevModes {
         JoinMode_t join_mode :2;
@@ -91,6 +138,9 @@ typedef struct sLoraDevConfig {
     ClassBParam_t classb_param;
     JoinSettings_t join_settings;
     uint16_t freqband_mask;
+#ifdef CONFIG_REGION_MULTI
+    uint8_t region;             // LoRaMacRegion_t the MAC starts with at boot
+#endif
     uint16_t crc;
 } __attribute__((packed)) LWanDevConfig_t;
 
@@ -171,6 +221,9 @@ typedef enum eDevConfigType {
     DEV_CONFIG_CLASS,
     DEV_CONFIG_CLASSB_PARAM,
     DEV_CONFIG_JOIN_SETTINGS,
+#ifdef CONFIG_REGION_MULTI
+    DEV_CONFIG_REGION,
+#endif
     DEV_CONFIG_MAX
 } DevConfigType_t;
 
@@ -187,6 +240,12 @@ typedef enum eMacConfigType {
     MAC_CONFIG_ADR_ENABLE,
     MAC_CONFIG_RX_PARAM,
     MAC_CONFIG_RX1_DELAY,
+#ifdef CONFIG_LORAMAC_LINK_ADR
+    MAC_CONFIG_LINK_ADR,
+#endif
+#ifdef CONFIG_LORA_RADIO_STATS
+    MAC_CONFIG_RADIO_STATS,
+#endif
     MAC_CONFIG_MAX
 } MacConfigType_t;
 
@@ -202,7 +261,7 @@ int lwan_dev_keys_set(int type, void *data);
 int lwan_dev_keys_get(int type, void *data);
 
 LWanDevConfig_t *lwan_dev_config_init(LWanDevConfig_t *default_config);
-LWanProdctConfig_t *lwan_prodct_config_init(LWanProdctConfig_t *default_config);
+const LWanProdctConfig_t *lwan_prodct_config_init(const LWanProdctConfig_t *default_config);
 int lwan_dev_config_get(int type, void *config);
 int lwan_dev_config_set(int type, void *config);
 
@@ -215,8 +274,34 @@ int lwan_mac_config_reset(LWanMacConfig_t *default_config);
 void lwan_mac_params_update();
 void lwan_dev_params_update();
 
-LWanSysConfig_t *lwan_sys_config_init(LWanSysConfig_t *default_config);
+/* the defaults are used in place while no config is saved, they are kept */
+const LWanSysConfig_t *lwan_sys_config_init(const LWanSysConfig_t *default_config);
 int lwan_sys_config_get(int type, void *config);
 int lwan_sys_config_set(int type, void *config);
 
+/* the LWAN_SETTINGS_* block saved, in place in the memory mapped flash, NULL
+   when its CRC is wrong. Valid until the settings are written again. */
+const void *lwan_settings_map(int type, int len);
+
+#ifdef CONFIG_LWAN_CONFIG_DEFER
+/* writes the settings changed since the last commit, kept in RAM until then */
+int lwan_config_commit(void);
+/* commits once the settings are left unchanged for a while, from the main loop */
+void lwan_config_process(void);
+#endif
+
+#ifdef CONFIG_LWAN_KV_STORE
+/* length read, or LWAN_ERROR when the key has no valid record */
+int lwan_kv_get(uint16_t key, void *value, uint16_t len);
+int lwan_kv_set(uint16_t key, const void *value, uint16_t len);
+/* the value in place in the flash, NULL when the key has no record of len
+   bytes at least. Valid until the next lwan_kv_set. */
+const void *lwan_kv_map(uint16_t key, uint16_t len);
+#endif
+
+#ifdef CONFIG_LWAN_FCNT_STORE
+int lwan_fcnt_restore(uint32_t *fcnt_up, uint32_t *fcnt_down);
+int lwan_fcnt_update(uint32_t fcnt_up, uint32_t fcnt_down);
+#endif
+
 #endif /* __LWAN_H__ */
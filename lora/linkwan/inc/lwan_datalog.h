@@ -0,0 +1,55 @@
+/*
+ * Flash data logger: the records of the application are kept in a ring of
+ * flash pages while the network is out of reach, and drained in uplinks
+ * packed with as many of them as the datarate allows:
+ *
+ *     | len | data (len bytes) | len | ...
+ *
+ * on port CONFIG_LWAN_DATALOG_PORT, confirmed. The records of a drain
+ * uplink are only dropped once it is acknowledged. A missing acknowledgement
+ * means the link is down, the drain is tried again after
+ * CONFIG_LWAN_DATALOG_RETRY, doubled up to CONFIG_LWAN_DATALOG_RETRY_MAX,
+ * and at once on the next downlink.
+ *
+ * A page starts with a header, its sequence number, then the records, each
+ * its length, the length inverted and a CRC-16 before its data. They go
+ * through the streaming flash writer, which programs whole word lines: the
+ * buffered line is programmed CONFIG_LWAN_DATALOG_SYNC_DELAY after the
+ * record which started it, at the latest, the records of that delay are
+ * lost on a reset. The page after the one filled is erased ahead while it
+ * holds no pending record. Once the ring is full, the page of the oldest
+ * records is erased for the new ones.
+ *
+ * The drained part is logged by a marker record, the scan at boot resumes
+ * the drain after the last one. The drain reads the records straight from
+ * the memory mapped flash.
+ */
+
+#ifndef __LWAN_DATALOG_H__
+#define __LWAN_DATALOG_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LWAN_DATALOG_RECORD_MAX     48
+
+// wakeup steps the state machine, a drain is due
+void lwan_datalog_init(void (*wakeup)(void));
+// from the main loop only
+int lwan_datalog_add(const uint8_t *data, uint8_t len);
+bool lwan_datalog_pending(void);
+// programs the buffered records, the flash stalls the CPU meanwhile
+void lwan_datalog_sync(void);
+/* programs the records buffered for long while the MAC is idle, true when
+   a drain is due */
+bool lwan_datalog_process(bool idle);
+// drain due, its port and payload of up to max bytes
+bool lwan_datalog_get(uint8_t *port, uint8_t *payload, uint8_t *size, uint8_t max);
+// the drain got is sent, or it is tried again later
+void lwan_datalog_sent(bool sent);
+// the MAC confirm of the uplinks
+void lwan_datalog_confirm(bool acked);
+// a downlink came, the link is up
+void lwan_datalog_link_up(void);
+
+#endif /* __LWAN_DATALOG_H__ */
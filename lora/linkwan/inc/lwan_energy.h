@@ -0,0 +1,70 @@
+/*
+ * Energy budget: the charge of a cell of a given capacity is spread over a
+ * target lifetime as a daily allowance, and the uplinks are adapted to stay
+ * within it.
+ *
+ * The charge used is the radio charge of the airtime accounting, plus a
+ * floor current standing for the MCU and the board over the elapsed time.
+ * At the start of each day the allowance is the charge left over the days
+ * left, the charge left being the lower of the capacity less the charge
+ * used and the capacity scaled by the battery level, which only tells on a
+ * cell whose voltage drops well ahead of the end.
+ *
+ * Each uplink is charged the radio charge from its request to its confirm,
+ * averaged. While the uplinks left in the day at the configured period
+ * would overrun the allowance left, the pressure rises:
+ *
+ *     1  the uplinks go unconfirmed, sent once
+ *     2  the datarate is raised a step, while ADR is off and it is allowed
+ *     3  a step more
+ *
+ * and the periodic uplinks are stretched so that the allowance left lasts
+ * the day. The uplinks of an explicit type and trials, AT+DTRX, keep them.
+ *
+ * With CONFIG_LWAN_KV_STORE the configuration and the charge used are kept
+ * across reboots, saved once a day, otherwise the lifetime starts again at
+ * each boot from the build defaults.
+ */
+
+#ifndef __LWAN_ENERGY_H__
+#define __LWAN_ENERGY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LWAN_ENERGY_LEVEL_MAX       3
+
+typedef struct {
+    uint32_t capacity;      // usable charge of the cell [mAh], 0 for no budget
+    uint16_t lifetime;      // target lifetime [days]
+    uint16_t floor;         // average current of the device, the radio excluded [uA]
+    uint8_t dr_adapt;       // the datarate may be raised while ADR is off
+} lwan_energy_config_t;
+
+typedef struct {
+    uint32_t allowance;     // of the day [uAh]
+    uint32_t spent;         // in the day [uAh]
+    uint32_t used;          // since the start of the lifetime [mAh]
+    uint16_t days;          // elapsed of the lifetime
+    uint16_t uplink_cost;   // average radio charge of an uplink [uAh]
+    uint32_t interval;      // period of the periodic uplinks applied [s]
+    uint8_t level;          // pressure, 0 to LWAN_ENERGY_LEVEL_MAX
+} lwan_energy_status_t;
+
+void lwan_energy_init(void);
+int lwan_energy_config_set(const lwan_energy_config_t *config);
+void lwan_energy_config_get(lwan_energy_config_t *config);
+// starts the lifetime again, the charge used cleared
+void lwan_energy_reset(void);
+// interval is the configured uplink period [s]
+void lwan_energy_status_get(uint32_t interval, lwan_energy_status_t *status);
+/* pressure for an uplink about to be requested, interval the configured
+   uplink period [s], 0 for uplinks not periodic, paced on the charge spent
+   in the day instead. Its radio charge is accounted from now. */
+uint8_t lwan_energy_uplink(uint32_t interval);
+// the MAC confirm of the uplink
+void lwan_energy_uplink_done(void);
+// the configured uplink period [s] stretched to the allowance left
+uint32_t lwan_energy_interval(uint32_t interval);
+
+#endif /* __LWAN_ENERGY_H__ */
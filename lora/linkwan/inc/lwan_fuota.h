@@ -0,0 +1,64 @@
+/*
+ * Firmware update over the air for a whole fleet at once: the LoRaWAN
+ * remote multicast setup (port 200) and fragmented data block transport
+ * (port 201) packages.
+ *
+ * The multicast setup derives the group session keys from the McKey
+ * encrypted by the AppKey, and runs the class C sessions: from their start
+ * time to their timeout the group is linked to the MAC, the device in
+ * class C on the session frequency and datarate. The RX2 channel of the
+ * MAC is the one of the session meanwhile.
+ *
+ * A fragmentation session writes the data fragments straight to their
+ * place in the image slot, erased by the session setup. The parity
+ * fragments are programmed to the parity store as they come: RAM keeps
+ * the parity matrix rows over the lost fragments only, each row a bit per
+ * lost fragment and a bit per stored parity fragment it combines. A lost
+ * fragment is rebuilt from the flash once a row holds it alone, the rows of
+ * the stored parity fragments generated again. Up to LWAN_FUOTA_LOST_MAX
+ * lost fragments are covered at once, and as many parity fragments as the
+ * store holds, up to LWAN_FUOTA_LOST_MAX too.
+ *
+ * The fragment size has to be a multiple of 8, the flash programs 8 bytes
+ * at once. The session descriptor is the CRC-32 of the image, the one
+ * SLOT_COMMIT of the OTA bootloader takes, the image being
+ * nb_frag * frag_size bytes less the padding. A single fragmentation
+ * session runs at a time.
+ */
+
+#ifndef __LWAN_FUOTA_H__
+#define __LWAN_FUOTA_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LWAN_FUOTA_MC_PORT          200
+#define LWAN_FUOTA_FRAG_PORT        201
+
+// Lost fragments covered by the parity rows, the bits of a row
+#define LWAN_FUOTA_LOST_MAX         32
+
+/* called once the image is complete in the slot, crc_ok when it matches the
+   descriptor of the session */
+typedef void (*lwan_fuota_done_cb_t)(uint32_t addr, uint32_t size, bool crc_ok);
+
+// wakeup steps the state machine, an answer or a session event is due
+void lwan_fuota_init(void (*wakeup)(void));
+void lwan_fuota_done_set(lwan_fuota_done_cb_t cb);
+// frame of one of the package ports
+void lwan_fuota_rx(uint8_t port, uint8_t *payload, uint8_t size);
+// runs the session starts and ends due, true when an answer is due
+bool lwan_fuota_process(void);
+// answer due, its port and payload
+bool lwan_fuota_answer_get(uint8_t *port, uint8_t *payload, uint8_t *size);
+// the answer got is sent, or it is tried again later
+void lwan_fuota_answer_sent(bool sent);
+#ifdef CONFIG_LWAN_FUOTA_STATE_ADDR
+/* logs the image complete in the slot pending in the state page of the OTA
+   bootloader, which activates it at the next boot, version above the
+   running one. A bootloader built with CONFIG_BOOT_SIGNED has to get it
+   through SLOT_COMMIT instead */
+int lwan_fuota_commit(uint32_t version);
+#endif
+
+#endif /* __LWAN_FUOTA_H__ */
@@ -0,0 +1,75 @@
+/*
+ * Store-and-forward relay for the end-devices out of gateway range, in the
+ * spirit of the LoRaWAN relay specification but without its MAC commands.
+ *
+ * A joined class A device listens to the relay channel with periodic CADs
+ * while its own MAC is idle. The uplinks heard from the registered
+ * end-devices are queued whole, PHYPayload and radio metadata, and
+ * forwarded on port LWAN_RELAY_PORT in the uplinks of the relay, as many
+ * per uplink as its payload holds:
+ *
+ *     | len | -rssi | snr | PHYPayload (len bytes) | len | ...
+ *
+ * A forward is due once the oldest record waited CONFIG_LWAN_RELAY_AGG_DELAY
+ * or the records fill the queue by half. At most
+ * CONFIG_LWAN_RELAY_FWD_PER_HOUR forwards go out per hour, the energy spent
+ * for the others is bounded: the queue holds the records until the next
+ * hour, the oldest dropped when it is full.
+ *
+ * The network server sends the downlinks of an end-device on the same port,
+ *
+ *     | DevAddr (4, LSB first) | PHYPayload |
+ *
+ * kept until the next uplink of the end-device is heard. The relay then
+ * sends it on the relay channel CONFIG_LWAN_RELAY_RX_DELAY after that
+ * uplink, with the inverted IQ of the downlinks: the RX1 window of an
+ * end-device set up on the single relay channel. A downlink is thus one
+ * uplink of the end-device late.
+ *
+ * The end-devices send with a preamble covering the sniff period, see
+ * RadioCadTx_t::WakePeriod of lora/radio/radio-cad.h. The relay gives the
+ * radio back to the MAC for each of its requests, the listening resumes
+ * once the MAC is idle again.
+ */
+
+#ifndef __LWAN_RELAY_H__
+#define __LWAN_RELAY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LWAN_RELAY_PORT             226
+
+// End-devices relayed
+#define LWAN_RELAY_DEVICES_MAX      8
+
+typedef struct {
+    uint32_t freq;                  // relay channel [Hz]
+    uint8_t bandwidth;              // [0: 125 kHz, 1: 250 kHz, 2: 500 kHz]
+    uint8_t datarate;               // spreading factor
+    int8_t tx_power;                // of the downlinks [dBm]
+    uint32_t sniff_period;          // [ms]
+} lwan_relay_channel_t;
+
+// wakeup steps the state machine, a forward is due
+void lwan_relay_init(void (*wakeup)(void));
+// listens to the channel from the next idle MAC on
+void lwan_relay_start(const lwan_relay_channel_t *channel);
+void lwan_relay_stop(void);
+bool lwan_relay_device_add(uint32_t dev_addr);
+bool lwan_relay_device_del(uint32_t dev_addr);
+// downlink of the relay port
+void lwan_relay_rx(uint8_t *payload, uint8_t size);
+/* listens while idle, the MAC idle and joined in class A, true when a
+   forward is due */
+bool lwan_relay_process(bool idle);
+// the relay holds the radio, its interrupts run with RadioSchedProcess
+bool lwan_relay_active(void);
+// gives the radio back to the MAC before its requests
+void lwan_relay_suspend(void);
+// forward due, its port and payload of up to max bytes
+bool lwan_relay_fwd_get(uint8_t *port, uint8_t *payload, uint8_t *size, uint8_t max);
+// the forward got is sent, or it is tried again later
+void lwan_relay_fwd_sent(bool sent);
+
+#endif /* __LWAN_RELAY_H__ */
@@ -1,6 +1,8 @@
 /*
  * Copyright (C) 2015-2017 Alibaba Group Holding Limited
  */
+#define LOG_MODULE LOG_MODULE_LWAN
+
 #include <string.h>
 #include <stdlib.h>
 #include "tremo_delay.h"
@@ -11,25 +13,109 @@
 #include "LoRaMacCrypto.h"
 #include "LoRaMac.h"
 #include "LoRaMacClassB.h"
+#include "Region.h"
+#include "RegionCommon.h"
 #include "timer.h"
 #include "radio.h"
 #include "linkwan_ica_at.h"
 #include "lwan_config.h"  
 #include "linkwan.h"
+#ifdef CONFIG_EVENT_QUEUE
+#include "event-queue.h"
+#endif
+#ifdef CONFIG_SCHEDULER
+#include "scheduler.h"
+#endif
+#ifdef CONFIG_FLASH_QUEUE
+#include "tremo_flash.h"
+#endif
+#ifdef CONFIG_WARM_BOOT_RETAINED
+#include "warm-boot.h"
+#endif
+#ifdef CONFIG_PULSE_COUNTER
+#include "pulse-counter.h"
+#endif
+#ifdef CONFIG_KEY_SLOTS
+#include "key-slot.h"
+#endif
+#ifdef CONFIG_RNG_POOL
+#include "rng-pool.h"
+#endif
+#ifdef CONFIG_LWAN_FUOTA
+#include "lwan_fuota.h"
+#endif
+#ifdef CONFIG_LWAN_RELAY
+#if defined(CONFIG_SCHEDULER) || defined(CONFIG_EVENT_QUEUE)
+#error "CONFIG_LWAN_RELAY runs the radio from the lora_fsm loop, without CONFIG_SCHEDULER and CONFIG_EVENT_QUEUE"
+#endif
+#include "radio-sched.h"
+#include "lwan_relay.h"
+#endif
+#ifdef CONFIG_LWAN_DATALOG
+#include "lwan_datalog.h"
+#endif
+#ifdef CONFIG_LWAN_ENERGY
+#include "lwan_energy.h"
+#endif
+#ifdef CONFIG_CLOCK_SYNC
+#include "clock-sync.h"
+#endif
+#include "watchdog.h"
 
 #define MAX_BEACON_RETRY_TIMES 2
 #define LORA_KEYS_MAGIC_NUM 0xABABBABA 
 
+/*!
+ * Tolerated TxNextPacketTimer expiry delay, to share wakeups with other timers [ms]
+ */
+#ifndef TX_NEXT_PACKET_SLACK
+#define TX_NEXT_PACKET_SLACK 50
+#endif
+
+#ifdef CONFIG_LWAN_TX_PREPARE
+/*!
+ * Default time LoraTxPrepare is called ahead of the periodic uplink [ms]
+ */
+#ifndef CONFIG_LWAN_TX_PREPARE_LEAD
+#define CONFIG_LWAN_TX_PREPARE_LEAD 2000
+#endif
+/*!
+ * Longest wait of the periodic uplink for lwan_tx_data_ready [ms]
+ */
+#ifndef CONFIG_LWAN_TX_PREPARE_TIMEOUT
+#define CONFIG_LWAN_TX_PREPARE_TIMEOUT 5000
+#endif
+
+#define TX_PREPARE_IDLE     0
+#define TX_PREPARE_DUE      1   // LoraTxPrepare to be called from the state machine
+#define TX_PREPARE_BUSY     2   // the application acquires the data
+#define TX_PREPARE_READY    3
+#endif
+
+/*!
+ * RSSI samples per channel of lwan_dev_rssi_get, one per ms
+ */
+#ifndef LWAN_RSSI_SAMPLES
+#define LWAN_RSSI_SAMPLES 8
+#endif
+
+#ifdef CONFIG_LORAMAC_CHANNEL_QUALITY
+/*!
+ * Channels scanned at once by lwan_channel_quality_scan
+ */
+#define LWAN_QUALITY_SCAN_CHUNK 16
+#endif
+
 static uint8_t tx_buf[LORAWAN_APP_DATA_BUFF_SIZE];
 static lora_AppData_t tx_data = {tx_buf, 1, 10};
-static uint8_t rx_buf[LORAWAN_APP_DATA_BUFF_SIZE];
-static lora_AppData_t rx_data = {rx_buf, 0, 0};
+static lora_AppData_t rx_data = {NULL, 0, 0}; // payload borrowed from the MAC
 
 static LoRaMacPrimitives_t LoRaMacPrimitives;
 static LoRaMacCallback_t LoRaMacCallbacks;
 static LoRaMainCallback_t *app_callbacks;
 
 static volatile bool next_tx = true;
+static lwan_send_cb_t g_send_cb = NULL; // completion of the lwan_data_send_async frame
 static volatile bool rejoin_flag = true;
 
 static uint8_t gGatewayID[3] ={0};
@@ -39,11 +125,93 @@ static uint32_t g_ack_index = 0;
 static uint8_t g_join_retry_times = 0;
 static uint8_t g_data_send_nbtrials = 0;
 static int8_t g_data_send_msg_type = -1;
+static bool g_device_time_app = false;  // DeviceTimeReq outside of the class B switch
+#if defined(CONFIG_LWAN_FUOTA) || defined(CONFIG_LWAN_RELAY) || defined(CONFIG_LWAN_DATALOG)
+static uint8_t g_data_send_port = 0;    // the configured port with 0
+#endif
 #ifdef CONFIG_LINKWAN
 static uint8_t g_freqband_num = 0;
+#ifdef CONFIG_LWAN_JOIN_CACHE
+#ifndef CONFIG_LWAN_KV_STORE
+#error "CONFIG_LWAN_JOIN_CACHE needs CONFIG_LWAN_KV_STORE"
+#endif
+static LWanJoinCache_t g_join_cache;
+static uint8_t g_join_order[16];    // freqbands which joined before, most likely first
+static uint8_t g_join_order_num = 0;
+static uint8_t g_join_order_next = 0;
+static int16_t g_join_rssi = 0;     // RSSI of the join accept
+#endif
 #endif    
+#ifdef CONFIG_LWAN_SESSION_STORE
+#if !defined(CONFIG_LORAMAC_SESSION) || !defined(CONFIG_LWAN_KV_STORE) || !defined(CONFIG_LWAN_FCNT_STORE)
+#error "CONFIG_LWAN_SESSION_STORE needs CONFIG_LORAMAC_SESSION, CONFIG_LWAN_KV_STORE and CONFIG_LWAN_FCNT_STORE"
+#endif
+// Session of the last OTAA join, the frame counters live in the FCnt store
+typedef struct {
+    uint8_t deveui[8];
+    uint8_t appeui[8];
+    LoRaMacSession_t mac;
+} LWanSession_t;
+static LWanSession_t g_session;
+#ifdef CONFIG_WARM_BOOT_RETAINED
+// Copy of the session with its counters, restored on a warm boot without the flash
+typedef struct {
+    LWanSession_t session;
+    WarmBootBlock_t block;
+} LWanSessionRetained_t;
+static LWanSessionRetained_t g_session_retained RETAINED_ATTR;
+#endif
+#endif
 
 static TimerEvent_t TxNextPacketTimer;
+#ifdef CONFIG_LWAN_TX_PREPARE
+// Fires the lead time ahead of TxNextPacketTimer, then bounds the wait for the data
+static TimerEvent_t TxPrepareTimer;
+static uint32_t g_tx_prepare_lead = CONFIG_LWAN_TX_PREPARE_LEAD;
+static volatile uint8_t g_tx_prepare = TX_PREPARE_IDLE;
+static volatile bool g_tx_prepare_wait = false;  // the periodic uplink waits for the data
+#endif
+
+// Widest jitter window of the join back-off, doubled from join_interval with each failed round [ms]
+#ifndef CONFIG_LWAN_JOIN_BACKOFF_MAX
+#define CONFIG_LWAN_JOIN_BACKOFF_MAX (30 * 60 * 1000)
+#endif
+// Join requests per hour at most, each one spends a DevNonce
+#ifndef CONFIG_LWAN_JOIN_NONCES_PER_HOUR
+#define CONFIG_LWAN_JOIN_NONCES_PER_HOUR 24
+#endif
+
+static uint32_t g_join_rand = 0;        // xorshift state of the join schedule
+static uint8_t g_join_failures = 0;     // join rounds failed in a row
+static bool g_join_started = false;
+static TimerTime_t g_join_first;        // first request of the rounds, for the join duty cycle
+static TimerTime_t g_nonce_hour;        // start of the hour of the DevNonce budget
+static uint16_t g_nonce_count = 0;
+
+#ifdef CONFIG_LWAN_AGGREGATE
+#ifndef CONFIG_LWAN_AGGREGATE_RECORDS
+#define CONFIG_LWAN_AGGREGATE_RECORDS 16
+#endif
+// Longest wait of a record for its uplink [ms]
+#ifndef CONFIG_LWAN_AGGREGATE_DEADLINE
+#define CONFIG_LWAN_AGGREGATE_DEADLINE 300000
+#endif
+
+typedef struct {
+    TimerTime_t time;
+    uint8_t type;
+    uint8_t len;
+    uint8_t data[LWAN_RECORD_MAX_SIZE];
+} lwan_record_t;
+
+static lwan_record_t agg_records[CONFIG_LWAN_AGGREGATE_RECORDS];
+static uint8_t agg_head = 0;    // oldest record
+static uint8_t agg_count = 0;
+static uint8_t agg_packed = 0;  // records in tx_data, dropped once sent
+static volatile bool agg_flush = false;
+static TimerEvent_t agg_timer;
+static bool agg_timer_init = false;
+#endif
 volatile DeviceState_t g_lwan_device_state = DEVICE_STATE_INIT;
 volatile DeviceState_t g_lwan_device_state_last = DEVICE_STATE_INIT;
 static DeviceStatus_t g_lwan_device_status = DEVICE_STATUS_IDLE;
@@ -52,18 +220,92 @@ bool g_lora_debug = false;
 static LWanDevConfig_t *g_lwan_dev_config_p = NULL;
 static LWanMacConfig_t *g_lwan_mac_config_p = NULL;
 static LWanDevKeys_t *g_lwan_dev_keys_p = NULL;
-static LWanProdctConfig_t *g_lwan_prodct_config_p = NULL;
+#ifdef CONFIG_REGION_MULTI
+static LoRaMacRegion_t g_lwan_region = LWAN_REGION_DEFAULT;
+#define LWAN_REGION_ACTIVE g_lwan_region
+#else
+#define LWAN_REGION_ACTIVE LWAN_REGION_DEFAULT
+#endif
+
+#ifdef CONFIG_SCHEDULER
+#ifndef CONFIG_EVENT_QUEUE
+#error "CONFIG_SCHEDULER needs CONFIG_EVENT_QUEUE"
+#endif
+#define LORA_EVENT_STATE    ( 1 << 0 )
+#define LORA_EVENT_RADIO    ( 1 << 0 )
+#define LORA_EVENT_AT_LINE  ( 1 << 0 )
+
+#define LORA_INPUT_PRIORITY 4
+#define LORA_RADIO_PRIORITY 3
+#define LORA_FSM_PRIORITY   2
+#define LORA_AT_PRIORITY    1
+
+static SchedTask_t lora_input_task;  // drains the event queue
+static SchedTask_t lora_radio_task;
+static SchedTask_t lora_fsm_task;    // lora_fsm, waited on
+#ifdef CONFIG_LWAN_AT
+static SchedTask_t lora_at_task;
+#ifndef CONFIG_LWAN_AT_LINE_RX
+static bool lora_at_line_pending = false;
+#endif
+#endif
+
+// The device state or next_tx changed, the state machine has to step
+static void lora_fsm_wakeup(void)
+{
+    SchedSetEvents(&lora_fsm_task, LORA_EVENT_STATE);
+}
+#else
+#define lora_fsm_wakeup()
+#endif
+static const LWanProdctConfig_t *g_lwan_prodct_config_p = NULL;
 static void start_dutycycle_timer(void); 
 
 extern bool print_isdone(void);
 
-static bool send_frame(void)
+#ifdef CONFIG_LWAN_ENERGY
+// The datarate raised a step per pressure level above 1, while ADR is off
+static uint8_t energy_datarate(uint8_t datarate, uint8_t level)
+{
+    lwan_energy_config_t config;
+    VerifyParams_t verify;
+
+    lwan_energy_config_get(&config);
+    if (!config.dr_adapt || g_lwan_mac_config_p->modes.adr_enabled) {
+        return datarate;
+    }
+    for (; level > 1; level--) {
+        verify.DatarateParams.Datarate = datarate + 1;
+        verify.DatarateParams.UplinkDwellTime = 0;
+        if (RegionVerify(LWAN_REGION_ACTIVE, &verify, PHY_TX_DR) == false) {
+            break;
+        }
+        datarate++;
+    }
+    return datarate;
+}
+#endif
+
+// The MAC builds the frame from the payload before it returns
+static bool send_payload(uint8_t *payload, uint8_t len)
 {
     McpsReq_t mcpsReq;
     LoRaMacTxInfo_t txInfo;
     uint8_t send_msg_type;
+    uint8_t datarate = g_lwan_mac_config_p->datarate;
+#if defined(CONFIG_LWAN_FUOTA) || defined(CONFIG_LWAN_RELAY) || defined(CONFIG_LWAN_DATALOG)
+    uint8_t port = g_data_send_port?g_data_send_port:g_lwan_mac_config_p->port;
 
-    if (LoRaMacQueryTxPossible(tx_data.BuffSize, &txInfo) != LORAMAC_STATUS_OK) {
+    // For this frame only, also when it is not sent
+    g_data_send_port = 0;
+#else
+    uint8_t port = g_lwan_mac_config_p->port;
+#endif
+
+#ifdef CONFIG_LWAN_RELAY
+    lwan_relay_suspend();
+#endif
+    if (LoRaMacQueryTxPossible(len, &txInfo) != LORAMAC_STATUS_OK) {
         return true;
     }
 
@@ -72,8 +314,32 @@ static bool send_frame(void)
         mlmeReq.Type = MLME_LINK_CHECK;
         LoRaMacMlmeRequest(&mlmeReq);
     }
+#ifdef CONFIG_CLOCK_SYNC
+    // Only when the clock may be off by more than the bound
+    if (ClockSyncNeeded()) {
+        MlmeReq_t mlmeReq;
+        mlmeReq.Type = MLME_DEVICE_TIME;
+        if (LoRaMacMlmeRequest(&mlmeReq) == LORAMAC_STATUS_OK) {
+            ClockSyncRequested();
+            g_device_time_app = true;
+        }
+    }
+#endif
     
     send_msg_type = g_data_send_msg_type>=0?g_data_send_msg_type:g_lwan_mac_config_p->modes.confirmed_msg;
+#ifdef CONFIG_LWAN_ENERGY
+    {
+        uint8_t level = lwan_energy_uplink(g_lwan_mac_config_p->modes.report_mode == TX_ON_TIMER ?
+                                           g_lwan_mac_config_p->report_interval : 0);
+
+        // The type and trials asked for this frame are kept
+        if (level > 0 && g_data_send_msg_type < 0 && g_data_send_nbtrials == 0) {
+            send_msg_type = LORAWAN_UNCONFIRMED_MSG;
+            g_data_send_nbtrials = 1;
+        }
+        datarate = energy_datarate(datarate, level);
+    }
+#endif
     if (send_msg_type == LORAWAN_UNCONFIRMED_MSG) {
         MibRequestConfirm_t mibReq;
         mibReq.Type = MIB_CHANNELS_NB_REP;
@@ -82,23 +348,37 @@ static bool send_frame(void)
         LoRaMacMibSetRequestConfirm(&mibReq);
     
         mcpsReq.Type = MCPS_UNCONFIRMED;
-        mcpsReq.Req.Unconfirmed.fPort = g_lwan_mac_config_p->port;
-        mcpsReq.Req.Unconfirmed.fBuffer = tx_data.Buff;
-        mcpsReq.Req.Unconfirmed.fBufferSize = tx_data.BuffSize;
-        mcpsReq.Req.Unconfirmed.Datarate = g_lwan_mac_config_p->datarate;
+        mcpsReq.Req.Unconfirmed.fPort = port;
+        mcpsReq.Req.Unconfirmed.fBuffer = payload;
+        mcpsReq.Req.Unconfirmed.fBufferSize = len;
+        mcpsReq.Req.Unconfirmed.Datarate = datarate;
     } else {
         mcpsReq.Type = MCPS_CONFIRMED;
-        mcpsReq.Req.Confirmed.fPort = g_lwan_mac_config_p->port;
-        mcpsReq.Req.Confirmed.fBuffer = tx_data.Buff;
-        mcpsReq.Req.Confirmed.fBufferSize = tx_data.BuffSize;
+        mcpsReq.Req.Confirmed.fPort = port;
+        mcpsReq.Req.Confirmed.fBuffer = payload;
+        mcpsReq.Req.Confirmed.fBufferSize = len;
         mcpsReq.Req.Confirmed.NbTrials = g_data_send_nbtrials?g_data_send_nbtrials:
                                                     g_lwan_mac_config_p->nbtrials.conf+1;
-        mcpsReq.Req.Confirmed.Datarate = g_lwan_mac_config_p->datarate; 
+        mcpsReq.Req.Confirmed.Datarate = datarate;
     }
 
     g_data_send_nbtrials = 0;
     g_data_send_msg_type = -1;
-    
+
+#ifdef CONFIG_LWAN_FCNT_STORE
+    {
+        // Checkpointed before the frame goes out, every CONFIG_LWAN_FCNT_INTERVAL frames
+        MibRequestConfirm_t mibReq;
+        uint32_t fcnt_up;
+
+        mibReq.Type = MIB_UPLINK_COUNTER;
+        LoRaMacMibGetRequestConfirm(&mibReq);
+        fcnt_up = mibReq.Param.UpLinkCounter;
+        mibReq.Type = MIB_DOWNLINK_COUNTER;
+        LoRaMacMibGetRequestConfirm(&mibReq);
+        lwan_fcnt_update(fcnt_up, mibReq.Param.DownLinkCounter);
+    }
+#endif
     if (LoRaMacMcpsRequest(&mcpsReq) == LORAMAC_STATUS_OK) {
         return false;
     }
@@ -106,10 +386,17 @@ static bool send_frame(void)
     return true;
 }
 
+static bool send_frame(void)
+{
+    return send_payload(tx_data.Buff, tx_data.BuffSize);
+}
+
 static void prepare_tx_frame(void)
 {
     if (g_lwan_mac_config_p->modes.report_mode == TX_ON_TIMER) {
+        WATCHDOG_TASK_BEGIN(WATCHDOG_TASK_APP);
         app_callbacks->LoraTxData(&tx_data);
+        WATCHDOG_TASK_END(WATCHDOG_TASK_APP);
     }
 }
 
@@ -141,6 +428,121 @@ static uint8_t get_next_freqband(void)
     
     return freqband[randr(0,freqnum-1)];
 }
+
+#ifdef CONFIG_LWAN_JOIN_CACHE
+static void join_cache_load(void)
+{
+    if (lwan_kv_get(LWAN_KV_JOIN_CACHE, &g_join_cache, sizeof(g_join_cache)) != sizeof(g_join_cache)) {
+        memset(&g_join_cache, 0, sizeof(g_join_cache));
+        g_join_cache.last_freqband = LWAN_JOIN_CACHE_NONE;
+    }
+}
+
+static bool join_cache_before(uint8_t a, uint8_t b)
+{
+    // The band of the last join first, then the most joins, then the strongest join accepts
+    if (a == g_join_cache.last_freqband || b == g_join_cache.last_freqband) {
+        return a == g_join_cache.last_freqband;
+    }
+    if (g_join_cache.success[a] != g_join_cache.success[b]) {
+        return g_join_cache.success[a] > g_join_cache.success[b];
+    }
+    return g_join_cache.rssi[a] > g_join_cache.rssi[b];
+}
+
+/* orders the scanned freqbands which joined before, the others are left to
+ * the random scan of the region */
+static void join_cache_order(void)
+{
+    uint16_t mask = g_lwan_dev_config_p->freqband_mask;
+
+    g_join_order_num = 0;
+    g_join_order_next = 0;
+    for (uint8_t i = 0; i < 16; i++) {
+        if ((mask & (1 << i)) == 0 || i == 1 || g_join_cache.success[i] == 0) {
+            continue;
+        }
+        uint8_t j = g_join_order_num++;
+        while (j > 0 && join_cache_before(i, g_join_order[j - 1])) {
+            g_join_order[j] = g_join_order[j - 1];
+            j--;
+        }
+        g_join_order[j] = i;
+    }
+}
+
+static void join_cache_update(uint8_t freqband, int16_t rssi)
+{
+    if (freqband >= 16) {
+        return;
+    }
+    if (g_join_cache.success[freqband] == 0xFF) {
+        // Keep the ratios, forget the old history
+        for (uint8_t i = 0; i < 16; i++) {
+            g_join_cache.success[i] >>= 1;
+        }
+    }
+    if (g_join_cache.success[freqband] == 0) {
+        g_join_cache.rssi[freqband] = MAX(rssi, -128);
+    } else {
+        g_join_cache.rssi[freqband] = (3 * g_join_cache.rssi[freqband] + MAX(rssi, -128)) / 4;
+    }
+    g_join_cache.success[freqband]++;
+    g_join_cache.last_freqband = freqband;
+    lwan_kv_set(LWAN_KV_JOIN_CACHE, &g_join_cache, sizeof(g_join_cache));
+}
+#endif
+#endif
+
+#ifdef CONFIG_LWAN_SESSION_STORE
+static void session_save(void)
+{
+    if (g_lwan_dev_config_p->modes.join_mode != JOIN_MODE_OTAA ||
+        LoRaMacSessionExport(&g_session.mac) != LORAMAC_STATUS_OK) {
+        return;
+    }
+    memcpy(g_session.deveui, g_lwan_dev_keys_p->ota.deveui, 8);
+    memcpy(g_session.appeui, g_lwan_dev_keys_p->ota.appeui, 8);
+#ifdef CONFIG_WARM_BOOT_RETAINED
+    g_session_retained.session = g_session;
+    WarmBootBlockSeal(&g_session_retained.block, &g_session_retained.session, sizeof(g_session_retained.session));
+#endif
+    // A new join resets the counters, the store must not hand back the ones of the last session
+    lwan_fcnt_update(g_session.mac.UpLinkCounter, g_session.mac.DownLinkCounter);
+    // Counters change with every frame, the record only when the network changes the session
+    g_session.mac.UpLinkCounter = 0;
+    g_session.mac.DownLinkCounter = 0;
+    g_session.mac.AdrAckCounter = 0;
+    lwan_kv_set(LWAN_KV_SESSION, &g_session, sizeof(g_session));
+}
+
+static bool session_restore(void)
+{
+    uint32_t fcnt_up, fcnt_down;
+
+#ifdef CONFIG_WARM_BOOT_RETAINED
+    if (WarmBootBlockValid(&g_session_retained.block, &g_session_retained.session, sizeof(g_session_retained.session)) &&
+        memcmp(g_session_retained.session.deveui, g_lwan_dev_keys_p->ota.deveui, 8) == 0 &&
+        memcmp(g_session_retained.session.appeui, g_lwan_dev_keys_p->ota.appeui, 8) == 0) {
+        g_session = g_session_retained.session;
+        // One uplink may have gone out after the save
+        g_session.mac.UpLinkCounter++;
+        return LoRaMacSessionImport(&g_session.mac) == LORAMAC_STATUS_OK;
+    }
+#endif
+    if (lwan_kv_get(LWAN_KV_SESSION, &g_session, sizeof(g_session)) != sizeof(g_session) ||
+        memcmp(g_session.deveui, g_lwan_dev_keys_p->ota.deveui, 8) != 0 ||
+        memcmp(g_session.appeui, g_lwan_dev_keys_p->ota.appeui, 8) != 0) {
+        return false;
+    }
+    // Without the counters the network would drop the frames as replays
+    if (lwan_fcnt_restore(&fcnt_up, &fcnt_down) != LWAN_SUCCESS) {
+        return false;
+    }
+    g_session.mac.UpLinkCounter = fcnt_up;
+    g_session.mac.DownLinkCounter = fcnt_down;
+    return LoRaMacSessionImport(&g_session.mac) == LORAMAC_STATUS_OK;
+}
 #endif
 
 static void reset_join_state(void)
@@ -149,36 +551,217 @@ static void reset_join_state(void)
 }
 static void on_tx_next_packet_timer_event(void)
 {
-    MibRequestConfirm_t mib_req;
-    LoRaMacStatus_t status;
-
     TimerStop(&TxNextPacketTimer);
 
-    mib_req.Type = MIB_NETWORK_JOINED;
-    status = LoRaMacMibGetRequestConfirm(&mib_req);
+    if (LoRaMacIsNetworkJoined() == true) {
+        g_lwan_device_state = DEVICE_STATE_SEND;
+    } else {
+        rejoin_flag = true;
+        g_lwan_device_state = DEVICE_STATE_JOIN;
+    }
+    lora_fsm_wakeup();
+}
 
-    if (status == LORAMAC_STATUS_OK) {
-        if (mib_req.Param.IsNetworkJoined == true) {
-            g_lwan_device_state = DEVICE_STATE_SEND;
-        } else {
-            rejoin_flag = true;
-            g_lwan_device_state = DEVICE_STATE_JOIN;
+#ifdef CONFIG_LWAN_TX_PREPARE
+static void on_tx_prepare_timer_event(void)
+{
+    TimerStop(&TxPrepareTimer);
+
+    if (g_tx_prepare_wait) {
+        // The data is late, the uplink goes with what LoraTxData gives
+        g_tx_prepare_wait = false;
+        g_tx_prepare = TX_PREPARE_IDLE;
+        g_lwan_device_state = DEVICE_STATE_SEND;
+    } else if (LoRaMacIsNetworkJoined() == true && g_lwan_mac_config_p->modes.report_mode == TX_ON_TIMER) {
+        g_tx_prepare = TX_PREPARE_DUE;
+    }
+    lora_fsm_wakeup();
+}
+
+void lwan_tx_data_ready(void)
+{
+    if (g_tx_prepare != TX_PREPARE_BUSY) {
+        return;
+    }
+    g_tx_prepare = TX_PREPARE_READY;
+    if (g_tx_prepare_wait) {
+        TimerStop(&TxPrepareTimer);
+        g_tx_prepare_wait = false;
+        g_lwan_device_state = DEVICE_STATE_SEND;
+        lora_fsm_wakeup();
+    }
+}
+
+int lwan_tx_prepare_lead_set(uint32_t lead)
+{
+    g_tx_prepare_lead = lead;
+    return LWAN_SUCCESS;
+}
+#endif
+
+#ifdef CONFIG_LWAN_AGGREGATE
+static uint8_t agg_put_varint(uint8_t *buf, uint32_t value)
+{
+    uint8_t n = 0;
+
+    while (value >= 0x80) {
+        buf[n++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buf[n++] = value;
+    return n;
+}
+
+// Packs the oldest records fitting in max bytes, in the order they were
+// added. Each record is a (type << 4 | length) byte, a varint number of
+// seconds and the data. The seconds are the age of the first record at
+// packing time, then the time since the previous record
+static uint8_t agg_pack(uint8_t *buf, uint8_t max, uint8_t *count)
+{
+    uint32_t prev = TimerGetCurrentTime() / 1000;
+    uint8_t size = 0;
+    uint8_t n;
+
+    for (n = 0; n < agg_count; n++) {
+        lwan_record_t *rec = &agg_records[(agg_head + n) % CONFIG_LWAN_AGGREGATE_RECORDS];
+        uint32_t time = rec->time / 1000;
+        uint8_t delta[5];
+        uint8_t delta_len = agg_put_varint(delta, (n == 0) ? prev - time : time - prev);
+
+        if (size + 1 + delta_len + rec->len > max) {
+            break;
+        }
+        if (buf) {
+            buf[size] = (rec->type << 4) | rec->len;
+            memcpy(buf + size + 1, delta, delta_len);
+            memcpy(buf + size + 1 + delta_len, rec->data, rec->len);
         }
+        size += 1 + delta_len + rec->len;
+        prev = time;
+    }
+    if (count) {
+        *count = n;
     }
+    return size;
 }
 
+static void agg_start_deadline(void)
+{
+    TimerTime_t age;
+
+    TimerStop(&agg_timer);
+    if (agg_count == 0) {
+        return;
+    }
+    age = TimerGetElapsedTime(agg_records[agg_head].time);
+    TimerSetValue(&agg_timer, (age < CONFIG_LWAN_AGGREGATE_DEADLINE) ? CONFIG_LWAN_AGGREGATE_DEADLINE - age : 1);
+    TimerStart(&agg_timer);
+}
+
+// The records fill an uplink or the oldest one reached the deadline
+static bool agg_ready(void)
+{
+    uint8_t count;
+
+    if (agg_count == 0) {
+        return false;
+    }
+    agg_pack(NULL, LoRaMacGetMaxPayload(), &count);
+    return count < agg_count || agg_count == CONFIG_LWAN_AGGREGATE_RECORDS ||
+           TimerGetElapsedTime(agg_records[agg_head].time) >= CONFIG_LWAN_AGGREGATE_DEADLINE;
+}
+
+static bool agg_request_send(void)
+{
+    agg_flush = true;
+    if (!LoRaMacIsNetworkJoined()) {
+        return false;
+    }
+    if (g_lwan_device_state == DEVICE_STATE_SLEEP) {
+        g_lwan_device_state = DEVICE_STATE_SEND;
+    }
+    lora_fsm_wakeup();
+    return true;
+}
+
+static void on_agg_timer_event(void)
+{
+    TimerStop(&agg_timer);
+    agg_request_send();
+}
+
+static bool agg_prepare_tx_frame(void)
+{
+    tx_data.BuffSize = agg_pack(tx_data.Buff, LoRaMacGetMaxPayload(), &agg_packed);
+    return agg_packed != 0;
+}
+
+static void agg_tx_frame_sent(void)
+{
+    agg_head = (agg_head + agg_packed) % CONFIG_LWAN_AGGREGATE_RECORDS;
+    agg_count -= agg_packed;
+    agg_packed = 0;
+    agg_flush = agg_ready();
+    agg_start_deadline();
+}
+#endif
+
+#ifdef CONFIG_LWAN_AT
+static void at_join_report(bool joined)
+{
+#ifdef CONFIG_LWAN_AT_URC
+    uint8_t status = joined;
+    linkwan_at_urc(LWAN_AT_URC_JOIN, &status, 1, NULL, 0);
+#else
+    AT_PRINTF("%s:%s\r\n", LORA_AT_CJOIN, joined ? "OK" : "FAIL");
+#endif
+}
+#endif
+
 static void mcps_confirm(McpsConfirm_t *mcpsConfirm)
 {
-    if (mcpsConfirm->Status == LORAMAC_EVENT_INFO_STATUS_OK) {
 #ifdef CONFIG_LWAN_AT
-        AT_PRINTF("\r\nOK+SENT:%02X\r\n", mcpsConfirm->NbRetries);
-#endif        
-    } else {
-#ifdef CONFIG_LWAN_AT   
-        AT_PRINTF("\r\nERR+SENT:%02X\r\n", mcpsConfirm->NbRetries);
-#endif  
-    }
+    bool sent_ok = (mcpsConfirm->Status == LORAMAC_EVENT_INFO_STATUS_OK);
+#if defined(CONFIG_LWAN_AT_URC)
+    uint8_t sent[2] = {sent_ok, mcpsConfirm->NbRetries};
+    linkwan_at_urc(LWAN_AT_URC_SENT, sent, sizeof(sent), NULL, 0);
+#else
+#ifdef CONFIG_LWAN_AT_BINARY
+    uint8_t sent[2] = {sent_ok ? LWAN_AT_BIN_STATUS_OK : LWAN_AT_BIN_STATUS_ERROR, mcpsConfirm->NbRetries};
+    if (!linkwan_at_bin_event(LWAN_AT_BIN_EVENT_SENT, sent, sizeof(sent), NULL, 0))
+#endif
+    AT_PRINTF("\r\n%s+SENT:%02X\r\n", sent_ok ? "OK" : "ERR", mcpsConfirm->NbRetries);
+#endif
+#endif
     next_tx = true;
+#ifdef CONFIG_LWAN_DATALOG
+    lwan_datalog_confirm(mcpsConfirm->AckReceived);
+#endif
+#ifdef CONFIG_LWAN_ENERGY
+    lwan_energy_uplink_done();
+#endif
+#ifdef CONFIG_LORAMAC_CHANNEL_QUALITY
+    // Only a confirmed uplink tells whether its channel got through
+    if (mcpsConfirm->McpsRequest == MCPS_CONFIRMED && mcpsConfirm->Status != LORAMAC_EVENT_INFO_STATUS_TX_DR_PAYLOAD_SIZE_ERROR) {
+        RegionCommonChannelQualityReport((uint8_t)mcpsConfirm->Channel, mcpsConfirm->AckReceived);
+    }
+#endif
+    if (g_send_cb) {
+        lwan_send_cb_t cb = g_send_cb;
+        g_send_cb = NULL;
+        cb(mcpsConfirm->Status == LORAMAC_EVENT_INFO_STATUS_OK, mcpsConfirm->NbRetries);
+    }
+#ifdef CONFIG_LWAN_SESSION_STORE
+    // ADR and channel commands of the last exchange
+    session_save();
+#endif
+#ifdef CONFIG_LWAN_AGGREGATE
+    // The records left for the next uplink
+    if (agg_flush && g_lwan_device_state == DEVICE_STATE_SLEEP) {
+        g_lwan_device_state = DEVICE_STATE_SEND;
+    }
+#endif
+    lora_fsm_wakeup();
 }
 
 static void mcps_indication(McpsIndication_t *mcpsIndication)
@@ -198,15 +781,37 @@ static void mcps_indication(McpsIndication_t *mcpsIndication)
     LOG_PRINTF(LL_DEBUG, "receive data: rssi = %d, snr = %d, datarate = %d\r\n", mcpsIndication->Rssi, mcpsIndication->Snr,
                  mcpsIndication->RxDatarate);
     lwan_dev_status_set(DEVICE_STATUS_SEND_PASS_WITH_DL);
+#ifdef CONFIG_LWAN_DATALOG
+    lwan_datalog_link_up();
+#endif
     if (mcpsIndication->RxData == true) {
         switch ( mcpsIndication->Port ) {
             case 224:
                 break;
+#ifdef CONFIG_LWAN_FUOTA
+            case LWAN_FUOTA_MC_PORT:
+            case LWAN_FUOTA_FRAG_PORT:
+                lwan_fuota_rx(mcpsIndication->Port, mcpsIndication->Buffer, mcpsIndication->BufferSize);
+                break;
+#endif
+#ifdef CONFIG_LWAN_RELAY
+            case LWAN_RELAY_PORT:
+                lwan_relay_rx(mcpsIndication->Buffer, mcpsIndication->BufferSize);
+                break;
+#endif
             default: {            
+                // Keep the newest payload for lwan_data_recv, drop the unread one
+                lwan_data_release();
+                rx_data.Buff = mcpsIndication->Buffer;
                 rx_data.Port = mcpsIndication->Port;
                 rx_data.BuffSize = mcpsIndication->BufferSize;
-                memcpy1(rx_data.Buff, mcpsIndication->Buffer, rx_data.BuffSize);
+                WATCHDOG_TASK_BEGIN(WATCHDOG_TASK_APP);
                 app_callbacks->LoraRxData(&rx_data);
+                WATCHDOG_TASK_END(WATCHDOG_TASK_APP);
+                if (!LoRaMacRxBufferHold(rx_data.Buff)) {
+                    rx_data.Buff = NULL;
+                    rx_data.BuffSize = 0;
+                }
                 break;
             }
         }
@@ -221,6 +826,15 @@ static void mcps_indication(McpsIndication_t *mcpsIndication)
         confirm = 1;
     uint8_t type = confirm | mcpsIndication->AckReceived<<1 | 
                    mcpsIndication->LinkCheckAnsReceived<<2 | mcpsIndication->DevTimeAnsReceived<<3;
+#if defined(CONFIG_LWAN_AT_URC)
+    uint8_t recv[2] = {type, mcpsIndication->Port};
+    linkwan_at_urc(LWAN_AT_URC_RECV, recv, sizeof(recv), mcpsIndication->Buffer, mcpsIndication->BufferSize);
+    lora_fsm_wakeup();
+#else
+#ifdef CONFIG_LWAN_AT_BINARY
+    uint8_t recv[3] = {LWAN_AT_BIN_STATUS_OK, type, mcpsIndication->Port};
+    if (!linkwan_at_bin_event(LWAN_AT_BIN_EVENT_RECV, recv, sizeof(recv), mcpsIndication->Buffer, mcpsIndication->BufferSize)) {
+#endif
     AT_PRINTF("\r\nOK+RECV:%02X,%02X,%02X", type, mcpsIndication->Port, mcpsIndication->BufferSize);
     if(mcpsIndication->BufferSize) {
         AT_PRINTF(",");
@@ -229,21 +843,89 @@ static void mcps_indication(McpsIndication_t *mcpsIndication)
         }
     }
     AT_PRINTF("\r\n");
+#ifdef CONFIG_LWAN_AT_BINARY
+    }
+#endif
+#endif
 #endif
 
 #ifdef CONFIG_LWAN    
     if(mcpsIndication->UplinkNeeded) {
         g_lwan_device_state = DEVICE_STATE_SEND_MAC;
+        lora_fsm_wakeup();
     }
 #endif 
 }
 
-static uint32_t generate_rejoin_delay(void)
+static uint32_t join_rand(void)
+{
+    if (g_join_rand == 0) {
+        // Seeded from the chip and the DevEUI so that the nodes of a fleet
+        // draw different delays after a common outage
+        if (app_callbacks->BoardGetRandomSeed != NULL) {
+            g_join_rand = app_callbacks->BoardGetRandomSeed();
+        }
+        for (uint8_t i = 0; i < LORA_EUI_LENGTH; i++) {
+            g_join_rand = g_join_rand * 31 + g_lwan_dev_keys_p->ota.deveui[i];
+        }
+        if (g_join_rand == 0) {
+            g_join_rand = rand1() | 1;
+        }
+    }
+    g_join_rand ^= g_join_rand << 13;
+    g_join_rand ^= g_join_rand >> 17;
+    g_join_rand ^= g_join_rand << 5;
+    return g_join_rand;
+}
+
+static void join_request_sent(uint8_t nb_trials)
+{
+    if (!g_join_started) {
+        g_join_started = true;
+        g_join_first = TimerGetCurrentTime();
+    }
+    if (g_nonce_count == 0 || TimerGetElapsedTime(g_nonce_hour) >= 3600000) {
+        g_nonce_hour = TimerGetCurrentTime();
+        g_nonce_count = 0;
+    }
+    // Each trial of the request spends a DevNonce
+    g_nonce_count += nb_trials;
+}
+
+static void join_schedule_reset(void)
+{
+    g_join_failures = 0;
+    g_join_started = false;
+}
+
+/* delay of the next join round: join_interval plus a jitter drawn over a
+ * window doubling with each failed round, no sooner than the join duty cycle
+ * and the DevNonce budget allow */
+static uint32_t generate_rejoin_delay(MlmeConfirm_t *mlmeConfirm)
 {
-    uint32_t rejoin_delay = 0;
+    uint32_t base = g_lwan_dev_config_p->join_settings.join_interval * 1000;
+    uint32_t window = MAX(base, 1000);
+    uint32_t rejoin_delay;
 
-    while (rejoin_delay < g_lwan_dev_config_p->join_settings.join_interval*1000) {
-        rejoin_delay += (rand1() % 250);
+    for (uint8_t i = 0; i < g_join_failures && window < CONFIG_LWAN_JOIN_BACKOFF_MAX; i++) {
+        window <<= 1;
+    }
+    window = MIN(window, CONFIG_LWAN_JOIN_BACKOFF_MAX);
+    rejoin_delay = base + join_rand() % (window + 1);
+    if (g_join_failures < 0xFF) {
+        g_join_failures++;
+    }
+
+    if (g_join_started) {
+        uint16_t dc = RegionCommonGetJoinDc(TimerGetElapsedTime(g_join_first));
+        rejoin_delay = MAX(rejoin_delay, mlmeConfirm->TxTimeOnAir * dc);
+    }
+
+    if (g_nonce_count >= CONFIG_LWAN_JOIN_NONCES_PER_HOUR) {
+        TimerTime_t elapsed = TimerGetElapsedTime(g_nonce_hour);
+        if (elapsed < 3600000) {
+            rejoin_delay = MAX(rejoin_delay, 3600000 - elapsed + join_rand() % (window + 1));
+        }
     }
 
     return rejoin_delay;
@@ -259,10 +941,14 @@ static void mlme_confirm( MlmeConfirm_t *mlmeConfirm )
             if (mlmeConfirm->Status == LORAMAC_EVENT_INFO_STATUS_OK) {
                 // Status is OK, node has joined the network
                 g_join_retry_times = 0;
+                join_schedule_reset();
                 g_lwan_device_state = DEVICE_STATE_JOINED;
                 lwan_dev_status_set(DEVICE_STATUS_JOIN_PASS);
+#ifdef CONFIG_LWAN_JOIN_CACHE
+                g_join_rssi = mlmeConfirm->Rssi;
+#endif
 #ifdef CONFIG_LWAN_AT
-                AT_PRINTF("%s:OK\r\n", LORA_AT_CJOIN);
+                at_join_report(true);
 #endif                
             } else {
                 lwan_dev_status_set(DEVICE_STATUS_JOIN_FAIL);
@@ -273,9 +959,12 @@ static void mlme_confirm( MlmeConfirm_t *mlmeConfirm )
                 if (g_lwan_dev_config_p->join_settings.join_method != JOIN_METHOD_SCAN) {
                     g_lwan_dev_config_p->join_settings.join_method = 
                         (g_lwan_dev_config_p->join_settings.join_method + 1) % JOIN_METHOD_NUM;
-                    rejoin_delay = generate_rejoin_delay();
+                    rejoin_delay = generate_rejoin_delay(mlmeConfirm);
                     if (g_lwan_dev_config_p->join_settings.join_method == JOIN_METHOD_SCAN) {
                         g_freqband_num = get_freqband_num();
+#ifdef CONFIG_LWAN_JOIN_CACHE
+                        join_cache_order();
+#endif
                     }
                 }
 
@@ -284,12 +973,12 @@ static void mlme_confirm( MlmeConfirm_t *mlmeConfirm )
                         g_lwan_dev_config_p->join_settings.join_method = JOIN_METHOD_DEF;
                         rejoin_delay = 60 * 60 * 1000;  // 1 hour
 #ifdef CONFIG_LWAN_AT
-                        AT_PRINTF("%s:FAIL\r\n", LORA_AT_CJOIN);
+                        at_join_report(false);
 #endif                        
                         LOG_PRINTF(LL_DEBUG, "Wait 1 hour for new round of scan\r\n");
                     } else {
                         g_freqband_num--;
-                        rejoin_delay = generate_rejoin_delay();
+                        rejoin_delay = generate_rejoin_delay(mlmeConfirm);
                     }
                 }
                 TimerSetValue(&TxNextPacketTimer, rejoin_delay);
@@ -299,12 +988,12 @@ static void mlme_confirm( MlmeConfirm_t *mlmeConfirm )
                 g_join_retry_times++;
                 if(g_join_retry_times>=g_lwan_dev_config_p->join_settings.join_trials) {
 #ifdef CONFIG_LWAN_AT                          
-                    AT_PRINTF("%s:FAIL\r\n", LORA_AT_CJOIN);
+                    at_join_report(false);
 #endif 
                     g_join_retry_times = 0;
                     g_lwan_device_state = DEVICE_STATE_SLEEP;
                 } else {
-                    rejoin_delay = generate_rejoin_delay();
+                    rejoin_delay = generate_rejoin_delay(mlmeConfirm);
                     
                     TimerSetValue(&TxNextPacketTimer, rejoin_delay);
                     TimerStart(&TxNextPacketTimer);
@@ -316,7 +1005,13 @@ static void mlme_confirm( MlmeConfirm_t *mlmeConfirm )
         }
         case MLME_LINK_CHECK: {
 #ifdef CONFIG_LWAN_AT
+#ifdef CONFIG_LWAN_AT_URC
+            uint8_t check[6] = {mlmeConfirm->Status, mlmeConfirm->DemodMargin, mlmeConfirm->NbGateways,
+                                (uint8_t)mlmeConfirm->Rssi, (uint8_t)((uint16_t)mlmeConfirm->Rssi >> 8), (uint8_t)mlmeConfirm->Snr};
+            linkwan_at_urc(LWAN_AT_URC_LINKCHECK, check, sizeof(check), NULL, 0);
+#else
             AT_PRINTF("+CLINKCHECK: %d, %d, %d, %d, %d\r\n", mlmeConfirm->Status, mlmeConfirm->DemodMargin, mlmeConfirm->NbGateways, mlmeConfirm->Rssi, mlmeConfirm->Snr);
+#endif
 #endif            
             if ( mlmeConfirm->Status == LORAMAC_EVENT_INFO_STATUS_OK ) {
                 // Check DemodMargin
@@ -328,6 +1023,11 @@ static void mlme_confirm( MlmeConfirm_t *mlmeConfirm )
         }
         case MLME_DEVICE_TIME:
         {
+            if (g_device_time_app) {
+                // The time is set, the device stays in its class
+                g_device_time_app = false;
+                break;
+            }
             if( mlmeConfirm->Status == LORAMAC_EVENT_INFO_STATUS_OK ){
                 // Switch to the next state immediately
                 g_lwan_device_state = DEVICE_STATE_BEACON_ACQUISITION;
@@ -384,6 +1084,7 @@ static void mlme_confirm( MlmeConfirm_t *mlmeConfirm )
             break;
     }
     next_tx = true;
+    lora_fsm_wakeup();
 }
 
 static void mlme_indication( MlmeIndication_t *mlmeIndication )
@@ -398,7 +1099,11 @@ static void mlme_indication( MlmeIndication_t *mlmeIndication )
                 g_lwan_device_state_last = g_lwan_device_state;
             }
 
-#ifndef REGION_US915
+#if defined(CONFIG_REGION_MULTI)
+            if (g_lwan_region != LORAMAC_REGION_US915) {
+                g_lwan_device_state = DEVICE_STATE_SEND_MAC;
+            }
+#elif !defined(REGION_US915)
             g_lwan_device_state = DEVICE_STATE_SEND_MAC;
 #endif
 
@@ -412,12 +1117,20 @@ static void mlme_indication( MlmeIndication_t *mlmeIndication )
 
             // Switch to class A again
             g_lwan_device_state = DEVICE_STATE_REQ_DEVICE_TIME;
+#ifdef CONFIG_LWAN_AT_URC
+            uint8_t locked = 0;
+            linkwan_at_urc(LWAN_AT_URC_BEACON, &locked, 1, NULL, 0);
+#endif
             break;
         }
         case MLME_BEACON:
         {
             if( mlmeIndication->Status == LORAMAC_EVENT_INFO_STATUS_BEACON_LOCKED )
             {
+#ifdef CONFIG_LWAN_AT_URC
+                uint8_t locked = 1;
+                linkwan_at_urc(LWAN_AT_URC_BEACON, &locked, 1, NULL, 0);
+#endif
                 if(mlmeIndication->BeaconInfo.GwSpecific.InfoDesc==3){ //NetID+GatewayID
                     uint8_t *info = mlmeIndication->BeaconInfo.GwSpecific.Info;
                     if((gGatewayID[0]|gGatewayID[1]|gGatewayID[2]) 
@@ -435,24 +1148,38 @@ static void mlme_indication( MlmeIndication_t *mlmeIndication )
         default:
             break;
     }
+    lora_fsm_wakeup();
 }
 
 
 static void start_dutycycle_timer(void)
 {
-    MibRequestConfirm_t mib_req;
-    LoRaMacStatus_t status;
-
     TimerStop(&TxNextPacketTimer);
-    mib_req.Type = MIB_NETWORK_JOINED;
-    status = LoRaMacMibGetRequestConfirm(&mib_req);
-    if (status == LORAMAC_STATUS_OK) {
-        if (mib_req.Param.IsNetworkJoined == true &&
-            g_lwan_mac_config_p->modes.report_mode == TX_ON_TIMER && g_lwan_mac_config_p->report_interval != 0) {
-            TimerSetValue(&TxNextPacketTimer, g_lwan_mac_config_p->report_interval*1000);
-            TimerStart(&TxNextPacketTimer);
-            return;
+#ifdef CONFIG_LWAN_TX_PREPARE
+    TimerStop(&TxPrepareTimer);
+#endif
+    if (LoRaMacIsNetworkJoined() == true &&
+        g_lwan_mac_config_p->modes.report_mode == TX_ON_TIMER && g_lwan_mac_config_p->report_interval != 0) {
+#ifdef CONFIG_LWAN_ENERGY
+        uint32_t interval = lwan_energy_interval(g_lwan_mac_config_p->report_interval)*1000;
+#else
+        uint32_t interval = g_lwan_mac_config_p->report_interval*1000;
+#endif
+        TimerSetValue(&TxNextPacketTimer, interval);
+        TimerStart(&TxNextPacketTimer);
+#ifdef CONFIG_LWAN_TX_PREPARE
+        // A period shorter than the lead time acquires the data at once
+        if (app_callbacks->LoraTxPrepare != NULL) {
+            if (interval > g_tx_prepare_lead) {
+                TimerSetValue(&TxPrepareTimer, interval - g_tx_prepare_lead);
+                TimerStart(&TxPrepareTimer);
+            } else {
+                g_tx_prepare = TX_PREPARE_DUE;
+                lora_fsm_wakeup();
+            }
         }
+#endif
+        return;
     }
     if (g_lwan_mac_config_p->report_interval == 0 && g_lwan_mac_config_p->modes.report_mode == TX_ON_TIMER) {
         g_lwan_mac_config_p->modes.report_mode = TX_ON_NONE;
@@ -508,34 +1235,290 @@ static void print_dev_info(void)
     LOG_PRINTF(LL_DEBUG, "scan chn mask 0x%04x\r\n", g_lwan_dev_config_p->freqband_mask);
 }
 
-void init_lwan_configs() 
+/* region the MAC starts with, the stored one in multi region builds */
+static LoRaMacRegion_t lwan_region_load(void)
+{
+#ifdef CONFIG_REGION_MULTI
+    // Read ahead of init_lwan_configs, which runs once the MAC is up
+    LWanDevConfig_t default_dev_config = LWAN_DEV_CONFIG_DEFAULT;
+
+    g_lwan_region = (LoRaMacRegion_t)lwan_dev_config_init(&default_dev_config)->region;
+    if (!RegionIsActive(g_lwan_region)) {
+        LOG_PRINTF(LL_WARN, "region %d not built, region %d used\r\n", g_lwan_region, LWAN_REGION_DEFAULT);
+        g_lwan_region = LWAN_REGION_DEFAULT;
+    }
+    return g_lwan_region;
+#else
+    return LWAN_REGION_DEFAULT;
+#endif
+}
+
+void init_lwan_configs() 
+{
+    LWanDevKeys_t default_keys = LWAN_DEV_KEYS_DEFAULT;
+    LWanDevConfig_t default_dev_config = LWAN_DEV_CONFIG_DEFAULT;
+    LWanMacConfig_t default_mac_config = LWAN_MAC_CONFIG_DEFAULT;
+    static const LWanProdctConfig_t default_prodct_config = LWAN_PRODCT_CONFIG_DEFAULT;
+    
+    g_lwan_dev_keys_p = lwan_dev_keys_init(&default_keys);
+    g_lwan_dev_config_p = lwan_dev_config_init(&default_dev_config);
+    g_lwan_mac_config_p = lwan_mac_config_init(&default_mac_config);
+#ifdef CONFIG_LWAN_JOIN_CACHE
+    join_cache_load();
+#endif
+
+    g_lwan_prodct_config_p = lwan_prodct_config_init(&default_prodct_config);
+}
+
+
+#if defined(CONFIG_LWAN_FUOTA) || defined(CONFIG_LWAN_RELAY) || defined(CONFIG_LWAN_DATALOG) || defined(CONFIG_WATCHDOG)
+static void module_wakeup(void)
+{
+    lora_fsm_wakeup();
+}
+#endif
+
+void lora_init(LoRaMainCallback_t *callbacks)
+{
+    g_lwan_device_state = DEVICE_STATE_INIT;
+    app_callbacks = callbacks;
+#ifdef CONFIG_LWAN_FUOTA
+    lwan_fuota_init(module_wakeup);
+#endif
+#ifdef CONFIG_LWAN_RELAY
+    lwan_relay_init(module_wakeup);
+#endif
+#ifdef CONFIG_LWAN_DATALOG
+    lwan_datalog_init(module_wakeup);
+#endif
+#ifdef CONFIG_LWAN_ENERGY
+    lwan_energy_init();
+#endif
+#ifdef CONFIG_WATCHDOG
+    WatchdogTaskRegister(WATCHDOG_TASK_RADIO, CONFIG_WATCHDOG_RADIO_BUDGET);
+    WatchdogTaskRegister(WATCHDOG_TASK_MAC, CONFIG_WATCHDOG_MAC_BUDGET);
+    WatchdogTaskRegister(WATCHDOG_TASK_APP, CONFIG_WATCHDOG_APP_BUDGET);
+    WatchdogInit(module_wakeup);
+#endif
+
+#ifdef CONFIG_LWAN_AT
+    linkwan_at_init();
+#endif
+}
+
+#ifdef CONFIG_FLASH_QUEUE
+// Queued flash operations, one step at a time while the MAC is idle so the
+// erase and program stall no RX window
+static bool lora_flash_step(void)
+{
+    return flash_queue_busy() && !lwan_is_dev_busy() && flash_queue_process();
+}
+#endif
+
+#ifdef CONFIG_PULSE_COUNTER
+#if !defined(CONFIG_LWAN_AGGREGATE) || !defined(CONFIG_EVENT_QUEUE)
+#error "CONFIG_PULSE_COUNTER needs CONFIG_LWAN_AGGREGATE and CONFIG_EVENT_QUEUE"
+#endif
+static void lora_pulse_record(const Event_t *event)
+{
+    uint8_t record[5];
+
+    record[0] = event->Param;
+    record[1] = event->Data & 0xFF;
+    record[2] = (event->Data >> 8) & 0xFF;
+    record[3] = (event->Data >> 16) & 0xFF;
+    record[4] = (event->Data >> 24) & 0xFF;
+    // Lost on a full aggregator, the total keeps counting
+    lwan_record_add(PULSE_COUNTER_RECORD_TYPE, record, sizeof(record));
+    if (event->Param == PULSE_COUNTER_THRESHOLD) {
+        // Sent now rather than at the aggregation deadline
+        lwan_record_flush();
+    }
+}
+#endif
+
+#if defined(CONFIG_SCHEDULER)
+static void lora_input_handler(uint32_t events)
+{
+    Event_t event;
+
+    while (EventPeek(&event)) {
+#if defined(CONFIG_LWAN_AT) && !defined(CONFIG_LWAN_AT_LINE_RX)
+        if (event.Type == EVENT_UART_RX && lora_at_line_pending) {
+            // Left queued until lora_at_handler has run the command
+            return;
+        }
+#endif
+        EventGet(&event);
+        switch (event.Type) {
+            case EVENT_RADIO_IRQ:
+                SchedSetEvents(&lora_radio_task, LORA_EVENT_RADIO);
+                break;
+#ifdef CONFIG_LWAN_AT
+            case EVENT_UART_RX:
+#ifdef CONFIG_LWAN_AT_LINE_RX
+                // Line end, the bytes of the line wait in the AT ring
+                SchedSetEvents(&lora_at_task, LORA_EVENT_AT_LINE);
+#else
+                if (linkwan_serial_process(event.Param)) {
+                    lora_at_line_pending = true;
+                    SchedSetEvents(&lora_at_task, LORA_EVENT_AT_LINE);
+                }
+#endif
+                break;
+#endif
+#ifdef CONFIG_PULSE_COUNTER
+            case EVENT_PULSE:
+                lora_pulse_record(&event);
+                break;
+#endif
+            default:
+                break;
+        }
+    }
+}
+
+static void lora_radio_handler(uint32_t events)
+{
+    if (Radio.IrqProcess != NULL) {
+        Radio.IrqProcess();
+    }
+}
+
+#ifdef CONFIG_LWAN_AT
+static void lora_at_handler(uint32_t events)
+{
+    linkwan_at_process();
+#ifdef CONFIG_LWAN_AT_LINE_RX
+    // One command per run, the other tasks run between the lines
+    if (linkwan_at_pending()) {
+        SchedSetEvents(&lora_at_task, LORA_EVENT_AT_LINE);
+    }
+#else
+    lora_at_line_pending = false;
+    // Resumes the UART bytes left queued, the command may have changed the state
+    SchedSetEvents(&lora_input_task, SCHED_EVENT_QUEUE);
+#endif
+    lora_fsm_wakeup();
+}
+#endif
+
+static void lora_idle(void)
 {
-    LWanDevKeys_t default_keys = LWAN_DEV_KEYS_DEFAULT;
-    LWanDevConfig_t default_dev_config = LWAN_DEV_CONFIG_DEFAULT;
-    LWanMacConfig_t default_mac_config = LWAN_MAC_CONFIG_DEFAULT;
-    LWanProdctConfig_t default_prodct_config = LWAN_PRODCT_CONFIG_DEFAULT;
-    
-    g_lwan_dev_keys_p = lwan_dev_keys_init(&default_keys);
-    g_lwan_dev_config_p = lwan_dev_config_init(&default_dev_config);
-    g_lwan_mac_config_p = lwan_mac_config_init(&default_mac_config);
-
-    g_lwan_prodct_config_p = lwan_prodct_config_init(&default_prodct_config);
+#ifdef CONFIG_LWAN_CONFIG_DEFER
+    lwan_config_process();
+#endif
+    log_deferred_flush();
+#ifdef CONFIG_RNG_POOL
+    RngPoolRefill();
+#endif
+#ifdef CONFIG_LORA_SLEEP_POLICY
+    Radio.SleepIdle();
+#endif
+    if (Radio.IrqPending != NULL && Radio.IrqPending()) {
+        // Radio interrupt whose event was dropped on a full queue
+        SchedSetEvents(&lora_radio_task, LORA_EVENT_RADIO);
+#ifdef CONFIG_LWAN_AT_LINE_RX
+    } else if (linkwan_at_pending()) {
+        // Line whose event was dropped on a full queue
+        SchedSetEvents(&lora_at_task, LORA_EVENT_AT_LINE);
+#endif
+#ifdef CONFIG_FLASH_QUEUE
+    } else if (lora_flash_step()) {
+        // More steps, no sleep before the next one
+#endif
+    } else if (print_isdone()) {
+        TimerLowPowerHandler();
+    }
 }
 
-
-void lora_init(LoRaMainCallback_t *callbacks)
+static void lora_sched_init(void)
 {
-    g_lwan_device_state = DEVICE_STATE_INIT;
-    app_callbacks = callbacks;
+    SchedTaskInit(&lora_input_task, lora_input_handler, LORA_INPUT_PRIORITY);
+    SchedTaskInit(&lora_radio_task, lora_radio_handler, LORA_RADIO_PRIORITY);
+    SchedTaskInit(&lora_fsm_task, NULL, LORA_FSM_PRIORITY);
+#ifdef CONFIG_LWAN_AT
+    SchedTaskInit(&lora_at_task, lora_at_handler, LORA_AT_PRIORITY);
+#endif
+    SchedSetQueueTask(&lora_input_task);
+    SchedSetIdleHandler(lora_idle);
+}
+#elif defined(CONFIG_EVENT_QUEUE)
+static void lora_events_process( void )
+{
+    Event_t event;
 
+    while (EventGet(&event)) {
+        switch (event.Type) {
+            case EVENT_RADIO_IRQ:
+                if (Radio.IrqProcess != NULL) {
+                    Radio.IrqProcess();
+                }
+                break;
 #ifdef CONFIG_LWAN_AT
-    linkwan_at_init();
+            case EVENT_UART_RX:
+#ifndef CONFIG_LWAN_AT_LINE_RX
+                if (linkwan_serial_process(event.Param)) {
+                    // Runs the command before the next bytes overwrite it
+                    linkwan_at_process();
+                }
+#endif
+                break;
+#endif
+#ifdef CONFIG_PULSE_COUNTER
+            case EVENT_PULSE:
+                lora_pulse_record(&event);
+                break;
+#endif
+            default:
+                break;
+        }
+    }
+#ifdef CONFIG_LWAN_AT_LINE_RX
+    // The lines of the AT ring, also those whose event was dropped on a
+    // full queue
+    while (linkwan_at_pending()) {
+        linkwan_at_process();
+    }
 #endif
+    // Radio interrupt whose event was dropped on a full queue
+    if (Radio.IrqPending != NULL && Radio.IrqPending() && Radio.IrqProcess != NULL) {
+        Radio.IrqProcess();
+    }
 }
+#endif
 
 void lora_fsm( void )
 {
+#ifdef CONFIG_WATCHDOG
+    bool fsm_step;
+#endif
+#ifdef CONFIG_SCHEDULER
+    DeviceState_t fsm_state = DEVICE_STATE_SLEEP;
+
+    lora_sched_init();
+#endif
     while (1) {
+#if defined(CONFIG_SCHEDULER)
+        // Steps again right away on a state change, otherwise runs the tasks
+        // and sleeps until the state machine is woken
+        if (g_lwan_device_state == DEVICE_STATE_SLEEP || g_lwan_device_state == fsm_state) {
+            SchedWait(&lora_fsm_task, LORA_EVENT_STATE);
+        }
+        fsm_state = g_lwan_device_state;
+#elif defined(CONFIG_EVENT_QUEUE)
+        lora_events_process();
+#else
+#ifdef CONFIG_LWAN_RELAY
+        // The relay listens through the radio scheduler while the MAC is
+        // idle, the MAC gets the radio back for its requests
+        if (g_lwan_device_state != DEVICE_STATE_SLEEP) {
+            lwan_relay_suspend();
+        }
+        if (lwan_relay_active()) {
+            RadioSchedProcess();
+        } else
+#endif
         if (Radio.IrqProcess != NULL) {
             Radio.IrqProcess();
         }
@@ -543,6 +1526,28 @@ void lora_fsm( void )
 #ifdef CONFIG_LWAN_AT
         linkwan_at_process();
 #endif        
+#endif
+#ifdef CONFIG_LWAN_AT_URC
+        linkwan_at_urc_flush();
+#endif
+#ifdef CONFIG_WATCHDOG
+        // Each wakeup feeds the IWDG, the steps out of the sleep state are
+        // timed, the sleep is not
+        WatchdogProcess();
+        fsm_step = (g_lwan_device_state != DEVICE_STATE_SLEEP);
+        if (fsm_step) {
+            WatchdogTaskBegin(WATCHDOG_TASK_MAC);
+        }
+#endif
+#ifdef CONFIG_LWAN_TX_PREPARE
+        // Set busy first, the application may tell the data ready from the callback
+        if (g_tx_prepare == TX_PREPARE_DUE) {
+            g_tx_prepare = TX_PREPARE_BUSY;
+            WATCHDOG_TASK_BEGIN(WATCHDOG_TASK_APP);
+            app_callbacks->LoraTxPrepare();
+            WATCHDOG_TASK_END(WATCHDOG_TASK_APP);
+        }
+#endif
         switch (g_lwan_device_state) {
             case DEVICE_STATE_INIT: { 
                 LoRaMacPrimitives.MacMcpsConfirm = mcps_confirm;
@@ -550,37 +1555,17 @@ void lora_fsm( void )
                 LoRaMacPrimitives.MacMlmeConfirm = mlme_confirm;
                 LoRaMacPrimitives.MacMlmeIndication = mlme_indication;
                 LoRaMacCallbacks.GetBatteryLevel = app_callbacks->BoardGetBatteryLevel;
-                LoRaMacCallbacks.GetTemperatureLevel = NULL;
-#if defined(REGION_AS923)
-                LoRaMacInitialization(&LoRaMacPrimitives, &LoRaMacCallbacks, LORAMAC_REGION_AS923);
-#elif defined(REGION_AU915)
-                LoRaMacInitialization(&LoRaMacPrimitives, &LoRaMacCallbacks, LORAMAC_REGION_AU915);
-#elif defined(REGION_CN470)
-                LoRaMacInitialization(&LoRaMacPrimitives, &LoRaMacCallbacks, LORAMAC_REGION_CN470);
-#elif defined(REGION_CN779)
-                LoRaMacInitialization(&LoRaMacPrimitives, &LoRaMacCallbacks, LORAMAC_REGION_CN779);
-#elif defined(REGION_EU433)
-                LoRaMacInitialization(&LoRaMacPrimitives, &LoRaMacCallbacks, LORAMAC_REGION_EU433);
-#elif defined(REGION_IN865)
-                LoRaMacInitialization(&LoRaMacPrimitives, &LoRaMacCallbacks, LORAMAC_REGION_IN865);
-#elif defined(REGION_EU868)
-                LoRaMacInitialization(&LoRaMacPrimitives, &LoRaMacCallbacks, LORAMAC_REGION_EU868);
-#elif defined(REGION_KR920)
-                LoRaMacInitialization(&LoRaMacPrimitives, &LoRaMacCallbacks, LORAMAC_REGION_KR920);
-#elif defined(REGION_US915)
-                LoRaMacInitialization(&LoRaMacPrimitives, &LoRaMacCallbacks, LORAMAC_REGION_US915);
-#elif defined(REGION_US915_HYBRID)
-                LoRaMacInitialization(&LoRaMacPrimitives, &LoRaMacCallbacks, LORAMAC_REGION_US915_HYBRID);
-#elif defined( REGION_CN470A )
-                LoRaMacInitialization( &LoRaMacPrimitives, &LoRaMacCallbacks, LORAMAC_REGION_CN470A);
-#else
-#error "Please define a region in the compiler options."
-#endif
+                LoRaMacCallbacks.GetTemperatureLevel = app_callbacks->BoardGetTemperatureLevel;
+                LoRaMacInitialization(&LoRaMacPrimitives, &LoRaMacCallbacks, lwan_region_load());
                 init_lwan_configs();
                 if(!lwan_is_key_valid(g_lwan_dev_keys_p->pkey, LORA_KEY_LENGTH))
                     print_dev_info();
                 
                 TimerInit( &TxNextPacketTimer, on_tx_next_packet_timer_event );
+                TimerSetSlack( &TxNextPacketTimer, TX_NEXT_PACKET_SLACK );
+#ifdef CONFIG_LWAN_TX_PREPARE
+                TimerInit( &TxPrepareTimer, on_tx_prepare_timer_event );
+#endif
 
                 lwan_dev_params_update();
                 lwan_mac_params_update();
@@ -594,10 +1579,18 @@ void lora_fsm( void )
                     mibReq.Param.DevAddr = g_lwan_dev_keys_p->abp.devaddr;
                     LoRaMacMibSetRequestConfirm(&mibReq);    
                     mibReq.Type = MIB_NWK_SKEY;
+#ifdef CONFIG_KEY_SLOTS
+                    mibReq.Param.NwkSKey = KeySlotKey(KEY_SLOT_ABP_NWK_S_KEY);
+#else
                     mibReq.Param.NwkSKey = g_lwan_dev_keys_p->abp.nwkskey;
+#endif
                     LoRaMacMibSetRequestConfirm(&mibReq);
                     mibReq.Type = MIB_APP_SKEY;
+#ifdef CONFIG_KEY_SLOTS
+                    mibReq.Param.AppSKey = KeySlotKey(KEY_SLOT_ABP_APP_S_KEY);
+#else
                     mibReq.Param.AppSKey = g_lwan_dev_keys_p->abp.appskey;
+#endif
                     LoRaMacMibSetRequestConfirm(&mibReq);
 #ifdef CONFIG_LINKWAN                    
                     mibReq.Type = MIB_FREQ_BAND;
@@ -607,6 +1600,18 @@ void lora_fsm( void )
                     mibReq.Type = MIB_NETWORK_JOINED;
                     mibReq.Param.IsNetworkJoined = true;
                     LoRaMacMibSetRequestConfirm(&mibReq);
+#ifdef CONFIG_LWAN_FCNT_STORE
+                    // The ABP session goes on with the counters of the last boot
+                    uint32_t fcnt_up, fcnt_down;
+                    if (lwan_fcnt_restore(&fcnt_up, &fcnt_down) == LWAN_SUCCESS) {
+                        mibReq.Type = MIB_UPLINK_COUNTER;
+                        mibReq.Param.UpLinkCounter = fcnt_up;
+                        LoRaMacMibSetRequestConfirm(&mibReq);
+                        mibReq.Type = MIB_DOWNLINK_COUNTER;
+                        mibReq.Param.DownLinkCounter = fcnt_down;
+                        LoRaMacMibSetRequestConfirm(&mibReq);
+                    }
+#endif
                     
                     lwan_mac_params_update();
 #ifdef CONFIG_LORA_VERIFY 
@@ -615,6 +1620,22 @@ void lora_fsm( void )
                     g_lwan_device_state = DEVICE_STATE_SLEEP;
 #endif    
 		        }else if(g_lwan_dev_config_p->modes.join_mode == JOIN_MODE_OTAA) {
+#ifdef CONFIG_LWAN_SESSION_STORE
+                    if (session_restore()) {
+                        LOG_PRINTF(LL_DEBUG, "Session resumed\r\n");
+                        if (g_lwan_dev_config_p->modes.class_mode == CLASS_B) {
+                            g_lwan_device_state = DEVICE_STATE_REQ_DEVICE_TIME;
+                        } else {
+#ifdef CONFIG_LWAN_AT
+                            g_lwan_device_state = DEVICE_STATE_SLEEP;
+#else
+                            g_lwan_device_state = DEVICE_STATE_SEND;
+#endif
+                        }
+                        lwan_dev_status_set(DEVICE_STATUS_IDLE);
+                        break;
+                    }
+#endif
 #ifdef CONFIG_LWAN_AT                      
                     if(g_lwan_dev_config_p->join_settings.auto_join){
                         g_lwan_device_state = DEVICE_STATE_JOIN;
@@ -638,13 +1659,26 @@ void lora_fsm( void )
                     mlmeReq.Type = MLME_JOIN;
                     mlmeReq.Req.Join.DevEui = g_lwan_dev_keys_p->ota.deveui;
                     mlmeReq.Req.Join.AppEui = g_lwan_dev_keys_p->ota.appeui;
+#ifdef CONFIG_KEY_SLOTS
+                    mlmeReq.Req.Join.AppKey = KeySlotKey(KEY_SLOT_APP_KEY);
+#else
                     mlmeReq.Req.Join.AppKey = g_lwan_dev_keys_p->ota.appkey;
+#endif
 #ifdef CONFIG_LINKWAN    
                     mlmeReq.Req.Join.method = g_lwan_dev_config_p->join_settings.join_method;
                     if (g_lwan_dev_config_p->join_settings.join_method == JOIN_METHOD_STORED) {
                         mlmeReq.Req.Join.freqband = g_lwan_dev_config_p->join_settings.stored_freqband;
                         mlmeReq.Req.Join.datarate = g_lwan_dev_config_p->join_settings.stored_datarate;
                         mlmeReq.Req.Join.NbTrials = 3;
+#ifdef CONFIG_LWAN_JOIN_CACHE
+                    } else if (g_lwan_dev_config_p->join_settings.join_method == JOIN_METHOD_SCAN &&
+                               g_join_order_next < g_join_order_num) {
+                        // The bands which joined before are scanned first, in likelihood order
+                        mlmeReq.Req.Join.method = JOIN_METHOD_STORED;
+                        mlmeReq.Req.Join.freqband = g_join_order[g_join_order_next];
+                        mlmeReq.Req.Join.datarate = g_lwan_dev_config_p->join_settings.stored_datarate;
+                        mlmeReq.Req.Join.NbTrials = g_lwan_dev_config_p->join_settings.join_trials;
+#endif
                     } else {
                         mlmeReq.Req.Join.NbTrials = g_lwan_dev_config_p->join_settings.join_trials;
                     }
@@ -655,6 +1689,13 @@ void lora_fsm( void )
                     if (next_tx == true && rejoin_flag == true) {
                         if (LoRaMacMlmeRequest(&mlmeReq) == LORAMAC_STATUS_OK) {
                             next_tx = false;
+                            join_request_sent(mlmeReq.Req.Join.NbTrials);
+#ifdef CONFIG_LWAN_JOIN_CACHE
+                            if (g_lwan_dev_config_p->join_settings.join_method == JOIN_METHOD_SCAN &&
+                                g_join_order_next < g_join_order_num) {
+                                g_join_order_next++;
+                            }
+#endif
                         }
 #ifdef CONFIG_LINKWAN                        
                         LOG_PRINTF(LL_DEBUG, "Start to Join, method %d, nb_trials:%d\r\n",
@@ -684,9 +1725,15 @@ void lora_fsm( void )
                 join_settings.join_method = JOIN_METHOD_STORED;
                 
                 lwan_dev_config_set(DEV_CONFIG_JOIN_SETTINGS, &join_settings);
+#ifdef CONFIG_LWAN_JOIN_CACHE
+                join_cache_update(join_settings.stored_freqband, g_join_rssi);
+#endif
 #endif                
                 
                 lwan_mac_params_update();
+#ifdef CONFIG_LWAN_SESSION_STORE
+                session_save();
+#endif
                 
                 if(g_lwan_dev_config_p->modes.class_mode == CLASS_B) {
                     g_lwan_device_state = DEVICE_STATE_REQ_DEVICE_TIME;
@@ -701,14 +1748,12 @@ void lora_fsm( void )
             }
             case DEVICE_STATE_REQ_DEVICE_TIME: {
                 MlmeReq_t mlmeReq;
-                MibRequestConfirm_t mib_req;
 
-                mib_req.Type = MIB_NETWORK_JOINED;
-                LoRaMacMibGetRequestConfirm(&mib_req);
-                if (mib_req.Param.IsNetworkJoined == true) {
+                if (LoRaMacIsNetworkJoined() == true) {
                     if( next_tx == true ) {
                         mlmeReq.Type = MLME_DEVICE_TIME;
                         LoRaMacMlmeRequest( &mlmeReq );
+                        g_device_time_app = false;
                     }
                     g_lwan_device_state = DEVICE_STATE_SEND_MAC;
                 } else {
@@ -746,6 +1791,29 @@ void lora_fsm( void )
                 break;
             }
             case DEVICE_STATE_SEND: {
+#ifdef CONFIG_LWAN_TX_PREPARE
+                // The uplink goes once the data acquired ahead is ready, or at the timeout
+                if (g_tx_prepare == TX_PREPARE_BUSY && !g_tx_prepare_wait) {
+                    g_tx_prepare_wait = true;
+                    TimerSetValue(&TxPrepareTimer, CONFIG_LWAN_TX_PREPARE_TIMEOUT);
+                    TimerStart(&TxPrepareTimer);
+                    g_lwan_device_state = DEVICE_STATE_SLEEP;
+                    break;
+                }
+                TimerStop(&TxPrepareTimer);
+                g_tx_prepare_wait = false;
+                g_tx_prepare = TX_PREPARE_IDLE;
+#endif
+#ifdef CONFIG_LWAN_AGGREGATE
+                if (next_tx == true && agg_flush) {
+                    if (agg_prepare_tx_frame()) {
+                        next_tx = send_frame();
+                        if (next_tx == false) {
+                            agg_tx_frame_sent();
+                        }
+                    }
+                } else
+#endif
                 if (next_tx == true) {
                     prepare_tx_frame();
                     next_tx = send_frame();
@@ -758,6 +1826,30 @@ void lora_fsm( void )
                 break;
             }
             case DEVICE_STATE_SEND_MAC: {
+#ifdef CONFIG_LWAN_FUOTA
+                // The package answers ride on the uplinks which carry no
+                // application data
+                if (next_tx == true && lwan_fuota_answer_get(&g_data_send_port, tx_data.Buff, &tx_data.BuffSize)) {
+                    next_tx = send_frame();
+                    lwan_fuota_answer_sent(next_tx == false);
+                } else
+#endif
+#ifdef CONFIG_LWAN_RELAY
+                if (next_tx == true && lwan_relay_fwd_get(&g_data_send_port, tx_data.Buff, &tx_data.BuffSize,
+                                                          MIN(LoRaMacGetMaxPayload(), LORAWAN_APP_DATA_BUFF_SIZE))) {
+                    next_tx = send_frame();
+                    lwan_relay_fwd_sent(next_tx == false);
+                } else
+#endif
+#ifdef CONFIG_LWAN_DATALOG
+                if (next_tx == true && lwan_datalog_get(&g_data_send_port, tx_data.Buff, &tx_data.BuffSize,
+                                                        MIN(LoRaMacGetMaxPayload(), LORAWAN_APP_DATA_BUFF_SIZE))) {
+                    // The records are dropped once the uplink is acknowledged
+                    g_data_send_msg_type = LORAWAN_CONFIRMED_MSG;
+                    next_tx = send_frame();
+                    lwan_datalog_sent(next_tx == false);
+                } else
+#endif
                 if (next_tx == true) {
                     tx_data.BuffSize = 0;
                     next_tx = send_frame();
@@ -771,9 +1863,59 @@ void lora_fsm( void )
                 break;
             }
             case DEVICE_STATE_SLEEP: {
+#if defined(CONFIG_LWAN_AT) && (!defined(CONFIG_EVENT_QUEUE) || defined(CONFIG_LWAN_AT_LINE_RX))
+                if (linkwan_at_pending()) {
+                    break;
+                }
+#endif
+#ifdef CONFIG_LWAN_AT_URC
+                if (linkwan_at_urc_pending()) {
+                    break;
+                }
+#endif
+#ifdef CONFIG_LWAN_CONFIG_DEFER
+                lwan_config_process();
+#endif
+#ifdef CONFIG_LWAN_FUOTA
+                if (lwan_fuota_process() && next_tx == true) {
+                    g_lwan_device_state = DEVICE_STATE_SEND_MAC;
+                    break;
+                }
+#endif
+#ifdef CONFIG_LWAN_RELAY
+                if (lwan_relay_process(next_tx == true && !lwan_is_dev_busy() && LoRaMacIsNetworkJoined() &&
+                                       g_lwan_dev_config_p->modes.class_mode == CLASS_A) && next_tx == true) {
+                    g_lwan_device_state = DEVICE_STATE_SEND_MAC;
+                    break;
+                }
+#endif
+#ifdef CONFIG_LWAN_DATALOG
+                if (lwan_datalog_process(!lwan_is_dev_busy()) && next_tx == true && LoRaMacIsNetworkJoined()) {
+                    g_lwan_device_state = DEVICE_STATE_SEND_MAC;
+                    break;
+                }
+#endif
+#if defined(CONFIG_FLASH_QUEUE) && !defined(CONFIG_SCHEDULER)
+                if (lora_flash_step()) {
+                    break;
+                }
+#endif
+#ifndef CONFIG_SCHEDULER
+                log_deferred_flush();
+#ifdef CONFIG_RNG_POOL
+                RngPoolRefill();
+#endif
+#ifdef CONFIG_LORA_SLEEP_POLICY
+#ifdef CONFIG_LWAN_RELAY
+                // The sniffing puts the radio to sleep itself
+                if (!lwan_relay_active())
+#endif
+                Radio.SleepIdle();
+#endif
                 if( print_isdone( ) ) {
                     TimerLowPowerHandler( );
                 }
+#endif
                 break;
             }
             default: {
@@ -781,6 +1923,11 @@ void lora_fsm( void )
                 break;
             }
         }
+#ifdef CONFIG_WATCHDOG
+        if (fsm_step) {
+            WatchdogTaskEnd(WATCHDOG_TASK_MAC);
+        }
+#endif
     }
 }
 
@@ -795,6 +1942,7 @@ void lwan_dev_state_set(DeviceState_t state)
         TimerStop(&TxNextPacketTimer);
     }
     g_lwan_device_state = state;
+    lora_fsm_wakeup();
 }
 
 bool lwan_dev_status_set(DeviceStatus_t ds)
@@ -831,6 +1979,8 @@ int lwan_mac_req_send(int type, void *param)
             break;
         }
         case MAC_REQ_DEVICE_TIME: {
+            mlmeReq.Type = MLME_DEVICE_TIME;
+            g_device_time_app = true;
             break;
         }
         case MAC_REQ_PSLOT_INFO: {
@@ -854,8 +2004,12 @@ int lwan_mac_req_send(int type, void *param)
         }
     }
     
+#ifdef CONFIG_LWAN_RELAY
+    lwan_relay_suspend();
+#endif
     if (LoRaMacMlmeRequest(&mlmeReq) == LORAMAC_STATUS_OK) {
         g_lwan_device_state = DEVICE_STATE_SEND_MAC;
+        lora_fsm_wakeup();
     }
     
 
@@ -886,6 +2040,7 @@ int lwan_join(uint8_t bJoin, uint8_t bAutoJoin, uint16_t joinInterval, uint16_t
             return LWAN_ERROR;
         g_lwan_device_state = DEVICE_STATE_SLEEP;
         rejoin_flag = bAutoJoin;
+        lora_fsm_wakeup();
     } else if(bJoin == 1){
         MibRequestConfirm_t mib_req;
         mib_req.Type = MIB_NETWORK_JOINED;
@@ -906,6 +2061,7 @@ int lwan_join(uint8_t bJoin, uint8_t bAutoJoin, uint16_t joinInterval, uint16_t
         TimerStop(&TxNextPacketTimer);   
         rejoin_flag = true;
         reset_join_state();
+        lora_fsm_wakeup();
     } else{
         ret = LWAN_ERROR;
     }
@@ -915,38 +2071,149 @@ int lwan_join(uint8_t bJoin, uint8_t bAutoJoin, uint16_t joinInterval, uint16_t
 
 int lwan_data_send(uint8_t confirm, uint8_t Nbtrials, uint8_t *payload, uint8_t len)
 {
-    MibRequestConfirm_t mib_req;
-    LoRaMacStatus_t status;
+    if (len > LORAWAN_APP_DATA_BUFF_SIZE) {
+        return LWAN_ERROR;
+    }
 
     TimerStop(&TxNextPacketTimer);
 
-    mib_req.Type = MIB_NETWORK_JOINED;
-    status = LoRaMacMibGetRequestConfirm(&mib_req);
-    if (status == LORAMAC_STATUS_OK) {
-        if (mib_req.Param.IsNetworkJoined == true) {
-            g_data_send_msg_type = confirm;
-            memcpy(tx_data.Buff, payload, len);
-            tx_data.BuffSize = len;
-            g_data_send_nbtrials = Nbtrials;
-            g_lwan_device_state = DEVICE_STATE_SEND;
-            return LWAN_SUCCESS;
-        }
+    if (LoRaMacIsNetworkJoined() == true) {
+        g_data_send_msg_type = confirm;
+        memcpy(tx_data.Buff, payload, len);
+        tx_data.BuffSize = len;
+        g_data_send_nbtrials = Nbtrials;
+        g_lwan_device_state = DEVICE_STATE_SEND;
+        lora_fsm_wakeup();
+        return LWAN_SUCCESS;
     }
     return LWAN_ERROR;
 }
 
+int lwan_data_send_async(uint8_t confirm, uint8_t Nbtrials, uint8_t *payload, uint8_t len, lwan_send_cb_t cb)
+{
+    if ((payload == NULL && len > 0) || next_tx == false)
+        return LWAN_ERROR;
+    if (LoRaMacIsNetworkJoined() == false)
+        return LWAN_ERROR;
+
+    TimerStop(&TxNextPacketTimer);
+    g_data_send_msg_type = confirm;
+    g_data_send_nbtrials = Nbtrials;
+    // Set first, the confirm of a frame sent at once may come before the return
+    g_send_cb = cb;
+    next_tx = false;
+    if (send_payload(payload, len)) {
+        g_send_cb = NULL;
+        next_tx = true;
+        return LWAN_ERROR;
+    }
+    if (g_lwan_mac_config_p->modes.report_mode == TX_ON_TIMER) {
+        start_dutycycle_timer();
+    }
+    return LWAN_SUCCESS;
+}
+
 int lwan_data_recv(uint8_t *port, uint8_t **payload, uint8_t *size)
 {
     if(!port || !payload || !size)
         return LWAN_ERROR;
     *port = rx_data.Port;
-    *size = rx_data.BuffSize;
+    *size = rx_data.Buff ? rx_data.BuffSize : 0;
     *payload = rx_data.Buff;
     
     rx_data.BuffSize = 0;
     return LWAN_SUCCESS;
 }
 
+void lwan_data_release(void)
+{
+    if (rx_data.Buff) {
+        LoRaMacRxBufferRelease(rx_data.Buff);
+        rx_data.Buff = NULL;
+    }
+    rx_data.BuffSize = 0;
+}
+
+#ifdef CONFIG_LORAMAC_FAST_INDICATION
+static void fast_indication(McpsIndication_t *mcpsIndication)
+{
+    lora_AppData_t data;
+
+    data.Buff = mcpsIndication->Buffer;
+    data.BuffSize = mcpsIndication->BufferSize;
+    data.Port = mcpsIndication->Port;
+    WATCHDOG_TASK_BEGIN(WATCHDOG_TASK_APP);
+    app_callbacks->LoraRxData(&data);
+    WATCHDOG_TASK_END(WATCHDOG_TASK_APP);
+}
+
+int lwan_data_fast_port_set(uint8_t port)
+{
+    LoRaMacStatus_t status;
+
+    if (port == 0) {
+        status = LoRaMacFastIndicationSet(1, NULL);
+    } else {
+        status = LoRaMacFastIndicationSet(port, fast_indication);
+    }
+    return (status == LORAMAC_STATUS_OK) ? LWAN_SUCCESS : LWAN_ERROR;
+}
+#endif
+
+#ifdef CONFIG_LORAMAC_TX_TIME
+int lwan_tx_time_get(uint8_t size, lwan_tx_time_t *tx_time)
+{
+    LoRaMacTxTime_t mac_tx_time;
+
+    if (!tx_time || LoRaMacQueryTxTime(size, &mac_tx_time) != LORAMAC_STATUS_OK)
+        return LWAN_ERROR;
+    tx_time->delay = mac_tx_time.Delay;
+    tx_time->channel = mac_tx_time.Channel;
+    tx_time->freq = mac_tx_time.Frequency;
+    tx_time->datarate = mac_tx_time.Datarate;
+    tx_time->time_on_air = mac_tx_time.TimeOnAir;
+    return LWAN_SUCCESS;
+}
+#endif
+
+#ifdef CONFIG_LWAN_AGGREGATE
+int lwan_record_add(uint8_t type, uint8_t *data, uint8_t len)
+{
+    lwan_record_t *rec;
+
+    if (type > LWAN_RECORD_MAX_TYPE || len > LWAN_RECORD_MAX_SIZE || (len && !data) ||
+        agg_count == CONFIG_LWAN_AGGREGATE_RECORDS) {
+        return LWAN_ERROR;
+    }
+    if (!agg_timer_init) {
+        TimerInit(&agg_timer, on_agg_timer_event);
+        agg_timer_init = true;
+    }
+
+    rec = &agg_records[(agg_head + agg_count) % CONFIG_LWAN_AGGREGATE_RECORDS];
+    rec->time = TimerGetCurrentTime();
+    rec->type = type;
+    rec->len = len;
+    memcpy(rec->data, data, len);
+    if (agg_count++ == 0) {
+        agg_start_deadline();
+    }
+
+    if (!agg_flush && agg_ready()) {
+        agg_request_send();
+    }
+    return LWAN_SUCCESS;
+}
+
+int lwan_record_flush(void)
+{
+    if (agg_count == 0) {
+        return LWAN_SUCCESS;
+    }
+    return agg_request_send() ? LWAN_SUCCESS : LWAN_ERROR;
+}
+#endif
+
 uint8_t lwan_dev_battery_get()
 {
     return app_callbacks->BoardGetBatteryLevel();
@@ -956,88 +2223,232 @@ int lwan_dev_rssi_get(uint8_t band, int16_t *channel_rssi)
 {
     //CN470A Only
     uint8_t FreqBandStartChannelNum[16] = {0, 8, 16, 24, 100, 108, 116, 124, 68, 76, 84, 92, 166, 174, 182, 190};
+    uint32_t freqs[8];
+    RadioScanChannel_t channels[8];
+
     if(band>=16) 
         return LWAN_ERROR;
 
-    Radio.SetModem(MODEM_LORA);
     for (uint8_t i = 0; i < 8; i++) {
-        uint32_t freq = 470300000 + (FreqBandStartChannelNum[band] + i) * 200000;
-        
-        Radio.SetChannel(freq);
-        Radio.Rx( 0 );
-        DelayMs(3);
-        
-        channel_rssi[i] = Radio.Rssi(MODEM_LORA);
+        freqs[i] = 470300000 + (FreqBandStartChannelNum[band] + i) * 200000;
+    }
+    memset(channels, 0, sizeof(channels));
+    if (lwan_dev_scan(freqs, 8, LWAN_RSSI_SAMPLES, channels) != LWAN_SUCCESS)
+        return LWAN_ERROR;
+
+    for (uint8_t i = 0; i < 8; i++) {
+        channel_rssi[i] = channels[i].RssiSum / (int32_t)channels[i].Samples;
     }
-    
-    Radio.Sleep();
     
     return LWAN_SUCCESS;
 }
 
+int lwan_dev_scan(const uint32_t *freqs, uint8_t count, uint16_t samples, RadioScanChannel_t *channels)
+{
+    RadioSpectrumScan_t scan;
+
+    if (Radio.StartSpectrumScan == NULL || count == 0 || samples == 0)
+        return LWAN_ERROR;
+
+    scan.Freqs = freqs;
+    scan.Count = count;
+    scan.Samples = samples;
+    scan.Channels = channels;
+    scan.Done = false;
 
-bool lwan_multicast_add(void *multicastInfo )
+    // The samples are read by the radio bottom half, run here until the
+    // scan puts the radio back to sleep
+    Radio.SetModem(MODEM_LORA);
+    Radio.StartSpectrumScan(&scan);
+    while (!scan.Done) {
+        Radio.IrqProcess();
+    }
+    return LWAN_SUCCESS;
+}
+
+uint16_t lwan_dev_scan_occupancy(const RadioScanChannel_t *channel, int16_t rssi_thresh)
+{
+    int16_t bin = (rssi_thresh - RADIO_SCAN_RSSI_FLOOR) / RADIO_SCAN_RSSI_STEP;
+    uint32_t busy = 0;
+
+    if (channel->Samples == 0)
+        return 0;
+    if (bin < 0)
+        bin = 0;
+    for (; bin < RADIO_SCAN_BINS; bin++) {
+        busy += channel->Hist[bin];
+    }
+    return busy * 1000 / channel->Samples;
+}
+
+int lwan_dev_scan_quietest(const RadioScanChannel_t *channels, uint8_t count, int16_t rssi_thresh)
+{
+    int quietest = -1;
+    uint16_t best_busy = 0;
+    int32_t best_avg = 0;
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (channels[i].Samples == 0)
+            continue;
+
+        uint16_t busy = lwan_dev_scan_occupancy(&channels[i], rssi_thresh);
+        int32_t avg = channels[i].RssiSum / (int32_t)channels[i].Samples;
+        if (quietest < 0 || busy < best_busy || (busy == best_busy && avg < best_avg)) {
+            quietest = i;
+            best_busy = busy;
+            best_avg = avg;
+        }
+    }
+    return quietest;
+}
+
+#ifdef CONFIG_LORAMAC_CHANNEL_QUALITY
+int lwan_channel_quality_scan(uint16_t samples, int16_t busy_rssi)
+{
+    GetPhyParams_t getPhy;
+    PhyParam_t phyParam;
+    uint16_t *mask;
+    ChannelParams_t *list;
+    uint8_t nb_channels;
+    uint32_t freqs[LWAN_QUALITY_SCAN_CHUNK];
+    uint8_t ids[LWAN_QUALITY_SCAN_CHUNK];
+    RadioScanChannel_t channels[LWAN_QUALITY_SCAN_CHUNK];
+    uint8_t count = 0;
+
+    getPhy.Attribute = PHY_MAX_NB_CHANNELS;
+    phyParam = RegionGetPhyParam(LWAN_REGION_ACTIVE, &getPhy);
+    nb_channels = phyParam.Value;
+    getPhy.Attribute = PHY_CHANNELS_MASK;
+    mask = RegionGetPhyParam(LWAN_REGION_ACTIVE, &getPhy).ChannelsMask;
+    getPhy.Attribute = PHY_CHANNELS;
+    list = RegionGetPhyParam(LWAN_REGION_ACTIVE, &getPhy).Channels;
+
+    // The enabled channels, scanned a chunk at a time
+    for (uint16_t ch = 0; ch < nb_channels; ch++) {
+        if ((mask[ch / 16] & (1 << (ch % 16))) != 0 && list[ch].Frequency != 0) {
+            freqs[count] = list[ch].Frequency;
+            ids[count++] = ch;
+        }
+        if (count == LWAN_QUALITY_SCAN_CHUNK || (count > 0 && ch == nb_channels - 1)) {
+            memset(channels, 0, sizeof(channels));
+            if (lwan_dev_scan(freqs, count, samples, channels) != LWAN_SUCCESS)
+                return LWAN_ERROR;
+            for (uint8_t i = 0; i < count; i++) {
+                RegionCommonChannelQualityOccupancy(ids[i], lwan_dev_scan_occupancy(&channels[i], busy_rssi));
+            }
+            count = 0;
+        }
+    }
+    return LWAN_SUCCESS;
+}
+#endif
+
+// Linked multicast groups, the MAC keeps pointers to them
+static MulticastParams_t g_multicast_groups[LORAMAC_MULTICAST_MAX];
+static bool g_multicast_used[LORAMAC_MULTICAST_MAX];
+static uint8_t g_multicast_num = 0;
+
+static int multicast_find(uint32_t dev_addr)
+{
+    for (int i = 0; i < LORAMAC_MULTICAST_MAX; i++) {
+        if (g_multicast_used[i] && g_multicast_groups[i].Address == dev_addr)
+            return i;
+    }
+    return -1;
+}
+
+static bool multicast_unlink(int slot)
 {
     MibRequestConfirm_t mibset;
-    LoRaMacStatus_t status;
-    MulticastParams_t *pmulticastInfo;
 
-    pmulticastInfo = malloc(sizeof(MulticastParams_t));
-    if (!pmulticastInfo)
+    mibset.Type = MIB_MULTICAST_CHANNEL_DEL;
+    mibset.Param.MulticastList = &g_multicast_groups[slot];
+    if (LoRaMacMibSetRequestConfirm(&mibset) != LORAMAC_STATUS_OK)
         return false;
-    memcpy(pmulticastInfo, multicastInfo, sizeof(MulticastParams_t));
-    mibset.Type = MIB_MULTICAST_CHANNEL;
-    mibset.Param.MulticastList = pmulticastInfo;
-    status = LoRaMacMibSetRequestConfirm(&mibset);
-    if (status !=  LORAMAC_STATUS_OK) {
-        return false;
-    }
+    g_multicast_used[slot] = false;
+    g_multicast_num--;
     return true;
 }
 
-bool lwan_multicast_del(uint32_t dev_addr)
+bool lwan_multicast_add_groups(const void *multicastInfos, uint8_t num)
 {
-    MulticastParams_t *multiCastNode = get_lora_cur_multicast();
-    if (multiCastNode == NULL) {
+    const MulticastParams_t *groups = (const MulticastParams_t *)multicastInfos;
+    MibRequestConfirm_t mibset;
+    int slots[LORAMAC_MULTICAST_MAX];
+    int slot = 0;
+    uint8_t i, j;
+
+    if (num == 0 || num > LORAMAC_MULTICAST_MAX - g_multicast_num)
         return false;
-    }
-    
-    while (multiCastNode != NULL) {
-        if (dev_addr == multiCastNode->Address) {
-            MibRequestConfirm_t mibset;
-            LoRaMacStatus_t status;
-            mibset.Type = MIB_MULTICAST_CHANNEL_DEL;
-            mibset.Param.MulticastList = multiCastNode;
-            status = LoRaMacMibSetRequestConfirm(&mibset);
-            if (status !=  LORAMAC_STATUS_OK) {
+    for (i = 0; i < num; i++) {
+        if (multicast_find(groups[i].Address) >= 0)
+            return false;
+        for (j = 0; j < i; j++) {
+            if (groups[j].Address == groups[i].Address)
                 return false;
-            } else {
-                free(mibset.Param.MulticastList);
-                return true;
-            }
         }
-        multiCastNode = multiCastNode->Next;
+    }
 
+    for (i = 0; i < num; i++) {
+        while (g_multicast_used[slot])
+            slot++;
+        memcpy(&g_multicast_groups[slot], &groups[i], sizeof(MulticastParams_t));
+        g_multicast_groups[slot].Next = NULL;
+        mibset.Type = MIB_MULTICAST_CHANNEL;
+        mibset.Param.MulticastList = &g_multicast_groups[slot];
+        if (LoRaMacMibSetRequestConfirm(&mibset) != LORAMAC_STATUS_OK) {
+            // All or none: unlink the groups of this call already linked
+            while (i > 0)
+                multicast_unlink(slots[--i]);
+            return false;
+        }
+        g_multicast_used[slot] = true;
+        g_multicast_num++;
+        slots[i] = slot;
     }
-    return false;
+    return true;
 }
 
-uint8_t lwan_multicast_num_get(void)
+bool lwan_multicast_del_groups(const uint32_t *dev_addrs, uint8_t num)
 {
-    MulticastParams_t *multiCastNode = get_lora_cur_multicast();
-    if (multiCastNode == NULL) {
-        return 0;
+    int slots[LORAMAC_MULTICAST_MAX];
+    uint8_t i;
+
+    if (num == 0 || num > g_multicast_num)
+        return false;
+    for (i = 0; i < num; i++) {
+        slots[i] = multicast_find(dev_addrs[i]);
+        if (slots[i] < 0)
+            return false;
     }
-    uint8_t num = 0;
-    while (multiCastNode != NULL) {
-        num++;
-        multiCastNode = multiCastNode->Next;
+    // Unlinking only fails while a transmission runs, then on the first one
+    for (i = 0; i < num; i++) {
+        if (g_multicast_used[slots[i]] && !multicast_unlink(slots[i]))
+            return false;
     }
-    return num;
+    return true;
+}
+
+bool lwan_multicast_add(void *multicastInfo )
+{
+    return lwan_multicast_add_groups(multicastInfo, 1);
+}
+
+bool lwan_multicast_del(uint32_t dev_addr)
+{
+    return lwan_multicast_del_groups(&dev_addr, 1);
+}
+
+uint8_t lwan_multicast_num_get(void)
+{
+    return g_multicast_num;
 }
 
 void lwan_sys_reboot(int8_t mode)
 {
+#ifdef CONFIG_LWAN_CONFIG_DEFER
+    lwan_config_commit();
+#endif
     if (mode == 0) {
 	    system_reset();
     } else if (mode == 1) {
@@ -1,11 +1,16 @@
 /*
  * Copyright (C) 2015-2017 Alibaba Group Holding Limited
  */
+#define LOG_MODULE LOG_MODULE_AT
+
 #include <stdlib.h>
 #include <string.h>
 #include "log.h"
 #include "LoRaMac.h"
 #include "Region.h"
+#ifdef CONFIG_LORAMAC_CHANNEL_QUALITY
+#include "RegionCommon.h"
+#endif
 #include "tremo_flash.h"
 #include "tremo_delay.h"
 #include "tremo_uart.h"
@@ -13,27 +18,80 @@
 #include "lwan_config.h"
 #include "linkwan.h"
 #include "linkwan_ica_at.h"
+#include "at-engine.h"
+#include "crc.h"
+#include "profile.h"
+#include "watchdog.h"
+#include "crash-dump.h"
+#include "stats.h"
+#ifdef CONFIG_LOWPOWER_GOVERNOR
+#include "rtc-board.h"
+#endif
+#ifdef CONFIG_EVENT_QUEUE
+#include "event-queue.h"
+#endif
+#ifdef CONFIG_LWAN_ENERGY
+#include "lwan_energy.h"
+#endif
 
 #define ARGC_LIMIT 16
-#define ATCMD_SIZE (LORAWAN_APP_DATA_BUFF_SIZE * 2 + 18)
+#define ATCMD_SIZE LWAN_AT_LINE_SIZE
 #define PORT_LEN 4
 
-#define QUERY_CMD		0x01
-#define EXECUTE_CMD		0x02
-#define DESC_CMD        0x03
-#define SET_CMD			0x04
-
+// AT+ISCAN channels at most, default samples per channel and busy level
+#define LWAN_AT_SCAN_CHANNELS   16
+#define LWAN_AT_SCAN_SAMPLES    32
+#define LWAN_AT_SCAN_BUSY_RSSI  -90
+
+#ifdef CONFIG_LWAN_AT_BINARY
+// Frame: sync, length of seq to data, seq, cmd, data, CRC16 of length to data
+#define BIN_SYNC            0xA5
+#define BIN_FRAME_SIZE      (255 + 4)
+#define BIN_REPLY           0x80
+#endif
+
+#ifdef CONFIG_LWAN_AT_URC
+#if (CONFIG_LWAN_AT_URC_QUEUE_SIZE & (CONFIG_LWAN_AT_URC_QUEUE_SIZE - 1)) != 0
+#error "CONFIG_LWAN_AT_URC_QUEUE_SIZE must be a power of 2"
+#endif
+#define URC_MASK_ALL        ((1 << LWAN_AT_URC_NUM) - 1)
+#define URC_HEAD_MAX        8
+#endif
+
+#define QUERY_CMD		AT_ENGINE_QUERY
+#define EXECUTE_CMD		AT_ENGINE_EXECUTE
+#define DESC_CMD        AT_ENGINE_DESC
+#define SET_CMD			AT_ENGINE_SET
+
+#if defined(CONFIG_LWAN_AT_BINARY) && (BIN_FRAME_SIZE > ATCMD_SIZE)
+// The frames are assembled in the command line, see bin_rx
+uint8_t atcmd[BIN_FRAME_SIZE];
+#else
 uint8_t atcmd[ATCMD_SIZE];
+#endif
 uint16_t atcmd_index = 0;
 volatile bool g_atcmd_processing = false;
+static bool atcmd_overflow = false;  // the rest of the line is dropped
+
+#if !defined(CONFIG_EVENT_QUEUE) || defined(CONFIG_LWAN_AT_LINE_RX)
+#define LWAN_AT_RX_RING
+#if (CONFIG_LWAN_AT_RX_RING_SIZE & (CONFIG_LWAN_AT_RX_RING_SIZE - 1)) != 0
+#error "CONFIG_LWAN_AT_RX_RING_SIZE must be a power of 2"
+#endif
+// Filled by the UART interrupt, the bytes of the next commands wait there
+// while a command runs
+static uint8_t at_rx_ring[CONFIG_LWAN_AT_RX_RING_SIZE];
+static volatile uint16_t at_rx_head = 0;
+static volatile uint16_t at_rx_tail = 0;
+#ifdef CONFIG_LWAN_AT_LINE_RX
+// Line ends stored by the interrupt and taken by linkwan_at_process
+static volatile uint16_t at_rx_line_in = 0;
+static uint16_t at_rx_line_out = 0;
+#endif
+#endif
 uint8_t g_default_key[LORA_KEY_LENGTH] = {0x41, 0x53, 0x52, 0x36, 0x35, 0x30, 0x58, 0x2D, 
                                           0x32, 0x30, 0x31, 0x38, 0x31, 0x30, 0x33, 0x30};
 
-typedef struct {
-	char *cmd;
-	int (*fn)(int opt, int argc, char *argv[]);	
-}at_cmd_t;
-
 //AT functions
 static int at_cjoinmode_func(int opt, int argc, char *argv[]);
 static int at_cdeveui_func(int opt, int argc, char *argv[]);
@@ -47,6 +105,9 @@ static int at_cdelmulticast_func(int opt, int argc, char *argv[]);
 static int at_cnummulticast_func(int opt, int argc, char *argv[]);
 static int at_cfreqbandmask_func(int opt, int argc, char *argv[]);
 static int at_culdlmode_func(int opt, int argc, char *argv[]);
+#ifdef CONFIG_REGION_MULTI
+static int at_cregion_func(int opt, int argc, char *argv[]);
+#endif
 static int at_cworkmode_func(int opt, int argc, char *argv[]);
 static int at_cclass_func(int opt, int argc, char *argv[]);
 static int at_cbl_func(int opt, int argc, char *argv[]);
@@ -61,8 +122,17 @@ static int at_crssi_func(int opt, int argc, char *argv[]);
 static int at_cnbtrials_func(int opt, int argc, char *argv[]);
 static int at_crm_func(int opt, int argc, char *argv[]);
 static int at_ctxp_func(int opt, int argc, char *argv[]);
+#ifdef CONFIG_LORAMAC_TX_TIME
+static int at_ctxtime_func(int opt, int argc, char *argv[]);
+#endif
 static int at_clinkcheck_func(int opt, int argc, char *argv[]);
 static int at_cadr_func(int opt, int argc, char *argv[]);
+#ifdef CONFIG_LORAMAC_LINK_ADR
+static int at_clinkadr_func(int opt, int argc, char *argv[]);
+#endif
+#ifdef CONFIG_LORA_RADIO_STATS
+static int at_cradiostat_func(int opt, int argc, char *argv[]);
+#endif
 static int at_crxp_func(int opt, int argc, char *argv[]);
 static int at_crx1delay_func(int opt, int argc, char *argv[]);
 static int at_csave_func(int opt, int argc, char *argv[]);
@@ -76,123 +146,593 @@ static int at_cgsn_func(int opt, int argc, char *argv[]);
 static int at_cgbr_func(int opt, int argc, char *argv[]);
 static int at_iloglvl_func(int opt, int argc, char *argv[]);
 static int at_ireboot_func(int opt, int argc, char *argv[]);
-
-static at_cmd_t g_at_table[] = {
-    {LORA_AT_CJOINMODE, at_cjoinmode_func},
-    {LORA_AT_CDEVEUI,  at_cdeveui_func},
-    {LORA_AT_CAPPEUI,  at_cappeui_func},
-    {LORA_AT_CAPPKEY,  at_cappkey_func},
-    {LORA_AT_CDEVADDR,  at_cdevaddr_func},
-    {LORA_AT_CAPPSKEY,  at_cappskey_func},
-    {LORA_AT_CNWKSKEY,  at_cnwkskey_func},
-    {LORA_AT_CADDMUTICAST,  at_caddmulticast_func},
-    {LORA_AT_CDELMUTICAST,  at_cdelmulticast_func},
-    {LORA_AT_CNUMMUTICAST,  at_cnummulticast_func},
-    {LORA_AT_CFREQBANDMASK,  at_cfreqbandmask_func},
-    {LORA_AT_CULDLMODE,  at_culdlmode_func},
-    {LORA_AT_CWORKMODE,  at_cworkmode_func},
-    {LORA_AT_CCLASS,  at_cclass_func},
-    {LORA_AT_CBL,  at_cbl_func},
-    {LORA_AT_CSTATUS,  at_cstatus_func},
-    {LORA_AT_CJOIN, at_cjoin_func},
-    {LORA_AT_DTRX,  at_dtrx_func},
-    {LORA_AT_DRX,  at_drx_func},
-    {LORA_AT_CCONFIRM,  at_cconfirm_func},
-    {LORA_AT_CAPPPORT,  at_cappport_func},
-    {LORA_AT_CDATARATE,  at_cdatarate_func},
-    {LORA_AT_CRSSI,  at_crssi_func},
-    {LORA_AT_CNBTRIALS,  at_cnbtrials_func},
-    {LORA_AT_CRM,  at_crm_func},
-    {LORA_AT_CTXP,  at_ctxp_func},
-    {LORA_AT_CLINKCHECK,  at_clinkcheck_func},
-    {LORA_AT_CADR,  at_cadr_func},
-    {LORA_AT_CRXP,  at_crxp_func},
-    {LORA_AT_CRX1DELAY,  at_crx1delay_func},
-    {LORA_AT_CSAVE,  at_csave_func},
-    {LORA_AT_CRESTORE,  at_crestore_func},
-    {LORA_AT_PINGSLOTINFOREQ,  at_cpslotinforeq_func},
-    {LORA_AT_CKEYSPROTECT,  at_ckeysprotect_func},
-    {LORA_AT_CGMI,  at_cgmi_func},
-    {LORA_AT_CGMM,  at_cgmm_func},
-    {LORA_AT_CGMR,  at_cgmr_func},
-    {LORA_AT_CGSN,  at_cgsn_func},
-    {LORA_AT_CGBR,  at_cgbr_func},
-    {LORA_AT_ILOGLVL,  at_iloglvl_func},
-    {LORA_AT_IREBOOT,  at_ireboot_func},
+static int at_iscan_func(int opt, int argc, char *argv[]);
+#ifdef CONFIG_PROFILE
+static int at_iprofile_func(int opt, int argc, char *argv[]);
+#endif
+#ifdef CONFIG_WATCHDOG
+static int at_ihealth_func(int opt, int argc, char *argv[]);
+#endif
+#ifdef CONFIG_CRASH_DUMP
+static int at_icrash_func(int opt, int argc, char *argv[]);
+#endif
+#ifdef CONFIG_LWAN_ENERGY
+static int at_ienergy_func(int opt, int argc, char *argv[]);
+#endif
+#ifdef CONFIG_STATS
+static int at_istat_func(int opt, int argc, char *argv[]);
+#endif
+#ifdef CONFIG_LWAN_AT_BINARY
+static int at_cbinmode_func(int opt, int argc, char *argv[]);
+
+static volatile bool g_bin_mode = false;
+// The frame mode and the text commands never run at the same time, and
+// both are assembled from the main loop, so they share the buffer
+static uint8_t *const bin_rx = atcmd;
+static uint16_t bin_rx_index = 0;
+static volatile bool bin_rx_ready = false;
+#endif
+#ifdef CONFIG_LWAN_AT_URC
+static int at_curc_func(int opt, int argc, char *argv[]);
+
+// Records of type, head length, data length, head, data. Posted from the MAC
+// callbacks, printed from the main loop
+static uint8_t urc_queue[CONFIG_LWAN_AT_URC_QUEUE_SIZE];
+static volatile uint16_t urc_head = 0;
+static volatile uint16_t urc_tail = 0;
+static uint8_t urc_mask = URC_MASK_ALL;
+static uint16_t urc_dropped = 0;
+#endif
+
+// Sorted by name, looked up with a binary search
+static const AtCmd_t g_at_table[] = {
+    AT_CMD_ENTRY(LORA_AT_CADDMUTICAST, at_caddmulticast_func),
+    AT_CMD_ENTRY(LORA_AT_CADR, at_cadr_func),
+    AT_CMD_ENTRY(LORA_AT_CAPPEUI, at_cappeui_func),
+    AT_CMD_ENTRY(LORA_AT_CAPPKEY, at_cappkey_func),
+    AT_CMD_ENTRY(LORA_AT_CAPPPORT, at_cappport_func),
+    AT_CMD_ENTRY(LORA_AT_CAPPSKEY, at_cappskey_func),
+#ifdef CONFIG_LWAN_AT_BINARY
+    AT_CMD_ENTRY(LORA_AT_CBINMODE, at_cbinmode_func),
+#endif
+    AT_CMD_ENTRY(LORA_AT_CBL, at_cbl_func),
+    AT_CMD_ENTRY(LORA_AT_CCLASS, at_cclass_func),
+    AT_CMD_ENTRY(LORA_AT_CCONFIRM, at_cconfirm_func),
+    AT_CMD_ENTRY(LORA_AT_CDATARATE, at_cdatarate_func),
+    AT_CMD_ENTRY(LORA_AT_CDELMUTICAST, at_cdelmulticast_func),
+    AT_CMD_ENTRY(LORA_AT_CDEVADDR, at_cdevaddr_func),
+    AT_CMD_ENTRY(LORA_AT_CDEVEUI, at_cdeveui_func),
+    AT_CMD_ENTRY(LORA_AT_CFREQBANDMASK, at_cfreqbandmask_func),
+    AT_CMD_ENTRY(LORA_AT_CGBR, at_cgbr_func),
+    AT_CMD_ENTRY(LORA_AT_CGMI, at_cgmi_func),
+    AT_CMD_ENTRY(LORA_AT_CGMM, at_cgmm_func),
+    AT_CMD_ENTRY(LORA_AT_CGMR, at_cgmr_func),
+    AT_CMD_ENTRY(LORA_AT_CGSN, at_cgsn_func),
+    AT_CMD_ENTRY(LORA_AT_CJOIN, at_cjoin_func),
+    AT_CMD_ENTRY(LORA_AT_CJOINMODE, at_cjoinmode_func),
+    AT_CMD_ENTRY(LORA_AT_CKEYSPROTECT, at_ckeysprotect_func),
+#ifdef CONFIG_LORAMAC_LINK_ADR
+    AT_CMD_ENTRY(LORA_AT_CLINKADR, at_clinkadr_func),
+#endif
+    AT_CMD_ENTRY(LORA_AT_CLINKCHECK, at_clinkcheck_func),
+    AT_CMD_ENTRY(LORA_AT_CNBTRIALS, at_cnbtrials_func),
+    AT_CMD_ENTRY(LORA_AT_CNUMMUTICAST, at_cnummulticast_func),
+    AT_CMD_ENTRY(LORA_AT_CNWKSKEY, at_cnwkskey_func),
+    AT_CMD_ENTRY(LORA_AT_PINGSLOTINFOREQ, at_cpslotinforeq_func),
+#ifdef CONFIG_LORA_RADIO_STATS
+    AT_CMD_ENTRY(LORA_AT_CRADIOSTAT, at_cradiostat_func),
+#endif
+#ifdef CONFIG_REGION_MULTI
+    AT_CMD_ENTRY(LORA_AT_CREGION, at_cregion_func),
+#endif
+    AT_CMD_ENTRY(LORA_AT_CRESTORE, at_crestore_func),
+    AT_CMD_ENTRY(LORA_AT_CRM, at_crm_func),
+    AT_CMD_ENTRY(LORA_AT_CRSSI, at_crssi_func),
+    AT_CMD_ENTRY(LORA_AT_CRX1DELAY, at_crx1delay_func),
+    AT_CMD_ENTRY(LORA_AT_CRXP, at_crxp_func),
+    AT_CMD_ENTRY(LORA_AT_CSAVE, at_csave_func),
+    AT_CMD_ENTRY(LORA_AT_CSTATUS, at_cstatus_func),
+    AT_CMD_ENTRY(LORA_AT_CTXP, at_ctxp_func),
+#ifdef CONFIG_LORAMAC_TX_TIME
+    AT_CMD_ENTRY(LORA_AT_CTXTIME, at_ctxtime_func),
+#endif
+    AT_CMD_ENTRY(LORA_AT_CULDLMODE, at_culdlmode_func),
+#ifdef CONFIG_LWAN_AT_URC
+    AT_CMD_ENTRY(LORA_AT_CURC, at_curc_func),
+#endif
+    AT_CMD_ENTRY(LORA_AT_CWORKMODE, at_cworkmode_func),
+    AT_CMD_ENTRY(LORA_AT_DRX, at_drx_func),
+    AT_CMD_ENTRY(LORA_AT_DTRX, at_dtrx_func),
+#ifdef CONFIG_CRASH_DUMP
+    AT_CMD_ENTRY(LORA_AT_ICRASH, at_icrash_func),
+#endif
+#ifdef CONFIG_LWAN_ENERGY
+    AT_CMD_ENTRY(LORA_AT_IENERGY, at_ienergy_func),
+#endif
+#ifdef CONFIG_WATCHDOG
+    AT_CMD_ENTRY(LORA_AT_IHEALTH, at_ihealth_func),
+#endif
+    AT_CMD_ENTRY(LORA_AT_ILOGLVL, at_iloglvl_func),
+#ifdef CONFIG_PROFILE
+    AT_CMD_ENTRY(LORA_AT_IPROFILE, at_iprofile_func),
+#endif
+    AT_CMD_ENTRY(LORA_AT_IREBOOT, at_ireboot_func),
+    AT_CMD_ENTRY(LORA_AT_ISCAN, at_iscan_func),
+#ifdef CONFIG_STATS
+    AT_CMD_ENTRY(LORA_AT_ISTAT, at_istat_func),
+#endif
 };
 
-#define AT_TABLE_SIZE	(sizeof(g_at_table) / sizeof(at_cmd_t))
+static const AtTable_t g_at_cmds = AT_TABLE(g_at_table);
 
 extern void uart_log_init(uint32_t baudrate);
 
-static int hex2bin(const char *hex, uint8_t *bin, uint16_t bin_length)
+extern int print_write(const uint8_t *data, size_t len);
+extern int print_write_static(const uint8_t *data, size_t len);
+
+#ifdef CONFIG_LWAN_AT_BINARY
+static uint16_t bin_crc16(uint16_t crc, const uint8_t *data, uint16_t len)
 {
-    uint16_t hex_length = strlen(hex);
-    const char *hex_end = hex + hex_length;
-    uint8_t *cur = bin;
-    uint8_t num_chars = hex_length & 1;
-    uint8_t byte = 0;
+    return CrcUpdate(&CrcCcitt, crc, data, len);
+}
 
-    if ((hex_length + 1) / 2 > bin_length) {
-        return -1;
+// Text and noise between the frames are skipped, a frame is kept until
+// linkwan_at_process has run it
+static bool bin_serial_input(uint8_t byte)
+{
+    if (bin_rx_ready || (bin_rx_index == 0 && byte != BIN_SYNC)) {
+        return false;
+    }
+    bin_rx[bin_rx_index++] = byte;
+    if (bin_rx_index == 2 && byte < 2) {
+        bin_rx_index = 0;
+    } else if (bin_rx_index > 2 && bin_rx_index == bin_rx[1] + 4) {
+        bin_rx_ready = true;
+        return true;
     }
+    return false;
+}
 
-    while (hex < hex_end) {
-        if ('A' <= *hex && *hex <= 'F') {
-            byte |= 10 + (*hex - 'A');
-        } else if ('a' <= *hex && *hex <= 'f') {
-            byte |= 10 + (*hex - 'a');
-        } else if ('0' <= *hex && *hex <= '9') {
-            byte |= *hex - '0';
-        } else {
-            return -1;
+static void bin_output(uint8_t *data, uint16_t len)
+{
+    // Queued behind the text output
+    print_write(data, len);
+}
+
+static void bin_send_frame(uint8_t seq, uint8_t cmd, uint8_t *head, uint8_t head_len, uint8_t *data, uint8_t len)
+{
+    uint8_t frame[4];
+    uint16_t crc;
+
+    if (2 + head_len + len > 255) {
+        len = 255 - 2 - head_len;
+    }
+    frame[0] = BIN_SYNC;
+    frame[1] = 2 + head_len + len;
+    frame[2] = seq;
+    frame[3] = cmd;
+    crc = bin_crc16(0, frame + 1, 3);
+    crc = bin_crc16(crc, head, head_len);
+    crc = bin_crc16(crc, data, len);
+
+    bin_output(frame, 4);
+    bin_output(head, head_len);
+    bin_output(data, len);
+    frame[0] = crc & 0xFF;
+    frame[1] = crc >> 8;
+    bin_output(frame, 2);
+}
+
+static void bin_process(void)
+{
+    uint8_t seq = bin_rx[2];
+    uint8_t cmd = bin_rx[3];
+    uint8_t *data = bin_rx + 4;
+    uint8_t len = bin_rx[1] - 2;
+    uint8_t head[3] = {LWAN_AT_BIN_STATUS_OK};
+    uint8_t head_len = 1;
+    uint8_t *payload = NULL;
+    uint8_t size = 0;
+    uint16_t crc = bin_rx[bin_rx[1] + 2] | (bin_rx[bin_rx[1] + 3] << 8);
+
+    if (bin_crc16(0, bin_rx + 1, bin_rx[1] + 1) != crc) {
+        // Dropped, the host resends on the missing reply of the seq
+        return;
+    }
+
+    switch (cmd) {
+        case LWAN_AT_BIN_CMD_SEND: {
+            if (len < 2 || lwan_data_send(data[0], data[1], data + 2, len - 2) != LWAN_SUCCESS) {
+                head[0] = LWAN_AT_BIN_STATUS_ERROR;
+            }
+            break;
+        }
+        case LWAN_AT_BIN_CMD_RECV: {
+            if (lwan_data_recv(&head[1], &payload, &size) != LWAN_SUCCESS) {
+                head[0] = LWAN_AT_BIN_STATUS_ERROR;
+            } else {
+                head_len = 2;
+            }
+            break;
+        }
+        case LWAN_AT_BIN_CMD_JOIN: {
+            if (len < 6 || lwan_join(data[0], data[1], data[2] | (data[3] << 8), data[4] | (data[5] << 8)) != LWAN_SUCCESS) {
+                head[0] = LWAN_AT_BIN_STATUS_ERROR;
+            }
+            break;
+        }
+        case LWAN_AT_BIN_CMD_STATUS: {
+            head[1] = lwan_dev_status_get();
+            head[2] = lwan_dev_state_get();
+            head_len = 3;
+            break;
+        }
+        case LWAN_AT_BIN_CMD_MAX_PAYLOAD: {
+            head[1] = LoRaMacGetMaxPayload();
+            head_len = 2;
+            break;
+        }
+        case LWAN_AT_BIN_CMD_TEXT: {
+            g_bin_mode = false;
+            break;
+        }
+        default: {
+            head[0] = LWAN_AT_BIN_STATUS_UNKNOWN;
+            break;
         }
-        hex++;
-        num_chars++;
+    }
+    bin_send_frame(seq, cmd | BIN_REPLY, head, head_len, payload, size);
+    if (cmd == LWAN_AT_BIN_CMD_RECV) {
+        lwan_data_release();
+    }
+}
+
+bool linkwan_at_bin_event(uint8_t event, uint8_t *head, uint8_t head_len, uint8_t *data, uint8_t len)
+{
+    if (!g_bin_mode) {
+        return false;
+    }
+    bin_send_frame(0, event, head, head_len, data, len);
+    return true;
+}
+#endif
+
+#ifdef CONFIG_LWAN_AT_URC
+static uint8_t urc_byte(uint16_t pos)
+{
+    return urc_queue[pos & (CONFIG_LWAN_AT_URC_QUEUE_SIZE - 1)];
+}
+
+bool linkwan_at_urc(uint8_t type, const uint8_t *head, uint8_t head_len, const uint8_t *data, uint8_t len)
+{
+    uint16_t size = 3 + head_len + len;
+    uint16_t pos;
+    uint8_t i;
+
+    if (type >= LWAN_AT_URC_NUM || !(urc_mask & (1 << type)) || head_len > URC_HEAD_MAX) {
+        return false;
+    }
+    __disable_irq();
+    pos = urc_head;
+    if ((uint16_t)(pos - urc_tail) + size > CONFIG_LWAN_AT_URC_QUEUE_SIZE) {
+        // The host reads slower than the events come, the newest are lost
+        urc_dropped++;
+        __enable_irq();
+        return false;
+    }
+    urc_queue[pos++ & (CONFIG_LWAN_AT_URC_QUEUE_SIZE - 1)] = type;
+    urc_queue[pos++ & (CONFIG_LWAN_AT_URC_QUEUE_SIZE - 1)] = head_len;
+    urc_queue[pos++ & (CONFIG_LWAN_AT_URC_QUEUE_SIZE - 1)] = len;
+    for (i = 0; i < head_len; i++) {
+        urc_queue[pos++ & (CONFIG_LWAN_AT_URC_QUEUE_SIZE - 1)] = head[i];
+    }
+    for (i = 0; i < len; i++) {
+        urc_queue[pos++ & (CONFIG_LWAN_AT_URC_QUEUE_SIZE - 1)] = data[i];
+    }
+    urc_head = pos;
+    __enable_irq();
+    return true;
+}
+
+bool linkwan_at_urc_pending(void)
+{
+    return urc_head != urc_tail;
+}
+
+static void urc_print(uint8_t type, uint8_t *head, uint16_t pos, uint8_t len)
+{
+    switch (type) {
+        case LWAN_AT_URC_RECV:
+            AT_PRINTF("\r\nOK+RECV:%02X,%02X,%02X", head[0], head[1], len);
+            if (len) {
+                AT_PRINTF(",");
+                while (len--) {
+                    AT_PRINTF("%02X", urc_byte(pos++));
+                }
+            }
+            AT_PRINTF("\r\n");
+            break;
+        case LWAN_AT_URC_JOIN:
+            AT_PRINTF("%s:%s\r\n", LORA_AT_CJOIN, head[0] ? "OK" : "FAIL");
+            break;
+        case LWAN_AT_URC_SENT:
+            AT_PRINTF("\r\n%s+SENT:%02X\r\n", head[0] ? "OK" : "ERR", head[1]);
+            break;
+        case LWAN_AT_URC_BEACON:
+            AT_PRINTF("+CBEACON:%s\r\n", head[0] ? "LOCKED" : "LOST");
+            break;
+        case LWAN_AT_URC_LINKCHECK:
+            AT_PRINTF("%s: %d, %d, %d, %d, %d\r\n", LORA_AT_CLINKCHECK, head[0], head[1], head[2],
+                      (int16_t)(head[3] | head[4] << 8), (int8_t)head[5]);
+            break;
+        default:
+            break;
+    }
+}
 
-        if (num_chars >= 2) {
-            num_chars = 0;
-            *cur++ = byte;
-            byte = 0;
+#ifdef CONFIG_LWAN_AT_BINARY
+// Only the events with a binary counterpart are sent in the frame mode
+static void urc_bin_event(uint8_t type, uint8_t *head, uint16_t pos, uint8_t len)
+{
+    uint8_t data[255];
+    uint8_t i;
+
+    if (type == LWAN_AT_URC_SENT) {
+        uint8_t sent[2] = {head[0] ? LWAN_AT_BIN_STATUS_OK : LWAN_AT_BIN_STATUS_ERROR, head[1]};
+        linkwan_at_bin_event(LWAN_AT_BIN_EVENT_SENT, sent, sizeof(sent), NULL, 0);
+    } else if (type == LWAN_AT_URC_RECV) {
+        uint8_t recv[3] = {LWAN_AT_BIN_STATUS_OK, head[0], head[1]};
+        for (i = 0; i < len; i++) {
+            data[i] = urc_byte(pos++);
+        }
+        linkwan_at_bin_event(LWAN_AT_BIN_EVENT_RECV, recv, sizeof(recv), data, len);
+    }
+}
+#endif
+
+void linkwan_at_urc_flush(void)
+{
+    uint8_t head[URC_HEAD_MAX];
+    uint8_t type, head_len, len, i;
+    uint16_t pos, dropped;
+
+    __disable_irq();
+    dropped = urc_dropped;
+    urc_dropped = 0;
+    __enable_irq();
+    if (dropped) {
+        AT_PRINTF("%s:LOST %u\r\n", LORA_AT_CURC, dropped);
+    }
+    while (urc_tail != urc_head) {
+        pos = urc_tail;
+        type = urc_byte(pos++);
+        head_len = urc_byte(pos++);
+        len = urc_byte(pos++);
+        for (i = 0; i < head_len; i++) {
+            head[i] = urc_byte(pos++);
+        }
+#ifdef CONFIG_LWAN_AT_BINARY
+        if (g_bin_mode) {
+            urc_bin_event(type, head, pos, len);
         } else {
-            byte <<= 4;
+            urc_print(type, head, pos, len);
         }
+#else
+        urc_print(type, head, pos, len);
+#endif
+        urc_tail = pos + len;
     }
-    return cur - bin;
 }
+#endif
 
-// this can be in intrpt context
-void linkwan_serial_input(uint8_t cmd)
+// Adds a byte to the command, true once the command is complete
+static bool serial_assemble(uint8_t cmd)
 {
-    if(g_atcmd_processing) 
-        return;
+#ifdef CONFIG_LWAN_AT_BINARY
+    if (g_bin_mode) {
+        return bin_serial_input(cmd);
+    }
+#endif
     
     if ((cmd >= '0' && cmd <= '9') || (cmd >= 'a' && cmd <= 'z') ||
         (cmd >= 'A' && cmd <= 'Z') || cmd == '?' || cmd == '+' ||
         cmd == ':' || cmd == '=' || cmd == ' ' || cmd == ',') {
+        if (atcmd_overflow) {
+            STATS_INC(STATS_AT_DROPPED);
+            return false;
+        }
         if (atcmd_index >= ATCMD_SIZE) {
+            STATS_ADD(STATS_AT_DROPPED, ATCMD_SIZE + 1);
             memset(atcmd, 0xff, ATCMD_SIZE);
             atcmd_index = 0;
-            return;
+            atcmd_overflow = true;
+            return false;
         }
         atcmd[atcmd_index++] = cmd;
     } else if (cmd == '\r' || cmd == '\n') {
-        if (atcmd_index >= ATCMD_SIZE) {
+        if (atcmd_overflow || atcmd_index >= ATCMD_SIZE) {
+            // The next line is a command again
             memset(atcmd, 0xff, ATCMD_SIZE);
             atcmd_index = 0;
-            return;
+            atcmd_overflow = false;
+            return false;
         }
         atcmd[atcmd_index] = '\0';
+        return true;
+    }
+    return false;
+}
+
+// this can be in intrpt context
+#ifndef LWAN_AT_RX_RING
+// Interrupt context: the byte is queued, the main loop assembles the command
+// so the bytes received while a command runs are kept
+RAM_FUNC_ATTR void linkwan_serial_input(uint8_t cmd)
+{
+    EventPost(EVENT_UART_RX, cmd, 0);
+}
+
+bool linkwan_serial_process(uint8_t cmd)
+{
+    return serial_assemble(cmd);
+}
+#else
+RAM_FUNC_ATTR void linkwan_serial_input(uint8_t cmd)
+{
+    uint16_t head = at_rx_head;
+
+    // Full: the byte is lost, the host sends faster than the commands run
+    if ((uint16_t)(head - at_rx_tail) >= CONFIG_LWAN_AT_RX_RING_SIZE) {
+        STATS_INC(STATS_AT_DROPPED);
+        return;
+    }
+    at_rx_ring[head & (CONFIG_LWAN_AT_RX_RING_SIZE - 1)] = cmd;
+    __DMB();
+    at_rx_head = head + 1;
+#ifdef CONFIG_LWAN_AT_LINE_RX
+    // The AT layer is woken at a line end only, after the other bytes the
+    // MCU goes back to STOP3 at once. A partial line filling half the ring
+    // wakes it too, the ring would stall otherwise
+    if (cmd == '\r' || cmd == '\n') {
+        at_rx_line_in++;
+    } else if ((uint16_t)(head + 1 - at_rx_tail) != CONFIG_LWAN_AT_RX_RING_SIZE / 2
+#ifdef CONFIG_LWAN_AT_BINARY
+               && !g_bin_mode
+#endif
+               ) {
+        return;
+    }
+#ifdef CONFIG_EVENT_QUEUE
+    EventPost(EVENT_UART_RX, cmd, 0);
+#endif
+#endif
+}
+
+bool linkwan_at_pending(void)
+{
+#ifdef CONFIG_LWAN_AT_LINE_RX
+    uint16_t count = at_rx_head - at_rx_tail;
+
+#ifdef CONFIG_LWAN_AT_BINARY
+    if (g_bin_mode) {
+        return count != 0;
     }
+#endif
+    return at_rx_line_in != at_rx_line_out || count >= CONFIG_LWAN_AT_RX_RING_SIZE / 2;
+#else
+    return at_rx_head != at_rx_tail;
+#endif
 }
+#endif
 
 int linkwan_serial_output(uint8_t *buffer, int len)
 {
-    AT_PRINTF("%s", buffer);
+    // Copied out as is, atcmd is reused right after
+    print_write(buffer, len);
+    linkwan_at_prompt_print();
+    return 0;
+}
+
+// For replies that stay in flash, sent from there when the output is idle
+static const char at_ok_reply[] = "\r\nOK\r\n";
+static const char at_error_reply[] = "\r\n" AT_ERROR "1\r\n";
+
+static int linkwan_serial_output_static(const char *str)
+{
+    print_write_static((const uint8_t *)str, strlen(str));
     linkwan_at_prompt_print();
     return 0;
 }
 
+// Response builder: the reply is appended to atcmd without a format parse
+// and sent at_rsp_len long, or is a reply in flash. The heads are literals
+// with their lengths known at build time
+#define AT_RSP_HEAD(name) "\r\n" name ":"
+#define AT_RSP_STR(str) at_rsp_put(str, sizeof(str) - 1)
+#define AT_RSP_START(name) AT_RSP_STR(AT_RSP_HEAD(name))
+
+static uint16_t at_rsp_len = 0;
+static const char *at_rsp_static = NULL;
+
+static void at_rsp_put(const char *str, uint16_t len)
+{
+    if (len > ATCMD_SIZE - at_rsp_len) {
+        len = ATCMD_SIZE - at_rsp_len;
+    }
+    memcpy(atcmd + at_rsp_len, str, len);
+    at_rsp_len += len;
+}
+
+static void at_rsp_uint(uint32_t value)
+{
+    char digits[10];
+    uint8_t n = 0;
+
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (n && at_rsp_len < ATCMD_SIZE) {
+        atcmd[at_rsp_len++] = digits[--n];
+    }
+}
+
+static void at_rsp_int(int32_t value)
+{
+    if (value < 0) {
+        AT_RSP_STR("-");
+        at_rsp_uint(0 - (uint32_t)value);
+    } else {
+        at_rsp_uint(value);
+    }
+}
+
+// Four characters per word: the nibbles of two bytes are spread over the
+// byte lanes, and the lanes above 9 move up to 'A' together
+static void at_rsp_hex(const uint8_t *data, uint16_t len)
+{
+    uint32_t nibbles, chars;
+
+    if (len > (ATCMD_SIZE - at_rsp_len) / 2) {
+        len = (ATCMD_SIZE - at_rsp_len) / 2;
+    }
+    for (; len >= 2; len -= 2, data += 2) {
+        nibbles = data[0] | ((uint32_t)data[1] << 16);
+        nibbles = ((nibbles >> 4) & 0x000F000F) | ((nibbles & 0x000F000F) << 8);
+        chars = nibbles + 0x30303030 + (((nibbles + 0x06060606) >> 4) & 0x01010101) * 7;
+        memcpy(atcmd + at_rsp_len, &chars, 4);
+        at_rsp_len += 4;
+    }
+    if (len) {
+        nibbles = (data[0] >> 4) | ((uint32_t)(data[0] & 0x0F) << 8);
+        chars = nibbles + 0x3030 + (((nibbles + 0x0606) >> 4) & 0x0101) * 7;
+        memcpy(atcmd + at_rsp_len, &chars, 2);
+        at_rsp_len += 2;
+    }
+}
+
+// The low size bytes of value in hex, the most significant first
+static void at_rsp_hex_uint(uint32_t value, uint8_t size)
+{
+    uint8_t bytes[4];
+    uint8_t i;
+
+    for (i = 0; i < 4; i++) {
+        bytes[i] = value >> (24 - 8 * i);
+    }
+    at_rsp_hex(bytes + 4 - size, size);
+}
+
+// Ends the reply, the OK alone being sent from flash
+static void at_rsp_ok(void)
+{
+    if (at_rsp_len == 0) {
+        at_rsp_static = at_ok_reply;
+    } else {
+        AT_RSP_STR("\r\nOK\r\n");
+    }
+}
+
 void linkwan_at_prompt_print()
 {
     LOG_PRINTF(LL_DEBUG, "\r\n%s%s:~# ", CONFIG_MANUFACTURER, CONFIG_DEVICE_MODEL);
@@ -207,7 +747,9 @@ static int at_cjoinmode_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_dev_config_get(DEV_CONFIG_JOIN_MODE, &join_mode);  
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%d\r\nOK\r\n", LORA_AT_CJOINMODE, join_mode);
+            AT_RSP_START(LORA_AT_CJOINMODE);
+            at_rsp_int(join_mode);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -222,7 +764,7 @@ static int at_cjoinmode_func(int opt, int argc, char *argv[])
             int res = lwan_dev_config_set(DEV_CONFIG_JOIN_MODE, (void *)&join_mode);
             if (res == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
             break;
         }
@@ -242,8 +784,9 @@ static int at_cdeveui_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_dev_keys_get(DEV_KEYS_OTA_DEVEUI, buf);
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%02X%02X%02X%02X%02X%02X%02X%02X\r\nOK\r\n", \
-                     LORA_AT_CDEVEUI, buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], buf[6], buf[7]);
+            AT_RSP_START(LORA_AT_CDEVEUI);
+            at_rsp_hex(buf, LORA_EUI_LENGTH);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -254,10 +797,10 @@ static int at_cdeveui_func(int opt, int argc, char *argv[])
         case SET_CMD: {
             if(argc < 1) break;
             
-            length = hex2bin((const char *)argv[0], buf, LORA_EUI_LENGTH);
+            length = AtEngineHex2Bin((const char *)argv[0], buf, LORA_EUI_LENGTH);
             if (length == LORA_EUI_LENGTH) {
                 if(lwan_dev_keys_set(DEV_KEYS_OTA_DEVEUI, buf) == LWAN_SUCCESS) {
-                    snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                    at_rsp_ok();
                     ret = LWAN_SUCCESS;
                 }
             }
@@ -279,8 +822,9 @@ static int at_cappeui_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_dev_keys_get(DEV_KEYS_OTA_APPEUI, buf);
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%02X%02X%02X%02X%02X%02X%02X%02X\r\nOK\r\n", \
-                     LORA_AT_CAPPEUI, buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], buf[6], buf[7]);
+            AT_RSP_START(LORA_AT_CAPPEUI);
+            at_rsp_hex(buf, LORA_EUI_LENGTH);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -290,9 +834,9 @@ static int at_cappeui_func(int opt, int argc, char *argv[])
         }
         case SET_CMD: {
             if(argc < 1) break;
-            length = hex2bin((const char *)argv[0], buf, LORA_EUI_LENGTH);
+            length = AtEngineHex2Bin((const char *)argv[0], buf, LORA_EUI_LENGTH);
             if (length == LORA_EUI_LENGTH && lwan_dev_keys_set(DEV_KEYS_OTA_APPEUI, buf) == LWAN_SUCCESS) {
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
                 ret = LWAN_SUCCESS;
             }
             break;
@@ -313,10 +857,9 @@ static int at_cappkey_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_dev_keys_get(DEV_KEYS_OTA_APPKEY, buf);   
-            snprintf((char *)atcmd, ATCMD_SIZE,
-                     "\r\n%s:%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X\r\nOK\r\n", \
-                     LORA_AT_CAPPKEY, buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], buf[6], buf[7],
-                                      buf[8], buf[9], buf[10], buf[11], buf[12], buf[13], buf[14], buf[15]);
+            AT_RSP_START(LORA_AT_CAPPKEY);
+            at_rsp_hex(buf, LORA_KEY_LENGTH);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -326,9 +869,9 @@ static int at_cappkey_func(int opt, int argc, char *argv[])
         }
         case SET_CMD: {
             if(argc < 1) break;
-            length = hex2bin((const char *)argv[0], buf, LORA_KEY_LENGTH);
+            length = AtEngineHex2Bin((const char *)argv[0], buf, LORA_KEY_LENGTH);
             if (length == LORA_KEY_LENGTH && lwan_dev_keys_set(DEV_KEYS_OTA_APPKEY, buf) == LWAN_SUCCESS) {
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
                 ret = LWAN_SUCCESS;
             }
             break;
@@ -350,7 +893,9 @@ static int at_cdevaddr_func(int opt, int argc, char *argv[])
             ret = LWAN_SUCCESS;
             uint32_t devaddr;
             lwan_dev_keys_get(DEV_KEYS_ABP_DEVADDR, &devaddr);
-            length = snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%08X\r\nOK\r\n", LORA_AT_CDEVADDR, (unsigned int)devaddr);
+            AT_RSP_START(LORA_AT_CDEVADDR);
+            at_rsp_hex_uint(devaddr, 4);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -361,11 +906,11 @@ static int at_cdevaddr_func(int opt, int argc, char *argv[])
         case SET_CMD: {
             if(argc < 1) break;
             
-            length = hex2bin((const char *)argv[0], buf, 4);
+            length = AtEngineHex2Bin((const char *)argv[0], buf, 4);
             if (length == 4) {
                 uint32_t devaddr = buf[0] << 24 | buf[1] << 16 | buf[2] <<8 | buf[3];
                 if(lwan_dev_keys_set(DEV_KEYS_ABP_DEVADDR, &devaddr) == LWAN_SUCCESS) {
-                    snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                    at_rsp_ok();
                     ret = LWAN_SUCCESS;
                 }
             }
@@ -387,11 +932,9 @@ static int at_cappskey_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_dev_keys_get(DEV_KEYS_ABP_APPSKEY, buf); 
-            length = snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:", LORA_AT_CAPPSKEY);
-            for (int i = 0; i < LORA_KEY_LENGTH; i++) {
-                length += snprintf((char *)(atcmd + length), ATCMD_SIZE, "%02X", buf[i]);
-            }
-            snprintf((char *)(atcmd + length), ATCMD_SIZE, "\r\nOK\r\n");
+            AT_RSP_START(LORA_AT_CAPPSKEY);
+            at_rsp_hex(buf, LORA_KEY_LENGTH);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -401,10 +944,10 @@ static int at_cappskey_func(int opt, int argc, char *argv[])
         }
         case SET_CMD: {
             if(argc < 1) break;
-            length = hex2bin((const char *)argv[0], buf, LORA_KEY_LENGTH);
+            length = AtEngineHex2Bin((const char *)argv[0], buf, LORA_KEY_LENGTH);
             if (length == LORA_KEY_LENGTH) {
                 if(lwan_dev_keys_set(DEV_KEYS_ABP_APPSKEY, buf) == LWAN_SUCCESS) {
-                    snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                    at_rsp_ok();
                     ret = LWAN_SUCCESS;
                 }
             }
@@ -427,11 +970,9 @@ static int at_cnwkskey_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_dev_keys_get(DEV_KEYS_ABP_NWKSKEY, buf); 
-            length = snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:", LORA_AT_CNWKSKEY);
-            for (int i = 0; i < LORA_KEY_LENGTH; i++) {
-                length += snprintf((char *)(atcmd + length), ATCMD_SIZE, "%02X", buf[i]);
-            }
-            snprintf((char *)(atcmd + length), ATCMD_SIZE, "\r\nOK\r\n");
+            AT_RSP_START(LORA_AT_CNWKSKEY);
+            at_rsp_hex(buf, LORA_KEY_LENGTH);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -441,10 +982,10 @@ static int at_cnwkskey_func(int opt, int argc, char *argv[])
         }
         case SET_CMD: {
             if(argc < 1) break;
-            length = hex2bin((const char *)argv[0], buf, LORA_KEY_LENGTH);
+            length = AtEngineHex2Bin((const char *)argv[0], buf, LORA_KEY_LENGTH);
             if (length == LORA_KEY_LENGTH) {
                 if(lwan_dev_keys_set(DEV_KEYS_ABP_NWKSKEY, buf) == LWAN_SUCCESS) {
-                    snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                    at_rsp_ok();
                     ret = LWAN_SUCCESS;
                 }
             }
@@ -463,30 +1004,38 @@ static int at_caddmulticast_func(int opt, int argc, char *argv[])
     switch(opt) {
         case DESC_CMD: {
             ret = LWAN_SUCCESS;
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"DevAddr\",\"AppSKey\",\"NwkSKey\"\r\nOK\r\n", LORA_AT_CADDMUTICAST);
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"DevAddr\",\"AppSKey\",\"NwkSKey\"[,...]\r\nOK\r\n", LORA_AT_CADDMUTICAST);
             break;
         }
         case SET_CMD: {
             if(argc < 3) break;
-            
-            MulticastParams_t curMulticastInfo;
-            curMulticastInfo.Address = (uint32_t)strtoul(argv[0], NULL, 16);
-            uint8_t appskey_len = hex2bin((const char *)argv[1], curMulticastInfo.AppSKey, 16);
-            uint8_t nwkskey_len = hex2bin((const char *)argv[2], curMulticastInfo.NwkSKey, 16);
-            
-            if(argc > 3) {
-                curMulticastInfo.Periodicity = strtoul(argv[3], NULL, 16);
+
+            // One group with its optional Periodicity and Datarate, or
+            // several DevAddr,AppSKey,NwkSKey groups added all or none
+            MulticastParams_t groups[ARGC_LIMIT / 3];
+            int num = (argc > 5 && argc % 3 == 0) ? argc / 3 : 1;
+            int i;
+
+            memset(groups, 0, sizeof(groups));
+            for (i = 0; i < num; i++) {
+                groups[i].Address = (uint32_t)strtoul(argv[i * 3], NULL, 16);
+                if (AtEngineHex2Bin((const char *)argv[i * 3 + 1], groups[i].AppSKey, 16) != 16 ||
+                    AtEngineHex2Bin((const char *)argv[i * 3 + 2], groups[i].NwkSKey, 16) != 16)
+                    break;
+            }
+            if (i < num) break;
+
+            if(num == 1 && argc > 3) {
+                groups[0].Periodicity = strtoul(argv[3], NULL, 16);
                 if(argc > 4 )
-                    curMulticastInfo.Datarate = strtoul(argv[4], NULL, 16);
-                curMulticastInfo.Frequency = 0;
+                    groups[0].Datarate = strtoul(argv[4], NULL, 16);
             }
-            
-            if (appskey_len == 16 && nwkskey_len == 16) {
+
+            if (lwan_multicast_add_groups(groups, num)) {
                 ret = LWAN_SUCCESS;
-                lwan_multicast_add(&curMulticastInfo);
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
-            
+
             break;
         }
         default: break;
@@ -502,14 +1051,16 @@ static int at_cdelmulticast_func(int opt, int argc, char *argv[])
     switch(opt) {
         case DESC_CMD: {
             ret = LWAN_SUCCESS;
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"DevAddr\"\r\nOK\r\n", LORA_AT_CDELMUTICAST);
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"DevAddr\"[,...]\r\nOK\r\n", LORA_AT_CDELMUTICAST);
             break;
         }
         case SET_CMD: {
             if(argc < 1) break;
-            uint32_t devAddr = (uint32_t)strtol((const char *)argv[0], NULL, 16);
-            if (lwan_multicast_del(devAddr) == true) {
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+            uint32_t devAddrs[ARGC_LIMIT];
+            for (int i = 0; i < argc; i++)
+                devAddrs[i] = (uint32_t)strtoul((const char *)argv[i], NULL, 16);
+            if (lwan_multicast_del_groups(devAddrs, argc) == true) {
+                at_rsp_ok();
                 ret = LWAN_SUCCESS;
             }
             break;
@@ -528,7 +1079,9 @@ static int at_cnummulticast_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             uint8_t multiNum = lwan_multicast_num_get();
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%u\r\nOK\r\n", LORA_AT_CNUMMUTICAST, multiNum);
+            AT_RSP_START(LORA_AT_CNUMMUTICAST);
+            at_rsp_uint(multiNum);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -552,7 +1105,9 @@ static int at_cfreqbandmask_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_dev_config_get(DEV_CONFIG_FREQBAND_MASK, &freqband_mask);  
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%04X\r\nOK\r\n", LORA_AT_CFREQBANDMASK, freqband_mask);
+            AT_RSP_START(LORA_AT_CFREQBANDMASK);
+            at_rsp_hex_uint(freqband_mask, 2);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -563,12 +1118,12 @@ static int at_cfreqbandmask_func(int opt, int argc, char *argv[])
         case SET_CMD: {
             if(argc < 1) break;
             uint8_t mask[2];
-            length = hex2bin((const char *)argv[0], (uint8_t *)mask, 2);
+            length = AtEngineHex2Bin((const char *)argv[0], (uint8_t *)mask, 2);
             if (length == 2) {
                 freqband_mask = mask[1] | ((uint16_t)mask[0] << 8);
                 if (lwan_dev_config_set(DEV_CONFIG_FREQBAND_MASK, (void *)&freqband_mask) == LWAN_SUCCESS) {
                     ret = LWAN_SUCCESS;
-                    snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                    at_rsp_ok();
                 }
             }
             break;
@@ -579,6 +1134,44 @@ static int at_cfreqbandmask_func(int opt, int argc, char *argv[])
     return ret;
 }
 
+#ifdef CONFIG_REGION_MULTI
+static int at_cregion_func(int opt, int argc, char *argv[])
+{
+    int ret = LWAN_ERROR;
+    uint8_t region;
+        
+    switch(opt) {
+        case QUERY_CMD: {
+            ret = LWAN_SUCCESS;
+            lwan_dev_config_get(DEV_CONFIG_REGION, &region);
+            AT_RSP_START(LORA_AT_CREGION);
+            at_rsp_int(region);
+            at_rsp_ok();
+            break;
+        }
+        case DESC_CMD: {
+            ret = LWAN_SUCCESS;
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s=\"region\"\r\nOK\r\n", LORA_AT_CREGION);
+            break;
+        }
+        case SET_CMD: {
+            if(argc < 1) break;
+            
+            // LoRaMacRegion_t of a region of the build, used from the next boot on
+            region = strtol((const char *)argv[0], NULL, 0);
+            if (lwan_dev_config_set(DEV_CONFIG_REGION, (void *)&region) == LWAN_SUCCESS) {
+                ret = LWAN_SUCCESS;
+                at_rsp_ok();
+            }
+            break;
+        }
+        default: break;
+    }
+
+    return ret;
+}
+#endif
+
 static int at_culdlmode_func(int opt, int argc, char *argv[])
 {
     int ret = LWAN_ERROR;
@@ -588,7 +1181,9 @@ static int at_culdlmode_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_dev_config_get(DEV_CONFIG_ULDL_MODE, &mode);
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%d\r\nOK\r\n", LORA_AT_CULDLMODE, mode);
+            AT_RSP_START(LORA_AT_CULDLMODE);
+            at_rsp_int(mode);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -602,7 +1197,7 @@ static int at_culdlmode_func(int opt, int argc, char *argv[])
             mode = strtol((const char *)argv[0], NULL, 0);
             if (lwan_dev_config_set(DEV_CONFIG_ULDL_MODE, (void *)&mode) == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
             break;
         }
@@ -621,7 +1216,9 @@ static int at_cworkmode_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_dev_config_get(DEV_CONFIG_WORK_MODE, &mode);
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%d\r\nOK\r\n", LORA_AT_CWORKMODE, mode);
+            AT_RSP_START(LORA_AT_CWORKMODE);
+            at_rsp_int(mode);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -635,7 +1232,7 @@ static int at_cworkmode_func(int opt, int argc, char *argv[])
             mode = strtol((const char *)argv[0], NULL, 0);
             if (mode == 2) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
             
             break;
@@ -655,7 +1252,9 @@ static int at_cclass_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_dev_config_get(DEV_CONFIG_CLASS, &class);  
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%d\r\nOK\r\n", LORA_AT_CCLASS, class);
+            AT_RSP_START(LORA_AT_CCLASS);
+            at_rsp_int(class);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -699,7 +1298,7 @@ static int at_cclass_func(int opt, int argc, char *argv[])
                 }
                 if (lwan_dev_config_set(DEV_CONFIG_CLASSB_PARAM, (void *)&classb_param) == LWAN_SUCCESS) {
                     ret = LWAN_SUCCESS;
-                    snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                    at_rsp_ok();
                 }
             }
             
@@ -719,7 +1318,9 @@ static int at_cbl_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             uint8_t batteryLevel = lwan_dev_battery_get();
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%d\r\nOK\r\n", LORA_AT_CBL, batteryLevel);
+            AT_RSP_START(LORA_AT_CBL);
+            at_rsp_int(batteryLevel);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -776,14 +1377,16 @@ static int at_dtrx_func(int opt, int argc, char *argv[])
             confirm = strtol((const char *)argv[0], NULL, 0);
             Nbtrials = strtol((const char *)argv[1], NULL, 0);
             len = strtol((const char *)argv[2], NULL, 0);
-            bin_len = hex2bin((const char *)argv[3], payload, len);
+            bin_len = AtEngineHex2Bin((const char *)argv[3], payload, len);
             
             if(bin_len>=0) {
                 ret = LWAN_SUCCESS;
                 if (lwan_data_send(confirm, Nbtrials, payload, bin_len) == LWAN_SUCCESS) {
-                    snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK+SEND:%02X\r\n", bin_len);
+                    AT_RSP_STR("\r\nOK+SEND:");
+                    at_rsp_hex_uint(bin_len, 1);
+                    AT_RSP_STR("\r\n");
                 }else{
-                    snprintf((char *)atcmd, ATCMD_SIZE, "\r\nERR+SEND:00\r\n");
+                    AT_RSP_STR("\r\nERR+SEND:00\r\n");
                 }
             }
             break;
@@ -811,14 +1414,14 @@ static int at_drx_func(int opt, int argc, char *argv[])
                     
             if(lwan_data_recv(&port, &buf, &size) == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                int16_t len = snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%d", LORA_AT_DRX, size);
+                AT_RSP_START(LORA_AT_DRX);
+                at_rsp_uint(size);
                 if (size > 0) {
-                    len += snprintf((char *)(atcmd + len), ATCMD_SIZE, ",");
-                    for(int i=0; i<size; i++) {
-                        len += snprintf((char *)(atcmd + len), ATCMD_SIZE, "%02X", buf[i]);
-                    }
+                    AT_RSP_STR(",");
+                    at_rsp_hex(buf, size);
                 }
-                snprintf((char *)(atcmd + len), ATCMD_SIZE, "\r\n%s\r\n", "OK");
+                at_rsp_ok();
+                lwan_data_release();
             }
             break;
         }
@@ -839,7 +1442,9 @@ static int at_cconfirm_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_mac_config_get(MAC_CONFIG_CONFIRM_MSG, &cfm);
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%d\r\nOK\r\n", LORA_AT_CCONFIRM, cfm);
+            AT_RSP_START(LORA_AT_CCONFIRM);
+            at_rsp_int(cfm);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -853,7 +1458,7 @@ static int at_cconfirm_func(int opt, int argc, char *argv[])
             cfm = strtol((const char *)argv[0], NULL, 0);
             if (lwan_mac_config_set(MAC_CONFIG_CONFIRM_MSG, (void *)&cfm) == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
             
             break;
@@ -874,7 +1479,9 @@ static int at_cappport_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_mac_config_get(MAC_CONFIG_APP_PORT, &port);
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%d\r\nOK\r\n", LORA_AT_CAPPPORT, port);
+            AT_RSP_START(LORA_AT_CAPPPORT);
+            at_rsp_int(port);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -888,7 +1495,7 @@ static int at_cappport_func(int opt, int argc, char *argv[])
 
             if (lwan_mac_config_set(MAC_CONFIG_APP_PORT, (void *)&port) == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
             break;
         }
@@ -908,7 +1515,9 @@ static int at_cdatarate_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_mac_config_get(MAC_CONFIG_DATARATE, &datarate);
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%d\r\nOK\r\n", LORA_AT_CDATARATE, datarate);
+            AT_RSP_START(LORA_AT_CDATARATE);
+            at_rsp_int(datarate);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -926,7 +1535,7 @@ static int at_cdatarate_func(int opt, int argc, char *argv[])
             datarate = strtol((const char *)argv[0], NULL, 0);
             if (lwan_mac_config_set(MAC_CONFIG_DATARATE, (void *)&datarate) == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
             break;
         }
@@ -1005,7 +1614,7 @@ static int at_cnbtrials_func(int opt, int argc, char *argv[])
                 res = lwan_mac_config_set(MAC_CONFIG_UNCONF_NBTRIALS, (void *)&value);
             if (res == LWAN_SUCCESS) { 
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
             break;
         }
@@ -1043,7 +1652,7 @@ static int at_crm_func(int opt, int argc, char *argv[])
             lwan_mac_config_set(MAC_CONFIG_REPORT_MODE, (void *)&reportMode);
             if (lwan_mac_config_set(MAC_CONFIG_REPORT_INTERVAL, (void *)&reportInterval) == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
 
             break;
@@ -1063,7 +1672,9 @@ static int at_ctxp_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_mac_config_get(MAC_CONFIG_TX_POWER, &tx_power);
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%d\r\nOK\r\n", LORA_AT_CTXP, tx_power);
+            AT_RSP_START(LORA_AT_CTXP);
+            at_rsp_int(tx_power);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -1077,7 +1688,7 @@ static int at_ctxp_func(int opt, int argc, char *argv[])
             tx_power = strtol((const char *)argv[0], NULL, 0);
             if (lwan_mac_config_set(MAC_CONFIG_TX_POWER, (void *)&tx_power) == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
             break;
         }
@@ -1087,6 +1698,41 @@ static int at_ctxp_func(int opt, int argc, char *argv[])
     return ret;
 }
 
+#ifdef CONFIG_LORAMAC_TX_TIME
+static int at_ctxtime_func(int opt, int argc, char *argv[])
+{
+    int ret = LWAN_ERROR;
+    lwan_tx_time_t tx_time;
+    uint8_t size = 0;
+
+    switch(opt) {
+        case SET_CMD: {
+            if(argc < 1) break;
+
+            size = strtol((const char *)argv[0], NULL, 0);
+        }
+        // fall through, the query is for an empty payload
+        case QUERY_CMD: {
+            if (lwan_tx_time_get(size, &tx_time) == LWAN_SUCCESS) {
+                ret = LWAN_SUCCESS;
+                snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%u,%u,%u,%u\r\nOK\r\n", LORA_AT_CTXTIME,
+                         (unsigned int)tx_time.delay, (unsigned int)tx_time.freq, tx_time.datarate,
+                         (unsigned int)tx_time.time_on_air);
+            }
+            break;
+        }
+        case DESC_CMD: {
+            ret = LWAN_SUCCESS;
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"delay\",\"freq\",\"datarate\",\"time on air\"\r\nOK\r\n", LORA_AT_CTXTIME);
+            break;
+        }
+        default: break;
+    }
+
+    return ret;
+}
+#endif
+
 static int at_clinkcheck_func(int opt, int argc, char *argv[])
 {
     int ret = LWAN_ERROR;
@@ -1105,7 +1751,7 @@ static int at_clinkcheck_func(int opt, int argc, char *argv[])
                 ret = LWAN_SUCCESS;
                 if(checkValue==1)
                     lwan_mac_req_send(MAC_REQ_LINKCHECK, 0);
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
             break;
         }
@@ -1124,7 +1770,9 @@ static int at_cadr_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_mac_config_get(MAC_CONFIG_ADR_ENABLE, &adr);
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%d\r\nOK\r\n", LORA_AT_CADR, adr);
+            AT_RSP_START(LORA_AT_CADR);
+            at_rsp_int(adr);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -1138,7 +1786,43 @@ static int at_cadr_func(int opt, int argc, char *argv[])
             adr = strtol((const char *)argv[0], NULL, 0);
             if (lwan_mac_config_set(MAC_CONFIG_ADR_ENABLE, (void *)&adr) == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
+            }
+            break;
+        }
+        default: break;
+    }
+
+    return ret;
+}
+
+#ifdef CONFIG_LORAMAC_LINK_ADR
+static int at_clinkadr_func(int opt, int argc, char *argv[])
+{
+    int ret = LWAN_ERROR;
+    LinkAdrInfo_t link_adr;
+    uint8_t enable;
+
+    switch(opt) {
+        case QUERY_CMD: {
+            ret = LWAN_SUCCESS;
+            lwan_mac_config_get(MAC_CONFIG_LINK_ADR, &link_adr);
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%d,%u,%d,%d,%d\r\nOK\r\n", LORA_AT_CLINKADR, link_adr.Enable,
+                     link_adr.NbSamples, link_adr.Snr, link_adr.Datarate, link_adr.TxPower);
+            break;
+        }
+        case DESC_CMD: {
+            ret = LWAN_SUCCESS;
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"enable\"\r\nOK\r\n", LORA_AT_CLINKADR);
+            break;
+        }
+        case SET_CMD: {
+            if(argc < 1) break;
+
+            enable = strtol((const char *)argv[0], NULL, 0);
+            if (enable <= 1 && lwan_mac_config_set(MAC_CONFIG_LINK_ADR, (void *)&enable) == LWAN_SUCCESS) {
+                ret = LWAN_SUCCESS;
+                at_rsp_ok();
             }
             break;
         }
@@ -1147,6 +1831,61 @@ static int at_cadr_func(int opt, int argc, char *argv[])
 
     return ret;
 }
+#endif
+
+#ifdef CONFIG_LORA_RADIO_STATS
+static int at_cradiostat_func(int opt, int argc, char *argv[])
+{
+    int ret = LWAN_ERROR;
+    RadioStats_t stats;
+    int len;
+
+    switch(opt) {
+        case QUERY_CMD: {
+            ret = LWAN_SUCCESS;
+            lwan_mac_config_get(MAC_CONFIG_RADIO_STATS, &stats);
+            // Times in ms, the charge in uAh, then the LoRa SFs in use
+            len = snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%u,%u,%u,%u,%u,%u,%u,%u,%u\r\n", LORA_AT_CRADIOSTAT,
+                           (unsigned int)(stats.Time[RADIO_STATS_MODE_TX] / 1000), (unsigned int)stats.Count[RADIO_STATS_MODE_TX],
+                           (unsigned int)((stats.Time[RADIO_STATS_MODE_RX] + stats.Time[RADIO_STATS_MODE_RX_DC]) / 1000),
+                           (unsigned int)(stats.Count[RADIO_STATS_MODE_RX] + stats.Count[RADIO_STATS_MODE_RX_DC]),
+                           (unsigned int)(stats.Time[RADIO_STATS_MODE_CAD] / 1000), (unsigned int)stats.Count[RADIO_STATS_MODE_CAD],
+                           (unsigned int)((stats.Time[RADIO_STATS_MODE_STDBY_RC] + stats.Time[RADIO_STATS_MODE_STDBY_XOSC] + stats.Time[RADIO_STATS_MODE_FS]) / 1000),
+                           (unsigned int)(stats.Time[RADIO_STATS_MODE_SLEEP] / 1000), (unsigned int)RadioStatsCharge(&stats));
+            for (int i = 0; i < RADIO_STATS_SF_MAX && len < ATCMD_SIZE; i++) {
+                if (stats.SfTxCount[i] == 0 && stats.SfRxCount[i] == 0) {
+                    continue;
+                }
+                len += snprintf((char *)atcmd + len, ATCMD_SIZE - len, "%s:SF%d,%u,%u,%u,%u\r\n", LORA_AT_CRADIOSTAT,
+                                i + RADIO_STATS_SF_MIN, (unsigned int)stats.SfTxCount[i], (unsigned int)(stats.SfTxTime[i] / 1000),
+                                (unsigned int)stats.SfRxCount[i], (unsigned int)(stats.SfRxTime[i] / 1000));
+            }
+            if (len < ATCMD_SIZE) {
+                snprintf((char *)atcmd + len, ATCMD_SIZE - len, "OK\r\n");
+            }
+            break;
+        }
+        case DESC_CMD: {
+            ret = LWAN_SUCCESS;
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"TX\",\"TXCount\",\"RX\",\"RXCount\",\"CAD\",\"CADCount\",\"Standby\",\"Sleep\",\"uAh\"\r\nOK\r\n", LORA_AT_CRADIOSTAT);
+            break;
+        }
+        case SET_CMD: {
+            if(argc < 1) break;
+
+            // 0 clears the counters
+            if (strtol((const char *)argv[0], NULL, 0) == 0 && lwan_mac_config_set(MAC_CONFIG_RADIO_STATS, NULL) == LWAN_SUCCESS) {
+                ret = LWAN_SUCCESS;
+                at_rsp_ok();
+            }
+            break;
+        }
+        default: break;
+    }
+
+    return ret;
+}
+#endif
 
 static int at_crxp_func(int opt, int argc, char *argv[])
 {
@@ -1179,7 +1918,7 @@ static int at_crxp_func(int opt, int argc, char *argv[])
             rx_params.rx2_freq = rx2_freq;
             if (lwan_mac_config_set(MAC_CONFIG_RX_PARAM, (void *)&rx_params) == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }     
             break;
         }
@@ -1198,7 +1937,9 @@ static int at_crx1delay_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_mac_config_get(MAC_CONFIG_RX1_DELAY, &rx1delay);
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%u\r\nOK\r\n", LORA_AT_CRX1DELAY, (unsigned int)rx1delay);
+            AT_RSP_START(LORA_AT_CRX1DELAY);
+            at_rsp_uint((unsigned int)rx1delay);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -1212,7 +1953,7 @@ static int at_crx1delay_func(int opt, int argc, char *argv[])
             rx1delay = strtol((const char *)argv[0], NULL, 0);
             if (lwan_mac_config_set(MAC_CONFIG_RX1_DELAY, (void *)&rx1delay) == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
             break;
         }
@@ -1235,7 +1976,7 @@ static int at_csave_func(int opt, int argc, char *argv[])
         case EXECUTE_CMD: {
             if (lwan_mac_config_save() == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
             break;
         }
@@ -1259,7 +2000,7 @@ static int at_crestore_func(int opt, int argc, char *argv[])
             LWanMacConfig_t default_mac_config = LWAN_MAC_CONFIG_DEFAULT;
             if (lwan_mac_config_reset(&default_mac_config) == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
             break;
         }
@@ -1278,7 +2019,9 @@ static int at_cpslotinforeq_func(int opt, int argc, char *argv[])
             ret = LWAN_SUCCESS;
             ClassBParam_t classb_param;
             lwan_dev_config_get(DEV_CONFIG_CLASSB_PARAM, &classb_param);
-            snprintf((char *)atcmd,ATCMD_SIZE,"\r\n%s:%u\r\nOK\r\n", LORA_AT_PINGSLOTINFOREQ, classb_param.periodicity);
+            AT_RSP_START(LORA_AT_PINGSLOTINFOREQ);
+            at_rsp_uint(classb_param.periodicity);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -1292,7 +2035,7 @@ static int at_cpslotinforeq_func(int opt, int argc, char *argv[])
             uint8_t periodicityVal = (uint8_t)strtol((const char *)argv[0], NULL, 0);
             if (lwan_mac_req_send(MAC_REQ_PSLOT_INFO, &periodicityVal) == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
             break;
         }
@@ -1313,7 +2056,9 @@ static int at_ckeysprotect_func(int opt, int argc, char *argv[])
             ret = LWAN_SUCCESS;
             lwan_dev_keys_get(DEV_KEYS_PKEY, buf);
             bool protected = lwan_is_key_valid(buf, LORA_KEY_LENGTH);
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%d\r\nOK\r\n", LORA_AT_CKEYSPROTECT, protected);
+            AT_RSP_START(LORA_AT_CKEYSPROTECT);
+            at_rsp_int(protected);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -1325,7 +2070,7 @@ static int at_ckeysprotect_func(int opt, int argc, char *argv[])
             if(argc < 1) break;
             
             int res = LWAN_SUCCESS;
-            length = hex2bin((const char *)argv[0], buf, LORA_KEY_LENGTH);
+            length = AtEngineHex2Bin((const char *)argv[0], buf, LORA_KEY_LENGTH);
             if (length == LORA_KEY_LENGTH) {
                 res = lwan_dev_keys_set(DEV_KEYS_PKEY, buf);
             } else {
@@ -1334,7 +2079,7 @@ static int at_ckeysprotect_func(int opt, int argc, char *argv[])
             
             if (res == LWAN_SUCCESS) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }
             break;
         }
@@ -1375,7 +2120,7 @@ static int at_cjoin_func(int opt, int argc, char *argv[])
             int res = lwan_join(bJoin, bAutoJoin, joinInterval, joinRetryCnt);
             if (res == LWAN_SUCCESS) {
                 ret = 0;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
             }    
             break;
         }
@@ -1448,7 +2193,9 @@ static int at_cgbr_func(int opt, int argc, char *argv[])
         case QUERY_CMD: {
             ret = LWAN_SUCCESS;
             lwan_sys_config_get(SYS_CONFIG_BAUDRATE, &baud);
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%u\r\nOK\r\n", LORA_AT_CGBR, (unsigned int)baud);
+            AT_RSP_START(LORA_AT_CGBR);
+            at_rsp_uint((unsigned int)baud);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
@@ -1463,8 +2210,7 @@ static int at_cgbr_func(int opt, int argc, char *argv[])
             if(baud<110 || baud>9600) break;
             
             ret = LWAN_SUCCESS;
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
-            linkwan_serial_output(atcmd, strlen((const char *)atcmd));
+            linkwan_serial_output_static(at_ok_reply);
             
             uart_log_init(baud); 
             lwan_sys_config_set(SYS_CONFIG_BAUDRATE, &baud);
@@ -1477,6 +2223,17 @@ static int at_cgbr_func(int opt, int argc, char *argv[])
     return ret;
 }
 
+static int log_module_find(const char *name)
+{
+    static const char *const names[LOG_MODULE_NUM] = {"APP", "MAC", "REGION", "RADIO", "LWAN", "AT"};
+
+    for (int i = 0; i < LOG_MODULE_NUM; i++) {
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
 static int at_iloglvl_func(int opt, int argc, char *argv[])
 {
     int ret = LWAN_ERROR;
@@ -1486,24 +2243,35 @@ static int at_iloglvl_func(int opt, int argc, char *argv[])
             ret = LWAN_SUCCESS;
             uint16_t ll = 0;
             lwan_sys_config_get(SYS_CONFIG_LOGLVL, &ll);
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%d\r\nOK\r\n", LORA_AT_ILOGLVL, ll);
+            AT_RSP_START(LORA_AT_ILOGLVL);
+            at_rsp_int(ll);
+            at_rsp_ok();
             break;
         }
         case DESC_CMD: {
             ret = LWAN_SUCCESS;
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"level\"\r\nOK\r\n", LORA_AT_ILOGLVL);
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"level\"[,\"module\"]\r\nOK\r\n", LORA_AT_ILOGLVL);
             break;
         }
         case SET_CMD: {
             if(argc < 1) break;
          
-            ret = LWAN_SUCCESS;
             uint16_t ll = strtol((const char *)argv[0], NULL, 0);
+            if (argc > 1) {
+                // Mask of one module, within the level set for all of them
+                int module = log_module_find(argv[1]);
+                if (module < 0 || ll > 4) break;
+                log_set_module_mask(module, (1<<ll)-1);
+                ret = LWAN_SUCCESS;
+                at_rsp_ok();
+                break;
+            }
+            ret = LWAN_SUCCESS;
             log_set_level((1<<ll)-1);
             
             lwan_sys_config_set(SYS_CONFIG_LOGLVL, &ll);
             
-            snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+            at_rsp_ok();
             break;
         }
         default: break;
@@ -1528,7 +2296,7 @@ static int at_ireboot_func(int opt, int argc, char *argv[])
             int8_t mode = strtol((const char *)argv[0], NULL, 0);
             if (mode == 0 || mode == 1) {
                 ret = LWAN_SUCCESS;
-                snprintf((char *)atcmd, ATCMD_SIZE, "\r\nOK\r\n");
+                at_rsp_ok();
                 AT_PRINTF("%s", atcmd);
                 delay_ms(1);
                 atcmd_index = 0;
@@ -1543,15 +2311,560 @@ static int at_ireboot_func(int opt, int argc, char *argv[])
     return ret;
 }
 
+#ifdef CONFIG_PROFILE
+static int at_iprofile_func(int opt, int argc, char *argv[])
+{
+    int ret = LWAN_ERROR;
+
+    switch(opt) {
+        case QUERY_CMD: {
+            ret = LWAN_SUCCESS;
+            // One line per probe hit so far, in CPU cycles
+            AT_PRINTF("\r\n");
+            for (int i = 0; i < PROFILE_PROBE_MAX; i++) {
+                if (ProfileFormat((ProfileProbe_t)i, (char *)atcmd, ATCMD_SIZE) > 0) {
+                    AT_PRINTF("%s:%s\r\n", LORA_AT_IPROFILE, atcmd);
+                }
+            }
+            snprintf((char *)atcmd, ATCMD_SIZE, "OK\r\n");
+            break;
+        }
+        case DESC_CMD: {
+            ret = LWAN_SUCCESS;
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"Name\",\"Count\",\"Min\",\"Avg\",\"Max\",\"Hist0..7\"\r\nOK\r\n", LORA_AT_IPROFILE);
+            break;
+        }
+        case SET_CMD: {
+            if(argc < 1) break;
+
+            // 0 clears the probes, 1 prints them on the log
+            int8_t mode = strtol((const char *)argv[0], NULL, 0);
+            if (mode == 0) {
+                ProfileReset();
+            } else if (mode == 1) {
+                ProfileDump();
+            } else {
+                break;
+            }
+            ret = LWAN_SUCCESS;
+            at_rsp_ok();
+            break;
+        }
+        default: break;
+    }
+
+    return ret;
+}
+#endif
+
+#ifdef CONFIG_WATCHDOG
+static int at_ihealth_func(int opt, int argc, char *argv[])
+{
+    int ret = LWAN_ERROR;
+
+    switch(opt) {
+        case QUERY_CMD: {
+            WatchdogOverrun_t overrun;
+
+            ret = LWAN_SUCCESS;
+            // One line per task, the latencies in ms, then the overruns, the
+            // most recent first
+            AT_PRINTF("\r\n");
+            for (int i = 0; i < WATCHDOG_TASK_MAX; i++) {
+                if (WatchdogFormat((WatchdogTask_t)i, (char *)atcmd, ATCMD_SIZE) > 0) {
+                    AT_PRINTF("%s:%s\r\n", LORA_AT_IHEALTH, atcmd);
+                }
+            }
+            AT_PRINTF("%s:RESETS,%u\r\n", LORA_AT_IHEALTH, (unsigned int)WatchdogResets());
+            for (uint8_t i = 0; WatchdogOverrunGet(i, &overrun); i++) {
+                AT_PRINTF("%s:OVERRUN,%u,%u,%u,%d\r\n", LORA_AT_IHEALTH, overrun.Task, overrun.Boot,
+                          (unsigned int)overrun.Time,
+                          overrun.Latency == WATCHDOG_LATENCY_HANG ? -1 : (int)overrun.Latency);
+            }
+            snprintf((char *)atcmd, ATCMD_SIZE, "OK\r\n");
+            break;
+        }
+        case DESC_CMD: {
+            ret = LWAN_SUCCESS;
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"Name\",\"Budget\",\"Count\",\"Overruns\",\"Hist0..7\"\r\n"
+                     "%s:\"RESETS\",\"Resets\"\r\n%s:\"OVERRUN\",\"Task\",\"Boot\",\"Time\",\"Latency\"\r\nOK\r\n",
+                     LORA_AT_IHEALTH, LORA_AT_IHEALTH, LORA_AT_IHEALTH);
+            break;
+        }
+        case SET_CMD: {
+            if(argc < 1) break;
+
+            // 0 clears the counters and the overruns
+            if (strtol((const char *)argv[0], NULL, 0) != 0) {
+                break;
+            }
+            WatchdogReset();
+            ret = LWAN_SUCCESS;
+            at_rsp_ok();
+            break;
+        }
+        default: break;
+    }
+
+    return ret;
+}
+#endif
+
+#ifdef CONFIG_CRASH_DUMP
+static int at_icrash_func(int opt, int argc, char *argv[])
+{
+    int ret = LWAN_ERROR;
+    const CrashDump_t *dump = CrashDumpGet();
+
+    switch(opt) {
+        case QUERY_CMD: {
+            int len;
+            int i;
+
+            ret = LWAN_SUCCESS;
+            // Nothing but OK without a snapshot
+            AT_PRINTF("\r\n");
+            if (dump != NULL) {
+                AT_PRINTF("%s:CAUSE,%u,%u\r\n", LORA_AT_ICRASH, dump->Cause, (unsigned int)dump->Time);
+                AT_PRINTF("%s:REGS,%08X,%08X,%08X,%08X,%08X,%08X,%08X,%08X,%08X,%08X\r\n", LORA_AT_ICRASH,
+                          (unsigned int)dump->Regs[CRASH_DUMP_R0], (unsigned int)dump->Regs[CRASH_DUMP_R1],
+                          (unsigned int)dump->Regs[CRASH_DUMP_R2], (unsigned int)dump->Regs[CRASH_DUMP_R3],
+                          (unsigned int)dump->Regs[CRASH_DUMP_R12], (unsigned int)dump->Regs[CRASH_DUMP_LR],
+                          (unsigned int)dump->Regs[CRASH_DUMP_PC], (unsigned int)dump->Regs[CRASH_DUMP_XPSR],
+                          (unsigned int)dump->Sp, (unsigned int)dump->ExcReturn);
+                AT_PRINTF("%s:FAULT,%08X,%08X,%08X,%08X\r\n", LORA_AT_ICRASH, (unsigned int)dump->Cfsr,
+                          (unsigned int)dump->Hfsr, (unsigned int)dump->Mmfar, (unsigned int)dump->Bfar);
+                AT_PRINTF("%s:TIMER,%u,%08X\r\n", LORA_AT_ICRASH, dump->TimerCount, (unsigned int)dump->TimerNext);
+                for (i = 0; i < dump->EventCount; i++) {
+                    AT_PRINTF("%s:EVENT,%u,%u,%u\r\n", LORA_AT_ICRASH, dump->Events[i].Type,
+                              dump->Events[i].Param, (unsigned int)dump->Events[i].Data);
+                }
+                for (i = 0; i < dump->StackCount; i += 8) {
+                    len = snprintf((char *)atcmd, ATCMD_SIZE, "%s:STACK", LORA_AT_ICRASH);
+                    for (int j = i; j < i + 8 && j < dump->StackCount && len < ATCMD_SIZE; j++) {
+                        len += snprintf((char *)atcmd + len, ATCMD_SIZE - len, ",%08X", (unsigned int)dump->Stack[j]);
+                    }
+                    AT_PRINTF("%s\r\n", atcmd);
+                }
+#ifdef CONFIG_PROFILE
+                len = snprintf((char *)atcmd, ATCMD_SIZE, "%s:PROBE", LORA_AT_ICRASH);
+                for (i = 0; i < PROFILE_PROBE_MAX && len < ATCMD_SIZE; i++) {
+                    len += snprintf((char *)atcmd + len, ATCMD_SIZE - len, ",%u", (unsigned int)dump->ProbeCycles[i]);
+                }
+                AT_PRINTF("%s\r\n", atcmd);
+#endif
+            }
+            snprintf((char *)atcmd, ATCMD_SIZE, "OK\r\n");
+            break;
+        }
+        case DESC_CMD: {
+            ret = LWAN_SUCCESS;
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"CAUSE\",\"Cause\",\"Time\"\r\n"
+                     "%s:\"REGS\",\"R0..R3\",\"R12\",\"LR\",\"PC\",\"xPSR\",\"SP\",\"EXC_RETURN\"\r\n"
+                     "%s:\"FAULT\",\"CFSR\",\"HFSR\",\"MMFAR\",\"BFAR\"\r\n"
+                     "%s:\"TIMER\",\"Running\",\"Next\"\r\n%s:\"EVENT\",\"Type\",\"Param\",\"Data\"\r\nOK\r\n",
+                     LORA_AT_ICRASH, LORA_AT_ICRASH, LORA_AT_ICRASH, LORA_AT_ICRASH, LORA_AT_ICRASH);
+            break;
+        }
+        case SET_CMD: {
+            if(argc < 1) break;
+
+            // 0 drops the snapshot, 1 prints it packed for an uplink
+            int8_t mode = strtol((const char *)argv[0], NULL, 0);
+            if (mode == 0) {
+                CrashDumpClear();
+                ret = LWAN_SUCCESS;
+                at_rsp_ok();
+            } else if (mode == 1) {
+                uint8_t buf[LORAWAN_APP_DATA_BUFF_SIZE];
+                uint8_t size = CrashDumpExport(buf, sizeof(buf));
+                int len = snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:", LORA_AT_ICRASH);
+
+                for (uint8_t i = 0; i < size && len < ATCMD_SIZE; i++) {
+                    len += snprintf((char *)atcmd + len, ATCMD_SIZE - len, "%02X", buf[i]);
+                }
+                if (len < ATCMD_SIZE) {
+                    snprintf((char *)atcmd + len, ATCMD_SIZE - len, "\r\nOK\r\n");
+                }
+                ret = LWAN_SUCCESS;
+            }
+            break;
+        }
+        default: break;
+    }
+
+    return ret;
+}
+#endif
+
+#ifdef CONFIG_LWAN_ENERGY
+static int at_ienergy_func(int opt, int argc, char *argv[])
+{
+    int ret = LWAN_ERROR;
+    lwan_energy_config_t config;
+
+    switch(opt) {
+        case QUERY_CMD: {
+            lwan_energy_status_t status;
+            uint8_t reportMode;
+            uint32_t reportInterval;
+
+            ret = LWAN_SUCCESS;
+            lwan_mac_config_get(MAC_CONFIG_REPORT_MODE, &reportMode);
+            lwan_mac_config_get(MAC_CONFIG_REPORT_INTERVAL, &reportInterval);
+            lwan_energy_config_get(&config);
+            lwan_energy_status_get(reportMode == TX_ON_TIMER ? reportInterval : 0, &status);
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\r\nOK\r\n", LORA_AT_IENERGY,
+                     (unsigned int)config.capacity, config.lifetime, config.floor, config.dr_adapt,
+                     (unsigned int)status.allowance, (unsigned int)status.spent, (unsigned int)status.used,
+                     status.days, status.uplink_cost, (unsigned int)status.interval, status.level);
+            break;
+        }
+        case DESC_CMD: {
+            ret = LWAN_SUCCESS;
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"mAh\",\"days\",\"floor uA\",\"DR adapt\",\"allowance uAh\","
+                     "\"spent uAh\",\"used mAh\",\"day\",\"uplink uAh\",\"interval\",\"level\"\r\nOK\r\n", LORA_AT_IENERGY);
+            break;
+        }
+        case SET_CMD: {
+            // 0 starts the lifetime again, else the capacity, lifetime, floor current and DR adapt
+            if (argc == 1) {
+                if (strtol((const char *)argv[0], NULL, 0) == 0) {
+                    lwan_energy_reset();
+                    ret = LWAN_SUCCESS;
+                    at_rsp_ok();
+                }
+                break;
+            }
+            if (argc < 3) break;
+
+            config.capacity = strtol((const char *)argv[0], NULL, 0);
+            config.lifetime = strtol((const char *)argv[1], NULL, 0);
+            config.floor = strtol((const char *)argv[2], NULL, 0);
+            config.dr_adapt = argc > 3 ? (strtol((const char *)argv[3], NULL, 0) != 0) : 0;
+            if (lwan_energy_config_set(&config) == LWAN_SUCCESS) {
+                ret = LWAN_SUCCESS;
+                at_rsp_ok();
+            }
+            break;
+        }
+        default: break;
+    }
+
+    return ret;
+}
+#endif
+
+static int at_iscan_func(int opt, int argc, char *argv[])
+{
+    int ret = LWAN_ERROR;
+
+    switch(opt) {
+        case DESC_CMD: {
+            ret = LWAN_SUCCESS;
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"freq\",\"step\",\"count\",\"samples\",\"busy dBm\"\r\nOK\r\n", LORA_AT_ISCAN);
+            break;
+        }
+#ifdef CONFIG_LORAMAC_CHANNEL_QUALITY
+        case EXECUTE_CMD: {
+            // Scans the MAC channels into the selection weights, then lists
+            // the channels below full weight
+            if (lwan_channel_quality_scan(LWAN_AT_SCAN_SAMPLES, LWAN_AT_SCAN_BUSY_RSSI) != LWAN_SUCCESS)
+                break;
+            ret = LWAN_SUCCESS;
+            AT_PRINTF("\r\n");
+            for (int i = 0; i < REGION_COMMON_QUALITY_CHANNELS; i++) {
+                uint8_t weight = RegionCommonChannelQualityWeight(i);
+                if (weight < REGION_COMMON_QUALITY_WEIGHT_MAX) {
+                    AT_PRINTF("%s:CH,%d,%u\r\n", LORA_AT_ISCAN, i, weight);
+                }
+            }
+            snprintf((char *)atcmd, ATCMD_SIZE, "OK\r\n");
+            break;
+        }
+#endif
+        case SET_CMD: {
+            static uint32_t freqs[LWAN_AT_SCAN_CHANNELS];
+            static RadioScanChannel_t channels[LWAN_AT_SCAN_CHANNELS];
+            uint16_t samples = LWAN_AT_SCAN_SAMPLES;
+            int16_t thresh = LWAN_AT_SCAN_BUSY_RSSI;
+            uint32_t freq, step;
+            uint8_t count;
+            int len;
+            int i, j;
+
+            if(argc < 3) break;
+
+            freq = strtoul((const char *)argv[0], NULL, 0);
+            step = strtoul((const char *)argv[1], NULL, 0);
+            count = strtol((const char *)argv[2], NULL, 0);
+            if (argc > 3)
+                samples = strtol((const char *)argv[3], NULL, 0);
+            if (argc > 4)
+                thresh = strtol((const char *)argv[4], NULL, 0);
+            if (count == 0 || count > LWAN_AT_SCAN_CHANNELS || samples == 0)
+                break;
+
+            for (i = 0; i < count; i++) {
+                freqs[i] = freq + i * step;
+            }
+            memset(channels, 0, sizeof(channels));
+            if (lwan_dev_scan(freqs, count, samples, channels) != LWAN_SUCCESS)
+                break;
+
+            // A line per channel: its frequency, the RSSI range and average,
+            // the per mille of samples at or above the busy level and the
+            // histogram, then the quietest channel
+            ret = LWAN_SUCCESS;
+            AT_PRINTF("\r\n");
+            for (i = 0; i < count; i++) {
+                len = snprintf((char *)atcmd, ATCMD_SIZE, "%s:%d,%u,%d,%d,%d,%u", LORA_AT_ISCAN, i,
+                               (unsigned int)freqs[i], channels[i].RssiMin,
+                               (int)(channels[i].RssiSum / (int32_t)channels[i].Samples), channels[i].RssiMax,
+                               lwan_dev_scan_occupancy(&channels[i], thresh));
+                for (j = 0; j < RADIO_SCAN_BINS && len < ATCMD_SIZE; j++) {
+                    len += snprintf((char *)atcmd + len, ATCMD_SIZE - len, ",%u", channels[i].Hist[j]);
+                }
+                AT_PRINTF("%s\r\n", atcmd);
+            }
+            snprintf((char *)atcmd, ATCMD_SIZE, "%s:QUIET,%d\r\nOK\r\n", LORA_AT_ISCAN,
+                     lwan_dev_scan_quietest(channels, count, thresh));
+            break;
+        }
+        default: break;
+    }
+
+    return ret;
+}
+
+#ifdef CONFIG_STATS
+static int at_istat_func(int opt, int argc, char *argv[])
+{
+    int ret = LWAN_ERROR;
+
+    switch(opt) {
+        case QUERY_CMD: {
+            int len;
+            int i;
+
+            ret = LWAN_SUCCESS;
+            // The uplinks and downlinks per DR, the counters, then the times
+            // in ms and the probes in cycles when built
+            AT_PRINTF("\r\n");
+            len = snprintf((char *)atcmd, ATCMD_SIZE, "%s:UL", LORA_AT_ISTAT);
+            for (i = 0; i < STATS_DR_MAX && len < ATCMD_SIZE; i++) {
+                len += snprintf((char *)atcmd + len, ATCMD_SIZE - len, ",%u", (unsigned int)StatsCounters.Uplinks[i]);
+            }
+            AT_PRINTF("%s\r\n", atcmd);
+            len = snprintf((char *)atcmd, ATCMD_SIZE, "%s:DL", LORA_AT_ISTAT);
+            for (i = 0; i < STATS_DR_MAX && len < ATCMD_SIZE; i++) {
+                len += snprintf((char *)atcmd + len, ATCMD_SIZE - len, ",%u", (unsigned int)StatsCounters.Downlinks[i]);
+            }
+            AT_PRINTF("%s\r\n", atcmd);
+            AT_PRINTF("%s:MAC,%u,%u,%u,%u,%u\r\n", LORA_AT_ISTAT,
+                      (unsigned int)StatsCounters.Counters[STATS_MIC_FAIL],
+                      (unsigned int)StatsCounters.Counters[STATS_RX_WINDOW],
+                      (unsigned int)StatsCounters.Counters[STATS_RX_FRAME],
+                      (unsigned int)StatsCounters.Counters[STATS_JOIN_REQUEST],
+                      (unsigned int)StatsCounters.Counters[STATS_RX_EARLY_DROP]);
+            AT_PRINTF("%s:SYS,%u,%u,%u,%u\r\n", LORA_AT_ISTAT,
+                      (unsigned int)StatsCounters.Counters[STATS_TIMER_DEPTH],
+                      (unsigned int)StatsCounters.Counters[STATS_AT_COMMAND],
+                      (unsigned int)StatsCounters.Counters[STATS_AT_DROPPED],
+                      (unsigned int)StatsCounters.Counters[STATS_LOG_DROPPED]);
+#ifdef CONFIG_LOWPOWER_GOVERNOR
+            {
+                RtcLowPowerStats_t lowPower;
+
+                RtcGetLowPowerStats(&lowPower);
+                len = snprintf((char *)atcmd, ATCMD_SIZE, "%s:POWER", LORA_AT_ISTAT);
+                for (i = 0; i < RTC_LP_MODE_NUM && len < ATCMD_SIZE; i++) {
+                    len += snprintf((char *)atcmd + len, ATCMD_SIZE - len, ",%u", (unsigned int)lowPower.Residency[i]);
+                }
+                AT_PRINTF("%s\r\n", atcmd);
+            }
+#endif
+#ifdef CONFIG_LORA_RADIO_STATS
+            {
+                RadioStats_t radio;
+
+                lwan_mac_config_get(MAC_CONFIG_RADIO_STATS, &radio);
+                AT_PRINTF("%s:RADIO,%u,%u,%u,%u\r\n", LORA_AT_ISTAT,
+                          (unsigned int)(radio.Time[RADIO_STATS_MODE_TX] / 1000),
+                          (unsigned int)((radio.Time[RADIO_STATS_MODE_RX] + radio.Time[RADIO_STATS_MODE_RX_DC]) / 1000),
+                          (unsigned int)(radio.Time[RADIO_STATS_MODE_CAD] / 1000),
+                          (unsigned int)((radio.Time[RADIO_STATS_MODE_STDBY_RC] + radio.Time[RADIO_STATS_MODE_STDBY_XOSC] + radio.Time[RADIO_STATS_MODE_FS]) / 1000));
+            }
+#endif
+#ifdef CONFIG_PROFILE
+            for (i = 0; i < PROFILE_PROBE_MAX; i++) {
+                if (ProfileFormat((ProfileProbe_t)i, (char *)atcmd, ATCMD_SIZE) > 0) {
+                    AT_PRINTF("%s:PROBE,%s\r\n", LORA_AT_ISTAT, atcmd);
+                }
+            }
+#endif
+            snprintf((char *)atcmd, ATCMD_SIZE, "OK\r\n");
+            break;
+        }
+        case DESC_CMD: {
+            ret = LWAN_SUCCESS;
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"UL\",\"DR0..15\"\r\n%s:\"DL\",\"DR0..15\"\r\n"
+                     "%s:\"MAC\",\"MICFail\",\"RXWindows\",\"RXFrames\",\"JoinRequests\",\"EarlyDrops\"\r\n"
+                     "%s:\"SYS\",\"TimersMax\",\"ATCommands\",\"ATDropped\",\"LogDropped\"\r\nOK\r\n",
+                     LORA_AT_ISTAT, LORA_AT_ISTAT, LORA_AT_ISTAT, LORA_AT_ISTAT);
+            break;
+        }
+        case SET_CMD: {
+            if(argc < 1) break;
+
+            // 0 clears the counters, 1 prints them packed for an uplink
+            int8_t mode = strtol((const char *)argv[0], NULL, 0);
+            if (mode == 0) {
+                StatsReset();
+                ret = LWAN_SUCCESS;
+                at_rsp_ok();
+            } else if (mode == 1) {
+                uint8_t buf[LORAWAN_APP_DATA_BUFF_SIZE];
+                uint8_t size = StatsExport(buf, sizeof(buf));
+                int len = snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:", LORA_AT_ISTAT);
+
+                for (uint8_t i = 0; i < size && len < ATCMD_SIZE; i++) {
+                    len += snprintf((char *)atcmd + len, ATCMD_SIZE - len, "%02X", buf[i]);
+                }
+                if (len < ATCMD_SIZE) {
+                    snprintf((char *)atcmd + len, ATCMD_SIZE - len, "\r\nOK\r\n");
+                }
+                ret = LWAN_SUCCESS;
+            }
+            break;
+        }
+        default: break;
+    }
+
+    return ret;
+}
+#endif
+
+#ifdef CONFIG_LWAN_AT_BINARY
+static int at_cbinmode_func(int opt, int argc, char *argv[])
+{
+    int ret = LWAN_ERROR;
+
+    switch(opt) {
+        case QUERY_CMD: {
+            ret = LWAN_SUCCESS;
+            AT_RSP_START(LORA_AT_CBINMODE);
+            at_rsp_int(g_bin_mode);
+            at_rsp_ok();
+            break;
+        }
+        case DESC_CMD: {
+            ret = LWAN_SUCCESS;
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"1: binary frames until their text command\"\r\nOK\r\n", LORA_AT_CBINMODE);
+            break;
+        }
+        case SET_CMD: {
+            if(argc < 1 || strtol((const char *)argv[0], NULL, 0) != 1) break;
+
+            linkwan_serial_output_static(at_ok_reply);
+            bin_rx_index = 0;
+            bin_rx_ready = false;
+            g_bin_mode = true;
+            return 1;
+        }
+        default: break;
+    }
+
+    return ret;
+}
+#endif
+
+#ifdef CONFIG_LWAN_AT_URC
+static int at_curc_func(int opt, int argc, char *argv[])
+{
+    int ret = LWAN_ERROR;
+    uint32_t mask;
+
+    switch(opt) {
+        case QUERY_CMD: {
+            ret = LWAN_SUCCESS;
+            AT_RSP_START(LORA_AT_CURC);
+            at_rsp_hex_uint(urc_mask, 1);
+            at_rsp_ok();
+            break;
+        }
+        case DESC_CMD: {
+            ret = LWAN_SUCCESS;
+            snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s:\"mask: recv, join, sent, beacon, linkcheck\"\r\nOK\r\n", LORA_AT_CURC);
+            break;
+        }
+        case SET_CMD: {
+            if(argc < 1) break;
+
+            mask = strtol((const char *)argv[0], NULL, 16);
+            if (mask & ~URC_MASK_ALL) break;
+
+            urc_mask = mask;
+            ret = LWAN_SUCCESS;
+            at_rsp_ok();
+            break;
+        }
+        default: break;
+    }
+
+    return ret;
+}
+#endif
+
 void linkwan_at_process(void)
 {
-    char *ptr = NULL;
-	int argc = 0;
-	int index = 0;
 	char *argv[ARGC_LIMIT];
     int ret = LWAN_ERROR;
-    uint8_t *rxcmd = atcmd + 2;
-    int16_t rxcmd_index = atcmd_index - 2;
+    uint8_t *rxcmd;
+    int16_t rxcmd_index;
+
+#ifdef LWAN_AT_RX_RING
+#ifdef CONFIG_LWAN_AT_LINE_RX
+    // Nothing is assembled before the end of the line
+    if (!linkwan_at_pending()) {
+        return;
+    }
+#endif
+    // Up to the end of a command, the bytes after it are kept for the next call
+    while (at_rx_tail != at_rx_head) {
+        uint8_t byte = at_rx_ring[at_rx_tail & (CONFIG_LWAN_AT_RX_RING_SIZE - 1)];
+
+        at_rx_tail++;
+#ifdef CONFIG_LWAN_AT_LINE_RX
+        if (byte == '\r' || byte == '\n') {
+            at_rx_line_out++;
+        }
+#endif
+        if (serial_assemble(byte)) {
+            break;
+        }
+    }
+#endif
+    rxcmd = atcmd + 2;
+    rxcmd_index = atcmd_index - 2;
+
+#ifdef CONFIG_LWAN_AT_BINARY
+    if (g_bin_mode) {
+        if (bin_rx_ready) {
+            g_atcmd_processing = true;
+            bin_process();
+            bin_rx_index = 0;
+            bin_rx_ready = false;
+            if (!g_bin_mode) {
+                // The next line starts over the frame just run
+                atcmd_index = 0;
+                memset(atcmd, 0xff, ATCMD_SIZE);
+            }
+            g_atcmd_processing = false;
+        }
+        return;
+    }
+#endif
 
     if (atcmd_index <=2 && atcmd[atcmd_index] == '\0') {
         linkwan_at_prompt_print();
@@ -1565,49 +2878,25 @@ void linkwan_at_process(void)
     }
 
     g_atcmd_processing = true;
+    PROFILE_START(PROFILE_AT_PROCESS);
+    WATCHDOG_TASK_BEGIN(WATCHDOG_TASK_AT);
     
-    if(atcmd[0] != 'A' || atcmd[1] != 'T')
-        goto at_end;
-    for (index = 0; index < AT_TABLE_SIZE; index++) {
-        int cmd_len = strlen(g_at_table[index].cmd);
-    	if (!strncmp((const char *)rxcmd, g_at_table[index].cmd, cmd_len)) {
-    		ptr = (char *)rxcmd + cmd_len;
-    		break;
-    	}
-    }
-	if (index >= AT_TABLE_SIZE || !g_at_table[index].fn)
-        goto at_end;
-
-    if ((ptr[0] == '?') && (ptr[1] == '\0')) {
-		ret = g_at_table[index].fn(QUERY_CMD, argc, argv);
-	} else if (ptr[0] == '\0') {
-		ret = g_at_table[index].fn(EXECUTE_CMD, argc, argv);
-	}  else if (ptr[0] == ' ') {
-        argv[argc++] = ptr;
-		ret = g_at_table[index].fn(EXECUTE_CMD, argc, argv);
-	} else if ((ptr[0] == '=') && (ptr[1] == '?') && (ptr[2] == '\0')) {
-        ret = g_at_table[index].fn(DESC_CMD, argc, argv);
-	} else if (ptr[0] == '=') {
-		ptr += 1;
-        
-        char *str = strtok((char *)ptr, ",");
-        while(str) {
-            argv[argc++] = str;
-            str = strtok((char *)NULL, ",");
-        }
-		ret = g_at_table[index].fn(SET_CMD, argc, argv);
-	} else {
-		ret = LWAN_ERROR;
-	}
+    STATS_INC(STATS_AT_COMMAND);
+    at_rsp_len = 0;
+    at_rsp_static = NULL;
+    ret = AtEngineRun(&g_at_cmds, (char *)atcmd, argv, ARGC_LIMIT);
 
-at_end:
 	if (LWAN_ERROR == ret)
-        snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s%x\r\n", AT_ERROR, 1);
-    if( ret<=0 )
-        linkwan_serial_output(atcmd, strlen((const char *)atcmd));  
+        linkwan_serial_output_static(at_error_reply);
+    else if( ret<=0 && at_rsp_static )
+        linkwan_serial_output_static(at_rsp_static);
+    else if( ret<=0 )
+        linkwan_serial_output(atcmd, at_rsp_len ? at_rsp_len : strlen((const char *)atcmd));  
         
     atcmd_index = 0;
     memset(atcmd, 0xff, ATCMD_SIZE);
+    WATCHDOG_TASK_END(WATCHDOG_TASK_AT);
+    PROFILE_STOP(PROFILE_AT_PROCESS);
     g_atcmd_processing = false;        
     return;
 }
@@ -1616,4 +2905,10 @@ void linkwan_at_init(void)
 {
     atcmd_index = 0;
     memset(atcmd, 0xff, ATCMD_SIZE);
+#ifdef CONFIG_PROFILE
+    ProfileInit();
+#endif
+#ifdef CONFIG_WATCHDOG
+    WatchdogTaskRegister(WATCHDOG_TASK_AT, CONFIG_WATCHDOG_AT_BUDGET);
+#endif
 }
\ No newline at end of file
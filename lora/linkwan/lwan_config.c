@@ -1,3 +1,5 @@
+#define LOG_MODULE LOG_MODULE_LWAN
+
 #include <string.h>
 #include "tremo_flash.h"
 #include "radio.h"
@@ -7,31 +9,454 @@
 #include "LoRaMacCrypto.h"
 #include "linkwan.h"
 #include "lwan_config.h" 
+#include "crc.h"
+#ifdef CONFIG_REGION_MULTI
+#include "Region.h"
+#endif
+#ifdef CONFIG_WARM_BOOT_RETAINED
+#include "warm-boot.h"
+#endif
+#ifdef CONFIG_KEY_SLOTS
+#include "key-slot.h"
+#endif
 
 #define MAX_BEACON_RETRY_TIMES 2
 #define LORA_KEYS_MAGIC_NUM 0xABABBABA 
+#ifdef CONFIG_KEY_SLOTS
+// The AppKey, NwkSKey and AppSKey are stored wrapped by the root key
+#define LORA_KEYS_WRAPPED_MAGIC_NUM 0xABABBABB
+#endif
 
 static LWanDevConfig_t g_lwan_dev_config;
 static LWanMacConfig_t g_lwan_mac_config;
+#ifdef CONFIG_LWAN_CONFIG_DEFER
 static LWanSysConfig_t g_lwan_sys_config;
+#else
+// Read in place from the flash, the defaults of the application while not saved
+static const LWanSysConfig_t *g_lwan_sys_config_default;
+#endif
 static LWanDevKeys_t g_lwan_dev_keys;
-static LWanProdctConfig_t g_lwan_prodct_config;
+static const LWanProdctConfig_t *g_lwan_prodct_config_p;
+
+static uint16_t crc16(uint8_t *buffer, uint16_t length )
+{
+    return CrcCompute(&CrcCcitt, buffer, length);
+}
+
+#ifdef CONFIG_LWAN_FCNT_STORE
+#ifndef CONFIG_LWAN_FCNT_FLASH_ADDR
+#error "CONFIG_LWAN_FCNT_STORE needs CONFIG_LWAN_FCNT_FLASH_ADDR"
+#endif
+#ifndef CONFIG_LWAN_FCNT_FLASH_PAGES
+#define CONFIG_LWAN_FCNT_FLASH_PAGES 2
+#endif
+#if CONFIG_LWAN_FCNT_FLASH_PAGES < 2
+#error "CONFIG_LWAN_FCNT_FLASH_PAGES must be 2 at least"
+#endif
+// Frames between two checkpoints, also the gap added to FCntUp on restore
+#ifndef CONFIG_LWAN_FCNT_INTERVAL
+#define CONFIG_LWAN_FCNT_INTERVAL 16
+#endif
+
+#define LWAN_FCNT_MAGIC 0x46434E54
+#define LWAN_FCNT_ERASED 0xFFFFFFFF
+
+// A page holds a header then checkpoints appended to its erased part, both 8
+// bytes: the flash programs 8 bytes at once
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+} LWanFcntHeader_t;
+
+typedef struct {
+    uint32_t up;
+    uint32_t down;
+} LWanFcntRecord_t;
+
+#define LWAN_FCNT_RECORDS ((FLASH_PAGE_SIZE - sizeof(LWanFcntHeader_t)) / sizeof(LWanFcntRecord_t))
+
+static bool g_fcnt_scanned = false;
+static bool g_fcnt_found = false;
+static uint8_t g_fcnt_page;
+static uint16_t g_fcnt_index;  // next erased record of the page
+static uint32_t g_fcnt_seq;
+static LWanFcntRecord_t g_fcnt_last;
+
+#ifdef CONFIG_WARM_BOOT_RETAINED
+// Counters of the last update, exact across a warm reset
+typedef struct {
+    LWanFcntRecord_t fcnt;
+    WarmBootBlock_t block;
+} LWanFcntRetained_t;
+static LWanFcntRetained_t g_fcnt_retained RETAINED_ATTR;
+#endif
+
+static LWanFcntHeader_t *fcnt_page_header(uint8_t page)
+{
+    return (LWanFcntHeader_t *)(CONFIG_LWAN_FCNT_FLASH_ADDR + page * FLASH_PAGE_SIZE);
+}
+
+static LWanFcntRecord_t *fcnt_page_records(uint8_t page)
+{
+    return (LWanFcntRecord_t *)(fcnt_page_header(page) + 1);
+}
+
+// Finds the last checkpoint, in the page of highest sequence number
+static void fcnt_store_scan(void)
+{
+    g_fcnt_scanned = true;
+    g_fcnt_found = false;
+    for (uint8_t page = 0; page < CONFIG_LWAN_FCNT_FLASH_PAGES; page++) {
+        LWanFcntHeader_t *header = fcnt_page_header(page);
+        LWanFcntRecord_t *records = fcnt_page_records(page);
+        uint16_t count = 0;
+
+        if (header->magic != LWAN_FCNT_MAGIC ||
+            (g_fcnt_found && (int32_t)(header->seq - g_fcnt_seq) <= 0)) {
+            continue;
+        }
+        while (count < LWAN_FCNT_RECORDS &&
+               (records[count].up != LWAN_FCNT_ERASED || records[count].down != LWAN_FCNT_ERASED)) {
+            count++;
+        }
+        if (count == 0) {
+            continue;
+        }
+        g_fcnt_found = true;
+        g_fcnt_page = page;
+        g_fcnt_index = count;
+        g_fcnt_seq = header->seq;
+        g_fcnt_last = records[count - 1];
+    }
+}
+
+int lwan_fcnt_restore(uint32_t *fcnt_up, uint32_t *fcnt_down)
+{
+#ifdef CONFIG_WARM_BOOT_RETAINED
+    if (WarmBootBlockValid(&g_fcnt_retained.block, &g_fcnt_retained.fcnt, sizeof(g_fcnt_retained.fcnt))) {
+        // One uplink may have gone out after the update
+        *fcnt_up = g_fcnt_retained.fcnt.up + 1;
+        *fcnt_down = g_fcnt_retained.fcnt.down;
+        return LWAN_SUCCESS;
+    }
+#endif
+    fcnt_store_scan();
+    if (!g_fcnt_found) {
+        return LWAN_ERROR;
+    }
+    // Less than CONFIG_LWAN_FCNT_INTERVAL uplinks went out after the checkpoint
+    *fcnt_up = g_fcnt_last.up + CONFIG_LWAN_FCNT_INTERVAL;
+    *fcnt_down = g_fcnt_last.down;
+    return LWAN_SUCCESS;
+}
+
+int lwan_fcnt_update(uint32_t fcnt_up, uint32_t fcnt_down)
+{
+    LWanFcntRecord_t record = {fcnt_up, fcnt_down};
+    int status;
+
+#ifdef CONFIG_WARM_BOOT_RETAINED
+    g_fcnt_retained.fcnt = record;
+    WarmBootBlockSeal(&g_fcnt_retained.block, &g_fcnt_retained.fcnt, sizeof(g_fcnt_retained.fcnt));
+#endif
+    if (!g_fcnt_scanned) {
+        fcnt_store_scan();
+    }
+    // A counter going back is a new session, checkpointed right away
+    if (g_fcnt_found && fcnt_up >= g_fcnt_last.up && fcnt_up - g_fcnt_last.up < CONFIG_LWAN_FCNT_INTERVAL &&
+        fcnt_down >= g_fcnt_last.down && fcnt_down - g_fcnt_last.down < CONFIG_LWAN_FCNT_INTERVAL) {
+        return LWAN_SUCCESS;
+    }
+
+    if (g_fcnt_found && g_fcnt_index < LWAN_FCNT_RECORDS) {
+        status = flash_program_bytes((uint32_t)&fcnt_page_records(g_fcnt_page)[g_fcnt_index],
+                                     (uint8_t *)&record, sizeof(record));
+        g_fcnt_index++;
+    } else {
+        // The next page of the ring is erased, the current one keeps the last
+        // checkpoint until the header and the first record are programmed
+        uint32_t buf[4] = {LWAN_FCNT_MAGIC, g_fcnt_found ? g_fcnt_seq + 1 : 0, fcnt_up, fcnt_down};
+        uint8_t page = g_fcnt_found ? (g_fcnt_page + 1) % CONFIG_LWAN_FCNT_FLASH_PAGES : 0;
+
+        flash_erase_page((uint32_t)fcnt_page_header(page));
+        status = flash_program_bytes((uint32_t)fcnt_page_header(page), (uint8_t *)buf, sizeof(buf));
+        g_fcnt_page = page;
+        g_fcnt_seq = buf[1];
+        g_fcnt_index = 1;
+    }
+    if (status != 0) {
+        LOG_PRINTF(LL_ERR, "Error writing frame counters\r\n");
+        return LWAN_ERROR;
+    }
+    g_fcnt_found = true;
+    g_fcnt_last = record;
+    return LWAN_SUCCESS;
+}
+#endif
+
+#ifdef CONFIG_LWAN_KV_STORE
+#ifndef CONFIG_LWAN_KV_FLASH_ADDR
+#error "CONFIG_LWAN_KV_STORE needs CONFIG_LWAN_KV_FLASH_ADDR"
+#endif
+#ifndef CONFIG_LWAN_KV_FLASH_PAGES
+#define CONFIG_LWAN_KV_FLASH_PAGES 2
+#endif
+#if CONFIG_LWAN_KV_FLASH_PAGES < 2
+#error "CONFIG_LWAN_KV_FLASH_PAGES must be 2 at least"
+#endif
+#ifndef CONFIG_LWAN_KV_KEYS
+#define CONFIG_LWAN_KV_KEYS 8
+#endif
+
+#define LWAN_KV_MAGIC 0x4C574B56
+#define LWAN_KV_ERASED 0xFFFF
+
+// A page holds a header then records appended to its erased part, each one
+// padded to the 8 bytes the flash programs at once. The header is programmed
+// once the page is complete, a page without it is ignored
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+} LWanKvHeader_t;
+
+typedef struct {
+    uint16_t key;
+    uint16_t len;
+    uint16_t crc;    // of the value
+    uint16_t check;  // of the key and length, a torn record header ends the page
+} LWanKvRecord_t;
+
+#define KV_ALIGN(len) (((len) + 7) & ~7)
+#define KV_RECORD_SIZE(len) (sizeof(LWanKvRecord_t) + KV_ALIGN(len))
+#define KV_CHECK(key, len) ((uint16_t)~((key) + (len)))
+
+static bool g_kv_scanned = false;
+static bool g_kv_found = false;
+static uint8_t g_kv_page;
+static uint32_t g_kv_seq;
+static uint16_t g_kv_end;  // offset of the next record in the page
+static uint16_t g_kv_index[CONFIG_LWAN_KV_KEYS];  // offset of the last record of a key, 0 for none
+
+static uint32_t kv_page_addr(uint8_t page)
+{
+    return CONFIG_LWAN_KV_FLASH_ADDR + page * FLASH_PAGE_SIZE;
+}
+
+static LWanKvRecord_t *kv_record(uint8_t page, uint16_t offset)
+{
+    return (LWanKvRecord_t *)(kv_page_addr(page) + offset);
+}
 
-static uint16_t crc16(uint8_t *buffer, uint8_t length )
+// Indexes the valid records of a page, returns the offset after the last one
+static uint16_t kv_page_index(uint8_t page, uint16_t *index)
 {
-    const uint16_t polynom = 0x1021;
-    uint16_t crc = 0x0000;
+    uint16_t offset = sizeof(LWanKvHeader_t);
 
-    for (uint8_t i = 0; i < length; ++i) {
-        crc ^= ( uint16_t ) buffer[i] << 8;
-        for (uint8_t j = 0; j < 8; ++j) {
-            crc = (crc & 0x8000) ? (crc << 1) ^ polynom : (crc << 1);
+    memset(index, 0, CONFIG_LWAN_KV_KEYS * sizeof(uint16_t));
+    while (offset + sizeof(LWanKvRecord_t) <= FLASH_PAGE_SIZE) {
+        LWanKvRecord_t *record = kv_record(page, offset);
+
+        if (record->key == LWAN_KV_ERASED && record->len == LWAN_KV_ERASED &&
+            record->crc == LWAN_KV_ERASED && record->check == LWAN_KV_ERASED) {
+            break;
+        }
+        if (record->check != KV_CHECK(record->key, record->len) ||
+            offset + KV_RECORD_SIZE(record->len) > FLASH_PAGE_SIZE) {
+            // Nothing is appended after a torn header, the next write compacts
+            return FLASH_PAGE_SIZE;
+        }
+        // A torn value fails its CRC, the previous record of the key stays
+        if (record->key < CONFIG_LWAN_KV_KEYS &&
+            crc16((uint8_t *)(record + 1), record->len) == record->crc) {
+            index[record->key] = offset;
+        }
+        offset += KV_RECORD_SIZE(record->len);
+    }
+    return offset;
+}
+
+// Indexes the page of highest sequence number
+static void kv_store_scan(void)
+{
+    g_kv_scanned = true;
+    g_kv_found = false;
+    memset(g_kv_index, 0, sizeof(g_kv_index));
+    for (uint8_t page = 0; page < CONFIG_LWAN_KV_FLASH_PAGES; page++) {
+        LWanKvHeader_t *header = (LWanKvHeader_t *)kv_page_addr(page);
+
+        if (header->magic != LWAN_KV_MAGIC ||
+            (g_kv_found && (int32_t)(header->seq - g_kv_seq) <= 0)) {
+            continue;
+        }
+        g_kv_found = true;
+        g_kv_page = page;
+        g_kv_seq = header->seq;
+    }
+    if (g_kv_found) {
+        g_kv_end = kv_page_index(g_kv_page, g_kv_index);
+    }
+}
+
+static int kv_program(uint8_t page, uint16_t offset, uint16_t key, const uint8_t *value, uint16_t len)
+{
+    LWanKvRecord_t record = {key, len, crc16((uint8_t *)value, len), KV_CHECK(key, len)};
+    uint32_t addr = kv_page_addr(page) + offset;
+
+    if (flash_program_bytes(addr, (uint8_t *)&record, sizeof(record)) != 0) {
+        return LWAN_ERROR;
+    }
+    if (len > 0 && flash_program_bytes(addr + sizeof(record), (uint8_t *)value, len) != 0) {
+        return LWAN_ERROR;
+    }
+    return LWAN_SUCCESS;
+}
+
+// Copies the last record of the other keys and the new one to the next page
+// of the ring. The current page stays the valid one until the header of the
+// next one is programmed
+static int kv_compact(uint16_t key, const uint8_t *value, uint16_t len)
+{
+    uint8_t page = g_kv_found ? (g_kv_page + 1) % CONFIG_LWAN_KV_FLASH_PAGES : 0;
+    uint32_t header[2] = {LWAN_KV_MAGIC, g_kv_found ? g_kv_seq + 1 : 0};
+    uint16_t offset = sizeof(LWanKvHeader_t);
+    uint16_t index[CONFIG_LWAN_KV_KEYS];
+
+    memset(index, 0, sizeof(index));
+    flash_erase_page(kv_page_addr(page));
+    for (uint16_t k = 0; k < CONFIG_LWAN_KV_KEYS; k++) {
+        LWanKvRecord_t *record;
+
+        if (k == key || !g_kv_found || g_kv_index[k] == 0) {
+            continue;
         }
+        record = kv_record(g_kv_page, g_kv_index[k]);
+        if (kv_program(page, offset, k, (uint8_t *)(record + 1), record->len) != LWAN_SUCCESS) {
+            return LWAN_ERROR;
+        }
+        index[k] = offset;
+        offset += KV_RECORD_SIZE(record->len);
+    }
+    if (offset + KV_RECORD_SIZE(len) > FLASH_PAGE_SIZE ||
+        kv_program(page, offset, key, value, len) != LWAN_SUCCESS) {
+        return LWAN_ERROR;
+    }
+    index[key] = offset;
+    offset += KV_RECORD_SIZE(len);
+    if (flash_program_bytes(kv_page_addr(page), (uint8_t *)header, sizeof(header)) != 0) {
+        return LWAN_ERROR;
     }
 
-    return crc;
+    g_kv_found = true;
+    g_kv_page = page;
+    g_kv_seq = header[1];
+    g_kv_end = offset;
+    memcpy(g_kv_index, index, sizeof(index));
+    return LWAN_SUCCESS;
 }
 
+const void *lwan_kv_map(uint16_t key, uint16_t len)
+{
+    LWanKvRecord_t *record;
+
+    if (!g_kv_scanned) {
+        kv_store_scan();
+    }
+    if (key >= CONFIG_LWAN_KV_KEYS || g_kv_index[key] == 0) {
+        return NULL;
+    }
+    record = kv_record(g_kv_page, g_kv_index[key]);
+    if (record->len < len) {
+        return NULL;
+    }
+    return record + 1;
+}
+
+int lwan_kv_get(uint16_t key, void *value, uint16_t len)
+{
+    LWanKvRecord_t *record;
+
+    if (!g_kv_scanned) {
+        kv_store_scan();
+    }
+    if (key >= CONFIG_LWAN_KV_KEYS || g_kv_index[key] == 0) {
+        return LWAN_ERROR;
+    }
+    record = kv_record(g_kv_page, g_kv_index[key]);
+    if (len > record->len) {
+        len = record->len;
+    }
+    memcpy(value, record + 1, len);
+    return len;
+}
+
+int lwan_kv_set(uint16_t key, const void *value, uint16_t len)
+{
+    int status;
+
+    if (!g_kv_scanned) {
+        kv_store_scan();
+    }
+    if (key >= CONFIG_LWAN_KV_KEYS) {
+        return LWAN_ERROR;
+    }
+    if (g_kv_index[key] != 0) {
+        LWanKvRecord_t *record = kv_record(g_kv_page, g_kv_index[key]);
+
+        if (record->len == len && memcmp(record + 1, value, len) == 0) {
+            return LWAN_SUCCESS;
+        }
+    }
+
+    if (g_kv_found && g_kv_end + KV_RECORD_SIZE(len) <= FLASH_PAGE_SIZE) {
+        uint16_t offset = g_kv_end;
+
+        // The space is used even if the programming fails
+        g_kv_end += KV_RECORD_SIZE(len);
+        status = kv_program(g_kv_page, offset, key, value, len);
+        if (status == LWAN_SUCCESS) {
+            g_kv_index[key] = offset;
+        }
+    } else {
+        status = kv_compact(key, value, len);
+    }
+    if (status != LWAN_SUCCESS) {
+        LOG_PRINTF(LL_ERR, "Error writing settings\r\n");
+        return LWAN_ERROR;
+    }
+    return LWAN_SUCCESS;
+}
+#endif
+
+#ifdef CONFIG_LWAN_CONFIG_DEFER
+// Idle time after the last change before the pending settings are written
+#ifndef CONFIG_LWAN_CONFIG_COMMIT_DELAY
+#define CONFIG_LWAN_CONFIG_COMMIT_DELAY 5000
+#endif
+
+static uint8_t g_config_dirty = 0;  // LWAN_SETTINGS_* bits changed in RAM only
+static volatile bool g_config_commit_due = false;
+static TimerEvent_t g_config_commit_timer;
+static bool g_config_timer_init = false;
+
+static void on_config_commit_timer(void)
+{
+    // Interrupt context, the flash is written from lwan_config_process
+    g_config_commit_due = true;
+}
+
+static void config_mark_dirty(int type)
+{
+    if (!g_config_timer_init) {
+        TimerInit(&g_config_commit_timer, on_config_commit_timer);
+        TimerSetValue(&g_config_commit_timer, CONFIG_LWAN_CONFIG_COMMIT_DELAY);
+        g_config_timer_init = true;
+    }
+    g_config_dirty |= 1 << type;
+    TimerStop(&g_config_commit_timer);
+    TimerStart(&g_config_commit_timer);
+}
+#endif
+
 #ifdef CONFIG_LINKWAN 
 static uint8_t get_next_freqband(void)
 {
@@ -50,9 +475,10 @@ static uint8_t get_next_freqband(void)
 }
 #endif
 
-int read_settings(int type, void *setting, int len)
+static uint32_t settings_offset(int type)
 {
     uint32_t offset = 0;
+
     switch(type){
         case LWAN_SETTINGS_MAC:{
             offset += sizeof(LWanDevConfig_t);
@@ -67,36 +493,38 @@ int read_settings(int type, void *setting, int len)
             break;
         }
     }
-    
-    memcpy(setting, (void *)(LWAN_SETTINGS_FLASH_ADDR+offset), len);
-    
-    return LWAN_SUCCESS;
+    return offset;
+}
+
+const void *lwan_settings_map(int type, int len)
+{
+    const uint8_t *setting = NULL;
+
+#ifdef CONFIG_LWAN_KV_STORE
+    setting = lwan_kv_map(type, len);
+    // Not saved since the store is used, read from the page written before
+#endif
+    if (setting == NULL) {
+        setting = (const uint8_t *)(LWAN_SETTINGS_FLASH_ADDR + settings_offset(type));
+    }
+    // Each block ends with the CRC of the bytes before
+    if (crc16((uint8_t *)setting, len - 2) != (setting[len - 2] | setting[len - 1] << 8)) {
+        return NULL;
+    }
+    return setting;
 }
 
 int write_settings(int type, void *setting, int len)
 {
-    uint32_t offset = 0;
+#ifdef CONFIG_LWAN_KV_STORE
+    return lwan_kv_set(type, setting, len);
+#else
     uint32_t total_len = sizeof(LWanDevConfig_t) + sizeof(LWanMacConfig_t) + sizeof(LWanSysConfig_t);
     uint8_t buf[total_len];
     int status = 0;
 
-    switch(type){
-        case LWAN_SETTINGS_MAC:{
-            offset += sizeof(LWanDevConfig_t);
-            break;
-        }
-        case LWAN_SETTINGS_SYS:{
-            offset += sizeof(LWanDevConfig_t) + sizeof(LWanMacConfig_t);
-            break;
-        }
-        case LWAN_SETTINGS_DEV:
-        default:{
-            break;
-        }
-    }
-    
     memcpy(buf, (void *)LWAN_SETTINGS_FLASH_ADDR, total_len);
-    memcpy(buf+offset, setting, len);
+    memcpy(buf + settings_offset(type), setting, len);
     
     flash_erase_page(LWAN_SETTINGS_FLASH_ADDR);
     status = flash_program_bytes(LWAN_SETTINGS_FLASH_ADDR, buf, total_len);
@@ -106,8 +534,73 @@ int write_settings(int type, void *setting, int len)
     }
     
     return LWAN_SUCCESS;
+#endif
 }
 
+#ifdef CONFIG_LWAN_CONFIG_DEFER
+int lwan_config_commit(void)
+{
+    int status = 0;
+
+    if (g_config_timer_init) {
+        TimerStop(&g_config_commit_timer);
+    }
+    g_config_commit_due = false;
+    if (g_config_dirty == 0) {
+        return LWAN_SUCCESS;
+    }
+
+    g_lwan_dev_config.crc = crc16((uint8_t *)&g_lwan_dev_config, sizeof(LWanDevConfig_t) - 2);
+    g_lwan_mac_config.crc = crc16((uint8_t *)&g_lwan_mac_config, sizeof(LWanMacConfig_t) - 2);
+    g_lwan_sys_config.crc = crc16((uint8_t *)&g_lwan_sys_config, sizeof(LWanSysConfig_t) - 2);
+#ifdef CONFIG_LWAN_KV_STORE
+    // One record per block, each one replaces the previous block at once
+    if ((g_config_dirty & (1 << LWAN_SETTINGS_DEV)) &&
+        lwan_kv_set(LWAN_SETTINGS_DEV, &g_lwan_dev_config, sizeof(LWanDevConfig_t)) != LWAN_SUCCESS) {
+        return LWAN_ERROR;
+    }
+    if ((g_config_dirty & (1 << LWAN_SETTINGS_MAC)) &&
+        lwan_kv_set(LWAN_SETTINGS_MAC, &g_lwan_mac_config, sizeof(LWanMacConfig_t)) != LWAN_SUCCESS) {
+        return LWAN_ERROR;
+    }
+    if ((g_config_dirty & (1 << LWAN_SETTINGS_SYS)) &&
+        lwan_kv_set(LWAN_SETTINGS_SYS, &g_lwan_sys_config, sizeof(LWanSysConfig_t)) != LWAN_SUCCESS) {
+        return LWAN_ERROR;
+    }
+#else
+    // The changed blocks are programmed together, with a single erase
+    uint32_t total_len = sizeof(LWanDevConfig_t) + sizeof(LWanMacConfig_t) + sizeof(LWanSysConfig_t);
+    uint8_t buf[total_len];
+
+    memcpy(buf, (void *)LWAN_SETTINGS_FLASH_ADDR, total_len);
+    if (g_config_dirty & (1 << LWAN_SETTINGS_DEV)) {
+        memcpy(buf + settings_offset(LWAN_SETTINGS_DEV), &g_lwan_dev_config, sizeof(LWanDevConfig_t));
+    }
+    if (g_config_dirty & (1 << LWAN_SETTINGS_MAC)) {
+        memcpy(buf + settings_offset(LWAN_SETTINGS_MAC), &g_lwan_mac_config, sizeof(LWanMacConfig_t));
+    }
+    if (g_config_dirty & (1 << LWAN_SETTINGS_SYS)) {
+        memcpy(buf + settings_offset(LWAN_SETTINGS_SYS), &g_lwan_sys_config, sizeof(LWanSysConfig_t));
+    }
+    flash_erase_page(LWAN_SETTINGS_FLASH_ADDR);
+    status = flash_program_bytes(LWAN_SETTINGS_FLASH_ADDR, buf, total_len);
+#endif
+    if (status != 0) {
+        LOG_PRINTF(LL_ERR, "Error writing settings\r\n");
+        return LWAN_ERROR;
+    }
+    g_config_dirty = 0;
+    return LWAN_SUCCESS;
+}
+
+void lwan_config_process(void)
+{
+    if (g_config_commit_due) {
+        lwan_config_commit();
+    }
+}
+#endif
+
 int write_lwan_dev_config(LWanDevConfig_t *dev_config)
 {
     int ret = LWAN_SUCCESS;
@@ -118,20 +611,13 @@ int write_lwan_dev_config(LWanDevConfig_t *dev_config)
 
 int read_lwan_dev_config(LWanDevConfig_t *dev_config)
 {
-    int len;
-    int ret = LWAN_SUCCESS;
-    uint16_t crc;
+    const void *saved = lwan_settings_map(LWAN_SETTINGS_DEV, sizeof(LWanDevConfig_t));
 
-    memset(dev_config, 0, sizeof(LWanDevConfig_t));
-    len = sizeof(LWanDevConfig_t);
-    ret = read_settings(LWAN_SETTINGS_DEV, dev_config, len);
-    if (ret == LWAN_SUCCESS) {
-        crc = crc16((uint8_t *)dev_config, len - 2);
-        if (crc != dev_config->crc)
-            ret = LWAN_ERROR;
+    if (saved == NULL) {
+        return LWAN_ERROR;
     }
-    
-    return ret;
+    memcpy(dev_config, saved, sizeof(LWanDevConfig_t));
+    return LWAN_SUCCESS;
 }
 
 int write_lwan_mac_config(LWanMacConfig_t *mac_config)
@@ -144,21 +630,14 @@ int write_lwan_mac_config(LWanMacConfig_t *mac_config)
 }
 
 int read_lwan_mac_config(LWanMacConfig_t *mac_config)
- {
-    int len;
-    int ret = LWAN_SUCCESS;
-    uint16_t crc;
+{
+    const void *saved = lwan_settings_map(LWAN_SETTINGS_MAC, sizeof(LWanMacConfig_t));
 
-    memset(mac_config, 0, sizeof(LWanMacConfig_t));
-    len = sizeof(LWanMacConfig_t);
-    ret = read_settings(LWAN_SETTINGS_MAC, mac_config, len);
-    if (ret == LWAN_SUCCESS) {
-        crc = crc16((uint8_t *)mac_config, len - 2);
-        if (crc != mac_config->crc)
-            ret = LWAN_ERROR;
+    if (saved == NULL) {
+        return LWAN_ERROR;
     }
-    
-    return ret;
+    memcpy(mac_config, saved, sizeof(LWanMacConfig_t));
+    return LWAN_SUCCESS;
 }
 
 int read_lwan_dev_keys(LWanDevKeys_t *keys)
@@ -167,7 +646,11 @@ int read_lwan_dev_keys(LWanDevKeys_t *keys)
     
     memcpy(keys, (LWanDevKeys_t *)LWAN_KEYS_FLASH_ADDR, sizeof(LWanDevKeys_t));
     
+#ifdef CONFIG_KEY_SLOTS
+    if(keys->magic != LORA_KEYS_MAGIC_NUM && keys->magic != LORA_KEYS_WRAPPED_MAGIC_NUM) {
+#else
     if(keys->magic != LORA_KEYS_MAGIC_NUM) {
+#endif
         return LWAN_ERROR;
     }
     
@@ -183,7 +666,11 @@ int write_lwan_dev_keys(LWanDevKeys_t *keys)
 {
     int status;
     
+#ifdef CONFIG_KEY_SLOTS
+    keys->magic = LORA_KEYS_WRAPPED_MAGIC_NUM;
+#else
     keys->magic = LORA_KEYS_MAGIC_NUM;
+#endif
     keys->checksum = crc16((uint8_t *)keys, sizeof(LWanDevKeys_t) - 2);
     
     flash_erase_page(LWAN_KEYS_FLASH_ADDR);
@@ -231,41 +718,59 @@ int decrypt_lwan_dev_keys(LWanDevKeys_t *loraKeys)
     return encrypt_lwan_dev_keys(loraKeys, loraKeys->pkey);
 }
 
+#ifdef CONFIG_KEY_SLOTS
+static void wrap_lwan_dev_keys(LWanDevKeys_t *loraKeys)
+{
+    KeySlotWrap(loraKeys->ota.appkey, loraKeys->ota.appkey);
+    KeySlotWrap(loraKeys->abp.nwkskey, loraKeys->abp.nwkskey);
+    KeySlotWrap(loraKeys->abp.appskey, loraKeys->abp.appskey);
+}
+
+static void unwrap_lwan_dev_keys(LWanDevKeys_t *loraKeys)
+{
+    KeySlotUnwrap(KEY_SLOT_APP_KEY, loraKeys->ota.appkey);
+    KeySlotUnwrap(KEY_SLOT_ABP_NWK_S_KEY, loraKeys->abp.nwkskey);
+    KeySlotUnwrap(KEY_SLOT_ABP_APP_S_KEY, loraKeys->abp.appskey);
+}
+#endif
+
 void lwan_mac_params_update()
 {
-    MibRequestConfirm_t mibReq;
+    MibRequestConfirm_t mibReq[7];
+    uint8_t n = 0;
     
-    mibReq.Type = MIB_ADR;
-    mibReq.Param.AdrEnable = g_lwan_mac_config.modes.adr_enabled;
-    LoRaMacMibSetRequestConfirm(&mibReq);
+    mibReq[n].Type = MIB_ADR;
+    mibReq[n++].Param.AdrEnable = g_lwan_mac_config.modes.adr_enabled;
     
-    mibReq.Type = MIB_CHANNELS_NB_REP;
-    mibReq.Param.ChannelNbRep = g_lwan_mac_config.nbtrials.unconf + 1;
-    LoRaMacMibSetRequestConfirm(&mibReq);
+    mibReq[n].Type = MIB_CHANNELS_NB_REP;
+    mibReq[n++].Param.ChannelNbRep = g_lwan_mac_config.nbtrials.unconf + 1;
     
-    mibReq.Type = MIB_CHANNELS_TX_POWER;
-    mibReq.Param.ChannelsTxPower = g_lwan_mac_config.tx_power;
-    LoRaMacMibSetRequestConfirm(&mibReq);
+    mibReq[n].Type = MIB_CHANNELS_TX_POWER;
+    mibReq[n++].Param.ChannelsTxPower = g_lwan_mac_config.tx_power;
     
-    mibReq.Type = MIB_CHANNELS_DATARATE;
-    mibReq.Param.ChannelsDatarate= g_lwan_mac_config.datarate;
-    LoRaMacMibSetRequestConfirm(&mibReq);
+    mibReq[n].Type = MIB_CHANNELS_DATARATE;
+    mibReq[n++].Param.ChannelsDatarate= g_lwan_mac_config.datarate;
     
     if(g_lwan_mac_config.rx1_delay) {
-        mibReq.Type = MIB_RECEIVE_DELAY_1;
-        mibReq.Param.ReceiveDelay1 = g_lwan_mac_config.rx1_delay * 1000;
-        LoRaMacMibSetRequestConfirm(&mibReq);
+        mibReq[n].Type = MIB_RECEIVE_DELAY_1;
+        mibReq[n++].Param.ReceiveDelay1 = g_lwan_mac_config.rx1_delay * 1000;
     }
     
     if(g_lwan_mac_config.rx_params.rx2_freq) {                    
-        mibReq.Type = MIB_RX2_CHANNEL;
-        mibReq.Param.Rx2Channel.Frequency = g_lwan_mac_config.rx_params.rx2_freq;
-        mibReq.Param.Rx2Channel.Datarate = g_lwan_mac_config.rx_params.rx2_dr;
-        LoRaMacMibSetRequestConfirm(&mibReq);
+        mibReq[n].Type = MIB_RX2_CHANNEL;
+        mibReq[n].Param.Rx2Channel.Frequency = g_lwan_mac_config.rx_params.rx2_freq;
+        mibReq[n++].Param.Rx2Channel.Datarate = g_lwan_mac_config.rx_params.rx2_dr;
         
-        mibReq.Type = MIB_RX1_DATARATE_OFFSET;
-        mibReq.Param.Rx1DrOffset = g_lwan_mac_config.rx_params.rx1_dr_offset;
-        LoRaMacMibSetRequestConfirm(&mibReq);
+        mibReq[n].Type = MIB_RX1_DATARATE_OFFSET;
+        mibReq[n++].Param.Rx1DrOffset = g_lwan_mac_config.rx_params.rx1_dr_offset;
+    }
+
+    // One call, when a stored value is rejected the others still apply one
+    // by one as before
+    if (LoRaMacMibSetParams(mibReq, n) != LORAMAC_STATUS_OK) {
+        for (uint8_t i = 0; i < n; i++) {
+            LoRaMacMibSetRequestConfirm(&mibReq[i]);
+        }
     }
 }
 
@@ -279,7 +784,7 @@ void lwan_dev_params_update()
             channelsMaskTemp[i / 2] |= (0xFF << ((i % 2) * 8));
         }
     }
-	if (g_lwan_prodct_config.protl == 1)
+	if (g_lwan_prodct_config_p->protl == 1)
 	{
         channelsMaskTemp[0] |= 0XFF00;
     }
@@ -310,6 +815,23 @@ LWanDevKeys_t *lwan_dev_keys_init(LWanDevKeys_t *default_keys)
     }
     if(lwan_is_key_valid(g_lwan_dev_keys.pkey, LORA_KEY_LENGTH))
         decrypt_lwan_dev_keys(&g_lwan_dev_keys);
+#ifdef CONFIG_KEY_SLOTS
+    // Only the wrapped keys are kept, the keys in clear are in the slots
+    KeySlotInit();
+    if(g_lwan_dev_keys.magic != LORA_KEYS_WRAPPED_MAGIC_NUM) {
+        LWanDevKeys_t keys_saved;
+
+        // Default keys, or stored in clear before the key slots
+        wrap_lwan_dev_keys(&g_lwan_dev_keys);
+        memcpy(&keys_saved, &g_lwan_dev_keys, sizeof(keys_saved));
+        if(lwan_is_key_valid(keys_saved.pkey, LORA_KEY_LENGTH)) {
+            encrypt_lwan_dev_keys(&keys_saved, keys_saved.pkey);
+        }
+        write_lwan_dev_keys(&keys_saved);
+        g_lwan_dev_keys.magic = LORA_KEYS_WRAPPED_MAGIC_NUM;
+    }
+    unwrap_lwan_dev_keys(&g_lwan_dev_keys);
+#endif
 
     return &g_lwan_dev_keys;
 }
@@ -330,10 +852,25 @@ int lwan_dev_keys_set(int type, void *data)
     switch(type) {
         case DEV_KEYS_OTA_DEVEUI: memcpy(g_lwan_dev_keys.ota.deveui, data, LORA_EUI_LENGTH); break;
         case DEV_KEYS_OTA_APPEUI: memcpy(g_lwan_dev_keys.ota.appeui, data, LORA_EUI_LENGTH); break;
-        case DEV_KEYS_OTA_APPKEY: memcpy(g_lwan_dev_keys.ota.appkey, data, LORA_KEY_LENGTH); break;
         case DEV_KEYS_ABP_DEVADDR:  g_lwan_dev_keys.abp.devaddr = *(uint32_t *)data; break;
+#ifdef CONFIG_KEY_SLOTS
+        case DEV_KEYS_OTA_APPKEY:
+            KeySlotLoad(KEY_SLOT_APP_KEY, data);
+            KeySlotWrap(data, g_lwan_dev_keys.ota.appkey);
+            break;
+        case DEV_KEYS_ABP_NWKSKEY:
+            KeySlotLoad(KEY_SLOT_ABP_NWK_S_KEY, data);
+            KeySlotWrap(data, g_lwan_dev_keys.abp.nwkskey);
+            break;
+        case DEV_KEYS_ABP_APPSKEY:
+            KeySlotLoad(KEY_SLOT_ABP_APP_S_KEY, data);
+            KeySlotWrap(data, g_lwan_dev_keys.abp.appskey);
+            break;
+#else
+        case DEV_KEYS_OTA_APPKEY: memcpy(g_lwan_dev_keys.ota.appkey, data, LORA_KEY_LENGTH); break;
         case DEV_KEYS_ABP_NWKSKEY: memcpy(g_lwan_dev_keys.abp.nwkskey, data, LORA_KEY_LENGTH); break;
         case DEV_KEYS_ABP_APPSKEY: memcpy(g_lwan_dev_keys.abp.appskey, data, LORA_KEY_LENGTH); break;
+#endif
         case DEV_KEYS_PKEY: memcpy(g_lwan_dev_keys.pkey, data, LORA_KEY_LENGTH); break;
         default: return LWAN_ERROR; 
     }
@@ -379,11 +916,12 @@ LWanDevConfig_t *lwan_dev_config_init(LWanDevConfig_t *default_config)
     return &g_lwan_dev_config;
 }
 
-LWanProdctConfig_t *lwan_prodct_config_init(LWanProdctConfig_t *default_config)
+const LWanProdctConfig_t *lwan_prodct_config_init(const LWanProdctConfig_t *default_config)
 {
-    memcpy(&g_lwan_prodct_config, default_config, sizeof(LWanProdctConfig_t));
+    // Never changed, used in place
+    g_lwan_prodct_config_p = default_config;
 
-    return &g_lwan_prodct_config;
+    return g_lwan_prodct_config_p;
 }
 
 int lwan_dev_config_get(int type, void *config)
@@ -419,6 +957,12 @@ int lwan_dev_config_get(int type, void *config)
             memcpy(config, &g_lwan_dev_config.join_settings, sizeof(g_lwan_dev_config.join_settings));
             break;
         }
+#ifdef CONFIG_REGION_MULTI
+        case DEV_CONFIG_REGION: {
+            *(uint8_t*)config = g_lwan_dev_config.region;
+            break;
+        }
+#endif
         default: {
             ret = LWAN_ERROR;
             break;
@@ -448,13 +992,21 @@ int lwan_dev_config_set(int type, void *config)
                 LoRaMacMibSetRequestConfirm(&mibReq);
 
                 mibReq.Type = MIB_NWK_SKEY;
+#ifdef CONFIG_KEY_SLOTS
+                mibReq.Param.NwkSKey = KeySlotKey(KEY_SLOT_ABP_NWK_S_KEY);
+#else
                 mibReq.Param.NwkSKey = g_lwan_dev_keys.abp.nwkskey;
+#endif
                 LoRaMacMibSetRequestConfirm(&mibReq);
 
                 mibReq.Type = MIB_APP_SKEY;
+#ifdef CONFIG_KEY_SLOTS
+                mibReq.Param.AppSKey = KeySlotKey(KEY_SLOT_ABP_APP_S_KEY);
+#else
                 mibReq.Param.AppSKey = g_lwan_dev_keys.abp.appskey;
+#endif
                 LoRaMacMibSetRequestConfirm(&mibReq);
-                if (g_lwan_prodct_config.protl == 1)
+                if (g_lwan_prodct_config_p->protl == 1)
                 {
 #ifdef CONFIG_LINKWAN                    
                     mibReq.Type = MIB_FREQ_BAND;
@@ -481,7 +1033,7 @@ int lwan_dev_config_set(int type, void *config)
                     channels_mask[i / 2] |= (0xFF << ((i % 2) * 8));
                 }
             }
-            if (g_lwan_prodct_config.protl == 1)
+            if (g_lwan_prodct_config_p->protl == 1)
             {
                 channels_mask[0] |= 0XFF00;
             }
@@ -537,14 +1089,30 @@ int lwan_dev_config_set(int type, void *config)
             memcpy(&g_lwan_dev_config.join_settings, config, sizeof(g_lwan_dev_config.join_settings));
             break;
         }
+#ifdef CONFIG_REGION_MULTI
+        case DEV_CONFIG_REGION: {
+            // Only stored, the MAC tables of the region are set up at the next boot
+            uint8_t region = *(uint8_t* )config;
+            if(!RegionIsActive((LoRaMacRegion_t)region))
+                return LWAN_ERROR;
+            
+            g_lwan_dev_config.region = region;
+            break;
+        }
+#endif
         default: {
             ret = LWAN_ERROR;
             break;
         }
     }
     
-    if(ret == LWAN_SUCCESS)
+    if(ret == LWAN_SUCCESS) {
+#ifdef CONFIG_LWAN_CONFIG_DEFER
+        config_mark_dirty(LWAN_SETTINGS_DEV);
+#else
         ret = write_lwan_dev_config(&g_lwan_dev_config);
+#endif
+    }
     
     return ret;
 }
@@ -625,6 +1193,22 @@ int lwan_mac_config_get(int type, void *config)
             *(uint16_t*)config = mibReq.Param.ReceiveDelay1/1000;
             break;
         }
+#ifdef CONFIG_LORAMAC_LINK_ADR
+        case MAC_CONFIG_LINK_ADR: {
+            mibReq.Type = MIB_LINK_ADR;
+            LoRaMacMibGetRequestConfirm(&mibReq);
+            memcpy(config, &mibReq.Param.LinkAdr, sizeof(LinkAdrInfo_t));
+            break;
+        }
+#endif
+#ifdef CONFIG_LORA_RADIO_STATS
+        case MAC_CONFIG_RADIO_STATS: {
+            mibReq.Type = MIB_RADIO_STATS;
+            mibReq.Param.RadioStats = (RadioStats_t *)config;
+            LoRaMacMibGetRequestConfirm(&mibReq);
+            break;
+        }
+#endif
         default: {
             ret = LWAN_ERROR;
             break;
@@ -747,6 +1331,23 @@ int lwan_mac_config_set(int type, void *config)
             LoRaMacMibSetRequestConfirm(&mibReq);
             break;
         }
+#ifdef CONFIG_LORAMAC_LINK_ADR
+        case MAC_CONFIG_LINK_ADR: {
+            // Not saved, a reset disables the device side ADR
+            mibReq.Type = MIB_LINK_ADR;
+            mibReq.Param.LinkAdr.Enable = *(uint8_t* )config ? true : false;
+            LoRaMacMibSetRequestConfirm(&mibReq);
+            break;
+        }
+#endif
+#ifdef CONFIG_LORA_RADIO_STATS
+        case MAC_CONFIG_RADIO_STATS: {
+            // Clears the counters, config is unused
+            mibReq.Type = MIB_RADIO_STATS;
+            LoRaMacMibSetRequestConfirm(&mibReq);
+            break;
+        }
+#endif
         default: {
             ret = LWAN_ERROR;
             break;
@@ -758,7 +1359,13 @@ int lwan_mac_config_set(int type, void *config)
 
 int lwan_mac_config_save()
 {
+#ifdef CONFIG_LWAN_CONFIG_DEFER
+    // The pending settings go with it
+    config_mark_dirty(LWAN_SETTINGS_MAC);
+    return lwan_config_commit();
+#else
     return write_lwan_mac_config(&g_lwan_mac_config);
+#endif
 }
 
 int lwan_mac_config_reset(LWanMacConfig_t *default_config)
@@ -773,19 +1380,27 @@ int lwan_mac_config_reset(LWanMacConfig_t *default_config)
     return ret;
 }
 
-LWanSysConfig_t *lwan_sys_config_init(LWanSysConfig_t *default_config)
+static const LWanSysConfig_t *sys_config(void)
 {
-    uint16_t crc = 0;
-    uint16_t len;
-    
-    len = sizeof(LWanSysConfig_t);
-    read_settings(LWAN_SETTINGS_SYS, &g_lwan_sys_config, len);
-    crc = crc16((uint8_t *)&g_lwan_sys_config, len-2);
-    if (crc != g_lwan_sys_config.crc){
-        memcpy(&g_lwan_sys_config, default_config, sizeof(LWanSysConfig_t));
-    }
-    
+#ifdef CONFIG_LWAN_CONFIG_DEFER
     return &g_lwan_sys_config;
+#else
+    const LWanSysConfig_t *saved = lwan_settings_map(LWAN_SETTINGS_SYS, sizeof(LWanSysConfig_t));
+
+    return saved != NULL ? saved : g_lwan_sys_config_default;
+#endif
+}
+
+const LWanSysConfig_t *lwan_sys_config_init(const LWanSysConfig_t *default_config)
+{
+#ifdef CONFIG_LWAN_CONFIG_DEFER
+    const void *saved = lwan_settings_map(LWAN_SETTINGS_SYS, sizeof(LWanSysConfig_t));
+
+    memcpy(&g_lwan_sys_config, saved != NULL ? saved : default_config, sizeof(LWanSysConfig_t));
+#else
+    g_lwan_sys_config_default = default_config;
+#endif
+    return sys_config();
 }
 
 int lwan_sys_config_get(int type, void *config)
@@ -794,11 +1409,11 @@ int lwan_sys_config_get(int type, void *config)
     
     switch(type) {
         case SYS_CONFIG_BAUDRATE: {
-            *(uint32_t*)config = g_lwan_sys_config.baudrate;
+            *(uint32_t*)config = sys_config()->baudrate;
             break;
         }
         case SYS_CONFIG_LOGLVL: {
-            *(uint16_t*)config = g_lwan_sys_config.loglevel;
+            *(uint16_t*)config = sys_config()->loglevel;
             break;
         }
         default: {
@@ -811,15 +1426,17 @@ int lwan_sys_config_get(int type, void *config)
 }
 int lwan_sys_config_set(int type, void *config)
 {
+    LWanSysConfig_t sys_config_new;
     int ret = LWAN_SUCCESS;
 
+    memcpy(&sys_config_new, sys_config(), sizeof(LWanSysConfig_t));
     switch(type) {
         case SYS_CONFIG_BAUDRATE: {
-            g_lwan_sys_config.baudrate = *(uint32_t* )config;
+            sys_config_new.baudrate = *(uint32_t* )config;
             break;
         }
         case SYS_CONFIG_LOGLVL: {
-            g_lwan_sys_config.loglevel = *(uint16_t* )config;
+            sys_config_new.loglevel = *(uint16_t* )config;
             break;
         }
         default: {
@@ -829,8 +1446,13 @@ int lwan_sys_config_set(int type, void *config)
     }
     
     if(ret == LWAN_SUCCESS){
-        g_lwan_sys_config.crc = crc16((uint8_t *)&g_lwan_sys_config, sizeof(LWanSysConfig_t) - 2);
-        ret = write_settings(LWAN_SETTINGS_SYS, &g_lwan_sys_config, sizeof(LWanSysConfig_t));
+        sys_config_new.crc = crc16((uint8_t *)&sys_config_new, sizeof(LWanSysConfig_t) - 2);
+#ifdef CONFIG_LWAN_CONFIG_DEFER
+        memcpy(&g_lwan_sys_config, &sys_config_new, sizeof(LWanSysConfig_t));
+        config_mark_dirty(LWAN_SETTINGS_SYS);
+#else
+        ret = write_settings(LWAN_SETTINGS_SYS, &sys_config_new, sizeof(LWanSysConfig_t));
+#endif
     }
     
     return ret;
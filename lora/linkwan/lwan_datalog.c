@@ -0,0 +1,503 @@
+/*
+ * Flash data logger, see inc/lwan_datalog.h
+ */
+#define LOG_MODULE LOG_MODULE_LWAN
+
+#include <string.h>
+#include "tremo_flash.h"
+#include "utilities.h"
+#include "timer.h"
+#include "crc.h"
+#include "linkwan.h"
+#include "lwan_config.h"
+#include "lwan_datalog.h"
+
+#ifdef CONFIG_LWAN_DATALOG
+
+#ifndef CONFIG_LWAN_DATALOG_FLASH_ADDR
+#error "CONFIG_LWAN_DATALOG needs CONFIG_LWAN_DATALOG_FLASH_ADDR"
+#endif
+#ifndef CONFIG_LWAN_DATALOG_FLASH_PAGES
+#define CONFIG_LWAN_DATALOG_FLASH_PAGES 4
+#endif
+#if CONFIG_LWAN_DATALOG_FLASH_PAGES < 2
+#error "CONFIG_LWAN_DATALOG_FLASH_PAGES must be 2 at least"
+#endif
+#ifndef CONFIG_LWAN_DATALOG_PORT
+#define CONFIG_LWAN_DATALOG_PORT 2
+#endif
+// Longest time a record stays in the line buffer [ms]
+#ifndef CONFIG_LWAN_DATALOG_SYNC_DELAY
+#define CONFIG_LWAN_DATALOG_SYNC_DELAY 60000
+#endif
+// Drain after the first record, and after a drain not acknowledged [ms]
+#ifndef CONFIG_LWAN_DATALOG_RETRY
+#define CONFIG_LWAN_DATALOG_RETRY 60000
+#endif
+#ifndef CONFIG_LWAN_DATALOG_RETRY_MAX
+#define CONFIG_LWAN_DATALOG_RETRY_MAX 3600000
+#endif
+// A drain not sent, the duty cycle or a frame in flight, is tried again after [ms]
+#define DATALOG_SEND_RETRY          5000
+
+#define DATALOG_MAGIC               0x4C574447
+#define DATALOG_ERASED              0xFF
+#define DATALOG_MARK                0xFE    // | 0xFE | 0x01 | seq (4) | offset (2) |
+#define DATALOG_MARK_VERSION        0x01
+#define DATALOG_MARK_SIZE           8
+#define DATALOG_REC_HDR             4       // len, ~len, CRC-16 of the data
+#define DATALOG_ALIGN(off)          (((off) + 7) & ~7)
+
+#define WALK_END                    0
+#define WALK_TORN                   1       // nothing may be programmed after it
+#define WALK_DATA                   2
+#define WALK_MARK                   3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+} datalog_header_t;
+
+typedef struct {
+    uint8_t page;
+    uint16_t offset;
+} datalog_pos_t;
+
+static void (*g_datalog_wakeup)(void) = NULL;
+static bool g_datalog_ready = false;
+static flash_writer_t g_datalog_writer;
+static uint8_t g_head_page;
+static uint32_t g_head_seq;
+static bool g_next_erased = false;      // the page after the head one
+static datalog_pos_t g_tail;            // oldest pending record
+static datalog_pos_t g_got;             // after the records of the drain got
+static bool g_inflight = false;         // the drain sent waits for its confirm
+static volatile bool g_due = false;
+static bool g_wait = false;             // g_retry_timer running
+static uint32_t g_backoff = CONFIG_LWAN_DATALOG_RETRY;
+static TimerEvent_t g_retry_timer;
+static TimerEvent_t g_sync_timer;
+static bool g_sync_armed = false;
+static volatile bool g_sync_due = false;
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t page_addr(uint8_t page)
+{
+    return CONFIG_LWAN_DATALOG_FLASH_ADDR + page * FLASH_PAGE_SIZE;
+}
+
+static const datalog_header_t *page_header(uint8_t page)
+{
+    return (const datalog_header_t *)page_addr(page);
+}
+
+static uint8_t page_next(uint8_t page)
+{
+    return (page + 1) % CONFIG_LWAN_DATALOG_FLASH_PAGES;
+}
+
+// End of the records programmed in the page
+static uint16_t page_end(uint8_t page)
+{
+    if (g_datalog_ready && page == g_head_page) {
+        return g_datalog_writer.addr - g_datalog_writer.len - page_addr(page);
+    }
+    return FLASH_PAGE_SIZE;
+}
+
+static uint16_t head_offset(void)
+{
+    return g_datalog_writer.addr - page_addr(g_head_page);
+}
+
+static void datalog_wakeup(void)
+{
+    if (g_datalog_wakeup) {
+        g_datalog_wakeup();
+    }
+}
+
+// The record at *offset, *offset moved after it
+static uint8_t datalog_walk(uint8_t page, uint16_t *offset, uint16_t end, const uint8_t **rec)
+{
+    const uint8_t *p;
+
+    while (*offset + 2 <= end) {
+        p = (const uint8_t *)(page_addr(page) + *offset);
+        if (p[0] == DATALOG_ERASED) {
+            // the padding of a flush up to 8 bytes
+            if ((*offset & 7) == 0) {
+                return WALK_END;
+            }
+            *offset = DATALOG_ALIGN(*offset);
+            continue;
+        }
+        if (p[0] == DATALOG_MARK && p[1] == DATALOG_MARK_VERSION && *offset + DATALOG_MARK_SIZE <= end) {
+            *rec = p;
+            *offset += DATALOG_MARK_SIZE;
+            return WALK_MARK;
+        }
+        if (p[0] <= LWAN_DATALOG_RECORD_MAX && p[1] == (uint8_t)~p[0] &&
+            *offset + DATALOG_REC_HDR + p[0] <= end &&
+            (p[2] | (p[3] << 8)) == CrcCompute(&CrcCcitt, p + DATALOG_REC_HDR, p[0])) {
+            *rec = p;
+            *offset += DATALOG_REC_HDR + p[0];
+            return WALK_DATA;
+        }
+        return WALK_TORN;
+    }
+    return WALK_END;
+}
+
+// Moves the tail over the markers and the padding to the oldest pending record
+static void datalog_tail_skip(void)
+{
+    const uint8_t *rec;
+    uint16_t offset;
+    uint8_t type;
+
+    for (;;) {
+        offset = g_tail.offset;
+        type = datalog_walk(g_tail.page, &offset, page_end(g_tail.page), &rec);
+        if (type == WALK_DATA) {
+            return;
+        }
+        if (type == WALK_MARK) {
+            g_tail.offset = offset;
+            continue;
+        }
+        if (g_tail.page == g_head_page) {
+            g_tail.offset = offset;
+            return;
+        }
+        g_tail.page = page_next(g_tail.page);
+        g_tail.offset = sizeof(datalog_header_t);
+    }
+}
+
+static void datalog_retry(uint32_t delay)
+{
+    TimerStop(&g_retry_timer);
+    TimerSetValue(&g_retry_timer, delay);
+    TimerStart(&g_retry_timer);
+    g_wait = true;
+}
+
+static void on_retry_timer_event(void)
+{
+    TimerStop(&g_retry_timer);
+    g_wait = false;
+    g_due = lwan_datalog_pending();
+    if (g_due) {
+        datalog_wakeup();
+    }
+}
+
+static void on_sync_timer_event(void)
+{
+    TimerStop(&g_sync_timer);
+    g_sync_due = true;
+    datalog_wakeup();
+}
+
+static int datalog_open(uint8_t page, uint32_t seq)
+{
+    datalog_header_t header = {DATALOG_MAGIC, seq};
+
+    // the ring is full, the oldest records make room
+    if (g_datalog_ready && g_tail.page == page) {
+        LOG_PRINTF(LL_WARN, "datalog: page %u of records dropped\r\n", page);
+        g_tail.page = page_next(page);
+        g_tail.offset = sizeof(datalog_header_t);
+    }
+    if (!(g_next_erased && page == page_next(g_head_page))) {
+        if (flash_erase_page(page_addr(page)) != ERRNO_OK) {
+            return LWAN_ERROR;
+        }
+    }
+    g_next_erased = false;
+    if (flash_program_bytes(page_addr(page), (uint8_t *)&header, sizeof(header)) != ERRNO_OK) {
+        return LWAN_ERROR;
+    }
+    g_head_page = page;
+    g_head_seq = seq;
+    flash_writer_init(&g_datalog_writer, page_addr(page) + sizeof(header), 0);
+
+    // erased in the background while this page fills
+    if (g_datalog_ready && page_next(page) != g_tail.page &&
+        flash_erase_page_start(page_addr(page_next(page))) == ERRNO_OK) {
+        g_next_erased = true;
+    }
+    return LWAN_SUCCESS;
+}
+
+// Appends a whole record to the head page, the next one opened when it does not fit
+static int datalog_append(const uint8_t *hdr, uint8_t hdr_len, const uint8_t *data, uint8_t len)
+{
+    if (head_offset() + hdr_len + len > FLASH_PAGE_SIZE) {
+        if (flash_writer_flush(&g_datalog_writer) != ERRNO_OK ||
+            datalog_open(page_next(g_head_page), g_head_seq + 1) != LWAN_SUCCESS) {
+            return LWAN_ERROR;
+        }
+    }
+    if (flash_writer_write(&g_datalog_writer, hdr, hdr_len) != ERRNO_OK ||
+        (len > 0 && flash_writer_write(&g_datalog_writer, data, len) != ERRNO_OK)) {
+        return LWAN_ERROR;
+    }
+
+    if (g_datalog_writer.len > 0 && !g_sync_armed) {
+        g_sync_armed = true;
+        TimerSetValue(&g_sync_timer, CONFIG_LWAN_DATALOG_SYNC_DELAY);
+        TimerStart(&g_sync_timer);
+    }
+    return LWAN_SUCCESS;
+}
+
+// Finds the head page, the end of its records and the tail of the last marker
+static void datalog_scan(void)
+{
+    const datalog_header_t *header;
+    const uint8_t *rec;
+    bool found = false;
+    uint8_t head = 0;
+    uint8_t oldest;
+    uint8_t pages = 1;
+    uint8_t page;
+    uint8_t type;
+    uint16_t offset;
+
+    for (page = 0; page < CONFIG_LWAN_DATALOG_FLASH_PAGES; page++) {
+        header = page_header(page);
+        if (header->magic != DATALOG_MAGIC ||
+            (found && (int32_t)(header->seq - page_header(head)->seq) <= 0)) {
+            continue;
+        }
+        found = true;
+        head = page;
+    }
+    g_tail.offset = sizeof(datalog_header_t);
+    if (!found) {
+        g_tail.page = 0;
+        datalog_open(0, 0);
+        g_datalog_ready = true;
+        return;
+    }
+    g_head_seq = page_header(head)->seq;
+
+    // the pages before the head one, in sequence
+    oldest = head;
+    while (pages < CONFIG_LWAN_DATALOG_FLASH_PAGES) {
+        page = (oldest + CONFIG_LWAN_DATALOG_FLASH_PAGES - 1) % CONFIG_LWAN_DATALOG_FLASH_PAGES;
+        header = page_header(page);
+        if (header->magic != DATALOG_MAGIC || header->seq != g_head_seq - pages) {
+            break;
+        }
+        oldest = page;
+        pages++;
+    }
+
+    g_tail.page = oldest;
+    for (page = oldest;; page = page_next(page)) {
+        offset = sizeof(datalog_header_t);
+        while ((type = datalog_walk(page, &offset, FLASH_PAGE_SIZE, &rec)) >= WALK_DATA) {
+            uint32_t age;
+
+            if (type != WALK_MARK) {
+                continue;
+            }
+            // the marked page is still in the ring
+            age = g_head_seq - get_u32(rec + 2);
+            if (age < pages) {
+                g_tail.page = (head + CONFIG_LWAN_DATALOG_FLASH_PAGES - age) % CONFIG_LWAN_DATALOG_FLASH_PAGES;
+                g_tail.offset = rec[6] | (rec[7] << 8);
+            }
+        }
+        if (page == head) {
+            break;
+        }
+    }
+
+    g_head_page = head;
+    g_datalog_ready = true;
+    if (type == WALK_TORN || DATALOG_ALIGN(offset) >= FLASH_PAGE_SIZE) {
+        datalog_open(page_next(head), g_head_seq + 1);
+    } else {
+        // the programmed bytes of a flash word are not programmed again
+        flash_writer_init(&g_datalog_writer, page_addr(head) + DATALOG_ALIGN(offset), 0);
+    }
+    datalog_tail_skip();
+}
+
+/**************************public functions**************************************/
+void lwan_datalog_init(void (*wakeup)(void))
+{
+    g_datalog_wakeup = wakeup;
+    TimerInit(&g_retry_timer, on_retry_timer_event);
+    TimerInit(&g_sync_timer, on_sync_timer_event);
+
+    datalog_scan();
+    g_due = lwan_datalog_pending();
+}
+
+int lwan_datalog_add(const uint8_t *data, uint8_t len)
+{
+    uint8_t hdr[DATALOG_REC_HDR];
+    uint16_t crc;
+
+    if (!data || len == 0 || len > LWAN_DATALOG_RECORD_MAX) {
+        return LWAN_ERROR;
+    }
+    crc = CrcCompute(&CrcCcitt, data, len);
+    hdr[0] = len;
+    hdr[1] = ~len;
+    hdr[2] = crc;
+    hdr[3] = crc >> 8;
+    if (datalog_append(hdr, sizeof(hdr), data, len) != LWAN_SUCCESS) {
+        LOG_PRINTF(LL_ERR, "datalog: error writing the record\r\n");
+        return LWAN_ERROR;
+    }
+
+    // the records of the next g_backoff ms share the drain
+    if (!g_due && !g_wait && !g_inflight) {
+        datalog_retry(g_backoff);
+    }
+    return LWAN_SUCCESS;
+}
+
+bool lwan_datalog_pending(void)
+{
+    return g_tail.page != g_head_page || g_tail.offset < head_offset();
+}
+
+void lwan_datalog_sync(void)
+{
+    TimerStop(&g_sync_timer);
+    g_sync_armed = false;
+    g_sync_due = false;
+    if (flash_writer_flush(&g_datalog_writer) != ERRNO_OK) {
+        LOG_PRINTF(LL_ERR, "datalog: error writing the records\r\n");
+    }
+}
+
+bool lwan_datalog_process(bool idle)
+{
+    if (g_sync_due && idle) {
+        lwan_datalog_sync();
+    }
+    return g_due && !g_inflight;
+}
+
+bool lwan_datalog_get(uint8_t *port, uint8_t *payload, uint8_t *size, uint8_t max)
+{
+    datalog_pos_t pos = g_tail;
+    const uint8_t *rec;
+    uint16_t offset;
+    uint8_t type;
+    uint8_t len = 0;
+
+    if (!g_due || g_inflight) {
+        return false;
+    }
+    lwan_datalog_sync();
+
+    for (;;) {
+        offset = pos.offset;
+        type = datalog_walk(pos.page, &offset, page_end(pos.page), &rec);
+        if (type == WALK_END || type == WALK_TORN) {
+            if (pos.page == g_head_page) {
+                // after the padding of the last flush
+                pos.offset = offset;
+                break;
+            }
+            pos.page = page_next(pos.page);
+            pos.offset = sizeof(datalog_header_t);
+            continue;
+        }
+        if (type == WALK_DATA) {
+            if (len + 1 + rec[0] > max) {
+                break;
+            }
+            payload[len] = rec[0];
+            memcpy(payload + len + 1, rec + DATALOG_REC_HDR, rec[0]);
+            len += 1 + rec[0];
+        }
+        pos.offset = offset;
+    }
+
+    g_due = false;
+    if (len == 0) {
+        datalog_tail_skip();
+        if (lwan_datalog_pending()) {
+            // larger than the uplinks at this datarate
+            datalog_retry(g_backoff);
+        }
+        return false;
+    }
+    g_got = pos;
+    *port = CONFIG_LWAN_DATALOG_PORT;
+    *size = len;
+    return true;
+}
+
+void lwan_datalog_sent(bool sent)
+{
+    if (sent) {
+        g_inflight = true;
+    } else {
+        datalog_retry(DATALOG_SEND_RETRY);
+    }
+}
+
+void lwan_datalog_confirm(bool acked)
+{
+    uint8_t mark[DATALOG_MARK_SIZE];
+
+    if (!g_inflight) {
+        return;
+    }
+    g_inflight = false;
+    if (!acked) {
+        // the link is down
+        datalog_retry(g_backoff);
+        g_backoff = MIN(g_backoff * 2, CONFIG_LWAN_DATALOG_RETRY_MAX);
+        return;
+    }
+
+    g_backoff = CONFIG_LWAN_DATALOG_RETRY;
+    g_tail = g_got;
+    mark[0] = DATALOG_MARK;
+    mark[1] = DATALOG_MARK_VERSION;
+    put_u32(&mark[2], page_header(g_tail.page)->seq);
+    mark[6] = g_tail.offset;
+    mark[7] = g_tail.offset >> 8;
+    if (datalog_append(mark, sizeof(mark), NULL, 0) == LWAN_SUCCESS) {
+        lwan_datalog_sync();
+    }
+    datalog_tail_skip();
+    g_due = lwan_datalog_pending();
+}
+
+void lwan_datalog_link_up(void)
+{
+    g_backoff = CONFIG_LWAN_DATALOG_RETRY;
+    if (g_wait && !g_inflight && lwan_datalog_pending()) {
+        TimerStop(&g_retry_timer);
+        g_wait = false;
+        g_due = true;
+        datalog_wakeup();
+    }
+}
+
+#endif /* CONFIG_LWAN_DATALOG */
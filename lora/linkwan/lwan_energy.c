@@ -0,0 +1,252 @@
+/*
+ * Energy budget, see inc/lwan_energy.h
+ */
+#define LOG_MODULE LOG_MODULE_LWAN
+
+#include <string.h>
+#include "timer.h"
+#include "LoRaMac.h"
+#include "linkwan.h"
+#include "lwan_config.h"
+#include "lwan_energy.h"
+
+#ifdef CONFIG_LWAN_ENERGY
+
+#ifndef CONFIG_LORA_RADIO_STATS
+#error "CONFIG_LWAN_ENERGY needs CONFIG_LORA_RADIO_STATS"
+#endif
+// Build defaults, a capacity of 0 leaves the uplinks alone
+#ifndef CONFIG_LWAN_ENERGY_CAPACITY
+#define CONFIG_LWAN_ENERGY_CAPACITY 0
+#endif
+#ifndef CONFIG_LWAN_ENERGY_LIFETIME
+#define CONFIG_LWAN_ENERGY_LIFETIME 3650
+#endif
+#ifndef CONFIG_LWAN_ENERGY_FLOOR
+#define CONFIG_LWAN_ENERGY_FLOOR 5
+#endif
+#ifndef CONFIG_LWAN_ENERGY_DR_ADAPT
+#define CONFIG_LWAN_ENERGY_DR_ADAPT 0
+#endif
+
+#define ENERGY_DAY                  86400000    // [ms]
+#define ENERGY_HOUR                 3600000     // [ms]
+
+typedef struct {
+    lwan_energy_config_t config;
+    uint64_t used;          // [uAh]
+    uint16_t days;
+} __attribute__((packed)) energy_store_t;
+
+static energy_store_t g_energy;
+static uint64_t g_day_used;         // used at the start of the day [uAh]
+static uint32_t g_allowance;        // of the day [uAh]
+static uint32_t g_day_time;         // elapsed in the day [ms]
+static TimerTime_t g_last_time;
+static uint64_t g_floor_acc;        // floor charge not accounted yet [uA.ms]
+static uint32_t g_radio_last;       // radio charge at the last update [uAh]
+static uint32_t g_uplink_start;     // radio charge at the uplink request [uAh]
+static bool g_uplink_pending = false;
+static uint16_t g_uplink_cost;      // averaged [uAh]
+
+static uint32_t energy_radio_charge(void)
+{
+    RadioStats_t stats;
+
+    lwan_mac_config_get(MAC_CONFIG_RADIO_STATS, &stats);
+    return RadioStatsCharge(&stats);
+}
+
+static void energy_save(void)
+{
+#ifdef CONFIG_LWAN_KV_STORE
+    lwan_kv_set(LWAN_KV_ENERGY, &g_energy, sizeof(g_energy));
+#endif
+}
+
+static void energy_new_day(void)
+{
+    uint64_t capacity = (uint64_t)g_energy.config.capacity * 1000;
+    uint64_t left = capacity > g_energy.used ? capacity - g_energy.used : 0;
+    uint8_t battery = lwan_dev_battery_get();
+    uint16_t days_left;
+
+    // 0 external power, 255 not measured
+    if (battery >= 1 && battery <= 254) {
+        uint64_t measured = capacity * (battery - 1) / 253;
+        if (measured < left) {
+            left = measured;
+        }
+    }
+    days_left = g_energy.config.lifetime > g_energy.days ? g_energy.config.lifetime - g_energy.days : 1;
+    left /= days_left;
+    g_allowance = left > UINT32_MAX ? UINT32_MAX : (uint32_t)left;
+    g_day_used = g_energy.used;
+    LOG_PRINTF(LL_DEBUG, "energy: day %u, allowance %u uAh\r\n", g_energy.days, (unsigned int)g_allowance);
+}
+
+static void energy_update(void)
+{
+    TimerTime_t now = TimerGetCurrentTime();
+    uint32_t elapsed = (uint32_t)(now - g_last_time);
+    uint32_t radio = energy_radio_charge();
+
+    g_last_time = now;
+    // The counters cleared by AT+CRADIOSTAT=0 count again from 0
+    g_energy.used += radio >= g_radio_last ? radio - g_radio_last : radio;
+    g_radio_last = radio;
+    g_floor_acc += (uint64_t)g_energy.config.floor * elapsed;
+    g_energy.used += g_floor_acc / ENERGY_HOUR;
+    g_floor_acc %= ENERGY_HOUR;
+
+    g_day_time += elapsed;
+    if (g_day_time >= ENERGY_DAY) {
+        g_energy.days += g_day_time / ENERGY_DAY;
+        g_day_time %= ENERGY_DAY;
+        energy_new_day();
+        energy_save();
+    }
+}
+
+/* pressure from the uplinks left in the day at interval [s] against the
+   allowance left, the period which keeps to it */
+static uint8_t energy_level(uint32_t interval, uint32_t *stretched)
+{
+    uint32_t spent = (uint32_t)(g_energy.used - g_day_used);
+    uint32_t left_time = (ENERGY_DAY - g_day_time) / 1000;
+    uint32_t floor_left = (uint64_t)g_energy.config.floor * left_time / 3600;
+    uint32_t headroom = g_allowance > spent + floor_left ? g_allowance - spent - floor_left : 0;
+    uint64_t planned;
+    uint8_t level;
+
+    *stretched = interval;
+    if (g_energy.config.capacity == 0) {
+        return 0;
+    }
+    if (interval == 0) {
+        // On pace while the charge spent is within the share of the allowance of the day elapsed, one uplink ahead
+        planned = spent;
+        headroom = (uint32_t)((uint64_t)g_allowance * g_day_time / ENERGY_DAY) + g_uplink_cost;
+        if (planned <= headroom) {
+            return 0;
+        }
+    } else {
+        planned = (uint64_t)(left_time / interval) * g_uplink_cost;
+        if (planned <= headroom) {
+            return 0;
+        }
+        // The allowance left spread over the rest of the day
+        if (headroom < g_uplink_cost) {
+            *stretched = left_time > interval ? left_time : interval;
+        } else {
+            *stretched = (uint32_t)((uint64_t)left_time * g_uplink_cost / headroom);
+            if (*stretched < interval) {
+                *stretched = interval;
+            }
+        }
+    }
+    level = 1;
+    if (planned > (uint64_t)headroom * 2) {
+        level++;
+    }
+    if (planned > (uint64_t)headroom * 4) {
+        level++;
+    }
+    return level;
+}
+
+void lwan_energy_init(void)
+{
+#ifdef CONFIG_LWAN_KV_STORE
+    if (lwan_kv_get(LWAN_KV_ENERGY, &g_energy, sizeof(g_energy)) != sizeof(g_energy))
+#endif
+    {
+        memset(&g_energy, 0, sizeof(g_energy));
+        g_energy.config.capacity = CONFIG_LWAN_ENERGY_CAPACITY;
+        g_energy.config.lifetime = CONFIG_LWAN_ENERGY_LIFETIME;
+        g_energy.config.floor = CONFIG_LWAN_ENERGY_FLOOR;
+        g_energy.config.dr_adapt = CONFIG_LWAN_ENERGY_DR_ADAPT;
+    }
+    g_last_time = TimerGetCurrentTime();
+    g_radio_last = energy_radio_charge();
+    energy_new_day();
+}
+
+int lwan_energy_config_set(const lwan_energy_config_t *config)
+{
+    if (config->capacity != 0 && config->lifetime == 0) {
+        return LWAN_ERROR;
+    }
+    energy_update();
+    g_energy.config = *config;
+    energy_new_day();
+    energy_save();
+    return LWAN_SUCCESS;
+}
+
+void lwan_energy_config_get(lwan_energy_config_t *config)
+{
+    *config = g_energy.config;
+}
+
+void lwan_energy_reset(void)
+{
+    energy_update();
+    g_energy.used = 0;
+    g_energy.days = 0;
+    g_day_time = 0;
+    energy_new_day();
+    energy_save();
+}
+
+void lwan_energy_status_get(uint32_t interval, lwan_energy_status_t *status)
+{
+    energy_update();
+    status->allowance = g_allowance;
+    status->spent = (uint32_t)(g_energy.used - g_day_used);
+    status->used = (uint32_t)(g_energy.used / 1000);
+    status->days = g_energy.days;
+    status->uplink_cost = g_uplink_cost;
+    status->level = energy_level(interval, &status->interval);
+}
+
+uint8_t lwan_energy_uplink(uint32_t interval)
+{
+    uint32_t stretched;
+
+    energy_update();
+    g_uplink_start = g_radio_last;
+    g_uplink_pending = true;
+    return energy_level(interval, &stretched);
+}
+
+void lwan_energy_uplink_done(void)
+{
+    uint32_t cost;
+
+    if (!g_uplink_pending) {
+        return;
+    }
+    g_uplink_pending = false;
+    energy_update();
+    if (g_radio_last < g_uplink_start) {
+        return;
+    }
+    cost = g_radio_last - g_uplink_start;
+    if (cost > UINT16_MAX) {
+        cost = UINT16_MAX;
+    }
+    // The first uplink sets the average
+    g_uplink_cost = g_uplink_cost == 0 ? cost : (g_uplink_cost * 3 + cost) / 4;
+}
+
+uint32_t lwan_energy_interval(uint32_t interval)
+{
+    uint32_t stretched;
+
+    energy_update();
+    energy_level(interval, &stretched);
+    return stretched;
+}
+
+#endif
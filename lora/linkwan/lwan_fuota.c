@@ -0,0 +1,1099 @@
+/*
+ * Remote multicast setup and fragmented data block transport, see
+ * inc/lwan_fuota.h
+ */
+#define LOG_MODULE LOG_MODULE_LWAN
+
+#include <string.h>
+#include "tremo_flash.h"
+#include "tremo_crc.h"
+#include "tremo_rcc.h"
+#include "utilities.h"
+#include "timer.h"
+#include "aes-key.h"
+#include "LoRaMac.h"
+#include "linkwan.h"
+#include "lwan_config.h"
+#include "lwan_fuota.h"
+#ifdef CONFIG_KEY_SLOTS
+#include "key-slot.h"
+#endif
+
+#ifdef CONFIG_LWAN_FUOTA
+
+#ifndef CONFIG_LWAN_FUOTA_SLOT_ADDR
+#error "CONFIG_LWAN_FUOTA needs CONFIG_LWAN_FUOTA_SLOT_ADDR"
+#endif
+#ifndef CONFIG_LWAN_FUOTA_SLOT_SIZE
+#define CONFIG_LWAN_FUOTA_SLOT_SIZE 0x8000
+#endif
+#ifndef CONFIG_LWAN_FUOTA_PARITY_ADDR
+#error "CONFIG_LWAN_FUOTA needs CONFIG_LWAN_FUOTA_PARITY_ADDR"
+#endif
+#ifndef CONFIG_LWAN_FUOTA_PARITY_PAGES
+#define CONFIG_LWAN_FUOTA_PARITY_PAGES 1
+#endif
+#ifndef CONFIG_LWAN_FUOTA_FRAG_MAX
+#define CONFIG_LWAN_FUOTA_FRAG_MAX 1024
+#endif
+// An answer not sent is tried again after [ms]
+#ifndef CONFIG_LWAN_FUOTA_RETRY
+#define CONFIG_LWAN_FUOTA_RETRY 5000
+#endif
+
+#define MC_PACKAGE_ID               2
+#define FRAG_PACKAGE_ID             3
+#define PACKAGE_VERSION             1
+
+// remote multicast setup commands
+#define MC_PACKAGE_VERSION          0x00
+#define MC_GROUP_STATUS             0x01
+#define MC_GROUP_SETUP              0x02
+#define MC_GROUP_DELETE             0x03
+#define MC_CLASS_C_SESSION          0x04
+
+// fragmented data block transport commands
+#define FRAG_PACKAGE_VERSION        0x00
+#define FRAG_SESSION_STATUS         0x01
+#define FRAG_SESSION_SETUP          0x02
+#define FRAG_SESSION_DELETE         0x03
+#define FRAG_DATA_FRAGMENT          0x08
+
+#define MC_GROUPS                   4
+#define MC_ERR_DR                   0x04
+#define MC_ERR_FREQ                 0x08
+#define MC_ERR_UNDEFINED            0x10
+#define MC_ERR_DELETE_UNDEFINED     0x04
+
+#define FRAG_ERR_ENCODING           0x01
+#define FRAG_ERR_MEMORY             0x02
+#define FRAG_ERR_INDEX              0x04
+#define FRAG_ERR_NO_SESSION         0x04
+
+#define FRAG_STATE_IDLE             0
+#define FRAG_STATE_RUNNING          1
+#define FRAG_STATE_DONE             2   // image complete, its CRC checked
+#define FRAG_STATE_ERR              3   // CRC or flash error
+
+#define FUOTA_ANS_SIZE              24
+#define FUOTA_SLOT_FREE             0xFFFF
+#define FUOTA_BIT(map, i)           ((map)[(i) >> 3] & (1 << ((i) & 7)))
+
+typedef struct {
+    bool defined;
+    uint32_t addr;
+    uint8_t nwkskey[16];
+    uint8_t appskey[16];
+    uint32_t fcnt_min;
+    uint32_t fcnt_max;
+} fuota_mc_group_t;
+
+// class C session of a group, one at a time
+typedef struct {
+    uint8_t state;
+    uint8_t group;
+    uint8_t timeout;                // 2^timeout s
+    uint32_t freq;
+    uint8_t dr;
+    Rx2ChannelParams_t rx2;         // of the MAC before the session
+    DeviceClass_t class_mode;
+} fuota_mc_session_t;
+
+#define MC_SESSION_IDLE             0
+#define MC_SESSION_WAIT             1
+#define MC_SESSION_START            2   // start due
+#define MC_SESSION_RUNNING          3
+#define MC_SESSION_END              4   // end due
+
+// a row is the XOR of the parity fragments of parity over the lost
+// fragments of the slots bits, the ones in flash XORed out. The rows are
+// kept reduced: no two of them have the same lowest slot
+typedef struct {
+    uint32_t bits;
+    uint32_t parity;
+} fuota_row_t;
+
+typedef struct {
+    uint8_t state;
+    uint8_t index;                  // FragIndex
+    uint16_t nb_frag;
+    uint8_t frag_size;
+    uint8_t padding;
+    uint8_t block_ack_delay;
+    bool mem_error;                 // parity fragments dropped
+    uint32_t crc;                   // descriptor
+    uint16_t nb_rx;                 // fragments received
+    uint16_t missing;               // data fragments not in flash yet
+    uint8_t received[CONFIG_LWAN_FUOTA_FRAG_MAX / 8];
+    uint16_t lost[LWAN_FUOTA_LOST_MAX];     // fragment index of each slot
+    uint8_t row_num;
+    fuota_row_t rows[LWAN_FUOTA_LOST_MAX];
+    uint8_t parity_num;
+    uint8_t parity_max;             // fragments the parity store holds
+    uint16_t parity_n[LWAN_FUOTA_LOST_MAX]; // matrix row of each stored fragment
+} fuota_frag_session_t;
+
+typedef struct {
+    uint8_t port;
+    uint8_t size;                   // 0 without answer
+    bool due;
+    uint8_t buf[FUOTA_ANS_SIZE];
+} fuota_answer_t;
+
+static void (*g_fuota_wakeup)(void) = NULL;
+static lwan_fuota_done_cb_t g_fuota_done = NULL;
+
+static fuota_mc_group_t g_mc_groups[MC_GROUPS];
+static fuota_mc_session_t g_mc_session;
+static TimerEvent_t g_mc_timer;
+
+static fuota_frag_session_t g_frag = {.state = FRAG_STATE_IDLE};
+static uint8_t g_frag_row[CONFIG_LWAN_FUOTA_FRAG_MAX / 8];   // parity matrix row
+static uint8_t g_frag_acc[CONFIG_LWAN_FUOTA_FRAG_MAX / 8];   // rows combined
+static uint8_t g_frag_buf[256];                             // fragment rebuilt
+
+static fuota_answer_t g_answers[2];     // multicast setup, fragmentation
+static fuota_answer_t *g_answer_got = NULL;
+static TimerEvent_t g_answer_timer;
+static bool g_frag_status_wait = false; // FragSessionStatusAns delayed
+static volatile bool g_frag_status_due = false;
+static bool g_frag_status_all = false;
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void fuota_wakeup(void)
+{
+    if (g_fuota_wakeup) {
+        g_fuota_wakeup();
+    }
+}
+
+static uint8_t *answer_put(uint8_t port, uint8_t size)
+{
+    fuota_answer_t *ans = &g_answers[port == LWAN_FUOTA_FRAG_PORT];
+    uint8_t *p;
+
+    if (ans->size + size > FUOTA_ANS_SIZE) {
+        return NULL;
+    }
+    p = &ans->buf[ans->size];
+    ans->port = port;
+    ans->size += size;
+    ans->due = true;
+    return p;
+}
+
+/**************************multicast setup**************************************/
+static void mc_derive_keys(uint8_t id, const uint8_t *mckey_enc)
+{
+    fuota_mc_group_t *group = &g_mc_groups[id];
+    uint8_t key[16];
+    uint8_t block[16];
+
+#ifdef CONFIG_KEY_SLOTS
+    memcpy(key, KeySlotKey(KEY_SLOT_APP_KEY), 16);
+#else
+    lwan_dev_keys_get(DEV_KEYS_OTA_APPKEY, key);
+#endif
+    // McRootKey from the AppKey, McKEKey from it, then the McKey
+    memset(block, 0, 16);
+    AesEcbEncrypt(key, block, 16, key);
+    AesEcbEncrypt(key, block, 16, key);
+    AesEcbEncrypt(key, mckey_enc, 16, key);
+
+    block[0] = 0x01;
+    put_u32(&block[1], group->addr);
+    AesEcbEncrypt(key, block, 16, group->appskey);
+    block[0] = 0x02;
+    AesEcbEncrypt(key, block, 16, group->nwkskey);
+    memset(key, 0, 16);
+}
+
+static void mc_session_start(void)
+{
+    fuota_mc_group_t *group = &g_mc_groups[g_mc_session.group];
+    MulticastParams_t mc;
+    MibRequestConfirm_t mibReq;
+
+    memset(&mc, 0, sizeof(mc));
+    mc.Address = group->addr;
+    memcpy(mc.NwkSKey, group->nwkskey, 16);
+    memcpy(mc.AppSKey, group->appskey, 16);
+    mc.DownLinkCounter = group->fcnt_min;
+    mc.Frequency = g_mc_session.freq;
+    mc.Datarate = g_mc_session.dr;
+    if (!lwan_multicast_add(&mc)) {
+        g_mc_session.state = MC_SESSION_IDLE;
+        return;
+    }
+
+    mibReq.Type = MIB_DEVICE_CLASS;
+    LoRaMacMibGetRequestConfirm(&mibReq);
+    g_mc_session.class_mode = mibReq.Param.Class;
+    mibReq.Type = MIB_RX2_CHANNEL;
+    LoRaMacMibGetRequestConfirm(&mibReq);
+    g_mc_session.rx2 = mibReq.Param.Rx2Channel;
+
+    mibReq.Param.Rx2Channel.Frequency = g_mc_session.freq;
+    mibReq.Param.Rx2Channel.Datarate = g_mc_session.dr;
+    if (LoRaMacMibSetRequestConfirm(&mibReq) != LORAMAC_STATUS_OK) {
+        lwan_multicast_del(group->addr);
+        g_mc_session.state = MC_SESSION_IDLE;
+        return;
+    }
+    if (g_mc_session.class_mode != CLASS_C) {
+        mibReq.Type = MIB_DEVICE_CLASS;
+        mibReq.Param.Class = CLASS_C;
+        if (LoRaMacMibSetRequestConfirm(&mibReq) != LORAMAC_STATUS_OK) {
+            mibReq.Type = MIB_RX2_CHANNEL;
+            mibReq.Param.Rx2Channel = g_mc_session.rx2;
+            LoRaMacMibSetRequestConfirm(&mibReq);
+            lwan_multicast_del(group->addr);
+            g_mc_session.state = MC_SESSION_IDLE;
+            return;
+        }
+    }
+
+    LOG_PRINTF(LL_DEBUG, "multicast session of group %u started\r\n", g_mc_session.group);
+    g_mc_session.state = MC_SESSION_RUNNING;
+    TimerSetValue(&g_mc_timer, (1UL << g_mc_session.timeout) * 1000);
+    TimerStart(&g_mc_timer);
+}
+
+static void mc_session_end(void)
+{
+    MibRequestConfirm_t mibReq;
+
+    TimerStop(&g_mc_timer);
+    if (g_mc_session.state == MC_SESSION_RUNNING || g_mc_session.state == MC_SESSION_END) {
+        if (g_mc_session.class_mode != CLASS_C) {
+            mibReq.Type = MIB_DEVICE_CLASS;
+            mibReq.Param.Class = g_mc_session.class_mode;
+            LoRaMacMibSetRequestConfirm(&mibReq);
+        }
+        mibReq.Type = MIB_RX2_CHANNEL;
+        mibReq.Param.Rx2Channel = g_mc_session.rx2;
+        LoRaMacMibSetRequestConfirm(&mibReq);
+        lwan_multicast_del(g_mc_groups[g_mc_session.group].addr);
+        LOG_PRINTF(LL_DEBUG, "multicast session of group %u ended\r\n", g_mc_session.group);
+    }
+    g_mc_session.state = MC_SESSION_IDLE;
+}
+
+// the class switches run from the state machine, not from the timer
+static void on_mc_timer_event(void)
+{
+    if (g_mc_session.state == MC_SESSION_WAIT) {
+        g_mc_session.state = MC_SESSION_START;
+    } else if (g_mc_session.state == MC_SESSION_RUNNING) {
+        g_mc_session.state = MC_SESSION_END;
+    }
+    fuota_wakeup();
+}
+
+static void mc_class_c_session(const uint8_t *req)
+{
+    uint8_t id = req[0] & 0x03;
+    uint32_t start = get_u32(&req[1]);
+    uint32_t freq = (req[6] | (req[7] << 8) | ((uint32_t)req[8] << 16)) * 100;
+    uint8_t dr = req[9];
+    uint8_t status = id;
+    uint8_t *ans;
+    uint32_t now, delay = 0;
+
+    if (!g_mc_groups[id].defined) {
+        status |= MC_ERR_UNDEFINED;
+    }
+    if (dr > 15) {
+        status |= MC_ERR_DR;
+    }
+    if (freq == 0) {
+        status |= MC_ERR_FREQ;
+    }
+
+    ans = answer_put(LWAN_FUOTA_MC_PORT, (status & 0x1C) ? 2 : 5);
+    if (ans == NULL) {
+        return;
+    }
+    ans[0] = MC_CLASS_C_SESSION;
+    ans[1] = status;
+    if (status & 0x1C) {
+        return;
+    }
+
+    // the session time is in GPS seconds, the system time the MAC sets from
+    // DeviceTimeAns in Unix ones. A session started already starts now
+    now = TimerGetSysTime().Seconds - UNIX_GPS_EPOCH_OFFSET;
+    if ((int32_t)(start - now) > 0) {
+        delay = start - now;
+        if (delay > 0xFFFFFF) {
+            delay = 0xFFFFFF;
+        }
+    }
+    ans[2] = delay;
+    ans[3] = delay >> 8;
+    ans[4] = delay >> 16;
+
+    mc_session_end();
+    g_mc_session.group = id;
+    g_mc_session.timeout = req[5] & 0x0F;
+    g_mc_session.freq = freq;
+    g_mc_session.dr = dr;
+    if (delay) {
+        g_mc_session.state = MC_SESSION_WAIT;
+        TimerSetValue(&g_mc_timer, delay * 1000);
+        TimerStart(&g_mc_timer);
+    } else {
+        g_mc_session.state = MC_SESSION_START;
+    }
+}
+
+// size of the command handled, 0 to stop the parsing
+static uint8_t mc_command(const uint8_t *req, uint8_t size)
+{
+    uint8_t *ans;
+    uint8_t id;
+
+    switch (req[0]) {
+        case MC_PACKAGE_VERSION:
+            ans = answer_put(LWAN_FUOTA_MC_PORT, 3);
+            if (ans) {
+                ans[0] = MC_PACKAGE_VERSION;
+                ans[1] = MC_PACKAGE_ID;
+                ans[2] = PACKAGE_VERSION;
+            }
+            return 1;
+        case MC_GROUP_STATUS: {
+            uint8_t mask = 0, num = 0, n = 0;
+
+            if (size < 2) {
+                return 0;
+            }
+            for (id = 0; id < MC_GROUPS; id++) {
+                if (g_mc_groups[id].defined) {
+                    num++;
+                    if (req[1] & (1 << id)) {
+                        mask |= 1 << id;
+                        n++;
+                    }
+                }
+            }
+            ans = answer_put(LWAN_FUOTA_MC_PORT, 2 + 5 * n);
+            if (ans) {
+                ans[0] = MC_GROUP_STATUS;
+                ans[1] = mask | (num << 4);
+                ans += 2;
+                for (id = 0; id < MC_GROUPS; id++) {
+                    if (mask & (1 << id)) {
+                        ans[0] = id;
+                        put_u32(&ans[1], g_mc_groups[id].addr);
+                        ans += 5;
+                    }
+                }
+            }
+            return 2;
+        }
+        case MC_GROUP_SETUP:
+            if (size < 30) {
+                return 0;
+            }
+            id = req[1] & 0x03;
+            if (g_mc_session.state != MC_SESSION_IDLE && g_mc_session.group == id) {
+                mc_session_end();
+            }
+            g_mc_groups[id].addr = get_u32(&req[2]);
+            g_mc_groups[id].fcnt_min = get_u32(&req[22]);
+            g_mc_groups[id].fcnt_max = get_u32(&req[26]);
+            mc_derive_keys(id, &req[6]);
+            g_mc_groups[id].defined = true;
+            ans = answer_put(LWAN_FUOTA_MC_PORT, 2);
+            if (ans) {
+                ans[0] = MC_GROUP_SETUP;
+                ans[1] = id;
+            }
+            return 30;
+        case MC_GROUP_DELETE:
+            if (size < 2) {
+                return 0;
+            }
+            id = req[1] & 0x03;
+            ans = answer_put(LWAN_FUOTA_MC_PORT, 2);
+            if (ans) {
+                ans[0] = MC_GROUP_DELETE;
+                ans[1] = id | (g_mc_groups[id].defined ? 0 : MC_ERR_DELETE_UNDEFINED);
+            }
+            if (g_mc_session.state != MC_SESSION_IDLE && g_mc_session.group == id) {
+                mc_session_end();
+            }
+            memset(&g_mc_groups[id], 0, sizeof(fuota_mc_group_t));
+            return 2;
+        case MC_CLASS_C_SESSION:
+            if (size < 11) {
+                return 0;
+            }
+            mc_class_c_session(&req[1]);
+            return 11;
+        default:
+            // class B sessions are not handled
+            return 0;
+    }
+}
+
+/**************************fragmentation**************************************/
+static uint32_t frag_addr(uint16_t index)
+{
+    return CONFIG_LWAN_FUOTA_SLOT_ADDR + (uint32_t)index * g_frag.frag_size;
+}
+
+static uint32_t frag_parity_addr(uint8_t k)
+{
+    return CONFIG_LWAN_FUOTA_PARITY_ADDR + (uint32_t)k * g_frag.frag_size;
+}
+
+static uint32_t frag_prbs23(uint32_t x)
+{
+    uint32_t b0 = x & 0x01;
+    uint32_t b1 = (x & 0x20) >> 5;
+
+    return (x >> 1) + ((b0 ^ b1) << 22);
+}
+
+// data fragments of the parity fragment n, from 1, as the fragmented data
+// block transport draws them
+static void frag_parity_row(uint16_t n, uint16_t m, uint8_t *row)
+{
+    uint32_t x = 1 + 1001 * (uint32_t)n;
+    uint32_t mod = m + (((m & (m - 1)) == 0) ? 1 : 0);
+    uint32_t r;
+    uint16_t coeff;
+
+    memset(row, 0, (m + 7) / 8);
+    for (coeff = 0; coeff < (m >> 1); coeff++) {
+        do {
+            x = frag_prbs23(x);
+            r = x % mod;
+        } while (r >= m);
+        row[r >> 3] |= 1 << (r & 7);
+    }
+}
+
+static void frag_xor(uint8_t *data, const uint8_t *src)
+{
+    for (int i = 0; i < g_frag.frag_size; i++) {
+        data[i] ^= src[i];
+    }
+}
+
+static uint32_t frag_lowest(uint32_t bits)
+{
+    return __builtin_ctz(bits);
+}
+
+static uint32_t frag_crc32(const uint8_t *data, uint32_t size)
+{
+    crc_config_t config;
+    crc_ctx_t ctx;
+    uint32_t crc;
+
+    config.init_value = 0xFFFFFFFF;
+    config.poly_size = CRC_POLY_SIZE_32;
+    config.poly = 0x04C11DB7;
+    config.reverse_in = CRC_REVERSE_IN_BYTE;
+    config.reverse_out = true;
+
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_CRC, true);
+    crc_ctx_init(&ctx, &config);
+    crc_ctx_update(&ctx, data, size);
+    crc = crc_ctx_value(&ctx) ^ 0xFFFFFFFF;
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_CRC, false);
+
+    return crc;
+}
+
+static void frag_done(void)
+{
+    uint32_t size = (uint32_t)g_frag.nb_frag * g_frag.frag_size - g_frag.padding;
+    bool crc_ok = (frag_crc32((const uint8_t *)CONFIG_LWAN_FUOTA_SLOT_ADDR, size) == g_frag.crc);
+
+    g_frag.state = crc_ok ? FRAG_STATE_DONE : FRAG_STATE_ERR;
+    LOG_PRINTF(LL_DEBUG, "fragmentation session done, %u bytes, crc %s\r\n", (unsigned int)size, crc_ok ? "ok" : "error");
+    if (g_fuota_done) {
+        g_fuota_done(CONFIG_LWAN_FUOTA_SLOT_ADDR, size, crc_ok);
+    }
+}
+
+static int frag_program(uint16_t index, uint8_t *data)
+{
+    if (flash_program_bytes(frag_addr(index), data, g_frag.frag_size) != 0) {
+        g_frag.state = FRAG_STATE_ERR;
+        return -1;
+    }
+
+    g_frag.received[index >> 3] |= 1 << (index & 7);
+    g_frag.missing--;
+    if (g_frag.missing == 0) {
+        frag_done();
+    }
+    return 0;
+}
+
+// slot of a lost fragment, a free one given to it with alloc
+static int frag_slot(uint16_t index, bool alloc)
+{
+    int free_slot = -1;
+
+    for (int i = 0; i < LWAN_FUOTA_LOST_MAX; i++) {
+        if (g_frag.lost[i] == index) {
+            return i;
+        }
+        if (g_frag.lost[i] == FUOTA_SLOT_FREE && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    if (!alloc || free_slot < 0) {
+        return -1;
+    }
+
+    g_frag.lost[free_slot] = index;
+    return free_slot;
+}
+
+// frees the slots no row refers to
+static void frag_slot_gc(void)
+{
+    uint32_t used = 0;
+
+    for (int i = 0; i < g_frag.row_num; i++) {
+        used |= g_frag.rows[i].bits;
+    }
+    for (int i = 0; i < LWAN_FUOTA_LOST_MAX; i++) {
+        if (!(used & (1UL << i))) {
+            g_frag.lost[i] = FUOTA_SLOT_FREE;
+        }
+    }
+}
+
+// XORs the rows of the same lowest slot in, until none is left or it is empty
+static void frag_row_reduce(fuota_row_t *row, const fuota_row_t *self)
+{
+    for (int j = 0; j < g_frag.row_num && row->bits; j++) {
+        const fuota_row_t *other = &g_frag.rows[j];
+
+        if (other != self && frag_lowest(other->bits) == frag_lowest(row->bits)) {
+            row->bits ^= other->bits;
+            row->parity ^= other->parity;
+            j = -1;
+        }
+    }
+}
+
+static void frag_row_remove(int i)
+{
+    g_frag.row_num--;
+    if (i != g_frag.row_num) {
+        g_frag.rows[i] = g_frag.rows[g_frag.row_num];
+    }
+}
+
+// the fragment of the slot is in flash now: it leaves the rows, the one
+// whose lowest slot it was is reduced again
+static void frag_slot_known(int slot)
+{
+    uint32_t bit = 1UL << slot;
+    int pivot = -1;
+
+    for (int i = 0; i < g_frag.row_num; i++) {
+        fuota_row_t *row = &g_frag.rows[i];
+
+        if (row->bits & bit) {
+            if (frag_lowest(row->bits) == slot) {
+                pivot = i;
+            }
+            row->bits &= ~bit;
+        }
+    }
+    g_frag.lost[slot] = FUOTA_SLOT_FREE;
+
+    if (pivot >= 0) {
+        frag_row_reduce(&g_frag.rows[pivot], &g_frag.rows[pivot]);
+        if (!g_frag.rows[pivot].bits) {
+            frag_row_remove(pivot);
+        }
+    }
+}
+
+// rebuilds the fragment a row holds alone: the XOR of its stored parity
+// fragments and of the fragments in flash their matrix rows cover an odd
+// number of times
+static bool frag_row_rebuild(const fuota_row_t *row, uint16_t index, uint8_t *data)
+{
+    uint16_t bytes = (g_frag.nb_frag + 7) / 8;
+
+    memset(data, 0, g_frag.frag_size);
+    memset(g_frag_acc, 0, bytes);
+    for (int k = 0; k < g_frag.parity_num; k++) {
+        if (!(row->parity & (1UL << k))) {
+            continue;
+        }
+        frag_xor(data, (const uint8_t *)frag_parity_addr(k));
+        frag_parity_row(g_frag.parity_n[k], g_frag.nb_frag, g_frag_row);
+        for (uint16_t i = 0; i < bytes; i++) {
+            g_frag_acc[i] ^= g_frag_row[i];
+        }
+    }
+    for (uint16_t i = 0; i < g_frag.nb_frag; i++) {
+        if (!FUOTA_BIT(g_frag_acc, i) || i == index) {
+            continue;
+        }
+        if (!FUOTA_BIT(g_frag.received, i)) {
+            return false;
+        }
+        frag_xor(data, (const uint8_t *)frag_addr(i));
+    }
+    return true;
+}
+
+// programs the fragments a row holds alone
+static void frag_solve(void)
+{
+    int i = 0;
+
+    while (i < g_frag.row_num && g_frag.state == FRAG_STATE_RUNNING) {
+        fuota_row_t *row = &g_frag.rows[i];
+        int slot;
+
+        if (row->bits & (row->bits - 1)) {
+            i++;
+            continue;
+        }
+        slot = frag_lowest(row->bits);
+        if (!frag_row_rebuild(row, g_frag.lost[slot], g_frag_buf)) {
+            i++;
+            continue;
+        }
+        if (frag_program(g_frag.lost[slot], g_frag_buf) != 0) {
+            return;
+        }
+        frag_row_remove(i);
+        frag_slot_known(slot);
+        i = 0;
+    }
+}
+
+static void frag_data(uint16_t index, uint8_t *data)
+{
+    int slot;
+
+    if (FUOTA_BIT(g_frag.received, index)) {
+        return;
+    }
+    if (frag_program(index, data) != 0) {
+        return;
+    }
+
+    slot = frag_slot(index, false);
+    if (slot >= 0) {
+        frag_slot_known(slot);
+        frag_solve();
+    }
+}
+
+static void frag_parity(uint16_t n, uint8_t *data)
+{
+    fuota_row_t row = {0, 0};
+    int slot;
+
+    for (int k = 0; k < g_frag.parity_num; k++) {
+        if (g_frag.parity_n[k] == n) {
+            return;
+        }
+    }
+    if (g_frag.parity_num >= g_frag.parity_max || g_frag.row_num >= LWAN_FUOTA_LOST_MAX) {
+        g_frag.mem_error = true;
+        return;
+    }
+
+    // the lost fragments of the matrix row get a slot
+    frag_parity_row(n, g_frag.nb_frag, g_frag_row);
+    for (uint16_t i = 0; i < g_frag.nb_frag; i++) {
+        if (!FUOTA_BIT(g_frag_row, i) || FUOTA_BIT(g_frag.received, i)) {
+            continue;
+        }
+        slot = frag_slot(i, true);
+        if (slot < 0) {
+            // more lost fragments than slots, left to the next parity ones
+            g_frag.mem_error = true;
+            row.bits = 0;
+            break;
+        }
+        row.bits |= 1UL << slot;
+    }
+
+    // stored only when it tells something new
+    row.parity = 1UL << g_frag.parity_num;
+    if (row.bits) {
+        frag_row_reduce(&row, NULL);
+    }
+    if (row.bits) {
+        if (flash_program_bytes(frag_parity_addr(g_frag.parity_num), data, g_frag.frag_size) != 0) {
+            g_frag.state = FRAG_STATE_ERR;
+            return;
+        }
+        g_frag.parity_n[g_frag.parity_num++] = n;
+        g_frag.rows[g_frag.row_num++] = row;
+        frag_solve();
+    }
+    frag_slot_gc();
+}
+
+static uint8_t frag_session_setup(const uint8_t *req)
+{
+    uint8_t index = (req[0] >> 4) & 0x03;
+    uint16_t nb_frag = req[1] | (req[2] << 8);
+    uint8_t frag_size = req[3];
+    uint8_t control = req[4];
+    uint32_t span = (uint32_t)nb_frag * frag_size;
+    uint8_t status = 0;
+    uint32_t offset;
+
+    if (((control >> 3) & 0x07) != 0 || frag_size == 0 || (frag_size & 7)) {
+        status |= FRAG_ERR_ENCODING;
+    }
+    if (nb_frag == 0 || nb_frag > CONFIG_LWAN_FUOTA_FRAG_MAX || span > CONFIG_LWAN_FUOTA_SLOT_SIZE
+        || frag_size > sizeof(g_frag_buf) || req[5] >= frag_size) {
+        status |= FRAG_ERR_MEMORY;
+    }
+    if (g_frag.state == FRAG_STATE_RUNNING && g_frag.index != index) {
+        status |= FRAG_ERR_INDEX;
+    }
+    if (status) {
+        return status;
+    }
+
+    // the image area and the parity store erased, the RX windows of the
+    // exchange over already
+    for (offset = 0; offset < span; offset += FLASH_PAGE_SIZE) {
+        if (flash_erase_page(CONFIG_LWAN_FUOTA_SLOT_ADDR + offset) != 0) {
+            return FRAG_ERR_MEMORY;
+        }
+    }
+    for (offset = 0; offset < CONFIG_LWAN_FUOTA_PARITY_PAGES * FLASH_PAGE_SIZE; offset += FLASH_PAGE_SIZE) {
+        if (flash_erase_page(CONFIG_LWAN_FUOTA_PARITY_ADDR + offset) != 0) {
+            return FRAG_ERR_MEMORY;
+        }
+    }
+
+    memset(&g_frag, 0, sizeof(g_frag));
+    memset(g_frag.lost, 0xFF, sizeof(g_frag.lost));
+    g_frag.index = index;
+    g_frag.nb_frag = nb_frag;
+    g_frag.frag_size = frag_size;
+    g_frag.block_ack_delay = control & 0x07;
+    g_frag.padding = req[5];
+    g_frag.crc = get_u32(&req[6]);
+    g_frag.missing = nb_frag;
+    offset = CONFIG_LWAN_FUOTA_PARITY_PAGES * FLASH_PAGE_SIZE / frag_size;
+    g_frag.parity_max = (offset < LWAN_FUOTA_LOST_MAX) ? offset : LWAN_FUOTA_LOST_MAX;
+    g_frag.state = FRAG_STATE_RUNNING;
+    g_frag_status_wait = false;
+    g_frag_status_due = false;
+    return 0;
+}
+
+static void frag_status_answer(void)
+{
+    uint8_t *ans = answer_put(LWAN_FUOTA_FRAG_PORT, 5);
+    uint16_t received = g_frag.nb_rx & 0x3FFF;
+
+    if (ans) {
+        ans[0] = FRAG_SESSION_STATUS;
+        ans[1] = received;
+        ans[2] = (received >> 8) | (g_frag.index << 6);
+        ans[3] = (g_frag.missing > 255) ? 255 : g_frag.missing;
+        ans[4] = g_frag.mem_error ? 0x01 : 0;
+    }
+}
+
+static void frag_status_request(uint8_t param)
+{
+    bool all = param & 0x01;
+
+    if (g_frag.state == FRAG_STATE_IDLE || g_frag.index != ((param >> 1) & 0x03)) {
+        return;
+    }
+    if (!all && g_frag.state == FRAG_STATE_DONE) {
+        return;
+    }
+    // answered after a random delay, the devices of the group answering
+    // the same request
+    g_frag_status_wait = true;
+    g_frag_status_all = all;
+    TimerStop(&g_answer_timer);
+    TimerSetValue(&g_answer_timer, randr(1, (1 << (g_frag.block_ack_delay + 4)) * 1000));
+    TimerStart(&g_answer_timer);
+}
+
+static uint8_t frag_command(uint8_t *req, uint8_t size)
+{
+    uint8_t *ans;
+    uint8_t status;
+
+    switch (req[0]) {
+        case FRAG_PACKAGE_VERSION:
+            ans = answer_put(LWAN_FUOTA_FRAG_PORT, 3);
+            if (ans) {
+                ans[0] = FRAG_PACKAGE_VERSION;
+                ans[1] = FRAG_PACKAGE_ID;
+                ans[2] = PACKAGE_VERSION;
+            }
+            return 1;
+        case FRAG_SESSION_STATUS:
+            if (size < 2) {
+                return 0;
+            }
+            frag_status_request(req[1]);
+            return 2;
+        case FRAG_SESSION_SETUP:
+            if (size < 11) {
+                return 0;
+            }
+            status = frag_session_setup(&req[1]);
+            ans = answer_put(LWAN_FUOTA_FRAG_PORT, 2);
+            if (ans) {
+                ans[0] = FRAG_SESSION_SETUP;
+                ans[1] = status | (((req[1] >> 4) & 0x03) << 6);
+            }
+            return 11;
+        case FRAG_SESSION_DELETE:
+            if (size < 2) {
+                return 0;
+            }
+            status = req[1] & 0x03;
+            if (g_frag.state == FRAG_STATE_IDLE || g_frag.index != status) {
+                status |= FRAG_ERR_NO_SESSION;
+            } else {
+                g_frag.state = FRAG_STATE_IDLE;
+                g_frag_status_wait = false;
+                g_frag_status_due = false;
+            }
+            ans = answer_put(LWAN_FUOTA_FRAG_PORT, 2);
+            if (ans) {
+                ans[0] = FRAG_SESSION_DELETE;
+                ans[1] = status;
+            }
+            return 2;
+        case FRAG_DATA_FRAGMENT: {
+            uint16_t n;
+
+            // the fragment takes the rest of the frame
+            if (size < 3 + g_frag.frag_size || g_frag.state != FRAG_STATE_RUNNING
+                || (req[2] >> 6) != g_frag.index) {
+                return 0;
+            }
+            n = (req[1] | (req[2] << 8)) & 0x3FFF;
+            if (n == 0) {
+                return 0;
+            }
+            g_frag.nb_rx++;
+            if (n <= g_frag.nb_frag) {
+                frag_data(n - 1, &req[3]);
+            } else {
+                frag_parity(n - g_frag.nb_frag, &req[3]);
+            }
+            return 0;
+        }
+        default:
+            return 0;
+    }
+}
+
+/**************************answers**************************************/
+static void on_answer_timer_event(void)
+{
+    uint8_t i;
+
+    if (g_frag_status_wait) {
+        g_frag_status_due = true;
+    }
+    for (i = 0; i < 2; i++) {
+        if (g_answers[i].size) {
+            g_answers[i].due = true;
+        }
+    }
+    fuota_wakeup();
+}
+
+void lwan_fuota_init(void (*wakeup)(void))
+{
+    g_fuota_wakeup = wakeup;
+    TimerInit(&g_mc_timer, on_mc_timer_event);
+    TimerInit(&g_answer_timer, on_answer_timer_event);
+}
+
+void lwan_fuota_done_set(lwan_fuota_done_cb_t cb)
+{
+    g_fuota_done = cb;
+}
+
+void lwan_fuota_rx(uint8_t port, uint8_t *payload, uint8_t size)
+{
+    uint8_t used;
+
+    while (size > 0) {
+        if (port == LWAN_FUOTA_MC_PORT) {
+            used = mc_command(payload, size);
+        } else {
+            used = frag_command(payload, size);
+        }
+        if (used == 0) {
+            break;
+        }
+        payload += used;
+        size -= used;
+    }
+
+    if (g_answers[0].due || g_answers[1].due || g_mc_session.state == MC_SESSION_START) {
+        fuota_wakeup();
+    }
+}
+
+bool lwan_fuota_process(void)
+{
+    if (g_mc_session.state == MC_SESSION_START) {
+        mc_session_start();
+    } else if (g_mc_session.state == MC_SESSION_END) {
+        mc_session_end();
+    }
+
+    // the status as it is when the delay is over
+    if (g_frag_status_due) {
+        g_frag_status_wait = false;
+        g_frag_status_due = false;
+        if (g_frag.state != FRAG_STATE_IDLE && (g_frag_status_all || g_frag.state != FRAG_STATE_DONE)) {
+            frag_status_answer();
+        }
+    }
+    return g_answers[0].due || g_answers[1].due;
+}
+
+bool lwan_fuota_answer_get(uint8_t *port, uint8_t *payload, uint8_t *size)
+{
+    for (uint8_t i = 0; i < 2; i++) {
+        if (g_answers[i].due) {
+            g_answer_got = &g_answers[i];
+            *port = g_answer_got->port;
+            memcpy(payload, g_answer_got->buf, g_answer_got->size);
+            *size = g_answer_got->size;
+            return true;
+        }
+    }
+    return false;
+}
+
+void lwan_fuota_answer_sent(bool sent)
+{
+    if (g_answer_got == NULL) {
+        return;
+    }
+    if (sent) {
+        g_answer_got->size = 0;
+        g_answer_got->due = false;
+    } else if (!g_frag_status_wait) {
+        // the duty cycle or a frame in flight, tried again later
+        g_answer_got->due = false;
+        TimerSetValue(&g_answer_timer, CONFIG_LWAN_FUOTA_RETRY);
+        TimerStart(&g_answer_timer);
+    }
+    g_answer_got = NULL;
+}
+
+#ifdef CONFIG_LWAN_FUOTA_STATE_ADDR
+/**************************bootloader state log**************************************/
+// records of the state page of the OTA bootloader, see its inc/bootloader.h
+#define BOOT_REC_PENDING            1
+#define BOOT_REC_CONFIRM            4
+#define BOOT_TRIAL_MAX              3
+#define BOOT_SLOT_PAGES             (CONFIG_LWAN_FUOTA_SLOT_SIZE / FLASH_PAGE_SIZE)
+
+typedef struct {
+    uint8_t type;
+    uint8_t step;
+    uint16_t page;
+    uint32_t version;
+    uint32_t size;
+    uint32_t crc;
+} fuota_boot_rec_t;
+
+#define BOOT_STATE_RECS             (FLASH_PAGE_SIZE / sizeof(fuota_boot_rec_t))
+
+static int boot_rec_write(uint16_t index, fuota_boot_rec_t *rec)
+{
+    return flash_program_bytes(CONFIG_LWAN_FUOTA_STATE_ADDR + index * sizeof(fuota_boot_rec_t),
+                               (uint8_t *)rec, sizeof(fuota_boot_rec_t));
+}
+
+int lwan_fuota_commit(uint32_t version)
+{
+    const fuota_boot_rec_t *recs = (const fuota_boot_rec_t *)CONFIG_LWAN_FUOTA_STATE_ADDR;
+    fuota_boot_rec_t last, good, rec;
+    uint16_t free_rec;
+
+    if (g_frag.state != FRAG_STATE_DONE) {
+        return LWAN_ERROR;
+    }
+
+    // the last record and the last confirmed image, as the bootloader scans
+    memset(&last, 0xFF, sizeof(last));
+    memset(&good, 0, sizeof(good));
+    for (free_rec = 0; free_rec < BOOT_STATE_RECS; free_rec++) {
+        if (recs[free_rec].type == 0xFF && recs[free_rec].size == 0xFFFFFFFF) {
+            break;
+        }
+        if (recs[free_rec].type == 0xFF || recs[free_rec].size == 0xFFFFFFFF) {
+            continue;
+        }
+        last = recs[free_rec];
+        if (last.type == BOOT_REC_CONFIRM) {
+            good = last;
+        }
+    }
+    if ((last.type != 0xFF && last.type != BOOT_REC_CONFIRM && last.type != BOOT_REC_PENDING)
+        || (good.type == BOOT_REC_CONFIRM && version <= good.version)) {
+        return LWAN_ERROR;
+    }
+
+    // room left for a whole swap, the log compacted otherwise
+    if (free_rec + 3 * BOOT_SLOT_PAGES + BOOT_TRIAL_MAX + 4 > BOOT_STATE_RECS) {
+        if (flash_erase_page(CONFIG_LWAN_FUOTA_STATE_ADDR) != 0) {
+            return LWAN_ERROR;
+        }
+        free_rec = 0;
+        if (good.type == BOOT_REC_CONFIRM && boot_rec_write(free_rec++, &good) != 0) {
+            return LWAN_ERROR;
+        }
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = BOOT_REC_PENDING;
+    rec.version = version;
+    rec.size = (uint32_t)g_frag.nb_frag * g_frag.frag_size - g_frag.padding;
+    rec.crc = g_frag.crc;
+    if (boot_rec_write(free_rec, &rec) != 0) {
+        return LWAN_ERROR;
+    }
+    return LWAN_SUCCESS;
+}
+#endif
+
+#endif
@@ -0,0 +1,395 @@
+/*
+ * Store-and-forward relay, see inc/lwan_relay.h
+ */
+#define LOG_MODULE LOG_MODULE_LWAN
+
+#include <string.h>
+#include "utilities.h"
+#include "timer.h"
+#include "radio.h"
+#include "radio-cad.h"
+#include "LoRaMac.h"
+#include "linkwan.h"
+#include "lwan_relay.h"
+
+#ifdef CONFIG_LWAN_RELAY
+
+// Forward queue, the records of the end-device uplinks [bytes]
+#ifndef CONFIG_LWAN_RELAY_QUEUE_SIZE
+#define CONFIG_LWAN_RELAY_QUEUE_SIZE 256
+#endif
+// The oldest record waits for others to share its forward [ms]
+#ifndef CONFIG_LWAN_RELAY_AGG_DELAY
+#define CONFIG_LWAN_RELAY_AGG_DELAY 60000
+#endif
+#ifndef CONFIG_LWAN_RELAY_FWD_PER_HOUR
+#define CONFIG_LWAN_RELAY_FWD_PER_HOUR 12
+#endif
+// From the end of an end-device uplink to its downlink [ms]
+#ifndef CONFIG_LWAN_RELAY_RX_DELAY
+#define CONFIG_LWAN_RELAY_RX_DELAY 1000
+#endif
+// Downlink PHYPayload kept per end-device
+#ifndef CONFIG_LWAN_RELAY_DL_SIZE
+#define CONFIG_LWAN_RELAY_DL_SIZE 64
+#endif
+// A forward not sent is tried again after [ms]
+#ifndef CONFIG_LWAN_RELAY_RETRY
+#define CONFIG_LWAN_RELAY_RETRY 5000
+#endif
+
+#define RELAY_CAD_SYMBOLS           2
+#define RELAY_PREAMBLE_LEN          8
+#define RELAY_TX_TIMEOUT            3000
+#define RELAY_HOUR                  3600000
+#define RELAY_REC_HDR               3       // len, -rssi, snr
+#define RELAY_PHY_SIZE_MIN          12      // MHDR, FHDR without FOpts, MIC
+
+typedef struct {
+    bool defined;
+    uint32_t dev_addr;
+    bool fcnt_valid;
+    uint16_t fcnt;                  // of the last uplink queued
+    uint8_t dl_size;                // 0 without downlink
+    uint8_t dl[CONFIG_LWAN_RELAY_DL_SIZE];
+} relay_device_t;
+
+static void (*g_relay_wakeup)(void) = NULL;
+static bool g_relay_enabled = false;
+static bool g_relay_active = false;     // the relay holds the radio
+static lwan_relay_channel_t g_relay_ch;
+static relay_device_t g_relay_devices[LWAN_RELAY_DEVICES_MAX];
+
+static RadioCadSniff_t g_relay_sniff;
+static RadioJob_t g_relay_tx;
+static RadioJob_t g_relay_sleep;
+static relay_device_t *g_relay_tx_dev = NULL;
+
+static uint8_t g_fwd_queue[CONFIG_LWAN_RELAY_QUEUE_SIZE];
+static uint16_t g_fwd_len = 0;
+static uint16_t g_fwd_got = 0;          // bytes of the forward got
+static volatile bool g_fwd_due = false;
+static TimerEvent_t g_fwd_timer;
+static TimerTime_t g_fwd_hour_start = 0;
+static uint16_t g_fwd_hour_num = 0;
+static uint32_t g_fwd_dropped = 0;
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static relay_device_t *device_find(uint32_t dev_addr)
+{
+    for (uint8_t i = 0; i < LWAN_RELAY_DEVICES_MAX; i++) {
+        if (g_relay_devices[i].defined && g_relay_devices[i].dev_addr == dev_addr) {
+            return &g_relay_devices[i];
+        }
+    }
+    return NULL;
+}
+
+static void fwd_timer_start(uint32_t delay)
+{
+    TimerStop(&g_fwd_timer);
+    TimerSetValue(&g_fwd_timer, delay);
+    TimerStart(&g_fwd_timer);
+}
+
+static void on_fwd_timer_event(void)
+{
+    TimerStop(&g_fwd_timer);
+    g_fwd_due = true;
+    if (g_relay_wakeup) {
+        g_relay_wakeup();
+    }
+}
+
+static void fwd_pop(uint16_t size)
+{
+    memmove(g_fwd_queue, &g_fwd_queue[size], g_fwd_len - size);
+    g_fwd_len -= size;
+}
+
+static void fwd_push(const uint8_t *phy, uint8_t size, int16_t rssi, int8_t snr)
+{
+    uint16_t rec = size + RELAY_REC_HDR;
+
+    if (rec > CONFIG_LWAN_RELAY_QUEUE_SIZE) {
+        return;
+    }
+    // the oldest records make room
+    while (g_fwd_len + rec > CONFIG_LWAN_RELAY_QUEUE_SIZE) {
+        fwd_pop(g_fwd_queue[0] + RELAY_REC_HDR);
+        g_fwd_dropped++;
+    }
+    if (g_fwd_len == 0 && !g_fwd_due) {
+        fwd_timer_start(CONFIG_LWAN_RELAY_AGG_DELAY);
+    }
+
+    g_fwd_queue[g_fwd_len] = size;
+    g_fwd_queue[g_fwd_len + 1] = (rssi < -255) ? 255 : (rssi > 0) ? 0 : -rssi;
+    g_fwd_queue[g_fwd_len + 2] = snr;
+    memcpy(&g_fwd_queue[g_fwd_len + RELAY_REC_HDR], phy, size);
+    g_fwd_len += rec;
+
+    if (g_fwd_len >= CONFIG_LWAN_RELAY_QUEUE_SIZE / 2) {
+        on_fwd_timer_event();
+    }
+}
+
+/**************************relay channel**************************************/
+static void relay_rx_setup(RadioCadSniff_t *sniff)
+{
+    Radio.SetChannel(g_relay_ch.freq);
+    Radio.SetRxConfig(MODEM_LORA, g_relay_ch.bandwidth, g_relay_ch.datarate, 1, 0,
+                      RELAY_PREAMBLE_LEN, 0, false, 0, true, 0, 0, false, false);
+}
+
+static void relay_tx_setup(RadioJob_t *job)
+{
+    Radio.SetChannel(g_relay_ch.freq);
+    Radio.SetTxConfig(MODEM_LORA, g_relay_ch.tx_power, 0, g_relay_ch.bandwidth,
+                      g_relay_ch.datarate, 1, RELAY_PREAMBLE_LEN, false,
+                      true, 0, 0, true, RELAY_TX_TIMEOUT);
+}
+
+static void relay_tx_done(RadioJob_t *job, RadioJobStatus_t status)
+{
+    // aborted, the downlink waits for the next uplink
+    if (status == RADIO_JOB_OK && g_relay_tx_dev != NULL) {
+        g_relay_tx_dev->dl_size = 0;
+    }
+    g_relay_tx_dev = NULL;
+}
+
+static void relay_rx_done(RadioCadSniff_t *sniff, RadioJob_t *rx, RadioJobStatus_t status)
+{
+    relay_device_t *dev;
+    uint8_t mtype;
+    uint16_t fcnt;
+
+    if (status != RADIO_JOB_OK || rx->PayloadSize < RELAY_PHY_SIZE_MIN || rx->PayloadSize > UINT8_MAX) {
+        return;
+    }
+    mtype = rx->Payload[0] >> 5;
+    if (mtype != FRAME_TYPE_DATA_UNCONFIRMED_UP && mtype != FRAME_TYPE_DATA_CONFIRMED_UP) {
+        return;
+    }
+    dev = device_find(get_u32(&rx->Payload[1]));
+    if (dev == NULL) {
+        return;
+    }
+
+    // the RX1 window of the end-device opens from the end of its uplink
+    if (dev->dl_size != 0 && g_relay_tx_dev == NULL) {
+        g_relay_tx_dev = dev;
+        g_relay_tx.StartTime = TimerGetCurrentTime() + CONFIG_LWAN_RELAY_RX_DELAY;
+        g_relay_tx.Buffer = dev->dl;
+        g_relay_tx.Size = dev->dl_size;
+        RadioSchedEnqueue(&g_relay_tx);
+    }
+
+    // the repetitions of an unconfirmed uplink are forwarded once
+    fcnt = rx->Payload[6] | (rx->Payload[7] << 8);
+    if (dev->fcnt_valid && dev->fcnt == fcnt) {
+        return;
+    }
+    dev->fcnt_valid = true;
+    dev->fcnt = fcnt;
+    fwd_push(rx->Payload, rx->PayloadSize, rx->Rssi, rx->Snr);
+}
+
+static void relay_resume(void)
+{
+    if (g_relay_active) {
+        return;
+    }
+    g_relay_active = true;
+    RadioSchedInit();
+    Radio.SetPublicNetwork(true);
+
+    memset(&g_relay_tx, 0, sizeof(g_relay_tx));
+    g_relay_tx.Type = RADIO_JOB_TX;
+    g_relay_tx.Priority = 1;
+    g_relay_tx.Setup = relay_tx_setup;
+    g_relay_tx.Done = relay_tx_done;
+    g_relay_tx.Chain = &g_relay_sleep;
+
+    memset(&g_relay_sleep, 0, sizeof(g_relay_sleep));
+    g_relay_sleep.Type = RADIO_JOB_SLEEP;
+    g_relay_sleep.Priority = 1;
+
+    g_relay_sniff.Period = g_relay_ch.sniff_period;
+    g_relay_sniff.Symbols = RELAY_CAD_SYMBOLS;
+    g_relay_sniff.Priority = 0;
+    g_relay_sniff.RxTimeout = 0;
+    g_relay_sniff.Setup = relay_rx_setup;
+    g_relay_sniff.Done = relay_rx_done;
+    g_relay_sniff.Running = false;
+    RadioCadSniffStart(&g_relay_sniff);
+}
+
+/**************************public functions**************************************/
+void lwan_relay_init(void (*wakeup)(void))
+{
+    g_relay_wakeup = wakeup;
+    TimerInit(&g_fwd_timer, on_fwd_timer_event);
+}
+
+void lwan_relay_start(const lwan_relay_channel_t *channel)
+{
+    lwan_relay_suspend();
+    g_relay_ch = *channel;
+    g_relay_enabled = true;
+}
+
+void lwan_relay_stop(void)
+{
+    lwan_relay_suspend();
+    g_relay_enabled = false;
+}
+
+bool lwan_relay_device_add(uint32_t dev_addr)
+{
+    if (device_find(dev_addr) != NULL) {
+        return true;
+    }
+    for (uint8_t i = 0; i < LWAN_RELAY_DEVICES_MAX; i++) {
+        if (!g_relay_devices[i].defined) {
+            memset(&g_relay_devices[i], 0, sizeof(g_relay_devices[i]));
+            g_relay_devices[i].dev_addr = dev_addr;
+            g_relay_devices[i].defined = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool lwan_relay_device_del(uint32_t dev_addr)
+{
+    relay_device_t *dev = device_find(dev_addr);
+
+    if (dev == NULL) {
+        return false;
+    }
+    if (dev == g_relay_tx_dev) {
+        RadioSchedCancel(&g_relay_tx);
+        g_relay_tx_dev = NULL;
+    }
+    dev->defined = false;
+    return true;
+}
+
+void lwan_relay_rx(uint8_t *payload, uint8_t size)
+{
+    relay_device_t *dev;
+
+    if (size < 4 + RELAY_PHY_SIZE_MIN || size - 4 > CONFIG_LWAN_RELAY_DL_SIZE) {
+        return;
+    }
+    dev = device_find(get_u32(payload));
+    // the downlink in flight is not overwritten
+    if (dev == NULL || dev == g_relay_tx_dev) {
+        return;
+    }
+    memcpy(dev->dl, &payload[4], size - 4);
+    dev->dl_size = size - 4;
+}
+
+bool lwan_relay_process(bool idle)
+{
+    if (g_relay_enabled && idle) {
+        relay_resume();
+    } else {
+        lwan_relay_suspend();
+    }
+
+    if (!g_fwd_due || g_fwd_len == 0) {
+        g_fwd_due = false;
+        return false;
+    }
+    if (TimerGetElapsedTime(g_fwd_hour_start) >= RELAY_HOUR) {
+        g_fwd_hour_start = TimerGetCurrentTime();
+        g_fwd_hour_num = 0;
+    }
+    if (g_fwd_hour_num >= CONFIG_LWAN_RELAY_FWD_PER_HOUR) {
+        // the queue waits for the next hour
+        g_fwd_due = false;
+        fwd_timer_start(RELAY_HOUR - TimerGetElapsedTime(g_fwd_hour_start));
+        return false;
+    }
+    return true;
+}
+
+bool lwan_relay_active(void)
+{
+    return g_relay_active;
+}
+
+void lwan_relay_suspend(void)
+{
+    if (!g_relay_active) {
+        return;
+    }
+    RadioCadSniffStop(&g_relay_sniff);
+    RadioSchedCancel(&g_relay_tx);
+    RadioSchedCancel(&g_relay_sleep);
+    g_relay_tx_dev = NULL;
+    g_relay_active = false;
+    LoRaMacRadioAttach();
+}
+
+bool lwan_relay_fwd_get(uint8_t *port, uint8_t *payload, uint8_t *size, uint8_t max)
+{
+    uint16_t len = 0;
+
+    if (!g_fwd_due) {
+        return false;
+    }
+    // a record larger than the uplinks at this datarate is dropped
+    while (g_fwd_len > 0 && g_fwd_queue[0] + RELAY_REC_HDR > max) {
+        fwd_pop(g_fwd_queue[0] + RELAY_REC_HDR);
+        g_fwd_dropped++;
+    }
+    while (len < g_fwd_len && len + g_fwd_queue[len] + RELAY_REC_HDR <= max) {
+        len += g_fwd_queue[len] + RELAY_REC_HDR;
+    }
+    if (len == 0) {
+        g_fwd_due = false;
+        return false;
+    }
+
+    *port = LWAN_RELAY_PORT;
+    memcpy(payload, g_fwd_queue, len);
+    *size = len;
+    g_fwd_got = len;
+    return true;
+}
+
+void lwan_relay_fwd_sent(bool sent)
+{
+    if (g_fwd_got == 0) {
+        return;
+    }
+    g_fwd_due = false;
+    if (sent) {
+        fwd_pop(g_fwd_got);
+        g_fwd_hour_num++;
+        if (g_fwd_len >= CONFIG_LWAN_RELAY_QUEUE_SIZE / 2) {
+            g_fwd_due = true;
+        } else if (g_fwd_len > 0) {
+            fwd_timer_start(CONFIG_LWAN_RELAY_AGG_DELAY);
+        }
+        if (g_fwd_dropped) {
+            LOG_PRINTF(LL_WARN, "relay: %u records dropped\r\n", (unsigned int)g_fwd_dropped);
+            g_fwd_dropped = 0;
+        }
+    } else {
+        // the duty cycle or a frame in flight, tried again later
+        fwd_timer_start(CONFIG_LWAN_RELAY_RETRY);
+    }
+    g_fwd_got = 0;
+}
+
+#endif /* CONFIG_LWAN_RELAY */
@@ -18,6 +18,8 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jaeckle ( STACKFORCE )
 */
 
+#define LOG_MODULE LOG_MODULE_REGION
+
 #include <stdbool.h>
 #include <string.h>
 #include <stdint.h>
@@ -51,6 +53,13 @@ static ChannelParams_t Channels[CN470A_MAX_NB_CHANNELS];
 static ChannelParams_t TxChannels[CN470A_MAX_NB_CHANNELS];
 static uint8_t TxFreqBandNum = 0;
 
+/*!
+ * Frequency bands Channels and TxChannels were set for, CN470A_NB_FREQBANDS
+ * when a channel was added, removed or reset since
+ */
+static uint8_t ChannelsRxFreqBand = CN470A_NB_FREQBANDS;
+static uint8_t ChannelsTxFreqBand = CN470A_NB_FREQBANDS;
+
 /*!
  * LoRaMac bands
  */
@@ -70,13 +79,16 @@ static uint16_t ChannelsDefaultMask[CHANNELS_MASK_SIZE] = {0};
 
 uint8_t NumFreqBand;
 uint8_t FreqBandNum[16] = {0};
-uint8_t FreqBandStartChannelNum[16] = {0, 8, 16, 24, 100, 108, 116, 124, 68, 76, 84, 92, 166, 174, 182, 190};
+// Channels 0, 8, 16, 24, 100, 108, 116, 124, 68, 76, 84, 92, 166, 174, 182
+// and 190 of the 200 kHz raster from 470.3 MHz
+const uint32_t CN470AFreqBandFirstFreq[CN470A_NB_FREQBANDS] = {
+    470300000, 471900000, 473500000, 475100000, 490300000, 491900000, 493500000, 495100000,
+    483900000, 485500000, 487100000, 488700000, 503500000, 505100000, 506700000, 508300000
+};
 uint8_t ChMaskCntlToStartBandNum[8] = {0, 2, 12, 14, CHANNELS_MASK_ALL_ON, CHANNELS_MASK_CNTL_RFU,
                                        CHANNELS_MASK_CNTL_RFU, CHANNELS_MASK_CNTL_RFU};
 uint8_t NextAvailableFreqBandIdx;
 uint16_t scan_mask;
-uint8_t InterFreqRx2Chan[16] = {75, 83, 91, 99, 173, 181, 189, 197, 7, 15, 23, 31, 107, 115, 123, 131};
-uint8_t IntraFreqRx2Chan[16] = {7, 15, 23, 31, 107, 115, 123, 131, 75, 83, 91, 99, 173, 181, 189, 197};
 
 // Static functions
 static int8_t GetNextLowerTxDr( int8_t dr, int8_t minDr )
@@ -298,6 +310,20 @@ PhyParam_t RegionCN470AGetPhyParam( GetPhyParams_t *getPhy )
             phyParam.Value = CN470A_BEACON_NB_CHANNELS;
             break;
         }
+#ifdef CONFIG_LORAMAC_TX_TIME
+        case PHY_TX_TIME_ON_AIR: {
+            phyParam.Value = RegionCommonComputeTxTimeOnAir( getPhy->Datarate == DR_7, DataratesCN470A[getPhy->Datarate],
+                                                             BandwidthsCN470A[getPhy->Datarate], getPhy->PktLen );
+            break;
+        }
+#endif
+#ifdef CONFIG_LORAMAC_LINK_ADR
+        case PHY_DATARATE_SF: {
+            phyParam.Value = ( ( getPhy->Datarate != DR_7 ) && ( BandwidthsCN470A[getPhy->Datarate] == 125e3 ) ) ?
+                             DataratesCN470A[getPhy->Datarate] : 0;
+            break;
+        }
+#endif
 
         default: {
             break;
@@ -325,6 +351,7 @@ void RegionCN470AInitDefaults( InitType_t type )
             Channels[5] = ( ChannelParams_t ) CN470A_LC6;
             Channels[6] = ( ChannelParams_t ) CN470A_LC7;
             Channels[7] = ( ChannelParams_t ) CN470A_LC8;
+            ChannelsRxFreqBand = CN470A_NB_FREQBANDS;
 
             // Initialize the channels default mask
             ChannelsDefaultMask[0] = (LC( 1 ) + LC( 2 ) + LC( 3 ) + LC( 4 ) + LC( 5 ) + LC( 6 ) + LC( 7 ) + LC( 8 )) << 8 ;
@@ -509,7 +536,7 @@ bool RegionCN470AAdrNext( AdrNextParams_t *adrNext, int8_t *drOut, int8_t *txPow
 void RegionCN470AComputeRxWindowParameters( int8_t datarate, uint8_t minRxSymbols, uint32_t rxError,
                                             RxConfigParams_t *rxConfigParams )
 {
-    double tSymbol = 0.0;
+    RegionSymbolTime_t tSymbol = 0;
 
     rxConfigParams->Datarate = datarate;
     rxConfigParams->Bandwidth = GetBandwidth( datarate );
@@ -523,7 +550,7 @@ void RegionCN470AComputeRxWindowParameters( int8_t datarate, uint8_t minRxSymbol
     }
 
     RegionCommonComputeRxWindowParameters( tSymbol, minRxSymbols, rxError, RADIO_WAKEUP_TIME,
-                                           &rxConfigParams->WindowTimeout, &rxConfigParams->WindowOffset );
+                                           &rxConfigParams->WindowTimeout, &rxConfigParams->WindowOffset, &rxConfigParams->WindowOffsetUs );
 }
 
 bool RegionCN470ARxConfig( RxConfigParams_t *rxConfig, int8_t *datarate )
@@ -552,10 +579,11 @@ bool RegionCN470ARxConfig( RxConfigParams_t *rxConfig, int8_t *datarate )
     if (rxConfig->RxSlot == RX_SLOT_WIN_2) {
         uint8_t uldl_mode;
         lwan_dev_config_get(DEV_CONFIG_ULDL_MODE, &uldl_mode);
+        // The inter frequency RX2 is on the band of the other half
         if (uldl_mode == ULDL_MODE_INTER) {
-            frequency = 470300000 + (InterFreqRx2Chan[TxFreqBandNum]) * 200000;
+            frequency = CN470A_FREQBAND_RX2_FREQ(TxFreqBandNum ^ 8);
         } else {
-            frequency = 470300000 + (IntraFreqRx2Chan[TxFreqBandNum]) * 200000;
+            frequency = CN470A_FREQBAND_RX2_FREQ(TxFreqBandNum);
         }
     }
 
@@ -660,6 +688,10 @@ uint8_t RegionCN470ALinkAdrReq( LinkAdrReqParams_t *linkAdrReq, int8_t *drOut, i
     uint16_t chMaskNew[8] = {0};
     ChanMaskSetParams_t chanMaskSet;
 
+    // The requests of the block update a copy of the mask, set once the whole block is valid
+    RegionCommonChanMaskCopy(chMaskNew, ChannelsMask, CHANNELS_MASK_SIZE );
+    chanMaskSet.ChannelsMaskIn = chMaskNew;
+
     while ( bytesProcessed < linkAdrReq->PayloadSize ) {
         // Get ADR request parameters
         nextIndex = RegionCommonParseLinkAdrReq( &( linkAdrReq->Payload[bytesProcessed] ), &linkAdrParams );
@@ -671,32 +703,21 @@ uint8_t RegionCN470ALinkAdrReq( LinkAdrReqParams_t *linkAdrReq, int8_t *drOut, i
         // Update bytes processed
         bytesProcessed += nextIndex;
 
-        // Revert status, as we only check the last ADR request for the channel mask KO
-        status = 0x07;
-
         // Setup temporary channels mask
         chMask = linkAdrParams.ChMask;
 
-        // Verify channels mask
-        if (linkAdrParams.ChMaskCtrl > 7)
-        {
-            status &= 0xFE; // Channel Ctrl KO
-        }
+        // Verify channels mask, ChMaskCtrl holds 3 bits
         bandNum = ChMaskCntlToStartBandNum[linkAdrParams.ChMaskCtrl];
         if (bandNum == CHANNELS_MASK_CNTL_RFU)
         {
             status &= 0xFE; // Channel Ctrl KO
-        }
-        if ( (( linkAdrParams.ChMaskCtrl == 0 ) && ( chMask == 0 )) ||
+        } else if ( (( linkAdrParams.ChMaskCtrl == 0 ) && ( chMask == 0 )) ||
              (( bandNum == CHANNELS_MASK_ALL_ON ) && ( chMask != 0xFFFF )) ) {
             status &= 0xFE; // Channel mask KO
         } else if ( bandNum == CHANNELS_MASK_ALL_ON ) {
             memset((uint8_t *)chMaskNew, 0xFF, sizeof(chMaskNew));
-            chanMaskSet.ChannelsMaskIn = chMaskNew;
         } else {
-            RegionCommonChanMaskCopy(chMaskNew, ChannelsMask, CHANNELS_MASK_SIZE );
             chMaskNew[bandNum / 2] = chMask;
-            chanMaskSet.ChannelsMaskIn = chMaskNew;
         }
     }
 
@@ -1019,10 +1040,13 @@ bool RegionCN470ANextChannel( NextChanParams_t *nextChanParams, uint8_t *channel
 
 
     //update the freq due to the change of FreqBand Num
-    for ( uint8_t i = 0; i < CN470A_MAX_NB_CHANNELS; i++ ) {
-        Channels[i].Frequency = 470300000 + (FreqBandStartChannelNum[nextChanParams->NextAvailableRxFreqBandNum] + i) * 200000;
-        TxChannels[i].Frequency = 470300000 + (FreqBandStartChannelNum[nextChanParams->NextAvailableTxFreqBandNum] + i) *
-                                  200000;
+    if (RxFreqBandNum != ChannelsRxFreqBand || TxFreqBandNum != ChannelsTxFreqBand) {
+        for ( uint8_t i = 0; i < CN470A_MAX_NB_CHANNELS; i++ ) {
+            Channels[i].Frequency = CN470A_FREQBAND_CHANNEL_FREQ(RxFreqBandNum, i);
+            TxChannels[i].Frequency = CN470A_FREQBAND_CHANNEL_FREQ(TxFreqBandNum, i);
+        }
+        ChannelsRxFreqBand = RxFreqBandNum;
+        ChannelsTxFreqBand = TxFreqBandNum;
     }
 
     return true;
@@ -1088,6 +1112,7 @@ LoRaMacStatus_t RegionCN470AChannelAdd( ChannelAddParams_t *channelAdd )
 
     memcpy( &(Channels[id]), channelAdd->NewChannel, sizeof( Channels[id] ) );
     Channels[id].Band = band;
+    ChannelsRxFreqBand = CN470A_NB_FREQBANDS;
     *((uint8_t *)ChannelsMask + TxFreqBandNum) |= ( 1 << id );
     return LORAMAC_STATUS_OK;
 }
@@ -1106,6 +1131,7 @@ bool RegionCN470AChannelsRemove( ChannelRemoveParams_t *channelRemove  )
     Channels[id] = ( ChannelParams_t ) {
         0, 0, { 0 }, 0
     };
+    ChannelsRxFreqBand = CN470A_NB_FREQBANDS;
 
     return RegionCommonChanDisable( &channelMaskOfBand, id, CN470A_MAX_NB_CHANNELS );
 }
@@ -45,6 +45,32 @@
  */
 #define CN470A_MAX_NB_CHANNELS                       8
 
+/*!
+ * Number of frequency bands, of CN470A_MAX_NB_CHANNELS channels each
+ */
+#define CN470A_NB_FREQBANDS                          16
+
+/*!
+ * Channel spacing within a frequency band
+ */
+#define CN470A_CHANNEL_STEPWIDTH                     200000
+
+/*!
+ * Frequency of a channel of a frequency band
+ */
+#define CN470A_FREQBAND_CHANNEL_FREQ( band, channel ) \
+    ( CN470AFreqBandFirstFreq[band] + ( uint32_t )( channel ) * CN470A_CHANNEL_STEPWIDTH )
+
+/*!
+ * RX2 frequency of a frequency band, on its last channel
+ */
+#define CN470A_FREQBAND_RX2_FREQ( band )             CN470A_FREQBAND_CHANNEL_FREQ( band, CN470A_MAX_NB_CHANNELS - 1 )
+
+/*!
+ * First frequency of each frequency band
+ */
+extern const uint32_t CN470AFreqBandFirstFreq[CN470A_NB_FREQBANDS];
+
 /*!
  * Number of default channels
  */
@@ -21,6 +21,8 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jaeckle ( STACKFORCE )
 */
+#define LOG_MODULE LOG_MODULE_MAC
+
 #include <stdbool.h>
 #include <string.h>
 #include <stdint.h>
@@ -30,6 +32,9 @@ Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jae
 #include "region/Region.h"
 #include "LoRaMacClassB.h"
 #include "LoRaMacCrypto.h"
+#include "profile.h"
+#include "stats.h"
+#include "radio-arbiter.h"
 #include "log.h"  
 #include "stdio.h"
 #ifdef CONFIG_LWAN
@@ -37,11 +42,25 @@ Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jae
 #endif
 #include "LoRaMacTest.h"
 #include "LoRaMacConfirmQueue.h"
+#if defined( CONFIG_LORAMAC_TX_QUEUE ) && defined( CONFIG_POOL )
+#include "pool.h"
+#endif
+#if defined( CONFIG_RTC_DISCIPLINE ) || defined( CONFIG_LORA_EVENT_TIMESTAMP )
+#include "rtc-board.h"
+#endif
+#ifdef CONFIG_CLOCK_SYNC
+#include "clock-sync.h"
+#endif
+#ifdef CONFIG_KEY_SLOTS
+#include "key-slot.h"
+#endif
 
 /*!
- * Maximum PHY layer payload size
+ * Number of frame buffers lent to the radio for reception
  */
-#define LORAMAC_PHY_MAXPAYLOAD                      255
+#ifndef LORAMAC_RX_BUFFER_COUNT
+#define LORAMAC_RX_BUFFER_COUNT                     2
+#endif
 
 /*!
  * Maximum MAC commands buffer size
@@ -79,6 +98,27 @@ static LoRaMacRegion_t LoRaMacRegion;
 #define LORA_CAD_DELAY  1   //delay 1ms after CAD
 #endif
 
+#ifdef CONFIG_LORA_LBT_ASYNC
+/*!
+ * Random delay before the next channel is sensed when the last one was busy [ms]
+ */
+#ifndef LORA_LBT_RETRY_DELAY_MAX
+#define LORA_LBT_RETRY_DELAY_MAX                    20
+#endif
+#endif
+
+#ifdef CONFIG_LORAMAC_RX_PREARM
+#ifndef CONFIG_LORA_SHADOW_REGS
+#error "CONFIG_LORAMAC_RX_PREARM needs CONFIG_LORA_SHADOW_REGS"
+#endif
+/*!
+ * Radio setup time a pre-armed RX window saves, it opens that much later [us]
+ */
+#ifndef LORAMAC_RX_PREARM_TIME
+#define LORAMAC_RX_PREARM_TIME                      500
+#endif
+#endif
+
 /*!
  * Device IEEE EUI
  */
@@ -94,6 +134,13 @@ static uint8_t *LoRaMacAppEui;
  */
 static uint8_t *LoRaMacAppKey;
 
+#ifdef CONFIG_KEY_SLOTS
+/*!
+ * Session keys held in their key slots, derived there by the join
+ */
+#define LoRaMacNwkSKey                              KeySlotKey( KEY_SLOT_NWK_S_KEY )
+#define LoRaMacAppSKey                              KeySlotKey( KEY_SLOT_APP_S_KEY )
+#else
 /*!
  * AES encryption/decryption cipher network session key
  */
@@ -109,6 +156,7 @@ static uint8_t LoRaMacAppSKey[] = {
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
+#endif
 
 /*!
  * Device nonce is a random value extracted by issuing a sequence of RSSI
@@ -131,6 +179,12 @@ static uint32_t LoRaMacDevAddr;
  */
 static MulticastParams_t *MulticastChannels = NULL;
 
+/*!
+ * Linked multicast channels by increasing address, searched on the downlinks
+ */
+static MulticastParams_t *MulticastIndex[LORAMAC_MULTICAST_MAX];
+static uint8_t MulticastCount = 0;
+
 /*!
  * Actual device class
  */
@@ -156,10 +210,284 @@ static uint16_t LoRaMacBufferPktLen = 0;
  */
 static uint8_t LoRaMacTxPayloadLen = 0;
 
+#ifdef CONFIG_LORAMAC_PREBUILD
+/*!
+ * MAC state PrepareFrame depends on and updates, besides the frame buffer
+ */
+typedef struct sLoRaMacTxState
+{
+    uint32_t UpLinkCounter;
+    uint32_t AdrAckCounter;
+    uint32_t DevAddr;
+    uint8_t NwkSKey[16];
+    uint8_t AppSKey[16];
+    int8_t Datarate;
+    int8_t TxPower;
+    uint8_t UplinkDwellTime;
+    bool Joined;
+    bool AdrCtrlOn;
+    bool SrvAckRequested;
+    bool MacCommandsInNextTx;
+    uint8_t MacCommandsBufferIndex;
+    uint8_t MacCommandsBufferToRepeatIndex;
+    uint8_t MacCommandsBuffer[LORA_MAC_COMMAND_MAX_LENGTH];
+    uint8_t MacCommandsBufferToRepeat[LORA_MAC_COMMAND_MAX_LENGTH];
+}LoRaMacTxState_t;
+
+/*!
+ * Uplink built ahead by LoRaMacMcpsPrebuild, held in LoRaMacBuffer
+ */
+typedef struct sLoRaMacStaged
+{
+    /*!
+     * Set while LoRaMacBuffer holds the frame, cleared by any PrepareFrame
+     */
+    bool Valid;
+    uint8_t MacHdr;
+    /*!
+     * Frame control given to PrepareFrame and the one it built
+     */
+    uint8_t FCtrlIn;
+    uint8_t FCtrlOut;
+    uint8_t FPort;
+    uint16_t FBufferSize;
+    /*!
+     * Application payload the frame has been built from
+     */
+    uint8_t FBuffer[LORAMAC_PHY_MAXPAYLOAD];
+    bool NodeAckRequested;
+    uint8_t TxPayloadLen;
+    uint16_t PktLen;
+    /*!
+     * MAC state before and after building the frame
+     */
+    LoRaMacTxState_t Before;
+    LoRaMacTxState_t After;
+}LoRaMacStaged_t;
+
+static LoRaMacStaged_t LoRaMacStaged;
+#endif
+
+#ifdef CONFIG_LORAMAC_TX_QUEUE
+/*!
+ * Delay before sending the next uplink again when the MAC was busy [ms]
+ */
+#ifndef LORAMAC_TX_QUEUE_RETRY_DELAY
+#define LORAMAC_TX_QUEUE_RETRY_DELAY                1000
+#endif
+
+/*!
+ * Queued uplink
+ */
+typedef struct sLoRaMacTxQueueEntry
+{
+    /*!
+     * Request, the payload pointing to Buffer
+     */
+    McpsReq_t Request;
+#ifdef CONFIG_POOL
+    /*!
+     * Pool block sized to the payload, NULL without payload
+     */
+    uint8_t *Buffer;
+#else
+    uint8_t Buffer[LORAMAC_TX_QUEUE_PAYLOAD_SIZE];
+#endif
+    LoRaMacTxConfirm_t Confirm;
+    void *Context;
+}LoRaMacTxQueueEntry_t;
+
+static LoRaMacTxQueueEntry_t LoRaMacTxQueue[LORAMAC_TX_QUEUE_SIZE];
+
+/*!
+ * Entries taken and added, the queue holds TxQueueTail - TxQueueHead entries.
+ * The head is only moved from the timer context, the tail by the upper layer
+ */
+static volatile uint8_t TxQueueHead = 0;
+static volatile uint8_t TxQueueTail = 0;
+
+/*!
+ * Set while the head entry is the MCPS request in progress
+ */
+static bool TxQueueInFlight = false;
+
+/*!
+ * Sends the next queued uplink, from the timer context
+ */
+static TimerEvent_t TxQueueTimer;
+#endif
+
+#ifdef CONFIG_LORAMAC_FAST_INDICATION
+/*!
+ * Fast indication of Class C downlinks and its FPort
+ */
+static LoRaMacFastIndication_t FastIndication = NULL;
+static uint8_t FastIndicationPort = 0;
+
+/*!
+ * Set once a fast indication opened the continuous RX2 window again
+ */
+static bool FastIndicationRxOpen = false;
+#endif
+
+/*!
+ * Frame buffers the radio receives into. Downlinks are decrypted in place
+ * and handed to the upper layer without copy
+ */
+static uint8_t LoRaMacRxBuffers[LORAMAC_RX_BUFFER_COUNT][LORAMAC_PHY_MAXPAYLOAD];
+
+/*!
+ * Bit n set while LoRaMacRxBuffers[n] carries an indication for the upper layer
+ */
+static uint8_t LoRaMacRxBuffersBusy = 0;
+
+/*!
+ * Bit n set while the upper layer holds LoRaMacRxBuffers[n] past the indication
+ */
+static uint8_t LoRaMacRxBuffersHeld = 0;
+
+/*!
+ * Index of the buffer lent to the radio, LORAMAC_RX_BUFFER_COUNT when none
+ */
+static uint8_t LoRaMacRxBufferLent = LORAMAC_RX_BUFFER_COUNT;
+
+/*!
+ * Class C downlink preamble length, 0 keeps the continuous RX2 window in full RX
+ */
+static uint16_t ClassCRxPreamble = 0;
+
+#ifdef CONFIG_LORAMAC_MAC_CMD_DEFER
+/*!
+ * Default deadline of the sticky MAC answers [ms], \ref MIB_MAC_CMD_DEFER
+ */
+#ifndef LORAMAC_MAC_CMD_DEFER_DEFAULT
+#define LORAMAC_MAC_CMD_DEFER_DEFAULT               60000
+#endif
+
+/*!
+ * Deadline of the sticky MAC answers, 0 schedules an uplink right away
+ */
+static uint32_t MacCmdDefer = LORAMAC_MAC_CMD_DEFER_DEFAULT;
+
+/*!
+ * Deadline of the sticky MAC answers waiting for an application uplink
+ */
+static TimerEvent_t MacCmdDeferTimer;
+#endif
+
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+/*!
+ * First back-off window of the default retransmission policy [ms], doubled
+ * on each retransmission
+ */
+#ifndef LORAMAC_RETRY_BACKOFF_MIN
+#define LORAMAC_RETRY_BACKOFF_MIN                   1000
+#endif
+
+/*!
+ * Largest back-off window of the default retransmission policy [ms]
+ */
+#ifndef LORAMAC_RETRY_BACKOFF_MAX
+#define LORAMAC_RETRY_BACKOFF_MAX                   32000
+#endif
+
+/*!
+ * Time on air budget of an uplink and its retransmissions [ms]
+ */
+#ifndef LORAMAC_RETRY_AIRTIME_BUDGET
+#define LORAMAC_RETRY_AIRTIME_BUDGET                10000
+#endif
+
+/*!
+ * Acknowledgement rates, out of 256, above which the losses are taken as
+ * collisions and below which as a weak link
+ */
+#define LORAMAC_RETRY_RATE_GOOD                     192
+#define LORAMAC_RETRY_RATE_POOR                     128
+
+/*!
+ * Channel selections tried for a retransmission on another channel
+ */
+#define LORAMAC_RETRY_CHANNEL_TRIALS                4
+
+/*!
+ * Retransmission policy in use
+ */
+static const LoRaMacRetryPolicy_t *RetryPolicy = &LoRaMacRetryPolicyDefault;
+
+/*!
+ * Time on air of the uplink in progress and its retransmissions
+ */
+static uint32_t RetryAirTime = 0;
+
+/*!
+ * Delay and channel choice of the next retransmission
+ */
+static uint32_t RetryDelay = 0;
+static bool RetryAvoidChannel = false;
+
+/*!
+ * Smoothed acknowledgement rate of the default policy, out of 256
+ */
+static uint16_t RetryAckRate = LORAMAC_RETRY_RATE_GOOD;
+#endif
+
+#ifdef CONFIG_LORAMAC_LINK_ADR
+/*!
+ * Number of link samples the device side ADR keeps
+ */
+#ifndef LORAMAC_LINK_ADR_WINDOW
+#define LORAMAC_LINK_ADR_WINDOW                     8
+#endif
+
+/*!
+ * Number of link samples needed before the device side ADR leaves the
+ * datarate and TX power of the application
+ */
+#ifndef LORAMAC_LINK_ADR_SAMPLES_MIN
+#define LORAMAC_LINK_ADR_SAMPLES_MIN                3
+#endif
+
+/*!
+ * Margin kept above the demodulation floor [dB]
+ */
+#ifndef LORAMAC_LINK_ADR_MARGIN
+#define LORAMAC_LINK_ADR_MARGIN                     10
+#endif
+
+/*!
+ * Age after which the link samples are dropped [ms]
+ */
+#ifndef LORAMAC_LINK_ADR_MAX_AGE
+#define LORAMAC_LINK_ADR_MAX_AGE                    ( 24UL * 3600UL * 1000UL )
+#endif
+
+/*!
+ * Output power step between two TX power indexes [dB]
+ */
+#define LORAMAC_LINK_ADR_TX_POWER_STEP              2
+
 /*!
- * Buffer containing the upper layer data.
+ * Device side ADR context
  */
-static uint8_t LoRaMacRxPayload[LORAMAC_PHY_MAXPAYLOAD];
+typedef struct sLoRaMacLinkAdr
+{
+    bool Enable;
+    /*!
+     * SNR of the recent downlinks and link check answers [dB]
+     */
+    int8_t Snr[LORAMAC_LINK_ADR_WINDOW];
+    uint8_t NbSamples;
+    uint8_t Next;
+    TimerTime_t LastSample;
+    /*!
+     * TX power set by the application, the power reduction starts from it
+     */
+    int8_t BaseTxPower;
+}LoRaMacLinkAdr_t;
+
+static LoRaMacLinkAdr_t LinkAdr;
+#endif
 
 /*!
  * LoRaMAC frame counter. Each time a packet is sent the counter is incremented.
@@ -173,6 +501,12 @@ static uint32_t UpLinkCounter = 0;
  */
 static uint32_t DownLinkCounter = 0;
 
+/*!
+ * A frame was received at DownLinkCounter, a repetition of FCnt 0 is then
+ * told from the first frame of the session
+ */
+static bool DownLinkCounterValid = false;
+
 /*!
  * IsPacketCounterFixed enables the MIC field tests by fixing the
  * UpLinkCounter value
@@ -226,6 +560,17 @@ static uint8_t MacCommandsBufferIndex = 0;
  */
 static uint8_t MacCommandsBufferToRepeatIndex = 0;
 
+/*!
+ * Maximum payload of each datarate, 0 until looked up in the region. Valid
+ * for the dwell time and repeater setting of MaxPayloadCacheKey
+ */
+static uint8_t MaxPayloadCache[DR_15 + 1];
+
+/*!
+ * Setting the maximum payloads have been looked up for, 0xFF when none
+ */
+static uint8_t MaxPayloadCacheKey = 0xFF;
+
 /*!
  * Buffer containing the MAC layer commands
  */
@@ -293,6 +638,13 @@ static TimerTime_t LoRaMacInitializationTime = 0;
 
 static TimerSysTime_t LastTxSysTime = { 0 };
 
+#ifdef CONFIG_RTC_DISCIPLINE
+/*!
+ * RTC time of the last TX done, the local side of a DeviceTimeAns sample
+ */
+static TimerTime_t LastTxRtcTime = 0;
+#endif
+
 /*!
  * LoRaMac internal states
  */
@@ -355,6 +707,14 @@ static TimerEvent_t RxWindowTimer2;
 static uint32_t RxWindow1Delay;
 static uint32_t RxWindow2Delay;
 
+#ifdef CONFIG_TIMER_PRECISE
+/*!
+ * LoRaMac reception windows delay [us], scheduled on the precise timer
+ */
+static int32_t RxWindow1DelayUs;
+static int32_t RxWindow2DelayUs;
+#endif
+
 /*!
  * LoRaMac Rx windows configuration
  */
@@ -441,11 +801,36 @@ static void OnRadioTxDone( void );
  */
 static void PrepareRxDoneAbort( void );
 
+/*!
+ * \brief Lends a free frame buffer to the radio if it has none
+ */
+static void LoRaMacRxBufferLend( void );
+
+/*!
+ * \brief Marks the buffer lent to the radio as carrying an indication and
+ *        lends the radio another one
+ */
+static void LoRaMacRxBufferPass( void );
+
+/*!
+ * \brief Gets the pool index of a frame buffer
+ *
+ * \retval index LORAMAC_RX_BUFFER_COUNT when the buffer is not part of the pool
+ */
+static uint8_t LoRaMacRxBufferIndex( uint8_t *buffer );
+
 /*!
  * \brief Function to be executed on Radio Rx Done event
  */
 static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr );
 
+/*!
+ * \brief Function executed once the radio has read the MHDR and DevAddr of a frame
+ *
+ * \retval accept false for data downlinks addressed to another device
+ */
+static bool OnRadioRxFilter( uint8_t *header, uint16_t size );
+
 /*!
  * \brief Function executed on Radio Tx Timeout event
  */
@@ -466,11 +851,24 @@ static void OnRadioCadDone( bool channelActivityDetected );
 static void OnTxImmediateTimerEvent( void );
 #endif
 
+#ifdef CONFIG_LORA_LBT_ASYNC
+/*!
+ * \brief Function executed on Radio carrier sense done event
+ */
+static void OnRadioCarrierSenseDone( bool channelFree );
+#endif
+
 /*!
  * \brief Function executed on Resend Frame timer event.
  */
 static void OnMacStateCheckTimerEvent( void );
 
+/*!
+ * \brief Runs OnMacStateCheckTimerEvent as soon as possible, raised by the
+ *        radio and timer handlers on each MAC state change.
+ */
+static void SetMacStateCheckEvent( void );
+
 /*!
  * \brief Function executed on duty cycle delayed Tx  timer event
  */
@@ -512,6 +910,32 @@ static void OnAckTimeoutTimerEvent( void );
  */
 static void RxWindowSetup( bool rxContinuous, uint32_t maxRxWindow );
 
+/*!
+ * \brief Fills RxWindow1Config from the MAC parameters and the channel
+ */
+static void RxWindow1ConfigUpdate( void );
+
+/*!
+ * \brief Fills RxWindow2Config from the MAC parameters and the device class
+ */
+static void RxWindow2ConfigUpdate( void );
+
+#ifdef CONFIG_LORAMAC_RX_PREARM
+/*!
+ * \brief Configures the radio for an RX window ahead of it, while the radio
+ *        is still in standby before its sleep
+ *
+ * \remark The warm start sleep keeps the commands, the window configures the
+ *         radio again and the shadows of CONFIG_LORA_SHADOW_REGS skip those
+ *         unchanged, the window mostly starts the reception. Should the
+ *         radio have been used in between, the window sends the whole
+ *         configuration as without pre-arming.
+ *
+ * \param [IN] rxConfig RX window configuration
+ */
+static void RxWindowPrearm( RxConfigParams_t *rxConfig );
+#endif
+
 /*!
  * \brief Verifies if sticky MAC commands are pending.
  *
@@ -525,6 +949,18 @@ static bool IsStickyMacCommandPending( void );
  */
 static void SetMlmeScheduleUplinkIndication( void );
 
+#ifdef CONFIG_LORAMAC_MAC_CMD_DEFER
+/*!
+ * \brief Verifies if sticky MAC commands are pending, the new ones included
+ */
+static bool IsStickyMacCommandQueued( void );
+
+/*!
+ * \brief Function executed on the sticky MAC answers deadline
+ */
+static void OnMacCmdDeferTimerEvent( void );
+#endif
+
 /*!
  * \brief Switches the device class
  *
@@ -583,6 +1019,16 @@ static uint8_t ParseMacCommandsToRepeat( uint8_t *cmdBufIn, uint8_t length, uint
  */
 static bool ValidatePayloadLength( uint8_t lenN, int8_t datarate, uint8_t fOptsLen );
 
+/*!
+ * \brief Maximum payload of a datarate, from the region on the first call
+ *        for the current dwell time and repeater setting
+ *
+ * \param datarate Datarate
+ *
+ * \retval maxN Maximum MAC payload size, fOpts included
+ */
+static uint8_t GetMaxPayload( int8_t datarate );
+
 /*!
  * \brief Decodes MAC commands in the fOpts field and in the payload
  *
@@ -693,52 +1139,215 @@ static bool IsFPortAllowed( uint8_t fPort );
  */
 static void OpenContinuousRx2Window( void );
 
-static void OnRadioTxDone( void )
-{
-    GetPhyParams_t getPhy;
-    PhyParam_t phyParam;
-    SetBandTxDoneParams_t txDone;
-    TimerTime_t curTime = TimerGetCurrentTime( );
-    LastTxSysTime = TimerGetSysTime( );
+/*!
+ * \brief Initializes the frame control field of an uplink
+ *
+ * \param [OUT] fCtrl    Frame control field
+ */
+static void InitFrameCtrl( LoRaMacFrameCtrl_t *fCtrl );
 
-    if( LoRaMacDeviceClass != CLASS_C )
-    {
-        Radio.Sleep( );
-    }
-    else
-    {
-        OpenContinuousRx2Window( );
-    }
+#ifdef CONFIG_LORAMAC_PREBUILD
+/*!
+ * \brief Saves the MAC state a frame is built from
+ *
+ * \param [OUT] state    Saved state
+ */
+static void LoRaMacTxStateSave( LoRaMacTxState_t *state );
 
-    // Setup timers
-    if ( IsRxWindowsEnabled == true ) {
-        TimerSetValue( &RxWindowTimer1, RxWindow1Delay );
-        TimerStart( &RxWindowTimer1 );
-        if ( LoRaMacDeviceClass != CLASS_C ) {
-            TimerSetValue( &RxWindowTimer2, RxWindow2Delay );
-            TimerStart( &RxWindowTimer2 );
-        }
-        if ( ( LoRaMacDeviceClass == CLASS_C ) || ( NodeAckRequested == true ) ) {
-            getPhy.Attribute = PHY_ACK_TIMEOUT;
-            phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
-            TimerSetValue( &AckTimeoutTimer, RxWindow2Delay + phyParam.Value );
-            TimerStart( &AckTimeoutTimer );
-        }
-    } else {
-        McpsConfirm.Status = LORAMAC_EVENT_INFO_STATUS_OK;
-        LoRaMacConfirmQueueSetStatusCmn( LORAMAC_EVENT_INFO_STATUS_RX2_TIMEOUT );
+/*!
+ * \brief Restores a saved MAC state
+ *
+ * \param [IN] state     Saved state
+ */
+static void LoRaMacTxStateRestore( const LoRaMacTxState_t *state );
 
-        if ( LoRaMacFlags.Value == 0 ) {
-            LoRaMacFlags.Bits.McpsReq = 1;
-        }
-        LoRaMacFlags.Bits.MacDone = 1;
-    }
+/*!
+ * \brief Tells if the MAC state is the saved one
+ *
+ * \param [IN] state     Saved state
+ *
+ * \retval [false: the state changed, true: the state is the same]
+ */
+static bool LoRaMacTxStateEqual( const LoRaMacTxState_t *state );
 
-    // Verify if the last uplink was a join request
-    if ( ( LoRaMacFlags.Bits.MlmeReq == 1 ) && ( LoRaMacConfirmQueueIsCmdActive( MLME_JOIN ) == true ) ) {
-        LastTxIsJoinRequest = true;
-    } else {
-        LastTxIsJoinRequest = false;
+/*!
+ * \brief Sends the staged frame when it has been built from the same request
+ *        and MAC state, prepares the frame otherwise
+ *
+ * \param [IN] macHdr      MAC header field
+ * \param [IN] fCtrl       MAC frame control field
+ * \param [IN] fPort       MAC payload port
+ * \param [IN] fBuffer     MAC data buffer to be sent
+ * \param [IN] fBufferSize MAC data buffer size
+ * \retval status          Status of the operation.
+ */
+static LoRaMacStatus_t PrepareStagedFrame( LoRaMacHeader_t *macHdr, LoRaMacFrameCtrl_t *fCtrl, uint8_t fPort, void *fBuffer,
+                                           uint16_t fBufferSize );
+#endif
+
+#ifdef CONFIG_LORAMAC_TX_QUEUE
+/*!
+ * \brief Gives the MCPS-Confirm of the uplink in progress to its entry and
+ *        takes the entry out of the queue
+ *
+ * \param [IN] mcpsConfirm MCPS-Confirm of the uplink
+ */
+static void TxQueueConfirm( McpsConfirm_t *mcpsConfirm );
+
+/*!
+ * \brief Takes the head entry out of the queue
+ */
+static void TxQueuePop( void );
+
+/*!
+ * \brief Requests the next queued uplink once the MAC is idle
+ */
+static void TxQueueNext( void );
+
+/*!
+ * \brief Function executed on TxQueueTimer expiry
+ */
+static void OnTxQueueTimerEvent( void );
+#endif
+
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+/*!
+ * \brief Asks the retransmission policy for the next retransmission and
+ *        applies its datarate
+ *
+ * \retval retry False when the policy gives the uplink up
+ */
+static bool RetryPolicyNext( void );
+
+/*!
+ * \brief Schedules the retransmission after the delay of the policy
+ *
+ * \retval status Status of the operation.
+ */
+static LoRaMacStatus_t ScheduleRetry( void );
+#endif
+
+#ifdef CONFIG_LORAMAC_LINK_ADR
+/*!
+ * \brief Adds a link sample to the device side ADR window
+ *
+ * \param [IN] snr SNR of the link [dB]
+ */
+static void LinkAdrAddSample( int8_t snr );
+
+/*!
+ * \brief Applies the datarate and TX power of the device side ADR to the
+ *        next uplink, over the datarate the application requested
+ */
+static void LinkAdrApply( void );
+
+/*!
+ * \brief Best SNR of the link samples [dB]
+ */
+static int8_t LinkAdrBestSnr( void );
+
+/*!
+ * \brief Demodulation floor of a datarate of the region
+ *
+ * \param [IN] datarate Datarate
+ *
+ * \retval floor SNR floor [0.1 dB], INT16_MAX when the datarate is not a
+ *               LoRa 125 kHz one
+ */
+static int16_t LinkAdrDemodFloor( int8_t datarate );
+#endif
+
+static void OnRadioTxDone( void )
+{
+    GetPhyParams_t getPhy;
+    PhyParam_t phyParam;
+    SetBandTxDoneParams_t txDone;
+    TimerTime_t curTime = TimerGetCurrentTime( );
+#ifdef CONFIG_TIMER_PRECISE
+    TimerTime_t curTicks = TimerGetCurrentTicks( );
+#endif
+#ifdef CONFIG_LORA_EVENT_TIMESTAMP
+    // Back to the TX done interrupt, the callback runs from the main loop
+    TimerTime_t age = RtcTick2Ms( ( uint32_t )RtcGetTimerTicks( ) - Radio.GetEventTicks( ) );
+
+    curTime -= age;
+#ifdef CONFIG_TIMER_PRECISE
+    curTicks = Radio.GetEventTicks( );
+#endif
+    LastTxSysTime.Seconds = ( uint32_t )( curTime / 1000 );
+    LastTxSysTime.SubSeconds = ( int16_t )( curTime % 1000 );
+#else
+    LastTxSysTime = TimerGetSysTime( );
+#endif
+#ifdef CONFIG_RTC_DISCIPLINE
+    LastTxRtcTime = RtcGetTimerValue( );
+#ifdef CONFIG_LORA_EVENT_TIMESTAMP
+    LastTxRtcTime -= age;
+#endif
+#endif
+
+    if( LoRaMacDeviceClass != CLASS_C )
+    {
+#ifdef CONFIG_LORAMAC_RX_PREARM
+        if( IsRxWindowsEnabled == true )
+        {
+            RxWindow1ConfigUpdate( );
+            RxWindowPrearm( &RxWindow1Config );
+        }
+#endif
+        Radio.Sleep( );
+        RADIO_ARBITER_RELEASE( RADIO_ARBITER_LORAMAC );
+#ifdef CONFIG_RADIO_ARBITER
+        // Keeps the other owners off the radio ahead of the windows
+        if( IsRxWindowsEnabled == true )
+        {
+            RadioArbiterReserve( RADIO_ARBITER_LORAMAC, curTime + RxWindow1Delay );
+            RadioArbiterReserve( RADIO_ARBITER_LORAMAC, curTime + RxWindow2Delay );
+        }
+#endif
+    }
+    else
+    {
+        OpenContinuousRx2Window( );
+    }
+
+    // Setup timers
+    if ( IsRxWindowsEnabled == true ) {
+#ifdef CONFIG_TIMER_PRECISE
+        TimerStartPrecise( &RxWindowTimer1, curTicks, RxWindow1DelayUs );
+        if ( LoRaMacDeviceClass != CLASS_C ) {
+            TimerStartPrecise( &RxWindowTimer2, curTicks, RxWindow2DelayUs );
+        }
+#else
+        TimerSetValue( &RxWindowTimer1, RxWindow1Delay );
+        TimerStart( &RxWindowTimer1 );
+        if ( LoRaMacDeviceClass != CLASS_C ) {
+            TimerSetValue( &RxWindowTimer2, RxWindow2Delay );
+            TimerStart( &RxWindowTimer2 );
+        }
+#endif
+        if ( ( LoRaMacDeviceClass == CLASS_C ) || ( NodeAckRequested == true ) ) {
+            getPhy.Attribute = PHY_ACK_TIMEOUT;
+            phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+            TimerSetValue( &AckTimeoutTimer, RxWindow2Delay + phyParam.Value );
+            TimerStart( &AckTimeoutTimer );
+        }
+    } else {
+        McpsConfirm.Status = LORAMAC_EVENT_INFO_STATUS_OK;
+        LoRaMacConfirmQueueSetStatusCmn( LORAMAC_EVENT_INFO_STATUS_RX2_TIMEOUT );
+
+        if ( LoRaMacFlags.Value == 0 ) {
+            LoRaMacFlags.Bits.McpsReq = 1;
+        }
+        LoRaMacFlags.Bits.MacDone = 1;
+        SetMacStateCheckEvent( );
+    }
+
+    // Verify if the last uplink was a join request
+    if ( ( LoRaMacFlags.Bits.MlmeReq == 1 ) && ( LoRaMacConfirmQueueIsCmdActive( MLME_JOIN ) == true ) ) {
+        LastTxIsJoinRequest = true;
+    } else {
+        LastTxIsJoinRequest = false;
     }
 
     // Store last Tx channel
@@ -765,6 +1374,51 @@ static void OnRadioTxDone( void )
 
 }
 
+static void LoRaMacRxBufferLend( void )
+{
+    uint8_t i;
+
+    if( LoRaMacRxBufferLent < LORAMAC_RX_BUFFER_COUNT )
+    {
+        return;
+    }
+    for( i = 0; i < LORAMAC_RX_BUFFER_COUNT; i++ )
+    {
+        if( ( LoRaMacRxBuffersBusy & ( 1 << i ) ) == 0 )
+        {
+            LoRaMacRxBufferLent = i;
+            Radio.SetRxBuffer( LoRaMacRxBuffers[i], LORAMAC_PHY_MAXPAYLOAD );
+            return;
+        }
+    }
+    // Every buffer is held, downlinks are dropped until one is released
+    Radio.SetRxBuffer( NULL, 0 );
+}
+
+static void LoRaMacRxBufferPass( void )
+{
+    if( LoRaMacRxBufferLent < LORAMAC_RX_BUFFER_COUNT )
+    {
+        LoRaMacRxBuffersBusy |= 1 << LoRaMacRxBufferLent;
+        LoRaMacRxBufferLent = LORAMAC_RX_BUFFER_COUNT;
+        LoRaMacRxBufferLend( );
+    }
+}
+
+static uint8_t LoRaMacRxBufferIndex( uint8_t *buffer )
+{
+    uint8_t i;
+
+    for( i = 0; i < LORAMAC_RX_BUFFER_COUNT; i++ )
+    {
+        if( ( buffer >= LoRaMacRxBuffers[i] ) && ( buffer < LoRaMacRxBuffers[i] + LORAMAC_PHY_MAXPAYLOAD ) )
+        {
+            break;
+        }
+    }
+    return i;
+}
+
 static void PrepareRxDoneAbort( void )
 {
     LoRaMacState |= LORAMAC_RX_ABORT;
@@ -779,9 +1433,74 @@ static void PrepareRxDoneAbort( void )
     LoRaMacFlags.Bits.McpsInd = 1;
     LoRaMacFlags.Bits.MacDone = 1;
 
-    // Trig OnMacCheckTimerEvent call as soon as possible
-    TimerSetValue( &MacStateCheckTimer, 1 );
-    TimerStart( &MacStateCheckTimer );
+    SetMacStateCheckEvent( );
+}
+
+/*!
+ * \brief Position of the address in the multicast index, or of the first
+ *        greater address
+ */
+static uint8_t MulticastSearch( uint32_t address )
+{
+    uint8_t low = 0;
+    uint8_t high = MulticastCount;
+
+    while( low < high )
+    {
+        uint8_t mid = ( low + high ) >> 1;
+
+        if( MulticastIndex[mid]->Address < address )
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static MulticastParams_t *MulticastFind( uint32_t address )
+{
+    uint8_t pos = MulticastSearch( address );
+
+    if( ( pos < MulticastCount ) && ( MulticastIndex[pos]->Address == address ) )
+    {
+        return MulticastIndex[pos];
+    }
+    return NULL;
+}
+
+static bool OnRadioRxFilter( uint8_t *header, uint16_t size )
+{
+    LoRaMacHeader_t macHdr;
+    uint32_t address = 0;
+
+    // Beacons carry no MAC header
+    if( LoRaMacClassBIsBeaconExpected( ) == true )
+    {
+        return true;
+    }
+
+    macHdr.Value = header[0];
+    if( ( macHdr.Bits.MType != FRAME_TYPE_DATA_CONFIRMED_DOWN ) &&
+        ( macHdr.Bits.MType != FRAME_TYPE_DATA_UNCONFIRMED_DOWN ) )
+    {
+        return true;
+    }
+
+    address = header[1];
+    address |= ( ( uint32_t )header[2] << 8 );
+    address |= ( ( uint32_t )header[3] << 16 );
+    address |= ( ( uint32_t )header[4] << 24 );
+
+    if( ( address == LoRaMacDevAddr ) || ( MulticastFind( address ) != NULL ) )
+    {
+        return true;
+    }
+    // Foreign frame, OnRadioRxDone gets the header only and drops it on the address check
+    return false;
 }
 
 static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr )
@@ -804,6 +1523,7 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
     uint16_t sequenceCounterPrev = 0;
     uint16_t sequenceCounterDiff = 0;
     uint32_t downLinkCounter = 0;
+    bool downLinkCounterValid = false;
 
     MulticastParams_t *curMulticastParams = NULL;
     uint8_t *nwkSKey = LoRaMacNwkSKey;
@@ -813,6 +1533,8 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
 
     bool isMicOk = false;
 
+    PROFILE_START( PROFILE_MAC_RX_DONE );
+
     McpsConfirm.AckReceived = false;
 #ifdef CONFIG_LWAN  
     MlmeConfirm.Rssi = rssi;
@@ -836,6 +1558,10 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
 
     Radio.Sleep( );
     TimerStop( &RxWindowTimer2 );
+    RADIO_ARBITER_RELEASE( RADIO_ARBITER_LORAMAC );
+#ifdef CONFIG_RADIO_ARBITER
+    RadioArbiterCancel( RADIO_ARBITER_LORAMAC );
+#endif
     
     // This function must be called even if we are not in class b mode yet.
     if( LoRaMacClassBRxBeacon( payload, size ) == true )
@@ -844,8 +1570,10 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
         MlmeIndication.BeaconInfo.Snr = snr;
 		
         LOG_PRINTF(LL_VDEBUG, "receive beacon\r\n");
+        PROFILE_STOP( PROFILE_MAC_RX_DONE );
         return;
     }
+    STATS_INC( STATS_RX_FRAME );
     // Check if we expect a ping or a multicast slot.
     if( LoRaMacDeviceClass == CLASS_B )
     {
@@ -855,7 +1583,8 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
             LoRaMacClassBPingSlotTimerEvent( );
             McpsIndication.RxSlot = RX_SLOT_WIN_PING_SLOT;
         }
-        else if( LoRaMacClassBIsMulticastExpected( ) == true )
+        // A window shared by a ping slot and a multicast slot ends both
+        if( LoRaMacClassBIsMulticastExpected( ) == true )
         {
             LoRaMacClassBSetMulticastSlotState( PINGSLOT_STATE_SET_TIMER );
             LoRaMacClassBMulticastSlotTimerEvent( );
@@ -870,39 +1599,39 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
             if ( IsLoRaMacNetworkJoined == true ) {
                 McpsIndication.Status = LORAMAC_EVENT_INFO_STATUS_ERROR;
                 PrepareRxDoneAbort( );
+                PROFILE_STOP( PROFILE_MAC_RX_DONE );
                 return;
             }
-            LoRaMacJoinDecrypt( payload + 1, size - 1, LoRaMacAppKey, LoRaMacRxPayload + 1 );
+            // Decrypt in place, payload[0] already holds the MHDR
+            LoRaMacJoinDecrypt( payload + 1, size - 1, LoRaMacAppKey, payload + 1 );
 
-            LoRaMacRxPayload[0] = macHdr.Value;
+            LoRaMacJoinComputeMic( payload, size - LORAMAC_MFR_LEN, LoRaMacAppKey, &mic );
 
-            LoRaMacJoinComputeMic( LoRaMacRxPayload, size - LORAMAC_MFR_LEN, LoRaMacAppKey, &mic );
-
-            micRx |= ( uint32_t )LoRaMacRxPayload[size - LORAMAC_MFR_LEN];
-            micRx |= ( ( uint32_t )LoRaMacRxPayload[size - LORAMAC_MFR_LEN + 1] << 8 );
-            micRx |= ( ( uint32_t )LoRaMacRxPayload[size - LORAMAC_MFR_LEN + 2] << 16 );
-            micRx |= ( ( uint32_t )LoRaMacRxPayload[size - LORAMAC_MFR_LEN + 3] << 24 );
+            micRx |= ( uint32_t )payload[size - LORAMAC_MFR_LEN];
+            micRx |= ( ( uint32_t )payload[size - LORAMAC_MFR_LEN + 1] << 8 );
+            micRx |= ( ( uint32_t )payload[size - LORAMAC_MFR_LEN + 2] << 16 );
+            micRx |= ( ( uint32_t )payload[size - LORAMAC_MFR_LEN + 3] << 24 );
 
             if( LoRaMacConfirmQueueIsCmdActive( MLME_JOIN ) == true )
             {
                 if( micRx == mic ) {
-                    LoRaMacJoinComputeSKeys( LoRaMacAppKey, LoRaMacRxPayload + 1, LoRaMacDevNonce, LoRaMacNwkSKey, LoRaMacAppSKey );
+                    LoRaMacJoinComputeSKeys( LoRaMacAppKey, payload + 1, LoRaMacDevNonce, LoRaMacNwkSKey, LoRaMacAppSKey );
 
-                    LoRaMacNetID = ( uint32_t )LoRaMacRxPayload[4];
-                    LoRaMacNetID |= ( ( uint32_t )LoRaMacRxPayload[5] << 8 );
-                    LoRaMacNetID |= ( ( uint32_t )LoRaMacRxPayload[6] << 16 );
+                    LoRaMacNetID = ( uint32_t )payload[4];
+                    LoRaMacNetID |= ( ( uint32_t )payload[5] << 8 );
+                    LoRaMacNetID |= ( ( uint32_t )payload[6] << 16 );
 
-                    LoRaMacDevAddr = ( uint32_t )LoRaMacRxPayload[7];
-                    LoRaMacDevAddr |= ( ( uint32_t )LoRaMacRxPayload[8] << 8 );
-                    LoRaMacDevAddr |= ( ( uint32_t )LoRaMacRxPayload[9] << 16 );
-                    LoRaMacDevAddr |= ( ( uint32_t )LoRaMacRxPayload[10] << 24 );
+                    LoRaMacDevAddr = ( uint32_t )payload[7];
+                    LoRaMacDevAddr |= ( ( uint32_t )payload[8] << 8 );
+                    LoRaMacDevAddr |= ( ( uint32_t )payload[9] << 16 );
+                    LoRaMacDevAddr |= ( ( uint32_t )payload[10] << 24 );
 
                     // DLSettings
-                    LoRaMacParams.Rx1DrOffset = ( LoRaMacRxPayload[11] >> 4 ) & 0x07;
-                    LoRaMacParams.Rx2Channel.Datarate = LoRaMacRxPayload[11] & 0x0F;
+                    LoRaMacParams.Rx1DrOffset = ( payload[11] >> 4 ) & 0x07;
+                    LoRaMacParams.Rx2Channel.Datarate = payload[11] & 0x0F;
 
                     // RxDelay
-                    LoRaMacParams.ReceiveDelay1 = ( LoRaMacRxPayload[12] & 0x0F );
+                    LoRaMacParams.ReceiveDelay1 = ( payload[12] & 0x0F );
                     if( LoRaMacParams.ReceiveDelay1 == 0 ) {
                         LoRaMacParams.ReceiveDelay1 = 1;
                     }
@@ -913,7 +1642,7 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
                             	LoRaMacParams.Rx1DrOffset, LoRaMacParams.Rx2Channel.Datarate, (unsigned int)LoRaMacParams.ReceiveDelay1);
 
                     // Apply CF list
-                    applyCFList.Payload = &LoRaMacRxPayload[13];
+                    applyCFList.Payload = &payload[13];
                     // Size of the regular payload is 12. Plus 1 byte MHDR and 4 bytes MIC
                     applyCFList.Size = size - 17;
 
@@ -921,9 +1650,11 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
 
                     LoRaMacConfirmQueueSetStatus( LORAMAC_EVENT_INFO_STATUS_OK, MLME_JOIN );
                     IsLoRaMacNetworkJoined = true;
+                    STATS_DOWNLINK( McpsIndication.RxDatarate );
                 	//Joined save its DR using LoRaMacParams.ChannelsDatarate, if set it will be default
                 	//LoRaMacParams.ChannelsDatarate = LoRaMacParamsDefaults.ChannelsDatarate;
             	} else {
+                    STATS_INC( STATS_MIC_FAIL );
                     LoRaMacConfirmQueueSetStatus( LORAMAC_EVENT_INFO_STATUS_JOIN_FAIL, MLME_JOIN );
                 }
             }
@@ -943,6 +1674,7 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
             if ( MAX( 0, ( int16_t )( ( int16_t )size - ( int16_t )LORA_MAC_FRMPAYLOAD_OVERHEAD ) ) > phyParam.Value ) {
                 McpsIndication.Status = LORAMAC_EVENT_INFO_STATUS_ERROR;
                 PrepareRxDoneAbort( );
+                PROFILE_STOP( PROFILE_MAC_RX_DONE );
                 return;
             }
 
@@ -954,21 +1686,19 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
             fCtrl.Value = payload[pktHeaderLen++];
 
             if ( address != LoRaMacDevAddr ) {
-                curMulticastParams = MulticastChannels;
-                while ( curMulticastParams != NULL ) {
-                    if ( address == curMulticastParams->Address ) {
-                        multicast = 1;
-                        nwkSKey = curMulticastParams->NwkSKey;
-                        appSKey = curMulticastParams->AppSKey;
-                        downLinkCounter = curMulticastParams->DownLinkCounter;
-                        break;
-                    }
-                    curMulticastParams = curMulticastParams->Next;
+                curMulticastParams = MulticastFind( address );
+                if ( curMulticastParams != NULL ) {
+                    multicast = 1;
+                    nwkSKey = curMulticastParams->NwkSKey;
+                    appSKey = curMulticastParams->AppSKey;
+                    downLinkCounter = curMulticastParams->DownLinkCounter;
+                    downLinkCounterValid = curMulticastParams->DownLinkCounterValid;
                 }
                 if ( multicast == 0 ) {
                     // We are not the destination of this frame.
                     McpsIndication.Status = LORAMAC_EVENT_INFO_STATUS_ADDRESS_FAIL;
                     PrepareRxDoneAbort( );
+                    PROFILE_STOP( PROFILE_MAC_RX_DONE );
                     return;
                 }
                 if( ( macHdr.Bits.MType != FRAME_TYPE_DATA_UNCONFIRMED_DOWN ) ||
@@ -977,6 +1707,7 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
                     // Wrong multicast message format. Refer to chapter 11.2.2 of the specification
                     McpsIndication.Status = LORAMAC_EVENT_INFO_STATUS_MULTICAST_FAIL;
                     PrepareRxDoneAbort( );
+                    PROFILE_STOP( PROFILE_MAC_RX_DONE );
                     return;
                 }
             } else {
@@ -984,6 +1715,7 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
                 nwkSKey = LoRaMacNwkSKey;
                 appSKey = LoRaMacAppSKey;
                 downLinkCounter = DownLinkCounter;
+                downLinkCounterValid = DownLinkCounterValid;
             }
 
             sequenceCounter = ( uint16_t )payload[pktHeaderLen++];
@@ -999,6 +1731,30 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
             sequenceCounterPrev = ( uint16_t )downLinkCounter;
             sequenceCounterDiff = ( sequenceCounter - sequenceCounterPrev );
 
+            // Drop before the MIC the frames a valid MIC would not save: a
+            // counter out of the window, older ones included, an unconfirmed
+            // or multicast frame repeated. A repeated confirmed frame is
+            // acknowledged again, its MIC is still checked.
+            getPhy.Attribute = PHY_MAX_FCNT_GAP;
+            phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+            if ( sequenceCounterDiff >= phyParam.Value ) {
+                STATS_INC( STATS_RX_EARLY_DROP );
+                McpsIndication.Status = LORAMAC_EVENT_INFO_STATUS_DOWNLINK_TOO_MANY_FRAMES_LOSS;
+                McpsIndication.DownLinkCounter = ( sequenceCounterDiff < ( 1 << 15 ) ) ? downLinkCounter + sequenceCounterDiff : downLinkCounter;
+                PrepareRxDoneAbort( );
+                PROFILE_STOP( PROFILE_MAC_RX_DONE );
+                return;
+            }
+            if ( ( macHdr.Bits.MType == FRAME_TYPE_DATA_UNCONFIRMED_DOWN ) &&
+                 ( sequenceCounterDiff == 0 ) && ( downLinkCounterValid == true ) ) {
+                STATS_INC( STATS_RX_EARLY_DROP );
+                McpsIndication.Status = LORAMAC_EVENT_INFO_STATUS_DOWNLINK_REPEATED;
+                McpsIndication.DownLinkCounter = downLinkCounter;
+                PrepareRxDoneAbort( );
+                PROFILE_STOP( PROFILE_MAC_RX_DONE );
+                return;
+            }
+
             if ( sequenceCounterDiff < ( 1 << 15 ) ) {
                 downLinkCounter += sequenceCounterDiff;
                 LoRaMacComputeMic( payload, size - LORAMAC_MFR_LEN, nwkSKey, address, DOWN_LINK, downLinkCounter, &mic );
@@ -1015,17 +1771,12 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
                 }
             }
 
-            // Check for a the maximum allowed counter difference
-            getPhy.Attribute = PHY_MAX_FCNT_GAP;
-            phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
-            if ( sequenceCounterDiff >= phyParam.Value ) {
-                McpsIndication.Status = LORAMAC_EVENT_INFO_STATUS_DOWNLINK_TOO_MANY_FRAMES_LOSS;
-                McpsIndication.DownLinkCounter = downLinkCounter;
-                PrepareRxDoneAbort( );
-                return;
-            }
-
             if ( isMicOk == true ) {
+#ifdef CONFIG_LORAMAC_LINK_ADR
+                if ( multicast == 0 ) {
+                    LinkAdrAddSample( snr );
+                }
+#endif
                 McpsIndication.Status = LORAMAC_EVENT_INFO_STATUS_OK;
                 McpsIndication.Multicast = multicast;
                 McpsIndication.FramePending = fCtrl.Bits.FPending;
@@ -1047,15 +1798,8 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
                 // Update 32 bits downlink counter
                 if ( multicast == 1 ) {
                     McpsIndication.McpsIndication = MCPS_MULTICAST;
-
-                    if ( ( curMulticastParams->DownLinkCounter == downLinkCounter ) &&
-                         ( curMulticastParams->DownLinkCounter != 0 ) ) {
-                        McpsIndication.Status = LORAMAC_EVENT_INFO_STATUS_DOWNLINK_REPEATED;
-                        McpsIndication.DownLinkCounter = downLinkCounter;
-                        PrepareRxDoneAbort( );
-                        return;
-                    }
                     curMulticastParams->DownLinkCounter = downLinkCounter;
+                    curMulticastParams->DownLinkCounterValid = true;
                 } else {
                     if ( macHdr.Bits.MType == FRAME_TYPE_DATA_CONFIRMED_DOWN ) {
 #ifdef CONFIG_LWAN
@@ -1071,7 +1815,7 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
                         McpsIndication.McpsIndication = MCPS_CONFIRMED;
 
                         if ( ( DownLinkCounter == downLinkCounter ) &&
-                             ( DownLinkCounter != 0 ) ) {
+                             ( DownLinkCounterValid == true ) ) {
                             // Duplicated confirmed downlink. Skip indication.
                             // In this case, the MAC layer shall accept the MAC commands
                             // which are included in the downlink retransmission.
@@ -1082,16 +1826,9 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
                     } else {
                         SrvAckRequested = false;
                         McpsIndication.McpsIndication = MCPS_UNCONFIRMED;
-
-                        if ( ( DownLinkCounter == downLinkCounter ) &&
-                             ( DownLinkCounter != 0 ) ) {
-                            McpsIndication.Status = LORAMAC_EVENT_INFO_STATUS_DOWNLINK_REPEATED;
-                            McpsIndication.DownLinkCounter = downLinkCounter;
-                            PrepareRxDoneAbort( );
-                            return;
-                        }
                     }
                     DownLinkCounter = downLinkCounter;
+                    DownLinkCounterValid = true;
                 }
 
                 // This must be done before parsing the payload and the MAC commands.
@@ -1142,7 +1879,7 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
                                                    address,
                                                    DOWN_LINK,
                                                    downLinkCounter,
-                                                   LoRaMacRxPayload );
+                                                   payload + appPayloadStartIndex );
 #ifdef CONFIG_LWAN
                             if ( fCtrl.Bits.Adr != AdrCtrlOn ) {
                                 uint8_t adr;
@@ -1154,7 +1891,7 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
 #endif
 
                             // Decode frame payload MAC commands
-                                ProcessMacCommands( LoRaMacRxPayload, 0, frameLen, snr, McpsIndication.RxSlot );
+                                ProcessMacCommands( payload + appPayloadStartIndex, 0, frameLen, snr, McpsIndication.RxSlot );
                         } else {
                             LoRaMacFlags.Bits.McpsIndSkip = 1;
                             // This is not a valid frame. Drop it and reset the ACK bits
@@ -1184,11 +1921,26 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
                                                address,
                                                DOWN_LINK,
                                                downLinkCounter,
-                                               LoRaMacRxPayload );
+                                               payload + appPayloadStartIndex );
 
-                        McpsIndication.Buffer = LoRaMacRxPayload;
+                        McpsIndication.Buffer = payload + appPayloadStartIndex;
                         McpsIndication.BufferSize = frameLen;
                         McpsIndication.RxData = true;
+#ifdef CONFIG_LORAMAC_FAST_INDICATION
+                        // Unconfirmed, nothing for the MAC to act on, the application gets it first
+                        if ( ( FastIndication != NULL ) && ( port == FastIndicationPort ) &&
+                             ( LoRaMacDeviceClass == CLASS_C ) && ( McpsIndication.RxSlot == RX_SLOT_WIN_CLASS_C ) &&
+                             ( macHdr.Bits.MType == FRAME_TYPE_DATA_UNCONFIRMED_DOWN ) && ( fCtrl.Bits.FOptsLen == 0 ) ) {
+                            FastIndication( &McpsIndication );
+                            OpenContinuousRx2Window( );
+                            FastIndicationRxOpen = true;
+
+                            McpsIndication.Buffer = NULL;
+                            McpsIndication.BufferSize = 0;
+                            McpsIndication.RxData = false;
+                        } else
+#endif
+                        LoRaMacRxBufferPass( );
                     }
                 } else {
 #ifdef CONFIG_LWAN
@@ -1210,22 +1962,24 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
                 // Provide always an indication, skip the callback to the user application,
                 // in case of a confirmed downlink retransmission.
                 LoRaMacFlags.Bits.McpsInd = 1;
+                STATS_DOWNLINK( McpsIndication.RxDatarate );
             } else {
                 LOG_PRINTF(LL_VDEBUG, "MIC verify failed ignore the frame\r\n");
+                STATS_INC( STATS_MIC_FAIL );
                 McpsIndication.Status = LORAMAC_EVENT_INFO_STATUS_MIC_FAIL;
 
                 PrepareRxDoneAbort( );
+                PROFILE_STOP( PROFILE_MAC_RX_DONE );
                 return;
             }
         }
         break;
         case FRAME_TYPE_PROPRIETARY: {
-            memcpy1( LoRaMacRxPayload, &payload[pktHeaderLen], size );
-
             McpsIndication.McpsIndication = MCPS_PROPRIETARY;
             McpsIndication.Status = LORAMAC_EVENT_INFO_STATUS_OK;
-            McpsIndication.Buffer = LoRaMacRxPayload;
+            McpsIndication.Buffer = &payload[pktHeaderLen];
             McpsIndication.BufferSize = size - pktHeaderLen;
+            LoRaMacRxBufferPass( );
 
             LoRaMacFlags.Bits.McpsInd = 1;
             break;
@@ -1243,11 +1997,9 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
     if( AckTimeoutTimer.IsRunning == false )
     {// Procedure is completed when the AckTimeoutTimer is not running anymore
     	LoRaMacFlags.Bits.MacDone = 1;
-
-    	// Trig OnMacCheckTimerEvent call as soon as possible
-    	TimerSetValue( &MacStateCheckTimer, 1 );
-    	TimerStart( &MacStateCheckTimer );
+    	SetMacStateCheckEvent( );
     }
+    PROFILE_STOP( PROFILE_MAC_RX_DONE );
 }
 
 static void OnRadioTxTimeout( void )
@@ -1255,6 +2007,7 @@ static void OnRadioTxTimeout( void )
     if( LoRaMacDeviceClass != CLASS_C )
     {
         Radio.Sleep( );
+        RADIO_ARBITER_RELEASE( RADIO_ARBITER_LORAMAC );
     }
     else
     {
@@ -1264,6 +2017,7 @@ static void OnRadioTxTimeout( void )
     McpsConfirm.Status = LORAMAC_EVENT_INFO_STATUS_TX_TIMEOUT;
     LoRaMacConfirmQueueSetStatusCmn( LORAMAC_EVENT_INFO_STATUS_TX_TIMEOUT );
     LoRaMacFlags.Bits.MacDone = 1;
+    SetMacStateCheckEvent( );
 #ifdef CONFIG_LWAN
     lwan_dev_status_set(DEVICE_STATUS_SEND_FAIL);
 #endif
@@ -1275,7 +2029,15 @@ static void OnRadioRxError( void )
 
     if( LoRaMacDeviceClass != CLASS_C )
     {
+#ifdef CONFIG_LORAMAC_RX_PREARM
+        if( RxSlot == RX_SLOT_WIN_1 )
+        {
+            RxWindow2ConfigUpdate( );
+            RxWindowPrearm( &RxWindow2Config );
+        }
+#endif
         Radio.Sleep( );
+        RADIO_ARBITER_RELEASE( RADIO_ARBITER_LORAMAC );
     }
 
     if( LoRaMacClassBIsBeaconExpected( ) == true )
@@ -1338,6 +2100,11 @@ static void OnRadioRxError( void )
     {
         OpenContinuousRx2Window( );
     }
+
+    if( LoRaMacFlags.Bits.MacDone == 1 )
+    {
+        SetMacStateCheckEvent( );
+    }
 }
 
 static void OnRadioRxTimeout( void )
@@ -1346,7 +2113,15 @@ static void OnRadioRxTimeout( void )
 
     if( LoRaMacDeviceClass != CLASS_C )
     {
+#ifdef CONFIG_LORAMAC_RX_PREARM
+        if( RxSlot == RX_SLOT_WIN_1 )
+        {
+            RxWindow2ConfigUpdate( );
+            RxWindowPrearm( &RxWindow2Config );
+        }
+#endif
         Radio.Sleep( );
+        RADIO_ARBITER_RELEASE( RADIO_ARBITER_LORAMAC );
     }
 
     if( LoRaMacClassBIsBeaconExpected( ) == true )
@@ -1409,12 +2184,18 @@ static void OnRadioRxTimeout( void )
     {
         OpenContinuousRx2Window( );
     }
+
+    if( LoRaMacFlags.Bits.MacDone == 1 )
+    {
+        SetMacStateCheckEvent( );
+    }
 }
 
 #ifdef CONFIG_LORA_CAD
 static void OnRadioCadDone( bool channelActivityDetected )
 {
     Radio.Sleep( );
+    RADIO_ARBITER_RELEASE( RADIO_ARBITER_LORAMAC );
     
     if(channelActivityDetected && g_lora_cad_cnt<LORA_CAD_CNT_MAX) {
         // Send later - prepare timer
@@ -1431,10 +2212,33 @@ static void OnRadioCadDone( bool channelActivityDetected )
 }
 #endif
 
+#ifdef CONFIG_LORA_LBT_ASYNC
+static void OnRadioCarrierSenseDone( bool channelFree )
+{
+    LoRaMacState &= ~LORAMAC_TX_DELAYED;
+
+    if( channelFree == true )
+    {
+        SendFrameOnChannel( Channel );
+    }
+    else
+    {
+        // Busy, ScheduleTx picks and senses another channel a bit later
+        LoRaMacState |= LORAMAC_TX_DELAYED;
+        TimerSetValue( &TxDelayedTimer, randr( 1, LORA_LBT_RETRY_DELAY_MAX ) );
+        TimerStart( &TxDelayedTimer );
+    }
+}
+#endif
+
+static void SetMacStateCheckEvent( void )
+{
+    TimerSetValue( &MacStateCheckTimer, 1 );
+    TimerStart( &MacStateCheckTimer );
+}
+
 static void OnMacStateCheckTimerEvent( void )
 {
-    GetPhyParams_t getPhy;
-    PhyParam_t phyParam;
     bool noTx = false;
 
     TimerStop( &MacStateCheckTimer );
@@ -1521,6 +2325,11 @@ static void OnMacStateCheckTimerEvent( void )
         if ( LoRaMacFlags.Bits.McpsInd == 1 ) {
             // Procedure if we received a frame
             if ( ( McpsConfirm.AckReceived == true ) || ( AckTimeoutRetriesCounter > AckTimeoutRetries ) ) {
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+                if ( ( NodeAckRequested == true ) && ( RetryPolicy->Done != NULL ) ) {
+                    RetryPolicy->Done( McpsConfirm.AckReceived, AckTimeoutRetriesCounter );
+                }
+#endif
                 AckTimeoutRetry = false;
                 NodeAckRequested = false;
                 if ( IsUpLinkCounterFixed == false ) {
@@ -1543,10 +2352,21 @@ static void OnMacStateCheckTimerEvent( void )
         if ( ( AckTimeoutRetry == true ) && ( ( LoRaMacState & LORAMAC_TX_DELAYED ) == 0 ) ) {
             // Retransmissions procedure for confirmed uplinks
             AckTimeoutRetry = false;
-            if ( ( AckTimeoutRetriesCounter < AckTimeoutRetries ) && ( AckTimeoutRetriesCounter <= MAX_ACK_RETRIES ) ) {
+            if ( ( AckTimeoutRetriesCounter < AckTimeoutRetries ) && ( AckTimeoutRetriesCounter <= MAX_ACK_RETRIES )
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+                 && ( RetryPolicyNext( ) == true )
+#endif
+               ) {
                 AckTimeoutRetriesCounter++;
 
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+                // The policy applied the datarate, sent now or after its back-off
+                if ( ScheduleRetry( ) == LORAMAC_STATUS_OK ) {
+#else
                 if ( ( AckTimeoutRetriesCounter % 2 ) == 1 ) {
+                    GetPhyParams_t getPhy;
+                    PhyParam_t phyParam;
+
                     getPhy.Attribute = PHY_NEXT_LOWER_TX_DR;
                     getPhy.UplinkDwellTime = LoRaMacParams.UplinkDwellTime;
                     getPhy.Datarate = LoRaMacParams.ChannelsDatarate;
@@ -1555,6 +2375,7 @@ static void OnMacStateCheckTimerEvent( void )
                 }
                 // Try to send the frame again
                 if ( ScheduleTx( ) == LORAMAC_STATUS_OK ) {
+#endif
                     LoRaMacFlags.Bits.MacDone = 0;
                 } else {
                     // The DR is not applicable for the payload size
@@ -1566,6 +2387,11 @@ static void OnMacStateCheckTimerEvent( void )
                     McpsConfirm.AckReceived = false;
                     McpsConfirm.NbRetries = AckTimeoutRetriesCounter;
                     McpsConfirm.Datarate = LoRaMacParams.ChannelsDatarate;
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+                    if ( RetryPolicy->Done != NULL ) {
+                        RetryPolicy->Done( false, AckTimeoutRetriesCounter );
+                    }
+#endif
                     if ( IsUpLinkCounterFixed == false ) {
                         UpLinkCounter++;
                         LOG_PRINTF(LL_VDEBUG, "Confirmed data can't send after decrease DR, UpLinkCounter:%u\r\n", (unsigned int)UpLinkCounter);
@@ -1580,6 +2406,11 @@ static void OnMacStateCheckTimerEvent( void )
                 NodeAckRequested = false;
                 McpsConfirm.AckReceived = false;
                 McpsConfirm.NbRetries = AckTimeoutRetriesCounter;
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+                if ( RetryPolicy->Done != NULL ) {
+                    RetryPolicy->Done( false, AckTimeoutRetriesCounter );
+                }
+#endif
                 if ( IsUpLinkCounterFixed == false ) {
                     UpLinkCounter++;
                     LOG_PRINTF(LL_VDEBUG, "Confirmed data exceed retry times, UpLinkCounter:%u\r\n", (unsigned int)UpLinkCounter);
@@ -1595,6 +2426,9 @@ static void OnMacStateCheckTimerEvent( void )
         {
             LoRaMacFlags.Bits.McpsReq = 0;
             LoRaMacPrimitives->MacMcpsConfirm( &McpsConfirm );
+#ifdef CONFIG_LORAMAC_TX_QUEUE
+            TxQueueConfirm( &McpsConfirm );
+#endif
         }
 
         if( LoRaMacFlags.Bits.MlmeReq == 1 )
@@ -1620,6 +2454,14 @@ static void OnMacStateCheckTimerEvent( void )
 #endif    
         }
 
+#ifdef CONFIG_LORAMAC_MAC_CMD_DEFER
+        if( ( MacCmdDefer > 0 ) && ( IsStickyMacCommandQueued( ) == true ) )
+        {// Piggybacked on the next application uplink, an uplink of their own only at the deadline
+            TimerSetValue( &MacCmdDeferTimer, MacCmdDefer );
+            TimerStart( &MacCmdDeferTimer );
+        }
+        else
+#endif
         // Verify if sticky MAC commands are pending or not
         if( IsStickyMacCommandPending( ) == true )
         {// Setup MLME indication
@@ -1638,17 +2480,19 @@ static void OnMacStateCheckTimerEvent( void )
 
         LoRaMacClassBResumeBeaconing( );
         
+#ifdef CONFIG_LORAMAC_FAST_INDICATION
+        if( ( FastIndicationRxOpen == true ) && ( RxSlot == RX_SLOT_WIN_CLASS_C ) &&
+            ( Radio.GetStatus( ) == RF_RX_RUNNING ) )
+        {// Already opened again by the fast indication
+            FastIndicationRxOpen = false;
+        }
+        else
+#endif
         if( LoRaMacDeviceClass == CLASS_C )
         {// Activate RX2 window for Class C
             OpenContinuousRx2Window( );
         }
     }
-    else
-    {
-        // Operation not finished restart timer
-        TimerSetValue( &MacStateCheckTimer, MAC_STATE_CHECK_TIMEOUT );
-        TimerStart( &MacStateCheckTimer );
-    }
 
     // Handle MCPS indication
     if( LoRaMacFlags.Bits.McpsInd == 1 )
@@ -1659,8 +2503,27 @@ static void OnMacStateCheckTimerEvent( void )
             LoRaMacPrimitives->MacMcpsIndication( &McpsIndication );
         }
         LoRaMacFlags.Bits.McpsIndSkip = 0;
+
+        // Take the frame buffer back unless the upper layer kept it
+        if( McpsIndication.Buffer != NULL )
+        {
+            uint8_t index = LoRaMacRxBufferIndex( McpsIndication.Buffer );
+
+            if( ( index < LORAMAC_RX_BUFFER_COUNT ) && ( ( LoRaMacRxBuffersHeld & ( 1 << index ) ) == 0 ) )
+            {
+                LoRaMacRxBuffersBusy &= ~( 1 << index );
+                LoRaMacRxBufferLend( );
+            }
+            McpsIndication.Buffer = NULL;
+        }
     }
 
+#ifdef CONFIG_LORAMAC_TX_QUEUE
+    // The RX windows of the previous uplink are over, the duty cycle of the
+    // next one is handled by ScheduleTx
+    TxQueueNext( );
+#endif
+
 }
 
 static void OnTxDelayedTimerEvent( void )
@@ -1705,30 +2568,18 @@ static void OnTxImmediateTimerEvent( void )
 }
 #endif
 
-static void OnRxWindow1TimerEvent( void )
+static void RxWindow1ConfigUpdate( void )
 {
-    TimerStop( &RxWindowTimer1 );
-    RxSlot = RX_SLOT_WIN_1;
-
     RxWindow1Config.Channel = Channel;
     RxWindow1Config.DrOffset = LoRaMacParams.Rx1DrOffset;
     RxWindow1Config.DownlinkDwellTime = LoRaMacParams.DownlinkDwellTime;
     RxWindow1Config.RepeaterSupport = LoRaMacParams.RepeaterSupport;
     RxWindow1Config.RxContinuous = false;
-    RxWindow1Config.RxSlot = RxSlot;
-
-    if ( LoRaMacDeviceClass == CLASS_C ) {
-        Radio.Standby( );
-    }
-
-    RegionRxConfig( LoRaMacRegion, &RxWindow1Config, ( int8_t * )&McpsIndication.RxDatarate );
-    RxWindowSetup( RxWindow1Config.RxContinuous, LoRaMacParams.MaxRxWindow );
+    RxWindow1Config.RxSlot = RX_SLOT_WIN_1;
 }
 
-static void OnRxWindow2TimerEvent( void )
+static void RxWindow2ConfigUpdate( void )
 {
-    TimerStop( &RxWindowTimer2 );
-
     RxWindow2Config.Channel = Channel;
     RxWindow2Config.Datarate = LoRaMacParams.Rx2Channel.Datarate;
     RxWindow2Config.Frequency = LoRaMacParams.Rx2Channel.Frequency;
@@ -1741,6 +2592,40 @@ static void OnRxWindow2TimerEvent( void )
     } else {
         RxWindow2Config.RxContinuous = true;
     }
+}
+
+#ifdef CONFIG_LORAMAC_RX_PREARM
+static void RxWindowPrearm( RxConfigParams_t *rxConfig )
+{
+    int8_t datarate;
+
+    // The datarate indicated is the one of the window itself
+    RegionRxConfig( LoRaMacRegion, rxConfig, &datarate );
+}
+#endif
+
+static void OnRxWindow1TimerEvent( void )
+{
+    TimerStop( &RxWindowTimer1 );
+    RADIO_ARBITER_ACQUIRE( RADIO_ARBITER_LORAMAC );
+    RxSlot = RX_SLOT_WIN_1;
+
+    RxWindow1ConfigUpdate( );
+
+    if ( LoRaMacDeviceClass == CLASS_C ) {
+        Radio.Standby( );
+    }
+
+    RegionRxConfig( LoRaMacRegion, &RxWindow1Config, ( int8_t * )&McpsIndication.RxDatarate );
+    RxWindowSetup( RxWindow1Config.RxContinuous, LoRaMacParams.MaxRxWindow );
+}
+
+static void OnRxWindow2TimerEvent( void )
+{
+    TimerStop( &RxWindowTimer2 );
+    RADIO_ARBITER_ACQUIRE( RADIO_ARBITER_LORAMAC );
+
+    RxWindow2ConfigUpdate( );
 
     if ( RegionRxConfig( LoRaMacRegion, &RxWindow2Config, ( int8_t * )&McpsIndication.RxDatarate ) == true ) {
         RxWindowSetup( RxWindow2Config.RxContinuous, LoRaMacParams.MaxRxWindow );
@@ -1794,13 +2679,18 @@ static void OnAckTimeoutTimerEvent( void )
     if ( LoRaMacDeviceClass == CLASS_C ) {
         LoRaMacFlags.Bits.MacDone = 1;
     }
+    if ( ( AckTimeoutRetry == true ) || ( LoRaMacFlags.Bits.MacDone == 1 ) ) {
+        SetMacStateCheckEvent( );
+    }
 }
 
 static void RxWindowSetup( bool rxContinuous, uint32_t maxRxWindow )
 {
+    STATS_INC( STATS_RX_WINDOW );
     if ( rxContinuous == false ) {
         Radio.Rx( maxRxWindow );
-    } else {
+    } else if ( ( LoRaMacDeviceClass != CLASS_C ) || ( ClassCRxPreamble == 0 ) ||
+                ( Radio.RxSniff( ClassCRxPreamble ) == false ) ) {
         Radio.Rx( 0 ); // Continuous mode
     }
 }
@@ -1829,6 +2719,7 @@ static LoRaMacStatus_t SwitchClass( DeviceClass_t deviceClass )
                 // Set the NodeAckRequested indicator to default
                 NodeAckRequested = false;
                 // Set the radio into sleep mode in case we are still in RX mode
+                RADIO_ARBITER_ACQUIRE( RADIO_ARBITER_LORAMAC );
                 Radio.Sleep( );
                 // Compute Rx2 windows parameters in case the RX2 datarate has changed
                 RegionComputeRxWindowParameters( LoRaMacRegion,
@@ -1860,6 +2751,7 @@ static LoRaMacStatus_t SwitchClass( DeviceClass_t deviceClass )
 
                 // Set the radio into sleep to setup a defined state
                 Radio.Sleep( );
+                RADIO_ARBITER_RELEASE( RADIO_ARBITER_LORAMAC );
 
                 status = LORAMAC_STATUS_OK;
             }
@@ -1870,12 +2762,20 @@ static LoRaMacStatus_t SwitchClass( DeviceClass_t deviceClass )
     return status;
 }
 
-static bool ValidatePayloadLength( uint8_t lenN, int8_t datarate, uint8_t fOptsLen )
+static uint8_t GetMaxPayload( int8_t datarate )
 {
     GetPhyParams_t getPhy;
     PhyParam_t phyParam;
-    uint16_t maxN = 0;
-    uint16_t payloadSize = 0;
+    uint8_t key = ( ( LoRaMacParams.UplinkDwellTime != 0 ) ? 0x01 : 0 ) |
+                  ( ( LoRaMacParams.RepeaterSupport == true ) ? 0x02 : 0 );
+
+    if ( key != MaxPayloadCacheKey ) {
+        memset1( MaxPayloadCache, 0, sizeof( MaxPayloadCache ) );
+        MaxPayloadCacheKey = key;
+    }
+    if ( ( datarate >= 0 ) && ( datarate <= DR_15 ) && ( MaxPayloadCache[datarate] != 0 ) ) {
+        return MaxPayloadCache[datarate];
+    }
 
     // Setup PHY request
     getPhy.UplinkDwellTime = LoRaMacParams.UplinkDwellTime;
@@ -1888,7 +2788,18 @@ static bool ValidatePayloadLength( uint8_t lenN, int8_t datarate, uint8_t fOptsL
         getPhy.Attribute = PHY_MAX_PAYLOAD_REPEATER;
     }
     phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
-    maxN = phyParam.Value;
+    if ( ( datarate >= 0 ) && ( datarate <= DR_15 ) ) {
+        MaxPayloadCache[datarate] = phyParam.Value;
+    }
+    return phyParam.Value;
+}
+
+static bool ValidatePayloadLength( uint8_t lenN, int8_t datarate, uint8_t fOptsLen )
+{
+    uint16_t maxN = 0;
+    uint16_t payloadSize = 0;
+
+    maxN = GetMaxPayload( datarate );
 
     // Calculate the resulting payload size
     payloadSize = ( lenN + fOptsLen );
@@ -1916,153 +2827,168 @@ static void SetMlmeScheduleUplinkIndication( void )
     LoRaMacFlags.Bits.MlmeInd = 1;
 }
 
+#ifdef CONFIG_LORAMAC_MAC_CMD_DEFER
+static bool IsStickyMacCommandQueued( void )
+{
+    uint8_t sticky[LORA_MAC_COMMAND_MAX_LENGTH];
+
+    if ( IsStickyMacCommandPending( ) == true ) {
+        return true;
+    }
+    return ( MacCommandsInNextTx == true ) &&
+           ( ParseMacCommandsToRepeat( MacCommandsBuffer, MacCommandsBufferIndex, sticky ) > 0 );
+}
+
+static void OnMacCmdDeferTimerEvent( void )
+{
+    TimerStop( &MacCmdDeferTimer );
+
+    // A frame in progress carries them, its end restarts the deadline
+    if ( ( LoRaMacState != LORAMAC_IDLE ) || ( IsLoRaMacNetworkJoined == false ) ||
+         ( IsStickyMacCommandQueued( ) == false ) ) {
+        return;
+    }
+    SetMlmeScheduleUplinkIndication( );
+    LoRaMacPrimitives->MacMlmeIndication( &MlmeIndication );
+    LoRaMacFlags.Bits.MlmeInd = 0;
+}
+#endif
+
+/*!
+ * MAC command descriptor flags
+ */
+#define MAC_CMD_KNOWN                               0x01
+#define MAC_CMD_STICKY                              0x02
+#define MAC_CMD_SCHEDULE_UPLINK                     0x04
+
+/*!
+ * Highest CID of the MAC commands handled
+ */
+#define MAC_CMD_CID_MAX                             0x13
+
+/*!
+ * MAC command descriptor, indexed by CID
+ */
+typedef struct sMacCmdInfo
+{
+    /*!
+     * Payload length, CID excluded
+     */
+    uint8_t Length;
+    /*!
+     * MAC_CMD_* flags
+     */
+    uint8_t Flags;
+}MacCmdInfo_t;
+
+/*!
+ * Commands sent by the end-device. The sticky answers are repeated until a
+ * downlink is received, the other flagged ones ask for an uplink to be
+ * scheduled
+ */
+static const MacCmdInfo_t MoteMacCmds[MAC_CMD_CID_MAX + 1] =
+{
+    { 0, 0 },                                                   // 0x00
+    { 0, 0 },                                                   // 0x01
+    { 0, MAC_CMD_KNOWN },                                       // MOTE_MAC_LINK_CHECK_REQ
+    { 1, MAC_CMD_KNOWN },                                       // MOTE_MAC_LINK_ADR_ANS
+    { 0, MAC_CMD_KNOWN },                                       // MOTE_MAC_DUTY_CYCLE_ANS
+    { 1, MAC_CMD_KNOWN | MAC_CMD_STICKY | MAC_CMD_SCHEDULE_UPLINK }, // MOTE_MAC_RX_PARAM_SETUP_ANS
+    { 2, MAC_CMD_KNOWN | MAC_CMD_SCHEDULE_UPLINK },             // MOTE_MAC_DEV_STATUS_ANS
+    { 1, MAC_CMD_KNOWN },                                       // MOTE_MAC_NEW_CHANNEL_ANS
+    { 0, MAC_CMD_KNOWN | MAC_CMD_STICKY | MAC_CMD_SCHEDULE_UPLINK }, // MOTE_MAC_RX_TIMING_SETUP_ANS
+    { 0, MAC_CMD_KNOWN },                                       // MOTE_MAC_TX_PARAM_SETUP_ANS
+    { 1, MAC_CMD_KNOWN | MAC_CMD_STICKY | MAC_CMD_SCHEDULE_UPLINK }, // MOTE_MAC_DL_CHANNEL_ANS
+    { 0, 0 },                                                   // 0x0B
+    { 0, 0 },                                                   // 0x0C
+    { 0, MAC_CMD_KNOWN },                                       // MOTE_MAC_DEVICE_TIME_REQ
+    { 0, 0 },                                                   // 0x0E
+    { 0, 0 },                                                   // 0x0F
+    { 1, MAC_CMD_KNOWN },                                       // MOTE_MAC_PING_SLOT_INFO_REQ
+    { 1, MAC_CMD_KNOWN | MAC_CMD_SCHEDULE_UPLINK },             // MOTE_MAC_PING_SLOT_FREQ_ANS
+    { 0, MAC_CMD_KNOWN },                                       // MOTE_MAC_BEACON_TIMING_REQ
+    { 1, MAC_CMD_KNOWN | MAC_CMD_SCHEDULE_UPLINK },             // MOTE_MAC_BEACON_FREQ_ANS
+};
+
+/*!
+ * Commands received from the network server
+ */
+static const MacCmdInfo_t SrvMacCmds[MAC_CMD_CID_MAX + 1] =
+{
+    { 0, 0 },                                                   // 0x00
+    { 0, 0 },                                                   // 0x01
+    { 2, MAC_CMD_KNOWN },                                       // SRV_MAC_LINK_CHECK_ANS
+    { 4, MAC_CMD_KNOWN },                                       // SRV_MAC_LINK_ADR_REQ
+    { 1, MAC_CMD_KNOWN },                                       // SRV_MAC_DUTY_CYCLE_REQ
+    { 4, MAC_CMD_KNOWN },                                       // SRV_MAC_RX_PARAM_SETUP_REQ
+    { 0, MAC_CMD_KNOWN },                                       // SRV_MAC_DEV_STATUS_REQ
+    { 5, MAC_CMD_KNOWN },                                       // SRV_MAC_NEW_CHANNEL_REQ
+    { 1, MAC_CMD_KNOWN },                                       // SRV_MAC_RX_TIMING_SETUP_REQ
+    { 1, MAC_CMD_KNOWN },                                       // SRV_MAC_TX_PARAM_SETUP_REQ
+    { 4, MAC_CMD_KNOWN },                                       // SRV_MAC_DL_CHANNEL_REQ
+    { 0, 0 },                                                   // 0x0B
+    { 0, 0 },                                                   // 0x0C
+    { 5, MAC_CMD_KNOWN },                                       // SRV_MAC_DEVICE_TIME_ANS
+    { 0, 0 },                                                   // 0x0E
+    { 0, 0 },                                                   // 0x0F
+    { 0, MAC_CMD_KNOWN },                                       // SRV_MAC_PING_SLOT_INFO_ANS
+    { 4, MAC_CMD_KNOWN },                                       // SRV_MAC_PING_SLOT_CHANNEL_REQ
+    { 3, MAC_CMD_KNOWN },                                       // SRV_MAC_BEACON_TIMING_ANS
+    { 3, MAC_CMD_KNOWN },                                       // SRV_MAC_BEACON_FREQ_REQ
+};
+
+/*!
+ * \brief Descriptor of a MAC command, NULL for an unknown CID
+ */
+static const MacCmdInfo_t *GetMacCmdInfo( const MacCmdInfo_t *table, uint8_t cid )
+{
+    if( ( cid > MAC_CMD_CID_MAX ) || ( ( table[cid].Flags & MAC_CMD_KNOWN ) == 0 ) )
+    {
+        return NULL;
+    }
+    return &table[cid];
+}
+
 static LoRaMacStatus_t AddMacCommand( uint8_t cmd, uint8_t p1, uint8_t p2 )
 {
-    LoRaMacStatus_t status = LORAMAC_STATUS_BUSY;
+    const MacCmdInfo_t *info = GetMacCmdInfo( MoteMacCmds, cmd );
     // The maximum buffer length must take MAC commands to re-send into account.
     uint8_t bufLen = LORA_MAC_COMMAND_MAX_LENGTH - MacCommandsBufferToRepeatIndex;
 
-    switch ( cmd ) {
-        case MOTE_MAC_LINK_CHECK_REQ:
-            if ( MacCommandsBufferIndex < bufLen ) {
-                MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
-                // No payload for this command
-                status = LORAMAC_STATUS_OK;
-            }
-            break;
-        case MOTE_MAC_LINK_ADR_ANS:
-            if ( MacCommandsBufferIndex < ( bufLen - 1 ) ) {
-                MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
-                // Margin
-                MacCommandsBuffer[MacCommandsBufferIndex++] = p1;
-                status = LORAMAC_STATUS_OK;
-            }
-            break;
-        case MOTE_MAC_DUTY_CYCLE_ANS:
-            if ( MacCommandsBufferIndex < bufLen ) {
-                MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
-                // No payload for this answer
-                status = LORAMAC_STATUS_OK;
-            }
-            break;
-        case MOTE_MAC_RX_PARAM_SETUP_ANS:
-            if ( MacCommandsBufferIndex < ( bufLen - 1 ) ) {
-                MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
-                // Status: Datarate ACK, Channel ACK
-                MacCommandsBuffer[MacCommandsBufferIndex++] = p1;
-                // This is a sticky MAC command answer. Setup indication
-                SetMlmeScheduleUplinkIndication( );
-                status = LORAMAC_STATUS_OK;
-            }
-            break;
-        case MOTE_MAC_DEV_STATUS_ANS:
-            if ( MacCommandsBufferIndex < ( bufLen - 2 ) ) {
-                MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
-                // 1st byte Battery
-                // 2nd byte Margin
-                MacCommandsBuffer[MacCommandsBufferIndex++] = p1;
-                MacCommandsBuffer[MacCommandsBufferIndex++] = p2;
-                SetMlmeScheduleUplinkIndication( );
-                status = LORAMAC_STATUS_OK;
-                LOG_PRINTF(LL_VDEBUG, "ready to send MOTE_MAC_DEV_STATUS_ANS p1=%d p2=%d\r\n",p1,p2);
-            }
-            break;
-        case MOTE_MAC_NEW_CHANNEL_ANS:
-            if ( MacCommandsBufferIndex < ( bufLen - 1 ) ) {
-                MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
-                // Status: Datarate range OK, Channel frequency OK
-                MacCommandsBuffer[MacCommandsBufferIndex++] = p1;
-                status = LORAMAC_STATUS_OK;
-            }
-            break;
-        case MOTE_MAC_RX_TIMING_SETUP_ANS:
-            if ( MacCommandsBufferIndex < bufLen ) {
-                MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
-                // No payload for this answer
-                // This is a sticky MAC command answer. Setup indication
-                SetMlmeScheduleUplinkIndication( );
-                status = LORAMAC_STATUS_OK;
-            }
-            break;
-        case MOTE_MAC_TX_PARAM_SETUP_ANS:
-            if ( MacCommandsBufferIndex < bufLen ) {
-                MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
-                // No payload for this answer
-                status = LORAMAC_STATUS_OK;
-            }
-            break;
-        case MOTE_MAC_DL_CHANNEL_ANS:
-            if ( MacCommandsBufferIndex < bufLen ) {
-                MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
-                // Status: Uplink frequency exists, Channel frequency OK
-                MacCommandsBuffer[MacCommandsBufferIndex++] = p1;
-                // This is a sticky MAC command answer. Setup indication
-                SetMlmeScheduleUplinkIndication( );
+    if ( info == NULL ) {
+        return LORAMAC_STATUS_SERVICE_UNKNOWN;
+    }
+    if ( ( MacCommandsBufferIndex + 1 + info->Length ) > bufLen ) {
+        return LORAMAC_STATUS_BUSY;
+    }
 
-                status = LORAMAC_STATUS_OK;
-            }
-            break;
-        case MOTE_MAC_DEVICE_TIME_REQ:
-            if( MacCommandsBufferIndex < LORA_MAC_COMMAND_MAX_LENGTH )
-            {
-                MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
-                // No payload for this answer
-                status = LORAMAC_STATUS_OK;
-                LOG_PRINTF(LL_VDEBUG, "ready to send MOTE_MAC_DEVICE_TIME_REQ\r\n");
-            }
-            break;
-        case MOTE_MAC_PING_SLOT_INFO_REQ:
-            if( MacCommandsBufferIndex < ( LORA_MAC_COMMAND_MAX_LENGTH - 1 ) )
-            {
-                MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
-                // Status: Periodicity and Datarate
-                MacCommandsBuffer[MacCommandsBufferIndex++] = p1;
-                status = LORAMAC_STATUS_OK;
-                LOG_PRINTF(LL_VDEBUG, "ready to send MOTE_MAC_PING_SLOT_INFO_REQ value=%d\r\n",p1);
-            }
-            break;
-        case MOTE_MAC_PING_SLOT_FREQ_ANS:
-            if( MacCommandsBufferIndex < LORA_MAC_COMMAND_MAX_LENGTH )
-            {
-                MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
-                // Status: Datarate range OK, Channel frequency OK
-                MacCommandsBuffer[MacCommandsBufferIndex++] = p1;
-                SetMlmeScheduleUplinkIndication( );
-                status = LORAMAC_STATUS_OK;
-            }
-            break;
-        case MOTE_MAC_BEACON_TIMING_REQ:
-            if( MacCommandsBufferIndex < LORA_MAC_COMMAND_MAX_LENGTH )
-            {
-                MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
-                // No payload for this answer
-                status = LORAMAC_STATUS_OK;
-            }
-            break;
-        case MOTE_MAC_BEACON_FREQ_ANS:
-            if( MacCommandsBufferIndex < LORA_MAC_COMMAND_MAX_LENGTH )
-            {
-                MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
-                // Status: Channel frequency OK
-                MacCommandsBuffer[MacCommandsBufferIndex++] = p1;
-                SetMlmeScheduleUplinkIndication( );
-                status = LORAMAC_STATUS_OK;
-            }
-            break;
-        default:
-            return LORAMAC_STATUS_SERVICE_UNKNOWN;
+    // The answer is built in place, PrepareFrame copies the buffer into FOpts
+    MacCommandsBuffer[MacCommandsBufferIndex++] = cmd;
+    if ( info->Length > 0 ) {
+        MacCommandsBuffer[MacCommandsBufferIndex++] = p1;
     }
-    if ( status == LORAMAC_STATUS_OK ) {
+    if ( info->Length > 1 ) {
+        MacCommandsBuffer[MacCommandsBufferIndex++] = p2;
+    }
+    LOG_PRINTF(LL_VDEBUG, "ready to send MAC command 0x%02x p1=%d p2=%d\r\n", cmd, p1, p2);
+
+#ifdef CONFIG_LORAMAC_MAC_CMD_DEFER
+    // The sticky answers wait for the next uplink, the end of the exchange starts their deadline
+    if ( ( MacCmdDefer > 0 ) && ( ( info->Flags & MAC_CMD_STICKY ) != 0 ) && ( SrvAckRequested == false ) ) {
         MacCommandsInNextTx = true;
-        if (SrvAckRequested) {
-            SetMlmeScheduleUplinkIndication();
-        }
+        return LORAMAC_STATUS_OK;
     }
-    return status;
+#endif
+    if ( ( ( info->Flags & MAC_CMD_SCHEDULE_UPLINK ) != 0 ) || SrvAckRequested ) {
+        SetMlmeScheduleUplinkIndication( );
+    }
+    MacCommandsInNextTx = true;
+    return LORAMAC_STATUS_OK;
 }
 
 static uint8_t ParseMacCommandsToRepeat( uint8_t *cmdBufIn, uint8_t length, uint8_t *cmdBufOut )
 {
+    const MacCmdInfo_t *info;
     uint8_t i = 0;
     uint8_t cmdCount = 0;
 
@@ -2070,62 +2996,72 @@ static uint8_t ParseMacCommandsToRepeat( uint8_t *cmdBufIn, uint8_t length, uint
         return 0;
     }
 
-    for ( i = 0; i < length; i++ ) {
-        switch ( cmdBufIn[i] ) {
-            // STICKY
-            case MOTE_MAC_DL_CHANNEL_ANS:
-            case MOTE_MAC_RX_PARAM_SETUP_ANS: {
-                // 1 byte payload
-                cmdBufOut[cmdCount++] = cmdBufIn[i++];
-                cmdBufOut[cmdCount++] = cmdBufIn[i];
-                break;
-            }
-            case MOTE_MAC_RX_TIMING_SETUP_ANS: {
-                // 0 byte payload
-                cmdBufOut[cmdCount++] = cmdBufIn[i];
-                break;
-            }
-            // NON-STICKY
-            case MOTE_MAC_DEV_STATUS_ANS: {
-                // 2 bytes payload
-                i += 2;
-                break;
-            }
-            case MOTE_MAC_LINK_ADR_ANS:
-            case MOTE_MAC_NEW_CHANNEL_ANS: {
-                // 1 byte payload
-                i++;
-                break;
-            }
-            case MOTE_MAC_TX_PARAM_SETUP_ANS:
-            case MOTE_MAC_DUTY_CYCLE_ANS:
-            case MOTE_MAC_LINK_CHECK_REQ: {
-                // 0 byte payload
-                break;
-            }
-            default:
-                break;
+    while ( i < length ) {
+        info = GetMacCmdInfo( MoteMacCmds, cmdBufIn[i] );
+        if ( ( info == NULL ) || ( ( i + 1 + info->Length ) > length ) ) {
+            // The buffer is only filled by AddMacCommand
+            break;
         }
+        if ( ( info->Flags & MAC_CMD_STICKY ) != 0 ) {
+            memcpy1( &cmdBufOut[cmdCount], &cmdBufIn[i], 1 + info->Length );
+            cmdCount += 1 + info->Length;
+        }
+        i += 1 + info->Length;
     }
 
     return cmdCount;
 }
 
+/*!
+ * \brief Validates a MAC commands block
+ *
+ * \param [IN] payload      Buffer holding the commands
+ * \param [IN] macIndex     Index of the first command
+ * \param [IN] commandsSize Index of the block end
+ *
+ * \retval end Index after the last known and complete command, the
+ *             commands from there are dropped
+ */
+static uint8_t ValidateMacCommands( uint8_t *payload, uint8_t macIndex, uint8_t commandsSize )
+{
+    const MacCmdInfo_t *info;
+
+    while ( macIndex < commandsSize ) {
+        info = GetMacCmdInfo( SrvMacCmds, payload[macIndex] );
+        if ( ( info == NULL ) || ( ( macIndex + 1 + info->Length ) > commandsSize ) ) {
+            break;
+        }
+        macIndex += 1 + info->Length;
+    }
+    return macIndex;
+}
+
 static void ProcessMacCommands( uint8_t *payload, uint8_t macIndex, uint8_t commandsSize, uint8_t snr, LoRaMacRxSlot_t rxSlot )
 {
     uint8_t status = 0;
+    uint8_t cmdEnd;
+
+    // Validated in one pass, the handlers read their payload unchecked
+    commandsSize = ValidateMacCommands( payload, macIndex, commandsSize );
 
     while ( macIndex < commandsSize ) {
         // Decode Frame MAC commands
         LOG_PRINTF(LL_VDEBUG, "MacCommands:%d being processed\r\n", payload[macIndex]);
+        cmdEnd = macIndex + 1 + SrvMacCmds[payload[macIndex]].Length;
 
         switch ( payload[macIndex++] ) {
             case SRV_MAC_LINK_CHECK_ANS:
                 if( LoRaMacConfirmQueueIsCmdActive( MLME_LINK_CHECK ) == true )
                 {
                     LoRaMacConfirmQueueSetStatus( LORAMAC_EVENT_INFO_STATUS_OK, MLME_LINK_CHECK );
-                	MlmeConfirm.DemodMargin = payload[macIndex++];
-                	MlmeConfirm.NbGateways = payload[macIndex++];
+                	MlmeConfirm.DemodMargin = payload[macIndex];
+                	MlmeConfirm.NbGateways = payload[macIndex + 1];
+#ifdef CONFIG_LORAMAC_LINK_ADR
+                    // The margin of the uplink at the gateway, above the floor of its datarate
+                    if ( ( MlmeConfirm.DemodMargin <= 64 ) && ( LinkAdrDemodFloor( McpsConfirm.Datarate ) != INT16_MAX ) ) {
+                        LinkAdrAddSample( ( int8_t )( MlmeConfirm.DemodMargin + ( LinkAdrDemodFloor( McpsConfirm.Datarate ) / 10 ) ) );
+                    }
+#endif
 #ifdef CONFIG_LWAN                    
                     McpsIndication.LinkCheckAnsReceived = true;
 #endif
@@ -2173,8 +3109,10 @@ static void ProcessMacCommands( uint8_t *payload, uint8_t macIndex, uint8_t comm
                 for ( uint8_t i = 0; i < ( linkAdrNbBytesParsed / 5 ); i++ ) {
                     AddMacCommand( MOTE_MAC_LINK_ADR_ANS, status, 0 );
                 }
-                // Update MAC index
-                macIndex += linkAdrNbBytesParsed - 1;
+                // The region parses the LinkAdrReq block, validated as well
+                if ( linkAdrNbBytesParsed > ( cmdEnd - ( macIndex - 1 ) ) ) {
+                    cmdEnd = ( macIndex - 1 ) + linkAdrNbBytesParsed;
+                }
             }
             break;
             case SRV_MAC_DUTY_CYCLE_REQ:
@@ -2248,6 +3186,8 @@ static void ProcessMacCommands( uint8_t *payload, uint8_t macIndex, uint8_t comm
             break;
             case SRV_MAC_TX_PARAM_SETUP_REQ: {
                 TxParamSetupReqParams_t txParamSetupReq;
+                GetPhyParams_t getPhy;
+                PhyParam_t phyParam;
                 uint8_t eirpDwellTime = payload[macIndex++];
 
                 txParamSetupReq.UplinkDwellTime = 0;
@@ -2267,6 +3207,11 @@ static void ProcessMacCommands( uint8_t *payload, uint8_t macIndex, uint8_t comm
                     LoRaMacParams.UplinkDwellTime = txParamSetupReq.UplinkDwellTime;
                     LoRaMacParams.DownlinkDwellTime = txParamSetupReq.DownlinkDwellTime;
                     LoRaMacParams.MaxEirp = LoRaMacMaxEirpTable[txParamSetupReq.MaxEirp];
+                    // The dwell time may raise the lowest datarate allowed
+                    getPhy.Attribute = PHY_MIN_TX_DR;
+                    getPhy.UplinkDwellTime = LoRaMacParams.UplinkDwellTime;
+                    phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+                    LoRaMacParams.ChannelsDatarate = MAX( LoRaMacParams.ChannelsDatarate, ( int8_t )phyParam.Value );
                     // Add command response
                     AddMacCommand( MOTE_MAC_TX_PARAM_SETUP_ANS, 0, 0 );
                 }
@@ -2303,6 +3248,10 @@ static void ProcessMacCommands( uint8_t *payload, uint8_t macIndex, uint8_t comm
                     // Convert the fractional second received in ms
                     // round( pow( 0.5, 8.0 ) * 1000 ) = 3.90625
                     sysTimeAns.SubSeconds = sysTimeAns.SubSeconds * 3.90625;
+#ifdef CONFIG_RTC_DISCIPLINE
+                    // The answer gives the GPS time of the end of the uplink
+                    RtcDisciplineUpdate( LastTxRtcTime, ( TimerTime_t )sysTimeAns.Seconds * 1000 + sysTimeAns.SubSeconds );
+#endif
 
                     // Add Unix to Gps epcoh offset. The system time is based on Unix time.
                     sysTimeAns.Seconds += UNIX_GPS_EPOCH_OFFSET;
@@ -2312,6 +3261,9 @@ static void ProcessMacCommands( uint8_t *payload, uint8_t macIndex, uint8_t comm
 
                     sysTime = TimerAddSysTime( sysTimeCurrent, TimerSubSysTime( sysTimeAns, LastTxSysTime ) );
                     LOG_PRINTF(LL_VDEBUG, "receive SRV_MAC_DEVICE_TIME_ANS, set time=%u.%d\r\n", (unsigned int)sysTime.Seconds, sysTime.SubSeconds);
+#ifdef CONFIG_CLOCK_SYNC
+                    ClockSyncUpdate( sysTimeCurrent, sysTime );
+#endif
                     // Apply the new system time.
                     TimerSetSysTime( sysTime );
                     currentTime = TimerGetCurrentTime( );
@@ -2384,6 +3336,7 @@ static void ProcessMacCommands( uint8_t *payload, uint8_t macIndex, uint8_t comm
                 // Unknown command. ABORT MAC commands processing
                 return;
         }
+        macIndex = cmdEnd;
     }
 }
 
@@ -2402,6 +3355,7 @@ static bool StartCAD( uint8_t channel )
     txConfig.AntennaGain = LoRaMacParams.AntennaGain;
     txConfig.PktLen = LoRaMacBufferPktLen;
 
+    RADIO_ARBITER_ACQUIRE( RADIO_ARBITER_LORAMAC );
     bool ret = RegionTxConfig( LoRaMacRegion, &txConfig, &txPower, &txTime );
     Radio.StartCad(LORA_CAD_SYMBOLS);
     
@@ -2409,6 +3363,44 @@ static bool StartCAD( uint8_t channel )
 }
 #endif
 
+#ifdef CONFIG_LORA_LBT_ASYNC
+/*!
+ * \brief Starts the carrier sense of the region before a TX on channel,
+ *        OnRadioCarrierSenseDone sends the frame
+ *
+ * \retval started false when the region has no listen before talk
+ */
+static bool StartCarrierSense( uint8_t channel )
+{
+    GetPhyParams_t getPhy;
+    PhyParam_t phyParam;
+    uint32_t senseTime;
+    int16_t rssiThresh;
+
+    memset( &getPhy, 0, sizeof( getPhy ) );
+    getPhy.Attribute = PHY_CARRIER_SENSE_TIME;
+    phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+    senseTime = phyParam.Value;
+    if( senseTime == 0 )
+    {
+        return false;
+    }
+
+    getPhy.Attribute = PHY_CARRIER_SENSE_RSSI_TH;
+    phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+    rssiThresh = ( int16_t )( int32_t )phyParam.Value;
+
+    getPhy.Attribute = PHY_CHANNELS;
+    phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+
+    // The MAC stays busy while the channel is sensed
+    LoRaMacState |= LORAMAC_TX_DELAYED;
+    RADIO_ARBITER_ACQUIRE( RADIO_ARBITER_LORAMAC );
+    Radio.StartCarrierSense( MODEM_LORA, phyParam.Channels[channel].Frequency, rssiThresh, senseTime );
+    return true;
+}
+#endif
+
 LoRaMacStatus_t Send( LoRaMacHeader_t *macHdr, uint8_t fPort, void *fBuffer, uint16_t fBufferSize )
 {
     LoRaMacFrameCtrl_t fCtrl;
@@ -2416,23 +3408,14 @@ LoRaMacStatus_t Send( LoRaMacHeader_t *macHdr, uint8_t fPort, void *fBuffer, uin
 #ifdef CONFIG_LWAN
     lwan_dev_status_set(DEVICE_STATUS_IDLE);
 #endif
-    fCtrl.Value = 0;
-    fCtrl.Bits.FOptsLen      = 0;
-    if( LoRaMacDeviceClass == CLASS_B )
-    {
-        LOG_PRINTF(LL_VDEBUG, "Send class b frame\r\n");        
-        fCtrl.Bits.FPending      = 1;
-    }
-    else
-    {
-        fCtrl.Bits.FPending      = 0;
-    }
-    fCtrl.Bits.Ack           = false;
-    fCtrl.Bits.AdrAckReq     = false;
-    fCtrl.Bits.Adr           = AdrCtrlOn;
+    InitFrameCtrl( &fCtrl );
 
-    // Prepare the frame
+    // Prepare the frame, unless it has been built ahead
+#ifdef CONFIG_LORAMAC_PREBUILD
+    status = PrepareStagedFrame( macHdr, &fCtrl, fPort, fBuffer, fBufferSize );
+#else
     status = PrepareFrame( macHdr, &fCtrl, fPort, fBuffer, fBufferSize );
+#endif
 
     // Validate status
     if ( status != LORAMAC_STATUS_OK ) {
@@ -2451,6 +3434,20 @@ LoRaMacStatus_t Send( LoRaMacHeader_t *macHdr, uint8_t fPort, void *fBuffer, uin
     return status;
 }
 
+static void SetupNextChanParams( NextChanParams_t *nextChan )
+{
+    nextChan->AggrTimeOff = AggregatedTimeOff;
+    nextChan->Datarate = LoRaMacParams.ChannelsDatarate;
+    nextChan->DutyCycleEnabled = DutyCycleOn;
+    nextChan->Joined = IsLoRaMacNetworkJoined;
+    nextChan->LastAggrTx = AggregatedLastTxDoneTime;
+#ifdef CONFIG_LINKWAN
+    nextChan->joinmethod = LoRaMacParams.method;
+    nextChan->freqband = LoRaMacParams.freqband;
+    nextChan->update_freqband = LoRaMacParams.update_freqband;
+#endif
+}
+
 static LoRaMacStatus_t ScheduleTx( void )
 {
     TimerTime_t dutyCycleTimeOff = 0;
@@ -2467,16 +3464,7 @@ static LoRaMacStatus_t ScheduleTx( void )
     // Update Backoff
     CalculateBackOff( LastTxChannel );
 
-    nextChan.AggrTimeOff = AggregatedTimeOff;
-    nextChan.Datarate = LoRaMacParams.ChannelsDatarate;
-    nextChan.DutyCycleEnabled = DutyCycleOn;
-    nextChan.Joined = IsLoRaMacNetworkJoined;
-    nextChan.LastAggrTx = AggregatedLastTxDoneTime;
-#ifdef CONFIG_LINKWAN
-    nextChan.joinmethod = LoRaMacParams.method;
-    nextChan.freqband = LoRaMacParams.freqband;
-    nextChan.update_freqband = LoRaMacParams.update_freqband;
-#endif
+    SetupNextChanParams( &nextChan );
 
     // Select channel
     while ( RegionNextChannel( LoRaMacRegion, &nextChan, &Channel, &dutyCycleTimeOff, &AggregatedTimeOff ) == false ) {
@@ -2486,7 +3474,18 @@ static LoRaMacStatus_t ScheduleTx( void )
         nextChan.Datarate = LoRaMacParams.ChannelsDatarate;
     }
 
-#ifdef CONFIG_LINKWAN
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+    // A retransmission moves to another channel when the region has one
+    for ( uint8_t i = 0; ( RetryAvoidChannel == true ) && ( Channel == LastTxChannel ) &&
+                         ( i < LORAMAC_RETRY_CHANNEL_TRIALS ); i++ ) {
+        if ( RegionNextChannel( LoRaMacRegion, &nextChan, &Channel, &dutyCycleTimeOff, &AggregatedTimeOff ) == false ) {
+            break;
+        }
+    }
+    RetryAvoidChannel = false;
+#endif
+
+#ifdef CONFIG_LINKWAN
     LoRaMacParams.freqband = nextChan.freqband;
     LoRaMacParams.update_freqband = nextChan.update_freqband;
 #endif
@@ -2508,19 +3507,43 @@ static LoRaMacStatus_t ScheduleTx( void )
     if ( IsLoRaMacNetworkJoined == false ) {
         RxWindow1Delay = LoRaMacParams.JoinAcceptDelay1 + RxWindow1Config.WindowOffset;
         RxWindow2Delay = LoRaMacParams.JoinAcceptDelay2 + RxWindow2Config.WindowOffset;
+#ifdef CONFIG_TIMER_PRECISE
+        RxWindow1DelayUs = ( int32_t )LoRaMacParams.JoinAcceptDelay1 * 1000 + RxWindow1Config.WindowOffsetUs;
+        RxWindow2DelayUs = ( int32_t )LoRaMacParams.JoinAcceptDelay2 * 1000 + RxWindow2Config.WindowOffsetUs;
+#endif
     } else {
         if ( ValidatePayloadLength( LoRaMacTxPayloadLen, LoRaMacParams.ChannelsDatarate, MacCommandsBufferIndex ) == false ) {
             return LORAMAC_STATUS_LENGTH_ERROR;
         }
         RxWindow1Delay = LoRaMacParams.ReceiveDelay1 + RxWindow1Config.WindowOffset;
         RxWindow2Delay = LoRaMacParams.ReceiveDelay2 + RxWindow2Config.WindowOffset;
+#ifdef CONFIG_TIMER_PRECISE
+        RxWindow1DelayUs = ( int32_t )LoRaMacParams.ReceiveDelay1 * 1000 + RxWindow1Config.WindowOffsetUs;
+        RxWindow2DelayUs = ( int32_t )LoRaMacParams.ReceiveDelay2 * 1000 + RxWindow2Config.WindowOffsetUs;
+#endif
     }
+#ifdef CONFIG_LORAMAC_RX_PREARM
+    // Class C opens RX2 right after the TX and RX1 from it, unprepared
+    if ( LoRaMacDeviceClass != CLASS_C ) {
+        RxWindow1Delay += LORAMAC_RX_PREARM_TIME / 1000;
+        RxWindow2Delay += LORAMAC_RX_PREARM_TIME / 1000;
+#ifdef CONFIG_TIMER_PRECISE
+        RxWindow1DelayUs += LORAMAC_RX_PREARM_TIME;
+        RxWindow2DelayUs += LORAMAC_RX_PREARM_TIME;
+#endif
+    }
+#endif
 
     // Schedule transmission of frame
     if ( dutyCycleTimeOff == 0 ) {
 #ifdef  CONFIG_LORA_CAD   
         StartCAD(Channel);
         return LORAMAC_STATUS_OK;
+#elif defined( CONFIG_LORA_LBT_ASYNC )
+        if ( StartCarrierSense( Channel ) == true ) {
+            return LORAMAC_STATUS_OK;
+        }
+        return SendFrameOnChannel( Channel );
 #else        
         // Try to send now
         return SendFrameOnChannel( Channel );
@@ -2560,6 +3583,7 @@ static void ResetMacParameters( void )
     // Counters
     UpLinkCounter = 0;
     DownLinkCounter = 0;
+    DownLinkCounterValid = false;
     AdrAckCounter = 0;
 
     ChannelsNbRepCounter = 0;
@@ -2593,6 +3617,7 @@ static void ResetMacParameters( void )
     MulticastParams_t *cur = MulticastChannels;
     while ( cur != NULL ) {
         cur->DownLinkCounter = 0;
+        cur->DownLinkCounterValid = false;
         cur = cur->Next;
     }
 
@@ -2616,6 +3641,109 @@ static void OpenContinuousRx2Window( void )
     RxSlot = RX_SLOT_WIN_CLASS_C;
 }
 
+static void InitFrameCtrl( LoRaMacFrameCtrl_t *fCtrl )
+{
+    fCtrl->Value = 0;
+    fCtrl->Bits.FOptsLen      = 0;
+    if( LoRaMacDeviceClass == CLASS_B )
+    {
+        LOG_PRINTF(LL_VDEBUG, "Send class b frame\r\n");        
+        fCtrl->Bits.FPending      = 1;
+    }
+    else
+    {
+        fCtrl->Bits.FPending      = 0;
+    }
+    fCtrl->Bits.Ack           = false;
+    fCtrl->Bits.AdrAckReq     = false;
+    fCtrl->Bits.Adr           = AdrCtrlOn;
+}
+
+#ifdef CONFIG_LORAMAC_PREBUILD
+static void LoRaMacTxStateSave( LoRaMacTxState_t *state )
+{
+    state->UpLinkCounter = UpLinkCounter;
+    state->AdrAckCounter = AdrAckCounter;
+    state->DevAddr = LoRaMacDevAddr;
+    memcpy1( state->NwkSKey, LoRaMacNwkSKey, 16 );
+    memcpy1( state->AppSKey, LoRaMacAppSKey, 16 );
+    state->Datarate = LoRaMacParams.ChannelsDatarate;
+    state->TxPower = LoRaMacParams.ChannelsTxPower;
+    state->UplinkDwellTime = LoRaMacParams.UplinkDwellTime;
+    state->Joined = IsLoRaMacNetworkJoined;
+    state->AdrCtrlOn = AdrCtrlOn;
+    state->SrvAckRequested = SrvAckRequested;
+    state->MacCommandsInNextTx = MacCommandsInNextTx;
+    state->MacCommandsBufferIndex = MacCommandsBufferIndex;
+    state->MacCommandsBufferToRepeatIndex = MacCommandsBufferToRepeatIndex;
+    memcpy1( state->MacCommandsBuffer, MacCommandsBuffer, MacCommandsBufferIndex );
+    memcpy1( state->MacCommandsBufferToRepeat, MacCommandsBufferToRepeat, MacCommandsBufferToRepeatIndex );
+}
+
+static void LoRaMacTxStateRestore( const LoRaMacTxState_t *state )
+{
+    // The keys, the address and the join state are not updated by
+    // PrepareFrame
+    UpLinkCounter = state->UpLinkCounter;
+    AdrAckCounter = state->AdrAckCounter;
+    LoRaMacParams.ChannelsDatarate = state->Datarate;
+    LoRaMacParams.ChannelsTxPower = state->TxPower;
+    SrvAckRequested = state->SrvAckRequested;
+    MacCommandsInNextTx = state->MacCommandsInNextTx;
+    MacCommandsBufferIndex = state->MacCommandsBufferIndex;
+    MacCommandsBufferToRepeatIndex = state->MacCommandsBufferToRepeatIndex;
+    memcpy1( MacCommandsBuffer, state->MacCommandsBuffer, MacCommandsBufferIndex );
+    memcpy1( MacCommandsBufferToRepeat, state->MacCommandsBufferToRepeat, MacCommandsBufferToRepeatIndex );
+}
+
+static bool LoRaMacTxStateEqual( const LoRaMacTxState_t *state )
+{
+    return ( state->UpLinkCounter == UpLinkCounter ) &&
+           ( state->AdrAckCounter == AdrAckCounter ) &&
+           ( state->DevAddr == LoRaMacDevAddr ) &&
+           ( memcmp( state->NwkSKey, LoRaMacNwkSKey, 16 ) == 0 ) &&
+           ( memcmp( state->AppSKey, LoRaMacAppSKey, 16 ) == 0 ) &&
+           ( state->Datarate == LoRaMacParams.ChannelsDatarate ) &&
+           ( state->TxPower == LoRaMacParams.ChannelsTxPower ) &&
+           ( state->UplinkDwellTime == LoRaMacParams.UplinkDwellTime ) &&
+           ( state->Joined == IsLoRaMacNetworkJoined ) &&
+           ( state->AdrCtrlOn == AdrCtrlOn ) &&
+           ( state->SrvAckRequested == SrvAckRequested ) &&
+           ( state->MacCommandsInNextTx == MacCommandsInNextTx ) &&
+           ( state->MacCommandsBufferIndex == MacCommandsBufferIndex ) &&
+           ( state->MacCommandsBufferToRepeatIndex == MacCommandsBufferToRepeatIndex ) &&
+           ( memcmp( state->MacCommandsBuffer, MacCommandsBuffer, MacCommandsBufferIndex ) == 0 ) &&
+           ( memcmp( state->MacCommandsBufferToRepeat, MacCommandsBufferToRepeat, MacCommandsBufferToRepeatIndex ) == 0 );
+}
+
+static LoRaMacStatus_t PrepareStagedFrame( LoRaMacHeader_t *macHdr, LoRaMacFrameCtrl_t *fCtrl, uint8_t fPort, void *fBuffer,
+                                           uint16_t fBufferSize )
+{
+    if ( fBuffer == NULL ) {
+        fBufferSize = 0;
+    }
+    if ( ( LoRaMacStaged.Valid == false ) ||
+         ( LoRaMacStaged.MacHdr != macHdr->Value ) ||
+         ( LoRaMacStaged.FCtrlIn != fCtrl->Value ) ||
+         ( LoRaMacStaged.FPort != fPort ) ||
+         ( LoRaMacStaged.FBufferSize != fBufferSize ) ||
+         ( ( fBufferSize > 0 ) && ( memcmp( LoRaMacStaged.FBuffer, fBuffer, fBufferSize ) != 0 ) ) ||
+         ( LoRaMacTxStateEqual( &LoRaMacStaged.Before ) == false ) ) {
+        return PrepareFrame( macHdr, fCtrl, fPort, fBuffer, fBufferSize );
+    }
+
+    // LoRaMacBuffer holds the frame, the MAC moves on to the state it has
+    // been built into
+    LoRaMacStaged.Valid = false;
+    LoRaMacTxStateRestore( &LoRaMacStaged.After );
+    NodeAckRequested = LoRaMacStaged.NodeAckRequested;
+    LoRaMacTxPayloadLen = LoRaMacStaged.TxPayloadLen;
+    LoRaMacBufferPktLen = LoRaMacStaged.PktLen;
+    fCtrl->Value = LoRaMacStaged.FCtrlOut;
+    return LORAMAC_STATUS_OK;
+}
+#endif
+
 LoRaMacStatus_t PrepareFrame( LoRaMacHeader_t *macHdr, LoRaMacFrameCtrl_t *fCtrl, uint8_t fPort, void *fBuffer,
                               uint16_t fBufferSize )
 {
@@ -2626,10 +3754,16 @@ LoRaMacStatus_t PrepareFrame( LoRaMacHeader_t *macHdr, LoRaMacFrameCtrl_t *fCtrl
     const void *payload = fBuffer;
     uint8_t framePort = fPort;
 
+    PROFILE_START( PROFILE_MAC_PREPARE_FRAME );
+
     LoRaMacBufferPktLen = 0;
 
     NodeAckRequested = false;
 
+#ifdef CONFIG_LORAMAC_PREBUILD
+    LoRaMacStaged.Valid = false;
+#endif
+
     if ( fBuffer == NULL ) {
         fBufferSize = 0;
     }
@@ -2668,6 +3802,7 @@ LoRaMacStatus_t PrepareFrame( LoRaMacHeader_t *macHdr, LoRaMacFrameCtrl_t *fCtrl
         //Intentional fallthrough
         case FRAME_TYPE_DATA_UNCONFIRMED_UP:
             if ( IsLoRaMacNetworkJoined == false ) {
+                PROFILE_STOP( PROFILE_MAC_PREPARE_FRAME );
                 return LORAMAC_STATUS_NO_NETWORK_JOINED; // No network has been joined yet
             }
 
@@ -2767,9 +3902,11 @@ LoRaMacStatus_t PrepareFrame( LoRaMacHeader_t *macHdr, LoRaMacFrameCtrl_t *fCtrl
             }
             break;
         default:
+            PROFILE_STOP( PROFILE_MAC_PREPARE_FRAME );
             return LORAMAC_STATUS_SERVICE_UNKNOWN;
     }
 
+    PROFILE_STOP( PROFILE_MAC_PREPARE_FRAME );
     return LORAMAC_STATUS_OK;
 }
 
@@ -2806,6 +3943,12 @@ LoRaMacStatus_t SendFrameOnChannel( uint8_t channel )
             LoRaMacClassBStopRxSlots( );
         }
     }
+    RADIO_ARBITER_ACQUIRE( RADIO_ARBITER_LORAMAC );
+    if( ( LoRaMacCallbacks != NULL ) && ( LoRaMacCallbacks->GetTemperatureLevel != NULL ) )
+    {
+        // A drifted image calibration is redone by the channel setting below
+        Radio.SetTemperature( ( int8_t )LoRaMacCallbacks->GetTemperatureLevel( ) );
+    }
     RegionTxConfig( LoRaMacRegion, &txConfig, &txPower, &TxTimeOnAir );
 
     LoRaMacConfirmQueueSetStatusCmn( LORAMAC_EVENT_INFO_STATUS_ERROR );
@@ -2817,6 +3960,9 @@ LoRaMacStatus_t SendFrameOnChannel( uint8_t channel )
     // Store the time on air
     McpsConfirm.TxTimeOnAir = TxTimeOnAir;
     MlmeConfirm.TxTimeOnAir = TxTimeOnAir;
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+    RetryAirTime += ( uint32_t )TxTimeOnAir;
+#endif
 
     if( LoRaMacClassBIsBeaconModeActive( ) == true )
     {
@@ -2832,12 +3978,11 @@ LoRaMacStatus_t SendFrameOnChannel( uint8_t channel )
 
     LoRaMacClassBHaltBeaconing( );
 
-    // Starts the MAC layer status check timer
-    TimerSetValue( &MacStateCheckTimer, MAC_STATE_CHECK_TIMEOUT );
-    TimerStart( &MacStateCheckTimer );
-
     if ( IsLoRaMacNetworkJoined == false ) {
         JoinRequestTrials++;
+        STATS_INC( STATS_JOIN_REQUEST );
+    } else {
+        STATS_UPLINK( LoRaMacParams.ChannelsDatarate );
     }
     // Send now
     Radio.Send( LoRaMacBuffer, LoRaMacBufferPktLen );
@@ -2860,12 +4005,9 @@ LoRaMacStatus_t SetTxContinuousWave( uint16_t timeout )
     continuousWave.AntennaGain = LoRaMacParams.AntennaGain;
     continuousWave.Timeout = timeout;
 
+    RADIO_ARBITER_ACQUIRE( RADIO_ARBITER_LORAMAC );
     RegionSetContinuousWave( LoRaMacRegion, &continuousWave );
 
-    // Starts the MAC layer status check timer
-    TimerSetValue( &MacStateCheckTimer, MAC_STATE_CHECK_TIMEOUT );
-    TimerStart( &MacStateCheckTimer );
-
     LoRaMacState |= LORAMAC_TX_RUNNING;
 
     return LORAMAC_STATUS_OK;
@@ -2873,12 +4015,9 @@ LoRaMacStatus_t SetTxContinuousWave( uint16_t timeout )
 
 LoRaMacStatus_t SetTxContinuousWave1( uint16_t timeout, uint32_t frequency, uint8_t power )
 {
+    RADIO_ARBITER_ACQUIRE( RADIO_ARBITER_LORAMAC );
     Radio.SetTxContinuousWave( frequency, power, timeout );
 
-    // Starts the MAC layer status check timer
-    TimerSetValue( &MacStateCheckTimer, MAC_STATE_CHECK_TIMEOUT );
-    TimerStart( &MacStateCheckTimer );
-
     LoRaMacState |= LORAMAC_TX_RUNNING;
 
     return LORAMAC_STATUS_OK;
@@ -2916,6 +4055,7 @@ LoRaMacStatus_t LoRaMacInitialization( LoRaMacPrimitives_t *primitives, LoRaMacC
     LoRaMacPrimitives = primitives;
     LoRaMacCallbacks = callbacks;
     LoRaMacRegion = region;
+    MaxPayloadCacheKey = 0xFF;
 
     LoRaMacFlags.Value = 0;
 
@@ -3011,15 +4151,25 @@ LoRaMacStatus_t LoRaMacInitialization( LoRaMacPrimitives_t *primitives, LoRaMacC
 
     // Initialize timers
     TimerInit( &MacStateCheckTimer, OnMacStateCheckTimerEvent );
-    TimerSetValue( &MacStateCheckTimer, MAC_STATE_CHECK_TIMEOUT );
 
     TimerInit( &TxDelayedTimer, OnTxDelayedTimerEvent );
     TimerInit( &RxWindowTimer1, OnRxWindow1TimerEvent );
     TimerInit( &RxWindowTimer2, OnRxWindow2TimerEvent );
+#ifdef CONFIG_TIMER_DEFER
+    // The receive windows open from the timer interrupt, behind no callback
+    TimerSetUrgent( &RxWindowTimer1, true );
+    TimerSetUrgent( &RxWindowTimer2, true );
+#endif
     TimerInit( &AckTimeoutTimer, OnAckTimeoutTimerEvent );
 #ifdef CONFIG_LORA_CAD    
     TimerInit( &TxImmediateTimer, OnTxImmediateTimerEvent );
+#endif
+#ifdef CONFIG_LORAMAC_TX_QUEUE
+    TimerInit( &TxQueueTimer, OnTxQueueTimerEvent );
 #endif    
+#ifdef CONFIG_LORAMAC_MAC_CMD_DEFER
+    TimerInit( &MacCmdDeferTimer, OnMacCmdDeferTimerEvent );
+#endif
 
     // Store the current initialization time
     LoRaMacInitializationTime = TimerGetCurrentTime( );
@@ -3027,13 +4177,27 @@ LoRaMacStatus_t LoRaMacInitialization( LoRaMacPrimitives_t *primitives, LoRaMacC
     // Initialize Radio driver
     RadioEvents.TxDone = OnRadioTxDone;
     RadioEvents.RxDone = OnRadioRxDone;
+    RadioEvents.RxFilter = OnRadioRxFilter;
     RadioEvents.RxError = OnRadioRxError;
     RadioEvents.TxTimeout = OnRadioTxTimeout;
     RadioEvents.RxTimeout = OnRadioRxTimeout;
 #ifdef CONFIG_LORA_CAD
     RadioEvents.CadDone = OnRadioCadDone;
 #endif
+#ifdef CONFIG_LORA_LBT_ASYNC
+    RadioEvents.CarrierSenseDone = OnRadioCarrierSenseDone;
+#endif
+#ifdef CONFIG_RADIO_ARBITER
+    RadioArbiterRegister( RADIO_ARBITER_LORAMAC, &RadioEvents, NULL );
+    RadioArbiterAcquire( RADIO_ARBITER_LORAMAC, 0 );
+#else
     Radio.Init( &RadioEvents );
+#endif
+
+    LoRaMacRxBuffersBusy = 0;
+    LoRaMacRxBuffersHeld = 0;
+    LoRaMacRxBufferLent = LORAMAC_RX_BUFFER_COUNT;
+    LoRaMacRxBufferLend( );
 
     // Random seed initialization
     srand1( Radio.Random( ) );
@@ -3041,6 +4205,7 @@ LoRaMacStatus_t LoRaMacInitialization( LoRaMacPrimitives_t *primitives, LoRaMacC
     PublicNetwork = true;
     Radio.SetPublicNetwork(true);
     Radio.Sleep( );
+    RADIO_ARBITER_RELEASE( RADIO_ARBITER_LORAMAC );
 
     // Initialize class b
     // Apply callback
@@ -3069,8 +4234,6 @@ LoRaMacStatus_t LoRaMacInitialization( LoRaMacPrimitives_t *primitives, LoRaMacC
 LoRaMacStatus_t LoRaMacQueryTxPossible( uint8_t size, LoRaMacTxInfo_t *txInfo )
 {
     AdrNextParams_t adrNext;
-    GetPhyParams_t getPhy;
-    PhyParam_t phyParam;
     int8_t datarate = LoRaMacParamsDefaults.ChannelsDatarate;
     int8_t txPower = LoRaMacParamsDefaults.ChannelsTxPower;
     uint8_t fOptLen = MacCommandsBufferIndex + MacCommandsBufferToRepeatIndex;
@@ -3091,17 +4254,7 @@ LoRaMacStatus_t LoRaMacQueryTxPossible( uint8_t size, LoRaMacTxInfo_t *txInfo )
     // apply the datarate, the tx power and the ADR ack counter.
     RegionAdrNext( LoRaMacRegion, &adrNext, &datarate, &txPower, &AdrAckCounter );
 
-    // Setup PHY request
-    getPhy.UplinkDwellTime = LoRaMacParams.UplinkDwellTime;
-    getPhy.Datarate = datarate;
-    getPhy.Attribute = PHY_MAX_PAYLOAD;
-
-    // Change request in case repeater is supported
-    if( LoRaMacParams.RepeaterSupport == true ) {
-        getPhy.Attribute = PHY_MAX_PAYLOAD_REPEATER;
-    }
-    phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
-    txInfo->CurrentPayloadSize = phyParam.Value;
+    txInfo->CurrentPayloadSize = GetMaxPayload( datarate );
 
     // Verify if the fOpts fit into the maximum payload
     if ( txInfo->CurrentPayloadSize >= fOptLen ) {
@@ -3122,6 +4275,71 @@ LoRaMacStatus_t LoRaMacQueryTxPossible( uint8_t size, LoRaMacTxInfo_t *txInfo )
     return LORAMAC_STATUS_OK;
 }
 
+#ifdef CONFIG_LORAMAC_TX_TIME
+LoRaMacStatus_t LoRaMacQueryTxTime( uint8_t size, LoRaMacTxTime_t *txTime )
+{
+    NextChanParams_t nextChan;
+    GetPhyParams_t getPhy;
+    PhyParam_t phyParam;
+    TimerTime_t aggregatedTimeOff;
+    uint8_t fOptLen = MacCommandsBufferIndex + MacCommandsBufferToRepeatIndex;
+
+    if ( txTime == NULL ) {
+        return LORAMAC_STATUS_PARAMETER_INVALID;
+    }
+    if ( MaxDCycle == 255 ) {
+        return LORAMAC_STATUS_DEVICE_OFF;
+    }
+    if ( ( LoRaMacState & LORAMAC_TX_RUNNING ) == LORAMAC_TX_RUNNING ) {
+        return LORAMAC_STATUS_BUSY;
+    }
+    if ( IsLoRaMacNetworkJoined == false ) {
+        return LORAMAC_STATUS_NO_NETWORK_JOINED;
+    }
+
+    // The back-off of the last uplink, as the next ScheduleTx computes it
+    CalculateBackOff( LastTxChannel );
+    SetupNextChanParams( &nextChan );
+
+    // The channel selection of ScheduleTx on copies of the MAC state
+    aggregatedTimeOff = AggregatedTimeOff;
+    while ( RegionNextChannel( LoRaMacRegion, &nextChan, &txTime->Channel, &txTime->Delay, &aggregatedTimeOff ) == false ) {
+        nextChan.Datarate = LoRaMacParamsDefaults.ChannelsDatarate;
+    }
+    txTime->Datarate = nextChan.Datarate;
+
+    // The MAC commands are omitted when they do not fit
+    if ( GetMaxPayload( txTime->Datarate ) < fOptLen ) {
+        fOptLen = 0;
+    }
+    if ( ValidatePayloadLength( size, txTime->Datarate, fOptLen ) == false ) {
+        return LORAMAC_STATUS_LENGTH_ERROR;
+    }
+
+    getPhy.Attribute = PHY_CHANNELS;
+    phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+    txTime->Frequency = phyParam.Channels[txTime->Channel].Frequency;
+
+    // MHDR, FHDR, FPort and MIC around the payload
+    getPhy.Attribute = PHY_TX_TIME_ON_AIR;
+    getPhy.Datarate = txTime->Datarate;
+    getPhy.PktLen = size + fOptLen + 13;
+    phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+    txTime->TimeOnAir = phyParam.Value;
+
+    return LORAMAC_STATUS_OK;
+}
+#endif
+
+uint8_t LoRaMacGetMaxPayload( void )
+{
+    uint8_t maxN = GetMaxPayload( LoRaMacParams.ChannelsDatarate );
+    uint8_t fOptLen = MacCommandsBufferIndex + MacCommandsBufferToRepeatIndex;
+
+    // The MAC commands are omitted when they do not fit
+    return ( maxN >= fOptLen ) ? ( maxN - fOptLen ) : maxN;
+}
+
 LoRaMacStatus_t LoRaMacMibGetRequestConfirm( MibRequestConfirm_t *mibGet )
 {
     LoRaMacStatus_t status = LORAMAC_STATUS_OK;
@@ -3262,6 +4480,42 @@ LoRaMacStatus_t LoRaMacMibGetRequestConfirm( MibRequestConfirm_t *mibGet )
             mibGet->Param.AntennaGain = LoRaMacParams.AntennaGain;
             break;
         }
+        case MIB_CLASS_C_RX_PREAMBLE: {
+            mibGet->Param.ClassCRxPreamble = ClassCRxPreamble;
+            break;
+        }
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+        case MIB_RETRY_POLICY: {
+            mibGet->Param.RetryPolicy = RetryPolicy;
+            break;
+        }
+#endif
+#ifdef CONFIG_LORAMAC_LINK_ADR
+        case MIB_LINK_ADR: {
+            mibGet->Param.LinkAdr.Enable = LinkAdr.Enable;
+            mibGet->Param.LinkAdr.NbSamples = LinkAdr.NbSamples;
+            mibGet->Param.LinkAdr.Snr = LinkAdrBestSnr( );
+            mibGet->Param.LinkAdr.Datarate = LoRaMacParams.ChannelsDatarate;
+            mibGet->Param.LinkAdr.TxPower = LoRaMacParams.ChannelsTxPower;
+            break;
+        }
+#endif
+#ifdef CONFIG_LORA_RADIO_STATS
+        case MIB_RADIO_STATS: {
+            if ( mibGet->Param.RadioStats == NULL ) {
+                status = LORAMAC_STATUS_PARAMETER_INVALID;
+            } else {
+                RadioStatsGet( mibGet->Param.RadioStats );
+            }
+            break;
+        }
+#endif
+#ifdef CONFIG_LORAMAC_MAC_CMD_DEFER
+        case MIB_MAC_CMD_DEFER: {
+            mibGet->Param.MacCmdDefer = MacCmdDefer;
+            break;
+        }
+#endif
 #ifdef CONFIG_LWAN
         case MIB_RX1_DATARATE_OFFSET: {
             mibGet->Param.Rx1DrOffset = LoRaMacParams.Rx1DrOffset;
@@ -3334,8 +4588,7 @@ LoRaMacStatus_t LoRaMacMibSetRequestConfirm( MibRequestConfirm_t *mibSet )
         }
         case MIB_NWK_SKEY: {
             if ( mibSet->Param.NwkSKey != NULL ) {
-                memcpy1( LoRaMacNwkSKey, mibSet->Param.NwkSKey,
-                         sizeof( LoRaMacNwkSKey ) );
+                memcpy1( LoRaMacNwkSKey, mibSet->Param.NwkSKey, 16 );
             } else {
                 status = LORAMAC_STATUS_PARAMETER_INVALID;
             }
@@ -3343,8 +4596,7 @@ LoRaMacStatus_t LoRaMacMibSetRequestConfirm( MibRequestConfirm_t *mibSet )
         }
         case MIB_APP_SKEY: {
             if ( mibSet->Param.AppSKey != NULL ) {
-                memcpy1( LoRaMacAppSKey, mibSet->Param.AppSKey,
-                         sizeof( LoRaMacAppSKey ) );
+                memcpy1( LoRaMacAppSKey, mibSet->Param.AppSKey, 16 );
             } else {
                 status = LORAMAC_STATUS_PARAMETER_INVALID;
             }
@@ -3383,6 +4635,7 @@ LoRaMacStatus_t LoRaMacMibSetRequestConfirm( MibRequestConfirm_t *mibSet )
                     RxWindow2Config.RxSlot = RX_SLOT_WIN_2;
                     RxWindow2Config.RxContinuous = true;
 
+                    RADIO_ARBITER_ACQUIRE( RADIO_ARBITER_LORAMAC );
                     Radio.Sleep();
                     if ( RegionRxConfig( LoRaMacRegion, &RxWindow2Config, ( int8_t * )&McpsIndication.RxDatarate ) == true ) {
                         RxWindowSetup( RxWindow2Config.RxContinuous, LoRaMacParams.MaxRxWindow );
@@ -3466,6 +4719,7 @@ LoRaMacStatus_t LoRaMacMibSetRequestConfirm( MibRequestConfirm_t *mibSet )
         }
         case MIB_CHANNELS_DATARATE: {
             verify.DatarateParams.Datarate = mibSet->Param.ChannelsDatarate;
+            verify.DatarateParams.UplinkDwellTime = LoRaMacParams.UplinkDwellTime;
 
             if ( RegionVerify( LoRaMacRegion, &verify, PHY_TX_DR ) == true ) {
                 LoRaMacParams.ChannelsDatarate = verify.DatarateParams.Datarate;
@@ -3489,6 +4743,9 @@ LoRaMacStatus_t LoRaMacMibSetRequestConfirm( MibRequestConfirm_t *mibSet )
 
             if ( RegionVerify( LoRaMacRegion, &verify, PHY_TX_POWER ) == true ) {
                 LoRaMacParams.ChannelsTxPower = verify.TxPower;
+#ifdef CONFIG_LORAMAC_LINK_ADR
+                LinkAdr.BaseTxPower = verify.TxPower;
+#endif
             } else {
                 status = LORAMAC_STATUS_PARAMETER_INVALID;
             }
@@ -3500,6 +4757,7 @@ LoRaMacStatus_t LoRaMacMibSetRequestConfirm( MibRequestConfirm_t *mibSet )
         }
         case MIB_DOWNLINK_COUNTER: {
             DownLinkCounter = mibSet->Param.DownLinkCounter;
+            DownLinkCounterValid = ( DownLinkCounter != 0 );
             break;
         }
         case MIB_SYSTEM_MAX_RX_ERROR: {
@@ -3514,6 +4772,49 @@ LoRaMacStatus_t LoRaMacMibSetRequestConfirm( MibRequestConfirm_t *mibSet )
             LoRaMacParams.AntennaGain = mibSet->Param.AntennaGain;
             break;
         }
+        case MIB_CLASS_C_RX_PREAMBLE: {
+            ClassCRxPreamble = mibSet->Param.ClassCRxPreamble;
+            break;
+        }
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+        case MIB_RETRY_POLICY: {
+            if ( ( mibSet->Param.RetryPolicy != NULL ) && ( mibSet->Param.RetryPolicy->Next == NULL ) ) {
+                status = LORAMAC_STATUS_PARAMETER_INVALID;
+            } else {
+                RetryPolicy = ( mibSet->Param.RetryPolicy != NULL ) ? mibSet->Param.RetryPolicy : &LoRaMacRetryPolicyDefault;
+            }
+            break;
+        }
+#endif
+#ifdef CONFIG_LORAMAC_LINK_ADR
+        case MIB_LINK_ADR: {
+            if ( mibSet->Param.LinkAdr.Enable != LinkAdr.Enable ) {
+                if ( mibSet->Param.LinkAdr.Enable == true ) {
+                    LinkAdr.BaseTxPower = LoRaMacParams.ChannelsTxPower;
+                } else {
+                    // Back to the TX power of the application
+                    LoRaMacParams.ChannelsTxPower = LinkAdr.BaseTxPower;
+                }
+                LinkAdr.Enable = mibSet->Param.LinkAdr.Enable;
+            }
+            break;
+        }
+#endif
+#ifdef CONFIG_LORA_RADIO_STATS
+        case MIB_RADIO_STATS: {
+            RadioStatsReset( );
+            break;
+        }
+#endif
+#ifdef CONFIG_LORAMAC_MAC_CMD_DEFER
+        case MIB_MAC_CMD_DEFER: {
+            MacCmdDefer = mibSet->Param.MacCmdDefer;
+            if ( MacCmdDefer == 0 ) {
+                TimerStop( &MacCmdDeferTimer );
+            }
+            break;
+        }
+#endif
         case MIB_MULTICAST_CHANNEL: {
             status = LoRaMacMulticastChannelLink(mibSet->Param.MulticastList);
             break;
@@ -3555,6 +4856,186 @@ LoRaMacStatus_t LoRaMacMibSetRequestConfirm( MibRequestConfirm_t *mibSet )
     return status;
 }
 
+static bool IsParamsMib( Mib_t type )
+{
+    switch ( type ) {
+        case MIB_ADR:
+        case MIB_RX2_CHANNEL:
+        case MIB_CHANNELS_NB_REP:
+        case MIB_MAX_RX_WINDOW_DURATION:
+        case MIB_RECEIVE_DELAY_1:
+        case MIB_RECEIVE_DELAY_2:
+        case MIB_JOIN_ACCEPT_DELAY_1:
+        case MIB_JOIN_ACCEPT_DELAY_2:
+        case MIB_CHANNELS_DATARATE:
+        case MIB_CHANNELS_TX_POWER:
+#ifdef CONFIG_LWAN
+        case MIB_RX1_DATARATE_OFFSET:
+#endif
+            return true;
+        default:
+            return false;
+    }
+}
+
+LoRaMacStatus_t LoRaMacMibSetParams( MibRequestConfirm_t *mibSet, uint8_t nbMib )
+{
+    LoRaMacStatus_t status = LORAMAC_STATUS_OK;
+    LoRaMacParams_t params;
+    bool adrCtrlOn = AdrCtrlOn;
+#ifdef CONFIG_LORAMAC_LINK_ADR
+    int8_t baseTxPower = LinkAdr.BaseTxPower;
+#endif
+    uint8_t i;
+
+    if ( ( mibSet == NULL ) && ( nbMib > 0 ) ) {
+        return LORAMAC_STATUS_PARAMETER_INVALID;
+    }
+    if ( ( LoRaMacState & LORAMAC_TX_RUNNING ) == LORAMAC_TX_RUNNING ) {
+        return LORAMAC_STATUS_BUSY;
+    }
+    for ( i = 0; i < nbMib; i++ ) {
+        if ( IsParamsMib( mibSet[i].Type ) == false ) {
+            return LORAMAC_STATUS_PARAMETER_INVALID;
+        }
+    }
+
+    memcpy( &params, &LoRaMacParams, sizeof( params ) );
+    for ( i = 0; ( i < nbMib ) && ( status == LORAMAC_STATUS_OK ); i++ ) {
+        status = LoRaMacMibSetRequestConfirm( &mibSet[i] );
+    }
+
+    if ( status != LORAMAC_STATUS_OK ) {
+        bool rx2Changed = memcmp( &params.Rx2Channel, &LoRaMacParams.Rx2Channel, sizeof( params.Rx2Channel ) ) != 0;
+
+        memcpy( &LoRaMacParams, &params, sizeof( params ) );
+        AdrCtrlOn = adrCtrlOn;
+#ifdef CONFIG_LORAMAC_LINK_ADR
+        LinkAdr.BaseTxPower = baseTxPower;
+#endif
+        if ( rx2Changed == true ) {
+            MibRequestConfirm_t rx2;
+
+            // Class C reopens its continuous window on the restored channel
+            rx2.Type = MIB_RX2_CHANNEL;
+            rx2.Param.Rx2Channel = params.Rx2Channel;
+            LoRaMacMibSetRequestConfirm( &rx2 );
+        }
+    }
+    return status;
+}
+
+bool LoRaMacIsNetworkJoined( void )
+{
+    return IsLoRaMacNetworkJoined;
+}
+
+int8_t LoRaMacGetDatarate( void )
+{
+    return LoRaMacParams.ChannelsDatarate;
+}
+
+DeviceClass_t LoRaMacGetDeviceClass( void )
+{
+    return LoRaMacDeviceClass;
+}
+
+bool LoRaMacIsAdrOn( void )
+{
+    return AdrCtrlOn;
+}
+
+#ifdef CONFIG_LORAMAC_SESSION
+LoRaMacStatus_t LoRaMacSessionExport( LoRaMacSession_t *session )
+{
+    GetPhyParams_t getPhy;
+    PhyParam_t phyParam;
+    uint8_t nbChannels;
+
+    if ( session == NULL ) {
+        return LORAMAC_STATUS_PARAMETER_INVALID;
+    }
+    if ( IsLoRaMacNetworkJoined == false ) {
+        return LORAMAC_STATUS_NO_NETWORK_JOINED;
+    }
+
+    memset1( ( uint8_t * )session, 0, sizeof( LoRaMacSession_t ) );
+    session->NetID = LoRaMacNetID;
+    session->DevAddr = LoRaMacDevAddr;
+    memcpy1( session->NwkSKey, LoRaMacNwkSKey, 16 );
+    memcpy1( session->AppSKey, LoRaMacAppSKey, 16 );
+    session->UpLinkCounter = UpLinkCounter;
+    session->DownLinkCounter = DownLinkCounter;
+    memcpy1( ( uint8_t * )&session->Params, ( uint8_t * )&LoRaMacParams, sizeof( LoRaMacParams ) );
+    session->AdrCtrlOn = AdrCtrlOn;
+    session->AdrAckCounter = AdrAckCounter;
+    session->MaxDCycle = MaxDCycle;
+    session->DeviceClass = LoRaMacDeviceClass;
+
+    getPhy.Attribute = PHY_MAX_NB_CHANNELS;
+    phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+    nbChannels = phyParam.Value;
+
+    getPhy.Attribute = PHY_CHANNELS_MASK;
+    phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+    memcpy1( ( uint8_t * )session->ChannelsMask, ( uint8_t * )phyParam.ChannelsMask,
+             MIN( ( nbChannels + 15 ) / 16, LORAMAC_SESSION_MASK_SIZE ) * sizeof( uint16_t ) );
+
+    if ( nbChannels <= LORAMAC_SESSION_MAX_CHANNELS ) {
+        getPhy.Attribute = PHY_CHANNELS;
+        phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+        session->NbChannels = nbChannels;
+        memcpy1( ( uint8_t * )session->Channels, ( uint8_t * )phyParam.Channels, nbChannels * sizeof( ChannelParams_t ) );
+    }
+    return LORAMAC_STATUS_OK;
+}
+
+LoRaMacStatus_t LoRaMacSessionImport( const LoRaMacSession_t *session )
+{
+    MibRequestConfirm_t mibSet;
+
+    if ( ( session == NULL ) || ( session->NbChannels > LORAMAC_SESSION_MAX_CHANNELS ) ) {
+        return LORAMAC_STATUS_PARAMETER_INVALID;
+    }
+    if ( ( LoRaMacState & LORAMAC_TX_RUNNING ) == LORAMAC_TX_RUNNING ) {
+        return LORAMAC_STATUS_BUSY;
+    }
+
+    LoRaMacNetID = session->NetID;
+    LoRaMacDevAddr = session->DevAddr;
+    memcpy1( LoRaMacNwkSKey, session->NwkSKey, 16 );
+    memcpy1( LoRaMacAppSKey, session->AppSKey, 16 );
+    UpLinkCounter = session->UpLinkCounter;
+    DownLinkCounter = session->DownLinkCounter;
+    DownLinkCounterValid = ( DownLinkCounter != 0 );
+    memcpy1( ( uint8_t * )&LoRaMacParams, ( uint8_t * )&session->Params, sizeof( LoRaMacParams ) );
+    AdrCtrlOn = session->AdrCtrlOn;
+    AdrAckCounter = session->AdrAckCounter;
+    MaxDCycle = session->MaxDCycle;
+    if ( MaxDCycle != 255 ) {
+        AggregatedDCycle = 1 << MaxDCycle;
+    }
+
+    // The channels the network added, the default ones are refused
+    for ( uint8_t i = 0; i < session->NbChannels; i++ ) {
+        if ( session->Channels[i].Frequency != 0 ) {
+            LoRaMacChannelAdd( i, session->Channels[i] );
+        } else {
+            LoRaMacChannelRemove( i );
+        }
+    }
+    mibSet.Type = MIB_CHANNELS_MASK;
+    mibSet.Param.ChannelsMask = ( uint16_t * )session->ChannelsMask;
+    LoRaMacMibSetRequestConfirm( &mibSet );
+
+    IsLoRaMacNetworkJoined = true;
+    if ( session->DeviceClass == CLASS_C ) {
+        SwitchClass( CLASS_C );
+    }
+    return LORAMAC_STATUS_OK;
+}
+#endif
+
 LoRaMacStatus_t LoRaMacChannelAdd( uint8_t id, ChannelParams_t params )
 {
     ChannelAddParams_t channelAdd;
@@ -3592,18 +5073,29 @@ LoRaMacStatus_t LoRaMacChannelRemove( uint8_t id )
 
 LoRaMacStatus_t LoRaMacMulticastChannelLink( MulticastParams_t *channelParam )
 {
+    uint8_t pos;
+
     if ( channelParam == NULL ) {
         return LORAMAC_STATUS_PARAMETER_INVALID;
     }
     if ( ( LoRaMacState & LORAMAC_TX_RUNNING ) == LORAMAC_TX_RUNNING ) {
         return LORAMAC_STATUS_BUSY;
     }
+    pos = MulticastSearch( channelParam->Address );
+    if ( ( MulticastCount >= LORAMAC_MULTICAST_MAX ) ||
+         ( ( pos < MulticastCount ) && ( MulticastIndex[pos]->Address == channelParam->Address ) ) ) {
+        return LORAMAC_STATUS_PARAMETER_INVALID;
+    }
+    memmove( &MulticastIndex[pos + 1], &MulticastIndex[pos], ( MulticastCount - pos ) * sizeof( MulticastIndex[0] ) );
+    MulticastIndex[pos] = channelParam;
+    MulticastCount++;
 
     // Calculate class b parameters
     LoRaMacClassBSetMulticastPeriodicity( channelParam );
 
     // Reset downlink counter
     channelParam->DownLinkCounter = 0;
+    channelParam->DownLinkCounterValid = false;
     channelParam->Next = NULL;
 
     if ( MulticastChannels == NULL ) {
@@ -3651,6 +5143,12 @@ LoRaMacStatus_t LoRaMacMulticastChannelUnlink( MulticastParams_t *channelParam )
         channelParam->Next = NULL;
     }
 
+    uint8_t pos = MulticastSearch( channelParam->Address );
+    if ( ( pos < MulticastCount ) && ( MulticastIndex[pos] == channelParam ) ) {
+        MulticastCount--;
+        memmove( &MulticastIndex[pos], &MulticastIndex[pos + 1], ( MulticastCount - pos ) * sizeof( MulticastIndex[0] ) );
+    }
+
     return LORAMAC_STATUS_OK;
 }
 
@@ -3878,6 +5376,9 @@ LoRaMacStatus_t LoRaMacMcpsRequest( McpsReq_t *mcpsRequest )
 
     // AckTimeoutRetriesCounter must be reset every time a new request (unconfirmed or confirmed) is performed.
     AckTimeoutRetriesCounter = 1;
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+    RetryAirTime = 0;
+#endif
 
     switch ( mcpsRequest->Type ) {
         case MCPS_UNCONFIRMED: {
@@ -3940,6 +5441,9 @@ LoRaMacStatus_t LoRaMacMcpsRequest( McpsReq_t *mcpsRequest )
             } else {
                 return LORAMAC_STATUS_PARAMETER_INVALID;
             }
+#ifdef CONFIG_LORAMAC_LINK_ADR
+            LinkAdrApply( );
+#endif
         }
 
         status = Send( &macHdr, fPort, fBuffer, fBufferSize );
@@ -3954,6 +5458,476 @@ LoRaMacStatus_t LoRaMacMcpsRequest( McpsReq_t *mcpsRequest )
     return status;
 }
 
+#ifdef CONFIG_LORAMAC_PREBUILD
+LoRaMacStatus_t LoRaMacMcpsPrebuild( McpsReq_t *mcpsRequest )
+{
+    GetPhyParams_t getPhy;
+    PhyParam_t phyParam;
+    LoRaMacStatus_t status;
+    LoRaMacHeader_t macHdr;
+    LoRaMacFrameCtrl_t fCtrl;
+    VerifyParams_t verify;
+    uint8_t fPort;
+    void *fBuffer;
+    uint16_t fBufferSize;
+    int8_t datarate;
+    int8_t channelsDatarate = LoRaMacParams.ChannelsDatarate;
+    bool nodeAckRequested = NodeAckRequested;
+
+    if ( mcpsRequest == NULL ) {
+        return LORAMAC_STATUS_PARAMETER_INVALID;
+    }
+    // LoRaMacBuffer still holds the frame in flight
+    if ( ( ( LoRaMacState & LORAMAC_TX_RUNNING ) == LORAMAC_TX_RUNNING ) ||
+         ( ( LoRaMacState & LORAMAC_TX_DELAYED ) == LORAMAC_TX_DELAYED ) ) {
+        return LORAMAC_STATUS_BUSY;
+    }
+
+    macHdr.Value = 0;
+    switch ( mcpsRequest->Type ) {
+        case MCPS_UNCONFIRMED: {
+            macHdr.Bits.MType = FRAME_TYPE_DATA_UNCONFIRMED_UP;
+            fPort = mcpsRequest->Req.Unconfirmed.fPort;
+            fBuffer = mcpsRequest->Req.Unconfirmed.fBuffer;
+            fBufferSize = mcpsRequest->Req.Unconfirmed.fBufferSize;
+            datarate = mcpsRequest->Req.Unconfirmed.Datarate;
+            break;
+        }
+        case MCPS_CONFIRMED: {
+            macHdr.Bits.MType = FRAME_TYPE_DATA_CONFIRMED_UP;
+            fPort = mcpsRequest->Req.Confirmed.fPort;
+            fBuffer = mcpsRequest->Req.Confirmed.fBuffer;
+            fBufferSize = mcpsRequest->Req.Confirmed.fBufferSize;
+            datarate = mcpsRequest->Req.Confirmed.Datarate;
+            break;
+        }
+        default:
+            return LORAMAC_STATUS_SERVICE_UNKNOWN;
+    }
+
+    if ( fBuffer == NULL ) {
+        fBufferSize = 0;
+    }
+    if ( ( IsFPortAllowed( fPort ) == false ) || ( fBufferSize > LORAMAC_PHY_MAXPAYLOAD ) ) {
+        return LORAMAC_STATUS_PARAMETER_INVALID;
+    }
+
+    // Built with the datarate LoRaMacMcpsRequest applies
+    if ( AdrCtrlOn == false ) {
+        getPhy.Attribute = PHY_MIN_TX_DR;
+        getPhy.UplinkDwellTime = LoRaMacParams.UplinkDwellTime;
+        phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+        verify.DatarateParams.Datarate = MAX( datarate, phyParam.Value );
+        verify.DatarateParams.UplinkDwellTime = LoRaMacParams.UplinkDwellTime;
+
+        if ( RegionVerify( LoRaMacRegion, &verify, PHY_TX_DR ) == false ) {
+            return LORAMAC_STATUS_PARAMETER_INVALID;
+        }
+        LoRaMacParams.ChannelsDatarate = verify.DatarateParams.Datarate;
+#ifdef CONFIG_LORAMAC_LINK_ADR
+        LinkAdrApply( );
+#endif
+    }
+
+    // The state LoRaMacMcpsRequest will find, the datarate applied
+    InitFrameCtrl( &fCtrl );
+    LoRaMacStaged.FCtrlIn = fCtrl.Value;
+    LoRaMacTxStateSave( &LoRaMacStaged.Before );
+
+    status = PrepareFrame( &macHdr, &fCtrl, fPort, fBuffer, fBufferSize );
+    if ( status == LORAMAC_STATUS_OK ) {
+        LoRaMacTxStateSave( &LoRaMacStaged.After );
+        LoRaMacStaged.MacHdr = macHdr.Value;
+        LoRaMacStaged.FCtrlOut = fCtrl.Value;
+        LoRaMacStaged.FPort = fPort;
+        LoRaMacStaged.FBufferSize = fBufferSize;
+        memcpy1( LoRaMacStaged.FBuffer, fBuffer, fBufferSize );
+        LoRaMacStaged.NodeAckRequested = NodeAckRequested;
+        LoRaMacStaged.TxPayloadLen = LoRaMacTxPayloadLen;
+        LoRaMacStaged.PktLen = LoRaMacBufferPktLen;
+        LoRaMacStaged.Valid = true;
+    }
+
+    // Until the request, the MAC state is left as it was
+    LoRaMacTxStateRestore( &LoRaMacStaged.Before );
+    LoRaMacParams.ChannelsDatarate = channelsDatarate;
+    NodeAckRequested = nodeAckRequested;
+
+    return status;
+}
+#endif
+
+#ifdef CONFIG_LORAMAC_TX_QUEUE
+static void TxQueueConfirm( McpsConfirm_t *mcpsConfirm )
+{
+    LoRaMacTxQueueEntry_t *entry = &LoRaMacTxQueue[TxQueueHead % LORAMAC_TX_QUEUE_SIZE];
+
+    if ( TxQueueInFlight == false ) {
+        return;
+    }
+    TxQueueInFlight = false;
+    if ( entry->Confirm != NULL ) {
+        entry->Confirm( mcpsConfirm, entry->Context );
+    }
+    TxQueuePop( );
+}
+
+static void TxQueuePop( void )
+{
+#ifdef CONFIG_POOL
+    LoRaMacTxQueueEntry_t *entry = &LoRaMacTxQueue[TxQueueHead % LORAMAC_TX_QUEUE_SIZE];
+
+    PoolFree( entry->Buffer );
+    entry->Buffer = NULL;
+#endif
+    TxQueueHead++;
+}
+
+static void TxQueueNext( void )
+{
+    LoRaMacTxQueueEntry_t *entry;
+    McpsConfirm_t mcpsConfirm;
+    LoRaMacStatus_t status;
+
+    while ( ( TxQueueInFlight == false ) && ( TxQueueHead != TxQueueTail ) ) {
+        entry = &LoRaMacTxQueue[TxQueueHead % LORAMAC_TX_QUEUE_SIZE];
+        status = ( LoRaMacState == LORAMAC_IDLE ) ? LoRaMacMcpsRequest( &entry->Request ) : LORAMAC_STATUS_BUSY;
+        if ( status == LORAMAC_STATUS_OK ) {
+            TxQueueInFlight = true;
+            return;
+        }
+        // Requested again once the MAC is done, or after the retry delay
+        if ( ( status == LORAMAC_STATUS_BUSY ) ||
+             ( status == LORAMAC_STATUS_BUSY_BEACON_RESERVED_TIME ) ||
+             ( status == LORAMAC_STATUS_BUSY_PING_SLOT_WINDOW_TIME ) ) {
+            TimerSetValue( &TxQueueTimer, LORAMAC_TX_QUEUE_RETRY_DELAY );
+            TimerStart( &TxQueueTimer );
+            return;
+        }
+
+        // The request cannot be sent, it is confirmed as failed
+        memset1( ( uint8_t * )&mcpsConfirm, 0, sizeof( McpsConfirm_t ) );
+        mcpsConfirm.McpsRequest = entry->Request.Type;
+        mcpsConfirm.Status = LORAMAC_EVENT_INFO_STATUS_ERROR;
+        if ( status == LORAMAC_STATUS_LENGTH_ERROR ) {
+            mcpsConfirm.Status = LORAMAC_EVENT_INFO_STATUS_TX_DR_PAYLOAD_SIZE_ERROR;
+        }
+        mcpsConfirm.UpLinkCounter = UpLinkCounter;
+        if ( entry->Confirm != NULL ) {
+            entry->Confirm( &mcpsConfirm, entry->Context );
+        }
+        TxQueuePop( );
+    }
+}
+
+static void OnTxQueueTimerEvent( void )
+{
+    TimerStop( &TxQueueTimer );
+    TxQueueNext( );
+}
+
+LoRaMacStatus_t LoRaMacMcpsEnqueue( McpsReq_t *mcpsRequest, LoRaMacTxConfirm_t confirm, void *context )
+{
+    LoRaMacTxQueueEntry_t *entry;
+    void **fBuffer;
+    uint16_t fBufferSize;
+    uint8_t fPort = 0;
+
+    if ( mcpsRequest == NULL ) {
+        return LORAMAC_STATUS_PARAMETER_INVALID;
+    }
+    if ( ( uint8_t )( TxQueueTail - TxQueueHead ) >= LORAMAC_TX_QUEUE_SIZE ) {
+        return LORAMAC_STATUS_BUSY;
+    }
+
+    entry = &LoRaMacTxQueue[TxQueueTail % LORAMAC_TX_QUEUE_SIZE];
+    entry->Request = *mcpsRequest;
+    switch ( mcpsRequest->Type ) {
+        case MCPS_UNCONFIRMED:
+            fPort = entry->Request.Req.Unconfirmed.fPort;
+            fBuffer = &entry->Request.Req.Unconfirmed.fBuffer;
+            fBufferSize = entry->Request.Req.Unconfirmed.fBufferSize;
+            break;
+        case MCPS_CONFIRMED:
+            fPort = entry->Request.Req.Confirmed.fPort;
+            fBuffer = &entry->Request.Req.Confirmed.fBuffer;
+            fBufferSize = entry->Request.Req.Confirmed.fBufferSize;
+            break;
+        case MCPS_PROPRIETARY:
+            fBuffer = &entry->Request.Req.Proprietary.fBuffer;
+            fBufferSize = entry->Request.Req.Proprietary.fBufferSize;
+            break;
+        default:
+            return LORAMAC_STATUS_SERVICE_UNKNOWN;
+    }
+    if ( *fBuffer == NULL ) {
+        fBufferSize = 0;
+    }
+#ifdef CONFIG_POOL
+    if ( ( IsFPortAllowed( fPort ) == false ) || ( fBufferSize > LORAWAN_APP_DATA_BUFF_SIZE ) ) {
+        return LORAMAC_STATUS_PARAMETER_INVALID;
+    }
+    entry->Buffer = NULL;
+    if ( fBufferSize > 0 ) {
+        entry->Buffer = PoolAlloc( fBufferSize );
+        if ( entry->Buffer == NULL ) {
+            return LORAMAC_STATUS_BUSY;
+        }
+    }
+#else
+    if ( ( IsFPortAllowed( fPort ) == false ) || ( fBufferSize > LORAMAC_TX_QUEUE_PAYLOAD_SIZE ) ) {
+        return LORAMAC_STATUS_PARAMETER_INVALID;
+    }
+#endif
+
+    // The payload is copied, the caller buffer is free on return
+    if ( fBufferSize > 0 ) {
+        memcpy1( entry->Buffer, ( uint8_t * )*fBuffer, fBufferSize );
+        *fBuffer = entry->Buffer;
+    }
+    entry->Confirm = confirm;
+    entry->Context = context;
+    TxQueueTail++;
+
+    // The queue is only walked from the timer context
+    TimerSetValue( &TxQueueTimer, 1 );
+    TimerStart( &TxQueueTimer );
+    return LORAMAC_STATUS_OK;
+}
+
+uint8_t LoRaMacMcpsQueued( void )
+{
+    return ( uint8_t )( TxQueueTail - TxQueueHead );
+}
+#endif
+
+#ifdef CONFIG_LORAMAC_FAST_INDICATION
+LoRaMacStatus_t LoRaMacFastIndicationSet( uint8_t port, LoRaMacFastIndication_t indication )
+{
+    if( ( port == 0 ) || ( port > 223 ) )
+    {
+        return LORAMAC_STATUS_PARAMETER_INVALID;
+    }
+    FastIndicationPort = port;
+    FastIndication = indication;
+    return LORAMAC_STATUS_OK;
+}
+#endif
+
+bool LoRaMacRxBufferHold( uint8_t *buffer )
+{
+    uint8_t index = LoRaMacRxBufferIndex( buffer );
+
+    if( ( index >= LORAMAC_RX_BUFFER_COUNT ) || ( ( LoRaMacRxBuffersBusy & ( 1 << index ) ) == 0 ) )
+    {
+        return false;
+    }
+    LoRaMacRxBuffersHeld |= 1 << index;
+    return true;
+}
+
+void LoRaMacRxBufferRelease( uint8_t *buffer )
+{
+    uint8_t index = LoRaMacRxBufferIndex( buffer );
+
+    if( index < LORAMAC_RX_BUFFER_COUNT )
+    {
+        LoRaMacRxBuffersHeld &= ~( 1 << index );
+        LoRaMacRxBuffersBusy &= ~( 1 << index );
+        LoRaMacRxBufferLend( );
+    }
+}
+
+void LoRaMacRadioAttach( void )
+{
+#ifdef CONFIG_RADIO_ARBITER
+    RadioArbiterRegister( RADIO_ARBITER_LORAMAC, &RadioEvents, NULL );
+    RadioArbiterAcquire( RADIO_ARBITER_LORAMAC, 0 );
+#else
+    Radio.Init( &RadioEvents );
+#endif
+    Radio.SetPublicNetwork( PublicNetwork );
+    Radio.Sleep( );
+    RADIO_ARBITER_RELEASE( RADIO_ARBITER_LORAMAC );
+}
+
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+static bool RetryPolicyDefaultNext( LoRaMacRetryParams_t *params )
+{
+    uint32_t window;
+
+    if ( params->AirTime >= LORAMAC_RETRY_AIRTIME_BUDGET ) {
+        return false;
+    }
+
+    // Randomized in a window doubled on each retransmission, the nodes which
+    // collided do not meet again
+    window = LORAMAC_RETRY_BACKOFF_MIN << MIN( params->Retry - 1, 5 );
+    params->Delay = randr( 0, MIN( window, LORAMAC_RETRY_BACKOFF_MAX ) );
+    params->AvoidChannel = true;
+
+    // Frames lost while most get acknowledged collided, a lower datarate only
+    // makes them longer. A poor rate points at the link instead
+    if ( RetryAckRate >= LORAMAC_RETRY_RATE_GOOD ) {
+        params->LowerDatarate = false;
+    } else if ( RetryAckRate >= LORAMAC_RETRY_RATE_POOR ) {
+        params->LowerDatarate = ( ( params->Retry % 2 ) == 0 ) ? true : false;
+    } else {
+        params->LowerDatarate = true;
+    }
+    return true;
+}
+
+static void RetryPolicyDefaultDone( bool acked, uint8_t nbRetries )
+{
+    int16_t sample = ( acked == true ) ? 256 : 0;
+
+    RetryAckRate = ( uint16_t )( RetryAckRate + ( sample - ( int16_t )RetryAckRate ) / 8 );
+}
+
+const LoRaMacRetryPolicy_t LoRaMacRetryPolicyDefault = {
+    RetryPolicyDefaultNext,
+    RetryPolicyDefaultDone,
+};
+
+static bool RetryPolicyNext( void )
+{
+    LoRaMacRetryParams_t params;
+    GetPhyParams_t getPhy;
+    PhyParam_t phyParam;
+
+    params.Retry = AckTimeoutRetriesCounter;
+    params.Datarate = LoRaMacParams.ChannelsDatarate;
+    params.AirTime = RetryAirTime;
+    params.Delay = 0;
+    params.LowerDatarate = false;
+    params.AvoidChannel = false;
+
+    if ( RetryPolicy->Next( &params ) == false ) {
+        return false;
+    }
+
+    if ( params.LowerDatarate == true ) {
+        getPhy.Attribute = PHY_NEXT_LOWER_TX_DR;
+        getPhy.UplinkDwellTime = LoRaMacParams.UplinkDwellTime;
+        getPhy.Datarate = LoRaMacParams.ChannelsDatarate;
+        phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+        LoRaMacParams.ChannelsDatarate = phyParam.Value;
+    }
+    RetryDelay = params.Delay;
+    RetryAvoidChannel = params.AvoidChannel;
+    return true;
+}
+
+static LoRaMacStatus_t ScheduleRetry( void )
+{
+    if ( RetryDelay == 0 ) {
+        return ScheduleTx( );
+    }
+
+    // The frame has to fit at the datarate of the policy, OnTxDelayedTimerEvent
+    // does not report errors
+    if ( ValidatePayloadLength( LoRaMacTxPayloadLen, LoRaMacParams.ChannelsDatarate, MacCommandsBufferIndex ) == false ) {
+        return LORAMAC_STATUS_LENGTH_ERROR;
+    }
+    LoRaMacState |= LORAMAC_TX_DELAYED;
+    TimerSetValue( &TxDelayedTimer, RetryDelay );
+    TimerStart( &TxDelayedTimer );
+    RetryDelay = 0;
+    return LORAMAC_STATUS_OK;
+}
+#endif
+
+#ifdef CONFIG_LORAMAC_LINK_ADR
+static void LinkAdrAddSample( int8_t snr )
+{
+    LinkAdr.Snr[LinkAdr.Next] = snr;
+    LinkAdr.Next = ( LinkAdr.Next + 1 ) % LORAMAC_LINK_ADR_WINDOW;
+    if ( LinkAdr.NbSamples < LORAMAC_LINK_ADR_WINDOW ) {
+        LinkAdr.NbSamples++;
+    }
+    LinkAdr.LastSample = TimerGetCurrentTime( );
+}
+
+static int8_t LinkAdrBestSnr( void )
+{
+    int8_t snr = INT8_MIN;
+
+    for ( uint8_t i = 0; i < LinkAdr.NbSamples; i++ ) {
+        snr = MAX( snr, LinkAdr.Snr[i] );
+    }
+    return snr;
+}
+
+static int16_t LinkAdrDemodFloor( int8_t datarate )
+{
+    GetPhyParams_t getPhy;
+    PhyParam_t phyParam;
+
+    getPhy.Attribute = PHY_DATARATE_SF;
+    getPhy.Datarate = datarate;
+    phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+    if ( ( phyParam.Value < 7 ) || ( phyParam.Value > 12 ) ) {
+        return INT16_MAX;
+    }
+    // -20 dB at SF12, 2.5 dB higher for each lower spreading factor
+    return -200 + ( ( 12 - ( int16_t )phyParam.Value ) * 25 );
+}
+
+static void LinkAdrApply( void )
+{
+    VerifyParams_t verify;
+    GetPhyParams_t getPhy;
+    PhyParam_t phyParam;
+    int8_t datarate = LoRaMacParams.ChannelsDatarate;
+    int8_t maxDatarate;
+    int16_t usableSnr;
+    int8_t steps;
+
+    // The network ADR keeps the control of the datarate and TX power
+    if ( ( LinkAdr.Enable == false ) || ( AdrCtrlOn == true ) ) {
+        return;
+    }
+
+    if ( ( LinkAdr.NbSamples != 0 ) && ( TimerGetElapsedTime( LinkAdr.LastSample ) > LORAMAC_LINK_ADR_MAX_AGE ) ) {
+        LinkAdr.NbSamples = 0;
+        LinkAdr.Next = 0;
+    }
+    LoRaMacParams.ChannelsTxPower = LinkAdr.BaseTxPower;
+    if ( ( LinkAdr.NbSamples < LORAMAC_LINK_ADR_SAMPLES_MIN ) || ( LinkAdrDemodFloor( datarate ) == INT16_MAX ) ) {
+        return;
+    }
+
+    getPhy.Attribute = PHY_MAX_TX_DR;
+    getPhy.UplinkDwellTime = LoRaMacParams.UplinkDwellTime;
+    phyParam = RegionGetPhyParam( LoRaMacRegion, &getPhy );
+    maxDatarate = ( int8_t )phyParam.Value;
+
+    // Fastest datarate the best SNR reaches with the margin, not below the
+    // one the application requested, on the LoRa 125 kHz datarates only
+    usableSnr = ( LinkAdrBestSnr( ) * 10 ) - ( LORAMAC_LINK_ADR_MARGIN * 10 );
+    while ( ( datarate < maxDatarate ) && ( usableSnr >= LinkAdrDemodFloor( datarate + 1 ) ) ) {
+        verify.DatarateParams.Datarate = datarate + 1;
+        verify.DatarateParams.UplinkDwellTime = LoRaMacParams.UplinkDwellTime;
+        if ( RegionVerify( LoRaMacRegion, &verify, PHY_TX_DR ) == false ) {
+            break;
+        }
+        datarate++;
+    }
+    LoRaMacParams.ChannelsDatarate = datarate;
+
+    // The margin left at the fastest datarate lowers the TX power
+    steps = ( int8_t )( ( usableSnr - LinkAdrDemodFloor( datarate ) ) / ( LORAMAC_LINK_ADR_TX_POWER_STEP * 10 ) );
+    while ( steps-- > 0 ) {
+        verify.TxPower = LoRaMacParams.ChannelsTxPower + 1;
+        if ( RegionVerify( LoRaMacRegion, &verify, PHY_TX_POWER ) == false ) {
+            break;
+        }
+        LoRaMacParams.ChannelsTxPower = verify.TxPower;
+    }
+}
+#endif
+
 void LoRaMacTestRxWindowsOn( bool enable )
 {
     IsRxWindowsEnabled = enable;
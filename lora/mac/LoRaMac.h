@@ -51,16 +51,14 @@
 #include "timer.h"
 #include "radio.h"
 #include "timer.h"
+#ifdef CONFIG_LORA_RADIO_STATS
+#include "radio-stats.h"
+#endif
 
 #if defined(CONFIG_LINKWAN) || defined(CONFIG_LWAN)
 #include "linkwan.h"
 #endif
 
-/*!
- * Check the Mac layer state every MAC_STATE_CHECK_TIMEOUT in ms
- */
-#define MAC_STATE_CHECK_TIMEOUT                     1000
-
 /*!
  * Maximum number of times the MAC layer tries to get an acknowledge.
  */
@@ -87,6 +85,11 @@
  */
 #define LORAMAC_MFR_LEN                             4
 
+/*!
+ * Maximum number of linked multicast channels, see mem-profile.h
+ */
+#include "mem-profile.h"
+
 /*!
  * LoRaMac MLME-Confirm queue length
  */
@@ -342,6 +345,39 @@ typedef struct sLoRaMacParams {
 #endif
 } LoRaMacParams_t;
 
+/*!
+ * Class B ping slot schedule of a beacon period
+ */
+typedef struct sPingSlotSchedule {
+    /*!
+     * Set once the schedule has been computed
+     */
+    bool Valid;
+    /*!
+     * Beacon time, address and ping period the ping offset and the
+     * frequency have been computed for
+     */
+    TimerTime_t BeaconTime;
+    uint32_t Address;
+    uint16_t PingPeriod;
+    /*!
+     * Reception time of the last beacon the period has been computed from
+     */
+    TimerTime_t LastBeaconRx;
+    /*!
+     * Start of the beacon period
+     */
+    TimerTime_t PeriodStart;
+    /*!
+     * Frequency of the ping slots of the period, from the channel plan
+     */
+    uint32_t Frequency;
+    /*!
+     * Index of the next ping slot of the period
+     */
+    uint8_t NextSlot;
+} PingSlotSchedule_t;
+
 /*!
  * LoRaMAC multicast channel parameter
  */
@@ -362,6 +398,10 @@ typedef struct sMulticastParams {
      * Downlink counter
      */
     uint32_t DownLinkCounter;
+    /*!
+     * A frame was received at DownLinkCounter, set by the MAC
+     */
+    bool DownLinkCounterValid;
     /*!
      * Reception frequency of the ping slot windows
      */
@@ -395,6 +435,11 @@ typedef struct sMulticastParams {
      * This parameter will be calculated automatically.
      */
     uint16_t PingOffset;
+    /*!
+     * Ping slot schedule of the current beacon period
+     * This parameter will be calculated automatically.
+     */
+    PingSlotSchedule_t Schedule;
     /*!
      * Reference pointer to the next multicast channel parameters in the list
      * This parameter will be calculated automatically.
@@ -1077,7 +1122,8 @@ typedef struct sMcpsIndication {
      */
     uint8_t FramePending;
     /*!
-     * Pointer to the received data stream
+     * Pointer to the received data stream, valid during the indication
+     * callback unless kept with \ref LoRaMacRxBufferHold
      */
     uint8_t *Buffer;
     /*!
@@ -1415,6 +1461,7 @@ typedef struct sMlmeIndication
  * \ref MIB_MAX_BEACON_LESS_PERIOD               | YES | YES
  * \ref MIB_ANTENNA_GAIN                         | YES | YES
  * \ref MIB_DEFAULT_ANTENNA_GAIN                 | YES | YES
+ * \ref MIB_CLASS_C_RX_PREAMBLE                  | YES | YES
  * \ref MIB_FREQ_BAND                | YES | NO
  *
  * The following table provides links to the function implementations of the
@@ -1688,6 +1735,45 @@ typedef enum eMib {
      * The allowed ranges are region specific. Please refer to \ref DR_0 to \ref DR_15 for details.
      */
     MIB_PING_SLOT_DATARATE,
+    /*!
+     * Preamble length in symbols the network server uses for class C
+     * downlinks. When long enough, the continuous RX2 window of class C
+     * sniffs for preambles with the radio RX duty cycle instead of
+     * staying in full RX. 0 disables it.
+     */
+    MIB_CLASS_C_RX_PREAMBLE,
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+    /*!
+     * Retransmission policy of the confirmed uplinks, NULL selects the
+     * default one, \ref LoRaMacRetryPolicyDefault
+     */
+    MIB_RETRY_POLICY,
+#endif
+#ifdef CONFIG_LORAMAC_LINK_ADR
+    /*!
+     * Device side ADR. While the network ADR is off, the MAC raises the
+     * uplink datarate and lowers the TX power from the SNR of the recent
+     * downlinks and link check answers. Set enables or disables it, get
+     * reports the link estimate.
+     */
+    MIB_LINK_ADR,
+#endif
+#ifdef CONFIG_LORA_RADIO_STATS
+    /*!
+     * Radio airtime and energy counters, \ref LORA_RADIO_STATS. Get fills
+     * the counters pointed by RadioStats, set clears them.
+     */
+    MIB_RADIO_STATS,
+#endif
+#ifdef CONFIG_LORAMAC_MAC_CMD_DEFER
+    /*!
+     * Time the sticky MAC answers, RXParamSetupAns, RXTimingSetupAns and
+     * DlChannelAns, wait for the FOpts of an application uplink before
+     * MLME_SCHEDULE_UPLINK asks for an uplink of their own [ms]. 0 asks for
+     * it right away.
+     */
+    MIB_MAC_CMD_DEFER,
+#endif
     
 #ifdef CONFIG_LWAN
     MIB_RX1_DATARATE_OFFSET,
@@ -1699,6 +1785,96 @@ typedef enum eMib {
 #endif
 } Mib_t;
 
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+/*!
+ * Retransmission of a confirmed uplink, \ref LoRaMacRetryPolicy_t
+ */
+typedef struct sLoRaMacRetryParams
+{
+    /*!
+     * Retransmission number, from 1
+     */
+    uint8_t Retry;
+    /*!
+     * Datarate of the last transmission
+     */
+    int8_t Datarate;
+    /*!
+     * Time on air the uplink used so far [ms]
+     */
+    uint32_t AirTime;
+    /*!
+     * Out, delay before the retransmission after the ACK timeout [ms]
+     */
+    uint32_t Delay;
+    /*!
+     * Out, set to true to step the datarate down
+     */
+    bool LowerDatarate;
+    /*!
+     * Out, set to true to retransmit on another channel than the last one
+     */
+    bool AvoidChannel;
+}LoRaMacRetryParams_t;
+
+/*!
+ * Retransmission policy of the confirmed uplinks, \ref MIB_RETRY_POLICY
+ */
+typedef struct sLoRaMacRetryPolicy
+{
+    /*!
+     * \brief Decides the retransmission of an unacknowledged uplink, within
+     *        the NbTrials of the request
+     *
+     * \param [IN/OUT] params Retransmission
+     *
+     * \retval retry False to give up the uplink
+     */
+    bool ( *Next )( LoRaMacRetryParams_t *params );
+    /*!
+     * \brief Reports the end of a confirmed uplink
+     *
+     * \param [IN] acked     True if the uplink has been acknowledged
+     * \param [IN] nbRetries Number of transmissions
+     */
+    void ( *Done )( bool acked, uint8_t nbRetries );
+}LoRaMacRetryPolicy_t;
+
+/*!
+ * Default policy: randomized exponential back-off, another channel on each
+ * retransmission, datarate steps driven by the recent acknowledgement rate
+ * and a time on air budget per uplink
+ */
+extern const LoRaMacRetryPolicy_t LoRaMacRetryPolicyDefault;
+#endif
+
+#ifdef CONFIG_LORAMAC_LINK_ADR
+/*!
+ * Device side ADR state, \ref MIB_LINK_ADR
+ */
+typedef struct sLinkAdrInfo
+{
+    /*!
+     * Set to true to let the MAC choose the datarate and TX power while the
+     * network ADR is off
+     */
+    bool Enable;
+    /*!
+     * Number of link samples in the window, read only
+     */
+    uint8_t NbSamples;
+    /*!
+     * Best SNR of the window [dB], read only
+     */
+    int8_t Snr;
+    /*!
+     * Datarate and TX power of the next uplink, read only
+     */
+    int8_t Datarate;
+    int8_t TxPower;
+}LinkAdrInfo_t;
+#endif
+
 /*!
  * LoRaMAC MIB parameters
  */
@@ -1969,6 +2145,44 @@ typedef union uMibParam {
      * Related MIB type: \ref MIB_PING_SLOT_DATARATE
      */
     int8_t PingSlotDatarate;
+    /*!
+     * Class C downlink preamble length in symbols
+     *
+     * Related MIB type: \ref MIB_CLASS_C_RX_PREAMBLE
+     */
+    uint16_t ClassCRxPreamble;
+#ifdef CONFIG_LORAMAC_RETRY_POLICY
+    /*!
+     * Retransmission policy
+     *
+     * Related MIB type: \ref MIB_RETRY_POLICY
+     */
+    const LoRaMacRetryPolicy_t *RetryPolicy;
+#endif
+#ifdef CONFIG_LORAMAC_LINK_ADR
+    /*!
+     * Device side ADR state
+     *
+     * Related MIB type: \ref MIB_LINK_ADR
+     */
+    LinkAdrInfo_t LinkAdr;
+#endif
+#ifdef CONFIG_LORA_RADIO_STATS
+    /*!
+     * Radio counters, filled by the get request
+     *
+     * Related MIB type: \ref MIB_RADIO_STATS
+     */
+    RadioStats_t *RadioStats;
+#endif
+#ifdef CONFIG_LORAMAC_MAC_CMD_DEFER
+    /*!
+     * Deadline of the sticky MAC answers [ms]
+     *
+     * Related MIB type: \ref MIB_MAC_CMD_DEFER
+     */
+    uint32_t MacCmdDefer;
+#endif
     
 #ifdef CONFIG_LWAN
     uint8_t Rx1DrOffset;
@@ -2009,6 +2223,78 @@ typedef struct sLoRaMacTxInfo {
     uint8_t CurrentPayloadSize;
 } LoRaMacTxInfo_t;
 
+#ifdef CONFIG_LORAMAC_TX_TIME
+/*!
+ * Earliest uplink the duty cycle allows, \ref LoRaMacQueryTxTime
+ */
+typedef struct sLoRaMacTxTime {
+    /*!
+     * Time before the uplink may start [ms], 0 when it may start now
+     */
+    TimerTime_t Delay;
+    /*!
+     * Channel of the uplink
+     */
+    uint8_t Channel;
+    /*!
+     * Frequency of the channel [Hz]
+     */
+    uint32_t Frequency;
+    /*!
+     * Datarate of the uplink
+     */
+    int8_t Datarate;
+    /*!
+     * Time on air of the uplink [ms]
+     */
+    TimerTime_t TimeOnAir;
+} LoRaMacTxTime_t;
+#endif
+
+#ifdef CONFIG_LORAMAC_SESSION
+/*!
+ * Channels of a dynamic channel plan held by a session, the fixed plans of
+ * more channels only keep their mask
+ */
+#ifndef LORAMAC_SESSION_MAX_CHANNELS
+#define LORAMAC_SESSION_MAX_CHANNELS                16
+#endif
+
+/*!
+ * Channels mask words held by a session, 96 channels
+ */
+#define LORAMAC_SESSION_MASK_SIZE                   6
+
+/*!
+ * Session of a joined device, \ref LoRaMacSessionExport
+ */
+typedef struct sLoRaMacSession {
+    uint32_t NetID;
+    uint32_t DevAddr;
+    uint8_t NwkSKey[16];
+    uint8_t AppSKey[16];
+    uint32_t UpLinkCounter;
+    uint32_t DownLinkCounter;
+    /*!
+     * Datarate, TX power, repetitions, RX windows and dwell times
+     */
+    LoRaMacParams_t Params;
+    bool AdrCtrlOn;
+    uint32_t AdrAckCounter;
+    /*!
+     * Aggregated duty cycle of the DutyCycleReq, 2^-MaxDCycle
+     */
+    uint8_t MaxDCycle;
+    DeviceClass_t DeviceClass;
+    uint16_t ChannelsMask[LORAMAC_SESSION_MASK_SIZE];
+    /*!
+     * Channels held, 0 for the fixed plans
+     */
+    uint8_t NbChannels;
+    ChannelParams_t Channels[LORAMAC_SESSION_MAX_CHANNELS];
+} LoRaMacSession_t;
+#endif
+
 /*!
  * LoRaMAC Status
  */
@@ -2245,6 +2531,43 @@ LoRaMacStatus_t LoRaMacInitialization( LoRaMacPrimitives_t *primitives, LoRaMacC
  */
 LoRaMacStatus_t LoRaMacQueryTxPossible( uint8_t size, LoRaMacTxInfo_t *txInfo );
 
+/*!
+ * \brief   Maximum application payload of the next uplink
+ *
+ * \details Same as \ref LoRaMacTxInfo_t::MaxPossiblePayload for the current
+ *          datarate, without the ADR evaluation. The maximum payloads are
+ *          looked up in the region once per datarate and dwell time setting.
+ *
+ * \retval  Maximum application payload size, the pending MAC commands taken
+ *          into account
+ */
+uint8_t LoRaMacGetMaxPayload( void );
+
+#ifdef CONFIG_LORAMAC_TX_TIME
+/*!
+ * \brief   Earliest time an uplink of the application may start
+ *
+ * \details Runs the channel selection of the next uplink at the current
+ *          datarate over the band and aggregated time offs, without sending.
+ *          The application can sample its sensors and sleep until then. In
+ *          the regions which sense the channel before a TX, the query senses
+ *          it as the uplink would.
+ *
+ * \param   [IN] size - Size of the application payload
+ *
+ * \param   [OUT] txTime - Delay, channel, datarate and time on air of the uplink
+ *
+ * \retval  LoRaMacStatus_t Status of the operation. Possible returns are:
+ *          \ref LORAMAC_STATUS_OK,
+ *          \ref LORAMAC_STATUS_PARAMETER_INVALID,
+ *          \ref LORAMAC_STATUS_BUSY,
+ *          \ref LORAMAC_STATUS_NO_NETWORK_JOINED,
+ *          \ref LORAMAC_STATUS_LENGTH_ERROR,
+ *          \ref LORAMAC_STATUS_DEVICE_OFF.
+ */
+LoRaMacStatus_t LoRaMacQueryTxTime( uint8_t size, LoRaMacTxTime_t *txTime );
+#endif
+
 /*!
  * \brief   LoRaMAC channel add service
  *
@@ -2280,7 +2603,9 @@ LoRaMacStatus_t LoRaMacChannelRemove( uint8_t id );
 /*!
  * \brief   LoRaMAC multicast channel link service
  *
- * \details Links a multicast channel into the linked list.
+ * \details Links a multicast channel into the linked list. At most
+ *          LORAMAC_MULTICAST_MAX channels are linked, each one with its own
+ *          address.
  *
  * \param   [IN] channelParam - Multicast channel parameters to link.
  *
@@ -2364,6 +2689,72 @@ LoRaMacStatus_t LoRaMacMibGetRequestConfirm( MibRequestConfirm_t *mibGet );
  */
 LoRaMacStatus_t LoRaMacMibSetRequestConfirm( MibRequestConfirm_t *mibSet );
 
+/*!
+ * \brief   Sets several MAC parameters at once
+ *
+ * \details Applies the MIB-SET requests in order, after one check that no TX
+ *          runs. Only the MAC parameters are accepted: \ref MIB_ADR,
+ *          \ref MIB_RX2_CHANNEL, \ref MIB_CHANNELS_NB_REP,
+ *          \ref MIB_MAX_RX_WINDOW_DURATION, the receive and join accept
+ *          delays, \ref MIB_CHANNELS_DATARATE, \ref MIB_CHANNELS_TX_POWER
+ *          and \ref MIB_RX1_DATARATE_OFFSET. When one of them is rejected,
+ *          the parameters are restored to their values before the call, so
+ *          either all requests apply or none.
+ *
+ * \param   [IN] mibSet - Array of the MIB-SET requests
+ *
+ * \param   [IN] nbMib - Number of requests
+ *
+ * \retval  LoRaMacStatus_t Status of the operation. Possible returns are:
+ *          \ref LORAMAC_STATUS_OK,
+ *          \ref LORAMAC_STATUS_BUSY,
+ *          \ref LORAMAC_STATUS_PARAMETER_INVALID.
+ */
+LoRaMacStatus_t LoRaMacMibSetParams( MibRequestConfirm_t *mibSet, uint8_t nbMib );
+
+/*!
+ * \brief   Accessors of the MAC state read on every uplink, without the
+ *          MIB-GET switch
+ */
+bool LoRaMacIsNetworkJoined( void );
+int8_t LoRaMacGetDatarate( void );
+DeviceClass_t LoRaMacGetDeviceClass( void );
+bool LoRaMacIsAdrOn( void );
+
+#ifdef CONFIG_LORAMAC_SESSION
+/*!
+ * \brief   Copies the session of the joined device
+ *
+ * \details With \ref LoRaMacSessionImport, a device resumes its session after
+ *          a reset without a new join: the keys, the address, the counters,
+ *          the MAC parameters, the ADR state and the channel plan.
+ *
+ * \param   [OUT] session - Session of the device
+ *
+ * \retval  LoRaMacStatus_t Status of the operation. Possible returns are:
+ *          \ref LORAMAC_STATUS_OK,
+ *          \ref LORAMAC_STATUS_PARAMETER_INVALID,
+ *          \ref LORAMAC_STATUS_NO_NETWORK_JOINED.
+ */
+LoRaMacStatus_t LoRaMacSessionExport( LoRaMacSession_t *session );
+
+/*!
+ * \brief   Resumes a session exported by \ref LoRaMacSessionExport
+ *
+ * \details The device is joined once it returns. A class C session reopens
+ *          the continuous RX2 window. A class B session resumes in class A,
+ *          the beacon has to be acquired again.
+ *
+ * \param   [IN] session - Session to resume
+ *
+ * \retval  LoRaMacStatus_t Status of the operation. Possible returns are:
+ *          \ref LORAMAC_STATUS_OK,
+ *          \ref LORAMAC_STATUS_BUSY,
+ *          \ref LORAMAC_STATUS_PARAMETER_INVALID.
+ */
+LoRaMacStatus_t LoRaMacSessionImport( const LoRaMacSession_t *session );
+#endif
+
 /*!
  * \brief   LoRaMAC MLME-Request
  *
@@ -2446,6 +2837,133 @@ LoRaMacStatus_t LoRaMacMlmeRequest( MlmeReq_t *mlmeRequest );
  */
 LoRaMacStatus_t LoRaMacMcpsRequest( McpsReq_t *mcpsRequest );
 
+#ifdef CONFIG_LORAMAC_PREBUILD
+/*!
+ * \brief   Builds and encrypts the frame of an MCPS-Request ahead of it
+ *
+ * \details To be called once the previous uplink is confirmed, while the
+ *          MAC waits for the next one. \ref LoRaMacMcpsRequest then sends
+ *          the staged frame when called with the same request, payload
+ *          included, and the MAC state the frame depends on has not changed:
+ *          the frame counter, the pending MAC commands, the ADR state, the
+ *          datarate, the keys. The frame is built again otherwise. Any other
+ *          request discards the staged frame.
+ *
+ * \remark  The regional ADR backoff runs when the frame is built, the
+ *          default channels it may enable are enabled ahead of the request.
+ *
+ * \param   [IN] mcpsRequest - MCPS_UNCONFIRMED or MCPS_CONFIRMED request.
+ *
+ * \retval  LoRaMacStatus_t Status of the operation. Possible returns are:
+ *          \ref LORAMAC_STATUS_OK,
+ *          \ref LORAMAC_STATUS_BUSY,
+ *          \ref LORAMAC_STATUS_SERVICE_UNKNOWN,
+ *          \ref LORAMAC_STATUS_PARAMETER_INVALID,
+ *          \ref LORAMAC_STATUS_NO_NETWORK_JOINED.
+ */
+LoRaMacStatus_t LoRaMacMcpsPrebuild( McpsReq_t *mcpsRequest );
+#endif
+
+#ifdef CONFIG_LORAMAC_TX_QUEUE
+/*!
+ * \brief   Confirm callback of a queued uplink
+ *
+ * \param   [IN] mcpsConfirm - MCPS-Confirm of the uplink.
+ * \param   [IN] context - Context given to \ref LoRaMacMcpsEnqueue.
+ */
+typedef void ( *LoRaMacTxConfirm_t )( McpsConfirm_t *mcpsConfirm, void *context );
+
+/*!
+ * \brief   Queues an MCPS-Request
+ *
+ * \details The payload is copied, into a pool block sized to it with
+ *          CONFIG_POOL, see \ref LORA_POOL. The queued uplinks are requested one after
+ *          the other once the MAC is done with the previous one, RX windows
+ *          and retransmissions included, and go out as soon as the duty cycle
+ *          allows. Each uplink is confirmed to its callback, after the
+ *          MacMcpsConfirm primitive. An uplink the MAC rejects is confirmed
+ *          with an error status, a busy MAC is retried later.
+ *
+ * \param   [IN] mcpsRequest - MCPS-Request to queue.
+ * \param   [IN] confirm - Confirm callback, may be NULL.
+ * \param   [IN] context - Context given to the callback.
+ *
+ * \retval  LoRaMacStatus_t Status of the operation. Possible returns are:
+ *          \ref LORAMAC_STATUS_OK,
+ *          \ref LORAMAC_STATUS_BUSY when the queue or the pool is full,
+ *          \ref LORAMAC_STATUS_SERVICE_UNKNOWN,
+ *          \ref LORAMAC_STATUS_PARAMETER_INVALID.
+ */
+LoRaMacStatus_t LoRaMacMcpsEnqueue( McpsReq_t *mcpsRequest, LoRaMacTxConfirm_t confirm, void *context );
+
+/*!
+ * \brief   Number of queued uplinks, the one in progress included
+ *
+ * \retval  uint8_t Queued uplinks.
+ */
+uint8_t LoRaMacMcpsQueued( void );
+#endif
+
+#ifdef CONFIG_LORAMAC_FAST_INDICATION
+/*!
+ * \brief   Fast indication of a Class C downlink
+ *
+ * \param   [IN] mcpsIndication - Port, Buffer, BufferSize, Rssi, Snr, RxSlot,
+ *                               Multicast and DownLinkCounter set, the buffer
+ *                               valid during the call only.
+ */
+typedef void ( *LoRaMacFastIndication_t )( McpsIndication_t *mcpsIndication );
+
+/*!
+ * \brief   Registers the fast indication of an FPort
+ *
+ * \details An unconfirmed downlink of the port received in the Class C
+ *          continuous RX2 window, without FOpts, is indicated from the radio
+ *          RX done, right after its payload is decrypted, and the continuous
+ *          RX2 window opened again before the MAC state check runs. The
+ *          MacMcpsIndication primitive follows with RxData false. The other
+ *          downlinks go the usual way.
+ *
+ * \param   [IN] port - FPort, 1 to 223.
+ * \param   [IN] indication - Fast indication, NULL to unregister.
+ *
+ * \retval  LoRaMacStatus_t Status of the operation. Possible returns are:
+ *          \ref LORAMAC_STATUS_OK,
+ *          \ref LORAMAC_STATUS_PARAMETER_INVALID.
+ */
+LoRaMacStatus_t LoRaMacFastIndicationSet( uint8_t port, LoRaMacFastIndication_t indication );
+#endif
+
+/*!
+ * \brief   Keeps the downlink payload of an MCPS-Indication
+ *
+ * \details McpsIndication_t.Buffer points into a MAC frame buffer that is
+ *          given back to the radio when the indication callback returns.
+ *          Calling this function from the callback keeps the payload valid
+ *          until \ref LoRaMacRxBufferRelease is called.
+ *
+ * \param   [IN] buffer - Buffer of the current MCPS-Indication.
+ *
+ * \retval  bool false when the buffer does not belong to a pending indication.
+ */
+bool LoRaMacRxBufferHold( uint8_t *buffer );
+
+/*!
+ * \brief   Gives back a payload kept with \ref LoRaMacRxBufferHold
+ *
+ * \param   [IN] buffer - Buffer previously held.
+ */
+void LoRaMacRxBufferRelease( uint8_t *buffer );
+
+/*!
+ * \brief   Gives the radio back to the MAC after another user of it
+ *
+ * \details The radio events are the ones of the MAC again and the sync word
+ *          the one of the network. Only while the MAC is idle, it sets the
+ *          radio configuration of its next operation itself.
+ */
+void LoRaMacRadioAttach( void );
+
 
 #include "region/Region.h"
 
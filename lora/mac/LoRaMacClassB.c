@@ -24,6 +24,11 @@ Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jae
 #include "LoRaMacClassBConfig.h"
 #include "LoRaMacCrypto.h"
 #include "LoRaMacConfirmQueue.h"
+#include "crc.h"
+#include "radio-arbiter.h"
+#ifdef CONFIG_RTC_DISCIPLINE
+#include "rtc-board.h"
+#endif
 #include <stdio.h>
 
 // #define LORAMAC_CLASSB_ENABLED
@@ -81,29 +86,47 @@ static LoRaMacClassBCallback_t LoRaMacClassBCallbacks;
 static LoRaMacClassBParams_t LoRaMacClassBParams;
 
 /*!
- * \brief Calculates the downlink frequency for a given channel.
- *
- * \param [IN] channel The channel according to the channel plan.
- *
- * \retval The downlink frequency
+ * Beacon and ping slot channel plan of the region, read once at the init
  */
-static uint32_t CalcDownlinkFrequency( uint8_t channel )
+static struct
+{
+    uint32_t Frequency;
+    uint32_t Stepwidth;
+    uint8_t NbChannels;
+}DownlinkPlan;
+
+/*!
+ * \brief Reads the beacon and ping slot channel plan of the region
+ */
+static void DownlinkPlanInit( void )
 {
     GetPhyParams_t getPhy;
     PhyParam_t phyParam;
-    uint32_t frequency = 0;
-    uint32_t stepwidth = 0;
 
     getPhy.Attribute = PHY_BEACON_CHANNEL_FREQ;
     phyParam = RegionGetPhyParam( *LoRaMacClassBParams.LoRaMacRegion, &getPhy );
-    frequency = phyParam.Value;
+    DownlinkPlan.Frequency = phyParam.Value;
 
     getPhy.Attribute = PHY_BEACON_CHANNEL_STEPWIDTH;
     phyParam = RegionGetPhyParam( *LoRaMacClassBParams.LoRaMacRegion, &getPhy );
-    stepwidth = phyParam.Value;
+    DownlinkPlan.Stepwidth = phyParam.Value;
 
+    getPhy.Attribute = PHY_BEACON_NB_CHANNELS;
+    phyParam = RegionGetPhyParam( *LoRaMacClassBParams.LoRaMacRegion, &getPhy );
+    DownlinkPlan.NbChannels = ( uint8_t )phyParam.Value;
+}
+
+/*!
+ * \brief Calculates the downlink frequency for a given channel.
+ *
+ * \param [IN] channel The channel according to the channel plan.
+ *
+ * \retval The downlink frequency
+ */
+static uint32_t CalcDownlinkFrequency( uint8_t channel )
+{
     // Calculate the frequency
-    return frequency + ( channel * stepwidth );
+    return DownlinkPlan.Frequency + ( channel * DownlinkPlan.Stepwidth );
 }
 
 /*!
@@ -120,16 +143,10 @@ static uint32_t CalcDownlinkFrequency( uint8_t channel )
  */
 static uint32_t CalcDownlinkChannelAndFrequency( uint32_t devAddr, TimerTime_t beaconTime, TimerTime_t beaconInterval )
 {
-    GetPhyParams_t getPhy;
-    PhyParam_t phyParam;
     uint32_t channel = 0;
-    uint8_t nbChannels = 0;
+    uint8_t nbChannels = DownlinkPlan.NbChannels;
     uint32_t frequency = 0;
 
-    getPhy.Attribute = PHY_BEACON_NB_CHANNELS;
-    phyParam = RegionGetPhyParam( *LoRaMacClassBParams.LoRaMacRegion, &getPhy );
-    nbChannels = (uint8_t) phyParam.Value;
-
     if( nbChannels > 1 )
     {
         // Calculate the channel for the next downlink
@@ -144,6 +161,108 @@ static uint32_t CalcDownlinkChannelAndFrequency( uint32_t devAddr, TimerTime_t b
     return frequency;
 }
 
+#ifdef CONFIG_LORAMAC_CLASSB_ADAPTIVE_WINDOW
+/*!
+ * \brief Tracks the arrival error of a received beacon, with the smoothing of
+ *        the TCP round trip estimator: gain 1/8 on the mean, 1/4 on the
+ *        deviation.
+ *
+ * \param [IN] error Measured minus expected beacon time in ms
+ */
+static void TrackBeaconRxError( int32_t error )
+{
+    int32_t diff;
+
+    if( ( error > CLASSB_RX_ERROR_SAMPLE_MAX ) || ( error < -CLASSB_RX_ERROR_SAMPLE_MAX ) )
+    {
+        // A beacon that far off is a timing change, not a measure of the jitter
+        return;
+    }
+
+    error *= 8;
+    if( BeaconCtx.RxErrorSamples == 0 )
+    {
+        BeaconCtx.RxErrorMean = error;
+        BeaconCtx.RxErrorDev = ( uint32_t )( ( error < 0 ) ? -error : error ) / 2;
+    }
+    else
+    {
+        diff = error - BeaconCtx.RxErrorMean;
+        BeaconCtx.RxErrorMean += diff / 8;
+        if( diff < 0 )
+        {
+            diff = -diff;
+        }
+        BeaconCtx.RxErrorDev = ( uint32_t )( ( int32_t )BeaconCtx.RxErrorDev + ( diff - ( int32_t )BeaconCtx.RxErrorDev ) / 4 );
+    }
+    if( BeaconCtx.RxErrorSamples < UINT8_MAX )
+    {
+        BeaconCtx.RxErrorSamples++;
+    }
+}
+#endif
+
+/*!
+ * \brief Maximum RX error of the beacon and ping slot windows while the beacon
+ *        timing is known
+ *
+ * \remark With CONFIG_LORAMAC_CLASSB_ADAPTIVE_WINDOW, the bound is the
+ *         measured beacon arrival error, mean plus 4 deviations, once enough
+ *         beacons have been received. It includes the timer drift over a
+ *         beacon period and never exceeds SystemMaxRxError.
+ *         With CONFIG_LORAMAC_CLASSB_PREDICTIVE, the drift adds up over the
+ *         periods without beacon.
+ *
+ * \retval rxError RX error in ms
+ */
+static uint32_t GetClassBRxError( void )
+{
+    uint32_t rxError = LoRaMacClassBParams.LoRaMacParams->SystemMaxRxError;
+#ifdef CONFIG_LORAMAC_CLASSB_ADAPTIVE_WINDOW
+    uint32_t measured;
+
+    if( BeaconCtx.RxErrorSamples >= CLASSB_RX_ERROR_SAMPLES_MIN )
+    {
+        measured = ( uint32_t )( ( BeaconCtx.RxErrorMean < 0 ) ? -BeaconCtx.RxErrorMean : BeaconCtx.RxErrorMean );
+        measured = ( measured + ( 4 * BeaconCtx.RxErrorDev ) + 7 ) / 8;
+        if( measured < CLASSB_RX_ERROR_MIN )
+        {
+            measured = CLASSB_RX_ERROR_MIN;
+        }
+        if( measured < rxError )
+        {
+            rxError = measured;
+        }
+    }
+#endif
+#ifdef CONFIG_LORAMAC_CLASSB_PREDICTIVE
+    rxError *= ( uint32_t )BeaconCtx.MissedBeacons + 1;
+    if( rxError > CLASSB_PREDICTIVE_RX_ERROR_MAX )
+    {
+        rxError = CLASSB_PREDICTIVE_RX_ERROR_MAX;
+    }
+#endif
+    return rxError;
+}
+
+/*!
+ * \brief Tells if the beacon and ping slot times are known precisely enough
+ *        to compute the RX windows from the RX error
+ *
+ * \retval known True while the beacon is acquired, or predicted from the last
+ *         one received with CONFIG_LORAMAC_CLASSB_PREDICTIVE
+ */
+static bool IsBeaconTimingKnown( void )
+{
+#ifdef CONFIG_LORAMAC_CLASSB_PREDICTIVE
+    if( BeaconCtx.MissedBeacons != 0 )
+    {
+        return true;
+    }
+#endif
+    return ( BeaconCtx.Ctrl.BeaconAcquired == 1 ) ? true : false;
+}
+
 /*!
  * \brief Calculates the correct frequency and opens up the beacon reception window.
  *
@@ -165,6 +284,7 @@ static void RxBeaconSetup( TimerTime_t rxTime, bool activateDefaultChannel )
     PhyParam_t phyParam;
     uint16_t windowTimeout = BeaconCtx.SymbolTimeout;
 
+    RADIO_ARBITER_ACQUIRE( RADIO_ARBITER_LORAMAC );
     if( activateDefaultChannel == true )
     {
         // This is the default frequency in case we don't know when the next
@@ -191,7 +311,7 @@ static void RxBeaconSetup( TimerTime_t rxTime, bool activateDefaultChannel )
         frequency = CalcDownlinkFrequency( BeaconCtx.BeaconTimingChannel );
     }
 
-    if( ( BeaconCtx.Ctrl.BeaconAcquired == 1 ) || ( BeaconCtx.Ctrl.AcquisitionPending == 1 ) )
+    if( ( IsBeaconTimingKnown( ) == true ) || ( BeaconCtx.Ctrl.AcquisitionPending == 1 ) )
     {
         // Apply the symbol timeout only if we have acquired the beacon
         // Otherwise, take the window enlargement into account
@@ -203,7 +323,7 @@ static void RxBeaconSetup( TimerTime_t rxTime, bool activateDefaultChannel )
         RegionComputeRxWindowParameters( *LoRaMacClassBParams.LoRaMacRegion,
                                         ( int8_t )phyParam.Value, // datarate
                                         LoRaMacClassBParams.LoRaMacParams->MinRxSymbols,
-                                        LoRaMacClassBParams.LoRaMacParams->SystemMaxRxError,
+                                        GetClassBRxError( ),
                                         &beaconRxConfig );
         windowTimeout = beaconRxConfig.WindowTimeout;
     }
@@ -211,6 +331,18 @@ static void RxBeaconSetup( TimerTime_t rxTime, bool activateDefaultChannel )
     rxBeaconSetup.SymbolTimeout = windowTimeout;
     // rxBeaconSetup.RxTime = (uint32_t)rxTime;
     rxBeaconSetup.RxTime = 0;
+#ifdef CONFIG_LORAMAC_CLASSB_PREDICTIVE
+    if( ( activateDefaultChannel == false ) && ( BeaconCtx.MissedBeacons != 0 ) )
+    {
+        // Short window around the predicted beacon time, the radio stops
+        // after the symbol timeout instead of listening until a frame arrives
+        if( windowTimeout > CLASSB_BEACON_SYMBOL_TO_EXPANSION_MAX )
+        {
+            rxBeaconSetup.SymbolTimeout = CLASSB_BEACON_SYMBOL_TO_EXPANSION_MAX;
+        }
+        rxBeaconSetup.RxTime = ( uint32_t )rxTime;
+    }
+#endif
     rxBeaconSetup.Frequency = frequency;
 
     RegionRxBeaconSetup( *LoRaMacClassBParams.LoRaMacRegion, &rxBeaconSetup, &LoRaMacClassBParams.McpsIndication->RxDatarate );
@@ -221,38 +353,71 @@ static void RxBeaconSetup( TimerTime_t rxTime, bool activateDefaultChannel )
     LoRaMacClassBParams.MlmeIndication->BeaconInfo.Datarate = LoRaMacClassBParams.McpsIndication->RxDatarate;
 }
 
+/*!
+ * \brief Computes the ping slot schedule of the current beacon period. The
+ *        ping offset and the frequency are computed once per beacon, the
+ *        period start once per period, beacon missed or not.
+ *
+ * \param [IN] schedule   Schedule to update
+ * \param [IN] address    Device or multicast address
+ * \param [IN] pingPeriod The ping period
+ * \param [OUT] pingOffset The ping offset
+ */
+static void UpdatePingSlotSchedule( PingSlotSchedule_t *schedule, uint32_t address, uint16_t pingPeriod, uint16_t *pingOffset )
+{
+    TimerTime_t currentTime = TimerGetCurrentTime( );
+
+    if( ( schedule->Valid == false ) || ( schedule->BeaconTime != BeaconCtx.BeaconTime ) ||
+        ( schedule->Address != address ) || ( schedule->PingPeriod != pingPeriod ) )
+    {
+        LoRaMacBeaconComputePingOffset( BeaconCtx.BeaconTime, address, pingPeriod, pingOffset );
+        schedule->Frequency = CalcDownlinkChannelAndFrequency( address, BeaconCtx.BeaconTime, CLASSB_BEACON_INTERVAL );
+        schedule->BeaconTime = BeaconCtx.BeaconTime;
+        schedule->Address = address;
+        schedule->PingPeriod = pingPeriod;
+        schedule->Valid = true;
+        // Computes the period start again, the offset has changed
+        schedule->LastBeaconRx = BeaconCtx.LastBeaconRx + 1;
+    }
+
+    if( ( schedule->LastBeaconRx != BeaconCtx.LastBeaconRx ) || ( currentTime < schedule->PeriodStart ) ||
+        ( ( currentTime - schedule->PeriodStart ) >= CLASSB_BEACON_INTERVAL ) )
+    {
+        // Calculate the point in time of the last beacon even if we missed it
+        schedule->PeriodStart = currentTime - ( ( currentTime - BeaconCtx.LastBeaconRx ) % CLASSB_BEACON_INTERVAL );
+        schedule->LastBeaconRx = BeaconCtx.LastBeaconRx;
+        schedule->NextSlot = 0;
+    }
+}
+
 /*!
  * \brief Calculates the next ping slot time.
  *
+ * \param [IN] schedule   Ping slot schedule of the current beacon period
  * \param [IN] slotOffset The ping slot offset
  * \param [IN] pingPeriod The ping period
  * \param [OUT] timeOffset Time offset of the next slot, based on current time
  *
  * \retval [true: ping slot found, false: no ping slot found]
  */
-static bool CalcNextSlotTime( uint16_t slotOffset, uint16_t pingPeriod, uint16_t pingNb, TimerTime_t* timeOffset )
+static bool CalcNextSlotTime( PingSlotSchedule_t *schedule, uint16_t slotOffset, uint16_t pingPeriod, uint16_t pingNb, TimerTime_t* timeOffset )
 {
-    uint8_t currentPingSlot = 0;
     TimerTime_t slotTime = 0;
     TimerTime_t currentTime = TimerGetCurrentTime( );
 
-    // Calculate the point in time of the last beacon even if we missed it
-    slotTime = ( ( currentTime - BeaconCtx.LastBeaconRx ) % CLASSB_BEACON_INTERVAL );
-    slotTime = currentTime - slotTime;
-
     // Add the reserved time and the ping offset
-    slotTime += CLASSB_BEACON_RESERVED;
-    slotTime += slotOffset * CLASSB_PING_SLOT_WINDOW;
+    slotTime = schedule->PeriodStart + CLASSB_BEACON_RESERVED;
+    slotTime += ( TimerTime_t )( slotOffset + ( uint32_t )schedule->NextSlot * pingPeriod ) * CLASSB_PING_SLOT_WINDOW;
 
-    if( slotTime < currentTime )
+    // The slots are taken in order, the passed ones are skipped from the
+    // last one taken
+    while( ( slotTime < currentTime ) && ( schedule->NextSlot < pingNb ) )
     {
-        currentPingSlot = ( ( currentTime - slotTime ) /
-                          ( pingPeriod * CLASSB_PING_SLOT_WINDOW ) ) + 1;
-        slotTime += ( ( TimerTime_t )( currentPingSlot * pingPeriod ) *
-                    CLASSB_PING_SLOT_WINDOW );
+        schedule->NextSlot++;
+        slotTime += ( TimerTime_t )pingPeriod * CLASSB_PING_SLOT_WINDOW;
     }
 
-    if( currentPingSlot < pingNb )
+    if( schedule->NextSlot < pingNb )
     {
         if( slotTime <= ( BeaconCtx.NextBeaconRx - CLASSB_BEACON_GUARD - CLASSB_PING_SLOT_WINDOW ) )
         {
@@ -277,26 +442,13 @@ static bool CalcNextSlotTime( uint16_t slotOffset, uint16_t pingPeriod, uint16_t
  */
 static uint16_t BeaconCrc( uint8_t *buffer, uint16_t length )
 {
-    // The CRC calculation follows CCITT
-    const uint16_t polynom = 0x1021;
-    // CRC initial value
-    uint16_t crc = 0x0000;
-
     if( buffer == NULL )
     {
         return 0;
     }
 
-    for( uint16_t i = 0; i < length; ++i )
-    {
-        crc ^= ( uint16_t ) buffer[i] << 8;
-        for( uint16_t j = 0; j < 8; ++j )
-        {
-            crc = ( crc & 0x8000 ) ? ( crc << 1 ) ^ polynom : ( crc << 1 );
-        }
-    }
-
-    return crc;
+    // The CRC calculation follows CCITT
+    return CrcCompute( &CrcCcitt, buffer, length );
 }
 
 static void GetTemperatureLevel( LoRaMacClassBCallback_t *callbacks, BeaconContext_t *beaconCtx )
@@ -344,6 +496,15 @@ static void InitClassBDefaults( void )
 
 static void EnlargeWindowTimeout( void )
 {
+#ifdef CONFIG_LORAMAC_CLASSB_PREDICTIVE
+    if( BeaconCtx.MissedBeacons < UINT8_MAX )
+    {
+        BeaconCtx.MissedBeacons++;
+    }
+    // The windows grow with the drift model, from the RX error, instead of
+    // doubling
+    BeaconCtx.BeaconWindowMovement = GetClassBRxError( );
+#else
     // Update beacon movement
     BeaconCtx.BeaconWindowMovement *= CLASSB_WINDOW_MOVE_EXPANSION_FACTOR;
     if( BeaconCtx.BeaconWindowMovement > CLASSB_WINDOW_MOVE_EXPANSION_MAX )
@@ -361,6 +522,7 @@ static void EnlargeWindowTimeout( void )
     {
         PingSlotCtx.SymbolTimeout = CLASSB_PING_SLOT_SYMBOL_TO_EXPANSION_MAX;
     }
+#endif
 }
 
 static void ResetWindowTimeout( void )
@@ -368,6 +530,14 @@ static void ResetWindowTimeout( void )
     BeaconCtx.SymbolTimeout = CLASSB_BEACON_SYMBOL_TO_DEFAULT;
     PingSlotCtx.SymbolTimeout = CLASSB_BEACON_SYMBOL_TO_DEFAULT;
     BeaconCtx.BeaconWindowMovement  = CLASSB_WINDOW_MOVE_DEFAULT;
+#ifdef CONFIG_LORAMAC_CLASSB_ADAPTIVE_WINDOW
+    // Open the beacon window early enough for the measured arrival error, the
+    // misses widen it from there
+    if( GetClassBRxError( ) > BeaconCtx.BeaconWindowMovement )
+    {
+        BeaconCtx.BeaconWindowMovement = GetClassBRxError( );
+    }
+#endif
 }
 
 static TimerTime_t CalcDelayForNextBeacon( TimerTime_t currentTime, TimerTime_t lastBeaconRx )
@@ -457,11 +627,18 @@ void LoRaMacClassBInit( LoRaMacClassBParams_t *classBParams, LoRaMacClassBCallba
     LoRaMacClassBCallbacks = *callbacks;
     // Store parameter pointers
     LoRaMacClassBParams = *classBParams;
+    DownlinkPlanInit( );
 
     // Initialize timers
     TimerInit( &BeaconTimer, LoRaMacClassBBeaconTimerEvent );
     TimerInit( &PingSlotTimer, LoRaMacClassBPingSlotTimerEvent );
     TimerInit( &MulticastSlotTimer, LoRaMacClassBMulticastSlotTimerEvent );
+#ifdef CONFIG_TIMER_DEFER
+    // The beacon and ping slot windows open from the timer interrupt
+    TimerSetUrgent( &BeaconTimer, true );
+    TimerSetUrgent( &PingSlotTimer, true );
+    TimerSetUrgent( &MulticastSlotTimer, true );
+#endif
 
 #ifdef MY_DEBUG2
     printf("init LoRaMacClassBInit 2\r\n");
@@ -671,7 +848,11 @@ void LoRaMacClassBBeaconTimerEvent( void )
             BeaconCtx.Ctrl.BeaconAcquired = 0;
 
             // Verify if the maximum beacon less period has been elapsed
+#ifdef CONFIG_LORAMAC_CLASSB_PREDICTIVE
+            if( BeaconCtx.MissedBeacons > CLASSB_PREDICTIVE_PERIODS )
+#else
             if( ( currentTime - BeaconCtx.LastBeaconRx ) > CLASSB_MAX_BEACON_LESS_PERIOD )
+#endif
             {
                 BeaconState = BEACON_STATE_LOST;
             }
@@ -803,27 +984,30 @@ void LoRaMacClassBPingSlotTimerEvent( void )
     {
         case PINGSLOT_STATE_CALC_PING_OFFSET:
         {
-            LoRaMacBeaconComputePingOffset( BeaconCtx.BeaconTime,
-                                            *LoRaMacClassBParams.LoRaMacDevAddr,
-                                            PingSlotCtx.PingPeriod,
-                                            &( PingSlotCtx.PingOffset ) );
             PingSlotState = PINGSLOT_STATE_SET_TIMER;
             // no break
         }
         case PINGSLOT_STATE_SET_TIMER:
         {
-            if( CalcNextSlotTime( PingSlotCtx.PingOffset, PingSlotCtx.PingPeriod, PingSlotCtx.PingNb, &pingSlotTime ) == true )
+            // Computed once per beacon period, a no-op for the other slots
+            UpdatePingSlotSchedule( &PingSlotCtx.Schedule, *LoRaMacClassBParams.LoRaMacDevAddr,
+                                    PingSlotCtx.PingPeriod, &( PingSlotCtx.PingOffset ) );
+            if( CalcNextSlotTime( &PingSlotCtx.Schedule, PingSlotCtx.PingOffset, PingSlotCtx.PingPeriod, PingSlotCtx.PingNb, &pingSlotTime ) == true )
             {
-                if( BeaconCtx.Ctrl.BeaconAcquired == 1 )
+                if( IsBeaconTimingKnown( ) == true )
                 {
                     // Compute the symbol timeout. Apply it only, if the beacon is acquired
                     // Otherwise, take the enlargement of the symbols into account.
                     RegionComputeRxWindowParameters( *LoRaMacClassBParams.LoRaMacRegion,
                                                      PingSlotCtx.Datarate,
                                                      LoRaMacClassBParams.LoRaMacParams->MinRxSymbols,
-                                                     LoRaMacClassBParams.LoRaMacParams->SystemMaxRxError,
+                                                     GetClassBRxError( ),
                                                      &pingSlotRxConfig );
                     PingSlotCtx.SymbolTimeout = pingSlotRxConfig.WindowTimeout;
+                    if( PingSlotCtx.SymbolTimeout > CLASSB_PING_SLOT_SYMBOL_TO_EXPANSION_MAX )
+                    {
+                        PingSlotCtx.SymbolTimeout = CLASSB_PING_SLOT_SYMBOL_TO_EXPANSION_MAX;
+                    }
 
                     if( ( int32_t )pingSlotTime > pingSlotRxConfig.WindowOffset )
                     {// Apply the window offset
@@ -846,7 +1030,7 @@ void LoRaMacClassBPingSlotTimerEvent( void )
             if( PingSlotCtx.Ctrl.CustomFreq == 0 )
             {
                 // Restore floor plan
-                frequency = CalcDownlinkChannelAndFrequency( *LoRaMacClassBParams.LoRaMacDevAddr, BeaconCtx.BeaconTime, CLASSB_BEACON_INTERVAL );
+                frequency = PingSlotCtx.Schedule.Frequency;
             }
 
             // Open the ping slot window only, if there is no multicast ping slot
@@ -854,6 +1038,8 @@ void LoRaMacClassBPingSlotTimerEvent( void )
             if( MulticastSlotState != PINGSLOT_STATE_RX )
             {
                 PingSlotState = PINGSLOT_STATE_RX;
+                PingSlotCtx.RxFrequency = frequency;
+                PingSlotCtx.RxDatarate = PingSlotCtx.Datarate;
 
                 pingSlotRxConfig.Datarate = PingSlotCtx.Datarate;
                 pingSlotRxConfig.DownlinkDwellTime = LoRaMacClassBParams.LoRaMacParams->DownlinkDwellTime;
@@ -862,6 +1048,7 @@ void LoRaMacClassBPingSlotTimerEvent( void )
                 pingSlotRxConfig.RxContinuous = false;
                 pingSlotRxConfig.RxSlot = RX_SLOT_WIN_PING_SLOT;
 
+                RADIO_ARBITER_ACQUIRE( RADIO_ARBITER_LORAMAC );
                 RegionRxConfig( *LoRaMacClassBParams.LoRaMacRegion, &pingSlotRxConfig, ( int8_t* )&LoRaMacClassBParams.McpsIndication->RxDatarate );
 
                 if( pingSlotRxConfig.RxContinuous == false )
@@ -873,6 +1060,12 @@ void LoRaMacClassBPingSlotTimerEvent( void )
                     Radio.Rx( 0 ); // Continuous mode
                 }
             }
+            else if( ( PingSlotCtx.RxFrequency == frequency ) && ( PingSlotCtx.RxDatarate == PingSlotCtx.Datarate ) )
+            {
+                // The multicast window open receives the unicast downlinks
+                // as well, the slots share it
+                PingSlotState = PINGSLOT_STATE_RX;
+            }
             else
             {
                 // Multicast slots have priority. Skip Rx
@@ -916,15 +1109,6 @@ void LoRaMacClassBMulticastSlotTimerEvent( void )
     {
         case PINGSLOT_STATE_CALC_PING_OFFSET:
         {
-            // Compute all offsets for every multicast slots
-            while( cur != NULL )
-            {
-                LoRaMacBeaconComputePingOffset( BeaconCtx.BeaconTime,
-                                                cur->Address,
-                                                cur->PingPeriod,
-                                                &( cur->PingOffset ) );
-                cur = cur->Next;
-            }
             MulticastSlotState = PINGSLOT_STATE_SET_TIMER;
             // no break
         }
@@ -935,8 +1119,10 @@ void LoRaMacClassBMulticastSlotTimerEvent( void )
 
             while( cur != NULL )
             {
-                // Calculate the next slot time for every multicast slot
-                if( CalcNextSlotTime( cur->PingOffset, cur->PingPeriod, cur->PingNb, &slotTime ) == true )
+                // Calculate the next slot time for every multicast slot, the
+                // schedules are computed once per beacon period
+                UpdatePingSlotSchedule( &cur->Schedule, cur->Address, cur->PingPeriod, &( cur->PingOffset ) );
+                if( CalcNextSlotTime( &cur->Schedule, cur->PingOffset, cur->PingPeriod, cur->PingNb, &slotTime ) == true )
                 {
                     if( ( multicastSlotTime == 0 ) || ( multicastSlotTime > slotTime ) )
                     {
@@ -951,14 +1137,18 @@ void LoRaMacClassBMulticastSlotTimerEvent( void )
             // Schedule the next multicast slot
             if( PingSlotCtx.NextMulticastChannel != NULL )
             {
-                if( BeaconCtx.Ctrl.BeaconAcquired == 1 )
+                if( IsBeaconTimingKnown( ) == true )
                 {
                     RegionComputeRxWindowParameters( *LoRaMacClassBParams.LoRaMacRegion,
                                                     PingSlotCtx.Datarate,
                                                     LoRaMacClassBParams.LoRaMacParams->MinRxSymbols,
-                                                    LoRaMacClassBParams.LoRaMacParams->SystemMaxRxError,
+                                                    GetClassBRxError( ),
                                                     &multicastSlotRxConfig );
                     PingSlotCtx.SymbolTimeout = multicastSlotRxConfig.WindowTimeout;
+                    if( PingSlotCtx.SymbolTimeout > CLASSB_PING_SLOT_SYMBOL_TO_EXPANSION_MAX )
+                    {
+                        PingSlotCtx.SymbolTimeout = CLASSB_PING_SLOT_SYMBOL_TO_EXPANSION_MAX;
+                    }
                 }
 
                 if( ( int32_t )multicastSlotTime > multicastSlotRxConfig.WindowOffset )
@@ -993,11 +1183,22 @@ void LoRaMacClassBMulticastSlotTimerEvent( void )
             if( frequency == 0 )
             {
                 // Restore floor plan
-                frequency = CalcDownlinkChannelAndFrequency( PingSlotCtx.NextMulticastChannel->Address, BeaconCtx.BeaconTime, CLASSB_BEACON_INTERVAL );
+                frequency = PingSlotCtx.NextMulticastChannel->Schedule.Frequency;
             }
 
             MulticastSlotState = PINGSLOT_STATE_RX;
 
+            if( ( PingSlotState == PINGSLOT_STATE_RX ) && ( PingSlotCtx.RxFrequency == frequency ) &&
+                ( PingSlotCtx.RxDatarate == PingSlotCtx.NextMulticastChannel->Datarate ) )
+            {
+                // The ping slot window open receives the multicast downlinks
+                // as well, the slots share it without configuring the radio
+                // again
+                break;
+            }
+            PingSlotCtx.RxFrequency = frequency;
+            PingSlotCtx.RxDatarate = PingSlotCtx.NextMulticastChannel->Datarate;
+
             multicastSlotRxConfig.Datarate = PingSlotCtx.NextMulticastChannel->Datarate;
             multicastSlotRxConfig.DownlinkDwellTime = LoRaMacClassBParams.LoRaMacParams->DownlinkDwellTime;
             multicastSlotRxConfig.RepeaterSupport = LoRaMacClassBParams.LoRaMacParams->RepeaterSupport;
@@ -1005,6 +1206,7 @@ void LoRaMacClassBMulticastSlotTimerEvent( void )
             multicastSlotRxConfig.RxContinuous = false;
             multicastSlotRxConfig.RxSlot = RX_SLOT_WIN_MULTICAST_SLOT;
 
+            RADIO_ARBITER_ACQUIRE( RADIO_ARBITER_LORAMAC );
             RegionRxConfig( *LoRaMacClassBParams.LoRaMacRegion, &multicastSlotRxConfig, ( int8_t* )&LoRaMacClassBParams.McpsIndication->RxDatarate );
 
             if( PingSlotState == PINGSLOT_STATE_RX )
@@ -1099,7 +1301,29 @@ bool LoRaMacClassBRxBeacon( uint8_t *payload, uint16_t size )
             // Reset beacon variables, if one of the crc is valid
             if( beaconProcessed == true )
             {
-                BeaconCtx.LastBeaconRx = TimerGetCurrentTime( ) - Radio.TimeOnAir( MODEM_LORA, size );
+                TimerTime_t age = 0;
+
+#ifdef CONFIG_LORA_EVENT_TIMESTAMP
+                // From the RX done interrupt rather than the callback
+                age = ( uint32_t )( TimerGetCurrentTime( ) - Radio.GetRxTime( ) );
+#endif
+                BeaconCtx.LastBeaconRx = TimerGetCurrentTime( ) - age - Radio.TimeOnAir( MODEM_LORA, size );
+#ifdef CONFIG_RTC_DISCIPLINE
+                // The beacon starts at its GPS time, up to the constant TX delay
+                RtcDisciplineUpdate( RtcGetTimerValue( ) - age - Radio.TimeOnAir( MODEM_LORA, size ),
+                                     ( TimerTime_t )BeaconCtx.BeaconTime * 1000 );
+#endif
+#ifdef CONFIG_LORAMAC_CLASSB_PREDICTIVE
+                BeaconCtx.MissedBeacons = 0;
+#endif
+#ifdef CONFIG_LORAMAC_CLASSB_ADAPTIVE_WINDOW
+                // Only a beacon received in the window of the locked state
+                // measures the timing error over one beacon period
+                if( ( BeaconCtx.Ctrl.BeaconAcquired == 1 ) && ( BeaconCtx.NextBeaconRx != 0 ) )
+                {
+                    TrackBeaconRxError( ( int32_t )( BeaconCtx.LastBeaconRx - BeaconCtx.NextBeaconRx ) );
+                }
+#endif
                 BeaconCtx.Ctrl.BeaconAcquired = 1;
                 BeaconCtx.Ctrl.BeaconMode = 1;
                 ResetWindowTimeout( );
@@ -1523,6 +1747,7 @@ void LoRaMacClassBSetMulticastPeriodicity( MulticastParams_t* multicastChannel )
     {
         multicastChannel->PingNb = CalcPingNb( multicastChannel->Periodicity );
         multicastChannel->PingPeriod = CalcPingPeriod( multicastChannel->PingNb );
+        multicastChannel->Schedule.Valid = false;
     }
 #endif // LORAMAC_CLASSB_ENABLED
 }
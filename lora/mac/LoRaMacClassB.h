@@ -150,6 +150,10 @@ typedef struct sPingSlotContext
      * Ping offset
      */
     uint16_t PingOffset;
+    /*!
+     * Ping slot schedule of the current beacon period
+     */
+    PingSlotSchedule_t Schedule;
     /*!
      * Reception frequency of the ping slot windows
      */
@@ -167,6 +171,11 @@ typedef struct sPingSlotContext
      * The multicast channel which will be enabled next.
      */
     MulticastParams_t *NextMulticastChannel;
+    /*!
+     * Frequency and datarate of the ping or multicast slot window open
+     */
+    uint32_t RxFrequency;
+    int8_t RxDatarate;
 }PingSlotContext_t;
 
 
@@ -249,6 +258,26 @@ typedef struct sBeaconContext
      * Delay for next beacon in ms
      */
     TimerTime_t BeaconTimingDelay;
+#ifdef CONFIG_LORAMAC_CLASSB_ADAPTIVE_WINDOW
+    /*!
+     * Smoothed beacon arrival error, measured minus expected time, in 1/8 ms
+     */
+    int32_t RxErrorMean;
+    /*!
+     * Smoothed beacon arrival error deviation in 1/8 ms
+     */
+    uint32_t RxErrorDev;
+    /*!
+     * Number of beacon arrival errors measured, saturated
+     */
+    uint8_t RxErrorSamples;
+#endif
+#ifdef CONFIG_LORAMAC_CLASSB_PREDICTIVE
+    /*!
+     * Number of beacons missed since the last one received
+     */
+    uint8_t MissedBeacons;
+#endif
 }BeaconContext_t;
 
 /*!
@@ -112,6 +112,36 @@
  */
 #define CLASSB_WINDOW_MOVE_EXPANSION_FACTOR         2
 
+/*!
+ * Number of measured beacon arrival errors before the adaptive windows
+ * replace the SystemMaxRxError based ones
+ */
+#define CLASSB_RX_ERROR_SAMPLES_MIN                 4
+
+/*!
+ * Minimum RX error of the adaptive windows in ms, covers the timer
+ * resolution and the radio interrupt latency
+ */
+#define CLASSB_RX_ERROR_MIN                         2
+
+/*!
+ * Largest beacon arrival error in ms taken as a timing measurement
+ */
+#define CLASSB_RX_ERROR_SAMPLE_MAX                  CLASSB_WINDOW_MOVE_EXPANSION_MAX
+
+/*!
+ * Number of beacon periods the predictive mode serves the ping slots without
+ * beacon before the beacon is lost
+ */
+#ifndef CLASSB_PREDICTIVE_PERIODS
+#define CLASSB_PREDICTIVE_PERIODS                   ( CLASSB_MAX_BEACON_LESS_PERIOD / CLASSB_BEACON_INTERVAL )
+#endif
+
+/*!
+ * Maximum RX error in ms of the predicted beacon and ping slot windows
+ */
+#define CLASSB_PREDICTIVE_RX_ERROR_MAX              CLASSB_WINDOW_MOVE_EXPANSION_MAX
+
 /*! \} addtogroup LORAMAC_CLASSB */
 
 #endif // __LORAMACCLASSBCONFIG_H__
@@ -27,6 +27,7 @@ Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jae
 #include "LoRaMacConfirmQueue.h"
 
 
+static LoRaMacPrimitives_t* Primitives;
 static LoRaMacPrimitives_t* Primitives;
 
 /*!
@@ -40,14 +41,15 @@ static MlmeConfirmQueue_t MlmeConfirmQueue[LORA_MAC_MLME_CONFIRM_QUEUE_LEN];
 static uint8_t MlmeConfirmQueueCnt;
 
 /*!
- * Pointer to the first element of the ring buffer
+ * Index of the first element of the ring buffer
  */
-MlmeConfirmQueue_t* BufferStart;
+static uint8_t MlmeConfirmQueueStart;
 
 /*!
- * Pointer to the last element of the ring buffer
+ * One bit per Mlme_t request in the queue, answers the lookups of the
+ * requests not queued without scanning
  */
-MlmeConfirmQueue_t* BufferEnd;
+static uint32_t MlmeConfirmQueueActive;
 
 /*!
  * Variable which holds a common status
@@ -55,53 +57,51 @@ MlmeConfirmQueue_t* BufferEnd;
 LoRaMacEventInfoStatus_t CommonStatus;
 
 
-static MlmeConfirmQueue_t* IncreaseBufferPointer( MlmeConfirmQueue_t* bufferPointer )
+static uint8_t GetIndex( uint8_t position )
 {
-    if( bufferPointer == &MlmeConfirmQueue[LORA_MAC_MLME_CONFIRM_QUEUE_LEN - 1] )
-    {
-        // Reset to the first element
-        bufferPointer = MlmeConfirmQueue;
-    }
-    else
+    uint8_t index = MlmeConfirmQueueStart + position;
+
+    if( index >= LORA_MAC_MLME_CONFIRM_QUEUE_LEN )
     {
-        // Increase
-        bufferPointer++;
+        index -= LORA_MAC_MLME_CONFIRM_QUEUE_LEN;
     }
-    return bufferPointer;
+    return index;
 }
 
-static MlmeConfirmQueue_t* DecreaseBufferPointer( MlmeConfirmQueue_t* bufferPointer )
+static MlmeConfirmQueue_t* GetElement( Mlme_t request )
 {
-    if( bufferPointer == MlmeConfirmQueue )
-    {
-        // Reset to the last element
-        bufferPointer = &MlmeConfirmQueue[LORA_MAC_MLME_CONFIRM_QUEUE_LEN - 1];
-    }
-    else
+    MlmeConfirmQueue_t* element;
+
+    if( ( MlmeConfirmQueueActive & ( 1UL << request ) ) == 0 )
     {
-        bufferPointer--;
+        return NULL;
     }
-    return bufferPointer;
-}
-
-static MlmeConfirmQueue_t* GetElement( Mlme_t request, MlmeConfirmQueue_t* bufferStart, MlmeConfirmQueue_t* bufferEnd )
-{
-    MlmeConfirmQueue_t* element = bufferStart;
 
-    do
+    for( uint8_t i = 0; i < MlmeConfirmQueueCnt; i++ )
     {
+        element = &MlmeConfirmQueue[GetIndex( i )];
         if( element->Request == request )
         {
             // We have found the element
             return element;
         }
-        else
+    }
+    return NULL;
+}
+
+static void UpdateActive( Mlme_t removed )
+{
+    MlmeConfirmQueueActive &= ~( 1UL << removed );
+
+    // Keep the bit of a duplicate still queued
+    for( uint8_t i = 0; i < MlmeConfirmQueueCnt; i++ )
+    {
+        if( MlmeConfirmQueue[GetIndex( i )].Request == removed )
         {
-            element = IncreaseBufferPointer( element );
+            MlmeConfirmQueueActive |= 1UL << removed;
+            break;
         }
-    }while( element != bufferEnd );
-
-    return NULL;
+    }
 }
 
 
@@ -113,8 +113,8 @@ void LoRaMacConfirmQueueInit( LoRaMacPrimitives_t* primitives )
     MlmeConfirmQueueCnt = 0;
 
     // Init buffer
-    BufferStart = MlmeConfirmQueue;
-    BufferEnd = MlmeConfirmQueue;
+    MlmeConfirmQueueStart = 0;
+    MlmeConfirmQueueActive = 0;
 
     memset1( (uint8_t*) MlmeConfirmQueue, 0xFF, sizeof( MlmeConfirmQueue ) );
 
@@ -124,6 +124,8 @@ void LoRaMacConfirmQueueInit( LoRaMacPrimitives_t* primitives )
 
 bool LoRaMacConfirmQueueAdd( MlmeConfirmQueue_t* mlmeConfirm )
 {
+    MlmeConfirmQueue_t* element;
+
     if( MlmeConfirmQueueCnt >= LORA_MAC_MLME_CONFIRM_QUEUE_LEN )
     {
         // Protect the buffer against overwrites
@@ -131,14 +133,14 @@ bool LoRaMacConfirmQueueAdd( MlmeConfirmQueue_t* mlmeConfirm )
     }
 
     // Add the element to the ring buffer
-    BufferEnd->Request = mlmeConfirm->Request;
-    BufferEnd->Status = mlmeConfirm->Status;
-    BufferEnd->RestrictCommonReadyToHandle = mlmeConfirm->RestrictCommonReadyToHandle;
-    BufferEnd->ReadyToHandle = false;
+    element = &MlmeConfirmQueue[GetIndex( MlmeConfirmQueueCnt )];
+    element->Request = mlmeConfirm->Request;
+    element->Status = mlmeConfirm->Status;
+    element->RestrictCommonReadyToHandle = mlmeConfirm->RestrictCommonReadyToHandle;
+    element->ReadyToHandle = false;
     // Increase counter
     MlmeConfirmQueueCnt++;
-    // Update end pointer
-    BufferEnd = IncreaseBufferPointer( BufferEnd );
+    MlmeConfirmQueueActive |= 1UL << mlmeConfirm->Request;
 
     return true;
 }
@@ -150,78 +152,70 @@ bool LoRaMacConfirmQueueRemoveLast( void )
         return false;
     }
 
-    // Increase counter
+    // Decrease counter
     MlmeConfirmQueueCnt--;
-    // Update start pointer
-    BufferEnd = DecreaseBufferPointer( BufferEnd );
+    UpdateActive( MlmeConfirmQueue[GetIndex( MlmeConfirmQueueCnt )].Request );
 
     return true;
 }
 
 bool LoRaMacConfirmQueueRemoveFirst( void )
 {
+    Mlme_t removed;
+
     if( MlmeConfirmQueueCnt == 0 )
     {
         return false;
     }
 
-    // Increase counter
+    removed = MlmeConfirmQueue[MlmeConfirmQueueStart].Request;
+    // Decrease counter
     MlmeConfirmQueueCnt--;
-    // Update start pointer
-    BufferStart = IncreaseBufferPointer( BufferStart );
+    // Update start index
+    MlmeConfirmQueueStart = GetIndex( 1 );
+    UpdateActive( removed );
 
     return true;
 }
 
 void LoRaMacConfirmQueueSetStatus( LoRaMacEventInfoStatus_t status, Mlme_t request )
 {
-    MlmeConfirmQueue_t* element = NULL;
+    MlmeConfirmQueue_t* element = GetElement( request );
 
-    if( MlmeConfirmQueueCnt > 0 )
+    if( element != NULL )
     {
-        element = GetElement( request, BufferStart, BufferEnd );
-        if( element != NULL )
-        {
-            element->Status = status;
-            element->ReadyToHandle = true;
-        }
+        element->Status = status;
+        element->ReadyToHandle = true;
     }
 }
 
 LoRaMacEventInfoStatus_t LoRaMacConfirmQueueGetStatus( Mlme_t request )
 {
-    MlmeConfirmQueue_t* element = NULL;
+    MlmeConfirmQueue_t* element = GetElement( request );
 
-    if( MlmeConfirmQueueCnt > 0 )
+    if( element != NULL )
     {
-        element = GetElement( request, BufferStart, BufferEnd );
-        if( element != NULL )
-        {
-            return element->Status;
-        }
+        return element->Status;
     }
     return LORAMAC_EVENT_INFO_STATUS_ERROR;
 }
 
 void LoRaMacConfirmQueueSetStatusCmn( LoRaMacEventInfoStatus_t status )
 {
-    MlmeConfirmQueue_t* element = BufferStart;
+    MlmeConfirmQueue_t* element;
 
     CommonStatus = status;
 
-    if( MlmeConfirmQueueCnt > 0 )
+    for( uint8_t i = 0; i < MlmeConfirmQueueCnt; i++ )
     {
-        do
+        element = &MlmeConfirmQueue[GetIndex( i )];
+        element->Status = status;
+        // Set the status if it is allowed to set it with a call to
+        // LoRaMacConfirmQueueSetStatusCmn.
+        if( element->RestrictCommonReadyToHandle == false )
         {
-            element->Status = status;
-            // Set the status if it is allowed to set it with a call to
-            // LoRaMacConfirmQueueSetStatusCmn.
-            if( element->RestrictCommonReadyToHandle == false )
-            {
-                element->ReadyToHandle = true;
-            }
-            element = IncreaseBufferPointer( element );
-        }while( element != BufferEnd );
+            element->ReadyToHandle = true;
+        }
     }
 }
 
@@ -232,44 +226,30 @@ LoRaMacEventInfoStatus_t LoRaMacConfirmQueueGetStatusCmn( void )
 
 bool LoRaMacConfirmQueueIsCmdActive( Mlme_t request )
 {
-    if( GetElement( request, BufferStart, BufferEnd ) != NULL )
-    {
-        return true;
-    }
-    return false;
+    return ( ( MlmeConfirmQueueActive & ( 1UL << request ) ) != 0 ) ? true : false;
 }
 
 void LoRaMacConfirmQueueHandleCb( MlmeConfirm_t* mlmeConfirm )
 {
     uint8_t nbElements = MlmeConfirmQueueCnt;
-    bool readyToHandle = false;
-    MlmeConfirmQueue_t mlmeConfirmToStore;
+    MlmeConfirmQueue_t element;
 
     for( uint8_t i = 0; i < nbElements; i++ )
     {
-        mlmeConfirm->MlmeRequest = BufferStart->Request;
-        mlmeConfirm->Status = BufferStart->Status;
-        readyToHandle = BufferStart->ReadyToHandle;
+        // Copied out first, the confirm handler may queue a new request
+        element = MlmeConfirmQueue[MlmeConfirmQueueStart];
+        LoRaMacConfirmQueueRemoveFirst( );
 
-        if( readyToHandle == true )
+        mlmeConfirm->MlmeRequest = element.Request;
+        mlmeConfirm->Status = element.Status;
+        if( element.ReadyToHandle == true )
         {
             Primitives->MacMlmeConfirm( mlmeConfirm );
         }
         else
-        {
-            // The request is not processed yet. Store the state.
-            mlmeConfirmToStore.Request = BufferStart->Request;
-            mlmeConfirmToStore.Status = BufferStart->Status;
-            mlmeConfirmToStore.RestrictCommonReadyToHandle = BufferStart->RestrictCommonReadyToHandle;
-        }
-
-        // Increase the pointer afterwards to prevent overwrites
-        LoRaMacConfirmQueueRemoveFirst( );
-
-        if( readyToHandle == false )
         {
             // Add a request which has not been finished again to the queue
-            LoRaMacConfirmQueueAdd( &mlmeConfirmToStore );
+            LoRaMacConfirmQueueAdd( &element );
         }
     }
 }
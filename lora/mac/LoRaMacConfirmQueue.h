@@ -37,7 +37,7 @@
  *            The confirm queue is implemented with as a ring buffer. The number of
  *            elements can be defined with \ref LORA_MAC_MLME_CONFIRM_QUEUE_LEN. The
  *            current implementation does not support multiple elements of the same
- *            Mlme_t type.
+ *            Mlme_t type. Checking if a request is queued takes constant time.
  * \{
  */
 #ifndef __LORAMAC_CONFIRMQUEUE_H__
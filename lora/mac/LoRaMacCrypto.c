@@ -24,8 +24,10 @@ Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jae
 #include <stdlib.h>
 #include <stdint.h>
 #include "utilities.h"
+#include "profile.h"
 
 #include "aes.h"
+#include "aes-key.h"
 #include "cmac.h"
 
 #include "LoRaMacCrypto.h"
@@ -36,33 +38,11 @@ Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jae
 #define LORAMAC_MIC_BLOCK_B0_SIZE                   16
 
 /*!
- * MIC field computation initial data
+ * Payload key stream chunk, multiple of 16, on the stack of the caller
  */
-static uint8_t MicBlockB0[] = { 0x49, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                                0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-                              };
-
-/*!
- * Contains the computed MIC field.
- *
- * \remark Only the 4 first bytes are used
- */
-static uint8_t Mic[16];
-
-/*!
- * Encryption aBlock and sBlock
- */
-static uint8_t aBlock[] = { 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-                          };
-static uint8_t sBlock[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-                          };
-
-/*!
- * CMAC computation context variable
- */
-static AES_CMAC_CTX AesCmacCtx[1];
+#ifndef LORAMAC_KEY_STREAM_SIZE
+#define LORAMAC_KEY_STREAM_SIZE                     64
+#endif
 
 /*!
  * \brief Computes the LoRaMAC frame MIC field  
@@ -77,40 +57,38 @@ static AES_CMAC_CTX AesCmacCtx[1];
  */
 void LoRaMacComputeMic( const uint8_t *buffer, uint16_t size, const uint8_t *key, uint32_t address, uint8_t dir, uint32_t sequenceCounter, uint32_t *mic )
 {
-    MicBlockB0[5] = dir;
-    
-    MicBlockB0[6] = ( address ) & 0xFF;
-    MicBlockB0[7] = ( address >> 8 ) & 0xFF;
-    MicBlockB0[8] = ( address >> 16 ) & 0xFF;
-    MicBlockB0[9] = ( address >> 24 ) & 0xFF;
-
-    MicBlockB0[10] = ( sequenceCounter ) & 0xFF;
-    MicBlockB0[11] = ( sequenceCounter >> 8 ) & 0xFF;
-    MicBlockB0[12] = ( sequenceCounter >> 16 ) & 0xFF;
-    MicBlockB0[13] = ( sequenceCounter >> 24 ) & 0xFF;
+    uint8_t micBlockB0[LORAMAC_MIC_BLOCK_B0_SIZE] = { 0x49 };
+    uint8_t computedMic[16];
 
-    MicBlockB0[15] = size & 0xFF;
+    PROFILE_START( PROFILE_MAC_COMPUTE_MIC );
+    micBlockB0[5] = dir;
+    
+    micBlockB0[6] = ( address ) & 0xFF;
+    micBlockB0[7] = ( address >> 8 ) & 0xFF;
+    micBlockB0[8] = ( address >> 16 ) & 0xFF;
+    micBlockB0[9] = ( address >> 24 ) & 0xFF;
 
-    AES_CMAC_Init( AesCmacCtx );
+    micBlockB0[10] = ( sequenceCounter ) & 0xFF;
+    micBlockB0[11] = ( sequenceCounter >> 8 ) & 0xFF;
+    micBlockB0[12] = ( sequenceCounter >> 16 ) & 0xFF;
+    micBlockB0[13] = ( sequenceCounter >> 24 ) & 0xFF;
 
-    AES_CMAC_SetKey( AesCmacCtx, key );
+    micBlockB0[15] = size & 0xFF;
 
-    AES_CMAC_Update( AesCmacCtx, MicBlockB0, LORAMAC_MIC_BLOCK_B0_SIZE );
-    
-    AES_CMAC_Update( AesCmacCtx, buffer, size & 0xFF );
-    
-    AES_CMAC_Final( Mic, AesCmacCtx );
+    AES_CMAC_Digest( computedMic, key, micBlockB0, LORAMAC_MIC_BLOCK_B0_SIZE, buffer, size & 0xFF );
     
-    *mic = ( uint32_t )( ( uint32_t )Mic[3] << 24 | ( uint32_t )Mic[2] << 16 | ( uint32_t )Mic[1] << 8 | ( uint32_t )Mic[0] );
+    *mic = ( uint32_t )( ( uint32_t )computedMic[3] << 24 | ( uint32_t )computedMic[2] << 16 | ( uint32_t )computedMic[1] << 8 | ( uint32_t )computedMic[0] );
+    PROFILE_STOP( PROFILE_MAC_COMPUTE_MIC );
 }
 
 void LoRaMacPayloadEncrypt( const uint8_t *buffer, uint16_t size, const uint8_t *key, uint32_t address, uint8_t dir, uint32_t sequenceCounter, uint8_t *encBuffer )
 {
     uint16_t i;
-    uint8_t bufferIndex = 0;
+    uint16_t len;
+    uint16_t bufferIndex = 0;
     uint16_t ctr = 1;
-
-    aes_init((uint8_t *)key, 16, 0, 0);
+    uint8_t aBlock[16] = { 0x01 };
+    uint8_t keyStream[LORAMAC_KEY_STREAM_SIZE];
 
     aBlock[5] = dir;
 
@@ -124,27 +102,25 @@ void LoRaMacPayloadEncrypt( const uint8_t *buffer, uint16_t size, const uint8_t
     aBlock[12] = ( sequenceCounter >> 16 ) & 0xFF;
     aBlock[13] = ( sequenceCounter >> 24 ) & 0xFF;
 
-    while( size >= 16 )
+    while( size > 0 )
     {
-        aBlock[15] = ( ( ctr ) & 0xFF );
-        ctr++;
-        aes_crypto(aBlock, 16, 0,  sBlock);
-        for( i = 0; i < 16; i++ )
+        // The A blocks of the chunk go through the engine in one call, the
+        // payload is then walked once. The payload is only written once the
+        // key stream is done, an in place buffer survives an engine retry
+        len = ( size < LORAMAC_KEY_STREAM_SIZE ) ? size : LORAMAC_KEY_STREAM_SIZE;
+        for( i = 0; i < len; i += 16 )
         {
-            encBuffer[bufferIndex + i] = buffer[bufferIndex + i] ^ sBlock[i];
+            aBlock[15] = ( ( ctr ) & 0xFF );
+            ctr++;
+            memcpy1( keyStream + i, aBlock, 16 );
         }
-        size -= 16;
-        bufferIndex += 16;
-    }
-
-    if( size > 0 )
-    {
-        aBlock[15] = ( ( ctr ) & 0xFF );
-        aes_crypto(aBlock, 16, 0,  sBlock);
-        for( i = 0; i < size; i++ )
+        AesEcbEncrypt( key, keyStream, ( len + 15 ) & ~15, keyStream );
+        for( i = 0; i < len; i++ )
         {
-            encBuffer[bufferIndex + i] = buffer[bufferIndex + i] ^ sBlock[i];
+            encBuffer[bufferIndex + i] = buffer[bufferIndex + i] ^ keyStream[i];
         }
+        size -= len;
+        bufferIndex += len;
     }
 }
 
@@ -155,46 +131,35 @@ void LoRaMacPayloadDecrypt( const uint8_t *buffer, uint16_t size, const uint8_t
 
 void LoRaMacJoinComputeMic( const uint8_t *buffer, uint16_t size, const uint8_t *key, uint32_t *mic )
 {
-    AES_CMAC_Init( AesCmacCtx );
-
-    AES_CMAC_SetKey( AesCmacCtx, key );
-
-    AES_CMAC_Update( AesCmacCtx, buffer, size & 0xFF );
+    uint8_t computedMic[16];
 
-    AES_CMAC_Final( Mic, AesCmacCtx );
+    AES_CMAC_Digest( computedMic, key, NULL, 0, buffer, size & 0xFF );
 
-    *mic = ( uint32_t )( ( uint32_t )Mic[3] << 24 | ( uint32_t )Mic[2] << 16 | ( uint32_t )Mic[1] << 8 | ( uint32_t )Mic[0] );
+    *mic = ( uint32_t )( ( uint32_t )computedMic[3] << 24 | ( uint32_t )computedMic[2] << 16 | ( uint32_t )computedMic[1] << 8 | ( uint32_t )computedMic[0] );
 }
 
 void LoRaMacJoinDecrypt( const uint8_t *buffer, uint16_t size, const uint8_t *key, uint8_t *decBuffer )
 {
-    aes_init((uint8_t *)key, 16, 0, 0);
-    aes_crypto((uint8_t *)buffer, 16, 0,  decBuffer);
-    // Check if optional CFList is included
-    if( size >= 16 )
-    {
-        aes_crypto((uint8_t *)(buffer + 16), size-16, 0,  decBuffer + 16);
-    }
+    // The join accept and its optional CFList, decrypted in place
+    AesEcbEncrypt( key, buffer, size & ~15, decBuffer );
 }
 
 void LoRaMacJoinComputeSKeys( const uint8_t *key, const uint8_t *appNonce, uint16_t devNonce, uint8_t *nwkSKey, uint8_t *appSKey )
 {
     uint8_t nonce[16];
     uint8_t *pDevNonce = ( uint8_t * )&devNonce;
-    
-    aes_init((uint8_t *)key, 16, 0, 0);
 
     memset1( nonce, 0, sizeof( nonce ) );
     nonce[0] = 0x01;
     memcpy1( nonce + 1, appNonce, 6 );
     memcpy1( nonce + 7, pDevNonce, 2 );
-    aes_crypto(nonce, 16, 0,  nwkSKey);
+    AesEcbEncrypt( key, nonce, 16, nwkSKey );
 
     memset1( nonce, 0, sizeof( nonce ) );
     nonce[0] = 0x02;
     memcpy1( nonce + 1, appNonce, 6 );
     memcpy1( nonce + 7, pDevNonce, 2 );
-    aes_crypto(nonce, 16, 0,  appSKey);
+    AesEcbEncrypt( key, nonce, 16, appSKey );
 }
 
 void LoRaMacBeaconComputePingOffset( uint64_t beaconTime, uint32_t address, uint16_t pingPeriod, uint16_t *pingOffset )
@@ -222,8 +187,7 @@ void LoRaMacBeaconComputePingOffset( uint64_t beaconTime, uint32_t address, uint
     buffer[6] = ( address >> 16 ) & 0xFF;
     buffer[7] = ( address >> 24 ) & 0xFF;
 
-    aes_init((uint8_t *)zeroKey, 16, 0, 0);
-    aes_crypto(buffer, 16, 0,  cipher);
+    AesEcbEncrypt( zeroKey, buffer, 16, cipher );
 
     result = ( ( ( uint32_t ) cipher[0] ) + ( ( ( uint32_t ) cipher[1] ) * 256 ) );
 
@@ -35,6 +35,9 @@ Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jae
 
 
 
+// The single region build binds the region in Region.h
+#ifndef REGION_SINGLE
+
 // Setup regions
 #ifdef REGION_AS923
 #include "RegionAS923.h"
@@ -1158,3 +1161,5 @@ void RegionRxBeaconSetup( LoRaMacRegion_t region, RxBeaconSetup_t* rxBeaconSetup
         }
     }
 }
+
+#endif // REGION_SINGLE
@@ -731,7 +731,26 @@ typedef enum ePhyAttribute {
     /*!
      * Default value for the number of join trials.
      */
-    PHY_DEF_NB_JOIN_TRIALS
+    PHY_DEF_NB_JOIN_TRIALS,
+    /*!
+     * Listen before talk carrier sense time [ms], 0 when the region has no
+     * LBT.
+     */
+    PHY_CARRIER_SENSE_TIME,
+    /*!
+     * Listen before talk RSSI threshold [dBm], as an int32_t.
+     */
+    PHY_CARRIER_SENSE_RSSI_TH,
+    /*!
+     * Time on air [ms] of an uplink of PktLen bytes at the datarate,
+     * CONFIG_LORAMAC_TX_TIME.
+     */
+    PHY_TX_TIME_ON_AIR,
+    /*!
+     * LoRa spreading factor of the datarate when its bandwidth is 125 kHz,
+     * 0 for the FSK and wider datarates, CONFIG_LORAMAC_LINK_ADR.
+     */
+    PHY_DATARATE_SF
 } PhyAttribute_t;
 
 /*!
@@ -820,7 +839,8 @@ typedef struct sGetPhyParams {
     /*!
      * Datarate.
      * The parameter is needed for the following queries:
-     * PHY_MAX_PAYLOAD, PHY_MAX_PAYLOAD_REPEATER, PHY_NEXT_LOWER_TX_DR.
+     * PHY_MAX_PAYLOAD, PHY_MAX_PAYLOAD_REPEATER, PHY_NEXT_LOWER_TX_DR,
+     * PHY_DATARATE_SF.
      */
     int8_t Datarate;
     /*!
@@ -835,6 +855,12 @@ typedef struct sGetPhyParams {
      * PHY_MIN_RX_DR, PHY_MAX_PAYLOAD, PHY_MAX_PAYLOAD_REPEATER.
      */
     uint8_t DownlinkDwellTime;
+    /*!
+     * PHY payload length.
+     * The parameter is needed for the following queries:
+     * PHY_TX_TIME_ON_AIR.
+     */
+    uint8_t PktLen;
 } GetPhyParams_t;
 
 /*!
@@ -980,6 +1006,10 @@ typedef struct sRxConfigParams {
      * RX window offset
      */
     int32_t WindowOffset;
+    /*!
+     * RX window offset [us]
+     */
+    int32_t WindowOffsetUs;
     /*!
      * Downlink dwell time.
      */
@@ -1622,6 +1652,98 @@ uint8_t RegionApplyDrOffset( LoRaMacRegion_t region, uint8_t downlinkDwellTime,
  */
 void RegionRxBeaconSetup( LoRaMacRegion_t region, RxBeaconSetup_t* rxBeaconSetup, uint8_t* outDr );
 
+/*!
+ * Single region build: with exactly one region defined, the region is bound
+ * at compile time and the functions above call its implementation directly,
+ * without the dispatch switch. The region parameter is then only checked by
+ * RegionIsActive. Define CONFIG_REGION_MULTI to keep the runtime dispatch.
+ */
+#if !defined( CONFIG_REGION_MULTI ) &&                                         \
+    ( ( defined( REGION_AS923 ) + defined( REGION_AU915 ) + defined( REGION_CN470 ) + \
+        defined( REGION_CN470A ) + defined( REGION_CN779 ) + defined( REGION_EU433 ) + \
+        defined( REGION_EU868 ) + defined( REGION_KR920 ) + defined( REGION_IN865 ) + \
+        defined( REGION_US915 ) + defined( REGION_US915_HYBRID ) ) == 1 )
+#define REGION_SINGLE
+
+#if defined( REGION_AS923 )
+#include "RegionAS923.h"
+#define REGION_SINGLE_ID                            LORAMAC_REGION_AS923
+#define REGION_SINGLE_CALL( fn )                    RegionAS923##fn
+#elif defined( REGION_AU915 )
+#include "RegionAU915.h"
+#define REGION_SINGLE_ID                            LORAMAC_REGION_AU915
+#define REGION_SINGLE_CALL( fn )                    RegionAU915##fn
+#elif defined( REGION_CN470 )
+#include "RegionCN470.h"
+#define REGION_SINGLE_ID                            LORAMAC_REGION_CN470
+#define REGION_SINGLE_CALL( fn )                    RegionCN470##fn
+#elif defined( REGION_CN470A )
+#include "RegionCN470A.h"
+#define REGION_SINGLE_ID                            LORAMAC_REGION_CN470A
+#define REGION_SINGLE_CALL( fn )                    RegionCN470A##fn
+#elif defined( REGION_CN779 )
+#include "RegionCN779.h"
+#define REGION_SINGLE_ID                            LORAMAC_REGION_CN779
+#define REGION_SINGLE_CALL( fn )                    RegionCN779##fn
+#elif defined( REGION_EU433 )
+#include "RegionEU433.h"
+#define REGION_SINGLE_ID                            LORAMAC_REGION_EU433
+#define REGION_SINGLE_CALL( fn )                    RegionEU433##fn
+#elif defined( REGION_EU868 )
+#include "RegionEU868.h"
+#define REGION_SINGLE_ID                            LORAMAC_REGION_EU868
+#define REGION_SINGLE_CALL( fn )                    RegionEU868##fn
+#elif defined( REGION_KR920 )
+#include "RegionKR920.h"
+#define REGION_SINGLE_ID                            LORAMAC_REGION_KR920
+#define REGION_SINGLE_CALL( fn )                    RegionKR920##fn
+#elif defined( REGION_IN865 )
+#include "RegionIN865.h"
+#define REGION_SINGLE_ID                            LORAMAC_REGION_IN865
+#define REGION_SINGLE_CALL( fn )                    RegionIN865##fn
+#elif defined( REGION_US915 )
+#include "RegionUS915.h"
+#define REGION_SINGLE_ID                            LORAMAC_REGION_US915
+#define REGION_SINGLE_CALL( fn )                    RegionUS915##fn
+#else
+#include "RegionUS915-Hybrid.h"
+#define REGION_SINGLE_ID                            LORAMAC_REGION_US915_HYBRID
+#define REGION_SINGLE_CALL( fn )                    RegionUS915Hybrid##fn
+#endif
+
+#define RegionIsActive( region )                    ( ( region ) == REGION_SINGLE_ID )
+#define RegionGetPhyParam( region, getPhy )         REGION_SINGLE_CALL( GetPhyParam )( getPhy )
+#define RegionSetBandTxDone( region, txDone )       REGION_SINGLE_CALL( SetBandTxDone )( txDone )
+#define RegionInitDefaults( region, type )          REGION_SINGLE_CALL( InitDefaults )( type )
+#define RegionVerify( region, verify, phyAttribute ) REGION_SINGLE_CALL( Verify )( verify, phyAttribute )
+#define RegionApplyCFList( region, applyCFList )    REGION_SINGLE_CALL( ApplyCFList )( applyCFList )
+#define RegionChanMaskSet( region, chanMaskSet )    REGION_SINGLE_CALL( ChanMaskSet )( chanMaskSet )
+#define RegionAdrNext( region, adrNext, drOut, txPowOut, adrAckCounter )                              \
+    REGION_SINGLE_CALL( AdrNext )( adrNext, drOut, txPowOut, adrAckCounter )
+#define RegionComputeRxWindowParameters( region, datarate, minRxSymbols, rxError, rxConfigParams )    \
+    REGION_SINGLE_CALL( ComputeRxWindowParameters )( datarate, minRxSymbols, rxError, rxConfigParams )
+#define RegionRxConfig( region, rxConfig, datarate ) REGION_SINGLE_CALL( RxConfig )( rxConfig, datarate )
+#define RegionTxConfig( region, txConfig, txPower, txTimeOnAir )                                      \
+    REGION_SINGLE_CALL( TxConfig )( txConfig, txPower, txTimeOnAir )
+#define RegionLinkAdrReq( region, linkAdrReq, drOut, txPowOut, nbRepOut, nbBytesParsed )              \
+    REGION_SINGLE_CALL( LinkAdrReq )( linkAdrReq, drOut, txPowOut, nbRepOut, nbBytesParsed )
+#define RegionRxParamSetupReq( region, rxParamSetupReq ) REGION_SINGLE_CALL( RxParamSetupReq )( rxParamSetupReq )
+#define RegionNewChannelReq( region, newChannelReq ) REGION_SINGLE_CALL( NewChannelReq )( newChannelReq )
+#define RegionTxParamSetupReq( region, txParamSetupReq ) REGION_SINGLE_CALL( TxParamSetupReq )( txParamSetupReq )
+#define RegionDlChannelReq( region, dlChannelReq )  REGION_SINGLE_CALL( DlChannelReq )( dlChannelReq )
+#define RegionAlternateDr( region, alternateDr )    REGION_SINGLE_CALL( AlternateDr )( alternateDr )
+#define RegionCalcBackOff( region, calcBackOff )    REGION_SINGLE_CALL( CalcBackOff )( calcBackOff )
+#define RegionNextChannel( region, nextChanParams, channel, time, aggregatedTimeOff )                 \
+    REGION_SINGLE_CALL( NextChannel )( nextChanParams, channel, time, aggregatedTimeOff )
+#define RegionChannelAdd( region, channelAdd )      REGION_SINGLE_CALL( ChannelAdd )( channelAdd )
+#define RegionChannelsRemove( region, channelRemove ) REGION_SINGLE_CALL( ChannelsRemove )( channelRemove )
+#define RegionSetContinuousWave( region, continuousWave ) REGION_SINGLE_CALL( SetContinuousWave )( continuousWave )
+#define RegionApplyDrOffset( region, downlinkDwellTime, dr, drOffset )                                \
+    REGION_SINGLE_CALL( ApplyDrOffset )( downlinkDwellTime, dr, drOffset )
+#define RegionRxBeaconSetup( region, rxBeaconSetup, outDr )                                           \
+    REGION_SINGLE_CALL( RxBeaconSetup )( rxBeaconSetup, outDr )
+#endif
+
 /*! \} defgroup REGION */
 
 #endif // __REGION_H__
@@ -21,6 +21,8 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jaeckle ( STACKFORCE )
 */
+#define LOG_MODULE LOG_MODULE_REGION
+
 #include <stdbool.h>
 #include <string.h>
 #include <stdint.h>
@@ -46,6 +48,13 @@ Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jae
  */
 static ChannelParams_t Channels[AU915_MAX_NB_CHANNELS];
 
+/*!
+ * Defined channels supporting each uplink datarate, rebuilt when the
+ * channels are initialized
+ */
+static uint32_t ChannelsSets[AU915_TX_MAX_DATARATE + 1][REGION_COMMON_CHANNELS_SET_SIZE( AU915_MAX_NB_CHANNELS )];
+static bool ChannelsSetsValid = false;
+
 /*!
  * LoRaMac bands
  */
@@ -70,11 +79,28 @@ static uint16_t ChannelsMaskRemaining[CHANNELS_MASK_SIZE];
 static uint16_t ChannelsDefaultMask[CHANNELS_MASK_SIZE];
 
 // Static functions
+static void ChannelsSetsUpdate( void )
+{
+    if( ChannelsSetsValid == false )
+    {
+        for( int8_t dr = 0; dr <= AU915_TX_MAX_DATARATE; dr++ )
+        {
+            RegionCommonChannelsSetBuild( dr, Channels, AU915_MAX_NB_CHANNELS, ChannelsSets[dr] );
+        }
+        ChannelsSetsValid = true;
+    }
+}
+
+static int8_t GetMinTxDr( uint8_t uplinkDwellTime )
+{
+    return ( uplinkDwellTime == 0 ) ? AU915_TX_MIN_DATARATE : AU915_DWELL_LIMIT_DATARATE;
+}
+
 static int8_t GetNextLowerTxDr( int8_t dr, int8_t minDr )
 {
     uint8_t nextLowerDr = 0;
 
-    if( dr == minDr )
+    if( dr <= minDr )
     {
         nextLowerDr = minDr;
     }
@@ -109,40 +135,6 @@ static int8_t LimitTxPower( int8_t txPower, int8_t maxBandTxPower, int8_t datara
     return txPowerResult;
 }
 
-static uint8_t CountNbOfEnabledChannels( uint8_t datarate, uint16_t* channelsMask, ChannelParams_t* channels, Band_t* bands, uint8_t* enabledChannels, uint8_t* delayTx )
-{
-    uint8_t nbEnabledChannels = 0;
-    uint8_t delayTransmission = 0;
-
-    for( uint8_t i = 0, k = 0; i < AU915_MAX_NB_CHANNELS; i += 16, k++ )
-    {
-        for( uint8_t j = 0; j < 16; j++ )
-        {
-            if( ( channelsMask[k] & ( 1 << j ) ) != 0 )
-            {
-                if( channels[i + j].Frequency == 0 )
-                { // Check if the channel is enabled
-                    continue;
-                }
-                if( RegionCommonValueInRange( datarate, channels[i + j].DrRange.Fields.Min,
-                                              channels[i + j].DrRange.Fields.Max ) == false )
-                { // Check if the current channel selection supports the given datarate
-                    continue;
-                }
-                if( bands[channels[i + j].Band].TimeOff > 0 )
-                { // Check if the band is available for transmission
-                    delayTransmission++;
-                    continue;
-                }
-                enabledChannels[nbEnabledChannels++] = i + j;
-            }
-        }
-    }
-
-    *delayTx = delayTransmission;
-    return nbEnabledChannels;
-}
-
 PhyParam_t RegionAU915GetPhyParam( GetPhyParams_t* getPhy )
 {
     PhyParam_t phyParam = { 0 };
@@ -156,7 +148,7 @@ PhyParam_t RegionAU915GetPhyParam( GetPhyParams_t* getPhy )
         }
         case PHY_MIN_TX_DR:
         {
-            phyParam.Value = AU915_TX_MIN_DATARATE;
+            phyParam.Value = GetMinTxDr( getPhy->UplinkDwellTime );
             break;
         }
         case PHY_DEF_TX_DR:
@@ -166,7 +158,7 @@ PhyParam_t RegionAU915GetPhyParam( GetPhyParams_t* getPhy )
         }
         case PHY_NEXT_LOWER_TX_DR:
         {
-            phyParam.Value = GetNextLowerTxDr( getPhy->Datarate, AU915_TX_MIN_DATARATE );
+            phyParam.Value = GetNextLowerTxDr( getPhy->Datarate, GetMinTxDr( getPhy->UplinkDwellTime ) );
             break;
         }
         case PHY_DEF_TX_POWER:
@@ -176,12 +168,26 @@ PhyParam_t RegionAU915GetPhyParam( GetPhyParams_t* getPhy )
         }
         case PHY_MAX_PAYLOAD:
         {
-            phyParam.Value = MaxPayloadOfDatarateAU915[getPhy->Datarate];
+            if( getPhy->UplinkDwellTime != 0 )
+            {
+                phyParam.Value = MaxPayloadOfDatarateDwell1UpAU915[getPhy->Datarate];
+            }
+            else
+            {
+                phyParam.Value = MaxPayloadOfDatarateAU915[getPhy->Datarate];
+            }
             break;
         }
         case PHY_MAX_PAYLOAD_REPEATER:
         {
-            phyParam.Value = MaxPayloadOfDatarateRepeaterAU915[getPhy->Datarate];
+            if( getPhy->UplinkDwellTime != 0 )
+            {
+                phyParam.Value = MaxPayloadOfDatarateDwell1UpAU915[getPhy->Datarate];
+            }
+            else
+            {
+                phyParam.Value = MaxPayloadOfDatarateRepeaterAU915[getPhy->Datarate];
+            }
             break;
         }
         case PHY_DUTY_CYCLE:
@@ -303,6 +309,20 @@ PhyParam_t RegionAU915GetPhyParam( GetPhyParams_t* getPhy )
             phyParam.Value = AU915_BEACON_NB_CHANNELS;
             break;
         }
+#ifdef CONFIG_LORAMAC_TX_TIME
+        case PHY_TX_TIME_ON_AIR:
+        {
+            phyParam.Value = RegionCommonComputeTxTimeOnAir( false, DataratesAU915[getPhy->Datarate], BandwidthsAU915[getPhy->Datarate], getPhy->PktLen );
+            break;
+        }
+#endif
+#ifdef CONFIG_LORAMAC_LINK_ADR
+        case PHY_DATARATE_SF:
+        {
+            phyParam.Value = ( BandwidthsAU915[getPhy->Datarate] == 125000 ) ? DataratesAU915[getPhy->Datarate] : 0;
+            break;
+        }
+#endif
         default:
         {
             break;
@@ -323,6 +343,8 @@ void RegionAU915InitDefaults( InitType_t type )
     {
         case INIT_TYPE_INIT:
         {
+            ChannelsSetsValid = false;
+
             // Channels
             // 125 kHz channels
             for( uint8_t i = 0; i < AU915_MAX_NB_CHANNELS - 8; i++ )
@@ -377,6 +399,9 @@ bool RegionAU915Verify( VerifyParams_t* verify, PhyAttribute_t phyAttribute )
     switch( phyAttribute )
     {
         case PHY_TX_DR:
+        {
+            return RegionCommonValueInRange( verify->DatarateParams.Datarate, GetMinTxDr( verify->DatarateParams.UplinkDwellTime ), AU915_TX_MAX_DATARATE );
+        }
         case PHY_DEF_TX_DR:
         {
             return RegionCommonValueInRange( verify->DatarateParams.Datarate, AU915_TX_MIN_DATARATE, AU915_TX_MAX_DATARATE );
@@ -463,7 +488,7 @@ bool RegionAU915AdrNext( AdrNextParams_t* adrNext, int8_t* drOut, int8_t* txPowO
 
     if( adrNext->AdrEnabled == true )
     {
-        if( datarate == AU915_TX_MIN_DATARATE )
+        if( datarate == GetMinTxDr( adrNext->UplinkDwellTime ) )
         {
             *adrAckCounter = 0;
             adrAckReq = false;
@@ -490,7 +515,7 @@ bool RegionAU915AdrNext( AdrNextParams_t* adrNext, int8_t* drOut, int8_t* txPowO
                     phyParam = RegionAU915GetPhyParam( &getPhy );
                     datarate = phyParam.Value;
 
-                    if( datarate == AU915_TX_MIN_DATARATE )
+                    if( datarate == GetMinTxDr( adrNext->UplinkDwellTime ) )
                     {
                         // We must set adrAckReq to false as soon as we reach the lowest datarate
                         adrAckReq = false;
@@ -517,7 +542,7 @@ bool RegionAU915AdrNext( AdrNextParams_t* adrNext, int8_t* drOut, int8_t* txPowO
 
 void RegionAU915ComputeRxWindowParameters( int8_t datarate, uint8_t minRxSymbols, uint32_t rxError, RxConfigParams_t *rxConfigParams )
 {
-    double tSymbol = 0.0;
+    RegionSymbolTime_t tSymbol = 0;
     uint32_t radioWakeUpTime;
 
     rxConfigParams->Datarate = datarate;
@@ -533,7 +558,7 @@ void RegionAU915ComputeRxWindowParameters( int8_t datarate, uint8_t minRxSymbols
     }
 
     radioWakeUpTime = Radio.GetWakeupTime( );
-    RegionCommonComputeRxWindowParameters( tSymbol, minRxSymbols, rxError, radioWakeUpTime, &rxConfigParams->WindowTimeout, &rxConfigParams->WindowOffset );
+    RegionCommonComputeRxWindowParameters( tSymbol, minRxSymbols, rxError, radioWakeUpTime, &rxConfigParams->WindowTimeout, &rxConfigParams->WindowOffset, &rxConfigParams->WindowOffsetUs );
 }
 
 bool RegionAU915RxConfig( RxConfigParams_t* rxConfig, int8_t* datarate )
@@ -620,9 +645,6 @@ uint8_t RegionAU915LinkAdrReq( LinkAdrReqParams_t* linkAdrReq, int8_t* drOut, in
         // Update bytes processed
         bytesProcessed += nextIndex;
 
-        // Revert status, as we only check the last ADR request for the channel mask KO
-        status = 0x07;
-
         if( linkAdrParams.ChMaskCtrl == 6 )
         {
             // Enable all 125 kHz channels
@@ -660,8 +682,10 @@ uint8_t RegionAU915LinkAdrReq( LinkAdrReqParams_t* linkAdrReq, int8_t* drOut, in
         status &= 0xFE; // Channel mask KO
     }
 
-    // Verify datarate
-    if( RegionCommonChanVerifyDr( AU915_MAX_NB_CHANNELS, channelsMask, linkAdrParams.Datarate, AU915_TX_MIN_DATARATE, AU915_TX_MAX_DATARATE, Channels  ) == false )
+    // Verify datarate, an AND of the mask with the channels supporting it
+    ChannelsSetsUpdate( );
+    if( ( RegionCommonValueInRange( linkAdrParams.Datarate, GetMinTxDr( linkAdrReq->UplinkDwellTime ), AU915_TX_MAX_DATARATE ) == 0 ) ||
+        ( RegionCommonChannelsSetVerify( ChannelsSets[linkAdrParams.Datarate], channelsMask, AU915_MAX_NB_CHANNELS ) == false ) )
     {
         status &= 0xFD; // Datarate KO
     }
@@ -750,7 +774,9 @@ uint8_t RegionAU915NewChannelReq( NewChannelReqParams_t* newChannelReq )
 
 int8_t RegionAU915TxParamSetupReq( TxParamSetupReqParams_t* txParamSetupReq )
 {
-    return -1;
+    // The uplink dwell time selects the tables above, the max EIRP is applied
+    // by the TX power table of RegionCommonComputeTxPower
+    return 0;
 }
 
 uint8_t RegionAU915DlChannelReq( DlChannelReqParams_t* dlChannelReq )
@@ -798,7 +824,6 @@ bool RegionAU915NextChannel( NextChanParams_t* nextChanParams, uint8_t* channel,
 {
     uint8_t nbEnabledChannels = 0;
     uint8_t delayTx = 0;
-    uint8_t enabledChannels[AU915_MAX_NB_CHANNELS] = { 0 };
     TimerTime_t nextTxDelay = 0;
 
     // Count 125kHz channels
@@ -820,10 +845,15 @@ bool RegionAU915NextChannel( NextChanParams_t* nextChanParams, uint8_t* channel,
         // Reset Aggregated time off
         *aggregatedTimeOff = 0;
 
-        // Search how many channels are enabled
-        nbEnabledChannels = CountNbOfEnabledChannels( nextChanParams->Datarate,
-                                                      ChannelsMaskRemaining, Channels,
-                                                      Bands, enabledChannels, &delayTx );
+        ChannelsSetsUpdate( );
+
+        // Search how many channels are enabled, and pick one
+        if( RegionCommonValueInRange( nextChanParams->Datarate, 0, AU915_TX_MAX_DATARATE ) == true )
+        {
+            nbEnabledChannels = RegionCommonChannelsSetSelect( ChannelsSets[nextChanParams->Datarate], ChannelsMaskRemaining,
+                                                               AU915_MAX_NB_CHANNELS, Channels, Bands, AU915_MAX_NB_BANDS,
+                                                               channel, &delayTx );
+        }
     }
     else
     {
@@ -834,7 +864,6 @@ bool RegionAU915NextChannel( NextChanParams_t* nextChanParams, uint8_t* channel,
     if( nbEnabledChannels > 0 )
     {
         // We found a valid channel
-        *channel = enabledChannels[randr( 0, nbEnabledChannels - 1 )];
         // Disable the channel in the mask
         RegionCommonChanDisable( ChannelsMaskRemaining, *channel, AU915_MAX_NB_CHANNELS - 8 );
 
@@ -71,6 +71,12 @@
  */
 #define AU915_DEFAULT_DATARATE                      DR_0
 
+/*!
+ * The minimum datarate which is used when the
+ * dwell time is limited.
+ */
+#define AU915_DWELL_LIMIT_DATARATE                  DR_2
+
 /*!
  * Minimal Rx1 receive datarate offset
  */
@@ -279,6 +285,13 @@ static const uint8_t MaxPayloadOfDatarateAU915[] = { 51, 51, 51, 115, 242, 242,
  */
 static const uint8_t MaxPayloadOfDatarateRepeaterAU915[] = { 51, 51, 51, 115, 222, 222, 222, 0, 33, 109, 222, 222, 222, 222, 0, 0 };
 
+/*!
+ * Maximum payload with respect to the datarate index, the frames within the
+ * 400 ms uplink dwell time set by TxParamSetupReq. Can operate with and
+ * without repeater. The table is only valid for uplinks.
+ */
+static const uint8_t MaxPayloadOfDatarateDwell1UpAU915[] = { 0, 0, 11, 53, 125, 242, 242, 0, 53, 129, 129, 242, 242, 242, 0, 0 };
+
 /*!
  * \brief The function gets a value of a specific phy attribute.
  *
@@ -21,6 +21,8 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jaeckle ( STACKFORCE )
 */
+#define LOG_MODULE LOG_MODULE_REGION
+
 #include <stdbool.h>
 #include <string.h>
 #include <stdint.h>
@@ -46,6 +48,13 @@ Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jae
  */
 static ChannelParams_t Channels[CN470_MAX_NB_CHANNELS];
 
+/*!
+ * Defined channels supporting each uplink datarate, rebuilt when the
+ * channels are initialized
+ */
+static uint32_t ChannelsSets[CN470_TX_MAX_DATARATE + 1][REGION_COMMON_CHANNELS_SET_SIZE( CN470_MAX_NB_CHANNELS )];
+static bool ChannelsSetsValid = false;
+
 /*!
  * LoRaMac bands
  */
@@ -65,6 +74,18 @@ static uint16_t ChannelsMask[CHANNELS_MASK_SIZE];
 static uint16_t ChannelsDefaultMask[CHANNELS_MASK_SIZE];
 
 // Static functions
+static void ChannelsSetsUpdate( void )
+{
+    if( ChannelsSetsValid == false )
+    {
+        for( int8_t dr = 0; dr <= CN470_TX_MAX_DATARATE; dr++ )
+        {
+            RegionCommonChannelsSetBuild( dr, Channels, CN470_MAX_NB_CHANNELS, ChannelsSets[dr] );
+        }
+        ChannelsSetsValid = true;
+    }
+}
+
 static int8_t GetNextLowerTxDr( int8_t dr, int8_t minDr )
 {
     uint8_t nextLowerDr = 0;
@@ -104,40 +125,6 @@ static int8_t LimitTxPower( int8_t txPower, int8_t maxBandTxPower, int8_t datara
     return txPowerResult;
 }
 
-static uint8_t CountNbOfEnabledChannels( uint8_t datarate, uint16_t* channelsMask, ChannelParams_t* channels, Band_t* bands, uint8_t* enabledChannels, uint8_t* delayTx )
-{
-    uint8_t nbEnabledChannels = 0;
-    uint8_t delayTransmission = 0;
-
-    for( uint8_t i = 0, k = 0; i < CN470_MAX_NB_CHANNELS; i += 16, k++ )
-    {
-        for( uint8_t j = 0; j < 16; j++ )
-        {
-            if( ( channelsMask[k] & ( 1 << j ) ) != 0 )
-            {
-                if( channels[i + j].Frequency == 0 )
-                { // Check if the channel is enabled
-                    continue;
-                }
-                if( RegionCommonValueInRange( datarate, channels[i + j].DrRange.Fields.Min,
-                                              channels[i + j].DrRange.Fields.Max ) == false )
-                { // Check if the current channel selection supports the given datarate
-                    continue;
-                }
-                if( bands[channels[i + j].Band].TimeOff > 0 )
-                { // Check if the band is available for transmission
-                    delayTransmission++;
-                    continue;
-                }
-                enabledChannels[nbEnabledChannels++] = i + j;
-            }
-        }
-    }
-
-    *delayTx = delayTransmission;
-    return nbEnabledChannels;
-}
-
 PhyParam_t RegionCN470GetPhyParam( GetPhyParams_t* getPhy )
 {
     PhyParam_t phyParam = { 0 };
@@ -303,6 +290,20 @@ PhyParam_t RegionCN470GetPhyParam( GetPhyParams_t* getPhy )
             phyParam.Value = CN470_BEACON_NB_CHANNELS;
             break;
         }
+#ifdef CONFIG_LORAMAC_TX_TIME
+        case PHY_TX_TIME_ON_AIR:
+        {
+            phyParam.Value = RegionCommonComputeTxTimeOnAir( false, DataratesCN470[getPhy->Datarate], BandwidthsCN470[getPhy->Datarate], getPhy->PktLen );
+            break;
+        }
+#endif
+#ifdef CONFIG_LORAMAC_LINK_ADR
+        case PHY_DATARATE_SF:
+        {
+            phyParam.Value = ( BandwidthsCN470[getPhy->Datarate] == 125000 ) ? DataratesCN470[getPhy->Datarate] : 0;
+            break;
+        }
+#endif
         default:
         {
             break;
@@ -323,6 +324,8 @@ void RegionCN470InitDefaults( InitType_t type )
     {
         case INIT_TYPE_INIT:
         {
+            ChannelsSetsValid = false;
+
             // Channels
             // 125 kHz channels
             for( uint8_t i = 0; i < CN470_MAX_NB_CHANNELS; i++ )
@@ -486,7 +489,7 @@ bool RegionCN470AdrNext( AdrNextParams_t* adrNext, int8_t* drOut, int8_t* txPowO
 
 void RegionCN470ComputeRxWindowParameters( int8_t datarate, uint8_t minRxSymbols, uint32_t rxError, RxConfigParams_t *rxConfigParams )
 {
-    double tSymbol = 0.0;
+    RegionSymbolTime_t tSymbol = 0;
     uint32_t radioWakeUpTime;
 
     rxConfigParams->Datarate = datarate;
@@ -495,7 +498,7 @@ void RegionCN470ComputeRxWindowParameters( int8_t datarate, uint8_t minRxSymbols
     tSymbol = RegionCommonComputeSymbolTimeLoRa( DataratesCN470[datarate], BandwidthsCN470[datarate] );
 
     radioWakeUpTime = Radio.GetWakeupTime( );
-    RegionCommonComputeRxWindowParameters( tSymbol, minRxSymbols, rxError, radioWakeUpTime, &rxConfigParams->WindowTimeout, &rxConfigParams->WindowOffset );
+    RegionCommonComputeRxWindowParameters( tSymbol, minRxSymbols, rxError, radioWakeUpTime, &rxConfigParams->WindowTimeout, &rxConfigParams->WindowOffset, &rxConfigParams->WindowOffsetUs );
 }
 
 bool RegionCN470RxConfig( RxConfigParams_t* rxConfig, int8_t* datarate )
@@ -587,9 +590,6 @@ uint8_t RegionCN470LinkAdrReq( LinkAdrReqParams_t* linkAdrReq, int8_t* drOut, in
         // Update bytes processed
         bytesProcessed += nextIndex;
 
-        // Revert status, as we only check the last ADR request for the channel mask KO
-        status = 0x07;
-
         if( linkAdrParams.ChMaskCtrl == 6 )
         {
             // Enable all 125 kHz channels
@@ -618,8 +618,10 @@ uint8_t RegionCN470LinkAdrReq( LinkAdrReqParams_t* linkAdrReq, int8_t* drOut, in
         }
     }
 
-    // Verify datarate
-    if( RegionCommonChanVerifyDr( CN470_MAX_NB_CHANNELS, channelsMask, linkAdrParams.Datarate, CN470_TX_MIN_DATARATE, CN470_TX_MAX_DATARATE, Channels  ) == false )
+    // Verify datarate, an AND of the mask with the channels supporting it
+    ChannelsSetsUpdate( );
+    if( ( RegionCommonValueInRange( linkAdrParams.Datarate, CN470_TX_MIN_DATARATE, CN470_TX_MAX_DATARATE ) == 0 ) ||
+        ( RegionCommonChannelsSetVerify( ChannelsSets[linkAdrParams.Datarate], channelsMask, CN470_MAX_NB_CHANNELS ) == false ) )
     {
         status &= 0xFD; // Datarate KO
     }
@@ -757,7 +759,6 @@ bool RegionCN470NextChannel( NextChanParams_t* nextChanParams, uint8_t* channel,
 {
     uint8_t nbEnabledChannels = 0;
     uint8_t delayTx = 0;
-    uint8_t enabledChannels[CN470_MAX_NB_CHANNELS] = { 0 };
     TimerTime_t nextTxDelay = 0;
 
     // Count 125kHz channels
@@ -779,10 +780,15 @@ bool RegionCN470NextChannel( NextChanParams_t* nextChanParams, uint8_t* channel,
         // Update bands Time OFF
         nextTxDelay = RegionCommonUpdateBandTimeOff( nextChanParams->Joined, nextChanParams->DutyCycleEnabled, Bands, CN470_MAX_NB_BANDS );
 
-        // Search how many channels are enabled
-        nbEnabledChannels = CountNbOfEnabledChannels( nextChanParams->Datarate,
-                                                      ChannelsMask, Channels,
-                                                      Bands, enabledChannels, &delayTx );
+        ChannelsSetsUpdate( );
+
+        // Search how many channels are enabled, and pick one
+        if( RegionCommonValueInRange( nextChanParams->Datarate, 0, CN470_TX_MAX_DATARATE ) == true )
+        {
+            nbEnabledChannels = RegionCommonChannelsSetSelect( ChannelsSets[nextChanParams->Datarate], ChannelsMask,
+                                                               CN470_MAX_NB_CHANNELS, Channels, Bands, CN470_MAX_NB_BANDS,
+                                                               channel, &delayTx );
+        }
     }
     else
     {
@@ -793,8 +799,6 @@ bool RegionCN470NextChannel( NextChanParams_t* nextChanParams, uint8_t* channel,
     if( nbEnabledChannels > 0 )
     {
         // We found a valid channel
-        *channel = enabledChannels[randr( 0, nbEnabledChannels - 1 )];
-
         *time = 0;
         return true;
     }
@@ -854,8 +858,8 @@ void RegionCN470RxBeaconSetup( RxBeaconSetup_t* rxBeaconSetup, uint8_t* outDr )
     regionCommonRxBeaconSetup.BeaconSize = CN470_BEACON_SIZE;
     regionCommonRxBeaconSetup.BeaconDatarate = CN470_BEACON_CHANNEL_DR;
     regionCommonRxBeaconSetup.BeaconChannelBW = CN470_BEACON_CHANNEL_BW;
-    // regionCommonRxBeaconSetup.RxTime = rxBeaconSetup->RxTime;
-    regionCommonRxBeaconSetup.RxTime = 0;
+    // The MAC layer sets 0 for the continuous reception
+    regionCommonRxBeaconSetup.RxTime = rxBeaconSetup->RxTime;
     regionCommonRxBeaconSetup.SymbolTimeout = rxBeaconSetup->SymbolTimeout;
 
     // printf("RegionCN470RxBeaconSetup -- rxBeaconSetup->RxTime: %ld", rxBeaconSetup->RxTime);
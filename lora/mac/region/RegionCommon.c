@@ -40,22 +40,14 @@ Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jae
 
 
 
-static uint8_t CountChannels( uint16_t mask, uint8_t nbBits )
+static uint8_t CountBits( uint32_t word )
 {
-    uint8_t nbActiveBits = 0;
-
-    for( uint8_t j = 0; j < nbBits; j++ )
-    {
-        if( ( mask & ( 1 << j ) ) == ( 1 << j ) )
-        {
-            nbActiveBits++;
-        }
-    }
-    return nbActiveBits;
+    word = word - ( ( word >> 1 ) & 0x55555555 );
+    word = ( word & 0x33333333 ) + ( ( word >> 2 ) & 0x33333333 );
+    word = ( word + ( word >> 4 ) ) & 0x0F0F0F0F;
+    return ( word * 0x01010101 ) >> 24;
 }
 
-
-
 uint16_t RegionCommonGetJoinDc( TimerTime_t elapsedTime )
 {
     uint16_t dutyCycle = 0;
@@ -87,21 +79,22 @@ bool RegionCommonChanVerifyDr( uint8_t nbChannels, uint16_t* channelsMask, int8_
         //4.29 workaround for when disable all channles not return server 0306 but return 0304
         if (channelsMask[k] == 0)
             return true;
-        for( uint8_t j = 0; j < 16; j++ )
+        // Only the enabled channels are visited, lowest first
+        for( uint16_t bits = channelsMask[k]; bits != 0; bits &= bits - 1 )
         {
-            if( ( ( channelsMask[k] & ( 1 << j ) ) != 0 ) )
-            {// Check datarate validity for enabled channels
+            uint8_t j = CountBits( ( bits & -bits ) - 1 );
+
+            // Check datarate validity for enabled channels
 #ifdef CONFIG_LINKWAN 
-                if( RegionCommonValueInRange( dr, ( channels[(i + j) % 8].DrRange.Fields.Min & 0x0F ),
-                                                  ( channels[(i + j) % 8].DrRange.Fields.Max & 0x0F ) ) == 1 )
+            if( RegionCommonValueInRange( dr, ( channels[(i + j) % 8].DrRange.Fields.Min & 0x0F ),
+                                              ( channels[(i + j) % 8].DrRange.Fields.Max & 0x0F ) ) == 1 )
 #else
-                if( RegionCommonValueInRange( dr, ( channels[i + j].DrRange.Fields.Min & 0x0F ),
-                                                  ( channels[i + j].DrRange.Fields.Max & 0x0F ) ) == 1 )
+            if( RegionCommonValueInRange( dr, ( channels[i + j].DrRange.Fields.Min & 0x0F ),
+                                              ( channels[i + j].DrRange.Fields.Max & 0x0F ) ) == 1 )
 #endif
-                {
-                    // At least 1 channel has been found we can return OK.
-                    return true;
-                }
+            {
+                // At least 1 channel has been found we can return OK.
+                return true;
             }
         }
     }
@@ -143,7 +136,7 @@ uint8_t RegionCommonCountChannels( uint16_t* channelsMask, uint8_t startIdx, uin
 
     for( uint8_t i = startIdx; i < stopIdx; i++ )
     {
-        nbChannels += CountChannels( channelsMask[i], 16 );
+        nbChannels += CountBits( channelsMask[i] );
     }
 
     return nbChannels;
@@ -153,10 +146,7 @@ void RegionCommonChanMaskCopy( uint16_t* channelsMaskDest, uint16_t* channelsMas
 {
     if( ( channelsMaskDest != NULL ) && ( channelsMaskSrc != NULL ) )
     {
-        for( uint8_t i = 0; i < len; i++ )
-        {
-            channelsMaskDest[i] = channelsMaskSrc[i];
-        }
+        memcpy1( ( uint8_t* )channelsMaskDest, ( uint8_t* )channelsMaskSrc, len * sizeof( uint16_t ) );
     }
 }
 
@@ -173,43 +163,43 @@ void RegionCommonSetBandTxDone( bool joined, Band_t* band, TimerTime_t lastTxDon
 TimerTime_t RegionCommonUpdateBandTimeOff( bool joined, bool dutyCycle, Band_t* bands, uint8_t nbBands )
 {
     TimerTime_t nextTxDelay = ( TimerTime_t )( -1 );
+    TimerTime_t now;
+
+    if( ( joined == true ) && ( dutyCycle == false ) )
+    {
+        for( uint8_t i = 0; i < nbBands; i++ )
+        {
+            bands[i].TimeOff = 0;
+        }
+        return ( nbBands > 0 ) ? 0 : nextTxDelay;
+    }
+
+    // One clock read for all the bands, the clock reads the RTC calendar
+    now = TimerGetCurrentTime( );
 
     // Update bands Time OFF
     for( uint8_t i = 0; i < nbBands; i++ )
     {
+        uint32_t txDoneTime;
+
+        if( bands[i].TimeOff == 0 )
+        { // Free band, its time off is only set again by the back-off
+            continue;
+        }
+
+        txDoneTime = now - bands[i].LastTxDoneTime;
         if( joined == false )
         {
-            uint32_t txDoneTime =  MAX( TimerGetElapsedTime( bands[i].LastJoinTxDoneTime ),
-                                        ( dutyCycle == true ) ? TimerGetElapsedTime( bands[i].LastTxDoneTime ) : 0 );
+            txDoneTime = MAX( now - bands[i].LastJoinTxDoneTime, ( dutyCycle == true ) ? txDoneTime : 0 );
+        }
 
-            if( bands[i].TimeOff <= txDoneTime )
-            {
-                bands[i].TimeOff = 0;
-            }
-            if( bands[i].TimeOff != 0 )
-            {
-                nextTxDelay = MIN( bands[i].TimeOff - txDoneTime, nextTxDelay );
-            }
+        if( bands[i].TimeOff <= txDoneTime )
+        {
+            bands[i].TimeOff = 0;
         }
         else
         {
-            if( dutyCycle == true )
-            {
-                if( bands[i].TimeOff <= TimerGetElapsedTime( bands[i].LastTxDoneTime ) )
-                {
-                    bands[i].TimeOff = 0;
-                }
-                if( bands[i].TimeOff != 0 )
-                {
-                    nextTxDelay = MIN( bands[i].TimeOff - TimerGetElapsedTime( bands[i].LastTxDoneTime ),
-                                       nextTxDelay );
-                }
-            }
-            else
-            {
-                nextTxDelay = 0;
-                bands[i].TimeOff = 0;
-            }
+            nextTxDelay = MIN( bands[i].TimeOff - txDoneTime, nextTxDelay );
         }
     }
     return nextTxDelay;
@@ -239,6 +229,42 @@ uint8_t RegionCommonParseLinkAdrReq( uint8_t* payload, LinkAdrParams_t* linkAdrP
     return retIndex;
 }
 
+#ifdef CONFIG_LORA_INTEGER_TOA
+RegionSymbolTime_t RegionCommonComputeSymbolTimeLoRa( uint8_t phyDr, uint32_t bandwidth )
+{
+    return ( ( uint32_t )( 1 << phyDr ) * 1000000 ) / bandwidth; // us
+}
+
+RegionSymbolTime_t RegionCommonComputeSymbolTimeFsk( uint8_t phyDr )
+{
+    return 8000 / ( uint32_t )phyDr; // 1 symbol equals 1 byte, us
+}
+
+void RegionCommonComputeRxWindowParameters( RegionSymbolTime_t tSymbol, uint8_t minRxSymbols, uint32_t rxError, uint32_t wakeUpTime, uint32_t* windowTimeout, int32_t* windowOffset, int32_t* windowOffsetUs )
+{
+    int32_t timeout;
+    int32_t offset;
+
+    // ceil( ( ( 2 * minRxSymbols - 8 ) * tSymbol + 2 * rxError ) / tSymbol ), rxError in ms
+    timeout = ( 2 * minRxSymbols - 8 ) + ( int32_t )( ( 2000 * rxError + tSymbol - 1 ) / tSymbol );
+    *windowTimeout = MAX( timeout, minRxSymbols ); // Computed number of symbols
+
+    // ceil( 4 * tSymbol - windowTimeout * tSymbol / 2 - wakeUpTime ) in ms
+    offset = ( 8 - ( int32_t )*windowTimeout ) * ( int32_t )tSymbol;
+    if( offset >= 0 )
+    {
+        *windowOffset = ( offset + 1999 ) / 2000;
+        *windowOffsetUs = ( offset + 1 ) / 2;
+    }
+    else
+    {
+        *windowOffset = -( -offset / 2000 );
+        *windowOffsetUs = -( -offset / 2 );
+    }
+    *windowOffset -= ( int32_t )wakeUpTime;
+    *windowOffsetUs -= ( int32_t )wakeUpTime * 1000;
+}
+#else
 double RegionCommonComputeSymbolTimeLoRa( uint8_t phyDr, uint32_t bandwidth )
 {
     return ( ( double )( 1 << phyDr ) / ( double )bandwidth ) * 1000;
@@ -249,20 +275,82 @@ double RegionCommonComputeSymbolTimeFsk( uint8_t phyDr )
     return ( 8.0 / ( double )phyDr ); // 1 symbol equals 1 byte
 }
 
-void RegionCommonComputeRxWindowParameters( double tSymbol, uint8_t minRxSymbols, uint32_t rxError, uint32_t wakeUpTime, uint32_t* windowTimeout, int32_t* windowOffset )
+void RegionCommonComputeRxWindowParameters( double tSymbol, uint8_t minRxSymbols, uint32_t rxError, uint32_t wakeUpTime, uint32_t* windowTimeout, int32_t* windowOffset, int32_t* windowOffsetUs )
 {
     *windowTimeout = MAX( ( uint32_t )ceil( ( ( 2 * minRxSymbols - 8 ) * tSymbol + 2 * rxError ) / tSymbol ), minRxSymbols ); // Computed number of symbols
     *windowOffset = ( int32_t )ceil( ( 4.0 * tSymbol ) - ( ( *windowTimeout * tSymbol ) / 2.0 ) - wakeUpTime );
+    *windowOffsetUs = ( int32_t )ceil( ( ( 4.0 * tSymbol ) - ( ( *windowTimeout * tSymbol ) / 2.0 ) - wakeUpTime ) * 1000 );
 }
+#endif
+
+/*!
+ * TX power indexes of the PHY power table
+ */
+#define REGION_COMMON_TX_POWERS                     16
+
+/*!
+ * PHY powers of the TX power indexes, for the max EIRP and the antenna gain
+ * they were computed with
+ */
+static int8_t TxPowerTable[REGION_COMMON_TX_POWERS];
+static float TxPowerTableMaxEirp;
+static float TxPowerTableAntennaGain;
+static bool TxPowerTableValid = false;
 
 int8_t RegionCommonComputeTxPower( int8_t txPowerIndex, float maxEirp, float antennaGain )
 {
-    int8_t phyTxPower = 0;
+    uint8_t i;
 
-    phyTxPower = ( int8_t )floor( ( maxEirp - ( txPowerIndex * 2U ) ) - antennaGain );
+    if( ( txPowerIndex < 0 ) || ( txPowerIndex >= REGION_COMMON_TX_POWERS ) )
+    {
+        return ( int8_t )floor( ( maxEirp - ( txPowerIndex * 2U ) ) - antennaGain );
+    }
 
-    return phyTxPower;
+    // Filled again only when the max EIRP or the antenna gain change
+    if( ( TxPowerTableValid == false ) || ( TxPowerTableMaxEirp != maxEirp ) ||
+        ( TxPowerTableAntennaGain != antennaGain ) )
+    {
+        for( i = 0; i < REGION_COMMON_TX_POWERS; i++ )
+        {
+            TxPowerTable[i] = ( int8_t )floor( ( maxEirp - ( i * 2U ) ) - antennaGain );
+        }
+        TxPowerTableMaxEirp = maxEirp;
+        TxPowerTableAntennaGain = antennaGain;
+        TxPowerTableValid = true;
+    }
+    return TxPowerTable[txPowerIndex];
 }
+#ifdef CONFIG_LORAMAC_TX_TIME
+TimerTime_t RegionCommonComputeTxTimeOnAir( bool fsk, uint8_t phyDr, uint32_t bandwidth, uint8_t pktLen )
+{
+    int32_t num;
+    int32_t den;
+    uint32_t nPayload = 8;
+    uint64_t quarters;
+
+    if( fsk == true )
+    {
+        // Preamble, sync word, length, payload and CRC bits at phyDr kbps
+        return ( phyDr == 0 ) ? 0 : ( 8 * ( 5 + 3 + 1 + pktLen + 2 ) + phyDr - 1 ) / phyDr;
+    }
+    if( bandwidth == 0 )
+    {
+        return 0;
+    }
+
+    // Low datarate optimization from 16.38 ms symbols
+    num = 8 * pktLen - 4 * phyDr + 28 + 16;
+    den = 4 * ( phyDr - ( ( ( ( uint32_t )1 << phyDr ) * 100000 >= 1638 * bandwidth ) ? 2 : 0 ) );
+    if( num > 0 )
+    {
+        nPayload += ( ( num + den - 1 ) / den ) * 5;
+    }
+    // Preamble + 4.25 + payload symbols, counted in quarter symbols
+    quarters = 4 * ( 8 + ( uint64_t )nPayload ) + 17;
+    return ( TimerTime_t )( ( ( quarters << phyDr ) * 250 + bandwidth - 1 ) / bandwidth );
+}
+#endif
+
 void RegionCommonRxBeaconSetup( RegionCommonRxBeaconSetupParams_t* rxBeaconSetupParams )
 {
     bool rxContinuous = true;
@@ -291,3 +379,264 @@ void RegionCommonRxBeaconSetup( RegionCommonRxBeaconSetupParams_t* rxBeaconSetup
 
     Radio.Rx( rxBeaconSetupParams->RxTime );
 }
+
+void RegionCommonChannelsSetBuild( int8_t datarate, ChannelParams_t* channels, uint8_t nbChannels, uint32_t* channelsSet )
+{
+    memset1( ( uint8_t* )channelsSet, 0, REGION_COMMON_CHANNELS_SET_SIZE( nbChannels ) * sizeof( uint32_t ) );
+
+    for( uint8_t i = 0; i < nbChannels; i++ )
+    {
+        if( ( channels[i].Frequency != 0 ) &&
+            ( RegionCommonValueInRange( datarate, channels[i].DrRange.Fields.Min, channels[i].DrRange.Fields.Max ) == true ) )
+        {
+            channelsSet[i / 32] |= 1UL << ( i % 32 );
+        }
+    }
+}
+
+bool RegionCommonChannelsSetVerify( uint32_t* channelsSet, uint16_t* channelsMask, uint8_t nbChannels )
+{
+    for( uint8_t k = 0; k < ( nbChannels + 15 ) / 16; k++ )
+    {
+        // Same workaround as RegionCommonChanVerifyDr for an empty mask
+        if( channelsMask[k] == 0 )
+        {
+            return true;
+        }
+        if( ( channelsMask[k] & ( uint16_t )( channelsSet[k / 2] >> ( 16 * ( k % 2 ) ) ) ) != 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef CONFIG_LORAMAC_CHANNEL_QUALITY
+/*!
+ * Penalty of each channel, its weight taken from REGION_COMMON_QUALITY_WEIGHT_MAX
+ */
+static uint8_t ChannelPenalty[REGION_COMMON_QUALITY_CHANNELS];
+
+/*!
+ * Time of the last penalty decay
+ */
+static TimerTime_t ChannelQualityDecayTime = 0;
+
+#define CHANNEL_PENALTY_MAX                         ( REGION_COMMON_QUALITY_WEIGHT_MAX - REGION_COMMON_QUALITY_WEIGHT_MIN )
+
+/*!
+ * \brief Halves the penalties once per decay period elapsed
+ */
+static void ChannelQualityDecay( void )
+{
+    TimerTime_t elapsed = TimerGetElapsedTime( ChannelQualityDecayTime );
+    uint8_t i;
+
+    if( elapsed < REGION_COMMON_QUALITY_DECAY_PERIOD )
+    {
+        return;
+    }
+    ChannelQualityDecayTime = TimerGetCurrentTime( );
+
+    for( i = 0; i < REGION_COMMON_QUALITY_CHANNELS; i++ )
+    {
+        // The penalties are below 64, gone after 6 periods
+        if( elapsed >= 6 * REGION_COMMON_QUALITY_DECAY_PERIOD )
+        {
+            ChannelPenalty[i] = 0;
+        }
+        else
+        {
+            ChannelPenalty[i] >>= elapsed / REGION_COMMON_QUALITY_DECAY_PERIOD;
+        }
+    }
+}
+
+void RegionCommonChannelQualityReport( uint8_t channel, bool acked )
+{
+    if( channel >= REGION_COMMON_QUALITY_CHANNELS )
+    {
+        return;
+    }
+    if( acked == true )
+    {
+        ChannelPenalty[channel] /= 2;
+    }
+    else
+    {
+        ChannelPenalty[channel] += ( CHANNEL_PENALTY_MAX - ChannelPenalty[channel] + 1 ) / 2;
+    }
+}
+
+void RegionCommonChannelQualityOccupancy( uint8_t channel, uint16_t occupancy )
+{
+    uint8_t penalty;
+
+    if( channel >= REGION_COMMON_QUALITY_CHANNELS )
+    {
+        return;
+    }
+    penalty = ( uint32_t )CHANNEL_PENALTY_MAX * MIN( occupancy, 1000 ) / 1000;
+    if( penalty > ChannelPenalty[channel] )
+    {
+        ChannelPenalty[channel] = penalty;
+    }
+}
+
+uint8_t RegionCommonChannelQualityWeight( uint8_t channel )
+{
+    if( channel >= REGION_COMMON_QUALITY_CHANNELS )
+    {
+        return REGION_COMMON_QUALITY_WEIGHT_MAX;
+    }
+    return REGION_COMMON_QUALITY_WEIGHT_MAX - ChannelPenalty[channel];
+}
+
+void RegionCommonChannelQualityReset( void )
+{
+    memset1( ChannelPenalty, 0, sizeof( ChannelPenalty ) );
+    ChannelQualityDecayTime = TimerGetCurrentTime( );
+}
+
+uint8_t RegionCommonChannelQualityPick( const uint8_t* channels, uint8_t nbChannels )
+{
+    uint16_t total = 0;
+    uint16_t r;
+    uint8_t i;
+
+    ChannelQualityDecay( );
+    for( i = 0; i < nbChannels; i++ )
+    {
+        total += RegionCommonChannelQualityWeight( channels[i] );
+    }
+
+    r = randr( 0, total - 1 );
+    for( i = 0; i < nbChannels - 1; i++ )
+    {
+        uint8_t weight = RegionCommonChannelQualityWeight( channels[i] );
+
+        if( r < weight )
+        {
+            break;
+        }
+        r -= weight;
+    }
+    return i;
+}
+
+/*!
+ * \brief Picks a channel of an enabled channels set, in proportion to the
+ *        channel weights
+ *
+ * \param [IN] enabled The enabled channels set, one channel at least.
+ *
+ * \param [IN] nbWords The words of the set.
+ *
+ * \retval Returns the channel picked.
+ */
+static uint8_t ChannelQualitySelect( const uint32_t* enabled, uint8_t nbWords )
+{
+    uint16_t total = 0;
+    uint16_t r;
+    uint32_t bits;
+    uint8_t ch = 0;
+    uint8_t i;
+
+    ChannelQualityDecay( );
+    for( i = 0; i < nbWords; i++ )
+    {
+        for( bits = enabled[i]; bits != 0; bits &= bits - 1 )
+        {
+            total += RegionCommonChannelQualityWeight( i * 32 + CountBits( ( bits & -bits ) - 1 ) );
+        }
+    }
+
+    r = randr( 0, total - 1 );
+    for( i = 0; i < nbWords; i++ )
+    {
+        for( bits = enabled[i]; bits != 0; bits &= bits - 1 )
+        {
+            uint8_t weight;
+
+            ch = i * 32 + CountBits( ( bits & -bits ) - 1 );
+            weight = RegionCommonChannelQualityWeight( ch );
+            if( r < weight )
+            {
+                return ch;
+            }
+            r -= weight;
+        }
+    }
+    return ch;
+}
+#endif
+
+uint8_t RegionCommonChannelsSetSelect( uint32_t* channelsSet, uint16_t* channelsMask, uint8_t nbChannels, ChannelParams_t* channels,
+                                       Band_t* bands, uint8_t nbBands, uint8_t* channel, uint8_t* delayTx )
+{
+    uint32_t enabled[REGION_COMMON_CHANNELS_SET_SIZE( 255 )];
+    uint8_t nbWords = REGION_COMMON_CHANNELS_SET_SIZE( nbChannels );
+    uint8_t nbMasks = ( nbChannels + 15 ) / 16;
+    uint32_t busyBands = 0;
+    uint8_t nbEnabledChannels = 0;
+    uint8_t delayTransmission = 0;
+    uint32_t bits;
+    uint8_t i;
+
+    for( i = 0; i < nbBands; i++ )
+    {
+        if( bands[i].TimeOff > 0 )
+        {
+            busyBands |= 1UL << i;
+        }
+    }
+
+    for( i = 0; i < nbWords; i++ )
+    {
+        enabled[i] = channelsMask[2 * i];
+        if( ( 2 * i + 1 ) < nbMasks )
+        {
+            enabled[i] |= ( uint32_t )channelsMask[2 * i + 1] << 16;
+        }
+        enabled[i] &= channelsSet[i];
+
+        if( busyBands != 0 )
+        { // Only walk the channels when a band is not available
+            for( bits = enabled[i]; bits != 0; bits &= bits - 1 )
+            {
+                uint8_t ch = i * 32 + CountBits( ( bits & -bits ) - 1 );
+
+                if( ( busyBands & ( 1UL << channels[ch].Band ) ) != 0 )
+                {
+                    enabled[i] &= ~( 1UL << ( ch % 32 ) );
+                    delayTransmission++;
+                }
+            }
+        }
+        nbEnabledChannels += CountBits( enabled[i] );
+    }
+
+    if( nbEnabledChannels > 0 )
+    {
+#ifdef CONFIG_LORAMAC_CHANNEL_QUALITY
+        *channel = ChannelQualitySelect( enabled, nbWords );
+#else
+        // The r-th enabled channel, by increasing index
+        uint8_t r = randr( 0, nbEnabledChannels - 1 );
+
+        for( i = 0; r >= CountBits( enabled[i] ); i++ )
+        {
+            r -= CountBits( enabled[i] );
+        }
+        bits = enabled[i];
+        while( r-- > 0 )
+        {
+            bits &= bits - 1;
+        }
+        *channel = i * 32 + CountBits( ( bits & -bits ) - 1 );
+#endif
+    }
+
+    *delayTx = delayTransmission;
+    return nbEnabledChannels;
+}
@@ -39,6 +39,16 @@
 #ifndef __REGIONCOMMON_H__
 #define __REGIONCOMMON_H__
 
+/*!
+ * Symbol time type of the RX window computations: integer microseconds
+ * with CONFIG_LORA_INTEGER_TOA, milliseconds otherwise.
+ */
+#ifdef CONFIG_LORA_INTEGER_TOA
+typedef uint32_t RegionSymbolTime_t;
+#else
+typedef double RegionSymbolTime_t;
+#endif
+
 typedef struct sLinkAdrParams
 {
     /*!
@@ -207,6 +217,69 @@ void RegionCommonSetBandTxDone( bool joined, Band_t* band, TimerTime_t lastTxDon
  */
 TimerTime_t RegionCommonUpdateBandTimeOff( bool joined, bool dutyCycle, Band_t* bands, uint8_t nbBands );
 
+/*!
+ * Number of 32 bits words of a channels set
+ */
+#define REGION_COMMON_CHANNELS_SET_SIZE( nbChannels )    ( ( ( nbChannels ) + 31 ) / 32 )
+
+/*!
+ * \brief Builds the set of the defined channels supporting a datarate, bit n
+ *        of word n / 32 standing for channel n. The set only depends on the
+ *        channels, it is kept until they change.
+ *        This is a generic function and valid for all regions.
+ *
+ * \param [IN] datarate The datarate.
+ *
+ * \param [IN] channels A pointer to the channels.
+ *
+ * \param [IN] nbChannels The number of channels.
+ *
+ * \param [OUT] channelsSet The channels set, REGION_COMMON_CHANNELS_SET_SIZE words.
+ */
+void RegionCommonChannelsSetBuild( int8_t datarate, ChannelParams_t* channels, uint8_t nbChannels, uint32_t* channelsSet );
+
+/*!
+ * \brief Verifies that an enabled channel supports a datarate, from the
+ *        channels set of the datarate. This is the word wide version of
+ *        \ref RegionCommonChanVerifyDr for the regions holding their sets.
+ *
+ * \param [IN] channelsSet The channels set of the datarate.
+ *
+ * \param [IN] channelsMask The channels mask to verify.
+ *
+ * \param [IN] nbChannels The number of channels.
+ *
+ * \retval Returns true if the datarate is supported, false if not.
+ */
+bool RegionCommonChannelsSetVerify( uint32_t* channelsSet, uint16_t* channelsMask, uint8_t nbChannels );
+
+/*!
+ * \brief Selects a random channel among the channels of a set enabled in the
+ *        channels mask whose band is available, as a random pick in the list
+ *        of enabled channels would.
+ *        This is a generic function and valid for all regions.
+ *
+ * \param [IN] channelsSet The channels set of the datarate.
+ *
+ * \param [IN] channelsMask The channels mask.
+ *
+ * \param [IN] nbChannels The number of channels.
+ *
+ * \param [IN] channels A pointer to the channels.
+ *
+ * \param [IN] bands A pointer to the bands.
+ *
+ * \param [IN] nbBands The number of bands, 32 at most.
+ *
+ * \param [OUT] channel The selected channel, set when channels are enabled.
+ *
+ * \param [OUT] delayTx The number of channels waiting for their band.
+ *
+ * \retval Returns the number of enabled channels.
+ */
+uint8_t RegionCommonChannelsSetSelect( uint32_t* channelsSet, uint16_t* channelsMask, uint8_t nbChannels, ChannelParams_t* channels,
+                                       Band_t* bands, uint8_t nbBands, uint8_t* channel, uint8_t* delayTx );
+
 /*!
  * \brief Parses the parameter of an LinkAdrRequest.
  *        This is a generic function and valid for all regions.
@@ -230,7 +303,7 @@ uint8_t RegionCommonParseLinkAdrReq( uint8_t* payload, LinkAdrParams_t* parseLin
  *
  * \retval Returns the symbol time.
  */
-double RegionCommonComputeSymbolTimeLoRa( uint8_t phyDr, uint32_t bandwidth );
+RegionSymbolTime_t RegionCommonComputeSymbolTimeLoRa( uint8_t phyDr, uint32_t bandwidth );
 
 /*!
  * \brief Computes the symbol time for FSK modulation.
@@ -241,7 +314,7 @@ double RegionCommonComputeSymbolTimeLoRa( uint8_t phyDr, uint32_t bandwidth );
  *
  * \retval Returns the symbol time.
  */
-double RegionCommonComputeSymbolTimeFsk( uint8_t phyDr );
+RegionSymbolTime_t RegionCommonComputeSymbolTimeFsk( uint8_t phyDr );
 
 /*!
  * \brief Computes the RX window timeout and the RX window offset.
@@ -258,8 +331,10 @@ double RegionCommonComputeSymbolTimeFsk( uint8_t phyDr );
  * \param [OUT] windowTimeout RX window timeout.
  *
  * \param [OUT] windowOffset RX window time offset to be applied to the RX delay.
+ *
+ * \param [OUT] windowOffsetUs RX window time offset in microseconds.
  */
-void RegionCommonComputeRxWindowParameters( double tSymbol, uint8_t minRxSymbols, uint32_t rxError, uint32_t wakeUpTime, uint32_t* windowTimeout, int32_t* windowOffset );
+void RegionCommonComputeRxWindowParameters( RegionSymbolTime_t tSymbol, uint8_t minRxSymbols, uint32_t rxError, uint32_t wakeUpTime, uint32_t* windowTimeout, int32_t* windowOffset, int32_t* windowOffsetUs );
 
 /*!
  * \brief Computes the txPower, based on the max EIRP and the antenna gain.
@@ -274,6 +349,25 @@ void RegionCommonComputeRxWindowParameters( double tSymbol, uint8_t minRxSymbols
  */
 int8_t RegionCommonComputeTxPower( int8_t txPowerIndex, float maxEirp, float antennaGain );
 
+#ifdef CONFIG_LORAMAC_TX_TIME
+/*!
+ * \brief Computes the time on air of an uplink with the settings the regions
+ *        give the radio: CR 4/5, 8 symbols of preamble, explicit header and
+ *        CRC for LoRa, 5 bytes of preamble, 3 of sync word and CRC for FSK.
+ *
+ * \param [IN] fsk Set to true for the FSK datarate.
+ *
+ * \param [IN] phyDr Spreading factor, or the FSK bitrate in kbps.
+ *
+ * \param [IN] bandwidth LoRa bandwidth [Hz].
+ *
+ * \param [IN] pktLen PHY payload length.
+ *
+ * \retval Returns the time on air [ms].
+ */
+TimerTime_t RegionCommonComputeTxTimeOnAir( bool fsk, uint8_t phyDr, uint32_t bandwidth, uint8_t pktLen );
+#endif
+
 /*!
  * \brief Sets up the radio into RX beacon mode.
  *
@@ -281,6 +375,80 @@ int8_t RegionCommonComputeTxPower( int8_t txPowerIndex, float maxEirp, float ant
  */
 void RegionCommonRxBeaconSetup( RegionCommonRxBeaconSetupParams_t* rxBeaconSetupParams );
 
+#ifdef CONFIG_LORAMAC_CHANNEL_QUALITY
+/*!
+ * Channels whose quality is tracked, the ones above are always weighted in
+ * full.
+ */
+#ifndef REGION_COMMON_QUALITY_CHANNELS
+#define REGION_COMMON_QUALITY_CHANNELS              96
+#endif
+
+/*!
+ * Weight of a channel in the random selection, from a channel which failed
+ * or was seen busy to a channel in full health.
+ */
+#define REGION_COMMON_QUALITY_WEIGHT_MAX            64
+#ifndef REGION_COMMON_QUALITY_WEIGHT_MIN
+#define REGION_COMMON_QUALITY_WEIGHT_MIN            4
+#endif
+
+/*!
+ * Period after which the penalty of each channel is halved [ms].
+ */
+#ifndef REGION_COMMON_QUALITY_DECAY_PERIOD
+#define REGION_COMMON_QUALITY_DECAY_PERIOD          600000
+#endif
+
+/*!
+ * \brief Reports the outcome of a confirmed uplink. A missing ACK halves the
+ *        weight of the channel, an ACK halves its penalty.
+ *
+ * \param [IN] channel Channel of the uplink.
+ *
+ * \param [IN] acked Set to true when the ACK was received.
+ */
+void RegionCommonChannelQualityReport( uint8_t channel, bool acked );
+
+/*!
+ * \brief Reports the occupancy measured on a channel, its weight is lowered
+ *        to the share of the samples found free.
+ *
+ * \param [IN] channel Channel measured.
+ *
+ * \param [IN] occupancy Samples found busy [per mille].
+ */
+void RegionCommonChannelQualityOccupancy( uint8_t channel, uint16_t occupancy );
+
+/*!
+ * \brief Gets the weight of a channel in the random selection.
+ *
+ * \param [IN] channel Channel.
+ *
+ * \retval Returns the weight, REGION_COMMON_QUALITY_WEIGHT_MIN to
+ *         REGION_COMMON_QUALITY_WEIGHT_MAX.
+ */
+uint8_t RegionCommonChannelQualityWeight( uint8_t channel );
+
+/*!
+ * \brief Puts all the channels back to full weight.
+ */
+void RegionCommonChannelQualityReset( void );
+
+/*!
+ * \brief Picks a channel of a list at random, in proportion to the channel
+ *        weights. The list is built under the regional rules and the
+ *        channels mask, only the odds within it change.
+ *
+ * \param [IN] channels The enabled channels.
+ *
+ * \param [IN] nbChannels The number of enabled channels, at least one.
+ *
+ * \retval Returns the index of the channel picked in the list.
+ */
+uint8_t RegionCommonChannelQualityPick( const uint8_t* channels, uint8_t nbChannels );
+#endif
+
 /*! \} defgroup REGIONCOMMON */
 
 #endif // __REGIONCOMMON_H__
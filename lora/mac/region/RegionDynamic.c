@@ -0,0 +1,1191 @@
+/*!
+ * \file      RegionDynamic.c
+ *
+ * \brief     Engine of the dynamic channel plan regions
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ *            Derived from the EU868 implementation of Semtech and STACKFORCE,
+ *            the region differences are read from the plan.
+ */
+#define LOG_MODULE LOG_MODULE_REGION
+
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "radio.h"
+#include "timer.h"
+#include "LoRaMac.h"
+
+#include "utilities.h"
+
+#include "Region.h"
+#include "RegionCommon.h"
+#include "RegionDynamic.h"
+#include "log.h"
+
+/*!
+ * Channels of a plan, one mask word
+ */
+#define REGION_DYNAMIC_MAX_NB_CHANNELS              16
+
+/*!
+ * Mask of the default channels, the first ones of the plan
+ */
+#define DEFAULT_CHANNELS_MASK( plan )               ( uint16_t )( ( 1 << ( plan )->NbDefaultChannels ) - 1 )
+
+static int8_t GetMinTxDr( const RegionDynamicPlan_t* plan, uint8_t uplinkDwellTime )
+{
+    if( ( uplinkDwellTime != 0 ) && ( plan->DwellLimitDatarate != REGION_DYNAMIC_DR_NONE ) )
+    {
+        return plan->DwellLimitDatarate;
+    }
+    return plan->TxMinDatarate;
+}
+
+static int8_t GetMinRxDr( const RegionDynamicPlan_t* plan, uint8_t downlinkDwellTime )
+{
+    if( ( downlinkDwellTime != 0 ) && ( plan->DwellLimitDatarate != REGION_DYNAMIC_DR_NONE ) )
+    {
+        return plan->DwellLimitDatarate;
+    }
+    return plan->RxMinDatarate;
+}
+
+static int8_t GetNextLowerTxDr( const RegionDynamicPlan_t* plan, int8_t dr, int8_t minDr )
+{
+    int8_t nextLowerDr = 0;
+
+    if( dr == minDr )
+    {
+        nextLowerDr = minDr;
+    }
+    else
+    {
+        nextLowerDr = dr - 1;
+        if( nextLowerDr == plan->RfuDatarate )
+        {
+            nextLowerDr--;
+        }
+    }
+    return nextLowerDr;
+}
+
+static uint32_t GetBandwidth( const RegionDynamicPlan_t* plan, uint32_t drIndex )
+{
+    switch( plan->Bandwidths[drIndex] )
+    {
+        default:
+        case 125000:
+            return 0;
+        case 250000:
+            return 1;
+        case 500000:
+            return 2;
+    }
+}
+
+static int8_t LimitTxPower( int8_t txPower, int8_t maxBandTxPower )
+{
+    // Limit tx power to the band max
+    return MAX( txPower, maxBandTxPower );
+}
+
+static bool VerifyTxFreq( const RegionDynamicPlan_t* plan, uint32_t freq, uint8_t *band )
+{
+    // Check radio driver support
+    if( Radio.CheckRfFrequency( freq ) == false )
+    {
+        return false;
+    }
+
+    // Check frequency bands
+    for( uint8_t i = 0; i < plan->NbBandRanges; i++ )
+    {
+        const RegionDynamicBandRange_t* range = &plan->BandRanges[i];
+
+        if( ( freq < range->Min ) || ( freq > range->Max ) )
+        {
+            continue;
+        }
+        if( ( plan->FrequencyStep != 0 ) && ( ( ( freq - range->Min ) % plan->FrequencyStep ) != 0 ) )
+        {
+            return false;
+        }
+        *band = range->Band;
+        return true;
+    }
+    return false;
+}
+
+static uint8_t CountNbOfEnabledChannels( const RegionDynamicPlan_t* plan, bool joined, uint8_t datarate, uint8_t* enabledChannels, uint8_t* delayTx )
+{
+    ChannelParams_t* channels = plan->Channels;
+    uint16_t channelsMask = plan->ChannelsMask[0];
+    uint8_t nbEnabledChannels = 0;
+    uint8_t delayTransmission = 0;
+
+    for( uint8_t i = 0; i < plan->MaxNbChannels; i++ )
+    {
+        if( ( channelsMask & ( 1 << i ) ) == 0 )
+        {
+            continue;
+        }
+        if( channels[i].Frequency == 0 )
+        { // Check if the channel is enabled
+            continue;
+        }
+        if( ( joined == false ) && ( ( plan->JoinChannels & ( 1 << i ) ) == 0 ) )
+        {
+            continue;
+        }
+        if( RegionCommonValueInRange( datarate, channels[i].DrRange.Fields.Min,
+                                      channels[i].DrRange.Fields.Max ) == false )
+        { // Check if the current channel selection supports the given datarate
+            continue;
+        }
+        if( plan->Bands[channels[i].Band].TimeOff > 0 )
+        { // Check if the band is available for transmission
+            delayTransmission++;
+            continue;
+        }
+        enabledChannels[nbEnabledChannels++] = i;
+    }
+
+    *delayTx = delayTransmission;
+    return nbEnabledChannels;
+}
+
+PhyParam_t RegionDynamicGetPhyParam( const RegionDynamicPlan_t* plan, GetPhyParams_t* getPhy )
+{
+    PhyParam_t phyParam = { 0 };
+
+    switch( getPhy->Attribute )
+    {
+        case PHY_MIN_RX_DR:
+        {
+            phyParam.Value = GetMinRxDr( plan, getPhy->DownlinkDwellTime );
+            break;
+        }
+        case PHY_MIN_TX_DR:
+        {
+            phyParam.Value = GetMinTxDr( plan, getPhy->UplinkDwellTime );
+            break;
+        }
+        case PHY_DEF_TX_DR:
+        {
+            phyParam.Value = plan->DefaultDatarate;
+            break;
+        }
+        case PHY_NEXT_LOWER_TX_DR:
+        {
+            phyParam.Value = GetNextLowerTxDr( plan, getPhy->Datarate, GetMinTxDr( plan, getPhy->UplinkDwellTime ) );
+            break;
+        }
+        case PHY_DEF_TX_POWER:
+        {
+            phyParam.Value = plan->DefaultTxPower;
+            break;
+        }
+        case PHY_MAX_PAYLOAD:
+        {
+            if( ( plan->MaxPayloadDwell1 != NULL ) && ( getPhy->UplinkDwellTime != 0 ) )
+            {
+                phyParam.Value = plan->MaxPayloadDwell1[getPhy->Datarate];
+            }
+            else
+            {
+                phyParam.Value = plan->MaxPayload[getPhy->Datarate];
+            }
+            break;
+        }
+        case PHY_MAX_PAYLOAD_REPEATER:
+        {
+            if( ( plan->MaxPayloadDwell1 != NULL ) && ( getPhy->UplinkDwellTime != 0 ) )
+            {
+                phyParam.Value = plan->MaxPayloadDwell1[getPhy->Datarate];
+            }
+            else
+            {
+                phyParam.Value = plan->MaxPayloadRepeater[getPhy->Datarate];
+            }
+            break;
+        }
+        case PHY_DUTY_CYCLE:
+        {
+            phyParam.Value = plan->DutyCycleEnabled;
+            break;
+        }
+        case PHY_MAX_RX_WINDOW:
+        {
+            phyParam.Value = plan->MaxRxWindow;
+            break;
+        }
+        case PHY_RECEIVE_DELAY1:
+        {
+            phyParam.Value = plan->ReceiveDelay1;
+            break;
+        }
+        case PHY_RECEIVE_DELAY2:
+        {
+            phyParam.Value = plan->ReceiveDelay2;
+            break;
+        }
+        case PHY_JOIN_ACCEPT_DELAY1:
+        {
+            phyParam.Value = plan->JoinAcceptDelay1;
+            break;
+        }
+        case PHY_JOIN_ACCEPT_DELAY2:
+        {
+            phyParam.Value = plan->JoinAcceptDelay2;
+            break;
+        }
+        case PHY_MAX_FCNT_GAP:
+        {
+            phyParam.Value = plan->MaxFCntGap;
+            break;
+        }
+        case PHY_ACK_TIMEOUT:
+        {
+            phyParam.Value = ( plan->AckTimeout + randr( -( int32_t )plan->AckTimeoutRnd, plan->AckTimeoutRnd ) );
+            break;
+        }
+        case PHY_DEF_DR1_OFFSET:
+        {
+            phyParam.Value = plan->DefaultRx1DrOffset;
+            break;
+        }
+        case PHY_DEF_RX2_FREQUENCY:
+        {
+            phyParam.Value = plan->Rx2Frequency;
+            break;
+        }
+        case PHY_DEF_RX2_DR:
+        {
+            phyParam.Value = plan->Rx2Datarate;
+            break;
+        }
+        case PHY_CHANNELS_MASK:
+        {
+            phyParam.ChannelsMask = plan->ChannelsMask;
+            break;
+        }
+        case PHY_CHANNELS_DEFAULT_MASK:
+        {
+            phyParam.ChannelsMask = plan->ChannelsDefaultMask;
+            break;
+        }
+        case PHY_MAX_NB_CHANNELS:
+        {
+            phyParam.Value = plan->MaxNbChannels;
+            break;
+        }
+        case PHY_CHANNELS:
+        {
+            phyParam.Channels = plan->Channels;
+            break;
+        }
+        case PHY_DEF_UPLINK_DWELL_TIME:
+        {
+            phyParam.Value = plan->DefaultUplinkDwellTime;
+            break;
+        }
+        case PHY_DEF_DOWNLINK_DWELL_TIME:
+        {
+            phyParam.Value = plan->DefaultDownlinkDwellTime;
+            break;
+        }
+        case PHY_DEF_MAX_EIRP:
+        {
+            // With a frequency dependent EIRP this is the higher one, the
+            // limit of the channel is applied in the TX configuration
+            phyParam.fValue = plan->DefaultMaxEirp;
+            break;
+        }
+        case PHY_DEF_ANTENNA_GAIN:
+        {
+            phyParam.fValue = plan->DefaultAntennaGain;
+            break;
+        }
+        case PHY_NB_JOIN_TRIALS:
+        case PHY_DEF_NB_JOIN_TRIALS:
+        {
+            phyParam.Value = plan->NbJoinTrials;
+            break;
+        }
+        case PHY_BEACON_CHANNEL_FREQ:
+        {
+            phyParam.Value = plan->BeaconFrequency;
+            break;
+        }
+        case PHY_BEACON_FORMAT:
+        {
+            phyParam.BeaconFormat.BeaconSize = plan->BeaconSize;
+            phyParam.BeaconFormat.Rfu1Size = plan->BeaconRfu1Size;
+            phyParam.BeaconFormat.Rfu2Size = plan->BeaconRfu2Size;
+            break;
+        }
+        case PHY_BEACON_CHANNEL_DR:
+        {
+            phyParam.Value = plan->BeaconDatarate;
+            break;
+        }
+        case PHY_CARRIER_SENSE_TIME:
+        {
+            phyParam.Value = plan->CarrierSenseTime;
+            break;
+        }
+        case PHY_CARRIER_SENSE_RSSI_TH:
+        {
+            phyParam.Value = ( plan->CarrierSenseTime != 0 ) ? ( uint32_t )( int32_t )plan->RssiFreeTh : 0;
+            break;
+        }
+#ifdef CONFIG_LORAMAC_TX_TIME
+        case PHY_TX_TIME_ON_AIR:
+        {
+            phyParam.Value = RegionCommonComputeTxTimeOnAir( getPhy->Datarate == plan->FskDatarate, plan->Datarates[getPhy->Datarate], plan->Bandwidths[getPhy->Datarate], getPhy->PktLen );
+            break;
+        }
+#endif
+#ifdef CONFIG_LORAMAC_LINK_ADR
+        case PHY_DATARATE_SF:
+        {
+            phyParam.Value = ( ( getPhy->Datarate != plan->FskDatarate ) && ( plan->Bandwidths[getPhy->Datarate] == 125000 ) ) ?
+                             plan->Datarates[getPhy->Datarate] : 0;
+            break;
+        }
+#endif
+        default:
+        {
+            break;
+        }
+    }
+
+    return phyParam;
+}
+
+void RegionDynamicSetBandTxDone( const RegionDynamicPlan_t* plan, SetBandTxDoneParams_t* txDone )
+{
+    RegionCommonSetBandTxDone( txDone->Joined, &plan->Bands[plan->Channels[txDone->Channel].Band], txDone->LastTxDoneTime );
+}
+
+void RegionDynamicInitDefaults( const RegionDynamicPlan_t* plan, InitType_t type )
+{
+    switch( type )
+    {
+        case INIT_TYPE_INIT:
+        {
+            // Channels
+            memcpy( plan->Channels, plan->DefaultChannels, plan->NbDefaultChannels * sizeof( ChannelParams_t ) );
+
+            // Initialize the channels default mask
+            plan->ChannelsDefaultMask[0] = DEFAULT_CHANNELS_MASK( plan );
+            // Update the channels mask
+            RegionCommonChanMaskCopy( plan->ChannelsMask, plan->ChannelsDefaultMask, 1 );
+            break;
+        }
+        case INIT_TYPE_RESTORE:
+        {
+            // Restore channels default mask
+            plan->ChannelsMask[0] |= plan->ChannelsDefaultMask[0];
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+}
+
+bool RegionDynamicVerify( const RegionDynamicPlan_t* plan, VerifyParams_t* verify, PhyAttribute_t phyAttribute )
+{
+    switch( phyAttribute )
+    {
+        case PHY_TX_DR:
+        {
+            return RegionCommonValueInRange( verify->DatarateParams.Datarate,
+                                             GetMinTxDr( plan, verify->DatarateParams.UplinkDwellTime ), plan->TxMaxDatarate );
+        }
+        case PHY_DEF_TX_DR:
+        {
+            return RegionCommonValueInRange( verify->DatarateParams.Datarate, DR_0, DR_5 );
+        }
+        case PHY_RX_DR:
+        {
+            return RegionCommonValueInRange( verify->DatarateParams.Datarate,
+                                             GetMinRxDr( plan, verify->DatarateParams.DownlinkDwellTime ), plan->RxMaxDatarate );
+        }
+        case PHY_DEF_TX_POWER:
+        case PHY_TX_POWER:
+        {
+            // Remark: switched min and max!
+            return RegionCommonValueInRange( verify->TxPower, plan->MaxTxPower, plan->MinTxPower );
+        }
+        case PHY_DUTY_CYCLE:
+        {
+            return plan->DutyCycleEnabled;
+        }
+        case PHY_NB_JOIN_TRIALS:
+        {
+            return verify->NbJoinTrials >= plan->MinNbJoinTrials;
+        }
+        default:
+            return false;
+    }
+}
+
+void RegionDynamicApplyCFList( const RegionDynamicPlan_t* plan, ApplyCFListParams_t* applyCFList )
+{
+    ChannelParams_t newChannel;
+    ChannelAddParams_t channelAdd;
+    ChannelRemoveParams_t channelRemove;
+
+    // Setup default datarate range
+    newChannel.DrRange.Value = ( DR_5 << 4 ) | DR_0;
+
+    // Size of the optional CF list
+    if( applyCFList->Size != 16 )
+    {
+        return;
+    }
+
+    // Last byte is RFU, don't take it into account
+    for( uint8_t i = 0, chanIdx = plan->NbDefaultChannels; chanIdx < plan->MaxNbChannels; i += 3, chanIdx++ )
+    {
+        if( chanIdx < ( plan->NbCfListChannels + plan->NbDefaultChannels ) )
+        {
+            // Channel frequency
+            newChannel.Frequency = ( uint32_t ) applyCFList->Payload[i];
+            newChannel.Frequency |= ( ( uint32_t ) applyCFList->Payload[i + 1] << 8 );
+            newChannel.Frequency |= ( ( uint32_t ) applyCFList->Payload[i + 2] << 16 );
+            newChannel.Frequency *= 100;
+
+            // Initialize alternative frequency to 0
+            newChannel.Rx1Frequency = 0;
+        }
+        else
+        {
+            newChannel.Frequency = 0;
+            newChannel.DrRange.Value = 0;
+            newChannel.Rx1Frequency = 0;
+        }
+
+        if( newChannel.Frequency != 0 )
+        {
+            channelAdd.NewChannel = &newChannel;
+            channelAdd.ChannelId = chanIdx;
+
+            // Try to add all channels
+            RegionDynamicChannelAdd( plan, &channelAdd );
+        }
+        else
+        {
+            channelRemove.ChannelId = chanIdx;
+
+            RegionDynamicChannelsRemove( plan, &channelRemove );
+        }
+    }
+}
+
+bool RegionDynamicChanMaskSet( const RegionDynamicPlan_t* plan, ChanMaskSetParams_t* chanMaskSet )
+{
+    switch( chanMaskSet->ChannelsMaskType )
+    {
+        case CHANNELS_MASK:
+        {
+            RegionCommonChanMaskCopy( plan->ChannelsMask, chanMaskSet->ChannelsMaskIn, 1 );
+            break;
+        }
+        case CHANNELS_DEFAULT_MASK:
+        {
+            RegionCommonChanMaskCopy( plan->ChannelsDefaultMask, chanMaskSet->ChannelsMaskIn, 1 );
+            break;
+        }
+        default:
+            return false;
+    }
+    return true;
+}
+
+bool RegionDynamicAdrNext( const RegionDynamicPlan_t* plan, AdrNextParams_t* adrNext, int8_t* drOut, int8_t* txPowOut, uint32_t* adrAckCounter )
+{
+    bool adrAckReq = false;
+    int8_t minTxDatarate = GetMinTxDr( plan, adrNext->UplinkDwellTime );
+    int8_t datarate = MAX( adrNext->Datarate, minTxDatarate );
+    int8_t txPower = adrNext->TxPower;
+
+    // Report back the adr ack counter
+    *adrAckCounter = adrNext->AdrAckCounter;
+
+    if( adrNext->AdrEnabled == true )
+    {
+        if( datarate == minTxDatarate )
+        {
+            *adrAckCounter = 0;
+            adrAckReq = false;
+        }
+        else
+        {
+            if( adrNext->AdrAckCounter >= plan->AdrAckLimit )
+            {
+                adrAckReq = true;
+                txPower = plan->MaxTxPower;
+            }
+            else
+            {
+                adrAckReq = false;
+            }
+            if( adrNext->AdrAckCounter >= ( plan->AdrAckLimit + plan->AdrAckDelay ) )
+            {
+                if( ( adrNext->AdrAckCounter % plan->AdrAckDelay ) == 1 )
+                {
+                    // Decrease the datarate
+                    datarate = GetNextLowerTxDr( plan, datarate, minTxDatarate );
+
+                    if( datarate == minTxDatarate )
+                    {
+                        // We must set adrAckReq to false as soon as we reach the lowest datarate
+                        adrAckReq = false;
+                        if( adrNext->UpdateChanMask == true )
+                        {
+                            // Re-enable default channels
+                            plan->ChannelsMask[0] |= DEFAULT_CHANNELS_MASK( plan );
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    *drOut = datarate;
+    *txPowOut = txPower;
+    return adrAckReq;
+}
+
+void RegionDynamicComputeRxWindowParameters( const RegionDynamicPlan_t* plan, int8_t datarate, uint8_t minRxSymbols, uint32_t rxError, RxConfigParams_t *rxConfigParams )
+{
+    RegionSymbolTime_t tSymbol = 0;
+    uint32_t radioWakeUpTime;
+
+    rxConfigParams->Datarate = datarate;
+    rxConfigParams->Bandwidth = GetBandwidth( plan, datarate );
+
+    if( datarate == plan->FskDatarate )
+    { // FSK
+        tSymbol = RegionCommonComputeSymbolTimeFsk( plan->Datarates[datarate] );
+    }
+    else
+    { // LoRa
+        tSymbol = RegionCommonComputeSymbolTimeLoRa( plan->Datarates[datarate], plan->Bandwidths[datarate] );
+    }
+
+    radioWakeUpTime = Radio.GetWakeupTime( );
+    RegionCommonComputeRxWindowParameters( tSymbol, minRxSymbols, rxError, radioWakeUpTime, &rxConfigParams->WindowTimeout, &rxConfigParams->WindowOffset, &rxConfigParams->WindowOffsetUs );
+}
+
+bool RegionDynamicRxConfig( const RegionDynamicPlan_t* plan, RxConfigParams_t* rxConfig, int8_t* datarate )
+{
+    RadioModems_t modem;
+    int8_t dr = rxConfig->Datarate;
+    uint8_t maxPayload = 0;
+    int8_t phyDr = 0;
+    uint32_t frequency = rxConfig->Frequency;
+    ChannelParams_t* channel = &plan->Channels[rxConfig->Channel];
+
+    if( Radio.GetStatus( ) != RF_IDLE )
+    {
+        return false;
+    }
+
+    if( rxConfig->RxSlot == RX_SLOT_WIN_1 )
+    {
+        // Apply window 1 frequency
+        frequency = channel->Frequency;
+        // Apply the alternative RX 1 window frequency, if it is available
+        if( channel->Rx1Frequency != 0 )
+        {
+            frequency = channel->Rx1Frequency;
+        }
+    }
+
+    // Read the physical datarate from the datarates table
+    phyDr = plan->Datarates[dr];
+
+    Radio.SetChannel( frequency );
+
+    // Radio configuration
+    if( dr == plan->FskDatarate )
+    {
+        modem = MODEM_FSK;
+        Radio.SetRxConfig( modem, 50000, phyDr * 1000, 0, 83333, 5, rxConfig->WindowTimeout, false, 0, true, 0, 0, false, rxConfig->RxContinuous );
+    }
+    else
+    {
+        modem = MODEM_LORA;
+        Radio.SetRxConfig( modem, rxConfig->Bandwidth, phyDr, 1, 0, 8, rxConfig->WindowTimeout, false, 0, false, 0, 0, true, rxConfig->RxContinuous );
+    }
+
+    // The downlinks are not limited by the uplink dwell time
+    if( rxConfig->RepeaterSupport == true )
+    {
+        maxPayload = plan->MaxPayloadRepeater[dr];
+    }
+    else
+    {
+        maxPayload = plan->MaxPayload[dr];
+    }
+
+    Radio.SetMaxPayloadLength( modem, maxPayload + LORA_MAC_FRMPAYLOAD_OVERHEAD );
+    LOG_PRINTF(LL_DEBUG, "RX on freq %u Hz at DR %d\n\r", (unsigned int)frequency, dr);
+
+    *datarate = (uint8_t) dr;
+    return true;
+}
+
+bool RegionDynamicTxConfig( const RegionDynamicPlan_t* plan, TxConfigParams_t* txConfig, int8_t* txPower, TimerTime_t* txTimeOnAir )
+{
+    RadioModems_t modem;
+    ChannelParams_t* channel = &plan->Channels[txConfig->Channel];
+    int8_t phyDr = plan->Datarates[txConfig->Datarate];
+    int8_t txPowerLimited = LimitTxPower( txConfig->TxPower, plan->Bands[channel->Band].TxMaxPower );
+    uint32_t bandwidth = GetBandwidth( plan, txConfig->Datarate );
+    float maxEirp = txConfig->MaxEirp;
+    int8_t phyTxPower = 0;
+
+    // The value of txConfig->MaxEirp could have changed during runtime, e.g.
+    // due to a MAC command, the lower one applies
+    if( plan->MaxEirpLowBelow != 0 )
+    {
+        maxEirp = MIN( maxEirp, ( channel->Frequency < plan->MaxEirpLowBelow ) ? plan->MaxEirpLow : plan->DefaultMaxEirp );
+    }
+
+    // Calculate physical TX power
+    phyTxPower = RegionCommonComputeTxPower( txPowerLimited, maxEirp, txConfig->AntennaGain );
+
+    // Setup the radio frequency
+    Radio.SetChannel( channel->Frequency );
+
+    if( txConfig->Datarate == plan->FskDatarate )
+    { // High Speed FSK channel
+        modem = MODEM_FSK;
+        Radio.SetTxConfig( modem, phyTxPower, 25000, bandwidth, phyDr * 1000, 0, 5, false, true, 0, 0, false, plan->TxTimeout );
+    }
+    else
+    {
+        modem = MODEM_LORA;
+        Radio.SetTxConfig( modem, phyTxPower, 0, bandwidth, phyDr, 1, 8, false, true, 0, 0, false, plan->TxTimeout );
+    }
+    LOG_PRINTF(LL_DEBUG, "TX on freq %u Hz at DR %d\n\r", (unsigned int)channel->Frequency, txConfig->Datarate);
+    // Setup maximum payload lenght of the radio driver
+    Radio.SetMaxPayloadLength( modem, txConfig->PktLen );
+    // Get the time-on-air of the next tx frame
+    *txTimeOnAir = Radio.TimeOnAir( modem,  txConfig->PktLen );
+
+    *txPower = txPowerLimited;
+    return true;
+}
+
+uint8_t RegionDynamicLinkAdrReq( const RegionDynamicPlan_t* plan, LinkAdrReqParams_t* linkAdrReq, int8_t* drOut, int8_t* txPowOut, uint8_t* nbRepOut, uint8_t* nbBytesParsed )
+{
+    uint8_t status = 0x07;
+    LinkAdrParams_t linkAdrParams;
+    uint8_t nextIndex = 0;
+    uint8_t bytesProcessed = 0;
+    uint16_t chMask = 0;
+    uint16_t definedChannels = 0;
+
+    // Channels defined, the mask of the requests is checked against it
+    for( uint8_t i = 0; i < plan->MaxNbChannels; i++ )
+    {
+        if( plan->Channels[i].Frequency != 0 )
+        {
+            definedChannels |= 1 << i;
+        }
+    }
+
+    while( bytesProcessed < linkAdrReq->PayloadSize )
+    {
+        // Get ADR request parameters
+        nextIndex = RegionCommonParseLinkAdrReq( &( linkAdrReq->Payload[bytesProcessed] ), &linkAdrParams );
+
+        if( nextIndex == 0 )
+            break; // break loop, since no more request has been found
+
+        // Update bytes processed
+        bytesProcessed += nextIndex;
+
+        // Setup temporary channels mask
+        chMask = linkAdrParams.ChMask;
+
+        // Verify channels mask
+        if( ( ( linkAdrParams.ChMaskCtrl >= 1 ) && ( linkAdrParams.ChMaskCtrl <= 5 )) ||
+                ( linkAdrParams.ChMaskCtrl >= 7 ) )
+        {
+            // RFU
+            status &= 0xFE; // Channel mask KO
+        }
+        else if( linkAdrParams.ChMaskCtrl == 6 )
+        {
+            // Enable all defined channels
+            chMask |= definedChannels;
+        }
+        else if( ( chMask & ~definedChannels ) != 0 )
+        {
+            // Trying to enable an undefined channel
+            status &= 0xFE; // Channel mask KO
+        }
+    }
+
+    // The mask the block ends with must enable a channel
+    if( chMask == 0 )
+    {
+        status &= 0xFE; // Channel mask KO
+    }
+
+    // Verify datarate
+    if( RegionCommonChanVerifyDr( plan->MaxNbChannels, &chMask, linkAdrParams.Datarate, plan->TxMinDatarate, plan->TxMaxDatarate, plan->Channels ) == false )
+    {
+        status &= 0xFD; // Datarate KO
+    }
+
+    // Verify tx power
+    if( RegionCommonValueInRange( linkAdrParams.TxPower, plan->MaxTxPower, plan->MinTxPower ) == 0 )
+    {
+        // Verify if the maximum TX power is exceeded
+        if( plan->MaxTxPower > linkAdrParams.TxPower )
+        { // Apply maximum TX power. Accept TX power.
+            linkAdrParams.TxPower = plan->MaxTxPower;
+        }
+        else
+        {
+            status &= 0xFB; // TxPower KO
+        }
+    }
+
+    // Update channelsMask if everything is correct
+    if( status == 0x07 )
+    {
+        if( linkAdrParams.NbRep == 0 )
+        { // Value of 0 is not allowed, revert to default.
+            linkAdrParams.NbRep = 1;
+        }
+
+        // Update the channels mask
+        plan->ChannelsMask[0] = chMask;
+    }
+
+    // Update status variables
+    *drOut = linkAdrParams.Datarate;
+    *txPowOut = linkAdrParams.TxPower;
+    *nbRepOut = linkAdrParams.NbRep;
+    *nbBytesParsed = bytesProcessed;
+
+    return status;
+}
+
+uint8_t RegionDynamicRxParamSetupReq( const RegionDynamicPlan_t* plan, RxParamSetupReqParams_t* rxParamSetupReq )
+{
+    uint8_t status = 0x07;
+
+    // Verify radio frequency
+    if( Radio.CheckRfFrequency( rxParamSetupReq->Frequency ) == false )
+    {
+        status &= 0xFE; // Channel frequency KO
+    }
+
+    // Verify datarate
+    if( RegionCommonValueInRange( rxParamSetupReq->Datarate, plan->RxMinDatarate, plan->RxMaxDatarate ) == false )
+    {
+        status &= 0xFD; // Datarate KO
+    }
+
+    // Verify datarate offset
+    if( RegionCommonValueInRange( rxParamSetupReq->DrOffset, plan->MinRx1DrOffset, plan->MaxRx1DrOffset ) == false )
+    {
+        status &= 0xFB; // Rx1DrOffset range KO
+    }
+
+    return status;
+}
+
+uint8_t RegionDynamicNewChannelReq( const RegionDynamicPlan_t* plan, NewChannelReqParams_t* newChannelReq )
+{
+    uint8_t status = 0x03;
+    ChannelAddParams_t channelAdd;
+    ChannelRemoveParams_t channelRemove;
+
+    if( newChannelReq->NewChannel->Frequency == 0 )
+    {
+        channelRemove.ChannelId = newChannelReq->ChannelId;
+
+        // Remove
+        if( RegionDynamicChannelsRemove( plan, &channelRemove ) == false )
+        {
+            status &= 0xFC;
+        }
+    }
+    else
+    {
+        channelAdd.NewChannel = newChannelReq->NewChannel;
+        channelAdd.ChannelId = newChannelReq->ChannelId;
+
+        switch( RegionDynamicChannelAdd( plan, &channelAdd ) )
+        {
+            case LORAMAC_STATUS_OK:
+            {
+                break;
+            }
+            case LORAMAC_STATUS_FREQUENCY_INVALID:
+            {
+                status &= 0xFE;
+                break;
+            }
+            case LORAMAC_STATUS_DATARATE_INVALID:
+            {
+                status &= 0xFD;
+                break;
+            }
+            case LORAMAC_STATUS_FREQ_AND_DR_INVALID:
+            {
+                status &= 0xFC;
+                break;
+            }
+            default:
+            {
+                status &= 0xFC;
+                break;
+            }
+        }
+    }
+
+    return status;
+}
+
+int8_t RegionDynamicTxParamSetupReq( const RegionDynamicPlan_t* plan, TxParamSetupReqParams_t* txParamSetupReq )
+{
+    // Only the regions with a dwell time limit accept the request
+    return ( plan->MaxPayloadDwell1 != NULL ) ? 0 : -1;
+}
+
+uint8_t RegionDynamicDlChannelReq( const RegionDynamicPlan_t* plan, DlChannelReqParams_t* dlChannelReq )
+{
+    uint8_t status = 0x03;
+    uint8_t band = 0;
+
+    // Verify if the frequency is supported
+    if( VerifyTxFreq( plan, dlChannelReq->Rx1Frequency, &band ) == false )
+    {
+        status &= 0xFE;
+    }
+
+    // Verify if an uplink frequency exists
+    if( plan->Channels[dlChannelReq->ChannelId].Frequency == 0 )
+    {
+        status &= 0xFD;
+    }
+
+    // Apply Rx1 frequency, if the status is OK
+    if( status == 0x03 )
+    {
+        plan->Channels[dlChannelReq->ChannelId].Rx1Frequency = dlChannelReq->Rx1Frequency;
+    }
+
+    return status;
+}
+
+int8_t RegionDynamicAlternateDr( const RegionDynamicPlan_t* plan, AlternateDrParams_t* alternateDr )
+{
+    int8_t datarate = 0;
+
+    if( plan->JoinDatarate != REGION_DYNAMIC_DR_NONE )
+    {
+        return plan->JoinDatarate;
+    }
+
+    if( ( alternateDr->NbTrials % 48 ) == 0 )
+    {
+        datarate = DR_0;
+    }
+    else if( ( alternateDr->NbTrials % 32 ) == 0 )
+    {
+        datarate = DR_1;
+    }
+    else if( ( alternateDr->NbTrials % 24 ) == 0 )
+    {
+        datarate = DR_2;
+    }
+    else if( ( alternateDr->NbTrials % 16 ) == 0 )
+    {
+        datarate = DR_3;
+    }
+    else if( ( alternateDr->NbTrials % 8 ) == 0 )
+    {
+        datarate = DR_4;
+    }
+    else
+    {
+        datarate = DR_5;
+    }
+    return datarate;
+}
+
+void RegionDynamicCalcBackOff( const RegionDynamicPlan_t* plan, CalcBackOffParams_t* calcBackOff )
+{
+    Band_t* band = &plan->Bands[plan->Channels[calcBackOff->Channel].Band];
+    uint16_t dutyCycle = band->DCycle;
+    uint16_t joinDutyCycle = 0;
+
+    // Reset time-off to initial value.
+    band->TimeOff = 0;
+
+    if( calcBackOff->Joined == false )
+    {
+        // Get the join duty cycle
+        joinDutyCycle = RegionCommonGetJoinDc( calcBackOff->ElapsedTime );
+        // Apply the most restricting duty cycle
+        dutyCycle = MAX( dutyCycle, joinDutyCycle );
+        // Apply band time-off.
+        band->TimeOff = calcBackOff->TxTimeOnAir * dutyCycle - calcBackOff->TxTimeOnAir;
+    }
+    else
+    {
+        if( calcBackOff->DutyCycleEnabled == true )
+        {
+            band->TimeOff = calcBackOff->TxTimeOnAir * dutyCycle - calcBackOff->TxTimeOnAir;
+        }
+    }
+}
+
+bool RegionDynamicNextChannel( const RegionDynamicPlan_t* plan, NextChanParams_t* nextChanParams, uint8_t* channel, TimerTime_t* time, TimerTime_t* aggregatedTimeOff )
+{
+    uint8_t nbEnabledChannels = 0;
+    uint8_t delayTx = 0;
+    uint8_t enabledChannels[REGION_DYNAMIC_MAX_NB_CHANNELS] = { 0 };
+    TimerTime_t nextTxDelay = 0;
+
+    if( RegionCommonCountChannels( plan->ChannelsMask, 0, 1 ) == 0 )
+    { // Reactivate default channels
+        plan->ChannelsMask[0] |= DEFAULT_CHANNELS_MASK( plan );
+    }
+
+    if( nextChanParams->AggrTimeOff <= TimerGetElapsedTime( nextChanParams->LastAggrTx ) )
+    {
+        // Reset Aggregated time off
+        *aggregatedTimeOff = 0;
+
+        // Update bands Time OFF
+        nextTxDelay = RegionCommonUpdateBandTimeOff( nextChanParams->Joined, nextChanParams->DutyCycleEnabled, plan->Bands, plan->MaxNbBands );
+
+        // Search how many channels are enabled
+        nbEnabledChannels = CountNbOfEnabledChannels( plan, nextChanParams->Joined, nextChanParams->Datarate,
+                                                      enabledChannels, &delayTx );
+    }
+    else
+    {
+        delayTx++;
+        nextTxDelay = nextChanParams->AggrTimeOff - TimerGetElapsedTime( nextChanParams->LastAggrTx );
+    }
+
+    if( nbEnabledChannels > 0 )
+    {
+        if( plan->CarrierSenseTime == 0 )
+        {
+            // We found a valid channel
+#ifdef CONFIG_LORAMAC_CHANNEL_QUALITY
+            *channel = enabledChannels[RegionCommonChannelQualityPick( enabledChannels, nbEnabledChannels )];
+#else
+            *channel = enabledChannels[randr( 0, nbEnabledChannels - 1 )];
+#endif
+
+            *time = 0;
+            return true;
+        }
+
+#ifdef CONFIG_LORAMAC_CHANNEL_QUALITY
+        // The weighted pick is sensed first, the next ones in order
+        for( uint8_t i = 0, j = RegionCommonChannelQualityPick( enabledChannels, nbEnabledChannels ); i < plan->MaxNbChannels; i++ )
+#else
+        for( uint8_t i = 0, j = randr( 0, nbEnabledChannels - 1 ); i < plan->MaxNbChannels; i++ )
+#endif
+        {
+            uint8_t channelNext = enabledChannels[j];
+
+            j = ( j + 1 ) % nbEnabledChannels;
+
+#ifdef CONFIG_LORA_LBT_ASYNC
+            // The MAC senses the channel without blocking right before the TX
+            *channel = channelNext;
+            *time = 0;
+            return true;
+#else
+            // Perform carrier sense for CarrierSenseTime
+            // If the channel is free, we can stop the LBT mechanism
+            if( Radio.IsChannelFree( MODEM_LORA, plan->Channels[channelNext].Frequency, plan->RssiFreeTh, plan->CarrierSenseTime ) == true )
+            {
+                // Free channel found
+                *channel = channelNext;
+                *time = 0;
+                return true;
+            }
+#endif
+        }
+        return false;
+    }
+    else
+    {
+        if( delayTx > 0 )
+        {
+            // Delay transmission due to AggregatedTimeOff or to a band time off
+            *time = nextTxDelay;
+            return true;
+        }
+        // Datarate not supported by any channel, restore defaults
+        plan->ChannelsMask[0] |= DEFAULT_CHANNELS_MASK( plan );
+        *time = 0;
+        return false;
+    }
+}
+
+LoRaMacStatus_t RegionDynamicChannelAdd( const RegionDynamicPlan_t* plan, ChannelAddParams_t* channelAdd )
+{
+    uint8_t band = 0;
+    bool drInvalid = false;
+    bool freqInvalid = false;
+    uint8_t id = channelAdd->ChannelId;
+
+    if( id >= plan->MaxNbChannels )
+    {
+        return LORAMAC_STATUS_PARAMETER_INVALID;
+    }
+
+    // Validate the datarate range
+    if( RegionCommonValueInRange( channelAdd->NewChannel->DrRange.Fields.Min, plan->TxMinDatarate, plan->TxMaxDatarate ) == false )
+    {
+        drInvalid = true;
+    }
+    if( RegionCommonValueInRange( channelAdd->NewChannel->DrRange.Fields.Max, plan->TxMinDatarate, plan->TxMaxDatarate ) == false )
+    {
+        drInvalid = true;
+    }
+    if( channelAdd->NewChannel->DrRange.Fields.Min > channelAdd->NewChannel->DrRange.Fields.Max )
+    {
+        drInvalid = true;
+    }
+
+    // Default channels don't accept all values
+    if( id < plan->NbDefaultChannels )
+    {
+        if( plan->DefaultChannelsDrCheck == true )
+        {
+            // Validate the datarate range for min: must be DR_0
+            if( channelAdd->NewChannel->DrRange.Fields.Min > DR_0 )
+            {
+                drInvalid = true;
+            }
+            // Validate the datarate range for max: must be DR_5 <= Max <= TX_MAX_DATARATE
+            if( RegionCommonValueInRange( channelAdd->NewChannel->DrRange.Fields.Max, DR_5, plan->TxMaxDatarate ) == false )
+            {
+                drInvalid = true;
+            }
+        }
+        // We are not allowed to change the frequency
+        if( channelAdd->NewChannel->Frequency != plan->Channels[id].Frequency )
+        {
+            freqInvalid = true;
+        }
+    }
+
+    // Check frequency
+    if( freqInvalid == false )
+    {
+        if( VerifyTxFreq( plan, channelAdd->NewChannel->Frequency, &band ) == false )
+        {
+            freqInvalid = true;
+        }
+    }
+
+    // Check status
+    if( ( drInvalid == true ) && ( freqInvalid == true ) )
+    {
+        return LORAMAC_STATUS_FREQ_AND_DR_INVALID;
+    }
+    if( drInvalid == true )
+    {
+        return LORAMAC_STATUS_DATARATE_INVALID;
+    }
+    if( freqInvalid == true )
+    {
+        return LORAMAC_STATUS_FREQUENCY_INVALID;
+    }
+
+    memcpy( &( plan->Channels[id] ), channelAdd->NewChannel, sizeof( plan->Channels[id] ) );
+    plan->Channels[id].Band = band;
+    plan->ChannelsMask[0] |= ( 1 << id );
+    return LORAMAC_STATUS_OK;
+}
+
+bool RegionDynamicChannelsRemove( const RegionDynamicPlan_t* plan, ChannelRemoveParams_t* channelRemove )
+{
+    uint8_t id = channelRemove->ChannelId;
+
+    if( id < plan->NbDefaultChannels )
+    {
+        return false;
+    }
+
+    // Remove the channel from the list of channels
+    plan->Channels[id] = ( ChannelParams_t ){ 0, 0, { 0 }, 0 };
+
+    return RegionCommonChanDisable( plan->ChannelsMask, id, plan->MaxNbChannels );
+}
+
+void RegionDynamicSetContinuousWave( const RegionDynamicPlan_t* plan, ContinuousWaveParams_t* continuousWave )
+{
+    ChannelParams_t* channel = &plan->Channels[continuousWave->Channel];
+    int8_t txPowerLimited = LimitTxPower( continuousWave->TxPower, plan->Bands[channel->Band].TxMaxPower );
+    int8_t phyTxPower = 0;
+
+    // Calculate physical TX power
+    phyTxPower = RegionCommonComputeTxPower( txPowerLimited, continuousWave->MaxEirp, continuousWave->AntennaGain );
+
+    Radio.SetTxContinuousWave( channel->Frequency, phyTxPower, continuousWave->Timeout );
+}
+
+uint8_t RegionDynamicApplyDrOffset( const RegionDynamicPlan_t* plan, uint8_t downlinkDwellTime, int8_t dr, int8_t drOffset )
+{
+    int8_t datarate;
+
+    if( plan->EffectiveRx1DrOffset != NULL )
+    {
+        // Apply offset formula
+        return MIN( DR_5, MAX( GetMinRxDr( plan, ( downlinkDwellTime == 1 ) ? 1 : 0 ), dr - plan->EffectiveRx1DrOffset[drOffset] ) );
+    }
+
+    datarate = dr - drOffset;
+    if( datarate < 0 )
+    {
+        datarate = DR_0;
+    }
+    return datarate;
+}
+
+void RegionDynamicRxBeaconSetup( const RegionDynamicPlan_t* plan, RxBeaconSetup_t* rxBeaconSetup, uint8_t* outDr )
+{
+    RegionCommonRxBeaconSetupParams_t regionCommonRxBeaconSetup;
+
+    regionCommonRxBeaconSetup.Datarates = plan->Datarates;
+    regionCommonRxBeaconSetup.Frequency = rxBeaconSetup->Frequency;
+    regionCommonRxBeaconSetup.BeaconSize = plan->BeaconSize;
+    regionCommonRxBeaconSetup.BeaconDatarate = plan->BeaconDatarate;
+    regionCommonRxBeaconSetup.BeaconChannelBW = plan->BeaconBandwidth;
+    regionCommonRxBeaconSetup.RxTime = rxBeaconSetup->RxTime;
+    regionCommonRxBeaconSetup.SymbolTimeout = rxBeaconSetup->SymbolTimeout;
+
+    RegionCommonRxBeaconSetup( &regionCommonRxBeaconSetup );
+
+    // Store downlink datarate
+    *outDr = plan->BeaconDatarate;
+}
@@ -0,0 +1,437 @@
+/*!
+ * \file      RegionDynamic.h
+ *
+ * \brief     Engine of the dynamic channel plan regions
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \defgroup  REGIONDYNAMIC Dynamic channel plan engine
+ *            EU868, EU433, CN779, IN865, KR920 and AS923 share one
+ *            implementation: up to 16 channels defined by the network in
+ *            a single mask word, default channels which cannot be removed,
+ *            and a CF list of 5 frequencies. Each region describes its
+ *            tables and limits in a constant \ref RegionDynamicPlan_t kept
+ *            in flash, and its Region<XX>* functions forward to the
+ *            RegionDynamic* ones with it.
+ * \{
+ */
+#ifndef __REGIONDYNAMIC_H__
+#define __REGIONDYNAMIC_H__
+
+/*!
+ * Datarate not used by the plan
+ */
+#define REGION_DYNAMIC_DR_NONE                      ( -1 )
+
+/*!
+ * Frequency range of a band, bounds included
+ */
+typedef struct sRegionDynamicBandRange
+{
+    uint32_t Min;
+    uint32_t Max;
+    uint8_t Band;
+}RegionDynamicBandRange_t;
+
+/*!
+ * Description of a dynamic channel plan region
+ */
+typedef struct sRegionDynamicPlan
+{
+    /*!
+     * Channels, bands and masks of the region, in RAM
+     */
+    ChannelParams_t* Channels;
+    Band_t* Bands;
+    uint16_t* ChannelsMask;
+    uint16_t* ChannelsDefaultMask;
+    /*!
+     * Default channels, the first channels of the plan
+     */
+    const ChannelParams_t* DefaultChannels;
+    uint8_t NbDefaultChannels;
+    uint8_t MaxNbChannels;
+    uint8_t MaxNbBands;
+    uint8_t NbCfListChannels;
+    /*!
+     * Channels allowed for the join requests
+     */
+    uint16_t JoinChannels;
+    /*!
+     * Uplink frequency ranges and the band of each one
+     */
+    const RegionDynamicBandRange_t* BandRanges;
+    uint8_t NbBandRanges;
+    /*!
+     * Channel grid from the start of the range, 0 when any frequency is allowed
+     */
+    uint32_t FrequencyStep;
+    /*!
+     * Spreading factors or FSK kbps, bandwidths and maximum payloads per datarate
+     */
+    const uint8_t* Datarates;
+    const uint32_t* Bandwidths;
+    const uint8_t* MaxPayload;
+    const uint8_t* MaxPayloadRepeater;
+    /*!
+     * Maximum uplink payloads with the dwell time limit, NULL when the
+     * region has no dwell time limit
+     */
+    const uint8_t* MaxPayloadDwell1;
+    /*!
+     * RX1 datarate offsets, NULL when the offset is subtracted as is
+     */
+    const int8_t* EffectiveRx1DrOffset;
+    int8_t TxMinDatarate;
+    int8_t TxMaxDatarate;
+    int8_t RxMinDatarate;
+    int8_t RxMaxDatarate;
+    int8_t DefaultDatarate;
+    /*!
+     * Lowest datarate with the dwell time limit, or REGION_DYNAMIC_DR_NONE
+     */
+    int8_t DwellLimitDatarate;
+    /*!
+     * FSK datarate, or REGION_DYNAMIC_DR_NONE
+     */
+    int8_t FskDatarate;
+    /*!
+     * Reserved datarate skipped when lowering the datarate, or REGION_DYNAMIC_DR_NONE
+     */
+    int8_t RfuDatarate;
+    /*!
+     * Datarate of the join requests, REGION_DYNAMIC_DR_NONE alternates
+     * from DR_5 down to DR_0 with the trials
+     */
+    int8_t JoinDatarate;
+    int8_t MinTxPower;
+    int8_t MaxTxPower;
+    int8_t DefaultTxPower;
+    uint8_t MinRx1DrOffset;
+    uint8_t MaxRx1DrOffset;
+    uint8_t DefaultRx1DrOffset;
+    uint8_t DefaultUplinkDwellTime;
+    uint8_t DefaultDownlinkDwellTime;
+    bool DutyCycleEnabled;
+    /*!
+     * The default channels accept only DR_0 to DR_5 or more
+     */
+    bool DefaultChannelsDrCheck;
+    /*!
+     * Default and minimum number of join trials
+     */
+    uint8_t NbJoinTrials;
+    uint8_t MinNbJoinTrials;
+    uint16_t AdrAckLimit;
+    uint16_t AdrAckDelay;
+    uint32_t MaxRxWindow;
+    uint32_t ReceiveDelay1;
+    uint32_t ReceiveDelay2;
+    uint32_t JoinAcceptDelay1;
+    uint32_t JoinAcceptDelay2;
+    uint32_t MaxFCntGap;
+    uint32_t AckTimeout;
+    uint32_t AckTimeoutRnd;
+    uint32_t Rx2Frequency;
+    int8_t Rx2Datarate;
+    float DefaultMaxEirp;
+    float DefaultAntennaGain;
+    /*!
+     * Lower maximum EIRP of the channels below MaxEirpLowBelow, 0 when the
+     * EIRP does not depend on the frequency
+     */
+    uint32_t MaxEirpLowBelow;
+    float MaxEirpLow;
+    /*!
+     * Radio TX timeout [ms]
+     */
+    uint32_t TxTimeout;
+    /*!
+     * Listen before talk, 0 without it [ms]
+     */
+    uint32_t CarrierSenseTime;
+    int16_t RssiFreeTh;
+    uint32_t BeaconFrequency;
+    int8_t BeaconDatarate;
+    uint8_t BeaconSize;
+    uint8_t BeaconRfu1Size;
+    uint8_t BeaconRfu2Size;
+    uint32_t BeaconBandwidth;
+}RegionDynamicPlan_t;
+
+/*!
+ * \brief The function gets a value of a specific phy attribute.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] getPhy Pointer to the function parameters.
+ *
+ * \retval Returns a structure containing the PHY parameter.
+ */
+PhyParam_t RegionDynamicGetPhyParam( const RegionDynamicPlan_t* plan, GetPhyParams_t* getPhy );
+
+/*!
+ * \brief Updates the last TX done parameters of the current channel.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] txDone Pointer to the function parameters.
+ */
+void RegionDynamicSetBandTxDone( const RegionDynamicPlan_t* plan, SetBandTxDoneParams_t* txDone );
+
+/*!
+ * \brief Initializes the channels masks and the channels.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] type Sets the initialization type.
+ */
+void RegionDynamicInitDefaults( const RegionDynamicPlan_t* plan, InitType_t type );
+
+/*!
+ * \brief Verifies a parameter.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] verify Pointer to the function parameters.
+ *
+ * \param [IN] phyAttribute Sets the initialization type.
+ *
+ * \retval Returns true, if the parameter is valid.
+ */
+bool RegionDynamicVerify( const RegionDynamicPlan_t* plan, VerifyParams_t* verify, PhyAttribute_t phyAttribute );
+
+/*!
+ * \brief Applies the CF list of a join accept.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] applyCFList Pointer to the function parameters.
+ */
+void RegionDynamicApplyCFList( const RegionDynamicPlan_t* plan, ApplyCFListParams_t* applyCFList );
+
+/*!
+ * \brief Sets a channels mask.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] chanMaskSet Pointer to the function parameters.
+ *
+ * \retval Returns true, if the channels mask could be set.
+ */
+bool RegionDynamicChanMaskSet( const RegionDynamicPlan_t* plan, ChanMaskSetParams_t* chanMaskSet );
+
+/*!
+ * \brief Calculates the next datarate to set, when ADR is on or off.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] adrNext Pointer to the function parameters.
+ *
+ * \param [OUT] drOut The calculated datarate for the next TX.
+ *
+ * \param [OUT] txPowOut The TX power for the next TX.
+ *
+ * \param [OUT] adrAckCounter The calculated ADR acknowledgement counter.
+ *
+ * \retval Returns true, if an ADR request should be performed.
+ */
+bool RegionDynamicAdrNext( const RegionDynamicPlan_t* plan, AdrNextParams_t* adrNext, int8_t* drOut, int8_t* txPowOut, uint32_t* adrAckCounter );
+
+/*!
+ * \brief Computes the RX window timeout and offset.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] datarate The RX window datarate index to be used.
+ *
+ * \param [IN] minRxSymbols The minimum required number of symbols to detect an RX frame.
+ *
+ * \param [IN] rxError System maximum timing error of the receiver [ms].
+ *
+ * \param [OUT] rxConfigParams Updated WindowTimeout and WindowOffset fields.
+ */
+void RegionDynamicComputeRxWindowParameters( const RegionDynamicPlan_t* plan, int8_t datarate, uint8_t minRxSymbols, uint32_t rxError, RxConfigParams_t *rxConfigParams );
+
+/*!
+ * \brief Configuration of the RX windows.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] rxConfig Pointer to the function parameters.
+ *
+ * \param [OUT] datarate The datarate index which was set.
+ *
+ * \retval Returns true, if the configuration was applied successfully.
+ */
+bool RegionDynamicRxConfig( const RegionDynamicPlan_t* plan, RxConfigParams_t* rxConfig, int8_t* datarate );
+
+/*!
+ * \brief TX configuration.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] txConfig Pointer to the function parameters.
+ *
+ * \param [OUT] txPower The tx power index which was set.
+ *
+ * \param [OUT] txTimeOnAir The time-on-air of the frame.
+ *
+ * \retval Returns true, if the configuration was applied successfully.
+ */
+bool RegionDynamicTxConfig( const RegionDynamicPlan_t* plan, TxConfigParams_t* txConfig, int8_t* txPower, TimerTime_t* txTimeOnAir );
+
+/*!
+ * \brief The function processes a Link ADR Request.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] linkAdrReq Pointer to the function parameters.
+ *
+ * \retval Returns the status of the operation, according to the LoRaMAC specification.
+ */
+uint8_t RegionDynamicLinkAdrReq( const RegionDynamicPlan_t* plan, LinkAdrReqParams_t* linkAdrReq, int8_t* drOut, int8_t* txPowOut, uint8_t* nbRepOut, uint8_t* nbBytesParsed );
+
+/*!
+ * \brief The function processes a RX Parameter Setup Request.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] rxParamSetupReq Pointer to the function parameters.
+ *
+ * \retval Returns the status of the operation, according to the LoRaMAC specification.
+ */
+uint8_t RegionDynamicRxParamSetupReq( const RegionDynamicPlan_t* plan, RxParamSetupReqParams_t* rxParamSetupReq );
+
+/*!
+ * \brief The function processes a New Channel Request.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] newChannelReq Pointer to the function parameters.
+ *
+ * \retval Returns the status of the operation, according to the LoRaMAC specification.
+ */
+uint8_t RegionDynamicNewChannelReq( const RegionDynamicPlan_t* plan, NewChannelReqParams_t* newChannelReq );
+
+/*!
+ * \brief The function processes a TX ParamSetup Request.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] txParamSetupReq Pointer to the function parameters.
+ *
+ * \retval Returns the status of the operation, according to the LoRaMAC specification.
+ *         Returns -1, if the functionality is not implemented. In this case, the end node
+ *         shall not process the command.
+ */
+int8_t RegionDynamicTxParamSetupReq( const RegionDynamicPlan_t* plan, TxParamSetupReqParams_t* txParamSetupReq );
+
+/*!
+ * \brief The function processes a DlChannel Request.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] dlChannelReq Pointer to the function parameters.
+ *
+ * \retval Returns the status of the operation, according to the LoRaMAC specification.
+ */
+uint8_t RegionDynamicDlChannelReq( const RegionDynamicPlan_t* plan, DlChannelReqParams_t* dlChannelReq );
+
+/*!
+ * \brief Alternates the datarate of the channel for the join request.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] alternateDr Pointer to the function parameters.
+ *
+ * \retval Datarate to apply.
+ */
+int8_t RegionDynamicAlternateDr( const RegionDynamicPlan_t* plan, AlternateDrParams_t* alternateDr );
+
+/*!
+ * \brief Calculates the back-off time.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] calcBackOff Pointer to the function parameters.
+ */
+void RegionDynamicCalcBackOff( const RegionDynamicPlan_t* plan, CalcBackOffParams_t* calcBackOff );
+
+/*!
+ * \brief Searches and set the next random available channel, listening
+ *        before talking when the region requires it.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [OUT] channel Next channel to use for TX.
+ *
+ * \param [OUT] time Time to wait for the next transmission according to the duty
+ *              cycle.
+ *
+ * \param [OUT] aggregatedTimeOff Updates the aggregated time off.
+ *
+ * \retval Function status [1: OK, 0: Unable to find a channel on the current datarate]
+ */
+bool RegionDynamicNextChannel( const RegionDynamicPlan_t* plan, NextChanParams_t* nextChanParams, uint8_t* channel, TimerTime_t* time, TimerTime_t* aggregatedTimeOff );
+
+/*!
+ * \brief Adds a channel.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] channelAdd Pointer to the function parameters.
+ *
+ * \retval Status of the operation.
+ */
+LoRaMacStatus_t RegionDynamicChannelAdd( const RegionDynamicPlan_t* plan, ChannelAddParams_t* channelAdd );
+
+/*!
+ * \brief Removes a channel.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] channelRemove Pointer to the function parameters.
+ *
+ * \retval Returns true, if the channel was removed successfully.
+ */
+bool RegionDynamicChannelsRemove( const RegionDynamicPlan_t* plan, ChannelRemoveParams_t* channelRemove );
+
+/*!
+ * \brief Sets the radio into continuous wave mode.
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] continuousWave Pointer to the function parameters.
+ */
+void RegionDynamicSetContinuousWave( const RegionDynamicPlan_t* plan, ContinuousWaveParams_t* continuousWave );
+
+/*!
+ * \brief Computes new datarate according to the given offset
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] downlinkDwellTime Downlink dwell time configuration. 0: No limit, 1: 400ms
+ *
+ * \param [IN] dr Current datarate
+ *
+ * \param [IN] drOffset Offset to be applied
+ *
+ * \retval newDr Computed datarate.
+ */
+uint8_t RegionDynamicApplyDrOffset( const RegionDynamicPlan_t* plan, uint8_t downlinkDwellTime, int8_t dr, int8_t drOffset );
+
+/*!
+ * \brief Sets the radio into beacon reception mode
+ *
+ * \param [IN] plan Channel plan of the region.
+ *
+ * \param [IN] rxBeaconSetup Pointer to the function parameters
+ *
+ * \param [OUT] outDr Datarate of the beacon.
+ */
+void RegionDynamicRxBeaconSetup( const RegionDynamicPlan_t* plan, RxBeaconSetup_t* rxBeaconSetup, uint8_t* outDr );
+
+/*! \} defgroup REGIONDYNAMIC */
+
+#endif // __REGIONDYNAMIC_H__
@@ -21,6 +21,8 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jaeckle ( STACKFORCE )
 */
+#define LOG_MODULE LOG_MODULE_REGION
+
 #include <stdbool.h>
 #include <string.h>
 #include <stdint.h>
@@ -404,6 +406,20 @@ PhyParam_t RegionUS915HybridGetPhyParam( GetPhyParams_t* getPhy )
             phyParam.Value = US915_HYBRID_BEACON_NB_CHANNELS;
             break;
         }
+#ifdef CONFIG_LORAMAC_TX_TIME
+        case PHY_TX_TIME_ON_AIR:
+        {
+            phyParam.Value = RegionCommonComputeTxTimeOnAir( false, DataratesUS915_HYBRID[getPhy->Datarate], BandwidthsUS915_HYBRID[getPhy->Datarate], getPhy->PktLen );
+            break;
+        }
+#endif
+#ifdef CONFIG_LORAMAC_LINK_ADR
+        case PHY_DATARATE_SF:
+        {
+            phyParam.Value = ( BandwidthsUS915_HYBRID[getPhy->Datarate] == 125000 ) ? DataratesUS915_HYBRID[getPhy->Datarate] : 0;
+            break;
+        }
+#endif
         default:
         {
             break;
@@ -618,7 +634,7 @@ bool RegionUS915HybridAdrNext( AdrNextParams_t* adrNext, int8_t* drOut, int8_t*
 
 void RegionUS915HybridComputeRxWindowParameters( int8_t datarate, uint8_t minRxSymbols, uint32_t rxError, RxConfigParams_t *rxConfigParams )
 {
-    double tSymbol = 0.0;
+    RegionSymbolTime_t tSymbol = 0;
     uint32_t radioWakeUpTime;
 
     rxConfigParams->Datarate = datarate;
@@ -634,7 +650,7 @@ void RegionUS915HybridComputeRxWindowParameters( int8_t datarate, uint8_t minRxS
     }
 
     radioWakeUpTime = Radio.GetWakeupTime( );
-    RegionCommonComputeRxWindowParameters( tSymbol, minRxSymbols, rxError, radioWakeUpTime, &rxConfigParams->WindowTimeout, &rxConfigParams->WindowOffset );
+    RegionCommonComputeRxWindowParameters( tSymbol, minRxSymbols, rxError, radioWakeUpTime, &rxConfigParams->WindowTimeout, &rxConfigParams->WindowOffset, &rxConfigParams->WindowOffsetUs );
 }
 
 bool RegionUS915HybridRxConfig( RxConfigParams_t* rxConfig, int8_t* datarate )
@@ -721,9 +737,6 @@ uint8_t RegionUS915HybridLinkAdrReq( LinkAdrReqParams_t* linkAdrReq, int8_t* drO
         // Update bytes processed
         bytesProcessed += nextIndex;
 
-        // Revert status, as we only check the last ADR request for the channel mask KO
-        status = 0x07;
-
         if( linkAdrParams.ChMaskCtrl == 6 )
         {
             // Enable all 125 kHz channels
@@ -943,7 +956,11 @@ bool RegionUS915HybridNextChannel( NextChanParams_t* nextChanParams, uint8_t* ch
     if( nbEnabledChannels > 0 )
     {
         // We found a valid channel
+#ifdef CONFIG_LORAMAC_CHANNEL_QUALITY
+        *channel = enabledChannels[RegionCommonChannelQualityPick( enabledChannels, nbEnabledChannels )];
+#else
         *channel = enabledChannels[randr( 0, nbEnabledChannels - 1 )];
+#endif
         // Disable the channel in the mask
         RegionCommonChanDisable( ChannelsMaskRemaining, *channel, US915_HYBRID_MAX_NB_CHANNELS - 8 );
 
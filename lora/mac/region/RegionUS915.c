@@ -21,6 +21,8 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jaeckle ( STACKFORCE )
 */
+#define LOG_MODULE LOG_MODULE_REGION
+
 #include <stdbool.h>
 #include <string.h>
 #include <stdint.h>
@@ -46,6 +48,13 @@ Maintainer: Miguel Luis ( Semtech ), Gregory Cristian ( Semtech ) and Daniel Jae
  */
 static ChannelParams_t Channels[US915_MAX_NB_CHANNELS];
 
+/*!
+ * Defined channels supporting each uplink datarate, rebuilt when the
+ * channels are initialized
+ */
+static uint32_t ChannelsSets[US915_TX_MAX_DATARATE + 1][REGION_COMMON_CHANNELS_SET_SIZE( US915_MAX_NB_CHANNELS )];
+static bool ChannelsSetsValid = false;
+
 /*!
  * LoRaMac bands
  */
@@ -70,6 +79,18 @@ static uint16_t ChannelsMaskRemaining[CHANNELS_MASK_SIZE];
 static uint16_t ChannelsDefaultMask[CHANNELS_MASK_SIZE];
 
 // Static functions
+static void ChannelsSetsUpdate( void )
+{
+    if( ChannelsSetsValid == false )
+    {
+        for( int8_t dr = 0; dr <= US915_TX_MAX_DATARATE; dr++ )
+        {
+            RegionCommonChannelsSetBuild( dr, Channels, US915_MAX_NB_CHANNELS, ChannelsSets[dr] );
+        }
+        ChannelsSetsValid = true;
+    }
+}
+
 static int8_t GetNextLowerTxDr( int8_t dr, int8_t minDr )
 {
     uint8_t nextLowerDr = 0;
@@ -120,40 +141,6 @@ static int8_t LimitTxPower( int8_t txPower, int8_t maxBandTxPower, int8_t datara
     return txPowerResult;
 }
 
-static uint8_t CountNbOfEnabledChannels( uint8_t datarate, uint16_t* channelsMask, ChannelParams_t* channels, Band_t* bands, uint8_t* enabledChannels, uint8_t* delayTx )
-{
-    uint8_t nbEnabledChannels = 0;
-    uint8_t delayTransmission = 0;
-
-    for( uint8_t i = 0, k = 0; i < US915_MAX_NB_CHANNELS; i += 16, k++ )
-    {
-        for( uint8_t j = 0; j < 16; j++ )
-        {
-            if( ( channelsMask[k] & ( 1 << j ) ) != 0 )
-            {
-                if( channels[i + j].Frequency == 0 )
-                { // Check if the channel is enabled
-                    continue;
-                }
-                if( RegionCommonValueInRange( datarate, channels[i + j].DrRange.Fields.Min,
-                                              channels[i + j].DrRange.Fields.Max ) == false )
-                { // Check if the current channel selection supports the given datarate
-                    continue;
-                }
-                if( bands[channels[i + j].Band].TimeOff > 0 )
-                { // Check if the band is available for transmission
-                    delayTransmission++;
-                    continue;
-                }
-                enabledChannels[nbEnabledChannels++] = i + j;
-            }
-        }
-    }
-
-    *delayTx = delayTransmission;
-    return nbEnabledChannels;
-}
-
 PhyParam_t RegionUS915GetPhyParam( GetPhyParams_t* getPhy )
 {
     PhyParam_t phyParam = { 0 };
@@ -316,6 +303,20 @@ PhyParam_t RegionUS915GetPhyParam( GetPhyParams_t* getPhy )
             phyParam.Value = US915_BEACON_NB_CHANNELS;
             break;
         }
+#ifdef CONFIG_LORAMAC_TX_TIME
+        case PHY_TX_TIME_ON_AIR:
+        {
+            phyParam.Value = RegionCommonComputeTxTimeOnAir( false, DataratesUS915[getPhy->Datarate], BandwidthsUS915[getPhy->Datarate], getPhy->PktLen );
+            break;
+        }
+#endif
+#ifdef CONFIG_LORAMAC_LINK_ADR
+        case PHY_DATARATE_SF:
+        {
+            phyParam.Value = ( BandwidthsUS915[getPhy->Datarate] == 125000 ) ? DataratesUS915[getPhy->Datarate] : 0;
+            break;
+        }
+#endif
         default:
         {
             break;
@@ -336,6 +337,8 @@ void RegionUS915InitDefaults( InitType_t type )
     {
         case INIT_TYPE_INIT:
         {
+            ChannelsSetsValid = false;
+
             // Channels
             // 125 kHz channels
             for( uint8_t i = 0; i < US915_MAX_NB_CHANNELS - 8; i++ )
@@ -531,7 +534,7 @@ bool RegionUS915AdrNext( AdrNextParams_t* adrNext, int8_t* drOut, int8_t* txPowO
 
 void RegionUS915ComputeRxWindowParameters( int8_t datarate, uint8_t minRxSymbols, uint32_t rxError, RxConfigParams_t *rxConfigParams )
 {
-    double tSymbol = 0.0;
+    RegionSymbolTime_t tSymbol = 0;
     uint32_t radioWakeUpTime;
 
     rxConfigParams->Datarate = datarate;
@@ -547,7 +550,7 @@ void RegionUS915ComputeRxWindowParameters( int8_t datarate, uint8_t minRxSymbols
     }
 
     radioWakeUpTime = Radio.GetWakeupTime( );
-    RegionCommonComputeRxWindowParameters( tSymbol, minRxSymbols, rxError, radioWakeUpTime, &rxConfigParams->WindowTimeout, &rxConfigParams->WindowOffset );
+    RegionCommonComputeRxWindowParameters( tSymbol, minRxSymbols, rxError, radioWakeUpTime, &rxConfigParams->WindowTimeout, &rxConfigParams->WindowOffset, &rxConfigParams->WindowOffsetUs );
 }
 
 bool RegionUS915RxConfig( RxConfigParams_t* rxConfig, int8_t* datarate )
@@ -634,9 +637,6 @@ uint8_t RegionUS915LinkAdrReq( LinkAdrReqParams_t* linkAdrReq, int8_t* drOut, in
         // Update bytes processed
         bytesProcessed += nextIndex;
 
-        // Revert status, as we only check the last ADR request for the channel mask KO
-        status = 0x07;
-
         if( linkAdrParams.ChMaskCtrl == 6 )
         {
             // Enable all 125 kHz channels
@@ -674,8 +674,10 @@ uint8_t RegionUS915LinkAdrReq( LinkAdrReqParams_t* linkAdrReq, int8_t* drOut, in
         status &= 0xFE; // Channel mask KO
     }
 
-    // Verify datarate
-    if( RegionCommonChanVerifyDr( US915_MAX_NB_CHANNELS, channelsMask, linkAdrParams.Datarate, US915_TX_MIN_DATARATE, US915_TX_MAX_DATARATE, Channels  ) == false )
+    // Verify datarate, an AND of the mask with the channels supporting it
+    ChannelsSetsUpdate( );
+    if( ( RegionCommonValueInRange( linkAdrParams.Datarate, US915_TX_MIN_DATARATE, US915_TX_MAX_DATARATE ) == 0 ) ||
+        ( RegionCommonChannelsSetVerify( ChannelsSets[linkAdrParams.Datarate], channelsMask, US915_MAX_NB_CHANNELS ) == false ) )
     {
         status &= 0xFD; // Datarate KO
     }
@@ -812,7 +814,6 @@ bool RegionUS915NextChannel( NextChanParams_t* nextChanParams, uint8_t* channel,
 {
     uint8_t nbEnabledChannels = 0;
     uint8_t delayTx = 0;
-    uint8_t enabledChannels[US915_MAX_NB_CHANNELS] = { 0 };
     TimerTime_t nextTxDelay = 0;
 
     // Count 125kHz channels
@@ -837,10 +838,15 @@ bool RegionUS915NextChannel( NextChanParams_t* nextChanParams, uint8_t* channel,
         // Update bands Time OFF
         nextTxDelay = RegionCommonUpdateBandTimeOff( nextChanParams->Joined, nextChanParams->DutyCycleEnabled, Bands, US915_MAX_NB_BANDS );
 
-        // Search how many channels are enabled
-        nbEnabledChannels = CountNbOfEnabledChannels( nextChanParams->Datarate,
-                                                      ChannelsMaskRemaining, Channels,
-                                                      Bands, enabledChannels, &delayTx );
+        ChannelsSetsUpdate( );
+
+        // Search how many channels are enabled, and pick one
+        if( RegionCommonValueInRange( nextChanParams->Datarate, 0, US915_TX_MAX_DATARATE ) == true )
+        {
+            nbEnabledChannels = RegionCommonChannelsSetSelect( ChannelsSets[nextChanParams->Datarate], ChannelsMaskRemaining,
+                                                               US915_MAX_NB_CHANNELS, Channels, Bands, US915_MAX_NB_BANDS,
+                                                               channel, &delayTx );
+        }
     }
     else
     {
@@ -851,7 +857,6 @@ bool RegionUS915NextChannel( NextChanParams_t* nextChanParams, uint8_t* channel,
     if( nbEnabledChannels > 0 )
     {
         // We found a valid channel
-        *channel = enabledChannels[randr( 0, nbEnabledChannels - 1 )];
         // Disable the channel in the mask
         RegionCommonChanDisable( ChannelsMaskRemaining, *channel, US915_MAX_NB_CHANNELS - 8 );
 
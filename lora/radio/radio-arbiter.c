@@ -0,0 +1,324 @@
+/*!
+ * \file      radio-arbiter.c
+ *
+ * \brief     Radio arbitration between the LoRaWAN MAC and other stacks
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stddef.h>
+#include "sx126x-board.h"
+#include "radio-arbiter.h"
+
+#ifdef CONFIG_RADIO_ARBITER
+
+/*!
+ * Holder value while no owner holds the radio
+ */
+#define RADIO_ARBITER_NONE                          RADIO_ARBITER_OWNERS
+
+/*!
+ * \brief Reservation of the radio
+ */
+typedef struct
+{
+    TimerTime_t Time;
+    uint8_t Owner;          //!< RADIO_ARBITER_NONE for a free entry
+}RadioArbiterReservation_t;
+
+/*!
+ * \brief Registered owner
+ */
+typedef struct
+{
+    RadioEvents_t *Events;
+    void ( *Preempted )( void );
+}RadioArbiterClient_t;
+
+static RadioArbiterClient_t RadioArbiterClients[RADIO_ARBITER_OWNERS];
+
+static RadioArbiterReservation_t RadioArbiterReservations[CONFIG_RADIO_ARBITER_RESERVATIONS];
+
+/*!
+ * Owner holding the radio
+ */
+static volatile uint8_t RadioArbiterHolder = RADIO_ARBITER_NONE;
+
+/*!
+ * Radio events of the arbiter, handed to the holder
+ */
+static RadioEvents_t RadioArbiterEvents;
+
+static bool RadioArbiterInitDone = false;
+
+/*!
+ * \brief Radio events of the holder, NULL while no owner holds the radio
+ */
+static RadioEvents_t *RadioArbiterHolderEvents( void )
+{
+    uint8_t holder = RadioArbiterHolder;
+
+    return ( holder != RADIO_ARBITER_NONE ) ? RadioArbiterClients[holder].Events : NULL;
+}
+
+/*!
+ * \brief Time to the next reservation of the owners above one [ms]
+ *
+ * \remark Drops the reservations which are past. To be called with the
+ *         interrupts disabled.
+ */
+static TimerTime_t RadioArbiterNextReservation( RadioArbiterOwner_t owner, TimerTime_t now )
+{
+    TimerTime_t next = ( TimerTime_t )-1;
+    uint8_t i;
+
+    for( i = 0; i < CONFIG_RADIO_ARBITER_RESERVATIONS; i++ )
+    {
+        RadioArbiterReservation_t *res = &RadioArbiterReservations[i];
+
+        if( res->Owner == RADIO_ARBITER_NONE )
+        {
+            continue;
+        }
+        if( res->Time < now )
+        {
+            res->Owner = RADIO_ARBITER_NONE;
+            continue;
+        }
+        if( ( res->Owner > owner ) && ( ( res->Time - now ) < next ) )
+        {
+            next = res->Time - now;
+        }
+    }
+    return next;
+}
+
+static void OnRadioArbiterTxDone( void )
+{
+    RadioEvents_t *events = RadioArbiterHolderEvents( );
+
+    if( ( events != NULL ) && ( events->TxDone != NULL ) )
+    {
+        events->TxDone( );
+    }
+}
+
+static void OnRadioArbiterTxTimeout( void )
+{
+    RadioEvents_t *events = RadioArbiterHolderEvents( );
+
+    if( ( events != NULL ) && ( events->TxTimeout != NULL ) )
+    {
+        events->TxTimeout( );
+    }
+}
+
+static void OnRadioArbiterRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr )
+{
+    RadioEvents_t *events = RadioArbiterHolderEvents( );
+
+    if( ( events != NULL ) && ( events->RxDone != NULL ) )
+    {
+        events->RxDone( payload, size, rssi, snr );
+    }
+}
+
+static void OnRadioArbiterRxTimeout( void )
+{
+    RadioEvents_t *events = RadioArbiterHolderEvents( );
+
+    if( ( events != NULL ) && ( events->RxTimeout != NULL ) )
+    {
+        events->RxTimeout( );
+    }
+}
+
+static void OnRadioArbiterRxError( void )
+{
+    RadioEvents_t *events = RadioArbiterHolderEvents( );
+
+    if( ( events != NULL ) && ( events->RxError != NULL ) )
+    {
+        events->RxError( );
+    }
+}
+
+static void OnRadioArbiterCadDone( bool channelActivityDetected )
+{
+    RadioEvents_t *events = RadioArbiterHolderEvents( );
+
+    if( ( events != NULL ) && ( events->CadDone != NULL ) )
+    {
+        events->CadDone( channelActivityDetected );
+    }
+}
+
+static bool OnRadioArbiterRxFilter( uint8_t *header, uint16_t size )
+{
+    RadioEvents_t *events = RadioArbiterHolderEvents( );
+
+    if( ( events != NULL ) && ( events->RxFilter != NULL ) )
+    {
+        return events->RxFilter( header, size );
+    }
+    return true;
+}
+
+static void OnRadioArbiterCarrierSenseDone( bool channelFree )
+{
+    RadioEvents_t *events = RadioArbiterHolderEvents( );
+
+    if( ( events != NULL ) && ( events->CarrierSenseDone != NULL ) )
+    {
+        events->CarrierSenseDone( channelFree );
+    }
+}
+
+static void OnRadioArbiterSpectrumScanDone( RadioSpectrumScan_t *scan )
+{
+    RadioEvents_t *events = RadioArbiterHolderEvents( );
+
+    if( ( events != NULL ) && ( events->SpectrumScanDone != NULL ) )
+    {
+        events->SpectrumScanDone( scan );
+    }
+}
+
+int RadioArbiterRegister( RadioArbiterOwner_t owner, RadioEvents_t *events, void ( *preempted )( void ) )
+{
+    RadioArbiterClients[owner].Events = events;
+    RadioArbiterClients[owner].Preempted = preempted;
+
+    if( RadioArbiterInitDone == true )
+    {
+        return 0;
+    }
+    RadioArbiterInitDone = true;
+
+    for( uint8_t i = 0; i < CONFIG_RADIO_ARBITER_RESERVATIONS; i++ )
+    {
+        RadioArbiterReservations[i].Owner = RADIO_ARBITER_NONE;
+    }
+
+    RadioArbiterEvents.TxDone = OnRadioArbiterTxDone;
+    RadioArbiterEvents.TxTimeout = OnRadioArbiterTxTimeout;
+    RadioArbiterEvents.RxDone = OnRadioArbiterRxDone;
+    RadioArbiterEvents.RxTimeout = OnRadioArbiterRxTimeout;
+    RadioArbiterEvents.RxError = OnRadioArbiterRxError;
+    RadioArbiterEvents.CadDone = OnRadioArbiterCadDone;
+    RadioArbiterEvents.RxFilter = OnRadioArbiterRxFilter;
+    RadioArbiterEvents.CarrierSenseDone = OnRadioArbiterCarrierSenseDone;
+    RadioArbiterEvents.SpectrumScanDone = OnRadioArbiterSpectrumScanDone;
+
+    return Radio.Init( &RadioArbiterEvents );
+}
+
+bool RadioArbiterAcquire( RadioArbiterOwner_t owner, uint32_t duration )
+{
+    uint8_t holder;
+
+    BoardDisableIrq( );
+    holder = RadioArbiterHolder;
+    if( holder == owner )
+    {
+        BoardEnableIrq( );
+        return true;
+    }
+    if( ( holder != RADIO_ARBITER_NONE ) && ( holder > owner ) )
+    {
+        BoardEnableIrq( );
+        return false;
+    }
+    if( ( duration != 0 ) &&
+        ( RadioArbiterNextReservation( owner, TimerGetCurrentTime( ) ) < ( ( TimerTime_t )duration + RADIO_ARBITER_GUARD ) ) )
+    {
+        BoardEnableIrq( );
+        return false;
+    }
+    RadioArbiterHolder = owner;
+    BoardEnableIrq( );
+
+    if( holder != RADIO_ARBITER_NONE )
+    {
+        // The events the holder would still get are dropped with its
+        // operation
+        Radio.Abort( );
+        if( RadioArbiterClients[holder].Preempted != NULL )
+        {
+            RadioArbiterClients[holder].Preempted( );
+        }
+    }
+    return true;
+}
+
+void RadioArbiterRelease( RadioArbiterOwner_t owner )
+{
+    BoardDisableIrq( );
+    if( RadioArbiterHolder == owner )
+    {
+        RadioArbiterHolder = RADIO_ARBITER_NONE;
+    }
+    BoardEnableIrq( );
+}
+
+bool RadioArbiterReserve( RadioArbiterOwner_t owner, TimerTime_t time )
+{
+    uint8_t i;
+
+    BoardDisableIrq( );
+    // Drops the past reservations first
+    RadioArbiterNextReservation( owner, TimerGetCurrentTime( ) );
+    for( i = 0; i < CONFIG_RADIO_ARBITER_RESERVATIONS; i++ )
+    {
+        if( RadioArbiterReservations[i].Owner == RADIO_ARBITER_NONE )
+        {
+            RadioArbiterReservations[i].Time = time;
+            RadioArbiterReservations[i].Owner = owner;
+            BoardEnableIrq( );
+            return true;
+        }
+    }
+    BoardEnableIrq( );
+    return false;
+}
+
+void RadioArbiterCancel( RadioArbiterOwner_t owner )
+{
+    uint8_t i;
+
+    BoardDisableIrq( );
+    for( i = 0; i < CONFIG_RADIO_ARBITER_RESERVATIONS; i++ )
+    {
+        if( RadioArbiterReservations[i].Owner == owner )
+        {
+            RadioArbiterReservations[i].Owner = RADIO_ARBITER_NONE;
+        }
+    }
+    BoardEnableIrq( );
+}
+
+uint32_t RadioArbiterFreeTime( RadioArbiterOwner_t owner )
+{
+    TimerTime_t next;
+
+    BoardDisableIrq( );
+    if( ( RadioArbiterHolder != RADIO_ARBITER_NONE ) && ( RadioArbiterHolder != owner ) )
+    {
+        BoardEnableIrq( );
+        return 0;
+    }
+    next = RadioArbiterNextReservation( owner, TimerGetCurrentTime( ) );
+    BoardEnableIrq( );
+
+    if( next == ( TimerTime_t )-1 )
+    {
+        return UINT32_MAX;
+    }
+    if( next <= RADIO_ARBITER_GUARD )
+    {
+        return 0;
+    }
+    next -= RADIO_ARBITER_GUARD;
+    return ( next > UINT32_MAX ) ? UINT32_MAX : ( uint32_t )next;
+}
+
+#endif
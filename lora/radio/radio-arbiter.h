@@ -0,0 +1,153 @@
+/*!
+ * \file      radio-arbiter.h
+ *
+ * \brief     Radio arbitration between the LoRaWAN MAC and other stacks
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_RADIO_ARBITER
+ *
+ *            Shares the \ref Radio driver between owners of different
+ *            priorities, the LoRaWAN MAC above a proprietary point to point
+ *            network. Each owner registers its radio events, the arbiter
+ *            holds the radio events itself and hands them to the owner
+ *            holding the radio, the events raised while no owner holds it
+ *            are dropped.
+ *
+ *            An owner acquires the radio before using it and releases it
+ *            once the radio sleeps. The acquisition of an owner of higher
+ *            priority aborts the operation of the holder, whose Preempted
+ *            callback is called. An owner also reserves the radio at the
+ *            times it knows it will need it, the MAC its RX windows from its
+ *            TX done. An owner of lower priority only gets the radio when
+ *            the time it asks for ends RADIO_ARBITER_GUARD ahead of the next
+ *            reservation of the owners above it, \ref RadioArbiterFreeTime
+ *            tells how long the gap lasts.
+ *
+ *            The owners other than the MAC use the Radio driver only while
+ *            they hold the radio, call Radio.IrqProcess as before and do not
+ *            call Radio.Init. A class C MAC keeps the radio for its
+ *            continuous RX2.
+ *
+ * \{
+ */
+#ifndef __RADIO_ARBITER_H__
+#define __RADIO_ARBITER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "radio.h"
+#include "timer.h"
+
+/*!
+ * Reservations held at once, all owners together
+ */
+#ifndef CONFIG_RADIO_ARBITER_RESERVATIONS
+#define CONFIG_RADIO_ARBITER_RESERVATIONS           4
+#endif
+
+/*!
+ * Margin left ahead of a reservation to an owner of lower priority [ms]
+ */
+#ifndef RADIO_ARBITER_GUARD
+#define RADIO_ARBITER_GUARD                         5
+#endif
+
+/*!
+ * Owners, by increasing priority
+ */
+typedef enum
+{
+    RADIO_ARBITER_P2P = 0,      //!< Proprietary point to point network
+    RADIO_ARBITER_LORAMAC,      //!< LoRaWAN MAC
+    RADIO_ARBITER_OWNERS,
+}RadioArbiterOwner_t;
+
+#ifdef CONFIG_RADIO_ARBITER
+
+#define RADIO_ARBITER_ACQUIRE( owner )              RadioArbiterAcquire( owner, 0 )
+#define RADIO_ARBITER_RELEASE( owner )              RadioArbiterRelease( owner )
+
+/*!
+ * \brief Registers the radio events of an owner, the first registration
+ *        initializes the radio
+ *
+ * \param [IN] owner     Owner
+ * \param [IN] events    Radio events of the owner, kept by the caller
+ * \param [IN] preempted Called when an owner of higher priority takes the
+ *                       radio, may be NULL
+ *
+ * \retval status        Radio.Init result
+ */
+int RadioArbiterRegister( RadioArbiterOwner_t owner, RadioEvents_t *events, void ( *preempted )( void ) );
+
+/*!
+ * \brief Acquires the radio
+ *
+ * \remark Granted to the holder again, to any owner while no owner holds
+ *         the radio and to an owner of higher priority than the holder,
+ *         whose operation is aborted.
+ *
+ * \param [IN] owner     Owner
+ * \param [IN] duration  Time the owner holds the radio for [ms], checked
+ *                       against the reservations of the owners of higher
+ *                       priority, 0 not to check them
+ *
+ * \retval acquired      true when the owner holds the radio
+ */
+bool RadioArbiterAcquire( RadioArbiterOwner_t owner, uint32_t duration );
+
+/*!
+ * \brief Releases the radio, once it sleeps
+ *
+ * \param [IN] owner     Owner, nothing is done unless it holds the radio
+ */
+void RadioArbiterRelease( RadioArbiterOwner_t owner );
+
+/*!
+ * \brief Reserves the radio at a time
+ *
+ * \remark The reservation keeps the owners of lower priority off the radio
+ *         from RADIO_ARBITER_GUARD ahead of it, the owner acquires the radio
+ *         at that time. It lapses once the time is past.
+ *
+ * \param [IN] owner     Owner
+ * \param [IN] time      TimerGetCurrentTime base [ms]
+ *
+ * \retval reserved      false when CONFIG_RADIO_ARBITER_RESERVATIONS are held
+ */
+bool RadioArbiterReserve( RadioArbiterOwner_t owner, TimerTime_t time );
+
+/*!
+ * \brief Drops the reservations of an owner
+ *
+ * \param [IN] owner     Owner
+ */
+void RadioArbiterCancel( RadioArbiterOwner_t owner );
+
+/*!
+ * \brief Time an owner may hold the radio for before the next reservation of
+ *        the owners above it
+ *
+ * \param [IN] owner     Owner
+ *
+ * \retval time          [ms], 0 while another owner holds the radio,
+ *                       UINT32_MAX without reservation ahead
+ */
+uint32_t RadioArbiterFreeTime( RadioArbiterOwner_t owner );
+
+#else
+
+#define RADIO_ARBITER_ACQUIRE( owner )
+#define RADIO_ARBITER_RELEASE( owner )
+
+#endif
+
+/*! \} defgroup LORA_RADIO_ARBITER */
+/*! \} addtogroup LORA */
+
+#endif // __RADIO_ARBITER_H__
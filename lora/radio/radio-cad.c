@@ -0,0 +1,419 @@
+/*!
+ * \file      radio-cad.c
+ *
+ * \brief     CAD based channel access and wake-on-radio implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stddef.h>
+#include <string.h>
+#include "radio.h"
+#include "radio-cad.h"
+#include "sx126x-board.h"
+#include "utilities.h"
+
+/*!
+ * \brief Computes the LoRa symbol time of a scanned configuration
+ *
+ * \retval symbTime    Symbol time [us]
+ */
+static uint32_t RadioCadScanSymbolTime( const RadioCadScanConfig_t *config )
+{
+    // Ts = 2^SF / BW, BW = 125 kHz << Bandwidth
+    return ( ( uint32_t )1000 << config->Datarate ) / ( 125 << config->Bandwidth );
+}
+
+/*!
+ * \brief Computes the duration of a scan cycle, each configuration is
+ *        dwelt on for its CAD length in symbols
+ *
+ * \retval cycleTime   Scan cycle duration [ms]
+ */
+static uint32_t RadioCadScanCycleTime( RadioCadScan_t *scan )
+{
+    uint32_t cycleTime = 0;
+    uint8_t i;
+
+    for( i = 0; i < scan->ConfigCount; i++ )
+    {
+        cycleTime += ( scan->Symbols * RadioCadScanSymbolTime( &scan->Configs[i] ) + 999 ) / 1000 +
+                     RADIO_CAD_SCAN_SWITCH_TIME;
+    }
+    return cycleTime;
+}
+
+/*!
+ * \brief Computes the preamble covering period, a CAD and the RX lock
+ */
+static uint16_t RadioCadPreambleSymbols( uint32_t period, uint32_t symbTime, uint8_t symbols )
+{
+    uint64_t preambleLen;
+
+    if( symbTime == 0 )
+    {
+        return 0;
+    }
+    // Wherever the receiver wakes up in the preamble, a whole CAD and the RX
+    // lock still fit in what is left of it
+    preambleLen = ( ( uint64_t )period * 1000 + symbTime - 1 ) / symbTime + symbols + RADIO_CAD_PREAMBLE_MARGIN;
+    return ( preambleLen > UINT16_MAX ) ? UINT16_MAX : ( uint16_t )preambleLen;
+}
+
+/*!
+ * \brief Queues the next CAD one period after the last one, and puts the
+ *        radio to sleep until then
+ *
+ * \param [IN] sniff   Sniffing
+ * \param [IN] sleep   false when a job of higher priority holds the radio
+ */
+static void RadioCadSniffNext( RadioCadSniff_t *sniff, bool sleep )
+{
+    TimerTime_t now = TimerGetCurrentTime( );
+
+    sniff->Cad.StartTime += sniff->Period;
+    if( sniff->Cad.StartTime <= now )
+    {
+        // Late after an RX window, restarts the cadence from now
+        sniff->Cad.StartTime = now + sniff->Period;
+    }
+    if( sleep == true )
+    {
+        RadioSchedEnqueue( &sniff->Sleep );
+    }
+    RadioSchedEnqueue( &sniff->Cad );
+}
+
+static void RadioCadSniffSetup( RadioJob_t *job )
+{
+    RadioCadSniff_t *sniff = job->Context;
+
+    sniff->Setup( sniff );
+}
+
+static void RadioCadSniffRxSetup( RadioJob_t *job )
+{
+    RadioCadSniff_t *sniff = job->Context;
+
+    sniff->Setup( sniff );
+
+    // The activity may be the start of a wake-up preamble a whole period long
+    job->Timeout = ( sniff->RxTimeout != 0 ) ? sniff->RxTimeout :
+                   sniff->Period + Radio.TimeOnAir( MODEM_LORA, 255 );
+}
+
+static void RadioCadSniffCadDone( RadioJob_t *job, RadioJobStatus_t status )
+{
+    RadioCadSniff_t *sniff = job->Context;
+
+    if( sniff->Running == false )
+    {
+        return;
+    }
+    if( status == RADIO_JOB_CAD_DETECTED )
+    {
+        sniff->Rx.StartTime = 0;
+        RadioSchedEnqueue( &sniff->Rx );
+        return;
+    }
+    RadioCadSniffNext( sniff, status != RADIO_JOB_ABORTED );
+}
+
+static void RadioCadSniffRxDone( RadioJob_t *job, RadioJobStatus_t status )
+{
+    RadioCadSniff_t *sniff = job->Context;
+
+    if( sniff->Running == false )
+    {
+        return;
+    }
+    if( sniff->Done != NULL )
+    {
+        sniff->Done( sniff, job, status );
+    }
+    // Done may have stopped the sniffing
+    if( sniff->Running == true )
+    {
+        RadioCadSniffNext( sniff, status != RADIO_JOB_ABORTED );
+    }
+}
+
+bool RadioCadSniffStart( RadioCadSniff_t *sniff )
+{
+    if( sniff->Running == true )
+    {
+        return false;
+    }
+
+    memset( &sniff->Cad, 0, sizeof( sniff->Cad ) );
+    sniff->Cad.Type = RADIO_JOB_CAD;
+    sniff->Cad.Priority = sniff->Priority;
+    sniff->Cad.StartTime = TimerGetCurrentTime( );
+    sniff->Cad.Size = sniff->Symbols;
+    sniff->Cad.Setup = RadioCadSniffSetup;
+    sniff->Cad.Done = RadioCadSniffCadDone;
+    sniff->Cad.Context = sniff;
+
+    memset( &sniff->Rx, 0, sizeof( sniff->Rx ) );
+    sniff->Rx.Type = RADIO_JOB_RX;
+    sniff->Rx.Priority = sniff->Priority;
+    sniff->Rx.Setup = RadioCadSniffRxSetup;
+    sniff->Rx.Done = RadioCadSniffRxDone;
+    sniff->Rx.Context = sniff;
+
+    memset( &sniff->Sleep, 0, sizeof( sniff->Sleep ) );
+    sniff->Sleep.Type = RADIO_JOB_SLEEP;
+    sniff->Sleep.Priority = sniff->Priority;
+
+    sniff->Running = true;
+    return RadioSchedEnqueue( &sniff->Cad );
+}
+
+void RadioCadSniffStop( RadioCadSniff_t *sniff )
+{
+    sniff->Running = false;
+    RadioSchedCancel( &sniff->Cad );
+    RadioSchedCancel( &sniff->Rx );
+    RadioSchedCancel( &sniff->Sleep );
+}
+
+static void RadioCadTxEnd( RadioCadTx_t *tx, RadioJobStatus_t status )
+{
+    tx->Pending = false;
+    if( tx->Done != NULL )
+    {
+        tx->Done( tx, status );
+    }
+}
+
+static void RadioCadTxSetup( RadioJob_t *job )
+{
+    RadioCadTx_t *tx = job->Context;
+    uint16_t preambleLen;
+
+    tx->Setup( tx );
+
+    if( ( job->Type == RADIO_JOB_TX ) && ( tx->WakePeriod != 0 ) )
+    {
+        // Stretched after SetTxConfig, RadioSend writes the packet params
+        preambleLen = RadioCadPreambleLength( tx->WakePeriod, tx->Symbols );
+        if( preambleLen > SX126x.PacketParams.Params.LoRa.PreambleLength )
+        {
+            SX126x.PacketParams.Params.LoRa.PreambleLength = preambleLen;
+        }
+    }
+}
+
+static void RadioCadTxCadDone( RadioJob_t *job, RadioJobStatus_t status )
+{
+    RadioCadTx_t *tx = job->Context;
+
+    if( status == RADIO_JOB_OK )
+    {
+        // Channel free, the chained TX job is queued
+        return;
+    }
+    if( ( status == RADIO_JOB_CAD_DETECTED ) && ( tx->Attempts < tx->MaxAttempts ) )
+    {
+        tx->Attempts++;
+        tx->Cad.StartTime = TimerGetCurrentTime( ) + randr( 0, ( int32_t )tx->BackoffMax );
+        RadioSchedEnqueue( &tx->Cad );
+        return;
+    }
+    RadioCadTxEnd( tx, status );
+}
+
+static void RadioCadTxDone( RadioJob_t *job, RadioJobStatus_t status )
+{
+    RadioCadTxEnd( job->Context, status );
+}
+
+bool RadioCadSend( RadioCadTx_t *tx )
+{
+    if( tx->Pending == true )
+    {
+        return false;
+    }
+
+    memset( &tx->Tx, 0, sizeof( tx->Tx ) );
+    tx->Tx.Type = RADIO_JOB_TX;
+    tx->Tx.Priority = tx->Priority;
+    tx->Tx.Buffer = tx->Buffer;
+    tx->Tx.Size = tx->Size;
+    tx->Tx.Setup = RadioCadTxSetup;
+    tx->Tx.Done = RadioCadTxDone;
+    tx->Tx.Context = tx;
+
+    memset( &tx->Cad, 0, sizeof( tx->Cad ) );
+    tx->Cad.Type = RADIO_JOB_CAD;
+    tx->Cad.Priority = tx->Priority;
+    tx->Cad.Size = tx->Symbols;
+    tx->Cad.Setup = RadioCadTxSetup;
+    tx->Cad.Done = RadioCadTxCadDone;
+    tx->Cad.Chain = &tx->Tx;
+    tx->Cad.Context = tx;
+
+    tx->Pending = true;
+    if( tx->MaxAttempts == 0 )
+    {
+        tx->Attempts = 0;
+        return RadioSchedEnqueue( &tx->Tx );
+    }
+    tx->Attempts = 1;
+    return RadioSchedEnqueue( &tx->Cad );
+}
+
+/*!
+ * \brief Moves to the next configuration, the next cycle one scan period
+ *        after the last one, with the radio asleep until then
+ *
+ * \param [IN] scan    Scanning
+ * \param [IN] sleep   false when a job of higher priority holds the radio
+ */
+static void RadioCadScanNext( RadioCadScan_t *scan, bool sleep )
+{
+    TimerTime_t now;
+
+    scan->Index++;
+    if( scan->Index < scan->ConfigCount )
+    {
+        scan->Cad.StartTime = 0;
+        RadioSchedEnqueue( &scan->Cad );
+        return;
+    }
+
+    scan->Index = 0;
+    now = TimerGetCurrentTime( );
+    if( scan->Period == 0 )
+    {
+        scan->CycleStart = now;
+        scan->Cad.StartTime = 0;
+        RadioSchedEnqueue( &scan->Cad );
+        return;
+    }
+    scan->CycleStart += scan->Period;
+    if( scan->CycleStart <= now )
+    {
+        // Late after an RX window, restarts the cadence from now
+        scan->CycleStart = now + scan->Period;
+    }
+    scan->Cad.StartTime = scan->CycleStart;
+    if( sleep == true )
+    {
+        RadioSchedEnqueue( &scan->Sleep );
+    }
+    RadioSchedEnqueue( &scan->Cad );
+}
+
+static void RadioCadScanSetup( RadioJob_t *job )
+{
+    RadioCadScan_t *scan = job->Context;
+    const RadioCadScanConfig_t *config = &scan->Configs[scan->Index];
+
+    Radio.SetChannel( config->Frequency );
+    Radio.SetRxConfig( MODEM_LORA, config->Bandwidth, config->Datarate, config->Coderate, 0,
+                       scan->PreambleLen, 0, false, 0, true, false, 0, scan->IqInverted, false );
+
+    if( job->Type == RADIO_JOB_RX )
+    {
+        // The activity may be the start of a preamble a whole scan long
+        job->Timeout = ( scan->RxTimeout != 0 ) ? scan->RxTimeout :
+                       MAX( scan->Period, scan->CycleTime ) + Radio.TimeOnAir( MODEM_LORA, 255 );
+    }
+}
+
+static void RadioCadScanCadDone( RadioJob_t *job, RadioJobStatus_t status )
+{
+    RadioCadScan_t *scan = job->Context;
+
+    if( scan->Running == false )
+    {
+        return;
+    }
+    if( status == RADIO_JOB_CAD_DETECTED )
+    {
+        // Locks on the configuration that detected the activity
+        scan->Rx.StartTime = 0;
+        RadioSchedEnqueue( &scan->Rx );
+        return;
+    }
+    if( status == RADIO_JOB_ABORTED )
+    {
+        // Scans the same configuration again once the radio is back
+        scan->Cad.StartTime = 0;
+        RadioSchedEnqueue( &scan->Cad );
+        return;
+    }
+    RadioCadScanNext( scan, true );
+}
+
+static void RadioCadScanRxDone( RadioJob_t *job, RadioJobStatus_t status )
+{
+    RadioCadScan_t *scan = job->Context;
+
+    if( scan->Running == false )
+    {
+        return;
+    }
+    if( scan->Done != NULL )
+    {
+        scan->Done( scan, &scan->Configs[scan->Index], job, status );
+    }
+    // Done may have stopped the scanning
+    if( scan->Running == true )
+    {
+        RadioCadScanNext( scan, status != RADIO_JOB_ABORTED );
+    }
+}
+
+bool RadioCadScanStart( RadioCadScan_t *scan )
+{
+    if( ( scan->Running == true ) || ( scan->ConfigCount == 0 ) )
+    {
+        return false;
+    }
+
+    scan->CycleTime = RadioCadScanCycleTime( scan );
+    scan->Index = 0;
+    scan->CycleStart = TimerGetCurrentTime( );
+
+    memset( &scan->Cad, 0, sizeof( scan->Cad ) );
+    scan->Cad.Type = RADIO_JOB_CAD;
+    scan->Cad.Priority = scan->Priority;
+    scan->Cad.Size = scan->Symbols;
+    scan->Cad.Setup = RadioCadScanSetup;
+    scan->Cad.Done = RadioCadScanCadDone;
+    scan->Cad.Context = scan;
+
+    memset( &scan->Rx, 0, sizeof( scan->Rx ) );
+    scan->Rx.Type = RADIO_JOB_RX;
+    scan->Rx.Priority = scan->Priority;
+    scan->Rx.Setup = RadioCadScanSetup;
+    scan->Rx.Done = RadioCadScanRxDone;
+    scan->Rx.Context = scan;
+
+    memset( &scan->Sleep, 0, sizeof( scan->Sleep ) );
+    scan->Sleep.Type = RADIO_JOB_SLEEP;
+    scan->Sleep.Priority = scan->Priority;
+
+    scan->Running = true;
+    return RadioSchedEnqueue( &scan->Cad );
+}
+
+void RadioCadScanStop( RadioCadScan_t *scan )
+{
+    scan->Running = false;
+    RadioSchedCancel( &scan->Cad );
+    RadioSchedCancel( &scan->Rx );
+    RadioSchedCancel( &scan->Sleep );
+}
+
+uint16_t RadioCadScanPreambleLength( RadioCadScan_t *scan, const RadioCadScanConfig_t *config )
+{
+    return RadioCadPreambleSymbols( MAX( scan->Period, RadioCadScanCycleTime( scan ) ),
+                                    RadioCadScanSymbolTime( config ), scan->Symbols );
+}
+
+uint16_t RadioCadPreambleLength( uint32_t period, uint8_t symbols )
+{
+    return RadioCadPreambleSymbols( period, Radio.SymbolTime( ), symbols );
+}
@@ -0,0 +1,348 @@
+/*!
+ * \file      radio-cad.h
+ *
+ * \brief     CAD based channel access and wake-on-radio
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_RADIO_CAD
+ *
+ *            LoRa channel activity detection services, run as
+ *            \ref LORA_RADIO_SCHED jobs:
+ *
+ *            - Sniffing: a CAD every Period ms with the radio asleep in
+ *              between, an RX window is only opened when activity is
+ *              detected. A receiver then spends a few symbols per period in
+ *              CAD instead of staying in continuous RX.
+ *            - Listen before talk: a CAD right before the TX, the TX is
+ *              delayed by a random back-off while the channel is busy.
+ *            - Wake-up TX: the preamble is stretched to cover a whole sniff
+ *              period so that sniffing receivers detect it.
+ *            - Scanning: CADs cycled over a list of channel, bandwidth and
+ *              spreading factor combinations, the RX window is opened on
+ *              the one that detected activity. A single radio then listens
+ *              to several LoRa configurations at once, as long as the
+ *              senders' preamble spans a whole scan cycle.
+ *
+ *            Unlike \ref Radio.IsChannelFree nothing blocks, the CPU is free
+ *            between the radio events.
+ *
+ * \{
+ */
+#ifndef __RADIO_CAD_H__
+#define __RADIO_CAD_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "radio-sched.h"
+
+/*!
+ * Preamble symbols added to the sniff period by \ref RadioCadPreambleLength,
+ * left for the RX to lock once the activity is detected
+ */
+#define RADIO_CAD_PREAMBLE_MARGIN                   8
+
+/*!
+ * Time added to each CAD of a scan for the reconfiguration [ms]
+ */
+#define RADIO_CAD_SCAN_SWITCH_TIME                  1
+
+/*!
+ * \brief Periodic CAD sniffing
+ *
+ * \remark Owned by the caller, must stay valid until stopped.
+ */
+typedef struct RadioCadSniff_s
+{
+    /*!
+     * Sniff period [ms]
+     */
+    uint32_t Period;
+    /*!
+     * CAD length [symbols], 1, 2, 4, 8 or 16
+     */
+    uint8_t Symbols;
+    /*!
+     * Priority of the sniff jobs
+     */
+    uint8_t Priority;
+    /*!
+     * RX window opened on activity [ms], 0 for a sniff period plus the
+     * time on air of a 255 bytes packet
+     */
+    uint32_t RxTimeout;
+    /*!
+     * \brief Sets the channel and the LoRa RX configuration, called before
+     *        each CAD and RX
+     */
+    void ( *Setup )( struct RadioCadSniff_s *sniff );
+    /*!
+     * \brief Called at the end of the RX window opened on activity
+     *
+     * \param [IN] sniff   Sniffing
+     * \param [IN] rx      RX job, Payload is only valid during the call
+     * \param [IN] status  RADIO_JOB_OK when a packet was received
+     */
+    void ( *Done )( struct RadioCadSniff_s *sniff, RadioJob_t *rx, RadioJobStatus_t status );
+    /*!
+     * Application context
+     */
+    void *Context;
+    /*!
+     * Internal jobs
+     */
+    RadioJob_t Cad;
+    RadioJob_t Rx;
+    RadioJob_t Sleep;
+    /*!
+     * Set while sniffing
+     */
+    bool Running;
+}RadioCadSniff_t;
+
+/*!
+ * \brief TX with listen before talk
+ *
+ * \remark Owned by the caller, must stay valid until Done.
+ */
+typedef struct RadioCadTx_s
+{
+    /*!
+     * Payload
+     */
+    uint8_t *Buffer;
+    /*!
+     * Payload size
+     */
+    uint8_t Size;
+    /*!
+     * Priority of the CAD and TX jobs
+     */
+    uint8_t Priority;
+    /*!
+     * CAD length [symbols], 1, 2, 4, 8 or 16
+     */
+    uint8_t Symbols;
+    /*!
+     * CADs before giving up on a busy channel, 0 sends without CAD
+     */
+    uint8_t MaxAttempts;
+    /*!
+     * Random back-off after a busy CAD, up to BackoffMax [ms]
+     */
+    uint32_t BackoffMax;
+    /*!
+     * Sniff period of the receivers to wake up [ms], 0 to keep the
+     * configured preamble. The receivers are assumed to sniff with Symbols
+     * long CADs
+     *
+     * \remark The TX timeout given to SetTxConfig has to cover the stretched
+     *         preamble.
+     */
+    uint32_t WakePeriod;
+    /*!
+     * \brief Sets the channel and the LoRa TX configuration, called before
+     *        the CAD and the TX
+     */
+    void ( *Setup )( struct RadioCadTx_s *tx );
+    /*!
+     * \brief Called once the TX is over
+     *
+     * \param [IN] tx      TX
+     * \param [IN] status  RADIO_JOB_OK when sent, RADIO_JOB_CAD_DETECTED when
+     *                     the channel stayed busy, the TX or CAD status else
+     */
+    void ( *Done )( struct RadioCadTx_s *tx, RadioJobStatus_t status );
+    /*!
+     * Application context
+     */
+    void *Context;
+    /*!
+     * Internal jobs
+     */
+    RadioJob_t Cad;
+    RadioJob_t Tx;
+    /*!
+     * CADs done for the pending TX
+     */
+    uint8_t Attempts;
+    /*!
+     * Set from RadioCadSend until Done
+     */
+    bool Pending;
+}RadioCadTx_t;
+
+/*!
+ * \brief LoRa configuration scanned by \ref RadioCadScan_t
+ */
+typedef struct
+{
+    /*!
+     * Channel RF frequency [Hz]
+     */
+    uint32_t Frequency;
+    /*!
+     * Bandwidth [0: 125 kHz, 1: 250 kHz, 2: 500 kHz]
+     */
+    uint8_t Bandwidth;
+    /*!
+     * Spreading factor [5..12]
+     */
+    uint8_t Datarate;
+    /*!
+     * Coding rate [1: 4/5, 2: 4/6, 3: 4/7, 4: 4/8]
+     */
+    uint8_t Coderate;
+}RadioCadScanConfig_t;
+
+/*!
+ * \brief CAD scanning over several LoRa configurations
+ *
+ * \remark Owned by the caller, must stay valid until stopped, as well as
+ *         Configs.
+ */
+typedef struct RadioCadScan_s
+{
+    /*!
+     * Configurations to scan, in scan order
+     */
+    const RadioCadScanConfig_t *Configs;
+    /*!
+     * Number of configurations
+     */
+    uint8_t ConfigCount;
+    /*!
+     * CAD length [symbols], 1, 2, 4, 8 or 16
+     */
+    uint8_t Symbols;
+    /*!
+     * Priority of the scan jobs
+     */
+    uint8_t Priority;
+    /*!
+     * RX preamble length [symbols]
+     */
+    uint16_t PreambleLen;
+    /*!
+     * Set when the senders invert the IQ signals
+     */
+    bool IqInverted;
+    /*!
+     * Scan period [ms], the radio sleeps between the scan cycles. 0 to
+     * scan continuously
+     */
+    uint32_t Period;
+    /*!
+     * RX window opened on activity [ms], 0 for a scan cycle plus the time
+     * on air of a 255 bytes packet
+     */
+    uint32_t RxTimeout;
+    /*!
+     * \brief Called at the end of the RX window opened on activity
+     *
+     * \param [IN] scan    Scanning
+     * \param [IN] config  Configuration on which the activity was detected
+     * \param [IN] rx      RX job, Payload is only valid during the call
+     * \param [IN] status  RADIO_JOB_OK when a packet was received
+     */
+    void ( *Done )( struct RadioCadScan_s *scan, const RadioCadScanConfig_t *config, RadioJob_t *rx, RadioJobStatus_t status );
+    /*!
+     * Application context
+     */
+    void *Context;
+    /*!
+     * Internal jobs
+     */
+    RadioJob_t Cad;
+    RadioJob_t Rx;
+    RadioJob_t Sleep;
+    /*!
+     * Configuration of the current CAD
+     */
+    uint8_t Index;
+    /*!
+     * Duration of a scan cycle [ms], set by RadioCadScanStart
+     */
+    uint32_t CycleTime;
+    /*!
+     * Start of the current scan cycle
+     */
+    TimerTime_t CycleStart;
+    /*!
+     * Set while scanning
+     */
+    bool Running;
+}RadioCadScan_t;
+
+/*!
+ * \brief Starts sniffing
+ *
+ * \param [IN] sniff   Sniffing with Period, Symbols, Setup and Done set
+ *
+ * \retval started     false when already sniffing
+ */
+bool RadioCadSniffStart( RadioCadSniff_t *sniff );
+
+/*!
+ * \brief Stops sniffing, the Done callback is not called
+ *
+ * \param [IN] sniff   Sniffing
+ */
+void RadioCadSniffStop( RadioCadSniff_t *sniff );
+
+/*!
+ * \brief Sends once the channel is free
+ *
+ * \param [IN] tx      TX with Buffer, Size, Setup and Done set
+ *
+ * \retval queued      false when this TX is already pending
+ */
+bool RadioCadSend( RadioCadTx_t *tx );
+
+/*!
+ * \brief Starts scanning
+ *
+ * \param [IN] scan    Scanning with Configs, ConfigCount, Symbols,
+ *                     PreambleLen and Done set
+ *
+ * \retval started     false when already scanning or without configuration
+ */
+bool RadioCadScanStart( RadioCadScan_t *scan );
+
+/*!
+ * \brief Stops scanning, the Done callback is not called
+ *
+ * \param [IN] scan    Scanning
+ */
+void RadioCadScanStop( RadioCadScan_t *scan );
+
+/*!
+ * \brief Computes the preamble the senders on a scanned configuration need
+ *        to be detected whatever the configuration being scanned
+ *
+ * \param [IN] scan    Scanning, the configurations and Period set
+ * \param [IN] config  Configuration of the sender
+ *
+ * \retval preambleLen Preamble length [symbols]
+ */
+uint16_t RadioCadScanPreambleLength( RadioCadScan_t *scan, const RadioCadScanConfig_t *config );
+
+/*!
+ * \brief Computes the preamble a wake-up TX needs for the current LoRa
+ *        configuration
+ *
+ * \param [IN] period  Sniff period of the receivers [ms]
+ * \param [IN] symbols CAD length of the receivers [symbols]
+ *
+ * \retval preambleLen Preamble length [symbols], 0 when not in LoRa
+ */
+uint16_t RadioCadPreambleLength( uint32_t period, uint8_t symbols );
+
+/*! \} defgroup LORA_RADIO_CAD */
+/*! \} addtogroup LORA */
+
+#endif // __RADIO_CAD_H__
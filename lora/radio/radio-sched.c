@@ -0,0 +1,372 @@
+/*!
+ * \file      radio-sched.c
+ *
+ * \brief     Radio operation scheduler implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stddef.h>
+#include "radio.h"
+#include "radio-sched.h"
+#include "sx126x-board.h"
+
+/*!
+ * Queued jobs, in queuing order
+ */
+static RadioJob_t *RadioSchedQueue = NULL;
+
+/*!
+ * Job running on the radio
+ */
+static RadioJob_t *RadioSchedCurrent = NULL;
+
+/*!
+ * Set while the queue is being run, only one context runs it at a time
+ */
+static volatile bool RadioSchedLocked = false;
+
+/*!
+ * Set when the queue has to be run again by the context holding the lock
+ */
+static volatile bool RadioSchedPending = false;
+
+/*!
+ * Wakes up the scheduler at the start time of the next queued job
+ */
+static TimerEvent_t RadioSchedTimer;
+
+/*!
+ * Radio events, owned by the scheduler
+ */
+static RadioEvents_t RadioSchedEvents;
+
+static bool RadioSchedUnlink( RadioJob_t *job )
+{
+    RadioJob_t **cur = &RadioSchedQueue;
+
+    while( *cur != NULL )
+    {
+        if( *cur == job )
+        {
+            *cur = job->Next;
+            job->Next = NULL;
+            return true;
+        }
+        cur = &( *cur )->Next;
+    }
+    return false;
+}
+
+static bool RadioSchedIsQueued( RadioJob_t *job )
+{
+    RadioJob_t *cur = RadioSchedQueue;
+
+    while( cur != NULL )
+    {
+        if( cur == job )
+        {
+            return true;
+        }
+        cur = cur->Next;
+    }
+    return false;
+}
+
+static void RadioSchedAppend( RadioJob_t *job )
+{
+    RadioJob_t **cur = &RadioSchedQueue;
+
+    while( *cur != NULL )
+    {
+        cur = &( *cur )->Next;
+    }
+    job->Next = NULL;
+    *cur = job;
+}
+
+/*!
+ * \brief Ends the running job, queues its chained job and reports it
+ */
+static void RadioSchedComplete( RadioJobStatus_t status )
+{
+    RadioJob_t *job = RadioSchedCurrent;
+
+    if( job == NULL )
+    {
+        return;
+    }
+    RadioSchedCurrent = NULL;
+
+    if( ( status == RADIO_JOB_OK ) && ( job->Chain != NULL ) )
+    {
+        job->Chain->StartTime = TimerGetCurrentTime( ) + job->Chain->Delay;
+        RadioSchedEnqueue( job->Chain );
+    }
+    RadioSchedPending = true;
+
+    if( job->Done != NULL )
+    {
+        job->Done( job, status );
+    }
+}
+
+/*!
+ * \brief Reports a continuous RX event, the job keeps running
+ */
+static void RadioSchedReport( RadioJobStatus_t status )
+{
+    RadioJob_t *job = RadioSchedCurrent;
+
+    if( ( job != NULL ) && ( job->Done != NULL ) )
+    {
+        job->Done( job, status );
+    }
+}
+
+static void RadioSchedStart( RadioJob_t *job )
+{
+    RadioSchedCurrent = job;
+
+    if( job->Setup != NULL )
+    {
+        job->Setup( job );
+    }
+
+    switch( job->Type )
+    {
+    case RADIO_JOB_TX:
+        Radio.Send( job->Buffer, job->Size );
+        break;
+    case RADIO_JOB_RX:
+        Radio.Rx( job->Timeout );
+        break;
+    case RADIO_JOB_CAD:
+        Radio.StartCad( job->Size );
+        break;
+    case RADIO_JOB_SLEEP:
+    default:
+        Radio.Sleep( );
+        RadioSchedComplete( RADIO_JOB_OK );
+        break;
+    }
+}
+
+/*!
+ * \brief Starts the due job of highest priority, preempting the running job
+ *        when it has a lower priority, and arms the timer for the next job
+ */
+static void RadioSchedDispatch( void )
+{
+    TimerTime_t now = TimerGetCurrentTime( );
+    TimerTime_t next = 0;
+    RadioJob_t *best = NULL;
+    RadioJob_t *cur;
+
+    BoardDisableIrq( );
+    for( cur = RadioSchedQueue; cur != NULL; cur = cur->Next )
+    {
+        if( cur->StartTime <= now )
+        {
+            if( ( best == NULL ) || ( cur->Priority > best->Priority ) )
+            {
+                best = cur;
+            }
+        }
+        else if( ( next == 0 ) || ( cur->StartTime < next ) )
+        {
+            next = cur->StartTime;
+        }
+    }
+    if( ( best != NULL ) && ( RadioSchedCurrent != NULL ) &&
+        ( best->Priority <= RadioSchedCurrent->Priority ) )
+    {
+        // Waits for the end of the running job
+        best = NULL;
+    }
+    if( best != NULL )
+    {
+        RadioSchedUnlink( best );
+    }
+    BoardEnableIrq( );
+
+    TimerStop( &RadioSchedTimer );
+    if( next != 0 )
+    {
+        TimerSetValue( &RadioSchedTimer, ( ( next - now ) > UINT32_MAX ) ? UINT32_MAX : ( uint32_t )( next - now ) );
+        TimerStart( &RadioSchedTimer );
+    }
+
+    if( best != NULL )
+    {
+        if( RadioSchedCurrent != NULL )
+        {
+            Radio.Standby( );
+            RadioSchedComplete( RADIO_JOB_ABORTED );
+        }
+        RadioSchedStart( best );
+    }
+}
+
+/*!
+ * \brief Runs the queue, or asks the context already running it to run it
+ *        again
+ *
+ * \param [IN] irqProcess Processes the radio events first
+ */
+static void RadioSchedRun( bool irqProcess )
+{
+    BoardDisableIrq( );
+    if( RadioSchedLocked == true )
+    {
+        RadioSchedPending = true;
+        BoardEnableIrq( );
+        return;
+    }
+    RadioSchedLocked = true;
+    RadioSchedPending = false;
+    BoardEnableIrq( );
+
+    if( irqProcess == true )
+    {
+        Radio.IrqProcess( );
+    }
+
+    for( ;; )
+    {
+        RadioSchedDispatch( );
+
+        BoardDisableIrq( );
+        if( RadioSchedPending == false )
+        {
+            RadioSchedLocked = false;
+            BoardEnableIrq( );
+            break;
+        }
+        RadioSchedPending = false;
+        BoardEnableIrq( );
+    }
+}
+
+static void OnRadioSchedTimerEvent( void )
+{
+    // Starts the job from the timer interrupt for the lowest latency
+    RadioSchedRun( false );
+}
+
+static void OnRadioSchedTxDone( void )
+{
+    RadioSchedComplete( RADIO_JOB_OK );
+}
+
+static void OnRadioSchedTxTimeout( void )
+{
+    RadioSchedComplete( RADIO_JOB_TIMEOUT );
+}
+
+static void OnRadioSchedRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr )
+{
+    RadioJob_t *job = RadioSchedCurrent;
+
+    if( job == NULL )
+    {
+        return;
+    }
+    job->Payload = payload;
+    job->PayloadSize = size;
+    job->Rssi = rssi;
+    job->Snr = snr;
+
+    if( job->Timeout == 0 )
+    {
+        RadioSchedReport( RADIO_JOB_OK );
+    }
+    else
+    {
+        RadioSchedComplete( RADIO_JOB_OK );
+    }
+    job->Payload = NULL;
+}
+
+static void OnRadioSchedRxTimeout( void )
+{
+    RadioSchedComplete( RADIO_JOB_TIMEOUT );
+}
+
+static void OnRadioSchedRxError( void )
+{
+    if( ( RadioSchedCurrent != NULL ) && ( RadioSchedCurrent->Timeout == 0 ) )
+    {
+        RadioSchedReport( RADIO_JOB_ERROR );
+    }
+    else
+    {
+        RadioSchedComplete( RADIO_JOB_ERROR );
+    }
+}
+
+static void OnRadioSchedCadDone( bool channelActivityDetected )
+{
+    RadioSchedComplete( ( channelActivityDetected == true ) ? RADIO_JOB_CAD_DETECTED : RADIO_JOB_OK );
+}
+
+int RadioSchedInit( void )
+{
+    RadioSchedQueue = NULL;
+    RadioSchedCurrent = NULL;
+    RadioSchedLocked = false;
+    RadioSchedPending = false;
+
+    TimerInit( &RadioSchedTimer, OnRadioSchedTimerEvent );
+
+    RadioSchedEvents.TxDone = OnRadioSchedTxDone;
+    RadioSchedEvents.TxTimeout = OnRadioSchedTxTimeout;
+    RadioSchedEvents.RxDone = OnRadioSchedRxDone;
+    RadioSchedEvents.RxTimeout = OnRadioSchedRxTimeout;
+    RadioSchedEvents.RxError = OnRadioSchedRxError;
+    RadioSchedEvents.CadDone = OnRadioSchedCadDone;
+
+    return Radio.Init( &RadioSchedEvents );
+}
+
+bool RadioSchedEnqueue( RadioJob_t *job )
+{
+    BoardDisableIrq( );
+    if( ( job == RadioSchedCurrent ) || ( RadioSchedIsQueued( job ) == true ) )
+    {
+        BoardEnableIrq( );
+        return false;
+    }
+    RadioSchedAppend( job );
+    BoardEnableIrq( );
+
+    RadioSchedRun( false );
+    return true;
+}
+
+bool RadioSchedCancel( RadioJob_t *job )
+{
+    bool cancelled;
+
+    BoardDisableIrq( );
+    cancelled = RadioSchedUnlink( job );
+    BoardEnableIrq( );
+
+    if( job == RadioSchedCurrent )
+    {
+        RadioSchedCurrent = NULL;
+        Radio.Standby( );
+        cancelled = true;
+        RadioSchedRun( false );
+    }
+    return cancelled;
+}
+
+bool RadioSchedIsBusy( void )
+{
+    return RadioSchedCurrent != NULL;
+}
+
+void RadioSchedProcess( void )
+{
+    RadioSchedRun( true );
+}
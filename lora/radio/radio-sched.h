@@ -0,0 +1,186 @@
+/*!
+ * \file      radio-sched.h
+ *
+ * \brief     Radio operation scheduler
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_RADIO_SCHED
+ *
+ *            Queues radio jobs (TX, RX window, CAD, sleep) with a start time
+ *            and a priority and runs them one after the other over the
+ *            \ref Radio driver. A job ends with its completion callback,
+ *            the job chained to it is started right away from the radio
+ *            event, without going back through the application main loop.
+ *
+ *            Once \ref RadioSchedInit has been called the scheduler owns the
+ *            radio events, the application calls \ref RadioSchedProcess
+ *            instead of Radio.IrqProcess and only uses the Radio driver
+ *            directly from the job Setup callbacks.
+ *
+ * \{
+ */
+#ifndef __RADIO_SCHED_H__
+#define __RADIO_SCHED_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "timer.h"
+
+/*!
+ * Radio job types
+ */
+typedef enum
+{
+    RADIO_JOB_TX = 0,   //!< Sends Buffer/Size
+    RADIO_JOB_RX,       //!< Opens an RX window of Timeout ms, 0 for continuous RX
+    RADIO_JOB_CAD,      //!< Channel activity detection on Size symbols
+    RADIO_JOB_SLEEP,    //!< Puts the radio to sleep
+}RadioJobType_t;
+
+/*!
+ * Radio job completion status
+ */
+typedef enum
+{
+    RADIO_JOB_OK = 0,           //!< Sent, received, channel free or asleep
+    RADIO_JOB_TIMEOUT,          //!< TX or RX timeout
+    RADIO_JOB_ERROR,            //!< RX CRC or header error
+    RADIO_JOB_CAD_DETECTED,     //!< Channel activity detected
+    RADIO_JOB_ABORTED,          //!< Preempted by a job of higher priority
+}RadioJobStatus_t;
+
+/*!
+ * \brief Radio job description
+ *
+ * \remark Jobs are owned by the caller and must stay valid while queued or
+ *         running.
+ */
+typedef struct RadioJob_s
+{
+    /*!
+     * Operation to perform
+     */
+    RadioJobType_t Type;
+    /*!
+     * Priority, a due job preempts a running job of lower priority
+     */
+    uint8_t Priority;
+    /*!
+     * Earliest start time, TimerGetCurrentTime base [ms]. 0 to start as
+     * soon as the radio is free
+     */
+    TimerTime_t StartTime;
+    /*!
+     * Start delay of a chained job after the end of the previous one [ms]
+     */
+    uint32_t Delay;
+    /*!
+     * RX window duration [ms], 0 for continuous RX
+     */
+    uint32_t Timeout;
+    /*!
+     * TX payload
+     */
+    uint8_t *Buffer;
+    /*!
+     * TX payload size, CAD number of symbols
+     */
+    uint8_t Size;
+    /*!
+     * \brief Called right before the job starts, may be NULL
+     *
+     * \remark Place to set the channel and the TX/RX configuration.
+     */
+    void ( *Setup )( struct RadioJob_s *job );
+    /*!
+     * \brief Called on job completion, may be NULL
+     *
+     * \remark A continuous RX job reports every received packet and error
+     *         and only ends when cancelled or preempted. Jobs may be queued
+     *         from this callback.
+     *
+     * \param [IN] job     Completed job
+     * \param [IN] status  Completion status
+     */
+    void ( *Done )( struct RadioJob_s *job, RadioJobStatus_t status );
+    /*!
+     * Job queued, Delay ms later, when this one ends with RADIO_JOB_OK.
+     * May be NULL
+     */
+    struct RadioJob_s *Chain;
+    /*!
+     * Application context
+     */
+    void *Context;
+    /*!
+     * Received payload, only valid during the Done callback
+     */
+    uint8_t *Payload;
+    /*!
+     * Received payload size
+     */
+    uint16_t PayloadSize;
+    /*!
+     * RSSI of the received packet [dBm]
+     */
+    int16_t Rssi;
+    /*!
+     * SNR of the received packet [dB]
+     */
+    int8_t Snr;
+    /*!
+     * Scheduler internal, queue link
+     */
+    struct RadioJob_s *Next;
+}RadioJob_t;
+
+/*!
+ * \brief Initializes the radio and the scheduler
+ *
+ * \retval status Radio.Init result
+ */
+int RadioSchedInit( void );
+
+/*!
+ * \brief Queues a job
+ *
+ * \param [IN] job     Job to queue
+ *
+ * \retval queued      false when the job is already queued or running
+ */
+bool RadioSchedEnqueue( RadioJob_t *job );
+
+/*!
+ * \brief Removes a job from the queue, or stops it when running
+ *
+ * \remark The Done callback is not called.
+ *
+ * \param [IN] job     Job to cancel
+ *
+ * \retval cancelled   false when the job was neither queued nor running
+ */
+bool RadioSchedCancel( RadioJob_t *job );
+
+/*!
+ * \brief Tells if a job is running on the radio
+ *
+ * \retval busy        true while a job is running
+ */
+bool RadioSchedIsBusy( void );
+
+/*!
+ * \brief Processes the radio events and starts the due jobs
+ *
+ * \remark To be called from the main loop in place of Radio.IrqProcess.
+ */
+void RadioSchedProcess( void );
+
+/*! \} defgroup LORA_RADIO_SCHED */
+/*! \} addtogroup LORA */
+
+#endif // __RADIO_SCHED_H__
@@ -60,6 +60,43 @@ typedef enum
     RF_CAD,        //!< The radio is doing channel activity detection
 }RadioState_t;
 
+/*!
+ * Occupancy histogram of a spectrum scan: bin n counts the RSSI samples from
+ * RADIO_SCAN_RSSI_FLOOR + n * RADIO_SCAN_RSSI_STEP [dBm], the first bin those
+ * below too and the last bin those above
+ */
+#define RADIO_SCAN_BINS                             8
+#define RADIO_SCAN_RSSI_FLOOR                       -125
+#define RADIO_SCAN_RSSI_STEP                        10
+
+/*!
+ * \brief Spectrum scan results of a channel, accumulated over the scans
+ */
+typedef struct
+{
+    int16_t RssiMin;                    //!< [dBm]
+    int16_t RssiMax;                    //!< [dBm]
+    int32_t RssiSum;                    //!< Sum of the samples [dBm]
+    uint32_t Samples;
+    uint16_t Hist[RADIO_SCAN_BINS];
+}RadioScanChannel_t;
+
+/*!
+ * \brief Spectrum scan, see Radio_s.StartSpectrumScan
+ */
+typedef struct
+{
+    const uint32_t *Freqs;              //!< Channels RF frequency [Hz]
+    uint8_t Count;                      //!< Number of channels
+    uint16_t Samples;                   //!< RSSI samples per channel and scan
+    /*!
+     * Count entries, zeroed by the caller before the first scan, the next
+     * scans accumulate into them
+     */
+    RadioScanChannel_t *Channels;
+    volatile bool Done;                 //!< Set once the scan is through
+}RadioSpectrumScan_t;
+
 /*!
  * \brief Radio driver callback functions
  */
@@ -105,8 +142,40 @@ typedef struct
      * \param [IN] channelDetected    Channel Activity detected during the CAD
      */
     void ( *CadDone ) ( bool channelActivityDetected );
+    /*!
+     * \brief Rx early filter callback prototype, may be NULL.
+     *
+     * \remark Called once the first \ref RADIO_RX_FILTER_HEADER_SIZE bytes of
+     *         a packet are read. When it returns false the rest of the packet
+     *         is not read and RxDone gets the header bytes only.
+     *
+     * \param [IN] header  First bytes of the received packet
+     * \param [IN] size    Size of the whole received packet
+     *
+     * \retval accept      false to skip reading the rest of the packet
+     */
+    bool ( *RxFilter )( uint8_t *header, uint16_t size );
+    /*!
+     * \brief Carrier sense done callback prototype, may be NULL.
+     *
+     * \param [IN] channelFree  true when the RSSI stayed below the threshold
+     *                          for the whole carrier sense time
+     */
+    void ( *CarrierSenseDone )( bool channelFree );
+    /*!
+     * \brief Spectrum scan done callback prototype, may be NULL.
+     *
+     * \param [IN] scan  Scan through, its Done set
+     */
+    void ( *SpectrumScanDone )( RadioSpectrumScan_t *scan );
 }RadioEvents_t;
 
+/*!
+ * \brief Number of leading packet bytes given to RadioEvents_t.RxFilter,
+ *        LoRaWAN MHDR plus DevAddr
+ */
+#define RADIO_RX_FILTER_HEADER_SIZE                 5
+
 /*!
  * \brief Radio driver definition
  */
@@ -378,6 +447,149 @@ struct Radio_s
      * \param [in]  sleepTime     Structure describing sleep timeout value
      */
     void ( *SetRxDutyCycle ) ( uint32_t rxTime, uint32_t sleepTime );
+    /*!
+     * \brief Lends the buffer the next received packets are read into
+     *
+     * \remark Available on SX126x radios only. The RxDone payload pointer
+     *         is this buffer. Without a lent buffer the driver buffer is
+     *         used, or packets are dropped when built with
+     *         CONFIG_LORA_RX_BUFFER_LENT
+     *
+     * \param [in]  buffer        Frame buffer, NULL to withdraw it
+     * \param [in]  size          Buffer size
+     */
+    void ( *SetRxBuffer )( uint8_t *buffer, uint8_t size );
+    /*!
+     * \brief Sets the radio in preamble sniffing reception, the modem cycles
+     *        autonomously between RX and sleep and only stays in RX when a
+     *        preamble is detected
+     *
+     * \remark Available on SX126x radios only. Uses the LoRa settings of the
+     *         last SetRxConfig call. RxDone, RxError and RxTimeout end the
+     *         sniffing, it has to be restarted afterwards.
+     *
+     * \param [in]  preambleLen   Preamble length used by the transmitter [symbols]
+     *
+     * \retval      started       false when the preamble is too short to
+     *                            leave any sleep time
+     */
+    bool ( *RxSniff )( uint16_t preambleLen );
+    /*!
+     * \brief Tells if a radio interrupt is waiting for IrqProcess
+     *
+     * \remark Lets the low power management keep the MCU awake until the
+     *         radio events have been processed.
+     *
+     * \retval      pending       true when IrqProcess has events to process
+     */
+    bool ( *IrqPending )( void );
+    /*!
+     * \brief Gets the LoRa symbol time of the last SetRxConfig or
+     *        SetTxConfig call
+     *
+     * \remark Available on SX126x radios only. Lets the callers size
+     *         preambles and CAD windows in ms.
+     *
+     * \retval      symbTime      Symbol time [us], 0 when not in LoRa
+     */
+    uint32_t ( *SymbolTime )( void );
+    /*!
+     * \brief Starts a carrier sense without blocking, IsChannelFree with the
+     *        result given to RadioEvents_t.CarrierSenseDone
+     *
+     * \remark Available on SX126x radios only. The RSSI is sampled from a
+     *         timer and read in IrqProcess, the CPU is free in between. The
+     *         radio is put to sleep at the end, Standby aborts the carrier
+     *         sense without callback.
+     *
+     * \param [IN] modem      Radio modem to be used [0: FSK, 1: LoRa]
+     * \param [IN] freq       Channel RF frequency
+     * \param [IN] rssiThresh RSSI threshold
+     * \param [IN] maxCarrierSenseTime Time while the RSSI is measured [ms]
+     */
+    void ( *StartCarrierSense )( RadioModems_t modem, uint32_t freq, int16_t rssiThresh, uint32_t maxCarrierSenseTime );
+    /*!
+     * \brief Reports the temperature, the radio calibrations depending on it
+     *        are run again once it drifted
+     *
+     * \remark Available on SX126x radios only. The image calibration is kept
+     *         per frequency band and only redone on a band change or a
+     *         temperature drift.
+     *
+     * \param [IN] temperature Current temperature [Celsius]
+     */
+    void ( *SetTemperature )( int8_t temperature );
+    /*!
+     * \brief Lets the radio parked by Sleep drop to a deeper state, called
+     *        from the idle loop once the timers are armed
+     *
+     * \remark Available on SX126x radios only, does nothing without
+     *         CONFIG_LORA_SLEEP_POLICY. Sleep leaves the radio in standby
+     *         when the next timer event is close and in a warm start sleep
+     *         otherwise, this one puts the radio from standby to sleep and
+     *         from warm to cold start sleep as the next event moves away.
+     */
+    void ( *SleepIdle )( void );
+    /*!
+     * \brief Starts a spectrum scan without blocking: each channel of the
+     *        list is sampled in turn and the samples accumulated into its
+     *        RSSI range, average and occupancy histogram
+     *
+     * \remark Available on SX126x radios only. The radio is kept in RX with
+     *         the current modulation, only the frequency changes between the
+     *         channels. The RSSI is sampled every ms from a timer and read in
+     *         IrqProcess, the CPU is free in between. The radio is put to
+     *         sleep at the end, Done set and RadioEvents_t.SpectrumScanDone
+     *         called. Standby aborts the scan without callback.
+     *
+     * \param [IN] scan   Scan, kept by the caller until Done
+     */
+    void ( *StartSpectrumScan )( RadioSpectrumScan_t *scan );
+    /*!
+     * \brief Captures the packets of a continuous RX from the interrupt
+     *
+     * \remark Available on SX126x radios only, does nothing without
+     *         CONFIG_LORA_RX_RING. While RX is continuous the DIO interrupt
+     *         reads each packet and its status into a ring, with the time it
+     *         came in, so packets closer than the main loop latency are not
+     *         lost. IrqProcess hands the packets of the ring to RxDone or
+     *         RxError in order, IrqPending stays set while some are left.
+     *
+     * \param [IN] enable Captures from the interrupt when true
+     */
+    void ( *SetRxRing )( bool enable );
+    /*!
+     * \brief Gets the time the packet given to RxDone or RxError came in
+     *
+     * \remark Available on SX126x radios only. Taken in the interrupt for
+     *         the packets of the RX ring or with CONFIG_LORA_EVENT_TIMESTAMP,
+     *         in IrqProcess otherwise.
+     *
+     * \retval time       System time of the RX done [ms]
+     */
+    uint32_t ( *GetRxTime )( void );
+    /*!
+     * \brief Gets the time of the event given to TxDone, RxDone or RxError
+     *
+     * \remark Available on SX126x radios only. With CONFIG_LORA_EVENT_TIMESTAMP
+     *         the DIO interrupt latches the RTC ticks at its entry, within
+     *         the interrupt latency of the radio event and an RTC tick of
+     *         about 31 us, whatever the main loop delays the callback by.
+     *         Taken in IrqProcess otherwise, the packets of the RX ring
+     *         excepted. To be read from the callback.
+     *
+     * \retval ticks      RTC ticks of the event, the origin of TimerStartPrecise
+     */
+    uint32_t ( *GetEventTicks )( void );
+    /*!
+     * \brief Stops the operation in progress without its callbacks
+     *
+     * \remark Available on SX126x radios only. Sets the radio in standby like
+     *         Standby, stops the TX and RX timeouts and drops the events
+     *         already raised and the packets of the RX ring, for the radio to
+     *         change hands.
+     */
+    void ( *Abort )( void );
 };
 
 /*!
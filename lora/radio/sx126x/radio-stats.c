@@ -0,0 +1,263 @@
+/*!
+ * \file      radio-stats.c
+ *
+ * \brief     SX126x airtime and energy accounting implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <string.h>
+#include "timer.h"
+#include "rtc-board.h"
+#include "sx126x-board.h"
+#include "radio-stats.h"
+#ifdef CONFIG_WARM_BOOT_RETAINED
+#include "tremo_cm4.h"
+#include "warm-boot.h"
+#endif
+
+/*!
+ * Counters, the times in RTC ticks until read
+ */
+#ifdef CONFIG_WARM_BOOT_RETAINED
+static RadioStats_t Stats RETAINED_ATTR;
+
+/*!
+ * Set once the counters of a warm boot are kept or those of a cold boot
+ * cleared
+ */
+static bool StatsRestored = false;
+#else
+static RadioStats_t Stats;
+#endif
+
+/*!
+ * The mode indexes of radio-stats.h must follow RadioOperatingModes_t
+ */
+typedef char RadioStatsModeCheck_t[( MODE_CAD == RADIO_STATS_MODE_CAD ) ? 1 : -1];
+
+/*!
+ * Mode being accounted and its start
+ */
+static RadioOperatingModes_t StatsMode;
+static TimerTime_t StatsModeStart;
+static bool StatsStarted = false;
+
+/*!
+ * Spreading factor index and TX level of the running TX or RX, -1 when not
+ * in LoRa
+ */
+static int8_t StatsSf = -1;
+static uint8_t StatsTxLevel = 0;
+
+/*!
+ * TX power of the next transmissions [dBm]
+ */
+static int8_t StatsTxPower = 0;
+
+static const RadioStatsCurrents_t RadioStatsCurrentsDefault =
+{
+    .Mode =
+    {
+        [MODE_SLEEP] = 1,
+        [MODE_STDBY_RC] = 600,
+        [MODE_STDBY_XOSC] = 800,
+        [MODE_FS] = 2100,
+        [MODE_RX] = 4600,
+        // Upper bound, the share of sleep depends on the duty cycle
+        [MODE_RX_DC] = 4600,
+        [MODE_CAD] = 4600,
+    },
+    .Tx =
+    {
+        { 0, 20000 },
+        { 10, 30000 },
+        { 14, 45000 },
+        { 17, 58000 },
+        { 20, 84000 },
+        { 22, 118000 },
+    },
+};
+
+static const RadioStatsCurrents_t *StatsCurrents = &RadioStatsCurrentsDefault;
+
+static uint8_t RadioStatsTxLevel( int8_t power )
+{
+    uint8_t level;
+
+    for( level = 0; level < ( RADIO_STATS_TX_LEVEL_MAX - 1 ); level++ )
+    {
+        if( power <= StatsCurrents->Tx[level].Power )
+        {
+            break;
+        }
+    }
+    return level;
+}
+
+/*!
+ * \brief Adds the time since the start of the mode to its counters
+ */
+#ifdef CONFIG_WARM_BOOT_RETAINED
+/*!
+ * \brief Clears the counters on a cold boot, called with the IRQs disabled
+ */
+static void RadioStatsRestore( void )
+{
+    if( WarmBootIsWarm( ) == false )
+    {
+        memset( &Stats, 0, sizeof( RadioStats_t ) );
+    }
+    StatsRestored = true;
+}
+#endif
+
+static void RadioStatsAccount( TimerTime_t now )
+{
+    TimerTime_t elapsed = now - StatsModeStart;
+
+    Stats.Time[StatsMode] += elapsed;
+    if( StatsMode == MODE_TX )
+    {
+        Stats.LevelTxTime[StatsTxLevel] += elapsed;
+        if( StatsSf >= 0 )
+        {
+            Stats.SfTxTime[StatsSf] += elapsed;
+        }
+    }
+    else if( ( ( StatsMode == MODE_RX ) || ( StatsMode == MODE_RX_DC ) ) && ( StatsSf >= 0 ) )
+    {
+        Stats.SfRxTime[StatsSf] += elapsed;
+    }
+    StatsModeStart = now;
+}
+
+void RadioStatsModeChange( uint8_t mode )
+{
+    TimerTime_t now = RtcGetTimerTicks( );
+    bool entered;
+
+    if( mode >= RADIO_STATS_MODE_MAX )
+    {
+        return;
+    }
+
+    BoardDisableIrq( );
+#ifdef CONFIG_WARM_BOOT_RETAINED
+    if( StatsRestored == false )
+    {
+        RadioStatsRestore( );
+    }
+#endif
+    if( StatsStarted == true )
+    {
+        RadioStatsAccount( now );
+    }
+    entered = ( StatsStarted == false ) || ( mode != StatsMode );
+    StatsStarted = true;
+    StatsMode = mode;
+    StatsModeStart = now;
+
+    if( ( SX126x.ModulationParams.PacketType == PACKET_TYPE_LORA ) &&
+        ( SX126x.ModulationParams.Params.LoRa.SpreadingFactor >= RADIO_STATS_SF_MIN ) &&
+        ( SX126x.ModulationParams.Params.LoRa.SpreadingFactor < ( RADIO_STATS_SF_MIN + RADIO_STATS_SF_MAX ) ) )
+    {
+        StatsSf = SX126x.ModulationParams.Params.LoRa.SpreadingFactor - RADIO_STATS_SF_MIN;
+    }
+    else
+    {
+        StatsSf = -1;
+    }
+    StatsTxLevel = RadioStatsTxLevel( StatsTxPower );
+
+    if( entered == true )
+    {
+        Stats.Count[mode]++;
+        if( mode == MODE_TX )
+        {
+            Stats.LevelTxCount[StatsTxLevel]++;
+            if( StatsSf >= 0 )
+            {
+                Stats.SfTxCount[StatsSf]++;
+            }
+        }
+        else if( ( ( mode == MODE_RX ) || ( mode == MODE_RX_DC ) ) && ( StatsSf >= 0 ) )
+        {
+            Stats.SfRxCount[StatsSf]++;
+        }
+    }
+    BoardEnableIrq( );
+}
+
+void RadioStatsSetTxPower( int8_t power )
+{
+    StatsTxPower = power;
+}
+
+void RadioStatsGet( RadioStats_t *stats )
+{
+    uint8_t i;
+
+    BoardDisableIrq( );
+#ifdef CONFIG_WARM_BOOT_RETAINED
+    if( StatsRestored == false )
+    {
+        RadioStatsRestore( );
+    }
+#endif
+    if( StatsStarted == true )
+    {
+        RadioStatsAccount( RtcGetTimerTicks( ) );
+    }
+    memcpy( stats, &Stats, sizeof( RadioStats_t ) );
+    BoardEnableIrq( );
+
+    for( i = 0; i < RADIO_STATS_MODE_MAX; i++ )
+    {
+        stats->Time[i] = RtcTick2Us( stats->Time[i] );
+    }
+    for( i = 0; i < RADIO_STATS_SF_MAX; i++ )
+    {
+        stats->SfTxTime[i] = RtcTick2Us( stats->SfTxTime[i] );
+        stats->SfRxTime[i] = RtcTick2Us( stats->SfRxTime[i] );
+    }
+    for( i = 0; i < RADIO_STATS_TX_LEVEL_MAX; i++ )
+    {
+        stats->LevelTxTime[i] = RtcTick2Us( stats->LevelTxTime[i] );
+    }
+}
+
+void RadioStatsReset( void )
+{
+    BoardDisableIrq( );
+    memset( &Stats, 0, sizeof( RadioStats_t ) );
+#ifdef CONFIG_WARM_BOOT_RETAINED
+    StatsRestored = true;
+#endif
+    StatsModeStart = RtcGetTimerTicks( );
+    BoardEnableIrq( );
+}
+
+void RadioStatsSetCurrents( const RadioStatsCurrents_t *currents )
+{
+    StatsCurrents = ( currents != NULL ) ? currents : &RadioStatsCurrentsDefault;
+}
+
+uint32_t RadioStatsCharge( const RadioStats_t *stats )
+{
+    uint64_t charge = 0;
+    uint8_t i;
+
+    // us x uA, 3.6e9 of them per uAh
+    for( i = 0; i < RADIO_STATS_MODE_MAX; i++ )
+    {
+        if( i != MODE_TX )
+        {
+            charge += stats->Time[i] * StatsCurrents->Mode[i];
+        }
+    }
+    for( i = 0; i < RADIO_STATS_TX_LEVEL_MAX; i++ )
+    {
+        charge += stats->LevelTxTime[i] * StatsCurrents->Tx[i].Current;
+    }
+    return ( uint32_t )( charge / 3600000000ULL );
+}
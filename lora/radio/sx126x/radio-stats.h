@@ -0,0 +1,175 @@
+/*!
+ * \file      radio-stats.h
+ *
+ * \brief     SX126x airtime and energy accounting
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_RADIO_STATS
+ *
+ *            Accumulates the time the radio spends in each operating mode,
+ *            timestamped with the RTC ticks on every mode change of the
+ *            SX126x driver, the IRQ completion paths included. The TX and RX
+ *            times are also split per LoRa spreading factor and the TX time
+ *            per TX power level, and the charge drawn is estimated from a
+ *            current table.
+ *
+ *            Built with CONFIG_LORA_RADIO_STATS, read through
+ *            \ref MIB_RADIO_STATS.
+ *
+ * \{
+ */
+#ifndef __RADIO_STATS_H__
+#define __RADIO_STATS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * Operating mode indexes of the counters, the RadioOperatingModes_t values
+ * of the driver. sx126x.h stays out of this header, which the MAC includes
+ */
+#define RADIO_STATS_MODE_SLEEP                      0
+#define RADIO_STATS_MODE_STDBY_RC                   1
+#define RADIO_STATS_MODE_STDBY_XOSC                 2
+#define RADIO_STATS_MODE_FS                         3
+#define RADIO_STATS_MODE_TX                         4
+#define RADIO_STATS_MODE_RX                         5
+#define RADIO_STATS_MODE_RX_DC                      6
+#define RADIO_STATS_MODE_CAD                        7
+
+/*!
+ * Number of operating modes
+ */
+#define RADIO_STATS_MODE_MAX                        ( RADIO_STATS_MODE_CAD + 1 )
+
+/*!
+ * Lowest LoRa spreading factor, index 0 of the per SF counters
+ */
+#define RADIO_STATS_SF_MIN                          5
+
+/*!
+ * Number of LoRa spreading factors, SF5 to SF12
+ */
+#define RADIO_STATS_SF_MAX                          8
+
+/*!
+ * Number of TX power levels of the current table
+ */
+#define RADIO_STATS_TX_LEVEL_MAX                    6
+
+/*!
+ * \brief TX current at a power level
+ */
+typedef struct
+{
+    /*!
+     * Highest TX power of the level [dBm]
+     */
+    int8_t Power;
+    /*!
+     * Supply current [uA]
+     */
+    uint32_t Current;
+}RadioStatsTxLevel_t;
+
+/*!
+ * \brief Supply currents of the radio, the MCU excluded
+ */
+typedef struct
+{
+    /*!
+     * Current per operating mode [uA], the RADIO_STATS_MODE_TX entry is
+     * unused
+     */
+    uint32_t Mode[RADIO_STATS_MODE_MAX];
+    /*!
+     * TX current per power level, by increasing Power. A TX is charged to
+     * the first level at or above its power, the last level above
+     */
+    RadioStatsTxLevel_t Tx[RADIO_STATS_TX_LEVEL_MAX];
+}RadioStatsCurrents_t;
+
+/*!
+ * \brief Accumulated counters
+ */
+typedef struct
+{
+    /*!
+     * Time per operating mode [us]. RADIO_STATS_MODE_RX_DC counts the whole
+     * duty cycle
+     */
+    uint64_t Time[RADIO_STATS_MODE_MAX];
+    /*!
+     * Entries per operating mode
+     */
+    uint32_t Count[RADIO_STATS_MODE_MAX];
+    /*!
+     * LoRa TX time and count per spreading factor [us]
+     */
+    uint64_t SfTxTime[RADIO_STATS_SF_MAX];
+    uint32_t SfTxCount[RADIO_STATS_SF_MAX];
+    /*!
+     * LoRa RX time and count per spreading factor [us]
+     */
+    uint64_t SfRxTime[RADIO_STATS_SF_MAX];
+    uint32_t SfRxCount[RADIO_STATS_SF_MAX];
+    /*!
+     * TX time and count per level of the current table [us]
+     */
+    uint64_t LevelTxTime[RADIO_STATS_TX_LEVEL_MAX];
+    uint32_t LevelTxCount[RADIO_STATS_TX_LEVEL_MAX];
+}RadioStats_t;
+
+/*!
+ * \brief Accounts a mode change, called by the SX126x driver
+ *
+ * \param [IN] mode    New operating mode, a RadioOperatingModes_t
+ */
+void RadioStatsModeChange( uint8_t mode );
+
+/*!
+ * \brief Records the TX power of the next transmissions, called by the
+ *        SX126x driver
+ *
+ * \param [IN] power   TX power [dBm]
+ */
+void RadioStatsSetTxPower( int8_t power );
+
+/*!
+ * \brief Reads the counters, the current mode included up to now
+ *
+ * \param [OUT] stats  Counters
+ */
+void RadioStatsGet( RadioStats_t *stats );
+
+/*!
+ * \brief Clears the counters
+ */
+void RadioStatsReset( void );
+
+/*!
+ * \brief Sets the current table used by \ref RadioStatsCharge
+ *
+ * \param [IN] currents Current table, NULL for the SX1262 datasheet values
+ *                      with the DC-DC regulator
+ */
+void RadioStatsSetCurrents( const RadioStatsCurrents_t *currents );
+
+/*!
+ * \brief Estimates the charge drawn by the radio
+ *
+ * \param [IN] stats   Counters
+ *
+ * \retval charge      Charge [uAh]
+ */
+uint32_t RadioStatsCharge( const RadioStats_t *stats );
+
+/*! \} defgroup LORA_RADIO_STATS */
+/*! \} addtogroup LORA */
+
+#endif // __RADIO_STATS_H__
@@ -20,6 +20,8 @@
  *
  * \author    Gregory Cristian ( Semtech )
  */
+#define LOG_MODULE LOG_MODULE_RADIO
+
 #include <math.h>
 #include <string.h>
 #include <stdio.h>
@@ -28,7 +30,87 @@
 #include "radio.h"
 #include "sx126x.h"
 #include "sx126x-board.h"
+#include "rtc-board.h"
 #include "utilities.h"
+#include "log.h"
+#ifdef CONFIG_RNG_POOL
+#include "rng-pool.h"
+#endif
+#include "tremo_cm4.h"
+#include "mem-profile.h"
+#include "itm-trace.h"
+#ifdef CONFIG_EVENT_QUEUE
+#include "event-queue.h"
+#endif
+
+/*!
+ * Preamble symbols the modem needs to detect a LoRa preamble in RX duty cycle
+ */
+#ifndef RADIO_RX_SNIFF_DETECT_SYMBOLS
+#define RADIO_RX_SNIFF_DETECT_SYMBOLS               4
+#endif
+
+/*!
+ * Time for the modem to go from the duty cycle sleep phase to RX [us]
+ */
+#ifndef RADIO_RX_SNIFF_WAKEUP_TIME
+#define RADIO_RX_SNIFF_WAKEUP_TIME                  500
+#endif
+
+/*!
+ * RSSI sampling period of RadioStartCarrierSense [ms]
+ */
+#ifndef RADIO_CARRIER_SENSE_PERIOD
+#define RADIO_CARRIER_SENSE_PERIOD                  1
+#endif
+
+/*!
+ * RSSI sampling period of RadioStartSpectrumScan, the first one lets the RX
+ * settle on the channel [ms]
+ */
+#ifndef RADIO_SCAN_PERIOD
+#define RADIO_SCAN_PERIOD                           1
+#endif
+
+#ifdef CONFIG_LORA_RX_RING
+/*!
+ * Packets held by the RX ring, a power of 2, and the largest one [bytes]
+ */
+#ifndef RADIO_RX_RING_SLOTS
+#define RADIO_RX_RING_SLOTS                         4
+#endif
+#ifndef RADIO_RX_RING_PAYLOAD
+#define RADIO_RX_RING_PAYLOAD                       LORAMAC_PHY_MAXPAYLOAD
+#endif
+
+#if ( RADIO_RX_RING_SLOTS & ( RADIO_RX_RING_SLOTS - 1 ) ) != 0
+#error "RADIO_RX_RING_SLOTS must be a power of 2"
+#endif
+#endif
+
+#ifdef CONFIG_LORA_SLEEP_POLICY
+/*!
+ * Time to the next timer event under which RadioSleep leaves the radio in
+ * STDBY_XOSC, the TCXO running, instead of a sleep [ms]
+ */
+#ifndef RADIO_SLEEP_STANDBY_TIME
+#define RADIO_SLEEP_STANDBY_TIME                    10
+#endif
+
+/*!
+ * Time to the next timer event from which RadioSleepIdle drops the
+ * configuration retention, the retention current then costs more than the
+ * configuration and calibration on the wake up [ms]
+ */
+#ifndef RADIO_SLEEP_COLD_TIME
+#define RADIO_SLEEP_COLD_TIME                       30000
+#endif
+
+/*!
+ * Calibration of all blocks on the wake up from a cold start sleep [ms]
+ */
+#define RADIO_COLD_WAKEUP_TIME                      4
+#endif
 
 /*!
  * \brief Initializes the radio
@@ -190,7 +272,27 @@ bool RadioCheckRfFrequency( uint32_t frequency );
  */
 uint32_t RadioTimeOnAir( RadioModems_t modem, uint8_t pktLen );
 
+#ifndef CONFIG_LORA_INTEGER_TOA
 double RadioSymbTime(uint8_t bw, uint8_t sf);
+#endif
+
+/*!
+ * \brief Computes the LoRa symbol time
+ *
+ * \param [IN] bw         LoRa bandwidth register value
+ * \param [IN] sf         Spreading factor
+ *
+ * \retval symbTime       Symbol time in us, truncated
+ */
+static uint32_t RadioSymbTimeUs( uint8_t bw, uint8_t sf );
+
+/*!
+ * \brief Tells if LowDatarateOptimize is mandated, symbol time >= 16.38 ms
+ *
+ * \param [IN] bw         LoRa bandwidth register value
+ * \param [IN] sf         Spreading factor
+ */
+static bool RadioLowDatarateOptimize( uint8_t bw, uint8_t sf );
 
 /*!
  * \brief Sends the buffer of size. Prepares the packet to be sent and sets
@@ -317,6 +419,95 @@ void RadioRxBoosted( uint32_t timeout );
  */
 void RadioSetRxDutyCycle( uint32_t rxTime, uint32_t sleepTime );
 
+/*!
+ * \brief Lends the buffer the next received packets are read into
+ *
+ * \param [in]  buffer        Frame buffer, NULL to withdraw it
+ * \param [in]  size          Buffer size
+ */
+void RadioSetRxBuffer( uint8_t *buffer, uint8_t size );
+
+/*!
+ * \brief Sets the radio in preamble sniffing reception
+ *
+ * \param [in]  preambleLen   Preamble length used by the transmitter [symbols]
+ *
+ * \retval      started       false when the preamble is too short
+ */
+bool RadioRxSniff( uint16_t preambleLen );
+
+/*!
+ * \brief Tells if a radio interrupt is waiting for RadioIrqProcess
+ *
+ * \retval      pending       true when RadioIrqProcess has events to process
+ */
+bool RadioIrqPending( void );
+
+/*!
+ * \brief Gets the LoRa symbol time of the current modulation parameters
+ *
+ * \retval      symbTime      Symbol time [us], 0 when not in LoRa
+ */
+uint32_t RadioSymbolTime( void );
+
+/*!
+ * \brief Starts a carrier sense, the result is given to
+ *        RadioEvents_t.CarrierSenseDone
+ *
+ * \param [IN] modem      Radio modem to be used [0: FSK, 1: LoRa]
+ * \param [IN] freq       Channel RF frequency
+ * \param [IN] rssiThresh RSSI threshold
+ * \param [IN] maxCarrierSenseTime Time while the RSSI is measured [ms]
+ */
+void RadioStartCarrierSense( RadioModems_t modem, uint32_t freq, int16_t rssiThresh, uint32_t maxCarrierSenseTime );
+
+/*!
+ * \brief Reports the temperature to the calibrations depending on it
+ *
+ * \param [IN] temperature Current temperature [Celsius]
+ */
+void RadioSetTemperature( int8_t temperature );
+
+/*!
+ * \brief Puts the radio parked by RadioSleep in a deeper state once the
+ *        next timer event is known to be far
+ */
+void RadioSleepIdle( void );
+
+/*!
+ * \brief Starts a spectrum scan, the end is given to
+ *        RadioEvents_t.SpectrumScanDone
+ *
+ * \param [IN] scan   Scan, kept by the caller until Done
+ */
+void RadioStartSpectrumScan( RadioSpectrumScan_t *scan );
+
+/*!
+ * \brief Captures the packets of a continuous RX from the interrupt
+ *
+ * \param [IN] enable Captures from the interrupt when true
+ */
+void RadioSetRxRing( bool enable );
+
+/*!
+ * \brief Gets the time the packet given to RxDone or RxError came in
+ *
+ * \retval time       System time of the RX done [ms]
+ */
+uint32_t RadioGetRxTime( void );
+
+/*!
+ * \brief Gets the RTC ticks of the event given to TxDone, RxDone or RxError
+ *
+ * \retval ticks      RTC ticks of the event
+ */
+uint32_t RadioGetEventTicks( void );
+
+/*!
+ * \brief Stops the operation in progress without its callbacks
+ */
+void RadioAbort( void );
+
 /*!
  * Radio driver structure initialization
  */
@@ -349,7 +540,19 @@ const struct Radio_s Radio =
     RadioIrqProcess,
     // Available on SX126x only
     RadioRxBoosted,
-    RadioSetRxDutyCycle
+    RadioSetRxDutyCycle,
+    RadioSetRxBuffer,
+    RadioRxSniff,
+    RadioIrqPending,
+    RadioSymbolTime,
+    RadioStartCarrierSense,
+    RadioSetTemperature,
+    RadioSleepIdle,
+    RadioStartSpectrumScan,
+    RadioSetRxRing,
+    RadioGetRxTime,
+    RadioGetEventTicks,
+    RadioAbort
 };
 
 /*
@@ -413,11 +616,66 @@ bool RxContinuous = false;
 
 
 PacketStatus_t RadioPktStatus;
-uint8_t RadioRxPayload[255];
+#ifndef CONFIG_LORA_RX_BUFFER_LENT
+uint8_t RadioRxPayload[LORAMAC_PHY_MAXPAYLOAD];
+#endif
 
-bool IrqFired = false;
+/*!
+ * Buffer the next received packet is read into
+ */
+#ifndef CONFIG_LORA_RX_BUFFER_LENT
+static uint8_t *RadioRxBuffer = RadioRxPayload;
+static uint8_t RadioRxBufferSize = LORAMAC_PHY_MAXPAYLOAD;
+#else
+static uint8_t *RadioRxBuffer = NULL;
+static uint8_t RadioRxBufferSize = 0;
+#endif
+
+volatile bool IrqFired = false;
 uint16_t irqRegs;
 
+/*!
+ * Time of the packet given to RxDone or RxError
+ */
+static TimerTime_t RadioRxTime = 0;
+
+/*!
+ * RTC ticks of the event given to TxDone, RxDone or RxError
+ */
+static uint32_t RadioEventTicks = 0;
+
+#ifdef CONFIG_LORA_EVENT_TIMESTAMP
+/*!
+ * RTC ticks of the last DIO interrupt, latched at the handler entry
+ */
+static volatile uint32_t RadioIrqTicks = 0;
+#endif
+
+#ifdef CONFIG_LORA_RX_RING
+/*!
+ * \brief Packet captured by the DIO interrupt
+ */
+typedef struct
+{
+    TimerTime_t Time;
+    uint32_t Ticks;             //!< RTC ticks of the DIO interrupt
+    int16_t Rssi;
+    int8_t Snr;
+    bool Error;                 //!< CRC error, or too large for a slot
+    uint8_t Size;
+    uint8_t Payload[RADIO_RX_RING_PAYLOAD];
+}RadioRxSlot_t;
+
+/*!
+ * RX ring, filled by RadioOnDioIrq from RxRingHead and drained by
+ * RadioIrqProcess from RxRingTail
+ */
+static RadioRxSlot_t RxRing[RADIO_RX_RING_SLOTS];
+static volatile uint8_t RxRingHead = 0;
+static volatile uint8_t RxRingTail = 0;
+static bool RxRingEnabled = false;
+#endif
+
 /*
  * SX126x DIO IRQ callback functions prototype
  */
@@ -441,6 +699,16 @@ void RadioOnRxTimeoutIrq( void );
  * \brief Cad timeout timer callback
  */
 void RadioOnCadTimeoutIrq( void );
+
+/*!
+ * \brief Carrier sense sampling timer callback
+ */
+void RadioOnCarrierSenseTimerIrq( void );
+
+/*!
+ * \brief Spectrum scan sampling timer callback
+ */
+void RadioOnSpectrumScanTimerIrq( void );
 /*
  * Private global variables
  */
@@ -477,6 +745,33 @@ SX126x_t SX126x;
 TimerEvent_t TxTimeoutTimer;
 TimerEvent_t RxTimeoutTimer;
 TimerEvent_t CadTimeoutTimer;
+TimerEvent_t CarrierSenseTimer;
+TimerEvent_t SpectrumScanTimer;
+
+/*!
+ * RadioStartCarrierSense state
+ */
+static RadioModems_t CarrierSenseModem;
+static int16_t CarrierSenseThresh;
+static uint32_t CarrierSenseTime;
+static TimerTime_t CarrierSenseStart;
+static bool CarrierSenseRunning = false;
+static volatile bool CarrierSenseDue = false;
+
+/*!
+ * RadioStartSpectrumScan state, SpectrumScan is NULL when none runs
+ */
+static RadioSpectrumScan_t *SpectrumScan = NULL;
+static uint8_t SpectrumScanIndex;
+static uint16_t SpectrumScanSample;
+static volatile bool SpectrumScanDue = false;
+
+#ifdef CONFIG_LORA_SLEEP_POLICY
+/*!
+ * Set by the cold start sleep of RadioSleepIdle, until the radio is used
+ */
+static bool RadioSleepCold = false;
+#endif
 
 /*!
  * Returns the known FSK bandwidth registers value
@@ -520,8 +815,14 @@ int RadioInit( RadioEvents_t *events )
     TimerInit( &TxTimeoutTimer, RadioOnTxTimeoutIrq );
     TimerInit( &RxTimeoutTimer, RadioOnRxTimeoutIrq );
     TimerInit( &CadTimeoutTimer, RadioOnCadTimeoutIrq );
+    TimerInit( &CarrierSenseTimer, RadioOnCarrierSenseTimerIrq );
+    TimerInit( &SpectrumScanTimer, RadioOnSpectrumScanTimerIrq );
 
     IrqFired = false;
+    CarrierSenseRunning = false;
+    CarrierSenseDue = false;
+    SpectrumScan = NULL;
+    SpectrumScanDue = false;
     return 0;
 }
 
@@ -565,7 +866,7 @@ void RadioSetModem( RadioModems_t modem )
 
 void RadioSetChannel( uint32_t freq )
 {
-    printf("\r\nRadioSetChannel: %ld\r\n", freq);
+    LOG_PRINTF(LL_VDEBUG, "\r\nRadioSetChannel: %ld\r\n", freq);
     SX126xSetRfFrequency( freq );
 }
 
@@ -600,8 +901,174 @@ bool RadioIsChannelFree( RadioModems_t modem, uint32_t freq, int16_t rssiThresh,
     return status;
 }
 
+void RadioStartCarrierSense( RadioModems_t modem, uint32_t freq, int16_t rssiThresh, uint32_t maxCarrierSenseTime )
+{
+    TimerStop( &CarrierSenseTimer );
+    CarrierSenseModem = modem;
+    CarrierSenseThresh = rssiThresh;
+    CarrierSenseTime = maxCarrierSenseTime;
+    CarrierSenseDue = false;
+    CarrierSenseRunning = true;
+
+    RadioSetModem( modem );
+
+    RadioSetChannel( freq );
+
+    // Only the RSSI is read, no packet event may end the listen period
+    SX126xSetDioIrqParams( IRQ_RADIO_NONE, IRQ_RADIO_NONE, IRQ_RADIO_NONE, IRQ_RADIO_NONE );
+    SX126xSetRx( 0xFFFFFF );
+
+    // As RadioIsChannelFree, the sense time starts once the RX has settled
+    CarrierSenseStart = TimerGetCurrentTime( ) + RADIO_CARRIER_SENSE_PERIOD;
+    TimerSetValue( &CarrierSenseTimer, RADIO_CARRIER_SENSE_PERIOD );
+    TimerStart( &CarrierSenseTimer );
+}
+
+/*!
+ * \brief Reads one RSSI sample of the running carrier sense, from
+ *        RadioIrqProcess
+ */
+static void RadioCarrierSenseProcess( void )
+{
+    bool channelFree;
+
+    CarrierSenseDue = false;
+    if( CarrierSenseRunning == false )
+    {
+        return;
+    }
+
+    if( RadioRssi( CarrierSenseModem ) > CarrierSenseThresh )
+    {
+        channelFree = false;
+    }
+    else if( ( TimerGetCurrentTime( ) - CarrierSenseStart ) < CarrierSenseTime )
+    {
+        TimerSetValue( &CarrierSenseTimer, RADIO_CARRIER_SENSE_PERIOD );
+        TimerStart( &CarrierSenseTimer );
+        return;
+    }
+    else
+    {
+        channelFree = true;
+    }
+
+    CarrierSenseRunning = false;
+    RadioSleep( );
+    if( ( RadioEvents != NULL ) && ( RadioEvents->CarrierSenseDone != NULL ) )
+    {
+        RadioEvents->CarrierSenseDone( channelFree );
+    }
+}
+
+/*!
+ * \brief Moves the RX of the running spectrum scan to its current channel
+ */
+static void RadioSpectrumScanChannel( void )
+{
+    // STDBY_XOSC keeps the oscillator running, the RX restarts at once
+    SX126xSetStandby( STDBY_XOSC );
+    SX126xSetRfFrequency( SpectrumScan->Freqs[SpectrumScanIndex] );
+    SX126xSetRx( 0xFFFFFF );
+
+    SpectrumScanSample = 0;
+    TimerSetValue( &SpectrumScanTimer, RADIO_SCAN_PERIOD );
+    TimerStart( &SpectrumScanTimer );
+}
+
+void RadioStartSpectrumScan( RadioSpectrumScan_t *scan )
+{
+    TimerStop( &CarrierSenseTimer );
+    CarrierSenseRunning = false;
+    TimerStop( &SpectrumScanTimer );
+    SpectrumScanDue = false;
+
+    scan->Done = false;
+    if( ( scan->Count == 0 ) || ( scan->Samples == 0 ) )
+    {
+        SpectrumScan = NULL;
+        scan->Done = true;
+        return;
+    }
+    SpectrumScan = scan;
+    SpectrumScanIndex = 0;
+
+    // Only the RSSI is read, no packet event may end the listen period
+    SX126xSetDioIrqParams( IRQ_RADIO_NONE, IRQ_RADIO_NONE, IRQ_RADIO_NONE, IRQ_RADIO_NONE );
+    RadioSpectrumScanChannel( );
+}
+
+/*!
+ * \brief Reads one RSSI sample of the running spectrum scan, from
+ *        RadioIrqProcess
+ */
+static void RadioSpectrumScanProcess( void )
+{
+    RadioSpectrumScan_t *scan = SpectrumScan;
+    RadioScanChannel_t *channel;
+    int16_t rssi;
+    int16_t bin;
+
+    SpectrumScanDue = false;
+    if( scan == NULL )
+    {
+        return;
+    }
+
+    rssi = SX126xGetRssiInst( );
+    channel = &scan->Channels[SpectrumScanIndex];
+    if( ( channel->Samples == 0 ) || ( rssi < channel->RssiMin ) )
+    {
+        channel->RssiMin = rssi;
+    }
+    if( ( channel->Samples == 0 ) || ( rssi > channel->RssiMax ) )
+    {
+        channel->RssiMax = rssi;
+    }
+    channel->RssiSum += rssi;
+    channel->Samples++;
+
+    bin = ( rssi - RADIO_SCAN_RSSI_FLOOR ) / RADIO_SCAN_RSSI_STEP;
+    if( bin < 0 )
+    {
+        bin = 0;
+    }
+    else if( bin >= RADIO_SCAN_BINS )
+    {
+        bin = RADIO_SCAN_BINS - 1;
+    }
+    if( channel->Hist[bin] < UINT16_MAX )
+    {
+        channel->Hist[bin]++;
+    }
+
+    if( ++SpectrumScanSample < scan->Samples )
+    {
+        TimerSetValue( &SpectrumScanTimer, RADIO_SCAN_PERIOD );
+        TimerStart( &SpectrumScanTimer );
+        return;
+    }
+    if( ++SpectrumScanIndex < scan->Count )
+    {
+        RadioSpectrumScanChannel( );
+        return;
+    }
+
+    SpectrumScan = NULL;
+    RadioSleep( );
+    scan->Done = true;
+    if( ( RadioEvents != NULL ) && ( RadioEvents->SpectrumScanDone != NULL ) )
+    {
+        RadioEvents->SpectrumScanDone( scan );
+    }
+}
+
 uint32_t RadioRandom( void )
 {
+#ifdef CONFIG_RNG_POOL
+    // The radio is left as it is
+    return RngPoolGet( );
+#else
     uint8_t i;
     uint32_t rnd = 0;
 
@@ -624,6 +1091,7 @@ uint32_t RadioRandom( void )
     RadioSleep( );
 
     return rnd;
+#endif
 }
 
 void RadioSetRxConfig( RadioModems_t modem, uint32_t bandwidth,
@@ -637,15 +1105,15 @@ void RadioSetRxConfig( RadioModems_t modem, uint32_t bandwidth,
 
     RxContinuous = rxContinuous;
 
-    printf("\r\nRadioSetRxConfig\r\n");
-    printf("bandwidth: %ld\r\n", bandwidth);
-    printf("datarate: %ld\r\n", datarate);
-    printf("coderate: %d\r\n", coderate);
-    printf("bandwidthAfc: %ld\r\n", bandwidthAfc);
-    printf("preambleLen: %d\r\n", preambleLen);
-    printf("symbTimeout: %d\r\n", symbTimeout);
-    printf("payloadLen: %d\r\n", payloadLen);
-    printf("rxContinuous: %d\r\n", rxContinuous);
+    LOG_PRINTF(LL_VDEBUG, "\r\nRadioSetRxConfig\r\n");
+    LOG_PRINTF(LL_VDEBUG, "bandwidth: %ld\r\n", bandwidth);
+    LOG_PRINTF(LL_VDEBUG, "datarate: %ld\r\n", datarate);
+    LOG_PRINTF(LL_VDEBUG, "coderate: %d\r\n", coderate);
+    LOG_PRINTF(LL_VDEBUG, "bandwidthAfc: %ld\r\n", bandwidthAfc);
+    LOG_PRINTF(LL_VDEBUG, "preambleLen: %d\r\n", preambleLen);
+    LOG_PRINTF(LL_VDEBUG, "symbTimeout: %d\r\n", symbTimeout);
+    LOG_PRINTF(LL_VDEBUG, "payloadLen: %d\r\n", payloadLen);
+    LOG_PRINTF(LL_VDEBUG, "rxContinuous: %d\r\n", rxContinuous);
 
     if( rxContinuous == true )
     {
@@ -663,7 +1131,8 @@ void RadioSetRxConfig( RadioModems_t modem, uint32_t bandwidth,
     switch( modem )
     {
         case MODEM_FSK:
-            SX126xSetStopRxTimerOnPreambleDetect( false );
+            // The RX timer ends an empty window, a detected preamble keeps the frame
+            SX126xSetStopRxTimerOnPreambleDetect( true );
             SX126x.ModulationParams.PacketType = PACKET_TYPE_GFSK;
 
             SX126x.ModulationParams.Params.Gfsk.BitRate = datarate;
@@ -698,15 +1167,17 @@ void RadioSetRxConfig( RadioModems_t modem, uint32_t bandwidth,
             break;
 
         case MODEM_LORA:
+            // The symbol timeout ends an empty window, the RX timer is left at its maximum
             SX126xSetStopRxTimerOnPreambleDetect( false );
-            SX126xSetLoRaSymbNumTimeout( symbTimeout );
+            SX126xSetLoRaSymbNumTimeout( ( symbTimeout > SX126X_MAX_LORA_SYMB_NUM_TIMEOUT ) ?
+                                         SX126X_MAX_LORA_SYMB_NUM_TIMEOUT : symbTimeout );
             SX126x.ModulationParams.PacketType = PACKET_TYPE_LORA;
             SX126x.ModulationParams.Params.LoRa.SpreadingFactor = ( RadioLoRaSpreadingFactors_t )datarate;
             SX126x.ModulationParams.Params.LoRa.Bandwidth = Bandwidths[bandwidth];
             SX126x.ModulationParams.Params.LoRa.CodingRate = ( RadioLoRaCodingRates_t )coderate;
 
             if( ( ( bandwidth == 0 ) && ( ( datarate == 11 ) || ( datarate == 12 ) ) ) ||
-            ( ( bandwidth == 1 ) && ( datarate == 12 ) ) || (RadioSymbTime(Bandwidths[bandwidth], datarate) >= 16.38) )
+            ( ( bandwidth == 1 ) && ( datarate == 12 ) ) || RadioLowDatarateOptimize( Bandwidths[bandwidth], datarate ) )
             {
                 SX126x.ModulationParams.Params.LoRa.LowDatarateOptimize = 0x01;
             }
@@ -770,6 +1241,9 @@ void RadioSetTxConfig( RadioModems_t modem, int8_t power, uint32_t fdev,
                         bool fixLen, bool crcOn, bool freqHopOn,
                         uint8_t hopPeriod, bool iqInverted, uint32_t timeout )
 {
+#ifdef CONFIG_LORA_CMD_BATCH
+    SX126xBatchBegin( );
+#endif
 
     switch( modem )
     {
@@ -813,7 +1287,7 @@ void RadioSetTxConfig( RadioModems_t modem, int8_t power, uint32_t fdev,
             SX126x.ModulationParams.Params.LoRa.CodingRate= ( RadioLoRaCodingRates_t )coderate;
 
             if( ( ( bandwidth == 0 ) && ( ( datarate == 11 ) || ( datarate == 12 ) ) ) ||
-            ( ( bandwidth == 1 ) && ( datarate == 12 ) ) || (RadioSymbTime(Bandwidths[bandwidth], datarate) >= 16.38) )
+            ( ( bandwidth == 1 ) && ( datarate == 12 ) ) || RadioLowDatarateOptimize( Bandwidths[bandwidth], datarate ) )
             {
                 SX126x.ModulationParams.Params.LoRa.LowDatarateOptimize = 0x01;
             }
@@ -868,6 +1342,9 @@ void RadioSetTxConfig( RadioModems_t modem, int8_t power, uint32_t fdev,
 
     SX126xSetRfTxPower( power );
     TxTimeout = timeout;
+#ifdef CONFIG_LORA_CMD_BATCH
+    SX126xBatchEnd( );
+#endif
 }
 
 bool RadioCheckRfFrequency( uint32_t frequency )
@@ -875,6 +1352,64 @@ bool RadioCheckRfFrequency( uint32_t frequency )
     return true;
 }
 
+#ifdef CONFIG_LORA_INTEGER_TOA
+/*!
+ * LoRa bandwidths in 10 Hz units, indexed by the bandwidth register value.
+ * These are exactly the kHz figures of the floating point implementation,
+ * so both give the same results.
+ */
+static const uint16_t RadioLoRaBandwidths10Hz[] =
+{
+    781,    // LORA_BW_007
+    1563,   // LORA_BW_015
+    3125,   // LORA_BW_031
+    6250,   // LORA_BW_062
+    12500,  // LORA_BW_125
+    25000,  // LORA_BW_250
+    50000,  // LORA_BW_500
+    0,
+    1042,   // LORA_BW_010
+    2083,   // LORA_BW_020
+    4167,   // LORA_BW_041
+};
+
+static uint32_t RadioGetLoRaBandwidth10Hz( uint8_t bw )
+{
+    if( bw >= sizeof( RadioLoRaBandwidths10Hz ) / sizeof( RadioLoRaBandwidths10Hz[0] ) )
+    {
+        return 0;
+    }
+    return RadioLoRaBandwidths10Hz[bw];
+}
+
+static uint32_t RadioSymbTimeUs( uint8_t bw, uint8_t sf )
+{
+    uint32_t bw10Hz = RadioGetLoRaBandwidth10Hz( bw );
+
+    if( bw10Hz == 0 )
+    {
+        return 0;
+    }
+    // Ts = 2^SF / BW[kHz] ms = 2^SF * 100000 / BW[10 Hz] us
+    return ( ( uint32_t )( 1 << sf ) * 100000 ) / bw10Hz;
+}
+
+static bool RadioLowDatarateOptimize( uint8_t bw, uint8_t sf )
+{
+    // 2^SF / ( BW[10 Hz] / 100 ) >= 16.38
+    return ( ( uint32_t )( 1 << sf ) * 10000 ) >= ( 1638 * RadioGetLoRaBandwidth10Hz( bw ) );
+}
+#else
+static uint32_t RadioSymbTimeUs( uint8_t bw, uint8_t sf )
+{
+    return ( uint32_t )( RadioSymbTime( bw, sf ) * 1000 );
+}
+
+static bool RadioLowDatarateOptimize( uint8_t bw, uint8_t sf )
+{
+    return RadioSymbTime( bw, sf ) >= 16.38;
+}
+
 double RadioSymbTime(uint8_t bw, uint8_t sf)
 {
     double bw_khz = 0;
@@ -894,7 +1429,67 @@ double RadioSymbTime(uint8_t bw, uint8_t sf)
     
     return (1<<sf)/bw_khz;
 }
+#endif
 
+#ifdef CONFIG_LORA_INTEGER_TOA
+uint32_t RadioTimeOnAir( RadioModems_t modem, uint8_t pktLen )
+{
+    uint32_t airTime = 0;
+
+    switch( modem )
+    {
+    case MODEM_FSK:
+        {
+            uint32_t bitRate = SX126x.ModulationParams.Params.Gfsk.BitRate;
+            uint32_t bits = 8 * ( SX126x.PacketParams.Params.Gfsk.PreambleLength +
+                                  ( SX126x.PacketParams.Params.Gfsk.SyncWordLength >> 3 ) +
+                                  ( ( SX126x.PacketParams.Params.Gfsk.HeaderType == RADIO_PACKET_FIXED_LENGTH ) ? 0 : 1 ) +
+                                  pktLen +
+                                  ( ( SX126x.PacketParams.Params.Gfsk.CrcLength == RADIO_CRC_2_BYTES ) ? 2 : 0 ) );
+            uint32_t rem;
+
+            if( bitRate == 0 )
+            {
+                break;
+            }
+            // rint( bits / bitRate * 1e3 ), rounding half to even
+            airTime = ( bits * 1000 ) / bitRate;
+            rem = ( bits * 1000 ) % bitRate;
+            if( ( ( 2 * rem ) > bitRate ) || ( ( ( 2 * rem ) == bitRate ) && ( ( airTime & 1 ) != 0 ) ) )
+            {
+                airTime++;
+            }
+        }
+        break;
+    case MODEM_LORA:
+        {
+            uint8_t sf = SX126x.ModulationParams.Params.LoRa.SpreadingFactor;
+            uint32_t bw10Hz = RadioGetLoRaBandwidth10Hz( SX126x.ModulationParams.Params.LoRa.Bandwidth );
+            int32_t num = 8 * pktLen - 4 * sf + 28 + 16 * SX126x.PacketParams.Params.LoRa.CrcMode -
+                          ( ( SX126x.PacketParams.Params.LoRa.HeaderType == LORA_PACKET_FIXED_LENGTH ) ? 20 : 0 );
+            int32_t den = 4 * ( sf - ( ( SX126x.ModulationParams.Params.LoRa.LowDatarateOptimize > 0 ) ? 2 : 0 ) );
+            uint32_t nPayload = 8;
+            uint64_t quarters;
+
+            if( ( bw10Hz == 0 ) || ( den <= 0 ) )
+            {
+                break;
+            }
+            // Symbol length of payload
+            if( num > 0 )
+            {
+                nPayload += ( ( num + den - 1 ) / den ) * ( ( SX126x.ModulationParams.Params.LoRa.CodingRate % 4 ) + 4 );
+            }
+            // Preamble + 4.25 + payload symbols, counted in quarter symbols
+            quarters = 4 * ( ( uint64_t )SX126x.PacketParams.Params.LoRa.PreambleLength + nPayload ) + 17;
+            // floor( quarters / 4 * 2^SF / BW[kHz] + 0.999 ) with BW[kHz] = BW[10 Hz] / 100
+            airTime = ( uint32_t )( ( ( quarters << sf ) * 25000 + 999 * bw10Hz ) / ( ( uint64_t )bw10Hz * 1000 ) );
+        }
+        break;
+    }
+    return airTime;
+}
+#else
 uint32_t RadioTimeOnAir( RadioModems_t modem, uint8_t pktLen )
 {
     uint32_t airTime = 0;
@@ -935,9 +1530,13 @@ uint32_t RadioTimeOnAir( RadioModems_t modem, uint8_t pktLen )
     }
     return airTime;
 }
+#endif
 
 void RadioSend( uint8_t *buffer, uint8_t size )
 {
+#ifdef CONFIG_LORA_CMD_BATCH
+    SX126xBatchBegin( );
+#endif
     SX126xSetDioIrqParams( IRQ_TX_DONE | IRQ_RX_TX_TIMEOUT,
                            IRQ_TX_DONE | IRQ_RX_TX_TIMEOUT,
                            IRQ_RADIO_NONE,
@@ -954,22 +1553,95 @@ void RadioSend( uint8_t *buffer, uint8_t size )
     SX126xSetPacketParams( &SX126x.PacketParams );
 
     SX126xSendPayload( buffer, size, 0 );
+#ifdef CONFIG_LORA_CMD_BATCH
+    SX126xBatchEnd( );
+#endif
     TimerSetValue( &TxTimeoutTimer, TxTimeout );
     TimerStart( &TxTimeoutTimer );
 }
 
+#ifdef CONFIG_LORA_SLEEP_POLICY
+/*!
+ * \brief Gets the time to the next timer event
+ *
+ * \retval time      Time to the next event [ms], TIMER_NO_EVENT when none
+ */
+static TimerTime_t RadioSleepNextEvent( void )
+{
+    uint32_t primask = __get_PRIMASK( );
+    TimerTime_t next;
+
+    __disable_irq( );
+    next = TimerGetTimeToNextEvent( );
+    __set_PRIMASK( primask );
+    return next;
+}
+#endif
+
 void RadioSleep( void )
 {
     SleepParams_t params = { 0 };
 
+#ifdef CONFIG_LORA_SLEEP_POLICY
+    // The radio is due again before the TCXO and the wake up would be
+    // through, it waits in standby. The radio timers are armed after the
+    // sleep by the MAC, the choice is checked again by RadioSleepIdle
+    if( RadioSleepNextEvent( ) < RADIO_SLEEP_STANDBY_TIME )
+    {
+        TimerStop( &CarrierSenseTimer );
+        CarrierSenseRunning = false;
+        TimerStop( &SpectrumScanTimer );
+        SpectrumScan = NULL;
+        SX126xAntSwOff( );
+        SX126xSetStandby( STDBY_XOSC );
+        return;
+    }
+    RadioSleepCold = false;
+#endif
     params.Fields.WarmStart = 1;
     SX126xSetSleep( params );
 
     DelayMs( 2 );
 }
 
+void RadioSleepIdle( void )
+{
+#ifdef CONFIG_LORA_SLEEP_POLICY
+    SleepParams_t params = { 0 };
+    TimerTime_t next = RadioSleepNextEvent( );
+
+    switch( SX126xGetOperatingMode( ) )
+    {
+        case MODE_STDBY_XOSC:
+            // Only RadioSleep leaves the radio in STDBY_XOSC
+            if( next >= RADIO_SLEEP_STANDBY_TIME )
+            {
+                RadioSleep( );
+            }
+            break;
+        case MODE_SLEEP:
+            if( ( RadioSleepCold == false ) && ( next >= RADIO_SLEEP_COLD_TIME ) )
+            {
+                // The LoRa sync word goes back to its reset value, the
+                // private one, RadioSetModem sets it again
+                RadioPublicNetwork.Current = false;
+                RadioSleepCold = true;
+                SX126xSetSleep( params );
+                DelayMs( 2 );
+            }
+            break;
+        default:
+            break;
+    }
+#endif
+}
+
 void RadioStandby( void )
 {
+    TimerStop( &CarrierSenseTimer );
+    CarrierSenseRunning = false;
+    TimerStop( &SpectrumScanTimer );
+    SpectrumScan = NULL;
     SX126xSetStandby( STDBY_RC );
 }
 
@@ -1021,9 +1693,71 @@ void RadioRxBoosted( uint32_t timeout )
 
 void RadioSetRxDutyCycle( uint32_t rxTime, uint32_t sleepTime )
 {
+    SX126xSetDioIrqParams( IRQ_RX_DONE | IRQ_CRC_ERROR| IRQ_RX_TX_TIMEOUT,
+                           IRQ_RX_DONE | IRQ_CRC_ERROR| IRQ_RX_TX_TIMEOUT,
+                           IRQ_RADIO_NONE,
+                           IRQ_RADIO_NONE );
+
+    // The modem drops to STDBY_RC once a packet is received
+    RxContinuous = false;
     SX126xSetRxDutyCycle( rxTime, sleepTime );
 }
 
+/*!
+ * \brief Converts microseconds to the SX126x 15.625 us time base without overflow
+ */
+static uint32_t RadioUsToRtcSteps( uint32_t us )
+{
+    return ( us / 125 ) * 8 + ( ( us % 125 ) * 8 ) / 125;
+}
+
+bool RadioRxSniff( uint16_t preambleLen )
+{
+    uint32_t symbTime;
+    uint32_t rxTime;
+    uint32_t preambleTime;
+    uint32_t wakeupTime = RADIO_RX_SNIFF_WAKEUP_TIME;
+
+    if( SX126x.ModulationParams.PacketType != PACKET_TYPE_LORA )
+    {
+        return false;
+    }
+
+    symbTime = RadioSymbTimeUs( SX126x.ModulationParams.Params.LoRa.Bandwidth,
+                                SX126x.ModulationParams.Params.LoRa.SpreadingFactor );
+    rxTime = RADIO_RX_SNIFF_DETECT_SYMBOLS * symbTime;
+    preambleTime = preambleLen * symbTime;
+#ifdef CONFIG_LORA_USE_TCXO
+    // The TCXO is restarted on every wakeup
+    wakeupTime += SX126xGetBoardTcxoWakeupTime( ) * 1000;
+#endif
+
+    // A whole RX period must fit in the preamble wherever it starts:
+    // preamble >= rx + sleep + rx, less the wakeup from the sleep phase
+    if( preambleTime <= ( 2 * rxTime + wakeupTime ) )
+    {
+        return false;
+    }
+
+    RadioSetRxDutyCycle( RadioUsToRtcSteps( rxTime ), RadioUsToRtcSteps( preambleTime - 2 * rxTime - wakeupTime ) );
+    return true;
+}
+
+void RadioSetRxBuffer( uint8_t *buffer, uint8_t size )
+{
+    if( buffer == NULL )
+    {
+#ifndef CONFIG_LORA_RX_BUFFER_LENT
+        buffer = RadioRxPayload;
+        size = LORAMAC_PHY_MAXPAYLOAD;
+#else
+        size = 0;
+#endif
+    }
+    RadioRxBuffer = buffer;
+    RadioRxBufferSize = size;
+}
+
 void RadioStartCad( uint8_t symbols )
 {
     uint8_t cadDetPeak = SX126x.ModulationParams.Params.LoRa.SpreadingFactor + 13;
@@ -1141,6 +1875,12 @@ void RadioSetPublicNetwork( bool enable )
 
 uint32_t RadioGetWakeupTime( void )
 {
+#ifdef CONFIG_LORA_SLEEP_POLICY
+    if( ( RadioSleepCold == true ) && ( SX126xGetOperatingMode( ) == MODE_SLEEP ) )
+    {
+        return SX126xGetBoardTcxoWakeupTime( ) + RADIO_WAKEUP_TIME + RADIO_COLD_WAKEUP_TIME;
+    }
+#endif
     return SX126xGetBoardTcxoWakeupTime( ) + RADIO_WAKEUP_TIME;
 }
 
@@ -1160,6 +1900,23 @@ void RadioOnRxTimeoutIrq( void )
     }
 }
 
+void RadioOnCarrierSenseTimerIrq( void )
+{
+    // The RSSI is read over SPI from RadioIrqProcess, not from the interrupt
+    CarrierSenseDue = true;
+#ifdef CONFIG_EVENT_QUEUE
+    EventPost( EVENT_RADIO_IRQ, 0, 0 );
+#endif
+}
+
+void RadioOnSpectrumScanTimerIrq( void )
+{
+    SpectrumScanDue = true;
+#ifdef CONFIG_EVENT_QUEUE
+    EventPost( EVENT_RADIO_IRQ, 0, 0 );
+#endif
+}
+
 void RadioOnCadTimeoutIrq( void )
 {
     SX126xSetOperatingMode(MODE_SLEEP);
@@ -1169,24 +1926,225 @@ void RadioOnCadTimeoutIrq( void )
     }
 }
 
+void RadioSetRxRing( bool enable )
+{
+#ifdef CONFIG_LORA_RX_RING
+    RxRingEnabled = enable;
+#endif
+}
+
+uint32_t RadioGetRxTime( void )
+{
+    return RadioRxTime;
+}
+
+uint32_t RadioGetEventTicks( void )
+{
+    return RadioEventTicks;
+}
+
+void RadioAbort( void )
+{
+    RadioStandby( );
+    TimerStop( &TxTimeoutTimer );
+    TimerStop( &RxTimeoutTimer );
+    // An interrupt already latched finds no event left in RadioIrqProcess
+    SX126xClearIrqStatus( IRQ_RADIO_ALL );
+#ifdef CONFIG_LORA_RX_RING
+    RxRingTail = RxRingHead;
+#endif
+}
+
+#ifdef CONFIG_LORA_RX_RING
+/*!
+ * \brief Reads the packet of a continuous RX into the RX ring, from the DIO
+ *        interrupt
+ *
+ * \retval captured   false to leave the events to RadioIrqProcess, the
+ *                    radio status holding more than a packet received
+ */
+static HOT_FUNC_ATTR bool RadioRxRingCapture( void )
+{
+    RadioRxSlot_t *slot;
+    PacketStatus_t status;
+    uint16_t irq;
+    uint8_t size;
+    uint8_t offset = 0;
+
+    irq = SX126xGetIrqStatus( );
+    if( ( ( irq & IRQ_RX_DONE ) == 0 ) || ( ( irq & ~( IRQ_RX_DONE | IRQ_CRC_ERROR ) ) != 0 ) )
+    {
+        return false;
+    }
+    SX126xClearIrqStatus( irq );
+
+    if( ( uint8_t )( RxRingHead - RxRingTail ) >= RADIO_RX_RING_SLOTS )
+    {
+        // Ring full, the packet is dropped
+        return true;
+    }
+    slot = &RxRing[RxRingHead & ( RADIO_RX_RING_SLOTS - 1 )];
+    slot->Time = TimerGetCurrentTime( );
+#ifdef CONFIG_LORA_EVENT_TIMESTAMP
+    slot->Ticks = RadioIrqTicks;
+#else
+    slot->Ticks = ( uint32_t )RtcGetTimerTicks( );
+#endif
+
+    SX126xGetRxBufferStatus( &size, &offset );
+    slot->Error = ( ( irq & IRQ_CRC_ERROR ) != 0 ) || ( size > RADIO_RX_RING_PAYLOAD );
+    slot->Size = size;
+    if( slot->Error == false )
+    {
+        SX126xReadBuffer( offset, slot->Payload, size );
+    }
+    SX126xGetPacketStatus( &status );
+    slot->Rssi = status.Params.LoRa.RssiPkt + status.Params.LoRa.SnrPkt;
+    slot->Snr = status.Params.LoRa.SnrPkt;
+    RxRingHead++;
+    return true;
+}
+
+/*!
+ * \brief Hands the oldest packet of the RX ring to RxDone or RxError, from
+ *        RadioIrqProcess
+ */
+static void RadioRxRingProcess( void )
+{
+    RadioRxSlot_t *slot = &RxRing[RxRingTail & ( RADIO_RX_RING_SLOTS - 1 )];
+    uint8_t size = slot->Size;
+    bool error = slot->Error;
+    int16_t rssi = slot->Rssi;
+    int8_t snr = slot->Snr;
+
+    RadioRxTime = slot->Time;
+    RadioEventTicks = slot->Ticks;
+    if( ( error == false ) && ( RadioRxBuffer != NULL ) && ( size <= RadioRxBufferSize ) )
+    {
+        if( ( RadioEvents != NULL ) && ( RadioEvents->RxFilter != NULL ) && ( size > RADIO_RX_FILTER_HEADER_SIZE ) &&
+            ( RadioEvents->RxFilter( slot->Payload, size ) == false ) )
+        {
+            size = RADIO_RX_FILTER_HEADER_SIZE;
+        }
+        memcpy( RadioRxBuffer, slot->Payload, size );
+    }
+    else
+    {
+        error = true;
+    }
+    // The slot is copied, the callbacks may restart the RX
+    RxRingTail++;
+
+    if( error == true )
+    {
+        if( ( RadioEvents != NULL ) && ( RadioEvents->RxError != NULL ) )
+        {
+            RadioEvents->RxError( );
+        }
+    }
+    else if( ( RadioEvents != NULL ) && ( RadioEvents->RxDone != NULL ) )
+    {
+        RadioEvents->RxDone( RadioRxBuffer, size, rssi, snr );
+    }
+}
+#endif
+
 extern uint8_t   dio1_ClearInterrupt(void);
-void RadioOnDioIrq( void )
+HOT_FUNC_ATTR void RadioOnDioIrq( void )
 {
+    ITM_TRACE_EVENT( ITM_TRACE_ISR_ENTER, ITM_TRACE_ISR_RADIO );
+#ifdef CONFIG_LORA_EVENT_TIMESTAMP
+    // DIO1 only carries the done and timeout events, the entry is their time
+    // up to the interrupt latency
+    RadioIrqTicks = ( uint32_t )RtcGetTimerTicks( );
+#endif
+#ifdef CONFIG_LORA_RX_RING
+    // A continuous RX keeps going, the packet is read before the next one
+    // overwrites the radio buffer unless the interrupted code holds the SPI
+    if( ( RxRingEnabled == true ) && ( RxContinuous == true ) && ( IrqFired == false ) &&
+        ( SX126xSpiIsSelected( ) == false ) && ( RadioRxRingCapture( ) == true ) )
+    {
+#ifdef CONFIG_EVENT_QUEUE
+        EventPost( EVENT_RADIO_IRQ, 0, 0 );
+#endif
+        ITM_TRACE_EVENT( ITM_TRACE_ISR_EXIT, ITM_TRACE_ISR_RADIO );
+        return;
+    }
+#endif
+    // Top half: mask the radio line and defer the status fetch to
+    // RadioIrqProcess so the handler never waits on BUSY
+    SX126xIoIrqDisable( );
     IrqFired = true;
-    irqRegs = SX126xGetIrqStatus( );
-    SX126xClearIrqStatus( IRQ_RADIO_ALL );
+#ifdef CONFIG_EVENT_QUEUE
+    EventPost( EVENT_RADIO_IRQ, 0, 0 );
+#endif
+    ITM_TRACE_EVENT( ITM_TRACE_ISR_EXIT, ITM_TRACE_ISR_RADIO );
+}
+
+bool RadioIrqPending( void )
+{
+#ifdef CONFIG_LORA_RX_RING
+    if( RxRingHead != RxRingTail )
+    {
+        return true;
+    }
+#endif
+    return ( IrqFired == true ) || ( CarrierSenseDue == true ) || ( SpectrumScanDue == true );
+}
+
+uint32_t RadioSymbolTime( void )
+{
+    if( SX126x.ModulationParams.PacketType != PACKET_TYPE_LORA )
+    {
+        return 0;
+    }
+    return RadioSymbTimeUs( SX126x.ModulationParams.Params.LoRa.Bandwidth,
+                            SX126x.ModulationParams.Params.LoRa.SpreadingFactor );
+}
+
+void RadioSetTemperature( int8_t temperature )
+{
+    SX126xSetTemperature( temperature );
 }
 
 void RadioIrqProcess( void )
 {
+    if( CarrierSenseDue == true )
+    {
+        RadioCarrierSenseProcess( );
+    }
+
+    if( SpectrumScanDue == true )
+    {
+        RadioSpectrumScanProcess( );
+    }
+
+#ifdef CONFIG_LORA_RX_RING
+    // The captured packets come before the events left to the bottom half,
+    // those captured meanwhile wait for the next call
+    for( uint8_t n = RxRingHead - RxRingTail; n > 0; n-- )
+    {
+        RadioRxRingProcess( );
+    }
+#endif
+
     if( IrqFired == true )
     {
-        BoardDisableIrq( );
+        // No critical section, the line stays masked until it is unmasked
+        // below so RadioOnDioIrq cannot set the flag in between
         IrqFired = false;
-        BoardEnableIrq( );
+#ifdef CONFIG_LORA_EVENT_TIMESTAMP
+        // Read while the line is masked, before the next interrupt latches
+        RadioEventTicks = RadioIrqTicks;
+#else
+        RadioEventTicks = ( uint32_t )RtcGetTimerTicks( );
+#endif
 
-        //uint16_t irqRegs = SX126xGetIrqStatus( );
-        //SX126xClearIrqStatus( IRQ_RADIO_ALL );
+        // Only acknowledge the events observed here, anything raised in
+        // between keeps DIO1 high and fires again once the line is unmasked
+        irqRegs = SX126xGetIrqStatus( );
+        SX126xClearIrqStatus( irqRegs );
+        SX126xIoIrqEnable( );
 
         if( ( irqRegs & IRQ_TX_DONE ) == IRQ_TX_DONE )
         {
@@ -1202,24 +2160,67 @@ void RadioIrqProcess( void )
         if( ( irqRegs & IRQ_RX_DONE ) == IRQ_RX_DONE )
         {
             uint8_t size;
+            uint8_t offset = 0;
 
             TimerStop( &RxTimeoutTimer );
+            RadioRxTime = TimerGetCurrentTime( );
+#ifdef CONFIG_LORA_EVENT_TIMESTAMP
+            // Back to the interrupt, the bottom half runs from the main loop
+            RadioRxTime -= RtcTick2Ms( ( uint32_t )RtcGetTimerTicks( ) - RadioEventTicks );
+#endif
             if( RxContinuous == false )
             {
             	//!< Update operating mode state to a value lower than \ref MODE_STDBY_XOSC
                 SX126xSetOperatingMode( MODE_STDBY_RC );
-                // WORKAROUND - Implicit Header Mode Timeout Behavior, see DS_SX1261-2_V1.2 datasheet chapter 15.3
-                // RegRtcControl = @address 0x0902
-                SX126xWriteRegister( 0x0902, 0x00 );
-                // RegEventMask = @address 0x0944
-                SX126xWriteRegister( 0x0944, SX126xReadRegister( 0x0944 ) | ( 1 << 1 ) );
-                // WORKAROUND END
+                if( ( SX126x.PacketParams.PacketType == PACKET_TYPE_LORA ) &&
+                    ( SX126x.PacketParams.Params.LoRa.HeaderType == LORA_PACKET_IMPLICIT ) )
+                {
+                    // WORKAROUND - Implicit Header Mode Timeout Behavior, see DS_SX1261-2_V1.2 datasheet chapter 15.3
+                    // RegRtcControl = @address 0x0902
+                    SX126xWriteRegister( 0x0902, 0x00 );
+                    // RegEventMask = @address 0x0944
+                    SX126xWriteRegister( 0x0944, SX126xReadRegister( 0x0944 ) | ( 1 << 1 ) );
+                    // WORKAROUND END
+                }
             }
-            SX126xGetPayload( RadioRxPayload, &size , 255 );
-            SX126xGetPacketStatus( &RadioPktStatus );
-            if( ( RadioEvents != NULL ) && ( RadioEvents->RxDone != NULL ) && ( ( irqRegs & IRQ_CRC_ERROR ) != IRQ_CRC_ERROR ) )
+            SX126xGetRxBufferStatus( &size, &offset );
+            if( ( irqRegs & IRQ_CRC_ERROR ) == IRQ_CRC_ERROR )
             {
-                RadioEvents->RxDone( RadioRxPayload, size, RadioPktStatus.Params.LoRa.RssiPkt+RadioPktStatus.Params.LoRa.SnrPkt, RadioPktStatus.Params.LoRa.SnrPkt );
+                // Corrupted packet, handled below without reading it
+            }
+            else if( ( RadioRxBuffer == NULL ) || ( size > RadioRxBufferSize ) )
+            {
+                // No room for the packet, report it like a corrupted one
+                if( ( RadioEvents != NULL ) && ( RadioEvents->RxError ) )
+                {
+                    RadioEvents->RxError( );
+                }
+            }
+            else
+            {
+                if( ( RadioEvents != NULL ) && ( RadioEvents->RxFilter != NULL ) && ( size > RADIO_RX_FILTER_HEADER_SIZE ) )
+                {
+                    // Header first, the rest only if the packet is wanted
+                    SX126xReadBuffer( offset, RadioRxBuffer, RADIO_RX_FILTER_HEADER_SIZE );
+                    if( RadioEvents->RxFilter( RadioRxBuffer, size ) == true )
+                    {
+                        SX126xReadBuffer( offset + RADIO_RX_FILTER_HEADER_SIZE, RadioRxBuffer + RADIO_RX_FILTER_HEADER_SIZE,
+                                          size - RADIO_RX_FILTER_HEADER_SIZE );
+                    }
+                    else
+                    {
+                        size = RADIO_RX_FILTER_HEADER_SIZE;
+                    }
+                }
+                else
+                {
+                    SX126xReadBuffer( offset, RadioRxBuffer, size );
+                }
+                SX126xGetPacketStatus( &RadioPktStatus );
+                if( ( RadioEvents != NULL ) && ( RadioEvents->RxDone != NULL ) && ( ( irqRegs & IRQ_CRC_ERROR ) != IRQ_CRC_ERROR ) )
+                {
+                    RadioEvents->RxDone( RadioRxBuffer, size, RadioPktStatus.Params.LoRa.RssiPkt+RadioPktStatus.Params.LoRa.SnrPkt, RadioPktStatus.Params.LoRa.SnrPkt );
+                }
             }
         }
 
@@ -1259,8 +2260,9 @@ void RadioIrqProcess( void )
                     RadioEvents->TxTimeout( );
                 }
             }
-            else if( SX126xGetOperatingMode( ) == MODE_RX )
+            else if( ( SX126xGetOperatingMode( ) == MODE_RX ) || ( SX126xGetOperatingMode( ) == MODE_RX_DC ) )
             {
+                // In RX duty cycle a detected preamble not followed by a packet ends here
                 TimerStop( &RxTimeoutTimer );
                 //!< Update operating mode state to a value lower than \ref MODE_STDBY_XOSC
                 SX126xSetOperatingMode( MODE_STDBY_RC );
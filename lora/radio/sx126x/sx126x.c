@@ -26,6 +26,13 @@
 #include "delay.h"
 #include "sx126x.h"
 #include "sx126x-board.h"
+#include "itm-trace.h"
+#ifdef CONFIG_LORA_RADIO_STATS
+#include "radio-stats.h"
+#endif
+#ifdef CONFIG_WARM_BOOT
+#include "warm-boot.h"
+#endif
 
 /*!
  * \brief Radio registers definition
@@ -52,9 +59,304 @@ static RadioPacketTypes_t PacketType;
 volatile uint32_t FrequencyError = 0;
 
 /*!
- * \brief Hold the status of the Image calibration
+ * \brief No image calibration run, the radio holds its power on calibration
+ */
+#define SX126X_IMAGE_BAND_NONE                      0xFF
+
+/*!
+ * \brief Unknown temperature
+ */
+#define SX126X_TEMPERATURE_NONE                     INT8_MIN
+
+/*!
+ * Temperature change that makes the image calibration stale [Celsius]
  */
-static bool ImageCalibrated = false;
+#ifndef SX126X_IMAGE_CAL_TEMP_DELTA
+#define SX126X_IMAGE_CAL_TEMP_DELTA                 10
+#endif
+
+/*!
+ * \brief Band of SX126xCalibrateImage the radio image is calibrated for.
+ *        The radio holds one image calibration, a frequency in the same band
+ *        reuses it
+ */
+static uint8_t ImageCalBand = SX126X_IMAGE_BAND_NONE;
+
+/*!
+ * \brief Temperature at the image calibration, and the last one reported
+ */
+static int8_t ImageCalTemperature = SX126X_TEMPERATURE_NONE;
+static int8_t RadioTemperature = SX126X_TEMPERATURE_NONE;
+
+/*!
+ * \brief Image calibration band of a frequency, the bands of
+ *        SX126xCalibrateImage
+ */
+static uint8_t SX126xImageBand( uint32_t freq )
+{
+    static const uint32_t bandFloor[] = { 900000000, 850000000, 770000000, 460000000, 425000000 };
+    uint8_t band;
+
+    for( band = 0; band < sizeof( bandFloor ) / sizeof( bandFloor[0] ); band++ )
+    {
+        if( freq > bandFloor[band] )
+        {
+            break;
+        }
+    }
+    return band;
+}
+
+/*!
+ * \brief Forgets the image calibration, the radio lost it
+ */
+static void SX126xImageLost( void )
+{
+    ImageCalBand = SX126X_IMAGE_BAND_NONE;
+#ifdef CONFIG_WARM_BOOT
+    WarmBootGet( )->ImageCalFreq = 0;
+    WarmBootCommit( );
+#endif
+}
+
+#ifdef CONFIG_LORA_SLEEP_POLICY
+/*!
+ * \brief Set by a cold start sleep, the radio wakes up with its power on
+ *        configuration
+ */
+static bool ColdStart = false;
+
+/*!
+ * \brief Settings of the initialization a cold start drops, set again on
+ *        the wake up
+ */
+static RadioRegulatorMode_t RegulatorMode = USE_LDO;
+static uint8_t TxBaseAddress = 0x00;
+static uint8_t RxBaseAddress = 0x00;
+
+/*!
+ * \brief Sets again what SX126xInit and RadioInit configured, after a cold
+ *        start
+ */
+static void SX126xColdRestore( void )
+{
+    // A wake up leaves the radio in STDBY_RC
+    SX126xSetOperatingMode( MODE_STDBY_RC );
+#ifdef CONFIG_LORA_USE_TCXO
+    CalibrationParams_t calibParam;
+
+    SX126xSetDio3AsTcxoCtrl( TCXO_CTRL_1_7V, SX126xGetBoardTcxoWakeupTime( ) << 6 );
+    calibParam.Value = 0x7F;
+    SX126xCalibrate( calibParam );
+#endif
+    SX126xSetDio2AsRfSwitchCtrl( true );
+    SX126xSetRegulatorMode( RegulatorMode );
+    SX126xSetBufferBaseAddress( TxBaseAddress, RxBaseAddress );
+}
+#endif
+
+#ifdef CONFIG_WARM_BOOT
+/*!
+ * Warm boots an image calibration is trusted for when no temperature is
+ * reported, the temperature may have drifted since
+ */
+#ifndef SX126X_IMAGE_CAL_WARM_BOOTS
+#define SX126X_IMAGE_CAL_WARM_BOOTS                 16
+#endif
+
+/*!
+ * \brief Set once the radio is initialized, a later initialization resets it
+ */
+static bool RadioBooted = false;
+
+/*!
+ * \brief Tells if the radio kept running across the reset, with the
+ *        calibrations of the previous boot
+ */
+static bool SX126xIsRetained( void )
+{
+    WarmBootState_t *state = WarmBootGet( );
+
+    return ( WarmBootIsWarm( ) == true ) && ( state->ImageCalFreq != 0 ) &&
+           ( ( state->ImageCalTemp != SX126X_TEMPERATURE_NONE ) ||
+             ( ( uint16_t )( state->WarmBoots - state->ImageCalBoot ) < SX126X_IMAGE_CAL_WARM_BOOTS ) ) &&
+           ( SX126xIsOutOfReset( ) == true );
+}
+#endif
+
+#ifdef CONFIG_LORA_SHADOW_REGS
+/*!
+ * \brief Last payload written by a configuration command
+ */
+typedef struct
+{
+    bool          Valid;                            //!< The shadow holds the radio content
+    uint8_t       Size;                             //!< Number of bytes in Buffer
+    uint8_t       Buffer[9];                        //!< The last command payload
+}SX126xShadowCommand_t;
+
+/*!
+ * \brief Shadow copies of the modulation, packet and RF frequency commands.
+ *        Kept across warm start sleep, dropped on reset and cold start sleep
+ */
+static SX126xShadowCommand_t ShadowModulationParams;
+static SX126xShadowCommand_t ShadowPacketParams;
+static SX126xShadowCommand_t ShadowRfFrequency;
+
+/*!
+ * \brief PacketType is the one set in the radio
+ */
+static bool ShadowPacketTypeValid = false;
+
+/*!
+ * \brief PA setting row, power and ramp time of the last SX126xSetTxParams.
+ *        The OCP is a register, dropped with the registers
+ */
+static SX126xShadowCommand_t ShadowTxParams;
+
+/*!
+ * \brief Configuration registers mirrored by the register accessors.
+ *        Only registers the modem itself never modifies may be listed here
+ */
+static RadioRegisters_t ShadowRegisters[] =
+{
+    { REG_LR_SYNCWORDBASEADDRESS,     0x00 },
+    { REG_LR_SYNCWORDBASEADDRESS + 1, 0x00 },
+    { REG_LR_SYNCWORDBASEADDRESS + 2, 0x00 },
+    { REG_LR_SYNCWORDBASEADDRESS + 3, 0x00 },
+    { REG_LR_SYNCWORDBASEADDRESS + 4, 0x00 },
+    { REG_LR_SYNCWORDBASEADDRESS + 5, 0x00 },
+    { REG_LR_SYNCWORDBASEADDRESS + 6, 0x00 },
+    { REG_LR_SYNCWORDBASEADDRESS + 7, 0x00 },
+    { REG_LR_CRCSEEDBASEADDR,         0x00 },
+    { REG_LR_CRCSEEDBASEADDR + 1,     0x00 },
+    { REG_LR_CRCPOLYBASEADDR,         0x00 },
+    { REG_LR_CRCPOLYBASEADDR + 1,     0x00 },
+    { REG_LR_WHITSEEDBASEADDR_MSB,    0x00 },
+    { REG_LR_WHITSEEDBASEADDR_LSB,    0x00 },
+    { REG_LR_SYNCWORD,                0x00 },
+    { REG_LR_SYNCWORD + 1,            0x00 },
+    { REG_RX_GAIN,                    0x00 },
+    { 0x0736,                         0x00 }, // IQ polarity workaround
+    { 0x0889,                         0x00 }, // 500 kHz sensitivity workaround
+    { 0x08D8,                         0x00 }, // Tx clamp workaround
+};
+
+#define SHADOW_REGISTERS_COUNT  ( sizeof( ShadowRegisters ) / sizeof( RadioRegisters_t ) )
+
+/*!
+ * \brief Bit n set when ShadowRegisters[n].Value matches the radio
+ */
+static uint32_t ShadowRegistersValid = 0;
+
+/*!
+ * \brief Compares a command payload with its shadow and records it
+ *
+ * \param [IN] shadow      Shadow of the command
+ * \param [IN] buffer      Payload about to be written
+ * \param [IN] size        Payload size
+ *
+ * \retval match           true when the radio already holds this payload
+ */
+static bool SX126xShadowMatchCommand( SX126xShadowCommand_t *shadow, uint8_t *buffer, uint8_t size )
+{
+    if( ( shadow->Valid == true ) && ( shadow->Size == size ) && ( memcmp( shadow->Buffer, buffer, size ) == 0 ) )
+    {
+        return true;
+    }
+    memcpy( shadow->Buffer, buffer, size );
+    shadow->Size = size;
+    shadow->Valid = true;
+    return false;
+}
+
+/*!
+ * \brief Looks up a register in the shadow table
+ *
+ * \retval index           Table index, SHADOW_REGISTERS_COUNT when not mirrored
+ */
+static uint8_t SX126xShadowFindRegister( uint16_t address )
+{
+    uint8_t i;
+
+    for( i = 0; i < SHADOW_REGISTERS_COUNT; i++ )
+    {
+        if( ShadowRegisters[i].Addr == address )
+        {
+            break;
+        }
+    }
+    return i;
+}
+
+static void SX126xShadowInvalidateRegisters( void )
+{
+    ShadowRegistersValid = 0;
+    ShadowTxParams.Valid = false;
+}
+
+void SX126xShadowInvalidate( void )
+{
+    ShadowModulationParams.Valid = false;
+    ShadowPacketParams.Valid = false;
+    ShadowRfFrequency.Valid = false;
+    ShadowPacketTypeValid = false;
+    SX126xShadowInvalidateRegisters( );
+}
+
+bool SX126xShadowMatchRegisters( uint16_t address, uint8_t *buffer, uint16_t size )
+{
+    uint16_t i;
+    uint8_t index;
+
+    for( i = 0; i < size; i++ )
+    {
+        index = SX126xShadowFindRegister( address + i );
+        if( ( index >= SHADOW_REGISTERS_COUNT ) || ( ( ShadowRegistersValid & ( 1UL << index ) ) == 0 ) ||
+            ( ShadowRegisters[index].Value != buffer[i] ) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SX126xShadowGetRegisters( uint16_t address, uint8_t *buffer, uint16_t size )
+{
+    uint16_t i;
+    uint8_t index;
+
+    for( i = 0; i < size; i++ )
+    {
+        index = SX126xShadowFindRegister( address + i );
+        if( ( index >= SHADOW_REGISTERS_COUNT ) || ( ( ShadowRegistersValid & ( 1UL << index ) ) == 0 ) )
+        {
+            return false;
+        }
+    }
+    for( i = 0; i < size; i++ )
+    {
+        buffer[i] = ShadowRegisters[SX126xShadowFindRegister( address + i )].Value;
+    }
+    return true;
+}
+
+void SX126xShadowSetRegisters( uint16_t address, uint8_t *buffer, uint16_t size )
+{
+    uint16_t i;
+    uint8_t index;
+
+    for( i = 0; i < size; i++ )
+    {
+        index = SX126xShadowFindRegister( address + i );
+        if( index < SHADOW_REGISTERS_COUNT )
+        {
+            ShadowRegisters[index].Value = buffer[i];
+            ShadowRegistersValid |= 1UL << index;
+        }
+    }
+}
+#endif
 
 /*
  * SX126x DIO IRQ callback functions prototype
@@ -81,10 +383,62 @@ void SX126xSetInterruptMode( void );
 void SX126xProcessIrqs( void );
 
 extern uint8_t gPaOptSetting;
+
+/*!
+ * \brief PA configuration, over current protection and power range of a PA
+ *        setting
+ */
+typedef struct
+{
+    uint8_t PaDutyCycle;
+    uint8_t HpMax;
+    uint8_t DeviceSel;
+    uint8_t Ocp;
+    int8_t  PowerMin;
+    int8_t  PowerMax;
+}SX126xPaSetting_t;
+
+/*!
+ * \brief PA settings of the SX1262 by gPaOptSetting, then of the SX1261
+ */
+static const SX126xPaSetting_t SX126xPaSettings[] =
+{
+    { 0x04, 0x07, 0x00, 0x38, -3, 22 },    // SX1262, +22 dBm, OCP 160 mA for the whole device
+    { 0x03, 0x05, 0x00, 0x38, -3, 22 },    // SX1262, +20 dBm
+    { 0x02, 0x03, 0x00, 0x38, -3, 22 },    // SX1262, +17 dBm
+    { 0x02, 0x02, 0x00, 0x38, -3, 22 },    // SX1262, +14 dBm
+    { 0x04, 0x00, 0x01, 0x18, -3, 14 },    // SX1261, +14 dBm, OCP 80 mA for the whole device
+    { 0x06, 0x00, 0x01, 0x18, -3, 14 },    // SX1261, +15 dBm
+};
+
+#define SX126X_PA_SX1262_SETTINGS                   4
+#define SX126X_PA_SX1261                            4
+#define SX126X_PA_SX1261_15_DBM                     5
 void SX126xInit( )
 {
+#ifdef CONFIG_WARM_BOOT
+    bool retained = ( RadioBooted == false ) && SX126xIsRetained( );
+
+    RadioBooted = true;
+#endif
     SX126xLoracInit();
-    
+
+#ifdef CONFIG_WARM_BOOT
+    if( retained == true )
+    {
+        // The TCXO setting and the calibrations survived, the reset and the
+        // calibration of all blocks are skipped
+        ImageCalBand = SX126xImageBand( WarmBootGet( )->ImageCalFreq );
+        ImageCalTemperature = WarmBootGet( )->ImageCalTemp;
+        SX126xWakeup( );
+        SX126xSetStandby( STDBY_RC );
+        SX126xSetDio2AsRfSwitchCtrl( true );
+        SX126xSetOperatingMode( MODE_STDBY_RC );
+        return;
+    }
+#endif
+    SX126xImageLost( );
+
     SX126xReset( );
 
     SX126xWakeup( );
@@ -100,7 +454,7 @@ void SX126xInit( )
 #endif
 
     SX126xSetDio2AsRfSwitchCtrl( true );
-    OperatingMode = MODE_STDBY_RC;
+    SX126xSetOperatingMode( MODE_STDBY_RC );
 }
 
 RadioOperatingModes_t SX126xGetOperatingMode( void )
@@ -110,6 +464,10 @@ RadioOperatingModes_t SX126xGetOperatingMode( void )
 void SX126xSetOperatingMode(RadioOperatingModes_t mode)
 {
     OperatingMode=mode;
+    ITM_TRACE_EVENT( ITM_TRACE_RADIO_MODE, mode );
+#ifdef CONFIG_LORA_RADIO_STATS
+    RadioStatsModeChange( mode );
+#endif
 }
 
 void SX126xCheckDeviceReady( void )
@@ -119,6 +477,13 @@ void SX126xCheckDeviceReady( void )
         SX126xWakeup( );
         // Switch is turned off when device is in sleep mode and turned on is all other modes
         SX126xAntSwOn( );
+#ifdef CONFIG_LORA_SLEEP_POLICY
+        if( ColdStart == true )
+        {
+            ColdStart = false;
+            SX126xColdRestore( );
+        }
+#endif
     }
 
     if (SX126xGetOperatingMode() == MODE_RX)
@@ -237,7 +602,25 @@ void SX126xSetSleep( SleepParams_t sleepConfig )
     SX126xAntSwOff( );
 
     SX126xWriteCommand( RADIO_SET_SLEEP, &sleepConfig.Value, 1 );
-    OperatingMode = MODE_SLEEP;
+    SX126xSetOperatingMode( MODE_SLEEP );
+    if( sleepConfig.Fields.WarmStart == 0 )
+    {
+        SX126xImageLost( );
+#ifdef CONFIG_LORA_SLEEP_POLICY
+        ColdStart = true;
+#endif
+    }
+#ifdef CONFIG_LORA_SHADOW_REGS
+    // Commands are retained by a warm start, registers may not be
+    if( sleepConfig.Fields.WarmStart == 0 )
+    {
+        SX126xShadowInvalidate( );
+    }
+    else
+    {
+        SX126xShadowInvalidateRegisters( );
+    }
+#endif
 }
 
 void SX126xSetStandby( RadioStandbyModes_t standbyConfig )
@@ -245,25 +628,25 @@ void SX126xSetStandby( RadioStandbyModes_t standbyConfig )
     SX126xWriteCommand( RADIO_SET_STANDBY, ( uint8_t* )&standbyConfig, 1 );
     if( standbyConfig == STDBY_RC )
     {
-        OperatingMode = MODE_STDBY_RC;
+        SX126xSetOperatingMode( MODE_STDBY_RC );
     }
     else
     {
-        OperatingMode = MODE_STDBY_XOSC;
+        SX126xSetOperatingMode( MODE_STDBY_XOSC );
     }
 }
 
 void SX126xSetFs( void )
 {
     SX126xWriteCommand( RADIO_SET_FS, 0, 0 );
-    OperatingMode = MODE_FS;
+    SX126xSetOperatingMode( MODE_FS );
 }
 
 void SX126xSetTx( uint32_t timeout )
 {
     uint8_t buf[3];
 
-    OperatingMode = MODE_TX;
+    SX126xSetOperatingMode( MODE_TX );
 
     buf[0] = ( uint8_t )( ( timeout >> 16 ) & 0xFF );
     buf[1] = ( uint8_t )( ( timeout >> 8 ) & 0xFF );
@@ -275,7 +658,7 @@ void SX126xSetRx( uint32_t timeout )
 {
     uint8_t buf[3];
 
-    OperatingMode = MODE_RX;
+    SX126xSetOperatingMode( MODE_RX );
 
     buf[0] = ( uint8_t )( ( timeout >> 16 ) & 0xFF );
     buf[1] = ( uint8_t )( ( timeout >> 8 ) & 0xFF );
@@ -287,7 +670,7 @@ void SX126xSetRxBoosted( uint32_t timeout )
 {
     uint8_t buf[3];
 
-    OperatingMode = MODE_RX;
+    SX126xSetOperatingMode( MODE_RX );
 
     SX126xWriteRegister( REG_RX_GAIN, 0x96 ); // max LNA gain, increase current by ~2mA for around ~3dB in sensivity
 
@@ -308,13 +691,13 @@ void SX126xSetRxDutyCycle( uint32_t rxTime, uint32_t sleepTime )
     buf[4] = ( uint8_t )( ( sleepTime >> 8 ) & 0xFF );
     buf[5] = ( uint8_t )( sleepTime & 0xFF );
     SX126xWriteCommand( RADIO_SET_RXDUTYCYCLE, buf, 6 );
-    OperatingMode = MODE_RX_DC;
+    SX126xSetOperatingMode( MODE_RX_DC );
 }
 
 void SX126xSetCad( void )
 {
     SX126xWriteCommand( RADIO_SET_CAD, 0, 0 );
-    OperatingMode = MODE_CAD;
+    SX126xSetOperatingMode( MODE_CAD );
 }
 
 void SX126xSetTxContinuousWave( void )
@@ -334,11 +717,32 @@ void SX126xSetStopRxTimerOnPreambleDetect( bool enable )
 
 void SX126xSetLoRaSymbNumTimeout( uint8_t SymbNum )
 {
-    SX126xWriteCommand( RADIO_SET_LORASYMBTIMEOUT, &SymbNum, 1 );
+    // The command only holds timeouts up to 63 symbols right, the longer ones
+    // are coded as mantissa * 2^(2 * exponent + 1) in the register
+    uint8_t mant = ( ( ( SymbNum > SX126X_MAX_LORA_SYMB_NUM_TIMEOUT ) ? SX126X_MAX_LORA_SYMB_NUM_TIMEOUT : SymbNum ) + 1 ) >> 1;
+    uint8_t exp = 0;
+    uint8_t reg;
+
+    while( mant > 31 )
+    {
+        mant = ( mant + 3 ) >> 2;
+        exp++;
+    }
+    reg = mant << ( 2 * exp + 1 );
+    SX126xWriteCommand( RADIO_SET_LORASYMBTIMEOUT, &reg, 1 );
+
+    if( SymbNum != 0 )
+    {
+        reg = exp + ( mant << 3 );
+        SX126xWriteRegister( REG_LR_SYNCH_TIMEOUT, reg );
+    }
 }
 
 void SX126xSetRegulatorMode( RadioRegulatorMode_t mode )
 {
+#ifdef CONFIG_LORA_SLEEP_POLICY
+    RegulatorMode = mode;
+#endif
     SX126xWriteCommand( RADIO_SET_REGULATORMODE, ( uint8_t* )&mode, 1 );
 }
 
@@ -377,6 +781,38 @@ void SX126xCalibrateImage( uint32_t freq )
         calFreq[1] = 0x6F;
     }
     SX126xWriteCommand( RADIO_CALIBRATEIMAGE, calFreq, 2 );
+    ImageCalBand = SX126xImageBand( freq );
+    ImageCalTemperature = RadioTemperature;
+#ifdef CONFIG_WARM_BOOT
+    WarmBootGet( )->ImageCalFreq = freq;
+    WarmBootGet( )->ImageCalBoot = WarmBootGet( )->WarmBoots;
+    WarmBootGet( )->ImageCalTemp = RadioTemperature;
+    WarmBootCommit( );
+#endif
+}
+
+void SX126xSetTemperature( int8_t temperature )
+{
+    int16_t delta;
+
+    RadioTemperature = temperature;
+    if( ImageCalBand == SX126X_IMAGE_BAND_NONE )
+    {
+        return;
+    }
+    if( ImageCalTemperature == SX126X_TEMPERATURE_NONE )
+    {
+        // Calibrated at an unknown temperature, the first one reported
+        // becomes the reference
+        ImageCalTemperature = temperature;
+        return;
+    }
+    delta = ( int16_t )temperature - ImageCalTemperature;
+    if( ( delta >= SX126X_IMAGE_CAL_TEMP_DELTA ) || ( delta <= -SX126X_IMAGE_CAL_TEMP_DELTA ) )
+    {
+        // Calibrated again by the next frequency setting
+        ImageCalBand = SX126X_IMAGE_BAND_NONE;
+    }
 }
 
 void SX126xSetPaConfig( uint8_t paDutyCycle, uint8_t hpMax, uint8_t deviceSel, uint8_t paLut )
@@ -440,10 +876,9 @@ void SX126xSetRfFrequency( uint32_t frequency )
     uint8_t buf[4];
     uint32_t freq = 0;
 
-    if( ImageCalibrated == false )
+    if( SX126xImageBand( frequency ) != ImageCalBand )
     {
         SX126xCalibrateImage( frequency );
-        ImageCalibrated = true;
     }
 
     freq = ( uint32_t )( ( double )frequency / ( double )FREQ_STEP );
@@ -451,11 +886,29 @@ void SX126xSetRfFrequency( uint32_t frequency )
     buf[1] = ( uint8_t )( ( freq >> 16 ) & 0xFF );
     buf[2] = ( uint8_t )( ( freq >> 8 ) & 0xFF );
     buf[3] = ( uint8_t )( freq & 0xFF );
+#ifdef CONFIG_LORA_SHADOW_REGS
+    if( SX126xShadowMatchCommand( &ShadowRfFrequency, buf, 4 ) == true )
+    {
+        return;
+    }
+#endif
     SX126xWriteCommand( RADIO_SET_RFFREQUENCY, buf, 4 );
 }
 
 void SX126xSetPacketType( RadioPacketTypes_t packetType )
 {
+#ifdef CONFIG_LORA_SHADOW_REGS
+    if( ( ShadowPacketTypeValid == true ) && ( PacketType == packetType ) )
+    {
+        return;
+    }
+    // Modulation and packet parameters and the sync words are reset by a
+    // packet type change
+    ShadowModulationParams.Valid = false;
+    ShadowPacketParams.Valid = false;
+    SX126xShadowInvalidateRegisters( );
+    ShadowPacketTypeValid = true;
+#endif
     // Save packet type internally to avoid questioning the radio
     PacketType = packetType;
     SX126xWriteCommand( RADIO_SET_PACKETTYPE, ( uint8_t* )&packetType, 1 );
@@ -468,68 +921,51 @@ RadioPacketTypes_t SX126xGetPacketType( void )
 
 void SX126xSetTxParams( int8_t power, RadioRampTimes_t rampTime )
 {
-    uint8_t buf[2];
+    const SX126xPaSetting_t *pa;
+    uint8_t row;
+    uint8_t buf[3];
 
     if( SX126xGetPaSelect( 0 ) == SX1261 )
     {
-        if( power == 15 )
-        {
-            SX126xSetPaConfig( 0x06, 0x00, 0x01, 0x01 );
-        }
-        else
-        {
-            SX126xSetPaConfig( 0x04, 0x00, 0x01, 0x01 );
-        }
-        if( power >= 14 )
-        {
-            power = 14;
-        }
-        else if( power < -3 )
-        {
-            power = -3;
-        }
-        SX126xWriteRegister( REG_OCP, 0x18 ); // current max is 80 mA for the whole device
-    }
-    else // sx1262
-    {        
-        // WORKAROUND - Better Resistance of the SX1262 Tx to Antenna Mismatch, see DS_SX1261-2_V1.2 datasheet chapter 15.2
-        // RegTxClampConfig = @address 0x08D8
-        SX126xWriteRegister( 0x08D8, SX126xReadRegister( 0x08D8 ) | ( 0x0F << 1 ) );
-        // WORKAROUND END
-
-        switch(gPaOptSetting) {
-            case 3: { 
-                SX126xSetPaConfig( 0x02, 0x02, 0x00, 0x01 ); 
-                break;
-            }
-            case 2: { 
-                SX126xSetPaConfig( 0x02, 0x03, 0x00, 0x01 ); 
-                break;
-            }
-            case 1: { 
-                SX126xSetPaConfig( 0x03, 0x05, 0x00, 0x01 ); 
-                break;
-            }
-            case 0: 
-            default: { 
-                SX126xSetPaConfig( 0x04, 0x07, 0x00, 0x01 ); 
-                break;
-            }
-        } 
-
-        if( power > 22 )
-        {
-            power = 22;
-        }
-        else if( power < -3 )
-        {
-            power = -3;
-        }
-        SX126xWriteRegister( REG_OCP, 0x38 ); // current max 160mA for the whole device
+        row = ( power == 15 ) ? SX126X_PA_SX1261_15_DBM : SX126X_PA_SX1261;
+    }
+    else
+    {
+        row = ( gPaOptSetting < SX126X_PA_SX1262_SETTINGS ) ? gPaOptSetting : 0;
+    }
+    pa = &SX126xPaSettings[row];
+    if( power > pa->PowerMax )
+    {
+        power = pa->PowerMax;
+    }
+    else if( power < pa->PowerMin )
+    {
+        power = pa->PowerMin;
     }
     buf[0] = power;
     buf[1] = ( uint8_t )rampTime;
-    SX126xWriteCommand( RADIO_SET_TXPARAMS, buf, 2 );
+    buf[2] = row;
+
+#ifdef CONFIG_LORA_SHADOW_REGS
+    // Nothing to write while the radio holds this setting, power and ramp
+    if( SX126xShadowMatchCommand( &ShadowTxParams, buf, 3 ) == false )
+#endif
+    {
+        if( pa->DeviceSel == 0 )
+        {
+            // WORKAROUND - Better Resistance of the SX1262 Tx to Antenna Mismatch, see DS_SX1261-2_V1.2 datasheet chapter 15.2
+            // RegTxClampConfig = @address 0x08D8
+            SX126xWriteRegister( 0x08D8, SX126xReadRegister( 0x08D8 ) | ( 0x0F << 1 ) );
+            // WORKAROUND END
+        }
+        SX126xSetPaConfig( pa->PaDutyCycle, pa->HpMax, pa->DeviceSel, 0x01 );
+        // SetPaConfig resets the OCP
+        SX126xWriteRegister( REG_OCP, pa->Ocp );
+        SX126xWriteCommand( RADIO_SET_TXPARAMS, buf, 2 );
+    }
+#ifdef CONFIG_LORA_RADIO_STATS
+    RadioStatsSetTxPower( power );
+#endif
 }
 
 void SX126xSetModulationParams( ModulationParams_t *modulationParams )
@@ -559,6 +995,12 @@ void SX126xSetModulationParams( ModulationParams_t *modulationParams )
         buf[5] = ( tempVal >> 16 ) & 0xFF;
         buf[6] = ( tempVal >> 8 ) & 0xFF;
         buf[7] = ( tempVal& 0xFF );
+#ifdef CONFIG_LORA_SHADOW_REGS
+        if( SX126xShadowMatchCommand( &ShadowModulationParams, buf, n ) == true )
+        {
+            break;
+        }
+#endif
         SX126xWriteCommand( RADIO_SET_MODULATIONPARAMS, buf, n );
         break;
     case PACKET_TYPE_LORA:
@@ -567,6 +1009,12 @@ void SX126xSetModulationParams( ModulationParams_t *modulationParams )
         buf[1] = modulationParams->Params.LoRa.Bandwidth;
         buf[2] = modulationParams->Params.LoRa.CodingRate;
         buf[3] = modulationParams->Params.LoRa.LowDatarateOptimize;
+#ifdef CONFIG_LORA_SHADOW_REGS
+        if( SX126xShadowMatchCommand( &ShadowModulationParams, buf, n ) == true )
+        {
+            break;
+        }
+#endif
 
         SX126xWriteCommand( RADIO_SET_MODULATIONPARAMS, buf, n );
 
@@ -633,6 +1081,12 @@ void SX126xSetPacketParams( PacketParams_t *packetParams )
     case PACKET_TYPE_NONE:
         return;
     }
+#ifdef CONFIG_LORA_SHADOW_REGS
+    if( SX126xShadowMatchCommand( &ShadowPacketParams, buf, n ) == true )
+    {
+        return;
+    }
+#endif
     SX126xWriteCommand( RADIO_SET_PACKETPARAMS, buf, n );
 }
 
@@ -648,13 +1102,17 @@ void SX126xSetCadParams( RadioLoRaCadSymbols_t cadSymbolNum, uint8_t cadDetPeak,
     buf[5] = ( uint8_t )( ( cadTimeout >> 8 ) & 0xFF );
     buf[6] = ( uint8_t )( cadTimeout & 0xFF );
     SX126xWriteCommand( RADIO_SET_CADPARAMS, buf, 5 );
-    OperatingMode = MODE_CAD;
+    SX126xSetOperatingMode( MODE_CAD );
 }
 
 void SX126xSetBufferBaseAddress( uint8_t txBaseAddress, uint8_t rxBaseAddress )
 {
     uint8_t buf[2];
 
+#ifdef CONFIG_LORA_SLEEP_POLICY
+    TxBaseAddress = txBaseAddress;
+    RxBaseAddress = rxBaseAddress;
+#endif
     buf[0] = txBaseAddress;
     buf[1] = rxBaseAddress;
     SX126xWriteCommand( RADIO_SET_BUFFERBASEADDRESS, buf, 2 );
@@ -99,6 +99,17 @@
  */
 #define REG_LR_PAYLOADLENGTH                        0x0702
 
+/*!
+ * \brief The address of the register holding the LoRa symbol timeout,
+ *        mantissa and exponent
+ */
+#define REG_LR_SYNCH_TIMEOUT                        0x0706
+
+/*!
+ * \brief Longest LoRa symbol timeout the modem can hold
+ */
+#define SX126X_MAX_LORA_SYMB_NUM_TIMEOUT            248
+
 /*!
  * \brief The addresses of the registers holding SyncWords values
  */
@@ -734,6 +745,45 @@ RadioOperatingModes_t SX126xGetOperatingMode( void );
  * 
  */
 void SX126xSetOperatingMode(RadioOperatingModes_t mode);
+
+#ifdef CONFIG_LORA_SHADOW_REGS
+/*!
+ * \brief Drops every shadowed command and register value.
+ *        Must be called whenever the radio loses its configuration
+ */
+void SX126xShadowInvalidate( void );
+
+/*!
+ * \brief Checks whether the radio already holds the given register values
+ *
+ * \param [in]  address       First register address
+ * \param [in]  buffer        Values about to be written
+ * \param [in]  size          Number of registers
+ *
+ * \retval      match         true when every register is shadowed and equal
+ */
+bool SX126xShadowMatchRegisters( uint16_t address, uint8_t *buffer, uint16_t size );
+
+/*!
+ * \brief Reads register values from the shadow
+ *
+ * \param [in]  address       First register address
+ * \param [out] buffer        Register values
+ * \param [in]  size          Number of registers
+ *
+ * \retval      hit           true when every register is shadowed
+ */
+bool SX126xShadowGetRegisters( uint16_t address, uint8_t *buffer, uint16_t size );
+
+/*!
+ * \brief Records register values known to be in the radio
+ *
+ * \param [in]  address       First register address
+ * \param [in]  buffer        Register values
+ * \param [in]  size          Number of registers
+ */
+void SX126xShadowSetRegisters( uint16_t address, uint8_t *buffer, uint16_t size );
+#endif
 /*!
  * \brief Wakeup the radio if it is in Sleep mode and check that Busy is low
  */
@@ -882,6 +932,10 @@ void SX126xSetStopRxTimerOnPreambleDetect( bool enable );
 /*!
  * \brief Set the number of symbol the radio will wait to validate a reception
  *
+ * \remark The modem ends a single reception when no preamble is detected
+ *         within SymbNum symbols, capped to SX126X_MAX_LORA_SYMB_NUM_TIMEOUT.
+ *         0 disables the symbol timeout.
+ *
  * \param [in]  SymbNum          number of LoRa symbols
  */
 void SX126xSetLoRaSymbNumTimeout( uint8_t SymbNum );
@@ -907,6 +961,14 @@ void SX126xCalibrate( CalibrationParams_t calibParam );
  */
 void SX126xCalibrateImage( uint32_t freq );
 
+/*!
+ * \brief Reports the temperature, the image is calibrated again on the next
+ *        frequency setting once it drifted by SX126X_IMAGE_CAL_TEMP_DELTA
+ *
+ * \param [in]  temperature Current temperature [Celsius]
+ */
+void SX126xSetTemperature( int8_t temperature );
+
 /*!
  * \brief Activate the extention of the timeout when long preamble is used
  *
@@ -0,0 +1,174 @@
+/*!
+ * \file      at-engine.c
+ *
+ * \brief     AT command dispatch shared by the AT front ends
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <string.h>
+#include "at-engine.h"
+
+const AtCmd_t *AtEngineFind( const AtTable_t *table, const char *name, uint8_t len )
+{
+    int lo = 0;
+    int hi = ( int )table->Count - 1;
+
+    while( lo <= hi )
+    {
+        int mid = ( lo + hi ) / 2;
+        const AtCmd_t *cmd = &table->Cmds[mid];
+        int cmp = memcmp( name, cmd->Name, ( len < cmd->Len ) ? len : cmd->Len );
+
+        if( cmp == 0 )
+        {
+            cmp = ( int )len - ( int )cmd->Len;
+        }
+        if( cmp == 0 )
+        {
+            return cmd;
+        }
+        if( cmp < 0 )
+        {
+            hi = mid - 1;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+int AtEngineSplit( char *args, char *argv[], int limit )
+{
+    int argc = 0;
+
+    while( ( *args != '\0' ) && ( argc < limit ) )
+    {
+        if( *args == ',' )
+        {
+            args++;
+            continue;
+        }
+        argv[argc++] = args;
+        while( ( *args != '\0' ) && ( *args != ',' ) )
+        {
+            args++;
+        }
+        if( *args == ',' )
+        {
+            *args++ = '\0';
+        }
+    }
+    return argc;
+}
+
+const AtCmd_t *AtEngineParse( const AtTable_t *table, char *line, int *opt, int *argc, char *argv[], int limit )
+{
+    const AtCmd_t *cmd;
+    size_t len;
+    char *ptr;
+
+    *argc = 0;
+    if( ( line[0] != 'A' ) || ( line[1] != 'T' ) )
+    {
+        return NULL;
+    }
+    line += 2;
+
+    // The name ends where its operation starts
+    len = strcspn( line, "?= " );
+    cmd = ( len <= UINT8_MAX ) ? AtEngineFind( table, line, ( uint8_t )len ) : NULL;
+    if( ( cmd == NULL ) || ( cmd->Fn == NULL ) )
+    {
+        return NULL;
+    }
+    ptr = line + len;
+
+    if( ( ptr[0] == '?' ) && ( ptr[1] == '\0' ) )
+    {
+        *opt = AT_ENGINE_QUERY;
+    }
+    else if( ptr[0] == '\0' )
+    {
+        *opt = AT_ENGINE_EXECUTE;
+    }
+    else if( ptr[0] == ' ' )
+    {
+        *opt = AT_ENGINE_EXECUTE;
+        argv[( *argc )++] = ptr;
+    }
+    else if( ( ptr[0] == '=' ) && ( ptr[1] == '?' ) && ( ptr[2] == '\0' ) )
+    {
+        *opt = AT_ENGINE_DESC;
+    }
+    else if( ptr[0] == '=' )
+    {
+        *opt = AT_ENGINE_SET;
+        *argc = AtEngineSplit( ptr + 1, argv, limit );
+    }
+    else
+    {
+        return NULL;
+    }
+    return cmd;
+}
+
+int AtEngineRun( const AtTable_t *table, char *line, char *argv[], int limit )
+{
+    const AtCmd_t *cmd;
+    int opt;
+    int argc;
+
+    cmd = AtEngineParse( table, line, &opt, &argc, argv, limit );
+    if( cmd == NULL )
+    {
+        return AT_ENGINE_ERROR;
+    }
+    return cmd->Fn( opt, argc, argv );
+}
+
+int AtEngineHex2Bin( const char *hex, uint8_t *bin, uint16_t size )
+{
+    size_t len = strlen( hex );
+    uint8_t *cur = bin;
+    uint8_t digits = len & 1;
+    uint8_t byte = 0;
+
+    if( ( len + 1 ) / 2 > size )
+    {
+        return -1;
+    }
+
+    for( ; *hex != '\0'; hex++ )
+    {
+        if( ( *hex >= '0' ) && ( *hex <= '9' ) )
+        {
+            byte |= *hex - '0';
+        }
+        else if( ( *hex >= 'a' ) && ( *hex <= 'f' ) )
+        {
+            byte |= 10 + ( *hex - 'a' );
+        }
+        else if( ( *hex >= 'A' ) && ( *hex <= 'F' ) )
+        {
+            byte |= 10 + ( *hex - 'A' );
+        }
+        else
+        {
+            return -1;
+        }
+
+        if( ++digits == 2 )
+        {
+            digits = 0;
+            *cur++ = byte;
+            byte = 0;
+        }
+        else
+        {
+            byte <<= 4;
+        }
+    }
+    return cur - bin;
+}
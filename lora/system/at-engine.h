@@ -0,0 +1,156 @@
+/*!
+ * \file      at-engine.h
+ *
+ * \brief     AT command dispatch shared by the AT front ends
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_AT_ENGINE
+ *
+ *            A front end keeps its line buffer, its receive path and its
+ *            output, and hands each line to \ref AtEngineRun with a table
+ *            of \ref AtCmd_t built at compile time with AT_CMD_ENTRY and
+ *            sorted by name. The name is looked up by a binary search on
+ *            its length known from the table, the operation is told from
+ *            what follows it:
+ *
+ *                AT<name>?          AT_ENGINE_QUERY
+ *                AT<name>           AT_ENGINE_EXECUTE
+ *                AT<name> <text>    AT_ENGINE_EXECUTE, argv[0] the text from
+ *                                   the space
+ *                AT<name>=?         AT_ENGINE_DESC
+ *                AT<name>=<a>,<b>   AT_ENGINE_SET, the arguments split in
+ *                                   place, the empty ones skipped
+ *
+ *            and the handler called with it.
+ *
+ * \{
+ */
+#ifndef __AT_ENGINE_H__
+#define __AT_ENGINE_H__
+
+#include <stdint.h>
+
+/*!
+ * Operations passed to the handlers
+ */
+#define AT_ENGINE_QUERY                             0x01
+#define AT_ENGINE_EXECUTE                           0x02
+#define AT_ENGINE_DESC                              0x03
+#define AT_ENGINE_SET                               0x04
+
+/*!
+ * Returned for a line which is no command of the table
+ */
+#define AT_ENGINE_ERROR                             -1
+
+/*!
+ * \brief Command handler
+ *
+ * \param [IN] opt     Operation, AT_ENGINE_
+ * \param [IN] argc    Number of arguments
+ * \param [IN] argv    Arguments, in the line
+ *
+ * \retval ret         Up to the front end, AT_ENGINE_ERROR for an error
+ */
+typedef int ( *AtHandler_t )( int opt, int argc, char *argv[] );
+
+/*!
+ * \brief Command, its name without the AT
+ */
+typedef struct
+{
+    const char *Name;
+    uint8_t Len;
+    AtHandler_t Fn;
+}AtCmd_t;
+
+/*!
+ * \brief Commands sorted by name, as memcmp orders them
+ */
+typedef struct
+{
+    const AtCmd_t *Cmds;
+    uint16_t Count;
+}AtTable_t;
+
+/*!
+ * Command of a string literal name
+ */
+#define AT_CMD_ENTRY( name, fn )                    { name, sizeof( name ) - 1, fn }
+
+/*!
+ * Table of an array of commands
+ */
+#define AT_TABLE( cmds )                            { cmds, sizeof( cmds ) / sizeof( cmds[0] ) }
+
+/*!
+ * \brief Looks a command up
+ *
+ * \param [IN] table   Commands
+ * \param [IN] name    Name, not terminated
+ * \param [IN] len     Name length
+ *
+ * \retval cmd         Command, NULL when not in the table
+ */
+const AtCmd_t *AtEngineFind( const AtTable_t *table, const char *name, uint8_t len );
+
+/*!
+ * \brief Splits comma separated arguments in place, the empty ones skipped
+ *
+ * \param [IN]  args   Arguments, terminated, the commas overwritten
+ * \param [OUT] argv   Arguments
+ * \param [IN]  limit  argv size, the arguments past it dropped
+ *
+ * \retval argc        Number of arguments
+ */
+int AtEngineSplit( char *args, char *argv[], int limit );
+
+/*!
+ * \brief Parses a command line, the arguments split in place
+ *
+ * \param [IN]  table  Commands
+ * \param [IN]  line   Line from the AT, terminated
+ * \param [OUT] opt    Operation, AT_ENGINE_
+ * \param [OUT] argc   Number of arguments
+ * \param [OUT] argv   Arguments
+ * \param [IN]  limit  argv size
+ *
+ * \retval cmd         Command, NULL for a line which is no command of the
+ *                     table
+ */
+const AtCmd_t *AtEngineParse( const AtTable_t *table, char *line, int *opt, int *argc, char *argv[], int limit );
+
+/*!
+ * \brief Parses a command line and calls its handler
+ *
+ * \param [IN]  table  Commands
+ * \param [IN]  line   Line from the AT, terminated
+ * \param [OUT] argv   Arguments, scratch of the call
+ * \param [IN]  limit  argv size
+ *
+ * \retval ret         Returned by the handler, AT_ENGINE_ERROR for a line
+ *                     which is no command of the table
+ */
+int AtEngineRun( const AtTable_t *table, char *line, char *argv[], int limit );
+
+/*!
+ * \brief Converts hexadecimal digits, an odd count right aligned
+ *
+ * \param [IN]  hex    Digits, terminated
+ * \param [OUT] bin    Bytes
+ * \param [IN]  size   bin size
+ *
+ * \retval len         Number of bytes, -1 for a digit out of [0-9a-fA-F] or
+ *                     more bytes than size
+ */
+int AtEngineHex2Bin( const char *hex, uint8_t *bin, uint16_t size );
+
+/*! \} defgroup LORA_AT_ENGINE */
+/*! \} addtogroup LORA */
+
+#endif // __AT_ENGINE_H__
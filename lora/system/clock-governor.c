@@ -0,0 +1,217 @@
+/*!
+ * \file      clock-governor.c
+ *
+ * \brief     System clock profiles following the workload implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stddef.h>
+#include "tremo_cm4.h"
+#include "tremo_rcc.h"
+#include "tremo_delay.h"
+#include "clock-governor.h"
+
+#ifdef CONFIG_CLOCK_GOVERNOR
+
+/*!
+ * Core clock divider of the low profile, from the boot clock
+ */
+#ifndef CLOCK_LOW_HCLK_DIV
+#define CLOCK_LOW_HCLK_DIV                          RCC_HCLK_DIV_8
+#endif
+
+/*!
+ * Settings of a profile
+ */
+typedef struct
+{
+    rcc_sys_clk_source_t Source;
+    rcc_hclk_div_t HclkDiv;
+    rcc_pclk0_div_t Pclk0Div;
+    rcc_pclk1_div_t Pclk1Div;
+}ClockConfig_t;
+
+static ClockConfig_t ClockConfigs[CLOCK_PROFILE_MAX];
+
+static ClockProfile_t ClockProfile = CLOCK_PROFILE_NORMAL;
+
+/*!
+ * Pending requests of the high profile
+ */
+static uint8_t ClockHighRequests = 0;
+
+static bool ClockIdle = false;
+
+static ClockNotifier_t *ClockNotifiers = NULL;
+
+static bool ClockInitialized = false;
+
+static uint32_t ClockSysFreq( rcc_sys_clk_source_t source )
+{
+    switch( source )
+    {
+        case RCC_SYS_CLK_SOURCE_RCO48M:
+            return RCC_FREQ_48M;
+        case RCC_SYS_CLK_SOURCE_XO32M:
+            return RCC_FREQ_32M;
+        case RCC_SYS_CLK_SOURCE_RCO4M:
+            return RCC_FREQ_4M;
+        case RCC_SYS_CLK_SOURCE_RCO32K:
+        case RCC_SYS_CLK_SOURCE_XO32K:
+            return RCC_FREQ_32768;
+        default:
+            return RCC_FREQ_24M;
+    }
+}
+
+/*!
+ * \brief Switches to a profile, with the interrupts masked
+ */
+static void ClockApply( ClockProfile_t profile )
+{
+    const ClockConfig_t *config = &ClockConfigs[profile];
+    ClockNotifier_t *notifier;
+    uint32_t hclk;
+    uint32_t pclk0;
+    uint32_t pclk1;
+
+    if( ( ClockInitialized == false ) || ( profile == ClockProfile ) )
+    {
+        return;
+    }
+    hclk = ClockSysFreq( config->Source ) >> ( ( uint32_t )config->HclkDiv >> 8 );
+    pclk0 = hclk >> ( ( uint32_t )config->Pclk0Div >> 5 );
+    pclk1 = hclk >> ( ( uint32_t )config->Pclk1Div >> 15 );
+    for( notifier = ClockNotifiers; notifier != NULL; notifier = notifier->Next )
+    {
+        if( ( notifier->CanChange != NULL ) && ( notifier->CanChange( hclk, pclk0, pclk1 ) == false ) )
+        {
+            return;
+        }
+    }
+
+    // The peripheral clocks never run above the ones of either profile
+    if( ClockSysFreq( config->Source ) > rcc_get_clk_freq( RCC_SYS_CLK ) )
+    {
+        rcc_set_pclk_div( config->Pclk0Div, config->Pclk1Div );
+        rcc_set_hclk_div( config->HclkDiv );
+        rcc_set_sys_clk_source( config->Source );
+    }
+    else
+    {
+        rcc_set_sys_clk_source( config->Source );
+        rcc_set_hclk_div( config->HclkDiv );
+        rcc_set_pclk_div( config->Pclk0Div, config->Pclk1Div );
+    }
+    ClockProfile = profile;
+
+    delay_init( );
+    for( notifier = ClockNotifiers; notifier != NULL; notifier = notifier->Next )
+    {
+        notifier->Changed( hclk, pclk0, pclk1 );
+    }
+}
+
+/*!
+ * \brief Profile the requests and the idle state call for
+ */
+static ClockProfile_t ClockWanted( void )
+{
+    if( ClockHighRequests > 0 )
+    {
+        return CLOCK_PROFILE_HIGH;
+    }
+    return ( ClockIdle == true ) ? CLOCK_PROFILE_LOW : CLOCK_PROFILE_NORMAL;
+}
+
+void ClockInit( void )
+{
+    ClockConfig_t *normal = &ClockConfigs[CLOCK_PROFILE_NORMAL];
+    uint32_t cr0 = RCC->CR0;
+
+    normal->Source = rcc_get_sys_clk_source( );
+    normal->HclkDiv = ( rcc_hclk_div_t )( cr0 & RCC_CR0_HCLK_DIV_MASK );
+    normal->Pclk0Div = ( rcc_pclk0_div_t )( cr0 & RCC_CR0_PCLK0_DIV_MASK );
+    normal->Pclk1Div = ( rcc_pclk1_div_t )( cr0 & RCC_CR0_PCLK1_DIV_MASK );
+
+    // Same source, slower core and peripherals
+    ClockConfigs[CLOCK_PROFILE_LOW] = *normal;
+    ClockConfigs[CLOCK_PROFILE_LOW].HclkDiv = CLOCK_LOW_HCLK_DIV;
+    ClockConfigs[CLOCK_PROFILE_LOW].Pclk0Div = RCC_PCLK0_DIV_1;
+    ClockConfigs[CLOCK_PROFILE_LOW].Pclk1Div = RCC_PCLK1_DIV_1;
+
+    // 48 MHz core, the peripherals stay at the 24 MHz of the boot clock
+    ClockConfigs[CLOCK_PROFILE_HIGH] = *normal;
+    if( ( normal->Source == RCC_SYS_CLK_SOURCE_RCO48M_DIV2 ) && ( normal->HclkDiv == RCC_HCLK_DIV_1 ) &&
+        ( normal->Pclk0Div == RCC_PCLK0_DIV_1 ) && ( normal->Pclk1Div == RCC_PCLK1_DIV_1 ) )
+    {
+        ClockConfigs[CLOCK_PROFILE_HIGH].Source = RCC_SYS_CLK_SOURCE_RCO48M;
+        ClockConfigs[CLOCK_PROFILE_HIGH].Pclk0Div = RCC_PCLK0_DIV_2;
+        ClockConfigs[CLOCK_PROFILE_HIGH].Pclk1Div = RCC_PCLK1_DIV_2;
+    }
+
+    ClockProfile = CLOCK_PROFILE_NORMAL;
+    ClockInitialized = true;
+}
+
+void ClockAddNotifier( ClockNotifier_t *notifier )
+{
+    uint32_t primask = __get_PRIMASK( );
+
+    __disable_irq( );
+    notifier->Next = ClockNotifiers;
+    ClockNotifiers = notifier;
+    __set_PRIMASK( primask );
+}
+
+void ClockRequest( ClockProfile_t profile )
+{
+    uint32_t primask;
+
+    if( profile != CLOCK_PROFILE_HIGH )
+    {
+        return;
+    }
+    primask = __get_PRIMASK( );
+    __disable_irq( );
+    ClockHighRequests++;
+    ClockApply( ClockWanted( ) );
+    __set_PRIMASK( primask );
+}
+
+void ClockRelease( ClockProfile_t profile )
+{
+    uint32_t primask;
+
+    if( profile != CLOCK_PROFILE_HIGH )
+    {
+        return;
+    }
+    primask = __get_PRIMASK( );
+    __disable_irq( );
+    if( ClockHighRequests > 0 )
+    {
+        ClockHighRequests--;
+    }
+    ClockApply( ClockWanted( ) );
+    __set_PRIMASK( primask );
+}
+
+void ClockIdleEnter( void )
+{
+    ClockIdle = true;
+    ClockApply( ClockWanted( ) );
+}
+
+void ClockIdleExit( void )
+{
+    ClockIdle = false;
+    ClockApply( ClockWanted( ) );
+}
+
+ClockProfile_t ClockGetProfile( void )
+{
+    return ClockProfile;
+}
+
+#endif
@@ -0,0 +1,126 @@
+/*!
+ * \file      clock-governor.h
+ *
+ * \brief     System clock profiles following the workload
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_CLOCK_GOVERNOR
+ *
+ *            The core runs at the boot clock, CLOCK_PROFILE_NORMAL. Work
+ *            bound by the core, the AES engine in particular, raises it to
+ *            CLOCK_PROFILE_HIGH for its duration with \ref ClockRequest and
+ *            \ref ClockRelease. While the MCU sleeps with the clocks on,
+ *            waiting for a radio window, the core drops to CLOCK_PROFILE_LOW
+ *            between \ref ClockIdleEnter and \ref ClockIdleExit, so the
+ *            interrupt handlers always run at the normal clock or faster.
+ *
+ *            The high profile keeps the peripheral clocks of the boot
+ *            clock. The low profile divides them, the drivers registered
+ *            with \ref ClockAddNotifier recompute their baud rates and
+ *            prescalers, or veto the change while a transfer is running.
+ *            The delay functions are recomputed by the governor.
+ *
+ * \{
+ */
+#ifndef __CLOCK_GOVERNOR_H__
+#define __CLOCK_GOVERNOR_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * Clock profiles, from the slowest
+ */
+typedef enum
+{
+    CLOCK_PROFILE_LOW = 0,  //!< MCU sleeping with the clocks on
+    CLOCK_PROFILE_NORMAL,   //!< Boot clock
+    CLOCK_PROFILE_HIGH,     //!< Crypto and computation bursts
+    CLOCK_PROFILE_MAX,
+}ClockProfile_t;
+
+/*!
+ * Driver told about the clock changes
+ */
+typedef struct sClockNotifier
+{
+    /*!
+     * \brief Asked before a change, may be NULL
+     *
+     * \param [IN] hclk   Core clock after the change [Hz]
+     * \param [IN] pclk0  Peripheral clock 0 after the change [Hz]
+     * \param [IN] pclk1  Peripheral clock 1 after the change [Hz]
+     *
+     * \retval allowed  false while a transfer would be corrupted, or when
+     *                  the driver cannot run from these clocks
+     */
+    bool ( *CanChange )( uint32_t hclk, uint32_t pclk0, uint32_t pclk1 );
+    /*!
+     * \brief Called after a change, with the interrupts masked
+     *
+     * \param [IN] hclk   Core clock [Hz]
+     * \param [IN] pclk0  Peripheral clock 0 [Hz]
+     * \param [IN] pclk1  Peripheral clock 1 [Hz]
+     */
+    void ( *Changed )( uint32_t hclk, uint32_t pclk0, uint32_t pclk1 );
+    struct sClockNotifier *Next;
+}ClockNotifier_t;
+
+/*!
+ * \brief Takes the boot clock as the normal profile
+ */
+void ClockInit( void );
+
+/*!
+ * \brief Registers a driver to the clock changes
+ *
+ * \param [IN] notifier Notifier, kept until the reset
+ */
+void ClockAddNotifier( ClockNotifier_t *notifier );
+
+/*!
+ * \brief Raises the clock until the matching \ref ClockRelease, from an
+ *        interrupt handler or the main loop
+ *
+ * \param [IN] profile  Profile needed, the requests are counted
+ */
+void ClockRequest( ClockProfile_t profile );
+
+/*!
+ * \brief Ends a \ref ClockRequest
+ *
+ * \param [IN] profile  Profile requested
+ */
+void ClockRelease( ClockProfile_t profile );
+
+/*!
+ * \brief Drops to the low profile before a sleep with the clocks on
+ *
+ * \remark To be called with the interrupts masked, the pending requests
+ *         keep their profile.
+ */
+void ClockIdleEnter( void );
+
+/*!
+ * \brief Restores the profile of the requests after the sleep
+ *
+ * \remark To be called with the interrupts still masked.
+ */
+void ClockIdleExit( void );
+
+/*!
+ * \brief Current profile
+ *
+ * \retval profile  Profile the clock runs at
+ */
+ClockProfile_t ClockGetProfile( void );
+
+/*! \} defgroup LORA_CLOCK_GOVERNOR */
+/*! \} addtogroup LORA */
+
+#endif // __CLOCK_GOVERNOR_H__
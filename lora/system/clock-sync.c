@@ -0,0 +1,151 @@
+/*!
+ * \file      clock-sync.c
+ *
+ * \brief     GPS time kept for the application from the DeviceTimeAns
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stdlib.h>
+#include "clock-sync.h"
+
+#ifdef CONFIG_CLOCK_SYNC
+
+static bool ClockSynced = false;
+static bool ClockRequested = false;
+static int64_t ClockLastSync;               // System time of the last answer [ms]
+static int64_t ClockLastRequest;            // System time of the last request [ms]
+static int64_t ClockSpanStart;              // System time of the answer starting the drift sample [ms]
+static int64_t ClockSpanCorrection;         // Corrections since [ms]
+static uint8_t ClockSamples = 0;
+static int32_t ClockDriftPpb;               // Positive when the RTC runs fast
+static int32_t ClockDeviationPpb;
+static uint32_t ClockErrorMax = CLOCK_SYNC_ERROR_MAX;
+
+static int64_t ClockSyncMs( TimerSysTime_t sysTime )
+{
+    return ( int64_t )sysTime.Seconds * 1000 + sysTime.SubSeconds;
+}
+
+/*!
+ * Time since the last answer, 0 when the system time was set back since
+ */
+static uint32_t ClockSyncElapsed( int64_t now )
+{
+    if( now <= ClockLastSync )
+    {
+        return 0;
+    }
+    if( now - ClockLastSync > UINT32_MAX )
+    {
+        return UINT32_MAX;
+    }
+    return ( uint32_t )( now - ClockLastSync );
+}
+
+void ClockSyncUpdate( TimerSysTime_t local, TimerSysTime_t ref )
+{
+    int64_t span = ClockSyncMs( ref ) - ClockSpanStart;
+    int32_t sample;
+
+    // The answers closer than CLOCK_SYNC_SPAN_MIN add up to a single sample,
+    // what the system time gained over the span is the drift
+    ClockSpanCorrection += ClockSyncMs( ref ) - ClockSyncMs( local );
+    if( ( ClockSynced == false ) || ( span < 0 ) )
+    {
+        ClockSpanStart = ClockSyncMs( ref );
+        ClockSpanCorrection = 0;
+    }
+    else if( span >= CLOCK_SYNC_SPAN_MIN )
+    {
+        sample = ( int32_t )( -ClockSpanCorrection * 1000000000LL / span );
+        if( ClockSamples == 0 )
+        {
+            ClockDriftPpb = sample;
+            // The error of the two answers over the span
+            ClockDeviationPpb = ( int32_t )( 2LL * CLOCK_SYNC_ERROR_BASE * 1000000000LL / span );
+        }
+        else
+        {
+            ClockDeviationPpb += ( abs( sample - ClockDriftPpb ) - ClockDeviationPpb ) / 4;
+            ClockDriftPpb += ( sample - ClockDriftPpb ) / 4;
+        }
+        if( ClockSamples < UINT8_MAX )
+        {
+            ClockSamples++;
+        }
+        ClockSpanStart = ClockSyncMs( ref );
+        ClockSpanCorrection = 0;
+    }
+
+    ClockLastSync = ClockSyncMs( ref );
+    ClockSynced = true;
+    ClockRequested = false;
+}
+
+bool ClockSyncGetGpsTime( TimerSysTime_t *gpsTime )
+{
+    int64_t now = ClockSyncMs( TimerGetSysTime( ) );
+
+    if( ClockSamples > 0 )
+    {
+        now -= ( int64_t )ClockDriftPpb * ClockSyncElapsed( now ) / 1000000000LL;
+    }
+    now -= ( int64_t )UNIX_GPS_EPOCH_OFFSET * 1000;
+
+    gpsTime->Seconds = ( uint32_t )( now / 1000 );
+    gpsTime->SubSeconds = ( int16_t )( now % 1000 );
+    return ClockSynced;
+}
+
+uint32_t ClockSyncGetError( void )
+{
+    uint32_t elapsed;
+    uint32_t ppb;
+
+    if( ClockSynced == false )
+    {
+        return UINT32_MAX;
+    }
+
+    elapsed = ClockSyncElapsed( ClockSyncMs( TimerGetSysTime( ) ) );
+    if( ClockSamples > 0 )
+    {
+        ppb = 2 * ( uint32_t )ClockDeviationPpb + CLOCK_SYNC_PPM_MARGIN * 1000;
+    }
+    else
+    {
+        ppb = CLOCK_SYNC_PPM_DEFAULT * 1000;
+    }
+    return CLOCK_SYNC_ERROR_BASE + ( uint32_t )( ( uint64_t )elapsed * ppb / 1000000000ULL );
+}
+
+void ClockSyncSetErrorMax( uint32_t errorMax )
+{
+    ClockErrorMax = errorMax;
+}
+
+bool ClockSyncNeeded( void )
+{
+    int64_t now = ClockSyncMs( TimerGetSysTime( ) );
+
+    // The answer of a request is waited for, the system time may have been
+    // set back meanwhile
+    if( ( ClockRequested == true ) && ( now >= ClockLastRequest ) &&
+        ( now - ClockLastRequest < CLOCK_SYNC_RETRY ) )
+    {
+        return false;
+    }
+    if( ClockSynced == false )
+    {
+        return true;
+    }
+    return ( ClockSyncElapsed( now ) >= CLOCK_SYNC_INTERVAL_MAX ) || ( ClockSyncGetError( ) > ClockErrorMax );
+}
+
+void ClockSyncRequested( void )
+{
+    ClockLastRequest = ClockSyncMs( TimerGetSysTime( ) );
+    ClockRequested = true;
+}
+
+#endif
@@ -0,0 +1,134 @@
+/*!
+ * \file      clock-sync.h
+ *
+ * \brief     GPS time kept for the application from the DeviceTimeAns
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_CLOCK_SYNC
+ *
+ *            The MAC sets the system time from each DeviceTimeAns, see
+ *            \ref TimerSetSysTime. The correction it makes over the time
+ *            since the previous answer gives the drift of the RTC, averaged
+ *            over the answers along with its deviation. The time given to
+ *            the application is compensated for the drift, its error
+ *            predicted from the deviation of the drift and the time elapsed.
+ *
+ *            A DeviceTimeReq is due only once the predicted error is above
+ *            the bound, added to the next uplink of the application: with a
+ *            crystal drifting by a few ppm, a few per day at most.
+ *
+ * \{
+ */
+#ifndef __CLOCK_SYNC_H__
+#define __CLOCK_SYNC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "timer.h"
+
+/*!
+ * Default bound of the predicted error [ms]
+ */
+#ifndef CLOCK_SYNC_ERROR_MAX
+#define CLOCK_SYNC_ERROR_MAX                        1000
+#endif
+
+/*!
+ * Error of the time of a DeviceTimeAns, the 1/256 s of the answer and the
+ * timing of the end of the uplink [ms]
+ */
+#ifndef CLOCK_SYNC_ERROR_BASE
+#define CLOCK_SYNC_ERROR_BASE                       10
+#endif
+
+/*!
+ * Drift assumed until it is measured [ppm]
+ */
+#ifndef CLOCK_SYNC_PPM_DEFAULT
+#define CLOCK_SYNC_PPM_DEFAULT                      40
+#endif
+
+/*!
+ * Drift change allowed for on top of the measured deviation, the crystal
+ * following the temperature [ppm]
+ */
+#ifndef CLOCK_SYNC_PPM_MARGIN
+#define CLOCK_SYNC_PPM_MARGIN                       1
+#endif
+
+/*!
+ * Shortest time between two answers giving a drift sample, the error of
+ * the answers over it small against the drift [ms]
+ */
+#ifndef CLOCK_SYNC_SPAN_MIN
+#define CLOCK_SYNC_SPAN_MIN                         ( 4 * 3600000 )
+#endif
+
+/*!
+ * Longest time between two DeviceTimeReq, whatever the predicted error [ms]
+ */
+#ifndef CLOCK_SYNC_INTERVAL_MAX
+#define CLOCK_SYNC_INTERVAL_MAX                     ( 24 * 3600000 )
+#endif
+
+/*!
+ * Shortest time between two DeviceTimeReq, the answer of one being lost [ms]
+ */
+#ifndef CLOCK_SYNC_RETRY
+#define CLOCK_SYNC_RETRY                            ( 10 * 60000 )
+#endif
+
+/*!
+ * \brief Takes the time of a DeviceTimeAns, called by the MAC before it
+ *        applies the time
+ *
+ * \param [IN] local    System time before the answer
+ * \param [IN] ref      System time given by the answer
+ */
+void ClockSyncUpdate( TimerSysTime_t local, TimerSysTime_t ref );
+
+/*!
+ * \brief Gets the GPS time, compensated for the drift
+ *
+ * \param [OUT] gpsTime Seconds and milliseconds since the GPS epoch
+ *
+ * \retval synced       false before the first DeviceTimeAns
+ */
+bool ClockSyncGetGpsTime( TimerSysTime_t *gpsTime );
+
+/*!
+ * \brief Predicted error of the GPS time
+ *
+ * \retval error        Error [ms], UINT32_MAX before the first DeviceTimeAns
+ */
+uint32_t ClockSyncGetError( void );
+
+/*!
+ * \brief Sets the bound of the predicted error
+ *
+ * \param [IN] errorMax Bound [ms]
+ */
+void ClockSyncSetErrorMax( uint32_t errorMax );
+
+/*!
+ * \brief Tells whether a DeviceTimeReq is due
+ *
+ * \retval due          true when the predicted error is above the bound, the
+ *                      previous request older than CLOCK_SYNC_RETRY
+ */
+bool ClockSyncNeeded( void );
+
+/*!
+ * \brief Logs a DeviceTimeReq added to an uplink
+ */
+void ClockSyncRequested( void );
+
+/*! \} defgroup LORA_CLOCK_SYNC */
+/*! \} addtogroup LORA */
+
+#endif // __CLOCK_SYNC_H__
@@ -0,0 +1,345 @@
+/*!
+ * \file      coroutine.c
+ *
+ * \brief     Stackless coroutines implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stddef.h>
+#include "tremo_cm4.h"
+#include "coroutine.h"
+#ifdef CONFIG_SCHEDULER
+#include "scheduler.h"
+#endif
+
+/*!
+ * Priority of the scheduler task running the coroutines
+ */
+#ifndef CO_TASK_PRIORITY
+#define CO_TASK_PRIORITY                            0
+#endif
+
+/*!
+ * Scheduler task event, a coroutine has been signaled
+ */
+#define CO_TASK_EVENT                               ( 1UL << 0 )
+
+CoRadioResult_t CoroutineRadio;
+
+static Coroutine_t *CoroutineList = NULL;
+
+/*!
+ * Shared by the coroutines, armed for the earliest deadline
+ */
+static TimerEvent_t CoroutineTimer;
+static bool CoroutineTimerInit = false;
+
+static RadioEvents_t CoroutineRadioCallbacks;
+
+static char CoroutineUartBuffer[CO_UART_LINE_SIZE];
+static uint8_t CoroutineUartIndex = 0;
+static volatile bool CoroutineUartReady = false;
+
+#ifdef CONFIG_SCHEDULER
+static SchedTask_t CoroutineTask;
+static bool CoroutineTaskInit = false;
+
+static void OnCoroutineTask( uint32_t events )
+{
+    // A coroutine signaled meanwhile wakes the task again, the other tasks
+    // run in between
+    CoroutineRunOnce( );
+}
+#endif
+
+static void CoroutineArmTimer( void );
+
+static void OnCoroutineTimerEvent( void )
+{
+    TimerTime_t now = TimerGetCurrentTime( );
+    Coroutine_t *co;
+
+    for( co = CoroutineList; co != NULL; co = co->Next )
+    {
+        if( ( co->TimerArmed == true ) && ( co->Deadline <= now ) )
+        {
+            co->TimerArmed = false;
+            CoroutineSignal( co, CO_EVENT_TIMER );
+        }
+    }
+    CoroutineArmTimer( );
+}
+
+/*!
+ * \brief Arms the shared timer for the earliest armed deadline
+ *
+ * \remark A deadline armed concurrently from the timer interrupt makes the
+ *         timer fire early at worst, the deadlines are checked again then.
+ */
+static void CoroutineArmTimer( void )
+{
+    TimerTime_t now = TimerGetCurrentTime( );
+    TimerTime_t next = 0;
+    Coroutine_t *co;
+
+    for( co = CoroutineList; co != NULL; co = co->Next )
+    {
+        if( ( co->TimerArmed == true ) && ( ( next == 0 ) || ( co->Deadline < next ) ) )
+        {
+            next = co->Deadline;
+        }
+    }
+    TimerStop( &CoroutineTimer );
+    if( next != 0 )
+    {
+        TimerSetValue( &CoroutineTimer, ( next > now ) ? ( uint32_t )( next - now ) : 1 );
+        TimerStart( &CoroutineTimer );
+    }
+}
+
+void CoroutineInit( Coroutine_t *co, CoState_t ( *body )( Coroutine_t *co ), void *context )
+{
+    Coroutine_t *cur;
+
+    if( CoroutineTimerInit == false )
+    {
+        TimerInit( &CoroutineTimer, OnCoroutineTimerEvent );
+        CoroutineTimerInit = true;
+    }
+#ifdef CONFIG_SCHEDULER
+    if( CoroutineTaskInit == false )
+    {
+        SchedTaskInit( &CoroutineTask, OnCoroutineTask, CO_TASK_PRIORITY );
+        CoroutineTaskInit = true;
+    }
+#endif
+
+    co->Body = body;
+    co->Context = context;
+    co->Fired = 0;
+    co->Line = 0;
+    co->Wait = CO_EVENT_START;
+    co->Events = 0;
+    co->Deadline = 0;
+    co->TimerArmed = false;
+
+    for( cur = CoroutineList; cur != NULL; cur = cur->Next )
+    {
+        if( cur == co )
+        {
+            break;
+        }
+    }
+    if( cur == NULL )
+    {
+        // Linked at the head in one store, the interrupt handlers may be
+        // walking the list
+        co->Next = CoroutineList;
+        CoroutineList = co;
+    }
+    CoroutineSignal( co, CO_EVENT_START );
+}
+
+void CoroutineRestart( Coroutine_t *co )
+{
+    CoroutineStopTimer( co );
+    co->Line = 0;
+    co->Wait = CO_EVENT_START;
+    CoroutineSignal( co, CO_EVENT_START );
+}
+
+void CoroutineSignal( Coroutine_t *co, uint32_t events )
+{
+    uint32_t cur;
+
+    do
+    {
+        cur = __LDREXW( &co->Events );
+    }while( __STREXW( cur | events, &co->Events ) != 0 );
+
+#ifdef CONFIG_SCHEDULER
+    SchedSetEvents( &CoroutineTask, CO_TASK_EVENT );
+#endif
+}
+
+void CoroutineBroadcast( uint32_t events )
+{
+    Coroutine_t *co;
+
+    for( co = CoroutineList; co != NULL; co = co->Next )
+    {
+        CoroutineSignal( co, events );
+    }
+}
+
+void CoroutineClearEvents( Coroutine_t *co, uint32_t events )
+{
+    uint32_t cur;
+
+    do
+    {
+        cur = __LDREXW( &co->Events );
+    }while( __STREXW( cur & ~events, &co->Events ) != 0 );
+    co->Fired &= ~events;
+}
+
+void CoroutineStartTimer( Coroutine_t *co, uint32_t timeout )
+{
+    CoroutineClearEvents( co, CO_EVENT_TIMER );
+    co->Deadline = TimerGetCurrentTime( ) + timeout;
+    co->TimerArmed = true;
+    CoroutineArmTimer( );
+}
+
+void CoroutineStopTimer( Coroutine_t *co )
+{
+    if( co->TimerArmed == true )
+    {
+        co->TimerArmed = false;
+        CoroutineArmTimer( );
+    }
+}
+
+bool CoroutinePending( void )
+{
+    Coroutine_t *co;
+
+    for( co = CoroutineList; co != NULL; co = co->Next )
+    {
+        if( ( co->Events & co->Wait ) != 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CoroutineRunOnce( void )
+{
+    Coroutine_t *co;
+    uint32_t events;
+    bool run = false;
+
+    for( co = CoroutineList; co != NULL; co = co->Next )
+    {
+        // Takes the awaited events only, the others stay signaled for a
+        // later await of the same coroutine
+        do
+        {
+            events = __LDREXW( &co->Events );
+            if( ( events & co->Wait ) == 0 )
+            {
+                __CLREX( );
+                break;
+            }
+        }while( __STREXW( events & ~co->Wait, &co->Events ) != 0 );
+
+        events &= co->Wait;
+        if( events != 0 )
+        {
+            co->Fired = events;
+            co->Body( co );
+            run = true;
+        }
+    }
+    return run;
+}
+
+void CoroutineRun( void )
+{
+    for( ;; )
+    {
+        Radio.IrqProcess( );
+#ifdef CONFIG_SCHEDULER
+        if( SchedRunOnce( ) == false )
+#else
+        if( CoroutineRunOnce( ) == false )
+#endif
+        {
+            TimerLowPowerHandler( );
+        }
+    }
+}
+
+static void CoroutineRadioReport( CoRadioStatus_t status )
+{
+    CoroutineRadio.Status = status;
+    CoroutineBroadcast( CO_EVENT_RADIO );
+}
+
+static void OnCoroutineTxDone( void )
+{
+    CoroutineRadioReport( CO_RADIO_TX_DONE );
+}
+
+static void OnCoroutineTxTimeout( void )
+{
+    CoroutineRadioReport( CO_RADIO_TX_TIMEOUT );
+}
+
+static void OnCoroutineRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr )
+{
+    CoroutineRadio.Payload = payload;
+    CoroutineRadio.Size = size;
+    CoroutineRadio.Rssi = rssi;
+    CoroutineRadio.Snr = snr;
+    CoroutineRadioReport( CO_RADIO_RX_DONE );
+}
+
+static void OnCoroutineRxTimeout( void )
+{
+    CoroutineRadioReport( CO_RADIO_RX_TIMEOUT );
+}
+
+static void OnCoroutineRxError( void )
+{
+    CoroutineRadioReport( CO_RADIO_RX_ERROR );
+}
+
+static void OnCoroutineCadDone( bool channelActivityDetected )
+{
+    CoroutineRadioReport( ( channelActivityDetected == true ) ? CO_RADIO_CAD_DETECTED : CO_RADIO_CAD_DONE );
+}
+
+RadioEvents_t *CoroutineRadioEvents( void )
+{
+    CoroutineRadioCallbacks.TxDone = OnCoroutineTxDone;
+    CoroutineRadioCallbacks.TxTimeout = OnCoroutineTxTimeout;
+    CoroutineRadioCallbacks.RxDone = OnCoroutineRxDone;
+    CoroutineRadioCallbacks.RxTimeout = OnCoroutineRxTimeout;
+    CoroutineRadioCallbacks.RxError = OnCoroutineRxError;
+    CoroutineRadioCallbacks.CadDone = OnCoroutineCadDone;
+    return &CoroutineRadioCallbacks;
+}
+
+void CoroutineUartInput( uint8_t data )
+{
+    if( CoroutineUartReady == true )
+    {
+        return;
+    }
+    if( ( data == '\r' ) || ( data == '\n' ) )
+    {
+        if( CoroutineUartIndex != 0 )
+        {
+            CoroutineUartBuffer[CoroutineUartIndex] = '\0';
+            CoroutineUartReady = true;
+            CoroutineBroadcast( CO_EVENT_UART_LINE );
+        }
+    }
+    else if( CoroutineUartIndex < ( CO_UART_LINE_SIZE - 1 ) )
+    {
+        CoroutineUartBuffer[CoroutineUartIndex++] = data;
+    }
+}
+
+char *CoroutineUartLine( void )
+{
+    return ( CoroutineUartReady == true ) ? CoroutineUartBuffer : NULL;
+}
+
+void CoroutineUartRelease( void )
+{
+    CoroutineUartIndex = 0;
+    CoroutineUartReady = false;
+}
@@ -0,0 +1,356 @@
+/*!
+ * \file      coroutine.h
+ *
+ * \brief     Stackless coroutines for the application flows
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_COROUTINE
+ *
+ *            A coroutine is a function written as a sequence of steps that
+ *            awaits timers, radio events, UART lines or user events in
+ *            between, without spinning: it returns at each await and is
+ *            resumed at the same place once the awaited event is signaled.
+ *            The MCU enters the low power mode while every coroutine waits.
+ *
+ *            The variables of the coroutine function are not kept across an
+ *            await, the state has to live in the coroutine context or in
+ *            static variables. An await cannot be placed in a switch
+ *            statement of the coroutine body.
+ *
+ * \code
+ * static CoState_t PingBody( Coroutine_t *co )
+ * {
+ *     CO_BEGIN( co );
+ *     for( ;; )
+ *     {
+ *         Radio.Send( Buffer, BufferSize );
+ *         CO_AWAIT_RADIO( co );
+ *         Radio.Rx( RX_TIMEOUT_VALUE );
+ *         CO_AWAIT_RADIO( co );
+ *         if( CoroutineRadio.Status != CO_RADIO_RX_DONE )
+ *         {
+ *             CO_AWAIT_TIMER( co, RETRY_DELAY );
+ *         }
+ *     }
+ *     CO_END( co );
+ * }
+ *
+ * Radio.Init( CoroutineRadioEvents( ) );
+ * CoroutineInit( &Ping, PingBody, NULL );
+ * CoroutineRun( );
+ * \endcode
+ *
+ * \{
+ */
+#ifndef __COROUTINE_H__
+#define __COROUTINE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "timer.h"
+#include "radio.h"
+
+/*!
+ * Size of the UART line buffer, terminating null included
+ */
+#ifndef CO_UART_LINE_SIZE
+#define CO_UART_LINE_SIZE                           64
+#endif
+
+/*!
+ * Coroutine events, the application numbers its own from CO_EVENT_USER
+ */
+#define CO_EVENT_START                              ( 1UL << 0 )
+#define CO_EVENT_YIELD                              ( 1UL << 1 )
+#define CO_EVENT_TIMER                              ( 1UL << 2 )
+#define CO_EVENT_RADIO                              ( 1UL << 3 )
+#define CO_EVENT_UART_LINE                          ( 1UL << 4 )
+#define CO_EVENT_USER                               ( 1UL << 8 )
+
+/*!
+ * Coroutine function return value
+ */
+typedef enum
+{
+    CO_WAITING = 0,     //!< Awaits an event
+    CO_ENDED,           //!< Reached CO_END or CO_EXIT
+}CoState_t;
+
+/*!
+ * Coroutine
+ */
+typedef struct Coroutine_s
+{
+    /*!
+     * Coroutine function
+     */
+    CoState_t ( *Body )( struct Coroutine_s *co );
+    /*!
+     * Application context
+     */
+    void *Context;
+    /*!
+     * Events the coroutine has been resumed with
+     */
+    uint32_t Fired;
+    /*!
+     * Internal, resume point
+     */
+    uint16_t Line;
+    /*!
+     * Internal, events awaited
+     */
+    uint32_t Wait;
+    /*!
+     * Internal, signaled events
+     */
+    volatile uint32_t Events;
+    /*!
+     * Internal, CO_EVENT_TIMER deadline
+     */
+    TimerTime_t Deadline;
+    /*!
+     * Internal, set while the deadline is armed
+     */
+    volatile bool TimerArmed;
+    /*!
+     * Internal, coroutine list link
+     */
+    struct Coroutine_s *Next;
+}Coroutine_t;
+
+/*!
+ * Radio event reported by the \ref CoroutineRadioEvents callbacks
+ */
+typedef enum
+{
+    CO_RADIO_NONE = 0,
+    CO_RADIO_TX_DONE,
+    CO_RADIO_TX_TIMEOUT,
+    CO_RADIO_RX_DONE,
+    CO_RADIO_RX_TIMEOUT,
+    CO_RADIO_RX_ERROR,
+    CO_RADIO_CAD_DONE,
+    CO_RADIO_CAD_DETECTED,
+}CoRadioStatus_t;
+
+/*!
+ * Last radio event
+ */
+typedef struct
+{
+    CoRadioStatus_t Status;
+    /*!
+     * Received payload, valid until the next RX
+     */
+    uint8_t *Payload;
+    uint16_t Size;
+    int16_t Rssi;
+    int8_t Snr;
+}CoRadioResult_t;
+
+extern CoRadioResult_t CoroutineRadio;
+
+/*!
+ * Starts the coroutine body, at its beginning or where it left
+ */
+#define CO_BEGIN( co )                                                        \
+    switch( ( co )->Line ) { case 0:
+
+/*!
+ * Ends the coroutine body, the coroutine is not resumed anymore
+ */
+#define CO_END( co )                                                          \
+    } ( co )->Line = 0; ( co )->Wait = 0; return CO_ENDED
+
+/*!
+ * Ends the coroutine from anywhere in its body
+ */
+#define CO_EXIT( co )                                                         \
+    do { ( co )->Line = 0; ( co )->Wait = 0; return CO_ENDED; } while( 0 )
+
+/*!
+ * Awaits one of the events of the mask, then until the condition is true.
+ * The condition is checked first and again on each awaited event
+ */
+#define CO_AWAIT( co, mask, cond )                                            \
+    do {                                                                      \
+        ( co )->Line = __LINE__; case __LINE__:                               \
+        if( !( cond ) ) { ( co )->Wait = ( mask ); return CO_WAITING; }       \
+        ( co )->Wait = 0;                                                     \
+    } while( 0 )
+
+/*!
+ * Awaits one of the events of the mask, signaled from now on
+ */
+#define CO_AWAIT_EVENTS( co, mask )                                           \
+    do {                                                                      \
+        CoroutineClearEvents( ( co ), ( mask ) );                             \
+        CO_AWAIT( ( co ), ( mask ), ( ( co )->Fired & ( mask ) ) != 0 );      \
+    } while( 0 )
+
+/*!
+ * Awaits one of the events of the mask, for timeout ms at most.
+ * \ref CO_TIMED_OUT tells how it ended
+ */
+#define CO_AWAIT_EVENTS_TIMEOUT( co, mask, timeout )                          \
+    do {                                                                      \
+        CoroutineClearEvents( ( co ), ( mask ) );                             \
+        CoroutineStartTimer( ( co ), ( timeout ) );                           \
+        CO_AWAIT( ( co ), ( mask ) | CO_EVENT_TIMER,                          \
+                  ( ( co )->Fired & ( ( mask ) | CO_EVENT_TIMER ) ) != 0 );   \
+        CoroutineStopTimer( co );                                             \
+    } while( 0 )
+
+#define CO_TIMED_OUT( co )                                                    \
+    ( ( ( co )->Fired & CO_EVENT_TIMER ) != 0 )
+
+/*!
+ * Lets the other coroutines run, resumes right after them
+ */
+#define CO_YIELD( co )                                                        \
+    do {                                                                      \
+        CoroutineClearEvents( ( co ), CO_EVENT_YIELD );                       \
+        CoroutineSignal( ( co ), CO_EVENT_YIELD );                            \
+        CO_AWAIT( ( co ), CO_EVENT_YIELD,                                     \
+                  ( ( co )->Fired & CO_EVENT_YIELD ) != 0 );                  \
+    } while( 0 )
+
+/*!
+ * Sleeps for timeout ms
+ */
+#define CO_AWAIT_TIMER( co, timeout )                                         \
+    do {                                                                      \
+        CoroutineStartTimer( ( co ), ( timeout ) );                           \
+        CO_AWAIT( ( co ), CO_EVENT_TIMER, ( co )->TimerArmed == false );      \
+    } while( 0 )
+
+/*!
+ * Awaits the end of the radio operation started before, reported in
+ * \ref CoroutineRadio
+ */
+#define CO_AWAIT_RADIO( co )                                                  \
+    CO_AWAIT_EVENTS( ( co ), CO_EVENT_RADIO )
+
+/*!
+ * Awaits a line on the UART, read with \ref CoroutineUartLine and released
+ * with \ref CoroutineUartRelease
+ */
+#define CO_AWAIT_UART_LINE( co )                                              \
+    CO_AWAIT( ( co ), CO_EVENT_UART_LINE, CoroutineUartLine( ) != NULL )
+
+/*!
+ * \brief Initializes a coroutine and schedules its first run
+ *
+ * \param [IN] co       Coroutine
+ * \param [IN] body     Coroutine function
+ * \param [IN] context  Application context
+ */
+void CoroutineInit( Coroutine_t *co, CoState_t ( *body )( Coroutine_t *co ), void *context );
+
+/*!
+ * \brief Runs an ended coroutine again from its beginning
+ *
+ * \param [IN] co       Coroutine
+ */
+void CoroutineRestart( Coroutine_t *co );
+
+/*!
+ * \brief Signals events to a coroutine, from an interrupt handler or the
+ *        main loop
+ *
+ * \param [IN] co       Coroutine
+ * \param [IN] events   Events to signal
+ */
+void CoroutineSignal( Coroutine_t *co, uint32_t events );
+
+/*!
+ * \brief Signals events to every coroutine
+ *
+ * \param [IN] events   Events to signal
+ */
+void CoroutineBroadcast( uint32_t events );
+
+/*!
+ * \brief Clears signaled events, used by the await macros
+ *
+ * \param [IN] co       Coroutine
+ * \param [IN] events   Events to clear
+ */
+void CoroutineClearEvents( Coroutine_t *co, uint32_t events );
+
+/*!
+ * \brief Signals CO_EVENT_TIMER to the coroutine timeout ms from now
+ *
+ * \param [IN] co       Coroutine
+ * \param [IN] timeout  Delay [ms]
+ */
+void CoroutineStartTimer( Coroutine_t *co, uint32_t timeout );
+
+/*!
+ * \brief Cancels the coroutine timer
+ *
+ * \param [IN] co       Coroutine
+ */
+void CoroutineStopTimer( Coroutine_t *co );
+
+/*!
+ * \brief Tells if a coroutine has an awaited event signaled
+ *
+ * \retval pending      true when CoroutineRunOnce would resume a coroutine
+ */
+bool CoroutinePending( void );
+
+/*!
+ * \brief Resumes the coroutines whose awaited events are signaled
+ *
+ * \retval run          false when no coroutine was resumed
+ */
+bool CoroutineRunOnce( void );
+
+/*!
+ * \brief Main loop processing the radio events and running the coroutines,
+ *        or the scheduler tasks, and the low power mode in between. Never
+ *        returns
+ */
+void CoroutineRun( void );
+
+/*!
+ * \brief Radio callbacks reporting to \ref CoroutineRadio and signaling
+ *        CO_EVENT_RADIO to every coroutine
+ *
+ * \retval events       Events to give to Radio.Init
+ */
+RadioEvents_t *CoroutineRadioEvents( void );
+
+/*!
+ * \brief Feeds a received UART byte, from the UART interrupt handler
+ *
+ * \remark CO_EVENT_UART_LINE is signaled to every coroutine on a line end,
+ *         the bytes received until the line is released are dropped.
+ *
+ * \param [IN] data     Received byte
+ */
+void CoroutineUartInput( uint8_t data );
+
+/*!
+ * \brief Received line, without its line end
+ *
+ * \retval line         NULL until a line has been received
+ */
+char *CoroutineUartLine( void );
+
+/*!
+ * \brief Releases the received line, the UART input starts the next one
+ */
+void CoroutineUartRelease( void );
+
+/*! \} defgroup LORA_COROUTINE */
+/*! \} addtogroup LORA */
+
+#endif // __COROUTINE_H__
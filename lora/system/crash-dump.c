@@ -0,0 +1,203 @@
+/*!
+ * \file      crash-dump.c
+ *
+ * \brief     Fault and watchdog snapshot kept across the reset
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stddef.h>
+#include <string.h>
+#include "tremo_cm4.h"
+#include "tremo_iwdg.h"
+#include "crc.h"
+#include "timer.h"
+#include "crash-dump.h"
+
+#ifdef CONFIG_CRASH_DUMP
+
+#define CRASH_DUMP_MAGIC                            0x44534352
+
+/*!
+ * Start of the main SRAM, the stack is read between it and _estack
+ */
+#define CRASH_DUMP_RAM_START                        0x20000000
+
+/*!
+ * Words of the exception frame with the FPU context
+ */
+#define CRASH_DUMP_FRAME_FPU_WORDS                  26
+
+/*!
+ * Length of the \ref CrashDumpExport form up to the events
+ */
+#define CRASH_DUMP_EXPORT_HEAD                      31
+
+/*!
+ * End of the stack, from the linker script
+ */
+extern uint32_t _estack;
+
+static CrashDump_t CrashDump RETAINED_ATTR;
+
+/*!
+ * Snapshot of the previous boot found valid
+ */
+static bool CrashDumpValid = false;
+
+static uint16_t CrashDumpCrc( void )
+{
+    return CrcCompute( &CrcCcitt, ( const uint8_t * )&CrashDump, offsetof( CrashDump_t, Crc ) );
+}
+
+static void CrashDumpSeal( void )
+{
+    CrashDump.Magic = CRASH_DUMP_MAGIC;
+    CrashDump.Crc = CrashDumpCrc( );
+}
+
+void CrashDumpInit( void )
+{
+    CrashDumpValid = ( CrashDump.Magic == CRASH_DUMP_MAGIC ) && ( CrashDump.Cause != CRASH_DUMP_NONE ) &&
+                     ( CrashDump.Crc == CrashDumpCrc( ) );
+    if( CrashDumpValid == false )
+    {
+        memset( &CrashDump, 0, sizeof( CrashDump_t ) );
+    }
+}
+
+void CrashDumpCapture( uint32_t *frame, uint32_t excReturn, uint32_t cause )
+{
+    uint32_t sp = ( uint32_t )frame;
+    void ( *next )( void );
+
+    __disable_irq( );
+    memset( &CrashDump, 0, sizeof( CrashDump_t ) );
+    CrashDump.Cause = ( uint8_t )cause;
+    CrashDump.ExcReturn = excReturn;
+    CrashDump.Cfsr = SCB->CFSR;
+    CrashDump.Hfsr = SCB->HFSR;
+    CrashDump.Mmfar = SCB->MMFAR;
+    CrashDump.Bfar = SCB->BFAR;
+
+    // A stack pointer out of the SRAM faulted itself, only the fault status
+    // is recorded
+    if( ( sp >= CRASH_DUMP_RAM_START ) && ( ( sp & 3 ) == 0 ) &&
+        ( ( sp + CRASH_DUMP_FRAME_WORDS * 4 ) <= ( uint32_t )&_estack ) )
+    {
+        memcpy( CrashDump.Regs, frame, sizeof( CrashDump.Regs ) );
+        // EXC_RETURN bit 4 clear for a frame with the FPU context
+        sp += ( ( excReturn & 0x10 ) == 0 ) ? CRASH_DUMP_FRAME_FPU_WORDS * 4 : CRASH_DUMP_FRAME_WORDS * 4;
+        // The 8 bytes alignment pad
+        if( ( CrashDump.Regs[CRASH_DUMP_XPSR] & ( 1UL << 9 ) ) != 0 )
+        {
+            sp += 4;
+        }
+        CrashDump.Sp = sp;
+        while( ( CrashDump.StackCount < CONFIG_CRASH_DUMP_STACK_WORDS ) && ( sp < ( uint32_t )&_estack ) )
+        {
+            CrashDump.Stack[CrashDump.StackCount++] = *( uint32_t * )sp;
+            sp += 4;
+        }
+    }
+    // Sealed twice, the registers are kept should the queues walked below
+    // be corrupted and fault again
+    CrashDumpSeal( );
+
+    CrashDump.EventCount = EventGetRecent( CrashDump.Events, CONFIG_CRASH_DUMP_EVENTS );
+    CrashDump.TimerCount = TimerGetRunning( &next );
+    CrashDump.TimerNext = ( uint32_t )next;
+    CrashDump.Time = ( uint32_t )TimerGetCurrentTime( );
+#ifdef CONFIG_PROFILE
+    for( uint8_t i = 0; i < PROFILE_PROBE_MAX; i++ )
+    {
+        if( ProfileProbes[i].Count != 0 )
+        {
+            CrashDump.ProbeCycles[i] = ( uint32_t )( ProfileProbes[i].Total / ProfileProbes[i].Count );
+        }
+    }
+#endif
+    CrashDumpSeal( );
+
+    if( cause == CRASH_DUMP_HARD_FAULT )
+    {
+        NVIC_SystemReset( );
+    }
+    // Once per hang, the IWDG reset follows and is accounted by the watchdog
+    iwdg_config_interrupt( false );
+    NVIC_DisableIRQ( IWDG_IRQn );
+    NVIC_ClearPendingIRQ( IWDG_IRQn );
+    __enable_irq( );
+}
+
+const CrashDump_t *CrashDumpGet( void )
+{
+    return ( CrashDumpValid == true ) ? &CrashDump : NULL;
+}
+
+void CrashDumpClear( void )
+{
+    __disable_irq( );
+    memset( &CrashDump, 0, sizeof( CrashDump_t ) );
+    CrashDumpValid = false;
+    __enable_irq( );
+}
+
+static uint8_t CrashDumpPut( uint8_t *buf, uint8_t size, uint8_t len, uint32_t value, uint8_t bytes )
+{
+    uint8_t i;
+
+    if( ( len + bytes ) > size )
+    {
+        return len;
+    }
+    for( i = 0; i < bytes; i++ )
+    {
+        buf[len++] = ( uint8_t )( value >> ( 8 * i ) );
+    }
+    return len;
+}
+
+uint8_t CrashDumpExport( uint8_t *buf, uint8_t size )
+{
+    uint8_t len = 0;
+    uint8_t events;
+    uint8_t i;
+
+    // The fixed head goes whole or not at all
+    if( ( CrashDumpValid == false ) || ( size < CRASH_DUMP_EXPORT_HEAD ) )
+    {
+        return 0;
+    }
+    events = ( size - CRASH_DUMP_EXPORT_HEAD ) / 8;
+    if( events > CrashDump.EventCount )
+    {
+        events = CrashDump.EventCount;
+    }
+
+    buf[len++] = CRASH_DUMP_EXPORT_VERSION;
+    buf[len++] = CrashDump.Cause;
+    len = CrashDumpPut( buf, size, len, CrashDump.Regs[CRASH_DUMP_PC], 4 );
+    len = CrashDumpPut( buf, size, len, CrashDump.Regs[CRASH_DUMP_LR], 4 );
+    len = CrashDumpPut( buf, size, len, CrashDump.Sp, 4 );
+    len = CrashDumpPut( buf, size, len, CrashDump.Cfsr, 4 );
+    len = CrashDumpPut( buf, size, len, CrashDump.Hfsr, 4 );
+    len = CrashDumpPut( buf, size, len, CrashDump.TimerCount, 1 );
+    len = CrashDumpPut( buf, size, len, CrashDump.TimerNext, 4 );
+    len = CrashDumpPut( buf, size, len, events, 1 );
+
+    // Type, parameter and data of the events, the most recent first, then
+    // the stack words from the frame up to the end
+    for( i = 0; i < events; i++ )
+    {
+        len = CrashDumpPut( buf, size, len, CrashDump.Events[i].Type, 2 );
+        len = CrashDumpPut( buf, size, len, CrashDump.Events[i].Param, 2 );
+        len = CrashDumpPut( buf, size, len, CrashDump.Events[i].Data, 4 );
+    }
+    for( i = 0; ( i < CrashDump.StackCount ) && ( ( len + 4 ) <= size ); i++ )
+    {
+        len = CrashDumpPut( buf, size, len, CrashDump.Stack[i], 4 );
+    }
+    return len;
+}
+
+#endif
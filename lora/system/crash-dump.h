@@ -0,0 +1,183 @@
+/*!
+ * \file      crash-dump.h
+ *
+ * \brief     Fault and watchdog snapshot kept across the reset
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_CRASH_DUMP
+ *
+ *            On a HardFault, or on the IWDG interrupt raised ahead of its
+ *            reset, CRASH_DUMP_ENTRY hands the exception frame to
+ *            \ref CrashDumpCapture which records, with RETAINED_ATTR:
+ *
+ *                the stacked r0-r3, r12, lr, pc and xPSR, the stack pointer
+ *                and EXC_RETURN of the interrupted code
+ *                the CFSR, HFSR, MMFAR and BFAR
+ *                CONFIG_CRASH_DUMP_STACK_WORDS words of the stack above the
+ *                frame
+ *                the last CONFIG_CRASH_DUMP_EVENTS events of the event queue
+ *                the running timers and the callback of the next one
+ *                the average cycles of the DWT probes with CONFIG_PROFILE
+ *
+ *            sealed with a CRC. A HardFault then resets the MCU, the IWDG
+ *            interrupt is turned off and the IWDG resets it. After the
+ *            reset \ref CrashDumpInit keeps the snapshot when its CRC
+ *            matches, to be read with AT+ICRASH or packed by
+ *            \ref CrashDumpExport for an uplink, until \ref CrashDumpClear.
+ *            A snapshot replaces the previous one.
+ *
+ *            Without CONFIG_WARM_BOOT_RETAINED the snapshot lives in .noinit
+ *            of the main SRAM, kept across the reset but the power on. The
+ *            IWDG interrupt is raised only while the interrupts are served,
+ *            a hang with them disabled resets without a snapshot.
+ *
+ * \{
+ */
+#ifndef __CRASH_DUMP_H__
+#define __CRASH_DUMP_H__
+
+#include <stdint.h>
+#include "event-queue.h"
+#include "profile.h"
+
+/*!
+ * Stack words recorded above the exception frame
+ */
+#ifndef CONFIG_CRASH_DUMP_STACK_WORDS
+#define CONFIG_CRASH_DUMP_STACK_WORDS               32
+#endif
+
+/*!
+ * Events recorded
+ */
+#ifndef CONFIG_CRASH_DUMP_EVENTS
+#define CONFIG_CRASH_DUMP_EVENTS                    8
+#endif
+
+/*!
+ * Version of the \ref CrashDumpExport form
+ */
+#define CRASH_DUMP_EXPORT_VERSION                   1
+
+/*!
+ * Causes, passed from the exception handlers as immediates
+ */
+#define CRASH_DUMP_NONE                             0
+#define CRASH_DUMP_HARD_FAULT                       1
+#define CRASH_DUMP_WATCHDOG                         2
+
+/*!
+ * Stacked registers of the exception frame
+ */
+typedef enum
+{
+    CRASH_DUMP_R0 = 0,
+    CRASH_DUMP_R1,
+    CRASH_DUMP_R2,
+    CRASH_DUMP_R3,
+    CRASH_DUMP_R12,
+    CRASH_DUMP_LR,
+    CRASH_DUMP_PC,
+    CRASH_DUMP_XPSR,
+    CRASH_DUMP_FRAME_WORDS,
+}CrashDumpReg_t;
+
+/*!
+ * Snapshot
+ */
+typedef struct
+{
+    uint32_t Magic;
+    uint8_t Cause;          //!< CRASH_DUMP_
+    uint8_t StackCount;     //!< Stack words recorded
+    uint8_t EventCount;     //!< Events recorded
+    uint8_t TimerCount;     //!< Running timers
+    uint32_t Time;          //!< TimerGetCurrentTime at the capture [ms]
+    uint32_t Regs[CRASH_DUMP_FRAME_WORDS];
+    uint32_t Sp;            //!< Stack pointer of the interrupted code, above the frame
+    uint32_t ExcReturn;
+    uint32_t Cfsr;
+    uint32_t Hfsr;
+    uint32_t Mmfar;
+    uint32_t Bfar;
+    uint32_t TimerNext;     //!< Callback of the next timer, 0 when none runs
+    uint32_t Stack[CONFIG_CRASH_DUMP_STACK_WORDS];
+    Event_t Events[CONFIG_CRASH_DUMP_EVENTS];
+#ifdef CONFIG_PROFILE
+    uint32_t ProbeCycles[PROFILE_PROBE_MAX];    //!< Average cycles, 0 for a probe never hit
+#endif
+    uint16_t Reserved;
+    uint16_t Crc;
+}CrashDump_t;
+
+#ifdef CONFIG_CRASH_DUMP
+
+/*!
+ * Body of a naked exception handler: passes the stack of the interrupted
+ * code, MSP or PSP as EXC_RETURN tells, EXC_RETURN and the cause to
+ * \ref CrashDumpCapture, which returns from the exception
+ */
+#define CRASH_DUMP_ENTRY( cause )                                              \
+    __asm volatile( "tst lr, #4        \n"                                     \
+                    "ite eq            \n"                                     \
+                    "mrseq r0, msp     \n"                                     \
+                    "mrsne r0, psp     \n"                                     \
+                    "mov r1, lr        \n"                                     \
+                    "movs r2, %0       \n"                                     \
+                    "b CrashDumpCapture\n"                                     \
+                    : : "i"( cause ) )
+
+/*!
+ * \brief Keeps the snapshot of the previous boot when valid, to be called at
+ *        boot
+ */
+void CrashDumpInit( void );
+
+/*!
+ * \brief Records the snapshot, see CRASH_DUMP_ENTRY
+ *
+ * \remark Resets the MCU on a HardFault.
+ *
+ * \param [IN] frame     Exception frame
+ * \param [IN] excReturn EXC_RETURN of the exception
+ * \param [IN] cause     CRASH_DUMP_HARD_FAULT or CRASH_DUMP_WATCHDOG
+ */
+void CrashDumpCapture( uint32_t *frame, uint32_t excReturn, uint32_t cause );
+
+/*!
+ * \brief Snapshot of a previous boot
+ *
+ * \retval dump        Snapshot, NULL when there is none
+ */
+const CrashDump_t *CrashDumpGet( void );
+
+/*!
+ * \brief Drops the snapshot
+ */
+void CrashDumpClear( void );
+
+/*!
+ * \brief Packs the snapshot for an uplink, little endian: the version, the
+ *        cause, the pc, lr, sp, CFSR and HFSR, the running timers, the next
+ *        timer callback and the number of events which fit, 31 bytes, then
+ *        the events as type, parameter and data and the stack words which
+ *        fit
+ *
+ * \param [OUT] buf    Exported form
+ * \param [IN]  size   buf size
+ *
+ * \retval len         Length of the exported form, 0 without a snapshot
+ */
+uint8_t CrashDumpExport( uint8_t *buf, uint8_t size );
+
+#endif
+
+/*! \} defgroup LORA_CRASH_DUMP */
+/*! \} addtogroup LORA */
+
+#endif // __CRASH_DUMP_H__
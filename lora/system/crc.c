@@ -0,0 +1,211 @@
+/*!
+ * \file      crc.c
+ *
+ * \brief     CRC computation implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stddef.h>
+#include "tremo_cm4.h"
+#include "tremo_rcc.h"
+#include "tremo_crc.h"
+#include "crc.h"
+
+static const uint32_t CrcCcittTable[16] =
+{
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+static const uint32_t CrcModbusTable[16] =
+{
+    0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401,
+    0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400
+};
+
+const CrcModel_t CrcCcitt = { 16, 0x1021, 0x0000, false, false, 0x0000, CrcCcittTable };
+
+const CrcModel_t CrcModbus = { 16, 0x8005, 0xFFFF, true, true, 0x0000, CrcModbusTable };
+
+/*!
+ * Set while a computation owns the hardware unit
+ */
+static volatile uint32_t CrcHwBusy = 0;
+static bool CrcHwClock = false;
+
+static uint32_t CrcMask( uint8_t width )
+{
+    return ( width >= 32 ) ? 0xFFFFFFFF : ( ( 1UL << width ) - 1 );
+}
+
+static uint32_t CrcReflect( uint32_t value, uint8_t width )
+{
+    uint32_t reflected = 0;
+
+    for( uint8_t i = 0; i < width; i++ )
+    {
+        reflected = ( reflected << 1 ) | ( value & 1 );
+        value >>= 1;
+    }
+    return reflected;
+}
+
+static void CrcBuildTable( const CrcModel_t *model, uint32_t *table )
+{
+    uint32_t mask = CrcMask( model->Width );
+    uint32_t top = 1UL << ( model->Width - 1 );
+    uint32_t poly = ( model->RefIn == true ) ? CrcReflect( model->Poly, model->Width ) : model->Poly;
+
+    for( uint32_t i = 0; i < 16; i++ )
+    {
+        uint32_t r = ( model->RefIn == true ) ? i : i << ( model->Width - 4 );
+
+        for( uint8_t j = 0; j < 4; j++ )
+        {
+            if( model->RefIn == true )
+            {
+                r = ( r & 1 ) ? ( r >> 1 ) ^ poly : ( r >> 1 );
+            }
+            else
+            {
+                r = ( r & top ) ? ( r << 1 ) ^ poly : ( r << 1 );
+            }
+        }
+        table[i] = r & mask;
+    }
+}
+
+/*!
+ * \brief Runs the nibble table computation
+ *
+ * \param [IN] value    Register, not reflected
+ *
+ * \retval value        Register after the data, not reflected
+ */
+static uint32_t CrcSoftware( const CrcModel_t *model, uint32_t value, const uint8_t *buffer, uint32_t length )
+{
+    uint32_t local[16];
+    const uint32_t *table = model->Table;
+    uint32_t mask = CrcMask( model->Width );
+    uint8_t shift = model->Width - 4;
+
+    if( table == NULL )
+    {
+        CrcBuildTable( model, local );
+        table = local;
+    }
+
+    if( model->RefIn == true )
+    {
+        value = CrcReflect( value, model->Width );
+        for( uint32_t i = 0; i < length; i++ )
+        {
+            value = ( value >> 4 ) ^ table[( value ^ buffer[i] ) & 0x0F];
+            value = ( value >> 4 ) ^ table[( value ^ ( buffer[i] >> 4 ) ) & 0x0F];
+        }
+        return CrcReflect( value, model->Width );
+    }
+    for( uint32_t i = 0; i < length; i++ )
+    {
+        value = ( ( value << 4 ) ^ table[( ( value >> shift ) ^ ( buffer[i] >> 4 ) ) & 0x0F] ) & mask;
+        value = ( ( value << 4 ) ^ table[( ( value >> shift ) ^ buffer[i] ) & 0x0F] ) & mask;
+    }
+    return value;
+}
+
+/*!
+ * \brief Runs the computation on the hardware unit when it supports the
+ *        model and no other computation owns it
+ *
+ * \retval done         false when the software has to compute it
+ */
+static bool CrcHardware( const CrcModel_t *model, uint32_t *value, const uint8_t *buffer, uint32_t length )
+{
+    uint32_t mask = CrcMask( model->Width );
+    crc_config_t config;
+
+    // The reflected initial value of the unit is only known for the
+    // symmetric ones
+    if( ( model->RefIn != model->RefOut ) ||
+        ( ( model->RefIn == true ) && ( *value != 0 ) && ( *value != mask ) ) )
+    {
+        return false;
+    }
+    switch( model->Width )
+    {
+        case 8:
+            config.poly_size = CRC_POLY_SIZE_8;
+            break;
+        case 16:
+            config.poly_size = CRC_POLY_SIZE_16;
+            break;
+        case 32:
+            config.poly_size = CRC_POLY_SIZE_32;
+            break;
+        default:
+            return false;
+    }
+
+    // A caller interrupting the owner computes in software
+    do
+    {
+        if( __LDREXW( &CrcHwBusy ) != 0 )
+        {
+            __CLREX( );
+            return false;
+        }
+    }while( __STREXW( 1, &CrcHwBusy ) != 0 );
+    __DMB( );
+
+    if( CrcHwClock == false )
+    {
+        __disable_irq( );
+        rcc_enable_peripheral_clk( RCC_PERIPHERAL_CRC, true );
+        __enable_irq( );
+        CrcHwClock = true;
+    }
+    config.init_value = *value;
+    config.poly = model->Poly;
+    config.reverse_in = ( model->RefIn == true ) ? CRC_REVERSE_IN_BYTE : CRC_REVERSE_IN_NONE;
+    config.reverse_out = model->RefOut;
+    crc_init( &config );
+    *value = crc_calc8( ( uint8_t * )buffer, length ) & mask;
+    if( model->RefOut == true )
+    {
+        // Back to the register form of CrcSoftware
+        *value = CrcReflect( *value, model->Width );
+    }
+
+    __DMB( );
+    CrcHwBusy = 0;
+    return true;
+}
+
+static uint32_t CrcRun( const CrcModel_t *model, uint32_t value, const uint8_t *buffer, uint32_t length )
+{
+    if( ( length > 0 ) && ( CrcHardware( model, &value, buffer, length ) == false ) )
+    {
+        value = CrcSoftware( model, value, buffer, length );
+    }
+    if( model->RefOut == true )
+    {
+        value = CrcReflect( value, model->Width );
+    }
+    return ( value ^ model->XorOut ) & CrcMask( model->Width );
+}
+
+uint32_t CrcCompute( const CrcModel_t *model, const uint8_t *buffer, uint32_t length )
+{
+    return CrcRun( model, model->Init & CrcMask( model->Width ), buffer, length );
+}
+
+uint32_t CrcUpdate( const CrcModel_t *model, uint32_t crc, const uint8_t *buffer, uint32_t length )
+{
+    uint32_t value = ( crc ^ model->XorOut ) & CrcMask( model->Width );
+
+    if( model->RefOut == true )
+    {
+        value = CrcReflect( value, model->Width );
+    }
+    return CrcRun( model, value, buffer, length );
+}
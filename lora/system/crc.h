@@ -0,0 +1,99 @@
+/*!
+ * \file      crc.h
+ *
+ * \brief     CRC computation on the hardware CRC unit, with a table driven
+ *            fallback
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_CRC
+ *
+ *            A CRC is described by its model. The hardware CRC unit computes
+ *            it when it supports the model and is not in use, otherwise a
+ *            nibble table gives the same result: it can be called from the
+ *            interrupt handlers and the main loop alike.
+ *
+ * \{
+ */
+#ifndef __CRC_H__
+#define __CRC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * CRC model, in the usual catalogue form
+ */
+typedef struct
+{
+    /*!
+     * Width [bit], from 8 to 32
+     */
+    uint8_t Width;
+    /*!
+     * Polynomial, not reflected and without its top bit
+     */
+    uint32_t Poly;
+    /*!
+     * Initial value
+     */
+    uint32_t Init;
+    /*!
+     * The bytes are processed least significant bit first
+     */
+    bool RefIn;
+    /*!
+     * The result is reflected before XorOut
+     */
+    bool RefOut;
+    /*!
+     * Final XOR value
+     */
+    uint32_t XorOut;
+    /*!
+     * Nibble table of the software computation, NULL to build it on each call
+     */
+    const uint32_t *Table;
+}CrcModel_t;
+
+/*!
+ * CRC-16/XMODEM: settings, Class B beacons, AT binary frames
+ */
+extern const CrcModel_t CrcCcitt;
+
+/*!
+ * CRC-16/MODBUS
+ */
+extern const CrcModel_t CrcModbus;
+
+/*!
+ * \brief Computes the CRC of a buffer
+ *
+ * \param [IN] model    CRC model
+ * \param [IN] buffer   Data
+ * \param [IN] length   Data length
+ *
+ * \retval crc          CRC value
+ */
+uint32_t CrcCompute( const CrcModel_t *model, const uint8_t *buffer, uint32_t length );
+
+/*!
+ * \brief Computes the CRC of a buffer following data already computed
+ *
+ * \param [IN] model    CRC model
+ * \param [IN] crc      CRC of the previous data, as returned
+ * \param [IN] buffer   Data
+ * \param [IN] length   Data length
+ *
+ * \retval crc          CRC of the previous data and the buffer
+ */
+uint32_t CrcUpdate( const CrcModel_t *model, uint32_t crc, const uint8_t *buffer, uint32_t length );
+
+/*! \} defgroup LORA_CRC */
+/*! \} addtogroup LORA */
+
+#endif // __CRC_H__
@@ -0,0 +1,115 @@
+/*!
+ * \file      aes-key.c
+ *
+ * \brief     Tracks and arbitrates the AES engine
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stdbool.h>
+#include <string.h>
+#include "tremo_cm4.h"
+#include "aes.h"
+#include "aes-key.h"
+#ifdef CONFIG_CLOCK_GOVERNOR
+#include "clock-governor.h"
+#endif
+
+#if ( AES_KEY_CHUNK_SIZE < 16 ) || ( ( AES_KEY_CHUNK_SIZE & 15 ) != 0 )
+#error "AES_KEY_CHUNK_SIZE must be a multiple of 16"
+#endif
+
+/*!
+ * Attempts started, an attempt is done when no other one started since
+ */
+static volatile uint32_t AesSeq = 0;
+
+#ifdef CONFIG_AES_KEY_CACHE
+/*!
+ * Key held by the engine in ECB mode
+ */
+static uint8_t AesKeyHeld[16];
+static bool AesKeyHeldValid = false;
+#endif
+
+uint32_t AesBegin( void )
+{
+    uint32_t seq;
+
+    do
+    {
+        seq = __LDREXW( &AesSeq );
+    }while( __STREXW( seq + 1, &AesSeq ) != 0 );
+    return seq + 1;
+}
+
+bool AesEnd( uint32_t token )
+{
+    return AesSeq == token;
+}
+
+void AesKeyLoad( const uint8_t *key )
+{
+    // The held key has to match the engine, an interrupt handler loading
+    // its key in between would leave them apart
+    uint32_t primask = __get_PRIMASK( );
+
+    __disable_irq( );
+#ifdef CONFIG_AES_KEY_CACHE
+    if( ( AesKeyHeldValid == false ) || ( memcmp( AesKeyHeld, key, 16 ) != 0 ) )
+    {
+        memcpy( AesKeyHeld, key, 16 );
+        AesKeyHeldValid = true;
+        aes_init( ( uint8_t * )key, 16, AES_ECB_MODE, 0 );
+    }
+#else
+    aes_init( ( uint8_t * )key, 16, AES_ECB_MODE, 0 );
+#endif
+    __set_PRIMASK( primask );
+}
+
+void AesKeyLoadCbc( const uint8_t *key, uint8_t *iv )
+{
+    uint32_t primask = __get_PRIMASK( );
+
+    __disable_irq( );
+    AesKeyInvalidate( );
+    aes_init( ( uint8_t * )key, 16, AES_CBC_MODE, iv );
+    __set_PRIMASK( primask );
+}
+
+void AesKeyInvalidate( void )
+{
+#ifdef CONFIG_AES_KEY_CACHE
+    AesKeyHeldValid = false;
+#endif
+}
+
+void AesEcbEncrypt( const uint8_t *key, const uint8_t *in, uint16_t size, uint8_t *out )
+{
+    uint8_t block[AES_KEY_CHUNK_SIZE];
+    uint32_t token;
+    uint16_t len;
+
+#ifdef CONFIG_CLOCK_GOVERNOR
+    ClockRequest( CLOCK_PROFILE_HIGH );
+#endif
+    while( size > 0 )
+    {
+        // The input of the chunk is only read, the output written once the
+        // chunk is done, so an in place chunk survives a retry
+        len = ( size < AES_KEY_CHUNK_SIZE ) ? size : AES_KEY_CHUNK_SIZE;
+        do
+        {
+            token = AesBegin( );
+            AesKeyLoad( key );
+            aes_crypto( ( uint8_t * )in, len, 0, block );
+        }while( AesEnd( token ) == false );
+        memcpy( out, block, len );
+        in += len;
+        out += len;
+        size -= len;
+    }
+#ifdef CONFIG_CLOCK_GOVERNOR
+    ClockRelease( CLOCK_PROFILE_HIGH );
+#endif
+}
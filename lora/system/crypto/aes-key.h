@@ -0,0 +1,110 @@
+/*!
+ * \file      aes-key.h
+ *
+ * \brief     Tracks and arbitrates the AES engine
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_AES_KEY
+ *
+ *            The AES engine expands the key itself and keeps it until the
+ *            next aes_init. With CONFIG_AES_KEY_CACHE, loading the key the
+ *            engine already holds in ECB mode skips aes_init. Every other use
+ *            of the engine has to go through this module, or call
+ *            \ref AesKeyInvalidate afterwards.
+ *
+ *            The engine is shared by the MAC and the application, from the
+ *            main loop and the interrupt handlers. An interrupt handler cannot
+ *            wait for the engine, so a use of the engine is an attempt
+ *            bracketed by \ref AesBegin and \ref AesEnd, retried when another
+ *            use has started in between. An attempt only writes to caller
+ *            buffers once it has succeeded, its inputs are intact on a retry.
+ *
+ * \code
+ * uint32_t token;
+ *
+ * do
+ * {
+ *     token = AesBegin( );
+ *     AesKeyLoad( key );
+ *     aes_crypto( in, 16, 0, block );
+ * }while( AesEnd( token ) == false );
+ * memcpy1( out, block, 16 );
+ * \endcode
+ *
+ * \{
+ */
+#ifndef __AES_KEY_H__
+#define __AES_KEY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * Bytes going through the engine per call of \ref AesEcbEncrypt, the size of
+ * the stack buffer of the callers, multiple of 16
+ */
+#ifndef AES_KEY_CHUNK_SIZE
+#define AES_KEY_CHUNK_SIZE                          64
+#endif
+
+/*!
+ * \brief Starts an attempt to use the engine
+ *
+ * \retval token        Attempt token, for \ref AesEnd
+ */
+uint32_t AesBegin( void );
+
+/*!
+ * \brief Ends an attempt to use the engine
+ *
+ * \param [IN] token    Token returned by \ref AesBegin
+ *
+ * \retval done         false when the engine has been used since, the attempt
+ *                      has to be retried
+ */
+bool AesEnd( uint32_t token );
+
+/*!
+ * \brief Loads a 128 bits key in ECB mode
+ *
+ * \param [IN] key      AES key
+ */
+void AesKeyLoad( const uint8_t *key );
+
+/*!
+ * \brief Loads a 128 bits key in CBC mode, the engine is always initialized
+ *
+ * \param [IN] key      AES key
+ * \param [IN] iv       Initialization vector, 16 bytes
+ */
+void AesKeyLoadCbc( const uint8_t *key, uint8_t *iv );
+
+/*!
+ * \brief Forgets the held key, the next load initializes the engine
+ *
+ * \remark To be called when the engine may have lost its state, on a STOP
+ *         mode entry.
+ */
+void AesKeyInvalidate( void );
+
+/*!
+ * \brief Encrypts blocks in ECB mode, from any context
+ *
+ * \remark The output may be the input.
+ *
+ * \param [IN]  key     AES key
+ * \param [IN]  in      Input blocks
+ * \param [IN]  size    Input size, multiple of 16
+ * \param [OUT] out     Encrypted blocks
+ */
+void AesEcbEncrypt( const uint8_t *key, const uint8_t *in, uint16_t size, uint8_t *out );
+
+/*! \} defgroup LORA_AES_KEY */
+/*! \} addtogroup LORA */
+
+#endif // __AES_KEY_H__
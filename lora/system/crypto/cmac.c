@@ -35,9 +35,16 @@ DEALINGS WITH THE SOFTWARE
 //#include <sys/param.h>
 //#include <sys/systm.h> 
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "tremo_cm4.h"
 #include "aes.h"
+#include "aes-key.h"
 #include "cmac.h"
 #include "utilities.h"
+#ifdef CONFIG_CLOCK_GOVERNOR
+#include "clock-governor.h"
+#endif
 
 #define LSHIFT(v, r) do {                                       \
   int32_t i;                                                  \
@@ -63,7 +70,7 @@ void AES_CMAC_Init(AES_CMAC_CTX *ctx)
     
 void AES_CMAC_SetKey(AES_CMAC_CTX *ctx, const uint8_t key[AES_CMAC_KEY_LENGTH])
 {
-    aes_init((uint8_t *)key, 16,0,0);
+    AesKeyLoad(key);
 }
     
 void AES_CMAC_Update(AES_CMAC_CTX *ctx, const uint8_t *data, uint32_t len)
@@ -139,3 +146,126 @@ void AES_CMAC_Final(uint8_t digest[AES_CMAC_DIGEST_LENGTH], AES_CMAC_CTX *ctx)
 
 }
 
+
+typedef struct {
+    uint8_t Key[AES_CMAC_KEY_LENGTH];
+    uint8_t K1[16];
+    uint8_t K2[16];
+    bool    Valid;
+} AES_CMAC_SUBKEYS;
+
+static AES_CMAC_SUBKEYS CmacSubkeys[AES_CMAC_KEY_CACHE_SIZE];
+static uint8_t CmacSubkeysNext = 0;
+
+/*
+ * The cache is shared with the interrupt handlers, the subkeys are copied
+ * in and out with the interrupts disabled
+ */
+static void AES_CMAC_GetSubkeys(const uint8_t key[AES_CMAC_KEY_LENGTH], uint8_t k1[16], uint8_t k2[16])
+{
+    AES_CMAC_SUBKEYS *sk;
+    uint32_t primask;
+    uint8_t i;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    for (i = 0; i < AES_CMAC_KEY_CACHE_SIZE; i++) {
+        if (CmacSubkeys[i].Valid && memcmp(CmacSubkeys[i].Key, key, AES_CMAC_KEY_LENGTH) == 0) {
+            memcpy1(k1, CmacSubkeys[i].K1, 16);
+            memcpy1(k2, CmacSubkeys[i].K2, 16);
+            __set_PRIMASK(primask);
+            return;
+        }
+    }
+    __set_PRIMASK(primask);
+
+    /* K1 = L << 1 ^ Rb, K2 = K1 << 1 ^ Rb, L = AES(key, 0) */
+    memset1(k1, 0, 16);
+    AesEcbEncrypt(key, k1, 16, k1);
+    if (k1[0] & 0x80) {
+        LSHIFT(k1, k1);
+        k1[15] ^= 0x87;
+    } else
+        LSHIFT(k1, k1);
+    if (k1[0] & 0x80) {
+        LSHIFT(k1, k2);
+        k2[15] ^= 0x87;
+    } else
+        LSHIFT(k1, k2);
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    sk = &CmacSubkeys[CmacSubkeysNext];
+    CmacSubkeysNext = (CmacSubkeysNext + 1) % AES_CMAC_KEY_CACHE_SIZE;
+    memcpy1(sk->Key, key, AES_CMAC_KEY_LENGTH);
+    memcpy1(sk->K1, k1, 16);
+    memcpy1(sk->K2, k2, 16);
+    sk->Valid = true;
+    __set_PRIMASK(primask);
+}
+
+/*
+ * Copies the bytes [off, off + clen) of header || data || padding
+ */
+static void AES_CMAC_Fill(uint8_t *chunk, uint32_t off, uint32_t clen,
+                          const uint8_t *header, uint32_t headerLen, const uint8_t *data, uint32_t n)
+{
+    uint32_t i = 0;
+    uint32_t m;
+
+    if (off < headerLen) {
+        m = MIN(headerLen - off, clen);
+        memcpy1(chunk, header + off, m);
+        i = m;
+    }
+    if (i < clen && off + i < n) {
+        m = MIN(n - (off + i), clen - i);
+        memcpy1(chunk + i, data + (off + i - headerLen), m);
+        i += m;
+    }
+    if (i < clen) {
+        chunk[i] = (off + i == n) ? 0x80 : 0;
+        memset1(chunk + i + 1, 0, clen - i - 1);
+    }
+}
+
+void AES_CMAC_Digest(uint8_t digest[AES_CMAC_DIGEST_LENGTH], const uint8_t key[AES_CMAC_KEY_LENGTH],
+                     const uint8_t *header, uint32_t headerLen, const uint8_t *data, uint32_t len)
+{
+    uint8_t k1[16];
+    uint8_t k2[16];
+    uint8_t iv[16];
+    uint8_t chunk[AES_KEY_CHUNK_SIZE];
+    uint32_t n = headerLen + len;
+    uint32_t padded;
+    uint32_t off;
+    uint32_t clen;
+    uint32_t token;
+    bool complete = (n != 0 && (n & 15) == 0);
+
+#ifdef CONFIG_CLOCK_GOVERNOR
+    ClockRequest(CLOCK_PROFILE_HIGH);
+#endif
+    AES_CMAC_GetSubkeys(key, k1, k2);
+    padded = complete ? n : (n + 16) & ~15UL;
+
+    /* CBC chunk by chunk, the last cipher block of a chunk is the IV of the
+     * next one, the CBC-MAC is the last cipher block */
+    do {
+        token = AesBegin();
+        memset1(iv, 0, 16);
+        for (off = 0; off < padded; off += clen) {
+            clen = MIN(padded - off, AES_KEY_CHUNK_SIZE);
+            AES_CMAC_Fill(chunk, off, clen, header, headerLen, data, n);
+            if (off + clen == padded)
+                XOR(complete ? k1 : k2, chunk + clen - 16);
+            AesKeyLoadCbc(key, iv);
+            aes_crypto(chunk, clen, 0, chunk);
+            memcpy1(iv, chunk + clen - 16, 16);
+        }
+    } while (!AesEnd(token));
+#ifdef CONFIG_CLOCK_GOVERNOR
+    ClockRelease(CLOCK_PROFILE_HIGH);
+#endif
+    memcpy1(digest, iv, AES_CMAC_DIGEST_LENGTH);
+}
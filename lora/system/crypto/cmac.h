@@ -57,6 +57,18 @@ void     AES_CMAC_Update(AES_CMAC_CTX * ctx, const uint8_t * data, uint32_t len)
           //          __attribute__((__bounded__(__string__,2,3)));
 void     AES_CMAC_Final(uint8_t digest[AES_CMAC_DIGEST_LENGTH], AES_CMAC_CTX  * ctx);
             //     __attribute__((__bounded__(__minbytes__,1,AES_CMAC_DIGEST_LENGTH)));
+
+/*
+ * One shot CMAC of header || data, reentrant. The subkeys of the last keys are
+ * cached and the message goes through the AES engine in CBC mode, by chunks of
+ * AES_KEY_CHUNK_SIZE bytes. The block by block functions above are not
+ * arbitrated, they may only be used where nothing else uses the engine.
+ */
+#ifndef AES_CMAC_KEY_CACHE_SIZE
+#define AES_CMAC_KEY_CACHE_SIZE 2
+#endif
+void     AES_CMAC_Digest(uint8_t digest[AES_CMAC_DIGEST_LENGTH], const uint8_t key[AES_CMAC_KEY_LENGTH],
+                         const uint8_t * header, uint32_t headerLen, const uint8_t * data, uint32_t len);
 //__END_DECLS
 
 #endif /* _CMAC_H_ */
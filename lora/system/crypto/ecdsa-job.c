@@ -0,0 +1,421 @@
+/*!
+ * \file      ecdsa-job.c
+ *
+ * \brief     ECDSA P-256 signature check run in steps, over comb tables
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <string.h>
+#include "ecc.h"
+#include "ecdsa-job.h"
+
+#ifdef CONFIG_ECDSA_JOB
+
+/*!
+ * secp256r1 parameters
+ */
+static const uint8_t EcdsaCurveP[32] =
+{
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF
+};
+static const uint8_t EcdsaCurveA[32] =
+{
+    0xFC, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF
+};
+static const uint8_t EcdsaCurveB[32] =
+{
+    0x4B, 0x60, 0xD2, 0x27, 0x3E, 0x3C, 0xCE, 0x3B, 0xF6, 0xB0, 0x53, 0xCC, 0xB0, 0x06, 0x1D, 0x65,
+    0xBC, 0x86, 0x98, 0x76, 0x55, 0xBD, 0xEB, 0xB3, 0xE7, 0x93, 0x3A, 0xAA, 0xD8, 0x35, 0xC6, 0x5A
+};
+static const uint8_t EcdsaCurveN[32] =
+{
+    0x51, 0x25, 0x63, 0xFC, 0xC2, 0xCA, 0xB9, 0xF3, 0x84, 0x9E, 0x17, 0xA7, 0xAD, 0xFA, 0xE6, 0xBC,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+/*!
+ * Comb table of the generator, entry i - 1 being the sum of the
+ * 2^( ECDSA_COMB_SPACING * t ) G over the bits t of i
+ */
+static const EcdsaPoint_t EcdsaCombG[ECDSA_COMB_POINTS] =
+{
+    { { 0x96, 0xC2, 0x98, 0xD8, 0x45, 0x39, 0xA1, 0xF4, 0xA0, 0x33, 0xEB, 0x2D, 0x81, 0x7D, 0x03, 0x77,
+        0xF2, 0x40, 0xA4, 0x63, 0xE5, 0xE6, 0xBC, 0xF8, 0x47, 0x42, 0x2C, 0xE1, 0xF2, 0xD1, 0x17, 0x6B },
+      { 0xF5, 0x51, 0xBF, 0x37, 0x68, 0x40, 0xB6, 0xCB, 0xCE, 0x5E, 0x31, 0x6B, 0x57, 0x33, 0xCE, 0x2B,
+        0x16, 0x9E, 0x0F, 0x7C, 0x4A, 0xEB, 0xE7, 0x8E, 0x9B, 0x7F, 0x1A, 0xFE, 0xE2, 0x42, 0xE3, 0x4F } },
+    { { 0x63, 0xDB, 0x14, 0x8E, 0xB4, 0x5C, 0xE7, 0x90, 0x7E, 0x1F, 0x65, 0xAD, 0xAA, 0x3B, 0x49, 0x29,
+        0xDE, 0x25, 0x6E, 0x32, 0x2E, 0x59, 0x92, 0x84, 0xA5, 0xAA, 0x11, 0x28, 0xBC, 0x22, 0xA8, 0x0F },
+      { 0xE7, 0x2E, 0x46, 0x5F, 0x54, 0x24, 0x11, 0xE4, 0xF5, 0x82, 0xFE, 0x50, 0x50, 0xA6, 0xB1, 0x34,
+        0x8B, 0x18, 0xDF, 0xB3, 0xBC, 0xD4, 0x4A, 0x6F, 0x0D, 0xA8, 0xDB, 0xF5, 0xE8, 0x4A, 0xF4, 0xBF } },
+    { { 0xAF, 0x92, 0x79, 0x09, 0xE2, 0x1C, 0x39, 0x93, 0xFA, 0xF1, 0x35, 0x0D, 0xFD, 0x98, 0x6C, 0xE9,
+        0x89, 0x27, 0xE0, 0x95, 0xDE, 0xC0, 0x57, 0xB2, 0x6F, 0x72, 0xD6, 0x89, 0xBC, 0x4B, 0x0A, 0x30 },
+      { 0xA0, 0x27, 0x81, 0xC0, 0x91, 0xA2, 0x54, 0xAA, 0xA5, 0x06, 0xD8, 0xA9, 0xAD, 0xEE, 0xB1, 0x5B,
+        0x6F, 0x3C, 0x1E, 0xFF, 0x25, 0xDB, 0x1D, 0x7F, 0x44, 0x46, 0x9B, 0xD0, 0xE0, 0xC7, 0xAA, 0x72 } },
+    { { 0x85, 0xBD, 0x89, 0xD7, 0xC9, 0x4F, 0xC8, 0x57, 0xC3, 0xEA, 0x97, 0xC2, 0x7D, 0xFF, 0x35, 0xFC,
+        0x6E, 0x76, 0xC6, 0x88, 0xD5, 0x2F, 0x98, 0xFB, 0x67, 0x5E, 0xDB, 0xEE, 0x9B, 0x73, 0x7D, 0x44 },
+      { 0x32, 0x5B, 0xE2, 0x72, 0xC9, 0x33, 0x7E, 0x0C, 0x00, 0xE5, 0xFA, 0xA7, 0x95, 0x9B, 0x34, 0x3D,
+        0xF7, 0xAF, 0x4A, 0x3A, 0x95, 0x9D, 0x2E, 0xE1, 0xEE, 0x31, 0x41, 0x83, 0xAB, 0x25, 0x48, 0x2D } },
+    { { 0x7F, 0x36, 0x1D, 0x2A, 0x93, 0x9C, 0x94, 0x13, 0xB7, 0x11, 0x0A, 0x1A, 0x2B, 0xBD, 0x7F, 0xEF,
+        0x60, 0xFC, 0x1D, 0xB9, 0x8B, 0x06, 0xC6, 0xDD, 0xFF, 0x72, 0x9C, 0x8A, 0x32, 0x19, 0x95, 0xEF },
+      { 0xA8, 0xD8, 0x76, 0x73, 0xA7, 0x35, 0x60, 0x19, 0x40, 0x17, 0xCA, 0x95, 0x08, 0x3B, 0x18, 0x23,
+        0x9C, 0x21, 0x2C, 0x02, 0x07, 0x98, 0xEE, 0xC1, 0x9B, 0x2C, 0xBB, 0x7D, 0xC3, 0x9F, 0x1E, 0x61 } },
+    { { 0xBC, 0xF4, 0x57, 0x0B, 0x92, 0xB1, 0xE2, 0xCA, 0x36, 0xBC, 0xC9, 0xC6, 0x5E, 0xDF, 0x36, 0x29,
+        0xBF, 0x38, 0x12, 0xE1, 0x82, 0x64, 0xEA, 0x7D, 0xD8, 0xF5, 0x51, 0x7B, 0x79, 0x63, 0x06, 0x55 },
+      { 0x4C, 0x96, 0x8A, 0x34, 0x16, 0xE2, 0xFF, 0x44, 0xE1, 0xFB, 0xDE, 0xDB, 0x76, 0xD5, 0xB3, 0x9F,
+        0xE5, 0x50, 0x9D, 0x8D, 0x01, 0x40, 0xFA, 0x0A, 0x51, 0xB8, 0xEC, 0x8A, 0x84, 0x64, 0x71, 0x15 } },
+    { { 0x01, 0xDE, 0x5C, 0xFC, 0xFF, 0xCA, 0x8E, 0xE4, 0x26, 0x5F, 0x71, 0x0D, 0xE7, 0x84, 0xCD, 0x7C,
+        0x91, 0x43, 0x3E, 0xF4, 0x83, 0xF4, 0xE8, 0xA2, 0xEA, 0x41, 0x11, 0xB2, 0x45, 0x77, 0x5D, 0xEB },
+      { 0x79, 0x34, 0x1A, 0x73, 0xE2, 0x17, 0xC9, 0xCA, 0x45, 0xB6, 0x44, 0x28, 0xFE, 0x2C, 0xF2, 0x85,
+        0xEE, 0x6C, 0x00, 0x58, 0xA1, 0xE6, 0x90, 0x09, 0x7B, 0xC1, 0xEC, 0xDB, 0xEB, 0x72, 0xFD, 0xEA } },
+    { { 0xBE, 0x28, 0x37, 0x31, 0xFB, 0x0F, 0xF2, 0x6C, 0x4A, 0xB9, 0xC6, 0xA3, 0x91, 0x95, 0x43, 0x96,
+        0xC5, 0x5F, 0x31, 0x44, 0x83, 0xFF, 0x36, 0x27, 0x76, 0x92, 0x84, 0xA7, 0x77, 0x96, 0xD3, 0xA6 },
+      { 0xF4, 0xF5, 0x57, 0xC3, 0x33, 0xB8, 0xBA, 0xF2, 0x9B, 0x05, 0x84, 0x22, 0x0C, 0x92, 0x4A, 0x82,
+        0xDF, 0xEC, 0x27, 0x2D, 0xBD, 0xBA, 0xB8, 0x66, 0x16, 0x88, 0x0B, 0x9B, 0x74, 0x84, 0x4F, 0x67 } },
+    { { 0x3E, 0x8A, 0x7C, 0x67, 0x04, 0x8C, 0xF4, 0x2D, 0x6B, 0xA5, 0x03, 0x02, 0x08, 0x2F, 0xE0, 0x74,
+        0xDB, 0xFE, 0xC7, 0xB8, 0x7D, 0x5F, 0x85, 0x31, 0xAD, 0xDD, 0xC9, 0x72, 0x76, 0x9E, 0x76, 0x4E },
+      { 0xB0, 0xBB, 0x24, 0xB8, 0x65, 0x61, 0xC3, 0xA4, 0xA5, 0x22, 0x91, 0x3B, 0x6F, 0xE1, 0x9A, 0xFB,
+        0x81, 0x72, 0x94, 0x06, 0x72, 0x05, 0xC0, 0x1E, 0x63, 0x06, 0x83, 0xDE, 0x82, 0x90, 0xB9, 0x42 } },
+    { { 0xB9, 0x68, 0xA8, 0xDD, 0x50, 0x51, 0xF9, 0x6E, 0x31, 0xE1, 0x0C, 0x9C, 0x79, 0x9E, 0xF8, 0xD1,
+        0x78, 0xC4, 0xA1, 0x08, 0xA0, 0x1C, 0xDC, 0x7F, 0x4D, 0xE0, 0x6C, 0x1C, 0xF6, 0x8E, 0x87, 0x78 },
+      { 0x76, 0xD9, 0xE0, 0x1F, 0x12, 0xB9, 0x62, 0x9C, 0x4F, 0x8D, 0xE0, 0xBD, 0x0E, 0x57, 0xCE, 0x6A,
+        0xEF, 0x9D, 0x30, 0x12, 0x2C, 0x14, 0x53, 0xDE, 0x21, 0xC3, 0x72, 0x7B, 0x5D, 0x3F, 0xCB, 0xB6 } },
+    { { 0x73, 0x35, 0x1A, 0xC3, 0xD2, 0x1E, 0x99, 0x7F, 0x96, 0xB4, 0x4F, 0xD5, 0x5B, 0xDD, 0x82, 0x5B,
+        0xAE, 0xFC, 0x2F, 0x81, 0x20, 0x52, 0x5C, 0x59, 0x87, 0x12, 0x6B, 0x71, 0x4D, 0xBC, 0x88, 0x0C },
+      { 0xA8, 0xAC, 0x48, 0x5F, 0x63, 0xBF, 0x57, 0x3A, 0xF3, 0x64, 0x25, 0xDF, 0xF4, 0x81, 0x81, 0x7C,
+        0xAA, 0xE6, 0x04, 0x9C, 0xB3, 0xB5, 0xD1, 0x18, 0xC6, 0x1D, 0x90, 0xF3, 0xA3, 0xDE, 0x5D, 0xDD } },
+    { { 0x0C, 0xAD, 0x72, 0x3E, 0xFB, 0x79, 0x6A, 0xE9, 0x2F, 0x79, 0xBA, 0x42, 0x8C, 0xA2, 0xA0, 0x43,
+        0xF3, 0x49, 0x3E, 0x08, 0x23, 0xA4, 0xE0, 0xEF, 0x66, 0x74, 0x31, 0x6B, 0xAF, 0x44, 0xF3, 0x68 },
+      { 0x4A, 0x4D, 0xB2, 0x3F, 0xDB, 0x17, 0xFE, 0xCD, 0x26, 0xC6, 0xF5, 0x71, 0x22, 0xFC, 0x8B, 0x66,
+        0xF3, 0x7F, 0xD6, 0x24, 0x3C, 0xD9, 0x4E, 0x60, 0x20, 0x0A, 0x54, 0xF8, 0x05, 0xC4, 0xB9, 0x31 } },
+    { { 0x7F, 0x2E, 0x58, 0xA2, 0x89, 0x47, 0x6B, 0xD3, 0x28, 0x9C, 0xC3, 0x4E, 0x14, 0x10, 0x1A, 0x0D,
+        0xA0, 0xD7, 0xBA, 0xED, 0xC3, 0x62, 0x3C, 0x66, 0xB9, 0x1D, 0x46, 0x6F, 0x4B, 0xBF, 0x52, 0x40 },
+      { 0xEB, 0x25, 0x8D, 0x18, 0xC3, 0x27, 0x5A, 0x23, 0x5B, 0xCC, 0xBF, 0x99, 0x39, 0xF3, 0x24, 0xE7,
+        0xC8, 0x0C, 0xD7, 0x71, 0xBD, 0xE6, 0x2B, 0x86, 0x61, 0xFC, 0xB0, 0x90, 0x51, 0x4D, 0xCF, 0xFE } },
+    { { 0xAC, 0xCF, 0xD4, 0xA1, 0x10, 0x6C, 0x34, 0x74, 0xA4, 0xA7, 0x26, 0x85, 0xC0, 0x5C, 0xDF, 0xAF,
+        0x7A, 0xFF, 0x2B, 0xF6, 0xA8, 0x02, 0x32, 0x12, 0x1A, 0xE4, 0x02, 0xC8, 0xE2, 0xBA, 0xDD, 0x1E },
+      { 0x44, 0xF8, 0x03, 0xD6, 0x2D, 0xAF, 0xA0, 0x8F, 0x17, 0x19, 0x70, 0x4C, 0x7E, 0x6B, 0xE0, 0x36,
+        0xA0, 0x33, 0xDB, 0x73, 0x52, 0xF4, 0x45, 0x0C, 0xFC, 0xBC, 0x0E, 0x56, 0x86, 0x4D, 0x10, 0x43 } },
+    { { 0xE5, 0x78, 0x1D, 0x0D, 0x11, 0xB5, 0x15, 0x96, 0x4B, 0x74, 0xC4, 0x25, 0x32, 0xDE, 0xB0, 0x66,
+        0x3A, 0x36, 0xAF, 0x6A, 0xFB, 0x46, 0x4A, 0x0A, 0x1C, 0xA2, 0xF7, 0x84, 0xB4, 0x26, 0x8E, 0xB4 },
+      { 0x2D, 0x1B, 0xA0, 0x21, 0xF6, 0xB0, 0xEB, 0x06, 0x98, 0x0F, 0x7B, 0x8B, 0x04, 0xE4, 0x04, 0xC0,
+        0x68, 0xF6, 0xD6, 0xFE, 0xCD, 0x1B, 0x13, 0x64, 0xAB, 0x3D, 0x4D, 0x4D, 0x40, 0x15, 0xC0, 0xFA } },
+};
+
+/*!
+ * Compares two numbers
+ *
+ * \retval cmp          < 0, 0 or > 0 as a is below, equal to or above b
+ */
+static int EcdsaCompare( const uint8_t *a, const uint8_t *b )
+{
+    int8_t i;
+
+    for( i = 31; i >= 0; i-- )
+    {
+        if( a[i] != b[i] )
+        {
+            return ( int )a[i] - ( int )b[i];
+        }
+    }
+    return 0;
+}
+
+/*!
+ * Reduces a number below 2n modulo n
+ */
+static void EcdsaReduce( uint8_t *a )
+{
+    int32_t borrow = 0;
+    uint8_t i;
+
+    if( EcdsaCompare( a, EcdsaCurveN ) < 0 )
+    {
+        return;
+    }
+    for( i = 0; i < 32; i++ )
+    {
+        borrow += ( int32_t )a[i] - EcdsaCurveN[i];
+        a[i] = ( uint8_t )borrow;
+        borrow >>= 8;
+    }
+}
+
+static bool EcdsaInRange( const uint8_t *a )
+{
+    uint8_t i;
+
+    if( EcdsaCompare( a, EcdsaCurveN ) >= 0 )
+    {
+        return false;
+    }
+    for( i = 0; i < 32; i++ )
+    {
+        if( a[i] != 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * Comb column of a scalar, the bit col of each of its teeth
+ */
+static uint8_t EcdsaCombIndex( const uint8_t *k, uint8_t col )
+{
+    uint8_t index = 0;
+    uint8_t t;
+
+    for( t = 0; t < ECDSA_COMB_TEETH; t++ )
+    {
+        index |= ( ( k[t * ( ECDSA_COMB_SPACING / 8 ) + ( col >> 3 )] >> ( col & 7 ) ) & 1 ) << t;
+    }
+    return index;
+}
+
+static bool EcdsaDouble( EcdsaJob_t *job )
+{
+    EcdsaPoint_t out;
+    ECC_POINT in_p = { job->Sum.x, job->Sum.y };
+    ECC_POINT out_p = { out.x, out.y };
+
+    if( job->SumZero == true )
+    {
+        return true;
+    }
+    if( ecc_pointdouble( &in_p, &out_p ) != ECCSUCCESS )
+    {
+        return false;
+    }
+    job->Sum = out;
+    return true;
+}
+
+static bool EcdsaAdd( EcdsaJob_t *job, const EcdsaPoint_t *point )
+{
+    // The engine is given copies in RAM, not the tables in flash
+    EcdsaPoint_t in, out;
+    ECC_POINT sum_p = { job->Sum.x, job->Sum.y };
+    ECC_POINT in_p = { in.x, in.y };
+    ECC_POINT out_p = { out.x, out.y };
+
+    if( job->SumZero == true )
+    {
+        job->Sum = *point;
+        job->SumZero = false;
+        return true;
+    }
+    in = *point;
+    // The addition formula does not take a point and itself or its opposite
+    if( memcmp( job->Sum.x, in.x, 32 ) == 0 )
+    {
+        if( memcmp( job->Sum.y, in.y, 32 ) == 0 )
+        {
+            return EcdsaDouble( job );
+        }
+        job->SumZero = true;
+        return true;
+    }
+    if( ecc_pointadd( &sum_p, &in_p, &out_p ) != ECCSUCCESS )
+    {
+        return false;
+    }
+    job->Sum = out;
+    return true;
+}
+
+static bool EcdsaScalars( EcdsaJob_t *job )
+{
+    ECC_PARA para;
+    uint8_t w[32];
+    uint8_t i;
+
+    para.ECC_NUMBIT = 256;
+    para.ECC_p = ( U8 * )EcdsaCurveP;
+    para.ECC_a = ( U8 * )EcdsaCurveA;
+    para.ECC_b = ( U8 * )EcdsaCurveB;
+    para.ECC_G0x = ( U8 * )EcdsaCombG[0].x;
+    para.ECC_G0y = ( U8 * )EcdsaCombG[0].y;
+    para.ECC_n = ( U8 * )EcdsaCurveN;
+    if( ecc_init( &para ) != ECCSUCCESS )
+    {
+        return false;
+    }
+
+    // e, the digest read as a big endian number, below 2n
+    for( i = 0; i < 16; i++ )
+    {
+        uint8_t b = job->U1[i];
+
+        job->U1[i] = job->U1[31 - i];
+        job->U1[31 - i] = b;
+    }
+    EcdsaReduce( job->U1 );
+
+    if( ecc_modinv( job->S, ( U8 * )EcdsaCurveN, 32, w ) != ECCSUCCESS )
+    {
+        return false;
+    }
+    ecc_modmul( job->R, w, ( U8 * )EcdsaCurveN, 32, job->U2 );
+    ecc_modmul( job->U1, w, ( U8 * )EcdsaCurveN, 32, w );
+    memcpy( job->U1, w, 32 );
+    return true;
+}
+
+static void EcdsaFinish( EcdsaJob_t *job, bool valid )
+{
+    if( job->State > ECDSA_JOB_SCALARS )
+    {
+        ecc_close( );
+    }
+    job->State = ECDSA_JOB_IDLE;
+    if( job->Done != NULL )
+    {
+        job->Done( job, valid );
+    }
+}
+
+static bool EcdsaJobSetup( EcdsaJob_t *job, const EcdsaPoint_t *key, const uint8_t *rs,
+                          EcdsaJobDone_t done )
+{
+    if( ( job->State != ECDSA_JOB_IDLE ) || ( EcdsaInRange( rs ) == false ) ||
+        ( EcdsaInRange( rs + 32 ) == false ) )
+    {
+        return false;
+    }
+    memcpy( job->R, rs, 32 );
+    memcpy( job->S, rs + 32, 32 );
+    job->Key = key;
+    job->Done = done;
+    return true;
+}
+
+bool EcdsaJobStart( EcdsaJob_t *job, const EcdsaPoint_t *key, const uint8_t *data,
+                    uint32_t size, const uint8_t *rs, EcdsaJobDone_t done )
+{
+    if( EcdsaJobSetup( job, key, rs, done ) == false )
+    {
+        return false;
+    }
+    job->Data = data;
+    job->Size = size;
+    sha256_init( &job->Sha );
+    job->State = ECDSA_JOB_HASH;
+    return true;
+}
+
+bool EcdsaJobStartDigest( EcdsaJob_t *job, const EcdsaPoint_t *key, const uint8_t *digest,
+                          const uint8_t *rs, EcdsaJobDone_t done )
+{
+    if( EcdsaJobSetup( job, key, rs, done ) == false )
+    {
+        return false;
+    }
+    memcpy( job->U1, digest, 32 );
+    job->State = ECDSA_JOB_SCALARS;
+    return true;
+}
+
+bool EcdsaJobStep( EcdsaJob_t *job )
+{
+    uint32_t chunk;
+    uint8_t index;
+
+    switch( job->State )
+    {
+    case ECDSA_JOB_HASH:
+        chunk = ( job->Size > ECDSA_JOB_HASH_CHUNK ) ? ECDSA_JOB_HASH_CHUNK : job->Size;
+        if( ( chunk > 0 ) && ( sha256_input( &job->Sha, ( U8 * )job->Data, chunk ) != HashSuccess ) )
+        {
+            EcdsaFinish( job, false );
+            break;
+        }
+        job->Data += chunk;
+        job->Size -= chunk;
+        if( job->Size == 0 )
+        {
+            if( sha256_result( &job->Sha, job->U1 ) != HashSuccess )
+            {
+                EcdsaFinish( job, false );
+                break;
+            }
+            job->State = ECDSA_JOB_SCALARS;
+        }
+        break;
+    case ECDSA_JOB_SCALARS:
+        if( EcdsaScalars( job ) == false )
+        {
+            // ecc_init may have failed, the engine is closed anyway
+            ecc_close( );
+            EcdsaFinish( job, false );
+            break;
+        }
+        job->SumZero = true;
+        job->Column = ECDSA_COMB_SPACING - 1;
+        job->State = ECDSA_JOB_DOUBLE;
+        break;
+    case ECDSA_JOB_DOUBLE:
+    case ECDSA_JOB_ADD_G:
+    case ECDSA_JOB_ADD_Q:
+        // One PKA operation per step, the columns without a point to add are
+        // skipped at once
+        if( job->State == ECDSA_JOB_DOUBLE )
+        {
+            job->State = ECDSA_JOB_ADD_G;
+            if( job->SumZero == false )
+            {
+                if( EcdsaDouble( job ) == false )
+                {
+                    EcdsaFinish( job, false );
+                }
+                break;
+            }
+        }
+        if( job->State == ECDSA_JOB_ADD_G )
+        {
+            job->State = ECDSA_JOB_ADD_Q;
+            index = EcdsaCombIndex( job->U1, job->Column );
+            if( index != 0 )
+            {
+                if( EcdsaAdd( job, &EcdsaCombG[index - 1] ) == false )
+                {
+                    EcdsaFinish( job, false );
+                }
+                break;
+            }
+        }
+        job->State = ( job->Column == 0 ) ? ECDSA_JOB_CHECK : ECDSA_JOB_DOUBLE;
+        index = EcdsaCombIndex( job->U2, job->Column );
+        job->Column--;
+        if( index != 0 )
+        {
+            if( EcdsaAdd( job, &job->Key[index - 1] ) == false )
+            {
+                EcdsaFinish( job, false );
+            }
+        }
+        break;
+    case ECDSA_JOB_CHECK:
+        if( job->SumZero == true )
+        {
+            EcdsaFinish( job, false );
+            break;
+        }
+        // x is below p, less than 2n
+        EcdsaReduce( job->Sum.x );
+        EcdsaFinish( job, memcmp( job->Sum.x, job->R, 32 ) == 0 );
+        break;
+    default:
+        break;
+    }
+    return job->State != ECDSA_JOB_IDLE;
+}
+
+bool EcdsaJobBusy( EcdsaJob_t *job )
+{
+    return job->State != ECDSA_JOB_IDLE;
+}
+
+#endif
@@ -0,0 +1,190 @@
+/*!
+ * \file      ecdsa-job.h
+ *
+ * \brief     ECDSA P-256 signature check run in steps, over comb tables
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_ECDSA_JOB
+ *
+ *            The PKA functions of the crypto library wait for the engine
+ *            and ecdsa_verify holds the CPU for the whole check. A job runs
+ *            the same check as a sequence of steps, each a part of the
+ *            message hash or a single PKA operation, the caller running the
+ *            steps from its main loop so that the radio interrupts and the
+ *            frames received are handled in between. The done callback is
+ *            called from the last step.
+ *
+ *            u1 * G + u2 * Q is computed with a fixed-base comb over both
+ *            points at once: ECDSA_COMB_SPACING doublings and up to twice as
+ *            many additions of precomputed points, against about 256
+ *            doublings and 256 additions for two plain point multiplications.
+ *            The table of G is built in, the table of a public key is made
+ *            off line by build/scripts/tremo_sign.py keygen.
+ *
+ *            The numbers are 32 bytes little endian, as the library takes
+ *            them. The signature is r then s.
+ *
+ *            The SHA engine keeps the hash state itself, so a single SHA-256
+ *            can run at a time: a job hashing its message ends any other one
+ *            in progress. A digest computed as the message was received is
+ *            checked with \ref EcdsaJobStartDigest.
+ *
+ * \code
+ * static EcdsaJob_t job;
+ *
+ * EcdsaJobStart( &job, key_table, image, size, rs, OnImageChecked );
+ * while( EcdsaJobStep( &job ) == true )
+ * {
+ *     Radio.IrqProcess( );
+ * }
+ * \endcode
+ *
+ * \{
+ */
+#ifndef __ECDSA_JOB_H__
+#define __ECDSA_JOB_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sha224_sha256.h"
+
+/*!
+ * Message bytes hashed per step
+ */
+#ifndef ECDSA_JOB_HASH_CHUNK
+#define ECDSA_JOB_HASH_CHUNK                        1024
+#endif
+
+/*!
+ * Comb teeth, the scalars are split in as many parts
+ */
+#define ECDSA_COMB_TEETH                            4
+
+/*!
+ * Bits per tooth, the doublings of a check
+ */
+#define ECDSA_COMB_SPACING                          ( 256 / ECDSA_COMB_TEETH )
+
+/*!
+ * Points of a comb table
+ */
+#define ECDSA_COMB_POINTS                           ( ( 1 << ECDSA_COMB_TEETH ) - 1 )
+
+/*!
+ * Curve point, little endian
+ */
+typedef struct
+{
+    uint8_t x[32];
+    uint8_t y[32];
+}EcdsaPoint_t;
+
+/*!
+ * Job states
+ */
+typedef enum
+{
+    ECDSA_JOB_IDLE = 0,
+    ECDSA_JOB_HASH,                 //!< Message hashed by chunks
+    ECDSA_JOB_SCALARS,              //!< u1 and u2 derived from the digest
+    ECDSA_JOB_DOUBLE,               //!< Sum doubled, once per comb column
+    ECDSA_JOB_ADD_G,                //!< Point of the G table added
+    ECDSA_JOB_ADD_Q,                //!< Point of the key table added
+    ECDSA_JOB_CHECK,                //!< Sum compared with r
+}EcdsaJobState_t;
+
+typedef struct sEcdsaJob EcdsaJob_t;
+
+/*!
+ * \brief Called from the last step of a job
+ *
+ * \param [IN] job      Job done, idle again
+ * \param [IN] valid    true when the signature matches
+ */
+typedef void ( *EcdsaJobDone_t )( EcdsaJob_t *job, bool valid );
+
+/*!
+ * Signature check in progress
+ */
+struct sEcdsaJob
+{
+    EcdsaJobState_t State;
+    const EcdsaPoint_t *Key;        //!< Comb table of the public key
+    const uint8_t *Data;            //!< Message left to hash
+    uint32_t Size;
+    SHA256Context Sha;
+    uint8_t R[32];
+    uint8_t S[32];
+    uint8_t U1[32];                 //!< Digest, then e / s mod n
+    uint8_t U2[32];                 //!< r / s mod n
+    EcdsaPoint_t Sum;
+    bool SumZero;                   //!< Sum at the point at infinity
+    int8_t Column;                  //!< Comb column, the top one first
+    EcdsaJobDone_t Done;
+    void *Arg;                      //!< Left to the caller
+};
+
+/*!
+ * \brief Starts the check of the signature of a message
+ *
+ * \remark The SAC clock has to be on. The message, the key table and the
+ *         job are used until the job is done. The PKA and SHA engines are
+ *         held by the job in between its steps.
+ *
+ * \param [IN] job      Job, idle
+ * \param [IN] key      Comb table of the public key
+ * \param [IN] data     Message
+ * \param [IN] size     Message size
+ * \param [IN] rs       Signature, r then s
+ * \param [IN] done     Called when the check is over
+ *
+ * \retval started      false when the job runs already or when r or s is
+ *                      out of range, done is not called then
+ */
+bool EcdsaJobStart( EcdsaJob_t *job, const EcdsaPoint_t *key, const uint8_t *data,
+                    uint32_t size, const uint8_t *rs, EcdsaJobDone_t done );
+
+/*!
+ * \brief Starts the check of the signature of a digest
+ *
+ * \remark As \ref EcdsaJobStart, the message hashed already.
+ *
+ * \param [IN] job      Job, idle
+ * \param [IN] key      Comb table of the public key
+ * \param [IN] digest   SHA-256 of the message, as sha256_result gives it
+ * \param [IN] rs       Signature, r then s
+ * \param [IN] done     Called when the check is over
+ *
+ * \retval started      false when the job runs already or when r or s is
+ *                      out of range, done is not called then
+ */
+bool EcdsaJobStartDigest( EcdsaJob_t *job, const EcdsaPoint_t *key, const uint8_t *digest,
+                          const uint8_t *rs, EcdsaJobDone_t done );
+
+/*!
+ * \brief Runs the next step of a job
+ *
+ * \param [IN] job      Job
+ *
+ * \retval running      true while the job has steps left
+ */
+bool EcdsaJobStep( EcdsaJob_t *job );
+
+/*!
+ * \brief Tells whether a job runs
+ *
+ * \param [IN] job      Job
+ *
+ * \retval running      true from the start to the done callback
+ */
+bool EcdsaJobBusy( EcdsaJob_t *job );
+
+/*! \} defgroup LORA_ECDSA_JOB */
+/*! \} addtogroup LORA */
+
+#endif // __ECDSA_JOB_H__
@@ -0,0 +1,113 @@
+/*!
+ * \file      key-slot.c
+ *
+ * \brief     LoRaWAN keys held in slots, stored wrapped by an OTP root key
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stdbool.h>
+#include <string.h>
+#include "tremo_flash.h"
+#include "aes.h"
+#include "rng.h"
+#include "aes-key.h"
+#include "key-slot.h"
+
+#ifdef CONFIG_KEY_SLOTS
+
+/*!
+ * Block encrypted by the OTP secret into the root key
+ */
+static const uint8_t KeySlotRootLabel[16] = "LoRaWAN key root";
+
+/*!
+ * Keys in clear
+ */
+static uint8_t KeySlots[KEY_SLOT_NUM][16];
+
+static bool KeySlotBlank( const uint8_t *data )
+{
+    uint8_t i;
+
+    for( i = 0; i < 16; i++ )
+    {
+        if( data[i] != 0xFF )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool KeySlotInit( void )
+{
+    uint8_t secret[16];
+    bool done = true;
+
+    memcpy( secret, ( const void * )KEY_SLOT_OTP_ADDR, 16 );
+    if( KeySlotBlank( secret ) == true )
+    {
+        rng_init( 0x0f, 0xFF );
+        rng_get_rand( secret, 16 );
+        rng_close( );
+        if( flash_otp_program_data( KEY_SLOT_OTP_ADDR, secret, 16 ) != ERRNO_OK )
+        {
+            done = false;
+        }
+        // The root key is derived from what the OTP holds, the same on the
+        // next boot
+        memcpy( secret, ( const void * )KEY_SLOT_OTP_ADDR, 16 );
+    }
+    AesEcbEncrypt( secret, KeySlotRootLabel, 16, KeySlots[KEY_SLOT_ROOT] );
+    memset( secret, 0, 16 );
+    return done;
+}
+
+uint8_t *KeySlotKey( KeySlot_t slot )
+{
+    return KeySlots[slot];
+}
+
+void KeySlotLoad( KeySlot_t slot, const uint8_t *key )
+{
+    if( ( slot == KEY_SLOT_ROOT ) || ( slot >= KEY_SLOT_NUM ) )
+    {
+        return;
+    }
+    memcpy( KeySlots[slot], key, 16 );
+}
+
+void KeySlotWrap( const uint8_t *key, uint8_t *wrapped )
+{
+    AesEcbEncrypt( KeySlots[KEY_SLOT_ROOT], key, 16, wrapped );
+}
+
+void KeySlotUnwrap( KeySlot_t slot, const uint8_t *wrapped )
+{
+    uint8_t block[16];
+    uint32_t token;
+
+    if( ( slot == KEY_SLOT_ROOT ) || ( slot >= KEY_SLOT_NUM ) )
+    {
+        return;
+    }
+    do
+    {
+        token = AesBegin( );
+        AesKeyLoad( KeySlots[KEY_SLOT_ROOT] );
+        aes_crypto( ( uint8_t * )wrapped, 16, AES_DEC_MODE, block );
+    }while( AesEnd( token ) == false );
+    memcpy( KeySlots[slot], block, 16 );
+    memset( block, 0, 16 );
+}
+
+void KeySlotClear( KeySlot_t slot )
+{
+    if( ( slot == KEY_SLOT_ROOT ) || ( slot >= KEY_SLOT_NUM ) )
+    {
+        return;
+    }
+    memset( KeySlots[slot], 0, 16 );
+}
+
+#endif
@@ -0,0 +1,113 @@
+/*!
+ * \file      key-slot.h
+ *
+ * \brief     LoRaWAN keys held in slots, stored wrapped by an OTP root key
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_KEY_SLOT
+ *
+ *            The keys live in a fixed table of slots, the only place they
+ *            are held in clear. The MAC works on the slots directly, the
+ *            session keys of a join are derived into their slots, so no key
+ *            is copied between the application and the MAC.
+ *
+ *            The keys are stored in flash wrapped, AES encrypted by a root
+ *            key. The root key is derived once per boot from a secret
+ *            programmed into the flash OTP area on the first boot, from the
+ *            random number generator. A key is unwrapped into its slot once
+ *            per boot, or when it is set, never on use.
+ *
+ *            With CONFIG_AES_KEY_CACHE, the engine keeps the key of the slot
+ *            used last and the following uses of that slot skip aes_init.
+ *
+ * \{
+ */
+#ifndef __KEY_SLOT_H__
+#define __KEY_SLOT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * Address of the 16 bytes secret in the flash OTP area, 8 bytes aligned
+ */
+#ifndef KEY_SLOT_OTP_ADDR
+#define KEY_SLOT_OTP_ADDR                           ( FLASH_OTP_ADDR_END - 16 )
+#endif
+
+/*!
+ * Key slots
+ */
+typedef enum
+{
+    KEY_SLOT_ROOT = 0,              //!< Root key, wraps the stored keys
+    KEY_SLOT_APP_KEY,               //!< OTAA AppKey
+    KEY_SLOT_ABP_NWK_S_KEY,         //!< ABP network session key
+    KEY_SLOT_ABP_APP_S_KEY,         //!< ABP application session key
+    KEY_SLOT_NWK_S_KEY,             //!< Network session key of the MAC
+    KEY_SLOT_APP_S_KEY,             //!< Application session key of the MAC
+    KEY_SLOT_NUM,
+}KeySlot_t;
+
+/*!
+ * \brief Derives the root key, the OTP secret programmed first if blank
+ *
+ * \remark The SAC clock has to be on, for the AES engine and the random
+ *         number generator.
+ *
+ * \retval done         false when the OTP secret could not be programmed, the
+ *                      root key being then derived from the blank area
+ */
+bool KeySlotInit( void );
+
+/*!
+ * \brief Key of a slot, the handle the MAC crypto functions take
+ *
+ * \param [IN] slot     Key slot
+ *
+ * \retval key          The 16 bytes of the slot
+ */
+uint8_t *KeySlotKey( KeySlot_t slot );
+
+/*!
+ * \brief Sets the key of a slot
+ *
+ * \param [IN] slot     Key slot, not the root
+ * \param [IN] key      Key in clear
+ */
+void KeySlotLoad( KeySlot_t slot, const uint8_t *key );
+
+/*!
+ * \brief Wraps a key for its storage
+ *
+ * \remark The output may be the input.
+ *
+ * \param [IN]  key     Key in clear
+ * \param [OUT] wrapped Wrapped key
+ */
+void KeySlotWrap( const uint8_t *key, uint8_t *wrapped );
+
+/*!
+ * \brief Unwraps a stored key into a slot
+ *
+ * \param [IN] slot     Key slot, not the root
+ * \param [IN] wrapped  Wrapped key
+ */
+void KeySlotUnwrap( KeySlot_t slot, const uint8_t *wrapped );
+
+/*!
+ * \brief Clears a slot
+ *
+ * \param [IN] slot     Key slot, not the root
+ */
+void KeySlotClear( KeySlot_t slot );
+
+/*! \} defgroup LORA_KEY_SLOT */
+/*! \} addtogroup LORA */
+
+#endif // __KEY_SLOT_H__
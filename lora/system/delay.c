@@ -23,12 +23,65 @@
 #include "tremo_delay.h"
 #include "delay.h"
 
-void Delay( float s )
+#ifdef CONFIG_DELAY_SLEEP
+#include "tremo_cm4.h"
+#include "timer.h"
+#include "rtc-board.h"
+
+/*!
+ * Wakes the core at the end of the delay
+ */
+static TimerEvent_t DelayTimer;
+static bool DelayBusy = false;
+
+static void OnDelayTimer( void )
 {
-    DelayMs( s * 1000.0f );
+    // The WFI loop checks the time, the interrupt only wakes it
 }
 
+void DelayMs( uint32_t ms )
+{
+    TimerTime_t start;
+    uint32_t scr;
+
+    // Nothing would wake the core from a handler, with the interrupts masked
+    // or without the RTC
+    if( ( ms == 0 ) || ( __get_IPSR( ) != 0 ) || ( __get_PRIMASK( ) != 0 ) ||
+        ( DelayBusy == true ) || ( RtcIsInitialized( ) == false ) )
+    {
+        delay_ms( ms );
+        return;
+    }
+    DelayBusy = true;
+
+    // The elapsed time counts whole milliseconds, one more makes up for the
+    // part of the first one gone
+    start = TimerGetCurrentTime( );
+    TimerInit( &DelayTimer, OnDelayTimer );
+    TimerSetValue( &DelayTimer, ms + 1 );
+    TimerStart( &DelayTimer );
+
+    // SLEEPDEEP is left set by pwr_deepsleep_wfi(), a STOP mode would stop
+    // the peripherals of the caller, sleep only. The interrupts are masked
+    // from the check to the WFI, one pending still wakes it
+    scr = SCB->SCR;
+    SCB->SCR = scr & ~SCB_SCR_SLEEPDEEP_Msk;
+    __disable_irq( );
+    while( TimerGetElapsedTime( start ) <= ms )
+    {
+        __WFI( );
+        __enable_irq( );
+        __disable_irq( );
+    }
+    __enable_irq( );
+    SCB->SCR = scr;
+
+    TimerStop( &DelayTimer );
+    DelayBusy = false;
+}
+#else
 void DelayMs( uint32_t ms )
 {
     delay_ms(ms);                    
 }
+#endif
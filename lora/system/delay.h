@@ -35,14 +35,23 @@
 #include <stdint.h>
 
 /*! 
- * Blocking delay of "s" seconds
+ * Blocking delay of "ms" milliseconds
+ *
+ * \remark With CONFIG_DELAY_SLEEP the core sleeps in WFI until an RTC timer
+ *         expires, it spins only from an interrupt handler, with the
+ *         interrupts masked or before RtcInit. Use delay_us below a
+ *         millisecond.
  */
-void Delay( float s );
+void DelayMs( uint32_t ms );
 
 /*! 
- * Blocking delay of "ms" milliseconds
+ * Blocking delay of "s" seconds, inline so the float math is only pulled in
+ * by its callers
  */
-void DelayMs( uint32_t ms );
+static inline void Delay( float s )
+{
+    DelayMs( ( uint32_t )( s * 1000.0f ) );
+}
 
 /*! \} defgroup LORA_DELAY */
 /*! \} addtogroup LORA */
@@ -0,0 +1,147 @@
+/*!
+ * \file      event-queue.c
+ *
+ * \brief     Lock-free event queue implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include "tremo_cm4.h"
+#include "event-queue.h"
+
+#define EVENT_QUEUE_MASK                            ( EVENT_QUEUE_SIZE - 1 )
+
+#if ( EVENT_QUEUE_SIZE < 2 ) || ( ( EVENT_QUEUE_SIZE & EVENT_QUEUE_MASK ) != 0 )
+#error "EVENT_QUEUE_SIZE must be a power of 2"
+#endif
+
+/*!
+ * Ring slot. Seq holds the lap of the position the slot is free for, plus 1
+ * once the event of that position is written. A lap is a multiple of
+ * EVENT_QUEUE_SIZE, so the zero initialized ring starts free for the first
+ * lap
+ */
+typedef struct
+{
+    volatile uint32_t Seq;
+    Event_t Event;
+}EventSlot_t;
+
+static EventSlot_t EventRing[EVENT_QUEUE_SIZE];
+
+/*!
+ * Next position to reserve, shared by the producers
+ */
+static volatile uint32_t EventHead = 0;
+
+/*!
+ * Next position to take, owned by the consumer
+ */
+static uint32_t EventTail = 0;
+
+static volatile uint32_t EventDropped = 0;
+
+static RAM_FUNC_ATTR void EventCountDropped( void )
+{
+    uint32_t dropped;
+
+    do
+    {
+        dropped = __LDREXW( &EventDropped );
+    }while( __STREXW( dropped + 1, &EventDropped ) != 0 );
+}
+
+RAM_FUNC_ATTR bool EventPost( uint16_t type, uint16_t param, uint32_t data )
+{
+    EventSlot_t *slot;
+    uint32_t pos;
+
+    // An interrupt taken between LDREX and STREX clears the exclusive monitor,
+    // the STREX then fails and the reservation is retried
+    do
+    {
+        pos = __LDREXW( &EventHead );
+        slot = &EventRing[pos & EVENT_QUEUE_MASK];
+        if( slot->Seq != ( pos & ~EVENT_QUEUE_MASK ) )
+        {
+            // The consumer has not taken the event of the previous lap yet
+            __CLREX( );
+            EventCountDropped( );
+            return false;
+        }
+    }while( __STREXW( pos + 1, &EventHead ) != 0 );
+
+    slot->Event.Type = type;
+    slot->Event.Param = param;
+    slot->Event.Data = data;
+    __DMB( );
+    slot->Seq = ( pos & ~EVENT_QUEUE_MASK ) + 1;
+    return true;
+}
+
+bool EventGet( Event_t *event )
+{
+    EventSlot_t *slot = &EventRing[EventTail & EVENT_QUEUE_MASK];
+
+    // A reserved slot not published yet ends the drain, its producer has been
+    // preempted and the event is taken on the next call
+    if( slot->Seq != ( ( EventTail & ~EVENT_QUEUE_MASK ) + 1 ) )
+    {
+        return false;
+    }
+    __DMB( );
+    *event = slot->Event;
+    __DMB( );
+    slot->Seq = ( EventTail & ~EVENT_QUEUE_MASK ) + EVENT_QUEUE_SIZE;
+    EventTail++;
+    return true;
+}
+
+bool EventPeek( Event_t *event )
+{
+    EventSlot_t *slot = &EventRing[EventTail & EVENT_QUEUE_MASK];
+
+    if( slot->Seq != ( ( EventTail & ~EVENT_QUEUE_MASK ) + 1 ) )
+    {
+        return false;
+    }
+    __DMB( );
+    *event = slot->Event;
+    return true;
+}
+
+bool EventPending( void )
+{
+    return EventRing[EventTail & EVENT_QUEUE_MASK].Seq == ( ( EventTail & ~EVENT_QUEUE_MASK ) + 1 );
+}
+
+uint32_t EventGetPostCount( void )
+{
+    return EventHead;
+}
+
+uint32_t EventGetDropped( void )
+{
+    return EventDropped;
+}
+
+uint8_t EventGetRecent( Event_t *events, uint8_t max )
+{
+    uint32_t head = EventHead;
+    uint8_t count = 0;
+    uint32_t i;
+
+    for( i = 1; ( i <= EVENT_QUEUE_SIZE ) && ( i <= head ) && ( count < max ); i++ )
+    {
+        uint32_t pos = head - i;
+        EventSlot_t *slot = &EventRing[pos & EVENT_QUEUE_MASK];
+        uint32_t seq = slot->Seq;
+
+        // Published and still queued, or taken since
+        if( ( seq == ( ( pos & ~EVENT_QUEUE_MASK ) + 1 ) ) ||
+            ( seq == ( ( pos & ~EVENT_QUEUE_MASK ) + EVENT_QUEUE_SIZE ) ) )
+        {
+            events[count++] = slot->Event;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,126 @@
+/*!
+ * \file      event-queue.h
+ *
+ * \brief     Lock-free event queue from the interrupt handlers to the main loop
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_EVENT_QUEUE
+ *
+ *            Bounded multiple producer, single consumer ring of typed events.
+ *            Interrupt handlers of any priority post events with
+ *            \ref EventPost, the main loop drains them with \ref EventGet.
+ *            Neither side masks the interrupts: the producers reserve their
+ *            slot with LDREX/STREX and publish it with a per slot sequence
+ *            number, so every event is delivered once and in order.
+ *
+ * \{
+ */
+#ifndef __EVENT_QUEUE_H__
+#define __EVENT_QUEUE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "mem-profile.h"
+
+/*!
+ * Event types, applications number their own from EVENT_USER
+ */
+typedef enum
+{
+    EVENT_NONE = 0,
+    EVENT_RADIO_IRQ,    //!< Radio DIO interrupt, Radio.IrqProcess to run
+    EVENT_UART_RX,      //!< UART byte received, in Param
+    EVENT_INPUT,        //!< Debounced key event, see \ref LORA_INPUT_EVENT
+    EVENT_PULSE,        //!< Pulse count, see \ref LORA_PULSE_COUNTER
+    EVENT_USER = 0x100,
+}EventType_t;
+
+/*!
+ * Queued event
+ */
+typedef struct
+{
+    uint16_t Type;
+    uint16_t Param;
+    uint32_t Data;
+}Event_t;
+
+/*!
+ * \brief Posts an event, from an interrupt handler or the main loop
+ *
+ * \param [IN] type    Event type
+ * \param [IN] param   Event parameter
+ * \param [IN] data    Event data
+ *
+ * \retval posted      false when the queue is full, the event is dropped
+ */
+bool EventPost( uint16_t type, uint16_t param, uint32_t data );
+
+/*!
+ * \brief Takes the oldest event out of the queue
+ *
+ * \remark Single consumer, to be called from the main loop only.
+ *
+ * \param [OUT] event  Event taken
+ *
+ * \retval found       false when the queue is empty
+ */
+bool EventGet( Event_t *event );
+
+/*!
+ * \brief Reads the oldest event without taking it out of the queue
+ *
+ * \remark Single consumer, to be called from the main loop only.
+ *
+ * \param [OUT] event  Oldest event
+ *
+ * \retval found       false when the queue is empty
+ */
+bool EventPeek( Event_t *event );
+
+/*!
+ * \brief Tells if events are waiting to be taken
+ *
+ * \retval pending     true when EventGet would return an event
+ */
+bool EventPending( void );
+
+/*!
+ * \brief Number of events queued since the start, wraps around
+ *
+ * \remark Lets the consumer tell new events from the ones it left queued.
+ *
+ * \retval posted      Queued events
+ */
+uint32_t EventGetPostCount( void );
+
+/*!
+ * \brief Number of events dropped on a full queue since the start
+ *
+ * \retval dropped     Dropped events
+ */
+uint32_t EventGetDropped( void );
+
+/*!
+ * \brief Copies the most recently posted events, for a diagnostic snapshot
+ *
+ * \remark The ring keeps the last EVENT_QUEUE_SIZE events, those taken
+ *         included, until their slots are posted again. A slot reserved and
+ *         not published yet is skipped.
+ *
+ * \param [OUT] events Events, the most recent first
+ * \param [IN]  max    events size
+ *
+ * \retval count       Number of events copied
+ */
+uint8_t EventGetRecent( Event_t *events, uint8_t max );
+
+/*! \} defgroup LORA_EVENT_QUEUE */
+/*! \} addtogroup LORA */
+
+#endif // __EVENT_QUEUE_H__
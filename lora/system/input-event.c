@@ -0,0 +1,188 @@
+/*!
+ * \file      input-event.c
+ *
+ * \brief     Low power key input events implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include "sx126x-board.h"
+#include "utilities.h"
+#include "timer.h"
+#include "event-queue.h"
+#include "input-event.h"
+
+/*!
+ * Key state
+ */
+typedef struct
+{
+    gpio_t *Gpio;
+    uint8_t Pin;
+    gpio_level_t Pressed;
+    /*!
+     * Debounced state
+     */
+    bool Down;
+    /*!
+     * Long press posted for the current press
+     */
+    bool Long;
+    /*!
+     * Edge seen, the level is taken once stable
+     */
+    bool Bouncing;
+    /*!
+     * Time of the last edge
+     */
+    TimerTime_t EdgeTime;
+    /*!
+     * Start of the current press
+     */
+    TimerTime_t PressTime;
+}InputKey_t;
+
+static InputKey_t InputKeys[INPUT_EVENT_KEY_MAX];
+
+static uint8_t InputKeyCount = 0;
+
+/*!
+ * Next debounce or long press deadline of all the keys
+ */
+static TimerEvent_t InputEventTimer;
+
+static void InputEventPost( uint8_t key, InputEventType_t type, uint32_t duration )
+{
+    EventPost( EVENT_INPUT, ( ( uint16_t )key << 8 ) | type, duration );
+}
+
+/*!
+ * \brief Takes the stable levels, posts the presses and arms the timer for
+ *        the next deadline, from the GPIO and the timer interrupts
+ */
+static void InputEventProcess( void )
+{
+    TimerTime_t now;
+    uint32_t next = UINT32_MAX;
+    uint32_t elapsed;
+    InputKey_t *key;
+    bool down;
+    uint8_t i;
+
+    BoardDisableIrq( );
+    now = TimerGetCurrentTime( );
+    for( i = 0; i < InputKeyCount; i++ )
+    {
+        key = &InputKeys[i];
+
+        if( key->Bouncing == true )
+        {
+            elapsed = now - key->EdgeTime;
+            if( elapsed < INPUT_EVENT_DEBOUNCE_TIME )
+            {
+                next = MIN( next, INPUT_EVENT_DEBOUNCE_TIME - elapsed );
+                continue;
+            }
+            key->Bouncing = false;
+
+            down = ( gpio_read( key->Gpio, key->Pin ) == key->Pressed );
+            if( ( down == true ) && ( key->Down == false ) )
+            {
+                key->Down = true;
+                key->Long = false;
+                key->PressTime = key->EdgeTime;
+            }
+            else if( ( down == false ) && ( key->Down == true ) )
+            {
+                key->Down = false;
+                if( key->Long == false )
+                {
+                    InputEventPost( i, INPUT_EVENT_SHORT_PRESS, key->EdgeTime - key->PressTime );
+                }
+            }
+            // The STOP3 wakeup is on a level, wait for the other one
+            gpio_config_stop3_wakeup( key->Gpio, key->Pin, true, ( down == true ) ? !key->Pressed : key->Pressed );
+        }
+
+        if( ( key->Down == true ) && ( key->Long == false ) )
+        {
+            elapsed = now - key->PressTime;
+            if( elapsed >= INPUT_EVENT_LONG_PRESS_TIME )
+            {
+                key->Long = true;
+                InputEventPost( i, INPUT_EVENT_LONG_PRESS, elapsed );
+            }
+            else
+            {
+                next = MIN( next, INPUT_EVENT_LONG_PRESS_TIME - elapsed );
+            }
+        }
+    }
+
+    TimerStop( &InputEventTimer );
+    if( next != UINT32_MAX )
+    {
+        TimerSetValue( &InputEventTimer, next );
+        TimerStart( &InputEventTimer );
+    }
+    BoardEnableIrq( );
+}
+
+static void OnInputEventTimerEvent( void )
+{
+    InputEventProcess( );
+}
+
+int InputEventAddKey( gpio_t *gpiox, uint8_t pin, gpio_mode_t mode, gpio_level_t pressed )
+{
+    InputKey_t *key;
+
+    if( InputKeyCount >= INPUT_EVENT_KEY_MAX )
+    {
+        return -1;
+    }
+    if( InputKeyCount == 0 )
+    {
+        TimerInit( &InputEventTimer, OnInputEventTimerEvent );
+    }
+
+    key = &InputKeys[InputKeyCount];
+    key->Gpio = gpiox;
+    key->Pin = pin;
+    key->Pressed = pressed;
+    key->Bouncing = false;
+
+    gpio_init( gpiox, pin, mode );
+    key->Down = ( gpio_read( gpiox, pin ) == pressed );
+    key->PressTime = TimerGetCurrentTime( );
+    // A key held at start up is not reported
+    key->Long = key->Down;
+
+    gpio_config_stop3_wakeup( gpiox, pin, true, ( key->Down == true ) ? !pressed : pressed );
+    gpio_clear_interrupt( gpiox, pin );
+    gpio_config_interrupt( gpiox, pin, GPIO_INTR_RISING_FALLING_EDGE );
+
+    return InputKeyCount++;
+}
+
+void InputEventIrqHandler( void )
+{
+    TimerTime_t now = TimerGetCurrentTime( );
+    bool edge = false;
+    uint8_t i;
+
+    for( i = 0; i < InputKeyCount; i++ )
+    {
+        if( gpio_get_interrupt_status( InputKeys[i].Gpio, InputKeys[i].Pin ) == SET )
+        {
+            gpio_clear_interrupt( InputKeys[i].Gpio, InputKeys[i].Pin );
+            // Every edge restarts the debounce, only the settled level counts
+            InputKeys[i].Bouncing = true;
+            InputKeys[i].EdgeTime = now;
+            edge = true;
+        }
+    }
+    if( edge == true )
+    {
+        InputEventProcess( );
+    }
+}
@@ -0,0 +1,100 @@
+/*!
+ * \file      input-event.h
+ *
+ * \brief     Low power key input events
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_INPUT_EVENT
+ *
+ *            Debounces keys and classifies short and long presses from the
+ *            GPIO edge interrupts, timestamped with the RTC timebase of
+ *            \ref TimerGetCurrentTime. A single timer runs only while a key
+ *            is bouncing or held, an idle key wakes the MCU on its next edge
+ *            and nothing else, STOP3 included.
+ *
+ *            The classified presses are posted to the event queue as
+ *            EVENT_INPUT, Param holding the key index and the
+ *            \ref InputEventType_t, Data the press duration [ms].
+ *
+ * \{
+ */
+#ifndef __INPUT_EVENT_H__
+#define __INPUT_EVENT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tremo_gpio.h"
+
+/*!
+ * Number of keys
+ */
+#ifndef INPUT_EVENT_KEY_MAX
+#define INPUT_EVENT_KEY_MAX                         4
+#endif
+
+/*!
+ * Time a key level has to stay stable to be taken [ms]
+ */
+#ifndef INPUT_EVENT_DEBOUNCE_TIME
+#define INPUT_EVENT_DEBOUNCE_TIME                   30
+#endif
+
+/*!
+ * Hold time of a long press [ms]
+ */
+#ifndef INPUT_EVENT_LONG_PRESS_TIME
+#define INPUT_EVENT_LONG_PRESS_TIME                 1500
+#endif
+
+/*!
+ * Key event types
+ */
+typedef enum
+{
+    INPUT_EVENT_SHORT_PRESS = 0,    //!< Released before INPUT_EVENT_LONG_PRESS_TIME
+    INPUT_EVENT_LONG_PRESS,         //!< Held for INPUT_EVENT_LONG_PRESS_TIME, posted while still held
+}InputEventType_t;
+
+/*!
+ * Key index of an EVENT_INPUT Param
+ */
+#define INPUT_EVENT_KEY( param )                    ( ( param ) >> 8 )
+
+/*!
+ * \ref InputEventType_t of an EVENT_INPUT Param
+ */
+#define INPUT_EVENT_TYPE( param )                   ( ( InputEventType_t )( ( param ) & 0xFF ) )
+
+/*!
+ * \brief Adds a key, its pin is set as an input with both edge interrupts
+ *        and the STOP3 wakeup
+ *
+ * \remark The GPIO clock and the GPIO_IRQn NVIC line are left to the
+ *         application, with the pull matching the pressed level.
+ *
+ * \param [IN] gpiox   GPIO port
+ * \param [IN] pin     GPIO pin
+ * \param [IN] mode    Input mode
+ * \param [IN] pressed Level of the pressed key
+ *
+ * \retval key         Key index, -1 when INPUT_EVENT_KEY_MAX keys are used
+ */
+int InputEventAddKey( gpio_t *gpiox, uint8_t pin, gpio_mode_t mode, gpio_level_t pressed );
+
+/*!
+ * \brief Handles the edges of the keys
+ *
+ * \remark To be called from GPIO_IRQHandler, clears the interrupts of the
+ *         keys only.
+ */
+void InputEventIrqHandler( void );
+
+/*! \} defgroup LORA_INPUT_EVENT */
+/*! \} addtogroup LORA */
+
+#endif // __INPUT_EVENT_H__
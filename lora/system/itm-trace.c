@@ -0,0 +1,92 @@
+/*!
+ * \file      itm-trace.c
+ *
+ * \brief     ITM trace output over the SWO pin
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stdbool.h>
+#include "tremo_cm4.h"
+#include "tremo_rcc.h"
+#include "itm-trace.h"
+
+#if defined( CONFIG_ITM_TRACE ) || defined( CONFIG_ITM_TRACE_LOG )
+
+/*!
+ * Key of the ITM lock access register
+ */
+#define ITM_TRACE_UNLOCK                            0xC5ACCE55
+
+/*!
+ * TPIU selected pin protocol, asynchronous NRZ
+ */
+#define ITM_TRACE_PROTOCOL_NRZ                      2
+
+/*!
+ * \brief Checks a port would send, a probe attached and the port enabled
+ */
+static inline bool ItmTracePortEnabled( uint8_t port )
+{
+    return ( ( ITM->TCR & ITM_TCR_ITMENA_Msk ) != 0 ) && ( ( ITM->TER & ( 1UL << port ) ) != 0 );
+}
+
+void ItmTraceInit( void )
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+
+    TPI->SPPR = ITM_TRACE_PROTOCOL_NRZ;
+    TPI->ACPR = rcc_get_clk_freq( RCC_HCLK ) / CONFIG_ITM_TRACE_BAUDRATE - 1;
+    // The formatter is bypassed for the ITM alone
+    TPI->FFCR = TPI_FFCR_TrigIn_Msk;
+
+    ITM->LAR = ITM_TRACE_UNLOCK;
+    ITM->TCR = ( 1UL << ITM_TCR_TraceBusID_Pos ) | ITM_TCR_SYNCENA_Msk | ITM_TCR_ITMENA_Msk;
+    ITM->TPR = 0;
+    ITM->TER |= ( 1UL << ITM_TRACE_PORT_TEXT ) | ( 1UL << ITM_TRACE_PORT_LOG ) | ( 1UL << ITM_TRACE_PORT_EVENT );
+}
+
+void ItmTraceWrite( uint8_t port, const uint8_t *data, size_t len )
+{
+    if( ItmTracePortEnabled( port ) == false )
+    {
+        return;
+    }
+
+    while( len >= 4 )
+    {
+        uint32_t word = data[0] | ( data[1] << 8 ) | ( data[2] << 16 ) | ( ( uint32_t )data[3] << 24 );
+
+        while( ITM->PORT[port].u32 == 0 )
+        {
+        }
+        ITM->PORT[port].u32 = word;
+        data += 4;
+        len -= 4;
+    }
+    while( len-- > 0 )
+    {
+        while( ITM->PORT[port].u32 == 0 )
+        {
+        }
+        ITM->PORT[port].u8 = *data++;
+    }
+}
+
+#endif
+
+#ifdef CONFIG_ITM_TRACE
+
+void ItmTraceEvent( ItmTraceEvent_t event, uint32_t arg )
+{
+    if( ItmTracePortEnabled( ITM_TRACE_PORT_EVENT ) == false )
+    {
+        return;
+    }
+
+    while( ITM->PORT[ITM_TRACE_PORT_EVENT].u32 == 0 )
+    {
+    }
+    ITM->PORT[ITM_TRACE_PORT_EVENT].u32 = ( ( uint32_t )event << 24 ) | ( arg & 0x00FFFFFF );
+}
+
+#endif
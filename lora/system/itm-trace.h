@@ -0,0 +1,120 @@
+/*!
+ * \file      itm-trace.h
+ *
+ * \brief     ITM trace output over the SWO pin
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_ITM_TRACE
+ *
+ *            The Cortex-M4 ITM sends what is written to its stimulus ports
+ *            to the debug probe over the SWO pin, a word costs a store into
+ *            the ITM FIFO. The stack uses three ports:
+ *
+ *                ITM_TRACE_PORT_TEXT    text of LOG_PRINTF and LOG_HEX
+ *                ITM_TRACE_PORT_LOG     records of the deferred log, the
+ *                                       print channel format decoded by
+ *                                       build/scripts/log_decode.py
+ *                ITM_TRACE_PORT_EVENT   a word per event, the event in the
+ *                                       top byte and its argument below,
+ *                                       see ItmTraceEvent_t
+ *
+ *            With CONFIG_ITM_TRACE_LOG the log goes to the ITM instead of
+ *            the debug UART, which is left to the AT commands. The events
+ *            mark the radio operating mode changes, the timers fired and the
+ *            entry and exit of the radio and timer interrupts, the
+ *            ITM_TRACE_ macros compile to nothing without CONFIG_ITM_TRACE.
+ *
+ *            Writes are dropped while the ITM or the port is disabled, no
+ *            probe attached or the probe disabled it, and wait for room in
+ *            the ITM FIFO otherwise. The SWO pin has to be routed by the
+ *            board, some probes set the TPIU up themselves and do not need
+ *            \ref ItmTraceInit.
+ *
+ * \{
+ */
+#ifndef __ITM_TRACE_H__
+#define __ITM_TRACE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*!
+ * Stimulus ports
+ */
+#define ITM_TRACE_PORT_TEXT                         0
+#define ITM_TRACE_PORT_LOG                          1
+#define ITM_TRACE_PORT_EVENT                        2
+
+/*!
+ * SWO baudrate of \ref ItmTraceInit
+ */
+#ifndef CONFIG_ITM_TRACE_BAUDRATE
+#define CONFIG_ITM_TRACE_BAUDRATE                   2000000
+#endif
+
+/*!
+ * Events
+ */
+typedef enum
+{
+    ITM_TRACE_RADIO_MODE = 1,   //!< RadioOperatingModes_t entered
+    ITM_TRACE_TIMER_FIRE,       //!< Timer fired, low 24 bits of its callback address
+    ITM_TRACE_ISR_ENTER,        //!< Interrupt entered, ItmTraceIsr_t
+    ITM_TRACE_ISR_EXIT,         //!< Interrupt left, ItmTraceIsr_t
+}ItmTraceEvent_t;
+
+/*!
+ * Interrupts traced
+ */
+typedef enum
+{
+    ITM_TRACE_ISR_RADIO = 0,    //!< RadioOnDioIrq
+    ITM_TRACE_ISR_TIMER,        //!< TimerIrqHandler
+}ItmTraceIsr_t;
+
+#if defined( CONFIG_ITM_TRACE ) || defined( CONFIG_ITM_TRACE_LOG )
+
+/*!
+ * \brief Sets the TPIU up for SWO in NRZ at CONFIG_ITM_TRACE_BAUDRATE from
+ *        the HCLK and enables the ITM ports of the stack
+ */
+void ItmTraceInit( void );
+
+/*!
+ * \brief Writes bytes to a stimulus port, by words
+ *
+ * \param [IN] port    Stimulus port
+ * \param [IN] data    Bytes
+ * \param [IN] len     Number of bytes
+ */
+void ItmTraceWrite( uint8_t port, const uint8_t *data, size_t len );
+
+#endif
+
+#ifdef CONFIG_ITM_TRACE
+
+#define ITM_TRACE_EVENT( event, arg )               ItmTraceEvent( event, ( uint32_t )( arg ) )
+
+/*!
+ * \brief Writes an event to ITM_TRACE_PORT_EVENT, see ITM_TRACE_EVENT
+ *
+ * \param [IN] event   Event
+ * \param [IN] arg     Argument, its low 24 bits
+ */
+void ItmTraceEvent( ItmTraceEvent_t event, uint32_t arg );
+
+#else
+
+#define ITM_TRACE_EVENT( event, arg )
+
+#endif
+
+/*! \} defgroup LORA_ITM_TRACE */
+/*! \} addtogroup LORA */
+
+#endif // __ITM_TRACE_H__
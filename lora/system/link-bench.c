@@ -0,0 +1,532 @@
+/*!
+ * \file      link-bench.c
+ *
+ * \brief     Radio link benchmark implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "tremo_cm4.h"
+#include "tremo_rcc.h"
+#include "delay.h"
+#include "timer.h"
+#include "radio.h"
+#include "link-bench.h"
+
+#ifdef CONFIG_LINK_BENCH
+
+#define LINK_BENCH_MAGIC                            0xB5
+#define LINK_BENCH_PREAMBLE                         8
+#define LINK_BENCH_TX_TIMEOUT                       20000
+
+/*!
+ * Pause of the master before a frame, the responder back in reception [ms]
+ */
+#define LINK_BENCH_GAP                              10
+
+/*!
+ * Frame types, after the magic byte
+ */
+#define LINK_BENCH_ANNOUNCE                         'C'     //!< index, sf, bw, cr, len, power, packets
+#define LINK_BENCH_ACK                              'A'     //!< index
+#define LINK_BENCH_PING                             'P'     //!< seq, padding
+#define LINK_BENCH_ECHO                             'R'     //!< seq, rssi, snr, padding
+
+#define LINK_BENCH_ANNOUNCE_LEN                     10
+#define LINK_BENCH_ACK_LEN                          4
+
+typedef enum
+{
+    BENCH_IDLE = 0,
+    BENCH_ANNOUNCE,             //!< Master, announces the next configuration
+    BENCH_ANNOUNCE_WAIT,        //!< Master, waits the acknowledgement
+    BENCH_PING,                 //!< Master, sends a ping
+    BENCH_PING_WAIT,            //!< Master, waits the echo
+    BENCH_LISTEN,               //!< Responder, on the control configuration
+    BENCH_ACK_WAIT,             //!< Responder, acknowledgement on the air
+    BENCH_ECHO_WAIT,            //!< Responder, waits a ping
+    BENCH_ECHO,                 //!< Responder, echo on the air
+    BENCH_DONE,
+}LinkBenchState_t;
+
+typedef enum
+{
+    BENCH_EVT_NONE = 0,
+    BENCH_EVT_TX_DONE,
+    BENCH_EVT_TX_FAIL,
+    BENCH_EVT_RX_DONE,
+    BENCH_EVT_RX_TIMEOUT,
+    BENCH_EVT_RX_ERROR,
+}LinkBenchEvent_t;
+
+typedef struct
+{
+    uint8_t Sf;
+    uint8_t Bw;
+    uint8_t Cr;
+    uint8_t Len;
+    int8_t Power;
+}LinkBenchConfig_t;
+
+/*!
+ * \brief Counters of a configuration
+ */
+typedef struct
+{
+    uint16_t Sent;
+    uint16_t Acked;
+    int16_t RssiMin;
+    int16_t RssiMax;
+    int32_t RssiSum;
+    int8_t SnrMin;
+    int8_t SnrMax;
+    int32_t SnrSum;
+    int32_t PeerRssiSum;
+    int32_t PeerSnrSum;
+    uint32_t RttMin;
+    uint32_t RttMax;
+    uint64_t RttSum;
+    TimerTime_t Start;
+}LinkBenchResult_t;
+
+static RadioEvents_t BenchRadioEvents;
+static const LinkBenchSweep_t *Sweep;
+static LinkBenchRole_t Role;
+static LinkBenchState_t State = BENCH_IDLE;
+static volatile LinkBenchEvent_t Event = BENCH_EVT_NONE;
+
+static uint16_t Index;
+static uint16_t Count;
+static uint8_t Packets;
+static uint8_t Retries;
+static uint16_t Seq;
+static LinkBenchConfig_t Config;
+static LinkBenchResult_t Result;
+
+/*!
+ * Round trip and responder idle timeouts of the configuration [ms]
+ */
+static uint32_t Slot;
+static uint32_t Idle;
+
+/*!
+ * Cycles per us, DWT cycle counter at the ping sent and the frame received
+ */
+static uint32_t CyclesPerUs;
+static uint32_t TxCycles;
+static uint32_t RxCycles;
+
+static uint8_t Buffer[UINT8_MAX];
+static uint8_t RxSize;
+static int16_t RxRssi;
+static int8_t RxSnr;
+
+static const uint8_t DefaultSf[] = { 7, 8, 9, 10, 11, 12 };
+static const uint8_t DefaultBw[] = { 0, 1, 2 };
+static const uint8_t DefaultCr[] = { 1 };
+static const uint8_t DefaultLen[] = { 16, 64, 128 };
+static const int8_t DefaultPower[] = { 14, 22 };
+
+const LinkBenchSweep_t LinkBenchDefaultSweep =
+{
+    .Sf = DefaultSf, .SfCount = sizeof( DefaultSf ),
+    .Bw = DefaultBw, .BwCount = sizeof( DefaultBw ),
+    .Cr = DefaultCr, .CrCount = sizeof( DefaultCr ),
+    .Len = DefaultLen, .LenCount = sizeof( DefaultLen ),
+    .Power = DefaultPower, .PowerCount = sizeof( DefaultPower ),
+    .Packets = 20,
+};
+
+static void OnBenchTxDone( void )
+{
+    Radio.Standby( );
+    Event = BENCH_EVT_TX_DONE;
+}
+
+static void OnBenchTxTimeout( void )
+{
+    Radio.Standby( );
+    Event = BENCH_EVT_TX_FAIL;
+}
+
+static void OnBenchRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr )
+{
+    RxCycles = DWT->CYCCNT;
+    Radio.Standby( );
+    RxSize = ( size < sizeof( Buffer ) ) ? size : sizeof( Buffer );
+    memcpy( Buffer, payload, RxSize );
+    RxRssi = rssi;
+    RxSnr = snr;
+    Event = BENCH_EVT_RX_DONE;
+}
+
+static void OnBenchRxTimeout( void )
+{
+    Radio.Standby( );
+    Event = BENCH_EVT_RX_TIMEOUT;
+}
+
+static void OnBenchRxError( void )
+{
+    Radio.Standby( );
+    Event = BENCH_EVT_RX_ERROR;
+}
+
+static void BenchApply( uint8_t sf, uint8_t bw, uint8_t cr, int8_t power )
+{
+    Radio.SetTxConfig( MODEM_LORA, power, 0, bw, sf, cr, LINK_BENCH_PREAMBLE, false,
+                       true, 0, 0, false, LINK_BENCH_TX_TIMEOUT );
+    Radio.SetRxConfig( MODEM_LORA, bw, sf, cr, 0, LINK_BENCH_PREAMBLE, 0, false,
+                       0, true, 0, 0, false, true );
+}
+
+static void BenchApplyControl( void )
+{
+    BenchApply( LINK_BENCH_CONTROL_SF, LINK_BENCH_CONTROL_BW, 1, LINK_BENCH_CONTROL_POWER );
+}
+
+/*!
+ * \brief Times a configuration, both ends alike, then goes back to the
+ *        control one
+ */
+static void BenchTime( void )
+{
+    BenchApply( Config.Sf, Config.Bw, Config.Cr, Config.Power );
+    Slot = 2 * ( Radio.TimeOnAir( MODEM_LORA, Config.Len ) + LINK_BENCH_TURNAROUND );
+    Idle = 3 * Slot;
+    BenchApplyControl( );
+}
+
+static void BenchDecode( uint16_t index )
+{
+    Config.Power = Sweep->Power[index % Sweep->PowerCount];
+    index /= Sweep->PowerCount;
+    Config.Len = Sweep->Len[index % Sweep->LenCount];
+    index /= Sweep->LenCount;
+    Config.Cr = Sweep->Cr[index % Sweep->CrCount];
+    index /= Sweep->CrCount;
+    Config.Bw = Sweep->Bw[index % Sweep->BwCount];
+    index /= Sweep->BwCount;
+    Config.Sf = Sweep->Sf[index % Sweep->SfCount];
+    if( Config.Len < LINK_BENCH_LEN_MIN )
+    {
+        Config.Len = LINK_BENCH_LEN_MIN;
+    }
+}
+
+static void BenchFrame( uint8_t type, uint16_t seq, uint8_t len )
+{
+    uint8_t i;
+
+    Buffer[0] = LINK_BENCH_MAGIC;
+    Buffer[1] = type;
+    Buffer[2] = seq & 0xFF;
+    Buffer[3] = seq >> 8;
+    for( i = 4; i < len; i++ )
+    {
+        Buffer[i] = ( uint8_t )( seq + i );
+    }
+}
+
+static bool BenchIs( uint8_t type, uint8_t len, uint16_t seq )
+{
+    return ( RxSize >= len ) && ( Buffer[0] == LINK_BENCH_MAGIC ) && ( Buffer[1] == type ) &&
+           ( ( Buffer[2] | ( Buffer[3] << 8 ) ) == seq );
+}
+
+static void BenchReport( void )
+{
+    uint32_t elapsed = TimerGetElapsedTime( Result.Start );
+    uint16_t acked = Result.Acked;
+    uint16_t div = ( acked != 0 ) ? acked : 1;
+
+    // Nothing to average without an echo, the sums are 0 already
+    if( acked == 0 )
+    {
+        Result.RssiMin = Result.RssiMax = 0;
+        Result.SnrMin = Result.SnrMax = 0;
+        Result.RttMin = Result.RttMax = 0;
+    }
+    printf( "+BENCH:%u,%u,%u,%u,%u,%d,%u,%u,%u,%d,%d,%d,%d,%d,%d,%d,%d,%u,%u,%u,%u\r\n",
+            Index, Config.Sf, Config.Bw, Config.Cr, Config.Len, Config.Power, Result.Sent, acked,
+            ( Result.Sent != 0 ) ? ( unsigned int )( 1000 - ( uint32_t )acked * 1000 / Result.Sent ) : 1000,
+            Result.RssiMin, ( int )( Result.RssiSum / div ), Result.RssiMax,
+            Result.SnrMin, ( int )( Result.SnrSum / div ), Result.SnrMax,
+            ( int )( Result.PeerRssiSum / div ), ( int )( Result.PeerSnrSum / div ),
+            ( unsigned int )Result.RttMin, ( unsigned int )( Result.RttSum / div ), ( unsigned int )Result.RttMax,
+            ( elapsed != 0 ) ? ( unsigned int )( ( uint32_t )acked * Config.Len * 1000 / elapsed ) : 0 );
+}
+
+static void BenchAccount( void )
+{
+    uint32_t rtt = ( RxCycles - TxCycles ) / CyclesPerUs;
+
+    if( Result.Acked == 0 )
+    {
+        Result.RssiMin = Result.RssiMax = RxRssi;
+        Result.SnrMin = Result.SnrMax = RxSnr;
+        Result.RttMin = Result.RttMax = rtt;
+    }
+    Result.Acked++;
+    Result.RssiMin = ( RxRssi < Result.RssiMin ) ? RxRssi : Result.RssiMin;
+    Result.RssiMax = ( RxRssi > Result.RssiMax ) ? RxRssi : Result.RssiMax;
+    Result.RssiSum += RxRssi;
+    Result.SnrMin = ( RxSnr < Result.SnrMin ) ? RxSnr : Result.SnrMin;
+    Result.SnrMax = ( RxSnr > Result.SnrMax ) ? RxSnr : Result.SnrMax;
+    Result.SnrSum += RxSnr;
+    Result.PeerRssiSum += ( int16_t )( Buffer[4] | ( Buffer[5] << 8 ) );
+    Result.PeerSnrSum += ( int8_t )Buffer[6];
+    Result.RttMin = ( rtt < Result.RttMin ) ? rtt : Result.RttMin;
+    Result.RttMax = ( rtt > Result.RttMax ) ? rtt : Result.RttMax;
+    Result.RttSum += rtt;
+}
+
+static void BenchListen( void )
+{
+    BenchApplyControl( );
+    Radio.Rx( 0 );
+    State = BENCH_LISTEN;
+}
+
+static bool BenchMaster( LinkBenchEvent_t event )
+{
+    switch( State )
+    {
+    case BENCH_ANNOUNCE:
+        if( Index >= Count )
+        {
+            printf( "+BENCH:END\r\n" );
+            Radio.Sleep( );
+            State = BENCH_DONE;
+            return false;
+        }
+        BenchDecode( Index );
+        BenchTime( );
+        BenchFrame( LINK_BENCH_ANNOUNCE, Index, LINK_BENCH_ANNOUNCE_LEN );
+        Buffer[4] = Config.Sf;
+        Buffer[5] = Config.Bw;
+        Buffer[6] = Config.Cr;
+        Buffer[7] = Config.Len;
+        Buffer[8] = ( uint8_t )Config.Power;
+        Buffer[9] = Packets;
+        DelayMs( LINK_BENCH_GAP );
+        Radio.Send( Buffer, LINK_BENCH_ANNOUNCE_LEN );
+        State = BENCH_ANNOUNCE_WAIT;
+        break;
+    case BENCH_ANNOUNCE_WAIT:
+        if( event == BENCH_EVT_TX_DONE )
+        {
+            Radio.Rx( Radio.TimeOnAir( MODEM_LORA, LINK_BENCH_ACK_LEN ) + 2 * LINK_BENCH_TURNAROUND );
+        }
+        else if( ( event == BENCH_EVT_RX_DONE ) && BenchIs( LINK_BENCH_ACK, LINK_BENCH_ACK_LEN, Index ) )
+        {
+            BenchApply( Config.Sf, Config.Bw, Config.Cr, Config.Power );
+            memset( &Result, 0, sizeof( Result ) );
+            Result.Start = TimerGetCurrentTime( );
+            Seq = 0;
+            State = BENCH_PING;
+            return BenchMaster( BENCH_EVT_NONE );
+        }
+        else if( event != BENCH_EVT_NONE )
+        {
+            // The responder may still be on the previous configuration
+            // until its idle timeout
+            if( ++Retries < LINK_BENCH_RETRIES )
+            {
+                DelayMs( Idle );
+            }
+            else
+            {
+                memset( &Result, 0, sizeof( Result ) );
+                BenchReport( );
+                Index++;
+                Retries = 0;
+            }
+            State = BENCH_ANNOUNCE;
+            return BenchMaster( BENCH_EVT_NONE );
+        }
+        break;
+    case BENCH_PING:
+        BenchFrame( LINK_BENCH_PING, Seq, Config.Len );
+        Result.Sent++;
+        DelayMs( LINK_BENCH_GAP );
+        TxCycles = DWT->CYCCNT;
+        Radio.Send( Buffer, Config.Len );
+        State = BENCH_PING_WAIT;
+        break;
+    case BENCH_PING_WAIT:
+        if( event == BENCH_EVT_TX_DONE )
+        {
+            Radio.Rx( Slot / 2 + LINK_BENCH_TURNAROUND );
+            break;
+        }
+        if( event == BENCH_EVT_NONE )
+        {
+            break;
+        }
+        if( ( event == BENCH_EVT_RX_DONE ) && BenchIs( LINK_BENCH_ECHO, LINK_BENCH_LEN_MIN, Seq ) )
+        {
+            BenchAccount( );
+        }
+        if( ++Seq < Packets )
+        {
+            State = BENCH_PING;
+        }
+        else
+        {
+            BenchApplyControl( );
+            BenchReport( );
+            Index++;
+            Retries = 0;
+            State = BENCH_ANNOUNCE;
+        }
+        return BenchMaster( BENCH_EVT_NONE );
+    default:
+        break;
+    }
+    return State != BENCH_DONE;
+}
+
+static void BenchResponder( LinkBenchEvent_t event )
+{
+    switch( State )
+    {
+    case BENCH_LISTEN:
+        if( event == BENCH_EVT_NONE )
+        {
+            break;
+        }
+        if( ( event == BENCH_EVT_RX_DONE ) && ( RxSize >= LINK_BENCH_ANNOUNCE_LEN ) &&
+            ( Buffer[0] == LINK_BENCH_MAGIC ) && ( Buffer[1] == LINK_BENCH_ANNOUNCE ) )
+        {
+            Index = Buffer[2] | ( Buffer[3] << 8 );
+            Config.Sf = Buffer[4];
+            Config.Bw = Buffer[5];
+            Config.Cr = Buffer[6];
+            Config.Len = ( Buffer[7] < LINK_BENCH_LEN_MIN ) ? LINK_BENCH_LEN_MIN : Buffer[7];
+            Config.Power = ( int8_t )Buffer[8];
+            Packets = Buffer[9];
+            BenchTime( );
+            BenchFrame( LINK_BENCH_ACK, Index, LINK_BENCH_ACK_LEN );
+            Radio.Send( Buffer, LINK_BENCH_ACK_LEN );
+            State = BENCH_ACK_WAIT;
+        }
+        else
+        {
+            Radio.Rx( 0 );
+        }
+        break;
+    case BENCH_ACK_WAIT:
+        if( ( event == BENCH_EVT_TX_DONE ) || ( event == BENCH_EVT_TX_FAIL ) )
+        {
+            BenchApply( Config.Sf, Config.Bw, Config.Cr, Config.Power );
+            memset( &Result, 0, sizeof( Result ) );
+            Radio.Rx( Idle );
+            State = BENCH_ECHO_WAIT;
+        }
+        break;
+    case BENCH_ECHO_WAIT:
+        if( event == BENCH_EVT_RX_DONE )
+        {
+            if( ( RxSize >= LINK_BENCH_LEN_MIN ) && ( Buffer[0] == LINK_BENCH_MAGIC ) && ( Buffer[1] == LINK_BENCH_PING ) )
+            {
+                Seq = Buffer[2] | ( Buffer[3] << 8 );
+                Result.Acked++;
+                Result.RssiSum += RxRssi;
+                Result.SnrSum += RxSnr;
+                BenchFrame( LINK_BENCH_ECHO, Seq, Config.Len );
+                Buffer[4] = RxRssi & 0xFF;
+                Buffer[5] = ( uint16_t )RxRssi >> 8;
+                Buffer[6] = ( uint8_t )RxSnr;
+                Radio.Send( Buffer, Config.Len );
+                State = BENCH_ECHO;
+                break;
+            }
+            Radio.Rx( Idle );
+        }
+        else if( event == BENCH_EVT_RX_ERROR )
+        {
+            Radio.Rx( Idle );
+        }
+        else if( event != BENCH_EVT_NONE )
+        {
+            // The master is done or gone
+            Seq = Packets;
+            State = BENCH_ECHO;
+            BenchResponder( BENCH_EVT_TX_DONE );
+        }
+        break;
+    case BENCH_ECHO:
+        if( event == BENCH_EVT_NONE )
+        {
+            break;
+        }
+        if( ( Seq + 1 ) < Packets )
+        {
+            Radio.Rx( Idle );
+            State = BENCH_ECHO_WAIT;
+            break;
+        }
+        printf( "+BENCH:RX,%u,%u,%d,%d\r\n", Index, Result.Acked,
+                ( Result.Acked != 0 ) ? ( int )( Result.RssiSum / Result.Acked ) : 0,
+                ( Result.Acked != 0 ) ? ( int )( Result.SnrSum / Result.Acked ) : 0 );
+        BenchListen( );
+        break;
+    default:
+        break;
+    }
+}
+
+void LinkBenchStart( LinkBenchRole_t role, uint32_t freq, const LinkBenchSweep_t *sweep )
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    CyclesPerUs = rcc_get_clk_freq( RCC_HCLK ) / 1000000;
+
+    BenchRadioEvents.TxDone = OnBenchTxDone;
+    BenchRadioEvents.RxDone = OnBenchRxDone;
+    BenchRadioEvents.TxTimeout = OnBenchTxTimeout;
+    BenchRadioEvents.RxTimeout = OnBenchRxTimeout;
+    BenchRadioEvents.RxError = OnBenchRxError;
+    Radio.Init( &BenchRadioEvents );
+    Radio.SetChannel( freq );
+
+    Role = role;
+    Sweep = ( sweep != NULL ) ? sweep : &LinkBenchDefaultSweep;
+    Event = BENCH_EVT_NONE;
+    Index = 0;
+    Retries = 0;
+    if( role == LINK_BENCH_MASTER )
+    {
+        Count = Sweep->SfCount * Sweep->BwCount * Sweep->CrCount * Sweep->LenCount * Sweep->PowerCount;
+        Packets = Sweep->Packets;
+        State = BENCH_ANNOUNCE;
+        printf( "+BENCH:START,%u,%u,%u,%u\r\n", role, ( unsigned int )freq, Count, Packets );
+    }
+    else
+    {
+        printf( "+BENCH:START,%u,%u\r\n", role, ( unsigned int )freq );
+        BenchListen( );
+    }
+}
+
+bool LinkBenchProcess( void )
+{
+    LinkBenchEvent_t event;
+    uint32_t primask = __get_PRIMASK( );
+
+    __disable_irq( );
+    event = Event;
+    Event = BENCH_EVT_NONE;
+    __set_PRIMASK( primask );
+
+    if( Role == LINK_BENCH_MASTER )
+    {
+        return BenchMaster( event );
+    }
+    BenchResponder( event );
+    return State != BENCH_IDLE;
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*!
+ * \file      link-bench.h
+ *
+ * \brief     Radio link benchmark
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_LINK_BENCH
+ *
+ *            A master and a responder sweep the LoRa configurations of a
+ *            \ref LinkBenchSweep_t, every combination of SF, bandwidth,
+ *            coding rate, payload length and TX power. The master announces
+ *            each configuration on the control one, the responder
+ *            acknowledges it and both switch to it. The master then sends
+ *            the pings, the responder echoes each with the RSSI and SNR it
+ *            measured, and both go back to the control configuration. A
+ *            responder which hears nothing for three round trips goes back
+ *            on its own.
+ *
+ *            The master prints a line per configuration for the host:
+ *
+ *                +BENCH:<index>,<sf>,<bw>,<cr>,<len>,<power>,<sent>,<acked>,
+ *                       <per>,<rssi min>,<rssi avg>,<rssi max>,<snr min>,
+ *                       <snr avg>,<snr max>,<peer rssi avg>,<peer snr avg>,
+ *                       <rtt min>,<rtt avg>,<rtt max>,<goodput>
+ *
+ *            the packet error rate in per mille of the round trips, the
+ *            RSSI [dBm] and SNR [dB] of the echoes and, for the peer, of the
+ *            pings, the round trip latency [us] timed with the DWT cycle
+ *            counter from the send to the echo received, and the goodput
+ *            [bytes/s], the ping payloads echoed over the configuration
+ *            time. The responder prints +BENCH:RX,<index>,<received>,
+ *            <rssi avg>,<snr avg> as it leaves a configuration.
+ *
+ *            Built with CONFIG_LINK_BENCH.
+ *
+ * \{
+ */
+#ifndef __LINK_BENCH_H__
+#define __LINK_BENCH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * Control configuration, on which the configurations are announced
+ */
+#ifndef LINK_BENCH_CONTROL_SF
+#define LINK_BENCH_CONTROL_SF                       9
+#endif
+#ifndef LINK_BENCH_CONTROL_BW
+#define LINK_BENCH_CONTROL_BW                       0
+#endif
+#ifndef LINK_BENCH_CONTROL_POWER
+#define LINK_BENCH_CONTROL_POWER                    14
+#endif
+
+/*!
+ * Time from a frame received to the answer on the air, and margin of the
+ * reception timeouts [ms]
+ */
+#ifndef LINK_BENCH_TURNAROUND
+#define LINK_BENCH_TURNAROUND                       50
+#endif
+
+/*!
+ * Announcements of a configuration before it is skipped
+ */
+#ifndef LINK_BENCH_RETRIES
+#define LINK_BENCH_RETRIES                          3
+#endif
+
+/*!
+ * Shortest payload, the echo header
+ */
+#define LINK_BENCH_LEN_MIN                          8
+
+/*!
+ * \brief Roles
+ */
+typedef enum
+{
+    LINK_BENCH_RESPONDER = 0,
+    LINK_BENCH_MASTER,
+}LinkBenchRole_t;
+
+/*!
+ * \brief Configurations swept, every combination of the lists, the power
+ *        varying first
+ */
+typedef struct
+{
+    const uint8_t *Sf;          //!< [SF5..SF12]
+    uint8_t SfCount;
+    const uint8_t *Bw;          //!< [0: 125 kHz, 1: 250 kHz, 2: 500 kHz]
+    uint8_t BwCount;
+    const uint8_t *Cr;          //!< [1: 4/5, 2: 4/6, 3: 4/7, 4: 4/8]
+    uint8_t CrCount;
+    const uint8_t *Len;         //!< Payload lengths, from LINK_BENCH_LEN_MIN
+    uint8_t LenCount;
+    const int8_t *Power;        //!< TX powers [dBm]
+    uint8_t PowerCount;
+    uint8_t Packets;            //!< Pings per configuration
+}LinkBenchSweep_t;
+
+#ifdef CONFIG_LINK_BENCH
+
+/*!
+ * SF7 to SF12 on 125, 250 and 500 kHz, CR 4/5, 16, 64 and 128 bytes at 14
+ * and 22 dBm, 20 pings each
+ */
+extern const LinkBenchSweep_t LinkBenchDefaultSweep;
+
+/*!
+ * \brief Initializes the radio and starts the benchmark
+ *
+ * \param [IN] role    Role
+ * \param [IN] freq    Channel RF frequency [Hz]
+ * \param [IN] sweep   Configurations swept by the master, NULL for
+ *                     \ref LinkBenchDefaultSweep, unused by the responder
+ */
+void LinkBenchStart( LinkBenchRole_t role, uint32_t freq, const LinkBenchSweep_t *sweep );
+
+/*!
+ * \brief Runs the benchmark, from the main loop along Radio.IrqProcess
+ *
+ * \retval running     False once the master swept its configurations, the
+ *                     responder runs on
+ */
+bool LinkBenchProcess( void );
+
+#endif
+
+/*! \} defgroup LORA_LINK_BENCH */
+/*! \} addtogroup LORA */
+
+#endif // __LINK_BENCH_H__
@@ -0,0 +1,327 @@
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "tremo_cm4.h"
+#include "log.h"
+#include "mem-profile.h"
+#include "stats.h"
+#ifdef CONFIG_ITM_TRACE_LOG
+#include "itm-trace.h"
+#endif
+#ifdef CONFIG_WARM_BOOT_RETAINED
+#include "warm-boot.h"
+#endif
+
+#ifdef CONFIG_LOG
+
+extern int print_write(const uint8_t *data, size_t len);
+extern size_t print_room(void);
+
+#ifdef CONFIG_ITM_TRACE_LOG
+extern int print_vsnprintf(char *buffer, size_t count, const char *format, va_list va);
+
+/* the ITM waits for room, it never drops */
+#define log_write(port, data, len) ItmTraceWrite(port, data, len)
+#define log_room()                 SIZE_MAX
+#else
+#define log_write(port, data, len) print_write(data, len)
+#define log_room()                 print_room()
+#endif
+
+uint8_t g_log_module_mask[LOG_MODULE_NUM] = {
+    LL_ALL, LL_ALL, LL_ALL, LL_ALL, LL_ALL, LL_ALL
+};
+
+#ifdef CONFIG_LOG_DEFERRED
+
+/* Private define ------------------------------------------------------------*/
+#ifndef LOG_DEFERRED_STR_MAX
+#define LOG_DEFERRED_STR_MAX 32
+#endif
+/* record: sync, length, format address, arguments, check */
+#define LOG_RECORD_SYNC     0x1E
+#define LOG_RECORD_MAX      64
+#define LOG_RECORD_OVERHEAD 3
+
+#if (CONFIG_LOG_DEFERRED_BUF_SIZE & (CONFIG_LOG_DEFERRED_BUF_SIZE - 1)) != 0
+#error "CONFIG_LOG_DEFERRED_BUF_SIZE has to be a power of two"
+#endif
+
+/* Private variables ---------------------------------------------------------*/
+#ifdef CONFIG_WARM_BOOT_RETAINED
+/* the records not printed before a warm reset are printed after it */
+static uint8_t log_buf[CONFIG_LOG_DEFERRED_BUF_SIZE] RETAINED_ATTR;
+static uint16_t log_idx_w RETAINED_ATTR;
+static uint16_t log_idx_r RETAINED_ATTR;
+static bool log_restored = false;
+#else
+static uint8_t log_buf[CONFIG_LOG_DEFERRED_BUF_SIZE];
+static uint16_t log_idx_w = 0;
+static uint16_t log_idx_r = 0;
+#endif
+static uint32_t log_dropped = 0;
+
+/* Private functions ---------------------------------------------------------*/
+#ifdef CONFIG_WARM_BOOT_RETAINED
+/* empties the ring on a cold boot */
+static void log_restore(void)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    if (!WarmBootIsWarm() || log_idx_w >= CONFIG_LOG_DEFERRED_BUF_SIZE ||
+        log_idx_r >= CONFIG_LOG_DEFERRED_BUF_SIZE) {
+        log_idx_w = 0;
+        log_idx_r = 0;
+    }
+    log_restored = true;
+    __set_PRIMASK(primask);
+}
+#endif
+
+static uint8_t *log_put32(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+    return p + 4;
+}
+
+/* closes the record started at rec, up to end */
+static uint16_t log_close(uint8_t *rec, uint8_t *end)
+{
+    uint16_t len = end - rec;
+    uint8_t check = 0;
+
+    rec[0] = LOG_RECORD_SYNC;
+    rec[1] = len - LOG_RECORD_OVERHEAD;
+    for (uint16_t i = 1; i < len - 1; i++)
+        check += rec[i];
+    end[-1] = ~check;
+    return len;
+}
+
+static void log_push(const uint8_t *rec, uint16_t len)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+#ifdef CONFIG_WARM_BOOT_RETAINED
+    if (!log_restored)
+        log_restore();
+#endif
+    if (((log_idx_r - log_idx_w - 1) & (CONFIG_LOG_DEFERRED_BUF_SIZE - 1)) < len) {
+        log_dropped++;
+        STATS_INC(STATS_LOG_DROPPED);
+    } else {
+        for (uint16_t i = 0; i < len; i++) {
+            log_buf[log_idx_w] = rec[i];
+            log_idx_w = (log_idx_w + 1) & (CONFIG_LOG_DEFERRED_BUF_SIZE - 1);
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+/* Exported functions --------------------------------------------------------*/
+void log_deferred(const char *format, ...)
+{
+    uint8_t rec[LOG_RECORD_MAX];
+    uint8_t *p = log_put32(rec + 2, (uint32_t)format);
+    uint8_t *limit = rec + LOG_RECORD_MAX - 1;
+    const char *f = format;
+    va_list args;
+
+    // The arguments are taken as the format converts them, the decoder
+    // walks it the same way
+    va_start(args, format);
+    while (*f) {
+        bool wide = false;
+
+        if (*f++ != '%')
+            continue;
+        while (*f == '-' || *f == '+' || *f == ' ' || *f == '#' || *f == '0')
+            f++;
+        for (int field = 0; field < 2; field++) {
+            if (*f == '*') {
+                f++;
+                if (p + 4 > limit)
+                    goto out;
+                p = log_put32(p, va_arg(args, uint32_t));
+            } else {
+                while (*f >= '0' && *f <= '9')
+                    f++;
+            }
+            if (*f != '.')
+                break;
+            f++;
+        }
+        while (*f == 'h' || *f == 'l' || *f == 'z' || *f == 'j' || *f == 't') {
+            wide = (*f == 'j') || (*f == 'l' && f[1] == 'l') || wide;
+            f++;
+        }
+        switch (*f) {
+            case '\0':
+                goto out;
+            case '%':
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': {
+                double d = va_arg(args, double);
+                uint64_t bits;
+
+                if (p + 8 > limit)
+                    goto out;
+                memcpy(&bits, &d, sizeof(bits));
+                p = log_put32(log_put32(p, bits), bits >> 32);
+                break;
+            }
+            case 's': {
+                const char *s = va_arg(args, const char *);
+                uint8_t n = 0;
+
+                if (!s)
+                    s = "(null)";
+                while (s[n] && n < LOG_DEFERRED_STR_MAX && p + 1 + n < limit)
+                    n++;
+                if (p + 1 + n > limit)
+                    goto out;
+                *p++ = n;
+                memcpy(p, s, n);
+                p += n;
+                break;
+            }
+            default:
+                if (wide) {
+                    uint64_t v = va_arg(args, uint64_t);
+
+                    if (p + 8 > limit)
+                        goto out;
+                    p = log_put32(log_put32(p, v), v >> 32);
+                } else {
+                    if (p + 4 > limit)
+                        goto out;
+                    p = log_put32(p, va_arg(args, uint32_t));
+                }
+                break;
+        }
+        f++;
+    }
+out:
+    va_end(args);
+    log_push(rec, log_close(rec, p + 1));
+}
+
+void log_deferred_flush(void)
+{
+    uint8_t rec[LOG_RECORD_MAX];
+    uint16_t len;
+
+#ifdef CONFIG_WARM_BOOT_RETAINED
+    if (!log_restored)
+        log_restore();
+#endif
+    if (log_dropped && log_room() >= 4 + LOG_RECORD_OVERHEAD + 4) {
+        // Format address 0: records lost on a full buffer
+        uint32_t primask = __get_PRIMASK();
+        uint32_t dropped;
+
+        __disable_irq();
+        dropped = log_dropped;
+        log_dropped = 0;
+        __set_PRIMASK(primask);
+        uint8_t *p = log_put32(log_put32(rec + 2, 0), dropped);
+        log_write(ITM_TRACE_PORT_LOG, rec, log_close(rec, p + 1));
+    }
+
+    // Whole records only, the print queue drops what does not fit
+    while (log_idx_r != log_idx_w) {
+        len = log_buf[(log_idx_r + 1) & (CONFIG_LOG_DEFERRED_BUF_SIZE - 1)] + LOG_RECORD_OVERHEAD;
+        if (log_room() < len)
+            break;
+        for (uint16_t i = 0; i < len; i++) {
+            rec[i] = log_buf[(log_idx_r + i) & (CONFIG_LOG_DEFERRED_BUF_SIZE - 1)];
+        }
+        log_idx_r = (log_idx_r + len) & (CONFIG_LOG_DEFERRED_BUF_SIZE - 1);
+        log_write(ITM_TRACE_PORT_LOG, rec, len);
+    }
+}
+
+#elif defined(CONFIG_ITM_TRACE_LOG)
+
+void log_printf(const char *format, ...)
+{
+    char line[LOG_ITM_LINE_MAX];
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    len = print_vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len <= 0)
+        return;
+    if (len >= (int)sizeof(line))
+        len = sizeof(line) - 1;
+    ItmTraceWrite(ITM_TRACE_PORT_TEXT, (const uint8_t *)line, len);
+}
+
+#endif
+
+#endif
+
+/* Formatters ----------------------------------------------------------------*/
+static const char log_hex_digits[16] = "0123456789ABCDEF";
+
+size_t log_fmt_dec(char *buf, int32_t value)
+{
+    char tmp[10];
+    uint32_t magnitude = (value < 0) ? 0 - (uint32_t)value : (uint32_t)value;
+    size_t len = 0;
+    size_t n = 0;
+
+    do {
+        tmp[n++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0)
+        buf[len++] = '-';
+    while (n)
+        buf[len++] = tmp[--n];
+    return len;
+}
+
+size_t log_fmt_hex(char *buf, uint32_t value, uint8_t digits)
+{
+    for (uint8_t i = digits; i > 0; i--) {
+        buf[i - 1] = log_hex_digits[value & 0x0F];
+        value >>= 4;
+    }
+    return digits;
+}
+
+#ifdef CONFIG_LOG
+void log_hex(const uint8_t *data, size_t len)
+{
+#ifdef CONFIG_LOG_DEFERRED
+    // A %s record per chunk, ordered with the other records
+    char chunk[LOG_DEFERRED_STR_MAX / 3 * 3 + 1];
+#else
+    char chunk[LOG_HEX_CHUNK * 3];
+#endif
+    size_t n = 0;
+
+    while (len--) {
+        log_fmt_hex(chunk + n, *data++, 2);
+        chunk[n + 2] = ' ';
+        n += 3;
+        if (n + 3 > sizeof(chunk) || !len) {
+#ifdef CONFIG_LOG_DEFERRED
+            chunk[n] = '\0';
+            log_deferred("%s", chunk);
+#else
+            log_write(ITM_TRACE_PORT_TEXT, (const uint8_t *)chunk, n);
+#endif
+            n = 0;
+        }
+    }
+}
+#endif
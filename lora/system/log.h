@@ -10,6 +10,7 @@ extern "C" {
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
@@ -24,16 +25,113 @@ typedef enum __log_level_t {
     LL_ALL    = 0x0F 
 } log_level_t;
 
+/* A source file sets LOG_MODULE before its includes, LOG_MODULE_APP otherwise */
+#define LOG_MODULE_APP    0
+#define LOG_MODULE_MAC    1
+#define LOG_MODULE_REGION 2
+#define LOG_MODULE_RADIO  3
+#define LOG_MODULE_LWAN   4
+#define LOG_MODULE_AT     5
+#define LOG_MODULE_NUM    6
+
+#ifndef LOG_MODULE
+#define LOG_MODULE LOG_MODULE_APP
+#endif
+
+/* Most verbose level built in per module, e.g. -DCONFIG_LOG_LEVEL_MAC=LL_WARN
+   in $(PROJECT)_DEFINES; the calls above it are compiled out */
+#ifndef CONFIG_LOG_LEVEL_APP
+#define CONFIG_LOG_LEVEL_APP LL_VDEBUG
+#endif
+#ifndef CONFIG_LOG_LEVEL_MAC
+#define CONFIG_LOG_LEVEL_MAC LL_VDEBUG
+#endif
+#ifndef CONFIG_LOG_LEVEL_REGION
+#define CONFIG_LOG_LEVEL_REGION LL_VDEBUG
+#endif
+#ifndef CONFIG_LOG_LEVEL_RADIO
+#define CONFIG_LOG_LEVEL_RADIO LL_VDEBUG
+#endif
+#ifndef CONFIG_LOG_LEVEL_LWAN
+#define CONFIG_LOG_LEVEL_LWAN LL_VDEBUG
+#endif
+#ifndef CONFIG_LOG_LEVEL_AT
+#define CONFIG_LOG_LEVEL_AT LL_VDEBUG
+#endif
+
+#define LOG_LEVEL_MASK(level) ((level) ? ((level) << 1) - 1 : 0)
+#define LOG_BUILT_MASK(module)                                              \
+    LOG_LEVEL_MASK((module) == LOG_MODULE_MAC    ? CONFIG_LOG_LEVEL_MAC :    \
+                   (module) == LOG_MODULE_REGION ? CONFIG_LOG_LEVEL_REGION : \
+                   (module) == LOG_MODULE_RADIO  ? CONFIG_LOG_LEVEL_RADIO :  \
+                   (module) == LOG_MODULE_LWAN   ? CONFIG_LOG_LEVEL_LWAN :   \
+                   (module) == LOG_MODULE_AT     ? CONFIG_LOG_LEVEL_AT :     \
+                                                   CONFIG_LOG_LEVEL_APP)
+
+
+/* Longest LOG_PRINTF line sent to the ITM, the rest cut */
+#ifndef LOG_ITM_LINE_MAX
+#define LOG_ITM_LINE_MAX 128
+#endif
+
+/* Bytes of a hex dump converted per write */
+#ifndef LOG_HEX_CHUNK
+#define LOG_HEX_CHUNK 32
+#endif
+
+/* One pass conversions into buf, without the terminating 0; they return the
+   length, up to 11 characters for a decimal and digits for a hex */
+size_t log_fmt_dec(char *buf, int32_t value);
+size_t log_fmt_hex(char *buf, uint32_t value, uint8_t digits);
 
 #ifdef CONFIG_LOG
 
 extern log_level_t g_log_level;
-
+/* runtime masks of the modules, all levels by default */
+extern uint8_t g_log_module_mask[LOG_MODULE_NUM];
+
+#define LOG_ENABLED(level)                                  \
+    ((LOG_BUILT_MASK(LOG_MODULE) & (level)) &&              \
+     (g_log_level & g_log_module_mask[LOG_MODULE] & (level)))
+
+#ifdef CONFIG_LOG_DEFERRED
+/* Records the format address and the raw arguments, formatted on the host by
+   build/scripts/log_decode.py from the ELF image. The format has to be a
+   string literal; %s strings are copied, up to LOG_DEFERRED_STR_MAX bytes */
+void log_deferred(const char *format, ...);
+/* Sends the records through the print channel, from the main loop */
+void log_deferred_flush(void);
+
+#define LOG_PRINTF(level, ...)         \
+    do {                               \
+        if (LOG_ENABLED(level))        \
+            log_deferred(__VA_ARGS__); \
+    } while (0)
+#elif defined(CONFIG_ITM_TRACE_LOG)
+/* Formats into a line sent to ITM_TRACE_PORT_TEXT, see itm-trace.h */
+void log_printf(const char *format, ...);
+
+#define LOG_PRINTF(level, ...)       \
+    do {                             \
+        if (LOG_ENABLED(level))      \
+            log_printf(__VA_ARGS__); \
+    } while (0)
+#else
 #define LOG_PRINTF(level, ...)   \
     do {                         \
-        if (g_log_level & level) \
+        if (LOG_ENABLED(level))  \
             printf(__VA_ARGS__); \
     } while (0)
+#endif
+
+/* Prints the bytes as "XX " each, converted in chunks without a format parse */
+void log_hex(const uint8_t *data, size_t len);
+
+#define LOG_HEX(level, data, len)    \
+    do {                             \
+        if (LOG_ENABLED(level))      \
+            log_hex(data, len);      \
+    } while (0)
 
 static inline int log_get_level()
 {
@@ -45,9 +143,21 @@ static inline void log_set_level(int level)
     g_log_level = level>LL_ALL?LL_ALL:level;
 }
 
+static inline int log_get_module_mask(int module)
+{
+    return (module >= 0 && module < LOG_MODULE_NUM) ? g_log_module_mask[module] : 0;
+}
+
+static inline void log_set_module_mask(int module, int mask)
+{
+    if (module >= 0 && module < LOG_MODULE_NUM)
+        g_log_module_mask[module] = mask & LL_ALL;
+}
+
 #else
 
 #define LOG_PRINTF(level, ...)
+#define LOG_HEX(level, data, len)
 
 static inline int log_get_level(void)
 {
@@ -59,6 +169,22 @@ static inline void log_set_level(int level)
     (void)level;
 }
 
+static inline int log_get_module_mask(int module)
+{
+    (void)module;
+    return 0;
+}
+
+static inline void log_set_module_mask(int module, int mask)
+{
+    (void)module;
+    (void)mask;
+}
+
+#endif
+
+#if !defined(CONFIG_LOG) || !defined(CONFIG_LOG_DEFERRED)
+#define log_deferred_flush()
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,189 @@
+/*!
+ * \file      mem-profile.h
+ *
+ * \brief     RAM sizing of the stack buffers
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_MEM_PROFILE
+ *
+ *            One place for the sizes the MAC, radio, timer, event queue, log
+ *            and AT layer derive their static buffers from. The default
+ *            profile fits the largest frames and the busiest applications.
+ *            CONFIG_MEM_PROFILE_TINY fits frames up to 64 bytes, two
+ *            multicast groups, short queues and small pools, and frees about
+ *            3 KB. Each
+ *            size can still be set on its own with -D.
+ *
+ * \{
+ */
+#ifndef __MEM_PROFILE_H__
+#define __MEM_PROFILE_H__
+
+#ifdef CONFIG_MEM_PROFILE_TINY
+
+/*!
+ * Maximum PHY layer payload size, longer downlinks are dropped by the radio
+ */
+#ifndef LORAMAC_PHY_MAXPAYLOAD
+#define LORAMAC_PHY_MAXPAYLOAD                      64
+#endif
+
+/*!
+ * Maximum number of linked multicast channels
+ */
+#ifndef LORAMAC_MULTICAST_MAX
+#define LORAMAC_MULTICAST_MAX                       2
+#endif
+
+/*!
+ * Uplinks held by the MAC transmit queue, CONFIG_LORAMAC_TX_QUEUE
+ */
+#ifndef LORAMAC_TX_QUEUE_SIZE
+#define LORAMAC_TX_QUEUE_SIZE                       2
+#endif
+
+/*!
+ * Maximum number of timers running at the same time, CONFIG_TIMER_HEAP
+ */
+#ifndef TIMER_HEAP_SIZE
+#define TIMER_HEAP_SIZE                             16
+#endif
+
+/*!
+ * Number of queued events, power of 2
+ */
+#ifndef EVENT_QUEUE_SIZE
+#define EVENT_QUEUE_SIZE                            16
+#endif
+
+/*!
+ * Ring of the deferred log records, power of 2
+ */
+#ifndef CONFIG_LOG_DEFERRED_BUF_SIZE
+#define CONFIG_LOG_DEFERRED_BUF_SIZE                256
+#endif
+
+/*!
+ * Ring of the AT bytes waiting for the main loop, power of 2
+ */
+#ifndef CONFIG_LWAN_AT_RX_RING_SIZE
+#define CONFIG_LWAN_AT_RX_RING_SIZE                 128
+#endif
+
+/*!
+ * Queue of the unsolicited AT results, power of 2
+ */
+#ifndef CONFIG_LWAN_AT_URC_QUEUE_SIZE
+#define CONFIG_LWAN_AT_URC_QUEUE_SIZE               128
+#endif
+
+/*!
+ * Blocks of each class of the fixed block pool, 32 at most
+ */
+#ifndef POOL_SMALL_COUNT
+#define POOL_SMALL_COUNT                            8
+#endif
+
+#ifndef POOL_MEDIUM_COUNT
+#define POOL_MEDIUM_COUNT                           4
+#endif
+
+#ifndef POOL_LARGE_COUNT
+#define POOL_LARGE_COUNT                            2
+#endif
+
+#else
+
+#ifndef LORAMAC_PHY_MAXPAYLOAD
+#define LORAMAC_PHY_MAXPAYLOAD                      255
+#endif
+
+#ifndef LORAMAC_MULTICAST_MAX
+#define LORAMAC_MULTICAST_MAX                       16
+#endif
+
+#ifndef LORAMAC_TX_QUEUE_SIZE
+#define LORAMAC_TX_QUEUE_SIZE                       4
+#endif
+
+#ifndef TIMER_HEAP_SIZE
+#define TIMER_HEAP_SIZE                             32
+#endif
+
+#ifndef EVENT_QUEUE_SIZE
+#define EVENT_QUEUE_SIZE                            32
+#endif
+
+#ifndef CONFIG_LOG_DEFERRED_BUF_SIZE
+#define CONFIG_LOG_DEFERRED_BUF_SIZE                1024
+#endif
+
+#ifndef CONFIG_LWAN_AT_RX_RING_SIZE
+#define CONFIG_LWAN_AT_RX_RING_SIZE                 512
+#endif
+
+#ifndef CONFIG_LWAN_AT_URC_QUEUE_SIZE
+#define CONFIG_LWAN_AT_URC_QUEUE_SIZE               512
+#endif
+
+#ifndef POOL_SMALL_COUNT
+#define POOL_SMALL_COUNT                            16
+#endif
+
+#ifndef POOL_MEDIUM_COUNT
+#define POOL_MEDIUM_COUNT                           8
+#endif
+
+#ifndef POOL_LARGE_COUNT
+#define POOL_LARGE_COUNT                            4
+#endif
+
+#endif
+
+/*!
+ * Maximum application payload size: the PHY payload less MHDR, FHDR
+ * without options, FPort and MIC
+ */
+#ifndef LORAWAN_APP_DATA_BUFF_SIZE
+#define LORAWAN_APP_DATA_BUFF_SIZE                  ( LORAMAC_PHY_MAXPAYLOAD - 13 )
+#endif
+
+/*!
+ * Maximum payload size of an uplink held by the MAC transmit queue
+ */
+#ifndef LORAMAC_TX_QUEUE_PAYLOAD_SIZE
+#define LORAMAC_TX_QUEUE_PAYLOAD_SIZE               ( ( LORAWAN_APP_DATA_BUFF_SIZE < 64 ) ? LORAWAN_APP_DATA_BUFF_SIZE : 64 )
+#endif
+
+/*!
+ * AT command line, long enough for the hex payload of the largest uplink
+ */
+#ifndef LWAN_AT_LINE_SIZE
+#define LWAN_AT_LINE_SIZE                           ( LORAWAN_APP_DATA_BUFF_SIZE * 2 + 18 )
+#endif
+
+/*!
+ * Block sizes of the fixed block pool: events and short AT responses, MAC
+ * commands and short uplinks, whole frames
+ */
+#ifndef POOL_SMALL_SIZE
+#define POOL_SMALL_SIZE                             16
+#endif
+
+#ifndef POOL_MEDIUM_SIZE
+#define POOL_MEDIUM_SIZE                            64
+#endif
+
+#ifndef POOL_LARGE_SIZE
+#define POOL_LARGE_SIZE                             LORAMAC_PHY_MAXPAYLOAD
+#endif
+
+/*! \} defgroup LORA_MEM_PROFILE */
+/*! \} addtogroup LORA */
+
+#endif // __MEM_PROFILE_H__
@@ -0,0 +1,500 @@
+/*!
+ * \file      payload-codec.c
+ *
+ * \brief     Table driven compression of the telemetry records
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <string.h>
+#include "payload-codec.h"
+
+typedef struct
+{
+    uint8_t *Buf;
+    uint16_t Size;                  // Bits
+    uint16_t Pos;                   // Bits
+}BitStream_t;
+
+/*!
+ * Writes the low n bits of value, the high bit first
+ */
+static bool BitPut( BitStream_t *s, uint32_t value, uint8_t n )
+{
+    uint8_t free;
+    uint8_t take;
+
+    if( ( uint32_t )s->Pos + n > s->Size )
+    {
+        return false;
+    }
+    while( n > 0 )
+    {
+        free = 8 - ( s->Pos & 7 );
+        take = ( n < free ) ? n : free;
+        n -= take;
+        if( free == 8 )
+        {
+            s->Buf[s->Pos >> 3] = 0;
+        }
+        s->Buf[s->Pos >> 3] |= ( uint8_t )( ( ( value >> n ) & ( ( 1U << take ) - 1 ) ) << ( free - take ) );
+        s->Pos += take;
+    }
+    return true;
+}
+
+static bool BitGet( BitStream_t *s, uint8_t n, uint32_t *value )
+{
+    uint8_t left;
+    uint8_t take;
+    uint32_t v = 0;
+
+    if( ( uint32_t )s->Pos + n > s->Size )
+    {
+        return false;
+    }
+    while( n > 0 )
+    {
+        left = 8 - ( s->Pos & 7 );
+        take = ( n < left ) ? n : left;
+        n -= take;
+        v = ( v << take ) | ( ( s->Buf[s->Pos >> 3] >> ( left - take ) ) & ( ( 1U << take ) - 1 ) );
+        s->Pos += take;
+    }
+    *value = v;
+    return true;
+}
+
+/*!
+ * Zigzag varint of groups of group bits, the low group first, each followed
+ * by a bit set when another group follows
+ */
+static bool VarintPut( BitStream_t *s, uint32_t delta, uint8_t group )
+{
+    uint32_t zz = ( delta << 1 ) ^ ( uint32_t )( ( int32_t )delta >> 31 );
+
+    if( group == 0 )
+    {
+        return false;
+    }
+    do
+    {
+        if( BitPut( s, zz, group ) == false )
+        {
+            return false;
+        }
+        zz = ( group < 32 ) ? ( zz >> group ) : 0;
+        if( BitPut( s, ( zz != 0 ) ? 1 : 0, 1 ) == false )
+        {
+            return false;
+        }
+    }while( zz != 0 );
+    return true;
+}
+
+static bool VarintGet( BitStream_t *s, uint8_t group, uint32_t *delta )
+{
+    uint32_t zz = 0;
+    uint32_t v;
+    uint32_t more;
+    uint8_t shift = 0;
+
+    do
+    {
+        if( ( group == 0 ) || ( shift >= 32 ) || ( BitGet( s, group, &v ) == false ) || ( BitGet( s, 1, &more ) == false ) )
+        {
+            return false;
+        }
+        zz |= v << shift;
+        shift += group;
+    }while( more != 0 );
+
+    *delta = ( zz >> 1 ) ^ ( uint32_t )-( int32_t )( zz & 1 );
+    return true;
+}
+
+/*!
+ * Number of bits of the positions of the LZ window, the dictionary then the
+ * array
+ */
+static uint8_t LzPosBits( const PayloadCodecField_t *field )
+{
+    uint16_t window = field->DictSize + field->Size;
+    uint8_t bits = 1;
+
+    while( ( 1U << bits ) < window )
+    {
+        bits++;
+    }
+    return bits;
+}
+
+static inline uint8_t LzAt( const PayloadCodecField_t *field, const uint8_t *data, uint16_t pos )
+{
+    return ( pos < field->DictSize ) ? field->Dict[pos] : data[pos - field->DictSize];
+}
+
+/*!
+ * Greedy LZ: a set bit then the position and length of the longest match,
+ * or a clear bit then a literal. A match in the array may run over the
+ * bytes it copies.
+ */
+static bool LzPut( BitStream_t *s, const PayloadCodecField_t *field, const uint8_t *data )
+{
+    const uint8_t lenMax = PAYLOAD_CODEC_LZ_LEN_MIN + ( 1 << PAYLOAD_CODEC_LZ_LEN_BITS ) - 1;
+    uint8_t posBits = LzPosBits( field );
+    uint16_t i = 0;
+    uint16_t cur;
+    uint16_t pos;
+    uint16_t bestPos;
+    uint8_t bestLen;
+    uint8_t len;
+
+    while( i < field->Size )
+    {
+        cur = field->DictSize + i;
+        bestLen = 0;
+        bestPos = 0;
+        for( pos = 0; pos < cur; pos++ )
+        {
+            len = 0;
+            while( ( len < lenMax ) && ( i + len < field->Size ) &&
+                   ( LzAt( field, data, pos + len ) == data[i + len] ) )
+            {
+                len++;
+            }
+            if( len > bestLen )
+            {
+                bestLen = len;
+                bestPos = pos;
+            }
+        }
+
+        if( bestLen >= PAYLOAD_CODEC_LZ_LEN_MIN )
+        {
+            if( ( BitPut( s, 1, 1 ) == false ) || ( BitPut( s, bestPos, posBits ) == false ) ||
+                ( BitPut( s, bestLen - PAYLOAD_CODEC_LZ_LEN_MIN, PAYLOAD_CODEC_LZ_LEN_BITS ) == false ) )
+            {
+                return false;
+            }
+            i += bestLen;
+        }
+        else
+        {
+            if( ( BitPut( s, 0, 1 ) == false ) || ( BitPut( s, data[i], 8 ) == false ) )
+            {
+                return false;
+            }
+            i++;
+        }
+    }
+    return true;
+}
+
+static bool LzGet( BitStream_t *s, const PayloadCodecField_t *field, uint8_t *data )
+{
+    uint8_t posBits = LzPosBits( field );
+    uint16_t i = 0;
+    uint32_t match;
+    uint32_t pos;
+    uint32_t len;
+
+    while( i < field->Size )
+    {
+        if( BitGet( s, 1, &match ) == false )
+        {
+            return false;
+        }
+        if( match != 0 )
+        {
+            if( ( BitGet( s, posBits, &pos ) == false ) ||
+                ( BitGet( s, PAYLOAD_CODEC_LZ_LEN_BITS, &len ) == false ) )
+            {
+                return false;
+            }
+            len += PAYLOAD_CODEC_LZ_LEN_MIN;
+            if( ( pos >= field->DictSize + i ) || ( i + len > field->Size ) )
+            {
+                return false;
+            }
+            while( len-- > 0 )
+            {
+                data[i] = LzAt( field, data, pos++ );
+                i++;
+            }
+        }
+        else
+        {
+            if( BitGet( s, 8, &pos ) == false )
+            {
+                return false;
+            }
+            data[i++] = ( uint8_t )pos;
+        }
+    }
+    return true;
+}
+
+static uint32_t FieldRead( const PayloadCodecField_t *field, const uint8_t *record )
+{
+    const uint8_t *p = record + field->Offset;
+
+    switch( field->Size )
+    {
+        case 1:
+            return field->Signed ? ( uint32_t )( int32_t )*( const int8_t * )p : *p;
+        case 2:
+        {
+            uint16_t v;
+            memcpy( &v, p, sizeof( v ) );
+            return field->Signed ? ( uint32_t )( int32_t )( int16_t )v : v;
+        }
+        default:
+        {
+            uint32_t v;
+            memcpy( &v, p, sizeof( v ) );
+            return v;
+        }
+    }
+}
+
+static void FieldWrite( const PayloadCodecField_t *field, uint8_t *record, uint32_t value )
+{
+    uint8_t *p = record + field->Offset;
+
+    switch( field->Size )
+    {
+        case 1:
+            *p = ( uint8_t )value;
+            break;
+        case 2:
+        {
+            uint16_t v = ( uint16_t )value;
+            memcpy( p, &v, sizeof( v ) );
+            break;
+        }
+        default:
+            memcpy( p, &value, sizeof( value ) );
+            break;
+    }
+}
+
+/*!
+ * Change coded for an integer, the history updated
+ */
+static uint32_t DeltaOf( const PayloadCodecField_t *field, PayloadCodecState_t *state, uint8_t f, uint32_t value )
+{
+    uint32_t delta = value - state->Prev[f];
+    uint32_t coded = delta;
+
+    if( field->Mode == PAYLOAD_CODEC_DELTA2 )
+    {
+        // The first record of a key frame has no change to compare with
+        coded = delta - state->PrevDelta[f];
+        if( state->Depth > 0 )
+        {
+            state->PrevDelta[f] = delta;
+        }
+    }
+    state->Prev[f] = value;
+    return coded;
+}
+
+static uint32_t ValueOf( const PayloadCodecField_t *field, PayloadCodecState_t *state, uint8_t f, uint32_t coded )
+{
+    uint32_t delta = coded;
+
+    if( field->Mode == PAYLOAD_CODEC_DELTA2 )
+    {
+        delta = coded + state->PrevDelta[f];
+        if( state->Depth > 0 )
+        {
+            state->PrevDelta[f] = delta;
+        }
+    }
+    state->Prev[f] += delta;
+    return state->Prev[f];
+}
+
+static void HistoryReset( PayloadCodecState_t *state )
+{
+    memset( state->Prev, 0, sizeof( state->Prev ) );
+    memset( state->PrevDelta, 0, sizeof( state->PrevDelta ) );
+    state->Depth = 0;
+    state->Frames = 0;
+}
+
+void PayloadCodecInit( PayloadCodecState_t *state, uint16_t keyInterval )
+{
+    HistoryReset( state );
+    state->KeyInterval = keyInterval;
+    state->Synced = false;
+}
+
+void PayloadCodecKey( PayloadCodecState_t *state )
+{
+    state->Synced = false;
+}
+
+uint8_t PayloadCodecEncode( const PayloadCodecSchema_t *schema, PayloadCodecState_t *state,
+                            const void *records, uint8_t count, uint8_t *frame, uint8_t size )
+{
+    PayloadCodecState_t next = *state;
+    BitStream_t s = { frame, ( uint16_t )size * 8, 0 };
+    const PayloadCodecField_t *field;
+    const uint8_t *record = records;
+    bool key;
+    uint8_t r;
+    uint8_t f;
+    uint32_t value;
+    bool ok = true;
+
+    if( ( count == 0 ) || ( count > PAYLOAD_CODEC_RECORDS_MAX ) || ( schema->FieldsNb > PAYLOAD_CODEC_FIELDS_MAX ) )
+    {
+        return 0;
+    }
+
+    key = ( next.Synced == false ) || ( ( next.KeyInterval != 0 ) && ( next.Frames >= next.KeyInterval ) );
+    if( key == true )
+    {
+        HistoryReset( &next );
+    }
+    ok = BitPut( &s, key ? 1 : 0, 1 ) && BitPut( &s, count - 1, 3 );
+
+    for( r = 0; ( r < count ) && ( ok == true ); r++, record += schema->RecordSize )
+    {
+        for( f = 0; ( f < schema->FieldsNb ) && ( ok == true ); f++ )
+        {
+            field = &schema->Fields[f];
+            switch( field->Mode )
+            {
+                case PAYLOAD_CODEC_RAW:
+                    ok = BitPut( &s, FieldRead( field, record ), field->Bits );
+                    break;
+                case PAYLOAD_CODEC_DELTA:
+                case PAYLOAD_CODEC_DELTA2:
+                    value = DeltaOf( field, &next, f, FieldRead( field, record ) );
+                    ok = VarintPut( &s, value, field->Bits );
+                    break;
+                case PAYLOAD_CODEC_BYTES:
+                    for( value = 0; ( value < field->Size ) && ( ok == true ); value++ )
+                    {
+                        ok = BitPut( &s, record[field->Offset + value], 8 );
+                    }
+                    break;
+                case PAYLOAD_CODEC_LZ:
+                    ok = LzPut( &s, field, record + field->Offset );
+                    break;
+                default:
+                    ok = false;
+                    break;
+            }
+        }
+        if( next.Depth < 2 )
+        {
+            next.Depth++;
+        }
+    }
+    if( ok == false )
+    {
+        return 0;
+    }
+
+    if( next.Frames < UINT16_MAX )
+    {
+        next.Frames++;
+    }
+    next.Synced = true;
+    *state = next;
+    return ( uint8_t )( ( s.Pos + 7 ) / 8 );
+}
+
+uint8_t PayloadCodecDecode( const PayloadCodecSchema_t *schema, PayloadCodecState_t *state,
+                            const uint8_t *frame, uint8_t size, void *records, uint8_t countMax )
+{
+    PayloadCodecState_t next = *state;
+    BitStream_t s = { ( uint8_t * )frame, ( uint16_t )size * 8, 0 };
+    const PayloadCodecField_t *field;
+    uint8_t *record = records;
+    uint32_t key;
+    uint32_t count;
+    uint32_t value;
+    uint8_t r;
+    uint8_t f;
+    bool ok;
+
+    if( ( BitGet( &s, 1, &key ) == false ) || ( BitGet( &s, 3, &count ) == false ) )
+    {
+        return 0;
+    }
+    count++;
+    if( key != 0 )
+    {
+        HistoryReset( &next );
+    }
+    else if( next.Synced == false )
+    {
+        return 0;
+    }
+    if( ( count > countMax ) || ( schema->FieldsNb > PAYLOAD_CODEC_FIELDS_MAX ) )
+    {
+        return 0;
+    }
+
+    ok = true;
+    for( r = 0; ( r < count ) && ( ok == true ); r++, record += schema->RecordSize )
+    {
+        for( f = 0; ( f < schema->FieldsNb ) && ( ok == true ); f++ )
+        {
+            field = &schema->Fields[f];
+            switch( field->Mode )
+            {
+                case PAYLOAD_CODEC_RAW:
+                    ok = BitGet( &s, field->Bits, &value );
+                    if( ( field->Signed == true ) && ( field->Bits < 32 ) && ( ( value >> ( field->Bits - 1 ) ) & 1 ) )
+                    {
+                        value |= ~( ( 1U << field->Bits ) - 1 );
+                    }
+                    FieldWrite( field, record, value );
+                    break;
+                case PAYLOAD_CODEC_DELTA:
+                case PAYLOAD_CODEC_DELTA2:
+                    ok = VarintGet( &s, field->Bits, &value );
+                    if( ok == true )
+                    {
+                        FieldWrite( field, record, ValueOf( field, &next, f, value ) );
+                    }
+                    break;
+                case PAYLOAD_CODEC_BYTES:
+                    for( value = 0; ( value < field->Size ) && ( ok == true ); value++ )
+                    {
+                        uint32_t byte;
+                        ok = BitGet( &s, 8, &byte );
+                        record[field->Offset + value] = ( uint8_t )byte;
+                    }
+                    break;
+                case PAYLOAD_CODEC_LZ:
+                    ok = LzGet( &s, field, record + field->Offset );
+                    break;
+                default:
+                    ok = false;
+                    break;
+            }
+        }
+        if( next.Depth < 2 )
+        {
+            next.Depth++;
+        }
+    }
+    if( ok == false )
+    {
+        return 0;
+    }
+
+    if( next.Frames < UINT16_MAX )
+    {
+        next.Frames++;
+    }
+    next.Synced = true;
+    *state = next;
+    return ( uint8_t )count;
+}
@@ -0,0 +1,206 @@
+/*!
+ * \file      payload-codec.h
+ *
+ * \brief     Table driven compression of the telemetry records
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_PAYLOAD_CODEC
+ *
+ *            A schema lists the fields of a record structure as const
+ *            descriptors, each with its coding:
+ *
+ *            - PAYLOAD_CODEC_RAW, the low Bits bits of the value
+ *            - PAYLOAD_CODEC_DELTA, the change since the previous record
+ *            - PAYLOAD_CODEC_DELTA2, the change of the change, for counters
+ *              and values ramping at a steady rate
+ *            - PAYLOAD_CODEC_BYTES, a byte array as it is
+ *            - PAYLOAD_CODEC_LZ, a byte array as matches in a static
+ *              dictionary and in the array itself, and literals
+ *
+ *            The changes are zigzag varints of Bits bit groups, a change of
+ *            zero taking Bits + 1 bits. The frame is a bit stream: the key
+ *            flag, the number of records less one on 3 bits, then the
+ *            fields of each record in turn. Nothing is allocated, the
+ *            history of the deltas is the \ref PayloadCodecState_t of the
+ *            caller, one per stream on each side.
+ *
+ *            A key frame starts the history again, the decoder of a
+ *            stream having lost frames waits for the next one: the first
+ *            frame, then every KeyInterval frames.
+ *
+ * \code
+ * typedef struct
+ * {
+ *     uint32_t Energy;
+ *     int16_t Temperature;
+ *     uint8_t Battery;
+ * }Record_t;
+ *
+ * static const PayloadCodecField_t RecordFields[] =
+ * {
+ *     PAYLOAD_CODEC_INT( Record_t, Energy, PAYLOAD_CODEC_DELTA2, 3 ),
+ *     PAYLOAD_CODEC_INT( Record_t, Temperature, PAYLOAD_CODEC_DELTA, 2 ),
+ *     PAYLOAD_CODEC_INT( Record_t, Battery, PAYLOAD_CODEC_RAW, 7 ),
+ * };
+ * static const PayloadCodecSchema_t RecordSchema = PAYLOAD_CODEC_SCHEMA( Record_t, RecordFields );
+ * \endcode
+ *
+ * \{
+ */
+#ifndef __PAYLOAD_CODEC_H__
+#define __PAYLOAD_CODEC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*!
+ * Most fields of a schema, the size of the history
+ */
+#ifndef PAYLOAD_CODEC_FIELDS_MAX
+#define PAYLOAD_CODEC_FIELDS_MAX                    16
+#endif
+
+/*!
+ * Most records of a frame
+ */
+#define PAYLOAD_CODEC_RECORDS_MAX                   8
+
+/*!
+ * Length bits of an LZ match, the matches being 3 to 18 bytes
+ */
+#define PAYLOAD_CODEC_LZ_LEN_BITS                   4
+#define PAYLOAD_CODEC_LZ_LEN_MIN                    3
+
+/*!
+ * Field codings
+ */
+typedef enum
+{
+    PAYLOAD_CODEC_RAW = 0,
+    PAYLOAD_CODEC_DELTA,
+    PAYLOAD_CODEC_DELTA2,
+    PAYLOAD_CODEC_BYTES,
+    PAYLOAD_CODEC_LZ,
+}PayloadCodecMode_t;
+
+/*!
+ * Field of a record
+ */
+typedef struct
+{
+    uint8_t Offset;                 //!< Offset in the record
+    uint8_t Size;                   //!< 1, 2 or 4 for the integers, the array size
+    uint8_t Mode;                   //!< \ref PayloadCodecMode_t
+    uint8_t Bits;                   //!< Width of a raw value, of a varint group
+    bool Signed;                    //!< Raw value sign extended by the decoder
+    uint8_t DictSize;
+    const uint8_t *Dict;            //!< LZ static dictionary
+}PayloadCodecField_t;
+
+/*!
+ * Record structure
+ */
+typedef struct
+{
+    const PayloadCodecField_t *Fields;
+    uint8_t FieldsNb;
+    uint8_t RecordSize;             //!< sizeof the record, the stride of the arrays
+}PayloadCodecSchema_t;
+
+/*!
+ * History of a stream
+ */
+typedef struct
+{
+    uint32_t Prev[PAYLOAD_CODEC_FIELDS_MAX];
+    uint32_t PrevDelta[PAYLOAD_CODEC_FIELDS_MAX];
+    uint8_t Depth;                  //!< Records since the key frame, up to 2
+    uint16_t Frames;                //!< Frames since the key frame
+    uint16_t KeyInterval;           //!< Frames between key frames, 0 for the first one only
+    bool Synced;                    //!< History valid, false until the next key frame
+}PayloadCodecState_t;
+
+/*!
+ * \brief Descriptor of an integer member
+ */
+#define PAYLOAD_CODEC_INT( type, member, mode, bits )                          \
+    { offsetof( type, member ), sizeof( ( ( type * )0 )->member ), ( mode ),  \
+      ( bits ), ( ( __typeof__( ( ( type * )0 )->member ) )-1 < 0 ), 0, NULL }
+
+/*!
+ * \brief Descriptor of a byte array member
+ */
+#define PAYLOAD_CODEC_ARRAY( type, member )                                    \
+    { offsetof( type, member ), sizeof( ( ( type * )0 )->member ), PAYLOAD_CODEC_BYTES, 8, false, 0, NULL }
+
+/*!
+ * \brief Descriptor of a byte array member compressed against a dictionary
+ */
+#define PAYLOAD_CODEC_ARRAY_LZ( type, member, dict )                           \
+    { offsetof( type, member ), sizeof( ( ( type * )0 )->member ), PAYLOAD_CODEC_LZ, 8, false, sizeof( dict ), ( dict ) }
+
+/*!
+ * \brief Schema of a record structure
+ */
+#define PAYLOAD_CODEC_SCHEMA( type, fields )                                   \
+    { ( fields ), sizeof( fields ) / sizeof( ( fields )[0] ), sizeof( type ) }
+
+/*!
+ * \brief Starts a stream, its first frame a key frame
+ *
+ * \param [OUT] state       History of the stream
+ * \param [IN]  keyInterval Frames between key frames, 0 for the first one only
+ */
+void PayloadCodecInit( PayloadCodecState_t *state, uint16_t keyInterval );
+
+/*!
+ * \brief Makes the next frame a key frame
+ *
+ * \param [IN] state        History of the stream
+ */
+void PayloadCodecKey( PayloadCodecState_t *state );
+
+/*!
+ * \brief Encodes records into a frame
+ *
+ * \param [IN]  schema      Record structure
+ * \param [IN]  state       History of the stream, updated when the records fit
+ * \param [IN]  records     Records, schema->RecordSize apart
+ * \param [IN]  count       Number of records, 1 to PAYLOAD_CODEC_RECORDS_MAX
+ * \param [OUT] frame       Frame
+ * \param [IN]  size        Frame size available
+ *
+ * \retval size             Frame size, 0 when the records do not fit
+ */
+uint8_t PayloadCodecEncode( const PayloadCodecSchema_t *schema, PayloadCodecState_t *state,
+                            const void *records, uint8_t count, uint8_t *frame, uint8_t size );
+
+/*!
+ * \brief Decodes the records of a frame
+ *
+ * \remark A frame lost, the stream is decoded again from the next key frame
+ *         on, after \ref PayloadCodecKey on the decoder side.
+ *
+ * \param [IN]  schema      Record structure
+ * \param [IN]  state       History of the stream
+ * \param [IN]  frame       Frame
+ * \param [IN]  size        Frame size
+ * \param [OUT] records     Records, schema->RecordSize apart
+ * \param [IN]  countMax    Room of records
+ *
+ * \retval count            Number of records, 0 when the frame is bad or
+ *                          follows a frame lost
+ */
+uint8_t PayloadCodecDecode( const PayloadCodecSchema_t *schema, PayloadCodecState_t *state,
+                            const uint8_t *frame, uint8_t size, void *records, uint8_t countMax );
+
+/*! \} defgroup LORA_PAYLOAD_CODEC */
+/*! \} addtogroup LORA */
+
+#endif // __PAYLOAD_CODEC_H__
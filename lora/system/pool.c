@@ -0,0 +1,204 @@
+/*!
+ * \file      pool.c
+ *
+ * \brief     Fixed block pool allocator implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stddef.h>
+#include "tremo_cm4.h"
+#include "pool.h"
+
+#if ( POOL_SMALL_COUNT > 32 ) || ( POOL_MEDIUM_COUNT > 32 ) || ( POOL_LARGE_COUNT > 32 )
+#error "A pool class holds 32 blocks at most"
+#endif
+
+#if ( POOL_SMALL_SIZE > POOL_MEDIUM_SIZE ) || ( POOL_MEDIUM_SIZE > POOL_LARGE_SIZE )
+#error "Pool classes must be ordered by block size"
+#endif
+
+/*!
+ * Block size rounded up to whole words, blocks stay 4 bytes aligned
+ */
+#define POOL_WORDS( size )                          ( ( ( size ) + 3 ) / 4 )
+
+static uint32_t PoolSmall[POOL_SMALL_COUNT * POOL_WORDS( POOL_SMALL_SIZE )];
+static uint32_t PoolMedium[POOL_MEDIUM_COUNT * POOL_WORDS( POOL_MEDIUM_SIZE )];
+static uint32_t PoolLarge[POOL_LARGE_COUNT * POOL_WORDS( POOL_LARGE_SIZE )];
+
+typedef struct
+{
+    uint8_t *Base;
+    uint16_t BlockSize;
+    uint8_t Count;
+}PoolDesc_t;
+
+static const PoolDesc_t PoolDesc[POOL_CLASS_MAX] =
+{
+    { ( uint8_t * )PoolSmall, POOL_WORDS( POOL_SMALL_SIZE ) * 4, POOL_SMALL_COUNT },
+    { ( uint8_t * )PoolMedium, POOL_WORDS( POOL_MEDIUM_SIZE ) * 4, POOL_MEDIUM_COUNT },
+    { ( uint8_t * )PoolLarge, POOL_WORDS( POOL_LARGE_SIZE ) * 4, POOL_LARGE_COUNT },
+};
+
+/*!
+ * Blocks in use of each class, bit n set while block n is taken. The zero
+ * initialized maps start with every block free
+ */
+static volatile uint32_t PoolUsed[POOL_CLASS_MAX];
+
+static volatile uint8_t PoolHighWater[POOL_CLASS_MAX];
+
+static volatile uint32_t PoolFailed[POOL_CLASS_MAX];
+
+static RAM_FUNC_ATTR uint8_t PoolCount( uint32_t map )
+{
+    uint8_t count = 0;
+
+    for( ; map != 0; map &= map - 1 )
+    {
+        count++;
+    }
+    return count;
+}
+
+static RAM_FUNC_ATTR void PoolCountUsed( uint8_t poolClass, uint32_t map )
+{
+    uint32_t highWater;
+    uint8_t used = PoolCount( map );
+
+    do
+    {
+        highWater = __LDREXB( &PoolHighWater[poolClass] );
+        if( used <= highWater )
+        {
+            __CLREX( );
+            return;
+        }
+    }while( __STREXB( used, &PoolHighWater[poolClass] ) != 0 );
+}
+
+static RAM_FUNC_ATTR void PoolCountFailed( uint8_t poolClass )
+{
+    uint32_t failed;
+
+    do
+    {
+        failed = __LDREXW( &PoolFailed[poolClass] );
+    }while( __STREXW( failed + 1, &PoolFailed[poolClass] ) != 0 );
+}
+
+RAM_FUNC_ATTR void *PoolAlloc( uint16_t size )
+{
+    const PoolDesc_t *desc;
+    uint32_t full;
+    uint32_t map;
+    uint8_t first = POOL_CLASS_MAX;
+    uint8_t block = 0;
+    uint8_t i;
+
+    for( i = 0; i < POOL_CLASS_MAX; i++ )
+    {
+        desc = &PoolDesc[i];
+        if( ( desc->Count == 0 ) || ( size > desc->BlockSize ) )
+        {
+            continue;
+        }
+        if( first == POOL_CLASS_MAX )
+        {
+            first = i;
+        }
+        full = ( desc->Count == 32 ) ? 0xFFFFFFFF : ( ( 1UL << desc->Count ) - 1 );
+
+        // An interrupt taken between LDREX and STREX clears the exclusive
+        // monitor, the STREX then fails and the lowest free block is searched
+        // again
+        do
+        {
+            map = __LDREXW( &PoolUsed[i] );
+            if( map == full )
+            {
+                __CLREX( );
+                break;
+            }
+            block = __CLZ( __RBIT( ~map ) );
+        }while( __STREXW( map | ( 1UL << block ), &PoolUsed[i] ) != 0 );
+
+        if( map != full )
+        {
+            PoolCountUsed( i, map | ( 1UL << block ) );
+            return desc->Base + ( uint32_t )block * desc->BlockSize;
+        }
+    }
+
+    if( first != POOL_CLASS_MAX )
+    {
+        PoolCountFailed( first );
+    }
+    return NULL;
+}
+
+/*!
+ * Class holding a block, POOL_CLASS_MAX when it is not a pool block
+ */
+static RAM_FUNC_ATTR uint8_t PoolClassOf( void *block, uint8_t *index )
+{
+    const PoolDesc_t *desc;
+    uint32_t offset;
+    uint8_t i;
+
+    for( i = 0; i < POOL_CLASS_MAX; i++ )
+    {
+        desc = &PoolDesc[i];
+        offset = ( uint32_t )( ( uint8_t * )block - desc->Base );
+        if( ( ( uint8_t * )block >= desc->Base ) && ( offset < ( uint32_t )desc->Count * desc->BlockSize ) )
+        {
+            *index = offset / desc->BlockSize;
+            return i;
+        }
+    }
+    return POOL_CLASS_MAX;
+}
+
+RAM_FUNC_ATTR void PoolFree( void *block )
+{
+    uint32_t map;
+    uint8_t index = 0;
+    uint8_t i;
+
+    if( block == NULL )
+    {
+        return;
+    }
+    i = PoolClassOf( block, &index );
+    if( i == POOL_CLASS_MAX )
+    {
+        return;
+    }
+
+    do
+    {
+        map = __LDREXW( &PoolUsed[i] );
+    }while( __STREXW( map & ~( 1UL << index ), &PoolUsed[i] ) != 0 );
+}
+
+uint16_t PoolBlockSize( void *block )
+{
+    uint8_t index = 0;
+    uint8_t i = PoolClassOf( block, &index );
+
+    return ( i == POOL_CLASS_MAX ) ? 0 : PoolDesc[i].BlockSize;
+}
+
+bool PoolGetStats( PoolClass_t poolClass, PoolStats_t *stats )
+{
+    if( ( poolClass >= POOL_CLASS_MAX ) || ( stats == NULL ) )
+    {
+        return false;
+    }
+    stats->BlockSize = PoolDesc[poolClass].BlockSize;
+    stats->Count = PoolDesc[poolClass].Count;
+    stats->Used = PoolCount( PoolUsed[poolClass] );
+    stats->HighWater = PoolHighWater[poolClass];
+    stats->Failed = PoolFailed[poolClass];
+    return true;
+}
@@ -0,0 +1,93 @@
+/*!
+ * \file      pool.h
+ *
+ * \brief     Fixed block pool allocator
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_POOL
+ *
+ *            Static blocks in a few size classes for the frames, events and
+ *            AT responses that outlive the function creating them. A block
+ *            is taken from the smallest class it fits, or from a larger class
+ *            when that one is exhausted. Each class keeps a bitmap of its
+ *            blocks in use, claimed with LDREX/STREX and searched with CLZ,
+ *            so \ref PoolAlloc and \ref PoolFree take constant time and are
+ *            safe from interrupt handlers of any priority without masking
+ *            the interrupts. The classes are sized in mem-profile.h.
+ *
+ * \{
+ */
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "mem-profile.h"
+
+/*!
+ * Size classes, from the smallest blocks
+ */
+typedef enum
+{
+    POOL_CLASS_SMALL = 0,
+    POOL_CLASS_MEDIUM,
+    POOL_CLASS_LARGE,
+    POOL_CLASS_MAX,
+}PoolClass_t;
+
+/*!
+ * Usage of a size class
+ */
+typedef struct
+{
+    uint16_t BlockSize;  //!< Bytes of a block
+    uint8_t Count;       //!< Blocks of the class
+    uint8_t Used;        //!< Blocks in use
+    uint8_t HighWater;   //!< Most blocks in use at the same time since the start
+    uint32_t Failed;     //!< Requests of the class size not served
+}PoolStats_t;
+
+/*!
+ * \brief Takes a block, from an interrupt handler or the main loop
+ *
+ * \param [IN] size    Bytes needed
+ *
+ * \retval block       4 bytes aligned block, NULL when no class can serve it
+ */
+void *PoolAlloc( uint16_t size );
+
+/*!
+ * \brief Gives a block back, from an interrupt handler or the main loop
+ *
+ * \param [IN] block   Block taken with \ref PoolAlloc, NULL is ignored
+ */
+void PoolFree( void *block );
+
+/*!
+ * \brief Usable size of a block
+ *
+ * \param [IN] block   Block taken with \ref PoolAlloc
+ *
+ * \retval size        Bytes of the block, 0 when it is not a pool block
+ */
+uint16_t PoolBlockSize( void *block );
+
+/*!
+ * \brief Reads the usage of a size class
+ *
+ * \param [IN]  poolClass  Size class
+ * \param [OUT] stats      Usage of the class
+ *
+ * \retval valid       false when the class does not exist
+ */
+bool PoolGetStats( PoolClass_t poolClass, PoolStats_t *stats );
+
+/*! \} defgroup LORA_POOL */
+/*! \} addtogroup LORA */
+
+#endif // __POOL_H__
@@ -0,0 +1,107 @@
+/*!
+ * \file      profile.c
+ *
+ * \brief     Cycle counting probes implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "log.h"
+#include "profile.h"
+
+#ifdef CONFIG_PROFILE
+
+ProfileStats_t ProfileProbes[PROFILE_PROBE_MAX];
+
+static const char *const ProfileNames[PROFILE_USER] =
+{
+    [PROFILE_MAC_RX_DONE] = "MacRxDone",
+    [PROFILE_MAC_PREPARE_FRAME] = "MacPrepareFrame",
+    [PROFILE_MAC_COMPUTE_MIC] = "MacComputeMic",
+    [PROFILE_RADIO_READ_BUFFER] = "RadioReadBuffer",
+    [PROFILE_TIMER_IRQ] = "TimerIrq",
+    [PROFILE_AT_PROCESS] = "AtProcess",
+};
+
+void ProfileInit( void )
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    ProfileReset( );
+}
+
+void ProfileStop( ProfileProbe_t probe )
+{
+    ProfileStats_t *stats = &ProfileProbes[probe];
+    uint32_t cycles = DWT->CYCCNT - stats->Start;
+    uint32_t bin;
+
+    if( ( stats->Count == 0 ) || ( cycles < stats->Min ) )
+    {
+        stats->Min = cycles;
+    }
+    if( cycles > stats->Max )
+    {
+        stats->Max = cycles;
+    }
+    stats->Count++;
+    stats->Total += cycles;
+
+    // log4 of the cycles, from 4^3
+    bin = ( cycles < 256 ) ? 0 : ( ( 31 - __CLZ( cycles ) ) >> 1 ) - 3;
+    stats->Hist[( bin < PROFILE_HIST_BINS ) ? bin : ( PROFILE_HIST_BINS - 1 )]++;
+}
+
+void ProfileReset( void )
+{
+    memset( ProfileProbes, 0, sizeof( ProfileProbes ) );
+}
+
+int ProfileFormat( ProfileProbe_t probe, char *buf, size_t size )
+{
+    ProfileStats_t stats = ProfileProbes[probe];
+    char name[8];
+    const char *label = name;
+    int len;
+    int i;
+
+    if( stats.Count == 0 )
+    {
+        return 0;
+    }
+    if( probe < PROFILE_USER )
+    {
+        label = ProfileNames[probe];
+    }
+    else
+    {
+        snprintf( name, sizeof( name ), "User%d", probe - PROFILE_USER );
+    }
+
+    len = snprintf( buf, size, "%s,%u,%u,%u,%u", label, ( unsigned int )stats.Count, ( unsigned int )stats.Min,
+                    ( unsigned int )( stats.Total / stats.Count ), ( unsigned int )stats.Max );
+    for( i = 0; ( i < PROFILE_HIST_BINS ) && ( len < ( int )size ); i++ )
+    {
+        len += snprintf( buf + len, size - len, ",%u", ( unsigned int )stats.Hist[i] );
+    }
+    return len;
+}
+
+void ProfileDump( void )
+{
+    char line[96];
+    int i;
+
+    for( i = 0; i < PROFILE_PROBE_MAX; i++ )
+    {
+        if( ProfileFormat( ( ProfileProbe_t )i, line, sizeof( line ) ) > 0 )
+        {
+            LOG_PRINTF( LL_DEBUG, "profile %s\r\n", line );
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,129 @@
+/*!
+ * \file      profile.h
+ *
+ * \brief     Cycle counting probes
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_PROFILE
+ *
+ *            Named probe points timed with the Cortex-M4 DWT cycle counter.
+ *            Each probe keeps its count, min, max and total cycles and a
+ *            histogram by powers of 4, the stack has probes on its hot
+ *            paths and the application numbers its own from
+ *            PROFILE_USER.
+ *
+ *            Built with CONFIG_PROFILE, the PROFILE_START and PROFILE_STOP
+ *            macros compile to nothing otherwise. A probe measures the wall
+ *            time in cycles, the interrupts served in between included, and
+ *            is not reentrant.
+ *
+ * \{
+ */
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*!
+ * Number of application probes
+ */
+#ifndef PROFILE_USER_PROBES
+#define PROFILE_USER_PROBES                         4
+#endif
+
+/*!
+ * Number of histogram bins, bin n > 0 counts from 4^(n + 3) cycles, bin 0
+ * everything below 256 and the last bin everything above
+ */
+#define PROFILE_HIST_BINS                           8
+
+/*!
+ * Probes
+ */
+typedef enum
+{
+    PROFILE_MAC_RX_DONE = 0,    //!< OnRadioRxDone
+    PROFILE_MAC_PREPARE_FRAME,  //!< PrepareFrame
+    PROFILE_MAC_COMPUTE_MIC,    //!< LoRaMacComputeMic
+    PROFILE_RADIO_READ_BUFFER,  //!< SX126xReadBuffer
+    PROFILE_TIMER_IRQ,          //!< TimerIrqHandler
+    PROFILE_AT_PROCESS,         //!< linkwan_at_process, a command line
+    PROFILE_USER,
+    PROFILE_PROBE_MAX = PROFILE_USER + PROFILE_USER_PROBES,
+}ProfileProbe_t;
+
+#ifdef CONFIG_PROFILE
+
+#include "tremo_cm4.h"
+
+/*!
+ * \brief Probe counters
+ */
+typedef struct
+{
+    uint32_t Count;
+    uint32_t Min;
+    uint32_t Max;
+    uint64_t Total;
+    uint32_t Hist[PROFILE_HIST_BINS];
+    /*!
+     * Cycle counter at PROFILE_START
+     */
+    uint32_t Start;
+}ProfileStats_t;
+
+extern ProfileStats_t ProfileProbes[PROFILE_PROBE_MAX];
+
+#define PROFILE_START( probe )                      ( ProfileProbes[probe].Start = DWT->CYCCNT )
+#define PROFILE_STOP( probe )                       ProfileStop( probe )
+
+/*!
+ * \brief Starts the DWT cycle counter and clears the probes
+ */
+void ProfileInit( void );
+
+/*!
+ * \brief Accounts the cycles since the start of a probe, see PROFILE_STOP
+ *
+ * \param [IN] probe   Probe
+ */
+void ProfileStop( ProfileProbe_t probe );
+
+/*!
+ * \brief Clears the probes
+ */
+void ProfileReset( void );
+
+/*!
+ * \brief Formats a probe as name,count,min,avg,max,hist0..hist7 in cycles
+ *
+ * \param [IN]  probe  Probe
+ * \param [OUT] buf    Line, without end of line
+ * \param [IN]  size   buf size
+ *
+ * \retval len         Line length as snprintf, 0 for a probe never hit
+ */
+int ProfileFormat( ProfileProbe_t probe, char *buf, size_t size );
+
+/*!
+ * \brief Prints the probes hit so far on the log
+ */
+void ProfileDump( void );
+
+#else
+
+#define PROFILE_START( probe )
+#define PROFILE_STOP( probe )
+
+#endif
+
+/*! \} defgroup LORA_PROFILE */
+/*! \} addtogroup LORA */
+
+#endif // __PROFILE_H__
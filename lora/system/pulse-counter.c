@@ -0,0 +1,204 @@
+/*!
+ * \file      pulse-counter.c
+ *
+ * \brief     Low power pulse counting with an LPTIMER implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include "sx126x-board.h"
+#include "tremo_rcc.h"
+#include "timer.h"
+#include "event-queue.h"
+#include "pulse-counter.h"
+
+static lptimer_t *PulseTimer;
+
+/*!
+ * Counter wraps, the high half of the total
+ */
+static volatile uint16_t PulseWraps = 0;
+
+/*!
+ * Total at the previous report
+ */
+static uint32_t PulseReported = 0;
+
+static uint32_t PulseThreshold = 0;
+
+static uint32_t PulseReportInterval = 0;
+
+static TimerEvent_t PulseReportTimer;
+
+/*!
+ * \brief Reads the counter, clocked apart from the CPU, until two reads agree
+ */
+static uint16_t PulseCounterRead( void )
+{
+    uint32_t count;
+
+    do
+    {
+        count = PulseTimer->CNT;
+    }while( count != PulseTimer->CNT );
+    return ( uint16_t )count;
+}
+
+/*!
+ * \brief Loads the compare register with the low half of the threshold
+ *        total, the compare matches once every 65536 pulses until the
+ *        high half is reached
+ */
+static void PulseCounterArm( void )
+{
+    if( PulseThreshold != 0 )
+    {
+        lptimer_set_cmp_register( PulseTimer, ( uint16_t )( PulseReported + PulseThreshold ) );
+    }
+}
+
+/*!
+ * \brief Posts the pulses since the previous report, the interrupts disabled
+ */
+static void PulseCounterReport( PulseCounterReason_t reason, uint32_t total )
+{
+    // Counted in the next report when the queue is full
+    if( EventPost( EVENT_PULSE, reason, total - PulseReported ) == true )
+    {
+        PulseReported = total;
+        PulseCounterArm( );
+    }
+}
+
+/*!
+ * \brief Reports a threshold reached, also one passed while the compare
+ *        register was loaded, the interrupts disabled
+ */
+static void PulseCounterCheckThreshold( void )
+{
+    uint32_t total;
+
+    if( PulseThreshold == 0 )
+    {
+        return;
+    }
+    total = PulseCounterGetTotal( );
+    if( ( total - PulseReported ) >= PulseThreshold )
+    {
+        PulseCounterReport( PULSE_COUNTER_THRESHOLD, total );
+    }
+}
+
+static void OnPulseReportTimerEvent( void )
+{
+    BoardDisableIrq( );
+    PulseCounterReport( PULSE_COUNTER_REPORT, PulseCounterGetTotal( ) );
+    BoardEnableIrq( );
+
+    TimerSetValue( &PulseReportTimer, PulseReportInterval );
+    TimerStart( &PulseReportTimer );
+}
+
+void PulseCounterInit( lptimer_t *lptimer, lptimer_ckpol_t polarity, uint32_t reportInterval, uint32_t threshold )
+{
+    lptimer_init_t config;
+
+    PulseTimer = lptimer;
+    PulseWraps = 0;
+    PulseReported = 0;
+
+    if( lptimer == LPTIMER0 )
+    {
+        rcc_enable_peripheral_clk( RCC_PERIPHERAL_LPTIMER0, false );
+        rcc_rst_peripheral( RCC_PERIPHERAL_LPTIMER0, true );
+        rcc_rst_peripheral( RCC_PERIPHERAL_LPTIMER0, false );
+        rcc_set_lptimer0_clk_source( RCC_LPTIMER0_CLK_SOURCE_XO32K );
+        rcc_enable_peripheral_clk( RCC_PERIPHERAL_LPTIMER0, true );
+    }
+    else
+    {
+        rcc_enable_peripheral_clk( RCC_PERIPHERAL_LPTIMER1, false );
+        rcc_rst_peripheral( RCC_PERIPHERAL_LPTIMER1, true );
+        rcc_rst_peripheral( RCC_PERIPHERAL_LPTIMER1, false );
+        rcc_set_lptimer1_clk_source( RCC_LPTIMER1_CLK_SOURCE_XO32K );
+        rcc_enable_peripheral_clk( RCC_PERIPHERAL_LPTIMER1, true );
+    }
+
+    // The XO32K samples the input and the counter counts its edges
+    config.sel_external_clock = false;
+    config.count_by_external = true;
+    config.prescaler = LPTIMER_PRESC_1;
+    config.autoreload_preload = false;
+    config.wavpol_inverted = false;
+    lptimer_init( lptimer, &config );
+    lptimer_config_clock_polarity( lptimer, polarity );
+
+    lptimer_config_interrupt( lptimer, LPTIMER_IT_ARRM, ENABLE );
+    lptimer_config_wakeup( lptimer, LPTIMER_CFGR_ARRM_WKUP, ENABLE );
+
+    lptimer_cmd( lptimer, true );
+    lptimer_set_arr_register( lptimer, 0xFFFF );
+    lptimer_config_count_mode( lptimer, LPTIMER_MODE_CNTSTRT, ENABLE );
+
+    NVIC_EnableIRQ( ( lptimer == LPTIMER0 ) ? LPTIMER0_IRQn : LPTIMER1_IRQn );
+
+    TimerInit( &PulseReportTimer, OnPulseReportTimerEvent );
+    PulseCounterSetThreshold( threshold );
+    PulseCounterSetReportInterval( reportInterval );
+}
+
+void PulseCounterSetReportInterval( uint32_t reportInterval )
+{
+    TimerStop( &PulseReportTimer );
+    PulseReportInterval = reportInterval;
+    if( reportInterval != 0 )
+    {
+        TimerSetValue( &PulseReportTimer, reportInterval );
+        TimerStart( &PulseReportTimer );
+    }
+}
+
+void PulseCounterSetThreshold( uint32_t threshold )
+{
+    BoardDisableIrq( );
+    PulseThreshold = threshold;
+    lptimer_config_interrupt( PulseTimer, LPTIMER_IT_CMPM, ( threshold != 0 ) ? ENABLE : DISABLE );
+    lptimer_config_wakeup( PulseTimer, LPTIMER_CFGR_CMPM_WKUP, ( threshold != 0 ) ? ENABLE : DISABLE );
+    PulseCounterArm( );
+    PulseCounterCheckThreshold( );
+    BoardEnableIrq( );
+}
+
+uint32_t PulseCounterGetTotal( void )
+{
+    uint32_t wraps;
+    uint16_t count;
+
+    BoardDisableIrq( );
+    wraps = PulseWraps;
+    count = PulseCounterRead( );
+    // Wrapped, its interrupt not taken yet
+    if( ( lptimer_get_status( PulseTimer, LPTIMER_ISR_ARRM ) == true ) && ( count < 0x8000 ) )
+    {
+        wraps++;
+    }
+    BoardEnableIrq( );
+    return ( wraps << 16 ) | count;
+}
+
+void PulseCounterIrqHandler( void )
+{
+    if( lptimer_get_interrupt_status( PulseTimer, LPTIMER_IT_ARRM ) )
+    {
+        lptimer_clear_interrupt( PulseTimer, LPTIMER_IT_ARRM );
+        while( lptimer_get_clear_status_flag( PulseTimer, LPTIMER_CSR_ARRM ) == false );
+        PulseWraps++;
+    }
+    if( lptimer_get_interrupt_status( PulseTimer, LPTIMER_IT_CMPM ) )
+    {
+        lptimer_clear_interrupt( PulseTimer, LPTIMER_IT_CMPM );
+        while( lptimer_get_clear_status_flag( PulseTimer, LPTIMER_CSR_CMPM ) == false );
+        BoardDisableIrq( );
+        PulseCounterCheckThreshold( );
+        BoardEnableIrq( );
+    }
+}
@@ -0,0 +1,93 @@
+/*!
+ * \file      pulse-counter.h
+ *
+ * \brief     Low power pulse counting with an LPTIMER
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_PULSE_COUNTER
+ *
+ *            Counts the pulses of a meter output on the IN1 input of an
+ *            LPTIMER, which keeps counting in STOP3 on the 32 kHz clock.
+ *            The MCU wakes on the compare match of a pulse threshold, on
+ *            a counter wrap every 65536 pulses and on the report timer,
+ *            never on a single pulse.
+ *
+ *            The pulses since the previous report are posted to the event
+ *            queue as EVENT_PULSE, Param holding the
+ *            \ref PulseCounterReason_t, Data the number of pulses.
+ *
+ * \{
+ */
+#ifndef __PULSE_COUNTER_H__
+#define __PULSE_COUNTER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tremo_lptimer.h"
+
+/*!
+ * Aggregated record type of the counts, see lwan_record_add
+ */
+#ifndef PULSE_COUNTER_RECORD_TYPE
+#define PULSE_COUNTER_RECORD_TYPE                   1
+#endif
+
+/*!
+ * Reasons of an EVENT_PULSE
+ */
+typedef enum
+{
+    PULSE_COUNTER_REPORT = 0,       //!< Report interval elapsed
+    PULSE_COUNTER_THRESHOLD,        //!< Threshold pulses counted before the report interval
+}PulseCounterReason_t;
+
+/*!
+ * \brief Starts counting, the LPTIMER reset and clocked by the XO32K
+ *
+ * \remark The IN1 pin multiplexing is left to the application, the
+ *         LPTIMER interrupt handler calls \ref PulseCounterIrqHandler.
+ *
+ * \param [IN] lptimer        LPTIMER0 or LPTIMER1
+ * \param [IN] polarity       Counted edges
+ * \param [IN] reportInterval Period of the reports [ms], 0 for none
+ * \param [IN] threshold      Pulses reported at once, 0 for none
+ */
+void PulseCounterInit( lptimer_t *lptimer, lptimer_ckpol_t polarity, uint32_t reportInterval, uint32_t threshold );
+
+/*!
+ * \brief Changes the report period, restarted from now
+ *
+ * \param [IN] reportInterval Period of the reports [ms], 0 for none
+ */
+void PulseCounterSetReportInterval( uint32_t reportInterval );
+
+/*!
+ * \brief Changes the threshold, counted from the previous report
+ *
+ * \param [IN] threshold      Pulses reported at once, 0 for none
+ */
+void PulseCounterSetThreshold( uint32_t threshold );
+
+/*!
+ * \brief Pulses counted since \ref PulseCounterInit
+ *
+ * \retval total              Pulse count, wraps at 2^32
+ */
+uint32_t PulseCounterGetTotal( void );
+
+/*!
+ * \brief Handles the compare match and the counter wrap
+ *
+ * \remark To be called from the interrupt handler of the LPTIMER.
+ */
+void PulseCounterIrqHandler( void );
+
+/*! \} defgroup LORA_PULSE_COUNTER */
+/*! \} addtogroup LORA */
+
+#endif // __PULSE_COUNTER_H__
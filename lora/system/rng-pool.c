@@ -0,0 +1,71 @@
+/*!
+ * \file      rng-pool.c
+ *
+ * \brief     Random numbers pooled from the hardware TRNG implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include "tremo_cm4.h"
+#include "rng.h"
+#include "rng-pool.h"
+
+#ifdef CONFIG_RNG_POOL
+
+static uint32_t RngPool[RNG_POOL_WORDS];
+static volatile uint8_t RngPoolCount = 0;
+
+/*!
+ * Reads a word from the TRNG, the interrupts disabled so that an interrupt
+ * handler drawing from an empty pool does not use it at the same time
+ */
+static uint32_t RngPoolDraw( void )
+{
+    uint32_t rnd;
+
+    // The TRNG only runs while a word is drawn
+    rng_init( 0x0f, 0xFF );
+    rng_get_rand( ( UINT8 * )&rnd, sizeof( rnd ) );
+    rng_close( );
+    return rnd;
+}
+
+uint32_t RngPoolGet( void )
+{
+    uint32_t primask = __get_PRIMASK( );
+    uint32_t rnd;
+
+    __disable_irq( );
+    if( RngPoolCount > 0 )
+    {
+        rnd = RngPool[--RngPoolCount];
+    }
+    else
+    {
+        rnd = RngPoolDraw( );
+    }
+    __set_PRIMASK( primask );
+    return rnd;
+}
+
+bool RngPoolRefill( void )
+{
+    uint32_t primask;
+    bool drawn = false;
+
+    // A word per critical section, the interrupts are held off for a single
+    // draw at most
+    while( RngPoolCount < RNG_POOL_WORDS )
+    {
+        primask = __get_PRIMASK( );
+        __disable_irq( );
+        if( RngPoolCount < RNG_POOL_WORDS )
+        {
+            RngPool[RngPoolCount++] = RngPoolDraw( );
+        }
+        __set_PRIMASK( primask );
+        drawn = true;
+    }
+    return drawn;
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*!
+ * \file      rng-pool.h
+ *
+ * \brief     Random numbers pooled from the hardware TRNG
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_RNG_POOL
+ *
+ *            Keeps RNG_POOL_WORDS words of the TRNG output, refilled from
+ *            the idle loop. A draw takes a word of the pool, from any
+ *            context; only an empty pool reads the TRNG at once.
+ *
+ *            With CONFIG_RNG_POOL, rand1 and randr draw from the pool, and
+ *            RadioRandom no longer switches the radio to reception for its
+ *            entropy. The DevNonces, the back-off jitters and the channel
+ *            choices then differ between the devices of a fleet.
+ *
+ * \{
+ */
+#ifndef __RNG_POOL_H__
+#define __RNG_POOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * Words pooled
+ */
+#ifndef RNG_POOL_WORDS
+#define RNG_POOL_WORDS                              8
+#endif
+
+/*!
+ * \brief Takes a random word
+ *
+ * \remark The SAC clock has to be on.
+ *
+ * \retval rnd          Random word
+ */
+uint32_t RngPoolGet( void );
+
+/*!
+ * \brief Fills the pool, from the idle loop
+ *
+ * \retval drawn        true when words were read from the TRNG
+ */
+bool RngPoolRefill( void );
+
+/*! \} defgroup LORA_RNG_POOL */
+/*! \} addtogroup LORA */
+
+#endif // __RNG_POOL_H__
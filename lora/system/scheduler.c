@@ -0,0 +1,174 @@
+/*!
+ * \file      scheduler.c
+ *
+ * \brief     Run to completion task scheduler implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stddef.h>
+#include "tremo_cm4.h"
+#include "timer.h"
+#include "scheduler.h"
+#ifdef CONFIG_EVENT_QUEUE
+#include "event-queue.h"
+#endif
+
+/*!
+ * Registered tasks, by decreasing priority
+ */
+static SchedTask_t *SchedTasks = NULL;
+
+static void ( *SchedIdle )( void ) = TimerLowPowerHandler;
+
+#ifdef CONFIG_EVENT_QUEUE
+static SchedTask_t *SchedQueueTask = NULL;
+
+/*!
+ * Event queue post count when the queue task was last woken
+ */
+static uint32_t SchedQueueSeen = 0;
+#endif
+
+/*!
+ * \brief Clears and returns the events of the mask
+ */
+static uint32_t SchedTakeEvents( SchedTask_t *task, uint32_t mask )
+{
+    uint32_t events;
+
+    do
+    {
+        events = __LDREXW( &task->Events );
+        if( ( events & mask ) == 0 )
+        {
+            __CLREX( );
+            return 0;
+        }
+    }while( __STREXW( events & ~mask, &task->Events ) != 0 );
+    return events & mask;
+}
+
+void SchedTaskInit( SchedTask_t *task, void ( *handler )( uint32_t events ), uint8_t priority )
+{
+    SchedTask_t **cur = &SchedTasks;
+
+    task->Handler = handler;
+    task->Priority = priority;
+    task->Events = 0;
+
+    while( ( *cur != NULL ) && ( ( *cur )->Priority >= priority ) )
+    {
+        cur = &( *cur )->Next;
+    }
+    task->Next = *cur;
+    *cur = task;
+}
+
+void SchedSetEvents( SchedTask_t *task, uint32_t events )
+{
+    uint32_t cur;
+
+    do
+    {
+        cur = __LDREXW( &task->Events );
+    }while( __STREXW( cur | events, &task->Events ) != 0 );
+}
+
+void SchedSetQueueTask( SchedTask_t *task )
+{
+#ifdef CONFIG_EVENT_QUEUE
+    SchedQueueTask = task;
+    SchedQueueSeen = EventGetPostCount( );
+    if( EventPending( ) == true )
+    {
+        SchedSetEvents( task, SCHED_EVENT_QUEUE );
+    }
+#endif
+}
+
+void SchedSetIdleHandler( void ( *idle )( void ) )
+{
+    SchedIdle = ( idle != NULL ) ? idle : TimerLowPowerHandler;
+}
+
+bool SchedPending( void )
+{
+    SchedTask_t *task;
+
+#ifdef CONFIG_EVENT_QUEUE
+    if( ( SchedQueueTask != NULL ) && ( EventGetPostCount( ) != SchedQueueSeen ) )
+    {
+        return true;
+    }
+#endif
+    for( task = SchedTasks; task != NULL; task = task->Next )
+    {
+        if( task->Events != 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SchedRunOnce( void )
+{
+    SchedTask_t *task;
+    uint32_t events;
+
+#ifdef CONFIG_EVENT_QUEUE
+    if( SchedQueueTask != NULL )
+    {
+        uint32_t posted = EventGetPostCount( );
+
+        if( posted != SchedQueueSeen )
+        {
+            SchedQueueSeen = posted;
+            SchedSetEvents( SchedQueueTask, SCHED_EVENT_QUEUE );
+        }
+    }
+#endif
+    for( task = SchedTasks; task != NULL; task = task->Next )
+    {
+        if( task->Handler == NULL )
+        {
+            continue;
+        }
+        events = SchedTakeEvents( task, UINT32_MAX );
+        if( events != 0 )
+        {
+            task->Handler( events );
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t SchedWait( SchedTask_t *task, uint32_t mask )
+{
+    uint32_t events;
+
+    for( ;; )
+    {
+        events = SchedTakeEvents( task, mask );
+        if( events != 0 )
+        {
+            return events;
+        }
+        if( SchedRunOnce( ) == false )
+        {
+            SchedIdle( );
+        }
+    }
+}
+
+void SchedRun( void )
+{
+    for( ;; )
+    {
+        if( SchedRunOnce( ) == false )
+        {
+            SchedIdle( );
+        }
+    }
+}
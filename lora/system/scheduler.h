@@ -0,0 +1,140 @@
+/*!
+ * \file      scheduler.h
+ *
+ * \brief     Run to completion task scheduler
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_SCHEDULER
+ *
+ *            Tasks are woken by setting bits of their event mask, from any
+ *            context. The main loop runs the woken task of highest priority
+ *            with the events it was woken with, one task at a time and
+ *            without preemption, and enters the low power mode when no task
+ *            is woken.
+ *
+ *            A task without handler is never run: the main loop context
+ *            waits on it with \ref SchedWait, running the other tasks in
+ *            the meantime.
+ *
+ * \{
+ */
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * Event of the queue task, set when events have been posted to the event
+ * queue
+ */
+#define SCHED_EVENT_QUEUE                           ( 1UL << 31 )
+
+/*!
+ * Scheduler task
+ */
+typedef struct SchedTask_s
+{
+    /*!
+     * \brief Runs the task, NULL for a task waited on with SchedWait
+     *
+     * \param [IN] events  Events the task has been woken with, cleared
+     */
+    void ( *Handler )( uint32_t events );
+    /*!
+     * Priority, the woken task of highest priority runs first
+     */
+    uint8_t Priority;
+    /*!
+     * Pending events
+     */
+    volatile uint32_t Events;
+    /*!
+     * Scheduler internal, task list link
+     */
+    struct SchedTask_s *Next;
+}SchedTask_t;
+
+/*!
+ * \brief Initializes and registers a task
+ *
+ * \remark To be called from the main loop.
+ *
+ * \param [IN] task     Task to register
+ * \param [IN] handler  Task handler, may be NULL
+ * \param [IN] priority Task priority
+ */
+void SchedTaskInit( SchedTask_t *task, void ( *handler )( uint32_t events ), uint8_t priority );
+
+/*!
+ * \brief Wakes up a task, from an interrupt handler or the main loop
+ *
+ * \param [IN] task     Task to wake up
+ * \param [IN] events   Events to set
+ */
+void SchedSetEvents( SchedTask_t *task, uint32_t events );
+
+/*!
+ * \brief Sets the task woken with SCHED_EVENT_QUEUE when events are posted
+ *        to the event queue
+ *
+ * \remark The task is not woken again for the events it leaves queued, it
+ *         wakes itself up to resume.
+ *
+ * \param [IN] task     Task draining the event queue
+ */
+void SchedSetQueueTask( SchedTask_t *task );
+
+/*!
+ * \brief Sets the function called when no task is woken, the default one
+ *        is TimerLowPowerHandler
+ *
+ * \remark The function has to return on an interrupt, it checks
+ *         \ref SchedPending with the interrupts disabled before sleeping.
+ *
+ * \param [IN] idle     Idle function
+ */
+void SchedSetIdleHandler( void ( *idle )( void ) );
+
+/*!
+ * \brief Tells if a task has been woken
+ *
+ * \retval pending      true when the scheduler has a task to run
+ */
+bool SchedPending( void );
+
+/*!
+ * \brief Runs the woken task of highest priority
+ *
+ * \retval run          false when no task was woken
+ */
+bool SchedRunOnce( void );
+
+/*!
+ * \brief Runs the tasks and the idle function until a task gets one of the
+ *        given events
+ *
+ * \remark Other events set on the waited task keep the MCU awake, the task
+ *         should only be woken with the events it waits for.
+ *
+ * \param [IN] task     Task waited on
+ * \param [IN] mask     Events waited for
+ *
+ * \retval events       Events of the mask set on the task, cleared
+ */
+uint32_t SchedWait( SchedTask_t *task, uint32_t mask );
+
+/*!
+ * \brief Runs the tasks and the idle function, never returns
+ */
+void SchedRun( void );
+
+/*! \} defgroup LORA_SCHEDULER */
+/*! \} addtogroup LORA */
+
+#endif // __SCHEDULER_H__
@@ -0,0 +1,140 @@
+/*!
+ * \file      stats.c
+ *
+ * \brief     Runtime statistics of the stack implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <string.h>
+#include "tremo_cm4.h"
+#include "timer.h"
+#include "rtc-board.h"
+#include "profile.h"
+#include "stats.h"
+
+#ifdef CONFIG_LORA_RADIO_STATS
+#include "radio-stats.h"
+#endif
+
+#ifdef CONFIG_STATS
+
+Stats_t StatsCounters;
+
+/*!
+ * \brief Appends a tag and its value, as LEB128, when not 0 and room is left
+ */
+static uint8_t StatsPut( uint8_t *buf, uint8_t size, uint8_t len, uint8_t tag, uint32_t value )
+{
+    uint8_t need = 2;
+    uint32_t rest;
+
+    if( value == 0 )
+    {
+        return len;
+    }
+    for( rest = value >> 7; rest != 0; rest >>= 7 )
+    {
+        need++;
+    }
+    if( ( uint16_t )len + need > size )
+    {
+        return len;
+    }
+
+    buf[len++] = tag;
+    while( value >= 0x80 )
+    {
+        buf[len++] = ( uint8_t )value | 0x80;
+        value >>= 7;
+    }
+    buf[len++] = ( uint8_t )value;
+    return len;
+}
+
+void StatsMax( StatsCounter_t counter, uint32_t value )
+{
+    if( value > StatsCounters.Counters[counter] )
+    {
+        StatsCounters.Counters[counter] = value;
+    }
+}
+
+void StatsReset( void )
+{
+    uint32_t primask = __get_PRIMASK( );
+
+    __disable_irq( );
+    memset( &StatsCounters, 0, sizeof( Stats_t ) );
+    __set_PRIMASK( primask );
+#ifdef CONFIG_LOWPOWER_GOVERNOR
+    RtcResetLowPowerStats( );
+#endif
+#ifdef CONFIG_LORA_RADIO_STATS
+    RadioStatsReset( );
+#endif
+#ifdef CONFIG_PROFILE
+    ProfileReset( );
+#endif
+}
+
+uint8_t StatsExport( uint8_t *buf, uint8_t size )
+{
+    Stats_t stats;
+    uint32_t primask;
+    uint8_t len = 0;
+    uint8_t i;
+
+    if( size == 0 )
+    {
+        return 0;
+    }
+    primask = __get_PRIMASK( );
+    __disable_irq( );
+    stats = StatsCounters;
+    __set_PRIMASK( primask );
+
+    buf[len++] = STATS_EXPORT_VERSION;
+    for( i = 0; i < STATS_DR_MAX; i++ )
+    {
+        len = StatsPut( buf, size, len, STATS_TAG_UPLINK + i, stats.Uplinks[i] );
+        len = StatsPut( buf, size, len, STATS_TAG_DOWNLINK + i, stats.Downlinks[i] );
+    }
+    for( i = 0; i < STATS_COUNTER_MAX; i++ )
+    {
+        len = StatsPut( buf, size, len, STATS_TAG_COUNTER + i, stats.Counters[i] );
+    }
+#ifdef CONFIG_LOWPOWER_GOVERNOR
+    {
+        RtcLowPowerStats_t lowPower;
+
+        RtcGetLowPowerStats( &lowPower );
+        for( i = 0; i < RTC_LP_MODE_NUM; i++ )
+        {
+            len = StatsPut( buf, size, len, STATS_TAG_LOWPOWER + i, ( uint32_t )lowPower.Residency[i] );
+        }
+    }
+#endif
+#ifdef CONFIG_LORA_RADIO_STATS
+    {
+        RadioStats_t radio;
+
+        RadioStatsGet( &radio );
+        for( i = 0; i < RADIO_STATS_MODE_MAX; i++ )
+        {
+            len = StatsPut( buf, size, len, STATS_TAG_RADIO + i, ( uint32_t )( radio.Time[i] / 1000 ) );
+        }
+    }
+#endif
+#ifdef CONFIG_PROFILE
+    for( i = 0; i < PROFILE_PROBE_MAX; i++ )
+    {
+        if( ProfileProbes[i].Count != 0 )
+        {
+            len = StatsPut( buf, size, len, STATS_TAG_PROBE + i, ( uint32_t )( ProfileProbes[i].Total / ProfileProbes[i].Count ) );
+        }
+    }
+#endif
+    return len;
+}
+
+#endif
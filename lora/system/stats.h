@@ -0,0 +1,139 @@
+/*!
+ * \file      stats.h
+ *
+ * \brief     Runtime statistics of the stack
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_STATS
+ *
+ *            Counters bumped from the MAC, the timers, the AT layer and the
+ *            log: the uplinks and the downlinks per datarate, the MIC
+ *            failures, the RX windows opened and those a frame came in, the
+ *            join requests, the high water mark of the running timers, the
+ *            AT command lines and the bytes dropped, the log records lost.
+ *
+ *            \ref StatsExport packs them, with the low power residency, the
+ *            radio time per mode and the probe cycles of the stack when
+ *            built, for an uplink:
+ *
+ *                | version | tag | value (LEB128) | tag | value | ...
+ *
+ *            the counters at 0 left out, see STATS_TAG_.
+ *
+ *            Built with CONFIG_STATS, the STATS_ macros compile to nothing
+ *            otherwise. The counters are not atomic, an interrupt may lose
+ *            a count of the same counter.
+ *
+ * \{
+ */
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+
+/*!
+ * Datarates counted, the higher ones in the last
+ */
+#define STATS_DR_MAX                                16
+
+/*!
+ * Version of the exported form, its first byte
+ */
+#define STATS_EXPORT_VERSION                        1
+
+/*!
+ * Tags of the exported form, each followed by its value
+ */
+#define STATS_TAG_UPLINK                            0x00    //!< + DR, uplinks
+#define STATS_TAG_DOWNLINK                          0x10    //!< + DR, downlinks
+#define STATS_TAG_COUNTER                           0x20    //!< + StatsCounter_t
+#define STATS_TAG_LOWPOWER                          0x30    //!< + RtcLowPowerMode_t, residency [ms]
+#define STATS_TAG_RADIO                             0x38    //!< + RadioOperatingModes_t, time [ms]
+#define STATS_TAG_PROBE                             0x40    //!< + ProfileProbe_t, average [cycles]
+
+/*!
+ * Counters
+ */
+typedef enum
+{
+    STATS_MIC_FAIL = 0,         //!< Downlinks and join accepts with a wrong MIC
+    STATS_RX_WINDOW,            //!< RX windows opened
+    STATS_RX_FRAME,             //!< Frames received, the beacons excepted
+    STATS_JOIN_REQUEST,         //!< Join requests sent
+    STATS_TIMER_DEPTH,          //!< Most timers running at once
+    STATS_AT_COMMAND,           //!< AT command lines run
+    STATS_AT_DROPPED,           //!< AT bytes dropped, a full ring or line
+    STATS_LOG_DROPPED,          //!< Deferred log records dropped
+    STATS_RX_EARLY_DROP,        //!< Downlinks dropped before their MIC, repeated or out of the counter window
+    STATS_COUNTER_MAX,
+}StatsCounter_t;
+
+#ifdef CONFIG_STATS
+
+/*!
+ * \brief Counters
+ */
+typedef struct
+{
+    uint32_t Uplinks[STATS_DR_MAX];
+    uint32_t Downlinks[STATS_DR_MAX];
+    uint32_t Counters[STATS_COUNTER_MAX];
+}Stats_t;
+
+extern Stats_t StatsCounters;
+
+/*!
+ * Index of a datarate, the higher ones in the last
+ */
+#define STATS_DR( dr )                              ( ( ( uint8_t )( dr ) < STATS_DR_MAX ) ? ( uint8_t )( dr ) : ( STATS_DR_MAX - 1 ) )
+
+#define STATS_INC( counter )                        ( StatsCounters.Counters[counter]++ )
+#define STATS_ADD( counter, value )                 ( StatsCounters.Counters[counter] += ( value ) )
+#define STATS_MAX( counter, value )                 StatsMax( counter, value )
+#define STATS_UPLINK( dr )                          ( StatsCounters.Uplinks[STATS_DR( dr )]++ )
+#define STATS_DOWNLINK( dr )                        ( StatsCounters.Downlinks[STATS_DR( dr )]++ )
+
+/*!
+ * \brief Raises a high water mark, see STATS_MAX
+ *
+ * \param [IN] counter Counter
+ * \param [IN] value   Current value
+ */
+void StatsMax( StatsCounter_t counter, uint32_t value );
+
+/*!
+ * \brief Clears the counters, the low power residency, the radio time and the
+ *        probes built in
+ */
+void StatsReset( void );
+
+/*!
+ * \brief Packs the counters, the low power residency, the radio time and the
+ *        probes built in, the entries which do not fit left out
+ *
+ * \param [OUT] buf    Exported form
+ * \param [IN]  size   buf size
+ *
+ * \retval len         Length of the exported form
+ */
+uint8_t StatsExport( uint8_t *buf, uint8_t size );
+
+#else
+
+#define STATS_INC( counter )
+#define STATS_ADD( counter, value )
+#define STATS_MAX( counter, value )
+#define STATS_UPLINK( dr )
+#define STATS_DOWNLINK( dr )
+
+#endif
+
+/*! \} defgroup LORA_STATS */
+/*! \} addtogroup LORA */
+
+#endif // __STATS_H__
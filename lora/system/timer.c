@@ -63,6 +63,18 @@ Maintainer: Miguel Luis, Gregory Cristian and Wael Guibene
 #include "sx126x-board.h"
 #include "timer.h"
 #include "rtc-board.h"
+#include "profile.h"
+#include "itm-trace.h"
+#include "stats.h"
+#include "mem-profile.h"
+
+#if defined( CONFIG_HOT_FUNC ) || defined( CONFIG_TIMER_DEFER ) || defined( RUN_IN_RAM )
+#include "tremo_cm4.h"
+#endif
+#ifndef HOT_FUNC_ATTR
+// Also built on the host, where nothing runs from RAM
+#define HOT_FUNC_ATTR
+#endif
 
 /*!
  * safely execute call back
@@ -76,14 +88,134 @@ do                              \
     }                           \
     else                        \
     {                           \
+        ITM_TRACE_EVENT( ITM_TRACE_TIMER_FIRE, _callback_ ); \
         _callback_( );          \
     }                           \
 } while(0);                   
 
 
+#ifndef CONFIG_LOWPOWER_GOVERNOR
 volatile uint8_t HasLoopedThroughMain = 0;
+#endif
 static TimerTime_t g_systime_ref = 0;
 
+#ifdef CONFIG_TIMER_DEFER
+/*!
+ * Expired timers waiting for TimerDeferredProcess at most
+ */
+#ifndef TIMER_DEFER_SIZE
+#define TIMER_DEFER_SIZE        16
+#endif
+
+/*!
+ * Expired timers in expiry order, a timer stopped or restarted meanwhile
+ * leaves a NULL entry
+ */
+static TimerEvent_t *TimerDeferred[TIMER_DEFER_SIZE];
+static uint8_t TimerDeferredHead = 0;
+static uint8_t TimerDeferredCount = 0;
+
+/*!
+ * \brief Drops the pending callback of a timer, the interrupts disabled
+ */
+static void TimerDeferCancel( TimerEvent_t *obj )
+{
+    uint8_t i;
+
+    for( i = 0; i < TimerDeferredCount; i++ )
+    {
+        if( TimerDeferred[( TimerDeferredHead + i ) % TIMER_DEFER_SIZE] == obj )
+        {
+            TimerDeferred[( TimerDeferredHead + i ) % TIMER_DEFER_SIZE] = NULL;
+        }
+    }
+}
+
+/*!
+ * \brief Runs the callback of an expired timer, from the timer interrupt
+ *        for an urgent timer, from PendSV for the others
+ */
+static HOT_FUNC_ATTR void TimerDispatch( TimerEvent_t *obj )
+{
+    if( obj->Urgent == true )
+    {
+        exec_cb( obj->Callback );
+        return;
+    }
+    if( TimerDeferredCount >= TIMER_DEFER_SIZE )
+    {
+        // TIMER_DEFER_SIZE too small for the application
+        while(1);
+    }
+    TimerDeferred[( TimerDeferredHead + TimerDeferredCount ) % TIMER_DEFER_SIZE] = obj;
+    TimerDeferredCount++;
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+void TimerSetUrgent( TimerEvent_t *obj, bool urgent )
+{
+    obj->Urgent = urgent;
+}
+
+void TimerDeferredProcess( void )
+{
+    TimerEvent_t *cur;
+
+    while( TimerDeferredCount != 0 )
+    {
+        BoardDisableIrq();
+        cur = TimerDeferred[TimerDeferredHead];
+        TimerDeferredHead = ( TimerDeferredHead + 1 ) % TIMER_DEFER_SIZE;
+        TimerDeferredCount--;
+        BoardEnableIrq();
+
+        if( cur != NULL )
+        {
+            exec_cb( cur->Callback );
+        }
+    }
+}
+#else
+#define TimerDispatch( _obj_ )      exec_cb( ( _obj_ )->Callback )
+#endif
+
+#ifdef CONFIG_TIMER_PRECISE
+/*!
+ * Deadlines closer than this are programmed on LPTIMER0 right away [RTC ticks]
+ */
+#ifndef TIMER_PRECISE_RANGE
+#define TIMER_PRECISE_RANGE     0x8000
+#endif
+
+/*!
+ * Precise timers list, sorted on the deadline. Timestamp holds the deadline
+ * in RTC ticks, compared with wrap around.
+ */
+static TimerEvent_t *TimerPreciseHead = NULL;
+
+/*!
+ * Millisecond timer waking up shortly before a far precise deadline
+ */
+static TimerEvent_t TimerPreciseWakeUp;
+
+static bool TimerPreciseExists( TimerEvent_t *obj );
+static bool TimerPreciseStop( TimerEvent_t *obj );
+#endif
+
+#ifdef CONFIG_TIMER_HEAP
+/*!
+ * Running timers, binary min-heap on the latest expiry time (timeout plus
+ * slack). With CONFIG_TIMER_HEAP Timestamp holds the absolute latest expiry
+ * time in ms of RtcGetTimerValue, compared with wrap around, so timeouts must
+ * stay below 2^31 ms.
+ */
+static TimerEvent_t *TimerHeap[TIMER_HEAP_SIZE];
+
+/*!
+ * Number of running timers
+ */
+static uint8_t TimerHeapCount = 0;
+#else
 /*!
  * Timers list head pointer
  */
@@ -126,6 +258,14 @@ static void TimerSetTimeout( TimerEvent_t *obj );
  */
 static bool TimerExists( TimerEvent_t *obj );
 
+#ifdef CONFIG_STATS
+/*!
+ * \brief Number of timers in the list
+ */
+static uint32_t TimerListDepth( void );
+#endif
+#endif
+
 
 void TimerSetSysTime( TimerSysTime_t sysTime )
 {
@@ -146,6 +286,270 @@ TimerSysTime_t TimerGetSysTime( void )
     return sysTime;
 }
 
+#ifdef CONFIG_TIMER_HEAP
+/*!
+ * \brief Tells if timer a expires before timer b
+ */
+static inline bool TimerHeapBefore( TimerEvent_t *a, TimerEvent_t *b )
+{
+    return ( int32_t )( a->Timestamp - b->Timestamp ) < 0;
+}
+
+static inline void TimerHeapPlace( TimerEvent_t *obj, uint8_t index )
+{
+    TimerHeap[index] = obj;
+    obj->HeapIndex = index + 1;
+}
+
+static void TimerHeapSiftUp( uint8_t index )
+{
+    TimerEvent_t *obj = TimerHeap[index];
+
+    while( index > 0 )
+    {
+        uint8_t parent = ( index - 1 ) >> 1;
+
+        if( TimerHeapBefore( obj, TimerHeap[parent] ) == false )
+        {
+            break;
+        }
+        TimerHeapPlace( TimerHeap[parent], index );
+        index = parent;
+    }
+    TimerHeapPlace( obj, index );
+}
+
+static void TimerHeapSiftDown( uint8_t index )
+{
+    TimerEvent_t *obj = TimerHeap[index];
+
+    for( ;; )
+    {
+        uint8_t child = ( index << 1 ) + 1;
+
+        if( child >= TimerHeapCount )
+        {
+            break;
+        }
+        if( ( ( child + 1 ) < TimerHeapCount ) && TimerHeapBefore( TimerHeap[child + 1], TimerHeap[child] ) )
+        {
+            child++;
+        }
+        if( TimerHeapBefore( TimerHeap[child], obj ) == false )
+        {
+            break;
+        }
+        TimerHeapPlace( TimerHeap[child], index );
+        index = child;
+    }
+    TimerHeapPlace( obj, index );
+}
+
+/*!
+ * \brief Tells if the object is in the heap, O(1)
+ */
+static bool TimerExists( TimerEvent_t *obj )
+{
+    return ( obj->HeapIndex != 0 ) && ( obj->HeapIndex <= TimerHeapCount ) &&
+           ( TimerHeap[obj->HeapIndex - 1] == obj );
+}
+
+static void TimerHeapRemove( TimerEvent_t *obj )
+{
+    uint8_t index = obj->HeapIndex - 1;
+    TimerEvent_t *last = TimerHeap[--TimerHeapCount];
+
+    obj->HeapIndex = 0;
+    obj->IsRunning = false;
+    if( last != obj )
+    {
+        TimerHeapPlace( last, index );
+        if( ( index > 0 ) && TimerHeapBefore( last, TimerHeap[( index - 1 ) >> 1] ) )
+        {
+            TimerHeapSiftUp( index );
+        }
+        else
+        {
+            TimerHeapSiftDown( index );
+        }
+    }
+}
+
+/*!
+ * \brief Arms the RTC alarm on the first timer to expire
+ */
+static void TimerHeapSetTimeout( void )
+{
+    int32_t remaining;
+
+    if( TimerHeapCount == 0 )
+    {
+        RtcStopTimeout( );
+        return;
+    }
+    remaining = ( int32_t )( TimerHeap[0]->Timestamp - ( uint32_t )RtcGetTimerValue( ) );
+    RtcSetTimeout( ( remaining > 0 ) ? ( uint32_t )remaining : 0 );
+}
+
+/*!
+ * \brief Removes from the heap the first timer whose timeout has elapsed but
+ *        whose slack has not, to be served by the current wakeup
+ *
+ * \retval obj Removed timer, NULL when none
+ */
+static TimerEvent_t* TimerHeapRemoveDueInSlack( void )
+{
+    uint32_t now = ( uint32_t )RtcGetTimerValue( );
+
+    for( uint8_t i = 0; i < TimerHeapCount; i++ )
+    {
+        TimerEvent_t *obj = TimerHeap[i];
+
+        if( ( obj->Slack != 0 ) && ( ( int32_t )( obj->Timestamp - obj->Slack - now ) <= 0 ) )
+        {
+            TimerHeapRemove( obj );
+            return obj;
+        }
+    }
+    return NULL;
+}
+
+void TimerInit( TimerEvent_t *obj, void ( *callback )( void ) )
+{
+    BoardDisableIrq();
+    if( TimerExists( obj ) == true )
+    {
+        TimerHeapRemove( obj );
+        TimerHeapSetTimeout( );
+    }
+#ifdef CONFIG_TIMER_DEFER
+    TimerDeferCancel( obj );
+#endif
+    BoardEnableIrq();
+
+    obj->Timestamp = 0;
+    obj->ReloadValue = 0;
+    obj->IsRunning = false;
+    obj->Callback = callback;
+    obj->Next = NULL;
+    obj->HeapIndex = 0;
+    obj->Slack = 0;
+#ifdef CONFIG_TIMER_DEFER
+    obj->Urgent = false;
+#endif
+}
+
+void TimerStart( TimerEvent_t *obj )
+{
+    BoardDisableIrq();
+
+    if( ( obj == NULL ) || ( TimerExists( obj ) == true ) )
+    {
+        BoardEnableIrq();
+        return;
+    }
+#ifdef CONFIG_TIMER_PRECISE
+    if( TimerPreciseExists( obj ) == true )
+    {
+        BoardEnableIrq();
+        return;
+    }
+#endif
+#ifdef CONFIG_TIMER_DEFER
+    // Restarted before its deferred callback ran, the expiry is dropped
+    TimerDeferCancel( obj );
+#endif
+    if( TimerHeapCount >= TIMER_HEAP_SIZE )
+    {
+        // TIMER_HEAP_SIZE too small for the application
+        while(1);
+    }
+
+    // The heap is ordered on the latest expiry, the timeout plus the slack
+    obj->Timestamp = ( uint32_t )RtcGetTimerValue( ) + obj->ReloadValue + obj->Slack;
+    obj->IsRunning = true;
+    TimerHeapPlace( obj, TimerHeapCount++ );
+    TimerHeapSiftUp( obj->HeapIndex - 1 );
+    STATS_MAX( STATS_TIMER_DEPTH, TimerHeapCount );
+
+    if( TimerHeap[0] == obj )
+    {
+        TimerHeapSetTimeout( );
+    }
+    BoardEnableIrq();
+}
+
+HOT_FUNC_ATTR void TimerIrqHandler( void )
+{
+    TimerEvent_t* cur;
+
+    ITM_TRACE_EVENT( ITM_TRACE_ISR_ENTER, ITM_TRACE_ISR_TIMER );
+    PROFILE_START( PROFILE_TIMER_IRQ );
+    /* the alarm is for the heap root, execute it imediately */
+    if( TimerHeapCount != 0 )
+    {
+        cur = TimerHeap[0];
+        TimerHeapRemove( cur );
+        TimerDispatch( cur );
+    }
+
+    // execute all the other expired objects
+    while( ( TimerHeapCount != 0 ) &&
+           ( ( int32_t )( TimerHeap[0]->Timestamp - ( uint32_t )RtcGetTimerValue( ) ) <= 0 ) )
+    {
+        cur = TimerHeap[0];
+        TimerHeapRemove( cur );
+        TimerDispatch( cur );
+    }
+
+    // execute the objects waiting within their slack on this wakeup
+    while( ( cur = TimerHeapRemoveDueInSlack( ) ) != NULL )
+    {
+        TimerDispatch( cur );
+    }
+
+    TimerHeapSetTimeout( );
+    PROFILE_STOP( PROFILE_TIMER_IRQ );
+    ITM_TRACE_EVENT( ITM_TRACE_ISR_EXIT, ITM_TRACE_ISR_TIMER );
+}
+
+void TimerStop( TimerEvent_t *obj )
+{
+    bool wasRoot;
+
+#ifdef CONFIG_TIMER_PRECISE
+    if( TimerPreciseStop( obj ) == true )
+    {
+        return;
+    }
+#endif
+    BoardDisableIrq();
+#ifdef CONFIG_TIMER_DEFER
+    if( obj != NULL )
+    {
+        TimerDeferCancel( obj );
+    }
+#endif
+
+    if( ( obj == NULL ) || ( TimerExists( obj ) == false ) )
+    {
+        if( obj != NULL )
+        {
+            obj->IsRunning = false;
+        }
+        BoardEnableIrq();
+        return;
+    }
+
+    wasRoot = ( TimerHeap[0] == obj );
+    TimerHeapRemove( obj );
+    if( wasRoot == true )
+    {
+        TimerHeapSetTimeout( );
+    }
+    BoardEnableIrq();
+}
+#else
 static void TimeStampsUpdate()
 {    
     TimerTime_t old =  RtcGetTimerContext(); 
@@ -169,6 +573,13 @@ void TimerInit( TimerEvent_t *obj, void ( *callback )( void ) )
   obj->IsRunning = false;
   obj->Callback = callback;
   obj->Next = NULL;
+  obj->Slack = 0;
+#ifdef CONFIG_TIMER_DEFER
+  obj->Urgent = false;
+  BoardDisableIrq();
+  TimerDeferCancel( obj );
+  BoardEnableIrq();
+#endif
 }
 
 void TimerStart( TimerEvent_t *obj )
@@ -181,8 +592,20 @@ void TimerStart( TimerEvent_t *obj )
         BoardEnableIrq();
         return;
     }
+#ifdef CONFIG_TIMER_PRECISE
+    if( TimerPreciseExists( obj ) == true )
+    {
+        BoardEnableIrq();
+        return;
+    }
+#endif
+#ifdef CONFIG_TIMER_DEFER
+    // Restarted before its deferred callback ran, the expiry is dropped
+    TimerDeferCancel( obj );
+#endif
 
-    obj->Timestamp = obj->ReloadValue;
+    // The list is sorted on the latest expiry, the timeout plus the slack
+    obj->Timestamp = obj->ReloadValue + obj->Slack;
     obj->IsRunning = false;
 
     if( TimerListHead == NULL )
@@ -205,6 +628,7 @@ void TimerStart( TimerEvent_t *obj )
             TimerInsertTimer( obj);
         }
     }
+    STATS_MAX( STATS_TIMER_DEPTH, TimerListDepth( ) );
     BoardEnableIrq();
 }
 
@@ -246,17 +670,45 @@ static void TimerInsertNewHeadTimer( TimerEvent_t *obj )
   TimerSetTimeout( TimerListHead );
 }
 
-void TimerIrqHandler( void )
+/*!
+ * \brief Removes from the list the first timer whose timeout has elapsed but
+ *        whose slack has not, to be served by the current wakeup
+ *
+ * \retval obj Removed timer, NULL when none
+ */
+static TimerEvent_t* TimerRemoveDueInSlack( void )
+{
+    uint32_t elapsed = RtcGetElapsedTime( );
+    TimerEvent_t** cur = &TimerListHead;
+
+    while( *cur != NULL )
+    {
+        TimerEvent_t* obj = *cur;
+
+        if( ( obj->Slack != 0 ) && ( obj->Timestamp <= ( obj->Slack + elapsed ) ) )
+        {
+            *cur = obj->Next;
+            obj->IsRunning = false;
+            return obj;
+        }
+        cur = &obj->Next;
+    }
+    return NULL;
+}
+
+HOT_FUNC_ATTR void TimerIrqHandler( void )
 {
     TimerEvent_t* cur;
 
+    ITM_TRACE_EVENT( ITM_TRACE_ISR_ENTER, ITM_TRACE_ISR_TIMER );
+    PROFILE_START( PROFILE_TIMER_IRQ );
     //update timer context for callbacks
     TimeStampsUpdate();
     /* execute imediately the alarm callback */
     if ( TimerListHead != NULL ) {
         cur = TimerListHead;
         TimerListHead = TimerListHead->Next;
-        exec_cb( cur->Callback );
+        TimerDispatch( cur );
     }
 
     // remove all the expired object from the list
@@ -264,7 +716,13 @@ void TimerIrqHandler( void )
     {
         cur = TimerListHead;
         TimerListHead = TimerListHead->Next;
-        exec_cb( cur->Callback );
+        TimerDispatch( cur );
+    }
+
+    // execute the objects waiting within their slack on this wakeup
+    while( ( cur = TimerRemoveDueInSlack( ) ) != NULL )
+    {
+        TimerDispatch( cur );
     }
     
     //update timestamps after callbacks
@@ -274,15 +732,30 @@ void TimerIrqHandler( void )
     if(( TimerListHead != NULL ) && (TimerListHead->IsRunning == false)) {
         TimerSetTimeout( TimerListHead );
     }
+    PROFILE_STOP( PROFILE_TIMER_IRQ );
+    ITM_TRACE_EVENT( ITM_TRACE_ISR_EXIT, ITM_TRACE_ISR_TIMER );
 }
 
 void TimerStop( TimerEvent_t *obj ) 
 {
+#ifdef CONFIG_TIMER_PRECISE
+    if( TimerPreciseStop( obj ) == true )
+    {
+        return;
+    }
+#endif
     BoardDisableIrq();
 
     TimerEvent_t* prev = TimerListHead;
     TimerEvent_t* cur = TimerListHead;
 
+#ifdef CONFIG_TIMER_DEFER
+    if( obj != NULL )
+    {
+        TimerDeferCancel( obj );
+    }
+#endif
+
     // List is empty or the Obj to stop does not exist 
     if( ( TimerListHead == NULL ) || ( obj == NULL ) )
     {
@@ -366,12 +839,33 @@ static bool TimerExists( TimerEvent_t *obj )
     return false;  
 }
 
+#ifdef CONFIG_STATS
+static uint32_t TimerListDepth( void )
+{
+    TimerEvent_t* cur = TimerListHead;
+    uint32_t depth = 0;
+
+    while( cur != NULL )
+    {
+        depth++;
+        cur = cur->Next;
+    }
+    return depth;
+}
+#endif
+#endif
+
 void TimerReset( TimerEvent_t *obj )
 {
   TimerStop( obj );
   TimerStart( obj );
 }
 
+void TimerSetSlack( TimerEvent_t *obj, uint32_t slack )
+{
+    obj->Slack = slack;
+}
+
 void TimerSetValue( TimerEvent_t *obj, uint32_t value )
 {
     TimerStop( obj );
@@ -390,20 +884,228 @@ TimerTime_t TimerGetElapsedTime( TimerTime_t savedTime )
     return (TimerGetCurrentTime() - savedTime);
 }
 
+#ifdef CONFIG_TIMER_PRECISE
+TimerTime_t TimerGetCurrentTicks( void )
+{
+    return RtcGetTimerTicks( );
+}
+
+/*!
+ * \brief Programs LPTIMER0 on the first precise deadline when it is close,
+ *        else wakes up in the millisecond domain shortly before it
+ */
+static void TimerPreciseSetTimeout( void )
+{
+    int32_t remaining;
+
+    RtcStopPreciseTimeout( );
+    TimerStop( &TimerPreciseWakeUp );
+    if( TimerPreciseHead == NULL )
+    {
+        return;
+    }
+
+    remaining = ( int32_t )( TimerPreciseHead->Timestamp - ( uint32_t )RtcGetTimerTicks( ) );
+    if( remaining <= TIMER_PRECISE_RANGE )
+    {
+        RtcSetPreciseTimeout( ( remaining > 0 ) ? ( uint32_t )remaining : 0 );
+    }
+    else
+    {
+        TimerSetValue( &TimerPreciseWakeUp, ( uint32_t )RtcTick2Ms( remaining - ( TIMER_PRECISE_RANGE / 2 ) ) );
+        TimerStart( &TimerPreciseWakeUp );
+    }
+}
+
+static void OnTimerPreciseWakeUp( void )
+{
+    TimerPreciseSetTimeout( );
+}
+
+static bool TimerPreciseExists( TimerEvent_t *obj )
+{
+    TimerEvent_t* cur = TimerPreciseHead;
+
+    while( cur != NULL )
+    {
+        if( cur == obj )
+        {
+            return true;
+        }
+        cur = cur->Next;
+    }
+    return false;
+}
+
+/*!
+ * \brief Removes the object from the precise list
+ *
+ * \retval true when the object was in the precise list
+ */
+static bool TimerPreciseStop( TimerEvent_t *obj )
+{
+    TimerEvent_t **cur = &TimerPreciseHead;
+    bool found = false;
+    bool wasHead = false;
+
+    BoardDisableIrq();
+    while( *cur != NULL )
+    {
+        if( *cur == obj )
+        {
+            wasHead = ( cur == &TimerPreciseHead );
+            *cur = obj->Next;
+            obj->Next = NULL;
+            obj->IsRunning = false;
+            found = true;
+            break;
+        }
+        cur = &( *cur )->Next;
+    }
+    BoardEnableIrq();
 
+    if( wasHead == true )
+    {
+        TimerPreciseSetTimeout( );
+    }
+    return found;
+}
+
+void TimerStartPrecise( TimerEvent_t *obj, TimerTime_t origin, int32_t delay )
+{
+    TimerEvent_t **cur;
+    uint32_t deadline;
+
+    if( obj == NULL )
+    {
+        return;
+    }
+    if( TimerPreciseWakeUp.Callback == NULL )
+    {
+        TimerInit( &TimerPreciseWakeUp, OnTimerPreciseWakeUp );
+    }
+
+    if( delay >= 0 )
+    {
+        deadline = ( uint32_t )( origin + RtcUs2Tick( ( uint32_t )delay ) );
+    }
+    else
+    {
+        deadline = ( uint32_t )( origin - RtcUs2Tick( ( uint32_t )( -delay ) ) );
+    }
+
+    TimerStop( obj );
+
+    BoardDisableIrq();
+    obj->Timestamp = deadline;
+    obj->IsRunning = true;
+    cur = &TimerPreciseHead;
+    while( ( *cur != NULL ) && ( ( int32_t )( ( *cur )->Timestamp - deadline ) <= 0 ) )
+    {
+        cur = &( *cur )->Next;
+    }
+    obj->Next = *cur;
+    *cur = obj;
+    BoardEnableIrq();
+
+    if( TimerPreciseHead == obj )
+    {
+        TimerPreciseSetTimeout( );
+    }
+}
+
+void TimerPreciseIrqHandler( void )
+{
+    TimerEvent_t* cur;
+
+    while( ( TimerPreciseHead != NULL ) &&
+           ( ( int32_t )( TimerPreciseHead->Timestamp - ( uint32_t )RtcGetTimerTicks( ) ) <= 0 ) )
+    {
+        cur = TimerPreciseHead;
+        TimerPreciseHead = cur->Next;
+        cur->Next = NULL;
+        cur->IsRunning = false;
+        exec_cb( cur->Callback );
+    }
+
+    TimerPreciseSetTimeout( );
+}
+#endif
+
+#ifndef CONFIG_TIMER_HEAP
 static void TimerSetTimeout( TimerEvent_t *obj )
 {
     obj->IsRunning = true;
     RtcSetTimeout(obj->Timestamp);
 }
+#endif
+
+TimerTime_t TimerGetTimeToNextEvent( void )
+{
+    TimerTime_t next = TIMER_NO_EVENT;
+    int32_t remaining;
+
+#ifdef CONFIG_TIMER_HEAP
+    if( TimerHeapCount != 0 )
+    {
+        remaining = ( int32_t )( TimerHeap[0]->Timestamp - ( uint32_t )RtcGetTimerValue( ) );
+        next = ( remaining > 0 ) ? ( TimerTime_t )remaining : 0;
+    }
+#else
+    if( TimerListHead != NULL )
+    {
+        remaining = ( int32_t )( TimerListHead->Timestamp - ( uint32_t )RtcGetElapsedTime( ) );
+        next = ( remaining > 0 ) ? ( TimerTime_t )remaining : 0;
+    }
+#endif
+#ifdef CONFIG_TIMER_PRECISE
+    if( TimerPreciseHead != NULL )
+    {
+        remaining = ( int32_t )( TimerPreciseHead->Timestamp - ( uint32_t )RtcGetTimerTicks( ) );
+        if( remaining <= 0 )
+        {
+            next = 0;
+        }
+        else if( RtcTick2Ms( remaining ) < next )
+        {
+            next = RtcTick2Ms( remaining );
+        }
+    }
+#endif
+    return next;
+}
+
+uint8_t TimerGetRunning( void ( **next )( void ) )
+{
+#ifdef CONFIG_TIMER_HEAP
+    *next = ( TimerHeapCount != 0 ) ? TimerHeap[0]->Callback : NULL;
+    return TimerHeapCount;
+#else
+    TimerEvent_t *cur = TimerListHead;
+    uint8_t count = 0;
+
+    *next = ( cur != NULL ) ? cur->Callback : NULL;
+    // Bounded, the list may be corrupted when a fault is being recorded
+    while( ( cur != NULL ) && ( count < UINT8_MAX ) )
+    {
+        count++;
+        cur = cur->Next;
+    }
+    return count;
+#endif
+}
 
 TimerTime_t TimerTempCompensation( TimerTime_t period, float temperature )
 {
-    (void)temperature;
-    
-    return period;
+    return RtcTempCompensation( period, temperature );
 }
 
+#ifdef CONFIG_LOWPOWER_GOVERNOR
+void TimerLowPowerHandler( void )
+{
+    RtcEnterLowPower( );
+}
+#else
 void TimerLowPowerHandler( void )
 {
     //if( ( TimerListHead != NULL ) && ( TimerListHead->IsRunning == true ) )
@@ -419,5 +1121,6 @@ void TimerLowPowerHandler( void )
         }
     }
 }
+#endif
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -50,9 +50,16 @@ typedef struct TimerEvent_s
 {
     uint32_t Timestamp;         //! Expiring timer value in ticks from TimerContext
     uint32_t ReloadValue;       //! Reload Value when Timer is restarted
+    uint32_t Slack;             //! Tolerated expiry delay in ms, to share a wakeup with other timers
     bool IsRunning;             //! Is the timer currently running
     void ( *Callback )( void ); //! Timer IRQ callback function
     struct TimerEvent_s *Next;  //! Pointer to the next Timer object.
+#ifdef CONFIG_TIMER_HEAP
+    uint8_t HeapIndex;          //! Position in the timer heap plus one, 0 when stopped
+#endif
+#ifdef CONFIG_TIMER_DEFER
+    bool Urgent;                //! Callback run from the timer interrupt, not deferred
+#endif
 } TimerEvent_t;
 
 
@@ -60,6 +67,11 @@ typedef struct TimerEvent_s
 typedef uint64_t TimerTime_t;
 #endif
 
+/*!
+ * \brief TimerGetTimeToNextEvent value when no timer is running
+ */
+#define TIMER_NO_EVENT                              ( ( TimerTime_t )-1 )
+
 /* Exported constants --------------------------------------------------------*/
 /* External variables --------------------------------------------------------*/
 /* Exported macros -----------------------------------------------------------*/
@@ -158,6 +170,40 @@ void TimerInit( TimerEvent_t *obj, void ( *callback )( void ) );
  */
 void TimerIrqHandler( void );
 
+/*!
+ * \brief Sets how late the timer object may expire
+ *
+ * \remark A timer with a slack expires up to slack ms after its timeout,
+ *         together with the other timers expiring in that time, so that they
+ *         are all served by a single wakeup. The default slack is 0.
+ *
+ * \param [IN] obj   Structure containing the timer object parameters
+ * \param [IN] slack Tolerated expiry delay [ms]
+ */
+void TimerSetSlack( TimerEvent_t *obj, uint32_t slack );
+
+#ifdef CONFIG_TIMER_DEFER
+/*!
+ * \brief Sets whether the callback of the timer object runs from the timer
+ *        interrupt
+ *
+ * \remark With CONFIG_TIMER_DEFER the callbacks run from PendSV, at the
+ *         lowest priority, so that a long callback does not hold off the
+ *         radio, timer and UART interrupts. An urgent timer, such as the
+ *         opening of a receive window, keeps running from the timer
+ *         interrupt and has to be short. TimerInit clears it.
+ *
+ * \param [IN] obj    Structure containing the timer object parameters
+ * \param [IN] urgent true to run the callback from the timer interrupt
+ */
+void TimerSetUrgent( TimerEvent_t *obj, bool urgent );
+
+/*!
+ * \brief Runs the callbacks of the expired timers, from PendSV_Handler
+ */
+void TimerDeferredProcess( void );
+#endif
+
 /*!
  * \brief Starts and adds the timer object to the list of timer events
  *
@@ -203,6 +249,33 @@ TimerTime_t TimerGetCurrentTime( void );
  */
 TimerTime_t TimerGetElapsedTime( TimerTime_t savedTime );
 
+#ifdef CONFIG_TIMER_PRECISE
+/*!
+ * \brief Read the current time in RTC ticks
+ *
+ * \retval returns current time in RTC ticks, origin for TimerStartPrecise
+ */
+TimerTime_t TimerGetCurrentTicks( void );
+
+/*!
+ * \brief Starts the timer object to expire delay us after an origin
+ *
+ * \remark The expiry is driven by LPTIMER0 with the RTC tick resolution
+ *         instead of the millisecond RTC alarm. The object is stopped with
+ *         TimerStop, TimerStart has no effect on it while it is running.
+ *
+ * \param [IN] obj    Structure containing the timer object parameters
+ * \param [IN] origin Reference time from TimerGetCurrentTicks
+ * \param [IN] delay  Delay from the origin [us], may be negative
+ */
+void TimerStartPrecise( TimerEvent_t *obj, TimerTime_t origin, int32_t delay );
+
+/*!
+ * \brief Precise timer IRQ event handler
+ */
+void TimerPreciseIrqHandler( void );
+#endif
+
 /*!
  * \brief Computes the temperature compensation for a period of time on a
  *        specific temperature.
@@ -214,6 +287,29 @@ TimerTime_t TimerGetElapsedTime( TimerTime_t savedTime );
  */
 TimerTime_t TimerTempCompensation( TimerTime_t period, float temperature );
 
+/*!
+ * \brief Returns the time until the next timer expiry
+ *
+ * \remark To be called with the interrupts disabled.
+ *
+ * \retval time Time to the next expiry in ms, 0 when due, TIMER_NO_EVENT
+ *              when no timer is running
+ */
+TimerTime_t TimerGetTimeToNextEvent( void );
+
+/*!
+ * \brief Running timers, for a diagnostic snapshot
+ *
+ * \remark To be called with the interrupts disabled. The precise timers are
+ *         not counted.
+ *
+ * \param [OUT] next   Callback of the next timer to expire, NULL when no
+ *                     timer is running
+ *
+ * \retval count       Number of running timers, at most UINT8_MAX
+ */
+uint8_t TimerGetRunning( void ( **next )( void ) );
+
 /*!
  * \brief Manages the entry into ARM cortex deep-sleep mode
  */
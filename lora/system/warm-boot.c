@@ -0,0 +1,81 @@
+/*!
+ * \file      warm-boot.c
+ *
+ * \brief     State kept in RAM across a soft or watchdog reset implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stddef.h>
+#include <string.h>
+#include "tremo_cm4.h"
+#include "crc.h"
+#include "warm-boot.h"
+
+#ifdef CONFIG_WARM_BOOT
+
+#define WARM_BOOT_MAGIC                             0x5741524D
+
+static WarmBootState_t WarmBootState RETAINED_ATTR;
+
+static bool WarmBoot = false;
+
+static uint16_t WarmBootCrc( void )
+{
+    return CrcCompute( &CrcCcitt, ( const uint8_t * )&WarmBootState, offsetof( WarmBootState_t, Crc ) );
+}
+
+bool WarmBootInit( void )
+{
+    // The reset flags are sticky until the next power on, the RAM content
+    // itself tells if it survived
+    WarmBoot = ( WarmBootState.Magic == WARM_BOOT_MAGIC ) &&
+               ( WarmBootState.Size == sizeof( WarmBootState_t ) ) &&
+               ( WarmBootState.Crc == WarmBootCrc( ) );
+
+    if( WarmBoot == true )
+    {
+        WarmBootState.WarmBoots++;
+    }
+    else
+    {
+        memset( &WarmBootState, 0, sizeof( WarmBootState_t ) );
+        WarmBootState.Magic = WARM_BOOT_MAGIC;
+        WarmBootState.Size = sizeof( WarmBootState_t );
+    }
+    WarmBootCommit( );
+    return WarmBoot;
+}
+
+bool WarmBootIsWarm( void )
+{
+    return WarmBoot;
+}
+
+WarmBootState_t *WarmBootGet( void )
+{
+    return &WarmBootState;
+}
+
+void WarmBootCommit( void )
+{
+    WarmBootState.Crc = WarmBootCrc( );
+}
+
+#ifdef CONFIG_WARM_BOOT_RETAINED
+bool WarmBootBlockValid( const WarmBootBlock_t *block, const void *data, uint16_t size )
+{
+    return ( WarmBoot == true ) && ( block->Size == size ) &&
+           ( block->Crc == CrcCompute( &CrcCcitt, ( const uint8_t * )data, size ) );
+}
+
+void WarmBootBlockSeal( WarmBootBlock_t *block, const void *data, uint16_t size )
+{
+    block->Size = size;
+    block->Crc = CrcCompute( &CrcCcitt, ( const uint8_t * )data, size );
+}
+#endif
+
+#elif defined( CONFIG_WARM_BOOT_RETAINED )
+#error "CONFIG_WARM_BOOT_RETAINED needs CONFIG_WARM_BOOT"
+
+#endif
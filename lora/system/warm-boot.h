@@ -0,0 +1,115 @@
+/*!
+ * \file      warm-boot.h
+ *
+ * \brief     State kept in RAM across a soft or watchdog reset
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_WARM_BOOT
+ *
+ *            The state lives in the .noinit section of the linker script,
+ *            which the startup neither loads nor clears. \ref WarmBootInit
+ *            runs first thing at boot: when the magic, the size or the CRC
+ *            does not match, as after a power on or a brown out, the state
+ *            is cleared and the boot is cold. Otherwise the boot is warm
+ *            and the drivers may skip the steps whose result is retained,
+ *            the radio reset and calibrations in particular.
+ *
+ *            CONFIG_WARM_BOOT_RETAINED moves the state to the .retained
+ *            section in the retention SRAM, and keeps more there with
+ *            RETAINED_ATTR: the MAC session and frame counters, checked with
+ *            a \ref WarmBootBlock_t, and the deferred log ring and radio
+ *            statistics, cleared on a cold boot. A warm boot then restores
+ *            the session without reading the flash.
+ *
+ * \{
+ */
+#ifndef __WARM_BOOT_H__
+#define __WARM_BOOT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * Retained state, updated with \ref WarmBootCommit
+ */
+typedef struct
+{
+    uint32_t Magic;
+    uint16_t Size;          //!< Catches a layout change by a firmware update
+    uint16_t WarmBoots;     //!< Warm boots since the last cold boot
+    uint32_t ImageCalFreq;  //!< Frequency the radio image was calibrated for [Hz], 0 when the radio lost it
+    uint16_t ImageCalBoot;  //!< WarmBoots when the image was calibrated
+    int8_t ImageCalTemp;    //!< Temperature of the image calibration [Celsius], INT8_MIN when unknown
+    uint8_t Reserved;
+    uint16_t Crc;
+}WarmBootState_t;
+
+#ifdef CONFIG_WARM_BOOT_RETAINED
+/*!
+ * Check of a block of retained state, kept next to it
+ */
+typedef struct
+{
+    uint16_t Size;
+    uint16_t Crc;
+}WarmBootBlock_t;
+#endif
+
+/*!
+ * \brief Validates the retained state, to be called first at boot
+ *
+ * \retval warm        true when the state survived the reset
+ */
+bool WarmBootInit( void );
+
+/*!
+ * \brief Tells if the current boot is warm
+ *
+ * \retval warm        Result of \ref WarmBootInit
+ */
+bool WarmBootIsWarm( void );
+
+/*!
+ * \brief Retained state, to be followed by \ref WarmBootCommit once modified
+ *
+ * \retval state       Retained state
+ */
+WarmBootState_t *WarmBootGet( void );
+
+/*!
+ * \brief Seals the retained state after a modification
+ */
+void WarmBootCommit( void );
+
+#ifdef CONFIG_WARM_BOOT_RETAINED
+/*!
+ * \brief Checks a block of retained state
+ *
+ * \param [IN] block   Check of the block
+ * \param [IN] data    Block
+ * \param [IN] size    Size of the block
+ *
+ * \retval valid       true on a warm boot when the block was sealed with
+ *                     this size and did not change since
+ */
+bool WarmBootBlockValid( const WarmBootBlock_t *block, const void *data, uint16_t size );
+
+/*!
+ * \brief Seals a block of retained state after a modification
+ *
+ * \param [OUT] block  Check of the block
+ * \param [IN] data    Block
+ * \param [IN] size    Size of the block
+ */
+void WarmBootBlockSeal( WarmBootBlock_t *block, const void *data, uint16_t size );
+#endif
+
+/*! \} defgroup LORA_WARM_BOOT */
+/*! \} addtogroup LORA */
+
+#endif // __WARM_BOOT_H__
@@ -0,0 +1,288 @@
+/*!
+ * \file      watchdog.c
+ *
+ * \brief     Task health monitor feeding the IWDG implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "timer.h"
+#include "tremo_cm4.h"
+#include "tremo_rcc.h"
+#include "tremo_iwdg.h"
+#include "warm-boot.h"
+#include "watchdog.h"
+
+#ifdef CONFIG_WATCHDOG
+
+#ifndef CONFIG_WARM_BOOT
+#error "CONFIG_WATCHDOG needs CONFIG_WARM_BOOT"
+#endif
+
+/*!
+ * IWDG ticks per second, the XO32K divided by the 256 prescaler
+ */
+#define WATCHDOG_IWDG_HZ                            ( 32768 / 256 )
+
+/*!
+ * Counters, kept across the resets but the power on
+ */
+typedef struct
+{
+    uint16_t Boots;
+    uint16_t Resets;
+    /*!
+     * Sections open and start of the outer one [ms], those of an IWDG reset
+     * are the hangs
+     */
+    uint8_t Depth[WATCHDOG_TASK_MAX];
+    uint32_t Start[WATCHDOG_TASK_MAX];
+    uint32_t Count[WATCHDOG_TASK_MAX];
+    uint32_t Overruns[WATCHDOG_TASK_MAX];
+    uint32_t Hist[WATCHDOG_TASK_MAX][WATCHDOG_HIST_BINS];
+    WatchdogOverrun_t Log[CONFIG_WATCHDOG_LOG_SIZE];
+    uint8_t LogNext;
+    uint8_t LogCount;
+}WatchdogState_t;
+
+static WatchdogState_t State RETAINED_ATTR;
+
+/*!
+ * Latency budgets [ms], 0 for a task not registered
+ */
+static uint32_t Budgets[WATCHDOG_TASK_MAX];
+
+static TimerEvent_t FeedTimer;
+static void ( *FeedWakeup )( void ) = NULL;
+static uint32_t FeedLast;
+static bool Started = false;
+
+static const char *const WatchdogNames[WATCHDOG_TASK_MAX] =
+{
+    [WATCHDOG_TASK_RADIO] = "Radio",
+    [WATCHDOG_TASK_MAC] = "Mac",
+    [WATCHDOG_TASK_AT] = "At",
+    [WATCHDOG_TASK_APP] = "App",
+};
+
+static uint8_t WatchdogBin( uint32_t latency, uint32_t budget )
+{
+    uint8_t bin = 0;
+
+    // From budget / 8 to budget * 8 by powers of 2
+    while( ( bin < ( WATCHDOG_HIST_BINS - 1 ) ) && ( ( ( uint64_t )latency << 3 ) > ( ( uint64_t )budget << bin ) ) )
+    {
+        bin++;
+    }
+    return bin;
+}
+
+/*!
+ * \brief Accounts a section, called with the IRQs disabled
+ */
+static void WatchdogAccount( uint8_t task, uint16_t boot, uint32_t start, uint32_t latency )
+{
+    WatchdogOverrun_t *overrun;
+
+    State.Count[task]++;
+    State.Hist[task][WatchdogBin( latency, Budgets[task] )]++;
+    if( ( latency <= Budgets[task] ) && ( latency != WATCHDOG_LATENCY_HANG ) )
+    {
+        return;
+    }
+
+    State.Overruns[task]++;
+    overrun = &State.Log[State.LogNext];
+    overrun->Task = task;
+    overrun->Boot = boot;
+    overrun->Time = start;
+    overrun->Latency = latency;
+    State.LogNext = ( State.LogNext + 1 ) % CONFIG_WATCHDOG_LOG_SIZE;
+    if( State.LogCount < CONFIG_WATCHDOG_LOG_SIZE )
+    {
+        State.LogCount++;
+    }
+}
+
+static void WatchdogOnFeedTimer( void )
+{
+    TimerStart( &FeedTimer );
+    if( FeedWakeup != NULL )
+    {
+        FeedWakeup( );
+    }
+}
+
+void WatchdogInit( void ( *wakeup )( void ) )
+{
+    bool iwdgReset = ( RCC->RST_SR & RCC_RST_SR_IWDG_RESET_SR ) ? true : false;
+    uint8_t task;
+
+    RCC->RST_SR = RCC_RST_SR_IWDG_RESET_SR;
+    __disable_irq( );
+    if( WarmBootIsWarm( ) == false )
+    {
+        memset( &State, 0, sizeof( WatchdogState_t ) );
+    }
+    else
+    {
+        if( iwdgReset == true )
+        {
+            State.Resets++;
+            for( task = 0; task < WATCHDOG_TASK_MAX; task++ )
+            {
+                if( State.Depth[task] != 0 )
+                {
+                    WatchdogAccount( task, State.Boots, State.Start[task], WATCHDOG_LATENCY_HANG );
+                }
+            }
+        }
+        State.Boots++;
+    }
+    memset( State.Depth, 0, sizeof( State.Depth ) );
+    __enable_irq( );
+
+    rcc_enable_peripheral_clk( RCC_PERIPHERAL_IWDG, true );
+    iwdg_init( true );
+    iwdg_set_prescaler( IWDG_PRESCALER_256 );
+    iwdg_set_reload( ( uint32_t )CONFIG_WATCHDOG_TIMEOUT * WATCHDOG_IWDG_HZ / 1000 );
+    iwdg_start( );
+#ifdef CONFIG_CRASH_DUMP
+    // A hang is recorded by the crash dump ahead of the reset
+    iwdg_config_interrupt( true );
+    NVIC_EnableIRQ( IWDG_IRQn );
+#endif
+    FeedLast = ( uint32_t )TimerGetCurrentTime( );
+
+    FeedWakeup = wakeup;
+    TimerInit( &FeedTimer, WatchdogOnFeedTimer );
+    TimerSetValue( &FeedTimer, CONFIG_WATCHDOG_TIMEOUT / 2 );
+    TimerStart( &FeedTimer );
+    Started = true;
+}
+
+void WatchdogTaskRegister( WatchdogTask_t task, uint32_t budget )
+{
+    if( task < WATCHDOG_TASK_MAX )
+    {
+        Budgets[task] = budget;
+    }
+}
+
+void WatchdogTaskBegin( WatchdogTask_t task )
+{
+    uint32_t primask;
+
+    if( Budgets[task] == 0 )
+    {
+        return;
+    }
+    primask = __get_PRIMASK( );
+    __disable_irq( );
+    if( State.Depth[task]++ == 0 )
+    {
+        State.Start[task] = ( uint32_t )TimerGetCurrentTime( );
+    }
+    __set_PRIMASK( primask );
+}
+
+void WatchdogTaskEnd( WatchdogTask_t task )
+{
+    uint32_t primask;
+
+    if( Budgets[task] == 0 )
+    {
+        return;
+    }
+    primask = __get_PRIMASK( );
+    __disable_irq( );
+    // A section begun before the registration or the init is not timed
+    if( ( State.Depth[task] != 0 ) && ( --State.Depth[task] == 0 ) )
+    {
+        WatchdogAccount( task, State.Boots, State.Start[task], ( uint32_t )TimerGetCurrentTime( ) - State.Start[task] );
+    }
+    __set_PRIMASK( primask );
+}
+
+void WatchdogProcess( void )
+{
+    uint32_t now = ( uint32_t )TimerGetCurrentTime( );
+    uint8_t task;
+
+    // The reload waits on the IWDG clock domain, once per quarter timeout
+    if( ( Started == false ) || ( ( now - FeedLast ) < ( CONFIG_WATCHDOG_TIMEOUT / 4 ) ) )
+    {
+        return;
+    }
+    for( task = 0; task < WATCHDOG_TASK_MAX; task++ )
+    {
+        if( ( Budgets[task] != 0 ) && ( State.Depth[task] != 0 ) && ( ( now - State.Start[task] ) > Budgets[task] ) )
+        {
+            // Starved, the IWDG resets the MCU unless the section ends
+            return;
+        }
+    }
+    iwdg_reload( );
+    FeedLast = now;
+}
+
+void WatchdogReset( void )
+{
+    __disable_irq( );
+    State.Resets = 0;
+    memset( State.Count, 0, sizeof( State.Count ) );
+    memset( State.Overruns, 0, sizeof( State.Overruns ) );
+    memset( State.Hist, 0, sizeof( State.Hist ) );
+    State.LogNext = 0;
+    State.LogCount = 0;
+    __enable_irq( );
+}
+
+int WatchdogFormat( WatchdogTask_t task, char *buf, size_t size )
+{
+    uint32_t hist[WATCHDOG_HIST_BINS];
+    uint32_t count;
+    uint32_t overruns;
+    int len;
+    int i;
+
+    if( ( task >= WATCHDOG_TASK_MAX ) || ( Budgets[task] == 0 ) )
+    {
+        return 0;
+    }
+    __disable_irq( );
+    count = State.Count[task];
+    overruns = State.Overruns[task];
+    memcpy( hist, State.Hist[task], sizeof( hist ) );
+    __enable_irq( );
+
+    len = snprintf( buf, size, "%s,%u,%u,%u", WatchdogNames[task], ( unsigned int )Budgets[task],
+                    ( unsigned int )count, ( unsigned int )overruns );
+    for( i = 0; ( i < WATCHDOG_HIST_BINS ) && ( len < ( int )size ); i++ )
+    {
+        len += snprintf( buf + len, size - len, ",%u", ( unsigned int )hist[i] );
+    }
+    return len;
+}
+
+int WatchdogOverrunGet( uint8_t index, WatchdogOverrun_t *overrun )
+{
+    int found = 0;
+
+    __disable_irq( );
+    if( index < State.LogCount )
+    {
+        *overrun = State.Log[( State.LogNext + CONFIG_WATCHDOG_LOG_SIZE - 1 - index ) % CONFIG_WATCHDOG_LOG_SIZE];
+        found = 1;
+    }
+    __enable_irq( );
+    return found;
+}
+
+uint16_t WatchdogResets( void )
+{
+    return State.Resets;
+}
+
+#endif
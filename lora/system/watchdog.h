@@ -0,0 +1,200 @@
+/*!
+ * \file      watchdog.h
+ *
+ * \brief     Task health monitor feeding the IWDG
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA
+ *
+ * \{
+ *
+ * \defgroup  LORA_WATCHDOG
+ *
+ *            The radio, MAC, AT and application tasks each register a
+ *            latency budget and time their sections with
+ *            \ref WatchdogTaskBegin and \ref WatchdogTaskEnd: the SX126x
+ *            busy wait, a step of the MAC state machine out of the sleep
+ *            state, an AT command line and the application callbacks. The
+ *            latencies are counted in a histogram per task, by fractions and
+ *            multiples of its budget, and each overrun is logged with the
+ *            boot and time it started.
+ *
+ *            \ref WatchdogProcess, from the main loop, feeds the IWDG while
+ *            no section ran past its budget. A timer wakes the main loop
+ *            every half timeout, a hang in a section or in a polling loop
+ *            out of them stops the feeding and the IWDG resets the MCU. The
+ *            next boot logs the sections left open as overruns of
+ *            \ref WATCHDOG_LATENCY_HANG.
+ *
+ *            Built with CONFIG_WATCHDOG, which needs CONFIG_WARM_BOOT: the
+ *            counters are kept in RAM across the resets but the power on,
+ *            see lora/system/warm-boot.h. The WATCHDOG_TASK_ macros compile
+ *            to nothing otherwise.
+ *
+ * \{
+ */
+#ifndef __WATCHDOG_H__
+#define __WATCHDOG_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*!
+ * IWDG timeout [ms], above the largest budget
+ */
+#ifndef CONFIG_WATCHDOG_TIMEOUT
+#define CONFIG_WATCHDOG_TIMEOUT                     8000
+#endif
+
+/*!
+ * Default latency budgets [ms]
+ */
+#ifndef CONFIG_WATCHDOG_RADIO_BUDGET
+#define CONFIG_WATCHDOG_RADIO_BUDGET                10
+#endif
+#ifndef CONFIG_WATCHDOG_MAC_BUDGET
+#define CONFIG_WATCHDOG_MAC_BUDGET                  500
+#endif
+#ifndef CONFIG_WATCHDOG_AT_BUDGET
+#define CONFIG_WATCHDOG_AT_BUDGET                   1000
+#endif
+#ifndef CONFIG_WATCHDOG_APP_BUDGET
+#define CONFIG_WATCHDOG_APP_BUDGET                  500
+#endif
+
+/*!
+ * Number of overruns logged, the oldest overwritten
+ */
+#ifndef CONFIG_WATCHDOG_LOG_SIZE
+#define CONFIG_WATCHDOG_LOG_SIZE                    8
+#endif
+
+/*!
+ * Number of histogram bins: bin n < 4 counts up to budget / 2^(3 - n),
+ * bin n >= 4 the overruns up to budget * 2^(n - 3), the last bin everything
+ * above and the hangs
+ */
+#define WATCHDOG_HIST_BINS                          8
+
+/*!
+ * Latency of a section left open by an IWDG reset
+ */
+#define WATCHDOG_LATENCY_HANG                       UINT32_MAX
+
+/*!
+ * Tasks
+ */
+typedef enum
+{
+    WATCHDOG_TASK_RADIO = 0,    //!< SX126xWaitOnBusy
+    WATCHDOG_TASK_MAC,          //!< lora_fsm, a step out of the sleep state
+    WATCHDOG_TASK_AT,           //!< linkwan_at_process, a command line
+    WATCHDOG_TASK_APP,          //!< LoraTxData and LoraRxData
+    WATCHDOG_TASK_MAX,
+}WatchdogTask_t;
+
+#ifdef CONFIG_WATCHDOG
+
+/*!
+ * \brief Overrun of a section
+ */
+typedef struct
+{
+    uint8_t Task;
+    /*!
+     * Boots since the power on when it started
+     */
+    uint16_t Boot;
+    /*!
+     * Start since the boot [ms]
+     */
+    uint32_t Time;
+    /*!
+     * Latency [ms], WATCHDOG_LATENCY_HANG for a hang
+     */
+    uint32_t Latency;
+}WatchdogOverrun_t;
+
+#define WATCHDOG_TASK_BEGIN( task )                 WatchdogTaskBegin( task )
+#define WATCHDOG_TASK_END( task )                   WatchdogTaskEnd( task )
+
+/*!
+ * \brief Logs the hangs of the last reset and starts the IWDG
+ *
+ * \param [IN] wakeup  Wakes the main loop, to call \ref WatchdogProcess, NULL
+ *                     when the timer interrupt already does
+ */
+void WatchdogInit( void ( *wakeup )( void ) );
+
+/*!
+ * \brief Registers a task, its sections are timed from then on
+ *
+ * \param [IN] task    Task
+ * \param [IN] budget  Latency budget of a section [ms]
+ */
+void WatchdogTaskRegister( WatchdogTask_t task, uint32_t budget );
+
+/*!
+ * \brief Starts a section of a task, see WATCHDOG_TASK_BEGIN. The sections
+ *        of a task nest, from the interrupts too, the outer one is timed
+ *
+ * \param [IN] task    Task
+ */
+void WatchdogTaskBegin( WatchdogTask_t task );
+
+/*!
+ * \brief Ends a section of a task, see WATCHDOG_TASK_END
+ *
+ * \param [IN] task    Task
+ */
+void WatchdogTaskEnd( WatchdogTask_t task );
+
+/*!
+ * \brief Feeds the IWDG while no section ran past its budget, from the main
+ *        loop
+ */
+void WatchdogProcess( void );
+
+/*!
+ * \brief Clears the counters and the overruns
+ */
+void WatchdogReset( void );
+
+/*!
+ * \brief Formats a task as name,budget,count,overruns,hist0..hist7
+ *
+ * \param [IN]  task   Task
+ * \param [OUT] buf    Line, without end of line
+ * \param [IN]  size   buf size
+ *
+ * \retval len         Line length as snprintf, 0 for a task not registered
+ */
+int WatchdogFormat( WatchdogTask_t task, char *buf, size_t size );
+
+/*!
+ * \brief Overrun logged, the most recent first
+ *
+ * \param [IN]  index  From 0, the most recent
+ * \param [OUT] overrun Overrun
+ *
+ * \retval found       0 past the overruns logged
+ */
+int WatchdogOverrunGet( uint8_t index, WatchdogOverrun_t *overrun );
+
+/*!
+ * \brief Number of IWDG resets since the power on
+ */
+uint16_t WatchdogResets( void );
+
+#else
+
+#define WATCHDOG_TASK_BEGIN( task )
+#define WATCHDOG_TASK_END( task )
+
+#endif
+
+/*! \} defgroup LORA_WATCHDOG */
+/*! \} addtogroup LORA */
+
+#endif // __WATCHDOG_H__
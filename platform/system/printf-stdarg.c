@@ -32,6 +32,7 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdint-gcc.h>
 #include "tremo_uart.h"
 
@@ -44,7 +45,8 @@
 #define PRINTF_DMA_NUM      0
 #define PRINTF_DMA_CH       0
 #define PRINTF_DMA_QUEUE_SIZE 1024
-#define PRINTF_DMA_BUF_SIZE 128
+#define PRINTF_DMA_CHUNK_SIZE 32
+#define PRINTF_DMA_BLOCK_MAX  4095   // block size field of the DMA
 
 
 // 'ntoa' conversion buffer size, this must be big enough to hold one converted
@@ -132,116 +134,173 @@ typedef struct {
 } out_fct_wrap_type;
 
 #ifdef PRINT_BY_DMA
+#if PRINTF_DMA_CH != 0
+#error "printf_dma_start rearms the registers of channel 0"
+#endif
 static dma_dev_t dma_printf = { 0 };
-static uint8_t printf_dma_busy = 0;
-static uint8_t printf_dma_buf[PRINTF_DMA_BUF_SIZE] = { 0 };
+static volatile uint8_t printf_dma_busy = 0;
+static bool printf_dma_ready = false;         // channel set up by dma_init
+static const uint8_t *printf_dma_ext = NULL;  // caller's buffer in flight
+static uint16_t printf_dma_len = 0;           // bytes in flight
 
+// printf_dma_idx_r to printf_dma_idx_w is ready to send, the DMA reads it
+// in place; up to printf_dma_idx_res is reserved by writers still copying
 uint8_t printf_dma_queue[PRINTF_DMA_QUEUE_SIZE] = { 0 };
-uint16_t printf_dma_idx_w = 0;
-uint16_t printf_dma_idx_r = 0;
+volatile uint16_t printf_dma_idx_w = 0;
+volatile uint16_t printf_dma_idx_r = 0;
+static uint16_t printf_dma_idx_res = 0;
+static uint8_t printf_dma_writers = 0;
+
+// printf output gathered before it is written to the queue
+typedef struct {
+    uint8_t len;
+    uint8_t buf[PRINTF_DMA_CHUNK_SIZE];
+} printf_dma_chunk_t;
 
-static void printf_dma_queue_push(char c)
+static size_t printf_dma_queue_write(const uint8_t *data, size_t len)
 {
-    if( ( ( printf_dma_idx_w + 1 ) % PRINTF_DMA_QUEUE_SIZE ) == printf_dma_idx_r ){
-        return;//queue is full , drop log
+    uint16_t pos, room, n;
+
+    __disable_irq();
+    room = ( printf_dma_idx_r + PRINTF_DMA_QUEUE_SIZE - printf_dma_idx_res - 1 ) % PRINTF_DMA_QUEUE_SIZE;
+    if( len > room ){
+        len = room;//queue is full , drop the rest
     }
+    pos = printf_dma_idx_res;
+    printf_dma_idx_res = ( pos + len ) % PRINTF_DMA_QUEUE_SIZE;
+    printf_dma_writers++;
+    __enable_irq();
+
+    n = PRINTF_DMA_QUEUE_SIZE - pos;
+    if( n > len ){
+        n = len;
+    }
+    memcpy(&printf_dma_queue[pos], data, n);
+    memcpy(printf_dma_queue, data + n, len - n);
+
     __disable_irq();
-    printf_dma_queue[printf_dma_idx_w++] = c;
-    printf_dma_idx_w %= PRINTF_DMA_QUEUE_SIZE;
+    // The interrupted writers finish after the ones interrupting them: the
+    // outermost one makes all the reserved bytes ready
+    if( --printf_dma_writers == 0 ){
+        printf_dma_idx_w = printf_dma_idx_res;
+    }
     __enable_irq();
+    return len;
 }
 
-static void printf_dma_queue_pop(uint8_t * buf, uint16_t * size)
+static void printf_dma_done_callback(void);
+
+// called with the interrupts disabled
+static void printf_dma_start(const uint8_t *src, uint16_t size)
 {
-    int i, len;
+    if( !printf_dma_ready ){
+        dma_printf.dma_num    = PRINTF_DMA_NUM;
+        dma_printf.ch         = PRINTF_DMA_CH;
+
+        dma_printf.mode       = M2P_MODE;
+        dma_printf.src        = (uint32_t)(src);
+        dma_printf.dest       = (uint32_t)(CONFIG_DEBUG_UART);
+        dma_printf.priv       = (dma_callback_func)printf_dma_done_callback;
+        dma_printf.data_width = 0;
+        dma_printf.block_size = size;
+        dma_printf.src_msize  = 1;
+        dma_printf.dest_msize = 1;
+        dma_printf.handshake  = DMA_HANDSHAKE_UART_0_TX;
 
-    if( printf_dma_idx_w > printf_dma_idx_r ) {
-        len = printf_dma_idx_w - printf_dma_idx_r;
-        if( len > PRINTF_DMA_BUF_SIZE ){
-            len = PRINTF_DMA_BUF_SIZE;
-        }
-        for( i = 0; i< len; i++){
-            printf_dma_buf[i] = printf_dma_queue[ printf_dma_idx_r + i ];
-        }
-        printf_dma_idx_r += len;
-        *size = len;
-    } else if( printf_dma_idx_w < printf_dma_idx_r ){
-        len = PRINTF_DMA_QUEUE_SIZE - printf_dma_idx_r;
-        if( len > PRINTF_DMA_BUF_SIZE ){
-            len = PRINTF_DMA_BUF_SIZE;
-            for( i = 0; i< len; i++){
-                printf_dma_buf[i] = printf_dma_queue[ printf_dma_idx_r + i ];
-            }
-            printf_dma_idx_r += len;
-            *size = len;
-        } else {
-            for( i = 0; i < len; i++){
-                printf_dma_buf[i] = printf_dma_queue[ printf_dma_idx_r + i ];
-            }
-            printf_dma_idx_r = 0;
-            *size = len;
-            for( ; printf_dma_idx_r < printf_dma_idx_w  && len < PRINTF_DMA_BUF_SIZE ; printf_dma_idx_r++, len++) {
-                printf_dma_buf[ i + printf_dma_idx_r ] = printf_dma_queue[ printf_dma_idx_r ];
-            }
-            *size += printf_dma_idx_r;
-        }
+        dma_init(&dma_printf);
+        printf_dma_ready = true;
+    }else{
+        // Only the source and the length change from one block to the next
+        DMA_SAR0_L(PRINTF_DMA_NUM) = (uint32_t)(src);
+        DMA_CTL0_H(PRINTF_DMA_NUM) = size | (0x1 << 12);
     }
+    dma_ch_enable(dma_printf.dma_num, PRINTF_DMA_CH);
+    uart_dma_config(CONFIG_DEBUG_UART,UART_DMA_REQ_TX, true);
+    printf_dma_busy = 1;
 }
 
-static void printf_dma_done_callback(void)
+// called with the interrupts disabled: sends the next contiguous segment,
+// a wrapped queue in two blocks
+static void printf_dma_next(void)
 {
-    uint16_t size = 0;
+    uint16_t w = printf_dma_idx_w;
+    uint16_t r = printf_dma_idx_r;
 
-    if( printf_dma_idx_w ==  printf_dma_idx_r ){
-        printf_dma_idx_w = printf_dma_idx_r = 0;
-        dma_finalize(&dma_printf);
+    if( w == r ){
         printf_dma_busy = 0;
+        return;
+    }
+    printf_dma_len = ( w > r ) ? w - r : PRINTF_DMA_QUEUE_SIZE - r;
+    printf_dma_start(&printf_dma_queue[r], printf_dma_len);
+}
+
+static void printf_dma_done_callback(void)
+{
+    if( printf_dma_ext ){
+        printf_dma_ext = NULL;
     }else{
-        printf_dma_queue_pop(printf_dma_buf, &size);
-        dma_printf.src        = (uint32_t)(printf_dma_buf);
-        dma_printf.block_size = size;
-        dma_init(&dma_printf);
-        dma_ch_enable(dma_printf.dma_num, PRINTF_DMA_CH);
-        uart_dma_config(CONFIG_DEBUG_UART,UART_DMA_REQ_TX, true);
+        printf_dma_idx_r = ( printf_dma_idx_r + printf_dma_len ) % PRINTF_DMA_QUEUE_SIZE;
     }
+    printf_dma_next();
 }
 
 static void printf_dma(void)
 {
-    uint16_t size = 0;
-
+    __disable_irq();
     if( !printf_dma_busy ){
-        __disable_irq();
-        printf_dma_queue_pop(printf_dma_buf, &size);
-        if( size > 0 ){
-            dma_printf.dma_num    = PRINTF_DMA_NUM;
-            dma_printf.ch         = PRINTF_DMA_CH;
-
-            dma_printf.mode       = M2P_MODE;
-            dma_printf.src        = (uint32_t)(printf_dma_buf);
-            dma_printf.dest       = (uint32_t)(CONFIG_DEBUG_UART);
-            dma_printf.priv       = (dma_callback_func)printf_dma_done_callback;
-            dma_printf.data_width = 0;
-            dma_printf.block_size = size;
-            dma_printf.src_msize  = 1;
-            dma_printf.dest_msize = 1;
-            dma_printf.handshake  = DMA_HANDSHAKE_UART_0_TX;
-
-            dma_init(&dma_printf);
-            dma_ch_enable(dma_printf.dma_num, PRINTF_DMA_CH);
-            uart_dma_config(CONFIG_DEBUG_UART,UART_DMA_REQ_TX, true);
-            printf_dma_busy = 1;
-        }
-        __enable_irq();
+        printf_dma_next();
     }
+    __enable_irq();
 }
 #endif
 
+int print_write(const uint8_t *data, size_t len)
+{
+#ifdef PRINT_BY_DMA
+    len = printf_dma_queue_write(data, len);
+    printf_dma();
+#else
+    for( size_t i = 0; i < len; i++ ){
+        uart_send_data(CONFIG_DEBUG_UART, data[i]);
+    }
+#endif
+    return len;
+}
+
+int print_write_static(const uint8_t *data, size_t len)
+{
+#ifdef PRINT_BY_DMA
+    bool started = false;
+
+    // Sent from where it is when nothing is queued before it
+    __disable_irq();
+    if( !printf_dma_busy && printf_dma_idx_res == printf_dma_idx_r && len > 0 && len <= PRINTF_DMA_BLOCK_MAX ){
+        printf_dma_ext = data;
+        printf_dma_start(data, len);
+        started = true;
+    }
+    __enable_irq();
+    if( started ){
+        return len;
+    }
+#endif
+    return print_write(data, len);
+}
+
+size_t print_room(void)
+{
+#ifdef PRINT_BY_DMA
+    return ( printf_dma_idx_r + PRINTF_DMA_QUEUE_SIZE - printf_dma_idx_res - 1 ) % PRINTF_DMA_QUEUE_SIZE;
+#else
+    return SIZE_MAX; // written blocking
+#endif
+}
+
 bool print_isdone(void)
 {
     #ifdef PRINT_BY_DMA
     return ( printf_dma_busy == 0 // dma is idle
-                && printf_dma_idx_w ==  printf_dma_idx_r // and queue is empty
+                && printf_dma_idx_res ==  printf_dma_idx_r // and queue is empty
                 && uart_get_flag_status( CONFIG_DEBUG_UART, UART_FLAG_TX_FIFO_EMPTY ) == SET // and uart fifo is empty
                 && uart_get_flag_status( CONFIG_DEBUG_UART, UART_FLAG_BUSY ) != SET); 
     #else
@@ -272,7 +331,13 @@ static inline void _out_char(char character, void* buffer, size_t idx, size_t ma
   (void)buffer; (void)idx; (void)maxlen;
   if (character) {
 	#ifdef PRINT_BY_DMA
-	printf_dma_queue_push(character);
+	// buffer is the chunk of the current call
+	printf_dma_chunk_t *chunk = (printf_dma_chunk_t *)buffer;
+	chunk->buf[chunk->len++] = character;
+	if (chunk->len == PRINTF_DMA_CHUNK_SIZE) {
+	  printf_dma_queue_write(chunk->buf, chunk->len);
+	  chunk->len = 0;
+	}
 	#else
 	uart_send_data(CONFIG_DEBUG_UART, (unsigned char)(character));
 	#endif
@@ -414,11 +479,21 @@ static size_t _ntoa_long(out_fct_type out, char* buffer, size_t idx, size_t maxl
 
   // write if precision != 0 and value is != 0
   if (!(flags & FLAGS_PRECISION) || value) {
-    do {
-      const char digit = (char)(value % base);
-      buf[len++] = digit < 10 ? '0' + digit : (flags & FLAGS_UPPERCASE ? 'A' : 'a') + digit - 10;
-      value /= base;
-    } while (value && (len < PRINTF_NTOA_BUFFER_SIZE));
+    if (base == 16U) {
+      // hex dumps, shifts instead of the divisions
+      const char* digits = (flags & FLAGS_UPPERCASE) ? "0123456789ABCDEF" : "0123456789abcdef";
+      do {
+        buf[len++] = digits[value & 0x0FU];
+        value >>= 4U;
+      } while (value && (len < PRINTF_NTOA_BUFFER_SIZE));
+    }
+    else {
+      do {
+        const char digit = (char)(value % base);
+        buf[len++] = digit < 10 ? '0' + digit : (flags & FLAGS_UPPERCASE ? 'A' : 'a') + digit - 10;
+        value /= base;
+      } while (value && (len < PRINTF_NTOA_BUFFER_SIZE));
+    }
   }
 
   return _ntoa_format(out, buffer, idx, maxlen, buf, len, negative, (unsigned int)base, prec, width, flags);
@@ -439,11 +514,21 @@ static size_t _ntoa_long_long(out_fct_type out, char* buffer, size_t idx, size_t
 
   // write if precision != 0 and value is != 0
   if (!(flags & FLAGS_PRECISION) || value) {
-    do {
-      const char digit = (char)(value % base);
-      buf[len++] = digit < 10 ? '0' + digit : (flags & FLAGS_UPPERCASE ? 'A' : 'a') + digit - 10;
-      value /= base;
-    } while (value && (len < PRINTF_NTOA_BUFFER_SIZE));
+    if (base == 16U) {
+      // hex dumps, shifts instead of the divisions
+      const char* digits = (flags & FLAGS_UPPERCASE) ? "0123456789ABCDEF" : "0123456789abcdef";
+      do {
+        buf[len++] = digits[value & 0x0FU];
+        value >>= 4U;
+      } while (value && (len < PRINTF_NTOA_BUFFER_SIZE));
+    }
+    else {
+      do {
+        const char digit = (char)(value % base);
+        buf[len++] = digit < 10 ? '0' + digit : (flags & FLAGS_UPPERCASE ? 'A' : 'a') + digit - 10;
+        value /= base;
+      } while (value && (len < PRINTF_NTOA_BUFFER_SIZE));
+    }
   }
 
   return _ntoa_format(out, buffer, idx, maxlen, buf, len, negative, (unsigned int)base, prec, width, flags);
@@ -988,12 +1073,19 @@ int __wrap_printf(const char* format, ...)
 {
   va_list va;
   va_start(va, format);
+  #ifdef PRINT_BY_DMA
+  printf_dma_chunk_t chunk;
+  chunk.len = 0;
+  const int ret = _vsnprintf(_out_char, (char*)&chunk, (size_t)-1, format, va);
+  va_end(va);
+  if (chunk.len) {
+    printf_dma_queue_write(chunk.buf, chunk.len);
+  }
+  printf_dma();
+  #else
   char buffer[1];
   const int ret = _vsnprintf(_out_char, buffer, (size_t)-1, format, va);
   va_end(va);
-  
-  #ifdef PRINT_BY_DMA
-  printf_dma();
   #endif
   return ret;
 }
@@ -1018,6 +1110,14 @@ int __wrap_snprintf(char* buffer, size_t count, const char* format, ...)
   return ret;
 }
 
+#ifdef CONFIG_ITM_TRACE_LOG
+// formats the log lines sent to the ITM
+int print_vsnprintf(char* buffer, size_t count, const char* format, va_list va)
+{
+  return _vsnprintf(_out_buffer, buffer, count, format, va);
+}
+#endif
+
 #if 0
 //it's supported, but not used yet
 int __wrap_vprintf(const char* format, va_list va)
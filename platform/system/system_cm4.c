@@ -8,6 +8,21 @@ void nvic_init()
     
     for(int i=0; i<=IWDG_IRQn; i++)
         NVIC_SetPriority(i, configLIBRARY_NORMAL_INTERRUPT_PRIORITY);
+
+#ifdef CONFIG_IRQ_PRIORITY_PLAN
+    // Radio line first, then the timers, then the UART bytes. The timer
+    // callbacks deferred by CONFIG_TIMER_DEFER run from PendSV below them all
+    NVIC_SetPriority(LORA_IRQn, configLIBRARY_RADIO_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(DMA0_IRQn, configLIBRARY_RADIO_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(DMA1_IRQn, configLIBRARY_RADIO_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(RTC_IRQn, configLIBRARY_TIMER_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(LPTIMER0_IRQn, configLIBRARY_TIMER_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(LPUART_IRQn, configLIBRARY_UART_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(UART0_IRQn, configLIBRARY_UART_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(UART1_IRQn, configLIBRARY_UART_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(UART2_IRQn, configLIBRARY_UART_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(UART3_IRQn, configLIBRARY_UART_INTERRUPT_PRIORITY);
+#endif
 }
 
 void system_init(void)
@@ -29,4 +44,25 @@ void system_init(void)
     delay_init();
 }
 
+// The stack below the initial stack pointer is painted by the startup
+#define SYSTEM_STACK_PAINT 0xA5A5A5A5
+
+extern uint32_t _stack_bottom[];
+extern uint32_t _estack[];
+
+/**
+ * @brief Get the deepest use of the stack since the reset
+ * @retval Bytes between the initial stack pointer and the lowest word written,
+ *         _STACK_SIZE or more when the stack overflowed its section
+ */
+uint32_t system_get_stack_watermark(void)
+{
+    uint32_t* p = _stack_bottom;
+
+    while ((p < _estack) && (*p == SYSTEM_STACK_PAINT))
+        p++;
+
+    return (uint32_t)_estack - (uint32_t)p;
+}
+
 /********END OF FILE ***********/
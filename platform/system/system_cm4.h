@@ -15,6 +15,7 @@ void assert_failed(void* file, uint32_t line);
 #endif
 
 void system_init(void);
+uint32_t system_get_stack_watermark(void);
 
 #ifdef __cplusplus
 }
@@ -24,6 +24,11 @@ extern "C" {
 #define __Vendor_SysTickConfig 0 /*!< Set to 1 if different SysTick Config is used  */
 #define configLIBRARY_NORMAL_INTERRUPT_PRIORITY 6
 
+// Priorities of nvic_init with CONFIG_IRQ_PRIORITY_PLAN, PendSV the lowest
+#define configLIBRARY_RADIO_INTERRUPT_PRIORITY  1 // LORA, the DMA of the radio SPI
+#define configLIBRARY_TIMER_INTERRUPT_PRIORITY  2 // RTC, LPTIMER0
+#define configLIBRARY_UART_INTERRUPT_PRIORITY   3 // LPUART, UART0-3
+
 typedef enum IRQn {
     /**************   Processor Exceptions Numbers *************************************/
     NonMaskableInt_IRQn   = -14, /*!< 2 Non Maskable Interrupt                         */
@@ -90,6 +95,22 @@ typedef unsigned int u32;
 #else
 #define RAM_FUNC_ATTR
 #endif
+
+// Hot paths of the radio, timer and LPUART, run from RAM with CONFIG_HOT_FUNC
+// to skip the flash wait states, and with RUN_IN_RAM along the flash operations
+#ifdef CONFIG_HOT_FUNC
+#define HOT_FUNC_ATTR __attribute__((section(".ram_funcs")))
+#else
+#define HOT_FUNC_ATTR RAM_FUNC_ATTR
+#endif
+
+// State kept across a soft or watchdog reset, in the retention SRAM with
+// CONFIG_WARM_BOOT_RETAINED, which also keeps it across the STOP3 sleep
+#ifdef CONFIG_WARM_BOOT_RETAINED
+#define RETAINED_ATTR __attribute__((section(".retained")))
+#else
+#define RETAINED_ATTR __attribute__((section(".noinit")))
+#endif
 // ---------------------------------------------------------------------------
 
 #define ERRNO_OK      (0)
@@ -0,0 +1,529 @@
+/*!
+ * \file      benchmark.c
+ *
+ * \brief     Cycle counts of the stack hot paths
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ *            Each case runs BENCH_REPEAT times under the DWT cycle counter and
+ *            prints one JSON line on the debug UART:
+ *
+ *            {"bench":"<name>","arg":<argument>,"n":<runs>,"min":<cycles>,"avg":<cycles>,"max":<cycles>}
+ *
+ *            The cost of the measurement itself is subtracted. The min is the
+ *            figure to compare between builds, avg and max include the
+ *            interrupts served during the runs.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "tremo_cm4.h"
+#include "tremo_crc.h"
+#include "tremo_flash.h"
+#include "timer.h"
+#include "radio.h"
+#include "sx126x.h"
+#include "crc.h"
+#include "payload-codec.h"
+#include "LoRaMac.h"
+#include "LoRaMacCrypto.h"
+#include "Region.h"
+#include "utilities.h"
+
+/*!
+ * Runs of each case
+ */
+#define BENCH_REPEAT                                16
+
+/*!
+ * Runs of the flash cases, each one erases a page first
+ */
+#define BENCH_FLASH_REPEAT                          4
+
+/*!
+ * Scratch page of the flash cases, the last page of the flash
+ */
+#define BENCH_FLASH_ADDR                            ( 0x08000000 + 0x20000 - FLASH_PAGE_SIZE )
+
+/*!
+ * Most timers armed by the timer cases
+ */
+#define BENCH_TIMERS_MAX                            32
+
+/*!
+ * Build profile, set by the Makefile
+ */
+#ifndef BENCH_PROFILE
+#define BENCH_PROFILE                               "release"
+#endif
+
+typedef struct
+{
+    uint32_t Count;
+    uint32_t Min;
+    uint32_t Max;
+    uint32_t Total;
+    uint32_t Start;
+}BenchStats_t;
+
+static BenchStats_t Bench;
+
+/*!
+ * Cycles of an empty case, subtracted from the results
+ */
+static uint32_t BenchOverhead = 0;
+
+static uint8_t BenchBuffer[FLASH_LINE_SIZE] __attribute__( ( aligned( 4 ) ) );
+static uint8_t BenchOutput[FLASH_LINE_SIZE] __attribute__( ( aligned( 4 ) ) );
+
+static const uint8_t BenchKey[16] =
+{
+    0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C
+};
+
+static RadioEvents_t BenchRadioEvents;
+
+/*!
+ * Telemetry record of the codec cases
+ */
+typedef struct
+{
+    uint32_t Time;
+    uint32_t Energy;
+    int16_t Temperature;
+    uint16_t Humidity;
+    uint8_t Battery;
+    int8_t Rssi;
+    char Status[12];
+}BenchRecord_t;
+
+static const uint8_t BenchDict[] = "okbatt_lowdoor_opendoor_closedalarm";
+
+static const PayloadCodecField_t BenchFields[] =
+{
+    PAYLOAD_CODEC_INT( BenchRecord_t, Time, PAYLOAD_CODEC_DELTA2, 2 ),
+    PAYLOAD_CODEC_INT( BenchRecord_t, Energy, PAYLOAD_CODEC_DELTA2, 3 ),
+    PAYLOAD_CODEC_INT( BenchRecord_t, Temperature, PAYLOAD_CODEC_DELTA, 2 ),
+    PAYLOAD_CODEC_INT( BenchRecord_t, Humidity, PAYLOAD_CODEC_DELTA, 3 ),
+    PAYLOAD_CODEC_INT( BenchRecord_t, Battery, PAYLOAD_CODEC_RAW, 7 ),
+    PAYLOAD_CODEC_INT( BenchRecord_t, Rssi, PAYLOAD_CODEC_RAW, 8 ),
+    PAYLOAD_CODEC_ARRAY_LZ( BenchRecord_t, Status, BenchDict ),
+};
+
+static const PayloadCodecSchema_t BenchSchema = PAYLOAD_CODEC_SCHEMA( BenchRecord_t, BenchFields );
+
+static TimerEvent_t BenchTimers[BENCH_TIMERS_MAX + 1];
+
+static void BenchReset( void )
+{
+    memset( &Bench, 0, sizeof( Bench ) );
+}
+
+static inline void BenchStart( void )
+{
+    Bench.Start = DWT->CYCCNT;
+}
+
+static inline void BenchStop( void )
+{
+    uint32_t cycles = DWT->CYCCNT - Bench.Start;
+
+    cycles = ( cycles > BenchOverhead ) ? ( cycles - BenchOverhead ) : 0;
+    if( ( Bench.Count == 0 ) || ( cycles < Bench.Min ) )
+    {
+        Bench.Min = cycles;
+    }
+    if( cycles > Bench.Max )
+    {
+        Bench.Max = cycles;
+    }
+    Bench.Count++;
+    Bench.Total += cycles;
+}
+
+static void BenchPrint( const char *name, uint32_t arg )
+{
+    printf( "{\"bench\":\"%s\",\"arg\":%u,\"n\":%u,\"min\":%u,\"avg\":%u,\"max\":%u}\r\n", name, ( unsigned int )arg,
+            ( unsigned int )Bench.Count, ( unsigned int )Bench.Min, ( unsigned int )( Bench.Total / Bench.Count ),
+            ( unsigned int )Bench.Max );
+}
+
+/*!
+ * Times a statement BENCH_REPEAT times and prints the result
+ */
+#define BENCH_RUN( name, arg, stmt )                                           \
+    do                                                                         \
+    {                                                                          \
+        uint32_t run;                                                          \
+        BenchReset( );                                                         \
+        for( run = 0; run < BENCH_REPEAT; run++ )                              \
+        {                                                                      \
+            BenchStart( );                                                     \
+            stmt;                                                              \
+            BenchStop( );                                                      \
+        }                                                                      \
+        BenchPrint( name, arg );                                               \
+    } while( 0 )
+
+static void BenchCalibrate( void )
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    BenchOverhead = 0;
+    BENCH_RUN( "overhead", 0, __NOP( ) );
+    BenchOverhead = Bench.Min;
+}
+
+static void BenchRadioBuffer( void )
+{
+    static const uint8_t sizes[] = { 1, 16, 32, 64, 128, 255 };
+    uint8_t i;
+
+    Radio.Init( &BenchRadioEvents );
+    Radio.Standby( );
+
+    for( i = 0; i < sizeof( sizes ); i++ )
+    {
+        BENCH_RUN( "SX126xWriteBuffer", sizes[i], SX126xWriteBuffer( 0, BenchBuffer, sizes[i] ) );
+        BENCH_RUN( "SX126xReadBuffer", sizes[i], SX126xReadBuffer( 0, BenchOutput, sizes[i] ) );
+    }
+    Radio.Sleep( );
+}
+
+static void BenchCrypto( void )
+{
+    // Empty, MAC command, SF12 and SF7 EU868 and the largest LoRaWAN frames
+    static const uint8_t sizes[] = { 0, 15, 51, 115, 222, 242 };
+    uint32_t mic;
+    uint8_t i;
+
+    for( i = 0; i < sizeof( sizes ); i++ )
+    {
+        BENCH_RUN( "LoRaMacComputeMic", sizes[i],
+                   LoRaMacComputeMic( BenchBuffer, sizes[i], BenchKey, 0x26011234, 0, 1, &mic ) );
+        BENCH_RUN( "LoRaMacPayloadEncrypt", sizes[i],
+                   LoRaMacPayloadEncrypt( BenchBuffer, sizes[i], BenchKey, 0x26011234, 0, 1, BenchOutput ) );
+    }
+}
+
+static void BenchTimeOnAir( void )
+{
+    volatile uint32_t toa;
+    uint8_t sf;
+
+    Radio.Init( &BenchRadioEvents );
+    for( sf = 7; sf <= 12; sf++ )
+    {
+        Radio.SetTxConfig( MODEM_LORA, 14, 0, 0, sf, 1, 8, false, true, 0, 0, false, 3000 );
+        BENCH_RUN( "RadioTimeOnAir", sf, toa = Radio.TimeOnAir( MODEM_LORA, 51 ) );
+    }
+    ( void )toa;
+    Radio.Sleep( );
+}
+
+/*!
+ * Command to air latency of an uplink, the TX configuration and the send
+ * as the MAC issues them, until the radio accepted SetTx. Compare a build
+ * with CMD_BATCH=1 against one without
+ */
+static void BenchTxLatency( void )
+{
+    static const uint8_t sizes[] = { 16, 51, 222 };
+    uint32_t run;
+    uint8_t i;
+
+    Radio.Init( &BenchRadioEvents );
+    Radio.SetChannel( 470300000 );
+    for( i = 0; i < sizeof( sizes ); i++ )
+    {
+        BenchReset( );
+        for( run = 0; run < BENCH_REPEAT; run++ )
+        {
+            BenchStart( );
+            Radio.SetTxConfig( MODEM_LORA, 14, 0, 0, 7, 1, 8, false, true, 0, 0, false, 3000 );
+            Radio.Send( BenchBuffer, sizes[i] );
+            BenchStop( );
+            Radio.Standby( );
+        }
+        BenchPrint( "RadioTxLatency", sizes[i] );
+    }
+    Radio.Sleep( );
+}
+
+static void BenchRegion( void )
+{
+    static const struct
+    {
+        const char *Name;
+        LoRaMacRegion_t Region;
+    }regions[] =
+    {
+        { "RegionNextChannel.CN470", LORAMAC_REGION_CN470 },
+        { "RegionNextChannel.EU868", LORAMAC_REGION_EU868 },
+        { "RegionNextChannel.US915", LORAMAC_REGION_US915 },
+        { "RegionNextChannel.AS923", LORAMAC_REGION_AS923 },
+    };
+    NextChanParams_t params;
+    TimerTime_t time;
+    TimerTime_t aggregatedTimeOff;
+    uint8_t channel;
+    uint8_t i;
+
+    for( i = 0; i < sizeof( regions ) / sizeof( regions[0] ); i++ )
+    {
+        if( RegionIsActive( regions[i].Region ) == false )
+        {
+            continue;
+        }
+        RegionInitDefaults( regions[i].Region, INIT_TYPE_INIT );
+
+        memset( &params, 0, sizeof( params ) );
+        params.Datarate = 0;
+        params.Joined = true;
+        params.DutyCycleEnabled = false;
+        BENCH_RUN( regions[i].Name, 0,
+                   RegionNextChannel( regions[i].Region, &params, &channel, &time, &aggregatedTimeOff ) );
+    }
+
+    // CN470 with a single band of 8 channels enabled, as the freqband mask
+    // of linkwan leaves it, the arg is the band
+    if( RegionIsActive( LORAMAC_REGION_CN470 ) == true )
+    {
+        static const uint8_t bands[] = { 0, 5, 11 };
+        uint16_t mask[6];
+        ChanMaskSetParams_t maskSet;
+
+        for( i = 0; i < sizeof( bands ); i++ )
+        {
+            RegionInitDefaults( LORAMAC_REGION_CN470, INIT_TYPE_INIT );
+            memset( mask, 0, sizeof( mask ) );
+            mask[bands[i] / 2] = 0x00FF << ( ( bands[i] % 2 ) * 8 );
+            maskSet.ChannelsMaskIn = mask;
+            maskSet.ChannelsMaskType = CHANNELS_MASK;
+            RegionChanMaskSet( LORAMAC_REGION_CN470, &maskSet );
+
+            memset( &params, 0, sizeof( params ) );
+            params.Datarate = 0;
+            params.Joined = true;
+            params.DutyCycleEnabled = false;
+            BENCH_RUN( "RegionNextChannel.CN470.band", bands[i],
+                       RegionNextChannel( LORAMAC_REGION_CN470, &params, &channel, &time, &aggregatedTimeOff ) );
+        }
+    }
+}
+
+static void OnBenchTimerEvent( void )
+{
+}
+
+static void BenchTimer( void )
+{
+    static const uint8_t counts[] = { 0, 1, 4, 16, BENCH_TIMERS_MAX };
+    TimerEvent_t *probe = &BenchTimers[BENCH_TIMERS_MAX];
+    uint8_t armed = 0;
+    uint32_t run;
+    uint8_t i;
+
+    for( i = 0; i <= BENCH_TIMERS_MAX; i++ )
+    {
+        TimerInit( &BenchTimers[i], OnBenchTimerEvent );
+    }
+    TimerSetValue( probe, 30000 );
+
+    for( i = 0; i < sizeof( counts ); i++ )
+    {
+        // Timeouts far enough not to expire during the runs, spread around the probe one
+        while( armed < counts[i] )
+        {
+            TimerSetValue( &BenchTimers[armed], 10000 + armed * 1000 );
+            TimerStart( &BenchTimers[armed] );
+            armed++;
+        }
+        BenchReset( );
+        for( run = 0; run < BENCH_REPEAT; run++ )
+        {
+            BenchStart( );
+            TimerStart( probe );
+            BenchStop( );
+            TimerStop( probe );
+        }
+        BenchPrint( "TimerStart", armed );
+
+        BenchReset( );
+        for( run = 0; run < BENCH_REPEAT; run++ )
+        {
+            TimerStart( probe );
+            BenchStart( );
+            TimerStop( probe );
+            BenchStop( );
+        }
+        BenchPrint( "TimerStop", armed );
+    }
+
+    for( i = 0; i < armed; i++ )
+    {
+        TimerStop( &BenchTimers[i] );
+    }
+}
+
+static void BenchFlash( void )
+{
+    static const uint16_t sizes[] = { 8, 64, FLASH_LINE_SIZE };
+    uint32_t run;
+    uint8_t i;
+
+    for( i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); i++ )
+    {
+        BenchReset( );
+        for( run = 0; run < BENCH_FLASH_REPEAT; run++ )
+        {
+            flash_erase_page( BENCH_FLASH_ADDR );
+            BenchStart( );
+            flash_program_bytes( BENCH_FLASH_ADDR, BenchBuffer, sizes[i] );
+            BenchStop( );
+        }
+        BenchPrint( "flash_program_bytes", sizes[i] );
+    }
+
+    BenchReset( );
+    for( run = 0; run < BENCH_FLASH_REPEAT; run++ )
+    {
+        flash_erase_page( BENCH_FLASH_ADDR );
+        BenchStart( );
+        flash_program_line( BENCH_FLASH_ADDR, BenchBuffer );
+        BenchStop( );
+    }
+    BenchPrint( "flash_program_line", FLASH_LINE_SIZE );
+
+    flash_erase_page( BENCH_FLASH_ADDR );
+}
+
+static void BenchCrc( void )
+{
+    static const uint16_t sizes[] = { 16, 64, 256 };
+    CrcModel_t bitwise = CrcCcitt;
+    crc_config_t ccitt = { 0, CRC_POLY_SIZE_16, 0x1021, CRC_REVERSE_IN_NONE, false };
+    crc_config_t crc32 = { 0xFFFFFFFF, CRC_POLY_SIZE_32, 0x04C11DB7, CRC_REVERSE_IN_BYTE, true };
+    crc_ctx_t ctx;
+    volatile uint32_t crc;
+    uint8_t i;
+
+    // Nibble table built on each call
+    bitwise.Table = NULL;
+
+    for( i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); i++ )
+    {
+        BENCH_RUN( "CrcCompute.table", sizes[i], crc = CrcCompute( &CrcCcitt, BenchBuffer, sizes[i] ) );
+        BENCH_RUN( "CrcCompute.notable", sizes[i], crc = CrcCompute( &bitwise, BenchBuffer, sizes[i] ) );
+        BENCH_RUN( "crc_calc8.ccitt", sizes[i], { crc_init( &ccitt ); crc = crc_calc8( BenchBuffer, sizes[i] ); } );
+        BENCH_RUN( "crc_calc32.crc32", sizes[i],
+                   { crc_init( &crc32 ); crc = crc_calc32( ( uint32_t * )BenchBuffer, sizes[i] / 4 ); } );
+        BENCH_RUN( "crc_ctx_update.crc32", sizes[i],
+                   { crc_ctx_init( &ctx, &crc32 ); crc_ctx_update( &ctx, BenchBuffer, sizes[i] ); crc = crc_ctx_value( &ctx ); } );
+    }
+    ( void )crc;
+}
+
+static void BenchUtilities( void )
+{
+    static const uint16_t sizes[] = { 8, 16, 64, 256 };
+    uint8_t i;
+
+    for( i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); i++ )
+    {
+        BENCH_RUN( "memcpy1.aligned", sizes[i], memcpy1( BenchOutput, BenchBuffer, sizes[i] ) );
+        BENCH_RUN( "memcpy1.unaligned", sizes[i], memcpy1( BenchOutput + 1, BenchBuffer, sizes[i] ) );
+        BENCH_RUN( "memcpyr", sizes[i], memcpyr( BenchOutput, BenchBuffer, sizes[i] ) );
+        BENCH_RUN( "memset1", sizes[i], memset1( BenchOutput, 0x5A, sizes[i] ) );
+    }
+}
+
+static void BenchCodec( void )
+{
+    static const uint8_t counts[] = { 1, 4, PAYLOAD_CODEC_RECORDS_MAX };
+    BenchRecord_t records[PAYLOAD_CODEC_RECORDS_MAX];
+    BenchRecord_t decoded[PAYLOAD_CODEC_RECORDS_MAX];
+    PayloadCodecState_t enc;
+    PayloadCodecState_t dec;
+    PayloadCodecState_t encKey;
+    uint8_t frame[64];
+    volatile uint8_t size = 0;
+    uint8_t i;
+
+    // A 15 minutes report of a meter
+    memset( records, 0, sizeof( records ) );
+    for( i = 0; i < PAYLOAD_CODEC_RECORDS_MAX; i++ )
+    {
+        records[i].Time = 1700000000 + i * 900 + ( i & 1 );
+        records[i].Energy = 123456 + i * 41 + ( i % 3 );
+        records[i].Temperature = 215 + ( i & 2 ) - 1;
+        records[i].Humidity = 450 + ( i % 5 );
+        records[i].Battery = 98;
+        records[i].Rssi = -70 - i;
+        strcpy( records[i].Status, ( i == 5 ) ? "door_open" : "ok" );
+    }
+
+    // The key frames then the delta ones, the history primed by a first frame
+    PayloadCodecInit( &enc, 0 );
+    PayloadCodecInit( &dec, 0 );
+    size = PayloadCodecEncode( &BenchSchema, &enc, records, 1, frame, sizeof( frame ) );
+    PayloadCodecDecode( &BenchSchema, &dec, frame, size, decoded, PAYLOAD_CODEC_RECORDS_MAX );
+    PayloadCodecInit( &encKey, 0 );
+
+    for( i = 0; i < sizeof( counts ) / sizeof( counts[0] ); i++ )
+    {
+        PayloadCodecState_t state;
+
+        BENCH_RUN( "PayloadCodecEncode.key", counts[i],
+                   { state = encKey; size = PayloadCodecEncode( &BenchSchema, &state, records, counts[i], frame, sizeof( frame ) ); } );
+        printf( "{\"codec\":\"key\",\"records\":%u,\"raw\":%u,\"encoded\":%u}\r\n", counts[i],
+                ( unsigned int )( counts[i] * sizeof( BenchRecord_t ) ), size );
+        BENCH_RUN( "PayloadCodecEncode.delta", counts[i],
+                   { state = enc; size = PayloadCodecEncode( &BenchSchema, &state, records, counts[i], frame, sizeof( frame ) ); } );
+        printf( "{\"codec\":\"delta\",\"records\":%u,\"raw\":%u,\"encoded\":%u}\r\n", counts[i],
+                ( unsigned int )( counts[i] * sizeof( BenchRecord_t ) ), size );
+        BENCH_RUN( "PayloadCodecDecode.delta", counts[i],
+                   { state = dec; PayloadCodecDecode( &BenchSchema, &state, frame, size, decoded, PAYLOAD_CODEC_RECORDS_MAX ); } );
+    }
+}
+
+static void BenchPrintf( void )
+{
+    char line[64];
+
+    BENCH_RUN( "snprintf.int", 0, snprintf( line, sizeof( line ), "%d", -1234567 ) );
+    BENCH_RUN( "snprintf.hex", 0, snprintf( line, sizeof( line ), "%08X", 0xDEADBEEF ) );
+    BENCH_RUN( "snprintf.str", 0, snprintf( line, sizeof( line ), "%s", "+CSTATUS:04" ) );
+    BENCH_RUN( "snprintf.at", 0, snprintf( line, sizeof( line ), "+CRECV:%d,%d,%d,%s\r\n", 2, -97, 8, "0102030405" ) );
+}
+
+int app_start( void )
+{
+    uint32_t i;
+
+    for( i = 0; i < sizeof( BenchBuffer ); i++ )
+    {
+        BenchBuffer[i] = ( uint8_t )i;
+    }
+
+    printf( "stack benchmark start\r\n" );
+    printf( "{\"profile\":\"%s\"}\r\n", BENCH_PROFILE );
+    BenchCalibrate( );
+    BenchRadioBuffer( );
+    BenchCrypto( );
+    BenchTimeOnAir( );
+    BenchTxLatency( );
+    BenchRegion( );
+    BenchTimer( );
+    BenchFlash( );
+    BenchCrc( );
+    BenchUtilities( );
+    BenchCodec( );
+    BenchPrintf( );
+    printf( "stack benchmark done\r\n" );
+
+    while( 1 )
+    {
+    }
+}
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <string.h>
+#include "delay.h"
+#include "timer.h"
+#include "radio.h"
+#include "tremo_uart.h"
+#include "tremo_gpio.h"
+#include "tremo_rcc.h"
+#include "tremo_pwr.h"
+#include "tremo_delay.h"
+#include "rtc-board.h"
+
+extern int app_start(void);
+
+void uart_log_init(void)
+{
+    // uart0
+    gpio_set_iomux(GPIOB, GPIO_PIN_0, 1);
+    gpio_set_iomux(GPIOB, GPIO_PIN_1, 1);
+
+    /* uart config struct init */
+    uart_config_t uart_config;
+    uart_config_init(&uart_config);
+
+    uart_config.baudrate = UART_BAUDRATE_115200;
+    uart_init(CONFIG_DEBUG_UART, &uart_config);
+    uart_cmd(CONFIG_DEBUG_UART, ENABLE);
+}
+
+void board_init()
+{
+    rcc_enable_oscillator(RCC_OSC_XO32K, true);
+
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_UART0, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_GPIOA, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_GPIOB, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_GPIOC, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_GPIOD, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_PWR, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_RTC, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_SAC, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_LORA, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_CRC, true);
+    
+    delay_ms(100);
+    pwr_xo32k_lpm_cmd(true);
+    
+    uart_log_init();
+
+    RtcInit();
+}
+
+int main(void)
+{
+    // Target board initialization
+    board_init();
+
+    app_start();
+}
+
+#ifdef USE_FULL_ASSERT
+void assert_failed(void* file, uint32_t line)
+{
+    (void)file;
+    (void)line;
+
+    while (1) { }
+}
+#endif
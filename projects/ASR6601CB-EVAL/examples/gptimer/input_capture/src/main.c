@@ -1,41 +1,38 @@
 #include <string.h>
 #include "tremo_regs.h"
-#include "tremo_timer.h"
+#include "tremo_timer_seq.h"
 #include "tremo_rcc.h"
 #include "tremo_gpio.h"
 
+#define CAPTURE_RING_SIZE (64)
+
+static timer_seq_t g_seq;
+static uint16_t g_ring[CAPTURE_RING_SIZE];
+static uint8_t g_wraps[CAPTURE_RING_SIZE];
+uint32_t g_periods[CAPTURE_RING_SIZE];
+uint32_t g_pulses = 0;
+
 void gptimer_input_capture(timer_gp_t* TIMERx)
 {
     timer_init_t timerx_init;
 
-    timer_config_interrupt(TIMERx, TIMER_DIER_UIE, ENABLE);
-    timer_config_interrupt(TIMERx, TIMER_DIER_CC0IE, ENABLE);
-    timer_config_interrupt(TIMERx, TIMER_DIER_CC1IE, ENABLE);
-    timer_config_interrupt(TIMERx, TIMER_DIER_CC2IE, ENABLE);
-    timer_config_interrupt(TIMERx, TIMER_DIER_CC3IE, ENABLE);
-    timer_config_interrupt(TIMERx, TIMER_DIER_TIE, ENABLE);
-
     timer_config_ti(TIMERx, (uint32_t)TIMER_CC0P_RISING, TIMER_CC0S_INPUT_SAME, TIMER_IC0F_0, 0);
 
     timerx_init.prescaler          = 0;
     timerx_init.counter_mode       = TIMER_COUNTERMODE_UP;
-    timerx_init.period             = 0xFF;
+    timerx_init.period             = 0xFFFF;
     timerx_init.clock_division     = TIMER_CKD_FPCLK_DIV4;
     timerx_init.autoreload_preload = false;
     timer_init(TIMERx, &timerx_init);
 
-    timer_cmd(TIMERx, true);
+    // every edge is stored by the DMA, the interrupt only runs at the counter wraps
+    timer_seq_init(&g_seq, TIMERx, TIMER_CHANNEL_0);
+    timer_seq_capture_start(&g_seq, g_ring, g_wraps, CAPTURE_RING_SIZE);
 }
 
 void gptim0_IRQHandler(void)
 {
-    bool state;
-
-    timer_get_status(TIMER0, TIMER_SR_UIF, &state);
-
-    if (state) {
-        timer_clear_status(TIMER0, TIMER_SR_UIF);
-    }
+    timer_seq_irq_handler(&g_seq);
 }
 
 int main(void)
@@ -44,6 +41,8 @@ int main(void)
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_GPIOB, true);
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_GPIOC, true);
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_GPIOD, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_DMA0, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_DMA1, true);
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_TIMER0, true);
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_TIMER1, true);
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_TIMER2, true);
@@ -61,7 +60,14 @@ int main(void)
     NVIC_SetPriority(TIMER0_IRQn, 2);
 
     /* Infinite loop */
-    while (1) { }
+    while (1) {
+        // periods in timer ticks, read once the ring is half full
+        if (timer_seq_count(&g_seq) - g_pulses >= CAPTURE_RING_SIZE / 2) {
+            timer_seq_capture_read(&g_seq, g_periods, CAPTURE_RING_SIZE);
+            g_pulses = timer_seq_count(&g_seq);
+        }
+        __WFI();
+    }
 }
 
 #ifdef USE_FULL_ASSERT
@@ -1,13 +1,24 @@
 #include <stdio.h>
 #include "tremo_regs.h"
-#include "tremo_i2s.h"
+#include "tremo_i2s_stream.h"
 #include "tremo_rcc.h"
 #include "tremo_gpio.h"
 
+#define CAPTURE_FRAMES (128)
 
-uint32_t g_data_l[5] = {0};
-uint32_t g_data_r[5] = {0};
-uint32_t g_index = 0;
+static int16_t g_capture[2 * 2 * CAPTURE_FRAMES] __attribute__((aligned(4)));
+static i2s_stream_t g_stream;
+volatile uint32_t g_events = 0;
+
+static void i2s_slave_detect(i2s_stream_t* stream, bool active, uint32_t energy)
+{
+    (void)stream;
+    (void)energy;
+
+    if (active) {
+        g_events++;
+    }
+}
 
 void i2s_slave()
 {
@@ -18,7 +29,8 @@ void i2s_slave()
     NVIC_SetPriority(I2S_IRQn, 2);
 
     i2s_init_struct(&i2s_struct);
-    i2s_struct.i2s_role = I2S_ROLE_SLAVE;
+    i2s_struct.i2s_role      = I2S_ROLE_SLAVE;
+    i2s_struct.i2s_word_size = I2S_WORDSIZE_16bit;
     i2s_init(I2S, &i2s_struct);
     if (i2s_struct.i2s_role == I2S_ROLE_MASTER) {
         freq_devision = i2s_calculate_devision(i2s_struct.i2s_word_size);
@@ -26,33 +38,19 @@ void i2s_slave()
         SYSCFG->CR10 |= freq_devision << I2S_WS_FREQ_POS; // config ws frequence
     }
 
-    i2s_rx_block_cmd(I2S, ENABLE);
+    // capture both channels, an event above about -30 dBFS
+    i2s_stream_init(&g_stream, I2S, I2S_STREAM_CAPTURE, I2S_STREAM_STEREO);
+    i2s_stream_set_detector(&g_stream, 1000000, 4, i2s_slave_detect);
+    i2s_stream_start(&g_stream, g_capture, CAPTURE_FRAMES);
 
     if (i2s_struct.i2s_role == I2S_ROLE_MASTER) {
         SYSCFG->CR10 |= 1 << I2S_WS_ENABLE_POS; // enable ws output
     }
-
-    i2s_config_interrupt(I2S, I2S_INTERRUPT_RXDA, ENABLE);
 }
 
 void i2s_IRQHandler(void)
 {
-    // rx data available
-    if (i2s_get_interrupt_status(I2S, I2S_INTERRUPT_RXDA)) {
-        g_data_l[g_index] = i2s_receive_data(I2S, I2S_LEFT_CHANNEL);
-        g_data_r[g_index] = i2s_receive_data(I2S, I2S_RIGHT_CHANNEL);
-        if ((g_data_l[g_index] != 0) || (g_data_r[g_index] != 0)) {
-            if (g_index < 4) {
-                g_index++;
-            } else {
-                g_index = 0;
-            }
-        }
-    }
-
-    // tx empty
-    if (i2s_get_interrupt_status(I2S, I2S_INTERRUPT_TXFE)) {
-    }
+    i2s_stream_irq_handler(&g_stream);
 }
 
 int main(void)
@@ -73,7 +71,9 @@ int main(void)
     i2s_slave();
 
     /* Infinite loop */
-    while (1) { }
+    while (1) {
+        __WFI();
+    }
 }
 
 #ifdef USE_FULL_ASSERT
@@ -18,6 +18,14 @@ extern "C"
 
 #define CONFIG_GATEWAY (1)
 
+// Beacon synchronised TDMA polling: the gateway broadcasts a schedule and all
+// the nodes answer in their slot of one superframe
+//#define CONFIG_LORA_NET_TDMA (1)
+
+// Group ask: one broadcast for all the polled nodes, answered in the order of
+// their address; not used together with CONFIG_LORA_NET_TDMA
+//#define CONFIG_LORA_NET_GROUP_ASK (1)
+
 #define CONFIG_LORA_RFSW_CTRL_GPIOX GPIOD
 #define CONFIG_LORA_RFSW_CTRL_PIN GPIO_PIN_11
 
@@ -21,4 +21,6 @@ unsigned char receivePackets(unsigned char *buffer);
 
 void handler_uart_data(uint8_t data);
 
+void KeyEventProcess(void);
+
 #endif
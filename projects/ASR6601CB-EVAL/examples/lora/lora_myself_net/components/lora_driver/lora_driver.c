@@ -110,6 +110,8 @@ int8_t RssiValue = 0;
 int8_t SnrValue = 0;
 
 uint32_t ChipId[2] = {0};
+TimerTime_t TxTime = 0; // end of the last TX
+TimerTime_t RxTime = 0; // end of the last RX
 uint8_t sendMsgFlag = 2; // 0：空闲状态可以发送数�?�?1：�?�在发送，等待发送完成；2：发送完�?
 
 /*!
@@ -117,6 +119,53 @@ uint8_t sendMsgFlag = 2; // 0：空闲状态可以发送数�?�?1：�?�
  */
 static RadioEvents_t RadioEvents;
 
+#ifdef CONFIG_LORA_NET_TDMA
+static TdmaSchedule Tdma;
+#ifdef CONFIG_GATEWAY
+static DeviceBlock TdmaDevices[TDMA_SLOT_MAX + 1]; // by slave address, the schedule starts at 1
+static uint8_t TdmaPhase = 0;                        // 0: idle, 1: beacon sent, 2: slots being received
+#endif
+#endif
+
+#ifdef CONFIG_LORA_NET_GROUP_ASK
+static GroupAsk Group;
+#ifdef CONFIG_GATEWAY
+static DeviceBlock GroupDevices[GROUP_MAP_MAX * 8 + 1]; // by slave address, the map starts at 1
+static uint8_t GroupPhase = 0;                           // 0: idle, 1: ask sent, 2: answers being received
+static bool GroupRetry = false;                          // the next ask is only for the slaves missed
+#endif
+#endif
+
+#if (defined(CONFIG_LORA_NET_TDMA) || defined(CONFIG_LORA_NET_GROUP_ASK)) && !defined(CONFIG_GATEWAY)
+static TimerEvent_t TdmaSlotTimer;
+static volatile bool TdmaSlotDue = false;
+static uint8_t SlotOpCode = 0; // operation answered when the slot is due
+static uint8_t SlotPram = 0;
+
+static void OnTdmaSlot(void)
+{
+    TdmaSlotDue = true;
+}
+
+/*!
+ * \brief Arm the answer of this node, offset ms after start; a negative or
+ *        already passed offset means no slot
+ */
+static void StartSlot(TimerTime_t start, int offset, uint8_t op_code, uint8_t pram)
+{
+    TimerTime_t elapsed = TimerGetElapsedTime(start);
+
+    if (offset > (int)elapsed)
+    {
+        SlotOpCode = op_code;
+        SlotPram = pram;
+        TimerStop(&TdmaSlotTimer);
+        TimerSetValue(&TdmaSlotTimer, offset - elapsed);
+        TimerStart(&TdmaSlotTimer);
+    }
+}
+#endif
+
 /*!
  * \brief Function to be executed on Radio Tx Done event
  */
@@ -268,7 +317,7 @@ int Ra08KitLoraTestStart(void)
     static uint8_t ledStatus = 0;
     uint8_t send_buff[8] = {0xA0, 0xF1, 0x01, 0x01, 0x11, 0x22, 0x33, 0xA1};
     DeviceSta_Strcture device = {0};
-    DeviceBlock DeviceBlock_Structure;
+    DeviceBlock DeviceBlock_Structure = {0};
     DeviceBlock DeviceBlock_StructureArray[2];
     int i = 0;
 
@@ -298,6 +347,12 @@ int Ra08KitLoraTestStart(void)
     RadioEvents.RxError = OnRxError;
 
     Radio.Init(&RadioEvents);
+#ifdef CONFIG_LORA_RX_RING
+    Radio.SetRxRing(true);
+#endif
+#if (defined(CONFIG_LORA_NET_TDMA) || defined(CONFIG_LORA_NET_GROUP_ASK)) && !defined(CONFIG_GATEWAY)
+    TimerInit(&TdmaSlotTimer, OnTdmaSlot);
+#endif
 
     // 设置LoRa�?片工作�?�率 #define RF_FREQUENCY 470000000 // Hz 953525
     Radio.SetChannel(433953525);
@@ -355,7 +410,95 @@ int Ra08KitLoraTestStart(void)
     while (1)
     {
 
-#ifdef CONFIG_GATEWAY
+#if defined(CONFIG_GATEWAY) && defined(CONFIG_LORA_NET_TDMA)
+        if (TdmaPhase == 0 && State == LORA_IDLE)
+        {
+            // Slot: one sensor ack plus the guard
+            Tdma.OpCode = OP_R_SENSOR;
+            Tdma.Pram = PRAM_R_ALL;
+            Tdma.FirstAddr = 0x01;
+            Tdma.SlotCount = Addr_Num > TDMA_SLOT_MAX ? TDMA_SLOT_MAX : Addr_Num;
+#if defined(USE_MODEM_LORA)
+            Tdma.SlotTime = Radio.TimeOnAir(MODEM_LORA, 9) + TDMA_GUARD_MS;
+#else
+            Tdma.SlotTime = Radio.TimeOnAir(MODEM_FSK, 9) + TDMA_GUARD_MS;
+#endif
+            sendTdmaBeacon(&Tdma);
+            TdmaPhase = 1;
+        }
+        else if (TdmaPhase == 2 && TimerGetElapsedTime(Tdma.Start) >= getTdmaSuperframeTime(&Tdma))
+        {
+            int acked = 0;
+
+            for (i = 0; i < Tdma.SlotCount; i++)
+            {
+                if (Tdma.Acked[i / 8] & (1 << (i % 8)))
+                {
+                    acked++;
+                }
+                else
+                {
+                    printf("ADDR %d no ack in its slot\r\n", Tdma.FirstAddr + i);
+                }
+            }
+            printf("superframe: %d of %d nodes, %d ms\r\n", acked, Tdma.SlotCount, (int)getTdmaSuperframeTime(&Tdma));
+            TdmaPhase = 0;
+        }
+#elif defined(CONFIG_GATEWAY) && defined(CONFIG_LORA_NET_GROUP_ASK)
+        if (GroupPhase == 0 && State == LORA_IDLE)
+        {
+            int count = Addr_Num > GROUP_MAP_MAX * 8 ? GROUP_MAP_MAX * 8 : Addr_Num;
+
+            Group.OpCode = OP_R_SENSOR;
+            Group.Pram = PRAM_R_ALL;
+            Group.FirstAddr = 0x01;
+#if defined(USE_MODEM_LORA)
+            Group.SlotTime = Radio.TimeOnAir(MODEM_LORA, 9) + TDMA_GUARD_MS;
+#else
+            Group.SlotTime = Radio.TimeOnAir(MODEM_FSK, 9) + TDMA_GUARD_MS;
+#endif
+            if (GroupRetry)
+            {
+                for (i = 0; i < GROUP_MAP_MAX; i++)
+                {
+                    Group.Map[i] &= ~Group.Acked[i];
+                }
+            }
+            else
+            {
+                memset(Group.Map, 0, sizeof(Group.Map));
+                for (i = 0; i < count; i++)
+                {
+                    Group.Map[i / 8] |= 1 << (i % 8);
+                }
+                Group.MapLen = (count + 7) / 8;
+            }
+            sendMasterGroupAsk(&Group);
+            GroupPhase = 1;
+        }
+        else if (GroupPhase == 2 && TimerGetElapsedTime(Group.Start) >= getGroupAskTime(&Group))
+        {
+            int asked = 0, missed = 0;
+
+            for (i = 0; i < Group.MapLen * 8; i++)
+            {
+                if (!(Group.Map[i / 8] & (1 << (i % 8))))
+                {
+                    continue;
+                }
+                asked++;
+                if (!(Group.Acked[i / 8] & (1 << (i % 8))))
+                {
+                    missed++;
+                    printf("ADDR %d no ack to the group ask\r\n", Group.FirstAddr + i);
+                }
+            }
+            printf("group ask: %d of %d nodes, %d ms\r\n", asked - missed, asked, (int)getGroupAskTime(&Group));
+            // one retry for the slaves missed, then a full ask again
+            GroupRetry = !GroupRetry && missed > 0;
+            GroupPhase = 0;
+        }
+#elif defined(CONFIG_GATEWAY)
         static bool flag = 0;
         static uint8_t node_addr = 0x01;
         static long count = 0;
@@ -401,7 +544,19 @@ int Ra08KitLoraTestStart(void)
             Radio.Rx(RX_TIMEOUT_VALUE);
             State = LORA_IDLE;
 
-#ifdef CONFIG_GATEWAY
+#if defined(CONFIG_GATEWAY) && defined(CONFIG_LORA_NET_TDMA)
+            if (TdmaPhase == 2 && receiveTdmaAck(&Tdma, TdmaDevices, Buffer, BufferSize) == FRAME_OK)
+            {
+                printf("slot ack from: %d, temperature: %d, humidity: %d, lux: %d\r\n", Buffer[1],
+                       TdmaDevices[Buffer[1]].Temperature, TdmaDevices[Buffer[1]].Humidity, TdmaDevices[Buffer[1]].Lux);
+            }
+#elif defined(CONFIG_GATEWAY) && defined(CONFIG_LORA_NET_GROUP_ASK)
+            if (GroupPhase == 2 && receiveGroupAck(&Group, GroupDevices, Buffer, BufferSize) == FRAME_OK)
+            {
+                printf("group ack from: %d, temperature: %d, humidity: %d, lux: %d\r\n", Buffer[1],
+                       GroupDevices[Buffer[1]].Temperature, GroupDevices[Buffer[1]].Humidity, GroupDevices[Buffer[1]].Lux);
+            }
+#elif defined(CONFIG_GATEWAY)
             if (Buffer[0] == 0xFF)
             {
                 node_addr = Buffer[1] + 1;
@@ -432,6 +587,24 @@ int Ra08KitLoraTestStart(void)
                 // printf("Recieve New Msg , length:[%d] \r\n", BufferSize);
                 // printf("Recieve SLAVE1_ADDR: %d, receive addr: %d\r\n", SLAVE1_ADDR, Buffer[2]);
 
+#ifdef CONFIG_LORA_NET_TDMA
+                if (receiveTdmaBeacon(&Tdma, Buffer, BufferSize) == FRAME_OK)
+                {
+                    // The slot is timed from the end of the beacon, as on the gateway
+                    Tdma.Start = RxTime;
+                    StartSlot(RxTime, getTdmaSlotOffset(&Tdma, SLAVE1_ADDR), Tdma.OpCode, Tdma.Pram);
+                    break;
+                }
+#endif
+#ifdef CONFIG_LORA_NET_GROUP_ASK
+                if (processMasterGroupAsk(&Group, Buffer, BufferSize) == FRAME_OK)
+                {
+                    // Answer in the rank of this node among the nodes addressed, -1 when not addressed
+                    Group.Start = RxTime;
+                    StartSlot(RxTime, getGroupAckOffset(&Group, SLAVE1_ADDR), Group.OpCode, Group.Pram);
+                    break;
+                }
+#endif
                 if (Buffer[1] == 0xFF)
                 {
                     // 设置�?的�?�色
@@ -543,6 +716,19 @@ int Ra08KitLoraTestStart(void)
         case TX:
             // printf("[%s()-%d]Tx done\r\n", __func__, __LINE__);
             Radio.Rx(RX_TIMEOUT_VALUE);
+#if defined(CONFIG_GATEWAY) && defined(CONFIG_LORA_NET_TDMA)
+            if (TdmaPhase == 1)
+            {
+                Tdma.Start = TxTime;
+                TdmaPhase = 2;
+            }
+#elif defined(CONFIG_GATEWAY) && defined(CONFIG_LORA_NET_GROUP_ASK)
+            if (GroupPhase == 1)
+            {
+                Group.Start = TxTime;
+                GroupPhase = 2;
+            }
+#endif
             sendMsgFlag = 2;
             State = LORA_IDLE;
             break;
@@ -555,6 +741,11 @@ int Ra08KitLoraTestStart(void)
         case TX_TIMEOUT:
             printf("[%s()-%d]Tx timeout\r\n", __func__, __LINE__);
             Radio.Rx(RX_TIMEOUT_VALUE);
+#if defined(CONFIG_GATEWAY) && defined(CONFIG_LORA_NET_TDMA)
+            TdmaPhase = 0;
+#elif defined(CONFIG_GATEWAY) && defined(CONFIG_LORA_NET_GROUP_ASK)
+            GroupPhase = 0;
+#endif
             sendMsgFlag = 2;
             State = LORA_IDLE;
             break;
@@ -582,6 +773,17 @@ int Ra08KitLoraTestStart(void)
             break;
         }
 
+#if (defined(CONFIG_LORA_NET_TDMA) || defined(CONFIG_LORA_NET_GROUP_ASK)) && !defined(CONFIG_GATEWAY)
+        if (TdmaSlotDue)
+        {
+            TdmaSlotDue = false;
+            DeviceBlock_Structure.Coils = ledStatus;
+            sendSlaveAck(SLAVE1_ADDR, SlotOpCode, SlotPram, &DeviceBlock_Structure);
+        }
+#endif
+
+        KeyEventProcess();
+
         // Process Radio IRQ
         Radio.IrqProcess();
     }
@@ -589,6 +791,7 @@ int Ra08KitLoraTestStart(void)
 
 void OnTxDone(void)
 {
+    TxTime = TimerGetCurrentTime();
     Radio.Sleep();
     State = TX;
 }
@@ -614,6 +817,7 @@ unsigned char receivePackets(unsigned char *buffer)
 
 void OnRxDone(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
 {
+    RxTime = TimerGetCurrentTime();
     Radio.Sleep();
     BufferSize = size;
     memset(Buffer, 0, BUFFER_SIZE);
@@ -22,6 +22,8 @@
 /*操作码相关宏定义*/
 #define OP_W_COILS 0x02  // 写继电器状�?
 #define OP_R_SENSOR 0x01 // 读传感器数据
+#define OP_TDMA_BEACON 0x03 // TDMA superframe schedule, broadcast by the master
+#define OP_GROUP_ASK 0x04   // one ask for a bitmap of slaves, broadcast by the master
 
 /*参数相关宏定�?*/
 #define PRAM_R_TEMPERATURE 0x01 // �?读取温度
@@ -32,6 +34,16 @@
 #define PRAM_W_RELAY1 0x01 // 吸合继电�?1,如果想断开按位取反即可
 #define PRAM_W_RELAY2 0x02 // 吸合继电�?2,如果想断开按位取反即可
 
+/*TDMA相关宏定义*/
+#define TDMA_SLOT_MAX 64      // slots of a superframe, the addresses answering are below TDMA_SLOT_MAX + first_addr
+#define TDMA_BEACON_LEN 11    // NET_ADDR, BROADCAST_ADDR, OP_TDMA_BEACON, op_code, pram, first_addr, slot_count, slot_ms(2), CRC(2)
+#define TDMA_FIRST_SLOT_MS 30 // from the end of the beacon to slot 0, the nodes handle the beacon meanwhile
+#define TDMA_GUARD_MS 20      // added to the airtime of an ack in each slot, for the clock and turnaround errors
+
+/*组查询相关宏定义*/
+#define GROUP_MAP_MAX 8      // bitmap bytes of a group ask, up to 64 slaves from first_addr
+#define GROUP_ASK_HEAD_LEN 9 // NET_ADDR, BROADCAST_ADDR, OP_GROUP_ASK, op_code, pram, first_addr, slot_ms(2), map_len
+
 typedef enum
 {
     FRAME_OK = 0x00,            // 数据帧�?�确
@@ -56,6 +68,38 @@ typedef struct
     /*�?继续添加其他传感器、�??控单元和系统参数*/
 } DeviceBlock;
 
+/**
+ * TDMA superframe: after the beacon each slave answers in its own slot, the
+ * master collects all the slots in one receive with no per slave timeout
+ */
+typedef struct
+{
+    unsigned char OpCode;                       // operation answered in the slots
+    unsigned char Pram;                         // its parameter
+    unsigned char FirstAddr;                    // slave address of slot 0
+    unsigned char SlotCount;                    // number of slots, up to TDMA_SLOT_MAX
+    unsigned short int SlotTime;                // slot length in ms
+    uint64_t Start;                             // TimerGetCurrentTime (TimerTime_t) at the end of the beacon
+    unsigned char Acked[TDMA_SLOT_MAX / 8];     // master, bitmap of the slots answered
+} TdmaSchedule;
+
+/**
+ * Group ask: the slaves set in Map answer the same op_code in the order of
+ * their bit, the n-th addressed slave in slot n after the ask. Slaves not
+ * addressed take no slot
+ */
+typedef struct
+{
+    unsigned char OpCode;                   // operation asked
+    unsigned char Pram;                     // its parameter
+    unsigned char FirstAddr;                // slave address of bit 0
+    unsigned char MapLen;                   // bytes used in Map, up to GROUP_MAP_MAX
+    unsigned short int SlotTime;            // slot length in ms
+    uint64_t Start;                         // TimerGetCurrentTime (TimerTime_t) at the end of the ask
+    unsigned char Map[GROUP_MAP_MAX];       // slaves addressed, bit i is FirstAddr + i
+    unsigned char Acked[GROUP_MAP_MAX];     // master, slaves answered
+} GroupAsk;
+
 typedef struct
 {
     u8 Humidity;
@@ -66,5 +110,18 @@ typedef struct
 void sendMasterAsk(unsigned char slave_addr, unsigned char op_code, unsigned char pram);
 FrameStatus receiveSlaveAck(unsigned char slave_addr, unsigned char op_code, unsigned char pram, DeviceBlock *pdevblock, unsigned char *receivebuffer, uint16_t len);
 FrameStatus processMasterAsk(DeviceBlock *pdevblock, unsigned char *receivebuffer, uint16_t len);
+void sendSlaveAck(unsigned char slave_addr, unsigned char op_code, unsigned char pram, DeviceBlock *pdevblock);
+
+void sendTdmaBeacon(TdmaSchedule *psched);
+FrameStatus receiveTdmaBeacon(TdmaSchedule *psched, unsigned char *receivebuffer, uint16_t len);
+FrameStatus receiveTdmaAck(TdmaSchedule *psched, DeviceBlock *pdevblock, unsigned char *receivebuffer, uint16_t len);
+int getTdmaSlotOffset(TdmaSchedule *psched, unsigned char slave_addr);
+uint32_t getTdmaSuperframeTime(TdmaSchedule *psched);
+
+void sendMasterGroupAsk(GroupAsk *pask);
+FrameStatus processMasterGroupAsk(GroupAsk *pask, unsigned char *receivebuffer, uint16_t len);
+FrameStatus receiveGroupAck(GroupAsk *pask, DeviceBlock *pdevblock, unsigned char *receivebuffer, uint16_t len);
+int getGroupAckOffset(GroupAsk *pask, unsigned char slave_addr);
+uint32_t getGroupAskTime(GroupAsk *pask);
 
 #endif
@@ -8,6 +8,8 @@
  */
 #include "lora_net.h"
 #include "lora_driver.h"
+#include "crc.h"
+#include "radio.h"
 /**
  * 功能：根据ModBus规则计算CRC16
  * 参数：
@@ -17,24 +19,7 @@
  */
 static unsigned short int getModbusCRC16(unsigned char *_pBuf, uint16_t _usLen)
 {
-    unsigned short int CRCValue = 0xFFFF; // 初始化CRC变量各位为1
-    unsigned char i, j;
-
-    for (i = 0; i < _usLen; ++i)
-    {
-        CRCValue ^= *(_pBuf + i); // 当前数据异或CRC低字节
-        for (j = 0; j < 8; ++j)   // 一个字节重复右移8次
-        {
-            if ((CRCValue & 0x01) == 0x01) // 判断右移前最低位是否为1
-            {
-                CRCValue = (CRCValue >> 1) ^ 0xA001; // 如果为1则右移并异或表达式
-            }
-            else
-            {
-                CRCValue >>= 1; // 否则直接右移一位
-            }
-        }
-    }
+    unsigned short int CRCValue = CrcCompute(&CrcModbus, _pBuf, _usLen);
 
     if (CRCValue & 0xFF == 0)
     {
@@ -206,3 +191,268 @@ transmitPackets(Ackbuffer, sizeof(Ackbuffer));
 */
     return FRAME_OK;
 }
+
+/**
+ * Build and send the answer of a slave, as processMasterAsk would
+ *       slave_addr: local address
+ *       op_code, pram: the operation asked
+ *       pdevblock: state of the local device
+ */
+void sendSlaveAck(unsigned char slave_addr, unsigned char op_code, unsigned char pram, DeviceBlock *pdevblock)
+{
+    unsigned char Ackbuffer[9] = {NET_ADDR, slave_addr, op_code};
+    unsigned short int CRC16;
+    unsigned char len = 9;
+
+    if (op_code == OP_W_COILS)
+    {
+        pdevblock->Coils = pram;
+        Ackbuffer[3] = pdevblock->Coils;
+        len = 6;
+    }
+    else if (op_code == OP_R_SENSOR)
+    {
+        if (pram & PRAM_R_TEMPERATURE)
+        {
+            Ackbuffer[3] = pdevblock->Temperature;
+        }
+        if (pram & PRAM_R_HUMIDITY)
+        {
+            Ackbuffer[4] = pdevblock->Humidity;
+        }
+        if (pram & PRAM_R_LUX)
+        {
+            Ackbuffer[5] = pdevblock->Lux >> 8;
+            Ackbuffer[6] = pdevblock->Lux;
+        }
+    }
+
+    CRC16 = getModbusCRC16(Ackbuffer, len - 2);
+    Ackbuffer[len - 2] = CRC16 >> 8;
+    Ackbuffer[len - 1] = CRC16;
+
+    // no delay here, the slot is already timed
+    Radio.Send(Ackbuffer, len);
+}
+
+/**
+ * Broadcast the schedule of a TDMA superframe, the slots start at the end
+ * of the beacon
+ */
+void sendTdmaBeacon(TdmaSchedule *psched)
+{
+    unsigned char sendbuffer[TDMA_BEACON_LEN] = {NET_ADDR, BROADCAST_ADDR, OP_TDMA_BEACON,
+                                                 psched->OpCode, psched->Pram, psched->FirstAddr, psched->SlotCount,
+                                                 psched->SlotTime >> 8, psched->SlotTime};
+    unsigned short int CRC16 = getModbusCRC16(sendbuffer, TDMA_BEACON_LEN - 2);
+
+    sendbuffer[TDMA_BEACON_LEN - 2] = CRC16 >> 8;
+    sendbuffer[TDMA_BEACON_LEN - 1] = CRC16;
+
+    memset(psched->Acked, 0, sizeof(psched->Acked));
+    Radio.Send(sendbuffer, TDMA_BEACON_LEN);
+}
+
+/**
+ * Parse a TDMA beacon on a slave, psched->Start is left to the caller
+ * Return: FRAME_OK for a beacon of this network
+ */
+FrameStatus receiveTdmaBeacon(TdmaSchedule *psched, unsigned char *receivebuffer, uint16_t len)
+{
+    if (len != TDMA_BEACON_LEN || receivebuffer[0] != NET_ADDR)
+    {
+        return FRAME_NETADDR_ERR;
+    }
+
+    if (receivebuffer[1] != BROADCAST_ADDR || receivebuffer[2] != OP_TDMA_BEACON)
+    {
+        return FRAME_SLAVEADDR_ERR;
+    }
+
+    if (getModbusCRC16(receivebuffer, len - 2) != (receivebuffer[len - 2] << 8 | receivebuffer[len - 1]))
+    {
+        return FRAME_CRC_ERR;
+    }
+
+    psched->OpCode = receivebuffer[3];
+    psched->Pram = receivebuffer[4];
+    psched->FirstAddr = receivebuffer[5];
+    psched->SlotCount = receivebuffer[6] > TDMA_SLOT_MAX ? TDMA_SLOT_MAX : receivebuffer[6];
+    psched->SlotTime = receivebuffer[7] << 8 | receivebuffer[8];
+    return FRAME_OK;
+}
+
+/**
+ * Handle a slot answer on the master
+ *       pdevblock: DeviceBlock array indexed by the slave address, covering
+ *                  the addresses of the schedule
+ */
+FrameStatus receiveTdmaAck(TdmaSchedule *psched, DeviceBlock *pdevblock, unsigned char *receivebuffer, uint16_t len)
+{
+    unsigned char slot;
+    FrameStatus status;
+
+    if (len < 4)
+    {
+        return FRAME_EMPTY;
+    }
+
+    slot = receivebuffer[1] - psched->FirstAddr;
+    if (receivebuffer[1] < psched->FirstAddr || slot >= psched->SlotCount)
+    {
+        return FRAME_SLAVEADDR_ERR;
+    }
+
+    status = receiveSlaveAck(receivebuffer[1], psched->OpCode, psched->Pram, pdevblock, receivebuffer, len);
+    if (status == FRAME_OK)
+    {
+        psched->Acked[slot / 8] |= 1 << (slot % 8);
+    }
+    return status;
+}
+
+/**
+ * Return: ms from the end of the beacon to the slot of the slave, -1 when it
+ *         has no slot
+ */
+int getTdmaSlotOffset(TdmaSchedule *psched, unsigned char slave_addr)
+{
+    if (slave_addr < psched->FirstAddr || slave_addr - psched->FirstAddr >= psched->SlotCount)
+    {
+        return -1;
+    }
+    return TDMA_FIRST_SLOT_MS + (slave_addr - psched->FirstAddr) * psched->SlotTime;
+}
+
+/**
+ * Return: ms from the end of the beacon to the end of the last slot
+ */
+uint32_t getTdmaSuperframeTime(TdmaSchedule *psched)
+{
+    return TDMA_FIRST_SLOT_MS + (uint32_t)psched->SlotCount * psched->SlotTime;
+}
+
+/**
+ * Count the slaves set in a group bitmap below bit end
+ */
+static int countGroupMap(unsigned char *map, int end)
+{
+    int i, count = 0;
+
+    for (i = 0; i < end; i++)
+    {
+        if (map[i / 8] & (1 << (i % 8)))
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * Broadcast one ask to all the slaves set in pask->Map, they answer in the
+ * order of getGroupAckOffset
+ */
+void sendMasterGroupAsk(GroupAsk *pask)
+{
+    unsigned char sendbuffer[GROUP_ASK_HEAD_LEN + GROUP_MAP_MAX + 2] = {NET_ADDR, BROADCAST_ADDR, OP_GROUP_ASK,
+                                                                       pask->OpCode, pask->Pram, pask->FirstAddr,
+                                                                       pask->SlotTime >> 8, pask->SlotTime, pask->MapLen};
+    unsigned char len = GROUP_ASK_HEAD_LEN + pask->MapLen;
+    unsigned short int CRC16;
+
+    memcpy(sendbuffer + GROUP_ASK_HEAD_LEN, pask->Map, pask->MapLen);
+    CRC16 = getModbusCRC16(sendbuffer, len);
+    sendbuffer[len] = CRC16 >> 8;
+    sendbuffer[len + 1] = CRC16;
+
+    memset(pask->Acked, 0, sizeof(pask->Acked));
+    Radio.Send(sendbuffer, len + 2);
+}
+
+/**
+ * Parse a group ask on a slave, pask->Start is left to the caller
+ * Return: FRAME_OK for a group ask of this network
+ */
+FrameStatus processMasterGroupAsk(GroupAsk *pask, unsigned char *receivebuffer, uint16_t len)
+{
+    if (len < GROUP_ASK_HEAD_LEN + 2 || receivebuffer[0] != NET_ADDR)
+    {
+        return FRAME_NETADDR_ERR;
+    }
+
+    if (receivebuffer[1] != BROADCAST_ADDR || receivebuffer[2] != OP_GROUP_ASK)
+    {
+        return FRAME_SLAVEADDR_ERR;
+    }
+
+    if (receivebuffer[8] > GROUP_MAP_MAX || len != GROUP_ASK_HEAD_LEN + receivebuffer[8] + 2)
+    {
+        return FRAME_EMPTY;
+    }
+
+    if (getModbusCRC16(receivebuffer, len - 2) != (receivebuffer[len - 2] << 8 | receivebuffer[len - 1]))
+    {
+        return FRAME_CRC_ERR;
+    }
+
+    pask->OpCode = receivebuffer[3];
+    pask->Pram = receivebuffer[4];
+    pask->FirstAddr = receivebuffer[5];
+    pask->SlotTime = receivebuffer[6] << 8 | receivebuffer[7];
+    pask->MapLen = receivebuffer[8];
+    memset(pask->Map, 0, sizeof(pask->Map));
+    memcpy(pask->Map, receivebuffer + GROUP_ASK_HEAD_LEN, pask->MapLen);
+    return FRAME_OK;
+}
+
+/**
+ * Handle the answer of an addressed slave on the master
+ *       pdevblock: DeviceBlock array indexed by the slave address
+ */
+FrameStatus receiveGroupAck(GroupAsk *pask, DeviceBlock *pdevblock, unsigned char *receivebuffer, uint16_t len)
+{
+    unsigned char bit;
+    FrameStatus status;
+
+    if (len < 4)
+    {
+        return FRAME_EMPTY;
+    }
+
+    bit = receivebuffer[1] - pask->FirstAddr;
+    if (getGroupAckOffset(pask, receivebuffer[1]) < 0)
+    {
+        return FRAME_SLAVEADDR_ERR;
+    }
+
+    status = receiveSlaveAck(receivebuffer[1], pask->OpCode, pask->Pram, pdevblock, receivebuffer, len);
+    if (status == FRAME_OK)
+    {
+        pask->Acked[bit / 8] |= 1 << (bit % 8);
+    }
+    return status;
+}
+
+/**
+ * Return: ms from the end of the ask to the slot of the slave, its rank among
+ *         the addressed slaves; -1 when it is not addressed
+ */
+int getGroupAckOffset(GroupAsk *pask, unsigned char slave_addr)
+{
+    int bit = slave_addr - pask->FirstAddr;
+
+    if (slave_addr < pask->FirstAddr || bit >= pask->MapLen * 8 || !(pask->Map[bit / 8] & (1 << (bit % 8))))
+    {
+        return -1;
+    }
+    return TDMA_FIRST_SLOT_MS + countGroupMap(pask->Map, bit) * pask->SlotTime;
+}
+
+/**
+ * Return: ms from the end of the ask to the end of the last answer
+ */
+uint32_t getGroupAskTime(GroupAsk *pask)
+{
+    return TDMA_FIRST_SLOT_MS + (uint32_t)countGroupMap(pask->Map, pask->MapLen * 8) * pask->SlotTime;
+}
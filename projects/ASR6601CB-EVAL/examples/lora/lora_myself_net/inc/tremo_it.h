@@ -14,8 +14,6 @@ void SVC_Handler(void);
 void PendSV_Handler(void);
 void SysTick_Handler(void);
 
-void gptim0_IRQHandler(void);
-
 #ifdef __cplusplus
 }
 #endif
@@ -9,46 +9,18 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include "tremo_rcc.h"
-#include "tremo_timer.h"
 
 #include "tremo_uart.h"
 #include "tremo_gpio.h"
 #include "tremo_rcc.h"
+#include "event-queue.h"
+#include "input-event.h"
 #include "lora_net.h"
 #include "lora_driver.h"
 
-typedef struct KEY_STRUCT
-{
-    u8 key_status;      /*按键状态*/
-    int key_press_time; /*按键按下时间*/
-    u8 key_lock;        /*按键锁*/
-    u8 key_num;         /*按键按下计数*/
-};
-
-struct KEY_STRUCT key = {0, 0, 0, 0};
-
 gpio_t *g_test_gpiox = GPIOA;
 uint8_t g_test_pin = GPIO_PIN_2;
 
-void gptimer_simple_timer(timer_gp_t *TIMERx)
-{
-    timer_init_t timerx_init;
-
-    timer_config_interrupt(TIMERx, TIMER_DIER_UIE, ENABLE);
-
-    timerx_init.prescaler = 23999; // sysclock defaults to 24M, is divided by (prescaler + 1) to 1k
-    timerx_init.counter_mode = TIMER_COUNTERMODE_UP;
-    timerx_init.period = 50; // time period is ((1 / 1k) * 1000)
-    timerx_init.clock_division = TIMER_CKD_FPCLK_DIV1;
-    timerx_init.autoreload_preload = false;
-    timer_init(TIMERx, &timerx_init);
-
-    timer_generate_event(TIMERx, TIMER_EGR_UG, ENABLE);
-    timer_clear_status(TIMERx, TIMER_SR_UIF);
-
-    timer_cmd(TIMERx, true); //
-}
-
 void uart_log_init(void)
 {
     // uart0
@@ -69,73 +41,57 @@ void uart_log_init(void)
     NVIC_EnableIRQ(UART0_IRQn);
 }
 
-void gptim0_IRQHandler(void)
-{
-    bool state;
-    timer_get_status(TIMER2, TIMER_SR_UIF, &state);
-    if (state)
-    {
-        if (key.key_lock)
-        {
-            key.key_press_time++;
-        }
-        timer_clear_status(TIMER2, TIMER_SR_UIF);
-    }
-}
 extern uint8_t sendMsgFlag;
 void GPIO_IRQHandler(void)
 {
-    if (gpio_get_interrupt_status(GPIOA, GPIO_PIN_2))
-    {
+    // Debounce and press timing run from the RTC timer, no periodic tick
+    InputEventIrqHandler();
+}
+
+/**
+ * Handles the key presses queued by GPIO_IRQHandler, from the LoRa main loop
+ */
+void KeyEventProcess(void)
+{
+    Event_t event;
 
-        if (key.key_lock == 1)
+    while (EventGet(&event))
+    {
+        if (event.Type != EVENT_INPUT)
         {
-            if (key.key_press_time > 1 && key.key_press_time < 10)
-            {
-                printf(" Short Press\r\n");
+            continue;
+        }
 
-                gpio_write(GPIOA, GPIO_PIN_4, GPIO_LEVEL_LOW);
-                gpio_write(GPIOA, GPIO_PIN_5, GPIO_LEVEL_HIGH);
+        if (INPUT_EVENT_TYPE(event.Param) == INPUT_EVENT_SHORT_PRESS)
+        {
+            printf(" Short Press\r\n");
 
-                key.key_press_time = 0;
+            gpio_write(GPIOA, GPIO_PIN_4, GPIO_LEVEL_LOW);
+            gpio_write(GPIOA, GPIO_PIN_5, GPIO_LEVEL_HIGH);
 
-                if (2 == sendMsgFlag)
-                {
-                    sendMsgFlag = 0;
-                }
-                else
-                {
-                    printf("[%s()-%d]lora busy\r\n", __func__, __LINE__);
-                }
+            if (2 == sendMsgFlag)
+            {
+                sendMsgFlag = 0;
             }
-
-            if (key.key_press_time > 30)
+            else
             {
-
-                gpio_write(GPIOA, GPIO_PIN_4, GPIO_LEVEL_HIGH);
-                gpio_write(GPIOA, GPIO_PIN_5, GPIO_LEVEL_LOW);
-
-                printf("Long Press \r\n");
-                key.key_lock = 1;
-                key.key_press_time = 0;
+                printf("[%s()-%d]lora busy\r\n", __func__, __LINE__);
             }
-
-            key.key_lock = 0;
         }
         else
         {
-            key.key_lock = 1;
-            key.key_press_time = 0;
+            gpio_write(GPIOA, GPIO_PIN_4, GPIO_LEVEL_HIGH);
+            gpio_write(GPIOA, GPIO_PIN_5, GPIO_LEVEL_LOW);
+
+            printf("Long Press \r\n");
         }
     }
-    gpio_clear_interrupt(GPIOA, GPIO_PIN_2);
 }
 
 int main(void)
 {
 
     rcc_enable_oscillator(RCC_OSC_XO32K, true);
-    rcc_enable_peripheral_clk(RCC_PERIPHERAL_TIMER2, true);
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_UART0, true);
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_GPIOA, true);
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_GPIOB, true);
@@ -146,23 +102,17 @@ int main(void)
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_SAC, true);
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_LORA, true);
 
-    gpio_init(g_test_gpiox, g_test_pin, GPIO_MODE_INPUT_PULL_DOWN);
-    gpio_config_interrupt(g_test_gpiox, g_test_pin, GPIO_INTR_RISING_FALLING_EDGE);
-
     delay_ms(100);
     pwr_xo32k_lpm_cmd(true);
 
     uart_log_init();
     RtcInit();
-    gptimer_simple_timer(TIMER2);
+    InputEventAddKey(g_test_gpiox, g_test_pin, GPIO_MODE_INPUT_PULL_DOWN, GPIO_LEVEL_HIGH);
 
     /* NVIC config */
     NVIC_EnableIRQ(GPIO_IRQn);
     NVIC_SetPriority(GPIO_IRQn, 2);
 
-    NVIC_EnableIRQ(TIMER2_IRQn);
-    NVIC_SetPriority(TIMER2_IRQn, 3);
-
     // 初始化GPIO
     gpio_set_iomux(GPIOA, GPIO_PIN_4, 0);
     gpio_set_iomux(GPIOA, GPIO_PIN_5, 0);
@@ -138,11 +138,6 @@ void TIMER0_IRQHandler(void)
     // gptim0_IRQHandler();
 }
 
-void TIMER2_IRQHandler()
-{
-    gptim0_IRQHandler();
-}
-
 void UART0_IRQHandler(void)
 {
     if (uart_get_interrupt_status(UART0, UART_INTERRUPT_RX_DONE))
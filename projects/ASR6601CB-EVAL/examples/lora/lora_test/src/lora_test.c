@@ -10,6 +10,8 @@
 #include "sx126x-board.h"
 #include "sx126x.h"
 #include "radio.h"
+#include "link-bench.h"
+#include "at-engine.h"
 
 #define RF_FREQUENCY               470000000
 #define TX_OUTPUT_POWER            22        // dBm
@@ -29,27 +31,29 @@
 
 #define AT_PROMPT "ASR6601:~#"
 
-typedef int(ATTestHandler)(int argc, char* argv[]);
-typedef struct TestCaseSt_ {
-    char name[32];
-    ATTestHandler* fn;
-} TestCaseSt;
-
-int test_case_ctxcw(int argc, char* argv[]);
-int test_case_ctx(int argc, char* argv[]);
-int test_case_crx(int argc, char* argv[]);
-int test_case_crxs(int argc, char* argv[]);
-int test_case_csleep(int argc, char* argv[]);
-int test_case_cstdby(int argc, char* argv[]);
-
-static TestCaseSt gCases[] = { 
-    { "AT+CTXCW=", &test_case_ctxcw }, 
-    { "AT+CTX=", &test_case_ctx }, 
-    { "AT+CRXS=", &test_case_crxs },
-    { "AT+CRX=", &test_case_crx }, 
-    { "AT+CSLEEP=", &test_case_csleep }, 
-    { "AT+CSTDBY=", &test_case_cstdby } 
+int test_case_ctxcw(int op, int argc, char* argv[]);
+int test_case_ctx(int op, int argc, char* argv[]);
+int test_case_crx(int op, int argc, char* argv[]);
+int test_case_crxs(int op, int argc, char* argv[]);
+int test_case_csleep(int op, int argc, char* argv[]);
+int test_case_cstdby(int op, int argc, char* argv[]);
+#ifdef CONFIG_LINK_BENCH
+int test_case_cbench(int op, int argc, char* argv[]);
+#endif
+
+// Sorted by name, see AtEngineFind
+static const AtCmd_t gCases[] = {
+#ifdef CONFIG_LINK_BENCH
+    AT_CMD_ENTRY("+CBENCH", test_case_cbench),
+#endif
+    AT_CMD_ENTRY("+CRX", test_case_crx),
+    AT_CMD_ENTRY("+CRXS", test_case_crxs),
+    AT_CMD_ENTRY("+CSLEEP", test_case_csleep),
+    AT_CMD_ENTRY("+CSTDBY", test_case_cstdby),
+    AT_CMD_ENTRY("+CTX", test_case_ctx),
+    AT_CMD_ENTRY("+CTXCW", test_case_ctxcw),
 };
+static const AtTable_t gCaseTable = AT_TABLE(gCases);
 static RadioEvents_t TestRadioEvents;
 static uint32_t g_fcnt_start = 0;
 static uint32_t g_fcnt_rcvd  = 0;
@@ -151,7 +155,7 @@ void test_stop3_wfi()
     printf("leave deepsleep...\r\n");
 }
 
-int test_case_ctxcw(int argc, char* argv[])
+int test_case_ctxcw(int op, int argc, char* argv[])
 {
     uint8_t opt   = 0;
     uint32_t freq = strtol(argv[0], NULL, 0);
@@ -175,7 +179,7 @@ int test_case_ctxcw(int argc, char* argv[])
     return 0;
 }
 
-int test_case_cstdby(int argc, char* argv[])
+int test_case_cstdby(int op, int argc, char* argv[])
 {
     uint8_t stdby_mode = 0;
     stdby_mode         = strtol((const char*)argv[0], NULL, 0);
@@ -199,7 +203,7 @@ int test_case_cstdby(int argc, char* argv[])
     return 0;
 }
 
-int test_case_csleep(int argc, char* argv[])
+int test_case_csleep(int op, int argc, char* argv[])
 {
     uint8_t sleep_mode = 0;
     sleep_mode         = strtol((const char*)argv[0], NULL, 0);
@@ -226,7 +230,7 @@ int test_case_csleep(int argc, char* argv[])
     return 0;
 }
 
-int test_case_crxs(int argc, char* argv[])
+int test_case_crxs(int op, int argc, char* argv[])
 {
     uint32_t freq = strtol(argv[0], NULL, 0);
     uint8_t dr    = strtol(argv[1], NULL, 0);
@@ -262,7 +266,7 @@ int test_case_crxs(int argc, char* argv[])
     }
 }
 
-int test_case_crx(int argc, char* argv[])
+int test_case_crx(int op, int argc, char* argv[])
 {
     uint32_t freq = strtol(argv[0], NULL, 0);
     uint8_t dr    = strtol(argv[1], NULL, 0);
@@ -297,7 +301,7 @@ int test_case_crx(int argc, char* argv[])
     }
 }
 
-int test_case_ctx(int argc, char* argv[])
+int test_case_ctx(int op, int argc, char* argv[])
 {
     char buf[32];
     uint32_t size = 0;
@@ -351,18 +355,39 @@ int test_case_ctx(int argc, char* argv[])
     }
 }
 
+#ifdef CONFIG_LINK_BENCH
+int test_case_cbench(int op, int argc, char* argv[])
+{
+    LinkBenchSweep_t sweep = LinkBenchDefaultSweep;
+    uint32_t freq;
+    uint8_t role;
+
+    if (argc < 2)
+        return -1;
+    freq = strtol(argv[0], NULL, 0);
+    role = strtol(argv[1], NULL, 0);
+    if (argc > 2)
+        sweep.Packets = strtol(argv[2], NULL, 0);
+
+    // Lines of +BENCH: results until the master is done, see link-bench.h
+    LinkBenchStart(role ? LINK_BENCH_MASTER : LINK_BENCH_RESPONDER, freq, &sweep);
+    while (LinkBenchProcess()) {
+        Radio.IrqProcess();
+    }
+    return 0;
+}
+#endif
+
 int tc_lora_test(void)
 {
     int ret   = -1;
-    int i     = 0;
-    char* ptr = NULL;
+    const AtCmd_t* cmd = NULL;
     char ch;
     char cmd_str[64];
     int cmd_index = 0;
-    int case_num  = sizeof(gCases) / sizeof(gCases[0]);
+    int opt       = 0;
     int argc      = 0;
     char* argv[16];
-    char* str      = NULL;
     char resetFlag = 1;
 
     while (1) {
@@ -384,25 +409,10 @@ int tc_lora_test(void)
             continue;
         cmd_str[cmd_index] = '\0';
 
-        for (i = 0; i < case_num; i++) {
-            int cmd_len = strlen(gCases[i].name);
-            if (!strncmp((const char*)cmd_str, gCases[i].name, cmd_len)) {
-                ptr = (char*)cmd_str + cmd_len;
-                break;
-            }
-        }
-
-        if (i >= case_num || !gCases[i].fn)
-            goto end;
-
-        str = strtok((char*)ptr, ",");
-        while (str) {
-            argv[argc++] = str;
-            str          = strtok((char*)NULL, ",");
-        }
-        ret = gCases[i].fn(argc, argv);
+        // The test cases only take AT+<name>=<args>
+        cmd = AtEngineParse(&gCaseTable, cmd_str, &opt, &argc, argv, 16);
+        ret = (cmd && opt == AT_ENGINE_SET) ? cmd->Fn(opt, argc, argv) : -1;
 
-    end:
         if (ret == -1)
             printf("\r\n+CME ERROR:1\r\n");
     }
@@ -64,6 +64,9 @@ int main(void)
             "* AT+CRXS=<freq>,<data_rate>,<bandwidth>,<code_rate>,<ldo>         *\r\n"
             "* AT+CSLEEP=<sleep_mode>                                           *\r\n"
             "* AT+CSTDBY=<standby_mode>                                         *\r\n"
+#ifdef CONFIG_LINK_BENCH
+            "* AT+CBENCH=<freq>,<role>[,packets]                                *\r\n"
+#endif
             "********************************************************************\r\n"
             "*******************************************************************/\r\n");
 	
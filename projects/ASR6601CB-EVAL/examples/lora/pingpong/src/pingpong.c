@@ -27,6 +27,7 @@
 #include "timer.h"
 #include "radio.h"
 #include "tremo_system.h"
+#include "link-bench.h"
 
 #if defined( REGION_AS923 )
 
@@ -114,6 +115,10 @@ typedef enum
 }States_t;
 
 #define RX_TIMEOUT_VALUE                            1800
+
+#ifndef PINGPONG_BENCH_ROLE
+#define PINGPONG_BENCH_ROLE                         LINK_BENCH_RESPONDER
+#endif
 #define BUFFER_SIZE                                 5 // Define the payload size here
 
 const uint8_t PingMsg[] = "PING";
@@ -172,6 +177,16 @@ int app_start( void )
 
     (void)system_get_chip_id(ChipId);
 
+#if defined( CONFIG_LINK_BENCH ) && defined( USE_MODEM_LORA )
+    // Sweeps the LoRa configurations with the peer instead of the ping-pong
+    LinkBenchStart( PINGPONG_BENCH_ROLE, RF_FREQUENCY, NULL );
+    while( LinkBenchProcess( ) )
+    {
+        Radio.IrqProcess( );
+    }
+    return 0;
+#endif
+
     // Radio initialization
     RadioEvents.TxDone = OnTxDone;
     RadioEvents.RxDone = OnRxDone;
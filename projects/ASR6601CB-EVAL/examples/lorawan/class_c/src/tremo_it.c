@@ -3,6 +3,9 @@
 
 extern void RadioOnDioIrq(void);
 extern void RtcOnIrq(void);
+#ifdef CONFIG_TIMER_PRECISE
+extern void RtcOnPreciseIrq(void);
+#endif
 
 /**
  * @brief  This function handles NMI exception.
@@ -110,3 +113,10 @@ void RTC_IRQHandler(void)
 {
     RtcOnIrq();
 }
+
+#ifdef CONFIG_TIMER_PRECISE
+void LPTIMER0_IRQHandler(void)
+{
+    RtcOnPreciseIrq();
+}
+#endif
@@ -15,6 +15,10 @@ extern "C" {
 
 #define CONFIG_LWAN_KEYS_FLASH_ADDR        (0x0801F000)
 #define CONFIG_LWAN_SETTINGS_FLASH_ADDR    (0x0801E000)
+#define CONFIG_LWAN_FCNT_FLASH_ADDR        (0x0801C000)
+#define CONFIG_LWAN_FCNT_FLASH_PAGES       2
+#define CONFIG_LWAN_KV_FLASH_ADDR          (0x0801A000)
+#define CONFIG_LWAN_KV_FLASH_PAGES         2
 
 #define CONFIG_MANUFACTURER "ASR"
 #define CONFIG_DEVICE_MODEL "6601"
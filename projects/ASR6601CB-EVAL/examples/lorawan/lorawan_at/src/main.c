@@ -10,7 +10,52 @@
 #include "tremo_rcc.h"
 #include "tremo_delay.h"
 #include "tremo_pwr.h"
+#include "tremo_system.h"
 #include "rtc-board.h"
+#ifdef CONFIG_WARM_BOOT
+#include "warm-boot.h"
+#endif
+#ifdef CONFIG_CLOCK_GOVERNOR
+#include "clock-governor.h"
+#endif
+#if defined(CONFIG_ITM_TRACE) || defined(CONFIG_ITM_TRACE_LOG)
+#include "itm-trace.h"
+#endif
+#ifdef CONFIG_CRASH_DUMP
+#include "crash-dump.h"
+#endif
+#ifdef CONFIG_PULSE_COUNTER
+#ifdef CONFIG_TIMER_PRECISE
+#error "CONFIG_PULSE_COUNTER counts on LPTIMER0, taken by CONFIG_TIMER_PRECISE"
+#endif
+#include "pulse-counter.h"
+#ifndef PULSE_COUNTER_REPORT_INTERVAL
+#define PULSE_COUNTER_REPORT_INTERVAL 900000
+#endif
+#ifndef PULSE_COUNTER_THRESHOLD_PULSES
+#define PULSE_COUNTER_THRESHOLD_PULSES 1000
+#endif
+#endif
+#ifdef CONFIG_ADC_SCAN
+#include "tremo_adc_scan.h"
+#ifndef BOARD_VBAT_ADC_CHAN
+#error "CONFIG_ADC_SCAN needs BOARD_VBAT_ADC_CHAN, the ADC channel VBAT/3 is routed to"
+#endif
+#ifndef BOARD_ADC_SCAN_PERIOD
+#define BOARD_ADC_SCAN_PERIOD 600000
+#endif
+#ifndef BOARD_BATTERY_EMPTY_MV
+#define BOARD_BATTERY_EMPTY_MV 2000
+#endif
+#ifndef BOARD_BATTERY_FULL_MV
+#define BOARD_BATTERY_FULL_MV 3300
+#endif
+#if defined(BOARD_TEMP_ADC_CHAN) && (!defined(BOARD_TEMP_MV_25C) || !defined(BOARD_TEMP_UV_PER_C))
+#error "BOARD_TEMP_ADC_CHAN needs BOARD_TEMP_MV_25C and BOARD_TEMP_UV_PER_C, the sensor voltage at 25 C and its slope"
+#endif
+#elif defined(BOARD_TEMP_ADC_CHAN)
+#error "BOARD_TEMP_ADC_CHAN needs CONFIG_ADC_SCAN"
+#endif
 #include "linkwan_ica_at.h"
 #include "linkwan.h"
 #include "lwan_config.h"
@@ -22,10 +67,101 @@ void LoraRxData(lora_AppData_t* AppData);
 uint8_t BoardGetBatteryLevel();
 void BoardGetUniqueId(uint8_t* id);
 uint32_t BoardGetRandomSeed();
+#ifdef BOARD_TEMP_ADC_CHAN
+float BoardGetTemperatureLevel();
+#endif
 
 log_level_t g_log_level = LL_ERR | LL_WARN | LL_DEBUG;
 static LoRaMainCallback_t LoRaMainCallbacks
-    = { BoardGetBatteryLevel, BoardGetUniqueId, BoardGetRandomSeed, LoraTxData, LoraRxData };
+    = { BoardGetBatteryLevel, BoardGetUniqueId, BoardGetRandomSeed, LoraTxData, LoraRxData,
+#ifdef BOARD_TEMP_ADC_CHAN
+        BoardGetTemperatureLevel,
+#endif
+      };
+
+#ifdef CONFIG_ADC_SCAN
+enum {
+    BOARD_ADC_VBAT,
+#ifdef BOARD_TEMP_ADC_CHAN
+    BOARD_ADC_TEMP,
+#endif
+    BOARD_ADC_USER, // first of BOARD_ADC_USER_CHANS
+};
+
+// Battery in mV, temperature in 0.01 C from the sensor voltage at 25 C and
+// its slope, then the application channels
+static const adc_scan_chan_t board_adc_chans[] = {
+    { BOARD_VBAT_ADC_CHAN, true, 3 * ADC_SCAN_UNITY, 0 },
+#ifdef BOARD_TEMP_ADC_CHAN
+    { BOARD_TEMP_ADC_CHAN, false, (int32_t)(100000LL * ADC_SCAN_UNITY / BOARD_TEMP_UV_PER_C),
+      2500 - (int32_t)(100000LL * BOARD_TEMP_MV_25C / BOARD_TEMP_UV_PER_C) },
+#endif
+#ifdef BOARD_ADC_USER_CHANS
+    BOARD_ADC_USER_CHANS
+#endif
+};
+
+static adc_scan_t board_adc_scan;
+static TimerEvent_t board_adc_timer;
+
+static void board_adc_scan_done(adc_scan_t* scan, bool success)
+{
+    BlockLowPowerDuringTask(false);
+}
+
+static void board_adc_scan_start(void)
+{
+    // The ADC clock stops in the STOP modes, the scan ends within the sleep
+    if (adc_scan_start(&board_adc_scan, TimerGetCurrentTime()) == ERRNO_OK) {
+        BlockLowPowerDuringTask(true);
+    }
+}
+
+static void on_board_adc_timer(void)
+{
+    board_adc_scan_start();
+    TimerStart(&board_adc_timer);
+}
+
+static void board_adc_init(void)
+{
+    rcc_set_adc_clk_source(RCC_ADC_CLK_SOURCE_RCO48M);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_ADC, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_SYSCFG, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_DMA0, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_DMA1, true);
+    adc_init();
+    adc_config_clock_division(20);
+
+    if (adc_scan_init(&board_adc_scan, board_adc_chans, sizeof(board_adc_chans) / sizeof(board_adc_chans[0]), false) != ERRNO_OK) {
+        return;
+    }
+    board_adc_scan.done = board_adc_scan_done;
+    TimerInit(&board_adc_timer, on_board_adc_timer);
+    TimerSetValue(&board_adc_timer, BOARD_ADC_SCAN_PERIOD);
+    TimerStart(&board_adc_timer);
+    board_adc_scan_start();
+}
+#endif
+
+#ifdef RUN_IN_RAM
+// The exceptions taken while the flash is erased or programmed fetch their
+// vector from this copy, the handlers in .ram_funcs then keep running
+#define VECTOR_NUM (16 + IWDG_IRQn + 1)
+static uint32_t ram_vectors[VECTOR_NUM] __attribute__((aligned(256)));
+
+static void vector_table_to_ram(void)
+{
+    memcpy(ram_vectors, (void*)SCB->VTOR, sizeof(ram_vectors));
+    __DSB();
+    SCB->VTOR = (uint32_t)ram_vectors;
+    __DSB();
+}
+#endif
+
+#ifdef CONFIG_CLOCK_GOVERNOR
+static uint32_t uart_log_baudrate;
+#endif
 
 void uart_log_init(uint32_t baudrate)
 {
@@ -52,7 +188,11 @@ void uart_log_init(uint32_t baudrate)
     lpuart_config_tx(LPUART, false);
     lpuart_config_rx(LPUART, true);
 
+#ifdef CONFIG_IRQ_PRIORITY_PLAN
+    NVIC_SetPriority(LPUART_IRQn, configLIBRARY_UART_INTERRUPT_PRIORITY);
+#else
     NVIC_SetPriority(LPUART_IRQn, 2);
+#endif
     NVIC_EnableIRQ(LPUART_IRQn);
 
     // uart init
@@ -62,11 +202,48 @@ void uart_log_init(uint32_t baudrate)
     uart_config.baudrate = baudrate;
     uart_init(CONFIG_DEBUG_UART, &uart_config);
 
+    uart_cmd(CONFIG_DEBUG_UART, ENABLE);
+#ifdef CONFIG_CLOCK_GOVERNOR
+    uart_log_baudrate = baudrate;
+#endif
+}
+
+#ifdef CONFIG_CLOCK_GOVERNOR
+extern bool print_isdone(void);
+
+static bool uart_log_clock_can_change(uint32_t hclk, uint32_t pclk0, uint32_t pclk1)
+{
+    // UART0 runs from PCLK0, a log being sent would be garbled
+    return print_isdone() && (pclk0 >= 16 * uart_log_baudrate);
+}
+
+static void uart_log_clock_changed(uint32_t hclk, uint32_t pclk0, uint32_t pclk1)
+{
+    uart_config_t uart_config;
+
+    uart_config_init(&uart_config);
+    uart_config.fifo_mode = ENABLE;
+    uart_config.mode     = UART_MODE_TX;
+    uart_config.baudrate = uart_log_baudrate;
+    uart_init(CONFIG_DEBUG_UART, &uart_config);
+
     uart_cmd(CONFIG_DEBUG_UART, ENABLE);
 }
 
+static ClockNotifier_t uart_log_clock_notifier = { uart_log_clock_can_change, uart_log_clock_changed, NULL };
+#endif
+
 void board_init()
 {
+#ifdef CONFIG_WARM_BOOT
+    WarmBootInit();
+#endif
+#ifdef CONFIG_CRASH_DUMP
+    CrashDumpInit();
+#endif
+#ifdef RUN_IN_RAM
+    vector_table_to_ram();
+#endif
     rcc_enable_oscillator(RCC_OSC_XO32K, true);
 
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_GPIOA, true);
@@ -84,10 +261,25 @@ void board_init()
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_DMA0, true);
     #endif
 
+#ifdef CONFIG_WARM_BOOT
+    // Returns at once when the crystal kept running across the reset
+    RtcWaitXo32kStable(100);
+#else
     delay_ms(100);
+#endif
     pwr_xo32k_lpm_cmd(true);
 
     RtcInit();
+#ifdef CONFIG_CLOCK_GOVERNOR
+    ClockInit();
+#endif
+#ifdef CONFIG_PULSE_COUNTER
+    gpio_set_iomux(GPIOD, GPIO_PIN_10, 2); // LPTIMER0 IN1:GP58
+    PulseCounterInit(LPTIMER0, LPTIMER_CKPOL_RISING, PULSE_COUNTER_REPORT_INTERVAL, PULSE_COUNTER_THRESHOLD_PULSES);
+#endif
+#ifdef CONFIG_ADC_SCAN
+    board_adc_init();
+#endif
 }
 
 void* _sbrk(int nbytes)
@@ -109,16 +301,47 @@ void* _sbrk(int nbytes)
 
 uint8_t BoardGetBatteryLevel()
 {
+#ifdef CONFIG_ADC_SCAN
+    int32_t mv;
+
+    // DevStatusAns level, 1 to 254 from the last scan, 255 before it
+    if (!adc_scan_get(&board_adc_scan, BOARD_ADC_VBAT, &mv, NULL)) {
+        return 255;
+    }
+    if (mv <= BOARD_BATTERY_EMPTY_MV) {
+        return 1;
+    }
+    if (mv >= BOARD_BATTERY_FULL_MV) {
+        return 254;
+    }
+    return 1 + (mv - BOARD_BATTERY_EMPTY_MV) * 253 / (BOARD_BATTERY_FULL_MV - BOARD_BATTERY_EMPTY_MV);
+#else
     return 0;
+#endif
 }
 
+#ifdef BOARD_TEMP_ADC_CHAN
+float BoardGetTemperatureLevel()
+{
+    int32_t temp;
+
+    if (!adc_scan_get(&board_adc_scan, BOARD_ADC_TEMP, &temp, NULL)) {
+        return 25.0f;
+    }
+    return temp / 100.0f;
+}
+#endif
+
 void BoardGetUniqueId(uint8_t* id)
 {
 }
 
 uint32_t BoardGetRandomSeed()
 {
-    return 0;
+    uint32_t id[2];
+
+    system_get_chip_id(id);
+    return id[0] ^ id[1];
 }
 
 void LoraTxData(lora_AppData_t* AppData)
@@ -132,25 +355,28 @@ void LoraRxData(lora_AppData_t* AppData)
 {
     AppData->Buff[AppData->BuffSize] = '\0';
     LOG_PRINTF(LL_DEBUG, "rx: port = %d, len = %d\r\n", AppData->Port, AppData->BuffSize);
-    int i;
-    for (i = 0; i < AppData->BuffSize; i++) {
-        LOG_PRINTF(LL_DEBUG, "0x%x ", AppData->Buff[i]);
-    }
+    LOG_HEX(LL_DEBUG, AppData->Buff, AppData->BuffSize);
     LOG_PRINTF(LL_DEBUG, "\r\n");
 }
 
 int main(void)
 {
-    LWanSysConfig_t default_sys_config = LWAN_SYS_CONFIG_DEFAULT;
+    static const LWanSysConfig_t default_sys_config = LWAN_SYS_CONFIG_DEFAULT;
     uint32_t baudrate;
     uint16_t log_level;
 
     // Target board initialization
     board_init();
+#if defined(CONFIG_ITM_TRACE) || defined(CONFIG_ITM_TRACE_LOG)
+    ItmTraceInit();
+#endif
 
     lwan_sys_config_init(&default_sys_config);
     lwan_sys_config_get(SYS_CONFIG_BAUDRATE, &baudrate);
     uart_log_init(baudrate);
+#ifdef CONFIG_CLOCK_GOVERNOR
+    ClockAddNotifier(&uart_log_clock_notifier);
+#endif
 
     lwan_sys_config_get(SYS_CONFIG_LOGLVL, &log_level);
     log_set_level((1<<log_level)-1);
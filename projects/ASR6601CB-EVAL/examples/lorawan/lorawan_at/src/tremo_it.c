@@ -1,11 +1,23 @@
 #include "tremo_lpuart.h"
 #include "tremo_it.h"
+#ifdef CONFIG_CRASH_DUMP
+#include "crash-dump.h"
+#endif
 
 extern void RadioOnDioIrq(void);
 extern void RtcOnIrq(void);
+#ifdef CONFIG_TIMER_PRECISE
+extern void RtcOnPreciseIrq(void);
+#endif
+#ifdef CONFIG_PULSE_COUNTER
+extern void PulseCounterIrqHandler(void);
+#endif
 extern void linkwan_serial_input(uint8_t cmd);
 extern void dma0_IRQHandler(void);
 extern void dma1_IRQHandler(void);
+#ifdef CONFIG_TIMER_DEFER
+extern void TimerDeferredProcess(void);
+#endif
 /**
  * @brief  This function handles NMI exception.
  * @param  None
@@ -20,12 +32,32 @@ void NMI_Handler(void)
  * @param  None
  * @retval None
  */
+#ifdef CONFIG_CRASH_DUMP
+__attribute__((naked)) void HardFault_Handler(void)
+{
+    /* Record the fault, then reset */
+    CRASH_DUMP_ENTRY(CRASH_DUMP_HARD_FAULT);
+}
+
+#ifdef CONFIG_WATCHDOG
+/**
+ * @brief  This function handles the IWDG interrupt, ahead of its reset.
+ * @param  None
+ * @retval None
+ */
+__attribute__((naked)) void IWDG_IRQHandler(void)
+{
+    CRASH_DUMP_ENTRY(CRASH_DUMP_WATCHDOG);
+}
+#endif
+#else
 void HardFault_Handler(void)
 {
 
     /* Go to infinite loop when Hard Fault exception occurs */
     while (1) { }
 }
+#endif
 
 /**
  * @brief  This function handles Memory Manage exception.
@@ -76,6 +108,9 @@ void SVC_Handler(void)
  */
 void PendSV_Handler(void)
 {
+#ifdef CONFIG_TIMER_DEFER
+    TimerDeferredProcess();
+#endif
 }
 
 /**
@@ -108,7 +143,7 @@ void PWR_IRQHandler()
  * @param  None
  * @retval None
  */
-void LORA_IRQHandler()
+HOT_FUNC_ATTR void LORA_IRQHandler()
 {
     RadioOnDioIrq();
 }
@@ -118,11 +153,23 @@ void RTC_IRQHandler(void)
     RtcOnIrq();
 }
 
+#ifdef CONFIG_TIMER_PRECISE
+void LPTIMER0_IRQHandler(void)
+{
+    RtcOnPreciseIrq();
+}
+#elif defined(CONFIG_PULSE_COUNTER)
+void LPTIMER0_IRQHandler(void)
+{
+    PulseCounterIrqHandler();
+}
+#endif
+
 void UART0_IRQHandler(void)
 {
 }
 
-void LPUART_IRQHandler(void)
+HOT_FUNC_ATTR void LPUART_IRQHandler(void)
 {
     if (lpuart_get_rx_status(LPUART, LPUART_SR0_RX_DONE_STATE)) {
         uint8_t rx_data_temp = lpuart_receive_data(LPUART);
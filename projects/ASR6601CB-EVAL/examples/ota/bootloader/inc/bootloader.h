@@ -50,6 +50,17 @@
 #define BOOTLOADER_CMD_RDREG       15
 #define BOOTLOADER_CMD_BAUDRATE    16
 #define BOOTLOADER_CMD_VERSION     17
+#define BOOTLOADER_CMD_WDATA       18
+#define BOOTLOADER_CMD_WACK        19
+#define BOOTLOADER_CMD_FRAG_SETUP  20
+#define BOOTLOADER_CMD_FRAG        21
+#define BOOTLOADER_CMD_FRAG_STATUS 22
+#define BOOTLOADER_CMD_STREAM_BEGIN 23
+#define BOOTLOADER_CMD_STREAM      24
+#define BOOTLOADER_CMD_STREAM_END  25
+#define BOOTLOADER_CMD_COPY        26
+#define BOOTLOADER_CMD_SLOT_COMMIT 27
+#define BOOTLOADER_CMD_BULK        28
 
 
 #define BOOTLOADER_SYMBOL_CMD_START 0xFE
@@ -73,6 +84,195 @@
 
 #define RES_UNSENT                      0
 #define RES_SENT                        1
+#define RES_NONE                        2   //no response, e.g. window data
+
+/*
+ * Windowed transfer: the host sends up to BOOTLOADER_WINDOW_MAX WDATA frames
+ * back to back, none is answered. Their data is
+ *   addr(4) size(4) window(1) slot(1) reserved(2) image data(size)
+ * and each one is programmed on reception. The host then sends WACK with its
+ * window number as data, answered with window(1) and the little endian
+ * bitmap(4) of the slots programmed. It resends the missing slots only and
+ * asks again, then moves on with the next window number, which resets the
+ * bitmap. A slot received twice is not programmed again.
+ */
+#define BOOTLOADER_WINDOW_MAX           32
+#define BOOTLOADER_WDATA_HDR_SIZE       12
+
+/*
+ * Broadcast transfer, LoRaWAN fragmentation style, heard by all the devices
+ * at once. FRAG_SETUP with
+ *   addr(4) size(4) crc(4) nb_frag(2) frag_size(1) session(1)
+ * erases the image area. FRAG frames carry session(1) reserved(1) index(2)
+ * and frag_size bytes: an index below nb_frag is a data fragment, the next
+ * ones are the parity fragments 1, 2..., the XOR of the data fragments of
+ * their parity matrix row. A device rebuilds the fragments it lost from
+ * the parity ones. Neither frame is answered. FRAG_STATUS with session(1)
+ * and the chip id(8) is answered by that device only with
+ *   session(1) state(1) missing(2) first missing indexes(2 each)
+ */
+#define BOOTLOADER_FRAG_STATE_RUNNING   0
+#define BOOTLOADER_FRAG_STATE_DONE      1   //image complete, its CRC checked
+#define BOOTLOADER_FRAG_STATE_ERR_CRC   2
+#define BOOTLOADER_FRAG_STATE_IDLE      3   //no session
+#define BOOTLOADER_FRAG_STATE_ERR_FLASH 4
+
+#define BOOTLOADER_FRAG_HDR_SIZE        4
+#define BOOTLOADER_FRAG_MAX             1024
+#define BOOTLOADER_FRAG_SIZE_MAX        232 //multiple of 8, one frame in a LoRa packet
+#define BOOTLOADER_FRAG_LOST_MAX        32  //lost fragments the parity rows can cover
+#define BOOTLOADER_FRAG_ROWS            12  //parity rows kept until they are solved
+#define BOOTLOADER_FRAG_MISSING_REPORT  32
+
+/*
+ * Compressed and delta images, packed by build/scripts/tremo_pack.py.
+ * STREAM_BEGIN with addr(4) size(4) src(4) src_size(4) starts decoding into
+ * the page aligned area at addr, erased as the output reaches it, src being
+ * the installed image the delta tokens copy from (src_size 0 without one). STREAM frames carry the stream
+ * offset(4) and the stream bytes, answered with the stream position(4).
+ * STREAM_END with the image crc(4) checks it. COPY with dst(4) src(4)
+ * size(4) then moves the image decoded to the application area. Tokens:
+ *   0x00-0x7F              literal run of (t+1) bytes following
+ *   0x80-0xBF d(2)         (t&0x3F)+3 bytes from d bytes back in the output
+ *   0xC0-0xFF l(1) o(3)    ((t&0x3F)<<8|l)+1 bytes from the offset o of src
+ */
+#define BOOTLOADER_STREAM_TOK_MAX       5
+
+#define BOOT_ERASE_ALL                  0xFFFFFFFF
+
+/*
+ * Bulk transfer, a technician next to the device: BULK with mode(1), 1 for
+ * the GFSK profile below and 0 for LoRa, is answered with the current
+ * modem, which is then switched. The host switches the dongle along
+ * (AT+BULK), and the WDATA windows and the other commands run the same
+ * way at about ten times the rate of LoRa SF7 at 500 kHz. The frames stay
+ * within the 255 byte radio buffer. With no frame for BOOT_BULK_IDLE_MS,
+ * the bootloader goes back to LoRa on its own.
+ */
+#define BOOT_BULK_FSK_DR                250000  //bps
+#define BOOT_BULK_FSK_DEV               62500   //Hz, modulation index 0.5
+#define BOOT_BULK_FSK_BW                400000  //Hz, the 467 kHz filter
+#define BOOT_BULK_FSK_PREAMBLE          8       //bytes
+#ifndef BOOT_BULK_IDLE_MS
+#define BOOT_BULK_IDLE_MS               10000
+#endif
+
+/*
+ * A/B slots, for the 128KB flash of cfg/gcc.ld: boot, slot A the
+ * application runs from, slot B the new image is downloaded to (plain, or
+ * decoded there by STREAM from a compressed or delta stream against A),
+ * the scratch page and the state page. The application data pages must
+ * stay out of these areas.
+ * SLOT_COMMIT with version(4) size(4) crc(4) checks the image in B and
+ * logs it pending. At the next boot A and B are swapped page by page
+ * through the scratch page, each step logged so that a reset resumes the
+ * swap, and the new image boots on trial with the IWDG running. The
+ * application reloads the IWDG and, once it runs fine, appends a CONFIRM
+ * record copied from the TRIAL one at the first free record of the state
+ * page with flash_program_bytes. A trial image reset by the IWDG or booted
+ * BOOT_TRIAL_MAX times unconfirmed is swapped back with the previous one,
+ * which stays in B.
+ * With CONFIG_BOOT_SIGNED, SLOT_COMMIT also carries the ECDSA P-256
+ * signature r(32) s(32), little endian, of the SHA-256 of the image, made
+ * by build/scripts/tremo_sign.py sign. The check runs in steps between the
+ * radio events and SLOT_COMMIT is answered at its end, the frames received
+ * meanwhile waiting. The FLASH and STREAM data programmed in a row from the
+ * start of B are hashed on reception, the image is then not read back. The public key table is inc/boot_key.h, made by
+ * build/scripts/tremo_sign.py keygen.
+ */
+#ifndef BOOT_SLOT_A_ADDR
+#define BOOT_SLOT_A_ADDR                APP_START_ADDR
+#endif
+#ifndef BOOT_SLOT_PAGES
+#define BOOT_SLOT_PAGES                 8   //32KB per slot
+#endif
+#define BOOT_SLOT_SIZE                  (BOOT_SLOT_PAGES * FLASH_PAGE_SIZE)
+#ifndef BOOT_SLOT_B_ADDR
+#define BOOT_SLOT_B_ADDR                (BOOT_SLOT_A_ADDR + BOOT_SLOT_SIZE)
+#endif
+#ifndef BOOT_SCRATCH_ADDR
+#define BOOT_SCRATCH_ADDR               (BOOT_SLOT_B_ADDR + BOOT_SLOT_SIZE)
+#endif
+#ifndef BOOT_STATE_ADDR
+#define BOOT_STATE_ADDR                 (BOOT_SCRATCH_ADDR + FLASH_PAGE_SIZE)
+#endif
+#ifndef BOOT_TRIAL_MAX
+#define BOOT_TRIAL_MAX                  3
+#endif
+#ifndef BOOT_TRIAL_IWDG_RELOAD
+#define BOOT_TRIAL_IWDG_RELOAD          0x3FF   //8s with the 256 prescaler
+#endif
+
+#ifdef CONFIG_BOOT_SIGNED
+#define BOOT_COMMIT_SIZE                (3*sizeof(uint32_t) + 64)
+#else
+#define BOOT_COMMIT_SIZE                (3*sizeof(uint32_t))
+#endif
+
+#define BOOT_REC_PENDING                1   //new image in B
+#define BOOT_REC_SWAP                   2   //page, step done, of the swap to the new image
+#define BOOT_REC_TRIAL                  3   //new image in A, step boots so far
+#define BOOT_REC_CONFIRM                4   //image in A confirmed
+#define BOOT_REC_REVERT                 5   //swap back to the confirmed image
+#define BOOT_REC_UNSWAP                 6   //page, step done, of the swap back
+
+//state page log record, valid once written in full
+typedef struct _boot_rec{
+    uint8_t type;
+    uint8_t step;
+    uint16_t page;
+    uint32_t version;
+    uint32_t size;
+    uint32_t crc;
+}boot_rec_t;
+
+#define BOOT_STATE_RECS                 (FLASH_PAGE_SIZE / sizeof(boot_rec_t))
+
+/*
+ * Image manifest of the application at APP_START_ADDR, in the last page of
+ * the bootloader area (see cfg/gcc.ld). It records the size, CRC and
+ * version of the image and the CRC of its first BOOT_HEAD_SIZE bytes, the
+ * vector table and the code following. It is written once the image was
+ * checked in full: VERIFY of APP_START_ADDR, with the version(4) after the
+ * crc optionally, STREAM_END, COPY, a broadcast transfer done or an A/B
+ * activation. ERASE, FLASH and the other writes over the image drop it.
+ * A normal boot checks the record and the head CRC only and jumps. The
+ * whole image is checked again when the record was cut short by a reset,
+ * the head does not match, or after BOOT_FAULT_MAX watchdog resets, each
+ * logged after the record, the check clearing them. An image failing it
+ * keeps the bootloader waiting for commands. Without a record, an image
+ * loaded by other means, the application is booted unless it is blank.
+ */
+#ifndef BOOT_MANIFEST_ADDR
+#define BOOT_MANIFEST_ADDR              (APP_START_ADDR - FLASH_PAGE_SIZE)
+#endif
+#ifndef BOOT_HEAD_SIZE
+#define BOOT_HEAD_SIZE                  512
+#endif
+#ifndef BOOT_FAULT_MAX
+#define BOOT_FAULT_MAX                  3
+#endif
+#define BOOT_MANIFEST_MAGIC             0x464E4D42  //"BMNF"
+#define BOOT_MANIFEST_VERIFIED          0x4B4F4B4F
+
+//manifest record, the verified word programmed last
+typedef struct _boot_manifest{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t crc;
+    uint32_t head_crc;
+    uint32_t rec_crc;       //of the fields above
+    uint32_t verified;
+    uint32_t reserved;
+}boot_manifest_t;
+
+//watchdog resets logged after the record, a double word each
+#define BOOT_FAULT_RECS                 ((FLASH_PAGE_SIZE - sizeof(boot_manifest_t)) / 8)
+
+//frames received while the previous ones are processed
+#define BOOT_RX_SLOT_NUM                4
+#define BOOT_RX_SLOT_SIZE               255
 
 typedef struct _loader_req{
     uint8_t cmd;
@@ -89,5 +289,7 @@ typedef struct _loader_res{
 
 void boot_to_app(uint32_t addr);
 void boot_handle_cmd(void);
+void boot_slot_process(void);
+int boot_app_check(void);
 
 #endif //__BOOTLOADER_H_
\ No newline at end of file
@@ -1,12 +1,21 @@
 #include <string.h>
+#include <stddef.h>
 #include <stdio.h>
 #include "system_cm4.h"
 #include "bootloader.h"
 #include "tremo_flash.h"
 #include "tremo_crc.h"
 #include "tremo_delay.h"
+#include "delay.h"
 #include "tremo_system.h"
+#include "tremo_rcc.h"
+#include "tremo_iwdg.h"
 #include "radio.h"
+#include "timer.h"
+#ifdef CONFIG_BOOT_SIGNED
+#include "ecdsa-job.h"
+#include "boot_key.h"   //made by build/scripts/tremo_sign.py keygen
+#endif
 
 
 #define RF_FREQUENCY                    470000000
@@ -44,6 +53,9 @@ static uint32_t g_fsk_dev = 25000;
 static uint32_t g_fsk_preamble = 5;
 static uint32_t g_fsk_afcbw = 166666;
 static volatile int g_tx_done = 0;
+//modem of the BULK command, switched once its answer is sent
+static uint32_t g_modem_next = MODEM_LORA;
+static uint32_t g_bulk_last_rx = 0;
 
 /**************************functions declaration**************************/
 int sync_cmd_func(volatile loader_req_t *req, loader_res_t *res);
@@ -53,6 +65,18 @@ int erase_cmd_func(volatile loader_req_t *req, loader_res_t *res);
 int verify_cmd_func(volatile loader_req_t *req, loader_res_t *res);
 int reboot_cmd_func(volatile loader_req_t *req, loader_res_t *res);
 int rdsn_cmd_func(volatile loader_req_t *req, loader_res_t *res);
+int wdata_cmd_func(volatile loader_req_t *req, loader_res_t *res);
+int wack_cmd_func(volatile loader_req_t *req, loader_res_t *res);
+int frag_setup_cmd_func(volatile loader_req_t *req, loader_res_t *res);
+int frag_cmd_func(volatile loader_req_t *req, loader_res_t *res);
+int frag_status_cmd_func(volatile loader_req_t *req, loader_res_t *res);
+int stream_begin_cmd_func(volatile loader_req_t *req, loader_res_t *res);
+int stream_cmd_func(volatile loader_req_t *req, loader_res_t *res);
+int stream_end_cmd_func(volatile loader_req_t *req, loader_res_t *res);
+int copy_cmd_func(volatile loader_req_t *req, loader_res_t *res);
+int slot_commit_cmd_func(volatile loader_req_t *req, loader_res_t *res);
+int bulk_cmd_func(volatile loader_req_t *req, loader_res_t *res);
+static void stream_abort(void);
 
 void lora_init();
 void lora_tx(uint8_t *data, uint32_t size);
@@ -75,6 +99,17 @@ static const cmd_entry boot_cmd_table[] =
     {BOOTLOADER_CMD_VERIFY,(void *)verify_cmd_func},
     {BOOTLOADER_CMD_REBOOT,(void *)reboot_cmd_func},
     {BOOTLOADER_CMD_SN,(void *)rdsn_cmd_func},
+    {BOOTLOADER_CMD_WDATA,(void *)wdata_cmd_func},
+    {BOOTLOADER_CMD_WACK,(void *)wack_cmd_func},
+    {BOOTLOADER_CMD_FRAG_SETUP,(void *)frag_setup_cmd_func},
+    {BOOTLOADER_CMD_FRAG,(void *)frag_cmd_func},
+    {BOOTLOADER_CMD_FRAG_STATUS,(void *)frag_status_cmd_func},
+    {BOOTLOADER_CMD_STREAM_BEGIN,(void *)stream_begin_cmd_func},
+    {BOOTLOADER_CMD_STREAM,(void *)stream_cmd_func},
+    {BOOTLOADER_CMD_STREAM_END,(void *)stream_end_cmd_func},
+    {BOOTLOADER_CMD_COPY,(void *)copy_cmd_func},
+    {BOOTLOADER_CMD_SLOT_COMMIT,(void *)slot_commit_cmd_func},
+    {BOOTLOADER_CMD_BULK,(void *)bulk_cmd_func},
 }; 
 
 #define BOOT_CMD_TABLE_SIZE (sizeof(boot_cmd_table) / sizeof(boot_cmd_table[0]))
@@ -84,8 +119,47 @@ loader_req_t g_request;
 loader_res_t g_response;
 
 
+//window of the windowed transfer and the slots programmed
+static uint8_t g_window = 0;
+static uint32_t g_window_bitmap = 0;
+
+//FLASH and STREAM data, programmed by word lines
+static flash_writer_t g_writer;
+static uint8_t g_writer_open = 0;
+
+//CRC of the FLASH data programmed from g_image_addr on, VERIFY of that area
+//is answered without reading it back
+static crc_ctx_t g_image_crc;
+static uint32_t g_image_addr = 0;
+static uint32_t g_image_len = 0;
+
+#ifdef CONFIG_BOOT_SIGNED
+//SHA-256 of the data programmed from g_digest_addr on by FLASH or STREAM,
+//SLOT_COMMIT checks the signature without hashing the image again. The SHA
+//engine keeps the state, fed by whole blocks
+static SHA256Context g_digest_ctx;
+static uint32_t g_digest_addr = 0;
+static uint32_t g_digest_len = 0;
+static uint8_t g_digest_block[64];
+#endif
+
+//pages of the last ERASE left, erased in the background between the frames
+static uint32_t g_erase_next = 0;
+static uint32_t g_erase_end = 0;
+static uint8_t g_erase_err = 0;
+
 /**port functions**/
-char boot_buf[BOOTLOADER_MAX_CMD_SIZE];
+typedef struct _boot_rx_slot{
+    uint8_t data[BOOT_RX_SLOT_SIZE];
+    uint16_t len;
+}boot_rx_slot_t;
+
+//filled by OnRxDone, a frame stays in its slot until it is processed
+static boot_rx_slot_t boot_rx_slots[BOOT_RX_SLOT_NUM];
+static volatile uint8_t boot_rx_head = 0;
+static volatile uint8_t boot_rx_tail = 0;
+
+uint8_t *boot_buf = boot_rx_slots[0].data;
 volatile uint16_t boot_wr_idx = 0;
 volatile uint16_t boot_rd_idx = 0;
 
@@ -107,7 +181,7 @@ uint16_t boot_buffer_len()
 
 void boot_buffer_write_byte(uint8_t byte)
 {   
-    if(boot_wr_idx < BOOTLOADER_MAX_CMD_SIZE)
+    if(boot_wr_idx < BOOT_RX_SLOT_SIZE)
         boot_buf[boot_wr_idx++] = byte;
 }
 
@@ -128,26 +202,57 @@ void boot_buffer_read_bytes(uint8_t *data, uint16_t size)
     }
 }
 
+//makes the oldest frame received the boot buffer, 0 when none is waiting
+int boot_rx_next()
+{
+    boot_rx_slot_t *slot;
+
+    if(boot_rx_tail == boot_rx_head)
+        return 0;
+
+    slot = &boot_rx_slots[boot_rx_tail % BOOT_RX_SLOT_NUM];
+    boot_buf = slot->data;
+    boot_wr_idx = slot->len;
+    boot_rd_idx = 0;
+    return 1;
+}
+
+//frees the slot of the boot buffer
+void boot_rx_release()
+{
+    boot_rx_tail++;
+    boot_buffer_clear();
+}
+
+//drops the frames waiting
+void boot_rx_flush()
+{
+    boot_rx_tail = boot_rx_head;
+    boot_buffer_clear();
+}
 
 /**************************functions**************************************/
-uint32_t crc32(uint8_t *data, uint32_t size)
+//CRC-32, fed by words
+static void crc32_init(crc_ctx_t *ctx)
 {
-    uint32_t crc_value = 0;
-    
-    //CRC-32
     crc_config_t config;
     config.init_value = 0xFFFFFFFF;
     config.poly_size = CRC_POLY_SIZE_32;
     config.poly = 0x04C11DB7;
-    config.reverse_in = CRC_CR_REVERSE_IN_BYTE;
+    config.reverse_in = CRC_REVERSE_IN_BYTE;
     config.reverse_out = true;
     
-    crc_init(&config);
-    
-    crc_value = crc_calc8(data, size);
-    crc_value ^= 0xFFFFFFFF;
+    crc_ctx_init(ctx, &config);
+}
 
-	return crc_value;
+uint32_t crc32(uint8_t *data, uint32_t size)
+{
+    crc_ctx_t ctx;
+
+    crc32_init(&ctx);
+    crc_ctx_update(&ctx, data, size);
+
+	return crc_ctx_value(&ctx) ^ 0xFFFFFFFF;
 }
 
 int get_request_from_lora(loader_req_t *req)
@@ -208,14 +313,230 @@ void send_response_to_lora(loader_res_t *res)
     *(uint32_t *)(g_bootloader_cmd+4+res->data_len) = crc32_value;
     g_bootloader_cmd[res->data_len+BOOTLOADER_MIN_CMD_SIZE-1] = BOOTLOADER_SYMBOL_CMD_END;
     
-	delay_ms(5);
+	DelayMs(5);
 	lora_tx(g_bootloader_cmd, res->data_len+BOOTLOADER_MIN_CMD_SIZE);	
 }
 
+//starts the erase of the next page left when the flash is free
+void boot_erase_poll(void)
+{
+    if(g_erase_next >= g_erase_end || flash_erase_busy())
+        return;
+
+    if(flash_erase_page_start(g_erase_next) != 0){
+        g_erase_err = 1;
+        g_erase_end = g_erase_next;
+        return;
+    }
+    g_erase_next += FLASH_PAGE_SIZE;
+}
+
+//erases the pages left below end, 0 when all the erases went well
+int boot_erase_sync(uint32_t end)
+{
+    while(g_erase_next < g_erase_end && g_erase_next < end){
+        FLASH_OP_BEGIN();
+        if(flash_erase_page(g_erase_next)<0){
+            g_erase_err = 1;
+            g_erase_end = g_erase_next;
+        }
+        FLASH_OP_END();
+        g_erase_next += FLASH_PAGE_SIZE;
+    }
+    while(flash_erase_busy());
+
+    return g_erase_err ? -1 : 0;
+}
+
+int boot_writer_flush(void)
+{
+    int ret = 0;
+
+    if(g_writer_open){
+        FLASH_OP_BEGIN();
+        ret = flash_writer_flush(&g_writer);
+        FLASH_OP_END();
+        g_writer_open = 0;
+    }
+
+    return ret;
+}
+
+int boot_writer_write(const uint8_t *data, uint32_t size)
+{
+    int ret;
+
+    FLASH_OP_BEGIN();
+    ret = flash_writer_write(&g_writer, data, size);
+    FLASH_OP_END();
+
+    return ret;
+}
+
+//the image CRC and digest no longer match the flash
+static void boot_image_forget(void)
+{
+    g_image_len = 0;
+#ifdef CONFIG_BOOT_SIGNED
+    g_digest_len = 0;
+#endif
+}
+
+#ifdef CONFIG_BOOT_SIGNED
+static void boot_digest_feed(uint32_t addr, const uint8_t *data, uint32_t size)
+{
+    uint32_t fill, n;
+
+    if(g_digest_len == 0 || addr != g_digest_addr + g_digest_len){
+        sha256_init(&g_digest_ctx);
+        g_digest_addr = addr;
+        g_digest_len = 0;
+    }
+
+    while(size){
+        fill = g_digest_len & 63;
+        if(fill == 0 && size >= 64){
+            n = size & ~63;
+            sha256_input(&g_digest_ctx, (U8 *)data, n);
+        }else{
+            n = (size < 64 - fill) ? size : 64 - fill;
+            memcpy(g_digest_block + fill, data, n);
+            if(fill + n == 64)
+                sha256_input(&g_digest_ctx, g_digest_block, 64);
+        }
+        data += n;
+        size -= n;
+        g_digest_len += n;
+    }
+}
+
+//digest of the size bytes at addr if they were all fed, used up either way
+static int boot_digest_result(uint32_t addr, uint32_t size, uint8_t *digest)
+{
+    uint32_t len = g_digest_len;
+
+    g_digest_len = 0;
+    if(len == 0 || addr != g_digest_addr || size != len)
+        return -1;
+    if(len & 63)
+        sha256_input(&g_digest_ctx, g_digest_block, len & 63);
+
+    return sha256_result(&g_digest_ctx, digest) == HashSuccess ? 0 : -1;
+}
+#endif
+
+/**************************image manifest**************************************/
+static uint32_t boot_manifest_crc(const boot_manifest_t *m)
+{
+    return crc32((uint8_t *)m, offsetof(boot_manifest_t, rec_crc));
+}
+
+//a record written in full, verified or not
+static int boot_manifest_intact(const boot_manifest_t *m)
+{
+    return m->magic == BOOT_MANIFEST_MAGIC
+        && m->size != 0 && m->size <= FLASH_START_ADDR + FLASH_MAX_SIZE - APP_START_ADDR
+        && m->rec_crc == boot_manifest_crc(m);
+}
+
+static uint32_t boot_head_crc(uint32_t size)
+{
+    return crc32((uint8_t *)APP_START_ADDR, size < BOOT_HEAD_SIZE ? size : BOOT_HEAD_SIZE);
+}
+
+//drops the manifest when the area about to be written overlaps its image
+static void boot_manifest_drop(uint32_t addr, uint32_t size)
+{
+    const boot_manifest_t *m = (const boot_manifest_t *)BOOT_MANIFEST_ADDR;
+
+    if(m->magic == 0xFFFFFFFF)
+        return;
+    if(boot_manifest_intact(m)
+        && (addr >= APP_START_ADDR + m->size || addr + size <= APP_START_ADDR))
+        return;
+
+    FLASH_OP_BEGIN();
+    flash_erase_page(BOOT_MANIFEST_ADDR);
+    FLASH_OP_END();
+}
+
+//records the image checked in full at addr if it is the application, the
+//faults logged cleared
+static int boot_manifest_image(uint32_t addr, uint32_t size, uint32_t crc, uint32_t version)
+{
+    boot_manifest_t m;
+    int ret;
+
+    if(addr != APP_START_ADDR || size == 0)
+        return 0;
+
+    memset(&m, 0xFF, sizeof(m));
+    m.magic = BOOT_MANIFEST_MAGIC;
+    m.version = version;
+    m.size = size;
+    m.crc = crc;
+    m.head_crc = boot_head_crc(size);
+    m.rec_crc = boot_manifest_crc(&m);
+
+    //a reset before the verified word leaves a record checked again
+    FLASH_OP_BEGIN();
+    ret = flash_erase_page(BOOT_MANIFEST_ADDR);
+    if(ret == 0)
+        ret = flash_program_bytes(BOOT_MANIFEST_ADDR, (uint8_t *)&m, offsetof(boot_manifest_t, verified));
+    m.verified = BOOT_MANIFEST_VERIFIED;
+    if(ret == 0)
+        ret = flash_program_bytes(BOOT_MANIFEST_ADDR + offsetof(boot_manifest_t, verified),
+                                  (uint8_t *)&m.verified, sizeof(m) - offsetof(boot_manifest_t, verified));
+    FLASH_OP_END();
+
+    return ret;
+}
+
+//checks the application before it is booted, 0 to jump to it
+int boot_app_check(void)
+{
+    const uint32_t *fault = (const uint32_t *)(BOOT_MANIFEST_ADDR + sizeof(boot_manifest_t));
+    uint32_t rst = RCC->RST_SR & (RCC_RST_SR_IWDG_RESET_SR | RCC_RST_SR_WDG_RESET_SR);
+    uint8_t zero[8];
+    boot_manifest_t m;
+    uint16_t n;
+
+    RCC->RST_SR = rst;
+    m = *(const boot_manifest_t *)BOOT_MANIFEST_ADDR;
+    if(!boot_manifest_intact(&m))
+        return (*(volatile uint32_t *)(APP_START_ADDR) == *(volatile uint32_t *)(APP_START_ADDR+4)) ? -1 : 0;
+
+    for(n=0; n<BOOT_FAULT_RECS && fault[2*n] != 0xFFFFFFFF; n++);
+    if(rst && n < BOOT_FAULT_RECS){
+        memset(zero, 0, sizeof(zero));
+        FLASH_OP_BEGIN();
+        flash_program_bytes((uint32_t)&fault[2*n], zero, sizeof(zero));
+        FLASH_OP_END();
+        n++;
+    }
+
+    if(n < BOOT_FAULT_MAX && m.verified == BOOT_MANIFEST_VERIFIED
+        && m.head_crc == boot_head_crc(m.size))
+        return 0;
+
+    //the record stays, an image failing the check is checked at each boot
+    if(crc32((uint8_t *)APP_START_ADDR, m.size) != m.crc)
+        return -1;
+    boot_manifest_image(APP_START_ADDR, m.size, m.crc, m.version);
+
+    return 0;
+}
+
 int copy_image_data_to_flash(uint32_t addr, uint8_t *data, uint32_t size)
 {
     int ret = 0;
     
+    //the lines buffered go first
+    if(boot_writer_flush() != 0 || boot_erase_sync(addr+size) != 0)
+        return -1;
+    boot_image_forget();
+    boot_manifest_drop(addr, size);
+
     if(FLASH_LINE_SIZE == size){
         FLASH_OP_BEGIN();
         ret = flash_program_line(addr, data);
@@ -240,6 +561,8 @@ int jump_cmd_func(volatile loader_req_t *req, loader_res_t *res)
     
     addr = *(uint32_t *)req->data;
 
+    boot_writer_flush();
+    boot_erase_sync(BOOT_ERASE_ALL);
     boot_buffer_clear();
     send_response_to_lora(res);
     while(1){
@@ -274,11 +597,40 @@ int flash_cmd_func(volatile loader_req_t *req, loader_res_t *res)
         res->status = BOOTLOADER_STATUS_ERR_PARAM;
         return RES_UNSENT;
     }
+
+    //consecutive frames are gathered in lines, VERIFY programs the tail
+    stream_abort();
+    boot_manifest_drop(addr, size);
+    if(!g_writer_open || g_writer.addr != addr){
+        if(boot_writer_flush() != 0){
+            res->status = BOOTLOADER_STATUS_ERR_FLASH;
+            return RES_UNSENT;
+        }
+        if(flash_writer_init(&g_writer, addr, 0) != 0){
+            res->status = BOOTLOADER_STATUS_ERR_PARAM;
+            return RES_UNSENT;
+        }
+        g_writer_open = 1;
+    }
         
-    if(copy_image_data_to_flash(addr, req->data+2*sizeof(uint32_t), size) != 0){
+    if(boot_erase_sync(addr+size) != 0
+        || boot_writer_write(req->data+2*sizeof(uint32_t), size) != 0){
+        g_writer_open = 0;
+        boot_image_forget();
         res->status = BOOTLOADER_STATUS_ERR_FLASH;
         return RES_UNSENT;
     }
+
+    if(g_image_len == 0 || addr != g_image_addr + g_image_len){
+        crc32_init(&g_image_crc);
+        g_image_addr = addr;
+        g_image_len = 0;
+    }
+    crc_ctx_update(&g_image_crc, req->data+2*sizeof(uint32_t), size);
+    g_image_len += size;
+#ifdef CONFIG_BOOT_SIGNED
+    boot_digest_feed(addr, req->data+2*sizeof(uint32_t), size);
+#endif
     
     return RES_UNSENT;
 }
@@ -303,28 +655,22 @@ int erase_cmd_func(volatile loader_req_t *req, loader_res_t *res)
         return RES_UNSENT;
     }
 
-    while(size){
-        FLASH_OP_BEGIN();
-        if(flash_erase_page(addr)<0) {
-            FLASH_OP_END();
-            res->status = BOOTLOADER_STATUS_ERR_FLASH;
-            return RES_UNSENT;
-        }
-        FLASH_OP_END();
-        if(size >= FLASH_PAGE_SIZE){
-            size -= FLASH_PAGE_SIZE;
-            addr += FLASH_PAGE_SIZE;
-        }else{
-            size = 0;
-        }
-    }
+    //answered at once, the pages are erased while the data comes in and
+    //before it is programmed
+    boot_writer_flush();
+    boot_erase_sync(BOOT_ERASE_ALL);
+    boot_image_forget();
+    boot_manifest_drop(addr, size);
+    g_erase_err = 0;
+    g_erase_next = addr;
+    g_erase_end = addr + size;
     
     return RES_UNSENT;
 }
 
 int verify_cmd_func(volatile loader_req_t *req, loader_res_t *res)
 {
-    uint32_t addr, size, checksum;
+    uint32_t addr, size, checksum, version = 0;
     
     if(req->data_len<3*sizeof(uint32_t)){
         res->status = BOOTLOADER_STATUS_ERR_PARAM;
@@ -334,12 +680,25 @@ int verify_cmd_func(volatile loader_req_t *req, loader_res_t *res)
     addr = *(uint32_t *)(req->data);
     size = *(uint32_t *)(req->data+sizeof(uint32_t));
     checksum = *(uint32_t *)(req->data+2*sizeof(uint32_t));
+    if(req->data_len>=4*sizeof(uint32_t))
+        version = *(uint32_t *)(req->data+3*sizeof(uint32_t));
     
-    uint32_t crc32_value = crc32((uint8_t *)addr, size);
+    if(boot_writer_flush() != 0 || boot_erase_sync(BOOT_ERASE_ALL) != 0){
+        res->status = BOOTLOADER_STATUS_ERR_FLASH;
+        return RES_UNSENT;
+    }
+
+    uint32_t crc32_value;
+    if(addr == g_image_addr && size == g_image_len && g_image_len)
+        crc32_value = crc_ctx_value(&g_image_crc) ^ 0xFFFFFFFF;
+    else
+        crc32_value = crc32((uint8_t *)addr, size);
     if(crc32_value != checksum){
         res->status = BOOTLOADER_STATUS_ERR_VERIFY;
         return RES_UNSENT;
     }
+    if(boot_manifest_image(addr, size, checksum, version) != 0)
+        res->status = BOOTLOADER_STATUS_ERR_FLASH;
     
     return RES_UNSENT;
 }
@@ -353,6 +712,8 @@ int reboot_cmd_func(volatile loader_req_t *req, loader_res_t *res)
     if(mode>0)
         SYSCFG->CR4 |= BOOT_MODE_REG_BIT;
     
+    boot_writer_flush();
+    boot_erase_sync(BOOT_ERASE_ALL);
     boot_buffer_clear();
     send_response_to_lora(res);
     while(1){
@@ -377,120 +738,1126 @@ int rdsn_cmd_func(volatile loader_req_t *req, loader_res_t *res)
     return RES_UNSENT;
 }
 
-int sync_cmd_func(volatile loader_req_t *req, loader_res_t *res)
+int wdata_cmd_func(volatile loader_req_t *req, loader_res_t *res)
 {
-    boot_buffer_clear();
-    
+    uint32_t addr, size, bit;
+    uint8_t window, slot;
+
+    //a frame not programmed is left out of the bitmap, the host resends it
+    if(req->data_len<BOOTLOADER_WDATA_HDR_SIZE)
+        return RES_NONE;
+
+    addr = *(uint32_t *)req->data;
+    size = *(uint32_t *)(req->data+sizeof(uint32_t));
+    window = req->data[2*sizeof(uint32_t)];
+    slot = req->data[2*sizeof(uint32_t)+1];
+
+    if(window != g_window){
+        g_window = window;
+        g_window_bitmap = 0;
+    }
+
+    if((slot >= BOOTLOADER_WINDOW_MAX)
+        || (size > req->data_len-BOOTLOADER_WDATA_HDR_SIZE)
+        || (addr < FLASH_START_ADDR)
+        || ((addr + size) > (FLASH_START_ADDR + FLASH_MAX_SIZE))
+        || (0 == size))
+        return RES_NONE;
+
+    //flash is programmed once, a resent slot already written is skipped
+    bit = 1UL << slot;
+    if(g_window_bitmap & bit)
+        return RES_NONE;
+
+    if(copy_image_data_to_flash(addr, req->data+BOOTLOADER_WDATA_HDR_SIZE, size) == 0)
+        g_window_bitmap |= bit;
+
+    return RES_NONE;
+}
+
+int wack_cmd_func(volatile loader_req_t *req, loader_res_t *res)
+{
+    uint32_t bitmap = 0;
+
+    if(req->data_len<1){
+        res->status = BOOTLOADER_STATUS_ERR_PARAM;
+        return RES_UNSENT;
+    }
+
+    //nothing of a window not started yet
+    if(req->data[0] == g_window)
+        bitmap = g_window_bitmap;
+
+    res->data[0] = req->data[0];
+    res->data[1] = bitmap & 0xFF;
+    res->data[2] = (bitmap>>8) & 0xFF;
+    res->data[3] = (bitmap>>16) & 0xFF;
+    res->data[4] = (bitmap>>24) & 0xFF;
+    res->data_len = 5;
+
     return RES_UNSENT;
 }
 
+/**************************broadcast transfer**************************************/
+#define FRAG_SLOT_FREE      0xFFFF
+#define FRAG_BIT(map, i)    ((map)[(i) >> 3] & (1 << ((i) & 7)))
 
-void OnTxDone( void )
+typedef struct _frag_row{
+    uint32_t bits;                              //slots of the lost fragments XORed in data
+    uint8_t data[BOOTLOADER_FRAG_SIZE_MAX];
+}frag_row_t;
+
+//the rows are kept reduced: no two of them have the same lowest slot
+typedef struct _frag_session{
+    uint32_t addr;
+    uint32_t size;
+    uint32_t crc;
+    uint16_t nb_frag;
+    uint8_t frag_size;
+    uint8_t session;
+    uint8_t state;
+    uint16_t missing;                           //data fragments not in flash yet
+    uint8_t received[BOOTLOADER_FRAG_MAX / 8];
+    uint16_t lost[BOOTLOADER_FRAG_LOST_MAX];    //fragment index of each slot
+    uint8_t row_num;
+    frag_row_t rows[BOOTLOADER_FRAG_ROWS];
+}frag_session_t;
+
+static frag_session_t g_frag = { .state = BOOTLOADER_FRAG_STATE_IDLE };
+static uint8_t g_frag_matrix[BOOTLOADER_FRAG_MAX / 8];
+
+static uint32_t frag_prbs23(uint32_t x)
 {
-    g_tx_done = 1;
-    lora_rx(0);
-    printf("%s\r\n", __func__);
+    uint32_t b0 = x & 0x01;
+    uint32_t b1 = (x & 0x20) >> 5;
+
+    return (x >> 1) + ((b0 ^ b1) << 22);
 }
 
-void OnRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr )
+//data fragments of the parity fragment n, from 1, as the LoRaWAN
+//fragmented data block transport draws them
+static void frag_parity_row(uint16_t n, uint16_t m, uint8_t *row)
 {
-    boot_buffer_clear();
-    lora_rx(0);
-    printf("%s\r\n", __func__);
-    for(int i=0; i<size; i++)
-        boot_buffer_write_byte(payload[i]);
+    uint32_t x = 1 + 1001 * (uint32_t)n;
+    uint32_t mod = m + (((m & (m - 1)) == 0) ? 1 : 0);
+    uint32_t r;
+    uint16_t coeff;
+
+    memset(row, 0, (m + 7) / 8);
+    for(coeff = 0; coeff < (m >> 1); coeff++){
+        do{
+            x = frag_prbs23(x);
+            r = x % mod;
+        }while(r >= m);
+        row[r >> 3] |= 1 << (r & 7);
+    }
 }
 
-void OnTxTimeout( void )
+static uint32_t frag_addr(uint16_t index)
 {
-    lora_rx(0);
-    printf("%s\r\n", __func__);
+    return g_frag.addr + (uint32_t)index * g_frag.frag_size;
 }
 
-void OnRxTimeout( void )
+static void frag_xor(uint8_t *data, const uint8_t *src)
 {
-    lora_rx(0);
-    printf("%s\r\n", __func__);
+    for(int i=0; i<g_frag.frag_size; i++)
+        data[i] ^= src[i];
 }
 
-void OnRxError( void )
+static uint32_t frag_lowest(uint32_t bits)
 {
-    lora_rx(0);
-    printf("%s\r\n", __func__);
+    return __CLZ(__RBIT(bits));
 }
 
-void lora_init()
+static int frag_program(uint16_t index, uint8_t *data)
 {
-    RadioEvents.TxDone = OnTxDone;
-    RadioEvents.RxDone = OnRxDone;
-    RadioEvents.TxTimeout = OnTxTimeout;
-    RadioEvents.RxTimeout = OnRxTimeout;
-    RadioEvents.RxError = OnRxError;
+    if(copy_image_data_to_flash(frag_addr(index), data, g_frag.frag_size) != 0){
+        g_frag.state = BOOTLOADER_FRAG_STATE_ERR_FLASH;
+        return -1;
+    }
 
-    Radio.Init( &RadioEvents );
-    
-    Radio.SetChannel(g_freq);
-    
-    if(g_modem == MODEM_LORA) {
-        
-        Radio.SetTxConfig( MODEM_LORA, g_txp, 0, g_lora_bw,
-                                       g_lora_sf, g_lora_cr,
-                                       g_lora_preamble, LORA_FIX_LENGTH_PAYLOAD_ON,
-                                       true, 0, 0, g_lora_iqi, 6000 );
-    
-        Radio.SetRxConfig( MODEM_LORA, g_lora_bw, g_lora_sf,
-                                       g_lora_cr, 0, g_lora_preamble,
-                                       LORA_SYMBOL_TIMEOUT, LORA_FIX_LENGTH_PAYLOAD_ON,
-                                       0, true, 0, 0, g_lora_iqi, true );
-    }else{
-        Radio.SetTxConfig( MODEM_FSK, g_txp, g_fsk_dev, 0,
-                                      g_fsk_dr, 0,
-                                      g_fsk_preamble, FSK_FIX_LENGTH_PAYLOAD_ON,
-                                      true, 0, 0, 0, 6000 );
-    
-        Radio.SetRxConfig( MODEM_FSK, g_fsk_bw, g_fsk_dr,
-                                      0, g_fsk_afcbw, g_fsk_preamble,
-                                      0, FSK_FIX_LENGTH_PAYLOAD_ON, 0, true,
-                                      0, 0, false, true );
+    g_frag.received[index >> 3] |= 1 << (index & 7);
+    g_frag.missing--;
+    if(g_frag.missing == 0){
+        if(crc32((uint8_t *)g_frag.addr, g_frag.size) == g_frag.crc){
+            g_frag.state = BOOTLOADER_FRAG_STATE_DONE;
+            boot_manifest_image(g_frag.addr, g_frag.size, g_frag.crc, 0);
+        }
+        else
+            g_frag.state = BOOTLOADER_FRAG_STATE_ERR_CRC;
+    }
+    return 0;
+}
+
+//slot of a lost fragment, a free one given to it with alloc
+static int frag_slot(uint16_t index, int alloc)
+{
+    int free_slot = -1;
+
+    for(int i=0; i<BOOTLOADER_FRAG_LOST_MAX; i++){
+        if(g_frag.lost[i] == index)
+            return i;
+        if(g_frag.lost[i] == FRAG_SLOT_FREE && free_slot < 0)
+            free_slot = i;
     }
+    if(!alloc || free_slot < 0)
+        return -1;
 
-    Radio.Rx( 0 );
+    g_frag.lost[free_slot] = index;
+    return free_slot;
 }
 
-void lora_tx(uint8_t *data, uint32_t size)
+//frees the slots no row refers to
+static void frag_slot_gc(void)
 {
-    if(g_modem == MODEM_LORA) {
-        
-        Radio.SetTxConfig( MODEM_LORA, g_txp, 0, g_lora_bw,
-                                       g_lora_sf, g_lora_cr,
-                                       g_lora_preamble, LORA_FIX_LENGTH_PAYLOAD_ON,
-                                       true, 0, 0, g_lora_iqi, 6000 );
-    
-        Radio.SetRxConfig( MODEM_LORA, g_lora_bw, g_lora_sf,
-                                       g_lora_cr, 0, g_lora_preamble,
-                                       LORA_SYMBOL_TIMEOUT, LORA_FIX_LENGTH_PAYLOAD_ON,
-                                       0, true, 0, 0, g_lora_iqi, true );
-    }else{
-        Radio.SetTxConfig( MODEM_FSK, g_txp, g_fsk_dev, 0,
-                                      g_fsk_dr, 0,
-                                      g_fsk_preamble, FSK_FIX_LENGTH_PAYLOAD_ON,
-                                      true, 0, 0, 0, 6000 );
-    
-        Radio.SetRxConfig( MODEM_FSK, g_fsk_bw, g_fsk_dr,
-                                      0, g_fsk_afcbw, g_fsk_preamble,
-                                      0, FSK_FIX_LENGTH_PAYLOAD_ON, 0, true,
-                                      0, 0, false, true );
+    uint32_t used = 0;
+
+    for(int i=0; i<g_frag.row_num; i++)
+        used |= g_frag.rows[i].bits;
+    for(int i=0; i<BOOTLOADER_FRAG_LOST_MAX; i++){
+        if(!(used & (1UL << i)))
+            g_frag.lost[i] = FRAG_SLOT_FREE;
     }
+}
 
-    g_tx_done = 0;
-    Radio.Send( data, size );
+//XORs the rows of the same lowest slot in, until none is left or it is empty
+static uint32_t frag_row_reduce(uint32_t bits, uint8_t *data, frag_row_t *self)
+{
+    for(int j=0; j<g_frag.row_num && bits; j++){
+        frag_row_t *row = &g_frag.rows[j];
+
+        if(row != self && frag_lowest(row->bits) == frag_lowest(bits)){
+            bits ^= row->bits;
+            frag_xor(data, row->data);
+            j = -1;
+        }
+    }
+    return bits;
 }
 
-void lora_rx(uint32_t timeout)
+static void frag_row_remove(int i)
 {
-    if(g_modem == MODEM_LORA) {
-        
-        Radio.SetTxConfig( MODEM_LORA, g_txp, 0, g_lora_bw,
+    g_frag.row_num--;
+    if(i != g_frag.row_num)
+        memcpy(&g_frag.rows[i], &g_frag.rows[g_frag.row_num], sizeof(frag_row_t));
+}
+
+//the fragment of the slot is in flash now: it leaves the rows, the one whose
+//lowest slot it was is reduced again
+static void frag_slot_known(int slot)
+{
+    const uint8_t *flash = (const uint8_t *)frag_addr(g_frag.lost[slot]);
+    uint32_t bit = 1UL << slot;
+    int pivot = -1;
+
+    for(int i=0; i<g_frag.row_num; i++){
+        frag_row_t *row = &g_frag.rows[i];
+
+        if(row->bits & bit){
+            if(frag_lowest(row->bits) == slot)
+                pivot = i;
+            row->bits &= ~bit;
+            frag_xor(row->data, flash);
+        }
+    }
+    g_frag.lost[slot] = FRAG_SLOT_FREE;
+
+    if(pivot >= 0){
+        frag_row_t *row = &g_frag.rows[pivot];
+
+        row->bits = frag_row_reduce(row->bits, row->data, row);
+        if(!row->bits)
+            frag_row_remove(pivot);
+    }
+}
+
+//programs the fragments a row holds alone
+static void frag_solve(void)
+{
+    int i = 0;
+
+    while(i < g_frag.row_num && g_frag.state == BOOTLOADER_FRAG_STATE_RUNNING){
+        frag_row_t *row = &g_frag.rows[i];
+        int slot;
+
+        if(row->bits & (row->bits - 1)){
+            i++;
+            continue;
+        }
+        slot = frag_lowest(row->bits);
+        if(frag_program(g_frag.lost[slot], row->data) != 0)
+            return;
+        frag_row_remove(i);
+        frag_slot_known(slot);
+        i = 0;
+    }
+}
+
+static void frag_data(uint16_t index, uint8_t *data)
+{
+    int slot;
+
+    if(FRAG_BIT(g_frag.received, index))
+        return;
+    if(frag_program(index, data) != 0)
+        return;
+
+    slot = frag_slot(index, 0);
+    if(slot >= 0){
+        frag_slot_known(slot);
+        frag_solve();
+    }
+}
+
+static void frag_parity(uint16_t n, uint8_t *data)
+{
+    uint32_t bits = 0;
+    int slot;
+
+    //the fragments in flash are XORed out, the lost ones get a slot
+    frag_parity_row(n, g_frag.nb_frag, g_frag_matrix);
+    for(uint16_t i=0; i<g_frag.nb_frag; i++){
+        if(!FRAG_BIT(g_frag_matrix, i))
+            continue;
+        if(FRAG_BIT(g_frag.received, i)){
+            frag_xor(data, (const uint8_t *)frag_addr(i));
+            continue;
+        }
+        slot = frag_slot(i, 1);
+        if(slot < 0){
+            //more lost fragments than slots, left to the missing list
+            bits = 0;
+            break;
+        }
+        bits |= 1UL << slot;
+    }
+
+    if(bits)
+        bits = frag_row_reduce(bits, data, NULL);
+    if(bits && g_frag.row_num < BOOTLOADER_FRAG_ROWS){
+        g_frag.rows[g_frag.row_num].bits = bits;
+        memcpy(g_frag.rows[g_frag.row_num].data, data, g_frag.frag_size);
+        g_frag.row_num++;
+        frag_solve();
+    }
+    frag_slot_gc();
+}
+
+int frag_setup_cmd_func(volatile loader_req_t *req, loader_res_t *res)
+{
+    uint32_t addr, size, crc, span;
+    uint16_t nb_frag;
+    uint8_t frag_size, session;
+
+    if(req->data_len<16)
+        return RES_NONE;
+
+    addr = *(uint32_t *)req->data;
+    size = *(uint32_t *)(req->data+sizeof(uint32_t));
+    crc = *(uint32_t *)(req->data+2*sizeof(uint32_t));
+    nb_frag = req->data[12] | (req->data[13]<<8);
+    frag_size = req->data[14];
+    session = req->data[15];
+    span = (uint32_t)nb_frag * frag_size;
+
+    //sent several times for all the devices to hear it, erased once
+    if(session == g_frag.session && g_frag.state != BOOTLOADER_FRAG_STATE_IDLE)
+        return RES_NONE;
+    boot_erase_sync(BOOT_ERASE_ALL);
+    boot_image_forget();
+
+    if((nb_frag == 0) || (nb_frag > BOOTLOADER_FRAG_MAX)
+        || (frag_size == 0) || (frag_size > BOOTLOADER_FRAG_SIZE_MAX) || (frag_size & 7)
+        || (addr & (FLASH_PAGE_SIZE - 1)) || (addr < FLASH_START_ADDR)
+        || ((addr + span) > (FLASH_START_ADDR + FLASH_MAX_SIZE))
+        || (0 == size) || (size > span))
+        return RES_NONE;
+
+    boot_manifest_drop(addr, span);
+    for(uint32_t offset = 0; offset < span; offset += FLASH_PAGE_SIZE){
+        FLASH_OP_BEGIN();
+        if(flash_erase_page(addr + offset)<0) {
+            FLASH_OP_END();
+            return RES_NONE;
+        }
+        FLASH_OP_END();
+    }
+
+    memset(&g_frag, 0, sizeof(g_frag));
+    memset(g_frag.lost, 0xFF, sizeof(g_frag.lost));
+    g_frag.addr = addr;
+    g_frag.size = size;
+    g_frag.crc = crc;
+    g_frag.nb_frag = nb_frag;
+    g_frag.frag_size = frag_size;
+    g_frag.session = session;
+    g_frag.missing = nb_frag;
+    g_frag.state = BOOTLOADER_FRAG_STATE_RUNNING;
+
+    return RES_NONE;
+}
+
+int frag_cmd_func(volatile loader_req_t *req, loader_res_t *res)
+{
+    uint16_t index;
+
+    if(g_frag.state != BOOTLOADER_FRAG_STATE_RUNNING
+        || req->data_len < BOOTLOADER_FRAG_HDR_SIZE + g_frag.frag_size
+        || req->data[0] != g_frag.session)
+        return RES_NONE;
+
+    index = req->data[2] | (req->data[3]<<8);
+    if(index < g_frag.nb_frag)
+        frag_data(index, req->data+BOOTLOADER_FRAG_HDR_SIZE);
+    else
+        frag_parity(index - g_frag.nb_frag + 1, req->data+BOOTLOADER_FRAG_HDR_SIZE);
+
+    return RES_NONE;
+}
+
+int frag_status_cmd_func(volatile loader_req_t *req, loader_res_t *res)
+{
+    uint8_t sn[8];
+    uint8_t state = BOOTLOADER_FRAG_STATE_IDLE;
+    uint16_t missing = 0, count = 0;
+
+    if(req->data_len<9)
+        return RES_NONE;
+
+    //broadcast, only the device asked answers
+    system_get_chip_id((uint32_t *)sn);
+    if(memcmp((uint8_t *)req->data+1, sn, sizeof(sn)) != 0)
+        return RES_NONE;
+
+    if(req->data[0] == g_frag.session && g_frag.state != BOOTLOADER_FRAG_STATE_IDLE){
+        state = g_frag.state;
+        missing = g_frag.missing;
+        for(uint16_t i=0; i<g_frag.nb_frag && count<BOOTLOADER_FRAG_MISSING_REPORT; i++){
+            if(FRAG_BIT(g_frag.received, i))
+                continue;
+            res->data[4+2*count] = i & 0xFF;
+            res->data[5+2*count] = (i>>8) & 0xFF;
+            count++;
+        }
+    }
+
+    res->data[0] = req->data[0];
+    res->data[1] = state;
+    res->data[2] = missing & 0xFF;
+    res->data[3] = (missing>>8) & 0xFF;
+    res->data_len = 4+2*count;
+
+    return RES_UNSENT;
+}
+
+/**************************compressed and delta images**************************/
+typedef struct _stream_dec{
+    uint32_t addr;                              //output area, erased
+    uint32_t size;
+    uint32_t src;                               //installed image the delta tokens copy from
+    uint32_t src_size;
+    uint32_t out;                               //bytes output
+    uint32_t pos;                               //stream bytes decoded
+    uint8_t active;
+    uint8_t tok[BOOTLOADER_STREAM_TOK_MAX];     //token being received
+    uint8_t tok_len;
+    uint8_t lit;                                //literal bytes left of the run
+}stream_dec_t;
+
+static stream_dec_t g_stream;
+
+static void stream_abort(void)
+{
+    g_stream.active = 0;
+}
+
+static int stream_emit(uint8_t byte)
+{
+    if(g_stream.out >= g_stream.size)
+        return -1;
+
+#ifdef CONFIG_BOOT_SIGNED
+    boot_digest_feed(g_stream.addr + g_stream.out, &byte, 1);
+#endif
+    g_stream.out++;
+    return boot_writer_write(&byte, 1);
+}
+
+//output byte dist bytes back, from the line buffer or from flash once programmed
+static uint8_t stream_back(uint32_t dist)
+{
+    uint32_t addr = g_stream.addr + g_stream.out - dist;
+    uint32_t programmed = g_writer.addr - g_writer.len;
+
+    if(addr >= programmed)
+        return ((uint8_t *)g_writer.line)[addr - programmed];
+    return *(uint8_t *)addr;
+}
+
+static uint8_t stream_tok_size(uint8_t t)
+{
+    if(t < 0x80)
+        return 1;
+    if(t < 0xC0)
+        return 3;
+    return 5;
+}
+
+static int stream_token(void)
+{
+    uint8_t *tok = g_stream.tok;
+    uint32_t len, off;
+
+    if(tok[0] < 0x80){
+        g_stream.lit = tok[0] + 1;
+    }else if(tok[0] < 0xC0){
+        len = (tok[0] & 0x3F) + 3;
+        off = tok[1] | (tok[2]<<8);
+        if(off == 0 || off > g_stream.out)
+            return -1;
+        while(len--){
+            if(stream_emit(stream_back(off)) != 0)
+                return -1;
+        }
+    }else{
+        len = (((tok[0] & 0x3F)<<8) | tok[1]) + 1;
+        off = tok[2] | (tok[3]<<8) | (tok[4]<<16);
+        if(off + len > g_stream.src_size)
+            return -1;
+        for(uint32_t i=0; i<len; i++){
+            if(stream_emit(*(uint8_t *)(g_stream.src + off + i)) != 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static int stream_decode(uint8_t *data, uint32_t size)
+{
+    for(uint32_t i=0; i<size; i++){
+        if(g_stream.lit){
+            g_stream.lit--;
+            if(stream_emit(data[i]) != 0)
+                return -1;
+            continue;
+        }
+
+        g_stream.tok[g_stream.tok_len++] = data[i];
+        if(g_stream.tok_len < stream_tok_size(g_stream.tok[0]))
+            continue;
+        g_stream.tok_len = 0;
+        if(stream_token() != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void stream_position(loader_res_t *res)
+{
+    *(uint32_t *)res->data = g_stream.pos;
+    res->data_len = sizeof(uint32_t);
+}
+
+int stream_begin_cmd_func(volatile loader_req_t *req, loader_res_t *res)
+{
+    uint32_t addr, size, src, src_size;
+
+    if(req->data_len<4*sizeof(uint32_t)){
+        res->status = BOOTLOADER_STATUS_ERR_PARAM;
+        return RES_UNSENT;
+    }
+
+    addr = *(uint32_t *)req->data;
+    size = *(uint32_t *)(req->data+sizeof(uint32_t));
+    src = *(uint32_t *)(req->data+2*sizeof(uint32_t));
+    src_size = *(uint32_t *)(req->data+3*sizeof(uint32_t));
+
+    //verify parameter, the output must not overwrite the installed image
+    if((addr < FLASH_START_ADDR)
+        || ((addr + size) > (FLASH_START_ADDR + FLASH_MAX_SIZE))
+        || (0 == size) || (addr & (FLASH_PAGE_SIZE - 1))
+        || (src_size && ((src < FLASH_START_ADDR)
+            || ((src + src_size) > (FLASH_START_ADDR + FLASH_MAX_SIZE))
+            || ((src < addr + size) && (addr < src + src_size))))){
+        res->status = BOOTLOADER_STATUS_ERR_PARAM;
+        return RES_UNSENT;
+    }
+
+    //the area is erased page by page ahead of the output
+    if(boot_writer_flush() != 0 || boot_erase_sync(BOOT_ERASE_ALL) != 0){
+        res->status = BOOTLOADER_STATUS_ERR_FLASH;
+        return RES_UNSENT;
+    }
+    boot_image_forget();
+    boot_manifest_drop(addr, size);
+    if(flash_writer_init(&g_writer, addr, size) != 0){
+        res->status = BOOTLOADER_STATUS_ERR_FLASH;
+        return RES_UNSENT;
+    }
+    g_writer_open = 1;
+
+    memset(&g_stream, 0, sizeof(g_stream));
+    g_stream.addr = addr;
+    g_stream.size = size;
+    g_stream.src = src;
+    g_stream.src_size = src_size;
+    g_stream.active = 1;
+
+    return RES_UNSENT;
+}
+
+int stream_cmd_func(volatile loader_req_t *req, loader_res_t *res)
+{
+    uint32_t offset, size;
+
+    if(req->data_len<sizeof(uint32_t) || !g_stream.active){
+        res->status = BOOTLOADER_STATUS_ERR_PARAM;
+        return RES_UNSENT;
+    }
+
+    offset = *(uint32_t *)req->data;
+    size = req->data_len - sizeof(uint32_t);
+
+    //a resent frame already decoded is acknowledged again, a gap is refused
+    if(offset + size <= g_stream.pos){
+        stream_position(res);
+        return RES_UNSENT;
+    }
+    if(offset != g_stream.pos){
+        res->status = BOOTLOADER_STATUS_ERR_PARAM;
+        stream_position(res);
+        return RES_UNSENT;
+    }
+
+    if(stream_decode(req->data+sizeof(uint32_t), size) != 0){
+        g_stream.active = 0;
+        res->status = BOOTLOADER_STATUS_ERR_DATA;
+        return RES_UNSENT;
+    }
+    g_stream.pos += size;
+    stream_position(res);
+
+    return RES_UNSENT;
+}
+
+int stream_end_cmd_func(volatile loader_req_t *req, loader_res_t *res)
+{
+    uint32_t checksum;
+
+    if(req->data_len<sizeof(uint32_t) || !g_stream.active){
+        res->status = BOOTLOADER_STATUS_ERR_PARAM;
+        return RES_UNSENT;
+    }
+
+    checksum = *(uint32_t *)req->data;
+    g_stream.active = 0;
+
+    if(boot_writer_flush() != 0){
+        res->status = BOOTLOADER_STATUS_ERR_FLASH;
+        return RES_UNSENT;
+    }
+    if(g_stream.out != g_stream.size || g_stream.lit || g_stream.tok_len
+        || crc32((uint8_t *)g_stream.addr, g_stream.size) != checksum){
+        res->status = BOOTLOADER_STATUS_ERR_VERIFY;
+        return RES_UNSENT;
+    }
+    if(boot_manifest_image(g_stream.addr, g_stream.size, checksum, 0) != 0)
+        res->status = BOOTLOADER_STATUS_ERR_FLASH;
+
+    return RES_UNSENT;
+}
+
+int copy_cmd_func(volatile loader_req_t *req, loader_res_t *res)
+{
+    uint32_t dst, src, size, len, crc;
+
+    if(req->data_len<3*sizeof(uint32_t)){
+        res->status = BOOTLOADER_STATUS_ERR_PARAM;
+        return RES_UNSENT;
+    }
+
+    dst = *(uint32_t *)req->data;
+    src = *(uint32_t *)(req->data+sizeof(uint32_t));
+    size = *(uint32_t *)(req->data+2*sizeof(uint32_t));
+
+    //verify parameter
+    if((dst < FLASH_START_ADDR) || (src < FLASH_START_ADDR)
+        || ((dst + size) > (FLASH_START_ADDR + FLASH_MAX_SIZE))
+        || ((src + size) > (FLASH_START_ADDR + FLASH_MAX_SIZE))
+        || (0 == size) || (dst & (FLASH_PAGE_SIZE - 1))
+        || ((src < dst + size) && (dst < src + size))){
+        res->status = BOOTLOADER_STATUS_ERR_PARAM;
+        return RES_UNSENT;
+    }
+
+    //erased and programmed page by page
+    g_stream.active = 0;
+    if(boot_writer_flush() != 0 || boot_erase_sync(BOOT_ERASE_ALL) != 0){
+        res->status = BOOTLOADER_STATUS_ERR_FLASH;
+        return RES_UNSENT;
+    }
+    boot_image_forget();
+    boot_manifest_drop(dst, size);
+    if(flash_writer_init(&g_writer, dst, size) != 0){
+        res->status = BOOTLOADER_STATUS_ERR_FLASH;
+        return RES_UNSENT;
+    }
+    g_writer_open = 1;
+    for(uint32_t offset = 0; offset < size; offset += len){
+        len = size - offset;
+        if(len > FLASH_PAGE_SIZE)
+            len = FLASH_PAGE_SIZE;
+        if(boot_writer_write((uint8_t *)(src + offset), len) != 0){
+            g_writer_open = 0;
+            res->status = BOOTLOADER_STATUS_ERR_FLASH;
+            return RES_UNSENT;
+        }
+    }
+    if(boot_writer_flush() != 0){
+        res->status = BOOTLOADER_STATUS_ERR_FLASH;
+        return RES_UNSENT;
+    }
+
+    crc = crc32((uint8_t *)src, size);
+    if(crc32((uint8_t *)dst, size) != crc)
+        res->status = BOOTLOADER_STATUS_ERR_VERIFY;
+    else if(boot_manifest_image(dst, size, crc, 0) != 0)
+        res->status = BOOTLOADER_STATUS_ERR_FLASH;
+
+    return RES_UNSENT;
+}
+
+/**************************A/B slots**************************************/
+static uint16_t g_rec_free = 0;
+
+#ifdef CONFIG_BOOT_SIGNED
+//signature check of the image committed, SLOT_COMMIT answered at its end
+static EcdsaJob_t g_sign_job;
+static boot_rec_t g_sign_img;
+#endif
+
+static boot_rec_t *boot_rec_at(uint16_t index)
+{
+    return (boot_rec_t *)BOOT_STATE_ADDR + index;
+}
+
+//last record and last confirmed image of the state log, its end in g_rec_free
+static void boot_rec_scan(boot_rec_t *last, boot_rec_t *good)
+{
+    memset(last, 0xFF, sizeof(boot_rec_t));
+    memset(good, 0, sizeof(boot_rec_t));
+
+    for(g_rec_free=0; g_rec_free<BOOT_STATE_RECS; g_rec_free++){
+        boot_rec_t *rec = boot_rec_at(g_rec_free);
+
+        if(rec->type == 0xFF && rec->size == 0xFFFFFFFF)
+            break;
+        //a record half written at a reset is skipped
+        if(rec->type == 0xFF || rec->size == 0xFFFFFFFF)
+            continue;
+        *last = *rec;
+        if(rec->type == BOOT_REC_CONFIRM)
+            *good = *rec;
+    }
+}
+
+static int boot_rec_append(uint8_t type, uint8_t step, uint16_t page, const boot_rec_t *img)
+{
+    boot_rec_t rec;
+    int ret;
+
+    if(g_rec_free >= BOOT_STATE_RECS)
+        return -1;
+
+    rec.type = type;
+    rec.step = step;
+    rec.page = page;
+    rec.version = img->version;
+    rec.size = img->size;
+    rec.crc = img->crc;
+
+    FLASH_OP_BEGIN();
+    ret = flash_program_bytes((uint32_t)boot_rec_at(g_rec_free), (uint8_t *)&rec, sizeof(rec));
+    FLASH_OP_END();
+    g_rec_free++;
+
+    return ret;
+}
+
+static int boot_page_copy(uint32_t dst, uint32_t src)
+{
+    int ret;
+
+    FLASH_OP_BEGIN();
+    ret = flash_erase_page(dst);
+    if(ret == 0)
+        ret = flash_writer_init(&g_writer, dst, 0);
+    if(ret == 0)
+        ret = flash_writer_write(&g_writer, (uint8_t *)src, FLASH_PAGE_SIZE);
+    if(ret == 0)
+        ret = flash_writer_flush(&g_writer);
+    FLASH_OP_END();
+
+    return ret;
+}
+
+//swaps A and B page by page through the scratch page, from the step after
+//the one logged last
+static int boot_slot_swap(uint8_t type, uint16_t page, uint8_t step, const boot_rec_t *img)
+{
+    boot_manifest_drop(BOOT_SLOT_A_ADDR, BOOT_SLOT_SIZE);
+    for(; page<BOOT_SLOT_PAGES; page++, step=0){
+        uint32_t a = BOOT_SLOT_A_ADDR + page*FLASH_PAGE_SIZE;
+        uint32_t b = BOOT_SLOT_B_ADDR + page*FLASH_PAGE_SIZE;
+
+        if(step < 1 && (boot_page_copy(BOOT_SCRATCH_ADDR, a) != 0 || boot_rec_append(type, 1, page, img) != 0))
+            return -1;
+        if(step < 2 && (boot_page_copy(a, b) != 0 || boot_rec_append(type, 2, page, img) != 0))
+            return -1;
+        if(step < 3 && (boot_page_copy(b, BOOT_SCRATCH_ADDR) != 0 || boot_rec_append(type, 3, page, img) != 0))
+            return -1;
+    }
+    return 0;
+}
+
+static void boot_slot_start_trial(void)
+{
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_IWDG, true);
+    iwdg_init(true);
+    iwdg_set_prescaler(IWDG_PRESCALER_256);
+    iwdg_set_reload(BOOT_TRIAL_IWDG_RELOAD);
+    iwdg_start();
+}
+
+static void boot_slot_revert(uint16_t page, uint8_t step, const boot_rec_t *good)
+{
+    if(boot_slot_swap(BOOT_REC_UNSWAP, page, step, good) != 0)
+        return;
+    boot_rec_append(BOOT_REC_CONFIRM, 0, 0, good);
+    if(good->size && crc32((uint8_t *)BOOT_SLOT_A_ADDR, good->size) == good->crc)
+        boot_manifest_image(BOOT_SLOT_A_ADDR, good->size, good->crc, good->version);
+}
+
+//finishes the activation or the rollback logged, before A is booted
+void boot_slot_process(void)
+{
+    boot_rec_t last, good;
+    uint16_t page = 0;
+    uint8_t step = 0;
+    bool iwdg_reset = (RCC->RST_SR & RCC_RST_SR_IWDG_RESET_SR) ? true : false;
+
+    boot_rec_scan(&last, &good);
+    //the watchdog reset of a confirmed image is a fault of boot_app_check
+    if(last.type != 0xFF && last.type != BOOT_REC_CONFIRM)
+        RCC->RST_SR = RCC_RST_SR_IWDG_RESET_SR;
+
+    if(last.type == BOOT_REC_SWAP || last.type == BOOT_REC_UNSWAP){
+        page = last.page;
+        step = last.step;
+        if(step >= 3){
+            page++;
+            step = 0;
+        }
+    }
+
+    switch(last.type){
+    case BOOT_REC_PENDING:
+    case BOOT_REC_SWAP:
+        if(boot_slot_swap(BOOT_REC_SWAP, page, step, &last) != 0)
+            return;
+        if(crc32((uint8_t *)BOOT_SLOT_A_ADDR, last.size) != last.crc){
+            if(boot_rec_append(BOOT_REC_REVERT, 0, 0, &good) == 0)
+                boot_slot_revert(0, 0, &good);
+            return;
+        }
+        boot_manifest_image(BOOT_SLOT_A_ADDR, last.size, last.crc, last.version);
+        if(boot_rec_append(BOOT_REC_TRIAL, 1, 0, &last) == 0)
+            boot_slot_start_trial();
+        break;
+    case BOOT_REC_TRIAL:
+        if(iwdg_reset || last.step >= BOOT_TRIAL_MAX){
+            if(boot_rec_append(BOOT_REC_REVERT, 0, 0, &good) == 0)
+                boot_slot_revert(0, 0, &good);
+            return;
+        }
+        if(boot_rec_append(BOOT_REC_TRIAL, last.step + 1, 0, &last) == 0)
+            boot_slot_start_trial();
+        break;
+    case BOOT_REC_REVERT:
+    case BOOT_REC_UNSWAP:
+        boot_slot_revert(page, step, &good);
+        break;
+    default:
+        break;
+    }
+}
+
+//logs the image in B pending
+static void slot_commit_log(const boot_rec_t *img, loader_res_t *res)
+{
+    boot_rec_t last, good;
+
+    //the log is compacted while it is idle, room left for a whole swap
+    boot_rec_scan(&last, &good);
+    if(g_rec_free + 3*BOOT_SLOT_PAGES + BOOT_TRIAL_MAX + 4 > BOOT_STATE_RECS){
+        FLASH_OP_BEGIN();
+        flash_erase_page(BOOT_STATE_ADDR);
+        FLASH_OP_END();
+        g_rec_free = 0;
+        if(good.type == BOOT_REC_CONFIRM)
+            boot_rec_append(BOOT_REC_CONFIRM, 0, 0, &good);
+    }
+
+    if(boot_rec_append(BOOT_REC_PENDING, 0, 0, img) != 0)
+        res->status = BOOTLOADER_STATUS_ERR_FLASH;
+}
+
+#ifdef CONFIG_BOOT_SIGNED
+static void slot_commit_signed(EcdsaJob_t *job, bool valid)
+{
+    if(valid)
+        slot_commit_log(&g_sign_img, &g_response);
+    else
+        g_response.status = BOOTLOADER_STATUS_ERR_VERIFY;
+
+    boot_buffer_clear();
+    send_response_to_lora(&g_response);
+}
+#endif
+
+int slot_commit_cmd_func(volatile loader_req_t *req, loader_res_t *res)
+{
+    boot_rec_t img, last, good;
+#ifdef CONFIG_BOOT_SIGNED
+    const uint8_t *rs = (const uint8_t *)req->data+3*sizeof(uint32_t);
+    uint8_t digest[32];
+    bool started;
+#endif
+
+    if(req->data_len<BOOT_COMMIT_SIZE){
+        res->status = BOOTLOADER_STATUS_ERR_PARAM;
+        return RES_UNSENT;
+    }
+
+    img.version = *(uint32_t *)req->data;
+    img.size = *(uint32_t *)(req->data+sizeof(uint32_t));
+    img.crc = *(uint32_t *)(req->data+2*sizeof(uint32_t));
+    if((0 == img.size) || (img.size > BOOT_SLOT_SIZE)){
+        res->status = BOOTLOADER_STATUS_ERR_PARAM;
+        return RES_UNSENT;
+    }
+
+    if(boot_writer_flush() != 0 || boot_erase_sync(BOOT_ERASE_ALL) != 0){
+        res->status = BOOTLOADER_STATUS_ERR_FLASH;
+        return RES_UNSENT;
+    }
+    if(crc32((uint8_t *)BOOT_SLOT_B_ADDR, img.size) != img.crc){
+        res->status = BOOTLOADER_STATUS_ERR_VERIFY;
+        return RES_UNSENT;
+    }
+
+    //only over a confirmed image, or a commit not activated yet, and newer
+    boot_rec_scan(&last, &good);
+    if((last.type != 0xFF && last.type != BOOT_REC_CONFIRM && last.type != BOOT_REC_PENDING)
+        || (good.type == BOOT_REC_CONFIRM && img.version <= good.version)){
+        res->status = BOOTLOADER_STATUS_ERR_PARAM;
+        return RES_UNSENT;
+    }
+
+#ifdef CONFIG_BOOT_SIGNED
+    //answered by slot_commit_signed, the main loop running the check, over
+    //the digest of the data received when it covers the image
+    g_sign_img = img;
+    if(boot_digest_result(BOOT_SLOT_B_ADDR, img.size, digest) == 0)
+        started = EcdsaJobStartDigest(&g_sign_job, boot_key, digest, rs, slot_commit_signed);
+    else
+        started = EcdsaJobStart(&g_sign_job, boot_key, (const uint8_t *)BOOT_SLOT_B_ADDR, img.size,
+                                rs, slot_commit_signed);
+    if(!started){
+        res->status = BOOTLOADER_STATUS_ERR_VERIFY;
+        return RES_UNSENT;
+    }
+    return RES_NONE;
+#else
+    slot_commit_log(&img, res);
+
+    return RES_UNSENT;
+#endif
+}
+
+int sync_cmd_func(volatile loader_req_t *req, loader_res_t *res)
+{
+    boot_rx_flush();
+    g_window = 0;
+    g_window_bitmap = 0;
+    
+    return RES_UNSENT;
+}
+
+int bulk_cmd_func(volatile loader_req_t *req, loader_res_t *res)
+{
+    uint8_t mode;
+
+    if(req->data_len<1){
+        res->status = BOOTLOADER_STATUS_ERR_PARAM;
+        return RES_UNSENT;
+    }
+
+    mode = *(uint8_t *)req->data;
+    if(mode > 1){
+        res->status = BOOTLOADER_STATUS_ERR_PARAM;
+        return RES_UNSENT;
+    }
+
+    //the profile is set before the answer, the modem switched after it
+    if(mode){
+        g_fsk_bw = BOOT_BULK_FSK_BW;
+        g_fsk_dr = BOOT_BULK_FSK_DR;
+        g_fsk_dev = BOOT_BULK_FSK_DEV;
+        g_fsk_preamble = BOOT_BULK_FSK_PREAMBLE;
+        g_fsk_afcbw = BOOT_BULK_FSK_BW;
+        g_modem_next = MODEM_FSK;
+    }else{
+        g_modem_next = MODEM_LORA;
+    }
+
+    return RES_UNSENT;
+}
+
+//back to LoRa when the bulk link went quiet, the host out of range
+static void boot_bulk_poll(void)
+{
+    if(g_modem != MODEM_FSK || TimerGetElapsedTime(g_bulk_last_rx) < BOOT_BULK_IDLE_MS)
+        return;
+
+    printf("bulk idle\r\n");
+    g_modem = g_modem_next = MODEM_LORA;
+    Radio.Sleep();
+    lora_rx(0);
+}
+
+
+void OnTxDone( void )
+{
+    g_tx_done = 1;
+    if(g_modem_next != g_modem){
+        g_modem = g_modem_next;
+        g_bulk_last_rx = TimerGetCurrentTime();
+        Radio.Sleep();
+    }
+    lora_rx(0);
+    printf("%s\r\n", __func__);
+}
+
+void OnRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr )
+{
+    boot_rx_slot_t *slot;
+
+    lora_rx(0);
+    g_bulk_last_rx = TimerGetCurrentTime();
+    //queued, the frames of a window come back to back; dropped when all
+    //the slots wait, the bitmap of the window tells the host
+    if((uint8_t)(boot_rx_head - boot_rx_tail) >= BOOT_RX_SLOT_NUM)
+        return;
+    if(size > BOOT_RX_SLOT_SIZE)
+        size = BOOT_RX_SLOT_SIZE;
+
+    slot = &boot_rx_slots[boot_rx_head % BOOT_RX_SLOT_NUM];
+    memcpy(slot->data, payload, size);
+    slot->len = size;
+    boot_rx_head++;
+}
+
+void OnTxTimeout( void )
+{
+    lora_rx(0);
+    printf("%s\r\n", __func__);
+}
+
+void OnRxTimeout( void )
+{
+    lora_rx(0);
+    printf("%s\r\n", __func__);
+}
+
+void OnRxError( void )
+{
+    lora_rx(0);
+    printf("%s\r\n", __func__);
+}
+
+void lora_init()
+{
+    RadioEvents.TxDone = OnTxDone;
+    RadioEvents.RxDone = OnRxDone;
+    RadioEvents.TxTimeout = OnTxTimeout;
+    RadioEvents.RxTimeout = OnRxTimeout;
+    RadioEvents.RxError = OnRxError;
+
+    Radio.Init( &RadioEvents );
+    
+    Radio.SetChannel(g_freq);
+    
+    if(g_modem == MODEM_LORA) {
+        
+        Radio.SetTxConfig( MODEM_LORA, g_txp, 0, g_lora_bw,
+                                       g_lora_sf, g_lora_cr,
+                                       g_lora_preamble, LORA_FIX_LENGTH_PAYLOAD_ON,
+                                       true, 0, 0, g_lora_iqi, 6000 );
+    
+        Radio.SetRxConfig( MODEM_LORA, g_lora_bw, g_lora_sf,
+                                       g_lora_cr, 0, g_lora_preamble,
+                                       LORA_SYMBOL_TIMEOUT, LORA_FIX_LENGTH_PAYLOAD_ON,
+                                       0, true, 0, 0, g_lora_iqi, true );
+    }else{
+        Radio.SetTxConfig( MODEM_FSK, g_txp, g_fsk_dev, 0,
+                                      g_fsk_dr, 0,
+                                      g_fsk_preamble, FSK_FIX_LENGTH_PAYLOAD_ON,
+                                      true, 0, 0, 0, 6000 );
+    
+        Radio.SetRxConfig( MODEM_FSK, g_fsk_bw, g_fsk_dr,
+                                      0, g_fsk_afcbw, g_fsk_preamble,
+                                      0, FSK_FIX_LENGTH_PAYLOAD_ON, 0, true,
+                                      0, 0, false, true );
+    }
+
+    Radio.Rx( 0 );
+}
+
+void lora_tx(uint8_t *data, uint32_t size)
+{
+    if(g_modem == MODEM_LORA) {
+        
+        Radio.SetTxConfig( MODEM_LORA, g_txp, 0, g_lora_bw,
+                                       g_lora_sf, g_lora_cr,
+                                       g_lora_preamble, LORA_FIX_LENGTH_PAYLOAD_ON,
+                                       true, 0, 0, g_lora_iqi, 6000 );
+    
+        Radio.SetRxConfig( MODEM_LORA, g_lora_bw, g_lora_sf,
+                                       g_lora_cr, 0, g_lora_preamble,
+                                       LORA_SYMBOL_TIMEOUT, LORA_FIX_LENGTH_PAYLOAD_ON,
+                                       0, true, 0, 0, g_lora_iqi, true );
+    }else{
+        Radio.SetTxConfig( MODEM_FSK, g_txp, g_fsk_dev, 0,
+                                      g_fsk_dr, 0,
+                                      g_fsk_preamble, FSK_FIX_LENGTH_PAYLOAD_ON,
+                                      true, 0, 0, 0, 6000 );
+    
+        Radio.SetRxConfig( MODEM_FSK, g_fsk_bw, g_fsk_dr,
+                                      0, g_fsk_afcbw, g_fsk_preamble,
+                                      0, FSK_FIX_LENGTH_PAYLOAD_ON, 0, true,
+                                      0, 0, false, true );
+    }
+
+    g_tx_done = 0;
+    Radio.Send( data, size );
+}
+
+void lora_rx(uint32_t timeout)
+{
+    if(g_modem == MODEM_LORA) {
+        
+        Radio.SetTxConfig( MODEM_LORA, g_txp, 0, g_lora_bw,
                                        g_lora_sf, g_lora_cr,
                                        g_lora_preamble, LORA_FIX_LENGTH_PAYLOAD_ON,
                                        true, 0, 0, g_lora_iqi, 6000 );
@@ -525,13 +1892,22 @@ void boot_handle_cmd(void)
         int ret = 0;
       
         Radio.IrqProcess( );			
+        boot_erase_poll();
+        boot_bulk_poll();
+#ifdef CONFIG_BOOT_SIGNED
+        //a step of the signature check per pass, the frames wait meanwhile
+        if(EcdsaJobStep(&g_sign_job))
+            continue;
+#endif
 			
+        if(!boot_rx_next())
+            continue;
+
         //get requeset
         ret = get_request_from_lora((loader_req_t *)&g_request);
-        if(ret!=0) {
-            boot_buffer_clear();
+        boot_rx_release();
+        if(ret!=0)
             continue;
-        }
         
         //init the response
         memset((loader_res_t *)&g_response, 0, sizeof(loader_res_t));
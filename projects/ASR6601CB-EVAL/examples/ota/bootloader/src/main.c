@@ -84,9 +84,14 @@ int main(void)
     gpio_init(BOOT_MODE_GPIOX, BOOT_MODE_GPIO_PIN, GPIO_MODE_INPUT_PULL_UP); 
 
     mode_sel = boot_mode_sel();
+
+    //activation or rollback of the A/B slots, before A is checked
+    if ((BOOT_MODE_JUMP2APP == mode_sel) && !(SYSCFG->CR4 & BOOT_MODE_REG_BIT))
+        boot_slot_process();
+
     if ((BOOT_MODE_NO_JUMP == mode_sel) || 
         (SYSCFG->CR4 & BOOT_MODE_REG_BIT) ||
-        (*(volatile uint32_t *)(APP_START_ADDR) == *(volatile uint32_t *)(APP_START_ADDR+4))) {
+        (boot_app_check() != 0)) {
         SYSCFG->CR4 &= ~(BOOT_MODE_REG_BIT);
 
         boot_handle_cmd();
@@ -19,6 +19,17 @@
 #define LORA_AT_TX "+TX"
 #define LORA_AT_RX "+RX"
 
+// broadcast transfer, parity fragments added by the dongle
+#define LORA_AT_FECINIT "+FECINIT"
+#define LORA_AT_FRAG "+FRAG"
+#define LORA_AT_FECTX "+FECTX"
+
+// LoRa configurations scanned by CAD, see radio-cad.h
+#define LORA_AT_SCAN "+SCAN"
+
+// GFSK bulk profile of the bootloader BULK command, or back to LoRa
+#define LORA_AT_BULK "+BULK"
+
 
 void at_init(void);
 void at_process(void);
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include "at-engine.h"
 #include "at_command.h"
 #include "radio.h"
 
@@ -11,16 +12,6 @@
 
 #define PORT_LEN 4
 
-#define QUERY_CMD        0x01
-#define EXECUTE_CMD        0x02
-#define DESC_CMD        0x03
-#define SET_CMD            0x04
-
-typedef struct {
-    char *cmd;
-    int (*fn)(int opt, int argc, char *argv[]);    
-}at_cmd_t;
-
 volatile bool g_atcmd_processing = false;
 static uint8_t atcmd[ATCMD_SIZE];
 static uint16_t atcmd_index;
@@ -30,15 +21,26 @@ extern int at_freq(int opt, int argc, char *argv[]);
 extern int at_cfg(int opt, int argc, char *argv[]);
 extern int at_tx(int opt, int argc, char *argv[]);
 extern int at_rx(int opt, int argc, char *argv[]);
-
-static const at_cmd_t g_at_table[] = {
-    {LORA_AT_FREQ, at_freq},
-    {LORA_AT_CFG, at_cfg},
-    {LORA_AT_TX, at_tx},
-    {LORA_AT_RX, at_rx},
+extern int at_fecinit(int opt, int argc, char *argv[]);
+extern int at_frag(int opt, int argc, char *argv[]);
+extern int at_fectx(int opt, int argc, char *argv[]);
+extern int at_scan(int opt, int argc, char *argv[]);
+extern int at_bulk(int opt, int argc, char *argv[]);
+
+// Sorted by name, see AtEngineFind
+static const AtCmd_t g_at_table[] = {
+    AT_CMD_ENTRY(LORA_AT_BULK, at_bulk),
+    AT_CMD_ENTRY(LORA_AT_CFG, at_cfg),
+    AT_CMD_ENTRY(LORA_AT_FECINIT, at_fecinit),
+    AT_CMD_ENTRY(LORA_AT_FECTX, at_fectx),
+    AT_CMD_ENTRY(LORA_AT_FRAG, at_frag),
+    AT_CMD_ENTRY(LORA_AT_FREQ, at_freq),
+    AT_CMD_ENTRY(LORA_AT_RX, at_rx),
+    AT_CMD_ENTRY(LORA_AT_SCAN, at_scan),
+    AT_CMD_ENTRY(LORA_AT_TX, at_tx),
 };
 
-#define AT_TABLE_SIZE    (sizeof(g_at_table) / sizeof(at_cmd_t))
+static const AtTable_t g_at_cmds = AT_TABLE(g_at_table);
 
 // this can be in intrpt context
 void serial_input(uint8_t cmd)
@@ -73,9 +75,6 @@ int serial_output(uint8_t *buffer, int len)
 
 void at_process(void)
 {
-    char *ptr = NULL;
-	int argc = 0;
-	int index = 0;
 	char *argv[ARGC_LIMIT];
     int ret = -1;
     uint8_t *rxcmd = atcmd + 2;
@@ -93,41 +92,7 @@ void at_process(void)
 
     g_atcmd_processing = true;
     
-    if(atcmd[0] != 'A' || atcmd[1] != 'T')
-        goto at_end;
-    for (index = 0; index < AT_TABLE_SIZE; index++) {
-        int cmd_len = strlen(g_at_table[index].cmd);
-    	if (!strncmp((const char *)rxcmd, g_at_table[index].cmd, cmd_len)) {
-    		ptr = (char *)rxcmd + cmd_len;
-    		break;
-    	}
-    }
-	if (index >= AT_TABLE_SIZE || !g_at_table[index].fn)
-        goto at_end;
-
-    if ((ptr[0] == '?') && (ptr[1] == '\0')) {
-		ret = g_at_table[index].fn(QUERY_CMD, argc, argv);
-	} else if (ptr[0] == '\0') {
-		ret = g_at_table[index].fn(EXECUTE_CMD, argc, argv);
-	}  else if (ptr[0] == ' ') {
-        argv[argc++] = ptr;
-		ret = g_at_table[index].fn(EXECUTE_CMD, argc, argv);
-	} else if ((ptr[0] == '=') && (ptr[1] == '?') && (ptr[2] == '\0')) {
-        ret = g_at_table[index].fn(DESC_CMD, argc, argv);
-	} else if (ptr[0] == '=') {
-		ptr += 1;
-        
-        char *str = strtok((char *)ptr, ",");
-        while(str) {
-            argv[argc++] = str;
-            str = strtok((char *)NULL, ",");
-        }
-		ret = g_at_table[index].fn(SET_CMD, argc, argv);
-	} else {
-		ret = -1;
-	}
-
-at_end:
+    ret = AtEngineRun(&g_at_cmds, (char *)atcmd, argv, ARGC_LIMIT);
 	if (-1 == ret)
         snprintf((char *)atcmd, ATCMD_SIZE, "\r\n%s%x\r\n", AT_ERROR, 1);
           
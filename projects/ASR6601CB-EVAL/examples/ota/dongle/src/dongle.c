@@ -26,6 +26,9 @@
 #include "delay.h"
 #include "timer.h"
 #include "radio.h"
+#include "radio-cad.h"
+#include "tremo_crc.h"
+#include "at-engine.h"
 #include "at_command.h"
 
 
@@ -47,6 +50,15 @@
 
 #define FSK_FIX_LENGTH_PAYLOAD_ON                   false
 
+//bulk transfer profile, as the bootloader BULK command sets it
+#define BULK_FSK_DR                                 250000
+#define BULK_FSK_DEV                                62500
+#define BULK_FSK_BW                                 400000
+#define BULK_FSK_PREAMBLE                           8
+
+#define SCAN_CONFIG_MAX                             5
+#define SCAN_CAD_SYMBOLS                            2
+
 //global variables
 static RadioEvents_t RadioEvents;
 static uint32_t g_freq = RF_FREQUENCY;
@@ -62,6 +74,8 @@ static uint32_t g_fsk_dr = 50000;
 static uint32_t g_fsk_dev = 25000;
 static uint32_t g_fsk_preamble = 5;
 static uint32_t g_fsk_afcbw = 166666;
+static RadioCadScanConfig_t g_scan_configs[SCAN_CONFIG_MAX];
+static RadioCadScan_t g_scan;
 
 void lora_tx(uint8_t *data, uint32_t size);
 void lora_rx(uint32_t timeout);
@@ -74,7 +88,9 @@ void OnTxDone( void )
 
 void OnRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr )
 {
+#ifndef CONFIG_LORA_RX_RING
     lora_rx( 0 );
+#endif
     
     printf("\r\nAT+DATA=0,%d,%d,%u,", snr, rssi, size);
     for(int i=0; i<size; i++)
@@ -100,42 +116,6 @@ void OnRxError( void )
     printf("\r\nAT+DATA=2\r\n");
 }
 
-static int hex2bin(const char *hex, uint8_t *bin, uint16_t bin_length)
-{
-    uint16_t hex_length = strlen(hex);
-    const char *hex_end = hex + hex_length;
-    uint8_t *cur = bin;
-    uint8_t num_chars = hex_length & 1;
-    uint8_t byte = 0;
-
-    if ((hex_length + 1) / 2 > bin_length) {
-        return -1;
-    }
-
-    while (hex < hex_end) {
-        if ('A' <= *hex && *hex <= 'F') {
-            byte |= 10 + (*hex - 'A');
-        } else if ('a' <= *hex && *hex <= 'f') {
-            byte |= 10 + (*hex - 'a');
-        } else if ('0' <= *hex && *hex <= '9') {
-            byte |= *hex - '0';
-        } else {
-            return -1;
-        }
-        hex++;
-        num_chars++;
-
-        if (num_chars >= 2) {
-            num_chars = 0;
-            *cur++ = byte;
-            byte = 0;
-        } else {
-            byte <<= 4;
-        }
-    }
-    return cur - bin;
-}
-
 int at_freq(int opt, int argc, char *argv[])
 {
     if(argc<1)
@@ -182,12 +162,75 @@ int at_cfg(int opt, int argc, char *argv[])
     return 0;
 }
 
+static void scan_done(RadioCadScan_t *scan, const RadioCadScanConfig_t *config, RadioJob_t *rx, RadioJobStatus_t status)
+{
+    if(status != RADIO_JOB_OK)
+        return;
+
+    printf("\r\nAT+SCAN=%u,%d,%d,%u,", (unsigned)(config - scan->Configs), rx->Snr, rx->Rssi, rx->PayloadSize);
+    for(int i=0; i<rx->PayloadSize; i++)
+        printf("%02X", rx->Payload[i]);
+    printf("\r\n");
+}
+
+//back to the plain Radio driver for the other commands
+static void scan_stop(void)
+{
+    if(!g_scan.Running)
+        return;
+
+    RadioCadScanStop(&g_scan);
+    Radio.Init(&RadioEvents);
+    Radio.SetChannel(g_freq);
+}
+
+int at_scan(int opt, int argc, char *argv[])
+{
+    uint8_t count = argc / 3;
+
+    //AT+SCAN=<freq>,<bw>,<sf>[,<freq>,<bw>,<sf>...], AT+SCAN=0 stops
+    if(argc == 1 && strtol(argv[0], NULL, 0) == 0) {
+        scan_stop();
+        lora_rx(0);
+        printf("\r\nOK\r\n");
+        return 0;
+    }
+    if(count == 0 || count > SCAN_CONFIG_MAX || argc != count * 3)
+        return -1;
+
+    scan_stop();
+    for(int i=0; i<count; i++) {
+        g_scan_configs[i].Frequency = strtol(argv[i * 3], NULL, 0);
+        g_scan_configs[i].Bandwidth = strtol(argv[i * 3 + 1], NULL, 0);
+        g_scan_configs[i].Datarate = strtol(argv[i * 3 + 2], NULL, 0);
+        g_scan_configs[i].Coderate = g_lora_cr;
+    }
+
+    g_scan.Configs = g_scan_configs;
+    g_scan.ConfigCount = count;
+    g_scan.Symbols = SCAN_CAD_SYMBOLS;
+    g_scan.PreambleLen = g_lora_preamble;
+    g_scan.IqInverted = g_lora_iqi;
+    g_scan.Period = 0;
+    g_scan.RxTimeout = 0;
+    g_scan.Done = scan_done;
+
+    RadioSchedInit();
+    RadioCadScanStart(&g_scan);
+
+    //preamble the senders of each configuration need to be caught
+    for(int i=0; i<count; i++)
+        printf("\r\n+SCAN:%d,%u\r\n", i, RadioCadScanPreambleLength(&g_scan, &g_scan_configs[i]));
+    printf("\r\nOK\r\n");
+    return 0;
+}
+
 int at_tx(int opt, int argc, char *argv[])
 {
     int len, bin_len;
     uint8_t data[256];
     len = strtol((const char *)argv[0], NULL, 0);
-    bin_len = hex2bin((const char *)argv[1], data, len);
+    bin_len = AtEngineHex2Bin((const char *)argv[1], data, len);
     
     if(bin_len>0) {
         lora_tx( data, bin_len );
@@ -206,8 +249,191 @@ int at_rx(int opt, int argc, char *argv[])
     return 0;
 }
 
+//AT+BULK=1 once the bootloader answered BULK 1, AT+BULK=0 once it answered
+//BULK 0; the LoRa settings are kept for the way back
+int at_bulk(int opt, int argc, char *argv[])
+{
+    uint32_t mode;
+
+    if(argc<1)
+        return -1;
+
+    mode = strtol(argv[0], NULL, 0);
+    if(mode > 1)
+        return -1;
+
+    if(mode) {
+        g_fsk_bw = BULK_FSK_BW;
+        g_fsk_dr = BULK_FSK_DR;
+        g_fsk_dev = BULK_FSK_DEV;
+        g_fsk_preamble = BULK_FSK_PREAMBLE;
+        g_fsk_afcbw = BULK_FSK_BW;
+        g_modem = MODEM_FSK;
+    }else{
+        g_modem = MODEM_LORA;
+    }
+
+    lora_rx(0);
+    printf("\r\nOK\r\n");
+    return 0;
+}
+
+//broadcast session: the fragments go out as bootloader FRAG frames and the
+//parity fragments are accumulated on the way, see bootloader.h
+#define FEC_CMD_FRAG            21
+#define FEC_FRAG_HDR_SIZE       4
+#define FEC_FRAG_MAX            1024
+#define FEC_FRAG_SIZE_MAX       232
+#define FEC_PARITY_MAX          16
+
+static uint8_t g_fec_session;
+static uint16_t g_fec_nb_frag;
+static uint8_t g_fec_frag_size;
+static uint8_t g_fec_redundancy;
+static uint8_t g_fec_rows[FEC_PARITY_MAX][FEC_FRAG_MAX / 8];
+static uint8_t g_fec_parity[FEC_PARITY_MAX][FEC_FRAG_SIZE_MAX];
+static uint8_t g_fec_frame[9 + FEC_FRAG_HDR_SIZE + FEC_FRAG_SIZE_MAX];
+
+static uint32_t crc32(uint8_t *data, uint32_t size)
+{
+    uint32_t crc_value = 0;
+
+    //CRC-32, as the bootloader
+    crc_config_t config;
+    config.init_value = 0xFFFFFFFF;
+    config.poly_size = CRC_POLY_SIZE_32;
+    config.poly = 0x04C11DB7;
+    config.reverse_in = CRC_CR_REVERSE_IN_BYTE;
+    config.reverse_out = true;
+
+    crc_init(&config);
+
+    crc_value = crc_calc8(data, size);
+    crc_value ^= 0xFFFFFFFF;
+
+    return crc_value;
+}
+
+static uint32_t fec_prbs23(uint32_t x)
+{
+    uint32_t b0 = x & 0x01;
+    uint32_t b1 = (x & 0x20) >> 5;
+
+    return (x >> 1) + ((b0 ^ b1) << 22);
+}
+
+//data fragments of the parity fragment n, from 1, the bootloader draws the same
+static void fec_parity_row(uint16_t n, uint16_t m, uint8_t *row)
+{
+    uint32_t x = 1 + 1001 * (uint32_t)n;
+    uint32_t mod = m + (((m & (m - 1)) == 0) ? 1 : 0);
+    uint32_t r;
+    uint16_t coeff;
+
+    memset(row, 0, (m + 7) / 8);
+    for(coeff = 0; coeff < (m >> 1); coeff++){
+        do{
+            x = fec_prbs23(x);
+            r = x % mod;
+        }while(r >= m);
+        row[r >> 3] |= 1 << (r & 7);
+    }
+}
+
+static void fec_send(uint16_t index, const uint8_t *data)
+{
+    uint16_t len = FEC_FRAG_HDR_SIZE + g_fec_frag_size;
+    uint32_t crc;
+
+    g_fec_frame[0] = 0xFE;
+    g_fec_frame[1] = FEC_CMD_FRAG;
+    g_fec_frame[2] = len & 0xFF;
+    g_fec_frame[3] = (len >> 8) & 0xFF;
+    g_fec_frame[4] = g_fec_session;
+    g_fec_frame[5] = 0;
+    g_fec_frame[6] = index & 0xFF;
+    g_fec_frame[7] = (index >> 8) & 0xFF;
+    memcpy(g_fec_frame + 4 + FEC_FRAG_HDR_SIZE, data, g_fec_frag_size);
+
+    crc = crc32(g_fec_frame, 4 + len);
+    memcpy(g_fec_frame + 4 + len, &crc, sizeof(crc));
+    g_fec_frame[8 + len] = 0xEF;
+
+    lora_tx(g_fec_frame, 9 + len);
+}
+
+int at_fecinit(int opt, int argc, char *argv[])
+{
+    uint32_t nb_frag, frag_size, redundancy;
+
+    if(argc<4)
+        return -1;
+
+    nb_frag = strtol(argv[1], NULL, 0);
+    frag_size = strtol(argv[2], NULL, 0);
+    redundancy = strtol(argv[3], NULL, 0);
+    if(nb_frag == 0 || nb_frag > FEC_FRAG_MAX || frag_size == 0 || frag_size > FEC_FRAG_SIZE_MAX
+        || (frag_size & 7) || redundancy > FEC_PARITY_MAX)
+        return -1;
+
+    g_fec_session = strtol(argv[0], NULL, 0);
+    g_fec_nb_frag = nb_frag;
+    g_fec_frag_size = frag_size;
+    g_fec_redundancy = redundancy;
+    for(int n=0; n<redundancy; n++)
+        fec_parity_row(n + 1, nb_frag, g_fec_rows[n]);
+    memset(g_fec_parity, 0, sizeof(g_fec_parity));
+
+    printf("\r\nOK\r\n");
+    return 0;
+}
+
+int at_frag(int opt, int argc, char *argv[])
+{
+    uint8_t data[FEC_FRAG_SIZE_MAX];
+    uint32_t index;
+    int bin_len;
+
+    if(argc<2 || g_fec_frag_size == 0)
+        return -1;
+
+    index = strtol(argv[0], NULL, 0);
+    bin_len = AtEngineHex2Bin((const char *)argv[1], data, g_fec_frag_size);
+    if(index >= g_fec_nb_frag || bin_len <= 0)
+        return -1;
+    //the tail of the last fragment is programmed as erased flash
+    memset(data + bin_len, 0xFF, g_fec_frag_size - bin_len);
+
+    for(int n=0; n<g_fec_redundancy; n++){
+        if(!(g_fec_rows[n][index >> 3] & (1 << (index & 7))))
+            continue;
+        for(int i=0; i<g_fec_frag_size; i++)
+            g_fec_parity[n][i] ^= data[i];
+    }
+
+    fec_send(index, data);
+    return 0;
+}
+
+int at_fectx(int opt, int argc, char *argv[])
+{
+    uint32_t n;
+
+    if(argc<1)
+        return -1;
+
+    //parity n, from 1, once all the fragments went out
+    n = strtol(argv[0], NULL, 0);
+    if(n == 0 || n > g_fec_redundancy)
+        return -1;
+
+    fec_send(g_fec_nb_frag + n - 1, g_fec_parity[n - 1]);
+    return 0;
+}
+
 void lora_tx(uint8_t *data, uint32_t size)
 {
+    scan_stop();
     Radio.Sleep();
     
     Radio.SetChannel(g_freq);
@@ -229,6 +455,7 @@ void lora_tx(uint8_t *data, uint32_t size)
 
 void lora_rx(uint32_t timeout)
 {
+    scan_stop();
     Radio.Sleep();
     
     if(g_modem == MODEM_LORA) {
@@ -259,6 +486,10 @@ int app_start( void )
     RadioEvents.RxError = OnRxError;
 
     Radio.Init( &RadioEvents );
+#ifdef CONFIG_LORA_RX_RING
+    // The RX stays continuous, the packets are captured from the interrupt
+    Radio.SetRxRing( true );
+#endif
     
     Radio.SetChannel(g_freq);
     
@@ -289,7 +520,9 @@ int app_start( void )
 
     at_init();
     while( 1 ) {
-        if( Radio.IrqProcess != NULL ) {
+        if( g_scan.Running ) {
+            RadioSchedProcess( );
+        } else if( Radio.IrqProcess != NULL ) {
             Radio.IrqProcess( );
         }
         
@@ -42,6 +42,7 @@ void board_init()
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_GPIOB, true);
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_GPIOC, true);
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_GPIOD, true);
+    rcc_enable_peripheral_clk(RCC_PERIPHERAL_CRC, true);
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_RTC, true);
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_SAC, true);
     rcc_enable_peripheral_clk(RCC_PERIPHERAL_LORA, true);
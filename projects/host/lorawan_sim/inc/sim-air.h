@@ -0,0 +1,131 @@
+/*!
+ * \file      sim-air.h
+ *
+ * \brief     Channel model of the host simulation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA_SIM
+ *
+ *            One gateway hears every device. A device has a mean link SNR
+ *            drawn at start up, each packet adds the TX power offset from
+ *            14 dBm and a normal fading. A packet is lost:
+ *            - when it overlaps a packet on the same frequency, spreading
+ *              factor and bandwidth that is not SIM_AIR_CAPTURE dB weaker,
+ *            - when it overlaps a gateway transmission, the gateway being
+ *              half duplex,
+ *            - when its SNR is below the demodulation floor of its
+ *              spreading factor,
+ *            - by the packet error rate.
+ *
+ * \{
+ */
+#ifndef __SIM_AIR_H__
+#define __SIM_AIR_H__
+
+#include "sim.h"
+
+/*!
+ * Power margin over the interferers for a packet to survive a collision [dB]
+ */
+#define SIM_AIR_CAPTURE                             6.0f
+
+typedef struct
+{
+    uint32_t Device;
+    uint32_t Frequency;
+    uint8_t Sf;
+    /*!
+     * Bandwidth, 0: 125 kHz, 1: 250 kHz, 2: 500 kHz
+     */
+    uint8_t Bandwidth;
+    SimTime_t Start;
+    SimTime_t End;
+    /*!
+     * SNR at the receiver [dB]
+     */
+    float Snr;
+    /*!
+     * Lost in a collision or while the gateway transmitted
+     */
+    bool Collided;
+}SimAirTx_t;
+
+int SimAirInit( uint32_t devices );
+
+void SimAirDeInit( void );
+
+/*!
+ * \brief Computes the time on air of a LoRa packet, explicit header and
+ *        LowDatarateOptimize from 16.38 ms symbols as set by the SX126x driver
+ *
+ * \param [IN] sf          Spreading factor
+ * \param [IN] bandwidth   Bandwidth, 0: 125 kHz, 1: 250 kHz, 2: 500 kHz
+ * \param [IN] coderate    Coding rate, 1: 4/5 to 4: 4/8
+ * \param [IN] preambleLen Preamble length [symbols]
+ * \param [IN] crcOn       Payload CRC
+ * \param [IN] size        Payload size
+ *
+ * \retval airTime         Time on air [us]
+ */
+SimTime_t SimAirTime( uint8_t sf, uint8_t bandwidth, uint8_t coderate, uint16_t preambleLen, bool crcOn, uint8_t size );
+
+/*!
+ * \brief Symbol time [us]
+ */
+uint32_t SimAirSymbolTime( uint8_t sf, uint8_t bandwidth );
+
+/*!
+ * \brief Mean link SNR of a device at 14 dBm [dB]
+ */
+float SimAirLinkSnr( uint32_t device );
+
+/*!
+ * \brief SNR of a packet over the link of a device [dB]
+ *
+ * \param [IN] device  Device index
+ * \param [IN] power   TX power [dBm]
+ */
+float SimAirPacketSnr( uint32_t device, int8_t power );
+
+/*!
+ * \brief Lowest SNR demodulated at a spreading factor [dB]
+ */
+float SimAirSnrFloor( uint8_t sf );
+
+/*!
+ * \brief Puts a transmission on the air and resolves its collisions with
+ *        the ones already there
+ *
+ * \param [IN] tx      Transmission, kept by the caller until its end
+ */
+void SimAirStart( SimAirTx_t *tx );
+
+/*!
+ * \brief Takes a transmission off the air at its end
+ *
+ * \param [IN] tx      Transmission
+ *
+ * \retval received    true when the packet is received
+ */
+bool SimAirEnd( SimAirTx_t *tx );
+
+/*!
+ * \brief Books a gateway transmission, the uplinks overlapping it are lost
+ *
+ * \param [IN] start   Start time, in the future
+ * \param [IN] end     End time
+ * \param [IN] frequency Frequency [Hz]
+ *
+ * \retval booked      false when the gateway already transmits then
+ */
+bool SimAirGatewayTx( SimTime_t start, SimTime_t end, uint32_t frequency );
+
+/*!
+ * \brief Tells if a frequency is in use at the current time
+ */
+bool SimAirBusy( uint32_t frequency );
+
+/*! \} addtogroup LORA_SIM */
+
+#endif // __SIM_AIR_H__
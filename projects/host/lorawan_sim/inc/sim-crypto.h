@@ -0,0 +1,33 @@
+/*!
+ * \file      sim-crypto.h
+ *
+ * \brief     Software AES-128 of the host simulation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA_SIM
+ *
+ *            Replaces the AES engine behind AesEcbEncrypt and
+ *            AES_CMAC_Digest, and adds the inverse cipher the network server
+ *            needs to build the join accepts.
+ *
+ * \{
+ */
+#ifndef __SIM_CRYPTO_H__
+#define __SIM_CRYPTO_H__
+
+#include <stdint.h>
+
+/*!
+ * \brief Decrypts blocks with AES-128 in ECB mode
+ *
+ * \param [IN]  key    Key, 16 bytes
+ * \param [IN]  in     Input, a multiple of 16 bytes
+ * \param [IN]  size   Input size
+ * \param [OUT] out    Output, may be in
+ */
+void SimAesEcbDecrypt( const uint8_t *key, const uint8_t *in, uint16_t size, uint8_t *out );
+
+/*! \} addtogroup LORA_SIM */
+
+#endif // __SIM_CRYPTO_H__
@@ -0,0 +1,94 @@
+/*!
+ * \file      sim-network.h
+ *
+ * \brief     Network server model of the host simulation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA_SIM
+ *
+ *            Answers the join requests with a join accept in RX1, checks
+ *            the MIC and the counter of the data uplinks, acknowledges the
+ *            confirmed ones and runs the usual ADR on the SNR of the last
+ *            SIM_NETWORK_ADR_HISTORY uplinks, sent as a LinkADRReq in the
+ *            FOpts of a downlink. The downlinks only use RX1 of the EU868
+ *            region, on the uplink frequency and datarate.
+ *
+ * \{
+ */
+#ifndef __SIM_NETWORK_H__
+#define __SIM_NETWORK_H__
+
+#include "sim.h"
+#include "sim-air.h"
+
+/*!
+ * Uplinks whose SNR is kept for the ADR
+ */
+#define SIM_NETWORK_ADR_HISTORY                     20
+
+/*!
+ * ADR installation margin [dB]
+ */
+#define SIM_NETWORK_ADR_MARGIN                      10.0f
+
+/*!
+ * \brief Downlink waiting for the RX window of its device
+ */
+typedef struct
+{
+    bool Pending;
+    /*!
+     * Transmission, Snr is the SNR at the device
+     */
+    SimAirTx_t Tx;
+    uint16_t PreambleLen;
+    uint8_t Size;
+    uint8_t Payload[64];
+}SimDownlink_t;
+
+int SimNetworkInit( uint32_t devices );
+
+void SimNetworkDeInit( void );
+
+/*!
+ * \brief Identity and keys of a device, shared with its application
+ *
+ * \param [IN]  device Device index
+ * \param [OUT] devEui DevEUI, 8 bytes
+ * \param [OUT] appEui AppEUI, 8 bytes
+ * \param [OUT] appKey AppKey, 16 bytes
+ */
+void SimNetworkDeviceKeys( uint32_t device, uint8_t *devEui, uint8_t *appEui, uint8_t *appKey );
+
+/*!
+ * \brief Creates the session of a device activated by personalization
+ *
+ * \param [IN]  device  Device index
+ * \param [OUT] devAddr Device address
+ * \param [OUT] nwkSKey Network session key, 16 bytes
+ * \param [OUT] appSKey Application session key, 16 bytes
+ */
+void SimNetworkAbpSession( uint32_t device, uint32_t *devAddr, uint8_t *nwkSKey, uint8_t *appSKey );
+
+/*!
+ * \brief Processes an uplink received by the gateway, at its end
+ *
+ * \param [IN] tx      Transmission
+ * \param [IN] payload PHY payload
+ * \param [IN] size    PHY payload size
+ */
+void SimNetworkUplink( const SimAirTx_t *tx, const uint8_t *payload, uint8_t size );
+
+/*!
+ * \brief Gets the downlink pending for a device
+ *
+ * \param [IN] device  Device index
+ *
+ * \retval downlink    Downlink, NULL when none
+ */
+SimDownlink_t *SimNetworkDownlink( uint32_t device );
+
+/*! \} addtogroup LORA_SIM */
+
+#endif // __SIM_NETWORK_H__
@@ -0,0 +1,253 @@
+/*!
+ * \file      sim.h
+ *
+ * \brief     Host simulation of the LoRaWAN stack
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \addtogroup LORA_SIM
+ *
+ *            Runs many instances of the unmodified LoRaMac, region and timer
+ *            code on the host, in a virtual time advanced from event to
+ *            event. The stack keeps its state in static variables, the
+ *            simulation links it with device.ld so that all of them land in
+ *            the sim_device section, which is swapped with the context of
+ *            the device to run before each of its events.
+ *
+ *            The hardware boundaries are replaced: the Radio driver by
+ *            sim-radio.c, rtc-board.c by the virtual clock of sim.c and the
+ *            AES engine by sim-crypto.c. The uplinks go through the channel
+ *            model of sim-air.c to the network server of sim-network.c.
+ *
+ * \{
+ */
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * Virtual time [us]
+ */
+typedef uint64_t SimTime_t;
+
+#define SIM_TIME_NEVER                              UINT64_MAX
+
+#define SIM_MS( ms )                                ( ( SimTime_t )( ms ) * 1000 )
+#define SIM_S( s )                                  ( ( SimTime_t )( s ) * 1000000 )
+
+typedef enum
+{
+    /*!
+     * The devices join, the run ends once all of them have
+     */
+    SIM_SCENARIO_JOIN = 0,
+    /*!
+     * The devices join and send with ADR until the end of the run
+     */
+    SIM_SCENARIO_ADR,
+    /*!
+     * The devices join and send as often as the period and the duty cycle
+     * allow until the end of the run
+     */
+    SIM_SCENARIO_THROUGHPUT,
+}SimScenario_t;
+
+/*!
+ * Run parameters, from the command line
+ */
+typedef struct
+{
+    SimScenario_t Scenario;
+    uint32_t Devices;
+    /*!
+     * Simulated time [s]
+     */
+    uint32_t Duration;
+    /*!
+     * The devices start at random within this window [s]
+     */
+    uint32_t StartWindow;
+    /*!
+     * Uplink period [s], 0 to send again as soon as the previous uplink is
+     * confirmed
+     */
+    uint32_t Period;
+    uint8_t PayloadSize;
+    bool Confirmed;
+    /*!
+     * Sessions activated by personalization, no join
+     */
+    bool Abp;
+    bool Adr;
+    /*!
+     * Datarate of the uplinks without ADR
+     */
+    int8_t Datarate;
+    /*!
+     * Mean link SNR of the devices at 14 dBm, uniform in [SnrMin, SnrMax] [dB]
+     */
+    float SnrMin;
+    float SnrMax;
+    /*!
+     * Standard deviation of the per packet fading [dB]
+     */
+    float Fading;
+    /*!
+     * Packet error rate on top of the collisions and the link budget
+     */
+    float Per;
+    uint32_t Seed;
+    bool Verbose;
+}SimOptions_t;
+
+/*!
+ * Counters of a device
+ */
+typedef struct
+{
+    /*!
+     * Time of the join, SIM_TIME_NEVER while not joined
+     */
+    SimTime_t JoinTime;
+    uint32_t JoinRequests;
+    /*!
+     * Frames transmitted, join requests included
+     */
+    uint32_t Uplinks;
+    /*!
+     * Frames received by the gateway
+     */
+    uint32_t UplinksReceived;
+    /*!
+     * Frames lost in a collision or while the gateway transmitted
+     */
+    uint32_t Collisions;
+    /*!
+     * Frames lost below the demodulation floor or by the packet error rate
+     */
+    uint32_t Faded;
+    /*!
+     * Downlinks sent by the gateway and received by the device
+     */
+    uint32_t DownlinksSent;
+    uint32_t DownlinksReceived;
+    /*!
+     * Data frames confirmed by the MAC, received by the network server and
+     * their payload bytes
+     */
+    uint32_t DataSent;
+    uint32_t DataReceived;
+    uint32_t BytesReceived;
+    /*!
+     * Uplink air time [us]
+     */
+    SimTime_t AirTime;
+    /*!
+     * Datarate and TX power index of the last data uplink
+     */
+    int8_t Datarate;
+    int8_t TxPower;
+    /*!
+     * ADR changes and the data uplink count at the last one
+     */
+    uint32_t AdrChanges;
+    uint32_t AdrConvergedAt;
+}SimDeviceStats_t;
+
+extern SimOptions_t SimOptions;
+
+extern SimDeviceStats_t *SimStats;
+
+/*!
+ * Device whose context is loaded
+ */
+extern uint32_t SimCurrent;
+
+/*!
+ * Devices joined. The variables of the device code are swapped with the
+ * contexts, the shared counters live in the simulator
+ */
+extern uint32_t SimJoined;
+
+/*!
+ * \brief Allocates the contexts, initializes the channel, the network server
+ *        and every device
+ *
+ * \retval status      0, -1 on an allocation failure
+ */
+int SimInit( void );
+
+/*!
+ * \brief Runs the events until the end of the duration or SimStop
+ *
+ * \retval events      Number of events processed
+ */
+uint64_t SimRun( void );
+
+/*!
+ * \brief Ends the run after the current event
+ */
+void SimStop( void );
+
+/*!
+ * \brief Frees the contexts, the channel and the network server
+ */
+void SimDeInit( void );
+
+SimTime_t SimNow( void );
+
+/*!
+ * \brief Sets the RTC alarm of the current device
+ *
+ * \param [IN] time    Alarm time, SIM_TIME_NEVER to stop it
+ */
+void SimSetAlarm( SimTime_t time );
+
+/*!
+ * \brief Sets the time of the next radio event of the current device
+ *
+ * \param [IN] time    Event time, SIM_TIME_NEVER when none
+ */
+void SimSetRadioEvent( SimTime_t time );
+
+/*!
+ * \brief Shared random generator of the channel model
+ */
+uint32_t SimRandom( void );
+
+/*!
+ * \brief Uniform random number in [0, 1)
+ */
+float SimUniform( void );
+
+/*!
+ * \brief Normal random number, mean 0 and standard deviation 1
+ */
+float SimGaussian( void );
+
+/*!
+ * \brief Sets up the application of the current device, from its fresh
+ *        context. Implemented by sim-device.c
+ *
+ * \param [IN] device  Device index
+ */
+void SimDeviceInit( uint32_t device );
+
+/*!
+ * \brief Initializes the radio of the device, implemented by sim-radio.c
+ */
+int SimRadioInit( uint32_t devices );
+
+/*!
+ * \brief Processes the due radio event of the current device, implemented
+ *        by sim-radio.c
+ */
+void SimRadioProcess( void );
+
+void SimRadioDeInit( void );
+
+/*! \} addtogroup LORA_SIM */
+
+#endif // __SIM_H__
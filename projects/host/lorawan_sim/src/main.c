@@ -0,0 +1,265 @@
+/*!
+ * \file      main.c
+ *
+ * \brief     Host simulation of the LoRaWAN stack, command line and report
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sim.h"
+
+static void Usage( const char *name )
+{
+    printf( "Usage: %s [options]\r\n"
+            "  -s join|adr|throughput  scenario (join)\r\n"
+            "  -n devices              number of devices (100)\r\n"
+            "  -t seconds              simulated time (3600, 86400 for adr)\r\n"
+            "  -w seconds              start window of the devices (60)\r\n"
+            "  -p seconds              uplink period, 0 as fast as allowed (300, 0 for throughput)\r\n"
+            "  -l bytes                payload size (10)\r\n"
+            "  -d datarate             datarate without ADR (5)\r\n"
+            "  -c                      confirmed uplinks\r\n"
+            "  -a                      activation by personalization\r\n"
+            "  -A                      ADR off\r\n"
+            "  -m dB                   lowest mean link SNR (-20)\r\n"
+            "  -M dB                   highest mean link SNR (10)\r\n"
+            "  -f dB                   fading standard deviation (2)\r\n"
+            "  -e rate                 packet error rate (0)\r\n"
+            "  -r seed                 random seed (1)\r\n"
+            "  -v                      per device report\r\n", name );
+}
+
+static int CompareTime( const void *a, const void *b )
+{
+    SimTime_t ta = *( const SimTime_t * )a;
+    SimTime_t tb = *( const SimTime_t * )b;
+
+    return ( ta > tb ) - ( ta < tb );
+}
+
+static double Percent( uint64_t part, uint64_t total )
+{
+    return ( total > 0 ) ? ( 100.0 * part / total ) : 0.0;
+}
+
+/*!
+ * \brief Prints the summary of the run, then the same as a JSON line
+ */
+static void Report( const char *scenario, uint64_t events, double wall )
+{
+    SimDeviceStats_t total;
+    SimTime_t *joinTimes = malloc( SimOptions.Devices * sizeof( SimTime_t ) );
+    uint32_t datarates[8] = { 0 };
+    uint32_t joined = 0;
+    uint32_t converged = 0;
+    uint64_t convergedAt = 0;
+    double simulated = SimNow( ) / 1e6;
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+
+    memset( &total, 0, sizeof( total ) );
+    for( uint32_t i = 0; i < SimOptions.Devices; i++ )
+    {
+        SimDeviceStats_t *stats = &SimStats[i];
+
+        total.JoinRequests += stats->JoinRequests;
+        total.Uplinks += stats->Uplinks;
+        total.UplinksReceived += stats->UplinksReceived;
+        total.Collisions += stats->Collisions;
+        total.Faded += stats->Faded;
+        total.DownlinksSent += stats->DownlinksSent;
+        total.DownlinksReceived += stats->DownlinksReceived;
+        total.DataSent += stats->DataSent;
+        total.DataReceived += stats->DataReceived;
+        total.BytesReceived += stats->BytesReceived;
+        total.AirTime += stats->AirTime;
+        total.AdrChanges += stats->AdrChanges;
+        if( stats->JoinTime != SIM_TIME_NEVER )
+        {
+            if( joinTimes != NULL )
+            {
+                joinTimes[joined] = stats->JoinTime;
+            }
+            joined++;
+        }
+        if( stats->DataSent > 0 )
+        {
+            datarates[stats->Datarate & 0x07]++;
+        }
+        if( stats->AdrChanges > 0 )
+        {
+            converged++;
+            convergedAt += stats->AdrConvergedAt;
+        }
+        if( SimOptions.Verbose == true )
+        {
+            printf( "device %u: join %.3f s, %u join requests, %u uplinks, %u received, %u collided, %u faded, "
+                    "%u data, DR%d, TX power %d, %u ADR changes\r\n",
+                    i, ( stats->JoinTime != SIM_TIME_NEVER ) ? stats->JoinTime / 1e6 : -1.0, stats->JoinRequests,
+                    stats->Uplinks, stats->UplinksReceived, stats->Collisions, stats->Faded, stats->DataSent,
+                    stats->Datarate, stats->TxPower, stats->AdrChanges );
+        }
+    }
+    if( ( joinTimes != NULL ) && ( joined > 0 ) )
+    {
+        qsort( joinTimes, joined, sizeof( SimTime_t ), CompareTime );
+        p50 = joinTimes[( joined - 1 ) / 2] / 1e6;
+        p90 = joinTimes[( uint32_t )( ( joined - 1 ) * 0.9 )] / 1e6;
+        p99 = joinTimes[( uint32_t )( ( joined - 1 ) * 0.99 )] / 1e6;
+    }
+    free( joinTimes );
+
+    printf( "scenario %s, %u devices, %.0f s simulated\r\n", scenario, SimOptions.Devices, simulated );
+    printf( "joined %u (%.1f%%), %u join requests, join time p50 %.1f s p90 %.1f s p99 %.1f s\r\n",
+            joined, Percent( joined, SimOptions.Devices ), total.JoinRequests, p50, p90, p99 );
+    printf( "uplinks %u, received %u (%.1f%%), collided %u, faded %u, air time %.1f s\r\n",
+            total.Uplinks, total.UplinksReceived, Percent( total.UplinksReceived, total.Uplinks ),
+            total.Collisions, total.Faded, total.AirTime / 1e6 );
+    printf( "downlinks sent %u, received %u\r\n", total.DownlinksSent, total.DownlinksReceived );
+    if( SimOptions.Scenario != SIM_SCENARIO_JOIN )
+    {
+        printf( "data sent %u, received %u (%.1f%%), %.1f bytes/s\r\n",
+                total.DataSent, total.DataReceived, Percent( total.DataReceived, total.DataSent ),
+                ( simulated > 0 ) ? total.BytesReceived / simulated : 0.0 );
+        printf( "datarates" );
+        for( uint8_t i = 0; i < 6; i++ )
+        {
+            printf( " DR%u %u", i, datarates[i] );
+        }
+        printf( ", %u ADR changes, %u devices changed, after %.1f uplinks on average\r\n", total.AdrChanges,
+                converged, ( converged > 0 ) ? ( double )convergedAt / converged : 0.0 );
+    }
+    printf( "%llu events in %.3f s, %.0f events/s, %.0fx real time\r\n", ( unsigned long long )events, wall,
+            ( wall > 0 ) ? events / wall : 0.0, ( wall > 0 ) ? simulated / wall : 0.0 );
+
+    printf( "{\"scenario\":\"%s\",\"devices\":%u,\"simulated\":%.0f,\"joined\":%u,\"join_requests\":%u,"
+            "\"join_p50\":%.3f,\"join_p90\":%.3f,\"join_p99\":%.3f,\"uplinks\":%u,\"received\":%u,"
+            "\"collided\":%u,\"faded\":%u,\"data_sent\":%u,\"data_received\":%u,\"bytes_received\":%u,"
+            "\"adr_changes\":%u,\"dr\":[%u,%u,%u,%u,%u,%u],\"events\":%llu,\"wall\":%.3f}\r\n",
+            scenario, SimOptions.Devices, simulated, joined, total.JoinRequests, p50, p90, p99, total.Uplinks,
+            total.UplinksReceived, total.Collisions, total.Faded, total.DataSent, total.DataReceived,
+            total.BytesReceived, total.AdrChanges, datarates[0], datarates[1], datarates[2], datarates[3],
+            datarates[4], datarates[5], ( unsigned long long )events, wall );
+}
+
+int main( int argc, char **argv )
+{
+    static const char *Scenarios[] = { "join", "adr", "throughput" };
+    int32_t duration = -1;
+    int32_t period = -1;
+    struct timespec start;
+    struct timespec stop;
+    uint64_t events;
+    double wall;
+    int opt;
+
+    memset( &SimOptions, 0, sizeof( SimOptions ) );
+    SimOptions.Scenario = SIM_SCENARIO_JOIN;
+    SimOptions.Devices = 100;
+    SimOptions.StartWindow = 60;
+    SimOptions.PayloadSize = 10;
+    SimOptions.Adr = true;
+    SimOptions.Datarate = 5;
+    SimOptions.SnrMin = -20.0f;
+    SimOptions.SnrMax = 10.0f;
+    SimOptions.Fading = 2.0f;
+    SimOptions.Seed = 1;
+
+    while( ( opt = getopt( argc, argv, "s:n:t:w:p:l:d:caAm:M:f:e:r:vh" ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 's':
+            for( opt = 0; opt < 3; opt++ )
+            {
+                if( strcmp( optarg, Scenarios[opt] ) == 0 )
+                {
+                    break;
+                }
+            }
+            if( opt == 3 )
+            {
+                Usage( argv[0] );
+                return 1;
+            }
+            SimOptions.Scenario = ( SimScenario_t )opt;
+            break;
+        case 'n':
+            SimOptions.Devices = ( uint32_t )strtoul( optarg, NULL, 0 );
+            break;
+        case 't':
+            duration = ( int32_t )strtol( optarg, NULL, 0 );
+            break;
+        case 'w':
+            SimOptions.StartWindow = ( uint32_t )strtoul( optarg, NULL, 0 );
+            break;
+        case 'p':
+            period = ( int32_t )strtol( optarg, NULL, 0 );
+            break;
+        case 'l':
+            SimOptions.PayloadSize = ( uint8_t )strtoul( optarg, NULL, 0 );
+            break;
+        case 'd':
+            SimOptions.Datarate = ( int8_t )strtol( optarg, NULL, 0 );
+            break;
+        case 'c':
+            SimOptions.Confirmed = true;
+            break;
+        case 'a':
+            SimOptions.Abp = true;
+            break;
+        case 'A':
+            SimOptions.Adr = false;
+            break;
+        case 'm':
+            SimOptions.SnrMin = strtof( optarg, NULL );
+            break;
+        case 'M':
+            SimOptions.SnrMax = strtof( optarg, NULL );
+            break;
+        case 'f':
+            SimOptions.Fading = strtof( optarg, NULL );
+            break;
+        case 'e':
+            SimOptions.Per = strtof( optarg, NULL );
+            break;
+        case 'r':
+            SimOptions.Seed = ( uint32_t )strtoul( optarg, NULL, 0 );
+            break;
+        case 'v':
+            SimOptions.Verbose = true;
+            break;
+        default:
+            Usage( argv[0] );
+            return ( opt == 'h' ) ? 0 : 1;
+        }
+    }
+    if( SimOptions.Devices == 0 )
+    {
+        Usage( argv[0] );
+        return 1;
+    }
+    SimOptions.Duration = ( duration >= 0 ) ? ( uint32_t )duration :
+                          ( SimOptions.Scenario == SIM_SCENARIO_ADR ) ? 86400 : 3600;
+    SimOptions.Period = ( period >= 0 ) ? ( uint32_t )period :
+                        ( SimOptions.Scenario == SIM_SCENARIO_THROUGHPUT ) ? 0 : 300;
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    if( SimInit( ) != 0 )
+    {
+        printf( "Out of memory\r\n" );
+        return 1;
+    }
+    events = SimRun( );
+    clock_gettime( CLOCK_MONOTONIC, &stop );
+    wall = ( stop.tv_sec - start.tv_sec ) + ( stop.tv_nsec - start.tv_nsec ) * 1e-9;
+
+    Report( Scenarios[SimOptions.Scenario], events, wall );
+    SimDeInit( );
+    return 0;
+}
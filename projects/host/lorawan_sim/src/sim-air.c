@@ -0,0 +1,239 @@
+/*!
+ * \file      sim-air.c
+ *
+ * \brief     Channel model of the host simulation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stdlib.h>
+#include <math.h>
+#include "sim.h"
+#include "sim-air.h"
+
+/*!
+ * Gateway transmission booked by the network server
+ */
+typedef struct
+{
+    SimTime_t Start;
+    SimTime_t End;
+    uint32_t Frequency;
+}SimAirGatewayTx_t;
+
+/*!
+ * Mean link SNR of the devices
+ */
+static float *LinkSnr = NULL;
+
+/*!
+ * Transmissions on the air, one per device at most
+ */
+static SimAirTx_t **Active = NULL;
+static uint32_t ActiveCount = 0;
+
+/*!
+ * Gateway transmissions not over yet, at most one downlink per device is
+ * pending
+ */
+static SimAirGatewayTx_t *Gateway = NULL;
+static uint32_t GatewayCount = 0;
+static uint32_t GatewaySize = 0;
+
+static const uint32_t Bandwidths[] = { 125000, 250000, 500000 };
+
+int SimAirInit( uint32_t devices )
+{
+    LinkSnr = malloc( devices * sizeof( float ) );
+    Active = malloc( devices * sizeof( SimAirTx_t * ) );
+    Gateway = malloc( devices * sizeof( SimAirGatewayTx_t ) );
+    if( ( LinkSnr == NULL ) || ( Active == NULL ) || ( Gateway == NULL ) )
+    {
+        SimAirDeInit( );
+        return -1;
+    }
+    GatewaySize = devices;
+    ActiveCount = 0;
+    GatewayCount = 0;
+
+    for( uint32_t i = 0; i < devices; i++ )
+    {
+        LinkSnr[i] = SimOptions.SnrMin + ( SimOptions.SnrMax - SimOptions.SnrMin ) * SimUniform( );
+    }
+    return 0;
+}
+
+void SimAirDeInit( void )
+{
+    free( LinkSnr );
+    free( Active );
+    free( Gateway );
+    LinkSnr = NULL;
+    Active = NULL;
+    Gateway = NULL;
+}
+
+uint32_t SimAirSymbolTime( uint8_t sf, uint8_t bandwidth )
+{
+    return ( uint32_t )( ( ( uint64_t )1000000 << sf ) / Bandwidths[bandwidth % 3] );
+}
+
+SimTime_t SimAirTime( uint8_t sf, uint8_t bandwidth, uint8_t coderate, uint16_t preambleLen, bool crcOn, uint8_t size )
+{
+    double ts = ( double )( 1 << sf ) * 1e6 / Bandwidths[bandwidth % 3];
+    bool ldro = ts >= 16380.0;
+    int32_t num = 8 * size - 4 * sf + 28 + ( crcOn ? 16 : 0 );
+    int32_t den = 4 * ( sf - ( ldro ? 2 : 0 ) );
+    double nPayload = 8;
+
+    if( num > 0 )
+    {
+        nPayload += ( ( num + den - 1 ) / den ) * ( coderate + 4 );
+    }
+    return ( SimTime_t )ceil( ( preambleLen + 4.25 + nPayload ) * ts );
+}
+
+float SimAirLinkSnr( uint32_t device )
+{
+    return LinkSnr[device];
+}
+
+float SimAirPacketSnr( uint32_t device, int8_t power )
+{
+    return LinkSnr[device] + ( power - 14 ) + SimOptions.Fading * SimGaussian( );
+}
+
+float SimAirSnrFloor( uint8_t sf )
+{
+    return -7.5f - 2.5f * ( sf - 7 );
+}
+
+/*!
+ * \brief Tells if the gateway transmits during an interval
+ */
+static bool SimAirGatewayOverlaps( SimTime_t start, SimTime_t end )
+{
+    for( uint32_t i = 0; i < GatewayCount; i++ )
+    {
+        if( ( Gateway[i].Start < end ) && ( start < Gateway[i].End ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * \brief Drops the gateway transmissions over
+ */
+static void SimAirGatewayPurge( void )
+{
+    SimTime_t now = SimNow( );
+
+    for( uint32_t i = 0; i < GatewayCount; )
+    {
+        if( Gateway[i].End <= now )
+        {
+            Gateway[i] = Gateway[--GatewayCount];
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+void SimAirStart( SimAirTx_t *tx )
+{
+    SimAirGatewayPurge( );
+    tx->Collided = SimAirGatewayOverlaps( tx->Start, tx->End );
+    for( uint32_t i = 0; i < ActiveCount; i++ )
+    {
+        SimAirTx_t *other = Active[i];
+
+        if( ( other->Frequency != tx->Frequency ) || ( other->Sf != tx->Sf ) ||
+            ( other->Bandwidth != tx->Bandwidth ) )
+        {
+            continue;
+        }
+        if( tx->Snr < ( other->Snr + SIM_AIR_CAPTURE ) )
+        {
+            tx->Collided = true;
+        }
+        if( other->Snr < ( tx->Snr + SIM_AIR_CAPTURE ) )
+        {
+            other->Collided = true;
+        }
+    }
+    Active[ActiveCount++] = tx;
+}
+
+bool SimAirEnd( SimAirTx_t *tx )
+{
+    SimDeviceStats_t *stats = &SimStats[tx->Device];
+
+    for( uint32_t i = 0; i < ActiveCount; i++ )
+    {
+        if( Active[i] == tx )
+        {
+            Active[i] = Active[--ActiveCount];
+            break;
+        }
+    }
+
+    if( tx->Collided == true )
+    {
+        stats->Collisions++;
+        return false;
+    }
+    if( ( tx->Snr < SimAirSnrFloor( tx->Sf ) ) || ( SimUniform( ) < SimOptions.Per ) )
+    {
+        stats->Faded++;
+        return false;
+    }
+    stats->UplinksReceived++;
+    return true;
+}
+
+bool SimAirGatewayTx( SimTime_t start, SimTime_t end, uint32_t frequency )
+{
+    SimAirGatewayPurge( );
+    if( ( GatewayCount == GatewaySize ) || ( SimAirGatewayOverlaps( start, end ) == true ) )
+    {
+        return false;
+    }
+    Gateway[GatewayCount].Start = start;
+    Gateway[GatewayCount].End = end;
+    Gateway[GatewayCount].Frequency = frequency;
+    GatewayCount++;
+
+    // The gateway does not listen while it transmits
+    for( uint32_t i = 0; i < ActiveCount; i++ )
+    {
+        if( Active[i]->End > start )
+        {
+            Active[i]->Collided = true;
+        }
+    }
+    return true;
+}
+
+bool SimAirBusy( uint32_t frequency )
+{
+    SimTime_t now = SimNow( );
+
+    for( uint32_t i = 0; i < ActiveCount; i++ )
+    {
+        if( Active[i]->Frequency == frequency )
+        {
+            return true;
+        }
+    }
+    for( uint32_t i = 0; i < GatewayCount; i++ )
+    {
+        if( ( Gateway[i].Frequency == frequency ) && ( Gateway[i].Start <= now ) && ( now < Gateway[i].End ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,254 @@
+/*!
+ * \file      sim-crypto.c
+ *
+ * \brief     Software AES-128 of the host simulation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "aes-key.h"
+#include "cmac.h"
+#include "sim-crypto.h"
+
+static const uint8_t SBox[256] =
+{
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+/*!
+ * Inverse S-box, built from SBox on the first use
+ */
+static uint8_t InvSBox[256];
+
+static uint8_t Xtime( uint8_t x )
+{
+    return ( uint8_t )( ( x << 1 ) ^ ( ( x & 0x80 ) ? 0x1b : 0x00 ) );
+}
+
+static uint8_t Mul( uint8_t x, uint8_t y )
+{
+    uint8_t r = 0;
+
+    while( y != 0 )
+    {
+        if( y & 1 )
+        {
+            r ^= x;
+        }
+        x = Xtime( x );
+        y >>= 1;
+    }
+    return r;
+}
+
+/*!
+ * \brief Expands a key into the 11 round keys
+ */
+static void AesExpandKey( const uint8_t *key, uint8_t roundKeys[176] )
+{
+    uint8_t rcon = 0x01;
+    uint8_t t[4];
+
+    memcpy( roundKeys, key, 16 );
+    for( uint8_t i = 16; i < 176; i += 4 )
+    {
+        memcpy( t, roundKeys + i - 4, 4 );
+        if( ( i % 16 ) == 0 )
+        {
+            uint8_t t0 = t[0];
+
+            t[0] = SBox[t[1]] ^ rcon;
+            t[1] = SBox[t[2]];
+            t[2] = SBox[t[3]];
+            t[3] = SBox[t0];
+            rcon = Xtime( rcon );
+        }
+        for( uint8_t j = 0; j < 4; j++ )
+        {
+            roundKeys[i + j] = roundKeys[i + j - 16] ^ t[j];
+        }
+    }
+}
+
+static void AesEncryptBlock( const uint8_t roundKeys[176], const uint8_t *in, uint8_t *out )
+{
+    uint8_t s[16];
+    uint8_t t[16];
+
+    for( uint8_t i = 0; i < 16; i++ )
+    {
+        s[i] = in[i] ^ roundKeys[i];
+    }
+    for( uint8_t round = 1; round <= 10; round++ )
+    {
+        // SubBytes and ShiftRows, the state is column major
+        for( uint8_t i = 0; i < 16; i++ )
+        {
+            t[i] = SBox[s[( i + 4 * ( i % 4 ) ) % 16]];
+        }
+        if( round < 10 )
+        {
+            // MixColumns
+            for( uint8_t c = 0; c < 16; c += 4 )
+            {
+                uint8_t a0 = t[c], a1 = t[c + 1], a2 = t[c + 2], a3 = t[c + 3];
+                uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+
+                t[c] ^= all ^ Xtime( a0 ^ a1 );
+                t[c + 1] ^= all ^ Xtime( a1 ^ a2 );
+                t[c + 2] ^= all ^ Xtime( a2 ^ a3 );
+                t[c + 3] ^= all ^ Xtime( a3 ^ a0 );
+            }
+        }
+        for( uint8_t i = 0; i < 16; i++ )
+        {
+            s[i] = t[i] ^ roundKeys[16 * round + i];
+        }
+    }
+    memcpy( out, s, 16 );
+}
+
+static void AesDecryptBlock( const uint8_t roundKeys[176], const uint8_t *in, uint8_t *out )
+{
+    uint8_t s[16];
+    uint8_t t[16];
+
+    for( uint8_t i = 0; i < 16; i++ )
+    {
+        s[i] = in[i] ^ roundKeys[160 + i];
+    }
+    for( int8_t round = 9; round >= 0; round-- )
+    {
+        // InvShiftRows and InvSubBytes
+        for( uint8_t i = 0; i < 16; i++ )
+        {
+            t[( i + 4 * ( i % 4 ) ) % 16] = InvSBox[s[i]];
+        }
+        for( uint8_t i = 0; i < 16; i++ )
+        {
+            t[i] ^= roundKeys[16 * round + i];
+        }
+        if( round > 0 )
+        {
+            // InvMixColumns
+            for( uint8_t c = 0; c < 16; c += 4 )
+            {
+                uint8_t a0 = t[c], a1 = t[c + 1], a2 = t[c + 2], a3 = t[c + 3];
+
+                t[c] = Mul( a0, 14 ) ^ Mul( a1, 11 ) ^ Mul( a2, 13 ) ^ Mul( a3, 9 );
+                t[c + 1] = Mul( a0, 9 ) ^ Mul( a1, 14 ) ^ Mul( a2, 11 ) ^ Mul( a3, 13 );
+                t[c + 2] = Mul( a0, 13 ) ^ Mul( a1, 9 ) ^ Mul( a2, 14 ) ^ Mul( a3, 11 );
+                t[c + 3] = Mul( a0, 11 ) ^ Mul( a1, 13 ) ^ Mul( a2, 9 ) ^ Mul( a3, 14 );
+            }
+        }
+        memcpy( s, t, 16 );
+    }
+    memcpy( out, s, 16 );
+}
+
+void AesEcbEncrypt( const uint8_t *key, const uint8_t *in, uint16_t size, uint8_t *out )
+{
+    uint8_t roundKeys[176];
+
+    AesExpandKey( key, roundKeys );
+    for( uint16_t i = 0; i < size; i += 16 )
+    {
+        AesEncryptBlock( roundKeys, in + i, out + i );
+    }
+}
+
+void SimAesEcbDecrypt( const uint8_t *key, const uint8_t *in, uint16_t size, uint8_t *out )
+{
+    uint8_t roundKeys[176];
+
+    if( InvSBox[SBox[1]] != 1 )
+    {
+        for( uint16_t i = 0; i < 256; i++ )
+        {
+            InvSBox[SBox[i]] = ( uint8_t )i;
+        }
+    }
+    AesExpandKey( key, roundKeys );
+    for( uint16_t i = 0; i < size; i += 16 )
+    {
+        AesDecryptBlock( roundKeys, in + i, out + i );
+    }
+}
+
+/*!
+ * \brief Doubles a block in GF(2^128), for the CMAC subkeys
+ */
+static void CmacDouble( const uint8_t *in, uint8_t *out )
+{
+    uint8_t carry = in[0] >> 7;
+
+    for( uint8_t i = 0; i < 15; i++ )
+    {
+        out[i] = ( uint8_t )( ( in[i] << 1 ) | ( in[i + 1] >> 7 ) );
+    }
+    out[15] = ( uint8_t )( ( in[15] << 1 ) ^ ( carry ? 0x87 : 0x00 ) );
+}
+
+void AES_CMAC_Digest( uint8_t digest[AES_CMAC_DIGEST_LENGTH], const uint8_t key[AES_CMAC_KEY_LENGTH],
+                      const uint8_t *header, uint32_t headerLen, const uint8_t *data, uint32_t len )
+{
+    uint8_t roundKeys[176];
+    uint8_t k[16];
+    uint8_t x[16] = { 0 };
+    uint8_t block[16];
+    uint32_t n = headerLen + len;
+    uint32_t off = 0;
+
+    AesExpandKey( key, roundKeys );
+    AesEncryptBlock( roundKeys, x, k );
+    CmacDouble( k, k );
+
+    do
+    {
+        uint32_t clen = ( n - off > 16 ) ? 16 : n - off;
+        bool last = ( off + clen ) == n;
+
+        for( uint32_t i = 0; i < clen; i++ )
+        {
+            block[i] = ( off + i < headerLen ) ? header[off + i] : data[off + i - headerLen];
+        }
+        if( last == true )
+        {
+            if( clen < 16 )
+            {
+                // Padded last block, K2
+                block[clen] = 0x80;
+                memset( block + clen + 1, 0, 15 - clen );
+                CmacDouble( k, k );
+            }
+            for( uint8_t i = 0; i < 16; i++ )
+            {
+                block[i] ^= k[i];
+            }
+        }
+        for( uint8_t i = 0; i < 16; i++ )
+        {
+            x[i] ^= block[i];
+        }
+        AesEncryptBlock( roundKeys, x, x );
+        off += clen;
+    }while( off < n );
+
+    memcpy( digest, x, AES_CMAC_DIGEST_LENGTH );
+}
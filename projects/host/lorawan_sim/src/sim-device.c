@@ -0,0 +1,249 @@
+/*!
+ * \file      sim-device.c
+ *
+ * \brief     Application of a simulated device
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ *            Linked with the stack in the device context, its variables are
+ *            per device.
+ */
+#include <string.h>
+#include "LoRaMac.h"
+#include "timer.h"
+#include "sim.h"
+#include "sim-network.h"
+
+/*!
+ * Application port of the uplinks
+ */
+#define SIM_DEVICE_PORT                             2
+
+/*!
+ * Join requests sent per MLME_JOIN request
+ */
+#define SIM_DEVICE_JOIN_TRIALS                      8
+
+/*!
+ * Transmissions of a confirmed uplink
+ */
+#define SIM_DEVICE_CONFIRMED_TRIALS                 4
+
+/*!
+ * Delay before a request refused by the MAC is retried [ms]
+ */
+#define SIM_DEVICE_RETRY_DELAY                      1000
+
+static uint32_t Device;
+
+static uint8_t DevEui[8];
+static uint8_t AppEui[8];
+static uint8_t AppKey[16];
+
+static uint8_t AppData[255];
+
+static LoRaMacPrimitives_t Primitives;
+static LoRaMacCallback_t Callbacks;
+
+/*!
+ * Joins or sends the next uplink
+ */
+static TimerEvent_t TxTimer;
+
+static void SimDeviceSchedule( uint32_t delay )
+{
+    TimerStop( &TxTimer );
+    TimerSetValue( &TxTimer, ( delay > 0 ) ? delay : 1 );
+    TimerStart( &TxTimer );
+}
+
+static void SimDeviceJoin( void )
+{
+    MlmeReq_t mlmeReq;
+
+    mlmeReq.Type = MLME_JOIN;
+    mlmeReq.Req.Join.DevEui = DevEui;
+    mlmeReq.Req.Join.AppEui = AppEui;
+    mlmeReq.Req.Join.AppKey = AppKey;
+    mlmeReq.Req.Join.NbTrials = SIM_DEVICE_JOIN_TRIALS;
+    if( LoRaMacMlmeRequest( &mlmeReq ) != LORAMAC_STATUS_OK )
+    {
+        SimDeviceSchedule( SIM_DEVICE_RETRY_DELAY );
+    }
+}
+
+static void SimDeviceSend( void )
+{
+    McpsReq_t mcpsReq;
+    LoRaMacTxInfo_t txInfo;
+
+    if( LoRaMacQueryTxPossible( SimOptions.PayloadSize, &txInfo ) != LORAMAC_STATUS_OK )
+    {
+        // Flushes the MAC commands with an empty frame
+        mcpsReq.Type = MCPS_UNCONFIRMED;
+        mcpsReq.Req.Unconfirmed.fBuffer = NULL;
+        mcpsReq.Req.Unconfirmed.fBufferSize = 0;
+        mcpsReq.Req.Unconfirmed.Datarate = SimOptions.Datarate;
+    }
+    else if( SimOptions.Confirmed == true )
+    {
+        mcpsReq.Type = MCPS_CONFIRMED;
+        mcpsReq.Req.Confirmed.fPort = SIM_DEVICE_PORT;
+        mcpsReq.Req.Confirmed.fBuffer = AppData;
+        mcpsReq.Req.Confirmed.fBufferSize = SimOptions.PayloadSize;
+        mcpsReq.Req.Confirmed.NbTrials = SIM_DEVICE_CONFIRMED_TRIALS;
+        mcpsReq.Req.Confirmed.Datarate = SimOptions.Datarate;
+    }
+    else
+    {
+        mcpsReq.Type = MCPS_UNCONFIRMED;
+        mcpsReq.Req.Unconfirmed.fPort = SIM_DEVICE_PORT;
+        mcpsReq.Req.Unconfirmed.fBuffer = AppData;
+        mcpsReq.Req.Unconfirmed.fBufferSize = SimOptions.PayloadSize;
+        mcpsReq.Req.Unconfirmed.Datarate = SimOptions.Datarate;
+    }
+
+    if( LoRaMacMcpsRequest( &mcpsReq ) != LORAMAC_STATUS_OK )
+    {
+        SimDeviceSchedule( SIM_DEVICE_RETRY_DELAY );
+    }
+}
+
+static void OnTxTimerEvent( void )
+{
+    MibRequestConfirm_t mibReq;
+
+    TimerStop( &TxTimer );
+
+    mibReq.Type = MIB_NETWORK_JOINED;
+    LoRaMacMibGetRequestConfirm( &mibReq );
+    if( mibReq.Param.IsNetworkJoined == true )
+    {
+        SimDeviceSend( );
+    }
+    else
+    {
+        SimDeviceJoin( );
+    }
+}
+
+static void McpsConfirm( McpsConfirm_t *mcpsConfirm )
+{
+    SimDeviceStats_t *stats = &SimStats[Device];
+
+    stats->DataSent++;
+    if( ( stats->DataSent > 1 ) &&
+        ( ( stats->Datarate != ( int8_t )mcpsConfirm->Datarate ) || ( stats->TxPower != mcpsConfirm->TxPower ) ) )
+    {
+        stats->AdrChanges++;
+        stats->AdrConvergedAt = stats->DataSent;
+    }
+    stats->Datarate = ( int8_t )mcpsConfirm->Datarate;
+    stats->TxPower = mcpsConfirm->TxPower;
+
+    SimDeviceSchedule( SimOptions.Period * 1000 );
+}
+
+static void McpsIndication( McpsIndication_t *mcpsIndication )
+{
+}
+
+static void MlmeConfirm( MlmeConfirm_t *mlmeConfirm )
+{
+    if( mlmeConfirm->MlmeRequest != MLME_JOIN )
+    {
+        return;
+    }
+    if( mlmeConfirm->Status != LORAMAC_EVENT_INFO_STATUS_OK )
+    {
+        SimDeviceSchedule( SIM_DEVICE_RETRY_DELAY );
+        return;
+    }
+
+    SimStats[Device].JoinTime = SimNow( );
+    SimJoined++;
+    if( SimOptions.Scenario == SIM_SCENARIO_JOIN )
+    {
+        if( SimJoined == SimOptions.Devices )
+        {
+            SimStop( );
+        }
+        return;
+    }
+    // Spreads the first uplinks over a period
+    SimDeviceSchedule( ( SimOptions.Period > 0 ) ? SimRandom( ) % ( SimOptions.Period * 1000 ) : 0 );
+}
+
+static void MlmeIndication( MlmeIndication_t *mlmeIndication )
+{
+}
+
+static uint8_t GetBatteryLevel( void )
+{
+    return 254;
+}
+
+static float GetTemperatureLevel( void )
+{
+    return 25.0f;
+}
+
+void SimDeviceInit( uint32_t device )
+{
+    MibRequestConfirm_t mibReq;
+
+    Device = device;
+    SimNetworkDeviceKeys( device, DevEui, AppEui, AppKey );
+    memset( AppData, ( uint8_t )device, sizeof( AppData ) );
+
+    Primitives.MacMcpsConfirm = McpsConfirm;
+    Primitives.MacMcpsIndication = McpsIndication;
+    Primitives.MacMlmeConfirm = MlmeConfirm;
+    Primitives.MacMlmeIndication = MlmeIndication;
+    Callbacks.GetBatteryLevel = GetBatteryLevel;
+    Callbacks.GetTemperatureLevel = GetTemperatureLevel;
+    LoRaMacInitialization( &Primitives, &Callbacks, LORAMAC_REGION_EU868 );
+
+    mibReq.Type = MIB_ADR;
+    mibReq.Param.AdrEnable = SimOptions.Adr;
+    LoRaMacMibSetRequestConfirm( &mibReq );
+
+    mibReq.Type = MIB_PUBLIC_NETWORK;
+    mibReq.Param.EnablePublicNetwork = true;
+    LoRaMacMibSetRequestConfirm( &mibReq );
+
+    if( SimOptions.Abp == true )
+    {
+        static uint8_t NwkSKey[16];
+        static uint8_t AppSKey[16];
+        uint32_t devAddr;
+
+        SimNetworkAbpSession( device, &devAddr, NwkSKey, AppSKey );
+
+        mibReq.Type = MIB_NET_ID;
+        mibReq.Param.NetID = 0;
+        LoRaMacMibSetRequestConfirm( &mibReq );
+
+        mibReq.Type = MIB_DEV_ADDR;
+        mibReq.Param.DevAddr = devAddr;
+        LoRaMacMibSetRequestConfirm( &mibReq );
+
+        mibReq.Type = MIB_NWK_SKEY;
+        mibReq.Param.NwkSKey = NwkSKey;
+        LoRaMacMibSetRequestConfirm( &mibReq );
+
+        mibReq.Type = MIB_APP_SKEY;
+        mibReq.Param.AppSKey = AppSKey;
+        LoRaMacMibSetRequestConfirm( &mibReq );
+
+        mibReq.Type = MIB_NETWORK_JOINED;
+        mibReq.Param.IsNetworkJoined = true;
+        LoRaMacMibSetRequestConfirm( &mibReq );
+
+        SimStats[device].JoinTime = 0;
+        SimJoined++;
+    }
+
+    TimerInit( &TxTimer, OnTxTimerEvent );
+    SimDeviceSchedule( ( SimOptions.StartWindow > 0 ) ? SimRandom( ) % ( SimOptions.StartWindow * 1000 ) : 0 );
+}
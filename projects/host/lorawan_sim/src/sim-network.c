@@ -0,0 +1,417 @@
+/*!
+ * \file      sim-network.c
+ *
+ * \brief     Network server model of the host simulation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sim.h"
+#include "LoRaMacCrypto.h"
+#include "sim-air.h"
+#include "sim-crypto.h"
+#include "sim-network.h"
+
+/*!
+ * RX1 delays of the EU868 region [us]
+ */
+#define SIM_NETWORK_RX1_DELAY                       SIM_S( 1 )
+#define SIM_NETWORK_JOIN_ACCEPT_DELAY1              SIM_S( 5 )
+
+/*!
+ * Network identifier, the DevAddr carry its 7 LSB as NwkID
+ */
+#define SIM_NETWORK_NET_ID                          0x000013
+
+/*!
+ * Highest datarate and TX power index the ADR sets in EU868
+ */
+#define SIM_NETWORK_ADR_DR_MAX                      5
+#define SIM_NETWORK_ADR_TX_POWER_MAX                7
+
+/*!
+ * Frame types of the MHDR
+ */
+#define SIM_FRAME_JOIN_REQUEST                      0
+#define SIM_FRAME_JOIN_ACCEPT                       1
+#define SIM_FRAME_UNCONFIRMED_UP                    2
+#define SIM_FRAME_UNCONFIRMED_DOWN                  3
+#define SIM_FRAME_CONFIRMED_UP                      4
+
+typedef struct
+{
+    bool Active;
+    uint32_t DevAddr;
+    uint8_t NwkSKey[16];
+    uint8_t AppSKey[16];
+    bool FCntUpValid;
+    uint32_t FCntUp;
+    uint32_t FCntDown;
+    uint32_t AppNonce;
+    /*!
+     * SNR of the last uplinks, for the ADR
+     */
+    float Snr[SIM_NETWORK_ADR_HISTORY];
+    uint8_t SnrCount;
+    uint8_t SnrIndex;
+    /*!
+     * TX power index acknowledged by the device, and the one requested
+     */
+    int8_t TxPower;
+    int8_t TxPowerRequested;
+}SimSession_t;
+
+static SimSession_t *Sessions = NULL;
+
+static SimDownlink_t *Downlinks = NULL;
+
+int SimNetworkInit( uint32_t devices )
+{
+    Sessions = calloc( devices, sizeof( SimSession_t ) );
+    Downlinks = calloc( devices, sizeof( SimDownlink_t ) );
+    if( ( Sessions == NULL ) || ( Downlinks == NULL ) )
+    {
+        SimNetworkDeInit( );
+        return -1;
+    }
+    return 0;
+}
+
+void SimNetworkDeInit( void )
+{
+    free( Sessions );
+    free( Downlinks );
+    Sessions = NULL;
+    Downlinks = NULL;
+}
+
+void SimNetworkDeviceKeys( uint32_t device, uint8_t *devEui, uint8_t *appEui, uint8_t *appKey )
+{
+    static const uint8_t AppEui[8] = { 0x70, 0xB3, 0xD5, 0x7E, 0xD0, 0x00, 0x00, 0x00 };
+
+    memset( devEui, 0, 8 );
+    devEui[4] = ( uint8_t )( device >> 24 );
+    devEui[5] = ( uint8_t )( device >> 16 );
+    devEui[6] = ( uint8_t )( device >> 8 );
+    devEui[7] = ( uint8_t )device;
+    memcpy( appEui, AppEui, 8 );
+    for( uint8_t i = 0; i < 16; i++ )
+    {
+        appKey[i] = ( uint8_t )( 0x2B + 17 * i ) ^ devEui[4 + ( i % 4 )];
+    }
+}
+
+/*!
+ * \brief Derives the device address of a device
+ */
+static uint32_t SimNetworkDevAddr( uint32_t device )
+{
+    return ( ( uint32_t )( SIM_NETWORK_NET_ID & 0x7F ) << 25 ) | ( device & 0x01FFFFFF );
+}
+
+void SimNetworkAbpSession( uint32_t device, uint32_t *devAddr, uint8_t *nwkSKey, uint8_t *appSKey )
+{
+    SimSession_t *session = &Sessions[device];
+    uint8_t devEui[8];
+    uint8_t appEui[8];
+    uint8_t appKey[16];
+
+    SimNetworkDeviceKeys( device, devEui, appEui, appKey );
+    memset( session, 0, sizeof( SimSession_t ) );
+    session->Active = true;
+    session->DevAddr = SimNetworkDevAddr( device );
+    for( uint8_t i = 0; i < 16; i++ )
+    {
+        session->NwkSKey[i] = appKey[i] ^ 0x01;
+        session->AppSKey[i] = appKey[i] ^ 0x02;
+    }
+
+    *devAddr = session->DevAddr;
+    memcpy( nwkSKey, session->NwkSKey, 16 );
+    memcpy( appSKey, session->AppSKey, 16 );
+}
+
+SimDownlink_t *SimNetworkDownlink( uint32_t device )
+{
+    return &Downlinks[device];
+}
+
+/*!
+ * \brief Books the RX1 downlink of an uplink, on its frequency and datarate
+ */
+static void SimNetworkSend( const SimAirTx_t *uplink, SimTime_t delay, const uint8_t *payload, uint8_t size )
+{
+    SimDownlink_t *downlink = &Downlinks[uplink->Device];
+    SimTime_t start = uplink->End + delay;
+    SimTime_t end = start + SimAirTime( uplink->Sf, uplink->Bandwidth, 1, 8, false, size );
+
+    if( SimAirGatewayTx( start, end, uplink->Frequency ) == false )
+    {
+        return;
+    }
+
+    downlink->Pending = true;
+    downlink->Tx.Device = uplink->Device;
+    downlink->Tx.Frequency = uplink->Frequency;
+    downlink->Tx.Sf = uplink->Sf;
+    downlink->Tx.Bandwidth = uplink->Bandwidth;
+    downlink->Tx.Start = start;
+    downlink->Tx.End = end;
+    downlink->Tx.Snr = SimAirPacketSnr( uplink->Device, 14 );
+    downlink->Tx.Collided = false;
+    downlink->PreambleLen = 8;
+    downlink->Size = size;
+    memcpy( downlink->Payload, payload, size );
+    SimStats[uplink->Device].DownlinksSent++;
+}
+
+static void SimNetworkJoinRequest( const SimAirTx_t *tx, const uint8_t *payload, uint8_t size )
+{
+    SimSession_t *session = &Sessions[tx->Device];
+    uint8_t devEui[8];
+    uint8_t appEui[8];
+    uint8_t appKey[16];
+    uint8_t accept[17];
+    uint32_t mic;
+    uint32_t appNonce;
+    uint16_t devNonce;
+
+    if( size != 23 )
+    {
+        return;
+    }
+    SimNetworkDeviceKeys( tx->Device, devEui, appEui, appKey );
+    LoRaMacJoinComputeMic( payload, 19, appKey, &mic );
+    if( ( payload[19] != ( uint8_t )mic ) || ( payload[20] != ( uint8_t )( mic >> 8 ) ) ||
+        ( payload[21] != ( uint8_t )( mic >> 16 ) ) || ( payload[22] != ( uint8_t )( mic >> 24 ) ) )
+    {
+        return;
+    }
+    devNonce = payload[17] | ( ( uint16_t )payload[18] << 8 );
+    appNonce = session->AppNonce + 1;
+
+    memset( session, 0, sizeof( SimSession_t ) );
+    session->AppNonce = appNonce;
+    session->Active = true;
+    session->DevAddr = SimNetworkDevAddr( tx->Device );
+
+    accept[0] = SIM_FRAME_JOIN_ACCEPT << 5;
+    accept[1] = ( uint8_t )session->AppNonce;
+    accept[2] = ( uint8_t )( session->AppNonce >> 8 );
+    accept[3] = ( uint8_t )( session->AppNonce >> 16 );
+    accept[4] = ( uint8_t )SIM_NETWORK_NET_ID;
+    accept[5] = ( uint8_t )( SIM_NETWORK_NET_ID >> 8 );
+    accept[6] = ( uint8_t )( SIM_NETWORK_NET_ID >> 16 );
+    accept[7] = ( uint8_t )session->DevAddr;
+    accept[8] = ( uint8_t )( session->DevAddr >> 8 );
+    accept[9] = ( uint8_t )( session->DevAddr >> 16 );
+    accept[10] = ( uint8_t )( session->DevAddr >> 24 );
+    // DLSettings, RX1DRoffset 0 and RX2 DR0, RxDelay 1 s
+    accept[11] = 0;
+    accept[12] = 1;
+    LoRaMacJoinComputeMic( accept, 13, appKey, &mic );
+    accept[13] = ( uint8_t )mic;
+    accept[14] = ( uint8_t )( mic >> 8 );
+    accept[15] = ( uint8_t )( mic >> 16 );
+    accept[16] = ( uint8_t )( mic >> 24 );
+    LoRaMacJoinComputeSKeys( appKey, accept + 1, devNonce, session->NwkSKey, session->AppSKey );
+
+    // The device decrypts with the AES encryption
+    SimAesEcbDecrypt( appKey, accept + 1, 16, accept + 1 );
+    SimNetworkSend( tx, SIM_NETWORK_JOIN_ACCEPT_DELAY1, accept, sizeof( accept ) );
+}
+
+/*!
+ * \brief Walks the MAC command answers of an uplink FOpts
+ *
+ * \retval linkAdrAns  Status of the LinkADRAns, -1 when none
+ */
+static int16_t SimNetworkMacAnswers( const uint8_t *fOpts, uint8_t size )
+{
+    // Payload sizes of the device answers, by CID, -1 when unknown
+    static const int8_t AnswerSizes[] = { -1, -1, 0, 1, 0, 1, 2, 1, 0, 0, 1, -1, -1, 0 };
+    int16_t linkAdrAns = -1;
+    uint8_t i = 0;
+
+    while( i < size )
+    {
+        uint8_t cid = fOpts[i++];
+
+        if( ( cid >= sizeof( AnswerSizes ) ) || ( AnswerSizes[cid] < 0 ) )
+        {
+            break;
+        }
+        if( ( cid == 0x03 ) && ( i < size ) )
+        {
+            linkAdrAns = fOpts[i];
+        }
+        i += AnswerSizes[cid];
+    }
+    return linkAdrAns;
+}
+
+/*!
+ * \brief Runs the ADR on the SNR history of a session
+ *
+ * \param [IN]  session  Session
+ * \param [IN]  sf       Spreading factor of the last uplink
+ * \param [OUT] dr       Datarate to request
+ * \param [OUT] txPower  TX power index to request
+ *
+ * \retval change        true when the device has to change its settings
+ */
+static bool SimNetworkAdr( SimSession_t *session, uint8_t sf, int8_t *dr, int8_t *txPower )
+{
+    float snrMax = session->Snr[0];
+    int8_t steps;
+
+    for( uint8_t i = 1; i < SIM_NETWORK_ADR_HISTORY; i++ )
+    {
+        snrMax = ( session->Snr[i] > snrMax ) ? session->Snr[i] : snrMax;
+    }
+    steps = ( int8_t )floorf( ( snrMax - SimAirSnrFloor( sf ) - SIM_NETWORK_ADR_MARGIN ) / 3.0f );
+
+    *dr = 12 - sf;
+    *txPower = session->TxPower;
+    while( ( steps > 0 ) && ( *dr < SIM_NETWORK_ADR_DR_MAX ) )
+    {
+        ( *dr )++;
+        steps--;
+    }
+    while( ( steps > 0 ) && ( *txPower < SIM_NETWORK_ADR_TX_POWER_MAX ) )
+    {
+        ( *txPower )++;
+        steps--;
+    }
+    while( ( steps < 0 ) && ( *txPower > 0 ) )
+    {
+        ( *txPower )--;
+        steps++;
+    }
+    return ( *dr != ( 12 - sf ) ) || ( *txPower != session->TxPower );
+}
+
+static void SimNetworkData( const SimAirTx_t *tx, const uint8_t *payload, uint8_t size )
+{
+    SimSession_t *session = &Sessions[tx->Device];
+    SimDeviceStats_t *stats = &SimStats[tx->Device];
+    uint8_t type = payload[0] >> 5;
+    uint8_t fCtrl = payload[5];
+    uint8_t fOptsLen = fCtrl & 0x0F;
+    uint32_t devAddr = payload[1] | ( ( uint32_t )payload[2] << 8 ) | ( ( uint32_t )payload[3] << 16 ) | ( ( uint32_t )payload[4] << 24 );
+    uint32_t fCnt = payload[6] | ( ( uint32_t )payload[7] << 8 );
+    uint8_t downlink[32];
+    uint8_t fOpts[5];
+    uint8_t fOptsSize = 0;
+    bool duplicate = false;
+    int16_t linkAdrAns;
+    uint32_t mic;
+
+    if( ( session->Active == false ) || ( devAddr != session->DevAddr ) || ( size < ( 12 + fOptsLen ) ) )
+    {
+        return;
+    }
+
+    // 32 bits counter from the 16 LSB received
+    if( session->FCntUpValid == true )
+    {
+        fCnt |= session->FCntUp & 0xFFFF0000;
+        if( fCnt < session->FCntUp )
+        {
+            fCnt += 0x10000;
+        }
+        duplicate = fCnt == session->FCntUp;
+    }
+    LoRaMacComputeMic( payload, size - 4, session->NwkSKey, devAddr, 0, fCnt, &mic );
+    if( ( payload[size - 4] != ( uint8_t )mic ) || ( payload[size - 3] != ( uint8_t )( mic >> 8 ) ) ||
+        ( payload[size - 2] != ( uint8_t )( mic >> 16 ) ) || ( payload[size - 1] != ( uint8_t )( mic >> 24 ) ) )
+    {
+        return;
+    }
+    session->FCntUpValid = true;
+    session->FCntUp = fCnt;
+
+    if( duplicate == false )
+    {
+        stats->DataReceived++;
+        if( size > ( 12 + fOptsLen ) )
+        {
+            // FPort then the FRMPayload
+            stats->BytesReceived += size - 13 - fOptsLen;
+        }
+    }
+
+    linkAdrAns = SimNetworkMacAnswers( payload + 8, fOptsLen );
+    if( ( linkAdrAns >= 0 ) && ( ( linkAdrAns & 0x07 ) == 0x07 ) )
+    {
+        session->TxPower = session->TxPowerRequested;
+    }
+
+    if( ( fCtrl & 0x80 ) != 0 )
+    {
+        int8_t dr;
+        int8_t txPower;
+
+        session->Snr[session->SnrIndex] = tx->Snr;
+        session->SnrIndex = ( session->SnrIndex + 1 ) % SIM_NETWORK_ADR_HISTORY;
+        if( session->SnrCount < SIM_NETWORK_ADR_HISTORY )
+        {
+            session->SnrCount++;
+        }
+        if( ( session->SnrCount == SIM_NETWORK_ADR_HISTORY ) && ( SimNetworkAdr( session, tx->Sf, &dr, &txPower ) == true ) )
+        {
+            // LinkADRReq on the 3 default channels, NbRep 1
+            fOpts[0] = 0x03;
+            fOpts[1] = ( uint8_t )( ( dr << 4 ) | txPower );
+            fOpts[2] = 0x07;
+            fOpts[3] = 0x00;
+            fOpts[4] = 0x01;
+            fOptsSize = 5;
+            session->TxPowerRequested = txPower;
+            // The history restarts at the new settings
+            session->SnrCount = 0;
+            session->SnrIndex = 0;
+        }
+    }
+
+    // Answers confirmed uplinks, ADR requests and ADRACKReq
+    if( ( type != SIM_FRAME_CONFIRMED_UP ) && ( fOptsSize == 0 ) && ( ( fCtrl & 0x40 ) == 0 ) )
+    {
+        return;
+    }
+    downlink[0] = SIM_FRAME_UNCONFIRMED_DOWN << 5;
+    memcpy( downlink + 1, payload + 1, 4 );
+    downlink[5] = ( uint8_t )( ( ( fCtrl & 0x80 ) ? 0x80 : 0x00 ) | ( ( type == SIM_FRAME_CONFIRMED_UP ) ? 0x20 : 0x00 ) | fOptsSize );
+    downlink[6] = ( uint8_t )session->FCntDown;
+    downlink[7] = ( uint8_t )( session->FCntDown >> 8 );
+    memcpy( downlink + 8, fOpts, fOptsSize );
+    LoRaMacComputeMic( downlink, 8 + fOptsSize, session->NwkSKey, devAddr, 1, session->FCntDown, &mic );
+    downlink[8 + fOptsSize] = ( uint8_t )mic;
+    downlink[9 + fOptsSize] = ( uint8_t )( mic >> 8 );
+    downlink[10 + fOptsSize] = ( uint8_t )( mic >> 16 );
+    downlink[11 + fOptsSize] = ( uint8_t )( mic >> 24 );
+    session->FCntDown++;
+    SimNetworkSend( tx, SIM_NETWORK_RX1_DELAY, downlink, 12 + fOptsSize );
+}
+
+void SimNetworkUplink( const SimAirTx_t *tx, const uint8_t *payload, uint8_t size )
+{
+    if( size == 0 )
+    {
+        return;
+    }
+    switch( payload[0] >> 5 )
+    {
+    case SIM_FRAME_JOIN_REQUEST:
+        SimNetworkJoinRequest( tx, payload, size );
+        break;
+    case SIM_FRAME_UNCONFIRMED_UP:
+    case SIM_FRAME_CONFIRMED_UP:
+        SimNetworkData( tx, payload, size );
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,503 @@
+/*!
+ * \file      sim-radio.c
+ *
+ * \brief     Radio driver of the host simulation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ *            Implements the Radio interface over the channel model, with one
+ *            radio per device. Only LoRa is modelled, the FSK calls are
+ *            accepted and ignored.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "radio.h"
+#include "sim.h"
+#include "sim-air.h"
+#include "sim-network.h"
+
+/*!
+ * Symbols a receiver needs to lock on a preamble
+ */
+#define SIM_RADIO_PREAMBLE_LOCK                     5
+
+/*!
+ * Radio wake up time from sleep [ms], TCXO included
+ */
+#define SIM_RADIO_WAKEUP_TIME                       3
+
+typedef enum
+{
+    SIM_RADIO_EVENT_NONE = 0,
+    SIM_RADIO_EVENT_TX_DONE,
+    SIM_RADIO_EVENT_RX_DONE,
+    SIM_RADIO_EVENT_RX_TIMEOUT,
+    SIM_RADIO_EVENT_CAD_DONE,
+    SIM_RADIO_EVENT_CS_DONE,
+}SimRadioEvent_t;
+
+typedef struct
+{
+    RadioEvents_t *Events;
+    RadioState_t State;
+    SimRadioEvent_t Event;
+    RadioModems_t Modem;
+    uint32_t Frequency;
+    /*!
+     * Transmission settings
+     */
+    int8_t Power;
+    uint8_t TxSf;
+    uint8_t TxBandwidth;
+    uint8_t TxCoderate;
+    uint16_t TxPreambleLen;
+    bool TxCrcOn;
+    /*!
+     * Reception settings
+     */
+    uint8_t RxSf;
+    uint8_t RxBandwidth;
+    uint16_t SymbTimeout;
+    bool RxContinuous;
+    /*!
+     * Symbol time of the last configuration [us]
+     */
+    uint32_t SymbolTime;
+    /*!
+     * Lent reception buffer
+     */
+    uint8_t *RxBuffer;
+    uint8_t RxBufferSize;
+    /*!
+     * Result of the channel activity detection or the carrier sense
+     */
+    bool ChannelBusy;
+    SimAirTx_t Tx;
+    SimDownlink_t Rx;
+    uint8_t TxSize;
+    uint8_t TxPayload[255];
+}SimRadio_t;
+
+static SimRadio_t *SimRadios = NULL;
+
+/*!
+ * Reception buffer when none is lent
+ */
+static uint8_t RxPayload[255];
+
+int SimRadioInit( uint32_t devices )
+{
+    SimRadios = calloc( devices, sizeof( SimRadio_t ) );
+    return ( SimRadios == NULL ) ? -1 : 0;
+}
+
+void SimRadioDeInit( void )
+{
+    free( SimRadios );
+    SimRadios = NULL;
+}
+
+static SimRadio_t *SimRadioCurrent( void )
+{
+    return &SimRadios[SimCurrent];
+}
+
+static void SimRadioSetEvent( SimRadioEvent_t event, SimTime_t time )
+{
+    SimRadio_t *radio = SimRadioCurrent( );
+
+    radio->Event = event;
+    SimSetRadioEvent( ( event == SIM_RADIO_EVENT_NONE ) ? SIM_TIME_NEVER : time );
+}
+
+static int RadioInit( RadioEvents_t *events )
+{
+    SimRadio_t *radio = SimRadioCurrent( );
+
+    memset( radio, 0, sizeof( SimRadio_t ) );
+    radio->Events = events;
+    radio->Modem = MODEM_LORA;
+    radio->State = RF_IDLE;
+    SimSetRadioEvent( SIM_TIME_NEVER );
+    return 0;
+}
+
+static RadioState_t RadioGetStatus( void )
+{
+    return SimRadioCurrent( )->State;
+}
+
+static void RadioSetModem( RadioModems_t modem )
+{
+    SimRadioCurrent( )->Modem = modem;
+}
+
+static void RadioSetChannel( uint32_t freq )
+{
+    SimRadioCurrent( )->Frequency = freq;
+}
+
+static bool RadioIsChannelFree( RadioModems_t modem, uint32_t freq, int16_t rssiThresh, uint32_t maxCarrierSenseTime )
+{
+    return SimAirBusy( freq ) == false;
+}
+
+static uint32_t RadioRandom( void )
+{
+    return SimRandom( );
+}
+
+static void RadioSetRxConfig( RadioModems_t modem, uint32_t bandwidth,
+                              uint32_t datarate, uint8_t coderate,
+                              uint32_t bandwidthAfc, uint16_t preambleLen,
+                              uint16_t symbTimeout, bool fixLen,
+                              uint8_t payloadLen,
+                              bool crcOn, bool freqHopOn, uint8_t hopPeriod,
+                              bool iqInverted, bool rxContinuous )
+{
+    SimRadio_t *radio = SimRadioCurrent( );
+
+    radio->Modem = modem;
+    radio->RxSf = ( uint8_t )datarate;
+    radio->RxBandwidth = ( uint8_t )bandwidth;
+    radio->SymbTimeout = symbTimeout;
+    radio->RxContinuous = rxContinuous;
+    radio->SymbolTime = ( modem == MODEM_LORA ) ? SimAirSymbolTime( radio->RxSf, radio->RxBandwidth ) : 0;
+}
+
+static void RadioSetTxConfig( RadioModems_t modem, int8_t power, uint32_t fdev,
+                              uint32_t bandwidth, uint32_t datarate,
+                              uint8_t coderate, uint16_t preambleLen,
+                              bool fixLen, bool crcOn, bool freqHopOn,
+                              uint8_t hopPeriod, bool iqInverted, uint32_t timeout )
+{
+    SimRadio_t *radio = SimRadioCurrent( );
+
+    radio->Modem = modem;
+    radio->Power = power;
+    radio->TxSf = ( uint8_t )datarate;
+    radio->TxBandwidth = ( uint8_t )bandwidth;
+    radio->TxCoderate = coderate;
+    radio->TxPreambleLen = preambleLen;
+    radio->TxCrcOn = crcOn;
+    radio->SymbolTime = ( modem == MODEM_LORA ) ? SimAirSymbolTime( radio->TxSf, radio->TxBandwidth ) : 0;
+}
+
+static bool RadioCheckRfFrequency( uint32_t frequency )
+{
+    return true;
+}
+
+static uint32_t RadioTimeOnAir( RadioModems_t modem, uint8_t pktLen )
+{
+    SimRadio_t *radio = SimRadioCurrent( );
+
+    if( modem != MODEM_LORA )
+    {
+        return 0;
+    }
+    return ( uint32_t )( ( SimAirTime( radio->TxSf, radio->TxBandwidth, radio->TxCoderate,
+                                       radio->TxPreambleLen, radio->TxCrcOn, pktLen ) + 999 ) / 1000 );
+}
+
+static void RadioSend( uint8_t *buffer, uint8_t size )
+{
+    SimRadio_t *radio = SimRadioCurrent( );
+    SimDeviceStats_t *stats = &SimStats[SimCurrent];
+    SimTime_t airTime = SimAirTime( radio->TxSf, radio->TxBandwidth, radio->TxCoderate,
+                                    radio->TxPreambleLen, radio->TxCrcOn, size );
+
+    memcpy( radio->TxPayload, buffer, size );
+    radio->TxSize = size;
+    radio->Tx.Device = SimCurrent;
+    radio->Tx.Frequency = radio->Frequency;
+    radio->Tx.Sf = radio->TxSf;
+    radio->Tx.Bandwidth = radio->TxBandwidth;
+    radio->Tx.Start = SimNow( );
+    radio->Tx.End = radio->Tx.Start + airTime;
+    radio->Tx.Snr = SimAirPacketSnr( SimCurrent, radio->Power );
+    SimAirStart( &radio->Tx );
+
+    stats->Uplinks++;
+    stats->AirTime += airTime;
+    if( ( size > 0 ) && ( ( buffer[0] >> 5 ) == 0 ) )
+    {
+        stats->JoinRequests++;
+    }
+
+    radio->State = RF_TX_RUNNING;
+    SimRadioSetEvent( SIM_RADIO_EVENT_TX_DONE, radio->Tx.End );
+}
+
+static void RadioSleep( void )
+{
+    SimRadio_t *radio = SimRadioCurrent( );
+
+    if( radio->State == RF_TX_RUNNING )
+    {
+        // The transmission is cut short, it is lost anyway
+        radio->Tx.Collided = true;
+        SimAirEnd( &radio->Tx );
+    }
+    radio->State = RF_IDLE;
+    SimRadioSetEvent( SIM_RADIO_EVENT_NONE, SIM_TIME_NEVER );
+}
+
+static void RadioStandby( void )
+{
+    RadioSleep( );
+}
+
+static void RadioRx( uint32_t timeout )
+{
+    SimRadio_t *radio = SimRadioCurrent( );
+    SimDownlink_t *downlink = SimNetworkDownlink( SimCurrent );
+    SimTime_t now = SimNow( );
+    SimTime_t window;
+
+    radio->State = RF_RX_RUNNING;
+    if( radio->RxContinuous == true )
+    {
+        window = SIM_TIME_NEVER - now;
+    }
+    else if( radio->SymbTimeout > 0 )
+    {
+        window = ( SimTime_t )radio->SymbTimeout * radio->SymbolTime;
+    }
+    else
+    {
+        window = SIM_MS( timeout );
+    }
+
+    if( ( downlink != NULL ) && ( downlink->Pending == true ) )
+    {
+        SimTime_t lock = downlink->Tx.Start + ( SimTime_t )( downlink->PreambleLen - SIM_RADIO_PREAMBLE_LOCK ) * radio->SymbolTime;
+
+        if( lock < now )
+        {
+            // Missed
+            downlink->Pending = false;
+        }
+        else if( ( downlink->Tx.Start <= ( now + window ) ) && ( downlink->Tx.Frequency == radio->Frequency ) &&
+                 ( downlink->Tx.Sf == radio->RxSf ) && ( downlink->Tx.Bandwidth == radio->RxBandwidth ) )
+        {
+            downlink->Pending = false;
+            if( ( downlink->Tx.Snr >= SimAirSnrFloor( downlink->Tx.Sf ) ) && ( SimUniform( ) >= SimOptions.Per ) )
+            {
+                radio->Rx = *downlink;
+                SimRadioSetEvent( SIM_RADIO_EVENT_RX_DONE, downlink->Tx.End );
+                return;
+            }
+        }
+    }
+    if( radio->RxContinuous == true )
+    {
+        SimRadioSetEvent( SIM_RADIO_EVENT_NONE, SIM_TIME_NEVER );
+    }
+    else
+    {
+        SimRadioSetEvent( SIM_RADIO_EVENT_RX_TIMEOUT, now + window );
+    }
+}
+
+static void RadioStartCad( uint8_t symbols )
+{
+    SimRadio_t *radio = SimRadioCurrent( );
+
+    radio->State = RF_CAD;
+    radio->ChannelBusy = SimAirBusy( radio->Frequency );
+    SimRadioSetEvent( SIM_RADIO_EVENT_CAD_DONE, SimNow( ) + ( SimTime_t )symbols * radio->SymbolTime );
+}
+
+static void RadioSetTxContinuousWave( uint32_t freq, int8_t power, uint16_t time )
+{
+}
+
+static int16_t RadioRssi( RadioModems_t modem )
+{
+    return SimAirBusy( SimRadioCurrent( )->Frequency ) ? -80 : -120;
+}
+
+static void RadioWrite( uint16_t addr, uint8_t data )
+{
+}
+
+static uint8_t RadioRead( uint16_t addr )
+{
+    return 0;
+}
+
+static void RadioWriteBuffer( uint16_t addr, uint8_t *buffer, uint8_t size )
+{
+}
+
+static void RadioReadBuffer( uint16_t addr, uint8_t *buffer, uint8_t size )
+{
+}
+
+static void RadioSetMaxPayloadLength( RadioModems_t modem, uint8_t max )
+{
+}
+
+static void RadioSetPublicNetwork( bool enable )
+{
+}
+
+static uint32_t RadioGetWakeupTime( void )
+{
+    return SIM_RADIO_WAKEUP_TIME;
+}
+
+static void RadioIrqProcess( void )
+{
+}
+
+static void RadioRxBoosted( uint32_t timeout )
+{
+    RadioRx( timeout );
+}
+
+static void RadioSetRxDutyCycle( uint32_t rxTime, uint32_t sleepTime )
+{
+    RadioRx( 0 );
+}
+
+static void RadioSetRxBuffer( uint8_t *buffer, uint8_t size )
+{
+    SimRadio_t *radio = SimRadioCurrent( );
+
+    radio->RxBuffer = buffer;
+    radio->RxBufferSize = size;
+}
+
+static bool RadioRxSniff( uint16_t preambleLen )
+{
+    return false;
+}
+
+static bool RadioIrqPending( void )
+{
+    return false;
+}
+
+static uint32_t RadioSymbolTime( void )
+{
+    return SimRadioCurrent( )->SymbolTime;
+}
+
+static void RadioStartCarrierSense( RadioModems_t modem, uint32_t freq, int16_t rssiThresh, uint32_t maxCarrierSenseTime )
+{
+    SimRadio_t *radio = SimRadioCurrent( );
+
+    radio->Frequency = freq;
+    radio->State = RF_RX_RUNNING;
+    radio->ChannelBusy = SimAirBusy( freq );
+    SimRadioSetEvent( SIM_RADIO_EVENT_CS_DONE, SimNow( ) + SIM_MS( maxCarrierSenseTime ) );
+}
+
+static void RadioSetTemperature( int8_t temperature )
+{
+}
+
+void SimRadioProcess( void )
+{
+    SimRadio_t *radio = SimRadioCurrent( );
+    RadioEvents_t *events = radio->Events;
+    SimRadioEvent_t event = radio->Event;
+
+    radio->State = RF_IDLE;
+    SimRadioSetEvent( SIM_RADIO_EVENT_NONE, SIM_TIME_NEVER );
+
+    switch( event )
+    {
+    case SIM_RADIO_EVENT_TX_DONE:
+        if( SimAirEnd( &radio->Tx ) == true )
+        {
+            SimNetworkUplink( &radio->Tx, radio->TxPayload, radio->TxSize );
+        }
+        if( ( events != NULL ) && ( events->TxDone != NULL ) )
+        {
+            events->TxDone( );
+        }
+        break;
+    case SIM_RADIO_EVENT_RX_DONE:
+        {
+            uint8_t *payload = ( radio->RxBuffer != NULL ) ? radio->RxBuffer : RxPayload;
+            uint16_t size = radio->Rx.Size;
+
+            if( ( radio->RxBuffer != NULL ) && ( size > radio->RxBufferSize ) )
+            {
+                size = radio->RxBufferSize;
+            }
+            memcpy( payload, radio->Rx.Payload, size );
+            SimStats[SimCurrent].DownlinksReceived++;
+            if( ( events != NULL ) && ( events->RxFilter != NULL ) && ( size > RADIO_RX_FILTER_HEADER_SIZE ) &&
+                ( events->RxFilter( payload, size ) == false ) )
+            {
+                size = RADIO_RX_FILTER_HEADER_SIZE;
+            }
+            if( ( events != NULL ) && ( events->RxDone != NULL ) )
+            {
+                events->RxDone( payload, size, ( int16_t )( -120 + radio->Rx.Tx.Snr ), ( int8_t )radio->Rx.Tx.Snr );
+            }
+        }
+        break;
+    case SIM_RADIO_EVENT_RX_TIMEOUT:
+        if( ( events != NULL ) && ( events->RxTimeout != NULL ) )
+        {
+            events->RxTimeout( );
+        }
+        break;
+    case SIM_RADIO_EVENT_CAD_DONE:
+        if( ( events != NULL ) && ( events->CadDone != NULL ) )
+        {
+            events->CadDone( radio->ChannelBusy );
+        }
+        break;
+    case SIM_RADIO_EVENT_CS_DONE:
+        if( ( events != NULL ) && ( events->CarrierSenseDone != NULL ) )
+        {
+            events->CarrierSenseDone( radio->ChannelBusy == false );
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+const struct Radio_s Radio =
+{
+    RadioInit,
+    RadioGetStatus,
+    RadioSetModem,
+    RadioSetChannel,
+    RadioIsChannelFree,
+    RadioRandom,
+    RadioSetRxConfig,
+    RadioSetTxConfig,
+    RadioCheckRfFrequency,
+    RadioTimeOnAir,
+    RadioSend,
+    RadioSleep,
+    RadioStandby,
+    RadioRx,
+    RadioStartCad,
+    RadioSetTxContinuousWave,
+    RadioRssi,
+    RadioWrite,
+    RadioRead,
+    RadioWriteBuffer,
+    RadioReadBuffer,
+    RadioSetMaxPayloadLength,
+    RadioSetPublicNetwork,
+    RadioGetWakeupTime,
+    RadioIrqProcess,
+    RadioRxBoosted,
+    RadioSetRxDutyCycle,
+    RadioSetRxBuffer,
+    RadioRxSniff,
+    RadioIrqPending,
+    RadioSymbolTime,
+    RadioStartCarrierSense,
+    RadioSetTemperature
+};
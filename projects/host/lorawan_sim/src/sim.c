@@ -0,0 +1,304 @@
+/*!
+ * \file      sim.c
+ *
+ * \brief     Virtual clock and device contexts of the host simulation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "timer.h"
+#include "rtc-board.h"
+#include "sim.h"
+#include "sim-air.h"
+#include "sim-network.h"
+
+/*!
+ * Bounds of the variables of the device code, from device.ld
+ */
+extern uint8_t __start_sim_device[];
+extern uint8_t __stop_sim_device[];
+
+SimOptions_t SimOptions;
+
+SimDeviceStats_t *SimStats = NULL;
+
+uint32_t SimCurrent = 0;
+
+uint32_t SimJoined = 0;
+
+static SimTime_t Now = 0;
+
+static bool Stopped = false;
+
+/*!
+ * Next RTC alarm and radio event of the devices
+ */
+static SimTime_t *Alarm = NULL;
+static SimTime_t *RadioEvent = NULL;
+
+/*!
+ * Devices ordered on their next event, binary min-heap, and the position
+ * of each device in it
+ */
+static uint32_t *Heap = NULL;
+static uint32_t *HeapIndex = NULL;
+
+/*!
+ * Saved device variables, and their image before any initialization
+ */
+static uint8_t *Contexts = NULL;
+static uint8_t *Pristine = NULL;
+static size_t ContextSize = 0;
+
+/*!
+ * Random generator state, xorshift64*
+ */
+static uint64_t RandomState = 1;
+
+static SimTime_t SimNextEvent( uint32_t device )
+{
+    return ( RadioEvent[device] <= Alarm[device] ) ? RadioEvent[device] : Alarm[device];
+}
+
+static void SimHeapSwap( uint32_t a, uint32_t b )
+{
+    uint32_t device = Heap[a];
+
+    Heap[a] = Heap[b];
+    Heap[b] = device;
+    HeapIndex[Heap[a]] = a;
+    HeapIndex[Heap[b]] = b;
+}
+
+/*!
+ * \brief Restores the heap order after the next event of a device changed
+ */
+static void SimHeapUpdate( uint32_t device )
+{
+    uint32_t i = HeapIndex[device];
+    SimTime_t key = SimNextEvent( device );
+
+    while( ( i > 0 ) && ( key < SimNextEvent( Heap[( i - 1 ) / 2] ) ) )
+    {
+        SimHeapSwap( i, ( i - 1 ) / 2 );
+        i = ( i - 1 ) / 2;
+    }
+    for( ;; )
+    {
+        uint32_t child = 2 * i + 1;
+
+        if( child >= SimOptions.Devices )
+        {
+            break;
+        }
+        if( ( ( child + 1 ) < SimOptions.Devices ) &&
+            ( SimNextEvent( Heap[child + 1] ) < SimNextEvent( Heap[child] ) ) )
+        {
+            child++;
+        }
+        if( SimNextEvent( Heap[child] ) >= key )
+        {
+            break;
+        }
+        SimHeapSwap( i, child );
+        i = child;
+    }
+}
+
+static void SimContextSave( uint32_t device )
+{
+    memcpy( Contexts + ( size_t )device * ContextSize, __start_sim_device, ContextSize );
+}
+
+static void SimContextLoad( uint32_t device )
+{
+    memcpy( __start_sim_device, Contexts + ( size_t )device * ContextSize, ContextSize );
+    SimCurrent = device;
+}
+
+int SimInit( void )
+{
+    uint32_t devices = SimOptions.Devices;
+
+    ContextSize = ( size_t )( __stop_sim_device - __start_sim_device );
+    SimStats = calloc( devices, sizeof( SimDeviceStats_t ) );
+    Alarm = malloc( devices * sizeof( SimTime_t ) );
+    RadioEvent = malloc( devices * sizeof( SimTime_t ) );
+    Heap = malloc( devices * sizeof( uint32_t ) );
+    HeapIndex = malloc( devices * sizeof( uint32_t ) );
+    Contexts = malloc( devices * ContextSize );
+    Pristine = malloc( ContextSize );
+    if( ( SimStats == NULL ) || ( Alarm == NULL ) || ( RadioEvent == NULL ) || ( Heap == NULL ) ||
+        ( HeapIndex == NULL ) || ( Contexts == NULL ) || ( Pristine == NULL ) )
+    {
+        SimDeInit( );
+        return -1;
+    }
+
+    Now = 0;
+    Stopped = false;
+    SimJoined = 0;
+    RandomState = ( ( uint64_t )SimOptions.Seed << 1 ) | 1;
+    for( uint32_t i = 0; i < devices; i++ )
+    {
+        SimStats[i].JoinTime = SIM_TIME_NEVER;
+        Alarm[i] = SIM_TIME_NEVER;
+        RadioEvent[i] = SIM_TIME_NEVER;
+        Heap[i] = i;
+        HeapIndex[i] = i;
+    }
+
+    if( ( SimAirInit( devices ) != 0 ) || ( SimNetworkInit( devices ) != 0 ) || ( SimRadioInit( devices ) != 0 ) )
+    {
+        SimDeInit( );
+        return -1;
+    }
+
+    memcpy( Pristine, __start_sim_device, ContextSize );
+    for( uint32_t i = 0; i < devices; i++ )
+    {
+        memcpy( __start_sim_device, Pristine, ContextSize );
+        SimCurrent = i;
+        SimDeviceInit( i );
+        SimHeapUpdate( i );
+        SimContextSave( i );
+    }
+    return 0;
+}
+
+uint64_t SimRun( void )
+{
+    SimTime_t end = SIM_S( SimOptions.Duration );
+    uint64_t events = 0;
+
+    while( Stopped == false )
+    {
+        uint32_t device = Heap[0];
+        SimTime_t time = SimNextEvent( device );
+
+        if( ( time == SIM_TIME_NEVER ) || ( time > end ) )
+        {
+            break;
+        }
+        Now = time;
+        if( device != SimCurrent )
+        {
+            SimContextSave( SimCurrent );
+            SimContextLoad( device );
+        }
+
+        if( RadioEvent[device] <= Alarm[device] )
+        {
+            SimRadioProcess( );
+        }
+        else
+        {
+            Alarm[device] = SIM_TIME_NEVER;
+            TimerIrqHandler( );
+        }
+        SimHeapUpdate( device );
+        events++;
+    }
+    SimContextSave( SimCurrent );
+    return events;
+}
+
+void SimStop( void )
+{
+    Stopped = true;
+}
+
+void SimDeInit( void )
+{
+    SimAirDeInit( );
+    SimNetworkDeInit( );
+    SimRadioDeInit( );
+    free( SimStats );
+    free( Alarm );
+    free( RadioEvent );
+    free( Heap );
+    free( HeapIndex );
+    free( Contexts );
+    free( Pristine );
+    SimStats = NULL;
+    Alarm = NULL;
+    RadioEvent = NULL;
+    Heap = NULL;
+    HeapIndex = NULL;
+    Contexts = NULL;
+    Pristine = NULL;
+}
+
+SimTime_t SimNow( void )
+{
+    return Now;
+}
+
+void SimSetAlarm( SimTime_t time )
+{
+    Alarm[SimCurrent] = time;
+}
+
+void SimSetRadioEvent( SimTime_t time )
+{
+    RadioEvent[SimCurrent] = time;
+}
+
+uint32_t SimRandom( void )
+{
+    RandomState ^= RandomState >> 12;
+    RandomState ^= RandomState << 25;
+    RandomState ^= RandomState >> 27;
+    return ( uint32_t )( ( RandomState * 0x2545F4914F6CDD1DULL ) >> 32 );
+}
+
+float SimUniform( void )
+{
+    return ( SimRandom( ) >> 8 ) * ( 1.0f / 16777216.0f );
+}
+
+float SimGaussian( void )
+{
+    float u = SimUniform( );
+    float v = SimUniform( );
+
+    // Box-Muller
+    return sqrtf( -2.0f * logf( 1.0f - u ) ) * cosf( 6.2831853f * v );
+}
+
+/*!
+ * RTC of the device code, on the virtual clock
+ */
+void RtcSetTimeout( uint32_t timeout )
+{
+    SimSetAlarm( Now + SIM_MS( timeout ) );
+}
+
+void RtcStopTimeout( void )
+{
+    SimSetAlarm( SIM_TIME_NEVER );
+}
+
+TimerTime_t RtcGetTimerValue( void )
+{
+    return ( TimerTime_t )( Now / 1000 );
+}
+
+TimerTime_t RtcTempCompensation( TimerTime_t period, float temperature )
+{
+    return period;
+}
+
+void RtcEnterLowPowerStopMode( void )
+{
+}
+
+void BoardDisableIrq( void )
+{
+}
+
+void BoardEnableIrq( void )
+{
+}